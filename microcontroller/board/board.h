@@ -15,6 +15,7 @@
 #ifndef BOARD_H
 #define BOARD_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
@@ -27,9 +28,46 @@ int board_uart_byte_available(void);
 /* Get the next uart byte; should only be called in board_uart_byte_available() returns true. */
 uint8_t board_uart_get_byte(void);
 
+/* Get the number of uart bytes taken with board_uart_get_byte() so far; wraps around at 2^32. */
+uint32_t board_uart_rx_taken(void);
+
+/* Get how many uart bytes can come in after the ones taken so far before any are lost. */
+size_t board_uart_rx_capacity(void);
+
+/* Set a function to be called from interrupt context when uart bytes have come in; NULL to stop calling it. */
+void board_uart_set_rx_callback(void (*callback)(void));
+
 /* Send a series of bytes to the serial port.  Returns after all bytes are queued, but not necessarily sent. */
 void board_uart_send_bytes(uint8_t *bytes, size_t size);
 
+/* Get size contiguous bytes of the transmit queue to write into directly, waiting until there is room.  Returns NULL if size is larger than the queue can ever hold.  Nothing is sent until board_uart_tx_commit() is called. */
+uint8_t *board_uart_tx_reserve(size_t size);
+
+/* Queue the first size bytes of the space got from board_uart_tx_reserve() to be sent. */
+void board_uart_tx_commit(size_t size);
+
+/* Hold the queued bytes back (hold true), or let them go again (hold false); a transfer that has already started is finished either way. */
+void board_uart_tx_hold(bool hold);
+
+/* Compute the CRC-16 (poly 0x8005, reflected, starting from 0; the same as the bridge's) of len bytes with the CRC unit.  May be called from any task. */
+uint16_t board_crc16(const uint8_t *buffer, size_t len);
+
+/* Get the DWT cycle counter, which counts CPU cycles and wraps around at 2^32. */
+uint32_t board_cycle_count(void);
+
+/* Get the CPU clock in Hz, at which board_cycle_count() counts. */
+uint32_t board_core_hz(void);
+
+/* Called by the FreeRTOS tickless idle just before the core sleeps and as
+   soon as it wakes up (configPRE_SLEEP_PROCESSING and
+   configPOST_SLEEP_PROCESSING), with interrupts disabled. */
+void board_pre_sleep(void);
+void board_post_sleep(void);
+
+/* Get how many times the core woke up from sleep, and how many cycles it
+   spent awake, since the last call.  Call with the scheduler suspended. */
+void board_sleep_stats(uint32_t *wakeups, uint64_t *awake_cycles);
+
 /* Toggle the liveliness LED. */
 void board_toggle_liveliness_led(void);
 
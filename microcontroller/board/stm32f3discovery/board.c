@@ -12,18 +12,72 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "libopencmsis/core_cm3.h"
+#include "libopencm3/cm3/cortex.h"
 #include "libopencm3/cm3/scb.h"
+#include "libopencm3/cm3/scs.h"
 #include "libopencm3/stm32/gpio.h"
+#include "libopencm3/stm32/memorymap.h"
 #include "libopencm3/stm32/f3/nvic.h"
 #include "libopencm3/stm32/rcc.h"
 #include "libopencm3/stm32/usart.h"
 
 #define __NOP() __asm__("nop")
 
+/* The baudrate of USART1; override it with 'make UART_BAUDRATE=...'.  With
+ * the 64MHz APB2 clock and 16x oversampling, up to 4Mbaud can be reached. */
+#ifndef BOARD_UART_BAUDRATE
+#define BOARD_UART_BAUDRATE 115200
+#endif
+
+#if BOARD_UART_BAUDRATE > 4000000
+#error "BOARD_UART_BAUDRATE must be at most 4000000"
+#endif
+
+/* The vendored libopencm3 doesn't include the DMA driver, so the few DMA1
+ * registers used here are defined directly; see RM0316, section 13.6. */
+#define DMA1_ISR                 MMIO32(DMA1_BASE + 0x00)
+#define DMA1_IFCR                MMIO32(DMA1_BASE + 0x04)
+#define DMA1_CCR(channel)        MMIO32(DMA1_BASE + 0x08 + 0x14 * ((channel) - 1))
+#define DMA1_CNDTR(channel)      MMIO32(DMA1_BASE + 0x0C + 0x14 * ((channel) - 1))
+#define DMA1_CPAR(channel)       MMIO32(DMA1_BASE + 0x10 + 0x14 * ((channel) - 1))
+#define DMA1_CMAR(channel)       MMIO32(DMA1_BASE + 0x14 + 0x14 * ((channel) - 1))
+
+#define DMA_CCR_EN               (1 << 0)
+#define DMA_CCR_TCIE             (1 << 1)
+#define DMA_CCR_HTIE             (1 << 2)
+#define DMA_CCR_DIR              (1 << 4)
+#define DMA_CCR_CIRC             (1 << 5)
+#define DMA_CCR_MINC             (1 << 7)
+#define DMA_CCR_PL_HIGH          (2 << 12)
+
+/* The interrupt flags of a channel in DMA1_ISR, and their clear bits in
+ * DMA1_IFCR. */
+#define DMA_GIF(channel)         (1 << (4 * ((channel) - 1)))
+#define DMA_TCIF(channel)        (2 << (4 * ((channel) - 1)))
+#define DMA_HTIF(channel)        (4 << (4 * ((channel) - 1)))
+
+/* Nor the CRC driver; see RM0316, section 6.4. */
+#define CRC_DR                   MMIO32(CRC_BASE + 0x00)
+#define CRC_DR8                  MMIO8(CRC_BASE + 0x00)
+#define CRC_CR                   MMIO32(CRC_BASE + 0x08)
+#define CRC_INIT                 MMIO32(CRC_BASE + 0x10)
+#define CRC_POL                  MMIO32(CRC_BASE + 0x14)
+
+#define CRC_CR_RESET             (1 << 0)
+#define CRC_CR_POLYSIZE_16       (1 << 3)
+#define CRC_CR_REV_IN_BYTE       (1 << 5)
+#define CRC_CR_REV_IN_WORD       (3 << 5)
+
+/* On the STM32F3, USART1 TX and RX are hardwired to DMA1 channels 4 and 5. */
+#define USART1_TX_DMA_CHANNEL    4
+#define USART1_RX_DMA_CHANNEL    5
+
 /* This is necessary for libc to link properly; its just empty for us */
 void _init(void)
 {
@@ -37,6 +91,23 @@ static void clock_setup(void)
   rcc_periph_clock_enable(RCC_GPIOB);
   rcc_periph_clock_enable(RCC_GPIOE);
   rcc_periph_clock_enable(RCC_USART1);
+  rcc_periph_clock_enable(RCC_DMA1);
+  rcc_periph_clock_enable(RCC_CRC);
+}
+
+static void crc_setup(void)
+{
+  /* The CRC-16 of the frames: poly 0x8005, starting from 0. */
+  CRC_POL = 0x8005;
+  CRC_INIT = 0;
+}
+
+static void cycle_counter_setup(void)
+{
+  /* The DWT is part of the debug unit, which has to be turned on first. */
+  SCS_DEMCR |= SCS_DEMCR_TRCENA;
+  SCS_DWT_CYCCNT = 0;
+  SCS_DWT_CTRL |= SCS_DWT_CTRL_CYCCNTENA;
 }
 
 #define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
@@ -47,10 +118,21 @@ struct nvic_irq
   uint8_t priority;
 };
 
+/* Only the top 4 bits of the priority are implemented.  These are below
+ * configMAX_SYSCALL_INTERRUPT_PRIORITY, so the UART receive callback can
+ * use the FreeRTOS FromISR functions. */
 static struct nvic_irq irqs[] = {
   {
     .irqn = NVIC_USART1_EXTI25_IRQ,
-    .priority = 12,
+    .priority = 12 << 4,
+  },
+  {
+    .irqn = NVIC_DMA1_CHANNEL4_IRQ,
+    .priority = 12 << 4,
+  },
+  {
+    .irqn = NVIC_DMA1_CHANNEL5_IRQ,
+    .priority = 12 << 4,
   },
 };
 
@@ -85,105 +167,224 @@ static void led_setup(void)
   gpio_clear(GPIOE, GPIO12);
 }
 
+/* Bytes to send are queued here, and DMA1 channel 4 sends the contiguous
+ * bytes at the tail of the queue in one transfer, starting the next one from
+ * its transfer complete interrupt.  A reservation that doesn't fit at the
+ * end of the queue starts over at its beginning, and uartTxEnd marks where
+ * the queued bytes stop until the tail wraps past it. */
 #define USART1_TX_Q_SIZE 512
-static uint16_t uartTxQSize = USART1_TX_Q_SIZE;
 static uint8_t uartTxQueue[USART1_TX_Q_SIZE];
-static uint16_t uartTxHead;
-static uint16_t uartTxTail;
-
-#define USART1_RX_Q_SIZE 512
+static volatile uint16_t uartTxHead;
+static volatile uint16_t uartTxTail;
+static volatile uint16_t uartTxEnd = USART1_TX_Q_SIZE;
+static volatile uint16_t uartTxDmaLen;
+static volatile bool uartTxHeld;
+
+/* DMA1 channel 5 receives into this queue in circular mode, so the head is
+ * wherever the DMA is, and no interrupt is taken per byte.  If the bytes
+ * aren't taken out before the DMA comes around again, they are overwritten. */
+#define USART1_RX_Q_SIZE 1024
 static uint8_t uartRxQueue[USART1_RX_Q_SIZE];
-static uint16_t uartRxHead;
 static uint16_t uartRxTail;
+static uint32_t uartRxTaken;
+
+static void (*uartRxCallback)(void);
 
-static void usart_enable_tx_complete_interrupt(uint32_t usart)
+/* Start sending the next contiguous bytes of the queue, if there are any
+ * and no transfer is running; must be called with interrupts masked. */
+static void usart1_tx_dma_start(void)
 {
-  USART_CR1(usart) |= USART_CR1_TCIE;
+  uint16_t head = uartTxHead;
+  uint16_t tail = uartTxTail;
+  uint16_t len;
+
+  if (uartTxDmaLen != 0 || head == tail || uartTxHeld) {
+    return;
+  }
+
+  len = (head > tail) ? head - tail : uartTxEnd - tail;
+
+  DMA1_CCR(USART1_TX_DMA_CHANNEL) &= ~DMA_CCR_EN;
+  DMA1_CMAR(USART1_TX_DMA_CHANNEL) = (uint32_t)&uartTxQueue[tail];
+  DMA1_CNDTR(USART1_TX_DMA_CHANNEL) = len;
+  uartTxDmaLen = len;
+  DMA1_CCR(USART1_TX_DMA_CHANNEL) |= DMA_CCR_EN;
 }
 
-static void usart_disable_tx_complete_interrupt(uint32_t usart)
+static void usart1_send_bytes(const uint8_t *data, size_t num)
 {
-  USART_CR1(usart) &= ~USART_CR1_TCIE;
+  while (num) {
+    uint32_t masked;
+
+    /* Queue as much as fits, and wait for the DMA to make room for the rest. */
+    while (num) {
+      uint16_t next_head = (uartTxHead + 1) % USART1_TX_Q_SIZE;
+      if (next_head == uartTxTail) {
+        break;
+      }
+
+      uartTxQueue[uartTxHead] = *data++;
+      num--;
+
+      uartTxHead = next_head;
+    }
+
+    masked = cm_mask_interrupts(1);
+    usart1_tx_dma_start();
+    cm_mask_interrupts(masked);
+  }
 }
 
-static uint8_t usart1_send_bytes(const uint8_t *data, uint8_t num)
+static uint8_t *usart1_tx_reserve(size_t size)
 {
-  uint8_t result = 0;
+  if (size >= USART1_TX_Q_SIZE) {
+    return NULL;
+  }
 
-  while (num) {
-    uint16_t next_head = (uartTxHead + 1) % uartTxQSize;
-    if (next_head == uartTxTail) {
-      break;
+  while (1) {
+    uint32_t masked = cm_mask_interrupts(1);
+    uint16_t head = uartTxHead;
+    uint16_t tail = uartTxTail;
+    uint8_t *space = NULL;
+
+    if (head == tail) {
+      /* Empty, so start at the beginning where everything fits. */
+      uartTxHead = uartTxTail = 0;
+      uartTxEnd = USART1_TX_Q_SIZE;
+      space = &uartTxQueue[0];
+    } else if (head > tail) {
+      /* The head must not catch up with the tail, or the queue looks empty. */
+      if ((size_t)(USART1_TX_Q_SIZE - head - (tail == 0 ? 1 : 0)) >= size) {
+        space = &uartTxQueue[head];
+      } else if (tail > size) {
+        uartTxEnd = head;
+        uartTxHead = 0;
+        space = &uartTxQueue[0];
+      }
+    } else if ((size_t)(tail - head) > size) {
+      space = &uartTxQueue[head];
     }
 
-    uartTxQueue[uartTxHead] = *data++;
-    num--;
-    result++;
+    cm_mask_interrupts(masked);
 
-    uartTxHead = next_head;
+    if (space != NULL) {
+      return space;
+    }
   }
+}
 
-  usart_enable_tx_complete_interrupt(USART1);
+static void usart1_tx_commit(size_t size)
+{
+  uint32_t masked;
 
-  return result;
+  uartTxHead = (uartTxHead + size) % USART1_TX_Q_SIZE;
+
+  masked = cm_mask_interrupts(1);
+  usart1_tx_dma_start();
+  cm_mask_interrupts(masked);
 }
 
-void usart1_exti25_isr(void)
+void dma1_channel4_isr(void)
 {
-  if (usart_get_flag(USART1, USART_FLAG_RXNE)) {
-    uint8_t b = usart_recv_blocking(USART1) & 0xff;
-    if (((uartRxHead + 1) == uartRxTail) || ((uartRxHead == (USART1_RX_Q_SIZE - 1)) && (uartRxTail == 0))) {
-      __NOP();
-    } else {
-      uartRxQueue[uartRxHead++] = b;
-      if (uartRxHead == USART1_RX_Q_SIZE) {
-        uartRxHead = 0;
-      }
+  if (DMA1_ISR & DMA_TCIF(USART1_TX_DMA_CHANNEL)) {
+    DMA1_IFCR = DMA_GIF(USART1_TX_DMA_CHANNEL);
+
+    uartTxTail += uartTxDmaLen;
+    if (uartTxTail == uartTxEnd) {
+      uartTxTail = 0;
+      uartTxEnd = USART1_TX_Q_SIZE;
     }
+    uartTxDmaLen = 0;
+    usart1_tx_dma_start();
   }
+}
 
-  if (usart_get_flag(USART1, USART_FLAG_TC)) {
-    if (uartTxTail != uartTxHead) {
-      usart_send(USART1, uartTxQueue[uartTxTail++]);
-      if (uartTxTail == uartTxQSize) {
-        uartTxTail = 0;
-      }
-    } else {
-      usart_disable_tx_complete_interrupt(USART1);
+void dma1_channel5_isr(void)
+{
+  /* Half and full transfer; wake the consumer so the queue is emptied before
+   * the DMA comes around to the same place again. */
+  DMA1_IFCR = DMA_GIF(USART1_RX_DMA_CHANNEL);
+
+  if (uartRxCallback != NULL) {
+    uartRxCallback();
+  }
+}
+
+void usart1_exti25_isr(void)
+{
+  /* The line went idle after some bytes, which is usually the end of a
+   * message, so hand over what has been received so far. */
+  if (usart_get_flag(USART1, USART_FLAG_IDLE)) {
+    USART_ICR(USART1) = USART_ICR_IDLECF;
+
+    if (uartRxCallback != NULL) {
+      uartRxCallback();
     }
   }
 }
 
+static void usart1_dma_setup(void)
+{
+  /* TX: memory to peripheral, one transfer per contiguous run of the queue. */
+  DMA1_CCR(USART1_TX_DMA_CHANNEL) = 0;
+  DMA1_CPAR(USART1_TX_DMA_CHANNEL) = (uint32_t)&USART_TDR(USART1);
+  DMA1_CCR(USART1_TX_DMA_CHANNEL) = DMA_CCR_DIR | DMA_CCR_MINC | DMA_CCR_TCIE | DMA_CCR_PL_HIGH;
+
+  /* RX: peripheral to memory, circular over the whole queue. */
+  DMA1_CCR(USART1_RX_DMA_CHANNEL) = 0;
+  DMA1_CPAR(USART1_RX_DMA_CHANNEL) = (uint32_t)&USART_RDR(USART1);
+  DMA1_CMAR(USART1_RX_DMA_CHANNEL) = (uint32_t)uartRxQueue;
+  DMA1_CNDTR(USART1_RX_DMA_CHANNEL) = USART1_RX_Q_SIZE;
+  DMA1_CCR(USART1_RX_DMA_CHANNEL) = DMA_CCR_MINC | DMA_CCR_CIRC | DMA_CCR_HTIE | DMA_CCR_TCIE | DMA_CCR_PL_HIGH;
+  DMA1_CCR(USART1_RX_DMA_CHANNEL) |= DMA_CCR_EN;
+}
+
 static void usart1_setup(void)
 {
-  /* Configure USART Tx and Rx as alternate function push-pull */
+  /* Configure USART Tx and Rx as alternate function push-pull; at Mbaud
+   * rates the edges need a faster output than 2MHz. */
   gpio_mode_setup(GPIOB, GPIO_MODE_AF, GPIO_PUPD_NONE, GPIO6);
-  gpio_set_output_options(GPIOB, GPIO_OTYPE_PP, GPIO_OSPEED_2MHZ, GPIO6);
+  gpio_set_output_options(GPIOB, GPIO_OTYPE_PP, GPIO_OSPEED_50MHZ, GPIO6);
 
   gpio_mode_setup(GPIOB, GPIO_MODE_AF, GPIO_PUPD_NONE, GPIO7);
-  gpio_set_output_options(GPIOB, GPIO_OTYPE_PP, GPIO_OSPEED_2MHZ, GPIO7);
+  gpio_set_output_options(GPIOB, GPIO_OTYPE_PP, GPIO_OSPEED_50MHZ, GPIO7);
 
   gpio_set_af(GPIOB, GPIO_AF7, GPIO6);
   gpio_set_af(GPIOB, GPIO_AF7, GPIO7);
 
   usart_disable(USART1);
 
-  usart_set_baudrate(USART1, 115200);
+  usart_set_baudrate(USART1, BOARD_UART_BAUDRATE);
   usart_set_databits(USART1, 8);
   usart_set_stopbits(USART1, USART_STOPBITS_1);
   usart_set_parity(USART1, USART_PARITY_NONE);
   usart_set_flow_control(USART1, USART_FLOWCONTROL_NONE);
   usart_set_mode(USART1, USART_MODE_TX_RX);
 
+  /* An overrun would otherwise stop reception until it is cleared; with DMA
+   * it can only happen if the DMA is starved, and a lost byte is caught by
+   * the CRC anyway. */
+  USART_CR3(USART1) |= USART_CR3_OVRDIS;
+
+  usart1_dma_setup();
+  usart_enable_rx_dma(USART1);
+  usart_enable_tx_dma(USART1);
+
   /* Enable USART */
   usart_enable(USART1);
 
-  usart_enable_rx_interrupt(USART1);
+  USART_CR1(USART1) |= USART_CR1_IDLEIE;
 }
 
 int board_uart_byte_available(void)
 {
-  return uartRxHead != uartRxTail;
+  uint16_t head = USART1_RX_Q_SIZE - DMA1_CNDTR(USART1_RX_DMA_CHANNEL);
+
+  if (head == USART1_RX_Q_SIZE) {
+    head = 0;
+  }
+
+  return head != uartRxTail;
 }
 
 uint8_t board_uart_get_byte(void)
@@ -193,15 +394,127 @@ uint8_t board_uart_get_byte(void)
   if (uartRxTail == USART1_RX_Q_SIZE) {
     uartRxTail = 0;
   }
+  uartRxTaken++;
 
   return byte;
 }
 
+uint32_t board_uart_rx_taken(void)
+{
+  return uartRxTaken;
+}
+
+size_t board_uart_rx_capacity(void)
+{
+  /* The DMA doesn't know where the tail is, so it overwrites bytes that
+   * haven't been taken once it laps it; and a full queue would look empty. */
+  return USART1_RX_Q_SIZE - 1;
+}
+
+void board_uart_set_rx_callback(void (*callback)(void))
+{
+  uartRxCallback = callback;
+}
+
 void board_uart_send_bytes(uint8_t *bytes, size_t size)
 {
   usart1_send_bytes(bytes, size);
 }
 
+uint8_t *board_uart_tx_reserve(size_t size)
+{
+  return usart1_tx_reserve(size);
+}
+
+void board_uart_tx_commit(size_t size)
+{
+  usart1_tx_commit(size);
+}
+
+void board_uart_tx_hold(bool hold)
+{
+  uint32_t masked = cm_mask_interrupts(1);
+
+  uartTxHeld = hold;
+  usart1_tx_dma_start();
+  cm_mask_interrupts(masked);
+}
+
+uint16_t board_crc16(const uint8_t *buffer, size_t len)
+{
+  uint32_t masked;
+  uint32_t word;
+  uint32_t crc;
+
+  /* The unit holds one CRC at a time, so nothing else may use it until this
+   * one is done; it takes a cycle per byte. */
+  masked = cm_mask_interrupts(1);
+
+  /* The CRC is reflected, so each byte goes in low bit first.  The unit
+   * takes the data register high bit first, so whole words are reversed,
+   * which puts their first byte in memory first too, and the bytes left
+   * over are reversed one at a time.  Changing the reversal doesn't reset
+   * the CRC. */
+  CRC_CR = CRC_CR_POLYSIZE_16 | CRC_CR_REV_IN_WORD | CRC_CR_RESET;
+  for (; len >= sizeof(word); len -= sizeof(word), buffer += sizeof(word)) {
+    memcpy(&word, buffer, sizeof(word));
+    CRC_DR = word;
+  }
+  CRC_CR = CRC_CR_POLYSIZE_16 | CRC_CR_REV_IN_BYTE;
+  while (len-- != 0) {
+    CRC_DR8 = *buffer++;
+  }
+  crc = CRC_DR;
+
+  cm_mask_interrupts(masked);
+
+  /* Reflect the result as well, here rather than with the unit's output
+   * reversal, which doesn't say how it treats a 16-bit polynomial. */
+  __asm__("rbit %0, %1" : "=r"(crc) : "r"(crc));
+  return (uint16_t)(crc >> 16);
+}
+
+uint32_t board_cycle_count(void)
+{
+  return SCS_DWT_CYCCNT;
+}
+
+uint32_t board_core_hz(void)
+{
+  return rcc_ahb_frequency;
+}
+
+/* The time awake is only counted between waking up and going back to sleep,
+   so it doesn't matter whether the cycle counter runs while the core
+   sleeps. */
+static uint32_t sleepWakeups;
+static uint64_t awakeCycles;
+static uint32_t awakeSince;
+
+void board_pre_sleep(void)
+{
+  awakeCycles += board_cycle_count() - awakeSince;
+}
+
+void board_post_sleep(void)
+{
+  sleepWakeups++;
+  awakeSince = board_cycle_count();
+}
+
+void board_sleep_stats(uint32_t *wakeups, uint64_t *awake_cycles)
+{
+  uint32_t now;
+
+  /* The idle task, the only one that sleeps, can't run in the meantime. */
+  now = board_cycle_count();
+  *wakeups = sleepWakeups;
+  *awake_cycles = awakeCycles + (now - awakeSince);
+  sleepWakeups = 0;
+  awakeCycles = 0;
+  awakeSince = now;
+}
+
 void board_toggle_liveliness_led(void)
 {
   gpio_toggle(GPIOE, GPIO11);     /* LED on/off */
@@ -231,6 +544,10 @@ void board_init(void)
 
   clock_setup();
 
+  cycle_counter_setup();
+
+  crc_setup();
+
   nvic_setup();
 
   led_setup();
@@ -95,6 +95,20 @@
 #endif
 
 #define configUSE_PREEMPTION			1
+/* With ROS2SERIAL_TICKLESS_IDLE set to 1, the tick is stopped while no task
+ * is ready to run, and the core sleeps until the next one is due or an
+ * interrupt (like the uart's) wakes it up; the board counts the wakeups and
+ * the time awake.
+ */
+#ifndef ROS2SERIAL_TICKLESS_IDLE
+#define ROS2SERIAL_TICKLESS_IDLE		0
+#endif
+#define configUSE_TICKLESS_IDLE			ROS2SERIAL_TICKLESS_IDLE
+#define configEXPECTED_IDLE_TIME_BEFORE_SLEEP	2
+void board_pre_sleep(void);
+void board_post_sleep(void);
+#define configPRE_SLEEP_PROCESSING(x)		board_pre_sleep()
+#define configPOST_SLEEP_PROCESSING(x)		board_post_sleep()
 #define configUSE_IDLE_HOOK			0
 #define configUSE_TICK_HOOK			0
 #define configCPU_CLOCK_HZ			( 64000000 )
@@ -17,6 +17,9 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 
+#include "ros2serial/ros2serial.h"
+#include "ros2serial/ros2serial_types.h"
+
 #include "ucdr/microcdr.h"
 
 void vApplicationStackOverflowHook(xTaskHandle pxTask, signed char *pcTaskName)
@@ -41,178 +44,191 @@ static void blinky_task(void *arg)
   }
 }
 
-// This function decodes length bytes of data at the location pointed to by
-// ptr, writing the output to the location pointed to by dst.  The amount of
-// memory needed by dst is guaranteed to be <= length.
-//
-// Returns the length of the decoded data.
-size_t cobs_unstuff_data(const uint8_t *ptr, size_t length, uint8_t *dst)
-{
-    const uint8_t *start = dst;
-    const uint8_t *end = ptr + length;
-    uint8_t code = 0xff;
-    uint8_t copy = 0;
-
-    for (; ptr < end; copy--)
-    {
-        if (copy != 0)
-        {
-            *dst++ = *ptr++;
-        }
-        else
-        {
-            if (code != 0xff)
-            {
-                *dst++ = 0;
-            }
-            copy = code = *ptr++;
-            if (code == 0)
-            {
-                break;  // source length too long
-            }
-        }
-    }
+static std_msgs_String msg;
+static uint8_t txBuffer[STD_MSGS_STRING_MAX_SIZE];
 
-    return dst - start;
-}
-
-/** CRC table for the CRC-16. The poly is 0x8005 (x^16 + x^15 + x^2 + 1) */
-static uint16_t const crc16_table[256] = {
-    0x0000, 0xC0C1, 0xC181, 0x0140, 0xC301, 0x03C0, 0x0280, 0xC241,
-    0xC601, 0x06C0, 0x0780, 0xC741, 0x0500, 0xC5C1, 0xC481, 0x0440,
-    0xCC01, 0x0CC0, 0x0D80, 0xCD41, 0x0F00, 0xCFC1, 0xCE81, 0x0E40,
-    0x0A00, 0xCAC1, 0xCB81, 0x0B40, 0xC901, 0x09C0, 0x0880, 0xC841,
-    0xD801, 0x18C0, 0x1980, 0xD941, 0x1B00, 0xDBC1, 0xDA81, 0x1A40,
-    0x1E00, 0xDEC1, 0xDF81, 0x1F40, 0xDD01, 0x1DC0, 0x1C80, 0xDC41,
-    0x1400, 0xD4C1, 0xD581, 0x1540, 0xD701, 0x17C0, 0x1680, 0xD641,
-    0xD201, 0x12C0, 0x1380, 0xD341, 0x1100, 0xD1C1, 0xD081, 0x1040,
-    0xF001, 0x30C0, 0x3180, 0xF141, 0x3300, 0xF3C1, 0xF281, 0x3240,
-    0x3600, 0xF6C1, 0xF781, 0x3740, 0xF501, 0x35C0, 0x3480, 0xF441,
-    0x3C00, 0xFCC1, 0xFD81, 0x3D40, 0xFF01, 0x3FC0, 0x3E80, 0xFE41,
-    0xFA01, 0x3AC0, 0x3B80, 0xFB41, 0x3900, 0xF9C1, 0xF881, 0x3840,
-    0x2800, 0xE8C1, 0xE981, 0x2940, 0xEB01, 0x2BC0, 0x2A80, 0xEA41,
-    0xEE01, 0x2EC0, 0x2F80, 0xEF41, 0x2D00, 0xEDC1, 0xEC81, 0x2C40,
-    0xE401, 0x24C0, 0x2580, 0xE541, 0x2700, 0xE7C1, 0xE681, 0x2640,
-    0x2200, 0xE2C1, 0xE381, 0x2340, 0xE101, 0x21C0, 0x2080, 0xE041,
-    0xA001, 0x60C0, 0x6180, 0xA141, 0x6300, 0xA3C1, 0xA281, 0x6240,
-    0x6600, 0xA6C1, 0xA781, 0x6740, 0xA501, 0x65C0, 0x6480, 0xA441,
-    0x6C00, 0xACC1, 0xAD81, 0x6D40, 0xAF01, 0x6FC0, 0x6E80, 0xAE41,
-    0xAA01, 0x6AC0, 0x6B80, 0xAB41, 0x6900, 0xA9C1, 0xA881, 0x6840,
-    0x7800, 0xB8C1, 0xB981, 0x7940, 0xBB01, 0x7BC0, 0x7A80, 0xBA41,
-    0xBE01, 0x7EC0, 0x7F80, 0xBF41, 0x7D00, 0xBDC1, 0xBC81, 0x7C40,
-    0xB401, 0x74C0, 0x7580, 0xB541, 0x7700, 0xB7C1, 0xB681, 0x7640,
-    0x7200, 0xB2C1, 0xB381, 0x7340, 0xB101, 0x71C0, 0x7080, 0xB041,
-    0x5000, 0x90C1, 0x9181, 0x5140, 0x9301, 0x53C0, 0x5280, 0x9241,
-    0x9601, 0x56C0, 0x5780, 0x9741, 0x5500, 0x95C1, 0x9481, 0x5440,
-    0x9C01, 0x5CC0, 0x5D80, 0x9D41, 0x5F00, 0x9FC1, 0x9E81, 0x5E40,
-    0x5A00, 0x9AC1, 0x9B81, 0x5B40, 0x9901, 0x59C0, 0x5880, 0x9841,
-    0x8801, 0x48C0, 0x4980, 0x8941, 0x4B00, 0x8BC1, 0x8A81, 0x4A40,
-    0x4E00, 0x8EC1, 0x8F81, 0x4F40, 0x8D01, 0x4DC0, 0x4C80, 0x8C41,
-    0x4400, 0x84C1, 0x8581, 0x4540, 0x8701, 0x47C0, 0x4680, 0x8641,
-    0x8201, 0x42C0, 0x4380, 0x8341, 0x4100, 0x81C1, 0x8081, 0x4040
-};
+#define CHATTER_TOPIC_ID 9
+#define ANOTHER_TOPIC_ID 13
 
-uint16_t crc16_byte(uint16_t crc, uint8_t data)
+// Every string that comes in on "another" is sent back out on "chatter".
+static void another_handler(topic_id_size_t topic_ID, ucdrBuffer *reader, void *arg)
 {
-  return (crc >> 8U) ^ crc16_table[(uint8_t)crc ^ data];
-}
+  ucdrBuffer writer;
 
-uint16_t crc16(uint8_t const *buffer, size_t len)
-{
-  uint16_t crc = 0;
+  (void)topic_ID;
+  (void)arg;
 
-  while ((len--) != 0) {
-    crc = crc16_byte(crc, *buffer++);
+  if (!ucdr_deserialize_std_msgs_String(reader, &msg)) {
+    return;
   }
 
-  return crc;
+  ucdr_init_buffer(&writer, txBuffer, sizeof(txBuffer));
+  if (ucdr_serialize_std_msgs_String(&writer, &msg)) {
+    ros2serial_publish(CHATTER_TOPIC_ID, txBuffer, ucdr_buffer_length(&writer));
+  }
+
+  board_toggle_spare_led();
 }
 
-#define MSG_BUFFER_SIZE 512
-static uint8_t msgBuffer[MSG_BUFFER_SIZE];
-static uint16_t msgBufferPtr;
+static const struct ros2serial_topic topics[] = {
+  { "chatter", STD_MSGS_STRING_TYPE_NAME, CHATTER_TOPIC_ID, ROS2SERIAL_SERIALTOROS2, NULL, NULL, STD_MSGS_STRING_TYPE_HASH },
+  { "another", STD_MSGS_STRING_TYPE_NAME, ANOTHER_TOPIC_ID, ROS2SERIAL_ROS2TOSERIAL, another_handler, NULL, STD_MSGS_STRING_TYPE_HASH },
+};
 
-// When unstuffing COBS, we know that it can't be larger than the original.
-static uint8_t cobsBuffer[MSG_BUFFER_SIZE];
+static TaskHandle_t serialTaskHandle;
 
-typedef uint8_t topic_id_size_t;
-struct __attribute__((packed)) COBSHeader
+// Called by the board when uart bytes have come in; wakes up serial_task so
+// it can take them out before the receive queue fills up.
+static void serial_rx_callback(void)
 {
-  topic_id_size_t topic_ID;
-  uint8_t payload_len_h;
-  uint8_t payload_len_l;
-  uint8_t crc_h;
-  uint8_t crc_l;
-};
+  BaseType_t woken = pdFALSE;
+
+  vTaskNotifyGiveFromISR(serialTaskHandle, &woken);
+  portYIELD_FROM_ISR(woken);
+}
+
+// The bridge is told how much room there is in the receive queue as soon as
+// a quarter of it was taken, once the line has been quiet for
+// CREDITS_PERIOD_MS, and every CREDITS_IDLE_MS anyway, so a bridge with
+// flow_control set can start (or start again after this end was reset).
+#define CREDITS_PERIOD_MS 50
+#define CREDITS_IDLE_MS 500
+
+// How often the profile is sent, when built with PROFILE=1.
+#define PROFILE_PERIOD_MS 1000
 
 static void serial_task(void *arg)
 {
-  uint8_t byte;
+  uint32_t advertised = 0;
+  uint32_t taken;
+  uint32_t window;
+  uint32_t notified;
+  TickType_t lastSent;
+  TickType_t now;
+  TickType_t wait;
+#if ROS2SERIAL_PROFILE
+  TickType_t lastProfile;
+#endif
 
   (void)arg;
 
+  window = board_uart_rx_capacity();
+  lastSent = xTaskGetTickCount() - MS_TO_TICKS(CREDITS_IDLE_MS);
+#if ROS2SERIAL_PROFILE
+  lastProfile = xTaskGetTickCount();
+#endif
+
   while (1) {
+    // Once everything taken out of the receive queue has been granted
+    // again, nothing is due until the next idle credits (or profile), so on
+    // an idle link the task, and with TICKLESS_IDLE the core, sleeps until
+    // then rather than waking up every CREDITS_PERIOD_MS.
+    wait = MS_TO_TICKS(CREDITS_PERIOD_MS);
+    now = xTaskGetTickCount();
+    if (board_uart_rx_taken() == advertised) {
+      wait = now - lastSent < MS_TO_TICKS(CREDITS_IDLE_MS) ? lastSent + MS_TO_TICKS(CREDITS_IDLE_MS) - now : 0;
+    }
+#if ROS2SERIAL_PROFILE
+    if (now - lastProfile >= MS_TO_TICKS(PROFILE_PERIOD_MS)) {
+      wait = 0;
+    } else if (lastProfile + MS_TO_TICKS(PROFILE_PERIOD_MS) - now < wait) {
+      wait = lastProfile + MS_TO_TICKS(PROFILE_PERIOD_MS) - now;
+    }
+#endif
+
+    // Sleep until the board says more bytes came in.  Every burst of bytes
+    // ends with an idle line interrupt, and a notification given while we
+    // are still draining the queue is kept, so nothing is left behind.
+    notified = ulTaskNotifyTake(pdTRUE, wait);
+
     while (board_uart_byte_available()) {
-      // data available in the RX queue
-      byte = board_uart_get_byte();
-
-      msgBuffer[msgBufferPtr++] = byte;
-
-      if (byte == 0x0) {
-        // OK, we saw a full COBS message.  Let's try to decode.
-        // The COBS header is a minimum of 5 bytes.  If we don't have that, this
-        // is definitely not a valid message
-        if (msgBufferPtr > sizeof(struct COBSHeader)) {
-          size_t unstuffed_size = cobs_unstuff_data(msgBuffer, msgBufferPtr, cobsBuffer);
-          if (unstuffed_size >= sizeof(struct COBSHeader)) {
-            struct COBSHeader *header = (struct COBSHeader *)cobsBuffer;
-            uint16_t payload_len = (uint16_t)header->payload_len_h << 8U | header->payload_len_l;
-            if ((unstuffed_size - sizeof(struct COBSHeader)) >= payload_len) {
-              uint16_t read_crc = (uint16_t)header->crc_h << 8U | header->crc_l;
-              uint16_t calc_crc = crc16(&cobsBuffer[0] + sizeof(struct COBSHeader), payload_len);
-              if (read_crc == calc_crc) {
-                // Valid buffer!  We can CDR unencode it now.  Note that we
-                // reuse the msgBuffer, since we no longer need the original contents.
-                ucdrBuffer reader;
-                ucdr_init_buffer(&reader, cobsBuffer + sizeof(struct COBSHeader), payload_len);
-                ucdr_deserialize_string(&reader, (char *)msgBuffer, MSG_BUFFER_SIZE);
-              }
-            }
-          }
-        }
-        msgBufferPtr = 0;
-      }
-
-      if (msgBufferPtr == MSG_BUFFER_SIZE) {
-        // We overflowed the message buffer; this can't be a valid message, so
-        // throw away what we have and try again.
-        msgBufferPtr = 0;
-      }
-
-      //byte += 1;
-
-      //board_uart_send_bytes(&byte, 1);
-      board_toggle_spare_led();
+      // Each frame is decoded as it comes in, and dispatched to its handler
+      // (or, with RX_FRAMES, queued for handler_task) as soon as its
+      // delimiter does.
+      ros2serial_receive_byte(board_uart_get_byte());
+    }
+
+    taken = board_uart_rx_taken();
+    now = xTaskGetTickCount();
+    if (taken - advertised >= window / 4 || (notified == 0 && taken != advertised) ||
+        now - lastSent >= MS_TO_TICKS(CREDITS_IDLE_MS)) {
+      ros2serial_send_credits(taken, window);
+      advertised = taken;
+      lastSent = now;
     }
 
-    vTaskDelay(MS_TO_TICKS(1));
+#if ROS2SERIAL_PROFILE
+    if (now - lastProfile >= MS_TO_TICKS(PROFILE_PERIOD_MS)) {
+      ros2serial_send_profile();
+      lastProfile = now;
+    }
+#endif
   }
 }
 
+#if ROS2SERIAL_RX_FRAMES > 1
+// Runs the handlers of the frames serial_task queued, while it goes on
+// receiving the next ones.
+static void handler_task(void *arg)
+{
+  (void)arg;
+
+  while (1) {
+    ros2serial_dispatch(UINT32_MAX);
+  }
+}
+#endif
+
+#if ROS2SERIAL_TX_SLOT_CYCLE_MS > 0
+// Opens and closes the transmit queue at the edges of our time slot.
+static void tx_slot_task(void *arg)
+{
+  (void)arg;
+
+  while (1) {
+    vTaskDelay(MS_TO_TICKS(ros2serial_tx_slot_update()));
+  }
+}
+#endif
+
 int main(void)
 {
   board_init();
 
+  if (!ros2serial_init(topics, sizeof(topics) / sizeof(topics[0]))) {
+    while(1);
+  }
+
   // Empirically, the smallest stack we can have for blinky is 37
   if (xTaskCreate(blinky_task, "blinky", 37, NULL,
 		  tskIDLE_PRIORITY + 1, NULL) != pdTRUE) {
     while(1);
   }
 
-  if (xTaskCreate(serial_task, "tx", 100, NULL,
-                  tskIDLE_PRIORITY + 2, NULL) != pdTRUE) {
+#if ROS2SERIAL_RX_FRAMES > 1
+  // Below serial_task, so that receiving isn't held up by a handler.
+  if (xTaskCreate(handler_task, "handler", 200, NULL,
+                  tskIDLE_PRIORITY + 1, NULL) != pdTRUE) {
+    while(1);
+  }
+#endif
+
+  // Without RX_FRAMES the handlers run on this task, so it needs room for
+  // them too.
+  if (xTaskCreate(serial_task, "serial", 200, NULL,
+                  tskIDLE_PRIORITY + 2, &serialTaskHandle) != pdTRUE) {
+    while(1);
+  }
+
+#if ROS2SERIAL_TX_SLOT_CYCLE_MS > 0
+  // Above the other tasks, so the slot edges are on time.
+  if (xTaskCreate(tx_slot_task, "txslot", 64, NULL,
+                  tskIDLE_PRIORITY + 3, NULL) != pdTRUE) {
     while(1);
   }
+#endif
+
+  board_uart_set_rx_callback(serial_rx_callback);
 
   vTaskStartScheduler();
 
@@ -0,0 +1,917 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string.h>
+
+#include "ros2serial/ros2serial.h"
+
+#include "board/board.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+uint16_t crc16(uint8_t const *buffer, size_t len)
+{
+  return board_crc16(buffer, len);
+}
+
+#if ROS2SERIAL_COBS_ZPE
+// The code bytes of COBS/ZPE: 0x01-0xDF are (code - 1) data bytes followed by
+// a 0, 0xE0 is 223 data bytes with no 0, and 0xE1-0xFF are (code - 0xE1) data
+// bytes followed by two 0s.
+#define COBS_ZPE_MAX_RUN 0xDF
+#define COBS_ZPE_MAX_PAIR_RUN 0x1E
+#define COBS_ZPE_RUN_CODE 0xE0
+#define COBS_ZPE_PAIR_CODE 0xE1
+#endif
+
+#if ROS2SERIAL_RX_FRAMES > 1
+#define RX_FRAME_BUFFERS ROS2SERIAL_RX_FRAMES
+#else
+#define RX_FRAME_BUFFERS 1
+#endif
+
+// The frame being received is COBS decoded straight into frameBuffer as its
+// bytes come in; a decoded frame is never larger than the stuffed one.  Once
+// the frame has been dispatched, the buffer is free again, so the answer to a
+// mapping request is serialized into it too.  With ROS2SERIAL_RX_FRAMES, a
+// frame for a handler takes its buffer with it to readyFrames, and
+// frameBuffer is NULL until another one is put back in freeFrames.
+static uint8_t frameBuffers[RX_FRAME_BUFFERS][ROS2SERIAL_FRAME_BUFFER_SIZE];
+static uint8_t *frameBuffer = frameBuffers[0];
+
+#if ROS2SERIAL_RX_FRAMES > 1
+// The frames waiting for their handlers, oldest first, and the buffers
+// nobody is using.  The vendored queue.c is older than the kernel, so these
+// are kept under a critical section instead, and the tasks waiting on them
+// (whose handles are only set while they are) are woken with a
+// notification.
+static uint8_t *readyFrames[RX_FRAME_BUFFERS];
+static size_t readyHead;
+static size_t readyCount;
+static uint8_t *freeFrames[RX_FRAME_BUFFERS];
+static size_t freeCount;
+static TaskHandle_t dispatchTask;
+static TaskHandle_t receiveTask;
+#endif
+
+// The state of the frame being received.  The CRC unit takes the whole
+// payload once the 0x00 delimiter of the frame comes in, which is quicker
+// than computing the CRC a byte at a time as it is decoded.
+struct FrameDecoder
+{
+  uint16_t len;   // decoded bytes in frameBuffer
+  uint8_t zeros;  // 0s that follow the data of the current COBS block
+  uint8_t copy;   // data bytes left in the current COBS block
+  uint8_t discard;  // the frame overflowed frameBuffer; drop it
+};
+
+static struct FrameDecoder frameDecoder = { 0, 0, 0, 0 };
+
+static void frame_decoder_reset(struct FrameDecoder *dec)
+{
+  dec->len = 0;
+  dec->zeros = 0;
+  dec->copy = 0;
+  dec->discard = 0;
+}
+
+static void frame_decoder_emit(struct FrameDecoder *dec, uint8_t byte)
+{
+  if (dec->len == ROS2SERIAL_FRAME_BUFFER_SIZE) {
+    // This can't be a valid message; throw away the rest of it.
+    dec->discard = 1;
+    return;
+  }
+
+  frameBuffer[dec->len++] = byte;
+}
+
+// Called once the 0x00 delimiter of a frame has come in.  Returns the length
+// of the valid payload following the header in frameBuffer, or -1 if the frame
+// is incomplete, too long or corrupt.
+static int frame_decoder_finish(const struct FrameDecoder *dec)
+{
+  const struct COBSHeader *header = (const struct COBSHeader *)frameBuffer;
+  uint16_t payload_len;
+  uint16_t read_crc;
+
+  // A block cut short by the delimiter means bytes went missing.  The COBS
+  // header is 5 bytes; anything shorter is definitely not a valid message.
+  if (dec->discard || dec->copy != 0 || dec->len < sizeof(struct COBSHeader)) {
+    return -1;
+  }
+
+  payload_len = (uint16_t)header->payload_len_h << 8U | header->payload_len_l;
+  if (dec->len - sizeof(struct COBSHeader) != payload_len) {
+    return -1;
+  }
+
+  read_crc = (uint16_t)header->crc_h << 8U | header->crc_l;
+  if (read_crc != crc16(frameBuffer + sizeof(struct COBSHeader), payload_len)) {
+    return -1;
+  }
+
+  return payload_len;
+}
+
+// Feed one received byte to the decoder.  Returns the length of the payload
+// when byte completes a valid frame, or -1 otherwise.
+static int frame_decoder_push(struct FrameDecoder *dec, uint8_t byte)
+{
+  int payload_len;
+
+  if (byte == 0x0) {
+    // The last 0 of the last block is the delimiter itself, so only a block
+    // that ended in a pair of 0s leaves one behind.
+    if (dec->zeros == 2 && dec->copy == 0 && !dec->discard) {
+      frame_decoder_emit(dec, 0);
+    }
+    payload_len = frame_decoder_finish(dec);
+    frame_decoder_reset(dec);
+    return payload_len;
+  }
+
+  if (dec->discard) {
+    return -1;
+  }
+
+  if (dec->copy != 0) {
+    frame_decoder_emit(dec, byte);
+    dec->copy--;
+  } else {
+    // A new block; the 0s that ended the one before aren't written until we
+    // know it wasn't the end of the frame.
+    while (dec->zeros != 0) {
+      frame_decoder_emit(dec, 0);
+      dec->zeros--;
+    }
+#if ROS2SERIAL_COBS_ZPE
+    if (byte >= COBS_ZPE_PAIR_CODE) {
+      dec->copy = byte - COBS_ZPE_PAIR_CODE;
+      dec->zeros = 2;
+    } else if (byte == COBS_ZPE_RUN_CODE) {
+      dec->copy = COBS_ZPE_MAX_RUN;
+      dec->zeros = 0;
+    } else {
+      dec->copy = byte - 1;
+      dec->zeros = 1;
+    }
+#else
+    // Every block but one of 254 data bytes ends in a 0.
+    dec->copy = byte - 1;
+    dec->zeros = byte != 0xff;
+#endif
+  }
+
+  return -1;
+}
+
+
+#if ROS2SERIAL_PROFILE
+// The cycles each stage took since the last ros2serial_send_profile(), and
+// the decoding cycles of the frame coming in so far.  The transmit and
+// handler stages are only counted with the scheduler suspended, which also
+// keeps the profile from being sent in the middle of an update.
+static uint32_t profileCount[ROS2SERIAL_NUM_STAGES];
+static uint32_t profileMin[ROS2SERIAL_NUM_STAGES];
+static uint32_t profileMax[ROS2SERIAL_NUM_STAGES];
+static uint64_t profileTotal[ROS2SERIAL_NUM_STAGES];
+static uint32_t rxDecodeCycles;
+static TickType_t profileStart;
+
+static void profile_reset(void)
+{
+  size_t i;
+
+  for (i = 0; i < ROS2SERIAL_NUM_STAGES; i++) {
+    profileCount[i] = 0;
+    profileMin[i] = UINT32_MAX;
+    profileMax[i] = 0;
+    profileTotal[i] = 0;
+  }
+}
+
+static void profile_add(size_t stage, uint32_t cycles)
+{
+  profileCount[stage]++;
+  profileTotal[stage] += cycles;
+  if (cycles < profileMin[stage]) {
+    profileMin[stage] = cycles;
+  }
+  if (cycles > profileMax[stage]) {
+    profileMax[stage] = cycles;
+  }
+}
+#endif
+
+static const struct ros2serial_topic *topicTable;
+static size_t numTopics;
+
+// The index + 1 into topicTable of each topic ID, or 0 for an unknown topic,
+// so a frame is dispatched without searching the table.
+static uint8_t topicIndex[256];
+
+// One bit per topic ID that the bridge asked us to stop sending.  Only the
+// receiving task writes it, so the publishing tasks at worst send one more
+// message, or drop one, as it changes.
+static volatile uint8_t pausedTopics[256 / 8];
+
+#if ROS2SERIAL_RATE_TOPICS > 0
+// The shortest time between two messages of each of the first topics of the
+// table that the bridge asked us to send less often, or 0 for no limit, and
+// the tick the last message of each was sent at.  Like pausedTopics, only
+// the receiving task writes the intervals, and tasks publishing the same
+// topic at once may at worst send one more message.
+static volatile TickType_t rateIntervals[ROS2SERIAL_RATE_TOPICS];
+static volatile TickType_t rateLastSent[ROS2SERIAL_RATE_TOPICS];
+#endif
+
+static ros2serial_refresh_handler_t refreshHandler;
+static void *refreshArg;
+
+bool ros2serial_init(const struct ros2serial_topic *topics, size_t num_topics)
+{
+  size_t i;
+
+  if (num_topics > 255) {
+    return false;
+  }
+
+  for (i = 0; i < sizeof(topicIndex); i++) {
+    topicIndex[i] = 0;
+  }
+  for (i = 0; i < sizeof(pausedTopics); i++) {
+    pausedTopics[i] = 0;
+  }
+#if ROS2SERIAL_RATE_TOPICS > 0
+  for (i = 0; i < ROS2SERIAL_RATE_TOPICS; i++) {
+    rateIntervals[i] = 0;
+  }
+#endif
+
+  for (i = 0; i < num_topics; i++) {
+    topic_id_size_t topic_ID = topics[i].topic_ID;
+    if (topic_ID < 2 || topicIndex[topic_ID] != 0) {
+      return false;
+    }
+    topicIndex[topic_ID] = (uint8_t)(i + 1);
+  }
+
+  topicTable = topics;
+  numTopics = num_topics;
+
+#if ROS2SERIAL_RX_FRAMES > 1
+  // Every buffer but the one being decoded into starts out free.
+  frameBuffer = frameBuffers[0];
+  readyHead = 0;
+  readyCount = 0;
+  for (i = 1; i < RX_FRAME_BUFFERS; i++) {
+    freeFrames[i - 1] = frameBuffers[i];
+  }
+  freeCount = RX_FRAME_BUFFERS - 1;
+#endif
+
+#if ROS2SERIAL_PROFILE
+  profile_reset();
+#endif
+
+  return true;
+}
+
+// The state of an in-progress COBS stuffing operation, so that the header
+// and the payload can be stuffed one after the other.
+struct COBSStuffState
+{
+  size_t write_index;
+  size_t code_index;
+  uint8_t code;
+  uint8_t pending_zero;  // COBS/ZPE: the block ended in a 0 that may be the first of a pair
+};
+
+// Returns the offset of the first 0 in the len bytes at data, or len if
+// there isn't one.  The Cortex-M4 can load a word from any address, so this
+// looks at four bytes at a time; the high bit of each byte of zeros is set
+// for a 0 (and maybe for bytes above a 0, but never below the first one).
+static size_t cobs_find_zero(const uint8_t *data, size_t len)
+{
+  size_t i = 0;
+  uint32_t word;
+  uint32_t zeros;
+
+  for (; i + sizeof(word) <= len; i += sizeof(word)) {
+    memcpy(&word, data + i, sizeof(word));
+    zeros = (word - 0x01010101U) & ~word & 0x80808080U;
+    if (zeros != 0) {
+      return i + (__builtin_ctz(zeros) >> 3);
+    }
+  }
+  while (i < len && data[i] != 0) {
+    i++;
+  }
+
+  return i;
+}
+
+// Each run of non-zero bytes, up to the end of the block, is found a word at
+// a time and copied in one go.  The output is the same as stuffing a byte at
+// a time.
+#if ROS2SERIAL_COBS_ZPE
+// A block that ends in a 0 is only closed once the next byte shows whether
+// a second 0 follows, which goes into the same code byte if the block is
+// short enough.
+static void cobs_stuff_data(struct COBSStuffState *state, const uint8_t *input, size_t length, uint8_t *output)
+{
+  size_t read_index = 0;
+  size_t write_index = state->write_index;
+  size_t code_index = state->code_index;
+  uint8_t code = state->code;
+  uint8_t pending_zero = state->pending_zero;
+  size_t room;
+  size_t run;
+
+  while (read_index < length) {
+    if (pending_zero) {
+      pending_zero = 0;
+      if (input[read_index] == 0 && code - 1U <= COBS_ZPE_MAX_PAIR_RUN) {
+        output[code_index] = (uint8_t)(COBS_ZPE_PAIR_CODE + code - 1);
+        read_index++;
+      } else {
+        output[code_index] = code;
+      }
+      code = 1;
+      code_index = write_index++;
+      continue;
+    }
+
+    room = COBS_ZPE_MAX_RUN + 1 - code;
+    if (room > length - read_index) {
+      room = length - read_index;
+    }
+    run = cobs_find_zero(input + read_index, room);
+    memcpy(output + write_index, input + read_index, run);
+    write_index += run;
+    read_index += run;
+    code = (uint8_t)(code + run);
+
+    if (code == COBS_ZPE_MAX_RUN + 1) {
+      // The block is full.
+      output[code_index] = COBS_ZPE_RUN_CODE;
+      code = 1;
+      code_index = write_index++;
+    } else if (read_index < length) {
+      // The run ended at a 0.
+      pending_zero = 1;
+      read_index++;
+    }
+  }
+
+  state->write_index = write_index;
+  state->code_index = code_index;
+  state->code = code;
+  state->pending_zero = pending_zero;
+}
+
+// Write the last code byte.  The delimiter after the frame pairs up with a
+// last 0 of the data if it can; if not, that 0 gets a block of its own.
+static void cobs_stuff_finish(struct COBSStuffState *state, uint8_t *output)
+{
+  if (state->pending_zero && state->code - 1U <= COBS_ZPE_MAX_PAIR_RUN) {
+    output[state->code_index] = (uint8_t)(COBS_ZPE_PAIR_CODE + state->code - 1);
+    return;
+  }
+  output[state->code_index] = state->code;
+  if (state->pending_zero) {
+    state->code_index = state->write_index++;
+    output[state->code_index] = 1;
+  }
+}
+#else
+static void cobs_stuff_data(struct COBSStuffState *state, const uint8_t *input, size_t length, uint8_t *output)
+{
+  size_t read_index = 0;
+  size_t write_index = state->write_index;
+  size_t code_index = state->code_index;
+  uint8_t code = state->code;
+  size_t room;
+  size_t run;
+
+  while (read_index < length) {
+    room = 0xff - code;
+    if (room > length - read_index) {
+      room = length - read_index;
+    }
+    run = cobs_find_zero(input + read_index, room);
+    memcpy(output + write_index, input + read_index, run);
+    write_index += run;
+    read_index += run;
+    code = (uint8_t)(code + run);
+
+    if (code == 0xff) {
+      // The block is full.
+      output[code_index] = code;
+      code = 1;
+      code_index = write_index++;
+    } else if (read_index < length) {
+      // The run ended at a 0.
+      output[code_index] = code;
+      code = 1;
+      code_index = write_index++;
+      read_index++;
+    }
+  }
+
+  state->write_index = write_index;
+  state->code_index = code_index;
+  state->code = code;
+}
+
+// Write the last code byte.
+static void cobs_stuff_finish(struct COBSStuffState *state, uint8_t *output)
+{
+  output[state->code_index] = state->code;
+}
+#endif
+
+bool ros2serial_publish(topic_id_size_t topic_ID, const uint8_t *payload, size_t len)
+{
+  struct COBSHeader header;
+  struct COBSStuffState state = { 1, 0, 1, 0 };
+  uint16_t crc;
+  size_t frame_len = sizeof(struct COBSHeader) + len;
+  uint8_t *out;
+#if ROS2SERIAL_RATE_TOPICS > 0
+  uint8_t index;
+#endif
+#if ROS2SERIAL_PROFILE
+  uint32_t crcStart;
+  uint32_t crcCycles;
+  uint32_t start;
+#endif
+
+  if (len > UINT16_MAX) {
+    return false;
+  }
+
+  if (pausedTopics[topic_ID / 8] & (1 << (topic_ID % 8))) {
+    return true;
+  }
+
+#if ROS2SERIAL_RATE_TOPICS > 0
+  index = topicIndex[topic_ID];
+  if (index != 0 && index <= ROS2SERIAL_RATE_TOPICS && rateIntervals[index - 1] != 0) {
+    TickType_t now = xTaskGetTickCount();
+    if (now - rateLastSent[index - 1] < rateIntervals[index - 1]) {
+      return true;
+    }
+    rateLastSent[index - 1] = now;
+  }
+#endif
+
+#if ROS2SERIAL_PROFILE
+  crcStart = board_cycle_count();
+#endif
+  crc = crc16(payload, len);
+#if ROS2SERIAL_PROFILE
+  crcCycles = board_cycle_count() - crcStart;
+#endif
+  header.topic_ID = topic_ID;
+  header.payload_len_h = (len >> 8) & 0xff;
+  header.payload_len_l = len & 0xff;
+  header.crc_h = (crc >> 8) & 0xff;
+  header.crc_l = crc & 0xff;
+
+  // Keep other tasks from interleaving their frames with this one; the
+  // transmit DMA keeps running, so waiting for room still works.
+  vTaskSuspendAll();
+
+#if ROS2SERIAL_COBS_ZPE
+  // Room for the worst case: one code byte per 223 bytes, plus the first
+  // code byte, a block for a last 0 that can't pair up with the delimiter,
+  // and the 0x00 delimiter.
+  out = board_uart_tx_reserve(frame_len + frame_len / COBS_ZPE_MAX_RUN + 3);
+#else
+  // Room for the worst case: one code byte per 254 bytes, plus the first
+  // code byte and the 0x00 delimiter.
+  out = board_uart_tx_reserve(frame_len + frame_len / 254 + 2);
+#endif
+  if (out == NULL) {
+    xTaskResumeAll();
+    return false;
+  }
+
+#if ROS2SERIAL_PROFILE
+  // Not counting the wait for room in the queue.
+  start = board_cycle_count();
+#endif
+  cobs_stuff_data(&state, (const uint8_t *)&header, sizeof(header), out);
+  cobs_stuff_data(&state, payload, len, out);
+  cobs_stuff_finish(&state, out);
+  out[state.write_index++] = 0x0;
+
+  board_uart_tx_commit(state.write_index);
+#if ROS2SERIAL_PROFILE
+  profile_add(ROS2SERIAL_STAGE_TX_ENCODE, board_cycle_count() - start);
+  profile_add(ROS2SERIAL_STAGE_TX_CRC, crcCycles);
+#endif
+
+  xTaskResumeAll();
+
+  return true;
+}
+
+bool ros2serial_send_credits(uint32_t received, uint32_t window)
+{
+  // Not frameBuffer, which may hold a frame still coming in.
+  uint8_t buffer[12];
+  ucdrBuffer writer;
+
+  ucdr_init_buffer(&writer, buffer, sizeof(buffer));
+  ucdr_serialize_uint8_t(&writer, ROS2SERIAL_FLOW_CREDITS);
+  ucdr_serialize_uint32_t(&writer, received);
+  ucdr_serialize_uint32_t(&writer, window);
+  if (ucdr_buffer_has_error(&writer)) {
+    return false;
+  }
+
+  return ros2serial_publish(0, buffer, ucdr_buffer_length(&writer));
+}
+
+int64_t ros2serial_time_ns(void)
+{
+  return (int64_t)xTaskGetTickCount() * (1000000000 / configTICK_RATE_HZ);
+}
+
+bool ros2serial_send_profile(void)
+{
+#if ROS2SERIAL_PROFILE
+  // Not frameBuffer, which may hold a frame still coming in.
+  uint8_t buffer[104];
+  ucdrBuffer writer;
+  uint32_t min[ROS2SERIAL_NUM_STAGES];
+  uint32_t wakeups;
+  uint64_t awake_cycles;
+  TickType_t now;
+  size_t i;
+
+  vTaskSuspendAll();
+
+  now = xTaskGetTickCount();
+  board_sleep_stats(&wakeups, &awake_cycles);
+
+  for (i = 0; i < ROS2SERIAL_NUM_STAGES; i++) {
+    min[i] = profileCount[i] != 0 ? profileMin[i] : 0;
+  }
+
+  ucdr_init_buffer(&writer, buffer, sizeof(buffer));
+  ucdr_serialize_uint8_t(&writer, ROS2SERIAL_PROFILE_KIND);
+  ucdr_serialize_uint32_t(&writer, board_core_hz());
+  ucdr_serialize_array_uint32_t(&writer, profileCount, ROS2SERIAL_NUM_STAGES);
+  ucdr_serialize_array_uint32_t(&writer, min, ROS2SERIAL_NUM_STAGES);
+  ucdr_serialize_array_uint32_t(&writer, profileMax, ROS2SERIAL_NUM_STAGES);
+  ucdr_serialize_array_uint64_t(&writer, profileTotal, ROS2SERIAL_NUM_STAGES);
+  // At least 1, since 0 means there are no sleep figures.
+  ucdr_serialize_uint32_t(&writer, now != profileStart ? (uint32_t)((now - profileStart) * 1000 / configTICK_RATE_HZ) : 1);
+  ucdr_serialize_uint32_t(&writer, wakeups);
+  ucdr_serialize_uint64_t(&writer, awake_cycles);
+  profile_reset();
+  profileStart = now;
+
+  xTaskResumeAll();
+
+  if (ucdr_buffer_has_error(&writer)) {
+    return false;
+  }
+
+  return ros2serial_publish(0, buffer, ucdr_buffer_length(&writer));
+#else
+  return false;
+#endif
+}
+
+uint32_t ros2serial_tx_slot_update(void)
+{
+  const int64_t ms = 1000000;
+  const int64_t cycle = (int64_t)ROS2SERIAL_TX_SLOT_CYCLE_MS * ms;
+  const int64_t length = (int64_t)ROS2SERIAL_TX_SLOT_LENGTH_MS * ms;
+  const int64_t guard = (int64_t)ROS2SERIAL_TX_SLOT_GUARD_MS * ms;
+  int64_t pos;
+  int64_t next;
+
+  if (cycle <= 0) {
+    board_uart_tx_hold(false);
+    return UINT32_MAX;
+  }
+
+  pos = (ros2serial_time_ns() - (int64_t)ROS2SERIAL_TX_SLOT_OFFSET_MS * ms) % cycle;
+  if (pos < 0) {
+    pos += cycle;
+  }
+
+  if (pos >= guard && pos < length - guard) {
+    board_uart_tx_hold(false);
+    next = length - guard - pos;
+  } else {
+    board_uart_tx_hold(true);
+    next = (pos < guard) ? guard - pos : cycle - pos + guard;
+  }
+
+  // Round up, so the next call isn't just short of the change.
+  return (uint32_t)((next + ms - 1) / ms);
+}
+
+// Answer a ros2_serial_msgs/TimeSync REQUEST from the bridge; received is
+// when its frame was complete.
+static void answer_time_request(ucdrBuffer *reader, int64_t received)
+{
+  uint8_t buffer[32];
+  ucdrBuffer writer;
+  uint8_t kind;
+  int64_t t1;
+
+  ucdr_deserialize_uint8_t(reader, &kind);
+  ucdr_deserialize_int64_t(reader, &t1);
+  if (ucdr_buffer_has_error(reader)) {
+    return;
+  }
+
+  ucdr_init_buffer(&writer, buffer, sizeof(buffer));
+  ucdr_serialize_uint8_t(&writer, ROS2SERIAL_TIME_RESPONSE);
+  ucdr_serialize_int64_t(&writer, t1);
+  ucdr_serialize_int64_t(&writer, received);
+  ucdr_serialize_int64_t(&writer, ros2serial_time_ns());
+  if (!ucdr_buffer_has_error(&writer)) {
+    ros2serial_publish(0, buffer, ucdr_buffer_length(&writer));
+  }
+}
+
+// Answer a dynamic mapping request with a ros2_serial_msgs/SerialMapping
+// built from the topic table.
+static void send_mapping(void)
+{
+  ucdrBuffer writer;
+  size_t i;
+
+  ucdr_init_buffer(&writer, frameBuffer, ROS2SERIAL_FRAME_BUFFER_SIZE);
+
+  ucdr_serialize_uint32_t(&writer, numTopics);
+  for (i = 0; i < numTopics; i++) {
+    ucdr_serialize_string(&writer, topicTable[i].name);
+  }
+  ucdr_serialize_uint32_t(&writer, numTopics);
+  for (i = 0; i < numTopics; i++) {
+    ucdr_serialize_uint64_t(&writer, topicTable[i].topic_ID);
+  }
+  ucdr_serialize_uint32_t(&writer, numTopics);
+  for (i = 0; i < numTopics; i++) {
+    ucdr_serialize_string(&writer, topicTable[i].type);
+  }
+  ucdr_serialize_uint32_t(&writer, numTopics);
+  for (i = 0; i < numTopics; i++) {
+    ucdr_serialize_uint8_t(&writer, topicTable[i].direction);
+  }
+  ucdr_serialize_uint32_t(&writer, numTopics);
+  for (i = 0; i < numTopics; i++) {
+    ucdr_serialize_uint32_t(&writer, topicTable[i].type_hash);
+  }
+
+  if (!ucdr_buffer_has_error(&writer)) {
+    ros2serial_publish(1, frameBuffer, ucdr_buffer_length(&writer));
+  }
+}
+
+void ros2serial_set_refresh_handler(ros2serial_refresh_handler_t handler, void *arg)
+{
+  refreshArg = arg;
+  refreshHandler = handler;
+}
+
+// Apply a ros2_serial_msgs/TopicControl from the bridge.
+static void apply_topic_control(ucdrBuffer *reader)
+{
+  uint64_t serial_mapping;
+  bool paused;
+  float max_rate_hz = 0.0f;
+  bool refresh = false;
+  uint8_t bit;
+#if ROS2SERIAL_RATE_TOPICS > 0
+  uint8_t index;
+#endif
+
+  ucdr_deserialize_uint64_t(reader, &serial_mapping);
+  ucdr_deserialize_bool(reader, &paused);
+  if (ucdr_buffer_has_error(reader) || serial_mapping < 2 || serial_mapping > 255) {
+    return;
+  }
+  // Bridges that predate max_rate_hz leave it out, which means no limit.
+  if (ucdr_buffer_remaining(reader) >= 7) {
+    ucdr_deserialize_float(reader, &max_rate_hz);
+  }
+  // And bridges that predate refresh leave that out.
+  if (ucdr_buffer_remaining(reader) >= 1) {
+    ucdr_deserialize_bool(reader, &refresh);
+  }
+
+  bit = 1 << (serial_mapping % 8);
+  if (paused) {
+    pausedTopics[serial_mapping / 8] |= bit;
+  } else {
+    pausedTopics[serial_mapping / 8] &= ~bit;
+  }
+
+#if ROS2SERIAL_RATE_TOPICS > 0
+  index = topicIndex[serial_mapping];
+  if (index != 0 && index <= ROS2SERIAL_RATE_TOPICS) {
+    // A rate faster than the tick can't be told apart from no limit.
+    rateIntervals[index - 1] = max_rate_hz > 0.0f ? (TickType_t)(configTICK_RATE_HZ / max_rate_hz) : 0;
+    if (refresh) {
+      rateLastSent[index - 1] = xTaskGetTickCount() - rateIntervals[index - 1];
+    }
+  }
+#endif
+
+  if (refresh && !paused && refreshHandler != NULL) {
+    refreshHandler((topic_id_size_t)serial_mapping, refreshArg);
+  }
+}
+
+// Run the handler of the topic of a valid frame, which has one.
+static void run_handler(const uint8_t *frame)
+{
+  const struct COBSHeader *header = (const struct COBSHeader *)frame;
+  const struct ros2serial_topic *topic = &topicTable[topicIndex[header->topic_ID] - 1];
+  uint16_t payload_len = (uint16_t)header->payload_len_h << 8U | header->payload_len_l;
+  ucdrBuffer reader;
+#if ROS2SERIAL_PROFILE
+  uint32_t start;
+  uint32_t cycles;
+#endif
+
+  ucdr_init_buffer(&reader, (uint8_t *)frame + sizeof(struct COBSHeader), payload_len);
+#if ROS2SERIAL_PROFILE
+  start = board_cycle_count();
+#endif
+  topic->handler(header->topic_ID, &reader, topic->arg);
+#if ROS2SERIAL_PROFILE
+  cycles = board_cycle_count() - start;
+  vTaskSuspendAll();
+  profile_add(ROS2SERIAL_STAGE_RX_HANDLER, cycles);
+  xTaskResumeAll();
+#endif
+}
+
+bool ros2serial_receive_byte(uint8_t byte)
+{
+  const struct COBSHeader *header;
+  const struct ros2serial_topic *topic;
+  ucdrBuffer reader;
+  int payload_len;
+  uint8_t index;
+#if ROS2SERIAL_PROFILE
+  uint32_t start;
+#endif
+#if ROS2SERIAL_RX_FRAMES > 1
+  TaskHandle_t waiter;
+
+  while (frameBuffer == NULL) {
+    // When every buffer holds a frame waiting for its handler, the bytes
+    // wait in the uart receive queue until one is done with.
+    taskENTER_CRITICAL();
+    if (freeCount != 0) {
+      frameBuffer = freeFrames[--freeCount];
+      receiveTask = NULL;
+    } else {
+      receiveTask = xTaskGetCurrentTaskHandle();
+    }
+    taskEXIT_CRITICAL();
+    if (frameBuffer == NULL) {
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+  }
+#endif
+  header = (const struct COBSHeader *)frameBuffer;
+
+#if ROS2SERIAL_PROFILE
+  start = board_cycle_count();
+#endif
+  payload_len = frame_decoder_push(&frameDecoder, byte);
+#if ROS2SERIAL_PROFILE
+  // A frame is decoded a byte at a time, so its cycles add up until its
+  // delimiter comes in.
+  rxDecodeCycles += board_cycle_count() - start;
+  if (byte == 0x0) {
+    if (payload_len >= 0) {
+      profile_add(ROS2SERIAL_STAGE_RX_DECODE, rxDecodeCycles);
+    }
+    rxDecodeCycles = 0;
+  }
+#endif
+  if (payload_len < 0) {
+    return false;
+  }
+
+  if (header->topic_ID == 0) {
+    // Anything else on topic 0, like an empty message, asks for the mapping.
+    if (payload_len > 0 && frameBuffer[sizeof(struct COBSHeader)] == ROS2SERIAL_TIME_REQUEST) {
+      ucdr_init_buffer(&reader, frameBuffer + sizeof(struct COBSHeader), payload_len);
+      answer_time_request(&reader, ros2serial_time_ns());
+    } else {
+      send_mapping();
+    }
+    return true;
+  }
+
+  if (header->topic_ID == 1) {
+    ucdr_init_buffer(&reader, frameBuffer + sizeof(struct COBSHeader), payload_len);
+    apply_topic_control(&reader);
+    return true;
+  }
+
+  index = topicIndex[header->topic_ID];
+  if (index == 0) {
+    return false;
+  }
+
+  topic = &topicTable[index - 1];
+  if (topic->handler == NULL) {
+    return false;
+  }
+
+#if ROS2SERIAL_RX_FRAMES > 1
+  // The handler runs in ros2serial_dispatch(), while the next frame is
+  // decoded into another buffer.  There are only as many frames as there is
+  // room for.
+  taskENTER_CRITICAL();
+  readyFrames[(readyHead + readyCount++) % RX_FRAME_BUFFERS] = frameBuffer;
+  waiter = dispatchTask;
+  taskEXIT_CRITICAL();
+  frameBuffer = NULL;
+  if (waiter != NULL) {
+    xTaskNotifyGive(waiter);
+  }
+#else
+  run_handler(frameBuffer);
+#endif
+
+  return true;
+}
+
+bool ros2serial_dispatch(uint32_t timeout_ms)
+{
+#if ROS2SERIAL_RX_FRAMES > 1
+  uint8_t *frame = NULL;
+  TaskHandle_t waiter;
+  int attempt;
+
+  // Wait once; a notification that was left over from a frame already
+  // taken just means coming back empty-handed.
+  for (attempt = 0; attempt < 2 && frame == NULL; attempt++) {
+    taskENTER_CRITICAL();
+    if (readyCount != 0) {
+      frame = readyFrames[readyHead];
+      readyHead = (readyHead + 1) % RX_FRAME_BUFFERS;
+      readyCount--;
+      dispatchTask = NULL;
+    } else {
+      dispatchTask = xTaskGetCurrentTaskHandle();
+    }
+    taskEXIT_CRITICAL();
+    if (frame == NULL && attempt == 0) {
+      ulTaskNotifyTake(pdTRUE, timeout_ms == UINT32_MAX ? portMAX_DELAY : MS_TO_TICKS(timeout_ms));
+    }
+  }
+  if (frame == NULL) {
+    taskENTER_CRITICAL();
+    dispatchTask = NULL;
+    taskEXIT_CRITICAL();
+    return false;
+  }
+
+  run_handler(frame);
+
+  taskENTER_CRITICAL();
+  freeFrames[freeCount++] = frame;
+  waiter = receiveTask;
+  receiveTask = NULL;
+  taskEXIT_CRITICAL();
+  if (waiter != NULL) {
+    xTaskNotifyGive(waiter);
+  }
+
+  return true;
+#else
+  (void)timeout_ms;
+  return false;
+#endif
+}
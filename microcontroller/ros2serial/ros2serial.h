@@ -0,0 +1,209 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ROS2SERIAL_H
+#define ROS2SERIAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ucdr/microcdr.h"
+
+/* The firmware side of the ros2_to_serial_bridge "cobs" protocol.  Frames
+ * are |COBSHeader|payload| COBS encoded and terminated by 0x00, where the
+ * header holds the topic ID, the payload length and the CRC-16 of the
+ * payload, and the payload is the bare CDR of the message.
+ *
+ * Building with ROS2SERIAL_COBS_ZPE set to 1 speaks the "cobs_zpe" protocol
+ * instead, which also folds pairs of 0s into the code bytes; the bridge must
+ * then be set to the same protocol. */
+
+#ifndef ROS2SERIAL_COBS_ZPE
+#define ROS2SERIAL_COBS_ZPE 0
+#endif
+
+typedef uint8_t topic_id_size_t;
+
+/* The directions of a topic; the same as in ros2_serial_msgs/SerialMapping. */
+#define ROS2SERIAL_SERIALTOROS2 0
+#define ROS2SERIAL_ROS2TOSERIAL 1
+
+/* The largest decoded frame, header included, that can be received. */
+#define ROS2SERIAL_FRAME_BUFFER_SIZE 512
+
+struct __attribute__((packed)) COBSHeader
+{
+  topic_id_size_t topic_ID;
+  uint8_t payload_len_h;
+  uint8_t payload_len_l;
+  uint8_t crc_h;
+  uint8_t crc_l;
+};
+
+/* Called with a reader over the payload of each message received on a topic. */
+typedef void (*ros2serial_handler_t)(topic_id_size_t topic_ID, ucdrBuffer *reader, void *arg);
+
+/* One entry of the topic table.  Topic IDs 0 and 1 are taken by the dynamic
+ * mapping request and response. */
+struct ros2serial_topic
+{
+  const char *name;             /* The ROS 2 topic name. */
+  const char *type;             /* The ROS 2 message type, e.g. "std_msgs/String". */
+  topic_id_size_t topic_ID;     /* The topic ID on the serial wire. */
+  uint8_t direction;            /* ROS2SERIAL_SERIALTOROS2 or ROS2SERIAL_ROS2TOSERIAL. */
+  ros2serial_handler_t handler; /* For ROS2SERIAL_ROS2TOSERIAL topics; may be NULL. */
+  void *arg;                    /* Passed to the handler. */
+  uint32_t type_hash;           /* The hash of the type's definition, from
+                                 * generate_ros2_topics.py --print-type-hashes,
+                                 * so the bridge can tell if it was built with
+                                 * a different one; 0 if unknown. */
+};
+
+/* Set the topic table, which must stay valid; it is sent to the bridge in
+ * answer to a dynamic mapping request and messages received are dispatched
+ * through it.  Returns false if there are too many topics or a topic ID is
+ * reserved or used twice. */
+bool ros2serial_init(const struct ros2serial_topic *topics, size_t num_topics);
+
+/* Receiving ahead of the handlers: with ROS2SERIAL_RX_FRAMES set above 1,
+ * frames are decoded into a pool of that many buffers, and a frame for a
+ * handler is queued for the task calling ros2serial_dispatch(), so that the
+ * next frame is received while it is handled.  When every buffer holds a frame still waiting for its handler,
+ * ros2serial_receive_byte() waits for one to be done with.  Otherwise the
+ * handlers run in ros2serial_receive_byte(). */
+#ifndef ROS2SERIAL_RX_FRAMES
+#define ROS2SERIAL_RX_FRAMES 0
+#endif
+
+/* Feed one received byte to the frame decoder.  When it completes a valid
+ * frame, the frame is dispatched to its handler (or answered, for a mapping
+ * request, or applied, for a ros2_serial_msgs/TopicControl on topic 1)
+ * before this returns; with ROS2SERIAL_RX_FRAMES, a frame for a handler is
+ * queued for ros2serial_dispatch() instead.  Returns true if a frame was
+ * dispatched or queued. */
+bool ros2serial_receive_byte(uint8_t byte);
+
+/* With ROS2SERIAL_RX_FRAMES, wait up to timeout_ms (forever for UINT32_MAX)
+ * for a frame queued by ros2serial_receive_byte() and run its handler.  Must
+ * always be called from the same task, which isn't the one receiving.
+ * Returns true if a handler ran, and always false without
+ * ROS2SERIAL_RX_FRAMES. */
+bool ros2serial_dispatch(uint32_t timeout_ms);
+
+/* The number of topics, from the start of the topic table, that the bridge
+ * can ask to be sent at a lower rate with the max_rate_hz of a
+ * ros2_serial_msgs/TopicControl; each takes 8 bytes of RAM.  The others are
+ * always sent at the rate they are published at. */
+#ifndef ROS2SERIAL_RATE_TOPICS
+#define ROS2SERIAL_RATE_TOPICS 32
+#endif
+
+/* Frame a serialized message and queue it to be sent.  The frame is COBS
+ * encoded straight into the uart transmit queue, so this waits if the queue
+ * is full.  May be called from any task.  Messages on a topic that the bridge
+ * paused, because nothing in ROS 2 subscribes to it, are dropped, and so are
+ * messages that come sooner after the last one sent than the rate the bridge
+ * asked for allows.  Returns false if the payload is too large to ever
+ * fit. */
+bool ros2serial_publish(topic_id_size_t topic_ID, const uint8_t *payload, size_t len);
+
+/* Called when the bridge asks for a topic to be sent once now, with the
+ * refresh of a ros2_serial_msgs/TopicControl, because a subscriber joined and
+ * the bridge has no message of the topic to give it.  It runs in the
+ * receiving task, so it should only flag the topic to be published soon; the
+ * next message of the topic isn't held back by its rate. */
+typedef void (*ros2serial_refresh_handler_t)(topic_id_size_t topic_ID, void *arg);
+
+/* Set the handler for refresh requests, or NULL to ignore them (the
+ * default).  arg is passed to it. */
+void ros2serial_set_refresh_handler(ros2serial_refresh_handler_t handler, void *arg);
+
+/* The kind of a ros2_serial_msgs/FlowCredits; the same as its CREDITS. */
+#define ROS2SERIAL_FLOW_CREDITS 2
+
+/* Send the bridge a ros2_serial_msgs/FlowCredits on topic 0, granting it
+ * window more bytes after the first received bytes that came in since the
+ * start.  Only a bridge with flow_control set needs them, and it can't send
+ * anything until it has had one, so they should be sent every so often from
+ * the start.  Returns false if the frame couldn't be queued. */
+bool ros2serial_send_credits(uint32_t received, uint32_t window);
+
+/* The kinds of a ros2_serial_msgs/TimeSync; the same as its REQUEST and
+ * RESPONSE.  A REQUEST from the bridge on topic 0 is answered straight away
+ * from ros2serial_receive_byte(), with the times from ros2serial_time_ns(). */
+#define ROS2SERIAL_TIME_REQUEST 3
+#define ROS2SERIAL_TIME_RESPONSE 4
+
+/* The time in nanoseconds since the scheduler started, at the resolution of
+ * the FreeRTOS tick.  A bridge with timesync_period_ms set estimates this
+ * clock, so the header.stamp of a topic with device_stamp set should be
+ * taken from it. */
+int64_t ros2serial_time_ns(void);
+
+/* Time-slotted sending, for a half-duplex link that is shared with the
+ * bridge: with ROS2SERIAL_TX_SLOT_CYCLE_MS set, frames are only sent from
+ * ROS2SERIAL_TX_SLOT_OFFSET_MS to ROS2SERIAL_TX_SLOT_OFFSET_MS +
+ * ROS2SERIAL_TX_SLOT_LENGTH_MS into every cycle of ros2serial_time_ns(),
+ * staying ROS2SERIAL_TX_SLOT_GUARD_MS away from either end, and wait in the
+ * transmit queue otherwise.  The bridge, with timesync_period_ms and its
+ * tx_slot_* parameters set, counts its own slot on the same clock; the two
+ * slots must not overlap. */
+#ifndef ROS2SERIAL_TX_SLOT_CYCLE_MS
+#define ROS2SERIAL_TX_SLOT_CYCLE_MS 0
+#endif
+#ifndef ROS2SERIAL_TX_SLOT_OFFSET_MS
+#define ROS2SERIAL_TX_SLOT_OFFSET_MS 0
+#endif
+#ifndef ROS2SERIAL_TX_SLOT_LENGTH_MS
+#define ROS2SERIAL_TX_SLOT_LENGTH_MS 0
+#endif
+#ifndef ROS2SERIAL_TX_SLOT_GUARD_MS
+#define ROS2SERIAL_TX_SLOT_GUARD_MS 0
+#endif
+
+/* Open or close the transmit queue for the slot we are in, and return the
+ * number of milliseconds until that changes, which is when this should be
+ * called again. */
+uint32_t ros2serial_tx_slot_update(void);
+
+/* Profiling: with ROS2SERIAL_PROFILE set to 1, each frame is timed in the
+ * stages below with board_cycle_count(), and ros2serial_send_profile()
+ * sends the bridge how many frames went through each stage, and the least,
+ * most and total cycles they took, since it was last called, as a
+ * ros2_serial_msgs/FirmwareProfile on topic 0, along with how often the
+ * core woke up and how long it was awake, from board_sleep_stats().  The
+ * handler stage includes whatever the handler publishes. */
+#ifndef ROS2SERIAL_PROFILE
+#define ROS2SERIAL_PROFILE 0
+#endif
+
+/* The kind of a ros2_serial_msgs/FirmwareProfile, and its stages. */
+#define ROS2SERIAL_PROFILE_KIND 5
+#define ROS2SERIAL_STAGE_RX_DECODE 0
+#define ROS2SERIAL_STAGE_RX_HANDLER 1
+#define ROS2SERIAL_STAGE_TX_CRC 2
+#define ROS2SERIAL_STAGE_TX_ENCODE 3
+#define ROS2SERIAL_NUM_STAGES 4
+
+/* Send the profile of the frames since the last call and start a new one.
+ * Returns false if the frame couldn't be queued, or if the firmware wasn't
+ * built with ROS2SERIAL_PROFILE. */
+bool ros2serial_send_profile(void);
+
+/* The CRC-16 (poly 0x8005) used for the frame payloads, computed with
+ * board_crc16(). */
+uint16_t crc16(uint8_t const *buffer, size_t len);
+
+#endif
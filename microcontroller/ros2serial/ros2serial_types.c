@@ -0,0 +1,39 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Generated by generate_ros2_topics.py --firmware-dir; do not edit.
+
+#include <string.h>
+
+#include "ros2serial/ros2serial_types.h"
+
+// A type with no strings or sequences has each field at the same offset in
+// every message, so when the buffer is in this machine's byte order and at
+// an offset with the same padding, the fields are copied straight to or from
+// there, rather than one microCDR call at a time.  Anything else (or not
+// enough room) goes the slow way, which also sets the error.
+
+bool ucdr_serialize_std_msgs_String(ucdrBuffer *mb, const std_msgs_String *msg)
+{
+  ucdr_serialize_string(mb, msg->data);
+
+  return !mb->error;
+}
+
+bool ucdr_deserialize_std_msgs_String(ucdrBuffer *mb, std_msgs_String *msg)
+{
+  ucdr_deserialize_string(mb, msg->data, sizeof(msg->data));
+
+  return !mb->error;
+}
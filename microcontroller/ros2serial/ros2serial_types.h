@@ -0,0 +1,53 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* Generated by generate_ros2_topics.py --firmware-dir; do not edit.
+
+   Each message type has a struct named after it, with a <name>_size field
+   after each sequence for the number of elements in use, and functions to
+   serialize it to and deserialize it from a microCDR buffer.  These return
+   false, with the error of the buffer set, if the data doesn't fit or a
+   string or sequence is longer than the struct has room for.  <TYPE>_MAX_SIZE
+   is the length of the longest serialized message, with every string and
+   sequence full, so a buffer that long always has room for one. */
+
+#ifndef ROS2SERIAL_TYPES_H
+#define ROS2SERIAL_TYPES_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ucdr/microcdr.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* std_msgs/String */
+#define STD_MSGS_STRING_TYPE_NAME "std_msgs/String"
+#define STD_MSGS_STRING_TYPE_HASH 0x5a99805aU
+#define STD_MSGS_STRING_MAX_SIZE 260U
+
+typedef struct std_msgs_String {
+  char data[256];
+} std_msgs_String;
+
+bool ucdr_serialize_std_msgs_String(ucdrBuffer *mb, const std_msgs_String *msg);
+bool ucdr_deserialize_std_msgs_String(ucdrBuffer *mb, std_msgs_String *msg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
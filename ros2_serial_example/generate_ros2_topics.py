@@ -18,14 +18,34 @@ import re
 import sys
 
 import em
+import yaml
 
 import ament_index_python.packages
 
+from rosidl_parser.definition import AbstractGenericString
+from rosidl_parser.definition import AbstractNestedType
+from rosidl_parser.definition import AbstractSequence
+from rosidl_parser.definition import AbstractWString
+from rosidl_parser.definition import Array
+from rosidl_parser.definition import BasicType
+from rosidl_parser.definition import BoundedSequence
+from rosidl_parser.definition import IdlLocator
+from rosidl_parser.definition import Message
+from rosidl_parser.definition import NamespacedType
+from rosidl_parser.parser import parse_idl_file
+
 class ROS2Type:
     def __init__(self, ns, ros_type, lower_type):
         self.ns = ns
         self.ros_type = ros_type
         self.lower_type = lower_type
+        self.type_hash = 0
+
+class BatchType(ROS2Type):
+    def __init__(self, ns, ros_type, lower_type, max_samples):
+        super().__init__(ns, ros_type, lower_type)
+        # The bound of the samples sequence, or 0 if it is unbounded.
+        self.max_samples = max_samples
 
 # Copied from rosidl_cmake
 def convert_camel_case_to_lower_case_underscore(value):
@@ -47,13 +67,789 @@ def uniquify(inlist):
         result.append(item)
     return result
 
+def types_in_config(path, section='topics'):
+    # A topic config is a parameter file, so the topics may be under the
+    # node, under a port of the node, or anywhere else a 'topics' key is
+    # found; collect the type of every topic in any of them, and the batch
+    # type of the topics that have one.  The services are found the same
+    # way, under 'services' keys.
+    with open(path, 'r') as infp:
+        config = yaml.safe_load(infp)
+
+    types = set()
+    def walk(node):
+        if not isinstance(node, dict):
+            return
+        for key, value in node.items():
+            if key == section and isinstance(value, dict):
+                for topic in value.values():
+                    if not isinstance(topic, dict):
+                        continue
+                    for type_key in ('type', 'batch_type'):
+                        if isinstance(topic.get(type_key), str):
+                            types.add(topic[type_key])
+            else:
+                walk(value)
+    walk(config)
+
+    return types
+
+class BakeError(Exception):
+    pass
+
+def cpp_string(value):
+    return '"' + value.replace('\\', '\\\\').replace('"', '\\"') + '"'
+
+def bake_int(topic, key, value, low, high):
+    if isinstance(value, bool) or not isinstance(value, int) or value < low or value > high:
+        raise BakeError("Invalid %s for topic '%s'; must be between %d and %d" % (key, topic, low, high))
+    return str(value)
+
+def bake_bool(topic, key, value):
+    if not isinstance(value, bool):
+        raise BakeError("Invalid %s for topic '%s'; must be true or false" % (key, topic))
+    return 'true' if value else 'false'
+
+def bake_rate(topic, key, value):
+    if isinstance(value, bool) or not isinstance(value, (int, float)) or not value >= 0:
+        raise BakeError("Invalid %s for topic '%s'; must be >= 0" % (key, topic))
+    return repr(float(value))
+
+def bake_choice(topic, key, value, choices):
+    if value not in choices:
+        raise BakeError("Invalid %s for topic '%s'; must be one of '%s'" % (key, topic, "' or '".join(choices)))
+    return choices[value]
+
+def bake_string(topic, key, value):
+    if not isinstance(value, str):
+        raise BakeError("Invalid %s for topic '%s'; must be a string" % (key, topic))
+    return cpp_string(value)
+
+UINT32_MAX = 0xffffffff
+
+# The members of BakedTopic (see ros2_topics.hpp.em), in order, with the
+# topic parameter that sets each of them, how that is checked and turned into
+# C++, and the C++ of its default, which is that of TopicMapping.  They are
+# checked the same way that parse_node_parameters_for_topics() checks the
+# parameters.
+BAKED_MEMBERS = [
+    ('type', lambda t, k, v: bake_string(t, k, v), '""'),
+    ('serial_mapping', lambda t, k, v: bake_int(t, k, v, 0, 0xffff), '-1'),
+    ('direction', lambda t, k, v: bake_choice(t, k, v, {'SerialToROS2': 'TopicMapping::Direction::SERIAL_TO_ROS2',
+                                                         'ROS2ToSerial': 'TopicMapping::Direction::ROS2_TO_SERIAL'}),
+     'TopicMapping::Direction::UNKNOWN'),
+    ('tx_queue_depth', lambda t, k, v: bake_int(t, k, v, 0, UINT32_MAX), '0'),
+    ('tx_overflow_policy', lambda t, k, v: bake_choice(t, k, v, {'drop_oldest': 'false', 'drop_newest': 'true'}), 'false'),
+    ('tx_priority', lambda t, k, v: bake_int(t, k, v, 0, 255), '0'),
+    ('tx_max_rate_hz', bake_rate, '0.0'),
+    ('passthrough', bake_bool, 'false'),
+    ('reliability', lambda t, k, v: bake_choice(t, k, v, {'reliable': 'false', 'best_effort': 'true'}), 'false'),
+    ('durability', lambda t, k, v: bake_choice(t, k, v, {'volatile': 'false', 'transient_local': 'true'}), 'false'),
+    ('history_depth', lambda t, k, v: bake_int(t, k, v, 1, UINT32_MAX), '10'),
+    ('deadline_ms', lambda t, k, v: bake_int(t, k, v, 0, 2**62), '-1'),
+    ('compress_threshold', lambda t, k, v: bake_int(t, k, v, 0, 2**62), '-1'),
+    ('delta_keyframe_interval', lambda t, k, v: bake_int(t, k, v, 0, UINT32_MAX), '0'),
+    ('reliable', bake_bool, 'false'),
+    ('bond_mode', lambda t, k, v: cpp_string(bake_choice(t, k, v, {'stripe': 'stripe', 'redundant': 'redundant'})), '""'),
+    ('stamp_header', bake_bool, 'false'),
+    ('device_stamp', bake_bool, 'false'),
+    ('lazy', bake_bool, 'false'),
+    ('max_rate_hz', bake_rate, '0.0'),
+    ('last_value', bake_bool, 'false'),
+    ('on_change', bake_bool, 'false'),
+    ('on_change_keepalive_ms', lambda t, k, v: bake_int(t, k, v, 0, UINT32_MAX), '1000'),
+    ('max_age_ms', lambda t, k, v: bake_int(t, k, v, 0, 0xffff), '0'),
+    ('rx_priority', lambda t, k, v: bake_int(t, k, v, 0, 255), '0'),
+    ('elide_length', bake_bool, 'false'),
+    ('intern_strings', bake_bool, 'false'),
+    ('batch_type', lambda t, k, v: bake_string(t, k, v), '""'),
+    ('batch_size', lambda t, k, v: bake_int(t, k, v, 0, UINT32_MAX), '0'),
+    ('batch_ms', lambda t, k, v: bake_int(t, k, v, 0, UINT32_MAX), '0'),
+    ('max_message_size', lambda t, k, v: bake_int(t, k, v, 0, UINT32_MAX), '0'),
+]
+
+class BakedTopic:
+    def __init__(self, index, port, name):
+        self.index = index
+        self.port = port
+        self.name = name
+        # The C++ of each member of BAKED_MEMBERS.
+        self.values = []
+        # The contents of the compress_dictionary, and the quantize specs.
+        self.dictionary = None
+        self.quantize = None
+
+    def initializer(self):
+        values = [cpp_string(self.port), cpp_string(self.name)] + self.values
+        values.append('BAKED_DICTIONARY_%d, sizeof(BAKED_DICTIONARY_%d)' % (self.index, self.index)
+                      if self.dictionary is not None else 'nullptr, 0')
+        values.append('BAKED_QUANTIZE_%d, %d' % (self.index, len(self.quantize))
+                      if self.quantize is not None else 'nullptr, 0')
+        return ', '.join(values)
+
+def baked_topics(path):
+    # The topics of a config file, to be built into the bridge.  Like
+    # types_in_config(), the parameters may be under a node; the topics are
+    # under each port in 'ports', or at the top if there are no ports.
+    with open(path, 'r') as infp:
+        config = yaml.safe_load(infp)
+
+    def find_params(node):
+        if not isinstance(node, dict):
+            return None
+        if isinstance(node.get('ros__parameters'), dict):
+            return node['ros__parameters']
+        for value in node.values():
+            params = find_params(value)
+            if params is not None:
+                return params
+        return None
+    params = find_params(config)
+    if params is None:
+        params = config if isinstance(config, dict) else {}
+
+    sections = []
+    if isinstance(params.get('ports'), list):
+        for port in params['ports']:
+            if isinstance(params.get(port), dict):
+                sections.append((port, params[port].get('topics')))
+    else:
+        sections.append(('', params.get('topics')))
+
+    baked = []
+    for port, topics in sections:
+        if not isinstance(topics, dict):
+            continue
+        for name in sorted(topics):
+            topic = topics[name]
+            if not isinstance(topic, dict):
+                raise BakeError("Invalid topic '%s'; must be a mapping of its parameters" % name)
+            unknown = set(topic) - set(key for key, _, _ in BAKED_MEMBERS) - {'compress_dictionary', 'quantize'}
+            if unknown:
+                raise BakeError("Invalid parameter(s) '%s' for topic '%s'" % ("', '".join(sorted(unknown)), name))
+            if 'type' not in topic or 'serial_mapping' not in topic or 'direction' not in topic:
+                raise BakeError("Topic '%s' needs a type, serial_mapping and direction" % name)
+
+            t = BakedTopic(len(baked), port, name)
+            for key, bake, default in BAKED_MEMBERS:
+                t.values.append(bake(name, key, topic[key]) if key in topic else default)
+            if 'compress_dictionary' in topic:
+                # A relative path is taken from the directory of the config.
+                dictionary = os.path.join(os.path.dirname(os.path.abspath(path)), topic['compress_dictionary'])
+                try:
+                    with open(dictionary, 'rb') as infp:
+                        t.dictionary = infp.read()
+                except OSError as e:
+                    raise BakeError("Failed to open compress_dictionary '%s' for topic '%s': %s" % (dictionary, name, e))
+                # An empty dictionary is the same as none, and an empty
+                # array isn't valid C++.
+                if not t.dictionary:
+                    t.dictionary = None
+            if 'quantize' in topic:
+                if not isinstance(topic['quantize'], list) or not all(isinstance(q, str) for q in topic['quantize']):
+                    raise BakeError("Invalid quantize for topic '%s'; must be a list of strings" % name)
+                t.quantize = [cpp_string(q) for q in topic['quantize']] or None
+            baked.append(t)
+
+    return baked
+
+# The CDR size of the basic types that can be part of a fixed layout.  wchar
+# and long double are left out, since their size depends on the Fast-CDR
+# version.
+CDR_SIZES = {
+    'boolean': 1, 'octet': 1, 'char': 1, 'int8': 1, 'uint8': 1,
+    'int16': 2, 'uint16': 2,
+    'int32': 4, 'uint32': 4, 'float': 4,
+    'int64': 8, 'uint64': 8, 'double': 8,
+}
+
+class NotFixed(Exception):
+    pass
+
+class FixedField:
+    def __init__(self, offset, size, accessor):
+        self.offset = offset
+        self.size = size
+        self.accessor = accessor
+
+class FixedLayout:
+    """
+    The CDR layout of a message type made only of fixed size fields, so that
+    every field is at the same offset in every message.  Fields are aligned
+    to their size relative to the start of the data, up to 8 bytes for CDR
+    (as microCDR and Fast-CDR 1 do) and up to 4 bytes for XCDR2 (as Fast-CDR
+    2 does by default); a type is only given a fixed layout if the two agree,
+    so the fixed layout always reads the same data as Fast-CDR would.
+    """
+    def __init__(self):
+        self.size = 0
+        self.fields = []
+        # Runs of padding, as (offset, length).
+        self.gaps = []
+        # The largest alignment of any field, so data that starts at a
+        # multiple of it has the same padding.
+        self.align = 1
+        # The element size of the last field.
+        self.last_size = 0
+
+    def add(self, accessor, elem_size, count):
+        offset = self.size
+        if offset % min(elem_size, 8) != 0:
+            offset += min(elem_size, 8) - offset % min(elem_size, 8)
+        offset_xcdr2 = self.size
+        if offset_xcdr2 % min(elem_size, 4) != 0:
+            offset_xcdr2 += min(elem_size, 4) - offset_xcdr2 % min(elem_size, 4)
+        if offset != offset_xcdr2:
+            raise NotFixed()
+        if offset != self.size:
+            self.gaps.append((self.size, offset - self.size))
+        self.fields.append(FixedField(offset, elem_size * count, accessor))
+        self.size = offset + elem_size * count
+        self.align = max(self.align, min(elem_size, 8))
+        self.last_size = elem_size
+
+_parsed_messages = {}
+
+def find_message(ns, name):
+    key = ns + '/' + name
+    if key not in _parsed_messages:
+        try:
+            basepath = ament_index_python.packages.get_package_share_directory(ns)
+        except ament_index_python.packages.PackageNotFoundError:
+            raise NotFixed()
+        relative = os.path.join('msg', name + '.idl')
+        if not os.path.exists(os.path.join(basepath, relative)):
+            raise NotFixed()
+        idl_file = parse_idl_file(IdlLocator(basepath, relative))
+        messages = idl_file.content.get_elements_of_type(Message)
+        if len(messages) != 1:
+            raise NotFixed()
+        _parsed_messages[key] = messages[0]
+
+    return _parsed_messages[key]
+
+def add_members(layout, message, prefix):
+    for member in message.structure.members:
+        accessor = prefix + member.name
+        member_type = member.type
+        count = 1
+        if isinstance(member_type, Array):
+            count = member_type.size
+            member_type = member_type.value_type
+        elif isinstance(member_type, AbstractNestedType):
+            # Sequences have a length that changes from message to message.
+            raise NotFixed()
+
+        if isinstance(member_type, BasicType):
+            if member_type.typename not in CDR_SIZES:
+                raise NotFixed()
+            layout.add(accessor, CDR_SIZES[member_type.typename], count)
+        elif isinstance(member_type, NamespacedType):
+            nested = find_message(member_type.namespaces[0], member_type.name)
+            if count == 1:
+                add_members(layout, nested, accessor + '.')
+            else:
+                for i in range(count):
+                    add_members(layout, nested, '%s[%d].' % (accessor, i))
+        else:
+            # Strings, which have a length that changes from message to
+            # message.
+            raise NotFixed()
+
+def fixed_layout(ns, name):
+    """Get the FixedLayout of a message type, or None if it doesn't have one."""
+    layout = FixedLayout()
+    try:
+        add_members(layout, find_message(ns, name), '')
+    except NotFixed:
+        return None
+
+    return layout
+
+class MinSize:
+    """
+    The length of the shortest CDR data of a message type, with every string
+    and sequence empty (just its 4 byte length).  Fields are only aligned up
+    to 4 bytes, as XCDR2 does; CDR aligns 8 byte fields to 8, which can only
+    make the data longer, so this is a lower bound for both.
+    """
+    def __init__(self):
+        self.size = 0
+
+    def add(self, elem_size, count):
+        align = min(elem_size, 4)
+        if self.size % align != 0:
+            self.size += align - self.size % align
+        self.size += elem_size * count
+
+def add_min_members(min_size, message):
+    for member in message.structure.members:
+        member_type = member.type
+        count = 1
+        if isinstance(member_type, Array):
+            count = member_type.size
+            member_type = member_type.value_type
+        elif isinstance(member_type, AbstractNestedType):
+            min_size.add(4, 1)
+            continue
+
+        if isinstance(member_type, BasicType):
+            # Basic types whose size isn't known count for nothing, which
+            # still leaves a lower bound.
+            if member_type.typename in CDR_SIZES:
+                min_size.add(CDR_SIZES[member_type.typename], count)
+        elif isinstance(member_type, NamespacedType):
+            nested = find_message(member_type.namespaces[0], member_type.name)
+            for i in range(count):
+                add_min_members(min_size, nested)
+        else:
+            min_size.add(4, count)
+
+def batched_type(ns, name):
+    """
+    Get the message type that a message type is a batch of, as (namespace,
+    name, bound), if its samples field is a sequence of a message type (see
+    batch_publisher.hpp), or None otherwise.  The bound is 0 for an
+    unbounded sequence.
+    """
+    try:
+        message = find_message(ns, name)
+    except NotFixed:
+        return None
+
+    for member in message.structure.members:
+        if member.name != 'samples' or not isinstance(member.type, AbstractSequence):
+            continue
+        value_type = member.type.value_type
+        if not isinstance(value_type, NamespacedType):
+            return None
+        bound = member.type.maximum_size if isinstance(member.type, BoundedSequence) else 0
+        return (value_type.namespaces[0], value_type.name, bound)
+
+    return None
+
+def min_cdr_size(ns, name):
+    """Get the length of the shortest CDR data of a message type, or 0 if it can't be worked out."""
+    min_size = MinSize()
+    try:
+        add_min_members(min_size, find_message(ns, name))
+    except NotFixed:
+        return 0
+
+    return min_size.size
+
+class PackedCodec:
+    """
+    The code that packs a message type (see packed_encoding.hpp), as lines of
+    C++ for the encode() and decode() of its packing struct, and the fields
+    they pass the index of.  Numbers and booleans are copied in native byte
+    order without padding, and sequences are sent as a varint length and
+    their elements.  Nested types are spelled out field by field, with a loop
+    for each array or sequence of them.
+    """
+    def __init__(self):
+        self.encode = []
+        self.decode = []
+        # The (path, kind) of each field, where kind is a PackedField::Kind.
+        self.fields = []
+        self.has_strings = False
+
+    def add(self, indent, encode, decode):
+        self.encode.append(' ' * indent + encode)
+        self.decode.append(' ' * indent + decode)
+
+    def add_field(self, path, kind):
+        self.fields.append((path, kind))
+        return len(self.fields) - 1
+
+def packed_length(member_type):
+    """Get the max_length argument of PackedReader::get_length(), if any, for a sequence."""
+    if isinstance(member_type, BoundedSequence):
+        return ', %d' % member_type.maximum_size
+    return ''
+
+def packed_kind(typename):
+    if typename == 'boolean':
+        return 'BOOLEAN'
+    if typename == 'float':
+        return 'FLOAT32'
+    if typename == 'double':
+        return 'FLOAT64'
+    return 'INTEGER'
+
+def add_packed_members(codec, message, prefix, path, indent, depth):
+    for member in message.structure.members:
+        accessor = prefix + member.name
+        member_path = path + member.name
+        member_type = member.type
+        value_type = member_type
+        if isinstance(member_type, (Array, AbstractNestedType)):
+            value_type = member_type.value_type
+        is_array = isinstance(member_type, Array)
+        is_sequence = not is_array and isinstance(member_type, AbstractNestedType)
+        index = 'i%d' % depth
+
+        if isinstance(value_type, BasicType):
+            if value_type.typename not in CDR_SIZES:
+                raise NotFixed()
+            size = CDR_SIZES[value_type.typename]
+            field = codec.add_field(member_path, packed_kind(value_type.typename))
+            if is_array:
+                codec.add(indent, 'writer.put_array<%d>(%s.data(), %d, %d);' % (size, accessor, member_type.size, field),
+                          'reader.get_array<%d>(%s.data(), %d, %d);' % (size, accessor, member_type.size, field))
+            elif is_sequence and value_type.typename == 'boolean':
+                # std::vector<bool> has no data(), so its elements are
+                # copied one at a time.
+                codec.add(indent, 'writer.put_field_length(%s.size(), %d);' % (accessor, field),
+                          '%s.resize(reader.get_field_length(%d, 1%s));' % (accessor, field, packed_length(member_type)))
+                codec.add(indent, 'for (size_t %s = 0; %s < %s.size(); ++%s)' % (index, index, accessor, index),
+                          'for (size_t %s = 0; %s < %s.size(); ++%s)' % (index, index, accessor, index))
+                codec.add(indent, '{', '{')
+                codec.add(indent + 4, 'writer.put<1>(static_cast<bool>(%s[%s]), %d);' % (accessor, index, field),
+                          'bool b = false;')
+                codec.decode.append(' ' * (indent + 4) + 'reader.get<1>(b, %d);' % field)
+                codec.decode.append(' ' * (indent + 4) + '%s[%s] = b;' % (accessor, index))
+                codec.add(indent, '}', '}')
+            elif is_sequence:
+                codec.add(indent, 'writer.put_field_length(%s.size(), %d);' % (accessor, field),
+                          '%s.resize(reader.get_field_length(%d, %d%s));' % (accessor, field, size, packed_length(member_type)))
+                codec.add(indent, 'writer.put_array<%d>(%s.data(), %s.size(), %d);' % (size, accessor, accessor, field),
+                          'reader.get_array<%d>(%s.data(), %s.size(), %d);' % (size, accessor, accessor, field))
+            else:
+                codec.add(indent, 'writer.put<%d>(%s, %d);' % (size, accessor, field),
+                          'reader.get<%d>(%s, %d);' % (size, accessor, field))
+            continue
+
+        if isinstance(value_type, AbstractWString) or not isinstance(value_type, (AbstractGenericString, NamespacedType)):
+            # Wide strings aren't packed, so their types aren't either.
+            raise NotFixed()
+
+        if is_array or is_sequence:
+            element = '%s[%s]' % (accessor, index)
+            if is_sequence:
+                codec.add(indent, 'writer.put_length(%s.size());' % accessor,
+                          '%s.resize(reader.get_length(1%s));' % (accessor, packed_length(member_type)))
+                count = '%s.size()' % accessor
+            else:
+                count = '%d' % member_type.size
+            loop = 'for (size_t %s = 0; %s < %s; ++%s)' % (index, index, count, index)
+            codec.add(indent, loop, loop)
+            codec.add(indent, '{', '{')
+            inner_indent = indent + 4
+        else:
+            element = accessor
+            inner_indent = indent
+
+        if isinstance(value_type, AbstractGenericString):
+            codec.has_strings = True
+            codec.add_field(member_path, 'STRING')
+            codec.add(inner_indent, 'writer.put_string(%s);' % element, 'reader.get_string(%s);' % element)
+        else:
+            nested = find_message(value_type.namespaces[0], value_type.name)
+            add_packed_members(codec, nested, element + '.', member_path + '.', inner_indent, depth + 1)
+
+        if is_array or is_sequence:
+            codec.add(indent, '}', '}')
+
+def packed_codec(ns, name):
+    """Get the PackedCodec of a message type, or None if it can't be packed."""
+    codec = PackedCodec()
+    try:
+        add_packed_members(codec, find_message(ns, name), 'msg.', '', 0, 0)
+    except NotFixed:
+        return None
+
+    return codec
+
+def describe_type(member_type):
+    if isinstance(member_type, Array):
+        return '%s[%d]' % (describe_type(member_type.value_type), member_type.size)
+    if isinstance(member_type, AbstractSequence):
+        if isinstance(member_type, BoundedSequence):
+            return 'sequence<%s,%d>' % (describe_type(member_type.value_type), member_type.maximum_size)
+        return 'sequence<%s>' % describe_type(member_type.value_type)
+    if isinstance(member_type, BasicType):
+        return member_type.typename
+    if isinstance(member_type, AbstractGenericString):
+        base = 'wstring' if isinstance(member_type, AbstractWString) else 'string'
+        if member_type.has_maximum_size():
+            return '%s<%d>' % (base, member_type.maximum_size)
+        return base
+    if isinstance(member_type, NamespacedType):
+        return describe_message(member_type.namespaces[0], member_type.name)
+    raise NotFixed()
+
+def describe_message(ns, name):
+    message = find_message(ns, name)
+    members = ['%s %s' % (describe_type(m.type), m.name) for m in message.structure.members]
+    return '%s/%s{%s}' % (ns, name, ';'.join(members))
+
+def type_hash(ns, name):
+    """
+    Get the hash of the definition of a message type that devices send in
+    the type_hashes of a SerialMapping, or 0 if it can't be worked out.
+    This is the 32-bit FNV-1a hash of a description of the type like
+    "pkg/Name{uint8 a;string<10> b;other_pkg/Other{float[3] c} d}", with the
+    fields of nested types spelled out, so that a change to any of them
+    changes the hash.  0 means "unknown", so a hash of 0 is made 1.
+    """
+    try:
+        description = describe_message(ns, name)
+    except NotFixed:
+        return 0
+
+    h = 0x811c9dc5
+    for b in description.encode():
+        h = ((h ^ b) * 0x01000193) & 0xffffffff
+
+    return h if h != 0 else 1
+
+# The C type of each basic type the firmware can use, which is also the
+# suffix of its microCDR functions.  char is a byte in ROS 2, so it is
+# carried as one.
+FIRMWARE_TYPES = {
+    'boolean': 'bool', 'octet': 'uint8_t', 'char': 'uint8_t', 'int8': 'int8_t', 'uint8': 'uint8_t',
+    'int16': 'int16_t', 'uint16': 'uint16_t',
+    'int32': 'int32_t', 'uint32': 'uint32_t', 'float': 'float',
+    'int64': 'int64_t', 'uint64': 'uint64_t', 'double': 'double',
+}
+
+class FirmwareUnsupported(Exception):
+    pass
+
+class FirmwareMember:
+    """
+    A field of the C struct of a message type.  kind is 'basic', 'string' or
+    'nested'; c_type is the C type of each element, which is char for
+    strings and the struct of the nested type for nested ones.  An array has
+    an array_size, and a sequence has room for sequence_capacity elements
+    and a <name>_size field with the number that are in use.  A string has
+    room for string_size - 1 characters and the terminating NUL.
+    """
+    def __init__(self, name, kind, c_type, elem_size, nested_key, array_size, sequence_capacity, string_size):
+        self.name = name
+        self.kind = kind
+        self.c_type = c_type
+        self.elem_size = elem_size
+        self.nested_key = nested_key
+        self.array_size = array_size
+        self.sequence_capacity = sequence_capacity
+        self.string_size = string_size
+
+    def declaration(self):
+        decl = '%s %s' % (self.c_type, self.name)
+        if self.array_size is not None:
+            decl += '[%d]' % self.array_size
+        if self.sequence_capacity is not None:
+            decl += '[%d]' % self.sequence_capacity
+        if self.kind == 'string':
+            decl += '[%d]' % self.string_size
+        return decl
+
+    def serialize(self, value):
+        """The microCDR call that serializes one element, value."""
+        if self.kind == 'basic':
+            return 'ucdr_serialize_%s(mb, %s);' % (self.c_type, value)
+        if self.kind == 'string':
+            return 'ucdr_serialize_string(mb, %s);' % value
+        return 'ucdr_serialize_%s(mb, &%s);' % (self.c_type, value)
+
+    def deserialize(self, value):
+        """The microCDR call that deserializes one element into value."""
+        if self.kind == 'basic':
+            return 'ucdr_deserialize_%s(mb, &%s);' % (self.c_type, value)
+        if self.kind == 'string':
+            return 'ucdr_deserialize_string(mb, %s, sizeof(%s));' % (value, value)
+        return 'ucdr_deserialize_%s(mb, &%s);' % (self.c_type, value)
+
+class FirmwareType:
+    def __init__(self, ns, name):
+        self.ns = ns
+        self.name = name
+        self.c_name = ns + '_' + name
+        self.macro = (ns + '_' + convert_camel_case_to_lower_case_underscore(name)).upper()
+        self.members = []
+        # (name, C value) of each constant.
+        self.constants = []
+        self.max_size = 0
+        self.fixed_layout = None
+        self.type_hash = 0
+
+class MaxSize:
+    """
+    The length of the longest CDR data of a message type as microCDR writes
+    it, with every string and sequence full.  Fields are aligned to their
+    size, up to 8 bytes, relative to the start of the data.  After a string
+    or sequence that isn't full a field starts earlier, and rounding an
+    earlier offset up never passes the rounded longest one, so the longest
+    data is still the one with everything full.
+    """
+    def __init__(self):
+        self.size = 0
+
+    def add(self, elem_size, count):
+        align = min(elem_size, 8)
+        if self.size % align != 0:
+            self.size += align - self.size % align
+        self.size += elem_size * count
+
+def add_max_members(max_size, firmware_type, firmware_types):
+    for m in firmware_type.members:
+        count = 1 if m.array_size is None else m.array_size
+        if m.sequence_capacity is not None:
+            max_size.add(4, 1)
+            count = m.sequence_capacity
+
+        if m.kind == 'basic':
+            max_size.add(m.elem_size, count)
+        elif m.kind == 'string':
+            for i in range(count):
+                max_size.add(4, 1)
+                max_size.add(1, m.string_size)
+        else:
+            for i in range(count):
+                add_max_members(max_size, firmware_types[m.nested_key], firmware_types)
+
+def firmware_constant(constant):
+    if isinstance(constant.type, AbstractGenericString):
+        return '"%s"' % constant.value.replace('\\', '\\\\').replace('"', '\\"')
+    typename = constant.type.typename
+    if typename == 'boolean':
+        return 'true' if constant.value else 'false'
+    if typename in ('float', 'double'):
+        return repr(float(constant.value)) + ('f' if typename == 'float' else '')
+    suffix = {'uint8': 'U', 'uint16': 'U', 'uint32': 'U', 'uint64': 'ULL', 'int64': 'LL'}
+    return str(constant.value) + suffix.get(typename, '')
+
+def add_firmware_type(ns, name, firmware_types, order, string_capacity, sequence_capacity):
+    """
+    Work out the C struct of a message type, after those of the types nested
+    in it, and add it to firmware_types and the end of order.
+    """
+    key = ns + '/' + name
+    if key in firmware_types:
+        return firmware_types[key]
+
+    try:
+        message = find_message(ns, name)
+    except NotFixed:
+        raise FirmwareUnsupported('%s: no definition was found' % key)
+
+    firmware_type = FirmwareType(ns, name)
+    for member in message.structure.members:
+        member_type = member.type
+        array_size = None
+        member_capacity = None
+        if isinstance(member_type, Array):
+            array_size = member_type.size
+            member_type = member_type.value_type
+        elif isinstance(member_type, AbstractSequence):
+            if isinstance(member_type, BoundedSequence):
+                member_capacity = member_type.maximum_size
+            else:
+                member_capacity = sequence_capacity
+            member_type = member_type.value_type
+
+        elem_size = 0
+        nested_key = None
+        string_size = 0
+        if isinstance(member_type, BasicType):
+            if member_type.typename not in FIRMWARE_TYPES:
+                raise FirmwareUnsupported('%s.%s: %s is not supported' % (key, member.name, member_type.typename))
+            kind = 'basic'
+            c_type = FIRMWARE_TYPES[member_type.typename]
+            elem_size = CDR_SIZES[member_type.typename]
+        elif isinstance(member_type, AbstractGenericString):
+            if isinstance(member_type, AbstractWString):
+                raise FirmwareUnsupported('%s.%s: wstring is not supported' % (key, member.name))
+            kind = 'string'
+            c_type = 'char'
+            if member_type.has_maximum_size():
+                string_size = member_type.maximum_size + 1
+            else:
+                string_size = string_capacity + 1
+        elif isinstance(member_type, NamespacedType):
+            nested = add_firmware_type(member_type.namespaces[0], member_type.name, firmware_types, order,
+                                       string_capacity, sequence_capacity)
+            kind = 'nested'
+            c_type = nested.c_name
+            nested_key = nested.ns + '/' + nested.name
+        else:
+            raise FirmwareUnsupported('%s.%s: the type is not supported' % (key, member.name))
+
+        firmware_type.members.append(FirmwareMember(member.name, kind, c_type, elem_size, nested_key,
+                                                    array_size, member_capacity, string_size))
+
+    for constant in message.constants:
+        firmware_type.constants.append((constant.name, firmware_constant(constant)))
+
+    firmware_types[key] = firmware_type
+    max_size = MaxSize()
+    add_max_members(max_size, firmware_type, firmware_types)
+    firmware_type.max_size = max_size.size
+    firmware_type.fixed_layout = fixed_layout(ns, name)
+    firmware_type.type_hash = type_hash(ns, name)
+    order.append(firmware_type)
+
+    return firmware_type
+
 MARKER_START = '// with input from '
 
+def read_marker(f, kind):
+    """
+    Get the (namespace, name) of the type an IDL file was generated from.
+
+    The IDL files that are generated from rosidl_fastrtps_cpp all have a
+    two-line comment header; the second line looks like:
+
+    // with input from std_msgs/msg/String.msg
+
+    We look through the passed in IDL file for the line that begins with
+    that string, and parse it apart into the 3-tuple containing the
+    namespace, the kind ('msg' or 'srv'), and the name with its extension.
+    """
+    with open(f, 'r') as infp:
+        marker_line = None
+        for line in infp:
+            if line.startswith(MARKER_START):
+                marker_line = line
+                break
+
+    if marker_line is None:
+        print("Failed to find marker '%s' in '%s'; quitting" % (MARKER_START, f))
+        sys.exit(3)
+
+    # We found the name of the original file; we can do conversions on it now
+    split = marker_line[len(MARKER_START):].strip().split('/')
+    if len(split) != 3 or split[1] != kind:
+        print("Failed to find proper marker '%s' in '%s'; quitting" % (MARKER_START, f))
+        sys.exit(2)
+
+    # This removes the '.msg' or '.srv' off the back
+    return split[0], split[2][:-4]
+
+def expand_template(tmpl, output, em_locals):
+    with open(output, 'w') as outfp:
+        interpreter = em.Interpreter(output=outfp, globals=em_locals,
+                                     options={em.RAW_OPT: True, em.BUFFERED_OPT: True})
+        with open(tmpl, 'r') as infp:
+            interpreter.file(infp)
+
+        interpreter.shutdown()
+
 if __name__ == '__main__':
     parser = argparse.ArgumentParser()
     parser.add_argument('--packages', help='Space-separated list of packages to generate code for', nargs='*', default=[])
     parser.add_argument('--ros2-msgs', help='Space-separated list of ROS 2 messages to generate code for', nargs='*', default=[])
+    parser.add_argument('--ros2-srvs', help='Space-separated list of ROS 2 services to generate code for', nargs='*', default=[])
+    parser.add_argument('--config-files', help='Space-separated list of topic config files; only generate code for the types their topics and services use', nargs='*', default=None)
+    parser.add_argument('--baked-config', help='A topic config file whose topics are built into the bridge, rather than read from its parameters; only the types it uses are generated, as with --config-files')
+    parser.add_argument('--type-plugins', help='Load each type from a plugin of its own, rather than building them all in', action='store_true')
     parser.add_argument('--print-outputs', help='Print a semicolon-separated list of the files that *would* be generated', action='store_true')
+    parser.add_argument('--print-type-hashes', help='Print the hash of each type, for devices to send in their SerialMapping', action='store_true')
+    parser.add_argument('--firmware-dir', help='Also generate C structs and microCDR functions for the types into ros2serial_types.h and ros2serial_types.c in this directory, for the firmware')
+    parser.add_argument('--firmware-string-capacity', help='The number of characters the C structs have room for in strings without a bound', type=int, default=255)
+    parser.add_argument('--firmware-sequence-capacity', help='The number of elements the C structs have room for in sequences without a bound', type=int, default=16)
     parser.add_argument('template_dir', help='Path to template directory')
     parser.add_argument('output_dir', help='Path to output directory')
     args = parser.parse_args()
@@ -88,91 +884,178 @@ if __name__ == '__main__':
     # Uniquify the list to only generate code for each message once.
     idl_files = uniquify(idl_files)
 
-    em_globals = {'ros2_types': []}
+    srv_idl_files = []
+    for t in args.ros2_srvs:
+        split = t.strip().split('/')
+        if len(split) != 2:
+            print("Invalid ros2 service type; must be of the form <package>/<srv>")
+            sys.exit(1)
+        package = split[0]
+        service = split[1]
+        f = os.path.join(ament_index_python.packages.get_package_share_directory(package), 'srv', service + '.idl')
+        if not os.path.exists(f):
+            print("Failed to find service '%s' in package '%s'; quitting" % (service, package))
+            sys.exit(1)
+        srv_idl_files.append(f)
+
+    srv_idl_files = uniquify(srv_idl_files)
+
+    # The topics of a baked config need their types built in, and only
+    # those are.
+    baked = []
+    if args.baked_config is not None:
+        if args.type_plugins:
+            print("A baked config can't be used with --type-plugins; quitting", file=sys.stderr)
+            sys.exit(1)
+        try:
+            baked = baked_topics(args.baked_config)
+        except BakeError as e:
+            print("Failed to bake '%s': %s; quitting" % (args.baked_config, e), file=sys.stderr)
+            sys.exit(1)
+        args.config_files = (args.config_files or []) + [args.baked_config]
+
+    config_types = None
+    config_srv_types = None
+    if args.config_files is not None:
+        config_types = set()
+        config_srv_types = set()
+        for c in args.config_files:
+            config_types |= types_in_config(c)
+            config_srv_types |= types_in_config(c, 'services')
+
+    em_globals = {'ros2_types': [], 'ros2_services': [], 'type_plugins': args.type_plugins, 'baked_topics': baked}
     outputs_to_print = []
+    selected = []
     for f in idl_files:
-        with open(f, 'r') as infp:
-            marker_line = None
-            for line in infp:
-                # The IDL files that are generated from rosidl_fastrtps_cpp all
-                # have a two-line comment header; the second line looks like:
-                #
-                # // with input from std_msgs/msg/String.msg
-                #
-                # We look through the passed in IDL file for lines that begin
-                # with that string; once we find it, we parse the line apart to
-                # the the 3-tuple containing the namespace, the string 'msg',
-                # and the name.  The namespace and 'msg' are used in the output
-                # verbatim, but we have to do a bit of munging on the name.
-                # In particular, we remove the .msg, then do a conversion of
-                # camel case to lower case with underscores to get the filename
-                # that things are stored in.  Once we have all of that
-                # information, we can create the strings that are necessary for
-                # creating the ros2_topics.hpp file.
-
-                if not line.startswith(MARKER_START):
-                    continue
+        # The namespace is used in the output verbatim, but we have to do a
+        # conversion of camel case to lower case with underscores on the name
+        # to get the filename that things are stored in.  Once we have all of
+        # that information, we can create the strings that are necessary for
+        # creating the ros2_topics.hpp file.
+        ns, name = read_marker(f, 'msg')
+        lowername = convert_camel_case_to_lower_case_underscore(name)
 
-                marker_line = line
-                break
+        if config_types is not None:
+            if ns + '/' + name not in config_types:
+                continue
+            config_types.discard(ns + '/' + name)
 
-            if marker_line is None:
-                print("Failed to find marker '%s' in '%s'; quitting" % (MARKER_START, f))
-                sys.exit(3)
+        selected.append((ns, name, lowername))
 
-            # We found the name of the original file; we can do conversions on it now
-            split = marker_line[len(MARKER_START):].strip().split('/')
-            if len(split) != 3:
-                print("Failed to find proper marker '%s' in '%s'; quitting" % (MARKER_START, f))
-                sys.exit(2)
+    # A type whose samples are a sequence of another type that the bridge is
+    # built with is a batch of it; the factories of the other type create
+    # the publishers of its batches.
+    batches = {}
+    if not args.print_outputs:
+        built = set(ns + '/' + name for ns, name, _ in selected)
+        for ns, name, lowername in selected:
+            batched = batched_type(ns, name)
+            if batched is not None and batched[0] + '/' + batched[1] in built:
+                batches.setdefault(batched[0] + '/' + batched[1], []).append(BatchType(ns, name, lowername, batched[2]))
 
-            ns = split[0]
-            msg = split[1]
-            name = split[2][:-4]  # This removes the '.msg' off the back
-            lowername = convert_camel_case_to_lower_case_underscore(name)
+    for ns, name, lowername in selected:
+        ros2_type = ROS2Type(ns, name, lowername)
 
-            ros2_type = ROS2Type(ns, name, lowername)
+        em_globals['ros2_types'].append(ros2_type)
 
-            em_globals['ros2_types'].append(ros2_type)
+        cpp_tmpl = os.path.join(args.template_dir, 'pub_sub_type.cpp.em')
+        cpp_output = os.path.join(args.output_dir, ns + '_' + lowername + '_pub_sub_type.cpp')
+        hpp_tmpl = os.path.join(args.template_dir, 'pub_sub_type.hpp.em')
+        hpp_output = os.path.join(args.output_dir, ns + '_' + lowername + '_pub_sub_type.hpp')
 
-            cpp_tmpl = os.path.join(args.template_dir, 'pub_sub_type.cpp.em')
-            cpp_output = os.path.join(args.output_dir, ns + '_' + lowername + '_pub_sub_type.cpp')
-            hpp_tmpl = os.path.join(args.template_dir, 'pub_sub_type.hpp.em')
-            hpp_output = os.path.join(args.output_dir, ns + '_' + lowername + '_pub_sub_type.hpp')
+        if args.print_outputs:
+            outputs_to_print.append(cpp_output)
+            outputs_to_print.append(hpp_output)
+            continue
 
-            if args.print_outputs:
-                outputs_to_print.append(cpp_output)
-                outputs_to_print.append(hpp_output)
+        ros2_type.type_hash = type_hash(ns, name)
+        if args.print_type_hashes:
+            print('%s/%s 0x%08x' % (ns, name, ros2_type.type_hash))
+            continue
+
+        expand_template(cpp_tmpl, cpp_output, {'ros2_type': ros2_type, 'fixed_layout': fixed_layout(ns, name),
+                                               'min_size': min_cdr_size(ns, name),
+                                               'packing': packed_codec(ns, name),
+                                               'batches': batches.get(ns + '/' + name, [])})
+        expand_template(hpp_tmpl, hpp_output, {'ros2_type': ros2_type})
+
+    if config_types:
+        print("Failed to find type(s) '%s' from the config files in the packages or messages; quitting" % ("', '".join(sorted(config_types))), file=sys.stderr)
+        sys.exit(1)
+
+    # Services are always built into the bridge, even with --type-plugins,
+    # since there are only ever a few of them.
+    for f in srv_idl_files:
+        ns, name = read_marker(f, 'srv')
+        lowername = convert_camel_case_to_lower_case_underscore(name)
+
+        if config_srv_types is not None:
+            if ns + '/' + name not in config_srv_types:
                 continue
+            config_srv_types.discard(ns + '/' + name)
 
-            em_cpp_locals = {'ros2_type': ros2_type}
-            with open(cpp_output, 'w') as outfp:
-                interpreter = em.Interpreter(output=outfp, globals=em_cpp_locals,
-                                             options={em.RAW_OPT: True, em.BUFFERED_OPT: True})
-                with open(cpp_tmpl, 'r') as infp:
-                    interpreter.file(infp)
+        ros2_service = ROS2Type(ns, name, lowername)
+        em_globals['ros2_services'].append(ros2_service)
 
-                interpreter.shutdown()
+        if args.print_type_hashes:
+            continue
+
+        cpp_output = os.path.join(args.output_dir, ns + '_' + lowername + '_service_type.cpp')
+        hpp_output = os.path.join(args.output_dir, ns + '_' + lowername + '_service_type.hpp')
+        if args.print_outputs:
+            outputs_to_print.append(cpp_output)
+            outputs_to_print.append(hpp_output)
+            continue
+
+        expand_template(os.path.join(args.template_dir, 'service_type.cpp.em'), cpp_output, {'ros2_service': ros2_service})
+        expand_template(os.path.join(args.template_dir, 'service_type.hpp.em'), hpp_output, {'ros2_service': ros2_service})
+
+    if config_srv_types:
+        print("Failed to find service type(s) '%s' from the config files in the services; quitting" % ("', '".join(sorted(config_srv_types))), file=sys.stderr)
+        sys.exit(1)
+
+    if args.print_type_hashes:
+        sys.exit(0)
+
+    # find_registered_type() binary searches the types, so they have to be
+    # in the same order that std::string compares them in.
+    em_globals['ros2_types'].sort(key=lambda t: (t.ns + '/' + t.ros_type).encode())
+    em_globals['ros2_services'].sort(key=lambda t: (t.ns + '/' + t.ros_type).encode())
+
+    for name in ['ros2_topics.hpp', 'ros2_topics.cpp']:
+        ros2_topics_tmpl = os.path.join(args.template_dir, name + '.em')
+        ros2_topics_output = os.path.join(args.output_dir, name)
+        if args.print_outputs:
+            outputs_to_print.append(ros2_topics_output)
+            continue
 
-            em_hpp_locals = {'ros2_type': ros2_type}
-            with open(hpp_output, 'w') as outfp:
-                interpreter = em.Interpreter(output=outfp, globals=em_hpp_locals,
+        expand_template(ros2_topics_tmpl, ros2_topics_output, em_globals)
+
+    if args.firmware_dir is not None:
+        firmware_types = {}
+        firmware_order = []
+        try:
+            for t in em_globals['ros2_types'] if not args.print_outputs else []:
+                add_firmware_type(t.ns, t.ros_type, firmware_types, firmware_order,
+                                  args.firmware_string_capacity, args.firmware_sequence_capacity)
+        except FirmwareUnsupported as e:
+            print("Failed to generate the firmware type %s; quitting" % e, file=sys.stderr)
+            sys.exit(1)
+
+        for name in ['ros2serial_types.h', 'ros2serial_types.c']:
+            firmware_tmpl = os.path.join(args.template_dir, name + '.em')
+            firmware_output = os.path.join(args.firmware_dir, name)
+            if args.print_outputs:
+                outputs_to_print.append(firmware_output)
+                continue
+
+            with open(firmware_output, 'w') as outfp:
+                interpreter = em.Interpreter(output=outfp, globals={'firmware_types': firmware_order},
                                              options={em.RAW_OPT: True, em.BUFFERED_OPT: True})
-                with open(hpp_tmpl, 'r') as infp:
+                with open(firmware_tmpl, 'r') as infp:
                     interpreter.file(infp)
 
                 interpreter.shutdown()
 
-    ros2_topics_tmpl = os.path.join(args.template_dir, 'ros2_topics.hpp.em')
-    ros2_topics_output = os.path.join(args.output_dir, 'ros2_topics.hpp')
     if args.print_outputs:
-        outputs_to_print.append(ros2_topics_output)
         print(';'.join(outputs_to_print))
-    else:
-        with open(ros2_topics_output, 'w') as outfp:
-            interpreter = em.Interpreter(output=outfp, globals=em_globals,
-                                         options={em.RAW_OPT: True, em.BUFFERED_OPT: True})
-            with open(ros2_topics_tmpl, 'r') as infp:
-                interpreter.file(infp)
-
-            interpreter.shutdown()
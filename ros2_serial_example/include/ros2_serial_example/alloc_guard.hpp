@@ -0,0 +1,113 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ROS2_SERIAL_EXAMPLE__ALLOC_GUARD_HPP_
+#define ROS2_SERIAL_EXAMPLE__ALLOC_GUARD_HPP_
+
+#include <cstdint>
+#include <string>
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+/**
+ * What to do about an allocation on the hot path.
+ *
+ * The library that defines these functions also replaces the global
+ * operator new and operator delete, so that every C++ allocation made while
+ * a HotPathScope is active on the allocating thread can be reported.
+ * Allocations made with malloc() directly (for instance, by the C layers of
+ * the middleware) aren't seen.
+ */
+enum class AllocGuardMode
+{
+    /// Allocations aren't checked.
+    OFF,
+    /// Each allocation on the hot path is counted and logged to stderr, with
+    /// a backtrace of where it came from.
+    LOG,
+    /// The first allocation on the hot path is logged and aborts the process.
+    ABORT,
+};
+
+/**
+ * Parse the name of an AllocGuardMode: "off", "log" or "abort".
+ *
+ * @param[in] name The name of the mode.
+ * @param[out] mode The mode, if the name is valid.
+ * @returns true if the name is valid, false otherwise.
+ */
+bool parse_alloc_guard_mode(const std::string & name, AllocGuardMode * mode);
+
+/**
+ * Set what to do about allocations on the hot path, for all threads.
+ *
+ * @param[in] mode The mode.
+ * @returns true on success, or false if mode isn't OFF but the replaced
+ *          operator new isn't the one in use (for instance, because another
+ *          library loaded earlier replaces it too), so that allocations
+ *          can't be seen.
+ */
+bool set_alloc_guard_mode(AllocGuardMode mode);
+
+/**
+ * Get the number of allocations on the hot path so far.
+ *
+ * @returns The number of allocations seen while the mode wasn't OFF.
+ */
+uint64_t get_hot_path_allocations();
+
+/**
+ * Mark the calling thread as being on the hot path while this object lives.
+ * Scopes may be nested.
+ */
+class HotPathScope final
+{
+public:
+    HotPathScope();
+    ~HotPathScope();
+
+    HotPathScope(HotPathScope const &) = delete;
+    HotPathScope& operator=(HotPathScope const &) = delete;
+    HotPathScope(HotPathScope &&) = delete;
+    HotPathScope& operator=(HotPathScope &&) = delete;
+};
+
+/**
+ * Take the calling thread off the hot path while this object lives, for
+ * rare work inside a HotPathScope that is allowed to allocate, such as
+ * handling control messages or errors.
+ */
+class ColdPathScope final
+{
+public:
+    ColdPathScope();
+    ~ColdPathScope();
+
+    ColdPathScope(ColdPathScope const &) = delete;
+    ColdPathScope& operator=(ColdPathScope const &) = delete;
+    ColdPathScope(ColdPathScope &&) = delete;
+    ColdPathScope& operator=(ColdPathScope &&) = delete;
+
+private:
+    unsigned int saved_depth_;
+};
+
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
+
+#endif
@@ -0,0 +1,219 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ROS2_SERIAL_EXAMPLE__ASYNC_LOG_HPP_
+#define ROS2_SERIAL_EXAMPLE__ASYNC_LOG_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+/**
+ * The AsyncLog class takes log messages off the threads that move data.
+ *
+ * Printing straight from the read thread (for instance, for every frame with
+ * a bad CRC on a noisy link) blocks it on the console for as long as the
+ * console takes, which is just when it has the most to do.  Instead, log()
+ * formats the message into a slot of a bounded, lock-free queue (the same
+ * kind of queue as the FrameQueue of the TxQueue) and returns; a background
+ * thread takes the messages from the queue every POLL_INTERVAL and hands
+ * them to the sink, which by default prints them to stderr, and in the bridge
+ * forwards them to the rclcpp logger of the node.  If the queue is full, the
+ * message is dropped and counted.
+ *
+ * Each call site has a Site, which allows it at most max_per_second messages
+ * per second; the ones over that are only counted, and the count is added to
+ * the next message from the site that is let through.  The background thread
+ * also coalesces a run of identical messages into the first one and a
+ * "last message repeated N times" line.
+ *
+ * Neither log() nor the rate limiting allocates or takes a lock, so they are
+ * safe to use inside a HotPathScope.  Messages longer than MESSAGE_SIZE - 1
+ * characters are truncated.
+ */
+class AsyncLog final
+{
+public:
+    enum class Level
+    {
+        INFO,
+        WARN,
+        ERROR,
+    };
+
+    /// Where the messages end up; called on the background thread only.
+    typedef std::function<void(Level, const char *)> Sink;
+
+    /// The longest message, including the terminating NUL.
+    static constexpr size_t MESSAGE_SIZE = 192;
+
+    /// How often the background thread looks for messages.
+    static constexpr std::chrono::milliseconds POLL_INTERVAL{20};
+
+    /**
+     * The rate limit of one call site.  A Site has no constructor to run, so
+     * it can be a function-local static without a guard (see
+     * ROS2_SERIAL_LOG()).
+     */
+    struct Site final
+    {
+        std::atomic<int64_t> window_start_ns{0};
+        std::atomic<uint32_t> in_window{0};
+        std::atomic<uint64_t> suppressed{0};
+    };
+
+    /**
+     * Construct an AsyncLog and start its background thread.
+     *
+     * @param[in] capacity The most messages that can be waiting at once.
+     * @param[in] max_per_second The most messages per second from each Site.
+     * @param[in] sink Where to send the messages, or an empty function for
+     *                 stderr.
+     * @throws std::runtime_error If capacity or max_per_second is 0.
+     */
+    AsyncLog(size_t capacity, uint32_t max_per_second, Sink sink);
+    ~AsyncLog();
+
+    AsyncLog(AsyncLog const &) = delete;
+    AsyncLog& operator=(AsyncLog const &) = delete;
+    AsyncLog(AsyncLog &&) = delete;
+    AsyncLog& operator=(AsyncLog &&) = delete;
+
+    /**
+     * Get the AsyncLog of the process, which the transports and the
+     * publishers and subscriptions log to.  It is created the first time
+     * this is called.
+     *
+     * @returns The AsyncLog of the process.
+     */
+    static AsyncLog & instance();
+
+    /**
+     * Queue a message, if the site hasn't used up its rate.
+     *
+     * @param[in] site The call site of the message.
+     * @param[in] level The level of the message.
+     * @param[in] fmt The printf() format of the message.
+     */
+    void log(Site * site, Level level, const char * fmt, ...) __attribute__((format(printf, 4, 5)));
+
+    /**
+     * Change where the messages go.  Messages queued before the call may go
+     * to either sink.
+     *
+     * @param[in] sink The new sink, or an empty function for stderr.
+     */
+    void set_sink(Sink sink);
+
+    /**
+     * Wait until every message queued before the call has been handed to the
+     * sink, including the count of a run of repeats that is still open.
+     */
+    void flush();
+
+    /**
+     * Get the number of messages dropped because the queue was full.
+     *
+     * @returns The number of messages dropped so far.
+     */
+    uint64_t get_dropped() const
+    {
+        return dropped_;
+    }
+
+    /**
+     * Get the number of messages held back by the rate limits of their sites.
+     *
+     * @returns The number of messages suppressed so far.
+     */
+    uint64_t get_suppressed() const
+    {
+        return suppressed_;
+    }
+
+private:
+    struct Slot final
+    {
+        std::atomic<size_t> seq{0};
+        Level level{Level::INFO};
+        uint64_t suppressed{0};
+        char text[MESSAGE_SIZE];
+    };
+
+    // A message waiting to see whether the next ones repeat it.
+    struct Pending final
+    {
+        bool valid{false};
+        Level level{Level::INFO};
+        char text[MESSAGE_SIZE];
+        uint64_t repeats{0};
+        uint64_t suppressed{0};
+        std::chrono::steady_clock::time_point first_repeat{};
+    };
+
+    bool allow(Site * site, uint64_t * suppressed);
+    void thread_func();
+    void drain(Pending * pending);
+    void emit(Level level, const char * text, uint64_t suppressed);
+    void emit_repeats(Pending * pending);
+
+    std::unique_ptr<Slot[]> slots_;
+    size_t num_slots_;
+    uint32_t max_per_second_;
+    std::atomic<size_t> enqueue_pos_{0};
+    size_t dequeue_pos_{0};
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    // Under mutex_.
+    Sink sink_;
+    bool running_{true};
+    size_t flush_requested_{0};
+    size_t flushed_{0};
+
+    std::atomic<uint64_t> dropped_{0};
+    std::atomic<uint64_t> suppressed_{0};
+    std::thread thread_;
+};
+
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
+
+/**
+ * Log a printf() style message to the AsyncLog of the process, with a rate
+ * limit for this call site.
+ *
+ * @param level INFO, WARN or ERROR.
+ */
+#define ROS2_SERIAL_LOG(level, ...) \
+    do \
+    { \
+        static ::ros2_to_serial_bridge::transport::AsyncLog::Site ros2_serial_log_site; \
+        ::ros2_to_serial_bridge::transport::AsyncLog::instance().log( \
+            &ros2_serial_log_site, ::ros2_to_serial_bridge::transport::AsyncLog::Level::level, __VA_ARGS__); \
+    } while (0)
+
+#endif
@@ -0,0 +1,141 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ROS2_SERIAL_EXAMPLE__BAG_RECORDER_HPP_
+#define ROS2_SERIAL_EXAMPLE__BAG_RECORDER_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+
+#include <rosbag2_cpp/writer.hpp>
+
+#include "ros2_serial_example/dispatch_pool.hpp"
+#include "ros2_serial_example/topic_id.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace pubsub
+{
+
+/**
+ * The BagRecorder class writes the messages received from the serial ports
+ * straight into a rosbag2 bag, without deserializing them or going through
+ * the middleware.
+ *
+ * The payloads on the serial port are bare CDR, so each one only needs the
+ * encapsulation header put in front of it to be a serialized message.  The
+ * read thread copies the payloads into the queue of a thread of its own (a
+ * one worker DispatchPool), which writes them to the bag; if the bag can't
+ * keep up and the queue fills, payloads are dropped rather than holding up
+ * the read thread.
+ */
+class BagRecorder final
+{
+public:
+    /// A topic that is recorded.
+    struct Topic final
+    {
+        /// The ROS 2 topic name.
+        std::string name;
+        /// The type, as "<package>/<name>" or "<package>/msg/<name>".
+        std::string type;
+    };
+
+    /**
+     * Construct a BagRecorder, creating the bag and starting its thread.
+     *
+     * @param[in] uri The path of the bag to create.
+     * @param[in] storage_id The rosbag2 storage plugin to write it with,
+     *                       such as "mcap" or "sqlite3".
+     * @param[in] queue_bytes The size of the queue of the thread, in bytes.
+     * @throws std::runtime_error If the bag can't be created.
+     */
+    BagRecorder(const std::string & uri, const std::string & storage_id, size_t queue_bytes);
+
+    ~BagRecorder();
+
+    BagRecorder(BagRecorder const &) = delete;
+    BagRecorder& operator=(BagRecorder const &) = delete;
+    BagRecorder(BagRecorder &&) = delete;
+    BagRecorder& operator=(BagRecorder &&) = delete;
+
+    /**
+     * Set the topics that are recorded from a source, replacing any that
+     * were set before.  Payloads of any other topic ID from the source are
+     * dropped.
+     *
+     * @param[in] source The source, such as the index of the serial port.
+     * @param[in] topics The topics to record, by serial mapping.
+     */
+    void set_topics(uint16_t source, const std::map<topic_id_size_t, Topic> & topics);
+
+    /**
+     * Queue a received payload to be written to the bag.  Only one thread
+     * may call this.
+     *
+     * @param[in] source The source of the payload.
+     * @param[in] topic_ID The topic ID of the payload.
+     * @param[in] buffer The payload, as bare CDR.
+     * @param[in] length The length of the payload.
+     * @param[in] receive_time The time the payload was received, which
+     *                         becomes the time stamp of the message.
+     * @returns true if the payload was queued, false if the queue is full.
+     */
+    bool push(uint16_t source, topic_id_size_t topic_ID, const uint8_t * buffer, size_t length,
+              std::chrono::system_clock::time_point receive_time);
+
+    /**
+     * Stop the thread, throwing away any payloads it hasn't written yet, and
+     * close the bag.  This is done by the destructor too.
+     */
+    void stop();
+
+    /**
+     * Get the number of payloads that were dropped because the queue was
+     * full.
+     *
+     * @returns The number of dropped payloads.
+     */
+    uint64_t get_drops() const
+    {
+        return drops_;
+    }
+
+private:
+    void write(uint16_t source, topic_id_size_t topic_ID, const uint8_t * buffer, size_t length,
+               std::chrono::system_clock::time_point receive_time);
+
+    std::unique_ptr<rosbag2_cpp::Writer> writer_;
+    // The topics by source and topic ID, and the names of the topics that
+    // have been created in the bag; the bag is only written under the mutex
+    // too, so that topics are never created in the middle of a write.
+    std::mutex topics_mutex_;
+    std::map<uint16_t, std::map<topic_id_size_t, Topic>> topics_;
+    std::set<std::string> created_;
+    std::atomic<uint64_t> drops_{0};
+    std::unique_ptr<ros2_to_serial_bridge::transport::DispatchPool> pool_;
+};
+
+}  // namespace pubsub
+}  // namespace ros2_to_serial_bridge
+
+#endif
@@ -0,0 +1,220 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ROS2_SERIAL_EXAMPLE__BATCH_PUBLISHER_HPP_
+#define ROS2_SERIAL_EXAMPLE__BATCH_PUBLISHER_HPP_
+
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include <builtin_interfaces/msg/time.hpp>
+#include <rclcpp/rclcpp.hpp>
+
+#include "ros2_serial_example/tracing.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace pubsub
+{
+
+/**
+ * Whether the batch message type B has a stamps field to put the receive
+ * time of each sample in.
+ */
+template<typename B, typename = void>
+struct has_batch_stamps : std::false_type {};
+
+template<typename B>
+struct has_batch_stamps<B, decltype(void(std::declval<B &>().stamps.push_back(builtin_interfaces::msg::Time())))>
+    : std::true_type {};
+
+/**
+ * The BatchSink class template is where a PublisherImpl of messages of type
+ * T puts each message it decodes when the topic is published in batches
+ * (see PublisherImpl's constructor), rather than publishing it itself.
+ */
+template<typename T>
+class BatchSink
+{
+public:
+    BatchSink() {}
+    virtual ~BatchSink() {}
+
+    BatchSink(BatchSink const &) = delete;
+    BatchSink& operator=(BatchSink const &) = delete;
+    BatchSink(BatchSink &&) = delete;
+    BatchSink& operator=(BatchSink &&) = delete;
+
+    /**
+     * Add a message to the batch, publishing the batch if that fills it.
+     *
+     * @param[in] msg The message.
+     * @param[in] receive_time The time the message was received.
+     */
+    virtual void add(const T & msg, std::chrono::system_clock::time_point receive_time) = 0;
+
+    /**
+     * Get the number of subscriptions to the batches.
+     *
+     * @returns The number of subscriptions.
+     */
+    virtual size_t get_subscription_count() const = 0;
+};
+
+/**
+ * The BatchSinkImpl class template publishes messages of type T in batches,
+ * as messages of type B, whose samples field is a sequence of T.  A batch
+ * is published once it has batch_size samples, and otherwise every
+ * batch_period, so no sample waits longer than that; if B also has a stamps
+ * field, a sequence of builtin_interfaces/Time, the receive time of each
+ * sample is put in it.  Each sample keeps whatever header it has.
+ *
+ * One DDS publish then carries a whole batch, which is what makes topics
+ * sent at kHz rates affordable, for the bridge and for the executors of the
+ * subscribers alike.
+ *
+ * add() is called from the thread that dispatches the topic, and the timer
+ * runs on the executor of the node, so the batch is behind a mutex; the two
+ * only meet once every batch_period.
+ */
+template<typename T, typename B>
+class BatchSinkImpl final : public BatchSink<T>
+{
+public:
+    /**
+     * Construct a BatchSinkImpl object.
+     *
+     * @param[in] node The rclcpp::Node to create the publisher and the timer
+     *                 with.
+     * @param[in] name The name of the topic to publish the batches to.
+     * @param[in] qos The QoS settings to publish with.
+     * @param[in] batch_size The number of samples to publish a batch at, or
+     *                       0 for no limit.
+     * @param[in] batch_period How often to publish the samples collected so
+     *                         far, or 0 to wait for batch_size of them.
+     * @param[in] max_samples The bound of the samples sequence of B, or 0 if
+     *                        it is unbounded.
+     * @throws std::runtime_error If both batch_size and batch_period are 0,
+     *         or batch_size doesn't fit in the samples of B.
+     */
+    BatchSinkImpl(rclcpp::Node * node, const std::string & name, const rclcpp::QoS & qos,
+                  size_t batch_size, std::chrono::milliseconds batch_period, size_t max_samples)
+        : batch_size_(batch_size)
+    {
+        if (batch_size == 0 && batch_period.count() <= 0)
+        {
+            throw std::runtime_error("Topic '" + name + "' needs a batch_size or a batch_ms to be batched");
+        }
+        if (max_samples > 0 && (batch_size == 0 || batch_size > max_samples))
+        {
+            throw std::runtime_error("Topic '" + name + "' has a batch_size over the " + std::to_string(max_samples) +
+                                     " samples its batch type has room for");
+        }
+
+        pub_ = node->create_publisher<B>(name, qos);
+        if (batch_size_ > 0)
+        {
+            batch_.samples.reserve(batch_size_);
+            reserve_stamps(batch_, has_batch_stamps<B>());
+        }
+        if (batch_period.count() > 0)
+        {
+            timer_ = node->create_wall_timer(batch_period, [this]() {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (!batch_.samples.empty())
+                {
+                    publish_locked();
+                }
+            });
+        }
+    }
+
+    void add(const T & msg, std::chrono::system_clock::time_point receive_time) override
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        batch_.samples.push_back(msg);
+        add_stamp(batch_, receive_time, has_batch_stamps<B>());
+        if (batch_size_ > 0 && batch_.samples.size() >= batch_size_)
+        {
+            publish_locked();
+        }
+    }
+
+    size_t get_subscription_count() const override
+    {
+        return pub_->get_subscription_count();
+    }
+
+private:
+    void publish_locked()
+    {
+        pub_->publish(batch_);
+        // The sequences keep their capacity, so a batch that is no larger
+        // than the last one doesn't allocate for them.
+        batch_.samples.clear();
+        clear_stamps(batch_, has_batch_stamps<B>());
+    }
+
+    template<typename M>
+    static void add_stamp(M & batch, std::chrono::system_clock::time_point receive_time, std::true_type)
+    {
+        batch.stamps.push_back(rclcpp::Time(tracing::stamp_ns(receive_time), RCL_SYSTEM_TIME));
+    }
+
+    template<typename M>
+    static void add_stamp(M &, std::chrono::system_clock::time_point, std::false_type)
+    {
+    }
+
+    template<typename M>
+    void reserve_stamps(M & batch, std::true_type) const
+    {
+        batch.stamps.reserve(batch_size_);
+    }
+
+    template<typename M>
+    void reserve_stamps(M &, std::false_type) const
+    {
+    }
+
+    template<typename M>
+    static void clear_stamps(M & batch, std::true_type)
+    {
+        batch.stamps.clear();
+    }
+
+    template<typename M>
+    static void clear_stamps(M &, std::false_type)
+    {
+    }
+
+    size_t batch_size_;
+    std::shared_ptr<rclcpp::Publisher<B>> pub_;
+    std::mutex mutex_;
+    B batch_;
+    // Last, so that it is destroyed before what its callback uses.
+    rclcpp::TimerBase::SharedPtr timer_;
+};
+
+}  // namespace pubsub
+}  // namespace ros2_to_serial_bridge
+
+#endif
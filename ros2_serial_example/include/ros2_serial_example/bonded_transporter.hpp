@@ -0,0 +1,370 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ROS2_SERIAL_EXAMPLE__BONDED_TRANSPORTER_HPP_
+#define ROS2_SERIAL_EXAMPLE__BONDED_TRANSPORTER_HPP_
+
+// C++ includes
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Local includes
+#include "ros2_serial_example/topic_id.hpp"
+#include "ros2_serial_example/transporter.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+/**
+ * The BondedTransporter class is an implementation of the abstract
+ * Transporter class that carries one stream of frames over several links,
+ * each of which is a Transporter of its own (for instance, two radios, or a
+ * radio and a cable).
+ *
+ * Each frame is framed once, by the BondedTransporter, and then either
+ * written to every link that is up (redundant mode), or to just one of them
+ * (stripe mode).  In stripe mode the link is the one that would get the
+ * frame out first, going by how much each link still has to send and by
+ * how fast it has been sending; a link's rate starts out at its baudrate
+ * (or 1 MB/s if it has none) and is then measured from how quickly its
+ * write queue drains, for links that report it.  The mode is set per topic
+ * with set_redundant().
+ *
+ * The receiving side takes messages from whichever link they arrive on
+ * first, and drops the copies that arrive later by their sequence numbers,
+ * so the protocol has to be one that has them ('px4' or 'v2').  Each topic
+ * has a window of the last 64 sequence numbers; a frame more than 64 behind
+ * the newest one is taken to mean that the other side started over.
+ *
+ * The receiving side unpacks each frame on the link it arrived on, so
+ * anything that keeps state between frames is kept per link: reliable
+ * topics, compression dictionaries, and the reassembly of fragments.  These
+ * work for redundant topics, but not for striped ones, where consecutive
+ * frames end up on different links.  Sequence gaps in the metrics of the
+ * links are expected in stripe mode for the same reason.  A link that fails
+ * is taken out of the bond and the others carry on.
+ */
+class BondedTransporter final : public Transporter
+{
+public:
+    /// How the frames of a topic are spread across the links.
+    enum class Mode
+    {
+        STRIPE,
+        REDUNDANT,
+    };
+
+    /// The largest number of links in a bond.
+    static constexpr size_t MAX_LINKS = 64;
+
+    /// A snapshot of the counters of a link.
+    struct LinkStats final
+    {
+        uint64_t tx_frames{0};
+        uint64_t tx_bytes{0};
+        uint64_t tx_errors{0};
+        uint64_t rx_messages{0};
+        uint64_t duplicates{0};
+        double rate_Bps{0.0};
+        bool up{false};
+    };
+
+    /**
+     * Construct a BondedTransporter object over the given links.
+     *
+     * @param[in] protocol The backend protocol to use; must be 'px4' or 'v2',
+     *                     and the same as that of every link.
+     * @param[in] links The links, which must not be initialized yet; the
+     *                  BondedTransporter takes care of that.
+     * @param[in] mode The mode of topics that set_redundant() wasn't called
+     *                 for.
+     * @param[in] read_poll_ms The amount of time to wait for data to come in
+     *                         on any of the links before timing out.
+     * @param[in] ring_buffer_size The number of bytes to allocate to the
+     *                             underlying ring buffer; the links each
+     *                             have their own.
+     * @throws std::runtime_error If the protocol is unsupported, there are
+     *         no links or more than MAX_LINKS, or a link is a nullptr or uses
+     *         another protocol.
+     */
+    BondedTransporter(const std::string & protocol,
+                      std::vector<std::unique_ptr<Transporter>> links,
+                      Mode mode,
+                      uint32_t read_poll_ms,
+                      size_t ring_buffer_size);
+    ~BondedTransporter() override;
+
+    BondedTransporter(BondedTransporter const &) = delete;
+    BondedTransporter& operator=(BondedTransporter const &) = delete;
+    BondedTransporter(BondedTransporter &&) = delete;
+    BondedTransporter& operator=(BondedTransporter &&) = delete;
+
+    /**
+     * Parse the name of a mode.
+     *
+     * @param[in] name The name of the mode.
+     * @param[out] out The mode.
+     * @returns true if the name is one of 'stripe' or 'redundant'.
+     */
+    static bool parse_mode(const std::string & name, Mode * out);
+
+    /**
+     * Initialize every link.
+     *
+     * This method is an override of the one provided by the Transporter
+     * class.  If all of the links have a read file descriptor, they are
+     * gathered into an epoll file descriptor, which get_read_fd() returns.
+     *
+     * @returns 0 on success, -1 on error.
+     */
+    int init() override;
+
+    /**
+     * Close every link.
+     *
+     * This method is an override of the one provided by the Transporter
+     * class and undoes the steps that the init() method does.
+     *
+     * @returns 0 on success, -1 on error.
+     */
+    int close() override;
+
+    /**
+     * Get a file descriptor that becomes readable when any of the links has
+     * something to read.
+     *
+     * @returns The epoll file descriptor, or -1 if a link has no read file
+     *          descriptor of its own.
+     */
+    int get_read_fd() const override;
+
+    /**
+     * Get the number of bytes the links have yet to send.
+     *
+     * @returns The largest number of bytes waiting on a link that is up, or
+     *          -1 if no link knows.
+     */
+    ssize_t get_write_queue_bytes() const override;
+
+    /**
+     * Choose whether the payloads of a topic are sent on every link, or
+     * striped across them.  This must be called before the first write.
+     *
+     * @param[in] topic_ID The topic ID.
+     * @param[in] redundant Whether to send the payloads on every link.
+     * @returns 0 on success, or -1 if the topic ID is too large for the
+     *          protocol.
+     */
+    int set_redundant(topic_id_size_t topic_ID, bool redundant) override;
+
+    /**
+     * Get the number of links in the bond, including those that failed.
+     *
+     * @returns The number of links.
+     */
+    size_t get_link_count() const
+    {
+        return links_.size();
+    }
+
+    /**
+     * Get the counters of a link.  This may be called from any thread.
+     *
+     * @param[in] link The index of the link, in the order they were given.
+     * @returns The counters of the link, or all zeroes if there is no such
+     *          link.
+     */
+    LinkStats get_link_stats(size_t link) const;
+
+    /**
+     * Change how long a read waits for data to come in.
+     *
+     * This must only be called from the thread that reads.
+     *
+     * @param[in] read_poll_ms The time to wait in milliseconds.
+     * @returns 0.
+     */
+    int set_read_poll_ms(uint32_t read_poll_ms) override
+    {
+        read_poll_ms_ = read_poll_ms;
+        return 0;
+    }
+
+private:
+    struct Link final
+    {
+        std::unique_ptr<Transporter> transporter;
+        std::atomic<bool> up{false};
+        int read_fd{-1};
+
+        // The transmit model, only touched with the write lock held.
+        double rate_Bps{0.0};
+        std::chrono::steady_clock::time_point busy_until{};
+        // A link that failed a write is passed over until then when striping.
+        std::chrono::steady_clock::time_point failed_until{};
+        // The write queue as of the last look at it, for the rate.
+        std::chrono::steady_clock::time_point queued_at{};
+        ssize_t queued{-1};
+
+        std::atomic<uint64_t> tx_frames{0};
+        std::atomic<uint64_t> tx_bytes{0};
+        std::atomic<uint64_t> tx_errors{0};
+        std::atomic<uint64_t> rx_messages{0};
+        std::atomic<uint64_t> duplicates{0};
+        // The bits of rate_Bps, for get_link_stats() to read from another
+        // thread.
+        std::atomic<uint64_t> rate_bits{0};
+
+        void set_rate(double rate)
+        {
+            rate_Bps = rate;
+            uint64_t bits;
+            ::memcpy(&bits, &rate, sizeof(bits));
+            rate_bits = bits;
+        }
+    };
+
+    // The sequence numbers seen recently on a topic; bit N of seen is set if
+    // newest - N was.
+    struct SeqWindow final
+    {
+        bool valid{false};
+        uint8_t newest{0};
+        uint64_t seen{0};
+    };
+
+    /**
+     * Not used; the messages come from the links through
+     * node_read_message() and node_read_messages().
+     *
+     * @returns -1 with errno set to ENOTSUP.
+     */
+    ssize_t node_read() override;
+
+    /**
+     * Write a frame to the links, according to the mode of its topic.
+     *
+     * @params[in] buffer The buffer containing the frame.
+     * @params[in] len The length of the frame.
+     * @returns len on success, or -1 if no link took the frame.
+     */
+    ssize_t node_write(void *buffer, size_t len) override;
+
+    /**
+     * Write a frame to the links, according to the mode of its topic.
+     *
+     * @params[in] iov The buffers containing the frame.
+     * @params[in] iovcnt The number of buffers in iov.
+     * @returns The length of the frame on success, or -1 if no link took
+     *          the frame.
+     */
+    ssize_t node_writev(const struct iovec *iov, int iovcnt) override;
+
+    /**
+     * Write each frame of a batch to the links, according to the mode of its
+     * topic.
+     *
+     * @params[in] frames The frames to write, one buffer per frame.
+     * @params[in] topic_IDs The topic ID of each frame.
+     * @params[in] count The number of frames.
+     * @returns The number of bytes written on success, or -1 on error.
+     */
+    ssize_t node_write_frames(const struct iovec *frames, const topic_id_size_t *topic_IDs, size_t count) override;
+
+    /**
+     * Read the next message that isn't a duplicate from the links, taking
+     * each in turn.
+     */
+    ssize_t node_read_message(topic_id_size_t *topic_ID, uint8_t *out_buffer, size_t buffer_len) override;
+
+    /**
+     * Read the messages that aren't duplicates from whichever links have
+     * something to read, waiting up to read_poll_ms for one of them.
+     */
+    ssize_t node_read_messages(uint8_t *out_buffer, size_t buffer_len, const MessageVisitor & visitor) override;
+
+    /**
+     * Detect whether the links were initialized.
+     *
+     * @returns true if init() succeeded and close() hasn't been called,
+     *          false otherwise.
+     */
+    bool fds_OK() override;
+
+    /**
+     * Check a message from a link against the window of its topic.
+     *
+     * @param[in] link The link the message came in on.
+     * @param[in] topic_ID The topic ID of the message.
+     * @returns true if the message is new, false if it is a duplicate.
+     */
+    bool accept(Link & link, topic_id_size_t topic_ID);
+
+    /**
+     * Read the messages from one link, handing the ones that aren't
+     * duplicates to the visitor.
+     *
+     * @returns The number of messages handed to the visitor, or -1 on error.
+     */
+    ssize_t read_link(Link & link, uint8_t *out_buffer, size_t buffer_len, const MessageVisitor & visitor);
+
+    /**
+     * Take a link out of the bond after it failed.
+     *
+     * @param[in] index The index of the link.
+     */
+    void link_down(size_t index);
+
+    /**
+     * Pick the link that would get a frame of the given length out first.
+     *
+     * @param[in] len The length of the frame.
+     * @param[in] skip A bit for each link (by index) that already failed to
+     *                 take the frame.
+     * @returns The link, or nullptr if no other link is up.
+     */
+    Link * pick_link(size_t len, uint64_t skip);
+
+    /**
+     * Write a frame to one link, updating its counters and transmit model.
+     *
+     * @returns true if the link took the frame, false otherwise.
+     */
+    bool write_link(Link & link, const struct iovec *iov, int iovcnt, size_t len);
+
+    std::vector<std::unique_ptr<Link>> links_;
+    Mode mode_;
+    uint32_t read_poll_ms_{0};
+    int epoll_fd_{-1};
+    bool initialized_{false};
+    size_t next_link_{0};
+    // The modes that differ from mode_, by topic ID, and the receive windows,
+    // also by topic ID; both grow up to the largest topic ID used.
+    std::vector<Mode> topic_modes_;
+    std::vector<SeqWindow> windows_;
+};
+
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
+
+#endif
@@ -0,0 +1,156 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ROS2_SERIAL_EXAMPLE__BRIDGE_MONITOR_HPP_
+#define ROS2_SERIAL_EXAMPLE__BRIDGE_MONITOR_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace ros2_to_serial_bridge
+{
+
+namespace monitor
+{
+
+/**
+ * The BridgeMonitor class turns the counters the bridge reports on
+ * /diagnostics into rates, for ros2_serial_top to show.
+ *
+ * Each port of the bridge is reported as a diagnostic status of its own,
+ * with a key per counter: "rx/<topic>/<counter>" and "tx/<topic>/<counter>"
+ * for the topics, and plain keys like "baudrate" or "latency/write/p99_us"
+ * for the port.  The rates are worked out from the change in the counters
+ * between two reports of the same port.
+ */
+class BridgeMonitor final
+{
+public:
+    /// The key/value pairs of one diagnostic status.
+    using Values = std::vector<std::pair<std::string, std::string>>;
+
+    /**
+     * The rates of one topic in one direction, over the time between the
+     * last two reports of its port.
+     */
+    struct TopicRow final
+    {
+        std::string port;
+        /// "rx" or "tx".
+        std::string direction;
+        std::string topic;
+        double messages_per_s{0.0};
+        double bytes_per_s{0.0};
+        /// The share of the baudrate the payloads take, or -1 if the port
+        /// has no baudrate.
+        double link_percent{-1.0};
+        /// The frames that failed their CRC, as a share of all of the frames
+        /// that came in, in percent.
+        double crc_error_percent{0.0};
+        /// The payloads that were dropped for any reason, per second.
+        double drops_per_s{0.0};
+        /// The payloads waiting in the transmit queue of the topic, or -1 if
+        /// it has none.
+        int64_t queue_depth{-1};
+    };
+
+    /**
+     * The rates and state of a port, over the time between its last two
+     * reports.
+     */
+    struct PortRow final
+    {
+        std::string port;
+        double rx_bytes_per_s{0.0};
+        double tx_bytes_per_s{0.0};
+        /// The share of the baudrate the payloads sent take, or -1 if the
+        /// port has no baudrate.
+        double tx_link_percent{-1.0};
+        uint32_t baudrate{0};
+        /// The bytes handed to the device that it hasn't sent yet, or -1 if
+        /// unknown.
+        int64_t write_queue_bytes{-1};
+        /// The 99th percentile of the time it took to write a frame out, or
+        /// -1 if the bridge doesn't time them.
+        double write_p99_us{-1.0};
+        double garbage_bytes_per_s{0.0};
+    };
+
+    /**
+     * Take in a report of one port.
+     *
+     * Reports older than the last one of the same port are ignored.  If any
+     * of the counters went backwards, the bridge was restarted, and the
+     * rates start over from this report.
+     *
+     * @param[in] port The name of the diagnostic status of the port.
+     * @param[in] stamp_ns The time of the report, in nanoseconds.
+     * @param[in] values The key/value pairs of the report.
+     * @returns true if the report was of a bridge port, false if it had no
+     *          topic counters in it and was ignored.
+     */
+    bool update(const std::string & port, int64_t stamp_ns, const Values & values);
+
+    /**
+     * Get the rates of every topic seen so far, busiest first.
+     *
+     * @returns The topics, sorted by bytes per second, most first.
+     */
+    std::vector<TopicRow> topics() const;
+
+    /**
+     * Get the rates of every port seen so far, in order of their names.
+     *
+     * @returns The ports.
+     */
+    std::vector<PortRow> ports() const;
+
+    /**
+     * Lay out the ports and the busiest topics as a table.
+     *
+     * @param[in] max_topics The most topics to show, or 0 for all of them.
+     * @returns The table, one line per port and topic, each ended by a
+     *          newline.
+     */
+    std::string render(size_t max_topics) const;
+
+private:
+    struct Report final
+    {
+        int64_t stamp_ns{0};
+        std::map<std::string, std::string> values;
+    };
+
+    struct PortState final
+    {
+        Report previous;
+        Report latest;
+        bool has_previous{false};
+    };
+
+    static uint64_t counter(const Report & report, const std::string & key);
+    static uint64_t delta(const PortState & state, const std::string & key);
+    static double rate(const PortState & state, const std::string & key);
+
+    std::map<std::string, PortState> ports_;
+};
+
+}  // namespace monitor
+}  // namespace ros2_to_serial_bridge
+
+#endif
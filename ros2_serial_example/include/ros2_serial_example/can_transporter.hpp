@@ -0,0 +1,243 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef ROS2_SERIAL_EXAMPLE__CAN_TRANSPORTER_HPP_
+#define ROS2_SERIAL_EXAMPLE__CAN_TRANSPORTER_HPP_
+
+// C++ includes
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <linux/can.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+// Local includes
+#include "ros2_serial_example/isotp.hpp"
+#include "ros2_serial_example/transporter.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+/**
+ * The CANTransporter class is an implementation of the abstract Transporter
+ * class for talking to peripherals on a CAN-FD bus, through a raw SocketCAN
+ * socket.
+ *
+ * Each frame (in the sense of the backend protocol, so header, payload and
+ * CRC) is sent as one ISO-TP message (see impl::IsoTp): in a single CAN-FD
+ * frame if it is up to 62 bytes long, or segmented into 64 byte CAN-FD
+ * frames if it is longer.  The CAN ID of the frames is the tx base ID plus
+ * the topic ID, so a lower topic ID wins arbitration on the bus over a
+ * higher one.  Received frames with CAN IDs from the rx base ID up are put
+ * back together per CAN ID, and each complete message is handed over as a
+ * frame, the same as a datagram in UDPTransporter's datagram mode; other
+ * CAN IDs are ignored.  CAN frames are received (and sent) in batches with
+ * recvmmsg() (and sendmmsg()).
+ *
+ * Topic IDs that would give a CAN ID beyond the 11-bit (or 29-bit, with
+ * extended IDs) range can't be sent, and writing them fails with errno set
+ * to ERANGE.
+ */
+class CANTransporter final : public Transporter
+{
+public:
+    /// The most CAN frames received or sent with one system call.
+    static constexpr size_t MAX_FRAME_BATCH = 1024;
+
+    /**
+     * Construct a CANTransporter object with the given CAN parameters.
+     *
+     * @param[in] protocol The backend protocol to use; see Transporter docs for
+     *                     more information about supported protocols.
+     * @param[in] interface The name of the CAN network interface, like can0.
+     *                      It must be up, with CAN-FD enabled.
+     * @param[in] tx_base_id The CAN ID to send topic ID 0 with.
+     * @param[in] rx_base_id The CAN ID that topic ID 0 is received with.
+     * @param[in] extended_ids Whether to use 29-bit CAN IDs instead of 11-bit
+     *                         ones.
+     * @param[in] read_poll_ms The amount of time to wait for data to come in
+     *                         before timing out.
+     * @param[in] ring_buffer_size The number of bytes to allocate to the
+     *                             underlying ring buffer that is used to
+     *                             accept data; this is also the longest
+     *                             message that is accepted.
+     * @param[in] frame_batch The most CAN frames to receive or send with one
+     *                        system call.
+     * @throws std::runtime_error If the interface name is empty or too long,
+     *         if a base ID is out of range, or if frame_batch is 0 or more
+     *         than MAX_FRAME_BATCH.
+     */
+    CANTransporter(const std::string & protocol,
+                   const std::string & interface,
+                   uint32_t tx_base_id,
+                   uint32_t rx_base_id,
+                   bool extended_ids,
+                   uint32_t read_poll_ms,
+                   size_t ring_buffer_size,
+                   size_t frame_batch);
+    ~CANTransporter() override;
+
+    CANTransporter(CANTransporter const &) = delete;
+    CANTransporter& operator=(CANTransporter const &) = delete;
+    CANTransporter(CANTransporter &&) = delete;
+    CANTransporter& operator=(CANTransporter &&) = delete;
+
+    /**
+     * Do CAN specific initialization.
+     *
+     * This method is an override of the one provided by the Transporter class.
+     * It opens a raw CAN socket with CAN-FD frames enabled, filters it to the
+     * received CAN IDs, and binds it to the interface.
+     *
+     * @returns 0 on success, -1 on error.
+     */
+    int init() override;
+
+    /**
+     * Do CAN specific de-initialization.
+     *
+     * This method is an override of the one provided by the Transporter class
+     * and undoes the steps that the init() method does.
+     *
+     * @returns 0 on success, -1 on error.
+     */
+    int close() override;
+
+    /**
+     * Get the file descriptor of the CAN socket.
+     *
+     * @returns The file descriptor of the socket if the transporter is
+     *          initialized, -1 otherwise.
+     */
+    int get_read_fd() const override;
+
+    /**
+     * Get the file descriptor of the CAN socket.
+     *
+     * @returns The file descriptor of the socket if the transporter is
+     *          initialized, -1 otherwise.
+     */
+    int get_write_fd() const override;
+
+    /**
+     * Change how long a read waits for data to come in.
+     *
+     * This must only be called from the thread that reads.
+     *
+     * @param[in] read_poll_ms The time to wait in milliseconds.
+     * @returns 0.
+     */
+    int set_read_poll_ms(uint32_t read_poll_ms) override
+    {
+        read_poll_ms_ = read_poll_ms;
+        return 0;
+    }
+
+private:
+    /**
+     * Read CAN frames and store the messages they complete in the ring
+     * buffer.
+     *
+     * This method is an override of the abstract one in the Transporter class.
+     *
+     * @returns The number of bytes stored, or -1 on error.
+     */
+    ssize_t node_read() override;
+
+    /**
+     * Read CAN frames and hand each message they complete to the visitor.
+     *
+     * This method is an override of the one in the Transporter class.  It
+     * receives up to frame_batch CAN frames, waiting up to read_poll_ms for
+     * the first of them.
+     *
+     * @params[in] visitor The callback to hand each message to.
+     * @returns The number of messages handed to the visitor, or -1 on error.
+     */
+    ssize_t node_read_frames(const FrameVisitor & visitor) override;
+
+    /**
+     * Write a frame as an ISO-TP message.
+     *
+     * This method is an override of the abstract one in the Transporter class
+     * and will block until all of the CAN frames are sent, or until an error
+     * occurs.
+     *
+     * @params[in] buffer The buffer containing the frame to write.
+     * @params[in] len The length of the frame.
+     * @returns The number of bytes written on success (which must be equal to
+     *          len), or -1 on error.
+     */
+    ssize_t node_write(void *buffer, size_t len) override;
+
+    /**
+     * Write a batch of frames, each as an ISO-TP message.
+     *
+     * This method is an override of the one in the Transporter class.  The
+     * CAN frames of all of the messages are sent together, frame_batch at a
+     * time.
+     *
+     * @params[in] frames The frames to write, one buffer per frame.
+     * @params[in] topic_IDs The topic ID of each frame.
+     * @params[in] count The number of frames.
+     * @returns The number of bytes written on success (which must be equal to
+     *          the sum of the frame lengths), or -1 on error.
+     */
+    ssize_t node_write_frames(const struct iovec *frames, const topic_id_size_t *topic_IDs, size_t count) override;
+
+    /**
+     * Detect whether the CAN socket is ready.
+     *
+     * @returns true if the socket is open, false otherwise.
+     */
+    bool fds_OK() override;
+
+    int segment(const uint8_t *data, size_t len, topic_id_size_t topic_ID);
+    ssize_t send_frames();
+    void send_flow_control(canid_t rx_id, impl::IsoTp::FlowStatus status);
+
+    std::string interface_;
+    canid_t tx_base_id_;
+    canid_t rx_base_id_;
+    canid_t id_mask_;
+    canid_t id_flags_;
+    uint32_t read_poll_ms_{0};
+    size_t max_message_len_{0};
+    int fd_{-1};
+    struct pollfd poll_fd_[1]{};
+
+    std::vector<struct canfd_frame> recv_frames_;
+    std::vector<struct iovec> recv_iovs_;
+    std::vector<struct mmsghdr> recv_msgs_;
+    std::unordered_map<canid_t, impl::IsoTp::Reassembler> reassemblers_;
+
+    std::vector<struct canfd_frame> send_frames_;
+    std::vector<struct iovec> send_iovs_;
+    std::vector<struct mmsghdr> send_msgs_;
+    size_t frame_batch_{0};
+};
+
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
+
+#endif
@@ -0,0 +1,102 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef ROS2_SERIAL_EXAMPLE__CDR_ENCAPSULATION_HPP_
+#define ROS2_SERIAL_EXAMPLE__CDR_ENCAPSULATION_HPP_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace ros2_to_serial_bridge
+{
+
+namespace pubsub
+{
+
+/**
+ * Helpers for the 4 byte encapsulation header that DDS puts in front of
+ * serialized CDR data.
+ *
+ * The data on the serial port is the bare CDR serialization (in the native
+ * byte order of the bridge, which is what Fast-CDR uses by default), without
+ * an encapsulation header.  Serialized messages on the ROS 2 side carry the
+ * header, so passing the bytes straight through in either direction only
+ * needs the header to be added or removed.
+ *
+ * The header is 2 bytes of representation identifier (0x0000 for big-endian
+ * CDR, 0x0001 for little-endian CDR) followed by 2 bytes of options; the low
+ * 2 bits of the options are the number of padding bytes at the end of the
+ * data.
+ */
+namespace cdr
+{
+
+constexpr size_t ENCAPSULATION_SIZE = 4;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+constexpr uint8_t NATIVE_REPRESENTATION = 0x00;
+#else
+constexpr uint8_t NATIVE_REPRESENTATION = 0x01;
+#endif
+
+/**
+ * Write an encapsulation header for native byte order CDR with no padding.
+ *
+ * @param[out] buffer The buffer to write to; must be at least
+ *                    ENCAPSULATION_SIZE bytes long.
+ */
+inline void write_encapsulation(uint8_t *buffer)
+{
+    buffer[0] = 0x00;
+    buffer[1] = NATIVE_REPRESENTATION;
+    buffer[2] = 0x00;
+    buffer[3] = 0x00;
+}
+
+/**
+ * Find the bare CDR data inside of a serialized message.
+ *
+ * @param[in] buffer The serialized message, starting with the encapsulation
+ *                   header.
+ * @param[in] length The length of the serialized message.
+ * @param[out] data_length The length of the CDR data following the header,
+ *                         with any trailing padding removed.
+ * @returns true if the message is native byte order CDR and data_length was
+ *          filled in, false otherwise (in which case the data can't be passed
+ *          straight through).
+ */
+inline bool unwrap_encapsulation(const uint8_t *buffer, size_t length, size_t *data_length)
+{
+    if (length < ENCAPSULATION_SIZE || buffer[0] != 0x00 || buffer[1] != NATIVE_REPRESENTATION)
+    {
+        return false;
+    }
+
+    size_t padding = buffer[3] & 0x3;
+    if (length - ENCAPSULATION_SIZE < padding)
+    {
+        return false;
+    }
+
+    *data_length = length - ENCAPSULATION_SIZE - padding;
+
+    return true;
+}
+
+}  // namespace cdr
+}  // namespace pubsub
+}  // namespace ros2_to_serial_bridge
+
+#endif
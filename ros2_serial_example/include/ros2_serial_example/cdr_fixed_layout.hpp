@@ -0,0 +1,189 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ROS2_SERIAL_EXAMPLE__CDR_FIXED_LAYOUT_HPP_
+#define ROS2_SERIAL_EXAMPLE__CDR_FIXED_LAYOUT_HPP_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+namespace ros2_to_serial_bridge
+{
+
+namespace pubsub
+{
+
+/**
+ * Helpers for copying messages of a fixed layout in and out of CDR.
+ *
+ * A message type made only of fixed size fields (numbers, booleans, fixed
+ * size arrays of them, and nested messages of the same kind) has the same CDR
+ * layout for every message: each field is at an offset that only depends on
+ * the type.  For those types, generate_ros2_topics.py generates a layout
+ * struct that copies each field to or from its offset with the functions
+ * below, instead of going through Fast-CDR a field at a time.  A layout
+ * struct looks like:
+ *
+ *     struct Layout final
+ *     {
+ *         static constexpr bool FIXED = true;
+ *         static constexpr size_t SIZE = ...;  // the length of the CDR data
+ *         static constexpr size_t MIN_SIZE = SIZE;
+ *         static bool decode(const uint8_t *data, size_t length, T & msg);
+ *         static size_t encode(const T & msg, uint8_t *data, size_t length);
+ *     };
+ *
+ * where decode() returns false if the data is too short, and encode() returns
+ * the length written, or 0 if the buffer is too short.
+ *
+ * Every other type gets a VariableLayout, which only carries MIN_SIZE, the
+ * length of the shortest CDR data of a message of the type (with every
+ * string and sequence empty).  Data shorter than that is turned away before
+ * Fast-CDR is asked to decode it.
+ *
+ * The copies are in the native byte order of the bridge, as Fast-CDR does by
+ * default.  The size of each field is a template parameter, so that a field
+ * whose C++ type doesn't have the size the layout was worked out with fails
+ * to compile instead of being copied wrongly.
+ */
+namespace cdr
+{
+
+/**
+ * The layout of a type without a fixed layout, which always goes through
+ * Fast-CDR.
+ *
+ * @tparam MinSize The length of the shortest CDR data of the type.
+ */
+template<typename T, size_t MinSize>
+struct VariableLayout final
+{
+    static constexpr bool FIXED = false;
+    static constexpr size_t SIZE = 0;
+    static constexpr size_t MIN_SIZE = MinSize;
+
+    static bool decode(const uint8_t *, size_t, T &)
+    {
+        return false;
+    }
+
+    static size_t encode(const T &, uint8_t *, size_t)
+    {
+        return 0;
+    }
+};
+
+template<typename T, size_t MinSize>
+constexpr bool VariableLayout<T, MinSize>::FIXED;
+
+template<typename T, size_t MinSize>
+constexpr size_t VariableLayout<T, MinSize>::SIZE;
+
+template<typename T, size_t MinSize>
+constexpr size_t VariableLayout<T, MinSize>::MIN_SIZE;
+
+/**
+ * The layout of a type that nothing is known about, which always goes
+ * through Fast-CDR, whatever the length of the data.
+ */
+template<typename T>
+using NoFixedLayout = VariableLayout<T, 0>;
+
+/**
+ * Copy a field of a message out of CDR data.
+ *
+ * @tparam Size The size of the field in the CDR data.
+ * @param[in] data The CDR data.
+ * @param[in] offset The offset of the field in the data.
+ * @param[out] field The field to fill in.
+ */
+template<size_t Size, typename F>
+inline void fixed_load(const uint8_t *data, size_t offset, F & field)
+{
+    static_assert(sizeof(F) == Size, "field size doesn't match the CDR layout");
+    static_assert(std::is_trivially_copyable<F>::value, "field can't be copied as bytes");
+    ::memcpy(&field, data + offset, Size);
+}
+
+/**
+ * Copy a boolean field of a message out of CDR data.  Anything but 0 is
+ * true, so that a bad byte can't make an invalid bool.
+ */
+template<size_t Size>
+inline void fixed_load(const uint8_t *data, size_t offset, bool & field)
+{
+    static_assert(Size == 1, "field size doesn't match the CDR layout");
+    field = data[offset] != 0;
+}
+
+/**
+ * Copy a fixed size array of booleans out of CDR data.
+ */
+template<size_t Size, size_t N>
+inline void fixed_load(const uint8_t *data, size_t offset, std::array<bool, N> & field)
+{
+    static_assert(Size == N, "field size doesn't match the CDR layout");
+    for (size_t i = 0; i < N; ++i)
+    {
+        field[i] = data[offset + i] != 0;
+    }
+}
+
+/**
+ * Copy a field of a message into CDR data.
+ *
+ * @tparam Size The size of the field in the CDR data.
+ * @param[out] data The CDR data.
+ * @param[in] offset The offset of the field in the data.
+ * @param[in] field The field to copy.
+ */
+template<size_t Size, typename F>
+inline void fixed_store(uint8_t *data, size_t offset, const F & field)
+{
+    static_assert(sizeof(F) == Size, "field size doesn't match the CDR layout");
+    static_assert(std::is_trivially_copyable<F>::value, "field can't be copied as bytes");
+    ::memcpy(data + offset, &field, Size);
+}
+
+/**
+ * Copy a boolean field of a message into CDR data.
+ */
+template<size_t Size>
+inline void fixed_store(uint8_t *data, size_t offset, const bool & field)
+{
+    static_assert(Size == 1, "field size doesn't match the CDR layout");
+    data[offset] = field ? 1 : 0;
+}
+
+/**
+ * Copy a fixed size array of booleans into CDR data.
+ */
+template<size_t Size, size_t N>
+inline void fixed_store(uint8_t *data, size_t offset, const std::array<bool, N> & field)
+{
+    static_assert(Size == N, "field size doesn't match the CDR layout");
+    for (size_t i = 0; i < N; ++i)
+    {
+        data[offset + i] = field[i] ? 1 : 0;
+    }
+}
+
+}  // namespace cdr
+}  // namespace pubsub
+}  // namespace ros2_to_serial_bridge
+
+#endif
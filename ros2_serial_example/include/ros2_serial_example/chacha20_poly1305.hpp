@@ -0,0 +1,115 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ROS2_SERIAL_EXAMPLE__CHACHA20_POLY1305_HPP_
+#define ROS2_SERIAL_EXAMPLE__CHACHA20_POLY1305_HPP_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include <sys/uio.h>
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+namespace impl
+{
+
+/**
+ * The ChaCha20Poly1305 class encrypts and authenticates the payloads of the
+ * v2 wire protocol when it is keyed (see Transporter::set_aead_key()).
+ *
+ * This is the AEAD of RFC 8439: the payload is encrypted with the ChaCha20
+ * stream cipher starting at block 1, and the tag is the Poly1305 MAC, keyed
+ * with the start of block 0, of the associated data and the ciphertext.
+ * ChaCha20 only needs 32-bit additions, rotations and XORs, so it is fast on
+ * CPUs without AES instructions, including the microcontrollers at the
+ * other end of most links, and takes the same time whatever the data.
+ *
+ * A nonce must never be used twice with the same key; that is up to the
+ * caller.  The object holds only the key, so it may be used from several
+ * threads at once.
+ */
+class ChaCha20Poly1305 final
+{
+public:
+    static constexpr size_t KEY_LEN = 32;
+    static constexpr size_t NONCE_LEN = 12;
+    static constexpr size_t TAG_LEN = 16;
+
+    /**
+     * Construct a ChaCha20Poly1305 object.
+     *
+     * @param[in] key The KEY_LEN byte key.
+     */
+    explicit ChaCha20Poly1305(const uint8_t *key);
+
+    ChaCha20Poly1305(ChaCha20Poly1305 const &) = delete;
+    ChaCha20Poly1305& operator=(ChaCha20Poly1305 const &) = delete;
+    ChaCha20Poly1305(ChaCha20Poly1305 &&) = delete;
+    ChaCha20Poly1305& operator=(ChaCha20Poly1305 &&) = delete;
+
+    /**
+     * Destroy the ChaCha20Poly1305 object, wiping the key.
+     */
+    ~ChaCha20Poly1305();
+
+    /**
+     * Encrypt data that may be in several buffers and compute its tag.
+     *
+     * @param[in] nonce The NONCE_LEN byte nonce.
+     * @param[in] aad The associated data, which is authenticated but not
+     *                encrypted.
+     * @param[in] aad_len The length of the associated data.
+     * @param[in] iov The buffers holding the data.
+     * @param[in] iovcnt The number of buffers in iov.
+     * @param[out] out The buffer to write the ciphertext into, which must be
+     *                 as long as all of the data.
+     * @param[out] tag The buffer to write the TAG_LEN byte tag into.
+     */
+    void seal(const uint8_t *nonce, const uint8_t *aad, size_t aad_len, const struct iovec *iov, int iovcnt,
+              uint8_t *out, uint8_t *tag) const;
+
+    /**
+     * Check the tag of some ciphertext and decrypt it.
+     *
+     * Nothing is written to out unless the tag is right.
+     *
+     * @param[in] nonce The NONCE_LEN byte nonce.
+     * @param[in] aad The associated data.
+     * @param[in] aad_len The length of the associated data.
+     * @param[in] in The ciphertext.
+     * @param[in] len The length of the ciphertext.
+     * @param[out] out The buffer to write the data into; this may be in, to
+     *                 decrypt in place.
+     * @param[in] tag The TAG_LEN byte tag.
+     * @returns true if the tag was right and the data was decrypted, false
+     *          otherwise.
+     */
+    bool open(const uint8_t *nonce, const uint8_t *aad, size_t aad_len, const uint8_t *in, size_t len,
+              uint8_t *out, const uint8_t *tag) const;
+
+private:
+    std::array<uint32_t, 8> key_;
+};
+
+}  // namespace impl
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
+
+#endif
@@ -0,0 +1,206 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ROS2_SERIAL_EXAMPLE__COBS_HPP_
+#define ROS2_SERIAL_EXAMPLE__COBS_HPP_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+namespace impl
+{
+
+/**
+ * The COBSEncoder class does the COBS (Consistent Overhead Byte Stuffing)
+ * encoding of the "cobs" and "cobs_zpe" protocols.
+ *
+ * The data of a frame can be stuffed in several pieces (for instance a
+ * header and then a payload) without first gathering it into one place; a
+ * State carries the encoding from one piece to the next, and finish()
+ * writes the last code byte.  In the worst case (long sequences of data with
+ * no 0 in them), the output is 1 byte longer than the input, plus one byte
+ * for every 254 bytes.  The 0 that ends a frame is not written.
+ *
+ * Several engines are available to do the encoding; they all produce
+ * identical output and differ only in speed:
+ *
+ * BYTEWISE - Looks at one byte at a time.  Always available.
+ *
+ * WORD - Looks for the next 0 eight bytes at a time in a general purpose
+ * register, and copies each run of non-zero bytes with memcpy.  Always
+ * available.
+ *
+ * SIMD - Like WORD, but looks for the next 0 with vector instructions, 16
+ * bytes at a time (SSE2 on x86_64, NEON on aarch64), or 32 bytes at a time
+ * if the CPU has AVX2, which is detected at runtime.  Only available on
+ * x86_64 and aarch64.
+ *
+ * The default constructor picks the fastest engine that is available.
+ *
+ * The encoder also does the COBS/ZPE (zero pair elimination) variant, in
+ * which a block can also end in a pair of zeros, so that the zero padding of
+ * CDR payloads costs less on the wire.  The code bytes of COBS/ZPE are:
+ *
+ * 0x01-0xDF - (code - 1) data bytes, followed by a 0.
+ *
+ * 0xE0 - 223 data bytes, not followed by a 0.
+ *
+ * 0xE1-0xFF - (code - 0xE1) data bytes, followed by two 0s.
+ *
+ * As with COBS, the 0 that follows the last block of a frame is not part of
+ * the data.
+ */
+class COBSEncoder final
+{
+public:
+    enum class Engine
+    {
+        BYTEWISE,
+        WORD,
+        SIMD,
+    };
+
+    /// The most data bytes in a COBS/ZPE block that isn't followed by a 0.
+    static constexpr size_t ZPE_MAX_RUN = 0xDF;
+
+    /// The most data bytes in a COBS/ZPE block followed by two 0s.
+    static constexpr size_t ZPE_MAX_PAIR_RUN = 0x1E;
+
+    /// The code of a full COBS/ZPE block.
+    static constexpr uint8_t ZPE_RUN_CODE = 0xE0;
+
+    /// The code of a COBS/ZPE block of no data bytes followed by two 0s.
+    static constexpr uint8_t ZPE_PAIR_CODE = 0xE1;
+
+    /**
+     * The state of an in-progress encoding.  A new State is ready to start a
+     * frame.
+     */
+    struct State final
+    {
+        size_t write_index{1};
+        size_t code_index{0};
+        uint8_t code{1};
+        /// For COBS/ZPE, whether the current block ended in a 0 that may yet
+        /// turn out to be the first of a pair.
+        bool pending_zero{false};
+    };
+
+    /**
+     * Get the longest that the encoding of some data can be, with either
+     * variant, not counting the 0 that ends a frame.
+     *
+     * @param[in] length The length of the data.
+     * @returns The longest encoding of the data.
+     */
+    static constexpr size_t max_encoded_length(size_t length)
+    {
+        return length + length / ZPE_MAX_RUN + 2;
+    }
+
+    /**
+     * Construct a COBSEncoder object that uses the fastest available engine.
+     */
+    COBSEncoder();
+
+    /**
+     * Construct a COBSEncoder object that uses a particular engine.
+     *
+     * @param[in] engine The engine to use.
+     * @throws std::runtime_error If the engine is not supported on this CPU.
+     */
+    explicit COBSEncoder(Engine engine);
+
+    /**
+     * Determine whether a particular engine can be used on this CPU.
+     *
+     * @param[in] engine The engine to check.
+     * @returns true if the engine can be used, false otherwise.
+     */
+    static bool engine_supported(Engine engine);
+
+    /**
+     * Get the engine in use by this object.
+     *
+     * @returns The engine in use by this object.
+     */
+    Engine engine() const
+    {
+        return engine_;
+    }
+
+    /**
+     * Encode more data of a frame.
+     *
+     * @param[in,out] state Where the encoding of the frame is up to.
+     * @param[in] input The data to encode.
+     * @param[in] length The length of the data to encode.
+     * @param[out] output The start of the encoded frame, which must have room
+     *                    for the worst case encoding of the whole frame.
+     */
+    void stuff(State *state, const uint8_t *input, size_t length, uint8_t *output) const;
+
+    /**
+     * Finish the encoding of a frame.
+     *
+     * @param[in] state Where the encoding of the frame is up to.
+     * @param[out] output The start of the encoded frame.
+     * @returns The length of the encoded frame.
+     */
+    static size_t finish(const State *state, uint8_t *output)
+    {
+        output[state->code_index] = state->code;
+
+        return state->write_index;
+    }
+
+    /**
+     * Encode more data of a frame with COBS/ZPE.
+     *
+     * @param[in,out] state Where the encoding of the frame is up to.
+     * @param[in] input The data to encode.
+     * @param[in] length The length of the data to encode.
+     * @param[out] output The start of the encoded frame, which must have room
+     *                    for the worst case encoding of the whole frame (see
+     *                    max_encoded_length()).
+     */
+    void stuff_zpe(State *state, const uint8_t *input, size_t length, uint8_t *output) const;
+
+    /**
+     * Finish the COBS/ZPE encoding of a frame.
+     *
+     * @param[in] state Where the encoding of the frame is up to.
+     * @param[out] output The start of the encoded frame.
+     * @returns The length of the encoded frame.
+     */
+    static size_t finish_zpe(const State *state, uint8_t *output);
+
+private:
+    typedef size_t (*find_zero_fn_t)(const uint8_t *, size_t);
+
+    Engine engine_;
+    find_zero_fn_t find_zero_fn_;
+};
+
+}  // namespace impl
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
+
+#endif
@@ -0,0 +1,149 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ROS2_SERIAL_EXAMPLE__CONGESTION_CONTROL_HPP_
+#define ROS2_SERIAL_EXAMPLE__CONGESTION_CONTROL_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#include <sys/types.h>
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+/**
+ * The CongestionControl class decides how many of the lowest priority
+ * classes of a TxQueue to hold back, so that the frames of the others don't
+ * wait in the transport for longer than a target delay.
+ *
+ * The delay is estimated from samples of the transport: the number of bytes
+ * it has yet to send (Transporter::get_write_queue_bytes()) divided by the
+ * rate at which it has been sending them, which is measured from how much
+ * of the queue drained while it stayed non-empty; and the round trip time of
+ * reliable topics over the lowest one seen (Transporter::get_last_rtt_us()).
+ * The larger of the two is the delay.
+ *
+ * This works like CoDel: once the delay has been above the target for a
+ * whole interval, one more class is held back, and then another one each
+ * interval / sqrt(number held back + 1) for as long as the delay stays above
+ * the target.  The highest priority class is never held back.  Once the delay
+ * is back below the target, one class is let go again each interval.
+ *
+ * sample() must be called from one thread at a time; the getters may be
+ * called from any thread.
+ */
+class CongestionControl final
+{
+public:
+    /**
+     * Construct a CongestionControl object.
+     *
+     * @param[in] target The longest delay to let frames wait in the
+     *                   transport.
+     * @param[in] interval How long the delay has to stay above the target
+     *                     before a class is held back, and stay below it
+     *                     before a class is let go.
+     * @param[in] levels The number of priority classes.
+     * @throws std::runtime_error If target or interval are not positive, or
+     *         levels is 0.
+     */
+    CongestionControl(std::chrono::microseconds target, std::chrono::microseconds interval, size_t levels);
+
+    CongestionControl(CongestionControl const &) = delete;
+    CongestionControl& operator=(CongestionControl const &) = delete;
+    CongestionControl(CongestionControl &&) = delete;
+    CongestionControl& operator=(CongestionControl &&) = delete;
+
+    /**
+     * Take a sample of the transport and update the number of classes held
+     * back.
+     *
+     * @param[in] now The time of the sample.
+     * @param[in] queued_bytes The number of bytes the transport has yet to
+     *                         send, or -1 if it doesn't know.
+     * @param[in] written_bytes The number of bytes written to the transport
+     *                          so far.
+     * @param[in] rtt_us The latest round trip time of a reliable topic in
+     *                   microseconds, or -1 if there is none.
+     */
+    void sample(std::chrono::steady_clock::time_point now, ssize_t queued_bytes, uint64_t written_bytes,
+                int64_t rtt_us);
+
+    /**
+     * Get the number of the lowest priority classes to hold back.
+     *
+     * @returns The number of classes to hold back, at most levels - 1.
+     */
+    size_t get_shed_levels() const
+    {
+        return shed_levels_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Get the delay estimated from the latest sample.
+     *
+     * @returns The delay in microseconds.
+     */
+    int64_t get_delay_us() const
+    {
+        return delay_us_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Get the rate at which the transport has been measured to send.
+     *
+     * @returns The rate in bytes per second, or 0 if it hasn't been measured
+     *          yet.
+     */
+    uint64_t get_rate_Bps() const
+    {
+        return rate_.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::chrono::steady_clock::duration target_;
+    std::chrono::steady_clock::duration interval_;
+    size_t levels_;
+
+    // The start of the window the rate is measured over.
+    bool have_window_{false};
+    std::chrono::steady_clock::time_point window_at_{};
+    ssize_t window_queued_{0};
+    uint64_t window_written_{0};
+    double rate_Bps_{0.0};
+
+    // The round trip times; a sample only counts for one interval, so a
+    // reliable topic that went quiet doesn't keep the delay up.
+    int64_t min_rtt_us_{-1};
+    int64_t last_rtt_us_{-1};
+    int64_t rtt_delay_us_{0};
+    std::chrono::steady_clock::time_point rtt_at_{};
+
+    bool above_{false};
+    std::chrono::steady_clock::time_point next_change_{};
+    std::atomic<size_t> shed_levels_{0};
+    std::atomic<int64_t> delay_us_{0};
+    std::atomic<uint64_t> rate_{0};
+};
+
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
+
+#endif
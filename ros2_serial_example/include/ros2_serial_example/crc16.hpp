@@ -0,0 +1,132 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ROS2_SERIAL_EXAMPLE__CRC16_HPP_
+#define ROS2_SERIAL_EXAMPLE__CRC16_HPP_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+namespace impl
+{
+
+/**
+ * The CRC16 class computes the CRC-16 used on the serial wire.
+ *
+ * The polynomial is 0x8005 (x^16 + x^15 + x^2 + 1), processed bit-reflected
+ * with an initial value of 0 and no final XOR (sometimes known as
+ * CRC-16/ARC).  This is the same CRC that PX4 uses, and the one that the
+ * microcontroller code implements.
+ *
+ * Several engines are available to compute the CRC; they all produce
+ * identical results and differ only in speed:
+ *
+ * TABLE - The classic one-byte-at-a-time table lookup.  Always available.
+ *
+ * SLICING_BY_8 - Processes 8 bytes per iteration using 8 lookup tables.
+ * Always available.
+ *
+ * CLMUL - Folds 16 bytes at a time using the carry-less multiply instructions
+ * (PCLMULQDQ on x86_64, PMULL on aarch64).  Only available if the CPU the
+ * program is running on supports the instructions; this is detected at
+ * runtime.
+ *
+ * The default constructor picks the fastest engine that is available.
+ */
+class CRC16 final
+{
+public:
+    enum class Engine
+    {
+        TABLE,
+        SLICING_BY_8,
+        CLMUL,
+    };
+
+    /**
+     * Construct a CRC16 object that uses the fastest available engine.
+     */
+    CRC16();
+
+    /**
+     * Construct a CRC16 object that uses a particular engine.
+     *
+     * @param[in] engine The engine to use.
+     * @throws std::runtime_error If the engine is not supported on this CPU.
+     */
+    explicit CRC16(Engine engine);
+
+    /**
+     * Determine whether a particular engine can be used on this CPU.
+     *
+     * @param[in] engine The engine to check.
+     * @returns true if the engine can be used, false otherwise.
+     */
+    static bool engine_supported(Engine engine);
+
+    /**
+     * Get the engine in use by this object.
+     *
+     * @returns The engine in use by this object.
+     */
+    Engine engine() const
+    {
+        return engine_;
+    }
+
+    /**
+     * Update an existing CRC with additional data.
+     *
+     * Calling this repeatedly on consecutive pieces of a buffer gives the same
+     * result as calling it once on the whole buffer, so the CRC can be
+     * computed as data streams in.  To compute the CRC of a complete buffer,
+     * start with a crc of 0.
+     *
+     * @param[in] crc The existing CRC.
+     * @param[in] data The buffer containing the additional data.
+     * @param[in] len The length of the additional data.
+     * @returns The new CRC.
+     */
+    uint16_t update(uint16_t crc, const uint8_t *data, size_t len) const
+    {
+        return update_fn_(crc, data, len);
+    }
+
+    /**
+     * Add the CRC of one additional byte.
+     *
+     * @param[in] crc The existing CRC.
+     * @param[in] data The new byte to add to the CRC.
+     * @returns The new CRC.
+     */
+    static uint16_t update_byte(uint16_t crc, uint8_t data);
+
+private:
+    typedef uint16_t (*update_fn_t)(uint16_t, const uint8_t *, size_t);
+
+    Engine engine_;
+    update_fn_t update_fn_;
+};
+
+}  // namespace impl
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
+
+#endif
@@ -0,0 +1,207 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ROS2_SERIAL_EXAMPLE__DISPATCH_POOL_HPP_
+#define ROS2_SERIAL_EXAMPLE__DISPATCH_POOL_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "ros2_serial_example/spsc_ring_buffer.hpp"
+#include "ros2_serial_example/topic_id.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+/**
+ * The DispatchPool class hands received payloads from the read thread to a
+ * pool of worker threads, which deserialize and publish them.
+ *
+ * Each worker has a lock-free queue of its own (an SPSCRingBuffer), and every
+ * payload of a topic goes to the same worker, picked by the source (the
+ * transport the payload came from) and the topic ID.  Payloads of one topic
+ * are therefore handled in the order they arrived, while different topics
+ * are handled in parallel.
+ *
+ * Payloads pushed with a priority above 0 can be kept apart from the rest
+ * on workers of their own, so that they don't wait behind the payloads of
+ * busier topics.
+ *
+ * Only one thread may push(); if the queue of a worker is full, the payload
+ * is dropped rather than holding up the read thread.
+ */
+class DispatchPool final
+{
+public:
+    /**
+     * The function that handles a payload on a worker.
+     *
+     * @param[in] worker The index of the worker calling it.
+     * @param[in] source The source the payload was pushed with.
+     * @param[in] topic_ID The topic ID of the payload.
+     * @param[in] buffer The payload, which the handler may change in place;
+     *                   it is only valid until the handler returns.
+     * @param[in] length The length of the payload.
+     * @param[in] receive_time The time the payload was received.
+     */
+    using Handler = std::function<void(size_t worker, uint16_t source, topic_id_size_t topic_ID,
+                                       uint8_t * buffer, size_t length,
+                                       std::chrono::system_clock::time_point receive_time)>;
+
+    /**
+     * Construct a DispatchPool and start its workers.
+     *
+     * @param[in] workers The number of worker threads.
+     * @param[in] queue_bytes The size of the queue of each worker, in bytes.
+     * @param[in] handler The function that handles the payloads.
+     * @param[in] max_payload If not 0, the longest payload that will be
+     *                        pushed; the workers then allocate everything
+     *                        they need for the payloads up front.
+     * @param[in] priority_workers The number of extra worker threads that
+     *                             only handle the payloads pushed with a
+     *                             priority above 0; if 0, those go to the
+     *                             other workers like the rest.
+     * @throws std::runtime_error If workers or queue_bytes is 0.
+     */
+    DispatchPool(size_t workers, size_t queue_bytes, Handler handler, size_t max_payload = 0,
+                 size_t priority_workers = 0);
+
+    ~DispatchPool();
+
+    DispatchPool(DispatchPool const &) = delete;
+    DispatchPool& operator=(DispatchPool const &) = delete;
+    DispatchPool(DispatchPool &&) = delete;
+    DispatchPool& operator=(DispatchPool &&) = delete;
+
+    /**
+     * Copy a payload into the queue of the worker for its topic, waking the
+     * worker if it is asleep.
+     *
+     * @param[in] source The source of the payload, such as the index of the
+     *                   transport it came from.
+     * @param[in] topic_ID The topic ID of the payload.
+     * @param[in] buffer The payload.
+     * @param[in] length The length of the payload.
+     * @param[in] receive_time The time the payload was received.
+     * @param[in] priority The priority of the topic; if above 0, the payload
+     *                     goes to one of the priority workers, if there are
+     *                     any.  Every payload of a topic must be pushed with
+     *                     the same priority to stay in order.
+     * @returns true if the payload was queued, false if the queue of the
+     *          worker is full or the payload is larger than it.
+     */
+    bool push(uint16_t source, topic_id_size_t topic_ID, const uint8_t * buffer, size_t length,
+              std::chrono::system_clock::time_point receive_time, uint8_t priority = 0);
+
+    /**
+     * Wait for the workers to finish handling every payload pushed so far.
+     * This may only be called from the thread that pushes, and spins rather
+     * than sleeps, since it is meant for waits as short as a handful of
+     * payloads.
+     *
+     * @returns true once every payload was handled, or false if the pool
+     *          was stopped first.
+     */
+    bool wait_handled();
+
+    /**
+     * Stop the workers, throwing away any payloads they haven't handled yet.
+     * This waits for the payloads being handled to finish.
+     */
+    void stop();
+
+    /**
+     * Get the number of worker threads, including the priority workers.
+     *
+     * @returns The number of worker threads.
+     */
+    size_t workers() const
+    {
+        return workers_.size();
+    }
+
+    /**
+     * Get the number of priority workers, which are the last ones.
+     *
+     * @returns The number of priority workers.
+     */
+    size_t priority_workers() const
+    {
+        return workers_.size() - normal_workers_;
+    }
+
+    /**
+     * Get the native handle of a worker thread, such as for setting its
+     * scheduling.
+     *
+     * @param[in] worker The index of the worker, less than workers().
+     * @returns The native handle of the worker thread.
+     */
+    std::thread::native_handle_type native_handle(size_t worker)
+    {
+        return workers_[worker]->thread.native_handle();
+    }
+
+private:
+    struct Record final
+    {
+        uint32_t length;
+        uint16_t source;
+        topic_id_size_t topic_ID;
+        int64_t receive_time_ns;
+    };
+
+    struct Worker final
+    {
+        explicit Worker(size_t queue_bytes) : queue(queue_bytes)
+        {
+        }
+
+        impl::SPSCRingBuffer queue;
+        // The payloads pushed to the worker, which only push() touches, and
+        // the ones it has handled.
+        uint64_t pushed{0};
+        std::atomic<uint64_t> handled{0};
+        // The worker sets sleeping before it waits on wakeup, and push()
+        // only takes mutex to notify it when it is set.
+        std::atomic<bool> sleeping{false};
+        std::mutex mutex;
+        std::condition_variable wakeup;
+        std::thread thread;
+    };
+
+    void worker_func(size_t index);
+
+    Handler handler_;
+    size_t max_payload_;
+    size_t normal_workers_;
+    std::atomic<bool> stopping_{false};
+    std::vector<std::unique_ptr<Worker>> workers_;
+};
+
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
+
+#endif
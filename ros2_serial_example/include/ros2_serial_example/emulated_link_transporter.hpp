@@ -0,0 +1,241 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ROS2_SERIAL_EXAMPLE__EMULATED_LINK_TRANSPORTER_HPP_
+#define ROS2_SERIAL_EXAMPLE__EMULATED_LINK_TRANSPORTER_HPP_
+
+// C++ includes
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+
+// Local includes
+#include "ros2_serial_example/transporter.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+namespace impl
+{
+
+struct EmulatedChannel;
+
+}  // namespace impl
+
+/**
+ * The impairments of one direction of an emulated link.  The defaults are a
+ * perfect link.
+ */
+struct LinkImpairments final
+{
+    /// The line rate in baud, at 10 bits a byte as for 8N1; 0 for no limit.
+    uint32_t baudrate{0};
+    /// How long a byte takes to get to the other end once it is sent.
+    std::chrono::microseconds delay{0};
+    /// The most that is added at random to the delay of each write.
+    std::chrono::microseconds jitter{0};
+    /// The chance of each bit being flipped.
+    double bit_error_rate{0.0};
+    /// The chance of each byte being replaced by a different one.
+    double byte_error_rate{0.0};
+    /// The chance of a loss burst starting at each byte (or packet, with an
+    /// MTU).
+    double burst_rate{0.0};
+    /// The mean number of bytes (or packets) lost in a burst; at least 1.
+    double burst_length{1.0};
+    /// If not 0, each write is a packet of at most this many bytes, which is
+    /// lost or kept whole; otherwise the link is a byte stream.
+    size_t mtu{0};
+    /// The seed of the random numbers, so that a run can be repeated.
+    uint64_t seed{1};
+};
+
+/**
+ * The EmulatedLinkTransporter class is an implementation of the abstract
+ * Transporter class for a link that exists only in memory, with the
+ * bandwidth, delay and errors of a real one, so that the protocol options
+ * can be measured and tested against it without hardware.
+ *
+ * The transporters come in pairs (see create_pair()), one for each end of
+ * the link.  A write is sent out at the line rate after whatever is still
+ * being sent, and turns up at the other end the delay (plus some jitter)
+ * after that; a writer that gets more than TX_BUFFER_BYTES ahead of the line
+ * waits, as it would for a UART.  On the way its bits and bytes may be
+ * damaged, and bytes are lost in bursts, with the bursts starting at random
+ * and lasting for a number of bytes that is geometrically distributed with
+ * the given mean (the Gilbert-Elliott model).  With an MTU, writes are
+ * packets like UDP datagrams: longer ones fail, bursts lose whole packets,
+ * and each packet is read as a frame of its own (see datagram_frames_);
+ * packets may be reordered by the jitter, where the bytes of a stream never
+ * are.
+ *
+ * All of the randomness comes from a generator seeded per direction, so the
+ * same writes are always damaged the same way.
+ */
+class EmulatedLinkTransporter final : public Transporter
+{
+public:
+    /// How far ahead of the line a writer can get before it has to wait.
+    static constexpr size_t TX_BUFFER_BYTES = 4096;
+
+    /**
+     * What happened to the bytes written to one end of the link so far.
+     */
+    struct Stats final
+    {
+        uint64_t bytes_written{0};
+        uint64_t bytes_lost{0};
+        uint64_t bits_flipped{0};
+        uint64_t bytes_replaced{0};
+        uint64_t oversize_packets{0};
+    };
+
+    /**
+     * Create the two ends of an emulated link.
+     *
+     * @param[in] protocol The backend protocol to use; see Transporter docs
+     *                     for more information about supported protocols.
+     * @param[in] a_to_b The impairments of what the first end writes.
+     * @param[in] b_to_a The impairments of what the second end writes.
+     * @param[in] read_poll_ms The amount of time to wait for data to come in
+     *                         before timing out.
+     * @param[in] ring_buffer_size The number of bytes to allocate to the
+     *                             underlying ring buffer of each end.
+     * @returns The two ends, which still have to be initialized.
+     * @throws std::runtime_error If an error rate isn't between 0 and 1, a
+     *         burst length is less than 1, or the delay or jitter is
+     *         negative.
+     */
+    static std::pair<std::unique_ptr<EmulatedLinkTransporter>, std::unique_ptr<EmulatedLinkTransporter>>
+    create_pair(const std::string & protocol, const LinkImpairments & a_to_b, const LinkImpairments & b_to_a,
+                uint32_t read_poll_ms, size_t ring_buffer_size);
+
+    ~EmulatedLinkTransporter() override;
+
+    EmulatedLinkTransporter(EmulatedLinkTransporter const &) = delete;
+    EmulatedLinkTransporter& operator=(EmulatedLinkTransporter const &) = delete;
+    EmulatedLinkTransporter(EmulatedLinkTransporter &&) = delete;
+    EmulatedLinkTransporter& operator=(EmulatedLinkTransporter &&) = delete;
+
+    /**
+     * Open this end of the link.
+     *
+     * @returns 0 on success, -1 on error.
+     */
+    int init() override;
+
+    /**
+     * Close this end of the link.  Anything it wrote that hasn't arrived
+     * yet still does.
+     *
+     * @returns 0 on success, -1 on error.
+     */
+    int close() override;
+
+    /**
+     * Get the number of bytes written that haven't gone out on the line yet.
+     *
+     * @returns The number of bytes waiting to be sent.
+     */
+    ssize_t get_write_queue_bytes() const override;
+
+    /**
+     * Get the line rate of what this end writes.
+     *
+     * @returns The line rate in baud, or 0 if it has no limit.
+     */
+    uint32_t get_baudrate() const override;
+
+    /**
+     * Get what happened to the bytes written to this end so far.
+     *
+     * @returns The statistics of the direction this end writes to.
+     */
+    Stats get_link_stats() const;
+
+    /**
+     * Change how long a read waits for data to come in.
+     *
+     * This must only be called from the thread that reads.
+     *
+     * @param[in] read_poll_ms The time to wait in milliseconds.
+     * @returns 0.
+     */
+    int set_read_poll_ms(uint32_t read_poll_ms) override
+    {
+        read_poll_ms_ = read_poll_ms;
+        return 0;
+    }
+
+private:
+    EmulatedLinkTransporter(const std::string & protocol, std::shared_ptr<impl::EmulatedChannel> tx,
+                            std::shared_ptr<impl::EmulatedChannel> rx, uint32_t read_poll_ms,
+                            size_t ring_buffer_size);
+
+    /**
+     * Copy whatever has arrived from the other end into the ring buffer.
+     *
+     * This method is an override of the abstract one in the Transporter class.
+     * If nothing has arrived, it sleeps until something does or until
+     * read_poll_ms passes, in which case it returns 0.
+     */
+    ssize_t node_read() override;
+
+    /**
+     * Send data to the other end.
+     *
+     * This method is an override of the abstract one in the Transporter class.
+     *
+     * @params[in] buffer The buffer containing the data to write.
+     * @params[in] len The number of bytes in the buffer to write.
+     * @returns The number of bytes written on success (which is len, even
+     *          if some of them will be lost), or -1 on error, with errno set
+     *          to EMSGSIZE if len is more than the MTU.
+     */
+    ssize_t node_write(void *buffer, size_t len) override;
+
+    /**
+     * Hand each packet that has arrived from the other end to the visitor.
+     *
+     * This method is an override of the virtual one in the Transporter
+     * class, and is only used with an MTU.  If nothing has arrived, it sleeps
+     * until something does or until read_poll_ms passes, in which case it
+     * returns 0.
+     */
+    ssize_t node_read_frames(const FrameVisitor & visitor) override;
+
+    /**
+     * Detect whether this end is open.
+     *
+     * @returns true if this end is open, false otherwise.
+     */
+    bool fds_OK() override;
+
+    std::shared_ptr<impl::EmulatedChannel> tx_;
+    std::shared_ptr<impl::EmulatedChannel> rx_;
+    uint32_t read_poll_ms_;
+    std::atomic<bool> open_{false};
+};
+
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
+
+#endif
@@ -0,0 +1,190 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ROS2_SERIAL_EXAMPLE__ISOTP_HPP_
+#define ROS2_SERIAL_EXAMPLE__ISOTP_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <linux/can.h>
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+namespace impl
+{
+
+/**
+ * The IsoTp class splits messages into CAN-FD frames, and puts them back
+ * together, as described by ISO 15765-2 (ISO-TP).
+ *
+ * A message of up to SF_MAX_LEN bytes goes in a single frame.  A longer one
+ * is sent as a first frame followed by consecutive frames, all of them
+ * 64 bytes long except for the last one.  Frames that aren't full are
+ * padded with PADDING up to the next length a CAN-FD frame can have.
+ *
+ * The receiver of a segmented message answers the first frame with a flow
+ * control frame.  The segment() side doesn't wait for it: the consecutive
+ * frames are sent straight away, as if the receiver had asked for no
+ * separation time and no block size, which is what a receiver that keeps up
+ * with the bus asks for.  The Reassembler side sends one that asks for just
+ * that (see flow_control()).
+ */
+class IsoTp final
+{
+public:
+    /// The data length of a full CAN-FD frame, and of every frame of a
+    /// segmented message except the last.
+    static constexpr size_t FRAME_LEN = CANFD_MAX_DLEN;
+    /// The longest message that fits in a single frame.
+    static constexpr size_t SF_MAX_LEN = FRAME_LEN - 2;
+    /// The longest message whose length fits in a short first frame header.
+    static constexpr size_t FF_SHORT_MAX_LEN = 4095;
+    /// The byte that frames are padded with.
+    static constexpr uint8_t PADDING = 0xCC;
+
+    IsoTp() = delete;
+
+    /**
+     * Get the number of frames a message is split into.
+     *
+     * @param[in] len The length of the message.
+     * @returns The number of frames.
+     */
+    static size_t frame_count(size_t len);
+
+    /**
+     * Split a message into frames.
+     *
+     * @param[in] data The message.
+     * @param[in] len The length of the message, which must be at most
+     *                UINT32_MAX.
+     * @param[in] can_id The CAN ID (with flags) to give each frame.
+     * @param[out] frames The frames to write, of which there must be at least
+     *                    frame_count(len).
+     * @returns The number of frames written.
+     */
+    static size_t segment(const uint8_t *data, size_t len, canid_t can_id, struct canfd_frame *frames);
+
+    /// The flow status of a flow control frame.
+    enum class FlowStatus : uint8_t
+    {
+        CONTINUE = 0,
+        WAIT = 1,
+        OVERFLOW = 2,
+    };
+
+    /**
+     * Make a flow control frame with no block size and no separation time.
+     *
+     * @param[in] status The flow status.
+     * @param[in] can_id The CAN ID (with flags) to give the frame.
+     * @param[out] frame The frame.
+     */
+    static void flow_control(FlowStatus status, canid_t can_id, struct canfd_frame *frame);
+
+    /**
+     * Get the shortest length a CAN-FD frame can have that holds len bytes.
+     *
+     * @param[in] len The number of bytes, which must be at most FRAME_LEN.
+     * @returns The frame length.
+     */
+    static uint8_t padded_length(size_t len);
+
+    /**
+     * The Reassembler class puts the frames sent from a single CAN ID back
+     * together into messages.
+     */
+    class Reassembler final
+    {
+    public:
+        /// What a frame did.
+        enum class Result
+        {
+            /// The frame was part of a message that isn't complete yet.
+            PENDING,
+            /// The frame completed a message; see message().
+            COMPLETE,
+            /// The frame was a first frame, which should be answered with a
+            /// flow control frame that says to continue.
+            FIRST_FRAME,
+            /// The frame was a first frame of a message longer than the
+            /// maximum, which should be answered with a flow control frame
+            /// that says so; the message is dropped.
+            OVERFLOW,
+            /// The frame was a flow control frame, which is ignored.
+            IGNORED,
+            /// The frame was malformed or out of sequence; it and any message
+            /// in progress are dropped.
+            ERROR,
+        };
+
+        /**
+         * Construct a Reassembler.
+         *
+         * @param[in] max_len The longest message to accept.
+         */
+        explicit Reassembler(size_t max_len);
+
+        /**
+         * Add a frame.
+         *
+         * @param[in] data The data of the frame.
+         * @param[in] len The data length of the frame.
+         * @returns What the frame did.
+         */
+        Result push(const uint8_t *data, size_t len);
+
+        /**
+         * Get the message that the last frame completed.  This is valid until
+         * the next call to push().
+         *
+         * @returns The message.
+         */
+        const uint8_t *message() const
+        {
+            return message_;
+        }
+
+        /**
+         * Get the length of the message that the last frame completed.
+         *
+         * @returns The length of the message.
+         */
+        size_t message_length() const
+        {
+            return message_len_;
+        }
+
+    private:
+        size_t max_len_;
+        std::vector<uint8_t> buffer_;
+        size_t expected_{0};
+        uint8_t next_sequence_{0};
+        bool in_progress_{false};
+        const uint8_t *message_{nullptr};
+        size_t message_len_{0};
+    };
+};
+
+}  // namespace impl
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
+
+#endif
@@ -0,0 +1,269 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ROS2_SERIAL_EXAMPLE__LINK_CAPTURE_HPP_
+#define ROS2_SERIAL_EXAMPLE__LINK_CAPTURE_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include <sys/uio.h>
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+/**
+ * The LinkCapture class records the raw bytes that go over a link, for
+ * looking at later or for replaying with a ReplayTransporter.
+ *
+ * The file is a header followed by one record per chunk of data that was
+ * read from or written to the link, each with the time (from
+ * std::chrono::steady_clock) it was read or written.  It is memory-mapped
+ * and only ever appended to, so adding a record is a copy into memory; the
+ * file is grown (and its blocks allocated) a megabyte or more at a time.
+ * A record is only marked as valid once all of it is in place, so a capture
+ * from a process that crashed can still be read up to the last whole record.
+ */
+class LinkCapture final
+{
+public:
+    /// Which way the data of a record went.
+    enum class Direction : uint8_t
+    {
+        RX = 1,
+        TX = 2,
+    };
+
+    LinkCapture();
+    ~LinkCapture();
+
+    LinkCapture(LinkCapture const &) = delete;
+    LinkCapture& operator=(LinkCapture const &) = delete;
+    LinkCapture(LinkCapture &&) = delete;
+    LinkCapture& operator=(LinkCapture &&) = delete;
+
+    /**
+     * Create a capture file, replacing any that is there, closing any that
+     * was open before.
+     *
+     * @param[in] path The path of the file.
+     * @param[in] protocol The framing protocol of the link, which is stored
+     *                     in the file for replaying it.
+     * @returns true if the file was created, false otherwise.
+     */
+    bool open(const std::string & path, const std::string & protocol);
+
+    /**
+     * Add a record.  This may be called from several threads at once.
+     *
+     * If the file can't be grown (for instance, because the disk is full),
+     * an error is printed and nothing more is captured.
+     *
+     * @param[in] direction Which way the data went.
+     * @param[in] iov The buffers containing the data, which make up a single
+     *                record.
+     * @param[in] iovcnt The number of buffers in iov.
+     */
+    void append(Direction direction, const struct iovec *iov, int iovcnt);
+
+    /**
+     * Add a record from a single buffer.  See the other append().
+     *
+     * @param[in] direction Which way the data went.
+     * @param[in] data The data.
+     * @param[in] length The length of the data.
+     */
+    void append(Direction direction, const void *data, size_t length);
+
+    /**
+     * Add a record that was read or written earlier.  See the other
+     * append().
+     *
+     * @param[in] direction Which way the data went.
+     * @param[in] iov The buffers containing the data, which make up a single
+     *                record.
+     * @param[in] iovcnt The number of buffers in iov.
+     * @param[in] timestamp_ns When the data was read or written, in
+     *                         nanoseconds of std::chrono::steady_clock.
+     */
+    void append(Direction direction, const struct iovec *iov, int iovcnt, uint64_t timestamp_ns);
+
+    /**
+     * Cut the file down to the records in it and close it.  This is done
+     * by the destructor too.
+     */
+    void close();
+
+private:
+    bool grow(size_t needed);
+
+    std::mutex mutex_;
+    int fd_{-1};
+    uint8_t *data_{nullptr};
+    size_t mapped_{0};
+    size_t length_{0};
+};
+
+/**
+ * The FlightRecorder class keeps the latest raw bytes that went over a link
+ * in a fixed amount of memory, so that what led up to a problem can be
+ * written out as a capture once it has happened.
+ *
+ * The records go one after the other into a ring of memory that is mapped
+ * twice in a row, so that a record running over the end of the ring is
+ * still copied in with a single memcpy; once the ring is full, the oldest
+ * records are overwritten.  Adding a record takes no lock, since its place
+ * in the ring is claimed with an atomic add, so the reading and writing
+ * threads of a transport can both add records at the same time.
+ */
+class FlightRecorder final
+{
+public:
+    /**
+     * Construct a FlightRecorder.
+     *
+     * @param[in] size The size of the ring in bytes, which is rounded up to
+     *                 a multiple of the page size.
+     * @throws std::runtime_error If size is 0 or the memory couldn't be
+     *                            mapped.
+     */
+    explicit FlightRecorder(size_t size);
+    ~FlightRecorder();
+
+    FlightRecorder(FlightRecorder const &) = delete;
+    FlightRecorder& operator=(FlightRecorder const &) = delete;
+    FlightRecorder(FlightRecorder &&) = delete;
+    FlightRecorder& operator=(FlightRecorder &&) = delete;
+
+    /**
+     * Add a record.  This may be called from several threads at once.  A
+     * record that doesn't fit in the ring is left out.
+     *
+     * @param[in] direction Which way the data went.
+     * @param[in] iov The buffers containing the data, which make up a single
+     *                record.
+     * @param[in] iovcnt The number of buffers in iov.
+     */
+    void append(LinkCapture::Direction direction, const struct iovec *iov, int iovcnt);
+
+    /**
+     * Write the records in the ring, oldest first, to a capture file.  This
+     * may be called while records are being added; records that are
+     * overwritten while they are copied out are left out.
+     *
+     * @param[in] path The path of the capture file, which is replaced.
+     * @param[in] protocol The framing protocol of the link, as for
+     *                     LinkCapture::open().
+     * @returns true if the file was written, false otherwise.
+     */
+    bool dump(const std::string & path, const std::string & protocol) const;
+
+    /**
+     * Get the size of the ring.
+     *
+     * @returns The size of the ring in bytes.
+     */
+    size_t get_size() const
+    {
+        return size_;
+    }
+
+private:
+    uint8_t *ring_{nullptr};
+    size_t size_{0};
+    // The bytes of records claimed and of records finished, since the
+    // start; the position of a record in the ring is where it was claimed,
+    // modulo the size.
+    std::atomic<uint64_t> claimed_{0};
+    std::atomic<uint64_t> committed_{0};
+};
+
+/**
+ * The LinkCaptureReader class reads back a file written by a LinkCapture.
+ * The file is memory-mapped, and the data of a record is handed out in
+ * place.
+ */
+class LinkCaptureReader final
+{
+public:
+    /// A record of a capture.
+    struct Record final
+    {
+        /// When the data was read or written, in nanoseconds of
+        /// std::chrono::steady_clock.
+        uint64_t timestamp_ns{0};
+        LinkCapture::Direction direction{LinkCapture::Direction::RX};
+        const uint8_t *data{nullptr};
+        size_t length{0};
+    };
+
+    LinkCaptureReader();
+    ~LinkCaptureReader();
+
+    LinkCaptureReader(LinkCaptureReader const &) = delete;
+    LinkCaptureReader& operator=(LinkCaptureReader const &) = delete;
+    LinkCaptureReader(LinkCaptureReader &&) = delete;
+    LinkCaptureReader& operator=(LinkCaptureReader &&) = delete;
+
+    /**
+     * Map a capture file into memory, unmapping any that was opened before.
+     *
+     * @param[in] path The path of the file.
+     * @returns true if the file was opened, false if there is no such file
+     *          or it isn't a capture.
+     */
+    bool open(const std::string & path);
+
+    /**
+     * Get the framing protocol the link used when the capture started.
+     *
+     * @returns The protocol; one of 'px4', 'cobs', 'cobs_zpe' or 'v2'.
+     */
+    const std::string & get_protocol() const
+    {
+        return protocol_;
+    }
+
+    /**
+     * Get the next record.  A record that was cut short, for instance by a
+     * crash while it was being written, ends the capture.
+     *
+     * @param[out] record The record, if there is one; its data stays valid
+     *                    until the reader is closed or opens another file.
+     * @returns true if there was another record, false at the end.
+     */
+    bool next(Record * record);
+
+    /// Go back to the first record.
+    void rewind();
+
+private:
+    void close();
+
+    const uint8_t *data_{nullptr};
+    size_t length_{0};
+    size_t offset_{0};
+    std::string protocol_;
+};
+
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
+
+#endif
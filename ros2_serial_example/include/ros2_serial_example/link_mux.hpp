@@ -0,0 +1,206 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ROS2_SERIAL_EXAMPLE__LINK_MUX_HPP_
+#define ROS2_SERIAL_EXAMPLE__LINK_MUX_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "ros2_serial_example/topic_id.hpp"
+#include "ros2_serial_example/transporter.hpp"
+#include "ros2_serial_example/tx_queue.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+/**
+ * The LinkMux class shares one link to a device between several independent
+ * channels, each of which is what a bridge (or any other tool) would
+ * otherwise have the link to itself for.
+ *
+ * The channel travels in the upper byte of the topic ID on the link: topic
+ * t of channel c is topic (c << CHANNEL_SHIFT) | t on the link (see
+ * link_topic_ID()), so each channel has topics 0 to 255 of its own,
+ * including the reserved topics for mapping requests and the like, and
+ * channel 0 is the link as it was without the LinkMux.  Anything but channel
+ * 0 needs a link protocol with 16-bit topic IDs, that is v2, and a device
+ * that knows about the channels.
+ *
+ * Each channel has an endpoint Transporter, such as the creating side of a
+ * ShmTransporter, that its client talks to with plain topic IDs.  A thread
+ * reads the link and hands each payload to the endpoint of its channel; one
+ * thread per channel reads its endpoint into a bounded queue of the
+ * channel; and a writer thread takes the payloads from the queues in
+ * deficit round robin order, so every channel with something to send gets
+ * an equal share of the bytes on the link, whatever the sizes of its
+ * payloads.  The payloads are moved as they are; neither side is
+ * deserialized.
+ *
+ * A payload that can't be delivered (to a channel that doesn't exist, to an
+ * endpoint that can't take it, or into a full queue) is dropped and counted,
+ * so a client that stops reading or floods its endpoint doesn't hold up the
+ * others.  Endpoints should have a short write timeout (see
+ * Transporter::set_write_timeout()) for the same reason.
+ */
+class LinkMux final
+{
+public:
+    /// How far up the topic ID on the link the channel is.
+    static constexpr unsigned CHANNEL_SHIFT = 8;
+
+    /// The largest topic ID of a channel.
+    static constexpr topic_id_size_t MAX_CHANNEL_TOPIC_ID = (1U << CHANNEL_SHIFT) - 1;
+
+    /// The most channels there can be.
+    static constexpr size_t MAX_CHANNELS = (static_cast<size_t>(std::numeric_limits<topic_id_size_t>::max()) >> CHANNEL_SHIFT) + 1;
+
+    /// The counters of one channel.
+    struct Stats final
+    {
+        /// Payloads from the link delivered to the endpoint.
+        uint64_t rx_messages{0};
+        /// Payloads from the link that the endpoint couldn't take.
+        uint64_t rx_drops{0};
+        /// Payloads from the endpoint written to the link.
+        uint64_t tx_messages{0};
+        /// Bytes of payload from the endpoint written to the link.
+        uint64_t tx_bytes{0};
+        /// Payloads from the endpoint dropped, because the queue was full,
+        /// the topic ID was too large, or the link write failed.
+        uint64_t tx_drops{0};
+    };
+
+    /**
+     * Construct a LinkMux.  The link and the endpoints must be initialized,
+     * and must stay around until the LinkMux is destroyed.
+     *
+     * @param[in] link The link to the device.
+     * @param[in] endpoints The endpoint of each channel, by channel.
+     * @param[in] queue_depth The most payloads that can wait to be written
+     *                        to the link for each channel.
+     * @param[in] quantum The bytes each channel may write to the link in a
+     *                    round, carried over to the next round if its next
+     *                    payload is larger.
+     * @throws std::runtime_error If link or an endpoint is a nullptr, there
+     *         are no endpoints or more than MAX_CHANNELS, the link can't carry
+     *         the topic IDs of channels other than 0, or queue_depth or
+     *         quantum is 0.
+     */
+    LinkMux(Transporter * link, const std::vector<Transporter *> & endpoints, size_t queue_depth, size_t quantum);
+    ~LinkMux();
+
+    LinkMux(LinkMux const &) = delete;
+    LinkMux& operator=(LinkMux const &) = delete;
+    LinkMux(LinkMux &&) = delete;
+    LinkMux& operator=(LinkMux &&) = delete;
+
+    /**
+     * Get the topic ID on the link of a topic of a channel.
+     *
+     * @param[in] channel The channel.
+     * @param[in] topic_ID The topic ID in the channel, up to
+     *                     MAX_CHANNEL_TOPIC_ID.
+     * @returns The topic ID on the link.
+     */
+    static topic_id_size_t link_topic_ID(size_t channel, topic_id_size_t topic_ID)
+    {
+        return static_cast<topic_id_size_t>((channel << CHANNEL_SHIFT) | topic_ID);
+    }
+
+    /**
+     * Start the threads.
+     */
+    void start();
+
+    /**
+     * Stop the threads.  Any payloads still queued are dropped.
+     */
+    void stop();
+
+    /**
+     * Get the counters of a channel.
+     *
+     * @param[in] channel The channel.
+     * @returns The counters, or all 0 if the channel doesn't exist.
+     */
+    Stats get_stats(size_t channel) const;
+
+    /**
+     * Get the number of payloads from the link for channels that don't
+     * exist.
+     *
+     * @returns The number of payloads dropped so far.
+     */
+    uint64_t get_unrouted() const
+    {
+        return unrouted_;
+    }
+
+private:
+    struct Channel final
+    {
+        explicit Channel(Transporter * endpoint, size_t queue_depth) : endpoint(endpoint), queue(queue_depth)
+        {
+        }
+
+        Transporter * endpoint;
+        // Each payload is queued with its topic ID in front of it.
+        impl::FrameQueue queue;
+        std::thread reader;
+        // Only touched by the writer thread.
+        std::vector<uint8_t> head;
+        bool have_head{false};
+        size_t deficit{0};
+
+        std::atomic<uint64_t> rx_messages{0};
+        std::atomic<uint64_t> rx_drops{0};
+        std::atomic<uint64_t> tx_messages{0};
+        std::atomic<uint64_t> tx_bytes{0};
+        std::atomic<uint64_t> tx_drops{0};
+    };
+
+    void link_reader_func();
+    void endpoint_reader_func(Channel * channel);
+    void writer_func();
+    bool write_round();
+
+    Transporter * link_;
+    std::vector<std::unique_ptr<Channel>> channels_;
+    size_t quantum_;
+    std::atomic<bool> running_{false};
+    std::thread link_reader_;
+    std::thread writer_;
+    std::atomic<uint64_t> unrouted_{0};
+
+    // The writer thread sleeps on this when every queue is empty.
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool queued_{false};
+};
+
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
+
+#endif
@@ -0,0 +1,79 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ROS2_SERIAL_EXAMPLE__LINK_NEGOTIATION_HPP_
+#define ROS2_SERIAL_EXAMPLE__LINK_NEGOTIATION_HPP_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+/**
+ * What one end of a link can do; the contents of a
+ * ros2_serial_msgs/LinkCapabilities OFFER.
+ */
+struct LinkCapabilities final
+{
+    // The baudrates this end can switch to; empty if it can't switch.
+    std::vector<uint32_t> baudrates;
+    // The serial wire protocols this end can speak.
+    std::vector<std::string> protocols;
+    // The largest payload this end can receive, or 0 if there is no limit.
+    uint32_t max_frame_size{0};
+    // Whether this end can decompress LZ4 payloads (v2 only).
+    bool compression{false};
+    // Whether this end can take several frames in one transfer.
+    bool batching{false};
+};
+
+/**
+ * What both ends of a link agreed on; the contents of a
+ * ros2_serial_msgs/LinkCapabilities SELECT.
+ */
+struct LinkSettings final
+{
+    // The baudrate to switch to, or 0 to keep the current one.
+    uint32_t baudrate{0};
+    std::string protocol;
+    // The largest payload either end can receive, or 0 if there is no limit.
+    uint32_t max_frame_size{0};
+    bool compression{false};
+    bool batching{false};
+};
+
+/**
+ * Work out the best settings that both ends of a link support.
+ *
+ * The highest baudrate both ends can switch to is picked, and the most
+ * capable protocol both can speak (v2, then cobs, then px4).  Compression
+ * is only used with v2 and batching only if both ends can take it.  The
+ * result is the same whichever end is local, so both ends can check it.
+ *
+ * @param[in] local The capabilities of this end.
+ * @param[in] remote The capabilities of the other end.
+ * @param[out] out The agreed settings.
+ * @returns true if the ends have a protocol in common, false otherwise.
+ */
+bool negotiate_link(const LinkCapabilities & local, const LinkCapabilities & remote, LinkSettings * out);
+
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
+
+#endif
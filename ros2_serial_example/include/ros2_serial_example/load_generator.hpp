@@ -0,0 +1,285 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ROS2_SERIAL_EXAMPLE__LOAD_GENERATOR_HPP_
+#define ROS2_SERIAL_EXAMPLE__LOAD_GENERATOR_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+#include "ros2_serial_example/metrics.hpp"
+#include "ros2_serial_example/topic_id.hpp"
+#include "ros2_serial_example/transporter.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace loadgen
+{
+
+/**
+ * One topic of a load mix.  Every 1/rate_hz seconds, burst messages of size
+ * bytes are sent back to back on out_topic_ID; the bridge is expected to
+ * send each of them back on in_topic_ID.
+ */
+struct TopicLoad final
+{
+    std::string name;
+    topic_id_size_t out_topic_ID{0};
+    topic_id_size_t in_topic_ID{0};
+    size_t size{0};
+    double rate_hz{0.0};
+    uint32_t burst{1};
+};
+
+/**
+ * What happened to the messages of one topic so far.
+ */
+struct TopicReport final
+{
+    std::string name;
+    uint64_t sent{0};
+    uint64_t received{0};
+    uint64_t lost{0};
+    uint64_t reordered{0};
+    uint64_t duplicates{0};
+    uint64_t bytes{0};
+    uint64_t rtt_p50_ns{0};
+    uint64_t rtt_p99_ns{0};
+    uint64_t rtt_p999_ns{0};
+    uint64_t rtt_max_ns{0};
+};
+
+/**
+ * What a process (the bridge, during a load test) used of the machine so
+ * far.
+ */
+struct ProcessUsage final
+{
+    // The CPU time used, user and system together, in seconds.
+    double cpu_s{0.0};
+    // The peak resident set size, in kB.
+    uint64_t max_rss_kb{0};
+};
+
+/**
+ * The LoadGenerator class sends a mix of topics over a Transporter at fixed
+ * rates or in bursts, and checks what comes back from the bridge.
+ *
+ * Every message is a std_msgs/UInt8MultiArray, serialized as bare CDR the
+ * way the bridge expects it, whose data starts with a sequence number and
+ * the time it was sent.  The bridge publishes it to ROS 2, and if one of its
+ * subscriptions is remapped onto the same ROS 2 topic, it sends the message
+ * straight back.  The generator then counts lost, reordered and duplicated
+ * messages and records the round trip time of each message in a histogram.
+ *
+ * send_due() and receive() are meant to be called from a sending and a
+ * receiving thread respectively, and report() may be called from any thread
+ * while they run.
+ */
+class LoadGenerator final
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // The length of the CDR header of the message (the empty layout and
+    // the length of the data) plus the sequence number and send time at the
+    // start of the data; no message can be shorter than this.
+    static constexpr size_t MIN_SIZE = 24;
+
+    /**
+     * Construct a LoadGenerator.
+     *
+     * @param[in] transporter The transporter to send the messages on; must
+     *                        outlive the LoadGenerator.
+     * @param[in] topics The topics to send.
+     * @throws std::runtime_error if a topic is shorter than MIN_SIZE, has
+     *         a rate that isn't positive or a burst of 0.
+     */
+    LoadGenerator(transport::Transporter * transporter, const std::vector<TopicLoad> & topics);
+    ~LoadGenerator();
+
+    LoadGenerator(LoadGenerator const &) = delete;
+    LoadGenerator& operator=(LoadGenerator const &) = delete;
+    LoadGenerator(LoadGenerator &&) = delete;
+    LoadGenerator& operator=(LoadGenerator &&) = delete;
+
+    /**
+     * Parse a topic given on the command line.
+     *
+     * @param[in] spec The topic, as <size>:<rate_hz>[:<burst>].
+     * @param[in] index The index of the topic in the mix, which its name and
+     *                  topic IDs are derived from.
+     * @param[out] out The topic.
+     * @returns true if the topic was parsed, false if spec is malformed.
+     */
+    static bool parse_topic_load(const std::string & spec, size_t index, TopicLoad * out);
+
+    /**
+     * Get the PX4 mix: topics with about the sizes and rates of the uORB
+     * topics that a flight controller typically streams to a companion
+     * computer.
+     *
+     * @param[in] first_index The index in the whole mix of the first topic,
+     *                        which the topic IDs are derived from.
+     * @returns The topics of the mix.
+     */
+    static std::vector<TopicLoad> px4_mix(size_t first_index);
+
+    /**
+     * Serialize a message.
+     *
+     * @param[in] seq The sequence number of the message.
+     * @param[in] send_time The time the message is sent.
+     * @param[out] buffer The buffer to serialize into.
+     * @param[in] size The size of the serialized message; must be at least
+     *                 MIN_SIZE.
+     */
+    static void encode(uint32_t seq, Clock::time_point send_time, uint8_t * buffer, size_t size);
+
+    /**
+     * Deserialize a message.
+     *
+     * @param[in] buffer The serialized message.
+     * @param[in] length The length of the serialized message.
+     * @param[out] seq The sequence number of the message.
+     * @param[out] send_time The time the message was sent.
+     * @returns true if the message was deserialized, false if it isn't a
+     *          message from encode().
+     */
+    static bool decode(const uint8_t * buffer, size_t length, uint32_t * seq, Clock::time_point * send_time);
+
+    /**
+     * Get the topics being sent.
+     *
+     * @returns The topics.
+     */
+    const std::vector<TopicLoad> & get_topics() const;
+
+    /**
+     * Send every message that is due.  The first call starts the schedule,
+     * and a topic that has fallen behind sends all of its missed bursts at
+     * once.
+     *
+     * @param[in] now The current time.
+     * @returns The time the next message is due.
+     */
+    Clock::time_point send_due(Clock::time_point now);
+
+    /**
+     * Account for a message that came back from the bridge.
+     *
+     * @param[in] topic_ID The topic ID the message was received on.
+     * @param[in] buffer The payload of the message.
+     * @param[in] length The length of the payload.
+     * @param[in] now The time the message was received.
+     * @returns true if the message is on one of the in_topic_IDs, false if
+     *          it isn't for the generator.
+     */
+    bool receive(topic_id_size_t topic_ID, const uint8_t * buffer, size_t length, Clock::time_point now);
+
+    /**
+     * Get what happened to the messages of every topic so far.  Messages
+     * that are still in flight count as lost.
+     *
+     * @param[out] out The reports, in the order of the topics.
+     */
+    void report(std::vector<TopicReport> * out) const;
+
+    /**
+     * Print a report as a table.
+     *
+     * @param[in] out The file to print to.
+     * @param[in] reports The reports from report().
+     * @param[in] elapsed_s The time the messages were sent over, for the
+     *                      throughput.
+     */
+    static void print_report(FILE * out, const std::vector<TopicReport> & reports, double elapsed_s);
+
+    /**
+     * Write a report as one line of JSON, so that the reports of runs with
+     * different links and protocols can be collected in one file and
+     * compared.
+     *
+     * @param[in] out The file to write to.
+     * @param[in] link The kind of link, for instance 'uart' or 'udp'.
+     * @param[in] protocol The serial protocol of the link.
+     * @param[in] reports The reports from report().
+     * @param[in] elapsed_s The time the messages were sent over.
+     * @param[in] start What the bridge had used when the load started, or
+     *                  nullptr if it wasn't measured.
+     * @param[in] end What the bridge had used when the load ended, or
+     *                nullptr if it wasn't measured.
+     */
+    static void write_json_report(FILE * out, const std::string & link, const std::string & protocol,
+                                  const std::vector<TopicReport> & reports, double elapsed_s,
+                                  const ProcessUsage * start, const ProcessUsage * end);
+
+    /**
+     * Find a running process by the name of its executable.
+     *
+     * @param[in] name The file name of the executable, without its
+     *                 directory.
+     * @returns The process ID of the first process found, or -1 if there is
+     *          none.
+     */
+    static pid_t find_process(const std::string & name);
+
+    /**
+     * Get what a process used of the machine so far, from /proc.
+     *
+     * @param[in] pid The process ID.
+     * @param[out] out What the process used.
+     * @returns true on success, false if the process is gone or /proc can't
+     *          be read.
+     */
+    static bool read_process_usage(pid_t pid, ProcessUsage * out);
+
+private:
+    struct TopicState final
+    {
+        TopicLoad load;
+        Clock::duration period{};
+        Clock::time_point next_send{};
+        std::atomic<uint64_t> sent{0};
+        std::atomic<uint64_t> received{0};
+        std::atomic<uint64_t> reordered{0};
+        std::atomic<uint64_t> duplicates{0};
+        std::atomic<uint64_t> bytes{0};
+        // Only used by the receiving thread.
+        uint32_t highest_seq{0};
+        bool any_received{false};
+        std::vector<bool> seen;
+        transport::impl::LatencyHistogram rtt;
+    };
+
+    transport::Transporter * transporter_;
+    std::vector<TopicLoad> topics_;
+    std::vector<std::unique_ptr<TopicState>> states_;
+    std::unique_ptr<uint8_t[]> send_buffer_;
+    bool started_{false};
+};
+
+}  // namespace loadgen
+}  // namespace ros2_to_serial_bridge
+
+#endif
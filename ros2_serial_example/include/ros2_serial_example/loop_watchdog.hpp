@@ -0,0 +1,228 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ROS2_SERIAL_EXAMPLE__LOOP_WATCHDOG_HPP_
+#define ROS2_SERIAL_EXAMPLE__LOOP_WATCHDOG_HPP_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "ros2_serial_example/metrics.hpp"
+#include "ros2_serial_example/topic_id.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+/**
+ * The LoopWatchdog class times each pass of a thread's loop, such as the
+ * read thread dispatching a batch of payloads or the writer thread sending a
+ * frame, and flags the passes that take longer than a threshold as stalls.
+ *
+ * The thread says which topic it is working on as it goes, so that each
+ * stall is put down to the topic that was being handled when it ended: a
+ * publisher that blocks under backpressure, for instance, shows up as stalls
+ * of its topic.  While the read thread is stalled nothing drains the
+ * transport, so the ring buffer overflows that show up in the pass that
+ * stalled or the one right after it are put down to the stall as well.
+ *
+ * A pass that never ends can't be timed when it ends, so check() lets
+ * another thread see how long the pass in progress has been going.
+ *
+ * begin(), set_topic() and end() must be called from the thread that is
+ * timed; the other methods may be called from any thread.  Timing a pass
+ * takes two clock reads and a few relaxed atomics, and doesn't allocate.
+ */
+class LoopWatchdog final
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    /// The most topics whose stalls are counted on their own; the stalls of
+    /// any further topics are only counted in the totals.
+    static constexpr size_t MAX_STALL_TOPICS = 16;
+
+    /**
+     * A pass that took longer than the threshold.
+     */
+    struct Stall final
+    {
+        uint64_t duration_ns{0};
+        /// Whether a topic was being handled; if not, the thread stalled
+        /// outside of any topic (for instance, flushing a write batch).
+        bool has_topic{false};
+        topic_id_size_t topic_ID{0};
+    };
+
+    /**
+     * The stalls put down to one topic.
+     */
+    struct TopicStalls final
+    {
+        bool has_topic{false};
+        topic_id_size_t topic_ID{0};
+        uint64_t stalls{0};
+        uint64_t total_ns{0};
+        uint64_t max_ns{0};
+        uint64_t ring_overflows{0};
+    };
+
+    /**
+     * A copy of what the watchdog has seen at one point in time.
+     */
+    struct Snapshot final
+    {
+        uint64_t threshold_ns{0};
+        /// The time each pass took.
+        impl::LatencyHistogram::Snapshot passes;
+        uint64_t stalls{0};
+        uint64_t stall_ns{0};
+        uint64_t max_stall_ns{0};
+        /// The ring buffer overflows put down to stalls.
+        uint64_t stall_ring_overflows{0};
+        /// The latest stall, if stalls isn't 0.
+        Stall last_stall;
+        /// The topics with stalls, in the order they first stalled.
+        std::vector<TopicStalls> topics;
+    };
+
+    LoopWatchdog() {}
+
+    LoopWatchdog(LoopWatchdog const &) = delete;
+    LoopWatchdog& operator=(LoopWatchdog const &) = delete;
+    LoopWatchdog(LoopWatchdog &&) = delete;
+    LoopWatchdog& operator=(LoopWatchdog &&) = delete;
+
+    /**
+     * Set how long a pass may take before it counts as a stall.  Passes are
+     * only timed while a threshold is set.
+     *
+     * @param[in] threshold The threshold, or 0 to stop timing the passes.
+     */
+    void set_threshold(std::chrono::nanoseconds threshold);
+
+    /**
+     * Get the time at the start or end of a pass.
+     *
+     * @returns The current time if a threshold is set, or a default
+     *          constructed time_point if it isn't.
+     */
+    Clock::time_point now() const
+    {
+        return threshold_ns_.load(std::memory_order_relaxed) > 0 ? Clock::now() : Clock::time_point();
+    }
+
+    /**
+     * Start timing a pass.  Nothing is timed if now came from now() while no
+     * threshold was set.
+     *
+     * @param[in] now The time the pass started, from now().
+     */
+    void begin(Clock::time_point now);
+
+    /**
+     * Find out whether a pass is being timed, such as for a thread that only
+     * starts timing once it has work to do.
+     *
+     * @returns true if begin() started a pass that hasn't ended yet.
+     */
+    bool in_pass() const
+    {
+        return pass_start_ns_.load(std::memory_order_relaxed) != 0;
+    }
+
+    /**
+     * Say which topic the pass is working on now.
+     *
+     * @param[in] topic_ID The topic ID.
+     */
+    void set_topic(topic_id_size_t topic_ID)
+    {
+        topic_.store(static_cast<int32_t>(topic_ID), std::memory_order_relaxed);
+    }
+
+    /**
+     * Stop timing a pass, and count it as a stall if it took longer than
+     * the threshold.
+     *
+     * @param[in] now The time the pass ended, from now().
+     * @param[in] ring_overflows The number of ring buffer overflows so far
+     *                           (see Transporter::get_ring_overflows()), or
+     *                           0 if the thread doesn't read.
+     * @returns true if the pass was a stall, false otherwise.
+     */
+    bool end(Clock::time_point now, uint64_t ring_overflows);
+
+    /**
+     * Find out whether the pass in progress has been going for longer than
+     * the threshold.
+     *
+     * @param[in] now The current time.
+     * @param[out] stall How long the pass has been going so far, and the
+     *                   topic it is working on.
+     * @returns true if the pass in progress is stalled, false if there is
+     *          none or it isn't.
+     */
+    bool check(Clock::time_point now, Stall * stall) const;
+
+    /**
+     * Take a snapshot of the watchdog.
+     *
+     * @param[out] out The snapshot to fill in; its vector keeps its capacity,
+     *                 so a snapshot can be reused.
+     */
+    void snapshot(Snapshot * out) const;
+
+private:
+    static constexpr int32_t NO_TOPIC = -1;
+    static constexpr size_t NO_ENTRY = MAX_STALL_TOPICS;
+
+    // Find the entry of a topic, adding it if there is room; returns
+    // NO_ENTRY if there isn't.  Must be called with stall_mutex_ held.
+    size_t stall_entry(int32_t topic);
+
+    std::atomic<int64_t> threshold_ns_{0};
+    // The start of the pass in progress in nanoseconds of Clock, or 0 if
+    // there is none, and the topic it is working on.
+    std::atomic<int64_t> pass_start_ns_{0};
+    std::atomic<int32_t> topic_{NO_TOPIC};
+    impl::LatencyHistogram passes_;
+
+    // Only used by the timed thread.
+    uint64_t last_ring_overflows_{0};
+    bool last_stalled_{false};
+    size_t last_stall_entry_{NO_ENTRY};
+
+    // Stalls are rare, so they are counted under a lock.
+    mutable std::mutex stall_mutex_;
+    uint64_t stalls_{0};
+    uint64_t stall_ns_{0};
+    uint64_t max_stall_ns_{0};
+    uint64_t stall_ring_overflows_{0};
+    Stall last_stall_;
+    std::array<TopicStalls, MAX_STALL_TOPICS> topic_stalls_{};
+    size_t num_topic_stalls_{0};
+};
+
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
+
+#endif
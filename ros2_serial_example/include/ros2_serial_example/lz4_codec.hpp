@@ -0,0 +1,124 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ROS2_SERIAL_EXAMPLE__LZ4_CODEC_HPP_
+#define ROS2_SERIAL_EXAMPLE__LZ4_CODEC_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+namespace impl
+{
+
+/**
+ * The LZ4Codec class compresses and decompresses data in the LZ4 block format.
+ *
+ * This format is described at
+ * https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md.  The output is
+ * compatible with LZ4_decompress_safe() (or LZ4_decompress_safe_usingDict()
+ * when a dictionary is used) from the reference library, so the other end of
+ * the link doesn't need this implementation.  Compression is a greedy,
+ * single-pass match search, which is plenty for the small payloads that go
+ * over a serial link.
+ *
+ * A codec can be given a dictionary: content that is likely to repeat in the
+ * data being compressed, such as a typical message of the topic.  Matches can
+ * then refer back into the dictionary, so even messages that are too small to
+ * have much repetition of their own compress well.  Both ends of the link
+ * must use exactly the same dictionary.  Only the last 64KB of a dictionary
+ * can be referred to, so anything before that is ignored.
+ *
+ * The match table and work buffer are kept between calls, so compressing
+ * doesn't allocate once the codec has seen its largest input.  compress()
+ * must not be called concurrently on the same codec, but decompress() doesn't
+ * change the codec and can be called at any time.
+ */
+class LZ4Codec final
+{
+public:
+    /**
+     * Construct an LZ4Codec.
+     *
+     * @param[in] dictionary The dictionary to use, which is copied; may be
+     *                       empty, in which case no dictionary is used.
+     */
+    explicit LZ4Codec(const std::vector<uint8_t> & dictionary = {});
+
+    LZ4Codec(LZ4Codec const &) = delete;
+    LZ4Codec& operator=(LZ4Codec const &) = delete;
+    LZ4Codec(LZ4Codec &&) = delete;
+    LZ4Codec& operator=(LZ4Codec &&) = delete;
+
+    /**
+     * Get the largest size that compressing len bytes can produce.
+     *
+     * @param[in] len The length of the data to compress.
+     * @returns The largest possible compressed length.
+     */
+    static size_t compress_bound(size_t len)
+    {
+        return len + len / 255 + 16;
+    }
+
+    /**
+     * Compress data.
+     *
+     * @param[in] iov The buffers containing the data to compress; the data is
+     *                the concatenation of the buffers.
+     * @param[in] iovcnt The number of buffers in iov.
+     * @param[out] dst The buffer to write the compressed data to.
+     * @param[in] dst_len The length of dst.
+     * @returns The compressed length on success, or 0 if the compressed data
+     *          doesn't fit in dst_len bytes.
+     */
+    size_t compress(const struct iovec *iov, int iovcnt, uint8_t *dst, size_t dst_len);
+
+    /**
+     * Decompress data.
+     *
+     * @param[in] src The compressed data.
+     * @param[in] len The length of the compressed data.
+     * @param[out] dst The buffer to write the decompressed data to.
+     * @param[in] dst_len The length of dst.
+     * @returns The decompressed length on success, or -1 if src isn't valid
+     *          compressed data or doesn't decompress into dst_len bytes.
+     */
+    ssize_t decompress(const uint8_t *src, size_t len, uint8_t *dst, size_t dst_len) const;
+
+private:
+    std::vector<uint8_t> dict_;
+    // The match table is seeded with the dictionary once, and copied over the
+    // working table at the start of each compress().
+    std::vector<uint32_t> seeded_table_;
+    std::vector<uint32_t> table_;
+    // The dictionary followed by the data being compressed, so that matches
+    // can run from one into the other.
+    std::vector<uint8_t> work_;
+};
+
+}  // namespace impl
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
+
+#endif
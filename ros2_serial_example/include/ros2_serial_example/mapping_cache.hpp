@@ -0,0 +1,91 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ROS2_SERIAL_EXAMPLE__MAPPING_CACHE_HPP_
+#define ROS2_SERIAL_EXAMPLE__MAPPING_CACHE_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+/**
+ * The MappingCache class keeps the last SerialMapping received from a device
+ * on disk, so that a bridge can set up its topics straight away on the next
+ * start instead of waiting for the device to answer.
+ *
+ * The cache file of a device is named after a hash of a string that
+ * identifies the device (such as its port name and serial device), and holds
+ * the CDR payload of the SerialMapping message as it was received, protected
+ * by a CRC-32C.
+ */
+class MappingCache final
+{
+public:
+    /**
+     * Construct a MappingCache.
+     *
+     * @param[in] dir The directory to keep the cache file in.
+     * @param[in] device The string that identifies the device.
+     */
+    MappingCache(const std::string & dir, const std::string & device);
+
+    /**
+     * Hash the string that identifies a device (64-bit FNV-1a).
+     *
+     * @param[in] device The string that identifies the device.
+     * @returns The hash.
+     */
+    static uint64_t hash_device(const std::string & device);
+
+    /**
+     * Get the path of the cache file.
+     *
+     * @returns The path.
+     */
+    const std::string & get_path() const;
+
+    /**
+     * Read the cached mapping.
+     *
+     * @param[out] payload The CDR payload of the SerialMapping message.
+     * @returns true if the mapping was read, false if there is no cache file
+     *          or it is damaged.
+     */
+    bool load(std::vector<uint8_t> * payload) const;
+
+    /**
+     * Replace the cached mapping.  The file is replaced atomically, so a
+     * bridge that is killed part way through leaves the old mapping behind.
+     *
+     * @param[in] payload The CDR payload of the SerialMapping message.
+     * @param[in] length The length of the payload.
+     * @returns true if the mapping was written, false otherwise.
+     */
+    bool store(const uint8_t * payload, size_t length) const;
+
+private:
+    std::string path_;
+};
+
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
+
+#endif
@@ -0,0 +1,437 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ROS2_SERIAL_EXAMPLE__METRICS_HPP_
+#define ROS2_SERIAL_EXAMPLE__METRICS_HPP_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "ros2_serial_example/topic_id.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+namespace impl
+{
+
+/**
+ * The LatencyHistogram class records durations in log-linear buckets, in the
+ * style of an HDR histogram.
+ *
+ * Every power of two is split into SUB_BUCKETS equal buckets, so whatever its
+ * magnitude, a value is known to within 1/SUB_BUCKETS of itself, and the
+ * whole range of uint64_t fits in NUM_BUCKETS counters.  Recording is a few
+ * relaxed atomic increments, so any number of threads can record into the
+ * histogram while another takes a snapshot of it.
+ */
+class LatencyHistogram final
+{
+public:
+    static constexpr size_t SUB_BUCKET_BITS = 3;
+    static constexpr size_t SUB_BUCKETS = 1U << SUB_BUCKET_BITS;
+    static constexpr size_t NUM_BUCKETS = SUB_BUCKETS + (64 - SUB_BUCKET_BITS) * SUB_BUCKETS;
+
+    /**
+     * A copy of the contents of a histogram at one point in time.
+     */
+    struct Snapshot final
+    {
+        uint64_t count{0};
+        uint64_t sum{0};
+        uint64_t max{0};
+        std::array<uint64_t, NUM_BUCKETS> buckets{};
+
+        /**
+         * Estimate a percentile of the recorded values.
+         *
+         * @param[in] percentile The percentile to estimate, from 0 to 100.
+         * @returns The largest value of the bucket that the percentile falls
+         *          in (but no more than the largest value recorded), or 0 if
+         *          nothing was recorded.
+         */
+        uint64_t percentile(double percentile) const;
+    };
+
+    LatencyHistogram();
+
+    LatencyHistogram(LatencyHistogram const &) = delete;
+    LatencyHistogram& operator=(LatencyHistogram const &) = delete;
+    LatencyHistogram(LatencyHistogram &&) = delete;
+    LatencyHistogram& operator=(LatencyHistogram &&) = delete;
+
+    /**
+     * Record a value.
+     *
+     * @param[in] value The value to record.
+     */
+    void record(uint64_t value);
+
+    /**
+     * Take a snapshot of the histogram.
+     *
+     * Values recorded while the snapshot is being taken may or may not be in
+     * it, so the count may be slightly off from the sum of the buckets.
+     *
+     * @param[out] out The snapshot to fill in.
+     */
+    void snapshot(Snapshot *out) const;
+
+    /**
+     * Get the bucket that a value is recorded in.
+     *
+     * @param[in] value The value.
+     * @returns The index of the bucket, less than NUM_BUCKETS.
+     */
+    static size_t bucket_index(uint64_t value);
+
+    /**
+     * Get the largest value that is recorded in a bucket.
+     *
+     * @param[in] index The index of the bucket, less than NUM_BUCKETS.
+     * @returns The largest value in the bucket.
+     */
+    static uint64_t bucket_max(size_t index);
+
+private:
+    std::array<std::atomic<uint64_t>, NUM_BUCKETS> buckets_;
+    std::atomic<uint64_t> count_{0};
+    std::atomic<uint64_t> sum_{0};
+    std::atomic<uint64_t> max_{0};
+};
+
+}  // namespace impl
+
+/**
+ * The Metrics class counts what happens to the messages that go through a
+ * Transporter, so that problems on a link can be seen while it is running.
+ *
+ * For each topic and direction it counts the messages and bytes that made it
+ * through and the messages that were dropped, by reason.  It also counts the
+ * bytes that were thrown away while looking for the start of a frame, the
+ * bytes lost because the ring buffer overflowed (and how many times it did),
+ * and failed reads.  Frames that carry a sequence number (PX4 and v2; COBS
+ * frames have none) are numbered per topic on the way out, and the numbers
+ * are checked on the way in for frames that went missing, came twice or
+ * came late, and frames of reliable topics that had to be sent again are
+ * counted too, as are the damaged bytes that forward error correction put
+ * right.  Finally, if timing is enabled, it keeps a LatencyHistogram of the
+ * time spent in each stage of getting a message across.
+ *
+ * Every counter is a relaxed atomic that is only ever incremented, and the
+ * per-topic counters live in blocks that are allocated the first time a
+ * topic in them is seen and then never freed.  Counting is therefore cheap
+ * enough to always be on, and snapshot() can be called from any thread at
+ * any time without taking a lock or stopping the counting.
+ */
+class Metrics final
+{
+public:
+    enum class Direction
+    {
+        RX,
+        TX,
+    };
+
+    // The reasons a message can be dropped.  A CRC failure (or, on a keyed
+    // link, a bad tag or a replay) or a payload that doesn't decode means
+    // the frame was corrupted, OVERSIZE that it was too big for the buffer
+    // or the protocol, WRITE that the transport failed to write it,
+    // DESERIALIZE that a good payload wasn't a valid message of
+    // the topic's type (most likely the two ends disagree on the type),
+    // STALE that it was older than the max age of its topic by the time the
+    // bridge got to it (or, for a service response, that its request was
+    // already given up on), and TIMEOUT that a service request got no
+    // response in time.
+    enum class Drop
+    {
+        CRC,
+        OVERSIZE,
+        DECODE,
+        WRITE,
+        DESERIALIZE,
+        STALE,
+        TIMEOUT,
+    };
+
+    // The stages that are timed: serializing a ROS 2 message to CDR,
+    // encoding and framing the payload, writing the frame to the transport,
+    // and dispatching a received payload to its publisher.
+    enum class Stage
+    {
+        SERIALIZE,
+        FRAME,
+        WRITE,
+        DISPATCH,
+    };
+    static constexpr size_t NUM_STAGES = 4;
+
+    using Clock = std::chrono::steady_clock;
+
+    /**
+     * The counters of one topic in one direction.
+     */
+    struct TopicCounters final
+    {
+        topic_id_size_t topic_ID{0};
+        uint64_t messages{0};
+        uint64_t bytes{0};
+        uint64_t crc_failures{0};
+        uint64_t oversize_drops{0};
+        uint64_t decode_failures{0};
+        uint64_t write_failures{0};
+        uint64_t deserialize_failures{0};
+        uint64_t stale_drops{0};
+        uint64_t timeouts{0};
+        // Received frames that never arrived, arrived twice in a row, or
+        // arrived after a later frame, going by their sequence numbers.  A
+        // late frame was counted as lost as well when the frame after it
+        // arrived.
+        uint64_t sequence_gaps{0};
+        uint64_t sequence_duplicates{0};
+        uint64_t sequence_reorders{0};
+        // Sent frames that had to be sent again because they weren't
+        // acknowledged in time (see Transporter::set_reliable()).
+        uint64_t retransmits{0};
+        // Received bytes that were damaged but put right by forward error
+        // correction (see Transporter::set_fec()).
+        uint64_t corrected_bytes{0};
+    };
+
+    /**
+     * A copy of all of the metrics at one point in time.  Topics appear in
+     * order of their topic ID, and only if something was counted for them.
+     */
+    struct Snapshot final
+    {
+        std::vector<TopicCounters> rx;
+        std::vector<TopicCounters> tx;
+        uint64_t garbage_bytes{0};
+        uint64_t ring_overflow_bytes{0};
+        uint64_t ring_overflows{0};
+        uint64_t ring_buffer_capacity{0};
+        uint64_t ring_buffer_high_water{0};
+        uint64_t read_errors{0};
+        std::array<impl::LatencyHistogram::Snapshot, NUM_STAGES> latency;
+    };
+
+    Metrics();
+    ~Metrics();
+
+    Metrics(Metrics const &) = delete;
+    Metrics& operator=(Metrics const &) = delete;
+    Metrics(Metrics &&) = delete;
+    Metrics& operator=(Metrics &&) = delete;
+
+    /**
+     * Count a message that made it through.
+     *
+     * @param[in] direction The direction the message went in.
+     * @param[in] topic_ID The topic ID of the message.
+     * @param[in] bytes The length of the payload.
+     */
+    void message(Direction direction, topic_id_size_t topic_ID, size_t bytes);
+
+    /**
+     * Count a message that was dropped.
+     *
+     * @param[in] direction The direction the message was going in.
+     * @param[in] topic_ID The topic ID of the message, as far as it is known.
+     * @param[in] reason Why the message was dropped.
+     */
+    void drop(Direction direction, topic_id_size_t topic_ID, Drop reason);
+
+    /**
+     * Get the sequence number for the next frame sent on a topic.  This is
+     * safe to call from several threads at once, and each gets a number of
+     * its own.
+     *
+     * @param[in] topic_ID The topic ID of the frame.
+     * @returns The sequence number, which goes up by one for every frame of
+     *          the topic and wraps around after 255.
+     */
+    uint8_t next_sequence(topic_id_size_t topic_ID);
+
+    /**
+     * Check the sequence number of a received frame against the last one of
+     * its topic, and count a gap, a duplicate or a reorder if it doesn't
+     * follow on.  Only one thread at a time may call this for a topic.
+     *
+     * A frame up to REORDER_WINDOW numbers behind the last one counts as
+     * late; anything further behind is taken to mean that the other end
+     * started over, and checking starts again from it.  The numbers are only
+     * 8 bits, so more than 127 frames lost in a row look like one of those
+     * instead of a gap.
+     *
+     * @param[in] topic_ID The topic ID of the frame.
+     * @param[in] sequence The sequence number of the frame.
+     */
+    void sequence(topic_id_size_t topic_ID, uint8_t sequence);
+
+    static constexpr int REORDER_WINDOW = 16;
+
+    /**
+     * Count a frame that was sent again because it wasn't acknowledged.
+     *
+     * @param[in] topic_ID The topic ID of the frame.
+     */
+    void retransmit(topic_id_size_t topic_ID);
+
+    /**
+     * Count received bytes that forward error correction put right.
+     *
+     * @param[in] topic_ID The topic ID of the frame.
+     * @param[in] bytes The number of bytes that were corrected.
+     */
+    void corrected(topic_id_size_t topic_ID, size_t bytes);
+
+    /**
+     * Count bytes that were received but weren't part of a frame.
+     *
+     * @param[in] bytes The number of bytes that were thrown away.
+     */
+    void garbage(size_t bytes);
+
+    /**
+     * Set the number of received bytes that were lost because the ring
+     * buffer overflowed.
+     *
+     * @param[in] bytes The total number of bytes lost so far.
+     */
+    void set_ring_overflow_bytes(uint64_t bytes);
+
+    /**
+     * Set the number of times received data was overwritten because the ring
+     * buffer overflowed.
+     *
+     * @param[in] overflows The total number of overflows so far.
+     */
+    void set_ring_overflows(uint64_t overflows);
+
+    /**
+     * Set the size of the receive ring buffer, which changes if it is
+     * adaptive, and the most bytes it has held at once.
+     *
+     * @param[in] capacity The number of bytes the ring buffer can hold now.
+     * @param[in] high_water The most bytes it has held so far.
+     */
+    void set_ring_buffer_usage(uint64_t capacity, uint64_t high_water);
+
+    /**
+     * Count a read from the transport that failed.
+     */
+    void read_error();
+
+    /**
+     * Enable or disable the latency histograms.  Timing costs a couple of
+     * clock reads per stage, so it is off by default.
+     *
+     * @param[in] enable true to time the stages, false to stop timing them.
+     */
+    void set_timing(bool enable);
+
+    /**
+     * Get the time at the start or end of a stage.
+     *
+     * @returns The current time if timing is enabled, or a default
+     *          constructed time_point if it isn't.
+     */
+    Clock::time_point now() const
+    {
+        return timing_.load(std::memory_order_relaxed) ? Clock::now() : Clock::time_point();
+    }
+
+    /**
+     * Record the time spent in a stage.  Nothing is recorded if either time
+     * came from now() while timing was disabled.
+     *
+     * @param[in] stage The stage.
+     * @param[in] start The time the stage started, from now().
+     * @param[in] end The time the stage ended, from now().
+     */
+    void record(Stage stage, Clock::time_point start, Clock::time_point end);
+
+    /**
+     * Take a snapshot of the metrics.
+     *
+     * Counts that happen while the snapshot is being taken may or may not be
+     * in it.
+     *
+     * @param[out] out The snapshot to fill in; its vectors keep their
+     *                 capacity, so a snapshot can be reused without
+     *                 allocating.
+     */
+    void snapshot(Snapshot *out) const;
+
+private:
+    struct Slot final
+    {
+        std::atomic<uint64_t> messages{0};
+        std::atomic<uint64_t> bytes{0};
+        std::atomic<uint64_t> crc_failures{0};
+        std::atomic<uint64_t> oversize_drops{0};
+        std::atomic<uint64_t> decode_failures{0};
+        std::atomic<uint64_t> write_failures{0};
+        std::atomic<uint64_t> deserialize_failures{0};
+        std::atomic<uint64_t> stale_drops{0};
+        std::atomic<uint64_t> timeouts{0};
+        std::atomic<uint64_t> sequence_gaps{0};
+        std::atomic<uint64_t> sequence_duplicates{0};
+        std::atomic<uint64_t> sequence_reorders{0};
+        std::atomic<uint64_t> retransmits{0};
+        std::atomic<uint64_t> corrected_bytes{0};
+        // For TX, the next sequence number; for RX, the last one plus
+        // SEQUENCE_VALID once a frame has been seen.
+        std::atomic<uint32_t> sequence{0};
+    };
+
+    static constexpr uint32_t SEQUENCE_VALID = 0x100;
+
+    static constexpr size_t BLOCK_BITS = 8;
+    static constexpr size_t BLOCK_SIZE = 1U << BLOCK_BITS;
+    static constexpr size_t NUM_BLOCKS = (static_cast<size_t>(std::numeric_limits<topic_id_size_t>::max()) >> BLOCK_BITS) + 1;
+
+    struct Block final
+    {
+        std::array<Slot, BLOCK_SIZE> slots;
+    };
+
+    // Get the counters for a topic, allocating its block if needed.
+    Slot & slot(Direction direction, topic_id_size_t topic_ID);
+
+    void snapshot_topics(Direction direction, std::vector<TopicCounters> *out) const;
+
+    std::array<std::array<std::atomic<Block *>, NUM_BLOCKS>, 2> blocks_;
+    std::atomic<uint64_t> garbage_bytes_{0};
+    std::atomic<uint64_t> ring_overflow_bytes_{0};
+    std::atomic<uint64_t> ring_overflows_{0};
+    std::atomic<uint64_t> ring_buffer_capacity_{0};
+    std::atomic<uint64_t> ring_buffer_high_water_{0};
+    std::atomic<uint64_t> read_errors_{0};
+    std::atomic<bool> timing_{false};
+    std::array<impl::LatencyHistogram, NUM_STAGES> latency_;
+};
+
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
+
+#endif
@@ -0,0 +1,527 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ROS2_SERIAL_EXAMPLE__PACKED_ENCODING_HPP_
+#define ROS2_SERIAL_EXAMPLE__PACKED_ENCODING_HPP_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "ros2_serial_example/string_interner.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace pubsub
+{
+
+/**
+ * Helpers for sending the messages of a topic packed, rather than as CDR.
+ *
+ * Topics with intern_strings set or a quantize profile send their messages
+ * packed: numbers and booleans in native byte order without any padding,
+ * the length of each sequence as a varint, and each string as a token (see
+ * string_interner.hpp).  Only topics with intern_strings set start each
+ * payload with the session and number of definitions of their interner;
+ * the others send every string as a literal.
+ *
+ * A quantize profile trades precision for size on the fields that don't
+ * need all of theirs, with a FieldRule for each field:
+ *
+ *     FLOAT32   a float64 sent as a float32
+ *     FIXED16   a float sent as an int16 count of scale, saturating, with
+ *               the lowest int16 standing for NaN
+ *     FIXED8    the same as an int8
+ *     DROP      not sent at all, and 0 (or an empty sequence) when decoded
+ *
+ * which applies to every element of an array or sequence, and to the field
+ * in every element of an array or sequence of a nested type.
+ *
+ * The packing of each type is done by a packing struct that
+ * generate_ros2_topics.py makes for every type it can pack, which looks
+ * like:
+ *
+ *     struct Packing final
+ *     {
+ *         static constexpr bool PACKABLE = true;
+ *         static constexpr bool HAS_STRINGS = true;
+ *         static const PackedField * fields(size_t * count);
+ *         static void encode(const T & msg, PackedWriter & writer);
+ *         static bool decode(PackedReader & reader, T & msg);
+ *     };
+ *
+ * where each number, boolean and string field of the type (nested ones
+ * included) has an index into fields(), which encode() and decode() pass
+ * along with the field so that its rule can be looked up.  Other types get
+ * a NoPacking.
+ */
+
+/**
+ * Append a varint (7 bits per octet, least significant first, with the top
+ * bit set on every octet but the last) to a payload.
+ */
+void put_packed_varint(uint64_t value, std::vector<uint8_t> * out);
+
+/**
+ * A field of a type that can be packed.
+ */
+struct PackedField final
+{
+    enum class Kind : uint8_t
+    {
+        BOOLEAN,
+        INTEGER,
+        FLOAT32,
+        FLOAT64,
+        STRING,
+    };
+
+    /// The path of the field from the message, like "header.frame_id", with
+    /// no index for the elements of arrays and sequences.
+    const char * path;
+    Kind kind;
+};
+
+/**
+ * How a field is sent, in the quantize profile of a topic.
+ */
+enum class Quantization : uint8_t
+{
+    FULL,
+    FLOAT32,
+    FIXED16,
+    FIXED8,
+    DROP,
+};
+
+/**
+ * The rule for one field of a quantize profile.
+ */
+struct FieldRule final
+{
+    Quantization kind{Quantization::FULL};
+    /// What a count of a fixed point field is worth.
+    double scale{1.0};
+};
+
+/**
+ * The quantize profile of a topic, with a rule for each of the fields of its
+ * type.
+ */
+class QuantizationProfile final
+{
+public:
+    QuantizationProfile() {}
+
+    /**
+     * Parse a profile from the quantize parameter of a topic, a list of
+     * specs like:
+     *
+     *     "altitude:float32"
+     *     "voltage:fixed16:0.001"
+     *     "current:fixed8:0.5"
+     *     "temperature:drop"
+     *
+     * float32 only applies to float64 fields, fixed16 and fixed8 to float32
+     * and float64 fields with a scale above 0, and drop to anything but
+     * strings.
+     *
+     * @param[in] specs The specs.
+     * @param[in] fields The fields of the type of the topic.
+     * @param[in] count The number of fields.
+     * @param[out] error What was wrong with the specs, if they didn't parse.
+     * @returns true on success, false if a spec is malformed, names a field
+     *          the type doesn't have or doesn't apply to its field.
+     */
+    bool parse(const std::vector<std::string> & specs, const PackedField * fields, size_t count,
+               std::string * error);
+
+    /**
+     * Get the rules for PackedWriter and PackedReader.
+     *
+     * @returns The rule of each field, or nullptr if every field is sent in
+     *          full.
+     */
+    const FieldRule * rules() const
+    {
+        return rules_.empty() ? nullptr : rules_.data();
+    }
+
+private:
+    std::vector<FieldRule> rules_;
+};
+
+/**
+ * Packs a message into a payload, for the encode() of a packing struct.
+ */
+class PackedWriter final
+{
+public:
+    /**
+     * Start a payload.
+     *
+     * @param[out] out The payload, which is cleared first; it keeps its
+     *                 capacity, so reusing it doesn't allocate once it has
+     *                 grown to the largest message.
+     * @param[in] interner The interner of the topic, or nullptr to send
+     *                     every string as a literal.
+     * @param[in] rules The rules of the quantize profile of the topic, or
+     *                  nullptr to send every field in full.
+     */
+    PackedWriter(std::vector<uint8_t> * out, StringInterner * interner, const FieldRule * rules = nullptr)
+        : out_(out), interner_(interner), rules_(rules)
+    {
+        out_->clear();
+        if (interner_ != nullptr)
+        {
+            interner_->begin(out_);
+        }
+    }
+
+    /**
+     * Append a number or boolean.
+     *
+     * @tparam Size The size of the field in CDR.
+     * @param[in] index The index of the field in the fields of the type.
+     */
+    template<size_t Size, typename F>
+    void put(const F & field, size_t index)
+    {
+        static_assert(sizeof(F) == Size, "field size doesn't match its CDR size");
+        static_assert(std::is_trivially_copyable<F>::value, "field can't be copied as bytes");
+        if (rules_ != nullptr && rules_[index].kind != Quantization::FULL)
+        {
+            put_quantized(field, rules_[index]);
+            return;
+        }
+        const uint8_t * p = reinterpret_cast<const uint8_t *>(&field);
+        out_->insert(out_->end(), p, p + Size);
+    }
+
+    /**
+     * Append an array of numbers.
+     *
+     * @tparam Size The size of each element in CDR.
+     * @param[in] index The index of the field in the fields of the type.
+     */
+    template<size_t Size, typename F>
+    void put_array(const F * data, size_t count, size_t index)
+    {
+        static_assert(sizeof(F) == Size, "field size doesn't match its CDR size");
+        static_assert(std::is_trivially_copyable<F>::value, "field can't be copied as bytes");
+        if (rules_ != nullptr && rules_[index].kind != Quantization::FULL)
+        {
+            for (size_t i = 0; i < count; ++i)
+            {
+                put_quantized(data[i], rules_[index]);
+            }
+            return;
+        }
+        const uint8_t * p = reinterpret_cast<const uint8_t *>(data);
+        out_->insert(out_->end(), p, p + Size * count);
+    }
+
+    /**
+     * Append the length of a sequence of strings or nested types.
+     */
+    void put_length(size_t length)
+    {
+        put_packed_varint(length, out_);
+    }
+
+    /**
+     * Append the length of a sequence of numbers or booleans, unless the
+     * sequence is dropped.
+     *
+     * @param[in] index The index of the field in the fields of the type.
+     */
+    void put_field_length(size_t length, size_t index)
+    {
+        if (rules_ != nullptr && rules_[index].kind == Quantization::DROP)
+        {
+            return;
+        }
+        put_packed_varint(length, out_);
+    }
+
+    /**
+     * Append a string.
+     */
+    void put_string(const std::string & s)
+    {
+        if (interner_ != nullptr)
+        {
+            interner_->put(s.data(), s.size(), out_);
+        }
+        else
+        {
+            StringInterner::put_literal(s.data(), s.size(), out_);
+        }
+    }
+
+private:
+    void put_quantized(float value, const FieldRule & rule)
+    {
+        put_quantized(static_cast<double>(value), rule);
+    }
+
+    void put_quantized(double value, const FieldRule & rule);
+
+    // The profile only drops the fields of other types.
+    template<typename F>
+    void put_quantized(const F &, const FieldRule &)
+    {
+    }
+
+    std::vector<uint8_t> * out_;
+    StringInterner * interner_;
+    const FieldRule * rules_;
+};
+
+/**
+ * Unpacks a message from a payload, for the decode() of a packing struct.
+ *
+ * Once anything fails to decode, the reader stops reading and every later
+ * field and length comes back as 0, so the decoding can carry on to the end
+ * without checking each field; finish() then says whether it worked.
+ */
+class PackedReader final
+{
+public:
+    /**
+     * Start decoding a payload.
+     *
+     * @param[in] data The payload.
+     * @param[in] length The length of the payload.
+     * @param[in] table The table of the topic, or nullptr if its strings
+     *                  aren't interned.
+     * @param[in] rules The rules of the quantize profile of the topic, or
+     *                  nullptr if every field is sent in full.
+     */
+    PackedReader(const uint8_t * data, size_t length, InternTable * table, const FieldRule * rules = nullptr);
+
+    /**
+     * Read a number or boolean; a boolean is true if its octet isn't 0.
+     *
+     * @tparam Size The size of the field in CDR.
+     * @param[in] index The index of the field in the fields of the type.
+     */
+    template<size_t Size, typename F>
+    void get(F & field, size_t index)
+    {
+        static_assert(sizeof(F) == Size, "field size doesn't match its CDR size");
+        static_assert(std::is_trivially_copyable<F>::value, "field can't be copied as bytes");
+        if (rules_ != nullptr && rules_[index].kind != Quantization::FULL)
+        {
+            get_quantized(field, rules_[index]);
+            return;
+        }
+        const uint8_t * p = take(Size);
+        if (p == nullptr)
+        {
+            field = F();
+            return;
+        }
+        load(p, field);
+    }
+
+    /**
+     * Read an array of numbers or booleans.
+     *
+     * @tparam Size The size of each element in CDR.
+     * @param[in] index The index of the field in the fields of the type.
+     */
+    template<size_t Size, typename F>
+    void get_array(F * data, size_t count, size_t index)
+    {
+        static_assert(sizeof(F) == Size, "field size doesn't match its CDR size");
+        static_assert(std::is_trivially_copyable<F>::value, "field can't be copied as bytes");
+        if (rules_ != nullptr && rules_[index].kind != Quantization::FULL)
+        {
+            for (size_t i = 0; i < count; ++i)
+            {
+                get_quantized(data[i], rules_[index]);
+            }
+            return;
+        }
+        const uint8_t * p = take(Size * count);
+        if (p == nullptr)
+        {
+            std::fill(data, data + count, F());
+            return;
+        }
+        load_array(p, data, count);
+    }
+
+    /**
+     * Read the length of a sequence of strings or nested types.  A length
+     * that couldn't fit in what is left of the payload fails, so that a bad
+     * length can't make the sequence allocate more than the payload could
+     * hold.
+     *
+     * @param[in] elem_size The least number of octets each element takes.
+     * @param[in] max_length The most elements the sequence can hold.
+     * @returns The length, or 0 if it failed.
+     */
+    size_t get_length(size_t elem_size, size_t max_length = std::numeric_limits<size_t>::max());
+
+    /**
+     * Read the length of a sequence of numbers or booleans, which is 0
+     * without reading anything if the sequence is dropped.
+     *
+     * @param[in] index The index of the field in the fields of the type.
+     * @param[in] elem_size The size of each element in CDR.
+     * @param[in] max_length The most elements the sequence can hold.
+     * @returns The length, or 0 if it failed.
+     */
+    size_t get_field_length(size_t index, size_t elem_size, size_t max_length = std::numeric_limits<size_t>::max());
+
+    /**
+     * Read a string.
+     */
+    void get_string(std::string & s);
+
+    /**
+     * Finish decoding.
+     *
+     * @returns true if everything decoded and the payload was used up, false
+     *          otherwise.
+     */
+    bool finish()
+    {
+        if (pos_ != length_)
+        {
+            failed_ = true;
+        }
+        return !failed_;
+    }
+
+    /**
+     * Find out whether decoding failed because of a reference to a slot that
+     * wasn't known, rather than bad data.
+     *
+     * @returns true if a slot wasn't known.
+     */
+    bool unknown_slot() const
+    {
+        return unknown_slot_;
+    }
+
+private:
+    template<typename F>
+    static void load(const uint8_t * p, F & field)
+    {
+        ::memcpy(&field, p, sizeof(F));
+    }
+
+    static void load(const uint8_t * p, bool & field)
+    {
+        field = *p != 0;
+    }
+
+    template<typename F>
+    static void load_array(const uint8_t * p, F * data, size_t count)
+    {
+        ::memcpy(data, p, sizeof(F) * count);
+    }
+
+    static void load_array(const uint8_t * p, bool * data, size_t count)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            data[i] = p[i] != 0;
+        }
+    }
+
+    void get_quantized(float & field, const FieldRule & rule)
+    {
+        field = static_cast<float>(get_quantized(rule));
+    }
+
+    void get_quantized(double & field, const FieldRule & rule)
+    {
+        field = get_quantized(rule);
+    }
+
+    // The profile only drops the fields of other types.
+    template<typename F>
+    void get_quantized(F & field, const FieldRule &)
+    {
+        field = F();
+    }
+
+    double get_quantized(const FieldRule & rule);
+
+    // Take the next length octets, or return nullptr (and fail) if there
+    // aren't that many.
+    const uint8_t * take(size_t length);
+
+    bool get_varint(uint64_t * value);
+
+    void fail()
+    {
+        failed_ = true;
+        pos_ = length_;
+    }
+
+    const uint8_t * data_;
+    size_t length_;
+    size_t pos_{0};
+    InternTable * table_;
+    const FieldRule * rules_;
+    bool failed_{false};
+    bool unknown_slot_{false};
+};
+
+/**
+ * The packing struct of a type that can't be packed, whose topics can't
+ * have intern_strings set or a quantize profile.
+ */
+template<typename T>
+struct NoPacking final
+{
+    static constexpr bool PACKABLE = false;
+    static constexpr bool HAS_STRINGS = false;
+
+    static const PackedField * fields(size_t * count)
+    {
+        *count = 0;
+        return nullptr;
+    }
+
+    static void encode(const T &, PackedWriter &)
+    {
+    }
+
+    static bool decode(PackedReader &, T &)
+    {
+        return false;
+    }
+};
+
+template<typename T>
+constexpr bool NoPacking<T>::PACKABLE;
+template<typename T>
+constexpr bool NoPacking<T>::HAS_STRINGS;
+
+}  // namespace pubsub
+}  // namespace ros2_to_serial_bridge
+
+#endif
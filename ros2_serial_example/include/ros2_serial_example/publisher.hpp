@@ -15,13 +15,22 @@
 #ifndef ROS2_SERIAL_EXAMPLE__PUBLISHER_HPP_
 #define ROS2_SERIAL_EXAMPLE__PUBLISHER_HPP_
 
+#include <chrono>
+#include <cstddef>
 #include <cstdint>
+#include <string>
+#include <vector>
 
 #include <sys/types.h>
 
 namespace ros2_to_serial_bridge
 {
 
+namespace transport
+{
+class TimeSync;
+}  // namespace transport
+
 namespace pubsub
 {
 
@@ -57,8 +66,207 @@ public:
      *
      * @param[in] data_buffer The buffer containing the CDR-serialized data to send
      * @param[in] length The length of the data_buffer
+     * @param[in] receive_time The time the data was received from the serial
+     *                         port (see Transporter::get_receive_time())
+     * @returns true if the data was published (or dropped on purpose), false
+     *          if it isn't a valid message of the topic's type.
+     */
+    virtual bool dispatch(uint8_t *data_buffer, ssize_t length, std::chrono::system_clock::time_point receive_time) = 0;
+
+    /**
+     * Virtual method to stamp the header of each message with its receive time.
+     *
+     * Derived classes that can set header.stamp in the messages they publish
+     * should override this method.
+     *
+     * @param[in] enable true to overwrite header.stamp with the time the data
+     *                   was received, false to publish it as received.
+     * @returns true on success, false if enable is true but the messages
+     *          can't be stamped.
+     */
+    virtual bool set_stamp_header(bool enable) {return !enable;}
+
+    /**
+     * Virtual method to translate the header.stamp that the device put in
+     * each message from its own clock into host time.
+     *
+     * Derived classes that can set header.stamp in the messages they publish
+     * should override this method.
+     *
+     * @param[in] time_sync The estimate of the device clock to translate with,
+     *                      which must outlive the publisher, or nullptr to
+     *                      publish header.stamp as received.
+     * @returns true on success, false if time_sync isn't nullptr but the
+     *          messages can't be stamped.
+     */
+    virtual bool set_device_clock(const transport::TimeSync * time_sync) {return time_sync == nullptr;}
+
+    /**
+     * Virtual method to drop the data, without deserializing it, while
+     * nothing subscribes to the topic.
+     *
+     * Derived classes that can tell whether the topic has subscribers should
+     * override this method, along with update_subscribed() and take_skipped().
+     *
+     * @param[in] enable true to drop the data while update_subscribed() last
+     *                   found no subscribers, false to always publish it.
+     * @returns true on success, false if enable is true but the publisher
+     *          can't tell whether the topic has subscribers.
+     */
+    virtual bool set_lazy(bool enable) {return !enable;}
+
+    /**
+     * Virtual method to take the data as messages packed with their strings
+     * interned (see string_interner.hpp), rather than as CDR, as the other
+     * end sends them for topics with intern_strings set.
+     *
+     * Derived classes that deserialize messages of a type with strings
+     * should override this method.
+     *
+     * @param[in] enable true to take interned messages, false to take CDR.
+     * @returns true on success, false if enable is true but the messages
+     *          can't be interned.
+     */
+    virtual bool set_string_interning(bool enable) {return !enable;}
+
+    /**
+     * Virtual method to take the data as messages packed with some of their
+     * fields quantized (see packed_encoding.hpp), rather than as CDR, as the
+     * other end sends them for topics with a quantize profile.
+     *
+     * Derived classes that can unpack the messages of their type should
+     * override this method.
+     *
+     * @param[in] specs The quantize profile of the topic, or an empty list to
+     *                  take every field in full.
+     * @param[out] error What was wrong, on failure.
+     * @returns true on success, false if the profile is bad or the messages
+     *          can't be packed.
      */
-    virtual void dispatch(uint8_t *data_buffer, ssize_t length) = 0;
+    virtual bool set_quantization(const std::vector<std::string> & specs, std::string * error)
+    {
+        if (specs.empty())
+        {
+            return true;
+        }
+        *error = "the messages can't be packed";
+        return false;
+    }
+
+    /**
+     * Virtual method to check whether anything subscribes to the topic, and
+     * remember the answer for dispatch().  This is too slow to do for every
+     * message, so it is meant to be called when the ROS 2 graph changes.
+     *
+     * @returns true if the topic has subscribers, false otherwise.
+     */
+    virtual bool update_subscribed() {return true;}
+
+    /**
+     * Virtual method to count the subscriptions to the topic.  Like
+     * update_subscribed(), this is too slow to do for every message.
+     *
+     * @returns The number of subscriptions, or 0 if the publisher can't tell.
+     */
+    virtual size_t get_subscription_count() {return 0;}
+
+    /**
+     * Virtual method to keep the data of the last message dispatch() was
+     * given, lazy or not, so that republish_last_value() can publish it
+     * again for subscribers that join later.
+     *
+     * Derived classes that can decode the data again on another thread
+     * should override this method, along with republish_last_value().
+     *
+     * @param[in] enable true to keep the last message, false not to.
+     * @returns true on success, false if enable is true but the publisher
+     *          can't publish the data again.
+     */
+    virtual bool set_last_value(bool enable) {return !enable;}
+
+    /**
+     * Virtual method to publish the last message again, as it was published
+     * the first time.  Every subscriber gets it, not only the ones that
+     * joined since.
+     *
+     * @returns true if it was published, false if there is none yet, it is
+     *          older than the maximum age (see set_max_age()), or it isn't a
+     *          valid message of the topic's type.
+     */
+    virtual bool republish_last_value() {return false;}
+
+    /**
+     * Virtual method to drop the data, without deserializing it, when it is
+     * the same as the data of the last message published, for topics that
+     * the other end sends the same state of over and over.  The same data is
+     * published again once keepalive has passed since then.
+     *
+     * Derived classes that can keep the data they publish should override
+     * this method.
+     *
+     * @param[in] enable true to drop unchanged data, false to always publish
+     *                   it.
+     * @param[in] keepalive How long after the last message published to
+     *                      publish the same data again, or 0 never to.
+     * @returns true on success, false if enable is true but the publisher
+     *          can't compare the data.
+     */
+    virtual bool set_on_change(bool enable, std::chrono::milliseconds keepalive) {(void)keepalive; return !enable;}
+
+    /**
+     * Virtual method to check whether dispatch() dropped any data since the
+     * last call, because the topic had no subscribers.
+     *
+     * @returns true if data was dropped, false otherwise.
+     */
+    virtual bool take_skipped() {return false;}
+
+    /**
+     * Virtual method to allocate everything dispatch() needs up front, for
+     * messages of up to max_size bytes of CDR data.
+     *
+     * Derived classes that reuse their buffers between messages should
+     * override this method.
+     *
+     * @param[in] max_size The largest CDR data that will be dispatched.
+     * @returns true if dispatch() won't allocate after this, false otherwise.
+     */
+    virtual bool reserve(size_t max_size) {(void)max_size; return false;}
+
+    /**
+     * Set how long after it was received data may still be published.  Older
+     * data is dropped before it gets to dispatch(), so it isn't deserialized.
+     *
+     * @param[in] max_age The maximum age, or 0 for no limit (the default).
+     */
+    void set_max_age(std::chrono::milliseconds max_age) {max_age_ = max_age;}
+
+    /**
+     * Get how long after it was received data may still be published.
+     *
+     * @returns The maximum age, or 0 if there is no limit.
+     */
+    std::chrono::milliseconds get_max_age() const {return max_age_;}
+
+    /**
+     * Set the priority the data is dispatched with.  Data with a higher
+     * priority is dispatched ahead of data with a lower one that was read at
+     * the same time.
+     *
+     * @param[in] priority The priority, or 0 for none (the default).
+     */
+    void set_rx_priority(uint8_t priority) {rx_priority_ = priority;}
+
+    /**
+     * Get the priority the data is dispatched with.
+     *
+     * @returns The priority, or 0 if there is none.
+     */
+    uint8_t get_rx_priority() const {return rx_priority_;}
+
+private:
+    std::chrono::milliseconds max_age_{0};
+    uint8_t rx_priority_{0};
 };
 
 }  // namespace pubsub
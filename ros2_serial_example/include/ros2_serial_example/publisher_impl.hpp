@@ -15,17 +15,34 @@
 #ifndef ROS2_SERIAL_EXAMPLE__PUBLISHER_IMPL_HPP_
 #define ROS2_SERIAL_EXAMPLE__PUBLISHER_IMPL_HPP_
 
+#include <atomic>
+#include <chrono>
 #include <cstdint>
-#include <functional>
+#include <cstring>
 #include <memory>
+#include <mutex>
+#include <stdexcept>
 #include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 #include <rclcpp/rclcpp.hpp>
 
 #include <fastcdr/Cdr.h>
 #include <fastcdr/FastCdr.h>
+#include <fastcdr/exceptions/Exception.h>
 
+#include "ros2_serial_example/async_log.hpp"
+#include "ros2_serial_example/batch_publisher.hpp"
+#include "ros2_serial_example/cdr_encapsulation.hpp"
+#include "ros2_serial_example/cdr_fixed_layout.hpp"
+#include "ros2_serial_example/packed_encoding.hpp"
 #include "ros2_serial_example/publisher.hpp"
+#include "ros2_serial_example/qos.hpp"
+#include "ros2_serial_example/string_interner.hpp"
+#include "ros2_serial_example/time_sync.hpp"
+#include "ros2_serial_example/tracing.hpp"
 
 namespace ros2_to_serial_bridge
 {
@@ -33,14 +50,84 @@ namespace ros2_to_serial_bridge
 namespace pubsub
 {
 
+/**
+ * Whether the message type M has a header.stamp field that can be set to a
+ * receive time.
+ */
+template<typename M, typename = void>
+struct has_header_stamp : std::false_type {};
+
+template<typename M>
+struct has_header_stamp<M, decltype(void(std::declval<M &>().header.stamp))> : std::true_type {};
+
 /**
  * The PublisherImpl class is an implementation of the abstract Publisher class.
  * As such, it implements the pure virtual function dispatch() to take
  * CDR-serialized data and transmit it on the ROS 2 network.  One of these
  * objects will be created for each SerialToROS2 topic mapping the user sets up
  * in the bridge configuration file.
+ *
+ * So that publishing doesn't allocate a new message each time, dispatch()
+ * deserializes into a message borrowed from the middleware if it supports
+ * loaned messages, and otherwise into a message owned by this object that is
+ * reused for every dispatch.
+ *
+ * In passthrough mode, the CDR data from the serial port isn't deserialized
+ * at all; it is wrapped in an rclcpp::SerializedMessage and handed to the
+ * middleware as-is, which also saves the middleware from serializing it again.
+ *
+ * If the node was created with intra-process comms enabled (as it is when it
+ * is loaded into a component container with use_intra_process_comms), and
+ * there are subscriptions in the same process, each message is deserialized
+ * into a newly allocated message that is handed over to them without any
+ * further copies.
+ *
+ * The deserialization function for the type is a template parameter rather
+ * than a stored function object, so each message type gets its own
+ * specialization that calls it directly.  Types whose CDR has a fixed
+ * layout also pass the Layout that generate_ros2_topics.py made for them
+ * (see cdr_fixed_layout.hpp), which copies the fields straight out of the
+ * data at known offsets; the others go through Fast-CDR.  Types that can
+ * be packed also pass their packing struct, for topics whose messages come
+ * packed with their strings interned (see set_string_interning()) or their
+ * fields quantized (see set_quantization()); those are decoded by it
+ * instead, and a string that is the same as in the last message is copied
+ * from the table of the topic into the string the reused message already
+ * has, which doesn't allocate.
+ *
+ * Data that is too short to be a message of the type (the length of the
+ * shortest one is in the Layout) is turned away before it is decoded, so a
+ * device sending the wrong type doesn't cost an exception per message.  Data
+ * that fails to decode anyway still makes Fast-CDR throw.  Either way,
+ * dispatch() returns false, and the warning is printed at most once a
+ * second with the number of failures so far.
+ *
+ * Message types with a std_msgs/Header can have header.stamp overwritten
+ * with the time the data was received (see set_stamp_header()), for
+ * devices that don't have a clock of their own, or translated from the clock
+ * of the device into host time (see set_device_clock()), for devices that
+ * do.
+ *
+ * In lazy mode (see set_lazy()), data is dropped without being deserialized
+ * while the topic has no subscribers.  Asking the middleware for the number
+ * of subscriptions is too slow to do for every message, so dispatch() only
+ * looks at the answer that update_subscribed() last got.
+ *
+ * A topic can also be published in batches (see BatchSinkImpl), in which
+ * case each message is deserialized into msg_ as usual and then added to
+ * the batch, rather than published by itself.
+ *
+ * With set_last_value(), the data of the last message is kept as it came,
+ * which only costs a copy of it, and republish_last_value() decodes and
+ * publishes it again for subscribers that join later, so that a slow topic
+ * doesn't have to be transient_local for them to get it at once.
+ *
+ * With set_on_change(), data that is the same as that of the last message
+ * published is dropped before it is deserialized, at the cost of comparing
+ * it with a copy of that data, until a keepalive is due.
  */
-template<typename T>
+template<typename T, bool (*Deserialize)(eprosima::fastcdr::Cdr &, T &), typename Layout = cdr::NoFixedLayout<T>,
+         typename Packing = NoPacking<T>>
 class PublisherImpl final : public Publisher
 {
 public:
@@ -49,15 +136,38 @@ public:
      *
      * @param[in] node The rclcpp::Node to use to create a publisher.
      * @param[in] name The name of the topic to publish to.
-     * @param[in] des A function pointer to the deserialization function for
-     *                this CDR type.
+     * @param[in] passthrough Whether to publish the CDR data as a serialized
+     *                        message rather than deserializing it.
+     * @param[in] qos The QoS settings to publish with.
+     * @param[in] batch Where to add the messages to instead of publishing
+     *                  them one at a time, or nullptr to publish them.  The
+     *                  batch publishes to the topic itself.
+     * @throws std::runtime_error If batch is given for a passthrough topic.
      */
     explicit PublisherImpl(rclcpp::Node * node, const std::string & name,
-                           std::function<bool(eprosima::fastcdr::Cdr &, T &)> des)
-        : deserialize_(des), name_(name), node_(node)
+                           bool passthrough = false,
+                           const rclcpp::QoS & qos = rclcpp::QoS(rclcpp::KeepLast(10)),
+                           std::unique_ptr<BatchSink<T>> batch = nullptr)
+        : name_(name), node_(node), passthrough_(passthrough), batch_(std::move(batch))
     {
-        rclcpp::QoS qos(rclcpp::KeepLast(10));
-        pub_ = node_->create_publisher<T>(name, qos);
+        if (batch_ != nullptr)
+        {
+            if (passthrough)
+            {
+                throw std::runtime_error("Topic '" + name + "' can't be both passthrough and batched");
+            }
+            ROS2_SERIAL_TRACEPOINT(publisher_init, this, name_.c_str());
+            return;
+        }
+
+        rclcpp::PublisherOptions options;
+        intra_process_ = use_intra_process(node, name, qos, passthrough);
+        if (!intra_process_)
+        {
+            options.use_intra_process_comm = rclcpp::IntraProcessSetting::Disable;
+        }
+        pub_ = node_->create_publisher<T>(name, qos, options);
+        ROS2_SERIAL_TRACEPOINT(publisher_init, this, name_.c_str());
     }
 
     /**
@@ -65,37 +175,581 @@ public:
      *
      * @param[in] data_buffer The buffer containing the CDR-serialized data to send
      * @param[in] length The length of the data_buffer
+     * @param[in] receive_time The time the data was received from the serial port
+     * @returns true if the data was published or skipped, false if it
+     *          couldn't be deserialized.
      */
-    void dispatch(uint8_t *data_buffer, ssize_t length) override
+    bool dispatch(uint8_t *data_buffer, ssize_t length, std::chrono::system_clock::time_point receive_time) override
     {
-        eprosima::fastcdr::FastBuffer cdrbuffer(reinterpret_cast<char *>(data_buffer), length);
-        eprosima::fastcdr::Cdr cdrdes(cdrbuffer);
-        auto msg = std::make_unique<T>();
+        // A topic with last_value set keeps and publishes each message under
+        // publish_order_mutex_, which republish_last_value() holds to check
+        // that its message is still the last one and publish it, so that an
+        // older message is never published after a newer one.
+        std::unique_lock<std::mutex> order;
+        if (last_value_enabled_)
+        {
+            order = std::unique_lock<std::mutex>(publish_order_mutex_);
+            // Even while nothing subscribes, so that the first subscriber
+            // gets it.
+            std::lock_guard<std::mutex> lock(last_value_mutex_);
+            last_value_.assign(data_buffer, data_buffer + length);
+            last_value_time_ = receive_time;
+            last_value_generation_++;
+            has_last_value_ = true;
+        }
+
+        if (lazy_ && !subscribed_.load(std::memory_order_relaxed))
+        {
+            skipped_.store(true, std::memory_order_relaxed);
+            // The first subscriber gets the next message, changed or not.
+            has_on_change_data_ = false;
+            return true;
+        }
+
+        if (on_change_ && unchanged(data_buffer, static_cast<size_t>(length), receive_time))
+        {
+            return true;
+        }
+
+        if (batch_ != nullptr)
+        {
+            // The batch copies the message, so msg_ is reused as it is for
+            // publishing.
+            if (!deserialize_into(data_buffer, length, msg_, receive_time))
+            {
+                return false;
+            }
+            batch_->add(msg_, receive_time);
+            ROS2_SERIAL_TRACEPOINT(published, this, tracing::stamp_ns(receive_time));
+            return true;
+        }
+
+        if (passthrough_)
+        {
+            dispatch_serialized(data_buffer, length);
+            ROS2_SERIAL_TRACEPOINT(published, this, tracing::stamp_ns(receive_time));
+            return true;
+        }
+
+        if (intra_process_ && pub_->get_intra_process_subscription_count() > 0)
+        {
+            // The subscriptions in this process take ownership of the message
+            // rather than getting a copy of it, so it can't be the reused one.
+            auto msg = std::make_unique<T>();
+            if (!deserialize_into(data_buffer, length, *msg, receive_time))
+            {
+                return false;
+            }
+            pub_->publish(std::move(msg));
+            ROS2_SERIAL_TRACEPOINT(published, this, tracing::stamp_ns(receive_time));
+            return true;
+        }
+
+        if (pub_->can_loan_messages())
+        {
+            // If deserialization fails, the loan is handed back to the
+            // middleware when msg goes out of scope.
+            auto msg = pub_->borrow_loaned_message();
+            if (!deserialize_into(data_buffer, length, msg.get(), receive_time))
+            {
+                return false;
+            }
+            pub_->publish(std::move(msg));
+            ROS2_SERIAL_TRACEPOINT(published, this, tracing::stamp_ns(receive_time));
+            return true;
+        }
+
+        // dispatch() is only ever called from the bridge read thread, and
+        // publishing by reference doesn't hold onto the message, so a single
+        // message is all the pool needs.  Deserializing over the previous
+        // contents keeps the capacity of any strings and sequences, so once
+        // they have grown to the largest message seen this doesn't allocate.
+        if (!deserialize_into(data_buffer, length, msg_, receive_time))
+        {
+            return false;
+        }
+        pub_->publish(msg_);
+        ROS2_SERIAL_TRACEPOINT(published, this, tracing::stamp_ns(receive_time));
+        return true;
+    }
+
+    /**
+     * Overwrite header.stamp of each message with its receive time.
+     *
+     * @param[in] enable true to stamp the messages, false to publish them as
+     *                   received.
+     * @returns true on success, false if enable is true but the type has no
+     *          header.stamp or the topic is passthrough.
+     */
+    bool set_stamp_header(bool enable) override
+    {
+        if (enable && (passthrough_ || !has_header_stamp<T>::value))
+        {
+            return false;
+        }
+        stamp_header_ = enable;
+        return true;
+    }
+
+    /**
+     * Translate header.stamp of each message from the clock of the device
+     * into host time.  Until the clocks are synchronized, the messages are
+     * stamped with their receive time instead.  This takes precedence over
+     * set_stamp_header().
+     *
+     * @param[in] time_sync The estimate of the device clock, or nullptr to
+     *                      publish header.stamp as received.
+     * @returns true on success, false if time_sync isn't nullptr but the
+     *          type has no header.stamp or the topic is passthrough.
+     */
+    bool set_device_clock(const transport::TimeSync * time_sync) override
+    {
+        if (time_sync != nullptr && (passthrough_ || !has_header_stamp<T>::value))
+        {
+            return false;
+        }
+        time_sync_ = time_sync;
+        return true;
+    }
+
+    /**
+     * Drop the data, without deserializing it, while the topic has no
+     * subscribers.  This must be called before the publisher is handed to the
+     * thread that calls dispatch().
+     *
+     * @param[in] enable true to drop the data while update_subscribed() last
+     *                   found no subscribers, false to always publish it.
+     * @returns true.
+     */
+    bool set_lazy(bool enable) override
+    {
+        lazy_ = enable;
+        return true;
+    }
+
+    /**
+     * Take the data as messages packed with their strings interned, rather
+     * than as CDR.  This must be called before the publisher is handed to
+     * the thread that calls dispatch().
+     *
+     * @param[in] enable true to take interned messages, false to take CDR.
+     * @returns true on success, false if enable is true but the type has no
+     *          strings or the topic is passthrough.
+     */
+    bool set_string_interning(bool enable) override
+    {
+        if (!enable)
+        {
+            intern_table_.reset();
+            return true;
+        }
+        if (passthrough_ || !Packing::HAS_STRINGS)
+        {
+            return false;
+        }
+        intern_table_ = std::make_unique<InternTable>();
+        return true;
+    }
+
+    /**
+     * Take the data as messages packed with some of their fields quantized,
+     * rather than as CDR.  This must be called before the publisher is
+     * handed to the thread that calls dispatch().
+     *
+     * @param[in] specs The quantize profile of the topic, or an empty list to
+     *                  take every field in full.
+     * @param[out] error What was wrong, on failure.
+     * @returns true on success, false if the profile is bad, or it isn't
+     *          empty but the type can't be packed or the topic is
+     *          passthrough.
+     */
+    bool set_quantization(const std::vector<std::string> & specs, std::string * error) override
+    {
+        if (!specs.empty() && (passthrough_ || !Packing::PACKABLE))
+        {
+            *error = passthrough_ ? "the topic is passthrough" : "the messages can't be packed";
+            return false;
+        }
+        size_t count;
+        const PackedField * fields = Packing::fields(&count);
+        return quantization_.parse(specs, fields, count, error);
+    }
+
+    /**
+     * Check whether anything subscribes to the topic, and remember the answer
+     * for dispatch().  Subscriptions in the same process count too, since
+     * they also have a subscription in the middleware.
+     *
+     * @returns true if the topic has subscribers, false otherwise.
+     */
+    bool update_subscribed() override
+    {
+        bool subscribed = (batch_ != nullptr ? batch_->get_subscription_count() : pub_->get_subscription_count()) > 0;
+        subscribed_.store(subscribed, std::memory_order_relaxed);
+        return subscribed;
+    }
+
+    /**
+     * Count the subscriptions to the topic, or to its batches.
+     *
+     * @returns The number of subscriptions.
+     */
+    size_t get_subscription_count() override
+    {
+        return batch_ != nullptr ? batch_->get_subscription_count() : pub_->get_subscription_count();
+    }
+
+    /**
+     * Keep the data of the last message to publish it again.  This must be
+     * called before the publisher is handed to the thread that calls
+     * dispatch(), and after set_string_interning().
+     *
+     * @param[in] enable true to keep the last message, false not to.
+     * @returns true on success, false if enable is true but the topic is
+     *          batched or its strings are interned, since an interned
+     *          message can't be decoded without the ones before it.
+     */
+    bool set_last_value(bool enable) override
+    {
+        if (enable && (batch_ != nullptr || intern_table_ != nullptr))
+        {
+            return false;
+        }
+        last_value_enabled_ = enable;
+        return true;
+    }
+
+    /**
+     * Decode the last message again and publish it, stamped the way it was
+     * the first time.  This is meant to be called from the executor, while
+     * dispatch() goes on in another thread.
+     *
+     * @returns true if it was published or a newer message came in while it
+     *          was decoded, false if there is none yet, it is older than the
+     *          maximum age, or it couldn't be deserialized.
+     */
+    bool republish_last_value() override
+    {
+        // The data is copied out, so that dispatch() doesn't wait for the
+        // message to be decoded, only for it to be published.
+        std::chrono::system_clock::time_point time;
+        uint64_t generation;
+        {
+            std::lock_guard<std::mutex> lock(last_value_mutex_);
+            if (!has_last_value_)
+            {
+                return false;
+            }
+            republish_data_.assign(last_value_.begin(), last_value_.end());
+            time = last_value_time_;
+            generation = last_value_generation_;
+        }
+        if (get_max_age().count() > 0 && std::chrono::system_clock::now() - time > get_max_age())
+        {
+            return false;
+        }
+
+        if (passthrough_)
+        {
+            rclcpp::SerializedMessage serialized_msg(cdr::ENCAPSULATION_SIZE + republish_data_.size());
+            rcl_serialized_message_t & rcl_msg = serialized_msg.get_rcl_serialized_message();
+            cdr::write_encapsulation(rcl_msg.buffer);
+            if (!republish_data_.empty())
+            {
+                ::memcpy(rcl_msg.buffer + cdr::ENCAPSULATION_SIZE, republish_data_.data(), republish_data_.size());
+            }
+            rcl_msg.buffer_length = cdr::ENCAPSULATION_SIZE + republish_data_.size();
+            // If dispatch() kept a newer message meanwhile, it published that
+            // one itself.
+            std::lock_guard<std::mutex> order(publish_order_mutex_);
+            if (last_value_generation_ != generation)
+            {
+                return true;
+            }
+            pub_->publish(serialized_msg);
+            return true;
+        }
+
+        // Not msg_, which dispatch() may be using; failures aren't counted
+        // either, since dispatch() already warned about this one.
+        T msg;
+        if (decode(republish_data_.data(), republish_data_.size(), msg, nullptr) != nullptr)
+        {
+            return false;
+        }
+        apply_stamp(msg, time);
+        std::lock_guard<std::mutex> order(publish_order_mutex_);
+        if (last_value_generation_ != generation)
+        {
+            return true;
+        }
+        pub_->publish(msg);
+        return true;
+    }
+
+    /**
+     * Drop the data when it is the same as that of the last message
+     * published, until keepalive has passed.  The data is compared as it
+     * came, before it is deserialized, so a message with a field that always
+     * changes, such as a timestamp, is never dropped.  This must be called
+     * before the publisher is handed to the thread that calls dispatch().
+     *
+     * @param[in] enable true to drop unchanged data, false to always publish
+     *                   it.
+     * @param[in] keepalive How long after the last message published to
+     *                      publish the same data again, or 0 never to.
+     * @returns true.
+     */
+    bool set_on_change(bool enable, std::chrono::milliseconds keepalive) override
+    {
+        on_change_ = enable;
+        on_change_keepalive_ = keepalive;
+        has_on_change_data_ = false;
+        return true;
+    }
+
+    /**
+     * Check whether dispatch() dropped any data since the last call.
+     *
+     * @returns true if data was dropped, false otherwise.
+     */
+    bool take_skipped() override
+    {
+        return skipped_.exchange(false, std::memory_order_relaxed);
+    }
+
+    /**
+     * Allocate the buffer for passthrough data up front.  Deserialized
+     * messages reuse msg_, so fixed size messages never allocate, but the
+     * strings and sequences in a message only grow to what they have held.
+     *
+     * @param[in] max_size The largest CDR data that will be dispatched.
+     * @returns true if dispatch() won't allocate for fixed size messages,
+     *          false if the messages go to subscriptions in the same
+     *          process, since each of them is a new message.  A batch
+     *          reserves room for its samples when it is created.
+     */
+    bool reserve(size_t max_size) override
+    {
+        if (on_change_)
+        {
+            on_change_data_.reserve(max_size);
+        }
+        if (batch_ != nullptr)
+        {
+            return true;
+        }
+        if (intra_process_)
+        {
+            return false;
+        }
+        if (passthrough_)
+        {
+            serialized_msg_.reserve(cdr::ENCAPSULATION_SIZE + max_size);
+        }
+        if (last_value_enabled_)
+        {
+            last_value_.reserve(max_size);
+            republish_data_.reserve(max_size);
+        }
+        return true;
+    }
+
+private:
+    // Check whether the data is the same as that of the last message
+    // published, and the keepalive isn't due yet; if not, it is kept as the
+    // data of the last message published.  A matching length is checked
+    // before the data, so a change in length costs nothing to find.
+    bool unchanged(const uint8_t *data_buffer, size_t length, std::chrono::system_clock::time_point receive_time)
+    {
+        if (has_on_change_data_ && on_change_data_.size() == length &&
+            (length == 0 || ::memcmp(on_change_data_.data(), data_buffer, length) == 0))
+        {
+            if (on_change_keepalive_.count() == 0 || receive_time - on_change_time_ < on_change_keepalive_)
+            {
+                return true;
+            }
+        }
+        else
+        {
+            on_change_data_.assign(data_buffer, data_buffer + length);
+            has_on_change_data_ = true;
+        }
+        on_change_time_ = receive_time;
+        return false;
+    }
+
+    void dispatch_serialized(uint8_t *data_buffer, ssize_t length)
+    {
+        size_t needed = cdr::ENCAPSULATION_SIZE + static_cast<size_t>(length);
+        if (serialized_msg_.capacity() < needed)
+        {
+            serialized_msg_.reserve(needed);
+        }
+
+        rcl_serialized_message_t & rcl_msg = serialized_msg_.get_rcl_serialized_message();
+        cdr::write_encapsulation(rcl_msg.buffer);
+        ::memcpy(rcl_msg.buffer + cdr::ENCAPSULATION_SIZE, data_buffer, length);
+        rcl_msg.buffer_length = needed;
+
+        pub_->publish(serialized_msg_);
+    }
+
+    template<typename M>
+    static void stamp(M & msg, std::chrono::system_clock::time_point receive_time, std::true_type)
+    {
+        msg.header.stamp = rclcpp::Time(tracing::stamp_ns(receive_time), RCL_SYSTEM_TIME);
+    }
+
+    template<typename M>
+    static void stamp(M &, std::chrono::system_clock::time_point, std::false_type)
+    {
+    }
+
+    template<typename M>
+    void translate_stamp(M & msg, std::chrono::system_clock::time_point receive_time, std::true_type) const
+    {
+        int64_t host_ns;
+        if (!time_sync_->to_host(rclcpp::Time(msg.header.stamp).nanoseconds(), &host_ns))
+        {
+            host_ns = tracing::stamp_ns(receive_time);
+        }
+        msg.header.stamp = rclcpp::Time(host_ns, RCL_SYSTEM_TIME);
+    }
+
+    template<typename M>
+    void translate_stamp(M &, std::chrono::system_clock::time_point, std::false_type) const
+    {
+    }
+
+    bool deserialize_into(uint8_t *data_buffer, ssize_t length, T & msg,
+                          std::chrono::system_clock::time_point receive_time)
+    {
+        const char * error = decode(data_buffer, static_cast<size_t>(length), msg, intern_table_.get());
+        if (error != nullptr)
+        {
+            return deserialize_failed(error);
+        }
+
+        ROS2_SERIAL_TRACEPOINT(deserialized, this, tracing::stamp_ns(receive_time));
+        apply_stamp(msg, receive_time);
+        return true;
+    }
+
+    // Decode the data into msg, returning what was wrong with it on failure
+    // or nullptr on success.
+    const char * decode(uint8_t *data_buffer, size_t length, T & msg, InternTable * intern_table)
+    {
+        if (intern_table != nullptr || quantization_.rules() != nullptr)
+        {
+            PackedReader reader(data_buffer, length, intern_table, quantization_.rules());
+            if (!Packing::decode(reader, msg))
+            {
+                // A message after one that was lost may refer to strings it
+                // defined; those fail until the sender defines them again.
+                return reader.unknown_slot() ? "Unknown interned string" : "Bad packed data";
+            }
+            return nullptr;
+        }
+
         // Deserialization can fail if, for instance, the user told us the
         // wrong type to deserialize (they configured it as a std_msgs/String
-        // when it is actually a std_msgs/UInt16, for instance).  In that case
-        // Fast-CDR will throw an
-        // eprosima::fastcdr::exception::NotEnoughMemoryException, so handle it
-        // here and print a message.
+        // when it is actually a std_msgs/UInt16, for instance).  Most of the
+        // time the data is then too short for the type, which is caught here
+        // without decoding any of it.
+        if (length < Layout::MIN_SIZE)
+        {
+            return "Too little data";
+        }
+
+        if (Layout::FIXED)
+        {
+            return Layout::decode(data_buffer, length, msg) ? nullptr : "Too little data";
+        }
+
+        eprosima::fastcdr::FastBuffer cdrbuffer(reinterpret_cast<char *>(data_buffer), length);
+        eprosima::fastcdr::Cdr cdrdes(cdrbuffer);
+
+        // Otherwise Fast-CDR throws, for instance an
+        // eprosima::fastcdr::exception::NotEnoughMemoryException if a string
+        // or sequence runs past the end of the data.
         try
         {
-            deserialize_(cdrdes, *(msg.get()));
+            Deserialize(cdrdes, msg);
         }
-        catch(const eprosima::fastcdr::exception::NotEnoughMemoryException & err)
+        catch(const eprosima::fastcdr::exception::Exception & err)
         {
-            RCLCPP_WARN(node_->get_logger(),  // NOLINT(cppcoreguidelines-pro-bounds-array-to-pointer-decay,hicpp-no-array-decay)
-                        "Not enough memory for deserialization on topic '%s'; is the type correct?",
-                        name_.c_str());
-            return;
+            return "Bad data";
+        }
+        return nullptr;
+    }
+
+    bool deserialize_failed(const char * what)
+    {
+        failures_++;
+        ROS2_SERIAL_LOG(WARN, "%s for deserialization on topic '%s'; is the type correct? (%lu failures)",
+                        what, name_.c_str(), static_cast<unsigned long>(failures_));
+        return false;
+    }
+
+    void apply_stamp(T & msg, std::chrono::system_clock::time_point receive_time) const
+    {
+        if (time_sync_ != nullptr)
+        {
+            translate_stamp(msg, receive_time, has_header_stamp<T>());
+        }
+        else if (stamp_header_)
+        {
+            stamp(msg, receive_time, has_header_stamp<T>());
         }
-        pub_->publish(std::move(msg));
     }
 
-private:
-    std::function<bool(eprosima::fastcdr::Cdr &, T &)> deserialize_;
     std::string name_;
     rclcpp::Node * node_;
     std::shared_ptr<rclcpp::Publisher<T>> pub_;
+    T msg_;
+    bool passthrough_;
+    // Only set for topics published in batches, which have no pub_.
+    std::unique_ptr<BatchSink<T>> batch_;
+    bool intra_process_{false};
+    bool stamp_header_{false};
+    const transport::TimeSync * time_sync_{nullptr};
+    bool lazy_{false};
+    // Until the first update_subscribed(), assume there are subscribers so
+    // that nothing is dropped.
+    std::atomic<bool> subscribed_{true};
+    std::atomic<bool> skipped_{false};
+    rclcpp::SerializedMessage serialized_msg_;
+    // Only set for topics with interned strings.
+    std::unique_ptr<InternTable> intern_table_;
+    // Empty unless the topic has a quantize profile.
+    QuantizationProfile quantization_;
+    // Only dispatch() touches these, so they needn't be atomic.
+    uint64_t failures_{0};
+    // The data of the last message, for topics with last_value set, which
+    // republish_last_value() takes from another thread.
+    bool last_value_enabled_{false};
+    std::mutex last_value_mutex_;
+    std::vector<uint8_t> last_value_;
+    std::chrono::system_clock::time_point last_value_time_;
+    // Counts the messages kept, so that republish_last_value() can tell
+    // whether a newer one came in while it decoded the one it copied; it is
+    // changed under both mutexes, so either is enough to read it.
+    uint64_t last_value_generation_{0};
+    // Held by dispatch() from keeping a message to publishing it, and by
+    // republish_last_value() to check and publish.
+    std::mutex publish_order_mutex_;
+    bool has_last_value_{false};
+    // The copy of the last message that republish_last_value() decodes,
+    // which only the executor touches.
+    std::vector<uint8_t> republish_data_;
+    // The data of the last message published, for topics with on_change
+    // set; only dispatch() touches these.
+    bool on_change_{false};
+    std::chrono::milliseconds on_change_keepalive_{0};
+    std::vector<uint8_t> on_change_data_;
+    std::chrono::system_clock::time_point on_change_time_;
+    bool has_on_change_data_{false};
 };
 
 }  // namespace pubsub
@@ -0,0 +1,236 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef ROS2_SERIAL_EXAMPLE__PUBLISHER_TABLE_HPP_
+#define ROS2_SERIAL_EXAMPLE__PUBLISHER_TABLE_HPP_
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "ros2_serial_example/publisher.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace pubsub
+{
+
+/**
+ * The PublisherTable class maps topic IDs to the Publisher for that topic.
+ *
+ * Looking up a publisher happens for every message that comes in from the
+ * serial port, so this is built up front and then only read; topics added or
+ * removed later go into a new copy of the table (see RcuPointer).  The table
+ * does not own the publishers; they must outlive it.
+ *
+ * For IDs of a single byte, this is a flat array with one entry per possible
+ * ID, so a lookup is a single indexed load.  Wider IDs (like the default
+ * topic_id_size_t) would make that array too big, so they use the
+ * specialization below instead.
+ */
+template<typename ID, bool Flat = (sizeof(ID) == 1)>
+class PublisherTable final
+{
+public:
+    /**
+     * Add a publisher for a topic ID, replacing any previous one.
+     *
+     * @param[in] topic_ID The topic ID to add the publisher for.
+     * @param[in] pub The publisher to use for topic_ID.
+     */
+    void insert(ID topic_ID, Publisher * pub)
+    {
+        table_[static_cast<size_t>(topic_ID)] = pub;
+    }
+
+    /**
+     * Remove the publisher for a topic ID, if there is one.
+     *
+     * @param[in] topic_ID The topic ID to remove the publisher for.
+     */
+    void erase(ID topic_ID)
+    {
+        table_[static_cast<size_t>(topic_ID)] = nullptr;
+    }
+
+    /**
+     * Find the publisher for a topic ID.
+     *
+     * @param[in] topic_ID The topic ID to look up.
+     * @returns The publisher for topic_ID, or nullptr if there isn't one.
+     */
+    Publisher * find(ID topic_ID) const
+    {
+        return table_[static_cast<size_t>(topic_ID)];
+    }
+
+private:
+    std::array<Publisher *, static_cast<size_t>(std::numeric_limits<ID>::max()) + 1> table_{};
+};
+
+/**
+ * PublisherTable for IDs that are wider than a byte.
+ *
+ * Topic IDs are mostly handed out from the bottom up, so the low IDs are
+ * kept in a direct table indexed by ID, which makes a lookup of one of them
+ * a single indexed load, as with the flat table.  The direct table covers
+ * the IDs below MIN_DIRECT_IDS, and grows to cover higher ones for as long
+ * as it stays at least half full, so it takes at most two pointers per
+ * topic.  IDs above that, which are sparse by then, go in an overflow area
+ * of IDs sorted apart from their publishers, which a lookup binary searches
+ * without touching the publishers until it has found the ID; that takes an
+ * ID and a pointer per topic.
+ *
+ * The direct table only ever grows; erasing a topic leaves its entry
+ * empty.
+ */
+template<typename ID>
+class PublisherTable<ID, false> final
+{
+public:
+    /**
+     * The IDs that always go in the direct table, however few of them are
+     * used.
+     */
+    static constexpr size_t MIN_DIRECT_IDS = 64;
+
+    void insert(ID topic_ID, Publisher * pub)
+    {
+        size_t id = static_cast<size_t>(topic_ID);
+        if (id < direct_.size())
+        {
+            direct_[id] = pub;
+            return;
+        }
+
+        auto it = lower_bound(topic_ID);
+        size_t pos = static_cast<size_t>(it - overflow_IDs_.begin());
+        if (it != overflow_IDs_.end() && *it == topic_ID)
+        {
+            overflow_pubs_[pos] = pub;
+            return;
+        }
+        overflow_IDs_.insert(it, topic_ID);
+        overflow_pubs_.insert(overflow_pubs_.begin() + pos, pub);
+        grow_direct();
+    }
+
+    void erase(ID topic_ID)
+    {
+        size_t id = static_cast<size_t>(topic_ID);
+        if (id < direct_.size())
+        {
+            direct_[id] = nullptr;
+            return;
+        }
+
+        auto it = lower_bound(topic_ID);
+        if (it != overflow_IDs_.end() && *it == topic_ID)
+        {
+            overflow_pubs_.erase(overflow_pubs_.begin() + (it - overflow_IDs_.begin()));
+            overflow_IDs_.erase(it);
+        }
+    }
+
+    Publisher * find(ID topic_ID) const
+    {
+        size_t id = static_cast<size_t>(topic_ID);
+        if (id < direct_.size())
+        {
+            return direct_[id];
+        }
+
+        auto it = lower_bound(topic_ID);
+        if (it != overflow_IDs_.end() && *it == topic_ID)
+        {
+            return overflow_pubs_[static_cast<size_t>(it - overflow_IDs_.begin())];
+        }
+        return nullptr;
+    }
+
+    /**
+     * Get the number of IDs that the direct table covers.
+     *
+     * @returns The number of entries in the direct table.
+     */
+    size_t get_direct_size() const
+    {
+        return direct_.size();
+    }
+
+    /**
+     * Get the number of topics in the overflow area.
+     *
+     * @returns The number of topics whose IDs are past the direct table.
+     */
+    size_t get_overflow_size() const
+    {
+        return overflow_IDs_.size();
+    }
+
+private:
+    typename std::vector<ID>::const_iterator lower_bound(ID topic_ID) const
+    {
+        return std::lower_bound(overflow_IDs_.begin(), overflow_IDs_.end(), topic_ID);
+    }
+
+    // Move the lowest IDs of the overflow area into the direct table, as far
+    // up as the direct table stays at least half full (or within
+    // MIN_DIRECT_IDS).  Since only the lowest ones move, the overflow area
+    // keeps holding exactly the IDs past the end of the direct table.
+    void grow_direct()
+    {
+        size_t used = static_cast<size_t>(std::count_if(direct_.begin(), direct_.end(),
+                                                        [](Publisher * pub) {return pub != nullptr;}));
+        size_t moving = 0;
+        for (size_t i = 0; i < overflow_IDs_.size(); ++i)
+        {
+            size_t size = static_cast<size_t>(overflow_IDs_[i]) + 1;
+            if (size <= std::max(MIN_DIRECT_IDS, 2 * (used + i + 1)))
+            {
+                moving = i + 1;
+            }
+        }
+        if (moving == 0)
+        {
+            return;
+        }
+
+        direct_.resize(static_cast<size_t>(overflow_IDs_[moving - 1]) + 1, nullptr);
+        for (size_t i = 0; i < moving; ++i)
+        {
+            direct_[static_cast<size_t>(overflow_IDs_[i])] = overflow_pubs_[i];
+        }
+        overflow_IDs_.erase(overflow_IDs_.begin(), overflow_IDs_.begin() + moving);
+        overflow_pubs_.erase(overflow_pubs_.begin(), overflow_pubs_.begin() + moving);
+    }
+
+    std::vector<Publisher *> direct_;
+    std::vector<ID> overflow_IDs_;
+    std::vector<Publisher *> overflow_pubs_;
+};
+
+template<typename ID>
+constexpr size_t PublisherTable<ID, false>::MIN_DIRECT_IDS;
+
+}  // namespace pubsub
+}  // namespace ros2_to_serial_bridge
+
+#endif
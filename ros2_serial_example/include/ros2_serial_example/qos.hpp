@@ -0,0 +1,67 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef ROS2_SERIAL_EXAMPLE__QOS_HPP_
+#define ROS2_SERIAL_EXAMPLE__QOS_HPP_
+
+#include <string>
+
+#include <rclcpp/rclcpp.hpp>
+
+namespace ros2_to_serial_bridge
+{
+
+namespace pubsub
+{
+
+/**
+ * Determine whether a publisher or subscription should use intra-process
+ * comms.
+ *
+ * This is the case if the node was created with intra-process comms enabled,
+ * unless the topic is passthrough (serialized messages don't go through
+ * intra-process comms) or the QoS settings can't be used with it (rclcpp only
+ * supports keep last history and volatile durability for intra-process
+ * comms), in which case a warning is printed.
+ *
+ * @param[in] node The rclcpp::Node the publisher or subscription belongs to.
+ * @param[in] name The name of the topic.
+ * @param[in] qos The QoS settings of the topic.
+ * @param[in] passthrough Whether the topic is a passthrough topic.
+ * @returns true if intra-process comms should be used, false otherwise.
+ */
+inline bool use_intra_process(rclcpp::Node * node, const std::string & name, const rclcpp::QoS & qos, bool passthrough)
+{
+    if (!node->get_node_options().use_intra_process_comms() || passthrough)
+    {
+        return false;
+    }
+
+    const rmw_qos_profile_t & profile = qos.get_rmw_qos_profile();
+    if (profile.history != RMW_QOS_POLICY_HISTORY_KEEP_LAST || profile.durability != RMW_QOS_POLICY_DURABILITY_VOLATILE)
+    {
+        RCLCPP_WARN(node->get_logger(),  // NOLINT(cppcoreguidelines-pro-bounds-array-to-pointer-decay,hicpp-no-array-decay)
+                    "Topic '%s' has QoS settings that don't support intra-process comms; not using them",
+                    name.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+}  // namespace pubsub
+}  // namespace ros2_to_serial_bridge
+
+#endif
@@ -0,0 +1,190 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ROS2_SERIAL_EXAMPLE__RCU_POINTER_HPP_
+#define ROS2_SERIAL_EXAMPLE__RCU_POINTER_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+
+namespace ros2_to_serial_bridge
+{
+
+namespace pubsub
+{
+
+/**
+ * The RcuPointer class holds a pointer to an object that one thread reads
+ * all the time and other threads occasionally replace, read-copy-update
+ * style: a writer makes a new copy of the object, changes it and swaps it in,
+ * and gets the old copy back once the reader can no longer be using it.
+ *
+ * Reading is two atomic increments and an atomic load, and never waits for a
+ * writer.  There is a fixed number of readers, each of which must only be
+ * used by one thread at a time; writers must be serialized by the caller,
+ * and may wait in exchange() for the readers to finish with the old object.
+ */
+template<typename T>
+class RcuPointer final
+{
+public:
+    /**
+     * The ReadGuard class gives the reader access to the current object.
+     * The object stays valid until the ReadGuard is destroyed, so it should
+     * be held for as short a time as possible.
+     */
+    class ReadGuard final
+    {
+    public:
+        ReadGuard(RcuPointer * rcu, size_t reader) : epoch_(&rcu->epochs_[reader].value)
+        {
+            // Mark the reader busy before loading the pointer; see exchange().
+            epoch_->fetch_add(1, std::memory_order_seq_cst);
+            ptr_ = rcu->ptr_.load(std::memory_order_seq_cst);
+        }
+
+        ~ReadGuard()
+        {
+            if (epoch_ != nullptr)
+            {
+                epoch_->fetch_add(1, std::memory_order_release);
+            }
+        }
+
+        ReadGuard(ReadGuard && other) : epoch_(other.epoch_), ptr_(other.ptr_)
+        {
+            other.epoch_ = nullptr;
+        }
+
+        ReadGuard(ReadGuard const &) = delete;
+        ReadGuard& operator=(ReadGuard const &) = delete;
+        ReadGuard& operator=(ReadGuard &&) = delete;
+
+        const T * operator->() const
+        {
+            return ptr_;
+        }
+
+        const T & operator*() const
+        {
+            return *ptr_;
+        }
+
+    private:
+        std::atomic<uint64_t> * epoch_;
+        const T * ptr_;
+    };
+
+    /**
+     * Construct an RcuPointer.
+     *
+     * @param[in] initial The initial object; must not be nullptr.
+     * @param[in] readers The number of readers.
+     * @throws std::runtime_error If readers is 0.
+     */
+    explicit RcuPointer(std::unique_ptr<T> initial = std::make_unique<T>(), size_t readers = 1)
+    : ptr_(initial.release()), epochs_(new Epoch[readers]), readers_(readers)
+    {
+        if (readers == 0)
+        {
+            delete ptr_.load();
+            throw std::runtime_error("RcuPointer needs at least one reader");
+        }
+    }
+
+    ~RcuPointer()
+    {
+        delete ptr_.load();
+    }
+
+    RcuPointer(RcuPointer const &) = delete;
+    RcuPointer& operator=(RcuPointer const &) = delete;
+    RcuPointer(RcuPointer &&) = delete;
+    RcuPointer& operator=(RcuPointer &&) = delete;
+
+    /**
+     * Get read access to the current object.  Only one thread at a time may
+     * do this for each reader.
+     *
+     * @param[in] reader The reader; must be less than the number of readers.
+     * @returns A ReadGuard for the current object.
+     */
+    ReadGuard read(size_t reader = 0)
+    {
+        return ReadGuard(this, reader);
+    }
+
+    /**
+     * Get the current object, to make a copy of it.  Only writers may call
+     * this, since the object is gone once another writer replaces it.
+     *
+     * @returns The current object.
+     */
+    const T & current() const
+    {
+        return *ptr_.load(std::memory_order_acquire);
+    }
+
+    /**
+     * Replace the current object.  This waits until none of the readers can
+     * still be using the old object.
+     *
+     * @param[in] next The new object; must not be nullptr.
+     * @returns The old object, which is now safe to destroy.
+     */
+    std::unique_ptr<T> exchange(std::unique_ptr<T> next)
+    {
+        T * old = ptr_.exchange(next.release(), std::memory_order_seq_cst);
+
+        // The epoch of a reader is odd while it holds a ReadGuard.  If it is
+        // even here, any ReadGuard it makes from now on loads the new pointer.
+        // If it is odd, the reader may have loaded the old pointer, so wait
+        // until it lets go of it.
+        for (size_t i = 0; i < readers_; ++i)
+        {
+            uint64_t epoch = epochs_[i].value.load(std::memory_order_seq_cst);
+            if ((epoch & 1U) != 0)
+            {
+                while (epochs_[i].value.load(std::memory_order_acquire) == epoch)
+                {
+                    std::this_thread::yield();
+                }
+            }
+        }
+
+        return std::unique_ptr<T>(old);
+    }
+
+private:
+    // Each reader's epoch is padded out to a cache line, so that readers on
+    // different cores don't keep taking the line away from each other.
+    struct Epoch final
+    {
+        std::atomic<uint64_t> value{0};
+        uint8_t padding[64 - sizeof(std::atomic<uint64_t>)];
+    };
+
+    std::atomic<T *> ptr_;
+    std::unique_ptr<Epoch[]> epochs_;
+    size_t readers_;
+};
+
+}  // namespace pubsub
+}  // namespace ros2_to_serial_bridge
+
+#endif
@@ -0,0 +1,80 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ROS2_SERIAL_EXAMPLE__READ_WAITABLE_HPP_
+#define ROS2_SERIAL_EXAMPLE__READ_WAITABLE_HPP_
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <rclcpp/rclcpp.hpp>
+#include <rclcpp/version.h>
+
+namespace ros2_to_serial_bridge
+{
+
+/**
+ * The ReadWaitable class lets an rclcpp executor run the bridge's reads, in
+ * the same thread (or threads) as the ROS 2 callbacks of the node.
+ *
+ * The rcl wait set that an executor sleeps in can't wait on an arbitrary
+ * file descriptor, so the waitable is ready when its guard condition is
+ * triggered, by whoever noticed that the transports have data; executing
+ * the waitable then calls the callback, which does the reading.
+ */
+class ReadWaitable final : public rclcpp::Waitable
+{
+public:
+    /**
+     * Construct a ReadWaitable.
+     *
+     * @param[in] context The context of the node the waitable is added to.
+     * @param[in] callback The function to call from the executor each time
+     *                     the waitable is triggered.
+     */
+    ReadWaitable(rclcpp::Context::SharedPtr context, std::function<void()> callback);
+
+    /**
+     * Make the waitable ready, so that the executor calls the callback.
+     *
+     * This can be called from any thread.
+     */
+    void trigger();
+
+    size_t get_number_of_ready_guard_conditions() override;
+
+#if RCLCPP_VERSION_GTE(28, 0, 0)
+    void add_to_wait_set(rcl_wait_set_t & wait_set) override;
+    bool is_ready(const rcl_wait_set_t & wait_set) override;
+    std::shared_ptr<void> take_data() override;
+    std::shared_ptr<void> take_data_by_entity_id(size_t id) override;
+    void execute(const std::shared_ptr<void> & data) override;
+    std::vector<std::shared_ptr<rclcpp::TimerBase>> get_timers() const override;
+#else
+    void add_to_wait_set(rcl_wait_set_t * wait_set) override;
+    bool is_ready(rcl_wait_set_t * wait_set) override;
+    std::shared_ptr<void> take_data() override;
+    void execute(std::shared_ptr<void> & data) override;
+#endif
+
+private:
+    rclcpp::GuardCondition guard_condition_;
+    std::function<void()> callback_;
+};
+
+}  // namespace ros2_to_serial_bridge
+
+#endif
@@ -0,0 +1,121 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ROS2_SERIAL_EXAMPLE__REED_SOLOMON_HPP_
+#define ROS2_SERIAL_EXAMPLE__REED_SOLOMON_HPP_
+
+#include <cstddef>
+#include <cstdint>
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+namespace impl
+{
+
+/**
+ * The ReedSolomon class adds and checks the forward error correction that
+ * the v2 wire protocol can put on a payload.
+ *
+ * The code is RS(255,223) over GF(256), with the field polynomial 0x11D and
+ * the generator roots alpha^0 to alpha^31.  The data is split into blocks of
+ * up to DATA_LEN bytes, and each block is followed by PARITY_LEN parity
+ * bytes; a short last block is a shortened code, as if it had been padded at
+ * the front with zeros.  Up to 16 damaged bytes in each block can be
+ * corrected, wherever they are in it, and more than that is almost always
+ * detected.  The arithmetic is done with log and antilog tables that are
+ * built at compile time.
+ *
+ * All of the methods are static; the class holds no state.
+ */
+class ReedSolomon final
+{
+public:
+    /// The most data bytes in a block.
+    static constexpr size_t DATA_LEN = 223;
+    /// The parity bytes that follow the data of each block.
+    static constexpr size_t PARITY_LEN = 32;
+    /// The length of a whole block.
+    static constexpr size_t BLOCK_LEN = DATA_LEN + PARITY_LEN;
+
+    ReedSolomon() = delete;
+
+    /**
+     * Get the encoded length of some data.
+     *
+     * @param[in] len The length of the data.
+     * @returns The length of the data with the parity of each block added.
+     */
+    static size_t encoded_length(size_t len)
+    {
+        return len + ((len + DATA_LEN - 1) / DATA_LEN) * PARITY_LEN;
+    }
+
+    /**
+     * Get the length of the data that was encoded to a length.
+     *
+     * @param[in] encoded_len The encoded length.
+     * @returns The length of the data, or -1 if no data encodes to
+     *          encoded_len bytes (because the last block is too short to
+     *          have any data in it).
+     */
+    static ssize_t decoded_length(size_t encoded_len)
+    {
+        size_t last = encoded_len % BLOCK_LEN;
+        if (last != 0 && last <= PARITY_LEN)
+        {
+            return -1;
+        }
+
+        return encoded_len - ((encoded_len + BLOCK_LEN - 1) / BLOCK_LEN) * PARITY_LEN;
+    }
+
+    /**
+     * Encode data.
+     *
+     * @param[in] iov The buffers containing the data to encode; the data is
+     *                the concatenation of the buffers.
+     * @param[in] iovcnt The number of buffers in iov.
+     * @param[out] dst The buffer to write the encoded data to, which must be
+     *                 at least encoded_length() of the data long.
+     * @returns The encoded length.
+     */
+    static size_t encode(const struct iovec *iov, int iovcnt, uint8_t *dst);
+
+    /**
+     * Decode data in place, correcting any damaged bytes.  The data is moved
+     * to the start of buf, in front of the parity.
+     *
+     * @param[in,out] buf The encoded data.
+     * @param[in] len The encoded length.
+     * @param[out] corrected Set to the number of bytes that were corrected;
+     *                       may be nullptr.
+     * @returns The length of the data on success, or -1 if len isn't a valid
+     *          encoded length or a block has too many damaged bytes to be
+     *          corrected.  On failure, buf is left partly decoded.
+     */
+    static ssize_t decode(uint8_t *buf, size_t len, size_t *corrected);
+};
+
+}  // namespace impl
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
+
+#endif
@@ -0,0 +1,135 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ROS2_SERIAL_EXAMPLE__RELAY_TABLE_HPP_
+#define ROS2_SERIAL_EXAMPLE__RELAY_TABLE_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "ros2_serial_example/topic_id.hpp"
+#include "ros2_serial_example/transporter.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+/**
+ * The RelayTable class forwards the payloads of selected topics received on
+ * one transport straight to other transports, for links that only pass
+ * traffic through (for instance, from a flight controller to a radio modem).
+ *
+ * A relayed payload is written to each of its transports under the same
+ * topic ID, as it was received; it is never deserialized.  Each transport
+ * frames it with its own protocol, so the two sides don't need to speak the
+ * same one, and the payload itself isn't copied for the px4 and v2
+ * protocols.
+ *
+ * The routes are set up with add() before the first forward(); forward()
+ * may then be called from one thread at a time, while the counters may be
+ * read from any thread.
+ */
+class RelayTable final
+{
+public:
+    RelayTable() = default;
+
+    RelayTable(RelayTable const &) = delete;
+    RelayTable& operator=(RelayTable const &) = delete;
+    RelayTable(RelayTable &&) = delete;
+    RelayTable& operator=(RelayTable &&) = delete;
+
+    /**
+     * Relay a topic to a transport.  A topic can be relayed to several
+     * transports.
+     *
+     * @param[in] topic_ID The topic ID.
+     * @param[in] to The transport to write the payloads of the topic to,
+     *               which must stay around for as long as the table.
+     * @throws std::runtime_error If to is a nullptr, the topic ID is too
+     *         large for the protocol of to, or the topic is already relayed
+     *         to it.
+     */
+    void add(topic_id_size_t topic_ID, Transporter * to);
+
+    /**
+     * Determine whether there are any routes.
+     *
+     * @returns true if no topic is relayed, false otherwise.
+     */
+    bool empty() const
+    {
+        return routes_.empty();
+    }
+
+    /**
+     * Determine whether a topic is relayed.
+     *
+     * @param[in] topic_ID The topic ID.
+     * @returns true if the topic is relayed, false otherwise.
+     */
+    bool relays(topic_id_size_t topic_ID) const
+    {
+        return topic_ID < routes_.size() && !routes_[topic_ID].empty();
+    }
+
+    /**
+     * Write a payload to the transports its topic is relayed to.
+     *
+     * @param[in] topic_ID The topic ID the payload was received with.
+     * @param[in] buffer The payload.
+     * @param[in] length The length of the payload.
+     * @returns true if the topic is relayed (whether or not the writes
+     *          worked), false if it isn't.
+     */
+    bool forward(topic_id_size_t topic_ID, const uint8_t * buffer, size_t length);
+
+    /**
+     * Get the number of payloads written to a transport.
+     *
+     * @returns The number of payloads relayed so far.
+     */
+    uint64_t get_relayed() const
+    {
+        return relayed_;
+    }
+
+    /**
+     * Get the number of payloads that a transport failed to take.  The
+     * transport counts the reason in its own metrics.
+     *
+     * @returns The number of payloads dropped so far.
+     */
+    uint64_t get_drops() const
+    {
+        return drops_;
+    }
+
+private:
+    // The transports of each topic, by topic ID, up to the largest relayed
+    // one.
+    std::vector<std::vector<Transporter *>> routes_;
+    std::atomic<uint64_t> relayed_{0};
+    std::atomic<uint64_t> drops_{0};
+};
+
+}  // namespace transport
+
+}  // namespace ros2_to_serial_bridge
+
+#endif
@@ -0,0 +1,173 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ROS2_SERIAL_EXAMPLE__REPLAY_TRANSPORTER_HPP_
+#define ROS2_SERIAL_EXAMPLE__REPLAY_TRANSPORTER_HPP_
+
+// C++ includes
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Local includes
+#include "ros2_serial_example/link_capture.hpp"
+#include "ros2_serial_example/transporter.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+/**
+ * The ReplayTransporter class is an implementation of the abstract
+ * Transporter class that plays back the received data of a capture written
+ * by a LinkCapture (see Transporter::set_capture()).
+ *
+ * Each received chunk in the capture is handed over by one node_read(), just
+ * as it was read from the link, so it goes through the same framing and
+ * dispatch code, and the same garbage and partial frames, as it did when it
+ * was captured.  The chunks are either handed over at the pace they were
+ * captured at, or as fast as they are asked for.  The data written in the
+ * capture is skipped, and anything written to this transporter is thrown
+ * away.
+ */
+class ReplayTransporter final : public Transporter
+{
+public:
+    /**
+     * Construct a ReplayTransporter object for a capture file.
+     *
+     * @param[in] protocol The backend protocol to use; this must be the one
+     *                     the capture was made with.
+     * @param[in] path The path of the capture file.
+     * @param[in] realtime If true, hand over each chunk at the same time,
+     *                     relative to the first one, as it was captured;
+     *                     otherwise hand them over as fast as possible.
+     * @param[in] read_poll_ms The longest time node_read() waits for the next
+     *                         chunk to be due, or waits once the capture has
+     *                         all been played back.
+     * @param[in] ring_buffer_size The number of bytes to allocate to the
+     *                             underlying ring buffer.
+     */
+    ReplayTransporter(const std::string & protocol,
+                      const std::string & path,
+                      bool realtime,
+                      uint32_t read_poll_ms,
+                      size_t ring_buffer_size);
+    ~ReplayTransporter() override;
+
+    ReplayTransporter(ReplayTransporter const &) = delete;
+    ReplayTransporter& operator=(ReplayTransporter const &) = delete;
+    ReplayTransporter(ReplayTransporter &&) = delete;
+    ReplayTransporter& operator=(ReplayTransporter &&) = delete;
+
+    /**
+     * Open the capture file.
+     *
+     * @returns 0 on success, or -1 if the file can't be opened or was
+     *          captured with a different protocol.
+     */
+    int init() override;
+
+    /**
+     * Close the capture file.
+     *
+     * @returns 0.
+     */
+    int close() override;
+
+    /**
+     * Find out whether all of the capture has been played back.
+     *
+     * @returns true if there is nothing more to play back, false otherwise.
+     */
+    bool is_finished() const
+    {
+        return finished_;
+    }
+
+    /**
+     * Start playing back the capture from the beginning again, throwing away
+     * anything that is still in the ring buffer.
+     */
+    void rewind();
+
+    /**
+     * Change how long a read waits for data to come in.
+     *
+     * This must only be called from the thread that reads.
+     *
+     * @param[in] read_poll_ms The time to wait in milliseconds.
+     * @returns 0.
+     */
+    int set_read_poll_ms(uint32_t read_poll_ms) override
+    {
+        read_poll_ms_ = read_poll_ms;
+        return 0;
+    }
+
+private:
+    /**
+     * Copy the next received chunk of the capture into the ring buffer.
+     *
+     * This method is an override of the abstract one in the Transporter
+     * class.  A chunk that doesn't fit in the free space of the ring buffer
+     * is handed over in pieces.
+     *
+     * @returns The number of bytes copied, 0 if the next chunk isn't due yet
+     *          or the capture is finished, or -1 if the capture isn't open.
+     */
+    ssize_t node_read() override;
+
+    /**
+     * Throw away data written to the transport.
+     *
+     * This method is an override of the abstract one in the Transporter
+     * class.
+     *
+     * @params[in] buffer The buffer containing the data to write.
+     * @params[in] len The number of bytes in the buffer to write.
+     * @returns len.
+     */
+    ssize_t node_write(void *buffer, size_t len) override;
+
+    /**
+     * Detect whether the capture file is open.
+     *
+     * @returns true if the capture file is open, false otherwise.
+     */
+    bool fds_OK() override;
+
+    bool next_chunk();
+
+    std::string path_;
+    bool realtime_;
+    uint32_t read_poll_ms_;
+    LinkCaptureReader reader_;
+    bool open_{false};
+    bool finished_{false};
+    LinkCaptureReader::Record chunk_;
+    size_t chunk_offset_{0};
+    bool have_chunk_{false};
+    bool started_{false};
+    uint64_t first_timestamp_ns_{0};
+    std::chrono::steady_clock::time_point start_time_;
+};
+
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
+
+#endif
@@ -47,10 +47,29 @@ namespace impl
  *
  * One semi-unique feature of this implementation is the read() method, which
  * does a POSIX read directly into the read buffer.
+ *
+ * The ring buffer can also be mirrored (see set_mirrored()), in which case the
+ * same memory is mapped twice, back to back.  Any data in the ring is then
+ * contiguous in memory, even if it wraps around the end, so it can be parsed
+ * in place (see contiguous()) and is never split into two spans.
+ *
+ * Finally, the ring buffer can be made adaptive (see set_adaptive()), in
+ * which case it grows, up to a maximum, when it fills up, and shrinks back
+ * and gives its memory back when it has stayed mostly empty for a while.
+ * The ring only changes size when data is about to be added to it, never
+ * while a span from free_span() is being filled.
  */
 class RingBuffer
 {
 public:
+    /// An adaptive ring buffer that is at least this full when data is about
+    /// to be added, in quarters of its capacity, grows.
+    static constexpr size_t GROW_QUARTERS = 3;
+
+    /// An adaptive ring buffer that was never more than a quarter full over
+    /// this many additions of data shrinks, once its data is contiguous.
+    static constexpr size_t SHRINK_AFTER_ADDS = 1024;
+
     explicit RingBuffer(size_t capacity);
 
     virtual ~RingBuffer();
@@ -60,6 +79,95 @@ public:
     RingBuffer(RingBuffer &&) = delete;
     RingBuffer& operator=(RingBuffer &&) = delete;
 
+    /**
+     * Switch the ring buffer to mirrored memory.
+     *
+     * The capacity is rounded up to a multiple of the page size, and a memfd
+     * of that size is mapped twice in a row.  This may only be done while the
+     * ring buffer is empty.  If mirroring isn't possible (for instance,
+     * because the platform has no memfd_create()), the ring buffer is left
+     * as it was.
+     *
+     * @returns 0 on success, or -1 if the ring buffer isn't empty or the
+     *          memory couldn't be mirrored.
+     */
+    int set_mirrored();
+
+    /**
+     * Determine whether the ring buffer uses mirrored memory.
+     *
+     * @returns true if set_mirrored() succeeded, false otherwise.
+     */
+    bool is_mirrored() const
+    {
+        return mirrored_;
+    }
+
+    /**
+     * Let the ring buffer change its capacity with the amount of data in it.
+     *
+     * Address space for max_capacity bytes (twice that if mirrored) is
+     * reserved up front, so the data never moves to another address, but
+     * memory is only used for the capacity in use.  Whenever data is about
+     * to be added while the ring buffer is at least GROW_QUARTERS quarters
+     * full, its capacity is doubled, up to max_capacity.  Once it has been
+     * no more than a quarter full for SHRINK_AFTER_ADDS additions of data,
+     * its capacity is halved, down to the capacity it started with, and the
+     * memory above it is given back to the system.  This may only be done
+     * while the ring buffer is empty, and either before or after
+     * set_mirrored(); a mirrored ring buffer rounds max_capacity up to a
+     * multiple of the page size.
+     *
+     * @param[in] max_capacity The most bytes the ring buffer may grow to
+     *                         hold; this must be larger than its capacity.
+     * @returns 0 on success, or -1 if the ring buffer isn't empty,
+     *          max_capacity is too small, or the memory couldn't be
+     *          reserved, in which case the ring buffer is left as it was.
+     */
+    int set_adaptive(size_t max_capacity);
+
+    /**
+     * Determine whether the ring buffer changes its capacity.
+     *
+     * @returns true if set_adaptive() succeeded, false otherwise.
+     */
+    bool is_adaptive() const
+    {
+        return max_capacity_ != 0;
+    }
+
+    /**
+     * Change the capacity of the ring buffer, keeping the data in it.
+     *
+     * The data is copied into new memory of the new capacity, and the old
+     * memory is freed.  A mirrored ring buffer stays mirrored, rounding the
+     * capacity up to a multiple of the page size, and an adaptive one grows
+     * from and shrinks back to the new capacity, reserving more address
+     * space if it is larger than the most it could grow to.  Pointers into
+     * the ring buffer are no longer valid afterwards.
+     *
+     * @param[in] capacity The new capacity.
+     * @returns 0 on success, or -1 if capacity is 0 or too small for the
+     *          data in the ring buffer, or the memory couldn't be had, in
+     *          which case the ring buffer is left as it was.
+     */
+    int resize(size_t capacity);
+
+    /**
+     * Get a pointer to the data at the tail of the ring buffer if it is
+     * contiguous in memory.
+     *
+     * For a mirrored ring buffer this is always the case; otherwise only if
+     * the data doesn't wrap around the end of the ring.  The ring buffer is
+     * not altered, and the pointer is only valid until the next call that
+     * adds data to the ring.
+     *
+     * @param[in] count The number of bytes that need to be contiguous.
+     * @returns A pointer to the data, or a nullptr if the ring buffer doesn't
+     *          contain at least count bytes or they aren't contiguous.
+     */
+    const uint8_t *contiguous(size_t count) const;
+
     /**
      * Read data from a file descriptor directly into the ring buffer.
      *
@@ -81,6 +189,58 @@ public:
      */
     ssize_t read(int fd);
 
+    /**
+     * Copy data from a linear buffer into the ring buffer.
+     *
+     * This is the equivalent of read() for data that is already in memory,
+     * and behaves the same way: if there isn't enough free space, the oldest
+     * data in the ring buffer is overwritten.
+     *
+     * @param[in] src The buffer to copy data from.
+     * @param[in] count The number of bytes in src.
+     * @returns The number of bytes copied on success, or -1 on error.
+     *
+     * @note Like read(), this method can do short copies when the data would
+     *       wrap around the end of the ring buffer.  Callers should be
+     *       prepared to call it again for the rest of the data.
+     */
+    ssize_t write(const void *src, size_t count);
+
+    /**
+     * Get the free space at the head of the ring buffer, so that it can be
+     * filled in place (for instance, by an asynchronous read) and then added
+     * to the ring with commit().
+     *
+     * The span is as large as it can be without wrapping around the end of
+     * the ring, or all of the free space if the ring buffer is mirrored.  If
+     * the ring buffer is full, the oldest data is dropped to make room, just
+     * as read() would overwrite it.  Data may be removed from the ring while
+     * the span is being filled, but nothing other than commit() may add any.
+     *
+     * @param[out] len The length of the span.
+     * @returns A pointer to the start of the span.
+     */
+    uint8_t *free_span(size_t *len);
+
+    /**
+     * Add data that was put into the span from free_span() to the ring
+     * buffer.
+     *
+     * @param[in] count The number of bytes put into the span; this must be
+     *                  no more than the length of the span.
+     */
+    void commit(size_t count);
+
+    /**
+     * Get the memory that the ring buffer keeps its data in, including the
+     * mirror if the ring buffer is mirrored, such as for registering it with
+     * the kernel.
+     *
+     * @param[out] base The start of the memory.
+     * @param[out] length The length of the memory.
+     */
+    void get_memory(uint8_t **base, size_t *length) const;
+
     /**
      * Look at the data currently in the ring buffer without removing it.
      *
@@ -109,6 +269,37 @@ public:
      */
     ssize_t memcpy_from(void *dst, size_t count);
 
+    /**
+     * Remove data from the ring buffer without copying it anywhere.
+     *
+     * If there isn't enough data in the buffer for the number of bytes
+     * requested, or the number of bytes requested is 0, this returns -1.
+     * Otherwise it advances the tail past the requested number of bytes.
+     *
+     * @param[in] count The number of bytes to remove from the ring buffer.
+     * @returns The number of bytes removed on success, or -1 on error.
+     */
+    ssize_t discard(size_t count);
+
+    /**
+     * Get direct pointers to the data at the tail of the ring buffer.
+     *
+     * Since the data may wrap around the end of the ring, it is returned as
+     * up to two contiguous spans; the second span is empty (nullptr and 0) if
+     * the data does not wrap.  The ring buffer is not altered, and the
+     * pointers are only valid until the next call that modifies the ring.
+     *
+     * @param[in] count The number of bytes to get spans for.
+     * @param[out] first The start of the first span.
+     * @param[out] first_len The number of bytes in the first span.
+     * @param[out] second The start of the second span.
+     * @param[out] second_len The number of bytes in the second span.
+     * @returns The total number of bytes in both spans on success, or -1 if
+     *          the ring buffer doesn't contain at least count bytes.
+     */
+    ssize_t peek_spans(size_t count, const uint8_t **first, size_t *first_len,
+                       const uint8_t **second, size_t *second_len) const;
+
     /**
      * Find a particular sequence of bytes in the ring buffer.
      *
@@ -117,6 +308,12 @@ public:
      * copied out of the ring to get to the sequence.  If the sequence cannot
      * be found for any reason, -1 is returned.
      *
+     * Each of the (up to two) contiguous spans of the ring is searched with
+     * memchr for the first byte of the sequence.  The ring also remembers how
+     * far it got for the most recently searched sequence, so calling this
+     * repeatedly for the same sequence while more data arrives only scans
+     * the new bytes.
+     *
      * @param[in] seq The byte sequence to look for in the ring; this should be
      *                at least as large as seqlen.
      * @param[in] seqlen The length of the byte sequence to look for.
@@ -131,6 +328,73 @@ public:
      */
     size_t bytes_used() const;
 
+    /**
+     * Get the number of bytes the ring buffer can hold.
+     *
+     * @returns The number of bytes the ring buffer can hold.
+     */
+    size_t capacity() const
+    {
+        return size_;
+    }
+
+    /**
+     * Get the most bytes the ring buffer can ever hold, which is more than
+     * its capacity if it is adaptive.
+     *
+     * @returns The number of bytes the ring buffer can grow to hold.
+     */
+    size_t max_capacity() const
+    {
+        return is_adaptive() ? max_capacity_ : size_;
+    }
+
+    /**
+     * Get the number of bytes that were overwritten before they were
+     * consumed, because more data was added than the ring buffer had room
+     * for.
+     *
+     * @returns The number of bytes lost to overflows so far.
+     */
+    uint64_t get_overflowed_bytes() const
+    {
+        return overflowed_bytes_;
+    }
+
+    /**
+     * Get the number of times data was overwritten before it was consumed.
+     *
+     * @returns The number of overflows so far.
+     */
+    uint64_t get_overflows() const
+    {
+        return overflows_;
+    }
+
+    /**
+     * Get a number that changes whenever data leaves the tail of the ring
+     * buffer, whether it was consumed, overwritten by an overflow, or thrown
+     * away when the memory was replaced.  As long as it stays the same, the
+     * data at the tail is the same data, possibly with more after it, so
+     * whatever a parser has worked out about it still holds.
+     *
+     * @returns The tail generation.
+     */
+    uint64_t get_tail_generation() const
+    {
+        return tail_generation_;
+    }
+
+    /**
+     * Get the most bytes the ring buffer has held at once.
+     *
+     * @returns The high-water mark of the ring buffer.
+     */
+    size_t get_high_water() const
+    {
+        return high_water_;
+    }
+
 protected:
     /**
      * Get a pointer to the end of the ring buffer.
@@ -153,11 +417,127 @@ protected:
      */
     bool is_empty() const;
 
-    std::unique_ptr<uint8_t[]> buf_;
+    /**
+     * Adjust the findseq() scan position, and move on the tail generation,
+     * after data was removed from the tail.
+     *
+     * @param[in] count The number of bytes removed from the tail.
+     */
+    void consumed(size_t count);
+
+    /**
+     * Determine whether a sequence is in the ring at a particular offset.
+     *
+     * @param[in] offset The offset from the tail to check at; there must be
+     *                   at least offset + seqlen bytes in the ring.
+     * @param[in] seq The byte sequence to compare against.
+     * @param[in] seqlen The length of the byte sequence.
+     * @returns true if the sequence is at offset, false otherwise.
+     */
+    bool matches_at(size_t offset, const uint8_t *seq, size_t seqlen) const;
+
+    /**
+     * Map memory for the ring buffer, replacing the memory it has, which
+     * must hold no data.
+     *
+     * @param[in] size The capacity of the ring buffer.
+     * @param[in] reserve The capacity to reserve address space for.
+     * @param[in] mirrored Whether to map the memory twice in a row.
+     * @returns 0 on success, or -1 if the memory couldn't be mapped.
+     */
+    int map_memory(size_t size, size_t reserve, bool mirrored);
+
+    /**
+     * Resize the memfd of a mirrored ring buffer and map both copies of it
+     * at the new size, reserving the address space above them again if they
+     * got smaller.
+     *
+     * @param[in] size The new capacity.
+     * @param[in] old_size The capacity the memory is mapped at now.
+     * @returns true on success, false if any step failed, in which case the
+     *          memory may be mapped at neither size.
+     */
+    bool map_mirror(size_t size, size_t old_size);
+
+    /**
+     * Map the memory of a mirrored ring buffer back at its capacity after
+     * map_mirror() failed to change it, aborting if even that fails.
+     *
+     * @param[in] size The capacity to map the memory at.
+     * @param[in] failed_size The capacity map_mirror() failed to map.
+     */
+    void restore_mirror(size_t size, size_t failed_size);
+
+    /**
+     * Grow or shrink an adaptive ring buffer if it is time to, before data
+     * is added to it.
+     */
+    void adapt();
+
+    /**
+     * Grow an adaptive ring buffer, keeping its data.
+     *
+     * @param[in] new_size The new capacity.
+     * @returns true on success, false if the memory couldn't be mapped.
+     */
+    bool grow(size_t new_size);
+
+    /**
+     * Shrink an adaptive ring buffer whose data doesn't wrap and fits in the
+     * new capacity, and give the memory above the new capacity back.  If a
+     * mirrored ring buffer's memory can't be remapped, it keeps its old
+     * capacity.
+     *
+     * @param[in] new_size The new capacity.
+     */
+    void shrink(size_t new_size);
+
+    /**
+     * Keep track of the high-water marks after data was added.
+     */
+    void added()
+    {
+        size_t used = bytes_used();
+        high_water_ = used > high_water_ ? used : high_water_;
+        window_high_water_ = used > window_high_water_ ? used : window_high_water_;
+    }
+
+    // The buffer is either allocated on the heap, or (when mirrored or
+    // adaptive) mapped, in which case the deleter has to unmap it.
+    struct BufferDeleter final
+    {
+        size_t mapped_len{0};
+        void operator()(uint8_t *p) const;
+    };
+
+    std::unique_ptr<uint8_t[], BufferDeleter> buf_;
     uint8_t *head_;
     uint8_t *tail_;
     bool full_{false};
     size_t size_;
+    uint64_t overflowed_bytes_{0};
+    uint64_t overflows_{0};
+    bool mirrored_{false};
+    // The memfd behind a mirrored ring buffer, which an adaptive one resizes.
+    int mirror_fd_{-1};
+    size_t high_water_{0};
+
+    // The capacity an adaptive ring buffer may grow to and shrink back to (0
+    // if it isn't adaptive), and the data added and high-water mark since
+    // it last decided whether to shrink.
+    size_t max_capacity_{0};
+    size_t min_capacity_{0};
+    size_t window_adds_{0};
+    size_t window_high_water_{0};
+    bool shrink_pending_{false};
+
+    // The findseq() scan state: the sequence searched for last, and the
+    // number of bytes from the tail that are known not to start it.
+    mutable uint8_t scanned_seq_[8]{};
+    mutable size_t scanned_seq_len_{0};
+    mutable size_t scanned_{0};
+
+    uint64_t tail_generation_{0};
 };
 
 }  // namespace impl
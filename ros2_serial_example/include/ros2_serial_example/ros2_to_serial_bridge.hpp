@@ -15,15 +15,46 @@
 #ifndef ROS2_SERIAL_EXAMPLE__ROS2_TO_SERIAL_BRIDGE_HPP_
 #define ROS2_SERIAL_EXAMPLE__ROS2_TO_SERIAL_BRIDGE_HPP_
 
-#include <future>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <thread>
+#include <vector>
 
+#include <sys/epoll.h>
+
+#include <diagnostic_msgs/msg/diagnostic_array.hpp>
+#include <rcl_interfaces/msg/set_parameters_result.hpp>
 #include <rclcpp/rclcpp.hpp>
+#include <rosgraph_msgs/msg/clock.hpp>
+
+#include "ros2_serial_msgs/msg/firmware_profile.hpp"
+#include "ros2_serial_msgs/srv/activate.hpp"
+#include "ros2_serial_msgs/srv/configure_topic.hpp"
+#include "ros2_serial_msgs/srv/dump_flight_recorder.hpp"
 
+#ifdef ROS2_SERIAL_BAG_RECORDER
+#include "ros2_serial_example/bag_recorder.hpp"
+#endif
+#include "ros2_serial_example/dispatch_pool.hpp"
+#include "ros2_serial_example/link_negotiation.hpp"
+#include "ros2_serial_example/loop_watchdog.hpp"
+#include "ros2_serial_example/mapping_cache.hpp"
+#include "ros2_serial_example/metrics.hpp"
+#include "ros2_serial_example/read_waitable.hpp"
+#include "ros2_serial_example/relay_table.hpp"
+#include "ros2_serial_example/rx_lanes.hpp"
+#include "ros2_serial_example/sim_lockstep.hpp"
+#include "ros2_serial_example/thread_settings.hpp"
+#include "ros2_serial_example/time_sync.hpp"
 #include "ros2_serial_example/transporter.hpp"
+#include "ros2_serial_example/tx_queue.hpp"
 
 // Generated file
 #include "ros2_topics.hpp"
@@ -43,15 +74,216 @@ public:
     ~ROS2ToSerialBridge() override;
 
 private:
-    void read_thread_func(const std::shared_future<void> & local_future);
-    std::map<std::string, ros2_to_serial_bridge::pubsub::TopicMapping> parse_node_parameters_for_topics();
-    std::map<std::string, ros2_to_serial_bridge::pubsub::TopicMapping> dynamically_get_serial_mapping(uint64_t wait_ms);
-
-    std::unique_ptr<ros2_to_serial_bridge::transport::Transporter> transporter_;
-    std::unique_ptr<ros2_to_serial_bridge::pubsub::ROS2Topics> ros2_topics_;
-    std::shared_future<void> future_;
-    std::promise<void> exit_signal_;
+    // One serial port (or other transport) served by the bridge, with its
+    // own topic map.  All ports share the node and the read thread.
+    struct Port final
+    {
+        std::string name;
+        // The index of the port in ports_.
+        uint16_t index{0};
+        std::unique_ptr<ros2_to_serial_bridge::transport::Transporter> transporter;
+        std::unique_ptr<ros2_to_serial_bridge::transport::TxQueue> tx_queue;
+        // The scheduling of the tx queue writer thread, if it runs.
+        ros2_to_serial_bridge::transport::ThreadSettings tx_thread_settings;
+        std::unique_ptr<ros2_to_serial_bridge::pubsub::ROS2Topics> ros2_topics;
+        int read_fd{-1};
+        // How long the read thread keeps polling the port without sleeping
+        // after it got data, in microseconds.
+        uint32_t busy_poll_us{0};
+        // Whether the port speaks v2, and so may have reliable payloads to
+        // send again or acknowledge (see Transporter::service_reliable()).
+        bool reliable{false};
+        // Whether every SerialToROS2 topic is lazy, including the ones that
+        // are set up later.
+        bool lazy_publishers{false};
+        // The namespace the topics and services of the port are in, if any
+        // (see topic_namespace.hpp).
+        std::string topic_namespace;
+        // If the topics were set up from a cached serial mapping, the other
+        // end is asked for its mapping in the background; this is the state
+        // of that check.
+        struct MappingCheck final
+        {
+            std::unique_ptr<ros2_to_serial_bridge::transport::MappingCache> cache;
+            std::vector<uint8_t> cached;
+            int64_t wait_ms{0};
+            std::chrono::steady_clock::time_point start;
+            std::chrono::steady_clock::time_point last_request;
+            // Set while waiting for the answer; the read thread hands the
+            // answer over in received, under mutex.
+            std::atomic<bool> pending{false};
+            std::mutex mutex;
+            std::vector<uint8_t> received;
+            bool has_received{false};
+        };
+        MappingCheck mapping_check;
+        // The ROS 2 topic names by serial mapping, to label the metrics.
+        std::map<topic_id_size_t, std::string> topic_names;
+        // Reused for every diagnostics message, with the number of errors
+        // counted as of the last one.
+        ros2_to_serial_bridge::transport::Metrics::Snapshot metrics_snapshot;
+        uint64_t reported_errors{0};
+        // The messages the read thread dropped because the queue of their
+        // dispatch thread was full.
+        std::atomic<uint64_t> dispatch_drops{0};
+        // Times each read of the port by the read thread, and the dispatching
+        // of what it read (see stall_threshold_ms); the writer thread has a
+        // watchdog of its own in tx_queue.  The stalls of each as of the last
+        // diagnostics, to warn about the new ones.
+        ros2_to_serial_bridge::transport::LoopWatchdog read_watchdog;
+        ros2_to_serial_bridge::transport::LoopWatchdog::Snapshot watchdog_snapshot;
+        uint64_t reported_read_stalls{0};
+        uint64_t reported_tx_stalls{0};
+        // Without dispatch threads, the messages of the topics below the
+        // highest rx_priority are held back here while a batch is read, and
+        // dispatched after the higher priority ones.
+        std::unique_ptr<ros2_to_serial_bridge::transport::RxLanes> rx_lanes;
+        // The topics received on this port that are written straight to
+        // other ports, and whether they are also published if they are
+        // mapped to ROS 2 topics.
+        ros2_to_serial_bridge::transport::RelayTable relays;
+        bool relay_publish{false};
+        // If the port synchronizes its clock with the other end (see
+        // timesync_period_ms), the estimate of the other end's clock and the
+        // timer that sends the requests for it.
+        std::unique_ptr<ros2_to_serial_bridge::transport::TimeSync> time_sync;
+        rclcpp::TimerBase::SharedPtr time_sync_timer;
+        // If the other end is a simulator that runs in lockstep with the
+        // bridge (see sim_lockstep), the steps it took.
+        std::unique_ptr<ros2_to_serial_bridge::transport::SimLockstep> sim_lockstep;
+        // The latest profile from firmware built to send them, for the
+        // diagnostics; the read thread hands it over under
+        // firmware_profile_mutex.
+        std::mutex firmware_profile_mutex;
+        ros2_serial_msgs::msg::FirmwareProfile firmware_profile;
+        bool has_firmware_profile{false};
+        // Whether the port keeps its recent traffic in a flight recorder
+        // (see flight_recorder_kb), and, for dumping it when errors come in
+        // too fast, the errors counted as of the last check and whether the
+        // last check was over the threshold.
+        bool flight_recorder{false};
+        uint64_t flight_recorder_errors{0};
+        bool flight_recorder_tripped{false};
+        ros2_to_serial_bridge::transport::Metrics::Snapshot flight_recorder_snapshot;
+        // Whether the traffic is captured to a file, which has to stay in
+        // one protocol.
+        bool capturing{false};
+        // What the port offers the other end, the settings the link is on,
+        // and how long to wait for the other end to answer after switching
+        // them, for switching the baudrate or protocol while running.
+        ros2_to_serial_bridge::transport::LinkCapabilities link_local;
+        ros2_to_serial_bridge::transport::LinkSettings link_settings;
+        int64_t link_check_ms{1000};
+        // The link parameters changed while running (see
+        // on_parameters_set()), which the thread that reads the port applies
+        // between reads; they are handed over under link_change_mutex.
+        struct LinkChange final
+        {
+            // 0, empty or -1 for the ones that didn't change.
+            uint32_t baudrate{0};
+            std::string protocol;
+            int64_t read_poll_ms{-1};
+            size_t ring_buffer_size{0};
+        };
+        std::mutex link_change_mutex;
+        LinkChange link_change;
+        std::atomic<bool> link_change_pending{false};
+    };
+
+    std::unique_ptr<Port> setup_port(const std::string & name);
+    void setup_relays(Port * port);
+    template<typename T>
+    bool get_port_parameter(const std::string & prefix, const std::string & name, T & value);
+    ros2_to_serial_bridge::transport::ThreadSettings get_thread_settings(const std::string & prefix, const std::string & name);
+    void stop_read_thread();
+    bool start_io(std::string * error);
+    void activate(const std::shared_ptr<ros2_serial_msgs::srv::Activate::Request> request,
+                  std::shared_ptr<ros2_serial_msgs::srv::Activate::Response> response);
+    void read_thread_func();
+    void watch_thread_func();
+    void executor_read();
+    ssize_t read_port(Port * port);
+    void drain_rx_lanes(Port * port);
+    void handle_sim_step(Port * port, const uint8_t * buffer, size_t length);
+    ssize_t handle_read_event(const struct epoll_event & event);
+    rcl_interfaces::msg::SetParametersResult on_parameters_set(const std::vector<rclcpp::Parameter> & parameters);
+    void apply_link_changes();
+    int service_reliable_ports(int timeout_ms);
+    void publish_diagnostics();
+    std::map<std::string, ros2_to_serial_bridge::pubsub::TopicMapping> parse_node_parameters_for_topics(const std::string & prefix);
+    std::map<std::string, ros2_to_serial_bridge::pubsub::ServiceMapping> parse_node_parameters_for_services(const std::string & prefix);
+    void check_serial_mappings();
+    void topics_changed(Port * port);
+    void update_bag_topics(Port * port);
+    void replace_topics(Port * port, std::map<std::string, ros2_to_serial_bridge::pubsub::TopicMapping> topic_names_and_serialization);
+    void configure_topic(const std::shared_ptr<ros2_serial_msgs::srv::ConfigureTopic::Request> request,
+                         std::shared_ptr<ros2_serial_msgs::srv::ConfigureTopic::Response> response);
+    void check_flight_recorders();
+    bool dump_flight_recorder(Port * port, const std::string & reason, std::string * file);
+    void dump_flight_recorders(const std::shared_ptr<ros2_serial_msgs::srv::DumpFlightRecorder::Request> request,
+                               std::shared_ptr<ros2_serial_msgs::srv::DumpFlightRecorder::Response> response);
+    bool negotiate_link(ros2_to_serial_bridge::transport::Transporter * transporter, const ros2_to_serial_bridge::transport::LinkCapabilities & local, uint64_t wait_ms, ros2_to_serial_bridge::transport::LinkSettings * settings);
+    bool switch_link(ros2_to_serial_bridge::transport::Transporter * transporter, const ros2_to_serial_bridge::transport::LinkCapabilities & local, uint64_t wait_ms, const ros2_to_serial_bridge::transport::LinkSettings & settings);
+    std::map<std::string, ros2_to_serial_bridge::pubsub::TopicMapping> dynamically_get_serial_mapping(ros2_to_serial_bridge::transport::Transporter * transporter, uint64_t wait_ms, std::vector<uint8_t> * payload);
+
+    std::vector<std::unique_ptr<Port>> ports_;
+    // If there are dispatch threads, the read thread hands the messages to
+    // them instead of dispatching them itself.  The priority dispatch
+    // threads only take the topics with an rx_priority above 0.
+    size_t dispatch_threads_{0};
+    size_t dispatch_priority_threads_{0};
+    // How many threads the publishers and subscriptions of a port are
+    // created on.
+    size_t entity_creation_threads_{1};
+    std::unique_ptr<ros2_to_serial_bridge::transport::DispatchPool> dispatch_pool_;
+    // The size of the buffer that received messages are read into.
+    size_t rx_buffer_size_{0};
+    std::unique_ptr<uint8_t[]> rx_buffer_;
+#ifdef ROS2_SERIAL_BAG_RECORDER
+    // If the received messages are recorded, the bag they are written to.
+    std::unique_ptr<ros2_to_serial_bridge::pubsub::BagRecorder> bag_recorder_;
+#endif
+    int epoll_fd_{-1};
+    int wakeup_fd_{-1};
+    std::atomic<bool> exiting_{false};
     std::thread read_thread_;
+    // The ports that the read thread waits on in epoll, and the ones that
+    // send reliable payloads.
+    size_t waitable_ports_{0};
+    std::vector<Port *> reliable_ports_;
+    // When the executor does the reads, the read thread only waits for the
+    // transports to have data, and hands their epoll events over to the
+    // waitable; it waits for the executor to be done with them before it
+    // waits again.
+    bool read_in_executor_{false};
+    ros2_to_serial_bridge::transport::ThreadSettings read_thread_settings_;
+    // Whether the transports are only opened, and read, once the bridge is
+    // activated through activate_srv_.
+    bool standby_{false};
+    rclcpp::Service<ros2_serial_msgs::srv::Activate>::SharedPtr activate_srv_;
+    std::shared_ptr<ReadWaitable> read_waitable_;
+    std::mutex read_handoff_mutex_;
+    std::condition_variable read_handoff_cv_;
+    bool read_handoff_pending_{false};
+    std::vector<struct epoll_event> read_events_;
+    // When the next retransmit or acknowledgement is due, in ms from when
+    // the reliable ports were last serviced, or -1 if none is.
+    std::atomic<int> reliable_due_ms_{-1};
+    rclcpp::Publisher<diagnostic_msgs::msg::DiagnosticArray>::SharedPtr diagnostics_pub_;
+    // The simulated time of the ports with sim_lockstep is published here.
+    rclcpp::Publisher<rosgraph_msgs::msg::Clock>::SharedPtr clock_pub_;
+    rclcpp::TimerBase::SharedPtr diagnostics_timer_;
+    rclcpp::TimerBase::SharedPtr mapping_check_timer_;
+    rclcpp::Service<ros2_serial_msgs::srv::ConfigureTopic>::SharedPtr configure_topic_srv_;
+    // Where the flight recorders are dumped to, and the errors per second on
+    // a port that make it dump its flight recorder, or 0 for never.
+    std::string flight_recorder_dir_;
+    double flight_recorder_error_rate_{0.0};
+    std::chrono::steady_clock::time_point flight_recorder_checked_;
+    rclcpp::TimerBase::SharedPtr flight_recorder_timer_;
+    rclcpp::Service<ros2_serial_msgs::srv::DumpFlightRecorder>::SharedPtr dump_flight_recorder_srv_;
+    // Checks the link parameters that are changed while the bridge runs.
+    rclcpp::node_interfaces::OnSetParametersCallbackHandle::SharedPtr parameters_callback_;
 };
 
 }  // namespace ros2_to_serial_bridge
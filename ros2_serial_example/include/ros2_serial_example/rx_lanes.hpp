@@ -0,0 +1,132 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ROS2_SERIAL_EXAMPLE__RX_LANES_HPP_
+#define ROS2_SERIAL_EXAMPLE__RX_LANES_HPP_
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+#include "ros2_serial_example/topic_id.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+/**
+ * The RxLanes class holds back the received payloads of the lower priority
+ * topics while a batch of messages is read, so that the higher priority ones
+ * can be dispatched ahead of them.
+ *
+ * Each payload is pushed with the rx_priority of its topic.  drain() then
+ * hands the payloads out one lane at a time, highest priority first, and in
+ * the order they were pushed within each lane; as every payload of a topic
+ * has the same priority, the payloads of a topic stay in order.
+ *
+ * All of the memory is allocated up front, so pushing never allocates; a
+ * payload that doesn't fit is refused, and the caller should drain() the
+ * lanes before it handles that payload itself.  RxLanes isn't thread safe.
+ */
+class RxLanes final
+{
+public:
+    /**
+     * The function that drain() hands each payload to.
+     *
+     * @param[in] topic_ID The topic ID of the payload.
+     * @param[in] buffer The payload, which the visitor may change in place;
+     *                   it is only valid until the visitor returns.
+     * @param[in] length The length of the payload.
+     * @param[in] receive_time The time the payload was received.
+     */
+    using Visitor = std::function<void(topic_id_size_t topic_ID, uint8_t * buffer, size_t length,
+                                       std::chrono::system_clock::time_point receive_time)>;
+
+    /**
+     * Construct an RxLanes.
+     *
+     * @param[in] capacity The room for the payloads held back, in bytes,
+     *                     including a small record for each.
+     * @throws std::runtime_error If capacity is too small for any payload.
+     */
+    explicit RxLanes(size_t capacity);
+
+    RxLanes(RxLanes const &) = delete;
+    RxLanes& operator=(RxLanes const &) = delete;
+    RxLanes(RxLanes &&) = delete;
+    RxLanes& operator=(RxLanes &&) = delete;
+
+    /**
+     * Copy a payload into its lane.
+     *
+     * @param[in] priority The rx_priority of the topic; higher is dispatched
+     *                     first.
+     * @param[in] topic_ID The topic ID of the payload.
+     * @param[in] buffer The payload.
+     * @param[in] length The length of the payload.
+     * @param[in] receive_time The time the payload was received.
+     * @returns true if the payload was held back, false if there is no room
+     *          for it.
+     */
+    bool push(uint8_t priority, topic_id_size_t topic_ID, const uint8_t * buffer, size_t length,
+              std::chrono::system_clock::time_point receive_time);
+
+    /**
+     * Hand every payload that was held back to a visitor, highest priority
+     * first, and empty the lanes.
+     *
+     * @param[in] visitor The function to hand the payloads to.
+     * @returns The number of payloads handed out.
+     */
+    size_t drain(const Visitor & visitor);
+
+    /**
+     * Find out whether any payload is held back.
+     *
+     * @returns true if no payload is held back, false otherwise.
+     */
+    bool empty() const
+    {
+        return used_ == 0;
+    }
+
+private:
+    struct Record final
+    {
+        uint32_t length;
+        topic_id_size_t topic_ID;
+        uint8_t priority;
+        int64_t receive_time_ns;
+    };
+
+    static size_t record_size(size_t length);
+
+    std::unique_ptr<uint8_t[]> buf_;
+    size_t capacity_;
+    size_t used_{0};
+    // The number of payloads in each lane, so that drain() only walks the
+    // records once for each lane that has any.
+    std::array<uint32_t, 256> counts_{};
+};
+
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
+
+#endif
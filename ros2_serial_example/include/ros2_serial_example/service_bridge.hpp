@@ -0,0 +1,82 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ROS2_SERIAL_EXAMPLE__SERVICE_BRIDGE_HPP_
+#define ROS2_SERIAL_EXAMPLE__SERVICE_BRIDGE_HPP_
+
+#include <chrono>
+#include <cstddef>
+
+#include "ros2_serial_example/publisher.hpp"
+#include "ros2_serial_example/topic_id.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace pubsub
+{
+
+/**
+ * The ServiceBridge class provides an abstract class for a ROS 2 service
+ * that the other end of the serial link answers.
+ *
+ * The requests of the service are sent on its serial mapping, each with a
+ * correlation ID in front of its CDR data (see ServiceCorrelator), and the
+ * other end sends each response back on the same serial mapping with the ID
+ * of its request in front.  The responses come in like the messages of a
+ * SerialToROS2 topic, so a ServiceBridge is a Publisher: dispatch() takes
+ * each response and sends it to the client that made the request.
+ */
+class ServiceBridge : public Publisher
+{
+public:
+    ServiceBridge() {}
+    ~ServiceBridge() override {}
+
+    /**
+     * Get the serial mapping number for this service.
+     *
+     * @returns The serial mapping number for this service.
+     */
+    topic_id_size_t get_serial_mapping() const
+    {
+        return serial_mapping_;
+    }
+
+    /**
+     * Pure virtual method to give up on the requests that got no response in
+     * time, which derived classes count as timeouts.  This is called
+     * periodically from a timer on the node.
+     *
+     * @param[in] now The current time.
+     * @returns The number of requests given up on.
+     */
+    virtual size_t expire(std::chrono::steady_clock::time_point now) = 0;
+
+    /**
+     * Pure virtual method to get the number of requests waiting for their
+     * responses.
+     *
+     * @returns The number of requests.
+     */
+    virtual size_t in_flight() const = 0;
+
+protected:
+    topic_id_size_t serial_mapping_{0};
+};
+
+}  // namespace pubsub
+}  // namespace ros2_to_serial_bridge
+
+#endif
@@ -0,0 +1,241 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ROS2_SERIAL_EXAMPLE__SERVICE_BRIDGE_IMPL_HPP_
+#define ROS2_SERIAL_EXAMPLE__SERVICE_BRIDGE_IMPL_HPP_
+
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <rclcpp/rclcpp.hpp>
+
+#include <fastcdr/Cdr.h>
+#include <fastcdr/FastCdr.h>
+#include <fastcdr/exceptions/Exception.h>
+
+#include "ros2_serial_example/async_log.hpp"
+#include "ros2_serial_example/service_bridge.hpp"
+#include "ros2_serial_example/service_correlator.hpp"
+#include "ros2_serial_example/transporter.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace pubsub
+{
+
+/**
+ * The ServiceBridgeImpl class is an implementation of the abstract
+ * ServiceBridge class for the service type S.  One of these objects is
+ * created for each service the user sets up in the bridge configuration
+ * file.
+ *
+ * The service callback doesn't wait for the response: it serializes the
+ * request, writes it to the transport and returns, so the next request can
+ * be sent while the first is still on its way, up to max_in_flight of them.
+ * The response is sent to the client from dispatch() when it comes in,
+ * through the deferred response API of rclcpp, on whichever thread
+ * dispatches the responses.
+ *
+ * A request that gets no response within the timeout is dropped and counted
+ * as a TIMEOUT of the service's serial mapping; ROS 2 services have no way
+ * to return an error, so the client finds out through its own timeout.  A
+ * request that comes in while max_in_flight requests are already waiting is
+ * dropped the same way and counted as a WRITE failure.
+ *
+ * Like SubscriptionImpl, the serialization functions for the request and
+ * response types are template parameters.
+ */
+template<typename S,
+         size_t (*GetSize)(const typename S::Request &, size_t),
+         bool (*Serialize)(const typename S::Request &, eprosima::fastcdr::Cdr &),
+         bool (*Deserialize)(eprosima::fastcdr::Cdr &, typename S::Response &)>
+class ServiceBridgeImpl final : public ServiceBridge
+{
+public:
+    /**
+     * Construct a ServiceBridgeImpl object.
+     *
+     * @param[in] node The rclcpp::Node to create the service on.
+     * @param[in] mapping The serial mapping that the requests are sent and
+     *                    the responses received on.
+     * @param[in] name The name of the service.
+     * @param[in] transporter The transporter to send the requests to.
+     * @param[in] max_in_flight The most requests that may wait for their
+     *                          responses at once.
+     * @param[in] timeout How long a request waits for its response.
+     * @param[in] callback_group The mutually exclusive callback group to put
+     *                           the service in, or nullptr for the node's
+     *                           default callback group.
+     * @throws std::runtime_error If max_in_flight or timeout is 0.
+     */
+    explicit ServiceBridgeImpl(rclcpp::Node * node,
+                               topic_id_size_t mapping,
+                               const std::string & name,
+                               transport::Transporter * transporter,
+                               size_t max_in_flight,
+                               std::chrono::milliseconds timeout,
+                               const std::shared_ptr<rclcpp::CallbackGroup> & callback_group = nullptr)
+        : ServiceBridge(), transporter_(transporter), correlator_(max_in_flight, timeout)
+    {
+        serial_mapping_ = mapping;
+
+        auto callback = [this](const std::shared_ptr<rmw_request_id_t> header,
+                               const std::shared_ptr<typename S::Request> request) -> void
+        {
+            send_request(header, *request);
+        };
+        service_ = node->create_service<S>(name, callback, rmw_qos_profile_services_default, callback_group);
+    }
+
+    /**
+     * Send a response to the client of its request.
+     *
+     * @param[in] data_buffer The payload, the correlation ID followed by the
+     *                        CDR data of the response.
+     * @param[in] length The length of the payload.
+     * @param[in] receive_time The time the payload was received.
+     * @returns true if the response was sent (or dropped because its request
+     *          was already given up on), false if it isn't a valid response.
+     */
+    bool dispatch(uint8_t *data_buffer, ssize_t length, std::chrono::system_clock::time_point receive_time) override
+    {
+        (void)receive_time;
+
+        uint32_t id;
+        if (length < 0 || !Correlator::get_id(data_buffer, static_cast<size_t>(length), &id))
+        {
+            return false;
+        }
+        std::shared_ptr<rmw_request_id_t> header;
+        if (!correlator_.complete(id, &header))
+        {
+            transporter_->get_metrics().drop(transport::Metrics::Direction::RX, serial_mapping_,
+                                             transport::Metrics::Drop::STALE);
+            return true;
+        }
+
+        // The responses are only ever dispatched from one thread, so the
+        // response is reused, keeping the capacity of its strings and
+        // sequences.
+        eprosima::fastcdr::FastBuffer cdrbuffer(reinterpret_cast<char *>(data_buffer + Correlator::ID_LEN),
+                                                static_cast<size_t>(length) - Correlator::ID_LEN);
+        eprosima::fastcdr::Cdr cdrdes(cdrbuffer);
+        try
+        {
+            Deserialize(cdrdes, response_);
+        }
+        catch(const eprosima::fastcdr::exception::Exception & err)
+        {
+            return false;
+        }
+
+        try
+        {
+            service_->send_response(*header, response_);
+        }
+        catch(const rclcpp::exceptions::RCLError & err)
+        {
+            // The client most likely went away in the meantime.
+            ROS2_SERIAL_LOG(WARN, "Failed to send the response for service %u: %s",
+                            static_cast<unsigned int>(serial_mapping_), err.what());
+        }
+
+        return true;
+    }
+
+    size_t expire(std::chrono::steady_clock::time_point now) override
+    {
+        expired_.clear();
+        size_t count = correlator_.expire(now, &expired_);
+        for (size_t i = 0; i < count; ++i)
+        {
+            transporter_->get_metrics().drop(transport::Metrics::Direction::TX, serial_mapping_,
+                                             transport::Metrics::Drop::TIMEOUT);
+        }
+        if (count > 0)
+        {
+            ROS2_SERIAL_LOG(WARN, "%zu request(s) for service %u got no response in time", count,
+                            static_cast<unsigned int>(serial_mapping_));
+        }
+        expired_.clear();
+
+        return count;
+    }
+
+    size_t in_flight() const override
+    {
+        return correlator_.in_flight();
+    }
+
+private:
+    using Correlator = transport::ServiceCorrelator<std::shared_ptr<rmw_request_id_t>>;
+
+    void send_request(const std::shared_ptr<rmw_request_id_t> & header, const typename S::Request & request)
+    {
+        uint32_t id;
+        if (!correlator_.begin(header, Correlator::Clock::now(), &id))
+        {
+            transporter_->get_metrics().drop(transport::Metrics::Direction::TX, serial_mapping_,
+                                             transport::Metrics::Drop::WRITE);
+            ROS2_SERIAL_LOG(WARN, "Dropping a request for service %u, which already has %zu waiting",
+                            static_cast<unsigned int>(serial_mapping_), correlator_.in_flight());
+            return;
+        }
+
+        // The service is in a mutually exclusive callback group, so one
+        // buffer is enough; it keeps its capacity between requests.
+        transport::Metrics & metrics = transporter_->get_metrics();
+        transport::Metrics::Clock::time_point start = metrics.now();
+        size_t serialized_size = Correlator::ID_LEN + GetSize(request, 0);
+        if (buffer_.size() < serialized_size)
+        {
+            buffer_.resize(serialized_size);
+        }
+        Correlator::put_id(buffer_.data(), id);
+        eprosima::fastcdr::FastBuffer cdrbuffer(reinterpret_cast<char *>(buffer_.data() + Correlator::ID_LEN),
+                                                buffer_.size() - Correlator::ID_LEN);
+        eprosima::fastcdr::Cdr scdr(cdrbuffer);
+        Serialize(request, scdr);
+        size_t length = Correlator::ID_LEN + scdr.getSerializedDataLength();
+        metrics.record(transport::Metrics::Stage::SERIALIZE, start, metrics.now());
+
+        if (transporter_->write(serial_mapping_, buffer_.data(), length) < 0)
+        {
+            // The response can't come, so don't wait for it.
+            std::shared_ptr<rmw_request_id_t> unused;
+            correlator_.complete(id, &unused);
+            ROS2_SERIAL_LOG(WARN, "Failed to write a request for service %u: %s",
+                            static_cast<unsigned int>(serial_mapping_), ::strerror(errno));
+        }
+    }
+
+    transport::Transporter * transporter_;
+    Correlator correlator_;
+    std::vector<uint8_t> buffer_;
+    typename S::Response response_;
+    std::vector<std::shared_ptr<rmw_request_id_t>> expired_;
+    std::shared_ptr<rclcpp::Service<S>> service_;
+};
+
+}  // namespace pubsub
+}  // namespace ros2_to_serial_bridge
+
+#endif
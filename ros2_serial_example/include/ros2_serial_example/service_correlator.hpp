@@ -0,0 +1,264 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ROS2_SERIAL_EXAMPLE__SERVICE_CORRELATOR_HPP_
+#define ROS2_SERIAL_EXAMPLE__SERVICE_CORRELATOR_HPP_
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+/**
+ * The ServiceCorrelator class keeps track of the requests of a service that
+ * were sent over the serial link and are waiting for their responses.
+ *
+ * Each request is given a correlation ID, which goes in front of its CDR data
+ * in the payload, and which the other end puts in front of the response.
+ * Several requests may be outstanding at once, up to max_in_flight, and the
+ * responses may come back in any order; each is matched to its request by
+ * its ID.  A request that gets no response within the timeout is given up
+ * on, and a response that comes in after that is ignored.
+ *
+ * The context of each request (for a ROS 2 service, the header to send the
+ * response with) is kept until the request is completed or expires.  All of
+ * the methods may be called from any thread.
+ */
+template<typename T>
+class ServiceCorrelator final
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    /// The length of the correlation ID in front of each payload.
+    static constexpr size_t ID_LEN = 4;
+
+    /**
+     * Construct a ServiceCorrelator.
+     *
+     * @param[in] max_in_flight The most requests that may wait for their
+     *                          responses at once.
+     * @param[in] timeout How long a request waits for its response.
+     * @throws std::runtime_error If max_in_flight or timeout is 0.
+     */
+    ServiceCorrelator(size_t max_in_flight, std::chrono::milliseconds timeout)
+        : max_in_flight_(max_in_flight), timeout_(timeout)
+    {
+        if (max_in_flight == 0)
+        {
+            throw std::runtime_error("A service needs at least 1 request in flight");
+        }
+        if (timeout.count() <= 0)
+        {
+            throw std::runtime_error("A service needs a timeout greater than 0");
+        }
+    }
+
+    ServiceCorrelator(ServiceCorrelator const &) = delete;
+    ServiceCorrelator& operator=(ServiceCorrelator const &) = delete;
+    ServiceCorrelator(ServiceCorrelator &&) = delete;
+    ServiceCorrelator& operator=(ServiceCorrelator &&) = delete;
+
+    /**
+     * Start a request.
+     *
+     * @param[in] context What to hand back when the request completes or
+     *                    expires.
+     * @param[in] now The time the request is sent.
+     * @param[out] id The correlation ID of the request, which is never 0.
+     * @returns true if the request was started, false if max_in_flight
+     *          requests are already waiting.
+     */
+    bool begin(T context, Clock::time_point now, uint32_t *id)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if (requests_.size() >= max_in_flight_)
+        {
+            return false;
+        }
+
+        // The IDs only wrap around after 2^32 requests, by which time the
+        // request that had the ID before is long gone, but skip any that is
+        // still in use anyway.
+        do
+        {
+            next_id_++;
+            if (next_id_ == 0)
+            {
+                next_id_ = 1;
+            }
+        } while (requests_.count(next_id_) != 0);
+
+        requests_.emplace(next_id_, Request{std::move(context), now + timeout_});
+        *id = next_id_;
+
+        return true;
+    }
+
+    /**
+     * Finish a request, because its response came in or it couldn't be sent.
+     *
+     * @param[in] id The correlation ID of the request.
+     * @param[out] context The context the request was started with.
+     * @returns true if the request was waiting, false if there is no request
+     *          with the ID (it already expired, or the ID is bogus).
+     */
+    bool complete(uint32_t id, T *context)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        auto it = requests_.find(id);
+        if (it == requests_.end())
+        {
+            return false;
+        }
+        *context = std::move(it->second.context);
+        requests_.erase(it);
+
+        return true;
+    }
+
+    /**
+     * Give up on the requests whose timeout has passed.
+     *
+     * @param[in] now The current time.
+     * @param[out] expired The contexts of the requests given up on are added
+     *                     to the end of this.
+     * @returns The number of requests given up on.
+     */
+    size_t expire(Clock::time_point now, std::vector<T> *expired)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        size_t count = 0;
+        for (auto it = requests_.begin(); it != requests_.end();)
+        {
+            if (it->second.deadline <= now)
+            {
+                expired->push_back(std::move(it->second.context));
+                it = requests_.erase(it);
+                count++;
+            }
+            else
+            {
+                ++it;
+            }
+        }
+
+        return count;
+    }
+
+    /**
+     * Get the time the next request expires.
+     *
+     * @returns The earliest deadline of the waiting requests, or
+     *          Clock::time_point::max() if none is waiting.
+     */
+    Clock::time_point next_deadline() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        Clock::time_point deadline = Clock::time_point::max();
+        for (const auto & r : requests_)
+        {
+            if (r.second.deadline < deadline)
+            {
+                deadline = r.second.deadline;
+            }
+        }
+
+        return deadline;
+    }
+
+    /**
+     * Get the number of requests waiting for their responses.
+     *
+     * @returns The number of requests.
+     */
+    size_t in_flight() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        return requests_.size();
+    }
+
+    /**
+     * Put a correlation ID in front of a payload, most significant byte
+     * first.
+     *
+     * @param[out] buf Where to put the ID; this must have room for ID_LEN
+     *                 bytes.
+     * @param[in] id The correlation ID.
+     */
+    static void put_id(uint8_t *buf, uint32_t id)
+    {
+        buf[0] = static_cast<uint8_t>(id >> 24U);
+        buf[1] = static_cast<uint8_t>(id >> 16U);
+        buf[2] = static_cast<uint8_t>(id >> 8U);
+        buf[3] = static_cast<uint8_t>(id);
+    }
+
+    /**
+     * Take the correlation ID off the front of a payload.
+     *
+     * @param[in] buf The payload.
+     * @param[in] len The length of the payload.
+     * @param[out] id The correlation ID.
+     * @returns true on success, false if the payload is too short to have
+     *          one.
+     */
+    static bool get_id(const uint8_t *buf, size_t len, uint32_t *id)
+    {
+        if (len < ID_LEN)
+        {
+            return false;
+        }
+        *id = (static_cast<uint32_t>(buf[0]) << 24U) | (static_cast<uint32_t>(buf[1]) << 16U) |
+              (static_cast<uint32_t>(buf[2]) << 8U) | buf[3];
+
+        return true;
+    }
+
+private:
+    struct Request final
+    {
+        T context;
+        Clock::time_point deadline;
+    };
+
+    const size_t max_in_flight_;
+    const std::chrono::milliseconds timeout_;
+    mutable std::mutex mutex_;
+    std::map<uint32_t, Request> requests_;
+    uint32_t next_id_{0};
+};
+
+template<typename T>
+constexpr size_t ServiceCorrelator<T>::ID_LEN;
+
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
+
+#endif
@@ -0,0 +1,272 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ROS2_SERIAL_EXAMPLE__SHARDED_TRANSPORTER_HPP_
+#define ROS2_SERIAL_EXAMPLE__SHARDED_TRANSPORTER_HPP_
+
+// C++ includes
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Local includes
+#include "ros2_serial_example/spsc_ring_buffer.hpp"
+#include "ros2_serial_example/topic_id.hpp"
+#include "ros2_serial_example/transporter.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+/**
+ * The ShardedTransporter class is an implementation of the abstract
+ * Transporter class that receives through several transporters at once,
+ * each read by a thread of its own, for instance UDP sockets sharing one
+ * port with SO_REUSEPORT (see UDPTransporter::set_reuse_port()).
+ *
+ * Each shard thread reads, unframes and checks what comes in on its shard,
+ * the same as the read thread would, and queues the messages in a lock-free
+ * queue of its own, from which the thread that reads the ShardedTransporter
+ * takes them.  get_read_fd() becomes readable when any of the queues has
+ * something in it.  When the senders are spread over the shards, as the
+ * kernel does for UDP, receiving scales with the number of cores rather
+ * than being limited to the one the read thread is on.
+ *
+ * Everything is written through the first shard, framed once by the
+ * ShardedTransporter.  Anything that keeps state between frames is kept per
+ * shard, as it is for the links of a BondedTransporter: reliable topics,
+ * compression dictionaries and the reassembly of fragments work as long as
+ * each sender sticks to one shard.  A message that comes in while the queue
+ * of its shard is full is dropped, and counted (see get_shard_stats()).
+ */
+class ShardedTransporter final : public Transporter
+{
+public:
+    /// The largest number of shards.
+    static constexpr size_t MAX_SHARDS = 64;
+
+    /// A snapshot of the counters of a shard.
+    struct ShardStats final
+    {
+        uint64_t rx_messages{0};
+        uint64_t overflows{0};
+    };
+
+    /**
+     * Construct a ShardedTransporter object over the given shards.
+     *
+     * @param[in] protocol The backend protocol to use; must be the same as
+     *                     that of every shard.
+     * @param[in] shards The shards, which must not be initialized yet; the
+     *                   ShardedTransporter takes care of that.
+     * @param[in] read_poll_ms The amount of time to wait for a message from
+     *                         any of the shards before timing out.
+     * @param[in] ring_buffer_size The number of bytes to allocate to the
+     *                             underlying ring buffer, and to the buffer
+     *                             each shard thread reads messages into;
+     *                             the shards each have their own ring.
+     * @param[in] queue_bytes The size of the queue of each shard, in bytes.
+     * @throws std::runtime_error If there are no shards or more than
+     *         MAX_SHARDS, or a shard is a nullptr or uses another protocol.
+     */
+    ShardedTransporter(const std::string & protocol,
+                       std::vector<std::unique_ptr<Transporter>> shards,
+                       uint32_t read_poll_ms,
+                       size_t ring_buffer_size,
+                       size_t queue_bytes);
+    ~ShardedTransporter() override;
+
+    ShardedTransporter(ShardedTransporter const &) = delete;
+    ShardedTransporter& operator=(ShardedTransporter const &) = delete;
+    ShardedTransporter(ShardedTransporter &&) = delete;
+    ShardedTransporter& operator=(ShardedTransporter &&) = delete;
+
+    /**
+     * Pin the shard threads to CPUs, one each, so that each shard is
+     * received on a core of its own.  This must be called before init().
+     *
+     * @param[in] cpus The CPU of each shard, in the order the shards were
+     *                 given; the shards past the end of the list may run on
+     *                 any CPU.
+     * @returns 0 on success, or -1 if a CPU is negative or the transporter
+     *          has already been initialized.
+     */
+    int set_shard_cpus(const std::vector<int64_t> & cpus);
+
+    /**
+     * Initialize every shard, and start a thread for each.
+     *
+     * This method is an override of the one provided by the Transporter
+     * class.
+     *
+     * @returns 0 on success, -1 on error.
+     */
+    int init() override;
+
+    /**
+     * Stop the shard threads and close every shard.
+     *
+     * This method is an override of the one provided by the Transporter
+     * class and undoes the steps that the init() method does.
+     *
+     * @returns 0 on success, -1 on error.
+     */
+    int close() override;
+
+    /**
+     * Get a file descriptor that becomes readable when a shard has queued
+     * messages.
+     *
+     * @returns The eventfd the shard threads signal, or -1 if the
+     *          transporter isn't initialized.
+     */
+    int get_read_fd() const override;
+
+    /**
+     * Get the number of bytes the first shard, which does the writing, has
+     * yet to send.
+     *
+     * @returns The number of bytes, or -1 if the shard doesn't know.
+     */
+    ssize_t get_write_queue_bytes() const override;
+
+    /**
+     * Get the number of shards.
+     *
+     * @returns The number of shards.
+     */
+    size_t get_shard_count() const
+    {
+        return shards_.size();
+    }
+
+    /**
+     * Get the counters of a shard.  This may be called from any thread.
+     *
+     * @param[in] shard The index of the shard, in the order they were given.
+     * @returns The counters of the shard, or all zeroes if there is no such
+     *          shard.
+     */
+    ShardStats get_shard_stats(size_t shard) const;
+
+    /**
+     * Change how long a read waits for a message to be queued.  The shard
+     * threads keep waiting as long as their own shards do.
+     *
+     * This must only be called from the thread that reads.
+     *
+     * @param[in] read_poll_ms The time to wait in milliseconds.
+     * @returns 0.
+     */
+    int set_read_poll_ms(uint32_t read_poll_ms) override
+    {
+        read_poll_ms_ = read_poll_ms;
+        return 0;
+    }
+
+private:
+    struct Shard final
+    {
+        explicit Shard(size_t queue_bytes) : queue(queue_bytes) {}
+
+        std::unique_ptr<Transporter> transporter;
+        // The messages read by the shard thread, each as a QueuedHeader and
+        // its payload.
+        impl::SPSCRingBuffer queue;
+        std::thread thread;
+        std::atomic<uint64_t> rx_messages{0};
+    };
+
+    /**
+     * Not used; the messages come from the shards through
+     * node_read_message() and node_read_messages().
+     *
+     * @returns -1 with errno set to ENOTSUP.
+     */
+    ssize_t node_read() override;
+
+    /**
+     * Write a frame to the first shard.
+     *
+     * @params[in] buffer The buffer containing the frame.
+     * @params[in] len The length of the frame.
+     * @returns len on success, or -1 on error.
+     */
+    ssize_t node_write(void *buffer, size_t len) override;
+
+    /**
+     * Write a frame to the first shard.
+     *
+     * @params[in] iov The buffers containing the frame.
+     * @params[in] iovcnt The number of buffers in iov.
+     * @returns The length of the frame on success, or -1 on error.
+     */
+    ssize_t node_writev(const struct iovec *iov, int iovcnt) override;
+
+    /**
+     * Take the next queued message, taking the shards in turn.
+     */
+    ssize_t node_read_message(topic_id_size_t *topic_ID, uint8_t *out_buffer, size_t buffer_len) override;
+
+    /**
+     * Take every queued message, waiting up to read_poll_ms for one if none
+     * is queued.
+     */
+    ssize_t node_read_messages(uint8_t *out_buffer, size_t buffer_len, const MessageVisitor & visitor) override;
+
+    /**
+     * Detect whether the shards were initialized.
+     *
+     * @returns true if init() succeeded and close() hasn't been called,
+     *          false otherwise.
+     */
+    bool fds_OK() override;
+
+    /**
+     * Read a shard until close() is called, queueing what comes in.
+     *
+     * @param[in] shard The shard.
+     */
+    void shard_thread_func(Shard * shard);
+
+    /**
+     * Take the next message queued by a shard.
+     *
+     * @param[out] taken The number of bytes taken off the queue.
+     * @returns The length of the message, -ENODATA if nothing is queued, or
+     *          -ENOBUFS if the message didn't fit in out_buffer, in which
+     *          case it is dropped.
+     */
+    ssize_t take(Shard & shard, topic_id_size_t *topic_ID, uint8_t *out_buffer, size_t buffer_len, size_t *taken);
+
+    std::vector<std::unique_ptr<Shard>> shards_;
+    std::vector<int64_t> cpus_;
+    uint32_t read_poll_ms_{0};
+    size_t ring_buffer_size_{0};
+    int notify_fd_{-1};
+    std::atomic<bool> stopping_{false};
+    bool initialized_{false};
+    size_t next_shard_{0};
+};
+
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
+
+#endif
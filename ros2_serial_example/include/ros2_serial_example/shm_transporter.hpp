@@ -0,0 +1,190 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef ROS2_SERIAL_EXAMPLE__SHM_TRANSPORTER_HPP_
+#define ROS2_SERIAL_EXAMPLE__SHM_TRANSPORTER_HPP_
+
+// C++ includes
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Local includes
+#include "ros2_serial_example/transporter.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+namespace impl
+{
+
+struct ShmRing;
+
+}  // namespace impl
+
+/**
+ * The ShmTransporter class is an implementation of the abstract Transporter
+ * class for talking to another process on the same machine through shared
+ * memory.
+ *
+ * The two processes share a POSIX shared memory segment containing a pair of
+ * single-producer, single-consumer byte rings, one for each direction.  The
+ * framing is the same as on any other transport; only the bytes move through
+ * memory rather than through a device or socket.  A side that finds a ring
+ * empty (or full) sleeps on a futex in the segment, and the other side only
+ * makes the wakeup system call if somebody is actually sleeping.
+ *
+ * One side creates the segment and the other attaches to it; the creating
+ * side has to be initialized first.
+ */
+class ShmTransporter final : public Transporter
+{
+public:
+    /// Whether this side creates the shared memory segment or attaches to it.
+    enum class Role
+    {
+        CREATE,
+        ATTACH,
+    };
+
+    /**
+     * Construct a ShmTransporter object with the given shared memory parameters.
+     *
+     * @param[in] protocol The backend protocol to use; see Transporter docs for
+     *                     more information about supported protocols.
+     * @param[in] shm_name The name of the POSIX shared memory segment, which
+     *                     must start with a '/' (for instance,
+     *                     "/ros2_serial_bridge").
+     * @param[in] role Whether to create the segment or attach to it.
+     * @param[in] shm_ring_size The number of bytes in each direction's ring
+     *                          when creating the segment; when attaching,
+     *                          the size is taken from the segment.
+     * @param[in] read_poll_ms The amount of time to wait for data to come in
+     *                         before timing out.
+     * @param[in] ring_buffer_size The number of bytes to allocate to the
+     *                             underlying ring buffer that is used to
+     *                             accept data from the shared memory.
+     * @throws std::runtime_error If shm_name or shm_ring_size is invalid.
+     */
+    ShmTransporter(const std::string & protocol,
+                   const std::string & shm_name,
+                   Role role,
+                   size_t shm_ring_size,
+                   uint32_t read_poll_ms,
+                   size_t ring_buffer_size);
+    ~ShmTransporter() override;
+
+    ShmTransporter(ShmTransporter const &) = delete;
+    ShmTransporter& operator=(ShmTransporter const &) = delete;
+    ShmTransporter(ShmTransporter &&) = delete;
+    ShmTransporter& operator=(ShmTransporter &&) = delete;
+
+    /**
+     * Do shared memory specific initialization.
+     *
+     * This method is an override of the one provided by the Transporter class
+     * and creates (or attaches to) and maps the shared memory segment.
+     *
+     * @returns 0 on success, -1 on error.
+     */
+    int init() override;
+
+    /**
+     * Do shared memory specific de-initialization.
+     *
+     * This method is an override of the one provided by the Transporter class
+     * and undoes the steps that the init() method does.  The creating side
+     * also removes the segment name.
+     *
+     * @returns 0 on success, -1 on error.
+     */
+    int close() override;
+
+    /**
+     * Get the number of bytes in the transmit ring that the other side
+     * hasn't read yet.
+     *
+     * @returns The number of bytes waiting to be read, or -1 if the shared
+     *          memory segment isn't mapped.
+     */
+    ssize_t get_write_queue_bytes() const override;
+
+    /**
+     * Change how long a read waits for data to come in.
+     *
+     * This must only be called from the thread that reads.
+     *
+     * @param[in] read_poll_ms The time to wait in milliseconds.
+     * @returns 0.
+     */
+    int set_read_poll_ms(uint32_t read_poll_ms) override
+    {
+        read_poll_ms_ = read_poll_ms;
+        return 0;
+    }
+
+private:
+    /**
+     * Copy data from the receive ring in shared memory into the ring buffer.
+     *
+     * This method is an override of the abstract one in the Transporter class.
+     * If the receive ring is empty, it sleeps until the other side writes
+     * something or until read_poll_ms passes, in which case it returns 0.
+     */
+    ssize_t node_read() override;
+
+    /**
+     * Write data to the transmit ring in shared memory.
+     *
+     * This method is an override of the abstract one in the Transporter class.
+     * If the ring is full, it waits for the other side to make room.  If no
+     * room is made within the write timeout (see
+     * Transporter::set_write_timeout()), it gives up and fails with errno set
+     * to EBUSY.
+     *
+     * @params[in] buffer The buffer containing the data to write.
+     * @params[in] len The number of bytes in the buffer to write.
+     * @returns The number of bytes written on success (which must be equal to
+     *          len), or -1 on error.
+     */
+    ssize_t node_write(void *buffer, size_t len) override;
+
+    /**
+     * Detect whether the shared memory segment is mapped.
+     *
+     * @returns true if the shared memory segment is mapped, false otherwise.
+     */
+    bool fds_OK() override;
+
+    std::string shm_name_;
+    Role role_;
+    size_t shm_ring_size_;
+    uint32_t read_poll_ms_{0};
+    int shm_fd_{-1};
+    void *segment_{nullptr};
+    size_t segment_size_{0};
+    impl::ShmRing *tx_ring_{nullptr};
+    impl::ShmRing *rx_ring_{nullptr};
+    uint8_t *tx_data_{nullptr};
+    uint8_t *rx_data_{nullptr};
+};
+
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
+
+#endif
@@ -0,0 +1,146 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ROS2_SERIAL_EXAMPLE__SIM_LOCKSTEP_HPP_
+#define ROS2_SERIAL_EXAMPLE__SIM_LOCKSTEP_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+/**
+ * The SimLockstep class keeps track of the steps of a simulator that runs
+ * in lockstep with the bridge (see ros2_serial_msgs/SimStep).
+ *
+ * The simulator sends the frames of each step followed by a STEP, and waits
+ * for the ACK of the step before it goes on, so it runs exactly as fast as
+ * the bridge gets through its frames: faster than real time if the bridge
+ * can keep up, and never so fast that the bridge falls behind.  A STEP that
+ * is sent again because its ACK was lost is told apart from a new one, so
+ * that the simulated time isn't published twice.
+ *
+ * step() must be called from one thread at a time; the other methods may be
+ * called from any thread.
+ */
+class SimLockstep final
+{
+public:
+    /// The kinds of SimStep message.
+    static constexpr uint8_t STEP = 6;
+    static constexpr uint8_t ACK = 7;
+
+    /// The CDR size of a SimStep: the kind, padding up to 8 bytes, the step
+    /// and the simulated time.
+    static constexpr size_t MESSAGE_SIZE = 24;
+
+    SimLockstep() {}
+
+    SimLockstep(SimLockstep const &) = delete;
+    SimLockstep& operator=(SimLockstep const &) = delete;
+    SimLockstep(SimLockstep &&) = delete;
+    SimLockstep& operator=(SimLockstep &&) = delete;
+
+    /**
+     * Serialize a SimStep as bare CDR in the byte order of the host, the way
+     * the bridge sends and expects its topic 0 messages.
+     *
+     * @param[in] kind STEP or ACK.
+     * @param[in] step The number of the step.
+     * @param[in] sim_time_ns The simulated time at the end of the step.
+     * @param[out] buf The buffer to serialize into.
+     * @param[in] len The size of buf.
+     * @returns MESSAGE_SIZE on success, or 0 if buf is too small.
+     */
+    static size_t encode(uint8_t kind, uint64_t step, int64_t sim_time_ns, uint8_t * buf, size_t len);
+
+    /**
+     * Deserialize a SimStep from encode().
+     *
+     * @param[in] buf The payload.
+     * @param[in] len The length of the payload.
+     * @param[out] kind The kind of the message.
+     * @param[out] step The number of the step.
+     * @param[out] sim_time_ns The simulated time at the end of the step.
+     * @returns true on success, false if the payload is too short or isn't
+     *          a STEP or an ACK.
+     */
+    static bool decode(const uint8_t * buf, size_t len, uint8_t * kind, uint64_t * step, int64_t * sim_time_ns);
+
+    /**
+     * Take a STEP from the simulator.
+     *
+     * @param[in] step The number of the step.
+     * @param[in] sim_time_ns The simulated time at the end of the step.
+     * @param[in] wall_ns The time the STEP was received, in nanoseconds of
+     *                    any steady clock.
+     * @returns true if it is a new step, whose time should be published,
+     *          or false if it is the last step again, which only needs to be
+     *          acknowledged again.
+     */
+    bool step(uint64_t step, int64_t sim_time_ns, int64_t wall_ns);
+
+    /**
+     * Get the number of steps taken.
+     *
+     * @returns The number of new steps.
+     */
+    uint64_t get_steps() const;
+
+    /**
+     * Get the number of STEPs that were sent again.
+     *
+     * @returns The number of repeated STEPs.
+     */
+    uint64_t get_repeats() const;
+
+    /**
+     * Get the simulated time of the last step.
+     *
+     * @returns The simulated time in nanoseconds, or 0 before the first step.
+     */
+    int64_t get_sim_time_ns() const;
+
+    /**
+     * Get how much faster than real time the simulation runs, since it
+     * started or last went back in time (which means it was started again).
+     *
+     * @returns The simulated time passed divided by the wall time passed, or
+     *          0 until there are two steps.
+     */
+    double get_real_time_factor() const;
+
+private:
+    mutable std::mutex mutex_;
+    bool stepped_{false};
+    uint64_t last_step_{0};
+    int64_t sim_time_ns_{0};
+    int64_t wall_ns_{0};
+    // The simulated and wall time of the step the real time factor is
+    // measured from.
+    int64_t start_sim_ns_{0};
+    int64_t start_wall_ns_{0};
+    uint64_t steps_{0};
+    uint64_t repeats_{0};
+};
+
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
+
+#endif
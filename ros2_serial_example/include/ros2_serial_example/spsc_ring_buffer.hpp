@@ -0,0 +1,254 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef ROS2_SERIAL_EXAMPLE__SPSC_RING_BUFFER_HPP_
+#define ROS2_SERIAL_EXAMPLE__SPSC_RING_BUFFER_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+namespace impl
+{
+
+/**
+ * The SPSCRingBuffer class is a ring buffer that one producer thread can fill
+ * while one consumer thread drains it, without any locks.
+ *
+ * Unlike RingBuffer, this never overwrites data that hasn't been consumed
+ * yet: if there isn't enough free space, writes fail (and are counted as
+ * overflows) instead of throwing away the oldest data, so the consumer never
+ * sees a corrupted stream.
+ *
+ * The head and tail are free-running byte counts, each written only by one
+ * side (the head by the producer, the tail by the consumer) and kept on their
+ * own cache lines.  Each side also keeps a cached copy of the other side's
+ * position, so it only has to touch the other side's cache line when the
+ * cached copy says the ring is full (or empty).
+ *
+ * The producer side is reserve_write()/commit_write(), write() and read(fd);
+ * the consumer side is peek_contiguous(), peek_spans(), consume() and
+ * memcpy_from().  The spans handed out by reserve_write() and the peek
+ * methods point straight into the ring, so data can be produced and parsed in
+ * place.
+ */
+class SPSCRingBuffer final
+{
+public:
+    /**
+     * Construct an SPSCRingBuffer.
+     *
+     * @param[in] capacity The number of bytes the ring can hold.
+     * @throws std::runtime_error If capacity is 0.
+     */
+    explicit SPSCRingBuffer(size_t capacity);
+
+    SPSCRingBuffer(SPSCRingBuffer const &) = delete;
+    SPSCRingBuffer& operator=(SPSCRingBuffer const &) = delete;
+    SPSCRingBuffer(SPSCRingBuffer &&) = delete;
+    SPSCRingBuffer& operator=(SPSCRingBuffer &&) = delete;
+
+    /**
+     * Get the contiguous free space at the head of the ring (producer only).
+     *
+     * The free space may wrap around the end of the ring, in which case this
+     * only returns the part up to the end; after committing it, the next call
+     * returns the rest.
+     *
+     * @param[out] len The number of contiguous bytes that can be written.
+     * @returns A pointer to the free space, which is only valid until the
+     *          next call to commit_write(), or a nullptr if the ring is full.
+     */
+    uint8_t *reserve_write(size_t *len);
+
+    /**
+     * Make data written into the space from reserve_write() visible to the
+     * consumer (producer only).
+     *
+     * @param[in] count The number of bytes that were written.
+     * @returns count on success, or -1 if count is larger than the free space.
+     */
+    ssize_t commit_write(size_t count);
+
+    /**
+     * Copy data from a linear buffer into the ring (producer only).
+     *
+     * The data is either copied in completely, wrapping around the end of the
+     * ring if needed, or not at all.
+     *
+     * @param[in] src The buffer to copy data from.
+     * @param[in] count The number of bytes in src.
+     * @returns count on success, or -1 on error.  If there isn't enough free
+     *          space, errno is set to ENOBUFS and the overflow is counted.
+     */
+    ssize_t write(const void *src, size_t count);
+
+    /**
+     * Copy data from several linear buffers into the ring (producer only).
+     *
+     * This works like write(), but the buffers are only made visible to the
+     * consumer together, so a header and its payload can be written without
+     * first copying them next to each other.
+     *
+     * @param[in] iov The buffers to copy data from.
+     * @param[in] iovcnt The number of buffers in iov.
+     * @returns The total number of bytes on success, or -1 on error.  If there
+     *          isn't enough free space for all of the buffers, nothing is
+     *          written, errno is set to ENOBUFS and the overflow is counted.
+     */
+    ssize_t writev(const struct iovec *iov, int iovcnt);
+
+    /**
+     * Read data from a file descriptor directly into the ring (producer only).
+     *
+     * Both parts of the free space are filled with a single readv(), so a read
+     * that wraps around the end of the ring still only takes one system call.
+     *
+     * @param[in] fd The file descriptor to read out of; this should be
+     *               non-blocking.
+     * @returns The number of bytes read on success (0 at end of file), or -1
+     *          on error.  If the ring is full, nothing is read, errno is set
+     *          to ENOBUFS and the overflow is counted.
+     */
+    ssize_t read(int fd);
+
+    /**
+     * Get the contiguous data at the tail of the ring (consumer only).
+     *
+     * The data may wrap around the end of the ring, in which case this only
+     * returns the part up to the end; after consuming it, the next call
+     * returns the rest.
+     *
+     * @param[out] len The number of contiguous bytes available.
+     * @returns A pointer to the data, which is only valid until the next call
+     *          to consume() or memcpy_from(), or a nullptr if the ring is
+     *          empty.
+     */
+    const uint8_t *peek_contiguous(size_t *len);
+
+    /**
+     * Get direct pointers to the data at the tail of the ring (consumer only).
+     *
+     * This works like RingBuffer::peek_spans(): the data is returned as up to
+     * two contiguous spans, the second of which is empty (nullptr and 0) if
+     * the data does not wrap.
+     *
+     * @param[in] count The number of bytes to get spans for.
+     * @param[out] first The start of the first span.
+     * @param[out] first_len The number of bytes in the first span.
+     * @param[out] second The start of the second span.
+     * @param[out] second_len The number of bytes in the second span.
+     * @returns count on success, or -1 if the ring doesn't contain at least
+     *          count bytes.
+     */
+    ssize_t peek_spans(size_t count, const uint8_t **first, size_t *first_len,
+                       const uint8_t **second, size_t *second_len);
+
+    /**
+     * Remove data from the tail of the ring, handing the space back to the
+     * producer (consumer only).
+     *
+     * @param[in] count The number of bytes to remove.
+     * @returns count on success, or -1 if the ring doesn't contain at least
+     *          count bytes.
+     */
+    ssize_t consume(size_t count);
+
+    /**
+     * Copy data out of the ring into a linear buffer and remove it (consumer
+     * only).
+     *
+     * @param[out] dst The destination buffer; this should be at least as
+     *                 large as count.
+     * @param[in] count The number of bytes to copy out.
+     * @returns count on success, or -1 if dst is a nullptr, count is 0, or the
+     *          ring doesn't contain at least count bytes.
+     */
+    ssize_t memcpy_from(void *dst, size_t count);
+
+    /**
+     * Get the number of bytes in the ring.  This is exact when called from
+     * the consumer, and a lower bound when called from anywhere else.
+     *
+     * @returns The number of bytes in the ring.
+     */
+    size_t bytes_used() const;
+
+    /**
+     * Get the number of bytes free in the ring.  This is exact when called
+     * from the producer, and a lower bound when called from anywhere else.
+     *
+     * @returns The number of bytes free in the ring.
+     */
+    size_t bytes_free() const;
+
+    /**
+     * Get the number of bytes the ring can hold.
+     *
+     * @returns The capacity of the ring.
+     */
+    size_t capacity() const
+    {
+        return size_;
+    }
+
+    /**
+     * Get the number of writes and reads that failed because the ring was
+     * full.
+     *
+     * @returns The number of overflows so far.
+     */
+    uint64_t get_overflows() const
+    {
+        return overflows_;
+    }
+
+private:
+    // The number of bytes free as far as the producer knows, refreshing its
+    // copy of the tail if that isn't at least count.
+    size_t producer_free(size_t count);
+
+    // The number of bytes used as far as the consumer knows, refreshing its
+    // copy of the head if that isn't at least count.
+    size_t consumer_used(size_t count);
+
+    std::unique_ptr<uint8_t[]> buf_;
+    size_t size_;
+    std::atomic<uint64_t> overflows_{0};
+
+    // Written by the producer.
+    alignas(64) std::atomic<size_t> head_{0};
+    size_t cached_tail_{0};
+
+    // Written by the consumer.
+    alignas(64) std::atomic<size_t> tail_{0};
+    size_t cached_head_{0};
+};
+
+}  // namespace impl
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
+
+#endif
@@ -0,0 +1,228 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ROS2_SERIAL_EXAMPLE__STRING_INTERNER_HPP_
+#define ROS2_SERIAL_EXAMPLE__STRING_INTERNER_HPP_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace ros2_to_serial_bridge
+{
+
+namespace pubsub
+{
+
+/**
+ * String interning for the packed messages of topics with intern_strings
+ * set (see packed_encoding.hpp).
+ *
+ * Many messages carry strings that rarely change, like the frame_id of a
+ * std_msgs/Header, which CDR sends in full in every message.  Interned, each
+ * string is a token instead:
+ *
+ *     varint 0, varint length, octets               a literal string
+ *     varint 1, varint slot, varint length, octets  the string of a slot
+ *     varint slot + 2                               the string of a slot again
+ *
+ * so a string that was sent before takes a single octet.  The sender keeps
+ * the last TABLE_SIZE strings it sent in its slots, evicting the least
+ * recently used one to make room, and the receiver keeps its own copy of
+ * the slots in an InternTable, filled in from the definitions.  Strings
+ * longer than MAX_STRING_LENGTH are always sent as literals, as are all of
+ * the strings of topics that are packed without interning.
+ *
+ * Each payload starts with the session of the sender, an octet picked at
+ * random when it starts, and the varint number of definitions it sent
+ * before the payload.  A receiver that sees a session or a number it didn't
+ * expect has missed a definition (or the sender started over), so it
+ * forgets every slot, and a reference to a slot it doesn't know fails to
+ * decode.  To recover from that, every REFRESH_INTERVAL payloads the sender
+ * defines each slot again the first time it uses it.
+ */
+
+/**
+ * The sending side of a topic with interned strings.
+ */
+class StringInterner final
+{
+public:
+    /// The number of slots, which the receiver has as many of.
+    static constexpr size_t TABLE_SIZE = 64;
+    /// Longer strings are sent as literals, not interned.
+    static constexpr size_t MAX_STRING_LENGTH = 255;
+    /// How many payloads go by between each time the slots are defined
+    /// again.
+    static constexpr uint32_t REFRESH_INTERVAL = 100;
+    /// The first varint of each kind of token; a reference is the slot plus
+    /// TOKEN_FIRST_SLOT.
+    static constexpr uint64_t TOKEN_LITERAL = 0;
+    static constexpr uint64_t TOKEN_DEFINITION = 1;
+    static constexpr uint64_t TOKEN_FIRST_SLOT = 2;
+
+    /**
+     * Construct a StringInterner.
+     *
+     * @param[in] session The session octet, which should be picked at random
+     *                    so that a receiver notices that a new sender
+     *                    started.
+     * @param[in] definitions The number of definitions to count from.
+     */
+    explicit StringInterner(uint8_t session, uint32_t definitions = 0);
+
+    StringInterner(StringInterner const &) = delete;
+    StringInterner& operator=(StringInterner const &) = delete;
+    StringInterner(StringInterner &&) = delete;
+    StringInterner& operator=(StringInterner &&) = delete;
+
+    /**
+     * Start a payload, writing its session and number of definitions.
+     *
+     * @param[out] out The payload to append to.
+     */
+    void begin(std::vector<uint8_t> * out);
+
+    /**
+     * Append the token for a string to a payload.
+     *
+     * @param[in] data The string.
+     * @param[in] length The length of the string.
+     * @param[out] out The payload to append to.
+     */
+    void put(const char * data, size_t length, std::vector<uint8_t> * out);
+
+    /**
+     * Append the token for a string that isn't interned to a payload.
+     *
+     * @param[in] data The string.
+     * @param[in] length The length of the string.
+     * @param[out] out The payload to append to.
+     */
+    static void put_literal(const char * data, size_t length, std::vector<uint8_t> * out);
+
+    /**
+     * Get the number of strings that were sent as a reference to a slot.
+     *
+     * @returns The number of references.
+     */
+    uint64_t get_references() const
+    {
+        return references_;
+    }
+
+    /**
+     * Get the number of strings that were sent in full, as a definition or a
+     * literal.
+     *
+     * @returns The number of definitions and literals.
+     */
+    uint64_t get_definitions() const
+    {
+        return total_definitions_ + literals_;
+    }
+
+private:
+    struct Slot final
+    {
+        std::string value;
+        uint32_t hash{0};
+        // When the slot was last used, or 0 if it never was.
+        uint64_t last_used{0};
+        // The refresh the slot was last defined in.
+        uint32_t refresh{0};
+    };
+
+    // Find the slot of a string, or the one to evict for it.
+    size_t find(const char * data, size_t length, uint32_t hash, bool * found) const;
+
+    std::array<Slot, TABLE_SIZE> slots_;
+    uint8_t session_;
+    uint32_t definitions_;
+    uint64_t uses_{0};
+    uint32_t payloads_{0};
+    uint32_t refresh_{0};
+    uint64_t references_{0};
+    uint64_t total_definitions_{0};
+    uint64_t literals_{0};
+};
+
+/**
+ * The receiving side of a topic with interned strings.
+ */
+class InternTable final
+{
+public:
+    InternTable() {}
+
+    InternTable(InternTable const &) = delete;
+    InternTable& operator=(InternTable const &) = delete;
+    InternTable(InternTable &&) = delete;
+    InternTable& operator=(InternTable &&) = delete;
+
+    /**
+     * Start a payload with the session and number of definitions at the
+     * front of it, forgetting every slot if a definition was missed.
+     *
+     * @param[in] session The session of the payload.
+     * @param[in] definitions The number of definitions sent before it.
+     */
+    void begin(uint8_t session, uint32_t definitions);
+
+    /**
+     * Fill in a slot from a definition.
+     *
+     * @param[in] slot The slot, which must be less than TABLE_SIZE.
+     * @param[in] data The string.
+     * @param[in] length The length of the string.
+     */
+    void define(size_t slot, const char * data, size_t length);
+
+    /**
+     * Look up the string of a slot.
+     *
+     * @param[in] slot The slot.
+     * @returns The string, or nullptr if the slot isn't known.
+     */
+    const std::string * lookup(size_t slot) const
+    {
+        return slot < StringInterner::TABLE_SIZE && valid_[slot] ? &values_[slot] : nullptr;
+    }
+
+    /**
+     * Get the number of times the slots were forgotten because a definition
+     * was missed.
+     *
+     * @returns The number of resets.
+     */
+    uint64_t get_resets() const
+    {
+        return resets_;
+    }
+
+private:
+    std::array<std::string, StringInterner::TABLE_SIZE> values_;
+    std::array<bool, StringInterner::TABLE_SIZE> valid_{};
+    bool started_{false};
+    uint8_t session_{0};
+    uint32_t definitions_{0};
+    uint64_t resets_{0};
+};
+
+}  // namespace pubsub
+}  // namespace ros2_to_serial_bridge
+
+#endif
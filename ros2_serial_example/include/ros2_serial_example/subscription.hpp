@@ -15,6 +15,10 @@
 #ifndef ROS2_SERIAL_EXAMPLE__SUBSCRIPTION_HPP_
 #define ROS2_SERIAL_EXAMPLE__SUBSCRIPTION_HPP_
 
+#include <cstddef>
+#include <string>
+#include <vector>
+
 #include "ros2_serial_example/transporter.hpp"
 
 namespace ros2_to_serial_bridge
@@ -55,6 +59,58 @@ public:
         return serial_mapping_;
     }
 
+    /**
+     * Virtual method to allocate everything the subscription needs to send
+     * a message up front, for messages of up to max_size bytes of CDR data.
+     *
+     * Derived classes that reuse their buffers between messages should
+     * override this method.
+     *
+     * @param[in] max_size The largest CDR data that will be sent.
+     * @returns true if sending a message won't allocate after this, false
+     *          otherwise.
+     */
+    virtual bool reserve(size_t max_size) {(void)max_size; return false;}
+
+    /**
+     * Virtual method to send the messages packed, with their strings
+     * interned (see string_interner.hpp), rather than as CDR.  The other end
+     * of the serial link has to decode them the same way.
+     *
+     * Derived classes that serialize messages of a type with strings should
+     * override this method.
+     *
+     * @param[in] enable true to intern the strings, false to send CDR.
+     * @returns true on success, false if enable is true but the messages
+     *          can't be interned.
+     */
+    virtual bool set_string_interning(bool enable) {return !enable;}
+
+    /**
+     * Virtual method to send the messages packed, with some of their fields
+     * sent with less precision or not at all (see packed_encoding.hpp),
+     * rather than as CDR.  The other end of the serial link has to decode
+     * them with the same profile.
+     *
+     * Derived classes that can pack the messages of their type should
+     * override this method.
+     *
+     * @param[in] specs The quantize profile of the topic, or an empty list to
+     *                  send every field in full.
+     * @param[out] error What was wrong, on failure.
+     * @returns true on success, false if the profile is bad or the messages
+     *          can't be packed.
+     */
+    virtual bool set_quantization(const std::vector<std::string> & specs, std::string * error)
+    {
+        if (specs.empty())
+        {
+            return true;
+        }
+        *error = "the messages can't be packed";
+        return false;
+    }
+
 protected:
     topic_id_size_t serial_mapping_{0};
 };
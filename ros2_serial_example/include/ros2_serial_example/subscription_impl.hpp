@@ -17,17 +17,28 @@
 
 #include <cerrno>
 #include <cstring>
-#include <functional>
 #include <memory>
+#include <mutex>
+#include <random>
+#include <shared_mutex>
 #include <string>
+#include <vector>
 
 #include <rclcpp/rclcpp.hpp>
 
 #include <fastcdr/Cdr.h>
 #include <fastcdr/FastCdr.h>
 
+#include "ros2_serial_example/alloc_guard.hpp"
+#include "ros2_serial_example/async_log.hpp"
+#include "ros2_serial_example/cdr_encapsulation.hpp"
+#include "ros2_serial_example/cdr_fixed_layout.hpp"
+#include "ros2_serial_example/packed_encoding.hpp"
+#include "ros2_serial_example/qos.hpp"
+#include "ros2_serial_example/string_interner.hpp"
 #include "ros2_serial_example/subscription.hpp"
 #include "ros2_serial_example/transporter.hpp"
+#include "ros2_serial_example/tx_queue.hpp"
 
 namespace ros2_to_serial_bridge
 {
@@ -39,9 +50,42 @@ namespace pubsub
  * The SubscriptionImpl class is an implementation of the base Subscription class.
  * As such, it arranges to subscribe to a particular topic on the ROS 2 network.
  * When data arrives on that topic, the callback serializes the data to CDR and
- * then delivers it to the transport for send on the serial port.
+ * then delivers it to the transport for send on the serial port (either
+ * directly, or through a TxQueue if one was given).
+ *
+ * In passthrough mode, the subscription takes serialized messages instead,
+ * and the CDR data in them is sent to the transport after stripping off the
+ * encapsulation header, without ever deserializing it.
+ *
+ * If the node was created with intra-process comms enabled, messages from
+ * publishers in the same process are received without being copied.
+ *
+ * The subscription is in the node's default callback group unless it is
+ * given one of its own, which must be mutually exclusive.
+ *
+ * The size and serialization functions for the type are template parameters
+ * rather than stored function pointers, so each message type gets its own
+ * specialization that calls them directly.  Messages of a bounded type (one
+ * without unbounded strings or sequences, as MaxSize reports) always fit in
+ * the largest size of the type, so they are serialized into a buffer of that
+ * size without being walked by GetSize first.  Types whose CDR has a fixed
+ * layout also pass the Layout that generate_ros2_topics.py made for them
+ * (see cdr_fixed_layout.hpp), which copies the fields straight into the
+ * buffer at known offsets instead of going through Fast-CDR.
+ *
+ * Types that can be packed also pass the packing struct that
+ * generate_ros2_topics.py made for them, so that topics with intern_strings
+ * set or a quantize profile can send their messages packed, with a single
+ * octet for each string that was sent before (see string_interner.hpp and
+ * set_string_interning()) or fewer octets for the fields that don't need
+ * full precision (see packed_encoding.hpp and set_quantization()).
  */
-template<typename T>
+template<typename T,
+         size_t (*GetSize)(const T &, size_t),
+         bool (*Serialize)(const T &, eprosima::fastcdr::Cdr &),
+         size_t (*MaxSize)(bool *),
+         typename Layout = cdr::NoFixedLayout<T>,
+         typename Packing = NoPacking<T>>
 class SubscriptionImpl final : public Subscription
 {
 public:
@@ -55,35 +99,262 @@ public:
      * @param[in] transporter A pointer to the transporter object to use to send
      *                        the serialized data to the underlying serial
      *                        transport.
-     * @param[in] get_size A function pointer to the function to determine the
-     *                     size of the serialization for the CDR type.
-     * @param[in] serialize A function pointer to the function to serialize the
-     *                      data into CDR.
+     * @param[in] tx_queue A pointer to the TxQueue to send the serialized data
+     *                     through, or nullptr to write it to the transporter
+     *                     directly from the callback.
+     * @param[in] passthrough Whether to subscribe to serialized messages and
+     *                        forward the CDR data without deserializing it.
+     * @param[in] qos The QoS settings to subscribe with.
+     * @param[in] callback_group The mutually exclusive callback group to put
+     *                           the subscription in, or nullptr for the
+     *                           node's default callback group.
      */
     explicit SubscriptionImpl(rclcpp::Node * node,
                               topic_id_size_t mapping,
                               const std::string & name,
                               transport::Transporter * transporter,
-                              std::function<size_t(const T &, size_t)> get_size,
-                              std::function<bool(const T &, eprosima::fastcdr::Cdr &)> serialize) : Subscription()
+                              transport::TxQueue * tx_queue = nullptr,
+                              bool passthrough = false,
+                              const rclcpp::QoS & qos = rclcpp::QoS(rclcpp::KeepLast(10)),
+                              const std::shared_ptr<rclcpp::CallbackGroup> & callback_group = nullptr)
+        : Subscription(), node_(node), transporter_(transporter), tx_queue_(tx_queue), passthrough_(passthrough)
     {
         serial_mapping_ = mapping;
-        auto callback = [node, mapping, transporter, get_size, serialize](const typename T::SharedPtr msg) -> void
+
+        bool bounded = false;
+        size_t max_size = MaxSize(&bounded);
+        if (bounded && !passthrough)
         {
-            size_t serialized_size = get_size(*(msg.get()), 0);
-            std::unique_ptr<uint8_t[]> data_buffer = std::unique_ptr<uint8_t[]>(new uint8_t[serialized_size]{});
-            eprosima::fastcdr::FastBuffer cdrbuffer(reinterpret_cast<char *>(data_buffer.get()), serialized_size);
-            eprosima::fastcdr::Cdr scdr(cdrbuffer);
-            serialize(*(msg.get()), scdr);
-            if (transporter->write(mapping, data_buffer.get(), scdr.getSerializedDataLength()) < 0)
+            bounded_size_ = max_size;
+            buffer_.reserve(max_size);
+        }
+
+        rclcpp::SubscriptionOptions options;
+        options.callback_group = callback_group;
+        if (!use_intra_process(node, name, qos, passthrough))
+        {
+            options.use_intra_process_comm = rclcpp::IntraProcessSetting::Disable;
+        }
+
+        if (passthrough)
+        {
+            auto serialized_callback = [mapping, transporter, tx_queue](const std::shared_ptr<rclcpp::SerializedMessage> msg) -> void
+            {
+                transport::HotPathScope hot_path;
+                const rcl_serialized_message_t & rcl_msg = msg->get_rcl_serialized_message();
+                size_t data_length;
+                if (!cdr::unwrap_encapsulation(rcl_msg.buffer, rcl_msg.buffer_length, &data_length))
+                {
+                    ROS2_SERIAL_LOG(WARN, "Dropping serialized message for topic %u that isn't native byte order CDR",
+                                    static_cast<unsigned int>(mapping));
+                    return;
+                }
+                uint8_t *data = rcl_msg.buffer + cdr::ENCAPSULATION_SIZE;
+                ssize_t ret;
+                if (tx_queue != nullptr)
+                {
+                    ret = tx_queue->write(mapping, data, data_length);
+                }
+                else
+                {
+                    ret = transporter->write(mapping, data, data_length);
+                }
+                if (ret < 0)
+                {
+                    ROS2_SERIAL_LOG(WARN, "Failed to write data for topic %u: %s", static_cast<unsigned int>(mapping),
+                                    ::strerror(errno));
+                }
+            };
+            sub_ = node->create_subscription<T>(name, qos, serialized_callback, options);
+            return;
+        }
+
+        // Taking a const message lets intra-process publishers share it with
+        // every subscription instead of making a copy for this one.
+        if (callback_group == nullptr)
+        {
+            auto callback = [this](const typename T::ConstSharedPtr msg) -> void
             {
-                RCLCPP_WARN(node->get_logger(), "Failed to write data: %s", ::strerror(errno));  // NOLINT(cppcoreguidelines-pro-bounds-array-to-pointer-decay,hicpp-no-array-decay)
+                serialize_and_send(*(msg.get()));
+            };
+            sub_ = node->create_subscription<T>(name, qos, callback, options);
+            return;
+        }
+
+        // Outside of the default callback group, the callback may be running
+        // while the topic is removed (from the default callback group), or
+        // may even be called after that by an executor that had already
+        // taken a message; the guard outlives the subscription to stop both.
+        guard_ = std::make_shared<CallbackGuard>();
+        auto callback = [this, guard = guard_](const typename T::ConstSharedPtr msg) -> void
+        {
+            std::shared_lock<std::shared_timed_mutex> lock(guard->mutex);
+            if (guard->alive)
+            {
+                serialize_and_send(*(msg.get()));
             }
         };
-        sub_ = node->create_subscription<T>(name, 10, callback);
+        sub_ = node->create_subscription<T>(name, qos, callback, options);
+    }
+
+    ~SubscriptionImpl() override
+    {
+        if (guard_ != nullptr)
+        {
+            std::unique_lock<std::shared_timed_mutex> lock(guard_->mutex);
+            guard_->alive = false;
+        }
+    }
+
+    /**
+     * Allocate the serialization buffer up front.  Passthrough subscriptions
+     * send the data straight out of the serialized message, so they don't
+     * need a buffer at all.
+     *
+     * @param[in] max_size The largest CDR data that will be sent.
+     * @returns true.
+     */
+    bool reserve(size_t max_size) override
+    {
+        buffer_.reserve(max_size);
+        return true;
+    }
+
+    /**
+     * Send the messages packed with their strings interned, rather than as
+     * CDR.  This must be called before the subscription gets any messages.
+     *
+     * @param[in] enable true to intern the strings, false to send CDR.
+     * @returns true on success, false if enable is true but the type has no
+     *          strings or the topic is passthrough.
+     */
+    bool set_string_interning(bool enable) override
+    {
+        if (!enable)
+        {
+            interner_.reset();
+            return true;
+        }
+        if (passthrough_ || !Packing::HAS_STRINGS)
+        {
+            return false;
+        }
+
+        // As with reliable topics, a random session tells the other end that
+        // the slots of the last run of the bridge are gone.
+        std::random_device random;
+        interner_ = std::make_unique<StringInterner>(static_cast<uint8_t>(random()), static_cast<uint32_t>(random()));
+        return true;
+    }
+
+    /**
+     * Send the messages packed with some of their fields quantized, rather
+     * than as CDR.  This must be called before the subscription gets any
+     * messages.
+     *
+     * @param[in] specs The quantize profile of the topic, or an empty list to
+     *                  send every field in full.
+     * @param[out] error What was wrong, on failure.
+     * @returns true on success, false if the profile is bad, or it isn't
+     *          empty but the type can't be packed or the topic is
+     *          passthrough.
+     */
+    bool set_quantization(const std::vector<std::string> & specs, std::string * error) override
+    {
+        if (!specs.empty() && (passthrough_ || !Packing::PACKABLE))
+        {
+            *error = passthrough_ ? "the topic is passthrough" : "the messages can't be packed";
+            return false;
+        }
+        size_t count;
+        const PackedField * fields = Packing::fields(&count);
+        return quantization_.parse(specs, fields, count, error);
     }
 
 private:
+    void serialize_and_send(const T & msg)
+    {
+        transport::HotPathScope hot_path;
+
+        // The subscription is in a mutually exclusive callback group, so
+        // callbacks never run concurrently and one buffer per subscription
+        // is enough.  The buffer keeps its capacity between
+        // messages, so once it is big enough for the largest message seen
+        // this doesn't allocate, and resize() only has to fill in the bytes
+        // past its previous size.
+        transport::Metrics & metrics = transporter_->get_metrics();
+        transport::Metrics::Clock::time_point start = metrics.now();
+        if (interner_ != nullptr || quantization_.rules() != nullptr)
+        {
+            // The writer appends to the buffer, which is just as cheap once
+            // it has the capacity.
+            PackedWriter writer(&buffer_, interner_.get(), quantization_.rules());
+            Packing::encode(msg, writer);
+            metrics.record(transport::Metrics::Stage::SERIALIZE, start, metrics.now());
+            send(buffer_.size());
+            return;
+        }
+
+        size_t serialized_size = Layout::FIXED ? Layout::SIZE : (bounded_size_ > 0 ? bounded_size_ : GetSize(msg, 0));
+        if (buffer_.size() < serialized_size)
+        {
+            buffer_.resize(serialized_size);
+        }
+        size_t length;
+        if (Layout::FIXED)
+        {
+            length = Layout::encode(msg, buffer_.data(), buffer_.size());
+        }
+        else
+        {
+            eprosima::fastcdr::FastBuffer cdrbuffer(reinterpret_cast<char *>(buffer_.data()), buffer_.size());
+            eprosima::fastcdr::Cdr scdr(cdrbuffer);
+            Serialize(msg, scdr);
+            length = scdr.getSerializedDataLength();
+        }
+        metrics.record(transport::Metrics::Stage::SERIALIZE, start, metrics.now());
+        send(length);
+    }
+
+    void send(size_t length)
+    {
+        ssize_t ret;
+        if (tx_queue_ != nullptr)
+        {
+            // Hand the buffer itself to the queue; on success we get a
+            // recycled one back from it to use next time.
+            buffer_.resize(length);
+            ret = tx_queue_->write(serial_mapping_, &buffer_);
+        }
+        else
+        {
+            ret = transporter_->write(serial_mapping_, buffer_.data(), length);
+        }
+        if (ret < 0)
+        {
+            ROS2_SERIAL_LOG(WARN, "Failed to write data for topic %u: %s", static_cast<unsigned int>(serial_mapping_),
+                            ::strerror(errno));
+        }
+    }
+
+    rclcpp::Node * node_;
+    transport::Transporter * transporter_;
+    transport::TxQueue * tx_queue_;
+    bool passthrough_;
+    std::vector<uint8_t> buffer_;
+    // Only set for topics with interned strings.
+    std::unique_ptr<StringInterner> interner_;
+    // Empty unless the topic has a quantize profile.
+    QuantizationProfile quantization_;
+    // The largest size of a bounded type, or 0 if messages have to be sized
+    // one by one.
+    size_t bounded_size_{0};
+    struct CallbackGuard final
+    {
+        std::shared_timed_mutex mutex;
+        bool alive{true};
+    };
+    std::shared_ptr<CallbackGuard> guard_;
     std::shared_ptr<rclcpp::Subscription<T>> sub_;
 };
 
@@ -0,0 +1,279 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef ROS2_SERIAL_EXAMPLE__TCP_TRANSPORTER_HPP_
+#define ROS2_SERIAL_EXAMPLE__TCP_TRANSPORTER_HPP_
+
+// C++ includes
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+// Local includes
+#include "ros2_serial_example/transporter.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+/**
+ * The TCPTransporter class is an implementation of the abstract Transporter
+ * class for talking to a board over a TCP connection, for instance over
+ * Ethernet or Wi-Fi.
+ *
+ * The connection is a byte stream like a UART: the data is read into the
+ * ring buffer and the frames are found in there, with the same framing as on
+ * any other transport.  TCP_NODELAY is set, so each frame (or batch of
+ * frames, see Transporter::set_write_batching()) goes out as soon as it is
+ * written, in a single send.
+ *
+ * As a client, the transporter connects to a server, and as a server, it
+ * listens for a client and takes the most recent one that connects.  A lost
+ * connection is noticed from the socket closing, or from TCP keepalives if
+ * the other end has gone away without closing it, and is made again in the
+ * background: the client tries to connect again after a short backoff, and
+ * the server waits for the client to come back.  None of that blocks;
+ * the connecting, accepting and backoff are all done from node_read(), and
+ * get_read_fd() returns an epoll file descriptor that becomes readable
+ * whenever there is something for node_read() to do.  While there is no
+ * connection, writes fail with errno set to ENOTCONN, and anything that was
+ * left over from the last connection is thrown away.
+ *
+ * The file descriptor of the connection stays the same across reconnects
+ * (new connections are moved onto it with dup2()), so get_write_fd() can be
+ * waited on at any time.  A frame that is being written while the
+ * connection is lost or made again may be cut short, which the other end's
+ * parser copes with like any other garbage.
+ */
+class TCPTransporter final : public Transporter
+{
+public:
+    /// Whether this side connects or waits for the other to connect.
+    enum class Mode
+    {
+        CLIENT,
+        SERVER,
+    };
+
+    /**
+     * Construct a TCPTransporter object with the given TCP parameters.
+     *
+     * @param[in] protocol The backend protocol to use; see Transporter docs for
+     *                     more information about supported protocols.
+     * @param[in] mode Whether to connect to address, or to listen on it.
+     * @param[in] address The host name or IP address (v4 or v6) to connect
+     *                    to as a client, or to listen on as a server, where
+     *                    an empty string means every address.
+     * @param[in] port The TCP port to connect to or to listen on.
+     * @param[in] read_poll_ms The amount of time to wait for data to come in
+     *                         before timing out.
+     * @param[in] ring_buffer_size The number of bytes to allocate to the
+     *                             underlying ring buffer that is used to
+     *                             accept data from the connection.
+     * @throws std::runtime_error If the port is 0, or the address is empty in
+     *         client mode.
+     */
+    TCPTransporter(const std::string & protocol,
+                   Mode mode,
+                   const std::string & address,
+                   uint16_t port,
+                   uint32_t read_poll_ms,
+                   size_t ring_buffer_size);
+    ~TCPTransporter() override;
+
+    TCPTransporter(TCPTransporter const &) = delete;
+    TCPTransporter& operator=(TCPTransporter const &) = delete;
+    TCPTransporter(TCPTransporter &&) = delete;
+    TCPTransporter& operator=(TCPTransporter &&) = delete;
+
+    /// The first wait before a client tries to connect again; it doubles
+    /// with each failure, up to RECONNECT_MAX_MS.
+    static constexpr uint32_t RECONNECT_MIN_MS = 50;
+
+    /// The longest wait before a client tries to connect again.
+    static constexpr uint32_t RECONNECT_MAX_MS = 1000;
+
+    /**
+     * Do TCP specific initialization.
+     *
+     * This method is an override of the one provided by the Transporter class.
+     * It looks up the address, and then starts listening as a server, or
+     * starts connecting as a client; it doesn't wait for a connection.
+     *
+     * @returns 0 on success, -1 on error.
+     */
+    int init() override;
+
+    /**
+     * Do TCP specific de-initialization.
+     *
+     * This method is an override of the one provided by the Transporter class
+     * and undoes the steps that the init() method does.
+     *
+     * @returns 0 on success, -1 on error.
+     */
+    int close() override;
+
+    /**
+     * Get a file descriptor that becomes readable when node_read() has
+     * something to do: data has come in, a connection was made or lost, or
+     * it is time to connect again.
+     *
+     * @returns The file descriptor if the transporter is initialized, -1
+     *          otherwise.
+     */
+    int get_read_fd() const override;
+
+    /**
+     * Get the file descriptor of the connection, which stays the same across
+     * reconnects.
+     *
+     * @returns The file descriptor of the connection if the transporter is
+     *          initialized, -1 otherwise.
+     */
+    int get_write_fd() const override;
+
+    /**
+     * Get the number of bytes in the send socket buffer (SIOCOUTQ) that
+     * haven't been acknowledged by the other end yet.
+     *
+     * @returns The number of bytes waiting to be sent, or -1 if there is no
+     *          connection.
+     */
+    ssize_t get_write_queue_bytes() const override;
+
+    /**
+     * Set the kernel buffer sizes of the connection (SO_RCVBUF and
+     * SO_SNDBUF).  A send buffer of about the bandwidth times the round trip
+     * time of the link keeps it busy; one much larger than that only adds to
+     * the latency of each frame when the link is backed up.  The kernel may
+     * limit the sizes (see net.core.rmem_max and net.core.wmem_max); a
+     * warning is printed if it does.  This must be called before init().
+     *
+     * @param[in] recv_bytes The receive buffer size, or 0 for the default.
+     * @param[in] send_bytes The send buffer size, or 0 for the default.
+     * @returns 0 on success, or -1 if a size is negative or the transporter
+     *          has already been initialized.
+     */
+    int set_socket_buffer_sizes(int recv_bytes, int send_bytes);
+
+    /**
+     * Determine whether there is a connection at the moment.
+     *
+     * @returns true if there is a connection, false otherwise.
+     */
+    bool is_connected() const
+    {
+        return connected_;
+    }
+
+    /**
+     * Change how long a read waits for data to come in.
+     *
+     * This must only be called from the thread that reads.
+     *
+     * @param[in] read_poll_ms The time to wait in milliseconds.
+     * @returns 0.
+     */
+    int set_read_poll_ms(uint32_t read_poll_ms) override
+    {
+        read_poll_ms_ = read_poll_ms;
+        return 0;
+    }
+
+private:
+    /**
+     * Read data from the connection and store it in the ring buffer.
+     *
+     * This method is an override of the abstract one in the Transporter class.
+     * It waits up to read_poll_ms for something to happen, and then reads any
+     * data that came in, or deals with a connection that was made or lost.
+     *
+     * @returns The number of bytes read, which is 0 if nothing came in, or
+     *          -1 on error.
+     */
+    ssize_t node_read() override;
+
+    /**
+     * Write data to the connection.
+     *
+     * This method is an override of the abstract one in the Transporter class
+     * and will block until all of the data is sent, or until an error occurs.
+     *
+     * @params[in] buffer The buffer containing the data to write.
+     * @params[in] len The number of bytes in the buffer to write.
+     * @returns The number of bytes written on success (which must be equal to
+     *          len), or -1 on error.
+     */
+    ssize_t node_write(void *buffer, size_t len) override;
+
+    /**
+     * Write a set of buffers to the connection.
+     *
+     * This method is an override of the one in the Transporter class and
+     * writes all of the buffers with a single sendmsg() call where it can,
+     * so they go out in the same segment.  This method will block until all
+     * of the data is sent, or until an error occurs.
+     *
+     * @params[in] iov The buffers containing the data to write.
+     * @params[in] iovcnt The number of buffers in iov.
+     * @returns The number of bytes written on success (which must be equal to
+     *          the sum of the buffer lengths), or -1 on error.
+     */
+    ssize_t node_writev(const struct iovec *iov, int iovcnt) override;
+
+    /**
+     * Detect whether the transporter is initialized.  This is true while
+     * there is no connection too, since one is being made.
+     *
+     * @returns true if the transporter is initialized, false otherwise.
+     */
+    bool fds_OK() override;
+
+    int new_socket();
+    int setup_connection(int fd);
+    void replace_connection(int fd);
+    void start_connect();
+    void connected();
+    void disconnected();
+    void schedule_reconnect();
+
+    Mode mode_;
+    std::string address_;
+    uint16_t port_{0};
+    uint32_t read_poll_ms_{0};
+    int recv_buffer_size_{0};
+    int send_buffer_size_{0};
+    struct sockaddr_storage addr_{};
+    socklen_t addr_len_{0};
+    int epoll_fd_{-1};
+    int listen_fd_{-1};
+    int conn_fd_{-1};
+    int timer_fd_{-1};
+    bool connecting_{false};
+    uint32_t reconnect_ms_{RECONNECT_MIN_MS};
+    std::atomic<bool> connected_{false};
+};
+
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
+
+#endif
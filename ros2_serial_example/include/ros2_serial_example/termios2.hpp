@@ -0,0 +1,84 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef ROS2_SERIAL_EXAMPLE__TERMIOS2_HPP_
+#define ROS2_SERIAL_EXAMPLE__TERMIOS2_HPP_
+
+#include <cstdint>
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+namespace impl
+{
+
+// These live in their own translation unit because the Linux termios2
+// definitions in <asm/termbits.h> clash with the ones in <termios.h>.
+
+/**
+ * Set an arbitrary baudrate on a serial port with termios2 and BOTHER.
+ *
+ * This allows rates that don't have a B* constant, such as the non-standard
+ * rates used by some flight controllers.  Only the speed is changed; the rest
+ * of the port configuration is left as it was.
+ *
+ * @param[in] fd The file descriptor of the serial port.
+ * @param[in] baudrate The baudrate in bits per second.
+ * @param[out] actual The baudrate the driver actually picked, which may be
+ *                    slightly different.
+ * @returns 0 on success, or -1 on error with errno set.
+ */
+int set_custom_baudrate(int fd, uint32_t baudrate, uint32_t *actual);
+
+/**
+ * Set or clear ASYNC_LOW_LATENCY on a serial port with TIOCSSERIAL.
+ *
+ * For USB serial adapters like the FTDI ones, this also drops the latency
+ * timer of the adapter from the default of 16 milliseconds to 1 millisecond.
+ *
+ * @param[in] fd The file descriptor of the serial port.
+ * @param[in] enable Whether to set or clear the flag.
+ * @returns 0 on success, or -1 on error with errno set (for instance, if the
+ *          driver doesn't support TIOCSSERIAL).
+ */
+int set_low_latency(int fd, bool enable);
+
+/**
+ * Turn RS-485 mode on or off on a serial port with TIOCSRS485.
+ *
+ * In RS-485 mode, the driver raises RTS to enable the line driver before it
+ * sends anything, and lowers it again once everything has gone out, so the
+ * bus is turned around by the kernel rather than by a GPIO toggled from user
+ * space.  The receiver is off while sending, so nothing sent is echoed back.
+ *
+ * @param[in] fd The file descriptor of the serial port.
+ * @param[in] enable Whether to turn RS-485 mode on.
+ * @param[in] delay_before_ms How long to wait between raising RTS and
+ *                            starting to send, in milliseconds.
+ * @param[in] delay_after_ms How long to keep RTS raised after the last byte
+ *                           has gone out, in milliseconds.
+ * @returns 0 on success, or -1 on error with errno set (for instance, if the
+ *          driver doesn't support RS-485).
+ */
+int set_rs485(int fd, bool enable, uint32_t delay_before_ms, uint32_t delay_after_ms);
+
+}  // namespace impl
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
+
+#endif
@@ -0,0 +1,109 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ROS2_SERIAL_EXAMPLE__THREAD_SETTINGS_HPP_
+#define ROS2_SERIAL_EXAMPLE__THREAD_SETTINGS_HPP_
+
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+/**
+ * The scheduling of a thread: its policy, its priority, and the CPUs it may
+ * run on.  The defaults leave the thread the way it was created.
+ */
+struct ThreadSettings final
+{
+    /**
+     * The scheduling policy: "other" (the normal time-sharing policy), one of
+     * the real-time policies "fifo" and "rr", or empty to keep the policy and
+     * priority the thread has.
+     */
+    std::string policy;
+
+    /**
+     * The priority; 1 to 99 for the real-time policies, and 0 otherwise.
+     */
+    int64_t priority{0};
+
+    /**
+     * The CPUs the thread may run on, or empty for any CPU.
+     */
+    std::vector<int64_t> cpus;
+};
+
+/**
+ * Check ThreadSettings without applying them.
+ *
+ * @param[in] settings The settings to check.
+ * @param[out] error Why the settings are invalid, if they are.
+ * @returns true if the settings are valid, false otherwise.
+ */
+bool check_thread_settings(const ThreadSettings & settings, std::string * error);
+
+/**
+ * Apply ThreadSettings to a running thread.
+ *
+ * The real-time policies need CAP_SYS_NICE or a high enough RLIMIT_RTPRIO,
+ * so this fails with a permission error for an ordinary user unless the
+ * limits were raised.
+ *
+ * @param[in] thread The native handle of the thread.
+ * @param[in] settings The settings to apply.
+ * @param[out] error Why the settings couldn't be applied, if they couldn't.
+ * @returns true if the settings were applied, false otherwise.
+ */
+bool apply_thread_settings(std::thread::native_handle_type thread, const ThreadSettings & settings, std::string * error);
+
+/**
+ * Lock all of the memory of the process, now and in the future, so that no
+ * thread ever stalls on a page fault.
+ *
+ * Locking the memory also faults in every page that is already mapped, so
+ * this should be called once the ring buffers and queues have been
+ * allocated.  Memory freed to the heap is kept rather than handed back to the
+ * kernel, so that allocating it again doesn't fault either.
+ *
+ * @param[out] error Why the memory couldn't be locked, if it couldn't.
+ * @returns true if the memory was locked, false otherwise.
+ */
+bool lock_memory(std::string * error);
+
+/**
+ * Tell the CPU that the calling thread is spinning, which hands the core's
+ * resources to its sibling hyperthread (and saves power) for a moment,
+ * without giving up the CPU to the scheduler.
+ */
+inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#else
+    std::this_thread::yield();
+#endif
+}
+
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
+
+#endif
@@ -0,0 +1,160 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ROS2_SERIAL_EXAMPLE__TIME_SYNC_HPP_
+#define ROS2_SERIAL_EXAMPLE__TIME_SYNC_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+/**
+ * The TimeSync class estimates the clock of the other end of a link from
+ * NTP-style exchanges (see ros2_serial_msgs/TimeSync), so that times taken
+ * there can be turned into host times.
+ *
+ * Each exchange gives the offset between the clocks to within half of its
+ * round trip time, so only exchanges that were as quick as the quickest of
+ * the last few are used; the others were held up on one leg or the other.
+ * The clocks also drift apart, so the estimate is a line through the
+ * offsets of the exchanges that were used, fitted by least squares: the
+ * offset at the device time of the last one, and the drift rate as its
+ * slope.  Fitting it to many exchanges rather than following each one keeps
+ * the jitter of the link out of the drift.  A device time that goes back
+ * means the device was reset, so the exchanges before it are forgotten.
+ *
+ * sample() must be called from one thread at a time; the other methods may
+ * be called from any thread.
+ */
+class TimeSync final
+{
+public:
+    /**
+     * Construct a TimeSync object.
+     *
+     * @param[in] window The number of the latest exchanges to take the
+     *                   quickest of.
+     * @param[in] history The number of the latest exchanges used to fit the
+     *                    line to.
+     * @throws std::runtime_error If window or history are 0.
+     */
+    explicit TimeSync(size_t window = 8, size_t history = 32);
+
+    TimeSync(TimeSync const &) = delete;
+    TimeSync& operator=(TimeSync const &) = delete;
+    TimeSync(TimeSync &&) = delete;
+    TimeSync& operator=(TimeSync &&) = delete;
+
+    /**
+     * Take the times of one exchange.
+     *
+     * @param[in] t1 When the host sent the request, in host nanoseconds.
+     * @param[in] t2 When the device received it, in device nanoseconds.
+     * @param[in] t3 When the device sent the response, in device nanoseconds.
+     * @param[in] t4 When the host received the response, in host nanoseconds.
+     * @returns true if the exchange was used, false if it was slower than
+     *          the quickest recent one or its times don't add up.
+     */
+    bool sample(int64_t t1, int64_t t2, int64_t t3, int64_t t4);
+
+    /**
+     * Turn a device time into a host time.
+     *
+     * @param[in] device_ns The device time in nanoseconds.
+     * @param[out] host_ns The host time in nanoseconds.
+     * @returns true on success, false if no exchange has been used yet.
+     */
+    bool to_host(int64_t device_ns, int64_t * host_ns) const;
+
+    /**
+     * Turn a host time into a device time; the inverse of to_host().
+     *
+     * @param[in] host_ns The host time in nanoseconds.
+     * @param[out] device_ns The device time in nanoseconds.
+     * @returns true on success, false if no exchange has been used yet.
+     */
+    bool to_device(int64_t host_ns, int64_t * device_ns) const;
+
+    /**
+     * Get whether an exchange has been used yet, so to_host() works.
+     *
+     * @returns true if the clocks are synchronized.
+     */
+    bool is_synced() const;
+
+    /**
+     * Get the offset of the host clock from the device clock as of the last
+     * exchange that was used.
+     *
+     * @returns The host time minus the device time, in nanoseconds.
+     */
+    int64_t get_offset_ns() const;
+
+    /**
+     * Get how fast the host clock runs compared to the device clock.
+     *
+     * @returns The drift in parts per million; positive if the host clock
+     *          runs faster.
+     */
+    double get_drift_ppm() const;
+
+    /**
+     * Get the round trip time of the last exchange that was used.
+     *
+     * @returns The round trip time in nanoseconds, or -1 if no exchange has
+     *          been used yet.
+     */
+    int64_t get_rtt_ns() const;
+
+    /**
+     * Get the number of exchanges that were used.
+     *
+     * @returns The number of exchanges used.
+     */
+    uint64_t get_samples() const;
+
+private:
+    size_t window_;
+    // The round trip times of the latest exchanges, overwritten oldest
+    // first once there are window_ of them.
+    std::vector<int64_t> rtts_;
+    size_t rtt_next_{0};
+
+    // The device times and offsets of the latest exchanges that were used,
+    // likewise.
+    size_t history_;
+    std::vector<std::pair<int64_t, int64_t>> used_;
+    size_t used_next_{0};
+
+    mutable std::mutex mutex_;
+    bool synced_{false};
+    int64_t ref_device_ns_{0};
+    int64_t offset_ns_{0};
+    double drift_{0.0};
+    int64_t rtt_ns_{-1};
+    uint64_t samples_{0};
+};
+
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
+
+#endif
@@ -0,0 +1,27 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ROS2_SERIAL_EXAMPLE__TOPIC_ID_HPP_
+#define ROS2_SERIAL_EXAMPLE__TOPIC_ID_HPP_
+
+#include <cstdint>
+
+// The type of a topic ID.  The PX4 and COBS protocols carry a single byte of
+// topic ID on the wire, so they can only use IDs up to 255 (see
+// Transporter::get_max_topic_ID()); the v2 protocol encodes it as a varint,
+// so it can use the whole range of this typedef.  Widening this does not
+// change the wire format of any of the protocols.
+typedef uint16_t topic_id_size_t;
+
+#endif
@@ -0,0 +1,145 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ROS2_SERIAL_EXAMPLE__TOPIC_MANIFEST_HPP_
+#define ROS2_SERIAL_EXAMPLE__TOPIC_MANIFEST_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+/**
+ * The settings of one topic in a TopicManifest; the same as the topic
+ * parameters of the bridge, with the enumerations as numbers and the
+ * compression dictionary read in.
+ */
+struct ManifestTopic final
+{
+    std::string name;
+    std::string type;
+    int64_t serial_mapping{-1};
+    // 0 for unknown, 1 for SerialToROS2, 2 for ROS2ToSerial.
+    uint8_t direction{0};
+    uint64_t tx_queue_depth{0};
+    // 0 for drop_oldest, 1 for drop_newest.
+    uint8_t tx_overflow_policy{0};
+    // The tx_priority of a ROS2ToSerial topic, or the rx_priority of a
+    // SerialToROS2 one.
+    uint8_t tx_priority{0};
+    // The tx_max_rate_hz of a ROS2ToSerial topic, or the max_rate_hz of a
+    // SerialToROS2 one.
+    double tx_max_rate_hz{0.0};
+    bool passthrough{false};
+    // 0 for reliable, 1 for best_effort.
+    uint8_t reliability{0};
+    // 0 for volatile, 1 for transient_local.
+    uint8_t durability{0};
+    uint64_t history_depth{10};
+    int64_t deadline_ms{0};
+    int64_t compress_threshold{-1};
+    std::vector<uint8_t> compress_dictionary;
+    uint32_t delta_keyframe_interval{0};
+    bool stamp_header{false};
+    bool device_stamp{false};
+    bool lazy{false};
+    bool last_value{false};
+    bool on_change{false};
+    uint32_t on_change_keepalive_ms{0};
+    // Sent with Transporter::set_reliable(); not the QoS reliability above.
+    bool reliable{false};
+    bool elide_length{false};
+    bool intern_strings{false};
+    std::vector<std::string> quantize;
+    std::string batch_type;
+    uint32_t batch_size{0};
+    uint32_t batch_ms{0};
+    uint32_t max_message_size{0};
+    uint16_t max_age_ms{0};
+};
+
+/**
+ * The TopicManifest class reads a precompiled table of topics, so that a
+ * bridge with hundreds of topics doesn't have to declare and parse hundreds
+ * of parameters every time it starts.
+ *
+ * The file is a header, a fixed size record for each topic, and the strings
+ * and dictionaries the records point at, protected by a CRC-32C.  It is
+ * memory-mapped rather than read, and a topic is only decoded when it is
+ * asked for.
+ */
+class TopicManifest final
+{
+public:
+    TopicManifest();
+    ~TopicManifest();
+
+    TopicManifest(TopicManifest const &) = delete;
+    TopicManifest& operator=(TopicManifest const &) = delete;
+    TopicManifest(TopicManifest &&) = delete;
+    TopicManifest& operator=(TopicManifest &&) = delete;
+
+    /**
+     * Write a manifest.  The file is replaced atomically.
+     *
+     * @param[in] path The path of the manifest.
+     * @param[in] topics The topics.
+     * @returns true if the manifest was written, false otherwise.
+     */
+    static bool write(const std::string & path, const std::vector<ManifestTopic> & topics);
+
+    /**
+     * Map a manifest into memory, unmapping any that was opened before.
+     *
+     * @param[in] path The path of the manifest.
+     * @returns true if the manifest was opened, false if there is no such
+     *          file or it is damaged.
+     */
+    bool open(const std::string & path);
+
+    /**
+     * Get the number of topics in the manifest.
+     *
+     * @returns The number of topics, or 0 if no manifest is open.
+     */
+    size_t size() const;
+
+    /**
+     * Decode a topic.
+     *
+     * @param[in] index The index of the topic; must be less than size().
+     * @param[out] topic The topic.
+     */
+    void get(size_t index, ManifestTopic * topic) const;
+
+private:
+    void close();
+
+    const uint8_t * data_{nullptr};
+    size_t length_{0};
+    size_t count_{0};
+    // The size of the records, which grew with the version of the file.
+    size_t record_size_{0};
+};
+
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
+
+#endif
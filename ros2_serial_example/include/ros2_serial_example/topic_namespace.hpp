@@ -0,0 +1,106 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ROS2_SERIAL_EXAMPLE__TOPIC_NAMESPACE_HPP_
+#define ROS2_SERIAL_EXAMPLE__TOPIC_NAMESPACE_HPP_
+
+#include <string>
+
+namespace ros2_to_serial_bridge
+{
+
+namespace pubsub
+{
+
+/**
+ * Check a topic namespace, which is one or more names separated by slashes,
+ * like "uav7" or "fleet/uav7", each a letter or underscore followed by
+ * letters, digits and underscores.  A leading or trailing slash is allowed
+ * and ignored.
+ *
+ * @param[in] ns The namespace.
+ * @returns true if it is valid or empty, false otherwise.
+ */
+inline bool valid_topic_namespace(const std::string & ns)
+{
+    size_t begin = !ns.empty() && ns.front() == '/' ? 1 : 0;
+    size_t end = ns.size() > begin && ns.back() == '/' ? ns.size() - 1 : ns.size();
+    if (begin == end)
+    {
+        return ns.size() <= 1;
+    }
+
+    bool start = true;
+    for (size_t i = begin; i < end; ++i)
+    {
+        char c = ns[i];
+        if (c == '/')
+        {
+            if (start)
+            {
+                return false;
+            }
+            start = true;
+            continue;
+        }
+        bool letter = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+        if (!letter && !(c >= '0' && c <= '9' && !start))
+        {
+            return false;
+        }
+        start = false;
+    }
+
+    return !start;
+}
+
+/**
+ * Put a topic or service name in a namespace, the way a node in that
+ * namespace would resolve it, except that absolute names go in it too: with
+ * the namespace "uav7", "/fmu/out/status" becomes "/uav7/fmu/out/status",
+ * "status" becomes "uav7/status" (still relative to the namespace of the
+ * node), and "~/status" becomes "~/uav7/status".
+ *
+ * @param[in] ns The namespace, which must be valid (see
+ *               valid_topic_namespace()).
+ * @param[in] name The name.
+ * @returns The name in the namespace, or the name as it is if the namespace
+ *          is empty.
+ */
+inline std::string apply_topic_namespace(const std::string & ns, const std::string & name)
+{
+    size_t begin = !ns.empty() && ns.front() == '/' ? 1 : 0;
+    size_t end = ns.size() > begin && ns.back() == '/' ? ns.size() - 1 : ns.size();
+    if (begin >= end)
+    {
+        return name;
+    }
+
+    std::string bare = ns.substr(begin, end - begin);
+    if (name.compare(0, 2, "~/") == 0)
+    {
+        return "~/" + bare + name.substr(1);
+    }
+    if (!name.empty() && name.front() == '/')
+    {
+        return "/" + bare + name;
+    }
+
+    return bare + "/" + name;
+}
+
+}  // namespace pubsub
+}  // namespace ros2_to_serial_bridge
+
+#endif
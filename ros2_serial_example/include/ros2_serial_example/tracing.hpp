@@ -0,0 +1,72 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ROS2_SERIAL_EXAMPLE__TRACING_HPP_
+#define ROS2_SERIAL_EXAMPLE__TRACING_HPP_
+
+#include <chrono>
+#include <cstdint>
+
+// The hot path tracepoints.  When the package is built with ENABLE_TRACING,
+// ROS2_SERIAL_TRACING is defined and each tracepoint is an LTTng-UST
+// tracepoint of the ros2_serial provider (see tracing_provider.h), which can
+// be recorded along with the ROS 2 tracepoints by ros2_tracing or by an LTTng
+// session.  Otherwise the tracepoints, including their arguments, compile to
+// nothing.
+//
+// The events, in the order a received message goes through them, are:
+//
+// publisher_init(publisher, topic_name) - a publisher was created
+// node_read(transporter, bytes, receive_stamp) - a read from the transport
+//     returned (for transports that deliver whole frames, the first frame of
+//     a read was handed over, and bytes is its length)
+// frame_complete(transporter, frame_len) - a whole frame is in the receive buffer
+// crc_verified(transporter, topic_ID, payload_len) - the frame's CRC matched
+// deserialized(publisher, receive_stamp) - the payload was deserialized
+// published(publisher, receive_stamp) - the message was handed to the middleware
+//
+// receive_stamp is the receive time of the message (see
+// Transporter::get_receive_time()) in nanoseconds since the epoch, so the
+// events of one message can be matched up.  For node_read, it is the receive
+// time of the data the read returned; with an arrival estimate (see
+// UARTTransporter::set_arrival_estimate()) the messages in it are stamped
+// earlier, by how long the bytes after them took to come in.
+#ifdef ROS2_SERIAL_TRACING
+#include "ros2_serial_example/tracing_provider.h"
+#define ROS2_SERIAL_TRACEPOINT(event, ...) tracepoint(ros2_serial, event, __VA_ARGS__)
+#else
+#define ROS2_SERIAL_TRACEPOINT(event, ...) do {} while (0)
+#endif
+
+namespace ros2_to_serial_bridge
+{
+
+namespace tracing
+{
+
+/**
+ * Convert a receive time to the form the tracepoints take.
+ *
+ * @param[in] time The receive time.
+ * @returns The time in nanoseconds since the epoch.
+ */
+inline int64_t stamp_ns(std::chrono::system_clock::time_point time)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+}
+
+}  // namespace tracing
+}  // namespace ros2_to_serial_bridge
+
+#endif
@@ -0,0 +1,119 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// The LTTng-UST tracepoint provider for the ros2_serial tracepoints.  This is
+// only used when the package is built with ENABLE_TRACING; code should use
+// ROS2_SERIAL_TRACEPOINT() from tracing.hpp rather than including this.
+//
+// LTTng includes this header several times with different definitions of the
+// TRACEPOINT_EVENT macros, so the include guard must allow that.
+
+#undef TRACEPOINT_PROVIDER
+#define TRACEPOINT_PROVIDER ros2_serial
+
+#undef TRACEPOINT_INCLUDE
+#define TRACEPOINT_INCLUDE "ros2_serial_example/tracing_provider.h"
+
+#if !defined(ROS2_SERIAL_EXAMPLE__TRACING_PROVIDER_H_) || defined(TRACEPOINT_HEADER_MULTI_READ)
+#define ROS2_SERIAL_EXAMPLE__TRACING_PROVIDER_H_
+
+#include <stdint.h>
+
+#include <lttng/tracepoint.h>
+
+TRACEPOINT_EVENT(
+  ros2_serial,
+  publisher_init,
+  TP_ARGS(
+    const void *, publisher_arg,
+    const char *, topic_name_arg
+  ),
+  TP_FIELDS(
+    ctf_integer_hex(const void *, publisher, publisher_arg)
+    ctf_string(topic_name, topic_name_arg)
+  )
+)
+
+TRACEPOINT_EVENT(
+  ros2_serial,
+  node_read,
+  TP_ARGS(
+    const void *, transporter_arg,
+    int64_t, bytes_arg,
+    int64_t, receive_stamp_arg
+  ),
+  TP_FIELDS(
+    ctf_integer_hex(const void *, transporter, transporter_arg)
+    ctf_integer(int64_t, bytes, bytes_arg)
+    ctf_integer(int64_t, receive_stamp, receive_stamp_arg)
+  )
+)
+
+TRACEPOINT_EVENT(
+  ros2_serial,
+  frame_complete,
+  TP_ARGS(
+    const void *, transporter_arg,
+    uint64_t, frame_len_arg
+  ),
+  TP_FIELDS(
+    ctf_integer_hex(const void *, transporter, transporter_arg)
+    ctf_integer(uint64_t, frame_len, frame_len_arg)
+  )
+)
+
+TRACEPOINT_EVENT(
+  ros2_serial,
+  crc_verified,
+  TP_ARGS(
+    const void *, transporter_arg,
+    uint16_t, topic_ID_arg,
+    uint64_t, payload_len_arg
+  ),
+  TP_FIELDS(
+    ctf_integer_hex(const void *, transporter, transporter_arg)
+    ctf_integer(uint16_t, topic_ID, topic_ID_arg)
+    ctf_integer(uint64_t, payload_len, payload_len_arg)
+  )
+)
+
+TRACEPOINT_EVENT(
+  ros2_serial,
+  deserialized,
+  TP_ARGS(
+    const void *, publisher_arg,
+    int64_t, receive_stamp_arg
+  ),
+  TP_FIELDS(
+    ctf_integer_hex(const void *, publisher, publisher_arg)
+    ctf_integer(int64_t, receive_stamp, receive_stamp_arg)
+  )
+)
+
+TRACEPOINT_EVENT(
+  ros2_serial,
+  published,
+  TP_ARGS(
+    const void *, publisher_arg,
+    int64_t, receive_stamp_arg
+  ),
+  TP_FIELDS(
+    ctf_integer_hex(const void *, publisher, publisher_arg)
+    ctf_integer(int64_t, receive_stamp, receive_stamp_arg)
+  )
+)
+
+#endif
+
+#include <lttng/tracepoint-event.h>
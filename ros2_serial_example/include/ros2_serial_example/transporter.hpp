@@ -38,16 +38,28 @@
 #ifndef ROS2_SERIAL_EXAMPLE__TRANSPORTER_HPP_
 #define ROS2_SERIAL_EXAMPLE__TRANSPORTER_HPP_
 
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <string>
+#include <vector>
 
-#include "ros2_serial_example/ring_buffer.hpp"
+#include <sys/uio.h>
 
-// If you want to allow > 255 topic name/topic types on the serial wire,
-// increase the size of this typedef.  Note that it will break on-wire
-// serial compatibility.
-typedef uint8_t topic_id_size_t;
+#include "ros2_serial_example/chacha20_poly1305.hpp"
+#include "ros2_serial_example/cobs.hpp"
+#include "ros2_serial_example/crc16.hpp"
+#include "ros2_serial_example/crc32c.hpp"
+#include "ros2_serial_example/link_capture.hpp"
+#include "ros2_serial_example/lz4_codec.hpp"
+#include "ros2_serial_example/metrics.hpp"
+#include "ros2_serial_example/ring_buffer.hpp"
+#include "ros2_serial_example/topic_id.hpp"
 
 namespace ros2_to_serial_bridge
 {
@@ -80,6 +92,54 @@ namespace transport
  * over the wire, and can recover from bit-flip failures fairly easily.  The
  * downsides are that it is a bit harder to understand, and isn't fixed sized
  * overhead.
+ *
+ * COBS_ZPE - This is COBS with zero pair elimination: a block of up to 30
+ * data bytes followed by two 0s takes a single code byte, as does a block
+ * followed by one 0 (see impl::COBSEncoder for the codes).  Frames are
+ * otherwise the same as COBS, with the same header, and the same benefits
+ * and downsides; payloads with a lot of 0s in them, like the padding in CDR
+ * data, come out shorter than with COBS.
+ *
+ * V2 - This is a marker-based protocol like PX4, but with a version byte,
+ * a varint-encoded topic ID (so more than 255 topics can be used), a 32-bit
+ * payload length (so payloads aren't limited to 64KB), and a choice of
+ * CRC-16 or CRC-32C over the payload (see set_crc32c()).  The header is of
+ * the form:
+ *
+ * [>,>,version(2),flags,seq,topic_ID(1-3 bytes),length(4 bytes),CRC(2 or 4 bytes)]
+ *
+ * where all multi-byte fields other than the topic ID are big-endian, bit 0
+ * of flags says that the CRC is a CRC-32C, bit 1 of flags says that the
+ * payload is LZ4-compressed (see set_compression()), bits 2 and 3 say that
+ * the payload is a base for later deltas or a delta against the previous
+ * payload of the topic (see set_delta_encoding()), bit 4 says that the
+ * payload is a fragment of a longer one (see set_fragment_size()), in which
+ * case it starts with the varint message ID, total length and offset of the
+ * fragment, bit 5 says that the payload is sent reliably (see
+ * set_reliable()), in which case it starts with a session and a sequence
+ * number byte, and bit 6 says that it starts with an acknowledgement of the
+ * reliable payloads of a topic going the other way.  Bit 7 says that the
+ * payload has Reed-Solomon parity added so that damaged bytes can be
+ * corrected (see set_fec()).  Like PX4, the payload otherwise follows the
+ * header unchanged, so it has the same benefits and downsides.  The length
+ * and CRC are of the payload as sent, so a frame can be checked before it is
+ * decoded; with bit 7, the length includes the parity and the CRC is checked
+ * once the payload is corrected.  The largest frame that can be received is limited
+ * by the ring buffer size, but a fragmented payload is not.
+ *
+ * On a keyed link (see set_aead_key()), the payload as sent is encrypted and
+ * the CRC is replaced by a nonce and a ChaCha20-Poly1305 tag over the rest of
+ * the header and the encrypted payload:
+ *
+ * [>,>,version(3),flags,seq,topic_ID(1-3 bytes),length(4 bytes),nonce(8 bytes),tag(16 bytes)]
+ *
+ * where bit 0 of flags is always clear.  The receiver only accepts keyed
+ * frames, each nonce only once.
+ *
+ * The seq byte of the PX4 and v2 headers counts the frames of each topic
+ * separately, and is checked on receipt for lost, duplicated and reordered
+ * frames (see Metrics::sequence()).  COBS frames have no sequence number, so
+ * a COBS link that needs the loss counted should use v2 instead.
  */
 class Transporter
 {
@@ -91,7 +151,8 @@ public:
      * this constructor is expected to be called during the derived class
      * constructor to setup the Transporter.
      *
-     * @param[in] protocol The backend protocol to use; either 'px4' or 'cobs'.
+     * @param[in] protocol The backend protocol to use; one of 'px4', 'cobs',
+     *                     'cobs_zpe' or 'v2'.
      * @param[in] ring_buffer_size The number of bytes to allocate to the
      *                             underlying ring buffer that is used to
      *                             accept data from the UDP socket.  Larger
@@ -130,6 +191,120 @@ public:
      */
     virtual int close() {return 0;}
 
+    /**
+     * Get a file descriptor that becomes readable when node_read() has data.
+     *
+     * Callers can wait on this file descriptor (with poll, epoll, etc.) and
+     * only call read() or read_many() once it is readable, rather than
+     * relying on the underlying transport to wait.  If the derived class
+     * doesn't have such a file descriptor, it does not need to be overridden.
+     *
+     * @returns The file descriptor on success, or -1 if there isn't one.
+     */
+    virtual int get_read_fd() const {return -1;}
+
+    /**
+     * Get a file descriptor that becomes writable when node_write() can make
+     * progress.
+     *
+     * Callers that get an EBUSY failure from write() can wait for this file
+     * descriptor to become writable before trying again.  If the derived
+     * class doesn't have such a file descriptor, it does not need to be
+     * overridden.
+     *
+     * @returns The file descriptor on success, or -1 if there isn't one.
+     */
+    virtual int get_write_fd() const {return -1;}
+
+    /**
+     * Set how long a write waits for a backed up transport.
+     *
+     * When the underlying transport can't take any more data, writes wait
+     * for it to drain (without spinning) rather than failing straight away.
+     * If no data at all can be written for this long, the write gives up and
+     * fails with errno set to EBUSY.  The default is 100 milliseconds.
+     *
+     * @param[in] timeout_ms The time to wait for progress, in milliseconds.
+     */
+    void set_write_timeout(uint32_t timeout_ms)
+    {
+        write_timeout_ms_ = timeout_ms;
+    }
+
+    /**
+     * Hold the transporter in standby, or take it out.
+     *
+     * A bridge that stands by to take over a link from another one has its
+     * topics set up before the transport is opened (see init()), so its
+     * subscriptions already get messages.  In standby, write() and writev()
+     * throw them away, returning the payload length as if they had been
+     * written, rather than failing on a transport that isn't open yet.
+     * Nothing is counted as dropped.
+     *
+     * @param[in] standby Whether writes are thrown away.
+     */
+    void set_standby(bool standby)
+    {
+        standby_ = standby;
+    }
+
+    /**
+     * Get whether the transporter is in standby (see set_standby()).
+     *
+     * @returns true if writes are thrown away.
+     */
+    bool get_standby() const
+    {
+        return standby_;
+    }
+
+    /**
+     * Get the number of bytes written to the underlying transport that it
+     * hasn't sent yet (for instance, the UART output queue).
+     *
+     * Upper layers can use this to shed load before writes start to fail.
+     * If the derived class can't tell, it does not need to be overridden.
+     *
+     * @returns The number of bytes waiting to be sent, or -1 if unknown.
+     */
+    virtual ssize_t get_write_queue_bytes() const {return -1;}
+
+    /**
+     * Get the number of writes that timed out after writing part of their
+     * data.  The frame that was cut short will be dropped by the receiver
+     * as corrupt, even if the caller retries it.
+     *
+     * @returns The number of partial writes so far.
+     */
+    uint64_t get_partial_writes() const
+    {
+        return partial_writes_;
+    }
+
+    /**
+     * Get the number of bytes handed to the underlying transport, framing
+     * included.  Together with get_write_queue_bytes(), this shows how fast
+     * the transport is sending.
+     *
+     * @returns The number of bytes written so far.
+     */
+    uint64_t get_written_bytes() const
+    {
+        return written_bytes_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Get the latest round trip time measured from the acknowledgements of
+     * reliable topics (see set_reliable()).
+     *
+     * @returns The round trip time in microseconds, or -1 if none has been
+     *          measured yet.
+     */
+    int64_t get_last_rtt_us() const
+    {
+        return last_rtt_us_.load(std::memory_order_relaxed);
+    }
+
     /**
      * Read some data from the underlying transport and return the payload in
      * out_buffer.
@@ -146,11 +321,37 @@ public:
      * @returns The payload size on success, 0 if there are no messages
      *          available, and < 0 if the payload couldn't fit into the given
      *          buffer.
-     * @throws std::runtime_error If an internal contract was not fulfilled;
-     *         this is typically fatal.
      */
     ssize_t read(topic_id_size_t *topic_ID, uint8_t *out_buffer, size_t buffer_len);
 
+    /// The type of the callback that read_many() hands each message to.
+    using MessageVisitor = std::function<void(topic_id_size_t topic_ID, uint8_t *buffer, size_t length)>;
+
+    /**
+     * Read all of the available payloads from the underlying transport.
+     *
+     * This is the batch version of read().  Every complete message that is
+     * already in the ring buffer is handed to the visitor; if there were
+     * none, this calls down into the underlying transport once and then hands
+     * every complete message that arrived to the visitor.  Each message is
+     * unpacked into out_buffer, which is reused for the next message as soon
+     * as the visitor returns.  PX4 payloads that are contiguous in the ring
+     * buffer are handed to the visitor in place rather than copied into
+     * out_buffer, so the visitor must only use the buffer it is given, and
+     * only until it returns.
+     *
+     * If the underlying transport delivers whole frames (see
+     * datagram_frames_), the messages are parsed straight out of the frames
+     * instead, without going through the ring buffer.
+     *
+     * @param[out] out_buffer The buffer to receive each payload into.
+     * @param[in] buffer_len The maximum buffer length to receive a payload into.
+     * @param[in] visitor The callback to hand each message to.
+     * @returns The number of messages handed to the visitor on success (which
+     *          may be 0), or < 0 if the underlying transport failed.
+     */
+    ssize_t read_many(uint8_t *out_buffer, size_t buffer_len, const MessageVisitor & visitor);
+
     /**
      * Write data from a buffer out to the underlying transport.
      *
@@ -165,126 +366,1741 @@ public:
      */
     ssize_t write(topic_id_size_t topic_ID, uint8_t const *buffer, size_t data_length);
 
-    // These methods and members are protected because derived classes need
-    // access to them.
-protected:
     /**
-     * Pure virtual method to read data from the underlying transport.
+     * Write data from a set of buffers out to the underlying transport.
      *
-     * Derived classes should override this method to read some data from the
-     * underlying transport and store it into the ring buffer.  How much data
-     * to read and how long to wait for the data is implementation specific.
+     * This is the scatter-gather version of write(); the payload is the
+     * concatenation of the iovcnt buffers described by iov.  For the PX4
+     * protocol the header and payload buffers are handed to the underlying
+     * node_writev() without being copied; for the COBS protocol they are
+     * stuffed in a single pass into a frame buffer owned by the Transporter.
+     * A payload longer than the fragment size (see set_fragment_size()) is
+     * sent as all of its fragments in a row.
      *
-     * @returns The number of bytes read, or -1 on error.
+     * @param[in] topic_ID The topic ID to add to the message.
+     * @param[in] iov The buffers containing the payload to send.
+     * @param[in] iovcnt The number of buffers in iov.
+     * @returns The payload length written on success, or -1 on error.
      */
-    virtual ssize_t node_read() = 0;
+    ssize_t writev(topic_id_size_t topic_ID, const struct iovec *iov, int iovcnt);
 
     /**
-     * Pure virtual method to write data to the underlying transport.
+     * Configure write batching.
      *
-     * Derived classes should override this method to write some data to the
-     * underlying transport.  This method should not return until either all
-     * of the data has been written or an error occurs.
+     * With batching enabled, write() and writev() append each frame to a
+     * batch buffer instead of writing it to the underlying transport, and the
+     * whole batch goes out in a single node_write() once the next frame would
+     * not fit, or when flush() is called.  Both the PX4 and COBS framings are
+     * self-delimiting, so the receiver handles back-to-back frames without
+     * changes.  Frames that are larger than the batch size on their own are
+     * written directly, after the pending batch.  Callers that enable
+     * batching are responsible for calling flush() so frames don't sit in
+     * the batch indefinitely.  If the underlying transport delivers whole
+     * frames (like a UDP transport in datagram mode), the frames in a batch
+     * are still written out together but each one stays a separate datagram.
      *
-     * @params[in] buffer The buffer containing the data to write.
-     * @params[in] len The number of bytes in the buffer to write.
-     * @returns The number of bytes written on success (which must be equal to
-     *          len), or -1 on error.
+     * @param[in] batch_size The size of the batch buffer in bytes (for
+     *                       instance, the UART FIFO size or the path MTU), or
+     *                       0 to disable batching.  Any frames pending in
+     *                       the previous batch are flushed first.
+     * @returns 0 on success, or -1 if flushing the pending batch failed.
      */
-    virtual ssize_t node_write(void *buffer, size_t len) = 0;
+    int set_write_batching(size_t batch_size);
 
     /**
-     * Pure virtual method to detect whether the file descriptors are ready.
+     * Configure message bundling.
      *
-     * Derived classes should override this method to determine whether the
-     * underlying transport is ready to send and receive data.
+     * With bundling enabled, write() and writev() pack small payloads into a
+     * bundle instead of sending each one in a frame of its own, and the
+     * bundle goes out as a single frame on bundle_topic_ID once the next
+     * payload would not fit, or when flush() is called.  The bundle is a
+     * list of records of the form [topic_ID(varint),length(varint),payload]
+     * (without the length for the topics given to set_fixed_length()), so a
+     * small payload costs two or three bytes instead of a header and a CRC
+     * of its own, and the receiver parses one frame for all of them.
+     * Payloads of reliable, compressed or delta encoded topics, and payloads
+     * that are fragmented or don't fit in a bundle on their own, are sent in
+     * frames of their own as usual; a topic's payloads stay in order, since
+     * the bundle is sent first if it holds one of the topic's payloads.
+     * Like with batching, callers are responsible for calling flush() (see
+     * TxQueue::set_flush_delay()) so payloads don't sit in the bundle
+     * indefinitely.
      *
-     * @returns true if the underlying transport is ready to send and receive
-     *          data, false otherwise.
+     * Both sides have to agree on bundle_topic_ID: bundles received on it
+     * are unpacked, and read() and read_many() hand out the payloads in them
+     * one by one as if they had come in frames of their own.  Neither 0 nor 1
+     * may be used, and no topic may be mapped to bundle_topic_ID.  This must
+     * be called before anything is read or written.
+     *
+     * @param[in] bundle_topic_ID The topic ID that bundles are sent and
+     *                            received on, or 0 to disable bundling.
+     * @param[in] bundle_size The most payload bytes to send in one bundle, or
+     *                        0 to only unpack the bundles that are received.
+     * @returns 0 on success, or -1 if bundle_topic_ID is reserved or above
+     *          get_max_topic_ID(), bundle_size is too large for the protocol,
+     *          or sending the pending bundle failed.
      */
-    virtual bool fds_OK() = 0;
+    int set_bundling(topic_id_size_t bundle_topic_ID, size_t bundle_size);
 
     /**
-     * Method to add the CRC16 of one additional byte.
+     * Get the topic ID set by set_bundling().
      *
-     * Given an existing CRC16 and a new byte, update the CRC16 to include the
-     * data from the new byte.
+     * @returns The topic ID that bundles are sent and received on, or 0 if
+     *          bundling is disabled.
+     */
+    topic_id_size_t get_bundle_topic_ID() const
+    {
+        return bundle_topic_ID_;
+    }
+
+    /**
+     * Leave the length of a topic's payloads out of the bundles they are
+     * sent in.
      *
-     * @param[in] crc The existing CRC16.
-     * @param[in] data The new byte to add to the CRC16.
-     * @returns The new CRC16.
+     * For a topic whose payloads are always the same length (a message type
+     * with a fixed CDR layout), the records in a bundle are of the form
+     * [topic_ID(varint),payload], so that a small payload of a topic ID below
+     * 128 costs a single byte.  Both sides have to agree on the topics and
+     * their lengths (see the fixed_sizes of SerialMapping), since a receiver
+     * that doesn't know the length can't find the records after it.  A
+     * payload of the topic that isn't this long is sent in a frame of its
+     * own.  This must be called after set_bundling(), and before anything is
+     * read or written.
+     *
+     * @param[in] topic_ID The topic ID to leave the length out for.
+     * @param[in] length The length of every payload of the topic.
+     * @returns 0 on success, or -1 if bundling is disabled, topic_ID is the
+     *          bundle topic ID, or length is 0.
      */
-    uint16_t crc16_byte(uint16_t crc, uint8_t data);
+    int set_fixed_length(topic_id_size_t topic_ID, uint32_t length);
 
     /**
-     * Method to calculate the CRC16 of an entire buffer.
+     * Switch the receive ring buffer to mirrored memory.
      *
-     * @param[in] buffer The buffer to calculate the CRC16 over.
-     * @param[in] len The length of the buffer to calculate.
-     * @returns The CRC16 of the entire buffer.
+     * This maps the ring buffer memory twice in a row (see
+     * impl::RingBuffer::set_mirrored()), so that frames that wrap around the
+     * end of the ring can still be parsed in place without being copied.  The
+     * ring buffer size is rounded up to a multiple of the page size.  This
+     * must be called before any data has been received.
+     *
+     * @returns 0 on success, or -1 if data was already received or the
+     *          platform doesn't support mirrored memory, in which case the
+     *          ordinary ring buffer keeps being used.
      */
-    uint16_t crc16(uint8_t const *buffer, size_t len);
+    int set_ring_buffer_mirrored()
+    {
+        return ringbuf_.set_mirrored();
+    }
 
-    impl::RingBuffer ringbuf_;
+    /**
+     * Let the receive ring buffer grow with bursts of data, and shrink back
+     * when they are over.
+     *
+     * The ring buffer grows, up to max_size, when it fills up, and shrinks
+     * back to the size it was constructed with, giving the memory back,
+     * after it has stayed mostly empty for a while (see
+     * impl::RingBuffer::set_adaptive()).  This must be called before any
+     * data has been received.
+     *
+     * @param[in] max_size The most bytes the ring buffer may grow to.
+     * @returns 0 on success, or -1 if data was already received, max_size
+     *          isn't larger than the ring buffer, or the memory couldn't be
+     *          reserved.
+     */
+    int set_ring_buffer_max_size(size_t max_size)
+    {
+        return ringbuf_.set_adaptive(max_size);
+    }
 
-    // These methods and members are protected because the tests need access
-    // to them.
-protected:
-    enum class SerialProtocol
+    /**
+     * Change the size of the receive ring buffer, keeping whatever was
+     * received but not read yet (see impl::RingBuffer::resize()).
+     *
+     * This must only be called from the thread that reads, between reads.
+     *
+     * @param[in] size The new size in bytes.
+     * @returns 0 on success, or -1 if size is 0 or too small for what is in
+     *          the ring buffer, or the memory couldn't be had.
+     */
+    int set_ring_buffer_size(size_t size)
     {
-        PX4,
-        COBS,
-    };
+        return ringbuf_.resize(size);
+    }
 
-    /** Get the length of the header.
+    /**
+     * Get the number of times received data was overwritten because the
+     * receive ring buffer overflowed.
      *
-     * @returns The length of the header.
+     * This must only be called from the thread that reads.
+     *
+     * @returns The number of overflows so far.
      */
-    size_t get_header_length();
+    uint64_t get_ring_overflows() const
+    {
+        return ringbuf_.get_overflows();
+    }
 
     /**
-     * Internal method to find a valid serial message in the ring buffer.
+     * Choose the CRC that is sent with each payload.
      *
-     * This method goes looking through the ring buffer for a valid serial
-     * message (what constitues a valid serial message depends on the serial
-     * protocol currently in use).  If it finds a valid message, it unpacks it,
-     * stuffs the corresponding topic_ID, and fills in the output buffer with
-     * the payload.
+     * This only applies to the v2 protocol, which can protect payloads
+     * with a CRC-32C instead of the CRC-16 that PX4 and COBS use.  The
+     * receiver takes the CRC type from each frame, so this only affects
+     * writes.  The CRC-32C is computed with the CPU's CRC instructions when
+     * they are available (see impl::CRC32C).
      *
-     * @param[out] topic_ID The topic ID corresponding to the payload (only
-     *                      valid if the return value > 0).
-     * @param[out] out_buffer The buffer to receive the payload into.
-     * @param[in] buffer_len The maximum buffer length to receive the payload into.
-     * @returns The payload length on success (which may be 0, and < 0 if a
-     *          valid message could not be returned.
-     * @throws std::runtime_error If an internal contract was not fulfilled;
-     *         this is typically fatal.
+     * @param[in] enable true to send a CRC-32C, false to send a CRC-16 (the
+     *                   default).
+     * @returns 0 on success, or -1 if the protocol isn't v2.
      */
-    ssize_t find_and_copy_message(topic_id_size_t *topic_ID, uint8_t *out_buffer, size_t buffer_len);
+    int set_crc32c(bool enable);
 
-private:
-    SerialProtocol backend_protocol_;
-    uint8_t seq_{0};
-    struct __attribute__((packed)) PX4Header
+    /**
+     * Compress the payloads of a topic.
+     *
+     * This only applies to the v2 protocol.  Payloads of at least threshold
+     * bytes are compressed with impl::LZ4Codec before they are sent, and are
+     * sent compressed only if that makes them smaller.  The receiver takes
+     * whether a payload is compressed from each frame, and decompresses
+     * frames for topics that weren't given to this method without a
+     * dictionary.
+     *
+     * @param[in] topic_ID The topic ID to compress payloads for.
+     * @param[in] threshold The smallest payload length to try compressing;
+     *                      SIZE_MAX to only use the dictionary for payloads
+     *                      that are received.
+     * @param[in] dictionary The dictionary to compress and decompress the
+     *                       payloads of the topic with, which the other end
+     *                       of the link must also use; may be empty.
+     * @returns 0 on success, or -1 if the protocol isn't v2.
+     */
+    int set_compression(topic_id_size_t topic_ID, size_t threshold, const std::vector<uint8_t> & dictionary);
+
+    /**
+     * Send the payloads of a topic as deltas against the previous payload.
+     *
+     * This only applies to the v2 protocol, and is meant for topics that are
+     * sent over and over with mostly the same content.  The last payload of
+     * the topic is kept, and each new payload of the same length is sent as
+     * the runs of bytes that changed since then; a payload that didn't
+     * change at all is sent as a 2-byte keepalive.  Every keyframe_interval
+     * payloads, and whenever a delta wouldn't be smaller, the whole payload
+     * is sent instead, so that a receiver that missed a frame can pick up
+     * again.  The receiver takes everything it needs from the frames, so this
+     * only affects writes.  Deltas are compressed like any other payload if
+     * set_compression() was also called for the topic.
+     *
+     * @param[in] topic_ID The topic ID to send deltas for.
+     * @param[in] keyframe_interval How often to send the whole payload; 1
+     *                              means every time, which effectively
+     *                              disables deltas.
+     * @returns 0 on success, or -1 if the protocol isn't v2 or
+     *          keyframe_interval is 0.
+     */
+    int set_delta_encoding(topic_id_size_t topic_ID, uint32_t keyframe_interval);
+
+    /**
+     * Send payloads that are longer than fragment_size in fragments of at
+     * most fragment_size bytes each.
+     *
+     * This only applies to the v2 protocol.  Each fragment is a frame of its
+     * own, carrying a message ID and the offset of its data in the payload,
+     * so a long payload doesn't need a buffer as large as itself anywhere on
+     * the way, and the frames of other topics can be sent in between its
+     * fragments (see write_fragment() and TxQueue).  Fragmented payloads are
+     * never compressed or sent as deltas.  The receiver reassembles the
+     * fragments whatever this is set to, so this only affects writes.
+     *
+     * @param[in] fragment_size The most payload bytes to send in one frame,
+     *                          including the up to 15 bytes that say where
+     *                          the fragment goes, or 0 to never fragment (the
+     *                          default).
+     * @returns 0 on success, or -1 if the protocol isn't v2 or fragment_size
+     *          leaves no room for data.
+     */
+    int set_fragment_size(size_t fragment_size);
+
+    /**
+     * Get the fragment size set by set_fragment_size().
+     *
+     * @returns The most payload bytes sent in one frame, or 0 if payloads are
+     *          never fragmented.
+     */
+    size_t get_fragment_size() const
     {
-        uint8_t marker[3];
-        topic_id_size_t topic_ID;
-        uint8_t seq;
-        uint8_t payload_len_h;
-        uint8_t payload_len_l;
-        uint8_t crc_h;
-        uint8_t crc_l;
-    };
+        return fragment_size_;
+    }
 
-    struct __attribute__((packed)) COBSHeader
+    /**
+     * Add forward error correction to the payloads that are sent.
+     *
+     * This only applies to the v2 protocol, and is meant for links that
+     * damage the odd byte often enough that many frames would otherwise fail
+     * their CRC, such as long range radios.  Each payload is sent with
+     * impl::ReedSolomon parity added, 32 bytes for each 223 bytes (or less)
+     * of payload, and the receiver corrects up to 16 damaged bytes in each
+     * block before it checks the CRC.  The header has no parity, so a frame
+     * whose header is damaged is still lost.  The receiver corrects the
+     * payloads that have parity whatever this is set to, so this only
+     * affects writes.
+     *
+     * @param[in] enable true to add parity to payloads, false not to (the
+     *                   default).
+     * @returns 0 on success, or -1 if the protocol isn't v2.
+     */
+    int set_fec(bool enable);
+
+    /**
+     * Encrypt and authenticate the frames of the link with a key.
+     *
+     * This only applies to the v2 protocol, and is meant for links that
+     * others can listen in on or send to, such as radios.  Each payload is
+     * encrypted with impl::ChaCha20Poly1305, and its tag authenticates the
+     * payload and the header in place of the CRC (so there is no CRC-32C
+     * either); the header itself isn't encrypted.  Both ends of the link must
+     * be given the same key, which should be random and used for no other
+     * link, and different sides.
+     *
+     * The nonce of each frame is the side in its top bit and a counter that
+     * starts from the wall clock time in nanoseconds, so the nonces of the
+     * two sides never meet, and a restart never repeats one as long as the
+     * clock doesn't go back.  The receiver drops frames with a bad tag, with
+     * its own side's nonces, and with a nonce it has seen before or that is
+     * too far behind the highest one (see AEAD_REPLAY_WINDOW in the source),
+     * counting them all as CRC drops.  Once this is called, frames that
+     * aren't keyed are thrown away as garbage.  This must be called before
+     * any data is sent or received.
+     *
+     * @param[in] key The impl::ChaCha20Poly1305::KEY_LEN byte key.
+     * @param[in] side The side of the link this end is, 0 or 1.
+     * @returns 0 on success, or -1 if the protocol isn't v2, the key is the
+     *          wrong length, or side isn't 0 or 1.
+     */
+    int set_aead_key(const std::vector<uint8_t> & key, unsigned int side);
+
+    /**
+     * Send the payloads of a topic reliably.
+     *
+     * This only applies to the v2 protocol.  Each payload of the topic is
+     * numbered and kept until the receiver acknowledges it, and is sent
+     * again if it isn't acknowledged in time (selective repeat ARQ).  Up to
+     * RELIABLE_WINDOW payloads of the topic can be waiting for an
+     * acknowledgement at once; writing another one fails with errno set to
+     * ENOBUFS until the oldest is acknowledged.  The retransmit timeout
+     * follows the round trip time measured from the acknowledgements (as in
+     * RFC 6298), and doubles each time the same payload is sent again; a
+     * payload that still isn't acknowledged after RELIABLE_MAX_RETRANSMITS
+     * retransmits is given up on and counted as a write failure.  Reliable
+     * payloads are never compressed, sent as deltas or fragmented.
+     *
+     * The receiver acknowledges the reliable payloads of any topic, whatever
+     * this is set to, and drops the ones it already has, but a payload that
+     * was lost and sent again can be delivered after later ones.  The
+     * acknowledgements ride along on the next payload going the other way
+     * where they can, and are sent on their own otherwise.  Retransmits and
+     * acknowledgements that go on their own are only sent by
+     * service_reliable(), which must be called regularly on both ends.
+     *
+     * A payload that can't be written at all is sent again like one that was
+     * lost.  This must not be called while another thread is writing.
+     *
+     * @param[in] topic_ID The topic ID to send payloads reliably for.
+     * @returns 0 on success, or -1 if the protocol isn't v2.
+     */
+    int set_reliable(topic_id_size_t topic_ID);
+
+    /**
+     * Send the retransmits and acknowledgements that are due.
+     *
+     * Any frames that were sent go out before this returns, even if write
+     * batching is enabled.  This is normally called from the thread that
+     * reads, between reads.
+     *
+     * @param[in] now The current time.
+     * @returns The number of milliseconds until this next needs to be
+     *          called, or -1 if nothing is waiting; the notify callback (see
+     *          set_reliable_notify()) is called when that changes from -1.
+     */
+    int service_reliable(std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
+
+    /**
+     * Set a callback to call when a reliable payload is sent while none of
+     * its topic were waiting for an acknowledgement, so a thread that waits
+     * for the time returned by service_reliable() knows to stop waiting.  It
+     * is called with the write lock held, so it must not write to the
+     * transporter.  This must not be called while another thread is writing.
+     *
+     * @param[in] notify The callback, or an empty function for none.
+     */
+    void set_reliable_notify(std::function<void()> notify)
     {
-        topic_id_size_t topic_ID;
-        uint8_t payload_len_h;
-        uint8_t payload_len_l;
-        uint8_t crc_h;
-        uint8_t crc_l;
+        reliable_notify_ = std::move(notify);
+    }
+
+    /**
+     * Only write as much as the other end has said it can take.
+     *
+     * A microcontroller that reads the serial port into a fixed size buffer
+     * loses data once the bridge gets too far ahead of it.  With flow
+     * control, the other end grants receive credits in
+     * ros2_serial_msgs/FlowCredits messages on topic 0 (see
+     * handle_flow_credits()), and a frame that would go past them isn't
+     * written: the write fails with errno set to EBUSY, as for a transport
+     * that is backed up, and waiting_for_credits() returns true until a
+     * frame is written again.  Nothing can be written until the first grant
+     * comes in, so this must only be enabled for an other end that sends
+     * them.  The credits are counted in bytes on the wire, including the
+     * framing.  This must not be called while another thread is writing.
+     *
+     * @param[in] enable Whether to limit writes to the credits.
+     */
+    void set_flow_control(bool enable);
+
+    /**
+     * Get whether writes are limited to the receive credits of the other
+     * end (see set_flow_control()).
+     *
+     * @returns true if flow control is enabled.
+     */
+    bool get_flow_control() const
+    {
+        return flow_control_;
+    }
+
+    /**
+     * Take in a ros2_serial_msgs/FlowCredits message received on topic 0.
+     *
+     * The message says how many bytes the other end has taken off the wire
+     * so far, and how many more it can take after those without losing any;
+     * everything up to there may be written.  The first grant, and one whose
+     * count went back (because the other end was reset), are taken to mean
+     * that nothing is on the way.  This must only be called from the thread
+     * that reads, and never blocks.
+     *
+     * @param[in] buffer The CDR serialized message.
+     * @param[in] length The length of the message.
+     * @returns 0 on success, or -1 if the message isn't a FlowCredits or
+     *          flow control isn't enabled.
+     */
+    int handle_flow_credits(const uint8_t *buffer, size_t length);
+
+    /**
+     * Get the number of bytes that can be written before the receive credits
+     * of the other end run out.
+     *
+     * @returns The number of bytes; 0 until the first grant comes in.
+     */
+    size_t get_credits() const;
+
+    /**
+     * Get whether the last write failed because the receive credits of the
+     * other end had run out (see set_flow_control()), so there is no point
+     * writing again until the notify callback (see set_credit_notify()) is
+     * called.
+     *
+     * @returns true if writes are waiting for credits.
+     */
+    bool waiting_for_credits() const
+    {
+        return credit_stalled_;
+    }
+
+    /**
+     * Set a callback to call when the other end grants more receive credits.
+     * It is called on the thread that reads, and must not write to the
+     * transporter.  This must not be called while another thread is reading.
+     *
+     * @param[in] notify The callback, or an empty function for none.
+     */
+    void set_credit_notify(std::function<void()> notify)
+    {
+        credit_notify_ = std::move(notify);
+    }
+
+    /// The kind of a ros2_serial_msgs/FlowCredits message, which tells it
+    /// apart from a LinkCapabilities on topic 0.
+    static constexpr uint8_t FLOW_CREDITS_KIND = 2;
+
+    /// The most reliable payloads of a topic that can wait for an
+    /// acknowledgement at once.
+    static constexpr size_t RELIABLE_WINDOW = 8;
+
+    /// The most times a reliable payload is sent again before giving up.
+    static constexpr uint32_t RELIABLE_MAX_RETRANSMITS = 10;
+
+    /// Where a payload being sent with write_fragment() is up to.
+    struct FragmentCursor final
+    {
+        /// The offset in the payload of the next fragment to send.
+        size_t offset{0};
+        /// The message ID of the payload, assigned by the first fragment.
+        uint32_t message_ID{0};
     };
-    std::mutex write_mutex_;
+
+    /**
+     * Write the next fragment of a payload out to the underlying transport.
+     *
+     * The first call for a payload must have cursor->offset set to 0, and
+     * the cursor is moved on past each fragment that is written; once
+     * cursor->offset reaches length, the whole payload has been sent.  Other
+     * frames may be written in between the fragments, but the fragments of
+     * one topic must not be mixed with other payloads of the same topic.
+     * The payloads of reliable topics (see set_reliable()) are sent whole,
+     * as a single fragment.
+     *
+     * @param[in] topic_ID The topic ID to add to the message.
+     * @param[in] buffer The buffer containing the whole payload.
+     * @param[in] length The length of the whole payload.
+     * @param[in,out] cursor Where the payload is up to.
+     * @returns The number of payload bytes in the fragment on success, or -1
+     *          on error, in which case the cursor is left as it was.  This
+     *          fails with errno set to EINVAL if fragmentation isn't enabled.
+     */
+    ssize_t write_fragment(topic_id_size_t topic_ID, uint8_t const *buffer, size_t length, FragmentCursor *cursor);
+
+    /**
+     * Allocate the buffers used to compress, decompress and delta encode
+     * payloads up front, rather than growing them as payloads come along.
+     *
+     * After this, framing payloads of up to max_payload bytes doesn't
+     * allocate, including the delta bases and the reassembly of fragmented
+     * payloads of the given received topics, as long as the buffers passed
+     * to read() are no larger than max_payload either.  This must be called after set_compression() and set_delta_encoding(),
+     * and before anything is read or written.
+     *
+     * @param[in] max_payload The largest payload that will be sent or
+     *                        received.
+     * @param[in] rx_topic_IDs The topics that may be received as deltas.
+     */
+    void reserve_buffers(size_t max_payload, const std::vector<topic_id_size_t> & rx_topic_IDs);
+
+    /**
+     * Set the largest payload each received topic can carry, replacing any
+     * that were set before.
+     *
+     * The PX4 and COBS parsers treat a header that claims a longer payload
+     * for its topic as garbage straight away, rather than waiting for that
+     * much data, since it is most likely a marker inside another payload or
+     * a corrupt length.  Topics that aren't given have no limit other than
+     * the size of the buffer passed to read().  The v2 protocol uses the
+     * limits for fragmented payloads, which are dropped as soon as the first
+     * fragment claims a longer one.  This may be called while another thread
+     * is reading.
+     *
+     * @param[in] max_payloads The largest payload by topic ID; topic IDs
+     *                         above get_max_topic_ID() are ignored.
+     */
+    void set_rx_max_payloads(const std::map<topic_id_size_t, size_t> & max_payloads);
+
+    /**
+     * Record the raw data read from and written to the underlying transport
+     * in a capture file (see LinkCapture), for replaying it later with a
+     * ReplayTransporter.  Every chunk handed over by node_read() (or frame by
+     * node_read_frames()) is one record, as is every frame or batch of
+     * frames written.  This must not be called while another thread is
+     * reading or writing.
+     *
+     * @param[in] path The path of the capture file, which is replaced; an
+     *                 empty path stops capturing.
+     * @returns 0 on success, or -1 if the file couldn't be created.
+     */
+    int set_capture(const std::string & path);
+
+    /**
+     * Keep the raw data read from and written to the underlying transport
+     * in a flight recorder (see FlightRecorder): the latest size bytes of
+     * it, in memory, for dumping to a capture file when something goes
+     * wrong.  Records are taken as for set_capture(), and the two can be
+     * used together.  This must not be called while another thread is
+     * reading or writing.
+     *
+     * @param[in] size The size of the flight recorder in bytes, or 0 to
+     *                 stop recording.
+     * @returns 0 on success, or -1 if the memory couldn't be mapped.
+     */
+    int set_flight_recorder(size_t size);
+
+    /**
+     * Write what the flight recorder holds to a capture file, which can be
+     * read with a LinkCaptureReader or played back with a
+     * ReplayTransporter.  This may be called from any thread, while others
+     * read and write; the recording carries on.
+     *
+     * @param[in] path The path of the capture file, which is replaced.
+     * @returns 0 on success, or -1 if there is no flight recorder or the
+     *          file couldn't be written.
+     */
+    int dump_flight_recorder(const std::string & path);
+
+    /**
+     * Switch to a different serial wire protocol.
+     *
+     * This is meant for switching both ends of a link over once they have
+     * agreed on a protocol (see negotiate_link()), so it must not be called
+     * while another thread is reading or writing.  Any frames pending in the
+     * batch buffer are written out in the old protocol first, and anything
+     * left in the receive ring buffer is thrown away, since it can't be
+     * parsed with the new protocol.
+     *
+     * @param[in] protocol The protocol to switch to; one of 'px4', 'cobs',
+     *                     'cobs_zpe' or 'v2'.
+     * @returns 0 on success, or -1 if the protocol is invalid, flushing the
+     *          batch failed, or the protocol isn't v2 and v2 only features
+     *          (see set_crc32c(), set_compression(), set_delta_encoding(),
+     *          set_fragment_size(), set_reliable(), set_fec() and
+     *          set_aead_key()) are in use.
+     */
+    int set_protocol(const std::string & protocol);
+
+    /**
+     * Get the serial wire protocol in use.
+     *
+     * @returns The protocol; one of 'px4', 'cobs', 'cobs_zpe' or 'v2'.
+     */
+    std::string get_protocol() const;
+
+    /**
+     * Change the baudrate of the underlying transport.
+     *
+     * Transports that have a baudrate (like a UART) override this to wait
+     * for everything written so far to be sent at the old rate and then
+     * switch.  Others don't need to override it.
+     *
+     * @param[in] baudrate The baudrate in bits per second.
+     * @returns 0 on success, or -1 on error or if the transport has no
+     *          baudrate.
+     */
+    virtual int set_baudrate(uint32_t baudrate)
+    {
+        (void)baudrate;
+        return -1;
+    }
+
+    /**
+     * Get the baudrate of the underlying transport.
+     *
+     * @returns The baudrate in bits per second, or 0 if the transport has no
+     *          baudrate or it was left as it was.
+     */
+    virtual uint32_t get_baudrate() const {return 0;}
+
+    /**
+     * Change how long a read waits for data to come in, the read_poll_ms
+     * the transport was constructed with.
+     *
+     * Every transport overrides this; it must only be called from the
+     * thread that reads.
+     *
+     * @param[in] read_poll_ms The time to wait in milliseconds.
+     * @returns 0 on success, or -1 if the transport doesn't wait.
+     */
+    virtual int set_read_poll_ms(uint32_t read_poll_ms)
+    {
+        (void)read_poll_ms;
+        return -1;
+    }
+
+    /**
+     * Choose whether the payloads of a topic are sent on every link of the
+     * transport, or on only one of them.
+     *
+     * Transports with several links (like a BondedTransporter) override
+     * this.  Others don't need to override it.
+     *
+     * @param[in] topic_ID The topic ID.
+     * @param[in] redundant Whether to send the payloads on every link.
+     * @returns 0 on success, or -1 on error or if the transport has only
+     *          one link.
+     */
+    virtual int set_redundant(topic_id_size_t topic_ID, bool redundant)
+    {
+        (void)topic_ID;
+        (void)redundant;
+        return -1;
+    }
+
+    /**
+     * Get the largest topic ID the protocol can carry.
+     *
+     * @returns The largest topic ID that can be passed to write().
+     */
+    topic_id_size_t get_max_topic_ID() const;
+
+    /**
+     * Write out any payloads pending in the bundle and any frames pending in
+     * the batch buffer.
+     *
+     * @returns The number of bytes written to the underlying transport on
+     *          success (0 if nothing was pending), or -1 on error.
+     */
+    ssize_t flush();
+
+    /**
+     * Get the number of bytes pending in the bundle and the batch buffer.
+     *
+     * @returns The number of bytes that will be written by the next flush(),
+     *          not counting the header of the bundle.
+     */
+    size_t get_pending_write_bytes();
+
+    /**
+     * Get the metrics of the messages going through this transporter.
+     *
+     * The counters are always kept; the latency histograms only once timing
+     * is enabled with Metrics::set_timing().
+     *
+     * @returns The Metrics object of this transporter.
+     */
+    Metrics & get_metrics()
+    {
+        return metrics_;
+    }
+
+    /**
+     * Get the time the message being handed to a read_many() visitor, or the
+     * message last returned by read(), was received.
+     *
+     * This is taken as soon as the read from the underlying transport that
+     * completed the message returns, unless the transport can tell when the
+     * data arrived: UDP from the timestamps the kernel takes (see
+     * UDPTransporter::set_kernel_timestamps()), and a UART from its baud
+     * rate (see UARTTransporter::set_arrival_estimate()).  It is the system
+     * (wall clock) time, so that it can be used to stamp the messages that
+     * are published.
+     *
+     * @returns The receive time, or a default constructed time_point if
+     *          nothing has been received yet.
+     */
+    std::chrono::system_clock::time_point get_receive_time() const
+    {
+        return rx_time_;
+    }
+
+    /**
+     * Get the sequence number from the header of the frame that the last
+     * message handed out by read() or read_many() came in.  Like
+     * get_receive_time(), this is only valid until the next message.
+     *
+     * @returns The sequence number, or -1 if the protocol has none (COBS) or
+     *          nothing has been received yet.
+     */
+    int get_receive_sequence() const
+    {
+        return rx_seq_;
+    }
+
+    /**
+     * Write a frame that is already framed in the protocol of this
+     * transport, for instance by another Transporter with the same
+     * protocol, as it is.
+     *
+     * The frame goes out after any batched frames.  It isn't counted in the
+     * metrics, and flow control doesn't hold it back; whoever framed it is
+     * expected to have done that.
+     *
+     * @param[in] topic_ID The topic ID in the frame.
+     * @param[in] iov The buffers containing the frame.
+     * @param[in] iovcnt The number of buffers in iov.
+     * @returns The number of bytes written on success, or -1 on error.
+     */
+    ssize_t write_framed(topic_id_size_t topic_ID, const struct iovec *iov, int iovcnt);
+
+    // These methods and members are protected because derived classes need
+    // access to them.
+protected:
+    /**
+     * Pure virtual method to read data from the underlying transport.
+     *
+     * Derived classes should override this method to read some data from the
+     * underlying transport and store it into the ring buffer.  How much data
+     * to read and how long to wait for the data is implementation specific.
+     *
+     * @returns The number of bytes read, or -1 on error.
+     */
+    virtual ssize_t node_read() = 0;
+
+    /**
+     * Pure virtual method to write data to the underlying transport.
+     *
+     * Derived classes should override this method to write some data to the
+     * underlying transport.  This method should not return until either all
+     * of the data has been written or an error occurs.
+     *
+     * @params[in] buffer The buffer containing the data to write.
+     * @params[in] len The number of bytes in the buffer to write.
+     * @returns The number of bytes written on success (which must be equal to
+     *          len), or -1 on error.
+     */
+    virtual ssize_t node_write(void *buffer, size_t len) = 0;
+
+    /**
+     * Virtual method to write a set of buffers to the underlying transport.
+     *
+     * This is called with at most MAX_NODE_IOVECS buffers, the first of which
+     * is always the protocol header.  The default implementation gathers the
+     * buffers into the frame buffer and calls node_write(); derived classes
+     * that can do scatter-gather I/O should override it.  Like node_write(),
+     * this method should not return until either all of the data has been
+     * written or an error occurs.
+     *
+     * @params[in] iov The buffers containing the data to write.
+     * @params[in] iovcnt The number of buffers in iov.
+     * @returns The number of bytes written on success (which must be equal to
+     *          the sum of the buffer lengths), or -1 on error.
+     */
+    virtual ssize_t node_writev(const struct iovec *iov, int iovcnt);
+
+    /// The maximum number of buffers that will be passed to node_writev().
+    static constexpr int MAX_NODE_IOVECS = 16;
+
+    /// The type of the callback that node_read_frames() hands each frame to.
+    using FrameVisitor = std::function<void(const uint8_t *frame, size_t length)>;
+
+    /**
+     * Virtual method to read whole frames from the underlying transport.
+     *
+     * This is only called if datagram_frames_ is set.  Derived classes that
+     * set it must override this method to receive some data, and hand each
+     * unit of data that was received (for instance, a datagram) to the
+     * visitor as a single frame, without going through the ring buffer.  How
+     * much data to read and how long to wait for the data is implementation
+     * specific.  The default implementation fails with errno set to ENOTSUP.
+     *
+     * @params[in] visitor The callback to hand each frame to.
+     * @returns The number of frames handed to the visitor (which may be 0),
+     *          or -1 on error.
+     */
+    virtual ssize_t node_read_frames(const FrameVisitor & visitor);
+
+    /**
+     * Virtual method to read a whole message from the underlying transport.
+     *
+     * This is only called if whole_messages_ is set.  Derived classes that
+     * set it must override this method to get the next message that was
+     * received, already unpacked, for read().  The default implementation
+     * fails with errno set to ENOTSUP.
+     *
+     * @params[out] topic_ID The topic ID of the message.
+     * @params[out] out_buffer The buffer to receive the payload into.
+     * @params[in] buffer_len The maximum buffer length to receive the payload
+     *                        into.
+     * @returns The payload size on success, -ENODATA if there is no message,
+     *          or < 0 on error.
+     */
+    virtual ssize_t node_read_message(topic_id_size_t *topic_ID, uint8_t *out_buffer, size_t buffer_len);
+
+    /**
+     * Virtual method to read whole messages from the underlying transport.
+     *
+     * This is only called if whole_messages_ is set.  Derived classes that
+     * set it must override this method to receive some data, and hand each
+     * message that was received, already unpacked, to the visitor, for
+     * read_many().  The same rules apply to the buffers as for read_many().
+     * The default implementation fails with errno set to ENOTSUP.
+     *
+     * @params[out] out_buffer The buffer to receive each payload into.
+     * @params[in] buffer_len The maximum buffer length to receive a payload
+     *                        into.
+     * @params[in] visitor The callback to hand each message to.
+     * @returns The number of messages handed to the visitor (which may be 0),
+     *          or -1 on error.
+     */
+    virtual ssize_t node_read_messages(uint8_t *out_buffer, size_t buffer_len, const MessageVisitor & visitor);
+
+    /**
+     * Record when, and with which sequence number, the message that
+     * node_read_message() or node_read_messages() is about to hand out was
+     * received, for get_receive_time() and get_receive_sequence().
+     *
+     * @param[in] time The time the message was received.
+     * @param[in] seq The sequence number of the message, or -1 if it has none.
+     */
+    void set_receive_info(std::chrono::system_clock::time_point time, int seq)
+    {
+        rx_time_ = time;
+        rx_seq_ = seq;
+    }
+
+    /**
+     * Record when the data that the node_read() in progress is about to
+     * return arrived, for transports that can tell better than the time the
+     * read returns, such as from a timestamp that the kernel took when the
+     * data came in.  In node_read_frames(), this is called before each frame
+     * is handed to the visitor.  If it isn't called, the data is taken to
+     * have arrived when the read returned.
+     *
+     * @param[in] time The time the data arrived.
+     */
+    void set_rx_arrival_time(std::chrono::system_clock::time_point time)
+    {
+        rx_arrival_time_ = time;
+    }
+
+    /**
+     * Set how long a byte takes to come in, for transports that receive the
+     * bytes one after another at a known rate, such as a UART.  The receive
+     * time of each message is then taken back from when the read returned
+     * by the time that the bytes still in the ring buffer after it took to
+     * come in, which leaves out the time it took to get to the read,
+     * scheduling delays included.
+     *
+     * @param[in] byte_time The time a byte takes, or 0 to take the time the
+     *                      read returned (the default).
+     */
+    void set_rx_byte_time(std::chrono::nanoseconds byte_time)
+    {
+        rx_byte_time_ = byte_time;
+    }
+
+    /**
+     * Virtual method to write a batch of frames to the underlying transport.
+     *
+     * This is called to write out the batch of frames collected while write
+     * batching is enabled (see set_write_batching()).  The frames are laid
+     * out back to back in memory.  The default implementation writes them
+     * with a single node_write(), or with one node_write() per frame if
+     * datagram_frames_ is set so that each of them stays a separate unit on
+     * the transport.  Derived classes that can do better (for instance, by
+     * sending several datagrams with one call, or by only sending some
+     * topics to some destinations) should override it.  This method should
+     * not return until either all of the frames have been written or an
+     * error occurs.
+     *
+     * @params[in] frames The frames to write, one buffer per frame.
+     * @params[in] topic_IDs The topic ID of each frame.
+     * @params[in] count The number of frames.
+     * @returns The number of bytes written on success (which must be equal to
+     *          the sum of the frame lengths), or -1 on error.
+     */
+    virtual ssize_t node_write_frames(const struct iovec *frames, const topic_id_size_t *topic_IDs, size_t count);
+
+    /**
+     * Pure virtual method to detect whether the file descriptors are ready.
+     *
+     * Derived classes should override this method to determine whether the
+     * underlying transport is ready to send and receive data.
+     *
+     * @returns true if the underlying transport is ready to send and receive
+     *          data, false otherwise.
+     */
+    virtual bool fds_OK() = 0;
+
+    /**
+     * Method to add the CRC16 of one additional byte.
+     *
+     * Given an existing CRC16 and a new byte, update the CRC16 to include the
+     * data from the new byte.
+     *
+     * @param[in] crc The existing CRC16.
+     * @param[in] data The new byte to add to the CRC16.
+     * @returns The new CRC16.
+     */
+    uint16_t crc16_byte(uint16_t crc, uint8_t data);
+
+    /**
+     * Method to calculate the CRC16 of an entire buffer.
+     *
+     * @param[in] buffer The buffer to calculate the CRC16 over.
+     * @param[in] len The length of the buffer to calculate.
+     * @returns The CRC16 of the entire buffer.
+     */
+    uint16_t crc16(uint8_t const *buffer, size_t len);
+
+    /**
+     * Method to hand every complete message in the ring buffer to a visitor.
+     *
+     * Messages that fail their CRC or don't fit in out_buffer are dropped,
+     * and parsing continues with the next message.
+     *
+     * @param[out] out_buffer The buffer to receive each payload into.
+     * @param[in] buffer_len The maximum buffer length to receive a payload into.
+     * @param[in] visitor The callback to hand each message to.
+     * @returns The number of messages handed to the visitor.
+     */
+    size_t drain_ring(uint8_t *out_buffer, size_t buffer_len, const MessageVisitor & visitor);
+
+    impl::RingBuffer ringbuf_;
+
+    /**
+     * The time a write that starts now gives up at, one write timeout from
+     * now (see set_write_timeout()).  Derived classes take this once before
+     * their write loop and hand it to every wait_writable() in that loop.
+     */
+    std::chrono::steady_clock::time_point write_deadline() const
+    {
+        return std::chrono::steady_clock::now() + std::chrono::milliseconds(write_timeout_ms_);
+    }
+
+    /**
+     * Wait for a file descriptor to become writable, until at most deadline.
+     * Derived classes call this when a write fails with EAGAIN.  The deadline
+     * covers the whole write, so a transport that keeps polling as writable
+     * and then refusing the write still times out.
+     *
+     * @param[in] fd The file descriptor to wait for.
+     * @param[in] deadline When to give up, usually from write_deadline().
+     * @returns 0 if fd is writable, or -1 on error.  If the deadline passed,
+     *          errno is set to EBUSY.
+     */
+    int wait_writable(int fd, std::chrono::steady_clock::time_point deadline);
+
+    /// How long to wait for the underlying transport to make progress.
+    uint32_t write_timeout_ms_{100};
+
+    /// The number of writes that timed out with only part of the data written.
+    std::atomic<uint64_t> partial_writes_{0};
+
+    /**
+     * Derived classes set this if every unit of data the underlying transport
+     * delivers holds exactly one frame, in which case read_many() gets them
+     * from node_read_frames() and the default node_write_frames() writes
+     * batched frames out one at a time.  read() still goes through
+     * node_read() and the ring buffer.
+     */
+    bool datagram_frames_{false};
+
+    /**
+     * Derived classes set this if the underlying transport delivers whole
+     * messages that were already unpacked and checked (for instance, by
+     * other Transporters), in which case read() and read_many() get them
+     * from node_read_message() and node_read_messages() rather than
+     * parsing anything themselves.
+     */
+    bool whole_messages_{false};
+
+    /**
+     * The topic ID of the frame being written.  This is valid for the
+     * duration of the node_write() and node_writev() calls that write a
+     * single frame, and of the per-frame node_write() calls made by the
+     * default node_write_frames() in datagram mode.
+     */
+    topic_id_size_t write_topic_ID_{0};
+
+    // These methods and members are protected because the tests need access
+    // to them.
+protected:
+    enum class SerialProtocol
+    {
+        PX4,
+        COBS,
+        V2,
+        COBS_ZPE,
+    };
+
+    /** Get the length of the header.
+     *
+     * For the v2 protocol, the header length depends on the topic ID and
+     * the type of CRC, and this is the shortest possible header.
+     *
+     * @returns The length of the header.
+     */
+    size_t get_header_length();
+
+    /**
+     * Internal method to find a valid serial message in the ring buffer.
+     *
+     * This method goes looking through the ring buffer for a valid serial
+     * message (what constitues a valid serial message depends on the serial
+     * protocol currently in use).  If it finds a valid message, it unpacks it,
+     * stuffs the corresponding topic_ID, and fills in the output buffer with
+     * the payload.
+     *
+     * If payload is not a nullptr, the PX4 payload is contiguous in the ring
+     * buffer (which it always is for a mirrored ring buffer), the payload is
+     * not copied at all; *payload points at it in the ring buffer instead,
+     * which stays valid until more data is added to the ring.  Otherwise
+     * *payload is set to out_buffer.
+     *
+     * @param[out] topic_ID The topic ID corresponding to the payload (only
+     *                      valid if the return value > 0).
+     * @param[out] out_buffer The buffer to receive the payload into.
+     * @param[in] buffer_len The maximum buffer length to receive the payload into.
+     * @param[out] payload Where the payload ended up (only valid if the
+     *                     return value >= 0); may be a nullptr, in which case
+     *                     the payload is always copied into out_buffer.
+     * A payload reassembled from fragments (see set_fragment_size()) can be
+     * longer than buffer_len; if payload is not a nullptr it is left where it
+     * was reassembled, which stays valid until the next message is read, and
+     * otherwise it is dropped if it doesn't fit in out_buffer.
+     *
+     * @returns The payload length on success (which may be 0, and < 0 if a
+     *          valid message could not be returned; -EINPROGRESS means a
+     *          fragment was taken but its payload isn't complete yet, and
+     *          -EIO that the ring buffer was inconsistent and has been
+     *          emptied (see ring_failure()).
+     */
+    ssize_t find_and_copy_message(topic_id_size_t *topic_ID, uint8_t *out_buffer, size_t buffer_len,
+                                  uint8_t **payload = nullptr);
+
+    /**
+     * Internal method to unpack a single, complete frame.
+     *
+     * Unlike find_and_copy_message(), this doesn't search for the frame; the
+     * buffer must hold exactly one frame, with no garbage before or after it.
+     *
+     * @param[in] frame The buffer containing the frame.
+     * @param[in] frame_len The length of the frame.
+     * @param[out] topic_ID The topic ID corresponding to the payload (only
+     *                      valid if the return value >= 0).
+     * @param[out] out_buffer The buffer to receive the payload into.
+     * @param[in] buffer_len The maximum buffer length to receive the payload into.
+     * @param[out] payload Where the payload ended up (only valid if the
+     *                     return value >= 0); may be a nullptr, in which case
+     *                     the payload is always copied into out_buffer.  A
+     *                     payload reassembled from fragments is only left
+     *                     where it was reassembled if this is given.
+     * @returns The payload length on success (which may be 0), -EBADMSG if
+     *          the buffer doesn't hold exactly one valid frame, -EMSGSIZE if
+     *          the payload doesn't fit in out_buffer, or -EINPROGRESS if the
+     *          frame is a fragment of a payload that isn't complete yet.
+     */
+    ssize_t copy_message_from_frame(const uint8_t *frame, size_t frame_len, topic_id_size_t *topic_ID,
+                                    uint8_t *out_buffer, size_t buffer_len, uint8_t **payload = nullptr);
+
+private:
+    /**
+     * Parse the name of a serial wire protocol.
+     *
+     * @param[in] protocol The name of the protocol.
+     * @param[out] out The protocol.
+     * @returns true if the name is one of 'px4', 'cobs', 'cobs_zpe' or 'v2'.
+     */
+    static bool parse_protocol(const std::string & protocol, SerialProtocol * out);
+
+    /**
+     * Take a payload of payload_len bytes off the front of the ring buffer.
+     *
+     * @param[in] payload_len The length of the payload; the ring buffer
+     *                        must hold at least this many bytes.
+     * @param[out] out_buffer The buffer to copy the payload into.
+     * @param[in] in_place Whether the payload may be left in the ring buffer
+     *                     if it is contiguous there.
+     * @returns A pointer to the payload, either in the ring buffer or in
+     *          out_buffer, or nullptr if the ring buffer doesn't hold the
+     *          payload, in which case it has been emptied (see
+     *          ring_failure()).
+     */
+    uint8_t *take_payload(size_t payload_len, uint8_t *out_buffer, bool in_place);
+
+    /**
+     * Recover from the ring buffer failing to give back data that the parser
+     * already found in it, which should never happen.  Rather than throwing
+     * from the read path, everything in the ring is dropped and counted as
+     * garbage and as a read error, so parsing starts over with new data.
+     *
+     * @returns -EIO, for the parser to return.
+     */
+    ssize_t ring_failure();
+
+    /**
+     * Internal method to check a received payload length against the limit
+     * for its topic set by set_rx_max_payloads().
+     *
+     * @param[in] topic_ID The topic ID from the header.
+     * @param[in] payload_len The payload length from the header.
+     * @returns true if the length is within the limit, false otherwise.
+     */
+    bool rx_payload_plausible(topic_id_size_t topic_ID, size_t payload_len) const;
+
+    /**
+     * Internal method to carry on the CRC (CRC-16, or CRC-32C) of the
+     * payload of the frame at the front of the ring buffer, without
+     * consuming it, over the bytes up to payload_len.  If the parser already
+     * worked out the CRC of some of the payload while waiting for the rest
+     * of the frame (see rx_frame_), only the bytes after those are added.
+     *
+     * @param[in] header_len The length of the header in front of the
+     *                       payload.
+     * @param[in] payload_len The number of bytes of the payload to cover.
+     * @param[in] use_crc32c Whether the CRC is a CRC-32C.
+     * @param[out] crc The CRC of the first payload_len bytes of the payload.
+     * @returns true on success, false if the ring buffer doesn't hold the
+     *          data.
+     */
+    bool ring_payload_crc(size_t header_len, size_t payload_len, bool use_crc32c, uint32_t *crc);
+
+    /**
+     * Internal method to determine whether rx_frame_ holds what the parser
+     * worked out about the frame at the front of the ring buffer.
+     *
+     * @param[in] aead Whether the link is keyed, which changes the header.
+     * @returns true if rx_frame_ is for the frame at the front of the ring.
+     */
+    bool rx_frame_pending(bool aead) const;
+
+    /**
+     * Internal method to remember the header of the frame at the front of
+     * the ring buffer, which has been checked but hasn't all arrived, so
+     * that the next call to the parser doesn't have to find and read it
+     * again.  The CRC worked out so far is kept if it was for this frame.
+     *
+     * @param[in] header The header of the frame.
+     * @param[in] header_len The length of the header.
+     * @param[in] aead Whether the link is keyed.
+     */
+    void rx_frame_wait(const uint8_t *header, size_t header_len, bool aead);
+
+    /**
+     * Make sure the frame buffer can hold len bytes, growing it if needed;
+     * the caller must hold write_mutex_.
+     *
+     * @param[in] len The number of bytes the frame buffer must be able to hold.
+     */
+    void reserve_frame_buf(size_t len);
+
+    /**
+     * Compute the CRC that goes in the header of a payload.
+     *
+     * @param[in] iov The buffers containing the payload.
+     * @param[in] iovcnt The number of buffers in iov.
+     * @param[in] use_crc32c true to compute a CRC-32C, false for a CRC-16.
+     * @returns The CRC of the payload.
+     */
+    uint32_t payload_crc(const struct iovec *iov, int iovcnt, bool use_crc32c) const;
+
+    /**
+     * Decompress the payload of a compressed v2 frame.
+     *
+     * @param[in] topic_ID The topic ID of the frame, which selects the
+     *                     dictionary to use.
+     * @param[in] data The compressed payload.
+     * @param[in] len The length of the compressed payload.
+     * @param[out] out_buffer The buffer to decompress the payload into.
+     * @param[in] buffer_len The length of out_buffer.
+     * @returns The decompressed length on success, or -EBADMSG if the
+     *          payload cannot be decompressed into out_buffer.
+     */
+    ssize_t decompress_payload(topic_id_size_t topic_ID, const uint8_t *data, size_t len,
+                               uint8_t *out_buffer, size_t buffer_len) const;
+
+    /**
+     * Correct the payload of a v2 frame that was sent with FEC, in place.
+     *
+     * @param[in] topic_ID The topic ID of the frame.
+     * @param[in,out] data The payload as it was received; the corrected
+     *                     payload is moved to the front of it.
+     * @param[in] len The length of the payload as it was received.
+     * @returns The length of the corrected payload on success, or -EBADMSG
+     *          if it has too many damaged bytes to be corrected.
+     */
+    ssize_t correct_fec(topic_id_size_t topic_ID, uint8_t *data, size_t len);
+
+    /**
+     * Check the nonce and tag of a keyed v2 frame and decrypt its payload.
+     *
+     * @param[in] topic_ID The topic ID of the frame.
+     * @param[in] header The header of the frame.
+     * @param[in] header_len The length of the header.
+     * @param[in] in The payload as it was sent (once any FEC is corrected).
+     * @param[out] out The buffer to decrypt the payload into; may be in.
+     * @param[in] len The length of the payload.
+     * @returns 0 on success, or -EBADMSG if the frame is a replay or its
+     *          tag is wrong, in which case nothing is written to out.
+     */
+    int open_aead(topic_id_size_t topic_ID, const uint8_t *header, size_t header_len, const uint8_t *in,
+                  uint8_t *out, size_t len);
+
+    /**
+     * Undo the compression and delta encoding of a v2 payload whose CRC has
+     * already been checked, and keep the payloads that deltas refer to.
+     *
+     * @param[in] topic_ID The topic ID of the frame.
+     * @param[in] compressed Whether the payload is compressed.
+     * @param[in] delta_base Whether later deltas of the topic refer to the
+     *                       payload.
+     * @param[in] delta Whether the payload is a delta.
+     * @param[in] data The payload as it was received.
+     * @param[in] len The length of the payload as it was received.
+     * @param[out] out_buffer The buffer to decode the payload into, if it
+     *                        needs decoding.
+     * @param[in] buffer_len The length of out_buffer.
+     * @param[out] payload Set to the decoded payload, which is either data
+     *                     or out_buffer.
+     * @returns The decoded length on success, -EMSGSIZE if the payload doesn't
+     *          fit in out_buffer, or -EBADMSG if the payload cannot be
+     *          decoded.
+     */
+    ssize_t decode_v2_payload(topic_id_size_t topic_ID, bool compressed, bool delta_base, bool delta,
+                              const uint8_t *data, size_t len, uint8_t *out_buffer, size_t buffer_len,
+                              const uint8_t **payload);
+
+    /**
+     * Frame a payload and write it out, or add it to the batch buffer; the
+     * caller must hold write_mutex_.
+     *
+     * @param[in] topic_ID The topic ID to add to the frame.
+     * @param[in] iov The buffers containing the payload, as it goes on the
+     *                wire.
+     * @param[in] iovcnt The number of buffers in iov.
+     * @param[in] data_length The total length of the buffers.
+     * @param[in] v2_flags The flags of the v2 header.
+     * @param[in] crc The CRC of the payload.
+     * @param[in] frame_start When framing started, for the metrics.
+     * @param[in] cobs_frame For the cobs protocols, the frame if it was
+     *                       already encoded (see encode_cobs_frame()), with
+     *                       its terminating 0, or nullptr to encode it here.
+     * @param[in] cobs_frame_len The length of cobs_frame.
+     * @returns The number of bytes written or batched on success, or -1 on
+     *          error.
+     */
+    ssize_t write_frame_locked(topic_id_size_t topic_ID, const struct iovec *iov, int iovcnt, size_t data_length,
+                               uint8_t v2_flags, uint32_t crc, Metrics::Clock::time_point frame_start,
+                               const uint8_t *cobs_frame = nullptr, size_t cobs_frame_len = 0);
+
+    /**
+     * Encode a payload into a whole cobs or cobs_zpe frame.  Nothing in the
+     * frame depends on the frames before it, so this needs no lock.
+     *
+     * @param[in] topic_ID The topic ID to add to the frame.
+     * @param[in] iov The buffers containing the payload.
+     * @param[in] iovcnt The number of buffers in iov.
+     * @param[in] data_length The total length of the buffers.
+     * @param[in] crc The CRC of the payload.
+     * @param[out] out Where to encode the frame; this must have room for
+     *                 COBSEncoder::max_encoded_length() of the header and
+     *                 payload, plus 1.
+     * @returns The length of the frame, with its terminating 0.
+     */
+    size_t encode_cobs_frame(topic_id_size_t topic_ID, const struct iovec *iov, int iovcnt, size_t data_length,
+                             uint32_t crc, uint8_t *out) const;
+
+    /**
+     * Write the next fragment of a payload; the caller must hold
+     * write_mutex_.
+     *
+     * @param[in] topic_ID The topic ID to add to the frame.
+     * @param[in] buffer The buffer containing the whole payload.
+     * @param[in] length The length of the whole payload.
+     * @param[in,out] cursor Where the payload is up to.
+     * @param[in] frame_start When framing started, for the metrics.
+     * @returns The number of payload bytes in the fragment on success, or -1
+     *          on error.
+     */
+    ssize_t write_fragment_locked(topic_id_size_t topic_ID, uint8_t const *buffer, size_t length,
+                                  FragmentCursor *cursor, Metrics::Clock::time_point frame_start);
+
+    /**
+     * Add a received fragment to the payload it is part of.
+     *
+     * Fragments must arrive in order; a fragment that doesn't follow on from
+     * the last one of its topic throws away the partial payload.  Up to
+     * MAX_REASSEMBLIES payloads can be reassembled at once, and starting
+     * another one throws away the partial payload that has gone the longest
+     * without a fragment.
+     *
+     * @param[in] topic_ID The topic ID of the frame.
+     * @param[in] data The payload of the frame, whose CRC has already been
+     *                 checked.
+     * @param[in] len The length of the payload of the frame.
+     * @param[out] out_buffer The buffer to copy a complete payload into, if
+     *                        payload is a nullptr.
+     * @param[in] buffer_len The length of out_buffer.
+     * @param[out] payload If not a nullptr, set to the complete payload where
+     *                     it was reassembled.
+     * @returns The length of the payload once it is complete, -EINPROGRESS if
+     *          it isn't complete yet, -EMSGSIZE if it is too long, or
+     *          -EBADMSG if the fragment is invalid or out of order.
+     */
+    ssize_t reassemble_fragment(topic_id_size_t topic_ID, const uint8_t *data, size_t len, uint8_t *out_buffer,
+                                size_t buffer_len, uint8_t **payload);
+
+    /**
+     * Take the acknowledgement and the reliable sequence number off the
+     * front of a received v2 payload whose CRC has already been checked.
+     *
+     * @param[in] topic_ID The topic ID of the frame.
+     * @param[in] ack Whether the payload starts with an acknowledgement.
+     * @param[in] reliable Whether the payload was sent reliably.
+     * @param[in] data The payload as it was received.
+     * @param[in] len The length of the payload as it was received.
+     * @returns The number of bytes to skip to get to the message, or
+     *          -EINPROGRESS if there is no message to deliver (the frame is
+     *          only an acknowledgement, or the message was already
+     *          delivered), or -EBADMSG if the payload is invalid.
+     */
+    ssize_t receive_reliable(topic_id_size_t topic_ID, bool ack, bool reliable, const uint8_t *data, size_t len);
+
+    /**
+     * Take an acknowledgement that is waiting to be sent; the caller must
+     * hold reliable_mutex_.
+     *
+     * @param[in] due_by Only take one that is due by this time.
+     * @param[out] buf The buffer to build the acknowledgement into, which
+     *                 must be at least RELIABLE_MAX_ACK_LEN bytes long.
+     * @param[out] topic_ID The topic ID that the acknowledgement is for.
+     * @returns The length of the acknowledgement, or 0 if none is waiting.
+     */
+    size_t take_ack_locked(std::chrono::steady_clock::time_point due_by, uint8_t *buf, topic_id_size_t *topic_ID);
+
+    /**
+     * Number a payload of a reliable topic, keep it for retransmits and
+     * write it out; the caller must hold write_mutex_.
+     *
+     * @param[in] topic_ID The topic ID to add to the frame.
+     * @param[in] iov The buffers containing the payload.
+     * @param[in] iovcnt The number of buffers in iov.
+     * @param[in] data_length The total length of the buffers.
+     * @param[in] frame_start When framing started, for the metrics.
+     * @returns The number of bytes written or batched on success, or -1 on
+     *          error, with errno set to ENOBUFS if too many payloads of the
+     *          topic are waiting for an acknowledgement.
+     */
+    ssize_t write_reliable_locked(topic_id_size_t topic_ID, const struct iovec *iov, int iovcnt,
+                                  size_t data_length, Metrics::Clock::time_point frame_start);
+
+    /**
+     * Write out the batch buffer; the caller must hold write_mutex_.
+     *
+     * @returns The number of bytes written on success, or -1 on error.
+     */
+    ssize_t flush_locked();
+
+    /**
+     * Add a payload to the bundle, sending the bundle first if the payload
+     * doesn't fit; the caller must hold write_mutex_.
+     *
+     * @param[in] topic_ID The topic ID of the payload.
+     * @param[in] record_header The topic ID and length of the payload as
+     *                          varints.
+     * @param[in] record_header_len The length of record_header.
+     * @param[in] iov The buffers containing the payload.
+     * @param[in] iovcnt The number of buffers in iov.
+     * @param[in] data_length The total length of the buffers.
+     * @returns 0 on success, or -1 if sending the bundle failed.
+     */
+    int bundle_locked(topic_id_size_t topic_ID, const uint8_t *record_header, size_t record_header_len,
+                      const struct iovec *iov, int iovcnt, size_t data_length);
+
+    /**
+     * Send the bundle in a frame; the caller must hold write_mutex_.
+     *
+     * @returns The number of bytes written or batched on success (0 if the
+     *          bundle was empty), or -1 on error.  The bundle is kept if the
+     *          frame was held back by flow control (errno EBUSY), and dropped
+     *          otherwise.
+     */
+    ssize_t flush_bundle_locked();
+
+    /**
+     * Find out whether the bundle holds a payload of a topic; the caller must
+     * hold write_mutex_.
+     *
+     * @param[in] topic_ID The topic ID to look for.
+     * @returns true if a payload of topic_ID is waiting in the bundle.
+     */
+    bool bundle_holds_locked(topic_id_size_t topic_ID) const;
+
+    /**
+     * Hand a received message to a read_many() visitor, or each of the
+     * payloads in it if it is a bundle.
+     *
+     * @param[in] topic_ID The topic ID of the message.
+     * @param[in] payload The payload of the message.
+     * @param[in] len The length of the payload.
+     * @param[in] visitor The callback to hand the payloads to.
+     * @returns The number of payloads handed to the visitor.
+     */
+    size_t visit_message(topic_id_size_t topic_ID, uint8_t *payload, size_t len, const MessageVisitor & visitor);
+
+    /**
+     * Keep a bundle that read() received to hand out its payloads one by
+     * one, and hand out the first one.
+     *
+     * @param[in,out] topic_ID The topic ID of the message; set to that of
+     *                         the payload handed out.
+     * @param[in,out] out_buffer The buffer holding the message, and to copy
+     *                           the payload into.
+     * @param[in] buffer_len The length of out_buffer.
+     * @param[in] len The length of the message, or < 0 if there is none.
+     * @returns len if the message isn't a bundle, otherwise what
+     *          read_bundled() returns.
+     */
+    ssize_t unbundle_read(topic_id_size_t *topic_ID, uint8_t *out_buffer, size_t buffer_len, ssize_t len);
+
+    /**
+     * Hand out the next payload of the bundle kept by unbundle_read().
+     *
+     * @param[out] topic_ID The topic ID of the payload.
+     * @param[out] out_buffer The buffer to copy the payload into.
+     * @param[in] buffer_len The length of out_buffer.
+     * @returns The length of the payload, -ENODATA if the rest of the bundle
+     *          is malformed, or -1 if the payload doesn't fit in out_buffer.
+     */
+    ssize_t read_bundled(topic_id_size_t *topic_ID, uint8_t *out_buffer, size_t buffer_len);
+
+    /**
+     * Add the last len bytes put into the ring buffer by node_read() to the
+     * capture.
+     *
+     * @param[in] len The number of bytes node_read() returned.
+     */
+    void capture_rx(size_t len);
+
+    /**
+     * Take the time the data that node_read() just returned arrived, from
+     * set_rx_arrival_time() if it was called, or as now otherwise.
+     */
+    void stamp_rx_read();
+
+    /**
+     * With a byte time (see set_rx_byte_time()), work out the receive time
+     * of the message that was just taken out of the ring buffer from the
+     * bytes still in it.
+     */
+    void estimate_rx_time()
+    {
+        if (rx_byte_time_.count() > 0)
+        {
+            rx_time_ = rx_read_time_ - std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                rx_byte_time_ * static_cast<int64_t>(ringbuf_.bytes_used()));
+        }
+    }
+
+    /**
+     * Add a record to the capture and to the flight recorder, if they are
+     * set.
+     *
+     * @param[in] direction Which way the data went.
+     * @param[in] iov The buffers containing the data.
+     * @param[in] iovcnt The number of buffers in iov.
+     */
+    void capture(LinkCapture::Direction direction, const struct iovec *iov, int iovcnt);
+
+    /**
+     * Add a record from a single buffer.  See the other capture().
+     *
+     * @param[in] direction Which way the data went.
+     * @param[in] data The data.
+     * @param[in] length The length of the data.
+     */
+    void capture(LinkCapture::Direction direction, const void *data, size_t length);
+
+    SerialProtocol backend_protocol_;
+    Metrics metrics_;
+    std::chrono::system_clock::time_point rx_time_;
+    int rx_seq_{-1};
+    // When the data of the last node_read() arrived, and what the transport
+    // said about it (see set_rx_arrival_time() and set_rx_byte_time()).
+    std::chrono::system_clock::time_point rx_read_time_;
+    std::chrono::system_clock::time_point rx_arrival_time_;
+    std::chrono::nanoseconds rx_byte_time_{0};
+
+    /**
+     * What the px4 and v2 parsers have worked out about the frame at the
+     * front of the ring buffer while waiting for the rest of it: its header,
+     * and the CRC of as much of the payload as had arrived.  With it, a frame
+     * that comes in over many small reads has its marker found and its
+     * header read once, and each byte of its payload is only added to the
+     * CRC once.  It only holds as long as the tail generation of the ring
+     * buffer stays the same, that is, as long as the frame is still at the
+     * front.
+     */
+    struct RxFrameState final
+    {
+        bool valid{false};
+        uint64_t tail_generation{0};
+        bool aead{false};
+        std::array<uint8_t, 64> header{};
+        size_t header_len{0};
+        size_t crc_len{0};
+        uint32_t crc{0};
+    };
+    RxFrameState rx_frame_;
+
+    struct __attribute__((packed)) PX4Header
+    {
+        uint8_t marker[3];
+        uint8_t topic_ID;
+        uint8_t seq;
+        uint8_t payload_len_h;
+        uint8_t payload_len_l;
+        uint8_t crc_h;
+        uint8_t crc_l;
+    };
+
+    struct __attribute__((packed)) COBSHeader
+    {
+        uint8_t topic_ID;
+        uint8_t payload_len_h;
+        uint8_t payload_len_l;
+        uint8_t crc_h;
+        uint8_t crc_l;
+    };
+
+    /**
+     * The framing policies, one per protocol, with the shortest header of
+     * the protocol as a compile-time constant (HEADER_LEN) and a static
+     * find() that calls the protocol's parser; see drain_ring_framed().
+     */
+    struct PX4Framing;
+    struct V2Framing;
+    struct COBSFraming;
+    struct COBSZPEFraming;
+
+    /**
+     * The protocol specific parts of find_and_copy_message(), which takes
+     * care of checking that there is at least a header in the ring first.
+     * find_cobs_message() does COBS/ZPE if zpe is true.
+     */
+    ssize_t find_px4_message(topic_id_size_t *topic_ID, uint8_t *out_buffer, size_t buffer_len, uint8_t **payload);
+    ssize_t find_v2_message(topic_id_size_t *topic_ID, uint8_t *out_buffer, size_t buffer_len, uint8_t **payload);
+    ssize_t find_cobs_message(topic_id_size_t *topic_ID, uint8_t *out_buffer, size_t buffer_len, uint8_t **payload,
+                              bool zpe);
+
+    /**
+     * The loop of drain_ring() for one protocol.  Instantiating it for each
+     * framing policy takes the protocol checks out of the per-message path:
+     * the header length is a constant, and the parser is called directly.
+     */
+    template<typename Framing>
+    size_t drain_ring_framed(uint8_t *out_buffer, size_t buffer_len, const MessageVisitor & visitor);
+
+    std::mutex write_mutex_;
+    std::unique_ptr<uint8_t[]> frame_buf_;
+    size_t frame_buf_size_{0};
+    impl::CRC16 crc_engine_;
+    impl::COBSEncoder cobs_encoder_;
+    impl::CRC32C crc32c_engine_;
+    bool crc32c_{false};
+    struct TopicCompression final
+    {
+        size_t threshold;
+        std::unique_ptr<impl::LZ4Codec> codec;
+    };
+    std::map<topic_id_size_t, TopicCompression> compression_;
+    // Used to decompress frames for topics that have no TopicCompression.
+    impl::LZ4Codec default_codec_;
+    std::vector<uint8_t> compress_buf_;
+    std::vector<uint8_t> rx_compressed_buf_;
+    bool fec_{false};
+    std::vector<uint8_t> fec_buf_;
+    std::vector<uint8_t> rx_fec_buf_;
+    // The nonce of the next keyed frame is sent under the write lock; the
+    // highest nonce received, and a bit for each of the ones below it that
+    // was seen, are only used by the read thread.
+    std::unique_ptr<impl::ChaCha20Poly1305> aead_;
+    uint64_t aead_side_{0};
+    uint64_t aead_tx_nonce_{0};
+    uint64_t aead_rx_highest_{0};
+    uint64_t aead_rx_seen_{0};
+    std::vector<uint8_t> aead_buf_;
+    std::vector<uint8_t> rx_aead_buf_;
+    struct TopicDelta final
+    {
+        uint32_t keyframe_interval;
+        uint32_t since_keyframe{0};
+        bool have_last{false};
+        uint16_t last_crc{0};
+        std::vector<uint8_t> last;
+        std::vector<uint8_t> pending;
+    };
+    std::map<topic_id_size_t, TopicDelta> delta_tx_;
+    struct DeltaBase final
+    {
+        bool valid{false};
+        uint16_t crc{0};
+        std::vector<uint8_t> data;
+    };
+    std::map<topic_id_size_t, DeltaBase> delta_rx_;
+    std::vector<uint8_t> delta_buf_;
+    std::vector<uint8_t> rx_delta_buf_;
+    std::unique_ptr<uint8_t[]> batch_buf_;
+    size_t batch_size_{0};
+    size_t batch_len_{0};
+    std::vector<struct iovec> batch_frames_;
+    std::vector<topic_id_size_t> batch_topic_IDs_;
+    std::unique_ptr<LinkCapture> capture_;
+    std::unique_ptr<FlightRecorder> flight_recorder_;
+    // The largest payload of each received topic, or 0 for no limit; it only
+    // covers the topic IDs of the PX4 and COBS protocols.
+    std::array<std::atomic<uint32_t>, 256> rx_max_payload_{};
+    size_t fragment_size_{0};
+    uint32_t next_message_ID_{0};
+    // The payloads waiting to go out in the next bundle, and the topics they
+    // are of; and the bundle that read() is handing out.
+    topic_id_size_t bundle_topic_ID_{0};
+    std::unique_ptr<uint8_t[]> bundle_buf_;
+    size_t bundle_size_{0};
+    size_t bundle_len_{0};
+    std::vector<topic_id_size_t> bundle_topic_IDs_;
+    // The lengths of the topics whose records in a bundle leave them out.
+    std::map<topic_id_size_t, uint32_t> fixed_lengths_;
+    std::vector<uint8_t> rx_bundle_;
+    size_t rx_bundle_pos_{0};
+    // The payloads being reassembled from fragments.  Their buffers are kept
+    // when they complete, so once they have grown to the largest payload
+    // reassembling doesn't allocate.
+    static constexpr size_t MAX_REASSEMBLIES = 8;
+    struct Reassembly final
+    {
+        bool active{false};
+        topic_id_size_t topic_ID{0};
+        uint32_t message_ID{0};
+        size_t received{0};
+        uint64_t last_used{0};
+        std::vector<uint8_t> data;
+    };
+    std::array<Reassembly, MAX_REASSEMBLIES> reassemblies_;
+    uint64_t reassembly_clock_{0};
+    // The state of the reliable topics.  The payloads kept for retransmits
+    // are only touched with write_mutex_ held, and everything else with
+    // reliable_mutex_ held, which the reading thread takes on its own to
+    // handle acknowledgements; when both are needed, write_mutex_ is taken
+    // first.
+    struct ReliableFrame final
+    {
+        bool in_flight{false};
+        uint8_t seq{0};
+        uint32_t retransmits{0};
+        std::chrono::steady_clock::time_point sent;
+        std::chrono::steady_clock::time_point due;
+        // The session and sequence number followed by the message.
+        std::vector<uint8_t> payload;
+    };
+    struct ReliableTx final
+    {
+        uint8_t session{0};
+        uint8_t next_seq{0};
+        size_t in_flight{0};
+        std::array<ReliableFrame, RELIABLE_WINDOW> window;
+        bool have_rtt{false};
+        std::chrono::microseconds srtt{0};
+        std::chrono::microseconds rttvar{0};
+        std::chrono::microseconds rto{0};
+    };
+    struct ReliableRx final
+    {
+        bool started{false};
+        uint8_t session{0};
+        // The first sequence number not received yet, and which of the ones
+        // after it were (bit i for base + i).
+        uint8_t base{0};
+        uint16_t received{0};
+        bool ack_pending{false};
+        std::chrono::steady_clock::time_point ack_due;
+    };
+    std::mutex reliable_mutex_;
+    std::map<topic_id_size_t, ReliableTx> reliable_tx_;
+    std::map<topic_id_size_t, ReliableRx> reliable_rx_;
+    // Whether any acknowledgements are waiting, so writers don't need to
+    // take reliable_mutex_ to find out.
+    std::atomic<bool> acks_pending_{false};
+    // The latest round trip time sample of any reliable topic.
+    std::atomic<int64_t> last_rtt_us_{-1};
+    std::atomic<uint64_t> written_bytes_{0};
+    std::function<void()> reliable_notify_;
+    // The receive credits of the other end, as running byte counts that
+    // wrap around.  credits_sent_ is only changed with write_mutex_ held,
+    // and the rest only by the thread that reads.
+    std::atomic<bool> standby_{false};
+    std::atomic<bool> flow_control_{false};
+    std::atomic<uint32_t> credit_limit_{0};
+    std::atomic<uint32_t> credits_sent_{0};
+    std::atomic<bool> credit_stalled_{false};
+    bool credits_granted_{false};
+    uint32_t credit_offset_{0};
+    uint32_t last_received_{0};
+    std::function<void()> credit_notify_;
 };
 
 }  // namespace transport
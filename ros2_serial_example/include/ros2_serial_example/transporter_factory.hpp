@@ -0,0 +1,123 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef ROS2_SERIAL_EXAMPLE__TRANSPORTER_FACTORY_HPP_
+#define ROS2_SERIAL_EXAMPLE__TRANSPORTER_FACTORY_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "ros2_serial_example/transporter.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+/**
+ * The configuration handed to a backend when creating a Transporter.
+ *
+ * The settings that every backend takes are plain members.  Backend specific
+ * settings are looked up by name through get_string(), get_int(),
+ * get_bool(), get_string_array() and get_int_array(), which return false if
+ * the setting wasn't given.
+ */
+struct TransporterConfig final
+{
+    std::string protocol;
+    uint32_t read_poll_ms{0};
+    size_t ring_buffer_size{0};
+    std::function<bool(const std::string &, std::string *)> get_string;
+    std::function<bool(const std::string &, int64_t *)> get_int;
+    std::function<bool(const std::string &, bool *)> get_bool;
+    std::function<bool(const std::string &, std::vector<std::string> *)> get_string_array;
+    std::function<bool(const std::string &, std::vector<int64_t> *)> get_int_array;
+};
+
+/**
+ * The TransporterFactory class creates Transporters by backend name.
+ *
+ * The built-in backends ("uart", "udp", "tcp", "can", "usb", "shm",
+ * "replay", and "bond") are always registered.
+ * New Transporter subclasses can be made available by registering a creator
+ * function for them with register_backend(), without changing any of the
+ * code that creates transporters.
+ */
+class TransporterFactory final
+{
+public:
+    /**
+     * A function that creates a Transporter; it should throw
+     * std::runtime_error if the configuration is invalid.
+     */
+    using Creator = std::function<std::unique_ptr<Transporter>(const TransporterConfig &)>;
+
+    /**
+     * Get the process-wide factory.
+     *
+     * @returns The process-wide factory.
+     */
+    static TransporterFactory & instance();
+
+    TransporterFactory(TransporterFactory const &) = delete;
+    TransporterFactory& operator=(TransporterFactory const &) = delete;
+    TransporterFactory(TransporterFactory &&) = delete;
+    TransporterFactory& operator=(TransporterFactory &&) = delete;
+
+    /**
+     * Register a backend.
+     *
+     * @param[in] name The name of the backend, as used in backend_comms.
+     * @param[in] creator The function to create a Transporter for the backend.
+     * @returns true on success, false if name is already registered.
+     */
+    bool register_backend(const std::string & name, Creator creator);
+
+    /**
+     * Create a Transporter for a backend.  The Transporter is not initialized.
+     *
+     * @param[in] name The name of the backend.
+     * @param[in] config The configuration for the Transporter.
+     * @returns The new Transporter.
+     * @throws std::runtime_error If name isn't registered, or the backend
+     *         rejected the configuration.
+     */
+    std::unique_ptr<Transporter> create(const std::string & name, const TransporterConfig & config) const;
+
+    /**
+     * Get the names of all of the registered backends.
+     *
+     * @returns The names of all of the registered backends, in sorted order.
+     */
+    std::vector<std::string> backends() const;
+
+private:
+    TransporterFactory();
+
+    mutable std::mutex mutex_;
+    std::map<std::string, Creator> creators_;
+};
+
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
+
+#endif
@@ -0,0 +1,572 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ROS2_SERIAL_EXAMPLE__TX_QUEUE_HPP_
+#define ROS2_SERIAL_EXAMPLE__TX_QUEUE_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "ros2_serial_example/congestion_control.hpp"
+#include "ros2_serial_example/loop_watchdog.hpp"
+#include "ros2_serial_example/time_sync.hpp"
+#include "ros2_serial_example/transporter.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+namespace impl
+{
+
+/**
+ * The FrameQueue class is a bounded, lock-free queue of payloads.
+ *
+ * This is an implementation of Dmitry Vyukov's bounded MPMC queue: every slot
+ * carries a sequence number that tells producers and consumers whether the
+ * slot is free, and positions are claimed with a single compare-and-swap.
+ * Any number of threads may push and pop at the same time.  Payload buffers
+ * are kept around and reused, so once they have grown to the largest payload
+ * seen, pushing and popping do not allocate.
+ */
+class FrameQueue final
+{
+public:
+    /**
+     * Construct a FrameQueue.
+     *
+     * @param[in] capacity The maximum number of payloads the queue can hold.
+     * @throws std::runtime_error If capacity is 0.
+     */
+    explicit FrameQueue(size_t capacity);
+
+    FrameQueue(FrameQueue const &) = delete;
+    FrameQueue& operator=(FrameQueue const &) = delete;
+    FrameQueue(FrameQueue &&) = delete;
+    FrameQueue& operator=(FrameQueue &&) = delete;
+
+    /**
+     * Copy a payload into the queue.
+     *
+     * @param[in] buffer The payload to copy.
+     * @param[in] length The length of the payload.
+     * @param[in] stamp A time to keep with the payload, such as when it was
+     *                  queued, for try_pop() to hand back.
+     * @returns true if the payload was queued, false if the queue is full.
+     */
+    bool try_push(uint8_t const *buffer, size_t length,
+                  std::chrono::steady_clock::time_point stamp = std::chrono::steady_clock::time_point());
+
+    /**
+     * Move a payload into the queue without copying it.
+     *
+     * The payload is swapped with the buffer of the slot it goes into, so on
+     * success in holds a recycled buffer with unspecified contents that the
+     * caller can reuse for its next payload.
+     *
+     * @param[in,out] in The payload to move into the queue.
+     * @param[in] stamp A time to keep with the payload, as for the try_push()
+     *                  above.
+     * @returns true if the payload was queued, false if the queue is full (in
+     *          which case in is left untouched).
+     */
+    bool try_push(std::vector<uint8_t> *in,
+                  std::chrono::steady_clock::time_point stamp = std::chrono::steady_clock::time_point());
+
+    /**
+     * Remove the oldest payload from the queue.
+     *
+     * The payload is swapped into out rather than copied, and the previous
+     * contents of out become the slot's buffer for a future payload; this way
+     * buffers circulate between the queue and the consumer without
+     * allocations.
+     *
+     * @param[out] out The vector to swap the payload into; may be a nullptr,
+     *                 in which case the payload is just dropped.
+     * @param[out] stamp The time the payload was pushed with; may be a
+     *                   nullptr.
+     * @returns true if a payload was removed, false if the queue is empty.
+     */
+    bool try_pop(std::vector<uint8_t> *out, std::chrono::steady_clock::time_point *stamp = nullptr);
+
+    /**
+     * Determine whether the queue is empty.
+     *
+     * With other threads pushing and popping at the same time, the answer
+     * may be out of date by the time it is returned.
+     *
+     * @returns true if the queue is empty, false otherwise.
+     */
+    bool empty() const;
+
+    /**
+     * Get the number of payloads in the queue.
+     *
+     * Like empty(), the answer may be out of date by the time it is
+     * returned, and it counts payloads that are still being pushed.
+     *
+     * @returns The number of payloads in the queue.
+     */
+    size_t size() const;
+
+    /**
+     * Grow the buffers of all of the slots to hold payloads of up to
+     * max_payload bytes, so that they don't have to grow later.  This must
+     * be called before anything is pushed.
+     *
+     * @param[in] max_payload The largest payload that will be pushed.
+     */
+    void reserve(size_t max_payload);
+
+    /**
+     * Get the maximum number of payloads the queue can hold.
+     *
+     * @returns The maximum number of payloads the queue can hold.
+     */
+    size_t capacity() const
+    {
+        return capacity_;
+    }
+
+private:
+    struct Slot final
+    {
+        std::atomic<size_t> seq{0};
+        std::vector<uint8_t> data;
+        std::chrono::steady_clock::time_point stamp;
+    };
+
+    Slot *claim_push_slot(size_t *claimed_pos);
+
+    std::unique_ptr<Slot[]> slots_;
+    size_t num_slots_;
+    size_t capacity_;
+    std::atomic<size_t> enqueue_pos_{0};
+    std::atomic<size_t> dequeue_pos_{0};
+};
+
+}  // namespace impl
+
+/**
+ * The TxQueue class sends payloads to a Transporter from a dedicated thread.
+ *
+ * Transporter::write() blocks until the whole frame is out on the wire, which
+ * can take a long time if the underlying transport is backed up.  Topics that
+ * are added to a TxQueue instead have their payloads copied into a per-topic
+ * bounded queue, and a single writer thread drains all of the queues into the
+ * Transporter in round-robin order.  If the transport stays busy, the writer
+ * thread waits for the transport to become writable again (with poll() on
+ * Transporter::get_write_fd()) instead of spinning.  With flow control (see
+ * Transporter::set_flow_control()), a writer thread that has run out of
+ * receive credits sleeps until the other end grants more; the payloads keep
+ * queuing up meanwhile, and are dropped by the policy of their queue.
+ *
+ * Topics must be added before start() is called.  Payloads for topics that
+ * were not added are written synchronously, as if Transporter::write() had
+ * been called directly.
+ *
+ * Each topic can also be given a priority and a maximum rate.  The writer
+ * thread always sends the next payload from the highest priority topic that
+ * has one ready, so a flood of payloads on a low priority topic holds up a
+ * high priority payload by at most the one frame that is already being
+ * written.  A topic with a maximum rate keeps its payloads queued until it is
+ * allowed to send again; with a depth of 1 and DROP_OLDEST, this decimates
+ * the topic to the latest payload at no more than that rate.  A topic with a
+ * maximum age drops the payloads that waited in its queue for longer than
+ * that instead of sending them.
+ *
+ * If the Transporter fragments long payloads (see
+ * Transporter::set_fragment_size()), the writer thread sends a long payload
+ * one fragment at a time, and looks for payloads of higher priority topics
+ * (and takes turns with the topics of the same priority) in between, so a
+ * long payload holds up a high priority payload by at most one fragment.
+ *
+ * If the Transporter has write batching enabled, the writer thread is also
+ * responsible for flushing the batch, which it does once the batch has been
+ * pending for the delay given to set_flush_delay().
+ *
+ * With congestion control (see set_congestion_control()), the writer thread
+ * holds back the lowest priorities while frames wait in the transport for
+ * longer than a target delay, as decided by a CongestionControl object; the
+ * payloads of the topics held back queue up meanwhile and are dropped by the
+ * policy of their queue, so the topics that are still sent don't wait behind
+ * them.
+ *
+ * On a half-duplex link that the two ends take turns on, like a shared radio
+ * channel, the writer thread can be limited to a time slot of a repeating
+ * cycle (see set_tx_slot()), so that the two ends never send at the same
+ * time.  Outside of its slot the writer thread sleeps and the payloads queue
+ * up; once the slot opens, they go out in one burst, and a pending write
+ * batch is flushed before the slot closes.
+ *
+ * Each pass of the writer thread that sends a frame is timed by a
+ * LoopWatchdog (see get_watchdog()), which is how a transport that holds up
+ * the writer for too long is found, along with the topic of the frame.
+ */
+class TxQueue final
+{
+public:
+    /// What to do with a new payload when the queue for its topic is full.
+    enum class OverflowPolicy
+    {
+        DROP_OLDEST,
+        DROP_NEWEST,
+    };
+
+    /**
+     * Construct a TxQueue.
+     *
+     * @param[in] transporter The transporter to send payloads to; this must
+     *                        outlive the TxQueue.
+     * @throws std::runtime_error If transporter is a nullptr or the wakeup
+     *         eventfd cannot be created.
+     */
+    explicit TxQueue(Transporter * transporter);
+    ~TxQueue();
+
+    TxQueue(TxQueue const &) = delete;
+    TxQueue& operator=(TxQueue const &) = delete;
+    TxQueue(TxQueue &&) = delete;
+    TxQueue& operator=(TxQueue &&) = delete;
+
+    /**
+     * Send payloads for a topic through a queue.
+     *
+     * @param[in] topic_ID The topic ID to queue payloads for.
+     * @param[in] depth The maximum number of payloads to queue for the topic.
+     * @param[in] policy What to do when the queue for the topic is full.
+     * @returns 0 on success, or -1 if depth is 0, the topic has already been
+     *          added, or the writer thread has already been started.
+     */
+    int add_topic(topic_id_size_t topic_ID, size_t depth, OverflowPolicy policy);
+
+    /**
+     * Set the priority of a queued topic.
+     *
+     * @param[in] topic_ID The topic ID to set the priority of.
+     * @param[in] priority The priority; payloads of higher priority topics
+     *                     are always sent first, and topics of the same
+     *                     priority take turns.  The default is 0.
+     * @returns 0 on success, or -1 if the topic hasn't been added or the
+     *          writer thread has already been started.
+     */
+    int set_priority(topic_id_size_t topic_ID, uint8_t priority);
+
+    /**
+     * Limit how often payloads of a queued topic are sent.
+     *
+     * @param[in] topic_ID The topic ID to limit.
+     * @param[in] max_rate_hz The most payloads per second to send, or 0 for
+     *                        no limit (the default).
+     * @returns 0 on success, or -1 if max_rate_hz is negative, the topic
+     *          hasn't been added, or the writer thread has already been
+     *          started.
+     */
+    int set_max_rate(topic_id_size_t topic_ID, double max_rate_hz);
+
+    /**
+     * Drop the payloads of a queued topic that waited in its queue for too
+     * long, rather than sending them late.  Each one is counted as a STALE
+     * drop in the metrics of the Transporter.
+     *
+     * @param[in] topic_ID The topic ID to limit.
+     * @param[in] max_age_ms The longest time in milliseconds a payload may
+     *                       wait, or 0 for no limit (the default).
+     * @returns 0 on success, or -1 if the topic hasn't been added or the
+     *          writer thread has already been started.
+     */
+    int set_max_age(topic_id_size_t topic_ID, uint32_t max_age_ms);
+
+    /**
+     * Determine whether payloads for a topic go through a queue.
+     *
+     * @param[in] topic_ID The topic ID to check.
+     * @returns true if the topic has a queue, false otherwise.
+     */
+    bool has_topic(topic_id_size_t topic_ID) const;
+
+    /**
+     * Have the writer thread flush the Transporter's write batch.
+     *
+     * @param[in] delay_us The longest time in microseconds a frame may wait
+     *                     in the batch before it is flushed, or 0 to disable
+     *                     flushing (for when the Transporter isn't batching).
+     * @returns 0 on success, or -1 if the writer thread was already started.
+     */
+    int set_flush_delay(uint32_t delay_us);
+
+    /**
+     * Hold back the lowest priority topics while the transport is congested.
+     *
+     * The writer thread samples the transport at most once a millisecond
+     * while it is sending; see CongestionControl for how the delay is
+     * estimated.  The transport has to report its write queue (see
+     * Transporter::get_write_queue_bytes()), or carry reliable topics, for
+     * there to be anything to go by.
+     *
+     * @param[in] target_us The longest time in microseconds frames should
+     *                      wait in the transport, or 0 to disable congestion
+     *                      control (the default).
+     * @param[in] interval_us How long in microseconds the delay has to stay
+     *                        above or below the target before a priority is
+     *                        held back or let go.
+     * @returns 0 on success, or -1 if interval_us is 0 with a target, or the
+     *          writer thread was already started.
+     */
+    int set_congestion_control(uint32_t target_us, uint32_t interval_us);
+
+    /**
+     * Only send queued payloads in a time slot of a repeating cycle.
+     *
+     * The cycles are counted from the epoch of a clock that both ends of the
+     * link agree on: the system clock (for when both are synchronized to
+     * NTP or GPS), or the clock of the other end as estimated by a TimeSync,
+     * in which case nothing is sent until it is synchronized.  The writer
+     * thread only starts writing a frame in the part of the slot that is at
+     * least guard_us away from either end of it, so the guard time has to
+     * cover both the error of the clocks and the time it takes to send the
+     * largest frame.  Payloads of topics that weren't added are written
+     * straight away, regardless of the slot.
+     *
+     * @param[in] cycle_us The length of the cycle in microseconds, or 0 to
+     *                     send at any time (the default).
+     * @param[in] offset_us Where the slot starts in the cycle, in
+     *                      microseconds.
+     * @param[in] length_us The length of the slot in microseconds.
+     * @param[in] guard_us How far from either end of the slot the writer
+     *                     thread stays, in microseconds.
+     * @param[in] clock The clock of the other end to count cycles in, or a
+     *                  nullptr to use the system clock; this must outlive
+     *                  the TxQueue.
+     * @returns 0 on success, or -1 if the offset or length don't fit in the
+     *          cycle, the guard times take up the whole slot, or the writer
+     *          thread was already started.
+     */
+    int set_tx_slot(uint32_t cycle_us, uint32_t offset_us, uint32_t length_us, uint32_t guard_us,
+                    const TimeSync * clock = nullptr);
+
+    /**
+     * Allocate the buffers of the queues up front for payloads of up to
+     * max_payload bytes, so that queueing and sending them doesn't allocate.
+     *
+     * Since buffers move between the topics, the callers of the write() that
+     * hands its buffer off should also make theirs at least this big.  This
+     * must be called after all of the topics have been added.
+     *
+     * @param[in] max_payload The largest payload of any queued topic.
+     * @returns 0 on success, or -1 if the writer thread was already started.
+     */
+    int reserve_payloads(size_t max_payload);
+
+    /**
+     * Start the writer thread.  This does nothing if no topics were added and
+     * there is no flush delay.  If the Transporter has flow control enabled,
+     * this sets its credit notify callback, so it must not be called while
+     * another thread is reading.
+     */
+    void start();
+
+    /**
+     * Stop the writer thread.  Any payloads still queued are dropped.  As for
+     * start(), this must not be called while another thread is reading from
+     * a Transporter with flow control enabled.
+     */
+    void stop();
+
+    /**
+     * Get the native handle of the writer thread, such as for setting its
+     * scheduling.
+     *
+     * @param[out] handle The native handle of the writer thread.
+     * @returns true if the writer thread is running, false otherwise.
+     */
+    bool native_handle(std::thread::native_handle_type * handle);
+
+    /**
+     * Send a payload.
+     *
+     * If the topic has a queue, the payload is copied into it and this
+     * returns immediately; otherwise the payload is written synchronously.
+     *
+     * @param[in] topic_ID The topic ID to add to the message.
+     * @param[in] buffer The buffer containing the payload to send.
+     * @param[in] length The length of the payload buffer.
+     * @returns The payload length on success, or -1 on error.  If the queue
+     *          is full and the policy is DROP_NEWEST, this fails with errno
+     *          set to ENOBUFS.  If the writer thread isn't running, this
+     *          fails with errno set to ESHUTDOWN.
+     */
+    ssize_t write(topic_id_size_t topic_ID, uint8_t const *buffer, size_t length);
+
+    /**
+     * Send a payload, handing its buffer off to the queue.
+     *
+     * This is the same as the write() above, except that for a topic with a
+     * queue the payload is moved into the queue rather than copied, and on
+     * success payload is left holding a recycled buffer with unspecified
+     * contents for the caller to reuse.  For topics without a queue, the
+     * payload is written synchronously and left as it was.
+     *
+     * @param[in] topic_ID The topic ID to add to the message.
+     * @param[in,out] payload The payload to send.
+     * @returns The payload length on success, or -1 on error, as for the
+     *          write() above.
+     */
+    ssize_t write(topic_id_size_t topic_ID, std::vector<uint8_t> *payload);
+
+    /**
+     * Get the number of payloads that were dropped because a queue was full.
+     *
+     * @returns The number of payloads dropped so far.
+     */
+    uint64_t get_dropped() const
+    {
+        return dropped_;
+    }
+
+    /**
+     * Get the watchdog of the writer thread.  It only times the passes of
+     * the writer thread once a threshold is set on it.
+     *
+     * @returns The watchdog.
+     */
+    LoopWatchdog & get_watchdog()
+    {
+        return watchdog_;
+    }
+
+    /**
+     * Get the number of payloads waiting in the queue of a topic.
+     *
+     * @param[in] topic_ID The topic to look up.
+     * @returns The number of payloads queued, or -1 if the topic has no
+     *          queue.
+     */
+    ssize_t get_queue_depth(topic_id_size_t topic_ID) const;
+
+    /**
+     * Get the target delay of congestion control.
+     *
+     * @returns The target delay in microseconds, or 0 if congestion control
+     *          is disabled.
+     */
+    uint32_t get_congestion_target_us() const
+    {
+        return congestion_target_us_;
+    }
+
+    /**
+     * Get the number of priorities that congestion control is holding back.
+     *
+     * @returns The number of the lowest priorities held back, or 0 if
+     *          congestion control is disabled.
+     */
+    size_t get_shed_priorities() const
+    {
+        return congestion_ != nullptr ? congestion_->get_shed_levels() : 0;
+    }
+
+    /**
+     * Get the delay that congestion control estimated last.
+     *
+     * @returns The delay in microseconds, or 0 if congestion control is
+     *          disabled.
+     */
+    int64_t get_congestion_delay_us() const
+    {
+        return congestion_ != nullptr ? congestion_->get_delay_us() : 0;
+    }
+
+private:
+    struct TopicQueue final
+    {
+        TopicQueue(topic_id_size_t id, size_t depth, OverflowPolicy p) : topic_ID(id), queue(depth), policy(p)
+        {
+        }
+
+        topic_id_size_t topic_ID;
+        impl::FrameQueue queue;
+        OverflowPolicy policy;
+        uint8_t priority{0};
+        std::chrono::steady_clock::duration min_interval{0};
+        std::chrono::steady_clock::time_point next_send{};
+        std::chrono::steady_clock::duration max_age{0};
+        // The payload being sent in fragments, if sending is set.
+        std::vector<uint8_t> partial;
+        Transporter::FragmentCursor cursor;
+        bool sending{false};
+    };
+
+    // The queues of one priority, which take turns starting from next.
+    struct PriorityClass final
+    {
+        uint8_t priority;
+        std::vector<TopicQueue *> queues;
+        size_t next{0};
+    };
+
+    void writer_thread_func();
+    bool write_queued_frame(std::vector<uint8_t> *payload, bool *rate_limited,
+                            std::chrono::steady_clock::time_point *next_due);
+    void check_flush(bool *flush_pending, std::chrono::steady_clock::time_point *flush_at);
+    bool in_slot(std::chrono::steady_clock::time_point now, std::chrono::steady_clock::time_point *until);
+    bool sleep_until(std::chrono::steady_clock::time_point const *wake_at);
+    void write_frame(topic_id_size_t topic_ID, uint8_t const *buffer, size_t length);
+    void write_fragment(TopicQueue *q);
+    bool wait_writable(int write_fd);
+    void wake_writer();
+    bool make_room(TopicQueue *q);
+    bool pop_fresh(TopicQueue *q, std::vector<uint8_t> *payload, std::chrono::steady_clock::time_point now);
+
+    Transporter * transporter_;
+    std::map<topic_id_size_t, std::unique_ptr<TopicQueue>> queues_;
+    std::vector<TopicQueue *> queue_list_;
+    // Highest priority first; built by start().
+    std::vector<PriorityClass> classes_;
+    int wakeup_fd_{-1};
+    uint32_t flush_delay_us_{0};
+    size_t reserved_payload_{0};
+    uint32_t congestion_target_us_{0};
+    uint32_t congestion_interval_us_{0};
+    // Created by start(), and only sampled by the writer thread.
+    std::unique_ptr<CongestionControl> congestion_;
+    std::chrono::steady_clock::time_point next_congestion_sample_{};
+    // The time slot, in nanoseconds; a cycle of 0 means there is none.
+    int64_t slot_cycle_ns_{0};
+    int64_t slot_offset_ns_{0};
+    int64_t slot_length_ns_{0};
+    int64_t slot_guard_ns_{0};
+    const TimeSync * slot_clock_{nullptr};
+    // When the usable part of the current slot ends; only used by the writer
+    // thread.
+    std::chrono::steady_clock::time_point slot_end_{};
+    std::atomic<bool> running_{false};
+    std::atomic<bool> writer_sleeping_{false};
+    std::atomic<uint64_t> dropped_{0};
+    LoopWatchdog watchdog_;
+    std::thread writer_thread_;
+};
+
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
+
+#endif
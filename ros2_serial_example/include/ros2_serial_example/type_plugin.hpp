@@ -0,0 +1,85 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ROS2_SERIAL_EXAMPLE__TYPE_PLUGIN_HPP_
+#define ROS2_SERIAL_EXAMPLE__TYPE_PLUGIN_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "ros2_serial_example/publisher.hpp"
+#include "ros2_serial_example/subscription.hpp"
+#include "ros2_serial_example/topic_id.hpp"
+#include "ros2_serial_example/transporter.hpp"
+#include "ros2_serial_example/tx_queue.hpp"
+
+namespace rclcpp
+{
+class CallbackGroup;
+class Node;
+class QoS;
+}  // namespace rclcpp
+
+// The name of the TypePlugin that every type plugin exports.
+#define ROS2_SERIAL_TYPE_PLUGIN_SYMBOL "ros2_serial_type_plugin"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace pubsub
+{
+
+/**
+ * The factories of one message type, either built into the bridge or
+ * exported by a type plugin.  When the bridge is built with
+ * ROS2_SERIAL_TYPE_PLUGINS, each message type is built into a shared library
+ * of its own, which is only loaded when a topic of that type is first set up.
+ *
+ * max_serialized_size returns the largest CDR data of a message of the type,
+ * and sets bounded to whether every message fits in it (see
+ * pubsub::max_serialized_size()).  fixed_size returns the length of the CDR
+ * data of every message of a type with a fixed layout (see
+ * cdr_fixed_layout.hpp), or 0 for other types.  batch_pub_factory
+ * creates a publisher that publishes the messages in batches of batch_type
+ * (see BatchSinkImpl), or returns nullptr if batch_type isn't a batch of
+ * the type that the bridge was built with.
+ */
+struct TypePlugin final
+{
+    std::unique_ptr<Publisher> (*pub_factory)(rclcpp::Node * node, const std::string & topic, bool passthrough, const rclcpp::QoS & qos);
+    std::unique_ptr<Subscription> (*sub_factory)(rclcpp::Node * node, topic_id_size_t serial_mapping, const std::string & topic, ros2_to_serial_bridge::transport::Transporter * transporter, ros2_to_serial_bridge::transport::TxQueue * tx_queue, bool passthrough, const rclcpp::QoS & qos, const std::shared_ptr<rclcpp::CallbackGroup> & callback_group);
+    size_t (*max_serialized_size)(bool * bounded);
+    size_t (*fixed_size)();
+    std::unique_ptr<Publisher> (*batch_pub_factory)(const std::string & batch_type, rclcpp::Node * node, const std::string & topic, const rclcpp::QoS & qos, size_t batch_size, uint32_t batch_ms);
+};
+
+/**
+ * Load a type plugin.  A plugin is only loaded once, and is never unloaded,
+ * since the publishers and subscriptions it creates run its code.  This may
+ * be called from any thread.
+ *
+ * @param[in] library The file name of the shared library, which is looked up
+ *                    the way dlopen() does.
+ * @param[out] error Why the plugin couldn't be loaded.
+ * @returns The factories of the type, or nullptr if the plugin couldn't be
+ *          loaded.
+ */
+const TypePlugin * load_type_plugin(const std::string & library, std::string * error);
+
+}  // namespace pubsub
+}  // namespace ros2_to_serial_bridge
+
+#endif
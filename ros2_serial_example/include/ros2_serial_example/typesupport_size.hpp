@@ -0,0 +1,72 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ROS2_SERIAL_EXAMPLE__TYPESUPPORT_SIZE_HPP_
+#define ROS2_SERIAL_EXAMPLE__TYPESUPPORT_SIZE_HPP_
+
+#include <cstddef>
+
+namespace ros2_to_serial_bridge
+{
+
+namespace pubsub
+{
+
+namespace detail
+{
+
+// Newer distros pass an is_plain flag as well, which the bridge has no use
+// for; the int/long overloads pick whichever signature the typesupport has.
+template<typename F>
+auto call_max_serialized_size(F max_size, bool & full_bounded, int) -> decltype(max_size(full_bounded, full_bounded, 0))
+{
+    bool is_plain = true;
+    return max_size(full_bounded, is_plain, 0);
+}
+
+template<typename F>
+size_t call_max_serialized_size(F max_size, bool & full_bounded, long)
+{
+    return max_size(full_bounded, 0);
+}
+
+}  // namespace detail
+
+/**
+ * Get the largest CDR data of a message type from its
+ * rosidl_typesupport_fastrtps_cpp max_serialized_size_<Type>() function.
+ *
+ * @param[in] max_size The max_serialized_size_<Type>() function of the type.
+ * @param[out] bounded Set to whether every message of the type fits in the
+ *                     returned size; it doesn't for types with unbounded
+ *                     strings or sequences, where the size is only the
+ *                     smallest that the largest message can be.
+ * @returns The largest CDR data of a message of the type, starting at
+ *          alignment 0 like the data on the serial port.
+ */
+template<typename F>
+size_t max_serialized_size(F max_size, bool * bounded)
+{
+    // The typesupport only ever clears the flag.
+    bool full_bounded = true;
+    size_t size = detail::call_max_serialized_size(max_size, full_bounded, 0);
+    *bounded = full_bounded;
+
+    return size;
+}
+
+}  // namespace pubsub
+}  // namespace ros2_to_serial_bridge
+
+#endif
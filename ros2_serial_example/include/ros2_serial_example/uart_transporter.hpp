@@ -38,13 +38,17 @@
 #define ROS2_SERIAL_EXAMPLE__UART_TRANSPORTER_HPP_
 
 // C++ includes
+#include <atomic>
 #include <cstdint>
+#include <memory>
 #include <string>
 
 #include <poll.h>
+#include <sys/uio.h>
 
 // Local includes
 #include "ros2_serial_example/transporter.hpp"
+#include "ros2_serial_example/uring_io.hpp"
 
 namespace ros2_to_serial_bridge
 {
@@ -55,6 +59,19 @@ namespace transport
 /**
  * The UARTTransporter class is an implementation of the abstract Transporter
  * class specifically for talking to UART devices.
+ *
+ * With set_reconnect(), a USB serial adapter that is unplugged (or reset) is
+ * opened again as soon as it comes back, without anything above the
+ * transporter noticing more than the frames that were lost.  The device
+ * going away is noticed from a hang up or an I/O error on it, and its coming
+ * back from inotify on the directory its path is in, with a retry every
+ * RECONNECT_RETRY_MS in case that was missed.  Giving the path in
+ * /dev/serial/by-id makes it the same adapter (by its serial number) that
+ * is opened again, whatever ttyUSB number it comes back as.  The UART
+ * settings, including a baudrate changed with set_baudrate(), are applied
+ * again, and get_read_fd() and get_write_fd() stay the same throughout.
+ * While the device is gone, writes fail with errno set to ENOTCONN, and
+ * anything left over from before it went is thrown away.
  */
 class UARTTransporter final : public Transporter
 {
@@ -66,7 +83,10 @@ public:
      * @param[in] protocol The backend protocol to use; see Transporter docs for
      *                     more information about supported protocols.
      * @param[in] baudrate The baudrate to set the UART to.  This must be a
-     *                     number in bits-per-second.
+     *                     number in bits-per-second, or 0 to leave the UART
+     *                     configuration alone.  Rates that aren't one of the
+     *                     standard ones are set with termios2 (BOTHER), if
+     *                     the driver supports it.
      * @param[in] read_poll_ms The amount of time to wait for the read file
      *                         descriptor to become ready before timing out.
      *                         Larger numbers mean less CPU time is spent, but
@@ -91,6 +111,14 @@ public:
     UARTTransporter(UARTTransporter &&) = delete;
     UARTTransporter& operator=(UARTTransporter &&) = delete;
 
+    /// How often to try to open the device again while it is gone, in case
+    /// inotify didn't say it was back.
+    static constexpr uint32_t RECONNECT_RETRY_MS = 250;
+
+    /// The longest RTS delay around sending in RS-485 mode; the kernel
+    /// doesn't allow more.
+    static constexpr uint32_t RS485_MAX_DELAY_MS = 100;
+
     /**
      * Do UART specific initialization.
      *
@@ -112,6 +140,170 @@ public:
      */
     int close() override;
 
+    /**
+     * Get the file descriptor of the underlying UART.
+     *
+     * With reconnecting enabled, this is an epoll file descriptor that also
+     * becomes readable when there may be a device to open again.
+     *
+     * @returns The file descriptor of the UART if it is open, -1 otherwise.
+     */
+    int get_read_fd() const override;
+
+    /**
+     * Get the file descriptor that data is written to.
+     *
+     * @returns The file descriptor of the UART if it is open, -1 otherwise.
+     */
+    int get_write_fd() const override;
+
+    /**
+     * Get the number of bytes in the UART output queue (TIOCOUTQ) that haven't been sent yet.
+     *
+     * @returns The number of bytes waiting to be sent, or -1 if the UART
+     *          isn't open.
+     */
+    ssize_t get_write_queue_bytes() const override;
+
+    /**
+     * Enable or disable low latency mode.
+     *
+     * In low latency mode, init() sets ASYNC_LOW_LATENCY on the UART with
+     * TIOCSSERIAL, which makes the driver hand received data up immediately;
+     * for USB serial adapters like the FTDI ones, this also lowers the
+     * latency timer of the adapter from 16 milliseconds to 1 millisecond.  A
+     * warning is printed if the driver doesn't support it.  This must be
+     * called before init().
+     *
+     * @param[in] enable Whether to enable low latency mode.
+     * @returns 0 on success, or -1 if the UART is already open.
+     */
+    int set_low_latency(bool enable);
+
+    /**
+     * Enable or disable estimating when each message arrived.
+     *
+     * A read returns everything that has come in since the last one, so the
+     * time it returns is late for all but the last bytes, by up to the
+     * read_poll_ms and the latency timer of the adapter.  When enabled, the
+     * receive time of each message is instead taken back from when the read
+     * returned by the time the bytes after it in the read took to come in
+     * at the baud rate (10 bits a byte, for 8N1).  That leaves out the time
+     * the data waited to be read, but not the time the UART or the adapter
+     * held it before handing it up.  This has no effect if no baudrate was
+     * given to the constructor.  This must be called before init().
+     *
+     * @param[in] enable Whether to estimate when each message arrived.
+     * @returns 0 on success, or -1 if the UART is already open.
+     */
+    int set_arrival_estimate(bool enable);
+
+    /**
+     * Enable or disable RTS/CTS hardware flow control.
+     *
+     * This is only applied if a baudrate was given to the constructor, since
+     * otherwise the UART configuration is left alone.  This must be called
+     * before init().
+     *
+     * @param[in] enable Whether to enable hardware flow control.
+     * @returns 0 on success, or -1 if the UART is already open.
+     */
+    int set_flow_control(bool enable);
+
+    /**
+     * Enable or disable the io_uring backend.
+     *
+     * With io_uring, a read into the ring buffer is always posted to the
+     * kernel, and get_read_fd() returns a file descriptor that becomes
+     * readable once it has finished; writes wait for room in the UART in the
+     * kernel instead of in poll().  If io_uring isn't available, init()
+     * prints a warning and uses poll() and read() as usual.  This must be
+     * called before init().
+     *
+     * @param[in] enable Whether to use io_uring.
+     * @returns 0 on success, or -1 if the UART is already open.
+     */
+    int set_io_uring(bool enable);
+
+    /**
+     * Enable or disable opening the device again after it goes away.
+     *
+     * See the class documentation for how this works.  The io_uring backend
+     * isn't used with it; init() prints a warning if both are enabled.  This
+     * must be called before init().
+     *
+     * @param[in] enable Whether to reconnect.
+     * @returns 0 on success, or -1 if the UART is already open.
+     */
+    int set_reconnect(bool enable);
+
+    /**
+     * Enable or disable half-duplex RS-485 mode.
+     *
+     * In RS-485 mode, init() has the driver turn the bus around with
+     * TIOCSRS485: it raises RTS to enable the line driver before sending and
+     * lowers it once everything has gone out, after the given delays.  Every
+     * write costs a turnaround, so writes should be batched into bursts (see
+     * Transporter::set_write_batching()).  RTS can't be used for flow control
+     * at the same time, and init() fails if the driver doesn't support
+     * RS-485.  This must be called before init().
+     *
+     * @param[in] enable Whether to enable RS-485 mode.
+     * @param[in] delay_before_ms How long to wait between raising RTS and
+     *                            starting to send, in milliseconds.
+     * @param[in] delay_after_ms How long to keep RTS raised after the last
+     *                           byte has gone out, in milliseconds.
+     * @returns 0 on success, or -1 if the UART is already open or a delay is
+     *          more than RS485_MAX_DELAY_MS.
+     */
+    int set_rs485(bool enable, uint32_t delay_before_ms, uint32_t delay_after_ms);
+
+    /**
+     * Get whether the device is there.
+     *
+     * @returns true if the UART is open and the device hasn't gone away,
+     *          false otherwise.
+     */
+    bool is_connected() const
+    {
+        return connected_;
+    }
+
+    /**
+     * Change the baudrate of the open UART.
+     *
+     * This waits for the UART output queue to drain, so everything written
+     * so far goes out at the old rate, then switches the rate the same way
+     * init() sets it and throws away anything received in between.
+     *
+     * @param[in] baudrate The baudrate in bits per second.
+     * @returns 0 on success, or -1 if the UART isn't open or the rate
+     *          couldn't be set.
+     */
+    int set_baudrate(uint32_t baudrate) override;
+
+    /**
+     * Get the baudrate of the UART.
+     *
+     * @returns The baudrate in bits per second, or 0 if the UART
+     *          configuration is being left alone.
+     */
+    uint32_t get_baudrate() const override;
+
+    /**
+     * Change how long a read waits for data to come in.
+     *
+     * This must only be called from the thread that reads.
+     *
+     * @param[in] read_poll_ms The time to wait in milliseconds.
+     * @returns 0.
+     */
+    int set_read_poll_ms(uint32_t read_poll_ms) override
+    {
+        read_poll_ms_ = read_poll_ms;
+        return 0;
+    }
+
 private:
     /**
      * Read data from the underlying UART and store it in the ring buffer.
@@ -138,6 +330,21 @@ private:
      */
     ssize_t node_write(void *buffer, size_t len) override;
 
+    /**
+     * Write a set of buffers to the underlying UART.
+     *
+     * This method is an override of the one in the Transporter class and
+     * writes all of the buffers with a single writev() call, so the data
+     * doesn't need to be gathered into one buffer first.  This method will
+     * block until all of the data is sent, or until an error occurs.
+     *
+     * @params[in] iov The buffers containing the data to write.
+     * @params[in] iovcnt The number of buffers in iov.
+     * @returns The number of bytes written on success (which must be equal to
+     *          the sum of the buffer lengths), or -1 on error.
+     */
+    ssize_t node_writev(const struct iovec *iov, int iovcnt) override;
+
     /**
      * Detect whether the UART is ready to send and receive data.
      *
@@ -146,12 +353,43 @@ private:
      */
     bool fds_OK() override;
 
+    /**
+     * Open the device and set it up with the current settings.
+     *
+     * @param[in] verbose Whether to print a message if the device can't be
+     *                    opened at all.
+     * @returns The new file descriptor on success, or a negative errno on
+     *          error.
+     */
+    int open_uart(bool verbose);
+
+    int setup_reconnect();
+    void disconnected();
+    void reopen();
+    void watch_device();
+    void update_byte_time();
+
     std::string uart_name_{};
     uint32_t baudrate_{0};
+    uint32_t custom_baudrate_{0};
+    uint32_t baudrate_bps_{0};
+    bool low_latency_{false};
+    bool arrival_estimate_{false};
+    bool flow_control_{false};
+    bool io_uring_{false};
+    bool reconnect_{false};
+    bool rs485_{false};
+    uint32_t rs485_delay_before_ms_{0};
+    uint32_t rs485_delay_after_ms_{0};
     uint32_t read_poll_ms_{0};
     int uart_fd_{-1};
-    uint32_t write_timeout_us_{20};
+    int epoll_fd_{-1};
+    int inotify_fd_{-1};
+    int watch_fd_{-1};
+    int timer_fd_{-1};
+    std::atomic<bool> connected_{false};
     struct pollfd poll_fd_[1] = {};
+    std::unique_ptr<impl::UringIo> uring_;
 };
 
 }  // namespace transport
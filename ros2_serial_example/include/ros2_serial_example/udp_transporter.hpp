@@ -39,13 +39,18 @@
 
 // C++ includes
 #include <cstdint>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include <netinet/in.h>
 #include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 
 // Local includes
 #include "ros2_serial_example/transporter.hpp"
+#include "ros2_serial_example/uring_io.hpp"
 
 namespace ros2_to_serial_bridge
 {
@@ -56,6 +61,33 @@ namespace transport
 /**
  * The UDPTransporter class is an implementation of the abstract Transporter
  * class specifically for talking to UDP sockets.
+ *
+ * By default the datagrams are treated as a byte stream, the same as a UART:
+ * they are read into the ring buffer and the frames are found in there, so a
+ * frame may be split across datagrams or share one with other frames.  In
+ * datagram mode, every datagram must instead hold exactly one frame.  Up to
+ * datagram_batch datagrams are then received with a single recvmmsg() and
+ * parsed where they landed, without going through the ring buffer, and a
+ * batch of frames (see Transporter::set_write_batching()) is sent with
+ * sendmmsg(), one datagram per frame.
+ *
+ * Frames are sent to one or more peers.  By default there is a single peer,
+ * on send_port at 127.0.0.1 (or the address given to set_remote_address()),
+ * that gets every topic.  set_peers() replaces that with a list of peers,
+ * each of which can be limited to a subset of the topics, so that a single
+ * transporter can feed several vehicles or simulators.  Frames are received
+ * from anyone sending to recv_port, optionally through a multicast group.
+ * With a single peer, the send socket is connect()ed to it, so the kernel
+ * doesn't look up the route for every datagram.
+ *
+ * In datagram mode, set_offload() makes the kernel do the work of splitting
+ * and merging datagrams: runs of equal sized frames to a peer are sent as
+ * one buffer that is split into datagrams on the way out (UDP_SEGMENT), and
+ * bursts of datagrams from the same sender are received as one buffer that
+ * is split back into frames here (UDP_GRO).
+ *
+ * set_kernel_timestamps() makes the receive time of each message the time
+ * the kernel received the datagram it came in.
  */
 class UDPTransporter final : public Transporter
 {
@@ -78,15 +110,44 @@ public:
      *                             numbers will allow the transport to accept
      *                             larger packets (or more of them), at the
      *                             expense of memory.  It is recommended to
-     *                             start with 8192.
+     *                             start with 8192.  In datagram mode,
+     *                             this is also the largest datagram that
+     *                             can be received.
+     * @param[in] datagram_batch If 0, use the byte stream mode.  Otherwise,
+     *                           use datagram mode and move up to this many
+     *                           datagrams per system call.
      */
     UDPTransporter(const std::string & protocol,
                    uint16_t recv_port,
                    uint16_t send_port,
                    uint32_t read_poll_ms,
-                   size_t ring_buffer_size);
+                   size_t ring_buffer_size,
+                   size_t datagram_batch = 0);
     ~UDPTransporter() override;
 
+    /// The largest datagram_batch; this is the kernel's limit for recvmmsg() and sendmmsg().
+    static constexpr size_t MAX_DATAGRAM_BATCH = 1024;
+
+    /// The most frames sent as one buffer with UDP_SEGMENT; this is the kernel's limit.
+    static constexpr size_t MAX_GSO_SEGMENTS = 64;
+
+    /// The largest frame sent with UDP_SEGMENT, so that each datagram fits in an Ethernet MTU.
+    static constexpr size_t MAX_GSO_SEGMENT_SIZE = 1472;
+
+    /// The largest buffer UDP_GRO may merge datagrams into, and so the size of each receive slot when it is on.
+    static constexpr size_t MAX_GRO_SIZE = 65535;
+
+    /// A destination for the frames sent by a UDPTransporter.
+    struct Peer final
+    {
+        /// The IPv4 address (which may be a multicast group) to send to.
+        std::string address;
+        /// The UDP port to send to.
+        uint16_t port{0};
+        /// The topic IDs to send to this peer; if empty, every topic is sent.
+        std::vector<topic_id_size_t> topic_IDs;
+    };
+
     UDPTransporter(UDPTransporter const &) = delete;
     UDPTransporter& operator=(UDPTransporter const &) = delete;
     UDPTransporter(UDPTransporter &&) = delete;
@@ -112,6 +173,182 @@ public:
      */
     int close() override;
 
+    /**
+     * Get the file descriptor of the underlying UDP socket.
+     *
+     * @returns The file descriptor of the UDP socket if it is open, -1 otherwise.
+     */
+    int get_read_fd() const override;
+
+    /**
+     * Get the file descriptor that data is written to.
+     *
+     * @returns The file descriptor of the UDP socket if it is open, -1 otherwise.
+     */
+    int get_write_fd() const override;
+
+    /**
+     * Get the number of bytes in the send socket buffer (SIOCOUTQ) that haven't been sent yet.
+     *
+     * @returns The number of bytes waiting to be sent, or -1 if the socket
+     *          isn't open.
+     */
+    ssize_t get_write_queue_bytes() const override;
+
+    /**
+     * Set the address of the default peer, which is 127.0.0.1 to start with.
+     * This must be called before init(), and has no effect if set_peers() is
+     * also called.
+     *
+     * @param[in] address The IPv4 address to send to, in dotted-quad form.
+     * @returns 0 on success, or -1 if the address is invalid or the
+     *          transporter has already been initialized.
+     */
+    int set_remote_address(const std::string & address);
+
+    /**
+     * Replace the default peer with a list of peers.  Each frame is sent to
+     * every peer that wants its topic.  This must be called before init().
+     *
+     * @param[in] peers The peers to send to.
+     * @returns 0 on success, or -1 if peers is empty, any of the addresses or
+     *          ports is invalid, or the transporter has already been
+     *          initialized.
+     */
+    int set_peers(const std::vector<Peer> & peers);
+
+    /**
+     * Receive frames sent to a multicast group, in addition to the ones sent
+     * directly to recv_port.  The receive socket is bound with SO_REUSEADDR
+     * so that several processes on the same machine can join the group.
+     * This must be called before init().
+     *
+     * @param[in] group The IPv4 multicast group to join, in dotted-quad form.
+     * @returns 0 on success, or -1 if group is not a multicast address or the
+     *          transporter has already been initialized.
+     */
+    int set_multicast_group(const std::string & group);
+
+    /**
+     * Set the kernel buffer sizes of the sockets (SO_RCVBUF and SO_SNDBUF).
+     * A large receive buffer keeps the kernel from dropping datagrams when
+     * they arrive in bursts.  The kernel may limit the sizes (see
+     * net.core.rmem_max and net.core.wmem_max); a warning is printed by
+     * init() if it does.  This must be called before init().
+     *
+     * @param[in] recv_bytes The receive buffer size, or 0 for the default.
+     * @param[in] send_bytes The send buffer size, or 0 for the default.
+     * @returns 0 on success, or -1 if a size is negative or the transporter
+     *          has already been initialized.
+     */
+    int set_socket_buffer_sizes(int recv_bytes, int send_bytes);
+
+    /**
+     * Bind the receive socket with SO_REUSEPORT, so that several
+     * transporters (see ShardedTransporter) can each receive a share of
+     * what is sent to recv_port.  The kernel spreads the datagrams over the
+     * sockets by a hash of the address and port they come from, so each
+     * sender sticks to one socket.  This must be called before init().
+     *
+     * @param[in] enable Whether to share recv_port.
+     * @returns 0 on success, or -1 if the transporter has already been
+     *          initialized.
+     */
+    int set_reuse_port(bool enable);
+
+    /**
+     * Spread what is sent to recv_port over the sockets sharing it (see
+     * set_reuse_port()) by the address it comes from alone, rather than by
+     * the address and port, so that everything from one host goes to the
+     * same socket.  This attaches a classic BPF program to the group of
+     * sockets, which picks the socket as the source address modulo shards;
+     * it is only needed on the first of them, and the sockets are numbered
+     * in the order they are initialized.  This must be called before init().
+     *
+     * @param[in] shards The number of sockets sharing recv_port, or 0 to
+     *                   leave it to the kernel.
+     * @returns 0 on success, or -1 if the transporter has already been
+     *          initialized.
+     */
+    int set_source_steering(uint32_t shards);
+
+    /**
+     * Enable or disable the io_uring backend.
+     *
+     * With io_uring, a receive into the ring buffer is always posted to the
+     * kernel, and get_read_fd() returns a file descriptor that becomes
+     * readable once it has finished; single datagrams are sent with a linked
+     * timeout instead of waiting in poll() when the socket is full.  In
+     * datagram mode the receive side keeps using recvmmsg(), which already
+     * takes a whole batch per system call, and batches are still sent with
+     * sendmmsg().  If io_uring isn't available, init() prints a warning and
+     * the sockets are used as usual.  This must be called before init().
+     *
+     * @param[in] enable Whether to use io_uring.
+     * @returns 0 on success, or -1 if the transporter has already been
+     *          initialized.
+     */
+    int set_io_uring(bool enable);
+
+    /**
+     * Enable or disable segmentation offload in datagram mode.
+     *
+     * When enabled, a batch of frames is sent with one sendmmsg() message per
+     * run of consecutive frames of the same size to a peer (the last may be
+     * shorter), up to MAX_GSO_SEGMENTS frames of at most MAX_GSO_SEGMENT_SIZE
+     * bytes, and the kernel splits each into one datagram per frame.  On the
+     * receive side, the kernel may merge datagrams from the same sender into
+     * one buffer, which is split back into frames before they are handed
+     * out.  Each receive slot grows to MAX_GRO_SIZE bytes to make room for
+     * that, so the receive buffers take datagram_batch * MAX_GRO_SIZE bytes.
+     *
+     * The peers see the same datagrams either way.  If the kernel doesn't
+     * support UDP_SEGMENT or UDP_GRO, init() prints a warning and does
+     * without; if the network device turns out not to support UDP_SEGMENT,
+     * the batch being sent fails and offload is turned off for the rest.
+     * This has no effect in byte stream mode, which already sends a batch as
+     * one datagram.  This must be called before init().
+     *
+     * @param[in] enable Whether to use segmentation offload.
+     * @returns 0 on success, or -1 if the transporter has already been
+     *          initialized.
+     */
+    int set_offload(bool enable);
+
+    /**
+     * Enable or disable taking the receive times from the kernel.
+     *
+     * When enabled, the kernel timestamps each datagram as it comes in from
+     * the network device (SO_TIMESTAMPING, in software), and that is what
+     * get_receive_time() returns for the messages in it, rather than the time
+     * the read returned; the time the datagram spent queued in the socket,
+     * and the time the reading thread took to get to it, no longer count.
+     * In byte stream mode, datagrams are then received into a buffer of
+     * their own and copied into the ring buffer, and io_uring isn't used for
+     * receiving.  If the kernel doesn't support it, init() prints a warning
+     * and the time the read returned is used.  This must be called before
+     * init().
+     *
+     * @param[in] enable Whether to take the receive times from the kernel.
+     * @returns 0 on success, or -1 if the transporter has already been
+     *          initialized.
+     */
+    int set_kernel_timestamps(bool enable);
+
+    /**
+     * Change how long a read waits for data to come in.
+     *
+     * This must only be called from the thread that reads.
+     *
+     * @param[in] read_poll_ms The time to wait in milliseconds.
+     * @returns 0.
+     */
+    int set_read_poll_ms(uint32_t read_poll_ms) override
+    {
+        read_poll_ms_ = read_poll_ms;
+        return 0;
+    }
+
 private:
     /**
      * Read data from the underlying UDP socket and store it in the ring buffer.
@@ -125,6 +362,21 @@ private:
      */
     ssize_t node_read() override;
 
+    /**
+     * Read datagrams from the underlying UDP socket and hand them out as frames.
+     *
+     * This method is an override of the one in the Transporter class, and is
+     * used in datagram mode.  It receives up to datagram_batch datagrams with
+     * one recvmmsg() call, waiting up to the read_timeout_ms set in the
+     * constructor if none are available.  Datagrams that were too large for
+     * their buffer are dropped.
+     *
+     * @params[in] visitor The callback to hand each datagram to.
+     * @returns The number of datagrams handed to the visitor (which may be
+     *          0), or -1 on error.
+     */
+    ssize_t node_read_frames(const FrameVisitor & visitor) override;
+
     /**
      * Write data to the underlying UDP socket.
      *
@@ -139,6 +391,38 @@ private:
      */
     ssize_t node_write(void *buffer, size_t len) override;
 
+    /**
+     * Write a set of buffers to the underlying UDP socket.
+     *
+     * This method is an override of the one in the Transporter class and
+     * writes all of the buffers with a single sendmsg() call, so the data
+     * doesn't need to be gathered into one buffer first.  This method will
+     * block until all of the data is sent, or until an error occurs.
+     *
+     * @params[in] iov The buffers containing the data to write.
+     * @params[in] iovcnt The number of buffers in iov.
+     * @returns The number of bytes written on success (which must be equal to
+     *          the sum of the buffer lengths), or -1 on error.
+     */
+    ssize_t node_writev(const struct iovec *iov, int iovcnt) override;
+
+    /**
+     * Write a batch of frames to the peers that want them.
+     *
+     * This method is an override of the one in the Transporter class.  In
+     * datagram mode, it sends up to datagram_batch frames per sendmmsg()
+     * call, one datagram per frame; otherwise, all of the frames for a peer
+     * go out in one datagram.  This method will block until all of the frames
+     * are sent, or until an error occurs.
+     *
+     * @params[in] frames The frames to write, one buffer per frame.
+     * @params[in] topic_IDs The topic ID of each frame.
+     * @params[in] count The number of frames.
+     * @returns The number of bytes written on success (which must be equal to
+     *          the sum of the frame lengths), or -1 on error.
+     */
+    ssize_t node_write_frames(const struct iovec *frames, const topic_id_size_t *topic_IDs, size_t count) override;
+
     /**
      * Detect whether the UDP sockets are ready to send and receive data.
      *
@@ -147,14 +431,56 @@ private:
      */
     bool fds_OK() override;
 
+    struct PeerAddr final
+    {
+        struct sockaddr_in addr;
+        std::vector<topic_id_size_t> topic_IDs;
+
+        bool wants(topic_id_size_t topic_ID) const;
+    };
+
+    int setup_socket_buffer(int fd, int optname, int size, const char *name);
+    ssize_t send_frame(const struct iovec *iov, int iovcnt);
+    ssize_t send_msg(struct sockaddr_in *addr, const struct iovec *iov, size_t iovcnt, size_t len);
+    ssize_t send_datagrams(size_t nmsgs);
+    size_t build_datagrams(PeerAddr & peer, const struct iovec *frames, const topic_id_size_t *topic_IDs,
+                           size_t count, size_t *next);
+    void setup_recv_slots(size_t datagram_size);
+    ssize_t recv_stamped(void *buffer, size_t len);
+    void take_timestamp(struct msghdr & msg);
+
     uint16_t recv_port_{0};
     uint16_t send_port_{0};
     uint32_t read_poll_ms_{0};
     int recv_fd_{-1};
     int send_fd_{-1};
-    uint32_t write_timeout_us_{20};
-    struct sockaddr_in send_outaddr{};
+    std::string remote_address_{"127.0.0.1"};
+    std::vector<Peer> peer_config_;
+    std::vector<PeerAddr> peers_;
+    std::string multicast_group_;
+    int recv_buffer_size_{0};
+    int send_buffer_size_{0};
+    bool reuse_port_{false};
+    uint32_t steering_shards_{0};
+    bool io_uring_{false};
+    bool offload_{false};
+    bool connected_{false};
+    bool gso_{false};
+    bool gro_{false};
+    bool kernel_timestamps_{false};
+    bool rx_timestamps_{false};
     struct pollfd poll_fd_[1] = {};
+    std::unique_ptr<impl::UringIo> uring_;
+    std::vector<struct iovec> send_iovs_;
+    size_t ring_buffer_size_{0};
+    size_t datagram_size_{0};
+    std::vector<uint8_t> recv_bufs_;
+    std::vector<struct iovec> recv_iovs_;
+    std::vector<struct mmsghdr> recv_msgs_;
+    std::vector<struct mmsghdr> send_msgs_;
+    std::vector<struct iovec> gso_iovs_;
+    std::vector<uint64_t> recv_control_;
+    std::vector<uint64_t> send_control_;
 };
 
 }  // namespace transport
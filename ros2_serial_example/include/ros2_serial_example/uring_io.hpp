@@ -0,0 +1,174 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ROS2_SERIAL_EXAMPLE__URING_IO_HPP_
+#define ROS2_SERIAL_EXAMPLE__URING_IO_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "ros2_serial_example/ring_buffer.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+namespace impl
+{
+
+class IoUring;
+
+/**
+ * The UringIo class does the I/O of a Transporter through io_uring, instead
+ * of with a poll() and a read() or write() per transfer.
+ *
+ * Reads go straight into the free space of the Transporter's ring buffer,
+ * which is registered with the kernel once so that it isn't mapped again for
+ * every read.  A read is always posted, so the kernel fills the ring buffer
+ * as soon as data arrives; get_fd() becomes readable when it has, and read()
+ * then only has to pick up the result and post the next read.  Several ports
+ * can therefore be served from one epoll loop with a single system call per
+ * read.
+ *
+ * Writes are submitted on a second ring, with a linked timeout, so waiting
+ * for room in the transport (and giving up when there is none for too long)
+ * happens in the kernel as part of the same system call.  Since the callers
+ * reuse their buffers straight away, writev() and sendmsg() still wait for
+ * the write to finish.
+ *
+ * Only one thread may read and only one thread may write at a time.
+ */
+class UringIo final
+{
+public:
+    /**
+     * Construct a UringIo and post the first read.
+     *
+     * @param[in] read_fd The file descriptor to read from, or -1 to only
+     *                    write.
+     * @param[in] write_fd The file descriptor to write to, or -1 to only
+     *                     read.
+     * @param[in] ringbuf The ring buffer to read into; this must outlive the
+     *                    UringIo.  Nothing else may add data to it.
+     * @param[in] bounce_size If not 0, each read goes into a separate buffer
+     *                        of this size and is then copied into the ring
+     *                        buffer, for datagrams that have to be received
+     *                        whole even when they would wrap around the end
+     *                        of the ring.
+     * @throws std::runtime_error If io_uring isn't available, for instance
+     *         because the kernel is too old or it has been disabled.
+     */
+    UringIo(int read_fd, int write_fd, RingBuffer * ringbuf, size_t bounce_size);
+
+    /**
+     * Cancel the read in flight, waiting for the kernel to let go of the
+     * ring buffer.
+     */
+    ~UringIo();
+
+    UringIo(UringIo const &) = delete;
+    UringIo& operator=(UringIo const &) = delete;
+    UringIo(UringIo &&) = delete;
+    UringIo& operator=(UringIo &&) = delete;
+
+    /**
+     * Get a file descriptor that becomes readable when a read has finished.
+     *
+     * @returns The file descriptor of the read ring, or -1 if there is none.
+     */
+    int get_fd() const;
+
+    /**
+     * Pick up the data of a finished read and post the next one.
+     *
+     * @param[in] timeout_ms How long to wait for a read to finish, if none
+     *                       has yet.
+     * @returns The number of bytes added to the ring buffer, 0 if there were
+     *          none before the timeout, or -1 on error (with errno set).  Once
+     *          the file descriptor has hung up or failed, no more reads are
+     *          posted and this fails with errno set to EIO.
+     */
+    ssize_t read(int timeout_ms);
+
+    /**
+     * Write all of some buffers to the write file descriptor.
+     *
+     * @param[in] iov The buffers to write.
+     * @param[in] iovcnt The number of buffers.
+     * @param[in] timeout_ms How long to wait for room in the transport
+     *                       before giving up.
+     * @param[out] written The number of bytes that were written, which is
+     *                     less than the total on failure.
+     * @returns The total length of the buffers on success, or -1 on error
+     *          (with errno set, to EBUSY if it timed out).
+     */
+    ssize_t writev(const struct iovec *iov, int iovcnt, uint32_t timeout_ms, size_t *written);
+
+    /**
+     * Send a message on the write file descriptor, which must be a socket.
+     *
+     * @param[in] msg The message to send.
+     * @param[in] timeout_ms How long to wait for room in the socket before
+     *                       giving up.
+     * @returns The number of bytes sent, or -1 on error (with errno set, to
+     *          EBUSY if it timed out).
+     */
+    ssize_t sendmsg(const struct msghdr *msg, uint32_t timeout_ms);
+
+    /**
+     * Determine whether reads go into a registered buffer.
+     *
+     * Registering the ring buffer pins its memory, which counts against
+     * RLIMIT_MEMLOCK; if that fails, the reads work the same, just a little
+     * slower.
+     *
+     * @returns true if the ring buffer was registered, false otherwise.
+     */
+    bool has_registered_buffer() const
+    {
+        return registered_;
+    }
+
+private:
+    void post_read();
+    ssize_t submit_write(bool is_sendmsg, const void *arg, unsigned count, uint32_t timeout_ms);
+
+    int read_fd_;
+    int write_fd_;
+    RingBuffer * ringbuf_;
+    std::vector<uint8_t> bounce_;
+    std::unique_ptr<IoUring> read_ring_;
+    std::unique_ptr<IoUring> write_ring_;
+    bool registered_{false};
+    // The state of the read in flight, if there is one.
+    bool read_posted_{false};
+    bool hung_up_{false};
+    uint8_t *read_span_{nullptr};
+    // Reused for the buffers that are left after a short write.
+    std::vector<struct iovec> write_iov_;
+};
+
+}  // namespace impl
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
+
+#endif
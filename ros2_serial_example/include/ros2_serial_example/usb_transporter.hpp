@@ -0,0 +1,244 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef ROS2_SERIAL_EXAMPLE__USB_TRANSPORTER_HPP_
+#define ROS2_SERIAL_EXAMPLE__USB_TRANSPORTER_HPP_
+
+// C++ includes
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <linux/usbdevice_fs.h>
+
+// Local includes
+#include "ros2_serial_example/transporter.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+/**
+ * The USBTransporter class is an implementation of the abstract Transporter
+ * class for talking straight to the bulk endpoints of a USB device, such as
+ * the data interface of a USB CDC-ACM device, without going through the tty
+ * layer.
+ *
+ * The device is found by its vendor and product IDs (and serial number, if
+ * there are several) in sysfs, and its interface is claimed through usbfs
+ * (/dev/bus/usb), taking it from the kernel driver (like cdc_acm) for as long
+ * as the transporter is initialized.  This needs write access to the usbfs
+ * device node, which is usually given with a udev rule.
+ *
+ * A number of bulk IN transfers are kept queued on the device at all times,
+ * so there is always one ready to take the next packet; each one completes
+ * when the device sends a short packet (or a zero-length packet), and its
+ * data is copied into the ring buffer and the transfer is queued again.
+ * Writes are sent as bulk OUT transfers straight from the buffer they are
+ * given, which is the whole batch when write batching is on.  A write that
+ * is a multiple of the endpoint's packet size is followed by a zero-length
+ * packet, so that the device sees the end of the transfer.
+ */
+class USBTransporter final : public Transporter
+{
+public:
+    /// The most bulk IN transfers to keep queued.
+    static constexpr size_t MAX_TRANSFERS = 64;
+
+    /// The largest bulk OUT transfer; longer writes are split.
+    static constexpr size_t MAX_OUT_TRANSFER = 16384;
+
+    /**
+     * What find_device() found out about a device.
+     */
+    struct Device
+    {
+        /// The usbfs device node, like /dev/bus/usb/001/004.
+        std::string path;
+        /// The address of the bulk IN endpoint, with the direction bit set.
+        uint8_t in_endpoint{0};
+        /// The address of the bulk OUT endpoint.
+        uint8_t out_endpoint{0};
+        /// The packet size of the bulk OUT endpoint.
+        size_t out_packet_size{0};
+    };
+
+    /**
+     * Construct a USBTransporter object with the given USB parameters.
+     *
+     * @param[in] protocol The backend protocol to use; see Transporter docs for
+     *                     more information about supported protocols.
+     * @param[in] vendor_id The USB vendor ID of the device.
+     * @param[in] product_id The USB product ID of the device.
+     * @param[in] serial The serial number of the device, or an empty string
+     *                   to take the first device with the IDs.
+     * @param[in] interface The number of the interface with the bulk
+     *                      endpoints; for CDC-ACM devices this is the data
+     *                      interface, which is usually 1.
+     * @param[in] read_poll_ms The amount of time to wait for data to come in
+     *                         before timing out.
+     * @param[in] ring_buffer_size The number of bytes to allocate to the
+     *                             underlying ring buffer that is used to
+     *                             accept data from the device.
+     * @param[in] transfers The number of bulk IN transfers to keep queued.
+     * @param[in] transfer_size The size of each bulk IN transfer, which
+     *                          should be a multiple of the packet size.
+     * @throws std::runtime_error If transfers is 0 or more than MAX_TRANSFERS,
+     *         or transfer_size is 0 or too large.
+     */
+    USBTransporter(const std::string & protocol,
+                   uint16_t vendor_id,
+                   uint16_t product_id,
+                   const std::string & serial,
+                   uint8_t interface,
+                   uint32_t read_poll_ms,
+                   size_t ring_buffer_size,
+                   size_t transfers,
+                   size_t transfer_size);
+    ~USBTransporter() override;
+
+    USBTransporter(USBTransporter const &) = delete;
+    USBTransporter& operator=(USBTransporter const &) = delete;
+    USBTransporter(USBTransporter &&) = delete;
+    USBTransporter& operator=(USBTransporter &&) = delete;
+
+    /**
+     * Do USB specific initialization.
+     *
+     * This method is an override of the one provided by the Transporter class.
+     * It finds the device, claims the interface, raises DTR for CDC-ACM
+     * devices, and queues the bulk IN transfers.
+     *
+     * @returns 0 on success, -1 on error.
+     */
+    int init() override;
+
+    /**
+     * Do USB specific de-initialization.
+     *
+     * This method is an override of the one provided by the Transporter class
+     * and undoes the steps that the init() method does, giving the interface
+     * back to its kernel driver.
+     *
+     * @returns 0 on success, -1 on error.
+     */
+    int close() override;
+
+    /**
+     * Get a file descriptor that becomes readable when a bulk IN transfer
+     * has completed.
+     *
+     * @returns The file descriptor if the transporter is initialized, -1
+     *          otherwise.
+     */
+    int get_read_fd() const override;
+
+    /**
+     * Find a device and its bulk endpoints in sysfs.
+     *
+     * This is what init() uses to find the device, in /sys/bus/usb/devices.
+     *
+     * @param[in] sysfs_root The directory with an entry for each device.
+     * @param[in] vendor_id The USB vendor ID of the device.
+     * @param[in] product_id The USB product ID of the device.
+     * @param[in] serial The serial number of the device, or an empty string
+     *                   for any.
+     * @param[in] interface The number of the interface with the bulk
+     *                      endpoints, in the active configuration.
+     * @param[out] device What was found out about the device.
+     * @returns 0 on success, or -1 if there is no such device, or it has no
+     *          such interface, or the interface doesn't have both a bulk IN
+     *          and a bulk OUT endpoint.
+     */
+    static int find_device(const std::string & sysfs_root,
+                           uint16_t vendor_id,
+                           uint16_t product_id,
+                           const std::string & serial,
+                           uint8_t interface,
+                           Device *device);
+
+    /**
+     * Change how long a read waits for data to come in.
+     *
+     * This must only be called from the thread that reads.
+     *
+     * @param[in] read_poll_ms The time to wait in milliseconds.
+     * @returns 0.
+     */
+    int set_read_poll_ms(uint32_t read_poll_ms) override
+    {
+        read_poll_ms_ = read_poll_ms;
+        return 0;
+    }
+
+private:
+    /**
+     * Copy the data of the completed bulk IN transfers into the ring buffer.
+     *
+     * This method is an override of the abstract one in the Transporter class.
+     * It waits up to read_poll_ms for a transfer to complete, and queues each
+     * completed transfer again once its data has been copied.
+     *
+     * @returns The number of bytes read, which is 0 if nothing came in, or
+     *          -1 on error.  If the device was unplugged, errno is ENODEV.
+     */
+    ssize_t node_read() override;
+
+    /**
+     * Write data to the device with bulk OUT transfers.
+     *
+     * This method is an override of the abstract one in the Transporter class
+     * and will block until all of the data is sent, or until the write
+     * timeout expires.
+     *
+     * @params[in] buffer The buffer containing the data to write.
+     * @params[in] len The number of bytes in the buffer to write.
+     * @returns The number of bytes written on success (which must be equal to
+     *          len), or -1 on error.  If the write timed out, errno is set to
+     *          EBUSY.
+     */
+    ssize_t node_write(void *buffer, size_t len) override;
+
+    /**
+     * Detect whether the device is open.
+     *
+     * @returns true if the device is open, false otherwise.
+     */
+    bool fds_OK() override;
+
+    int bulk_out(void *buffer, size_t len);
+    int submit_in(size_t index);
+
+    uint16_t vendor_id_;
+    uint16_t product_id_;
+    std::string serial_;
+    uint8_t interface_;
+    uint32_t read_poll_ms_{0};
+    size_t transfer_size_{0};
+    Device device_;
+    int fd_{-1};
+    int epoll_fd_{-1};
+    bool claimed_{false};
+    std::vector<struct usbdevfs_urb> urbs_;
+    std::vector<uint8_t> in_buffers_;
+};
+
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
+
+#endif
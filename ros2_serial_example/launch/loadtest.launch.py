@@ -0,0 +1,105 @@
+# Copyright 2019 Open Source Robotics Foundation, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Run the bridge under the PX4 load mix and append a report of the run."""
+
+import launch
+from launch.actions import DeclareLaunchArgument, EmitEvent, ExecuteProcess, OpaqueFunction, RegisterEventHandler, TimerAction
+from launch.event_handlers import OnProcessExit
+from launch.events import Shutdown
+from launch.substitutions import LaunchConfiguration
+from launch_ros.actions import Node
+from ament_index_python.packages import get_package_prefix
+import os
+import subprocess
+
+BRIDGE_PTY = '/tmp/ros2_serial_loadtest_bridge'
+GENERATOR_PTY = '/tmp/ros2_serial_loadtest_generator'
+BRIDGE_RECV_PORT = '2020'
+BRIDGE_SEND_PORT = '2019'
+
+def launch_setup(context):
+    """Generate the actions for the link and protocol that were asked for."""
+    link = LaunchConfiguration('link').perform(context)
+    protocol = LaunchConfiguration('protocol').perform(context)
+    duration = LaunchConfiguration('duration').perform(context)
+    report = LaunchConfiguration('report').perform(context)
+
+    lib_directory = os.path.join(get_package_prefix('ros2_serial_example'), 'lib', 'ros2_serial_example')
+    if link == 'pty':
+        generator = os.path.join(lib_directory, 'dummy_serial')
+    elif link == 'udp':
+        generator = os.path.join(lib_directory, 'dummy_udp')
+    else:
+        raise RuntimeError("link must be 'pty' or 'udp', not '%s'" % link)
+
+    # The echo topics of the load have to be remapped onto the topics the
+    # bridge publishes, so that every message comes straight back.
+    remap_lines = subprocess.check_output([generator, '-m', 'px4', '-l'], universal_newlines=True).splitlines()
+    remappings = [tuple(line.split(':=')) for line in remap_lines if line]
+
+    params = {
+        'backend_protocol': protocol,
+        'dynamic_serial_mapping_ms': 5000,
+        'read_poll_ms': 100,
+        'ring_buffer_size': 65536,
+    }
+    load_args = ['-m', 'px4', '-s', protocol, '-T', duration, '-o', report, '-p', 'ros2_to_serial_bridge_node']
+    actions = []
+    if link == 'pty':
+        params['backend_comms'] = 'uart'
+        params['device'] = BRIDGE_PTY
+        params['baudrate'] = 0
+        actions.append(ExecuteProcess(
+            cmd=['socat', 'pty,raw,echo=0,link=' + BRIDGE_PTY, 'pty,raw,echo=0,link=' + GENERATOR_PTY],
+            output='screen'))
+        generator_cmd = [generator, '-d', GENERATOR_PTY] + load_args
+    else:
+        params['backend_comms'] = 'udp'
+        params['udp_recv_port'] = int(BRIDGE_RECV_PORT)
+        params['udp_send_port'] = int(BRIDGE_SEND_PORT)
+        generator_cmd = [generator, '-r', BRIDGE_SEND_PORT, '-e', BRIDGE_RECV_PORT] + load_args
+
+    generator_process = ExecuteProcess(cmd=generator_cmd, output='screen')
+    bridge = Node(
+        package='ros2_serial_example',
+        node_executable='ros2_to_serial_bridge_node',
+        node_name='ros2_to_serial_bridge',
+        parameters=[params],
+        remappings=remappings,
+        output='screen')
+
+    # socat needs a moment to make the ptys, and the generator has to be
+    # waiting for the mapping request before the bridge starts.
+    actions.append(TimerAction(period=1.0, actions=[generator_process]))
+    actions.append(TimerAction(period=2.0, actions=[bridge]))
+    actions.append(RegisterEventHandler(OnProcessExit(
+        target_action=generator_process,
+        on_exit=[EmitEvent(event=Shutdown())])))
+
+    return actions
+
+def generate_launch_description():
+    """Generate launch description for one load test run."""
+    return launch.LaunchDescription([
+        DeclareLaunchArgument('link', default_value='pty',
+                              description="The link to run over; 'pty' (a pty pair made by socat) or 'udp'"),
+        DeclareLaunchArgument('protocol', default_value='cobs',
+                              description="The serial protocol; 'cobs', 'cobs_zpe', 'px4' or 'v2'"),
+        DeclareLaunchArgument('duration', default_value='60',
+                              description='How many seconds to run the load for'),
+        DeclareLaunchArgument('report', default_value='loadtest.jsonl',
+                              description='The file to append the report of the run to'),
+        OpaqueFunction(function=launch_setup),
+    ])
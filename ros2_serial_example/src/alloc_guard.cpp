@@ -0,0 +1,244 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+
+#include <execinfo.h>
+#include <unistd.h>
+
+#include "ros2_serial_example/alloc_guard.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+namespace
+{
+
+std::atomic<int> guard_mode{static_cast<int>(AllocGuardMode::OFF)};
+std::atomic<uint64_t> hot_path_allocations{0};
+
+// Plain thread_locals, so that they don't need a constructor or destructor
+// (which could themselves allocate).
+thread_local unsigned int hot_path_depth = 0;
+thread_local bool probing = false;
+thread_local bool probe_seen = false;
+
+void report(size_t size, AllocGuardMode mode)
+{
+    // Nothing in here may allocate with operator new; the depth is cleared
+    // anyway in case something does, so that it doesn't recurse.
+    unsigned int depth = hot_path_depth;
+    hot_path_depth = 0;
+
+    char msg[96];
+    int len = ::snprintf(msg, sizeof(msg), "%s: allocation of %zu bytes on the hot path\n",
+                         mode == AllocGuardMode::ABORT ? "Aborting" : "Warning", size);
+    if (len > 0 && ::write(STDERR_FILENO, msg, static_cast<size_t>(len)) < 0)
+    {
+        // There is nowhere else to report it.
+    }
+    void *frames[32];
+    int nframes = ::backtrace(frames, 32);
+    ::backtrace_symbols_fd(frames, nframes, STDERR_FILENO);
+
+    if (mode == AllocGuardMode::ABORT)
+    {
+        ::abort();
+    }
+
+    hot_path_depth = depth;
+}
+
+void *allocate(size_t size)
+{
+    if (probing)
+    {
+        probe_seen = true;
+    }
+    else if (hot_path_depth > 0)
+    {
+        AllocGuardMode mode = static_cast<AllocGuardMode>(guard_mode.load(std::memory_order_relaxed));
+        if (mode != AllocGuardMode::OFF)
+        {
+            hot_path_allocations.fetch_add(1, std::memory_order_relaxed);
+            report(size, mode);
+        }
+    }
+
+    if (size == 0)
+    {
+        size = 1;
+    }
+    while (true)
+    {
+        void *p = ::malloc(size);
+        if (p != nullptr)
+        {
+            return p;
+        }
+        std::new_handler handler = std::get_new_handler();
+        if (handler == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+}
+
+void *allocate_nothrow(size_t size) noexcept
+{
+    try
+    {
+        return allocate(size);
+    }
+    catch (...)
+    {
+        return nullptr;
+    }
+}
+
+}  // namespace
+
+bool parse_alloc_guard_mode(const std::string & name, AllocGuardMode * mode)
+{
+    if (name == "off")
+    {
+        *mode = AllocGuardMode::OFF;
+    }
+    else if (name == "log")
+    {
+        *mode = AllocGuardMode::LOG;
+    }
+    else if (name == "abort")
+    {
+        *mode = AllocGuardMode::ABORT;
+    }
+    else
+    {
+        return false;
+    }
+
+    return true;
+}
+
+bool set_alloc_guard_mode(AllocGuardMode mode)
+{
+    if (mode != AllocGuardMode::OFF)
+    {
+        // Make sure that allocations actually come through here.  This calls
+        // the allocation function directly, since an allocation in a new
+        // expression may be optimized away.
+        probing = true;
+        probe_seen = false;
+        ::operator delete(::operator new(1));
+        probing = false;
+        if (!probe_seen)
+        {
+            return false;
+        }
+    }
+
+    guard_mode.store(static_cast<int>(mode), std::memory_order_relaxed);
+
+    return true;
+}
+
+uint64_t get_hot_path_allocations()
+{
+    return hot_path_allocations.load(std::memory_order_relaxed);
+}
+
+HotPathScope::HotPathScope()
+{
+    hot_path_depth++;
+}
+
+HotPathScope::~HotPathScope()
+{
+    hot_path_depth--;
+}
+
+ColdPathScope::ColdPathScope() : saved_depth_(hot_path_depth)
+{
+    hot_path_depth = 0;
+}
+
+ColdPathScope::~ColdPathScope()
+{
+    hot_path_depth = saved_depth_;
+}
+
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
+
+// The replacements of the global allocation functions.  The aligned
+// variants of C++17 are left alone; nothing on the hot path uses them.
+
+void *operator new(size_t size)
+{
+    return ros2_to_serial_bridge::transport::allocate(size);
+}
+
+void *operator new[](size_t size)
+{
+    return ros2_to_serial_bridge::transport::allocate(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+    return ros2_to_serial_bridge::transport::allocate_nothrow(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+    return ros2_to_serial_bridge::transport::allocate_nothrow(size);
+}
+
+void operator delete(void *p) noexcept
+{
+    ::free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    ::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    ::free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+    ::free(p);
+}
+
+void operator delete(void *p, const std::nothrow_t &) noexcept
+{
+    ::free(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t &) noexcept
+{
+    ::free(p);
+}
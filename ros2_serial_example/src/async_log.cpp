@@ -0,0 +1,298 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+#include "ros2_serial_example/async_log.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+constexpr size_t AsyncLog::MESSAGE_SIZE;
+constexpr std::chrono::milliseconds AsyncLog::POLL_INTERVAL;
+
+// How long a run of repeated messages may go before its count is reported,
+// even if it hasn't ended yet.
+static constexpr std::chrono::seconds REPEAT_REPORT_INTERVAL{5};
+
+// The queue and rate limit of AsyncLog::instance().
+static constexpr size_t INSTANCE_CAPACITY = 256;
+static constexpr uint32_t INSTANCE_MAX_PER_SECOND = 10;
+
+static const char *level_name(AsyncLog::Level level)
+{
+    switch (level)
+    {
+    case AsyncLog::Level::INFO:
+        return "INFO";
+    case AsyncLog::Level::WARN:
+        return "WARN";
+    case AsyncLog::Level::ERROR:
+        return "ERROR";
+    }
+
+    return "";
+}
+
+AsyncLog::AsyncLog(size_t capacity, uint32_t max_per_second, Sink sink)
+    : max_per_second_(max_per_second), sink_(std::move(sink))
+{
+    if (capacity == 0)
+    {
+        throw std::runtime_error("AsyncLog capacity must be > 0");
+    }
+    if (max_per_second == 0)
+    {
+        throw std::runtime_error("AsyncLog max_per_second must be > 0");
+    }
+
+    // As for the FrameQueue, one slot can't tell full from free, so there
+    // are always at least two.
+    num_slots_ = std::max<size_t>(capacity, 2);
+    slots_ = std::unique_ptr<Slot[]>(new Slot[num_slots_]);
+    for (size_t i = 0; i < num_slots_; ++i)
+    {
+        slots_[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    thread_ = std::thread(&AsyncLog::thread_func, this);
+}
+
+AsyncLog::~AsyncLog()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = false;
+    }
+    cv_.notify_all();
+    thread_.join();
+}
+
+AsyncLog & AsyncLog::instance()
+{
+    // This is destroyed after main() returns, which stops the thread once
+    // whatever is still queued has been printed.
+    static AsyncLog log(INSTANCE_CAPACITY, INSTANCE_MAX_PER_SECOND, Sink());
+
+    return log;
+}
+
+bool AsyncLog::allow(Site * site, uint64_t * suppressed)
+{
+    int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+
+    // The first caller to see that the window is over starts the next one.
+    // Racing with the other callers at the edge of a window can let one or
+    // two more messages through than the limit, which doesn't matter.
+    int64_t start = site->window_start_ns.load(std::memory_order_relaxed);
+    if (now - start >= std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::seconds(1)).count())
+    {
+        if (site->window_start_ns.compare_exchange_strong(start, now, std::memory_order_relaxed))
+        {
+            site->in_window.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    if (site->in_window.fetch_add(1, std::memory_order_relaxed) >= max_per_second_)
+    {
+        site->suppressed.fetch_add(1, std::memory_order_relaxed);
+        suppressed_++;
+        return false;
+    }
+
+    *suppressed = site->suppressed.exchange(0, std::memory_order_relaxed);
+
+    return true;
+}
+
+void AsyncLog::log(Site * site, Level level, const char * fmt, ...)
+{
+    uint64_t suppressed;
+    if (!allow(site, &suppressed))
+    {
+        return;
+    }
+
+    Slot *slot;
+    size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        slot = &slots_[pos % num_slots_];
+        size_t seq = slot->seq.load(std::memory_order_acquire);
+        intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+        if (diff == 0)
+        {
+            if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            // The queue is full.  The messages this one stood for are lost
+            // with it.
+            dropped_ += 1 + suppressed;
+            return;
+        }
+        else
+        {
+            pos = enqueue_pos_.load(std::memory_order_relaxed);
+        }
+    }
+
+    slot->level = level;
+    slot->suppressed = suppressed;
+    va_list args;
+    va_start(args, fmt);
+    ::vsnprintf(slot->text, MESSAGE_SIZE, fmt, args);
+    va_end(args);
+    slot->seq.store(pos + 1, std::memory_order_release);
+}
+
+void AsyncLog::set_sink(Sink sink)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    sink_ = std::move(sink);
+}
+
+void AsyncLog::flush()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    size_t ticket = ++flush_requested_;
+    cv_.notify_all();
+    cv_.wait(lock, [this, ticket]() { return flushed_ >= ticket || !running_; });
+}
+
+void AsyncLog::emit(Level level, const char * text, uint64_t suppressed)
+{
+    char line[MESSAGE_SIZE + 64];
+    if (suppressed > 0)
+    {
+        ::snprintf(line, sizeof(line), "%s (%lu similar messages suppressed)", text,
+                   static_cast<unsigned long>(suppressed));
+        text = line;
+    }
+
+    if (sink_)
+    {
+        sink_(level, text);
+    }
+    else
+    {
+        ::fprintf(stderr, "[%s] %s\n", level_name(level), text);
+    }
+}
+
+void AsyncLog::emit_repeats(Pending * pending)
+{
+    if (pending->repeats == 0)
+    {
+        return;
+    }
+
+    char line[64];
+    ::snprintf(line, sizeof(line), "last message repeated %lu times", static_cast<unsigned long>(pending->repeats));
+    emit(pending->level, line, pending->suppressed);
+    pending->repeats = 0;
+    pending->suppressed = 0;
+}
+
+void AsyncLog::drain(Pending * pending)
+{
+    for (;;)
+    {
+        Slot *slot = &slots_[dequeue_pos_ % num_slots_];
+        if (slot->seq.load(std::memory_order_acquire) != dequeue_pos_ + 1)
+        {
+            break;
+        }
+
+        if (pending->valid && slot->level == pending->level && ::strcmp(slot->text, pending->text) == 0)
+        {
+            if (pending->repeats == 0)
+            {
+                pending->first_repeat = std::chrono::steady_clock::now();
+            }
+            pending->repeats++;
+            pending->suppressed += slot->suppressed;
+            slot->seq.store(dequeue_pos_ + num_slots_, std::memory_order_release);
+            dequeue_pos_++;
+            continue;
+        }
+
+        emit_repeats(pending);
+
+        // The slot is handed back before the sink is called, so that a slow
+        // sink holds up one less message.
+        uint64_t suppressed = slot->suppressed;
+        pending->valid = true;
+        pending->level = slot->level;
+        ::memcpy(pending->text, slot->text, MESSAGE_SIZE);
+        slot->seq.store(dequeue_pos_ + num_slots_, std::memory_order_release);
+        dequeue_pos_++;
+
+        emit(pending->level, pending->text, suppressed);
+    }
+}
+
+void AsyncLog::thread_func()
+{
+    Pending pending;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;)
+    {
+        // Producers never wake this thread, so that logging never makes a
+        // system call; it just looks every POLL_INTERVAL.
+        cv_.wait_for(lock, POLL_INTERVAL, [this]() { return !running_ || flush_requested_ != flushed_; });
+
+        size_t ticket = flush_requested_;
+        drain(&pending);
+        if (ticket != flushed_ || !running_ ||
+            (pending.repeats > 0 && std::chrono::steady_clock::now() - pending.first_repeat >= REPEAT_REPORT_INTERVAL))
+        {
+            emit_repeats(&pending);
+        }
+
+        if (ticket != flushed_)
+        {
+            flushed_ = ticket;
+            cv_.notify_all();
+        }
+        if (!running_)
+        {
+            break;
+        }
+    }
+}
+
+}  // namespace transport
+
+}  // namespace ros2_to_serial_bridge
@@ -0,0 +1,192 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+
+#include <rosbag2_cpp/converter_options.hpp>
+#include <rosbag2_cpp/writer.hpp>
+#include <rosbag2_storage/ros_helper.hpp>
+#include <rosbag2_storage/serialized_bag_message.hpp>
+#include <rosbag2_storage/storage_options.hpp>
+#include <rosbag2_storage/topic_metadata.hpp>
+
+#include "ros2_serial_example/alloc_guard.hpp"
+#include "ros2_serial_example/bag_recorder.hpp"
+#include "ros2_serial_example/cdr_encapsulation.hpp"
+#include "ros2_serial_example/dispatch_pool.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace pubsub
+{
+
+namespace
+{
+
+// The bridge names types as "<package>/<name>", while bags want the full
+// "<package>/msg/<name>".
+std::string bag_type(const std::string & type)
+{
+    size_t slash = type.find('/');
+    if (slash == std::string::npos || type.find('/', slash + 1) != std::string::npos)
+    {
+        return type;
+    }
+
+    return type.substr(0, slash) + "/msg" + type.substr(slash);
+}
+
+}  // namespace
+
+BagRecorder::BagRecorder(const std::string & uri, const std::string & storage_id, size_t queue_bytes)
+{
+    rosbag2_storage::StorageOptions storage_options;
+    storage_options.uri = uri;
+    storage_options.storage_id = storage_id;
+    rosbag2_cpp::ConverterOptions converter_options;
+    converter_options.input_serialization_format = "cdr";
+    converter_options.output_serialization_format = "cdr";
+
+    writer_ = std::make_unique<rosbag2_cpp::Writer>();
+    try
+    {
+        writer_->open(storage_options, converter_options);
+    }
+    catch (const std::exception & e)
+    {
+        throw std::runtime_error("Failed to create bag '" + uri + "': " + e.what());
+    }
+
+    pool_ = std::make_unique<ros2_to_serial_bridge::transport::DispatchPool>(
+        1, queue_bytes,
+        [this](size_t, uint16_t source, topic_id_size_t topic_ID, uint8_t * buffer, size_t length,
+               std::chrono::system_clock::time_point receive_time)
+        {
+            write(source, topic_ID, buffer, length, receive_time);
+        });
+}
+
+BagRecorder::~BagRecorder()
+{
+    stop();
+}
+
+void BagRecorder::set_topics(uint16_t source, const std::map<topic_id_size_t, Topic> & topics)
+{
+    std::lock_guard<std::mutex> lock(topics_mutex_);
+
+    if (writer_ == nullptr)
+    {
+        return;
+    }
+
+    for (const auto & t : topics)
+    {
+        if (created_.count(t.second.name) != 0)
+        {
+            continue;
+        }
+
+        // The serial port has no QoS to offer, so that is left empty.
+        rosbag2_storage::TopicMetadata metadata;
+        metadata.name = t.second.name;
+        metadata.type = bag_type(t.second.type);
+        metadata.serialization_format = "cdr";
+        try
+        {
+            writer_->create_topic(metadata);
+        }
+        catch (const std::exception & e)
+        {
+            ::fprintf(stderr, "Failed to add topic '%s' to the bag: %s\n", t.second.name.c_str(), e.what());
+            continue;
+        }
+        created_.insert(t.second.name);
+    }
+
+    topics_[source] = topics;
+}
+
+bool BagRecorder::push(uint16_t source, topic_id_size_t topic_ID, const uint8_t * buffer, size_t length,
+                       std::chrono::system_clock::time_point receive_time)
+{
+    if (!pool_->push(source, topic_ID, buffer, length, receive_time))
+    {
+        drops_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    return true;
+}
+
+void BagRecorder::write(uint16_t source, topic_id_size_t topic_ID, const uint8_t * buffer, size_t length,
+                        std::chrono::system_clock::time_point receive_time)
+{
+    // Writing to the bag allocates, and is off the receive path anyway.
+    ros2_to_serial_bridge::transport::ColdPathScope cold_path;
+
+    std::lock_guard<std::mutex> lock(topics_mutex_);
+
+    auto source_it = topics_.find(source);
+    if (writer_ == nullptr || source_it == topics_.end())
+    {
+        return;
+    }
+    auto topic_it = source_it->second.find(topic_ID);
+    if (topic_it == source_it->second.end() || created_.count(topic_it->second.name) == 0)
+    {
+        return;
+    }
+
+    auto message = std::make_shared<rosbag2_storage::SerializedBagMessage>();
+    message->serialized_data = rosbag2_storage::make_empty_serialized_message(cdr::ENCAPSULATION_SIZE + length);
+    cdr::write_encapsulation(message->serialized_data->buffer);
+    ::memcpy(message->serialized_data->buffer + cdr::ENCAPSULATION_SIZE, buffer, length);
+    message->serialized_data->buffer_length = cdr::ENCAPSULATION_SIZE + length;
+    message->time_stamp = std::chrono::duration_cast<std::chrono::nanoseconds>(receive_time.time_since_epoch()).count();
+    message->topic_name = topic_it->second.name;
+
+    try
+    {
+        writer_->write(message);
+    }
+    catch (const std::exception & e)
+    {
+        ::fprintf(stderr, "Failed to write to the bag: %s\n", e.what());
+    }
+}
+
+void BagRecorder::stop()
+{
+    if (pool_ != nullptr)
+    {
+        pool_->stop();
+    }
+
+    std::lock_guard<std::mutex> lock(topics_mutex_);
+    writer_.reset();
+}
+
+}  // namespace pubsub
+}  // namespace ros2_to_serial_bridge
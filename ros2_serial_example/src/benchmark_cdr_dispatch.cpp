@@ -0,0 +1,151 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// A micro-benchmark of the per-message CDR work that the bridge does, to
+// compare calling the fastrtps typesupport functions through std::function
+// (how PublisherImpl and SubscriptionImpl used to hold them) against calling
+// them through template parameters (how they hold them now).  Each iteration
+// serializes a message into a buffer and deserializes it back out, which is
+// what one message costs on the ROS2ToSerial plus the SerialToROS2 path.
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <vector>
+
+#include <fastcdr/Cdr.h>
+#include <fastcdr/FastCdr.h>
+
+#include <std_msgs/msg/float64_multi_array.hpp>
+#include <std_msgs/msg/detail/float64_multi_array__rosidl_typesupport_fastrtps_cpp.hpp>
+#include <std_msgs/msg/u_int16.hpp>
+#include <std_msgs/msg/detail/u_int16__rosidl_typesupport_fastrtps_cpp.hpp>
+
+namespace
+{
+
+template<typename T>
+struct ErasedCdr final
+{
+    std::function<size_t(const T &, size_t)> get_size;
+    std::function<bool(const T &, eprosima::fastcdr::Cdr &)> serialize;
+    std::function<bool(eprosima::fastcdr::Cdr &, T &)> deserialize;
+
+    void round_trip(const T & in, T & out, std::vector<uint8_t> & buffer) const
+    {
+        size_t size = get_size(in, 0);
+        if (buffer.size() < size)
+        {
+            buffer.resize(size);
+        }
+        eprosima::fastcdr::FastBuffer sbuf(reinterpret_cast<char *>(buffer.data()), buffer.size());
+        eprosima::fastcdr::Cdr scdr(sbuf);
+        serialize(in, scdr);
+        eprosima::fastcdr::FastBuffer dbuf(reinterpret_cast<char *>(buffer.data()), scdr.getSerializedDataLength());
+        eprosima::fastcdr::Cdr dcdr(dbuf);
+        deserialize(dcdr, out);
+    }
+};
+
+template<typename T,
+         size_t (*GetSize)(const T &, size_t),
+         bool (*Serialize)(const T &, eprosima::fastcdr::Cdr &),
+         bool (*Deserialize)(eprosima::fastcdr::Cdr &, T &)>
+struct SpecializedCdr final
+{
+    void round_trip(const T & in, T & out, std::vector<uint8_t> & buffer) const
+    {
+        size_t size = GetSize(in, 0);
+        if (buffer.size() < size)
+        {
+            buffer.resize(size);
+        }
+        eprosima::fastcdr::FastBuffer sbuf(reinterpret_cast<char *>(buffer.data()), buffer.size());
+        eprosima::fastcdr::Cdr scdr(sbuf);
+        Serialize(in, scdr);
+        eprosima::fastcdr::FastBuffer dbuf(reinterpret_cast<char *>(buffer.data()), scdr.getSerializedDataLength());
+        eprosima::fastcdr::Cdr dcdr(dbuf);
+        Deserialize(dcdr, out);
+    }
+};
+
+template<typename T, typename Impl>
+double ns_per_message(const Impl & impl, const T & in, size_t iterations)
+{
+    T out;
+    std::vector<uint8_t> buffer;
+
+    // Warm up, so the buffer and the output message have their final sizes.
+    impl.round_trip(in, out, buffer);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i)
+    {
+        impl.round_trip(in, out, buffer);
+    }
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+    return std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+}
+
+template<typename T,
+         size_t (*GetSize)(const T &, size_t),
+         bool (*Serialize)(const T &, eprosima::fastcdr::Cdr &),
+         bool (*Deserialize)(eprosima::fastcdr::Cdr &, T &)>
+void compare(const char *name, const T & msg, size_t iterations)
+{
+    ErasedCdr<T> erased{GetSize, Serialize, Deserialize};
+    SpecializedCdr<T, GetSize, Serialize, Deserialize> specialized;
+
+    double erased_ns = ns_per_message(erased, msg, iterations);
+    double specialized_ns = ns_per_message(specialized, msg, iterations);
+
+    ::printf("%-28s std::function %8.1f ns/msg   template %8.1f ns/msg   (%+.1f%%)\n",
+             name, erased_ns, specialized_ns, 100.0 * (specialized_ns - erased_ns) / erased_ns);
+}
+
+}  // namespace
+
+int main(int argc, char *argv[])
+{
+    size_t iterations = 1000000;
+    if (argc > 1)
+    {
+        iterations = ::strtoul(argv[1], nullptr, 10);
+        if (iterations == 0)
+        {
+            ::fprintf(stderr, "Usage: %s [iterations]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    namespace ts = std_msgs::msg::typesupport_fastrtps_cpp;
+
+    std_msgs::msg::UInt16 small;
+    small.data = 0x1234;
+    compare<std_msgs::msg::UInt16, ts::get_serialized_size, ts::cdr_serialize, ts::cdr_deserialize>(
+        "std_msgs/UInt16", small, iterations);
+
+    // Something closer in size to the PX4 sensor messages, which are mostly
+    // arrays of floating point values.
+    std_msgs::msg::Float64MultiArray large;
+    large.data.resize(32, 1.0);
+    compare<std_msgs::msg::Float64MultiArray, ts::get_serialized_size, ts::cdr_serialize, ts::cdr_deserialize>(
+        "std_msgs/Float64MultiArray", large, iterations);
+
+    return 0;
+}
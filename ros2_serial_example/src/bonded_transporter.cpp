@@ -0,0 +1,604 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "ros2_serial_example/async_log.hpp"
+#include "ros2_serial_example/bonded_transporter.hpp"
+#include "ros2_serial_example/transporter.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+constexpr size_t BondedTransporter::MAX_LINKS;
+
+// The rate a link without a baudrate starts out with, until it is measured.
+static constexpr double DEFAULT_RATE_BPS = 1000000.0;
+
+// How much a new measurement of the rate of a link counts for.
+static constexpr double RATE_WEIGHT = 0.2;
+
+// How long a link that failed a write is passed over when striping.
+static constexpr std::chrono::milliseconds WRITE_FAILURE_BACKOFF{100};
+
+// How many sequence numbers back the receive window of a topic goes.
+static constexpr int SEQ_WINDOW = 64;
+
+static constexpr int MAX_EPOLL_EVENTS = 16;
+
+static std::chrono::steady_clock::duration seconds_to_duration(double seconds)
+{
+    return std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds));
+}
+
+BondedTransporter::BondedTransporter(const std::string & protocol,
+                                     std::vector<std::unique_ptr<Transporter>> links,
+                                     Mode mode,
+                                     uint32_t read_poll_ms,
+                                     size_t ring_buffer_size):
+    Transporter(protocol, ring_buffer_size),
+    mode_(mode),
+    read_poll_ms_(read_poll_ms)
+{
+    // The copies of a frame are told apart by their sequence numbers, which
+    // COBS doesn't have.
+    if (get_protocol() != "px4" && get_protocol() != "v2")
+    {
+        throw std::runtime_error("Invalid protocol '" + protocol + "' for a bond; must be one of 'px4' or 'v2'");
+    }
+
+    if (links.empty() || links.size() > MAX_LINKS)
+    {
+        throw std::runtime_error("Invalid number of links for a bond; must be between 1 and " +
+                                 std::to_string(MAX_LINKS) + " inclusive");
+    }
+
+    for (std::unique_ptr<Transporter> & transporter : links)
+    {
+        if (transporter == nullptr)
+        {
+            throw std::runtime_error("Bond link must not be a nullptr");
+        }
+        if (transporter->get_protocol() != get_protocol())
+        {
+            throw std::runtime_error("Bond link uses protocol '" + transporter->get_protocol() + "' rather than '" +
+                                     get_protocol() + "'");
+        }
+        links_.push_back(std::make_unique<Link>());
+        links_.back()->transporter = std::move(transporter);
+    }
+
+    whole_messages_ = true;
+}
+
+BondedTransporter::~BondedTransporter()
+{
+    close();
+}
+
+bool BondedTransporter::parse_mode(const std::string & name, Mode * out)
+{
+    if (name == "stripe")
+    {
+        *out = Mode::STRIPE;
+    }
+    else if (name == "redundant")
+    {
+        *out = Mode::REDUNDANT;
+    }
+    else
+    {
+        return false;
+    }
+
+    return true;
+}
+
+int BondedTransporter::init()
+{
+    if (initialized_)
+    {
+        ::fprintf(stderr, "Cannot re-init; call close first\n");
+        return -1;
+    }
+
+    bool all_fds = true;
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < links_.size(); ++i)
+    {
+        Link & link = *links_[i];
+        if (link.transporter->init() < 0)
+        {
+            ::fprintf(stderr, "Failed to initialize bond link %zu\n", i);
+            close();
+            return -1;
+        }
+
+        // A byte on a UART takes 10 bits with the start and stop bits.
+        uint32_t baudrate = link.transporter->get_baudrate();
+        link.set_rate((baudrate > 0) ? baudrate / 10.0 : DEFAULT_RATE_BPS);
+        link.busy_until = now;
+        link.failed_until = now;
+        link.queued_at = now;
+        link.queued = -1;
+        link.read_fd = link.transporter->get_read_fd();
+        all_fds = all_fds && link.read_fd >= 0;
+        link.up = true;
+    }
+
+    // Links without a file descriptor can only be read by waiting in each of
+    // their reads in turn.
+    if (all_fds)
+    {
+        epoll_fd_ = ::epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd_ < 0)
+        {
+            ::fprintf(stderr, "Failed to create bond epoll: %s\n", ::strerror(errno));
+            close();
+            return -1;
+        }
+        for (size_t i = 0; i < links_.size(); ++i)
+        {
+            struct epoll_event ev{};
+            ev.events = EPOLLIN;
+            ev.data.u64 = i;
+            if (::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, links_[i]->read_fd, &ev) < 0)
+            {
+                ::fprintf(stderr, "Failed to add bond link %zu to epoll: %s\n", i, ::strerror(errno));
+                close();
+                return -1;
+            }
+        }
+    }
+
+    initialized_ = true;
+
+    return 0;
+}
+
+int BondedTransporter::close()
+{
+    int ret = 0;
+
+    if (epoll_fd_ != -1)
+    {
+        if (::close(epoll_fd_) < 0)
+        {
+            ret = -1;
+        }
+        epoll_fd_ = -1;
+    }
+
+    for (std::unique_ptr<Link> & link : links_)
+    {
+        link->up = false;
+        link->read_fd = -1;
+        if (link->transporter->close() < 0)
+        {
+            ret = -1;
+        }
+    }
+
+    initialized_ = false;
+
+    return ret;
+}
+
+int BondedTransporter::get_read_fd() const
+{
+    return epoll_fd_;
+}
+
+ssize_t BondedTransporter::get_write_queue_bytes() const
+{
+    ssize_t queued = -1;
+    for (const std::unique_ptr<Link> & link : links_)
+    {
+        if (link->up)
+        {
+            queued = std::max(queued, link->transporter->get_write_queue_bytes());
+        }
+    }
+
+    return queued;
+}
+
+int BondedTransporter::set_redundant(topic_id_size_t topic_ID, bool redundant)
+{
+    if (topic_ID > get_max_topic_ID())
+    {
+        return -1;
+    }
+
+    if (topic_modes_.size() <= topic_ID)
+    {
+        topic_modes_.resize(static_cast<size_t>(topic_ID) + 1, mode_);
+    }
+    topic_modes_[topic_ID] = redundant ? Mode::REDUNDANT : Mode::STRIPE;
+
+    return 0;
+}
+
+BondedTransporter::LinkStats BondedTransporter::get_link_stats(size_t link) const
+{
+    LinkStats stats;
+    if (link >= links_.size())
+    {
+        return stats;
+    }
+
+    const Link & l = *links_[link];
+    stats.tx_frames = l.tx_frames;
+    stats.tx_bytes = l.tx_bytes;
+    stats.tx_errors = l.tx_errors;
+    stats.rx_messages = l.rx_messages;
+    stats.duplicates = l.duplicates;
+    uint64_t rate_bits = l.rate_bits;
+    ::memcpy(&stats.rate_Bps, &rate_bits, sizeof(stats.rate_Bps));
+    stats.up = l.up;
+
+    return stats;
+}
+
+ssize_t BondedTransporter::node_read()
+{
+    errno = ENOTSUP;
+
+    return -1;
+}
+
+ssize_t BondedTransporter::node_write(void *buffer, size_t len)
+{
+    struct iovec iov;
+    iov.iov_base = buffer;
+    iov.iov_len = len;
+
+    return node_writev(&iov, 1);
+}
+
+ssize_t BondedTransporter::node_writev(const struct iovec *iov, int iovcnt)
+{
+    size_t len = 0;
+    for (int i = 0; i < iovcnt; ++i)
+    {
+        len += iov[i].iov_len;
+    }
+
+    Mode mode = (write_topic_ID_ < topic_modes_.size()) ? topic_modes_[write_topic_ID_] : mode_;
+    if (mode == Mode::REDUNDANT)
+    {
+        bool written = false;
+        for (std::unique_ptr<Link> & link : links_)
+        {
+            if (link->up && write_link(*link, iov, iovcnt, len))
+            {
+                written = true;
+            }
+        }
+        if (!written)
+        {
+            errno = EBUSY;
+            return -1;
+        }
+
+        return len;
+    }
+
+    // If the quickest link can't take the frame, the next quickest gets it.
+    uint64_t skip = 0;
+    Link * link;
+    while ((link = pick_link(len, skip)) != nullptr)
+    {
+        if (write_link(*link, iov, iovcnt, len))
+        {
+            return len;
+        }
+        for (size_t i = 0; i < links_.size(); ++i)
+        {
+            if (links_[i].get() == link)
+            {
+                skip |= UINT64_C(1) << i;
+            }
+        }
+    }
+
+    errno = EBUSY;
+
+    return -1;
+}
+
+ssize_t BondedTransporter::node_write_frames(const struct iovec *frames, const topic_id_size_t *topic_IDs, size_t count)
+{
+    // Each frame may go somewhere else, so they are written one at a time.
+    size_t total = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        write_topic_ID_ = topic_IDs[i];
+        ssize_t ret = node_writev(&frames[i], 1);
+        if (ret < 0)
+        {
+            return -1;
+        }
+        total += ret;
+    }
+
+    return total;
+}
+
+BondedTransporter::Link * BondedTransporter::pick_link(size_t len, uint64_t skip)
+{
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+    Link * best = nullptr;
+    std::chrono::steady_clock::time_point best_finish{};
+    for (size_t i = 0; i < links_.size(); ++i)
+    {
+        Link & link = *links_[i];
+        if (!link.up || (skip & (UINT64_C(1) << i)) != 0)
+        {
+            continue;
+        }
+
+        ssize_t queued = link.transporter->get_write_queue_bytes();
+        if (queued >= 0)
+        {
+            // A link that still had something queued both times was sending
+            // all along in between, so what went out shows how fast it is.
+            if (queued > 0 && link.queued > queued)
+            {
+                double elapsed = std::chrono::duration<double>(now - link.queued_at).count();
+                if (elapsed > 0.0)
+                {
+                    double rate = (link.queued - queued) / elapsed;
+                    link.set_rate((1.0 - RATE_WEIGHT) * link.rate_Bps + RATE_WEIGHT * rate);
+                }
+            }
+            link.queued = queued;
+            link.queued_at = now;
+            link.busy_until = now + seconds_to_duration(queued / link.rate_Bps);
+        }
+
+        std::chrono::steady_clock::time_point finish = std::max({now, link.busy_until, link.failed_until}) +
+                                                       seconds_to_duration(len / link.rate_Bps);
+        if (best == nullptr || finish < best_finish)
+        {
+            best = &link;
+            best_finish = finish;
+        }
+    }
+
+    return best;
+}
+
+bool BondedTransporter::write_link(Link & link, const struct iovec *iov, int iovcnt, size_t len)
+{
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+    if (link.transporter->write_framed(write_topic_ID_, iov, iovcnt) < 0)
+    {
+        link.tx_errors++;
+        link.failed_until = now + WRITE_FAILURE_BACKOFF;
+        return false;
+    }
+
+    link.tx_frames++;
+    link.tx_bytes += len;
+    link.busy_until = std::max(now, link.busy_until) + seconds_to_duration(len / link.rate_Bps);
+    ssize_t queued = link.transporter->get_write_queue_bytes();
+    if (queued >= 0)
+    {
+        link.queued = queued;
+        link.queued_at = now;
+    }
+
+    return true;
+}
+
+bool BondedTransporter::accept(Link & link, topic_id_size_t topic_ID)
+{
+    link.rx_messages++;
+
+    int seq = link.transporter->get_receive_sequence();
+    if (seq < 0)
+    {
+        return true;
+    }
+
+    if (windows_.size() <= topic_ID)
+    {
+        windows_.resize(static_cast<size_t>(topic_ID) + 1);
+    }
+    SeqWindow & window = windows_[topic_ID];
+
+    if (!window.valid)
+    {
+        window.valid = true;
+        window.newest = static_cast<uint8_t>(seq);
+        window.seen = 1;
+        return true;
+    }
+
+    int diff = static_cast<int8_t>(static_cast<uint8_t>(seq - window.newest));
+    if (diff > 0)
+    {
+        window.seen = (diff >= SEQ_WINDOW) ? 1 : ((window.seen << diff) | 1);
+        window.newest = static_cast<uint8_t>(seq);
+        return true;
+    }
+
+    if (-diff >= SEQ_WINDOW)
+    {
+        // Too far back to be a late copy; the other side started over.
+        window.seen = 1;
+        window.newest = static_cast<uint8_t>(seq);
+        return true;
+    }
+
+    uint64_t bit = UINT64_C(1) << -diff;
+    if ((window.seen & bit) != 0)
+    {
+        link.duplicates++;
+        return false;
+    }
+    window.seen |= bit;
+
+    return true;
+}
+
+ssize_t BondedTransporter::read_link(Link & link, uint8_t *out_buffer, size_t buffer_len,
+                                     const MessageVisitor & visitor)
+{
+    ssize_t nmessages = 0;
+    ssize_t ret = link.transporter->read_many(out_buffer, buffer_len,
+                                              [&](topic_id_size_t topic_ID, uint8_t *payload, size_t payload_len) {
+        if (!accept(link, topic_ID))
+        {
+            return;
+        }
+        set_receive_info(link.transporter->get_receive_time(), link.transporter->get_receive_sequence());
+        nmessages++;
+        visitor(topic_ID, payload, payload_len);
+    });
+    if (ret < 0 && nmessages == 0)
+    {
+        return -1;
+    }
+
+    return nmessages;
+}
+
+void BondedTransporter::link_down(size_t index)
+{
+    Link & link = *links_[index];
+    if (!link.up.exchange(false))
+    {
+        return;
+    }
+
+    if (epoll_fd_ != -1 && link.read_fd != -1)
+    {
+        ::epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, link.read_fd, nullptr);
+    }
+
+    size_t left = 0;
+    for (const std::unique_ptr<Link> & l : links_)
+    {
+        if (l->up)
+        {
+            left++;
+        }
+    }
+    ROS2_SERIAL_LOG(WARN, "Bond link %zu failed; %zu left", index, left);
+}
+
+ssize_t BondedTransporter::node_read_message(topic_id_size_t *topic_ID, uint8_t *out_buffer, size_t buffer_len)
+{
+    // Take the links in turn, so a busy one doesn't starve the others.
+    for (size_t n = 0; n < links_.size(); ++n)
+    {
+        size_t index = next_link_;
+        next_link_ = (next_link_ + 1) % links_.size();
+
+        Link & link = *links_[index];
+        if (!link.up)
+        {
+            continue;
+        }
+
+        ssize_t len = link.transporter->read(topic_ID, out_buffer, buffer_len);
+        if (len >= 0 && accept(link, *topic_ID))
+        {
+            set_receive_info(link.transporter->get_receive_time(), link.transporter->get_receive_sequence());
+            return len;
+        }
+    }
+
+    return -ENODATA;
+}
+
+ssize_t BondedTransporter::node_read_messages(uint8_t *out_buffer, size_t buffer_len, const MessageVisitor & visitor)
+{
+    ssize_t nmessages = 0;
+
+    if (epoll_fd_ == -1)
+    {
+        for (size_t i = 0; i < links_.size(); ++i)
+        {
+            if (links_[i]->up)
+            {
+                nmessages += std::max(read_link(*links_[i], out_buffer, buffer_len, visitor), ssize_t(0));
+            }
+        }
+
+        return nmessages;
+    }
+
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+    int n = ::epoll_wait(epoll_fd_, events, MAX_EPOLL_EVENTS, read_poll_ms_);
+    if (n < 0)
+    {
+        if (errno == EINTR)
+        {
+            return 0;
+        }
+        return -1;
+    }
+
+    for (int i = 0; i < n; ++i)
+    {
+        size_t index = static_cast<size_t>(events[i].data.u64);
+        Link & link = *links_[index];
+        if (!link.up)
+        {
+            continue;
+        }
+
+        // Whatever the link still had is taken before it goes.
+        if ((events[i].events & EPOLLIN) != 0)
+        {
+            nmessages += std::max(read_link(link, out_buffer, buffer_len, visitor), ssize_t(0));
+        }
+        if ((events[i].events & (EPOLLERR | EPOLLHUP)) != 0)
+        {
+            link_down(index);
+        }
+    }
+
+    return nmessages;
+}
+
+bool BondedTransporter::fds_OK()
+{
+    return initialized_;
+}
+
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
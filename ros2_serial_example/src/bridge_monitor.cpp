@@ -0,0 +1,306 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ros2_serial_example/bridge_monitor.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace monitor
+{
+
+namespace
+{
+
+// The counters of a topic that count dropped payloads; these are the ones
+// the bridge adds up to decide whether to flag the port.
+const char * const DROP_COUNTERS[] = {
+    "crc_failures", "oversize_drops", "decode_failures", "write_failures", "stale_drops", "timeouts",
+    "deserialize_failures", "sequence_gaps", "sequence_duplicates", "sequence_reorders",
+};
+
+// A UART sends 10 bits for each byte: a start bit, 8 data bits and a stop
+// bit.
+constexpr double BITS_PER_BYTE = 10.0;
+
+// Split a topic key, "<direction>/<topic>/<counter>", into its parts.  The
+// topic may have slashes in it itself.
+bool split_topic_key(const std::string & key, std::string * direction, std::string * topic, std::string * name)
+{
+    if (key.compare(0, 3, "rx/") != 0 && key.compare(0, 3, "tx/") != 0)
+    {
+        return false;
+    }
+    size_t last = key.rfind('/');
+    if (last <= 3)
+    {
+        return false;
+    }
+    *direction = key.substr(0, 2);
+    *topic = key.substr(3, last - 3);
+    *name = key.substr(last + 1);
+
+    return true;
+}
+
+double link_percent(double bytes_per_s, uint32_t baudrate)
+{
+    return baudrate > 0 ? bytes_per_s * BITS_PER_BYTE * 100.0 / baudrate : -1.0;
+}
+
+// Format a rate or share, or "-" if it is unknown.
+std::string format_value(double value, const char *format)
+{
+    if (value < 0.0)
+    {
+        return "-";
+    }
+    char buf[32];
+    ::snprintf(buf, sizeof(buf), format, value);
+    return buf;
+}
+
+}  // namespace
+
+bool BridgeMonitor::update(const std::string & port, int64_t stamp_ns, const Values & values)
+{
+    bool has_topics = false;
+    std::string direction;
+    std::string topic;
+    std::string name;
+    for (const auto & kv : values)
+    {
+        if (split_topic_key(kv.first, &direction, &topic, &name))
+        {
+            has_topics = true;
+            break;
+        }
+    }
+    if (!has_topics)
+    {
+        return false;
+    }
+
+    Report report;
+    report.stamp_ns = stamp_ns;
+    for (const auto & kv : values)
+    {
+        report.values[kv.first] = kv.second;
+    }
+
+    auto it = ports_.find(port);
+    if (it == ports_.end())
+    {
+        ports_[port].latest = std::move(report);
+        return true;
+    }
+
+    PortState & state = it->second;
+    if (stamp_ns < state.latest.stamp_ns)
+    {
+        return true;
+    }
+
+    state.previous = std::move(state.latest);
+    state.latest = std::move(report);
+    state.has_previous = true;
+
+    // A counter that went backwards means the bridge started over.
+    for (const auto & kv : state.latest.values)
+    {
+        if (split_topic_key(kv.first, &direction, &topic, &name) && (name == "messages" || name == "bytes") &&
+            counter(state.latest, kv.first) < counter(state.previous, kv.first))
+        {
+            state.has_previous = false;
+            break;
+        }
+    }
+
+    return true;
+}
+
+uint64_t BridgeMonitor::counter(const Report & report, const std::string & key)
+{
+    auto it = report.values.find(key);
+    if (it == report.values.end())
+    {
+        return 0;
+    }
+
+    return ::strtoull(it->second.c_str(), nullptr, 10);
+}
+
+uint64_t BridgeMonitor::delta(const PortState & state, const std::string & key)
+{
+    if (!state.has_previous)
+    {
+        return 0;
+    }
+
+    // A topic only shows up once something was counted for it, so one that
+    // is missing from the previous report had nothing counted then.
+    uint64_t latest = counter(state.latest, key);
+    uint64_t previous = counter(state.previous, key);
+    return latest > previous ? latest - previous : 0;
+}
+
+double BridgeMonitor::rate(const PortState & state, const std::string & key)
+{
+    int64_t elapsed_ns = state.latest.stamp_ns - state.previous.stamp_ns;
+    if (!state.has_previous || elapsed_ns <= 0)
+    {
+        return 0.0;
+    }
+
+    return static_cast<double>(delta(state, key)) * 1e9 / static_cast<double>(elapsed_ns);
+}
+
+std::vector<BridgeMonitor::TopicRow> BridgeMonitor::topics() const
+{
+    std::vector<TopicRow> rows;
+    std::string direction;
+    std::string topic;
+    std::string name;
+    for (const auto & port : ports_)
+    {
+        const PortState & state = port.second;
+        uint32_t baudrate = static_cast<uint32_t>(counter(state.latest, "baudrate"));
+        for (const auto & kv : state.latest.values)
+        {
+            if (!split_topic_key(kv.first, &direction, &topic, &name) || name != "messages")
+            {
+                continue;
+            }
+
+            std::string prefix = direction + "/" + topic + "/";
+            TopicRow row;
+            row.port = port.first;
+            row.direction = direction;
+            row.topic = topic;
+            row.messages_per_s = rate(state, prefix + "messages");
+            row.bytes_per_s = rate(state, prefix + "bytes");
+            row.link_percent = link_percent(row.bytes_per_s, baudrate);
+            uint64_t crc_failures = delta(state, prefix + "crc_failures");
+            uint64_t frames = crc_failures + delta(state, prefix + "messages");
+            row.crc_error_percent = frames > 0 ? static_cast<double>(crc_failures) * 100.0 / frames : 0.0;
+            for (const char *drop : DROP_COUNTERS)
+            {
+                row.drops_per_s += rate(state, prefix + drop);
+            }
+            auto depth_it = state.latest.values.find(prefix + "queue_depth");
+            if (depth_it != state.latest.values.end())
+            {
+                row.queue_depth = ::strtoll(depth_it->second.c_str(), nullptr, 10);
+            }
+            rows.push_back(row);
+        }
+    }
+
+    std::stable_sort(rows.begin(), rows.end(), [](const TopicRow & a, const TopicRow & b) {
+        return a.bytes_per_s > b.bytes_per_s;
+    });
+
+    return rows;
+}
+
+std::vector<BridgeMonitor::PortRow> BridgeMonitor::ports() const
+{
+    std::vector<PortRow> rows;
+    for (const auto & port : ports_)
+    {
+        const PortState & state = port.second;
+        PortRow row;
+        row.port = port.first;
+        row.baudrate = static_cast<uint32_t>(counter(state.latest, "baudrate"));
+
+        std::string direction;
+        std::string topic;
+        std::string name;
+        for (const auto & kv : state.latest.values)
+        {
+            if (split_topic_key(kv.first, &direction, &topic, &name) && name == "bytes")
+            {
+                (direction == "rx" ? row.rx_bytes_per_s : row.tx_bytes_per_s) += rate(state, kv.first);
+            }
+        }
+        row.tx_link_percent = link_percent(row.tx_bytes_per_s, row.baudrate);
+
+        auto queue_it = state.latest.values.find("write_queue_bytes");
+        if (queue_it != state.latest.values.end())
+        {
+            row.write_queue_bytes = ::strtoll(queue_it->second.c_str(), nullptr, 10);
+        }
+        auto p99_it = state.latest.values.find("latency/write/p99_us");
+        if (p99_it != state.latest.values.end() && counter(state.latest, "latency/write/count") > 0)
+        {
+            row.write_p99_us = ::strtod(p99_it->second.c_str(), nullptr);
+        }
+        row.garbage_bytes_per_s = rate(state, "garbage_bytes");
+        rows.push_back(row);
+    }
+
+    return rows;
+}
+
+std::string BridgeMonitor::render(size_t max_topics) const
+{
+    std::string out;
+    char line[256];
+
+    ::snprintf(line, sizeof(line), "%-24s %12s %12s %8s %9s %10s %10s %10s\n", "PORT", "RX B/s", "TX B/s", "TX LINK%",
+               "BAUD", "WRITE Q", "P99 us", "GARBAGE/s");
+    out += line;
+    for (const PortRow & row : ports())
+    {
+        ::snprintf(line, sizeof(line), "%-24.24s %12.0f %12.0f %8s %9s %10s %10s %10.0f\n", row.port.c_str(),
+                   row.rx_bytes_per_s, row.tx_bytes_per_s, format_value(row.tx_link_percent, "%.1f").c_str(),
+                   row.baudrate > 0 ? std::to_string(row.baudrate).c_str() : "-",
+                   row.write_queue_bytes >= 0 ? std::to_string(row.write_queue_bytes).c_str() : "-",
+                   format_value(row.write_p99_us, "%.1f").c_str(), row.garbage_bytes_per_s);
+        out += line;
+    }
+
+    out += "\n";
+    ::snprintf(line, sizeof(line), "%-24s %-2s %-32s %9s %12s %7s %6s %8s %6s\n", "PORT", "", "TOPIC", "MSG/s", "B/s",
+               "LINK%", "CRC%", "DROPS/s", "QUEUE");
+    out += line;
+    std::vector<TopicRow> rows = topics();
+    if (max_topics > 0 && rows.size() > max_topics)
+    {
+        rows.resize(max_topics);
+    }
+    for (const TopicRow & row : rows)
+    {
+        ::snprintf(line, sizeof(line), "%-24.24s %-2s %-32.32s %9.1f %12.0f %7s %6.2f %8.1f %6s\n", row.port.c_str(),
+                   row.direction.c_str(), row.topic.c_str(), row.messages_per_s, row.bytes_per_s,
+                   format_value(row.link_percent, "%.1f").c_str(), row.crc_error_percent, row.drops_per_s,
+                   row.queue_depth >= 0 ? std::to_string(row.queue_depth).c_str() : "-");
+        out += line;
+    }
+
+    return out;
+}
+
+}  // namespace monitor
+}  // namespace ros2_to_serial_bridge
@@ -0,0 +1,447 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include <linux/can.h>
+#include <linux/can/raw.h>
+#include <net/if.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "ros2_serial_example/async_log.hpp"
+#include "ros2_serial_example/can_transporter.hpp"
+#include "ros2_serial_example/isotp.hpp"
+#include "ros2_serial_example/transporter.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+constexpr size_t CANTransporter::MAX_FRAME_BATCH;
+
+CANTransporter::CANTransporter(const std::string & protocol,
+                               const std::string & interface,
+                               uint32_t tx_base_id,
+                               uint32_t rx_base_id,
+                               bool extended_ids,
+                               uint32_t read_poll_ms,
+                               size_t ring_buffer_size,
+                               size_t frame_batch):
+    Transporter(protocol, ring_buffer_size),
+    interface_(interface),
+    tx_base_id_(tx_base_id),
+    rx_base_id_(rx_base_id),
+    id_mask_(extended_ids ? CAN_EFF_MASK : CAN_SFF_MASK),
+    id_flags_(extended_ids ? CAN_EFF_FLAG : 0),
+    read_poll_ms_(read_poll_ms),
+    max_message_len_(ring_buffer_size),
+    frame_batch_(frame_batch)
+{
+    if (interface_.empty() || interface_.size() >= IFNAMSIZ)
+    {
+        throw std::runtime_error("Invalid CAN interface name '" + interface_ + "'");
+    }
+
+    if (tx_base_id_ > id_mask_ || rx_base_id_ > id_mask_)
+    {
+        throw std::runtime_error("Invalid CAN base ID, must be at most " + std::to_string(id_mask_));
+    }
+
+    if (frame_batch_ == 0 || frame_batch_ > MAX_FRAME_BATCH)
+    {
+        throw std::runtime_error("Invalid CAN frame batch, must be between 1 and " +
+                                 std::to_string(MAX_FRAME_BATCH) + " inclusive");
+    }
+
+    // Each CAN frame gets its own slot; the message headers point at those
+    // slots once and are reused for every recvmmsg() call.
+    recv_frames_.resize(frame_batch_);
+    recv_iovs_.resize(frame_batch_);
+    recv_msgs_.resize(frame_batch_);
+    for (size_t i = 0; i < frame_batch_; ++i)
+    {
+        recv_iovs_[i].iov_base = &recv_frames_[i];
+        recv_iovs_[i].iov_len = sizeof(recv_frames_[i]);
+        recv_msgs_[i].msg_hdr.msg_iov = &recv_iovs_[i];
+        recv_msgs_[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    send_frames_.reserve(frame_batch_);
+    send_iovs_.reserve(frame_batch_);
+    send_msgs_.reserve(frame_batch_);
+
+    datagram_frames_ = true;
+}
+
+CANTransporter::~CANTransporter()
+{
+    close();
+}
+
+int CANTransporter::init()
+{
+    if (fds_OK())
+    {
+        ::fprintf(stderr, "Cannot re-init; call close first\n");
+        return -1;
+    }
+
+    if ((fd_ = ::socket(PF_CAN, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, CAN_RAW)) < 0)
+    {
+        ::fprintf(stderr, "create CAN socket failed: %s\n", ::strerror(errno));
+        return -1;
+    }
+
+    struct ifreq ifr{};
+    ::strncpy(ifr.ifr_name, interface_.c_str(), IFNAMSIZ - 1);
+    if (::ioctl(fd_, SIOCGIFINDEX, &ifr) < 0)
+    {
+        ::fprintf(stderr, "Failed to find CAN interface %s: %s\n", interface_.c_str(), ::strerror(errno));
+        close();
+        return -1;
+    }
+    int ifindex = ifr.ifr_ifindex;
+
+    // An interface that only does classic CAN has a smaller MTU, and would
+    // refuse every frame longer than 8 bytes.
+    if (::ioctl(fd_, SIOCGIFMTU, &ifr) < 0 || ifr.ifr_mtu < static_cast<int>(CANFD_MTU))
+    {
+        ::fprintf(stderr, "CAN interface %s doesn't have CAN-FD enabled\n", interface_.c_str());
+        close();
+        return -1;
+    }
+
+    int enable = 1;
+    if (::setsockopt(fd_, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &enable, sizeof(enable)) < 0)
+    {
+        ::fprintf(stderr, "Failed to enable CAN-FD frames: %s\n", ::strerror(errno));
+        close();
+        return -1;
+    }
+
+    // The kernel filter lets through the smallest aligned block of CAN IDs
+    // that holds all of the received ones; the rest are checked when they
+    // come in.
+    canid_t last_rx_id = rx_base_id_ + get_max_topic_ID();
+    if (last_rx_id > id_mask_)
+    {
+        last_rx_id = id_mask_;
+    }
+    canid_t block_mask = id_mask_;
+    while ((rx_base_id_ & block_mask) != (last_rx_id & block_mask))
+    {
+        block_mask = (block_mask << 1) & id_mask_;
+    }
+    struct can_filter filter{};
+    filter.can_id = (rx_base_id_ & block_mask) | id_flags_;
+    filter.can_mask = block_mask | CAN_EFF_FLAG | CAN_RTR_FLAG;
+    if (::setsockopt(fd_, SOL_CAN_RAW, CAN_RAW_FILTER, &filter, sizeof(filter)) < 0)
+    {
+        ::fprintf(stderr, "Failed to set CAN filter: %s\n", ::strerror(errno));
+        close();
+        return -1;
+    }
+
+    struct sockaddr_can addr{};
+    addr.can_family = AF_CAN;
+    addr.can_ifindex = ifindex;
+    if (::bind(fd_, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0)
+    {
+        ::fprintf(stderr, "bind to CAN interface %s failed: %s\n", interface_.c_str(), ::strerror(errno));
+        close();
+        return -1;
+    }
+
+    poll_fd_[0].fd = fd_;
+    poll_fd_[0].events = POLLIN;
+
+    return 0;
+}
+
+int CANTransporter::close()
+{
+    if (-1 != fd_)
+    {
+        ::close(fd_);
+        fd_ = -1;
+    }
+
+    ::memset(&poll_fd_, 0, sizeof(poll_fd_));
+    reassemblers_.clear();
+
+    return 0;
+}
+
+bool CANTransporter::fds_OK()
+{
+    return -1 != fd_;
+}
+
+int CANTransporter::get_read_fd() const
+{
+    return fd_;
+}
+
+int CANTransporter::get_write_fd() const
+{
+    return fd_;
+}
+
+ssize_t CANTransporter::node_read()
+{
+    // The messages go into the ring buffer for read() to find, as if they
+    // had come in over a byte stream.
+    ssize_t stored = 0;
+    ssize_t ret = node_read_frames([this, &stored](const uint8_t *frame, size_t length) {
+        for (size_t copied = 0; copied < length; )
+        {
+            copied += ringbuf_.write(frame + copied, length - copied);
+        }
+        stored += length;
+    });
+
+    return (ret < 0) ? -1 : stored;
+}
+
+ssize_t CANTransporter::node_read_frames(const FrameVisitor & visitor)
+{
+    if (!fds_OK())
+    {
+        return -1;
+    }
+
+    // See UDPTransporter::node_read_frames() for why this only polls if
+    // nothing was there.
+    int n = ::recvmmsg(fd_, recv_msgs_.data(), recv_msgs_.size(), MSG_DONTWAIT, nullptr);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+        int r = ::poll(reinterpret_cast<struct pollfd *>(poll_fd_), 1, read_poll_ms_);
+        if (r != 1 || (poll_fd_[0].revents & POLLIN) == 0)
+        {
+            return (r < 0) ? -1 : 0;
+        }
+
+        n = ::recvmmsg(fd_, recv_msgs_.data(), recv_msgs_.size(), MSG_DONTWAIT, nullptr);
+    }
+
+    if (n < 0)
+    {
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+
+    size_t nmessages = 0;
+    for (int i = 0; i < n; ++i)
+    {
+        const struct canfd_frame & frame = recv_frames_[i];
+        if ((frame.can_id & (CAN_RTR_FLAG | CAN_ERR_FLAG)) != 0 || (frame.can_id & CAN_EFF_FLAG) != id_flags_)
+        {
+            continue;
+        }
+        canid_t can_id = frame.can_id & id_mask_;
+        if (can_id < rx_base_id_ || can_id - rx_base_id_ > get_max_topic_ID())
+        {
+            continue;
+        }
+
+        // Classic CAN frames come in with the same layout, just shorter.
+        size_t len = (recv_msgs_[i].msg_len == CAN_MTU) ? std::min<size_t>(frame.len, CAN_MAX_DLEN) : frame.len;
+
+        auto it = reassemblers_.find(can_id);
+        if (it == reassemblers_.end())
+        {
+            it = reassemblers_.emplace(can_id, impl::IsoTp::Reassembler(max_message_len_)).first;
+        }
+
+        switch (it->second.push(frame.data, len))
+        {
+        case impl::IsoTp::Reassembler::Result::COMPLETE:
+            visitor(it->second.message(), it->second.message_length());
+            nmessages++;
+            break;
+
+        case impl::IsoTp::Reassembler::Result::FIRST_FRAME:
+            send_flow_control(can_id, impl::IsoTp::FlowStatus::CONTINUE);
+            break;
+
+        case impl::IsoTp::Reassembler::Result::OVERFLOW:
+            ROS2_SERIAL_LOG(WARN, "Dropping CAN message on ID 0x%x larger than %zu bytes", can_id,
+                            max_message_len_);
+            send_flow_control(can_id, impl::IsoTp::FlowStatus::OVERFLOW);
+            break;
+
+        case impl::IsoTp::Reassembler::Result::PENDING:
+        case impl::IsoTp::Reassembler::Result::IGNORED:
+        case impl::IsoTp::Reassembler::Result::ERROR:
+            break;
+        }
+    }
+
+    return nmessages;
+}
+
+void CANTransporter::send_flow_control(canid_t rx_id, impl::IsoTp::FlowStatus status)
+{
+    // The flow control goes back on the CAN ID that this side sends the same
+    // topic ID with.  This is called from the read thread, so it doesn't use
+    // the buffers the writes use; if it can't be sent, a sender that waits
+    // for it times out and drops the message, which is all that can be done.
+    canid_t tx_id = tx_base_id_ + (rx_id - rx_base_id_);
+    if (tx_id > id_mask_)
+    {
+        return;
+    }
+
+    struct canfd_frame frame;
+    impl::IsoTp::flow_control(status, tx_id | id_flags_, &frame);
+    if (::write(fd_, &frame, CANFD_MTU) < 0)
+    {
+        ROS2_SERIAL_LOG(WARN, "Failed to send CAN flow control: %s", ::strerror(errno));
+    }
+}
+
+int CANTransporter::segment(const uint8_t *data, size_t len, topic_id_size_t topic_ID)
+{
+    if (static_cast<uint64_t>(tx_base_id_) + topic_ID > id_mask_)
+    {
+        errno = ERANGE;
+        return -1;
+    }
+    if (len > std::numeric_limits<uint32_t>::max())
+    {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    size_t start = send_frames_.size();
+    send_frames_.resize(start + impl::IsoTp::frame_count(len));
+    impl::IsoTp::segment(data, len, (tx_base_id_ + topic_ID) | id_flags_, &send_frames_[start]);
+
+    return 0;
+}
+
+ssize_t CANTransporter::node_write(void *buffer, size_t len)
+{
+    if (nullptr == buffer || !fds_OK())
+    {
+        return -1;
+    }
+
+    send_frames_.clear();
+    if (segment(static_cast<const uint8_t *>(buffer), len, write_topic_ID_) < 0 || send_frames() < 0)
+    {
+        return -1;
+    }
+
+    return len;
+}
+
+ssize_t CANTransporter::node_write_frames(const struct iovec *frames, const topic_id_size_t *topic_IDs, size_t count)
+{
+    if (nullptr == frames || nullptr == topic_IDs || !fds_OK())
+    {
+        return -1;
+    }
+
+    size_t len = 0;
+    send_frames_.clear();
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (segment(static_cast<const uint8_t *>(frames[i].iov_base), frames[i].iov_len, topic_IDs[i]) < 0)
+        {
+            return -1;
+        }
+        len += frames[i].iov_len;
+    }
+
+    return (send_frames() < 0) ? -1 : len;
+}
+
+ssize_t CANTransporter::send_frames()
+{
+    // The message headers are only pointed at the frames now, since the
+    // frames may have moved while they were being added.
+    size_t total = send_frames_.size();
+    send_iovs_.resize(total);
+    send_msgs_.resize(total);
+    for (size_t i = 0; i < total; ++i)
+    {
+        send_iovs_[i].iov_base = &send_frames_[i];
+        send_iovs_[i].iov_len = CANFD_MTU;
+        send_msgs_[i] = {};
+        send_msgs_[i].msg_hdr.msg_iov = &send_iovs_[i];
+        send_msgs_[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    std::chrono::steady_clock::time_point deadline = write_deadline();
+    size_t sent = 0;
+    while (sent < total)
+    {
+        size_t nmsgs = std::min(total - sent, frame_batch_);
+        int ret = ::sendmmsg(fd_, &send_msgs_[sent], nmsgs, 0);
+        if (ret == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            if (errno == EAGAIN && wait_writable(fd_, deadline) == 0)
+            {
+                continue;
+            }
+
+            // A full transmit queue in the CAN driver shows up as ENOBUFS,
+            // and the socket still polls as writable, so back off briefly
+            // instead; the frames go out at the bus rate.
+            if (errno == ENOBUFS && std::chrono::steady_clock::now() < deadline)
+            {
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+                continue;
+            }
+
+            if (sent > 0)
+            {
+                partial_writes_++;
+            }
+            if (errno == ENOBUFS)
+            {
+                errno = EBUSY;
+            }
+            return -1;
+        }
+
+        sent += ret;
+    }
+
+    return sent;
+}
+
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
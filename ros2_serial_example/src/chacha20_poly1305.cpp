@@ -0,0 +1,467 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <sys/uio.h>
+
+#include "ros2_serial_example/chacha20_poly1305.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+namespace impl
+{
+
+constexpr size_t ChaCha20Poly1305::KEY_LEN;
+constexpr size_t ChaCha20Poly1305::NONCE_LEN;
+constexpr size_t ChaCha20Poly1305::TAG_LEN;
+
+constexpr size_t CHACHA20_BLOCK_LEN = 64;
+constexpr size_t POLY1305_BLOCK_LEN = 16;
+
+static uint32_t get_le32(const uint8_t *buf)
+{
+    return static_cast<uint32_t>(buf[0]) | (static_cast<uint32_t>(buf[1]) << 8U) |
+           (static_cast<uint32_t>(buf[2]) << 16U) | (static_cast<uint32_t>(buf[3]) << 24U);
+}
+
+static void put_le32(uint8_t *buf, uint32_t val)
+{
+    buf[0] = static_cast<uint8_t>(val);
+    buf[1] = static_cast<uint8_t>(val >> 8U);
+    buf[2] = static_cast<uint8_t>(val >> 16U);
+    buf[3] = static_cast<uint8_t>(val >> 24U);
+}
+
+static void put_le64(uint8_t *buf, uint64_t val)
+{
+    put_le32(buf, static_cast<uint32_t>(val));
+    put_le32(buf + 4, static_cast<uint32_t>(val >> 32U));
+}
+
+static inline uint32_t rotl32(uint32_t x, unsigned int n)
+{
+    return (x << n) | (x >> (32U - n));
+}
+
+#define CHACHA20_QUARTER_ROUND(a, b, c, d) \
+    a += b; d = rotl32(d ^ a, 16); \
+    c += d; b = rotl32(b ^ c, 12); \
+    a += b; d = rotl32(d ^ a, 8); \
+    c += d; b = rotl32(b ^ c, 7)
+
+// The ChaCha20 keystream, one 64-byte block at a time.
+class ChaCha20Stream final
+{
+public:
+    ChaCha20Stream(const std::array<uint32_t, 8> & key, const uint8_t *nonce, uint32_t counter)
+    {
+        // "expand 32-byte k"
+        state_[0] = 0x61707865;
+        state_[1] = 0x3320646e;
+        state_[2] = 0x79622d32;
+        state_[3] = 0x6b206574;
+        for (size_t i = 0; i < 8; ++i)
+        {
+            state_[4 + i] = key[i];
+        }
+        state_[12] = counter;
+        state_[13] = get_le32(nonce);
+        state_[14] = get_le32(nonce + 4);
+        state_[15] = get_le32(nonce + 8);
+    }
+
+    ~ChaCha20Stream()
+    {
+        wipe(&state_[0], sizeof(state_));
+        wipe(&block_[0], sizeof(block_));
+    }
+
+    // XOR len bytes of keystream into in, writing the result to out (which
+    // may be in).  The keystream carries on from one call to the next.
+    void apply(const uint8_t *in, uint8_t *out, size_t len)
+    {
+        while (len > 0 && used_ < CHACHA20_BLOCK_LEN)
+        {
+            *out++ = *in++ ^ block_[used_++];
+            len--;
+        }
+
+        while (len >= CHACHA20_BLOCK_LEN)
+        {
+            next_block();
+            for (size_t i = 0; i < CHACHA20_BLOCK_LEN; i += 4)
+            {
+                put_le32(out + i, get_le32(in + i) ^ get_le32(&block_[i]));
+            }
+            in += CHACHA20_BLOCK_LEN;
+            out += CHACHA20_BLOCK_LEN;
+            len -= CHACHA20_BLOCK_LEN;
+        }
+
+        if (len > 0)
+        {
+            next_block();
+            for (size_t i = 0; i < len; ++i)
+            {
+                out[i] = in[i] ^ block_[i];
+            }
+            used_ = len;
+        }
+    }
+
+    // Get the next block of keystream in full.
+    const uint8_t *next_block()
+    {
+        uint32_t x[16];
+        ::memcpy(&x[0], &state_[0], sizeof(x));
+        for (int i = 0; i < 10; ++i)
+        {
+            CHACHA20_QUARTER_ROUND(x[0], x[4], x[8], x[12]);
+            CHACHA20_QUARTER_ROUND(x[1], x[5], x[9], x[13]);
+            CHACHA20_QUARTER_ROUND(x[2], x[6], x[10], x[14]);
+            CHACHA20_QUARTER_ROUND(x[3], x[7], x[11], x[15]);
+            CHACHA20_QUARTER_ROUND(x[0], x[5], x[10], x[15]);
+            CHACHA20_QUARTER_ROUND(x[1], x[6], x[11], x[12]);
+            CHACHA20_QUARTER_ROUND(x[2], x[7], x[8], x[13]);
+            CHACHA20_QUARTER_ROUND(x[3], x[4], x[9], x[14]);
+        }
+        for (size_t i = 0; i < 16; ++i)
+        {
+            put_le32(&block_[4 * i], x[i] + state_[i]);
+        }
+        wipe(&x[0], sizeof(x));
+        state_[12]++;
+        used_ = CHACHA20_BLOCK_LEN;
+
+        return &block_[0];
+    }
+
+    static void wipe(void *buf, size_t len)
+    {
+        volatile uint8_t *p = static_cast<volatile uint8_t *>(buf);
+        while (len-- > 0)
+        {
+            *p++ = 0;
+        }
+    }
+
+private:
+    uint32_t state_[16];
+    uint8_t block_[CHACHA20_BLOCK_LEN]{};
+    size_t used_{CHACHA20_BLOCK_LEN};
+};
+
+#undef CHACHA20_QUARTER_ROUND
+
+// Poly1305 with the accumulator and r in five 26-bit limbs, so that the
+// products fit in 64 bits without needing 128-bit arithmetic.
+class Poly1305 final
+{
+public:
+    explicit Poly1305(const uint8_t *key)
+    {
+        // r is clamped as the RFC requires.
+        r_[0] = get_le32(key) & 0x3ffffff;
+        r_[1] = (get_le32(key + 3) >> 2U) & 0x3ffff03;
+        r_[2] = (get_le32(key + 6) >> 4U) & 0x3ffc0ff;
+        r_[3] = (get_le32(key + 9) >> 6U) & 0x3f03fff;
+        r_[4] = (get_le32(key + 12) >> 8U) & 0x00fffff;
+        for (size_t i = 0; i < 4; ++i)
+        {
+            pad_[i] = get_le32(key + 16 + 4 * i);
+        }
+    }
+
+    ~Poly1305()
+    {
+        ChaCha20Stream::wipe(&r_[0], sizeof(r_));
+        ChaCha20Stream::wipe(&pad_[0], sizeof(pad_));
+        ChaCha20Stream::wipe(&buf_[0], sizeof(buf_));
+    }
+
+    void update(const uint8_t *data, size_t len)
+    {
+        if (buf_len_ > 0)
+        {
+            size_t n = std::min(len, POLY1305_BLOCK_LEN - buf_len_);
+            ::memcpy(&buf_[buf_len_], data, n);
+            buf_len_ += n;
+            data += n;
+            len -= n;
+            if (buf_len_ < POLY1305_BLOCK_LEN)
+            {
+                return;
+            }
+            block(&buf_[0], 1U << 24U);
+            buf_len_ = 0;
+        }
+
+        while (len >= POLY1305_BLOCK_LEN)
+        {
+            block(data, 1U << 24U);
+            data += POLY1305_BLOCK_LEN;
+            len -= POLY1305_BLOCK_LEN;
+        }
+
+        if (len > 0)
+        {
+            ::memcpy(&buf_[0], data, len);
+            buf_len_ = len;
+        }
+    }
+
+    // The AEAD pads the associated data and the ciphertext with zeros to a
+    // whole block each.
+    void pad()
+    {
+        if (buf_len_ > 0)
+        {
+            ::memset(&buf_[buf_len_], 0, POLY1305_BLOCK_LEN - buf_len_);
+            block(&buf_[0], 1U << 24U);
+            buf_len_ = 0;
+        }
+    }
+
+    void finish(uint8_t *tag)
+    {
+        if (buf_len_ > 0)
+        {
+            // A short last block has a 1 after it instead of the 2^128 bit.
+            buf_[buf_len_] = 1;
+            ::memset(&buf_[buf_len_ + 1], 0, POLY1305_BLOCK_LEN - buf_len_ - 1);
+            block(&buf_[0], 0);
+            buf_len_ = 0;
+        }
+
+        uint32_t h0 = h_[0];
+        uint32_t h1 = h_[1];
+        uint32_t h2 = h_[2];
+        uint32_t h3 = h_[3];
+        uint32_t h4 = h_[4];
+
+        // Carry all the way through.
+        uint32_t c = h1 >> 26U;
+        h1 &= 0x3ffffff;
+        h2 += c;
+        c = h2 >> 26U;
+        h2 &= 0x3ffffff;
+        h3 += c;
+        c = h3 >> 26U;
+        h3 &= 0x3ffffff;
+        h4 += c;
+        c = h4 >> 26U;
+        h4 &= 0x3ffffff;
+        h0 += c * 5;
+        c = h0 >> 26U;
+        h0 &= 0x3ffffff;
+        h1 += c;
+
+        // Work out h - p, and take it instead of h if it isn't negative,
+        // without branching on it.
+        uint32_t g0 = h0 + 5;
+        c = g0 >> 26U;
+        g0 &= 0x3ffffff;
+        uint32_t g1 = h1 + c;
+        c = g1 >> 26U;
+        g1 &= 0x3ffffff;
+        uint32_t g2 = h2 + c;
+        c = g2 >> 26U;
+        g2 &= 0x3ffffff;
+        uint32_t g3 = h3 + c;
+        c = g3 >> 26U;
+        g3 &= 0x3ffffff;
+        uint32_t g4 = h4 + c - (1U << 26U);
+
+        uint32_t mask = (g4 >> 31U) - 1U;
+        h0 = (h0 & ~mask) | (g0 & mask);
+        h1 = (h1 & ~mask) | (g1 & mask);
+        h2 = (h2 & ~mask) | (g2 & mask);
+        h3 = (h3 & ~mask) | (g3 & mask);
+        h4 = (h4 & ~mask) | (g4 & mask);
+
+        // Back to 32-bit words, and add the pad.
+        uint32_t w0 = h0 | (h1 << 26U);
+        uint32_t w1 = (h1 >> 6U) | (h2 << 20U);
+        uint32_t w2 = (h2 >> 12U) | (h3 << 14U);
+        uint32_t w3 = (h3 >> 18U) | (h4 << 8U);
+
+        uint64_t f = static_cast<uint64_t>(w0) + pad_[0];
+        put_le32(tag, static_cast<uint32_t>(f));
+        f = static_cast<uint64_t>(w1) + pad_[1] + (f >> 32U);
+        put_le32(tag + 4, static_cast<uint32_t>(f));
+        f = static_cast<uint64_t>(w2) + pad_[2] + (f >> 32U);
+        put_le32(tag + 8, static_cast<uint32_t>(f));
+        f = static_cast<uint64_t>(w3) + pad_[3] + (f >> 32U);
+        put_le32(tag + 12, static_cast<uint32_t>(f));
+    }
+
+private:
+    // h = (h + block) * r mod 2^130 - 5, where hibit is the bit above the
+    // 128 bits of the block.
+    void block(const uint8_t *m, uint32_t hibit)
+    {
+        const uint32_t r0 = r_[0];
+        const uint32_t r1 = r_[1];
+        const uint32_t r2 = r_[2];
+        const uint32_t r3 = r_[3];
+        const uint32_t r4 = r_[4];
+        const uint32_t s1 = r1 * 5;
+        const uint32_t s2 = r2 * 5;
+        const uint32_t s3 = r3 * 5;
+        const uint32_t s4 = r4 * 5;
+
+        uint32_t h0 = h_[0] + (get_le32(m) & 0x3ffffff);
+        uint32_t h1 = h_[1] + ((get_le32(m + 3) >> 2U) & 0x3ffffff);
+        uint32_t h2 = h_[2] + ((get_le32(m + 6) >> 4U) & 0x3ffffff);
+        uint32_t h3 = h_[3] + ((get_le32(m + 9) >> 6U) & 0x3ffffff);
+        uint32_t h4 = h_[4] + ((get_le32(m + 12) >> 8U) | hibit);
+
+        uint64_t d0 = static_cast<uint64_t>(h0) * r0 + static_cast<uint64_t>(h1) * s4 +
+                      static_cast<uint64_t>(h2) * s3 + static_cast<uint64_t>(h3) * s2 +
+                      static_cast<uint64_t>(h4) * s1;
+        uint64_t d1 = static_cast<uint64_t>(h0) * r1 + static_cast<uint64_t>(h1) * r0 +
+                      static_cast<uint64_t>(h2) * s4 + static_cast<uint64_t>(h3) * s3 +
+                      static_cast<uint64_t>(h4) * s2;
+        uint64_t d2 = static_cast<uint64_t>(h0) * r2 + static_cast<uint64_t>(h1) * r1 +
+                      static_cast<uint64_t>(h2) * r0 + static_cast<uint64_t>(h3) * s4 +
+                      static_cast<uint64_t>(h4) * s3;
+        uint64_t d3 = static_cast<uint64_t>(h0) * r3 + static_cast<uint64_t>(h1) * r2 +
+                      static_cast<uint64_t>(h2) * r1 + static_cast<uint64_t>(h3) * r0 +
+                      static_cast<uint64_t>(h4) * s4;
+        uint64_t d4 = static_cast<uint64_t>(h0) * r4 + static_cast<uint64_t>(h1) * r3 +
+                      static_cast<uint64_t>(h2) * r2 + static_cast<uint64_t>(h3) * r1 +
+                      static_cast<uint64_t>(h4) * r0;
+
+        uint32_t c = static_cast<uint32_t>(d0 >> 26U);
+        h0 = static_cast<uint32_t>(d0) & 0x3ffffff;
+        d1 += c;
+        c = static_cast<uint32_t>(d1 >> 26U);
+        h1 = static_cast<uint32_t>(d1) & 0x3ffffff;
+        d2 += c;
+        c = static_cast<uint32_t>(d2 >> 26U);
+        h2 = static_cast<uint32_t>(d2) & 0x3ffffff;
+        d3 += c;
+        c = static_cast<uint32_t>(d3 >> 26U);
+        h3 = static_cast<uint32_t>(d3) & 0x3ffffff;
+        d4 += c;
+        c = static_cast<uint32_t>(d4 >> 26U);
+        h4 = static_cast<uint32_t>(d4) & 0x3ffffff;
+        h0 += c * 5;
+        c = h0 >> 26U;
+        h0 &= 0x3ffffff;
+        h1 += c;
+
+        h_[0] = h0;
+        h_[1] = h1;
+        h_[2] = h2;
+        h_[3] = h3;
+        h_[4] = h4;
+    }
+
+    uint32_t r_[5];
+    uint32_t pad_[4];
+    uint32_t h_[5]{};
+    uint8_t buf_[POLY1305_BLOCK_LEN]{};
+    size_t buf_len_{0};
+};
+
+// The MAC ends with the lengths of the associated data and the ciphertext.
+static void aead_finish(Poly1305 *mac, size_t aad_len, size_t len, uint8_t *tag)
+{
+    mac->pad();
+    uint8_t lengths[16];
+    put_le64(&lengths[0], aad_len);
+    put_le64(&lengths[8], len);
+    mac->update(&lengths[0], sizeof(lengths));
+    mac->finish(tag);
+}
+
+ChaCha20Poly1305::ChaCha20Poly1305(const uint8_t *key)
+{
+    for (size_t i = 0; i < key_.size(); ++i)
+    {
+        key_[i] = get_le32(key + 4 * i);
+    }
+}
+
+ChaCha20Poly1305::~ChaCha20Poly1305()
+{
+    ChaCha20Stream::wipe(key_.data(), sizeof(key_));
+}
+
+void ChaCha20Poly1305::seal(const uint8_t *nonce, const uint8_t *aad, size_t aad_len, const struct iovec *iov,
+                            int iovcnt, uint8_t *out, uint8_t *tag) const
+{
+    // The Poly1305 key is the start of keystream block 0, and the data is
+    // encrypted from block 1 on.
+    ChaCha20Stream stream(key_, nonce, 0);
+    Poly1305 mac(stream.next_block());
+    mac.update(aad, aad_len);
+    mac.pad();
+
+    size_t len = 0;
+    for (int i = 0; i < iovcnt; ++i)
+    {
+        stream.apply(static_cast<const uint8_t *>(iov[i].iov_base), out + len, iov[i].iov_len);
+        mac.update(out + len, iov[i].iov_len);
+        len += iov[i].iov_len;
+    }
+
+    aead_finish(&mac, aad_len, len, tag);
+}
+
+bool ChaCha20Poly1305::open(const uint8_t *nonce, const uint8_t *aad, size_t aad_len, const uint8_t *in,
+                            size_t len, uint8_t *out, const uint8_t *tag) const
+{
+    // The Poly1305 key is the start of keystream block 0, and the data is
+    // encrypted from block 1 on.
+    ChaCha20Stream stream(key_, nonce, 0);
+    Poly1305 mac(stream.next_block());
+    mac.update(aad, aad_len);
+    mac.pad();
+    mac.update(in, len);
+
+    uint8_t expected[TAG_LEN];
+    aead_finish(&mac, aad_len, len, &expected[0]);
+
+    // The tags are compared without stopping at the first difference, so
+    // the time taken gives nothing away about how much of a forgery was
+    // right.
+    uint8_t diff = 0;
+    for (size_t i = 0; i < TAG_LEN; ++i)
+    {
+        diff |= expected[i] ^ tag[i];
+    }
+    if (diff != 0)
+    {
+        return false;
+    }
+
+    stream.apply(in, out, len);
+
+    return true;
+}
+
+}  // namespace impl
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
@@ -0,0 +1,406 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__x86_64__)
+#include <emmintrin.h>
+#include <immintrin.h>
+#define ROS2_SERIAL_EXAMPLE_HAVE_COBS_SIMD 1
+#elif defined(__aarch64__)
+// NEON is part of the aarch64 baseline, so there is nothing to detect.
+#include <arm_neon.h>
+#define ROS2_SERIAL_EXAMPLE_HAVE_COBS_SIMD 1
+#endif
+
+#include "ros2_serial_example/cobs.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+namespace impl
+{
+
+// The longest run of non-zero bytes in one COBS block.
+constexpr size_t COBS_MAX_RUN = 0xFE;
+
+constexpr size_t COBSEncoder::ZPE_MAX_RUN;
+constexpr size_t COBSEncoder::ZPE_MAX_PAIR_RUN;
+constexpr uint8_t COBSEncoder::ZPE_RUN_CODE;
+constexpr uint8_t COBSEncoder::ZPE_PAIR_CODE;
+
+// Each of these returns the offset of the first 0 in the len bytes at data,
+// or len if there isn't one.
+
+static size_t cobs_find_zero_bytewise(const uint8_t *data, size_t len)
+{
+    size_t i = 0;
+    while (i < len && data[i] != 0)
+    {
+        i++;
+    }
+
+    return i;
+}
+
+static size_t cobs_find_zero_word(const uint8_t *data, size_t len)
+{
+    constexpr uint64_t ONES = 0x0101010101010101ULL;
+    constexpr uint64_t HIGHS = 0x8080808080808080ULL;
+
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t))
+    {
+        uint64_t word;
+        ::memcpy(&word, data + i, sizeof(word));
+        // The high bit of each byte that is 0 is set (and maybe of bytes
+        // above a 0, but never below the first one).
+        uint64_t zeros = (word - ONES) & ~word & HIGHS;
+        if (zeros != 0)
+        {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+            return i + (__builtin_clzll(zeros) >> 3U);
+#else
+            return i + (__builtin_ctzll(zeros) >> 3U);
+#endif
+        }
+    }
+
+    return i + cobs_find_zero_bytewise(data + i, len - i);
+}
+
+#if defined(__x86_64__)
+// This is inlined into the AVX2 kernel as well, for searches shorter than
+// 32 bytes, where the compiler VEX encodes it so there is no switch back to
+// SSE code.
+static inline __attribute__((always_inline)) size_t cobs_find_zero_16(const uint8_t *data, size_t len)
+{
+    const __m128i zero = _mm_setzero_si128();
+
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        unsigned int mask = static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)));
+        if (mask != 0)
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+
+    if (i == len)
+    {
+        return len;
+    }
+    if (i == 0)
+    {
+        return cobs_find_zero_word(data, len);
+    }
+
+    // The last 16 bytes, overlapping ones already known to be non-zero.
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + len - 16));
+    unsigned int mask = static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)));
+
+    return mask != 0 ? len - 16 + __builtin_ctz(mask) : len;
+}
+
+static size_t cobs_find_zero_sse2(const uint8_t *data, size_t len)
+{
+    return cobs_find_zero_16(data, len);
+}
+
+__attribute__((target("avx2")))
+static size_t cobs_find_zero_avx2(const uint8_t *data, size_t len)
+{
+    const __m256i zero = _mm256_setzero_si256();
+
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+        unsigned int mask = static_cast<unsigned int>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, zero)));
+        if (mask != 0)
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+
+    if (i == len)
+    {
+        return len;
+    }
+    if (i > 0)
+    {
+        // The last 32 bytes, overlapping ones already known to be non-zero.
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + len - 32));
+        unsigned int mask = static_cast<unsigned int>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, zero)));
+        return mask != 0 ? len - 32 + __builtin_ctz(mask) : len;
+    }
+
+    // The short search may call out to code that isn't VEX encoded.
+    _mm256_zeroupper();
+    return cobs_find_zero_16(data, len);
+}
+
+static bool cobs_avx2_supported()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+#elif defined(__aarch64__)
+// Narrowing each 16 bit lane of the comparison by 4 leaves a nibble per
+// byte, all ones for a 0 and all zeros otherwise.
+static inline uint64_t cobs_zero_mask_neon(const uint8_t *data)
+{
+    uint8x16_t eq = vceqzq_u8(vld1q_u8(data));
+
+    return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+}
+
+static size_t cobs_find_zero_neon(const uint8_t *data, size_t len)
+{
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16)
+    {
+        uint64_t mask = cobs_zero_mask_neon(data + i);
+        if (mask != 0)
+        {
+            return i + (__builtin_ctzll(mask) >> 2U);
+        }
+    }
+
+    if (i == len)
+    {
+        return len;
+    }
+    if (i > 0)
+    {
+        // The last 16 bytes, overlapping ones already known to be non-zero.
+        uint64_t mask = cobs_zero_mask_neon(data + len - 16);
+        return mask != 0 ? len - 16 + (__builtin_ctzll(mask) >> 2U) : len;
+    }
+
+    return cobs_find_zero_word(data, len);
+}
+#endif
+
+COBSEncoder::COBSEncoder() : COBSEncoder(engine_supported(Engine::SIMD) ? Engine::SIMD : Engine::WORD)
+{
+}
+
+COBSEncoder::COBSEncoder(Engine engine) : engine_(engine), find_zero_fn_(cobs_find_zero_bytewise)
+{
+    if (!engine_supported(engine))
+    {
+        throw std::runtime_error("COBS engine not supported on this CPU");
+    }
+
+    switch (engine)
+    {
+    case Engine::BYTEWISE:
+        find_zero_fn_ = cobs_find_zero_bytewise;
+        break;
+    case Engine::WORD:
+        find_zero_fn_ = cobs_find_zero_word;
+        break;
+    case Engine::SIMD:
+#if defined(__x86_64__)
+        find_zero_fn_ = cobs_avx2_supported() ? cobs_find_zero_avx2 : cobs_find_zero_sse2;
+#elif defined(__aarch64__)
+        find_zero_fn_ = cobs_find_zero_neon;
+#endif
+        break;
+    }
+}
+
+bool COBSEncoder::engine_supported(Engine engine)
+{
+    switch (engine)
+    {
+    case Engine::BYTEWISE:
+    case Engine::WORD:
+        return true;
+    case Engine::SIMD:
+#if defined(ROS2_SERIAL_EXAMPLE_HAVE_COBS_SIMD)
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    return false;
+}
+
+void COBSEncoder::stuff(State *state, const uint8_t *input, size_t length, uint8_t *output) const
+{
+    size_t read_index = 0;
+    size_t write_index = state->write_index;
+    size_t code_index = state->code_index;
+    uint8_t code = state->code;
+
+    if (engine_ == Engine::BYTEWISE)
+    {
+        while (read_index < length)
+        {
+            if (input[read_index] == 0)
+            {
+                output[code_index] = code;
+                code = 1;
+                code_index = write_index++;
+                read_index++;
+            }
+            else
+            {
+                output[write_index++] = input[read_index++];
+                code++;
+                if (code == 0xFF)
+                {
+                    output[code_index] = code;
+                    code = 1;
+                    code_index = write_index++;
+                }
+            }
+        }
+    }
+    else
+    {
+        // Each run of non-zero bytes, up to the end of the block, is found
+        // with the engine and copied in one go.
+        while (read_index < length)
+        {
+            size_t room = std::min(COBS_MAX_RUN + 1 - code, length - read_index);
+            size_t run = find_zero_fn_(input + read_index, room);
+            ::memcpy(output + write_index, input + read_index, run);
+            write_index += run;
+            read_index += run;
+            code = static_cast<uint8_t>(code + run);
+
+            if (code == 0xFF)
+            {
+                // The block is full.
+                output[code_index] = code;
+                code = 1;
+                code_index = write_index++;
+            }
+            else if (read_index < length)
+            {
+                // The run ended at a 0.
+                output[code_index] = code;
+                code = 1;
+                code_index = write_index++;
+                read_index++;
+            }
+        }
+    }
+
+    state->write_index = write_index;
+    state->code_index = code_index;
+    state->code = code;
+}
+
+void COBSEncoder::stuff_zpe(State *state, const uint8_t *input, size_t length, uint8_t *output) const
+{
+    size_t read_index = 0;
+    size_t write_index = state->write_index;
+    size_t code_index = state->code_index;
+    uint8_t code = state->code;
+    bool pending_zero = state->pending_zero;
+
+    while (read_index < length)
+    {
+        if (pending_zero)
+        {
+            // The block ended in a 0; a second one straight after it goes
+            // into the same block if the block is short enough.
+            pending_zero = false;
+            if (input[read_index] == 0 && code - 1U <= ZPE_MAX_PAIR_RUN)
+            {
+                output[code_index] = static_cast<uint8_t>(ZPE_PAIR_CODE + code - 1);
+                read_index++;
+            }
+            else
+            {
+                output[code_index] = code;
+            }
+            code = 1;
+            code_index = write_index++;
+            continue;
+        }
+
+        size_t room = std::min(ZPE_MAX_RUN + 1 - code, length - read_index);
+        size_t run = find_zero_fn_(input + read_index, room);
+        ::memcpy(output + write_index, input + read_index, run);
+        write_index += run;
+        read_index += run;
+        code = static_cast<uint8_t>(code + run);
+
+        if (code == ZPE_MAX_RUN + 1)
+        {
+            // The block is full.
+            output[code_index] = ZPE_RUN_CODE;
+            code = 1;
+            code_index = write_index++;
+        }
+        else if (read_index < length)
+        {
+            // The run ended at a 0.
+            pending_zero = true;
+            read_index++;
+        }
+    }
+
+    state->write_index = write_index;
+    state->code_index = code_index;
+    state->code = code;
+    state->pending_zero = pending_zero;
+}
+
+size_t COBSEncoder::finish_zpe(const State *state, uint8_t *output)
+{
+    size_t write_index = state->write_index;
+    size_t code_index = state->code_index;
+
+    // The 0 that ends the frame follows the last block, so if the data
+    // ended in a 0 the two of them make a pair, or else a block of their
+    // own.
+    if (state->pending_zero)
+    {
+        if (state->code - 1U <= ZPE_MAX_PAIR_RUN)
+        {
+            output[code_index] = static_cast<uint8_t>(ZPE_PAIR_CODE + state->code - 1);
+            return write_index;
+        }
+        output[code_index] = state->code;
+        code_index = write_index++;
+        output[code_index] = 1;
+        return write_index;
+    }
+
+    output[code_index] = state->code;
+
+    return write_index;
+}
+
+}  // namespace impl
+
+}  // namespace transport
+
+}  // namespace ros2_to_serial_bridge
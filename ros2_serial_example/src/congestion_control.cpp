@@ -0,0 +1,137 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+
+#include "ros2_serial_example/congestion_control.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+// The rate is measured over windows at least this long, so that the few
+// bytes a slow link sends between two samples don't make it jumpy.
+static constexpr std::chrono::milliseconds RATE_WINDOW(10);
+
+CongestionControl::CongestionControl(std::chrono::microseconds target, std::chrono::microseconds interval,
+                                     size_t levels)
+    : target_(target), interval_(interval), levels_(levels)
+{
+    if (target.count() <= 0 || interval.count() <= 0)
+    {
+        throw std::runtime_error("Congestion control target and interval must be > 0");
+    }
+    if (levels == 0)
+    {
+        throw std::runtime_error("Congestion control needs at least one priority class");
+    }
+}
+
+void CongestionControl::sample(std::chrono::steady_clock::time_point now, ssize_t queued_bytes,
+                               uint64_t written_bytes, int64_t rtt_us)
+{
+    // The rate only shows while there is a backlog; an idle link sends
+    // slower than it can.
+    if (queued_bytes <= 0)
+    {
+        have_window_ = false;
+    }
+    else if (!have_window_)
+    {
+        have_window_ = true;
+        window_at_ = now;
+        window_queued_ = queued_bytes;
+        window_written_ = written_bytes;
+    }
+    else if (now - window_at_ >= RATE_WINDOW)
+    {
+        int64_t drained = window_queued_ + static_cast<int64_t>(written_bytes - window_written_) - queued_bytes;
+        double seconds = std::chrono::duration<double>(now - window_at_).count();
+        double rate = std::max<int64_t>(drained, 0) / seconds;
+        rate_Bps_ = rate_Bps_ == 0.0 ? rate : rate_Bps_ + (rate - rate_Bps_) / 8.0;
+        rate_.store(static_cast<uint64_t>(rate_Bps_), std::memory_order_relaxed);
+        window_at_ = now;
+        window_queued_ = queued_bytes;
+        window_written_ = written_bytes;
+    }
+
+    int64_t queue_delay_us = 0;
+    if (queued_bytes > 0 && rate_Bps_ > 0.0)
+    {
+        queue_delay_us = static_cast<int64_t>(queued_bytes * 1e6 / rate_Bps_);
+    }
+
+    if (rtt_us >= 0 && rtt_us != last_rtt_us_)
+    {
+        last_rtt_us_ = rtt_us;
+        if (min_rtt_us_ < 0 || rtt_us < min_rtt_us_)
+        {
+            min_rtt_us_ = rtt_us;
+        }
+        rtt_delay_us_ = rtt_us - min_rtt_us_;
+        rtt_at_ = now;
+    }
+    else if (rtt_delay_us_ > 0 && now - rtt_at_ >= interval_)
+    {
+        rtt_delay_us_ = 0;
+    }
+
+    int64_t delay_us = std::max(queue_delay_us, rtt_delay_us_);
+    delay_us_.store(delay_us, std::memory_order_relaxed);
+
+    size_t shed = shed_levels_.load(std::memory_order_relaxed);
+    if (std::chrono::microseconds(delay_us) > target_)
+    {
+        if (!above_)
+        {
+            above_ = true;
+            next_change_ = now + interval_;
+        }
+        else if (now >= next_change_)
+        {
+            if (shed + 1 < levels_)
+            {
+                shed++;
+            }
+            // Hold back more and more quickly while the delay doesn't come
+            // down.
+            next_change_ = now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                interval_ / std::sqrt(static_cast<double>(shed + 1)));
+        }
+    }
+    else
+    {
+        if (above_)
+        {
+            above_ = false;
+            next_change_ = now + interval_;
+        }
+        else if (shed > 0 && now >= next_change_)
+        {
+            shed--;
+            next_change_ = now + interval_;
+        }
+    }
+    shed_levels_.store(shed, std::memory_order_relaxed);
+}
+
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
@@ -0,0 +1,350 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <emmintrin.h>
+#include <wmmintrin.h>
+#define ROS2_SERIAL_EXAMPLE_HAVE_CLMUL 1
+#elif defined(__aarch64__) && (defined(__ARM_FEATURE_CRYPTO) || defined(__ARM_FEATURE_AES))
+// The PMULL kernel is only compiled in if the build enables the crypto
+// extensions (for instance with -march=armv8-a+crypto); whether the CPU
+// actually has them is still checked at runtime.
+#include <arm_neon.h>
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#define ROS2_SERIAL_EXAMPLE_HAVE_CLMUL 1
+#endif
+
+#include "ros2_serial_example/crc16.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+namespace impl
+{
+
+// The polynomial 0x8005, bit-reflected.
+constexpr uint16_t CRC16_POLY_REFLECTED = 0xA001;
+
+struct CRC16Tables final
+{
+    // table[0] is the classic one-byte table.  table[k][i] is the CRC of the
+    // byte i followed by k zero bytes, which is what slicing-by-8 needs.
+    uint16_t table[8][256];
+};
+
+constexpr CRC16Tables make_crc16_tables()
+{
+    CRC16Tables tables{};
+
+    for (uint32_t i = 0; i < 256; ++i)
+    {
+        uint16_t crc = static_cast<uint16_t>(i);
+        for (int bit = 0; bit < 8; ++bit)
+        {
+            crc = ((crc & 1U) != 0) ? static_cast<uint16_t>((crc >> 1U) ^ CRC16_POLY_REFLECTED) : static_cast<uint16_t>(crc >> 1U);
+        }
+        tables.table[0][i] = crc;
+    }
+
+    for (int k = 1; k < 8; ++k)
+    {
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+            uint16_t prev = tables.table[k - 1][i];
+            tables.table[k][i] = static_cast<uint16_t>((prev >> 8U) ^ tables.table[0][prev & 0xffU]);
+        }
+    }
+
+    return tables;
+}
+
+constexpr CRC16Tables crc16_tables = make_crc16_tables();
+
+static uint16_t crc16_update_table(uint16_t crc, const uint8_t *data, size_t len)
+{
+    while ((len--) != 0)
+    {
+        crc = static_cast<uint16_t>((crc >> 8U) ^ crc16_tables.table[0][(crc ^ *data++) & 0xffU]);
+    }
+
+    return crc;
+}
+
+static uint16_t crc16_update_slicing_by_8(uint16_t crc, const uint8_t *data, size_t len)
+{
+    const uint16_t (&t)[8][256] = crc16_tables.table;
+
+    while (len >= 8)
+    {
+        crc = t[7][data[0] ^ (crc & 0xffU)] ^ t[6][data[1] ^ (crc >> 8U)] ^
+              t[5][data[2]] ^ t[4][data[3]] ^ t[3][data[4]] ^ t[2][data[5]] ^
+              t[1][data[6]] ^ t[0][data[7]];
+        data += 8;
+        len -= 8;
+    }
+
+    return crc16_update_table(crc, data, len);
+}
+
+#if defined(ROS2_SERIAL_EXAMPLE_HAVE_CLMUL)
+// The carry-less multiply kernel folds the data 128 bits at a time.  The
+// accumulator holds 128 bits of data in wire (bit-reflected) order, so that
+// bit i of the accumulator is the coefficient of x^(127 - i).  Folding the
+// accumulator forward by D bits multiplies its low 64 bits by x^(D + 64) and
+// its high 64 bits by x^D, modulo the polynomial; the constants below are
+// those powers of x, each divided by x once more to make up for the one bit
+// shift that multiplying two bit-reflected numbers introduces.  Once all of
+// the data is folded in, the accumulator has the same CRC as the data it
+// replaced, so the final reduction is done with the slicing-by-8 tables.
+
+// Compute x^n modulo x^16 + x^15 + x^2 + 1, in normal (not reflected) order.
+constexpr uint64_t crc16_xpow_mod(uint32_t n)
+{
+    uint32_t r = 1;
+    for (uint32_t i = 0; i < n; ++i)
+    {
+        r <<= 1U;
+        if ((r & 0x10000U) != 0)
+        {
+            r ^= 0x18005U;
+        }
+    }
+
+    return r;
+}
+
+constexpr uint64_t bit_reverse64(uint64_t v)
+{
+    uint64_t r = 0;
+    for (int i = 0; i < 64; ++i)
+    {
+        r = (r << 1U) | ((v >> i) & 1U);
+    }
+
+    return r;
+}
+
+// Constants to fold forward by 128 bits (one 16 byte block) ...
+constexpr uint64_t CRC16_FOLD128_LO = bit_reverse64(crc16_xpow_mod(128 + 64 - 1));
+constexpr uint64_t CRC16_FOLD128_HI = bit_reverse64(crc16_xpow_mod(128 - 1));
+// ... and by 512 bits (four 16 byte blocks).
+constexpr uint64_t CRC16_FOLD512_LO = bit_reverse64(crc16_xpow_mod(512 + 64 - 1));
+constexpr uint64_t CRC16_FOLD512_HI = bit_reverse64(crc16_xpow_mod(512 - 1));
+
+// Below this size the setup cost of the fold isn't worth it.
+constexpr size_t CRC16_CLMUL_MIN_LEN = 64;
+
+#if defined(__x86_64__)
+__attribute__((target("pclmul,sse2")))
+static inline __m128i crc16_fold(__m128i acc, __m128i k)
+{
+    return _mm_xor_si128(_mm_clmulepi64_si128(acc, k, 0x00), _mm_clmulepi64_si128(acc, k, 0x11));
+}
+
+__attribute__((target("pclmul,sse2")))
+static uint16_t crc16_update_clmul(uint16_t crc, const uint8_t *data, size_t len)
+{
+    if (len < CRC16_CLMUL_MIN_LEN)
+    {
+        return crc16_update_slicing_by_8(crc, data, len);
+    }
+
+    const __m128i k128 = _mm_set_epi64x(static_cast<int64_t>(CRC16_FOLD128_HI), static_cast<int64_t>(CRC16_FOLD128_LO));
+    const __m128i k512 = _mm_set_epi64x(static_cast<int64_t>(CRC16_FOLD512_HI), static_cast<int64_t>(CRC16_FOLD512_LO));
+
+    // Starting with a non-zero CRC is the same as XORing it into the
+    // first two bytes of the data.
+    __m128i acc0 = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data)), _mm_cvtsi32_si128(crc));
+    __m128i acc1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 16));
+    __m128i acc2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 32));
+    __m128i acc3 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 48));
+    data += 64;
+    len -= 64;
+
+    while (len >= 64)
+    {
+        acc0 = _mm_xor_si128(crc16_fold(acc0, k512), _mm_loadu_si128(reinterpret_cast<const __m128i *>(data)));
+        acc1 = _mm_xor_si128(crc16_fold(acc1, k512), _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 16)));
+        acc2 = _mm_xor_si128(crc16_fold(acc2, k512), _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 32)));
+        acc3 = _mm_xor_si128(crc16_fold(acc3, k512), _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 48)));
+        data += 64;
+        len -= 64;
+    }
+
+    __m128i acc = _mm_xor_si128(crc16_fold(acc0, k128), acc1);
+    acc = _mm_xor_si128(crc16_fold(acc, k128), acc2);
+    acc = _mm_xor_si128(crc16_fold(acc, k128), acc3);
+
+    while (len >= 16)
+    {
+        acc = _mm_xor_si128(crc16_fold(acc, k128), _mm_loadu_si128(reinterpret_cast<const __m128i *>(data)));
+        data += 16;
+        len -= 16;
+    }
+
+    uint8_t folded[16];
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(folded), acc);
+    crc = crc16_update_slicing_by_8(0, folded, sizeof(folded));
+
+    return crc16_update_slicing_by_8(crc, data, len);
+}
+
+static bool crc16_clmul_supported()
+{
+    unsigned int eax;
+    unsigned int ebx;
+    unsigned int ecx;
+    unsigned int edx;
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) == 0)
+    {
+        return false;
+    }
+
+    return (ecx & bit_PCLMUL) != 0 && (edx & bit_SSE2) != 0;
+}
+#elif defined(__aarch64__)
+static inline uint64x2_t crc16_fold(uint64x2_t acc, uint64x2_t k)
+{
+    uint64x2_t lo = vreinterpretq_u64_p128(vmull_p64(vgetq_lane_u64(acc, 0), vgetq_lane_u64(k, 0)));
+    uint64x2_t hi = vreinterpretq_u64_p128(vmull_p64(vgetq_lane_u64(acc, 1), vgetq_lane_u64(k, 1)));
+    return veorq_u64(lo, hi);
+}
+
+static inline uint64x2_t crc16_load(const uint8_t *data)
+{
+    return vreinterpretq_u64_u8(vld1q_u8(data));
+}
+
+static uint16_t crc16_update_clmul(uint16_t crc, const uint8_t *data, size_t len)
+{
+    if (len < CRC16_CLMUL_MIN_LEN)
+    {
+        return crc16_update_slicing_by_8(crc, data, len);
+    }
+
+    const uint64x2_t k128 = vcombine_u64(vcreate_u64(CRC16_FOLD128_LO), vcreate_u64(CRC16_FOLD128_HI));
+    const uint64x2_t k512 = vcombine_u64(vcreate_u64(CRC16_FOLD512_LO), vcreate_u64(CRC16_FOLD512_HI));
+
+    // Starting with a non-zero CRC is the same as XORing it into the
+    // first two bytes of the data.
+    uint64x2_t acc0 = veorq_u64(crc16_load(data), vcombine_u64(vcreate_u64(crc), vcreate_u64(0)));
+    uint64x2_t acc1 = crc16_load(data + 16);
+    uint64x2_t acc2 = crc16_load(data + 32);
+    uint64x2_t acc3 = crc16_load(data + 48);
+    data += 64;
+    len -= 64;
+
+    while (len >= 64)
+    {
+        acc0 = veorq_u64(crc16_fold(acc0, k512), crc16_load(data));
+        acc1 = veorq_u64(crc16_fold(acc1, k512), crc16_load(data + 16));
+        acc2 = veorq_u64(crc16_fold(acc2, k512), crc16_load(data + 32));
+        acc3 = veorq_u64(crc16_fold(acc3, k512), crc16_load(data + 48));
+        data += 64;
+        len -= 64;
+    }
+
+    uint64x2_t acc = veorq_u64(crc16_fold(acc0, k128), acc1);
+    acc = veorq_u64(crc16_fold(acc, k128), acc2);
+    acc = veorq_u64(crc16_fold(acc, k128), acc3);
+
+    while (len >= 16)
+    {
+        acc = veorq_u64(crc16_fold(acc, k128), crc16_load(data));
+        data += 16;
+        len -= 16;
+    }
+
+    uint8_t folded[16];
+    vst1q_u8(folded, vreinterpretq_u8_u64(acc));
+    crc = crc16_update_slicing_by_8(0, folded, sizeof(folded));
+
+    return crc16_update_slicing_by_8(crc, data, len);
+}
+
+static bool crc16_clmul_supported()
+{
+    return (::getauxval(AT_HWCAP) & HWCAP_PMULL) != 0;
+}
+#endif
+#endif
+
+CRC16::CRC16() : CRC16(engine_supported(Engine::CLMUL) ? Engine::CLMUL : Engine::SLICING_BY_8)
+{
+}
+
+CRC16::CRC16(Engine engine) : engine_(engine), update_fn_(crc16_update_table)
+{
+    if (!engine_supported(engine))
+    {
+        throw std::runtime_error("CRC16 engine not supported on this CPU");
+    }
+
+    switch (engine)
+    {
+    case Engine::TABLE:
+        update_fn_ = crc16_update_table;
+        break;
+    case Engine::SLICING_BY_8:
+        update_fn_ = crc16_update_slicing_by_8;
+        break;
+    case Engine::CLMUL:
+#if defined(ROS2_SERIAL_EXAMPLE_HAVE_CLMUL)
+        update_fn_ = crc16_update_clmul;
+#endif
+        break;
+    }
+}
+
+bool CRC16::engine_supported(Engine engine)
+{
+    switch (engine)
+    {
+    case Engine::TABLE:
+    case Engine::SLICING_BY_8:
+        return true;
+    case Engine::CLMUL:
+#if defined(ROS2_SERIAL_EXAMPLE_HAVE_CLMUL)
+    {
+        static const bool supported = crc16_clmul_supported();
+        return supported;
+    }
+#else
+        return false;
+#endif
+    }
+
+    return false;
+}
+
+uint16_t CRC16::update_byte(uint16_t crc, uint8_t data)
+{
+    return static_cast<uint16_t>((crc >> 8U) ^ crc16_tables.table[0][(crc ^ data) & 0xffU]);
+}
+
+}  // namespace impl
+
+}  // namespace transport
+
+}  // namespace ros2_to_serial_bridge
@@ -0,0 +1,229 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <nmmintrin.h>
+#define ROS2_SERIAL_EXAMPLE_HAVE_CRC32C_HW 1
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+// The CRC kernel is only compiled in if the build enables the CRC extension
+// (for instance with -march=armv8-a+crc); whether the CPU actually has it is
+// still checked at runtime.
+#include <arm_acle.h>
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#define ROS2_SERIAL_EXAMPLE_HAVE_CRC32C_HW 1
+#endif
+
+#include "ros2_serial_example/crc32c.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+namespace impl
+{
+
+// The polynomial 0x1EDC6F41, bit-reflected.
+constexpr uint32_t CRC32C_POLY_REFLECTED = 0x82F63B78;
+
+struct CRC32CTables final
+{
+    // table[0] is the classic one-byte table.  table[k][i] is the CRC of the
+    // byte i followed by k zero bytes, which is what slicing-by-8 needs.
+    uint32_t table[8][256];
+};
+
+constexpr CRC32CTables make_crc32c_tables()
+{
+    CRC32CTables tables{};
+
+    for (uint32_t i = 0; i < 256; ++i)
+    {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; ++bit)
+        {
+            crc = ((crc & 1U) != 0) ? ((crc >> 1U) ^ CRC32C_POLY_REFLECTED) : (crc >> 1U);
+        }
+        tables.table[0][i] = crc;
+    }
+
+    for (int k = 1; k < 8; ++k)
+    {
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+            uint32_t prev = tables.table[k - 1][i];
+            tables.table[k][i] = (prev >> 8U) ^ tables.table[0][prev & 0xffU];
+        }
+    }
+
+    return tables;
+}
+
+constexpr CRC32CTables crc32c_tables = make_crc32c_tables();
+
+// The update functions below work on the CRC register directly; the initial
+// value and final XOR are applied by CRC32C::update().
+
+static uint32_t crc32c_update_table(uint32_t crc, const uint8_t *data, size_t len)
+{
+    while ((len--) != 0)
+    {
+        crc = (crc >> 8U) ^ crc32c_tables.table[0][(crc ^ *data++) & 0xffU];
+    }
+
+    return crc;
+}
+
+static uint32_t crc32c_update_slicing_by_8(uint32_t crc, const uint8_t *data, size_t len)
+{
+    const uint32_t (&t)[8][256] = crc32c_tables.table;
+
+    while (len >= 8)
+    {
+        crc = t[7][(data[0] ^ crc) & 0xffU] ^ t[6][(data[1] ^ (crc >> 8U)) & 0xffU] ^
+              t[5][(data[2] ^ (crc >> 16U)) & 0xffU] ^ t[4][data[3] ^ (crc >> 24U)] ^
+              t[3][data[4]] ^ t[2][data[5]] ^ t[1][data[6]] ^ t[0][data[7]];
+        data += 8;
+        len -= 8;
+    }
+
+    return crc32c_update_table(crc, data, len);
+}
+
+#if defined(ROS2_SERIAL_EXAMPLE_HAVE_CRC32C_HW)
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_update_hardware(uint32_t crc, const uint8_t *data, size_t len)
+{
+    uint64_t crc64 = crc;
+    while (len >= 8)
+    {
+        uint64_t v;
+        ::memcpy(&v, data, sizeof(v));
+        crc64 = _mm_crc32_u64(crc64, v);
+        data += 8;
+        len -= 8;
+    }
+
+    crc = static_cast<uint32_t>(crc64);
+    while ((len--) != 0)
+    {
+        crc = _mm_crc32_u8(crc, *data++);
+    }
+
+    return crc;
+}
+
+static bool crc32c_hardware_supported()
+{
+    unsigned int eax;
+    unsigned int ebx;
+    unsigned int ecx;
+    unsigned int edx;
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) == 0)
+    {
+        return false;
+    }
+
+    return (ecx & bit_SSE4_2) != 0;
+}
+#elif defined(__aarch64__)
+static uint32_t crc32c_update_hardware(uint32_t crc, const uint8_t *data, size_t len)
+{
+    while (len >= 8)
+    {
+        uint64_t v;
+        ::memcpy(&v, data, sizeof(v));
+        crc = __crc32cd(crc, v);
+        data += 8;
+        len -= 8;
+    }
+
+    while ((len--) != 0)
+    {
+        crc = __crc32cb(crc, *data++);
+    }
+
+    return crc;
+}
+
+static bool crc32c_hardware_supported()
+{
+    return (::getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+}
+#endif
+#endif
+
+CRC32C::CRC32C() : CRC32C(engine_supported(Engine::HARDWARE) ? Engine::HARDWARE : Engine::SLICING_BY_8)
+{
+}
+
+CRC32C::CRC32C(Engine engine) : engine_(engine), update_fn_(crc32c_update_table)
+{
+    if (!engine_supported(engine))
+    {
+        throw std::runtime_error("CRC32C engine not supported on this CPU");
+    }
+
+    switch (engine)
+    {
+    case Engine::TABLE:
+        update_fn_ = crc32c_update_table;
+        break;
+    case Engine::SLICING_BY_8:
+        update_fn_ = crc32c_update_slicing_by_8;
+        break;
+    case Engine::HARDWARE:
+#if defined(ROS2_SERIAL_EXAMPLE_HAVE_CRC32C_HW)
+        update_fn_ = crc32c_update_hardware;
+#endif
+        break;
+    }
+}
+
+bool CRC32C::engine_supported(Engine engine)
+{
+    switch (engine)
+    {
+    case Engine::TABLE:
+    case Engine::SLICING_BY_8:
+        return true;
+    case Engine::HARDWARE:
+#if defined(ROS2_SERIAL_EXAMPLE_HAVE_CRC32C_HW)
+    {
+        static const bool supported = crc32c_hardware_supported();
+        return supported;
+    }
+#else
+        return false;
+#endif
+    }
+
+    return false;
+}
+
+}  // namespace impl
+
+}  // namespace transport
+
+}  // namespace ros2_to_serial_bridge
@@ -0,0 +1,215 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <sys/uio.h>
+
+#include "ros2_serial_example/alloc_guard.hpp"
+#include "ros2_serial_example/dispatch_pool.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+DispatchPool::DispatchPool(size_t workers, size_t queue_bytes, Handler handler, size_t max_payload,
+                           size_t priority_workers)
+    : handler_(std::move(handler)), max_payload_(max_payload), normal_workers_(workers)
+{
+    if (workers == 0)
+    {
+        throw std::runtime_error("DispatchPool needs at least one worker");
+    }
+    if (queue_bytes <= sizeof(Record))
+    {
+        throw std::runtime_error("DispatchPool queue_bytes is too small");
+    }
+
+    for (size_t i = 0; i < workers + priority_workers; ++i)
+    {
+        workers_.push_back(std::make_unique<Worker>(queue_bytes));
+    }
+    for (size_t i = 0; i < workers_.size(); ++i)
+    {
+        workers_[i]->thread = std::thread(&DispatchPool::worker_func, this, i);
+    }
+}
+
+DispatchPool::~DispatchPool()
+{
+    stop();
+}
+
+bool DispatchPool::push(uint16_t source, topic_id_size_t topic_ID, const uint8_t * buffer, size_t length,
+                        std::chrono::system_clock::time_point receive_time, uint8_t priority)
+{
+    if (length > UINT32_MAX)
+    {
+        return false;
+    }
+
+    // Consecutive topic IDs go to consecutive workers.
+    size_t key = (static_cast<size_t>(source) << 16) | topic_ID;
+    size_t priority_workers = workers_.size() - normal_workers_;
+    Worker & worker = (priority > 0 && priority_workers > 0) ?
+                      *workers_[normal_workers_ + key % priority_workers] :
+                      *workers_[key % normal_workers_];
+
+    Record record;
+    record.length = static_cast<uint32_t>(length);
+    record.source = source;
+    record.topic_ID = topic_ID;
+    record.receive_time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(receive_time.time_since_epoch()).count();
+
+    struct iovec iov[2];
+    iov[0].iov_base = &record;
+    iov[0].iov_len = sizeof(record);
+    iov[1].iov_base = const_cast<uint8_t *>(buffer);
+    iov[1].iov_len = length;
+    if (worker.queue.writev(iov, 2) < 0)
+    {
+        return false;
+    }
+    worker.pushed++;
+
+    // This pairs with the fence in worker_func(): either the worker sees the
+    // new record before it goes to sleep, or we see that it is asleep.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (worker.sleeping.load(std::memory_order_relaxed))
+    {
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.wakeup.notify_one();
+    }
+
+    return true;
+}
+
+bool DispatchPool::wait_handled()
+{
+    for (auto & worker : workers_)
+    {
+        while (worker->handled.load(std::memory_order_acquire) != worker->pushed)
+        {
+            if (stopping_)
+            {
+                return false;
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    return true;
+}
+
+void DispatchPool::stop()
+{
+    stopping_ = true;
+    for (auto & worker : workers_)
+    {
+        {
+            std::lock_guard<std::mutex> lock(worker->mutex);
+            worker->wakeup.notify_one();
+        }
+        if (worker->thread.joinable())
+        {
+            worker->thread.join();
+        }
+    }
+}
+
+void DispatchPool::worker_func(size_t index)
+{
+    Worker & worker = *workers_[index];
+    impl::SPSCRingBuffer & queue = worker.queue;
+    // Payloads that wrap around the end of the queue are copied out, since
+    // the handler needs them in one piece.
+    std::vector<uint8_t> scratch;
+    scratch.reserve(max_payload_);
+
+    while (!stopping_)
+    {
+        if (queue.bytes_used() < sizeof(Record))
+        {
+            std::unique_lock<std::mutex> lock(worker.mutex);
+            worker.sleeping.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (queue.bytes_used() < sizeof(Record) && !stopping_)
+            {
+                worker.wakeup.wait(lock);
+            }
+            worker.sleeping.store(false, std::memory_order_relaxed);
+            continue;
+        }
+
+        HotPathScope hot_path;
+
+        // push() writes a record and its payload at once, so the whole
+        // record is here.
+        const uint8_t * first;
+        size_t first_len;
+        const uint8_t * second;
+        size_t second_len;
+        Record record;
+        queue.peek_spans(sizeof(record), &first, &first_len, &second, &second_len);
+        ::memcpy(&record, first, first_len);
+        if (second_len > 0)
+        {
+            ::memcpy(reinterpret_cast<uint8_t *>(&record) + first_len, second, second_len);
+        }
+
+        size_t total = sizeof(record) + record.length;
+        queue.peek_spans(total, &first, &first_len, &second, &second_len);
+
+        // The queue is ours until the payload is consumed, so the handler
+        // may change it in place.
+        uint8_t * payload;
+        if (first_len >= total)
+        {
+            payload = const_cast<uint8_t *>(first) + sizeof(record);
+        }
+        else if (first_len <= sizeof(record))
+        {
+            payload = const_cast<uint8_t *>(second) + (sizeof(record) - first_len);
+        }
+        else
+        {
+            scratch.resize(record.length);
+            size_t n = first_len - sizeof(record);
+            ::memcpy(scratch.data(), first + sizeof(record), n);
+            ::memcpy(scratch.data() + n, second, record.length - n);
+            payload = scratch.data();
+        }
+
+        std::chrono::system_clock::time_point receive_time{
+            std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::nanoseconds(record.receive_time_ns))};
+        handler_(index, record.source, record.topic_ID, payload, record.length, receive_time);
+
+        queue.consume(total);
+        worker.handled.fetch_add(1, std::memory_order_release);
+    }
+}
+
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
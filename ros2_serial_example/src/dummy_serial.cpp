@@ -12,7 +12,9 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
 #include <cerrno>
+#include <chrono>
 #include <csignal>
 #include <cstdio>
 #include <cstdlib>
@@ -20,19 +22,24 @@
 #include <memory>
 #include <string>
 #include <thread>
+#include <vector>
 
+#include <sys/types.h>
 #include <unistd.h>
 
 #include <fastcdr/Cdr.h>
 #include <fastcdr/FastCdr.h>
 
+#include "ros2_serial_msgs/msg/link_capabilities.hpp"
+#include "ros2_serial_msgs/msg/detail/link_capabilities__rosidl_typesupport_fastrtps_cpp.hpp"
 #include "ros2_serial_msgs/msg/serial_mapping.hpp"
 #include "ros2_serial_msgs/msg/detail/serial_mapping__rosidl_typesupport_fastrtps_cpp.hpp"
 
+#include "ros2_serial_example/load_generator.hpp"
 #include "ros2_serial_example/transporter.hpp"
 #include "ros2_serial_example/uart_transporter.hpp"
 
-constexpr int BUFFER_SIZE = 1024;
+constexpr int BUFFER_SIZE = 8192;
 
 static void usage(const char *name)
 {
@@ -40,12 +47,26 @@ static void usage(const char *name)
              "  -b <baudrate> Baudrate to use for the device\n"
              "  -d <device>   UART device; must be specified\n"
              "  -h            Print this help message\n"
+             "  -l            Print the remapping arguments the bridge needs for\n"
+             "                the load, one per line, and exit\n"
+             "  -m <mix>      Generate load with a predefined mix of topics;\n"
+             "                currently supported is 'px4'\n"
+             "  -o <file>     Append the report of the load to this file as a\n"
+             "                line of JSON\n"
+             "  -p <name>     Measure the CPU and memory use of the running\n"
+             "                executable with this name (the bridge) during\n"
+             "                the load\n"
              "  -s <protocol> Serial protocol to use; currently supported are\n"
-             "                'cobs' (default) and 'px4'\n",
+             "                'cobs' (default), 'cobs_zpe', 'px4' and 'v2'\n"
+             "  -t <topic>    Generate load with a topic given as\n"
+             "                <size>:<rate_hz>[:<burst>]; may be repeated\n"
+             "  -T <seconds>  How long to generate load for; by default until\n"
+             "                interrupted\n",
              name);
 }
 
 volatile sig_atomic_t running = 1;
+volatile sig_atomic_t manifest_sent = 0;
 
 static void signal_handler(int signum)
 {
@@ -53,20 +74,152 @@ static void signal_handler(int signum)
     running = 0;
 }
 
-void read_thread_func(ros2_to_serial_bridge::transport::Transporter * transporter)
+// A switch to new link settings that the bridge hasn't confirmed yet by
+// sending a valid frame with them.
+struct LinkSwitch final
+{
+    bool pending{false};
+    std::chrono::steady_clock::time_point when;
+    std::string old_protocol;
+    uint32_t old_baudrate{0};
+};
+
+// Answer a link negotiation message from the bridge: an OFFER with an OFFER
+// of our own, and a SELECT by switching to the settings in it.
+//
+// Returns false if the message isn't a LinkCapabilities message.
+static bool handle_link_message(ros2_to_serial_bridge::transport::Transporter * transporter, uint8_t * buffer, size_t length, LinkSwitch * link_switch)
+{
+    ros2_serial_msgs::msg::LinkCapabilities msg;
+    eprosima::fastcdr::FastBuffer cdrbuffer(reinterpret_cast<char *>(buffer), length);
+    eprosima::fastcdr::Cdr cdrdes(cdrbuffer);
+    try
+    {
+        ros2_serial_msgs::msg::typesupport_fastrtps_cpp::cdr_deserialize(cdrdes, msg);
+    }
+    catch(const eprosima::fastcdr::exception::NotEnoughMemoryException & err)
+    {
+        return false;
+    }
+
+    if (msg.kind == ros2_serial_msgs::msg::LinkCapabilities::OFFER)
+    {
+        ros2_serial_msgs::msg::LinkCapabilities offer;
+        offer.kind = ros2_serial_msgs::msg::LinkCapabilities::OFFER;
+        if (transporter->get_baudrate() != 0)
+        {
+            offer.baudrates = {transporter->get_baudrate(), 115200, 230400, 460800, 921600, 1000000, 2000000, 3000000, 4000000};
+        }
+        offer.protocols = {"v2", "cobs_zpe", "cobs", "px4"};
+        offer.max_frame_size = BUFFER_SIZE;
+        offer.compression = true;
+        offer.batching = true;
+
+        size_t serialized_size = ros2_serial_msgs::msg::typesupport_fastrtps_cpp::get_serialized_size(offer, 0);
+        std::unique_ptr<uint8_t[]> data_buffer = std::unique_ptr<uint8_t[]>(new uint8_t[serialized_size]{});
+        eprosima::fastcdr::FastBuffer outbuffer(reinterpret_cast<char *>(data_buffer.get()), serialized_size);
+        eprosima::fastcdr::Cdr scdr(outbuffer);
+        ros2_serial_msgs::msg::typesupport_fastrtps_cpp::cdr_serialize(offer, scdr);
+        if (transporter->write(0, data_buffer.get(), scdr.getSerializedDataLength()) < 0)
+        {
+            ::fprintf(stderr, "Failed to write link offer: %s\n", ::strerror(errno));
+        }
+    }
+    else if (msg.kind == ros2_serial_msgs::msg::LinkCapabilities::SELECT && msg.protocols.size() == 1)
+    {
+        link_switch->old_protocol = transporter->get_protocol();
+        link_switch->old_baudrate = transporter->get_baudrate();
+        if (msg.baudrates.size() == 1 && msg.baudrates[0] != link_switch->old_baudrate && transporter->set_baudrate(msg.baudrates[0]) < 0)
+        {
+            ::fprintf(stderr, "Failed to switch to %u baud\n", msg.baudrates[0]);
+        }
+        if (msg.protocols[0] != link_switch->old_protocol && transporter->set_protocol(msg.protocols[0]) < 0)
+        {
+            ::fprintf(stderr, "Failed to switch to protocol '%s'\n", msg.protocols[0].c_str());
+        }
+        link_switch->pending = true;
+        link_switch->when = std::chrono::steady_clock::now();
+        ::printf("Link switched to %u baud, protocol '%s'\n", transporter->get_baudrate(), transporter->get_protocol().c_str());
+    }
+
+    return true;
+}
+
+void read_thread_func(ros2_to_serial_bridge::transport::Transporter * transporter, ros2_to_serial_bridge::loadgen::LoadGenerator * generator)
 {
     // We use a unique_ptr here both to make this a heap allocation and to quiet
     // non-owning pointer warnings from clang-tidy
     std::unique_ptr<uint8_t[]> data_buffer(new uint8_t[BUFFER_SIZE]);
     ssize_t length = 0;
     topic_id_size_t topic_ID;
+    LinkSwitch link_switch;
 
     while (running != 0)
     {
+        // If nothing valid has come in since switching the link settings,
+        // the bridge didn't make it; go back to the old ones.
+        if (link_switch.pending && std::chrono::steady_clock::now() - link_switch.when > std::chrono::seconds(1))
+        {
+            if (link_switch.old_baudrate != 0)
+            {
+                transporter->set_baudrate(link_switch.old_baudrate);
+            }
+            transporter->set_protocol(link_switch.old_protocol);
+            link_switch.pending = false;
+            ::printf("Link switch not confirmed; back to %u baud, protocol '%s'\n", transporter->get_baudrate(), transporter->get_protocol().c_str());
+        }
+
         // Process data coming over serial
         if ((length = transporter->read(&topic_ID, data_buffer.get(), BUFFER_SIZE)) >= 0)
         {
-            if (topic_ID == 0)
+            if (length > 0)
+            {
+                link_switch.pending = false;
+            }
+
+            // A topic 0 message longer than an empty one is link negotiation.
+            if (topic_ID == 0 && length > 1 && handle_link_message(transporter, data_buffer.get(), length, &link_switch))
+            {
+                continue;
+            }
+
+            if (generator != nullptr && generator->receive(topic_ID, data_buffer.get(), length, ros2_to_serial_bridge::loadgen::LoadGenerator::Clock::now()))
+            {
+                continue;
+            }
+
+            if (topic_ID == 0 && generator != nullptr)
+            {
+                // The other side is requesting a manifest; send the topics of
+                // the load generator.  The echo topics are remapped onto the
+                // others on the bridge side, so that every message comes back.
+                ros2_serial_msgs::msg::SerialMapping serial_mapping;
+
+                for (const ros2_to_serial_bridge::loadgen::TopicLoad & t : generator->get_topics())
+                {
+                    serial_mapping.topic_names.push_back("loadgen/" + t.name);
+                    serial_mapping.serial_mappings.push_back(t.out_topic_ID);
+                    serial_mapping.types.push_back("std_msgs/UInt8MultiArray");
+                    serial_mapping.direction.push_back(ros2_serial_msgs::msg::SerialMapping::SERIALTOROS2);
+
+                    serial_mapping.topic_names.push_back("loadgen/" + t.name + "_echo");
+                    serial_mapping.serial_mappings.push_back(t.in_topic_ID);
+                    serial_mapping.types.push_back("std_msgs/UInt8MultiArray");
+                    serial_mapping.direction.push_back(ros2_serial_msgs::msg::SerialMapping::ROS2TOSERIAL);
+                }
+
+                size_t serialized_size = ros2_serial_msgs::msg::typesupport_fastrtps_cpp::get_serialized_size(serial_mapping, 0);
+                std::unique_ptr<uint8_t[]> data_buffer = std::unique_ptr<uint8_t[]>(new uint8_t[serialized_size]{});
+                eprosima::fastcdr::FastBuffer cdrbuffer(reinterpret_cast<char *>(data_buffer.get()), serialized_size);
+                eprosima::fastcdr::Cdr scdr(cdrbuffer);
+                ros2_serial_msgs::msg::typesupport_fastrtps_cpp::cdr_serialize(serial_mapping, scdr);
+                if (transporter->write(1, data_buffer.get(), scdr.getSerializedDataLength()) < 0)
+                {
+                    ::fprintf(stderr, "Failed to write dynamic response: %s\n", ::strerror(errno));
+                }
+                manifest_sent = 1;
+            }
+            else if (topic_ID == 0)
             {
                 // The other side is requesting a manifest
                 ros2_serial_msgs::msg::SerialMapping serial_mapping;
@@ -114,9 +267,14 @@ int main(int argc, char *argv[])
     std::string device{};
     uint32_t baudrate = 0;
     std::string serial_protocol{"cobs"};
+    std::vector<ros2_to_serial_bridge::loadgen::TopicLoad> load_topics;
+    double load_seconds{0.0};
+    bool list_remaps{false};
+    std::string report_file{};
+    std::string bridge_process{};
 
     int ch;
-    while ((ch = ::getopt(argc, argv, "b:d:hs:")) != EOF)
+    while ((ch = ::getopt(argc, argv, "b:d:hlm:o:p:s:t:T:")) != EOF)
     {
         switch (ch)
         {
@@ -147,12 +305,64 @@ int main(int argc, char *argv[])
         case 'h':
             usage(argv[0]);
             return 0;
+        case 'l':
+            list_remaps = true;
+            break;
+        case 'o':
+            if (optarg != nullptr)
+            {
+                report_file = optarg;
+            }
+            break;
+        case 'p':
+            if (optarg != nullptr)
+            {
+                bridge_process = optarg;
+            }
+            break;
+        case 'm':
+            if (optarg != nullptr)
+            {
+                if (std::string(optarg) != "px4")
+                {
+                    ::fprintf(stderr, "Unknown mix '%s'\n", optarg);
+                    return 1;
+                }
+                std::vector<ros2_to_serial_bridge::loadgen::TopicLoad> mix = ros2_to_serial_bridge::loadgen::LoadGenerator::px4_mix(load_topics.size());
+                load_topics.insert(load_topics.end(), mix.begin(), mix.end());
+            }
+            break;
         case 's':
             if (optarg != nullptr)
             {
                 serial_protocol = optarg;
             }
             break;
+        case 't':
+            if (optarg != nullptr)
+            {
+                ros2_to_serial_bridge::loadgen::TopicLoad load;
+                if (!ros2_to_serial_bridge::loadgen::LoadGenerator::parse_topic_load(optarg, load_topics.size(), &load))
+                {
+                    ::fprintf(stderr, "Invalid topic '%s'; must be <size>:<rate_hz>[:<burst>], with a size of at least %zu\n", optarg, ros2_to_serial_bridge::loadgen::LoadGenerator::MIN_SIZE);
+                    return 1;
+                }
+                load_topics.push_back(load);
+            }
+            break;
+        case 'T':
+            if (optarg != nullptr)
+            {
+                char *endptr;
+                errno = 0;
+                load_seconds = ::strtod(optarg, &endptr);
+                if (errno == ERANGE || *optarg == '\0' || *endptr != '\0' || load_seconds < 0.0)
+                {
+                    ::fprintf(stderr, "Invalid duration; must be a non-negative number of seconds\n");
+                    return 1;
+                }
+            }
+            break;
         default:
             usage(argv[0]);
             return 1;
@@ -165,6 +375,15 @@ int main(int argc, char *argv[])
         return 1;
     }
 
+    if (list_remaps)
+    {
+        for (const ros2_to_serial_bridge::loadgen::TopicLoad & t : load_topics)
+        {
+            ::printf("loadgen/%s_echo:=loadgen/%s\n", t.name.c_str(), t.name.c_str());
+        }
+        return 0;
+    }
+
     if (device.empty())
     {
         fprintf(stderr, "No device specified\n");
@@ -181,7 +400,94 @@ int main(int argc, char *argv[])
 
     ::signal(SIGINT, signal_handler);
 
-    std::thread read_thread(read_thread_func, transporter.get());
+    if (!load_topics.empty())
+    {
+        ros2_to_serial_bridge::loadgen::LoadGenerator generator(transporter.get(), load_topics);
+
+        ::printf("Generating load; start the bridge with dynamic_serial_mapping_ms >= 0 and\n"
+                 "  --ros-args");
+        for (const ros2_to_serial_bridge::loadgen::TopicLoad & t : load_topics)
+        {
+            ::printf(" -r loadgen/%s_echo:=loadgen/%s", t.name.c_str(), t.name.c_str());
+        }
+        ::printf("\nso that every message comes back\n");
+
+        std::thread read_thread(read_thread_func, transporter.get(), &generator);
+
+        // Wait for the bridge to ask for the manifest, and then give it a
+        // moment to set up its topics, before starting the clock.
+        while (running != 0 && manifest_sent == 0)
+        {
+            ::usleep(100000);
+        }
+        std::this_thread::sleep_for(std::chrono::seconds(2));
+
+        // The bridge is measured over the same time as the load.
+        pid_t bridge_pid = -1;
+        ros2_to_serial_bridge::loadgen::ProcessUsage bridge_start;
+        ros2_to_serial_bridge::loadgen::ProcessUsage bridge_end;
+        if (!bridge_process.empty())
+        {
+            bridge_pid = ros2_to_serial_bridge::loadgen::LoadGenerator::find_process(bridge_process);
+            if (bridge_pid < 0 || !ros2_to_serial_bridge::loadgen::LoadGenerator::read_process_usage(bridge_pid, &bridge_start))
+            {
+                ::fprintf(stderr, "Can't measure '%s'; is it running?\n", bridge_process.c_str());
+                bridge_pid = -1;
+            }
+        }
+
+        using Clock = ros2_to_serial_bridge::loadgen::LoadGenerator::Clock;
+        Clock::time_point start = Clock::now();
+        Clock::time_point end = load_seconds > 0.0 ? start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(load_seconds)) : Clock::time_point::max();
+        Clock::time_point now = start;
+        while (running != 0 && now < end)
+        {
+            Clock::time_point next = generator.send_due(now);
+            std::this_thread::sleep_until(std::min(next, end));
+            now = Clock::now();
+        }
+        double elapsed_s = std::chrono::duration<double>(Clock::now() - start).count();
+        if (bridge_pid >= 0 && !ros2_to_serial_bridge::loadgen::LoadGenerator::read_process_usage(bridge_pid, &bridge_end))
+        {
+            ::fprintf(stderr, "Can't measure '%s' any more; did it exit?\n", bridge_process.c_str());
+            bridge_pid = -1;
+        }
+
+        // Give the messages still in flight a moment to come back.
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        running = 0;
+        read_thread.join();
+
+        std::vector<ros2_to_serial_bridge::loadgen::TopicReport> reports;
+        generator.report(&reports);
+        ros2_to_serial_bridge::loadgen::LoadGenerator::print_report(stdout, reports, elapsed_s);
+        if (bridge_pid >= 0)
+        {
+            ::printf("bridge: %.1f%% CPU, %lu kB peak RSS\n", (bridge_end.cpu_s - bridge_start.cpu_s) / elapsed_s * 100.0,
+                     static_cast<unsigned long>(bridge_end.max_rss_kb));
+        }
+        if (!report_file.empty())
+        {
+            FILE * f = ::fopen(report_file.c_str(), "a");
+            if (f == nullptr)
+            {
+                ::fprintf(stderr, "Failed to open report file '%s': %s\n", report_file.c_str(), ::strerror(errno));
+            }
+            else
+            {
+                ros2_to_serial_bridge::loadgen::LoadGenerator::write_json_report(
+                    f, "uart", serial_protocol, reports, elapsed_s,
+                    bridge_pid >= 0 ? &bridge_start : nullptr, bridge_pid >= 0 ? &bridge_end : nullptr);
+                ::fclose(f);
+            }
+        }
+
+        transporter->close();
+
+        return 0;
+    }
+
+    std::thread read_thread(read_thread_func, transporter.get(), nullptr);
 
     // We use a unique_ptr here both to make this a heap allocation and to quiet
     // non-owning pointer warnings from clang-tidy
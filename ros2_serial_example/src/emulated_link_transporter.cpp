@@ -0,0 +1,505 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "ros2_serial_example/emulated_link_transporter.hpp"
+#include "ros2_serial_example/transporter.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+namespace impl
+{
+
+// One direction of an emulated link: the bytes that are on their way, and
+// the state of the line and of the random impairments.
+struct EmulatedChannel final
+{
+    using Clock = std::chrono::steady_clock;
+
+    struct Chunk final
+    {
+        Clock::time_point deliver_at;
+        std::vector<uint8_t> bytes;
+        size_t offset;
+    };
+
+    explicit EmulatedChannel(const LinkImpairments & imp):
+        imp(imp),
+        rng(imp.seed)
+    {
+        loss_gap = gap(imp.burst_rate);
+        byte_gap = gap(imp.byte_error_rate);
+        bit_gap = gap(imp.bit_error_rate);
+    }
+
+    // The number of trials before the next one that happens with chance p.
+    uint64_t gap(double p)
+    {
+        if (p <= 0.0)
+        {
+            return std::numeric_limits<uint64_t>::max();
+        }
+        if (p >= 1.0)
+        {
+            return 0;
+        }
+
+        return std::geometric_distribution<uint64_t>(p)(rng);
+    }
+
+    // How long it takes to send len bytes at the line rate.
+    Clock::duration serialize_time(size_t len) const
+    {
+        if (imp.baudrate == 0)
+        {
+            return Clock::duration::zero();
+        }
+
+        return std::chrono::duration_cast<Clock::duration>(
+            std::chrono::nanoseconds(static_cast<uint64_t>(len) * 10ULL * 1000000000ULL / imp.baudrate));
+    }
+
+    // The number of bytes that are still to go out on the line at now.
+    size_t backlog(Clock::time_point now) const
+    {
+        if (imp.baudrate == 0 || tx_free_at <= now)
+        {
+            return 0;
+        }
+
+        uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(tx_free_at - now).count();
+        return ns * imp.baudrate / 10ULL / 1000000000ULL;
+    }
+
+    // Decide which of the next units (bytes, or one packet) are lost, and
+    // return the number of them that are kept before the next change, as a
+    // positive number, or lost, as a negative one.
+    int64_t next_loss_run(size_t units)
+    {
+        if (burst_left > 0)
+        {
+            uint64_t n = std::min<uint64_t>(burst_left, units);
+            burst_left -= n;
+            if (burst_left == 0)
+            {
+                loss_gap = gap(imp.burst_rate);
+            }
+            return -static_cast<int64_t>(n);
+        }
+
+        if (loss_gap > 0)
+        {
+            uint64_t n = std::min<uint64_t>(loss_gap, units);
+            loss_gap -= n;
+            return static_cast<int64_t>(n);
+        }
+
+        // A burst starts here, and lasts for at least one unit.
+        burst_left = 1 + gap(1.0 / imp.burst_length);
+        return next_loss_run(units);
+    }
+
+    // Damage the bytes that got through.
+    void corrupt(uint8_t *bytes, size_t len)
+    {
+        size_t i = 0;
+        while (byte_gap < len - i)
+        {
+            i += byte_gap;
+            bytes[i] ^= static_cast<uint8_t>(std::uniform_int_distribution<unsigned>(1, 255)(rng));
+            stats.bytes_replaced++;
+            i++;
+            byte_gap = gap(imp.byte_error_rate);
+        }
+        if (byte_gap != std::numeric_limits<uint64_t>::max())
+        {
+            byte_gap -= len - i;
+        }
+
+        uint64_t bits = static_cast<uint64_t>(len) * 8;
+        uint64_t b = 0;
+        while (bit_gap < bits - b)
+        {
+            b += bit_gap;
+            bytes[b / 8] ^= static_cast<uint8_t>(1U << (b % 8));
+            stats.bits_flipped++;
+            b++;
+            bit_gap = gap(imp.bit_error_rate);
+        }
+        if (bit_gap != std::numeric_limits<uint64_t>::max())
+        {
+            bit_gap -= bits - b;
+        }
+    }
+
+    void deliver(Chunk && chunk)
+    {
+        if (imp.mtu == 0)
+        {
+            // The bytes of a stream arrive in the order they were sent,
+            // however much the jitter says otherwise.
+            chunk.deliver_at = std::max(chunk.deliver_at, last_deliver_at);
+            last_deliver_at = chunk.deliver_at;
+            chunks.push_back(std::move(chunk));
+        }
+        else
+        {
+            auto it = std::upper_bound(chunks.begin(), chunks.end(), chunk.deliver_at,
+                                       [](Clock::time_point t, const Chunk & c) {return t < c.deliver_at;});
+            chunks.insert(it, std::move(chunk));
+        }
+        cv.notify_all();
+    }
+
+    // Wait, with the lock held, until the first chunk is due or the deadline
+    // passes; returns whether it is due.
+    bool wait_due(std::unique_lock<std::mutex> & lock, Clock::time_point deadline,
+                  const std::atomic<bool> & open)
+    {
+        while (open)
+        {
+            Clock::time_point now = Clock::now();
+            if (!chunks.empty() && chunks.front().deliver_at <= now)
+            {
+                return true;
+            }
+            if (now >= deadline)
+            {
+                return false;
+            }
+
+            Clock::time_point until = deadline;
+            if (!chunks.empty())
+            {
+                until = std::min(until, chunks.front().deliver_at);
+            }
+            cv.wait_until(lock, until);
+        }
+
+        return false;
+    }
+
+    const LinkImpairments imp;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::mt19937_64 rng;
+    std::deque<Chunk> chunks;
+    Clock::time_point tx_free_at;
+    Clock::time_point last_deliver_at;
+    uint64_t loss_gap;
+    uint64_t burst_left{0};
+    uint64_t byte_gap;
+    uint64_t bit_gap;
+    EmulatedLinkTransporter::Stats stats;
+};
+
+}  // namespace impl
+
+namespace
+{
+
+void check_impairments(const LinkImpairments & imp)
+{
+    for (double rate : {imp.bit_error_rate, imp.byte_error_rate, imp.burst_rate})
+    {
+        if (!(rate >= 0.0 && rate <= 1.0))
+        {
+            throw std::runtime_error("Invalid link error rate, must be between 0 and 1 inclusive");
+        }
+    }
+
+    if (!(imp.burst_length >= 1.0))
+    {
+        throw std::runtime_error("Invalid link burst length, must be at least 1");
+    }
+
+    if (imp.delay.count() < 0 || imp.jitter.count() < 0)
+    {
+        throw std::runtime_error("Invalid link delay or jitter, must not be negative");
+    }
+}
+
+}  // namespace
+
+std::pair<std::unique_ptr<EmulatedLinkTransporter>, std::unique_ptr<EmulatedLinkTransporter>>
+EmulatedLinkTransporter::create_pair(const std::string & protocol, const LinkImpairments & a_to_b,
+                                     const LinkImpairments & b_to_a, uint32_t read_poll_ms,
+                                     size_t ring_buffer_size)
+{
+    check_impairments(a_to_b);
+    check_impairments(b_to_a);
+
+    auto ab = std::make_shared<impl::EmulatedChannel>(a_to_b);
+    auto ba = std::make_shared<impl::EmulatedChannel>(b_to_a);
+
+    // The constructor is private, so make_unique can't be used.
+    std::unique_ptr<EmulatedLinkTransporter> a(
+        new EmulatedLinkTransporter(protocol, ab, ba, read_poll_ms, ring_buffer_size));
+    std::unique_ptr<EmulatedLinkTransporter> b(
+        new EmulatedLinkTransporter(protocol, ba, ab, read_poll_ms, ring_buffer_size));
+
+    return std::make_pair(std::move(a), std::move(b));
+}
+
+EmulatedLinkTransporter::EmulatedLinkTransporter(const std::string & protocol,
+                                                 std::shared_ptr<impl::EmulatedChannel> tx,
+                                                 std::shared_ptr<impl::EmulatedChannel> rx,
+                                                 uint32_t read_poll_ms,
+                                                 size_t ring_buffer_size):
+    Transporter(protocol, ring_buffer_size),
+    tx_(std::move(tx)),
+    rx_(std::move(rx)),
+    read_poll_ms_(read_poll_ms)
+{
+    // A packet link reads each packet as a frame of its own; both ends have
+    // the same MTU in practice, but only what arrives here matters.
+    datagram_frames_ = rx_->imp.mtu > 0;
+}
+
+EmulatedLinkTransporter::~EmulatedLinkTransporter()
+{
+    close();
+}
+
+int EmulatedLinkTransporter::init()
+{
+    if (fds_OK())
+    {
+        ::fprintf(stderr, "Cannot re-init; call close first\n");
+        return -1;
+    }
+
+    open_ = true;
+
+    return 0;
+}
+
+bool EmulatedLinkTransporter::fds_OK()
+{
+    return open_;
+}
+
+int EmulatedLinkTransporter::close()
+{
+    {
+        std::lock_guard<std::mutex> lock(rx_->mutex);
+        open_ = false;
+    }
+    // Wake up a reader, so that it sees that this end is closed.
+    rx_->cv.notify_all();
+
+    return 0;
+}
+
+ssize_t EmulatedLinkTransporter::node_read()
+{
+    if (!fds_OK())
+    {
+        return -1;
+    }
+
+    std::unique_lock<std::mutex> lock(rx_->mutex);
+    impl::EmulatedChannel::Clock::time_point now = impl::EmulatedChannel::Clock::now();
+    if (!rx_->wait_due(lock, now + std::chrono::milliseconds(read_poll_ms_), open_))
+    {
+        return 0;
+    }
+
+    // Copy everything that has arrived.  Like a short read() from a file
+    // descriptor, stop when the ring buffer wraps; the rest stays on the
+    // link for the next call.
+    now = impl::EmulatedChannel::Clock::now();
+    size_t ncopied = 0;
+    while (!rx_->chunks.empty() && rx_->chunks.front().deliver_at <= now)
+    {
+        impl::EmulatedChannel::Chunk & chunk = rx_->chunks.front();
+        size_t n = chunk.bytes.size() - chunk.offset;
+        ssize_t ret = ringbuf_.write(chunk.bytes.data() + chunk.offset, n);
+        if (ret <= 0)
+        {
+            break;
+        }
+        ncopied += ret;
+        chunk.offset += ret;
+        if (chunk.offset == chunk.bytes.size())
+        {
+            rx_->chunks.pop_front();
+        }
+        if (static_cast<size_t>(ret) < n)
+        {
+            break;
+        }
+    }
+
+    return ncopied;
+}
+
+ssize_t EmulatedLinkTransporter::node_read_frames(const FrameVisitor & visitor)
+{
+    if (!fds_OK())
+    {
+        return -1;
+    }
+
+    std::unique_lock<std::mutex> lock(rx_->mutex);
+    impl::EmulatedChannel::Clock::time_point now = impl::EmulatedChannel::Clock::now();
+    if (!rx_->wait_due(lock, now + std::chrono::milliseconds(read_poll_ms_), open_))
+    {
+        return 0;
+    }
+
+    // Take the packets that have arrived off the link before handing them
+    // over, so the writer isn't held up by the visitor.
+    now = impl::EmulatedChannel::Clock::now();
+    std::vector<std::vector<uint8_t>> packets;
+    while (!rx_->chunks.empty() && rx_->chunks.front().deliver_at <= now)
+    {
+        packets.push_back(std::move(rx_->chunks.front().bytes));
+        rx_->chunks.pop_front();
+    }
+    lock.unlock();
+
+    for (const std::vector<uint8_t> & packet : packets)
+    {
+        visitor(packet.data(), packet.size());
+    }
+
+    return packets.size();
+}
+
+ssize_t EmulatedLinkTransporter::node_write(void *buffer, size_t len)
+{
+    if (nullptr == buffer || !fds_OK())
+    {
+        return -1;
+    }
+
+    const LinkImpairments & imp = tx_->imp;
+    if (imp.mtu > 0 && len > imp.mtu)
+    {
+        std::lock_guard<std::mutex> lock(tx_->mutex);
+        tx_->stats.oversize_packets++;
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    // Like a UART's transmit buffer, only so much can be waiting to go out
+    // before the writer has to wait for the line.
+    impl::EmulatedChannel::Clock::time_point now;
+    while (true)
+    {
+        std::unique_lock<std::mutex> lock(tx_->mutex);
+        now = impl::EmulatedChannel::Clock::now();
+        if (tx_->backlog(now) <= TX_BUFFER_BYTES)
+        {
+            break;
+        }
+        impl::EmulatedChannel::Clock::time_point until = tx_->tx_free_at - tx_->serialize_time(TX_BUFFER_BYTES);
+        lock.unlock();
+        std::this_thread::sleep_until(until);
+    }
+
+    std::lock_guard<std::mutex> lock(tx_->mutex);
+    now = impl::EmulatedChannel::Clock::now();
+    tx_->tx_free_at = std::max(tx_->tx_free_at, now) + tx_->serialize_time(len);
+    tx_->stats.bytes_written += len;
+
+    impl::EmulatedChannel::Chunk chunk;
+    chunk.deliver_at = tx_->tx_free_at + imp.delay;
+    if (imp.jitter.count() > 0)
+    {
+        chunk.deliver_at += std::chrono::microseconds(
+            std::uniform_int_distribution<int64_t>(0, imp.jitter.count())(tx_->rng));
+    }
+    chunk.offset = 0;
+
+    const uint8_t *b = static_cast<const uint8_t *>(buffer);
+    if (imp.mtu > 0)
+    {
+        if (tx_->next_loss_run(1) < 0)
+        {
+            tx_->stats.bytes_lost += len;
+            return len;
+        }
+        chunk.bytes.assign(b, b + len);
+    }
+    else
+    {
+        chunk.bytes.reserve(len);
+        size_t i = 0;
+        while (i < len)
+        {
+            int64_t run = tx_->next_loss_run(len - i);
+            if (run > 0)
+            {
+                chunk.bytes.insert(chunk.bytes.end(), b + i, b + i + run);
+                i += run;
+            }
+            else
+            {
+                tx_->stats.bytes_lost += -run;
+                i += -run;
+            }
+        }
+        if (chunk.bytes.empty())
+        {
+            return len;
+        }
+    }
+
+    tx_->corrupt(chunk.bytes.data(), chunk.bytes.size());
+    tx_->deliver(std::move(chunk));
+
+    return len;
+}
+
+ssize_t EmulatedLinkTransporter::get_write_queue_bytes() const
+{
+    std::lock_guard<std::mutex> lock(tx_->mutex);
+    return tx_->backlog(impl::EmulatedChannel::Clock::now());
+}
+
+uint32_t EmulatedLinkTransporter::get_baudrate() const
+{
+    return tx_->imp.baudrate;
+}
+
+EmulatedLinkTransporter::Stats EmulatedLinkTransporter::get_link_stats() const
+{
+    std::lock_guard<std::mutex> lock(tx_->mutex);
+    return tx_->stats;
+}
+
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
@@ -0,0 +1,296 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <linux/can.h>
+
+#include "ros2_serial_example/isotp.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+namespace impl
+{
+
+constexpr size_t IsoTp::FRAME_LEN;
+constexpr size_t IsoTp::SF_MAX_LEN;
+constexpr size_t IsoTp::FF_SHORT_MAX_LEN;
+constexpr uint8_t IsoTp::PADDING;
+
+// The frame types, in the high nibble of the first byte.
+constexpr uint8_t PCI_SINGLE = 0x00;
+constexpr uint8_t PCI_FIRST = 0x10;
+constexpr uint8_t PCI_CONSECUTIVE = 0x20;
+constexpr uint8_t PCI_FLOW_CONTROL = 0x30;
+
+// A single frame with the length in the low nibble of the first byte, as on
+// classic CAN, can hold up to 7 bytes; longer ones have the length in the
+// second byte instead.
+constexpr size_t SF_SHORT_MAX_LEN = 7;
+constexpr size_t CLASSIC_FRAME_LEN = 8;
+
+// The header lengths of first frames with a 12-bit and a 32-bit length.
+constexpr size_t FF_SHORT_HEADER_LEN = 2;
+constexpr size_t FF_LONG_HEADER_LEN = 6;
+
+static size_t first_frame_data(size_t len)
+{
+    return IsoTp::FRAME_LEN - ((len <= IsoTp::FF_SHORT_MAX_LEN) ? FF_SHORT_HEADER_LEN : FF_LONG_HEADER_LEN);
+}
+
+size_t IsoTp::frame_count(size_t len)
+{
+    if (len <= SF_MAX_LEN)
+    {
+        return 1;
+    }
+
+    return 1 + (len - first_frame_data(len) + FRAME_LEN - 2) / (FRAME_LEN - 1);
+}
+
+uint8_t IsoTp::padded_length(size_t len)
+{
+    if (len <= CLASSIC_FRAME_LEN)
+    {
+        return static_cast<uint8_t>(len);
+    }
+    if (len <= 24)
+    {
+        return static_cast<uint8_t>((len + 3) & ~static_cast<size_t>(3));
+    }
+    if (len <= 32)
+    {
+        return 32;
+    }
+    if (len <= 48)
+    {
+        return 48;
+    }
+
+    return 64;
+}
+
+// This function fills in a frame with header, followed by len bytes of data,
+// padded up to at least min_len.
+static void fill_frame(struct canfd_frame *frame, canid_t can_id, const uint8_t *header, size_t header_len,
+                       const uint8_t *data, size_t len, size_t min_len)
+{
+    size_t used = header_len + len;
+    uint8_t frame_len = IsoTp::padded_length(used > min_len ? used : min_len);
+
+    frame->can_id = can_id;
+    frame->len = frame_len;
+    frame->flags = CANFD_BRS;
+    frame->__res0 = 0;
+    frame->__res1 = 0;
+    ::memcpy(frame->data, header, header_len);
+    ::memcpy(frame->data + header_len, data, len);
+    ::memset(frame->data + used, IsoTp::PADDING, frame_len - used);
+}
+
+size_t IsoTp::segment(const uint8_t *data, size_t len, canid_t can_id, struct canfd_frame *frames)
+{
+    if (len <= SF_SHORT_MAX_LEN)
+    {
+        uint8_t header[1]{static_cast<uint8_t>(PCI_SINGLE | len)};
+        fill_frame(&frames[0], can_id, header, sizeof(header), data, len, CLASSIC_FRAME_LEN);
+        return 1;
+    }
+
+    if (len <= SF_MAX_LEN)
+    {
+        uint8_t header[2]{PCI_SINGLE, static_cast<uint8_t>(len)};
+        fill_frame(&frames[0], can_id, header, sizeof(header), data, len, 0);
+        return 1;
+    }
+
+    size_t offset = first_frame_data(len);
+    if (len <= FF_SHORT_MAX_LEN)
+    {
+        uint8_t header[FF_SHORT_HEADER_LEN]{static_cast<uint8_t>(PCI_FIRST | (len >> 8)),
+                                            static_cast<uint8_t>(len)};
+        fill_frame(&frames[0], can_id, header, sizeof(header), data, offset, 0);
+    }
+    else
+    {
+        uint32_t len32 = static_cast<uint32_t>(len);
+        uint8_t header[FF_LONG_HEADER_LEN]{PCI_FIRST, 0,
+                                           static_cast<uint8_t>(len32 >> 24), static_cast<uint8_t>(len32 >> 16),
+                                           static_cast<uint8_t>(len32 >> 8), static_cast<uint8_t>(len32)};
+        fill_frame(&frames[0], can_id, header, sizeof(header), data, offset, 0);
+    }
+
+    size_t nframes = 1;
+    uint8_t sequence = 1;
+    while (offset < len)
+    {
+        size_t chunk = (len - offset < FRAME_LEN - 1) ? len - offset : FRAME_LEN - 1;
+        uint8_t header[1]{static_cast<uint8_t>(PCI_CONSECUTIVE | sequence)};
+        fill_frame(&frames[nframes], can_id, header, sizeof(header), data + offset, chunk, 0);
+        offset += chunk;
+        nframes++;
+        sequence = (sequence + 1) & 0x0F;
+    }
+
+    return nframes;
+}
+
+void IsoTp::flow_control(FlowStatus status, canid_t can_id, struct canfd_frame *frame)
+{
+    // A block size of 0 lets the sender send all of the consecutive frames
+    // without waiting, and a separation time of 0 lets it send them back to
+    // back.
+    uint8_t header[3]{static_cast<uint8_t>(PCI_FLOW_CONTROL | static_cast<uint8_t>(status)), 0, 0};
+    fill_frame(frame, can_id, header, sizeof(header), nullptr, 0, CLASSIC_FRAME_LEN);
+}
+
+IsoTp::Reassembler::Reassembler(size_t max_len) :
+    max_len_(max_len)
+{
+}
+
+IsoTp::Reassembler::Result IsoTp::Reassembler::push(const uint8_t *data, size_t len)
+{
+    message_ = nullptr;
+    message_len_ = 0;
+    if (len == 0)
+    {
+        in_progress_ = false;
+        return Result::ERROR;
+    }
+
+    switch (data[0] & 0xF0)
+    {
+    case PCI_SINGLE:
+    {
+        // A single frame ends whatever was in progress; the rest of that
+        // message is never coming.
+        in_progress_ = false;
+
+        size_t header_len = 1;
+        size_t message_len = data[0] & 0x0F;
+        if (message_len == 0)
+        {
+            if (len <= CLASSIC_FRAME_LEN)
+            {
+                return Result::ERROR;
+            }
+            header_len = 2;
+            message_len = data[1];
+        }
+        if (message_len == 0 || header_len + message_len > len)
+        {
+            return Result::ERROR;
+        }
+        if (message_len > max_len_)
+        {
+            return Result::ERROR;
+        }
+
+        message_ = data + header_len;
+        message_len_ = message_len;
+        return Result::COMPLETE;
+    }
+
+    case PCI_FIRST:
+    {
+        in_progress_ = false;
+        if (len < FF_SHORT_HEADER_LEN)
+        {
+            return Result::ERROR;
+        }
+
+        size_t header_len = FF_SHORT_HEADER_LEN;
+        size_t message_len = (static_cast<size_t>(data[0] & 0x0F) << 8) | data[1];
+        if (message_len == 0)
+        {
+            if (len < FF_LONG_HEADER_LEN)
+            {
+                return Result::ERROR;
+            }
+            header_len = FF_LONG_HEADER_LEN;
+            message_len = (static_cast<size_t>(data[2]) << 24) | (static_cast<size_t>(data[3]) << 16) |
+                          (static_cast<size_t>(data[4]) << 8) | data[5];
+        }
+
+        // A first frame is only used for what doesn't fit in a single one,
+        // so it can't hold the whole message.
+        if (message_len <= len - header_len)
+        {
+            return Result::ERROR;
+        }
+        if (message_len > max_len_)
+        {
+            return Result::OVERFLOW;
+        }
+
+        buffer_.resize(message_len);
+        ::memcpy(buffer_.data(), data + header_len, len - header_len);
+        expected_ = len - header_len;
+        next_sequence_ = 1;
+        in_progress_ = true;
+        return Result::FIRST_FRAME;
+    }
+
+    case PCI_CONSECUTIVE:
+    {
+        if (!in_progress_)
+        {
+            return Result::ERROR;
+        }
+        if ((data[0] & 0x0F) != next_sequence_)
+        {
+            in_progress_ = false;
+            return Result::ERROR;
+        }
+
+        // The last frame may be padded, so take no more than is missing.
+        size_t chunk = len - 1;
+        if (chunk > buffer_.size() - expected_)
+        {
+            chunk = buffer_.size() - expected_;
+        }
+        ::memcpy(buffer_.data() + expected_, data + 1, chunk);
+        expected_ += chunk;
+        next_sequence_ = (next_sequence_ + 1) & 0x0F;
+
+        if (expected_ < buffer_.size())
+        {
+            return Result::PENDING;
+        }
+
+        in_progress_ = false;
+        message_ = buffer_.data();
+        message_len_ = buffer_.size();
+        return Result::COMPLETE;
+    }
+
+    case PCI_FLOW_CONTROL:
+        return Result::IGNORED;
+
+    default:
+        in_progress_ = false;
+        return Result::ERROR;
+    }
+}
+
+}  // namespace impl
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
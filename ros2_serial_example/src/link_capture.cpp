@@ -0,0 +1,523 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "ros2_serial_example/link_capture.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+namespace
+{
+
+// The file is the magic, the version, the steady and wall clock times the
+// capture started at (in nanoseconds) and the name of the protocol, padded
+// with zeros, all little-endian.
+constexpr uint8_t CAPTURE_MAGIC[4] = {'R', '2', 'S', 'C'};
+constexpr uint32_t CAPTURE_VERSION = 1;
+constexpr size_t CAPTURE_PROTOCOL = 24;
+constexpr size_t CAPTURE_PROTOCOL_SIZE = 8;
+constexpr size_t CAPTURE_HEADER_SIZE = 32;
+
+// Each record is the timestamp, the length of the data and the direction,
+// followed by the data.  The direction is written last, and a zero there
+// (which is what the file is grown with) ends the capture.
+constexpr size_t RECORD_TIMESTAMP = 0;
+constexpr size_t RECORD_LENGTH = 8;
+constexpr size_t RECORD_DIRECTION = 12;
+constexpr size_t RECORD_HEADER_SIZE = 16;
+
+constexpr size_t GROW_SIZE = 1024 * 1024;
+
+// In the ring of a FlightRecorder, each record is its position (the bytes
+// claimed before it), the timestamp, the length of the data and the
+// direction, followed by the data, padded to 8 bytes, and its position
+// again.  The position at the end lets a dump walk back from the newest
+// record, and the one at the start is written last, so that a record that
+// wasn't finished or was overwritten doesn't match.
+constexpr size_t RING_POSITION = 0;
+constexpr size_t RING_TIMESTAMP = 8;
+constexpr size_t RING_LENGTH = 16;
+constexpr size_t RING_DIRECTION = 20;
+constexpr size_t RING_HEADER_SIZE = 24;
+constexpr size_t RING_TRAILER_SIZE = 8;
+
+// How many times a dump yields to the threads adding records, waiting for
+// them to finish the ones they are on.
+constexpr int DUMP_SETTLE_TRIES = 1000;
+
+uint64_t ring_record_size(size_t length)
+{
+    return RING_HEADER_SIZE + ((length + 7) & ~static_cast<size_t>(7)) + RING_TRAILER_SIZE;
+}
+
+void put_le32(uint8_t * p, uint32_t v)
+{
+    for (size_t i = 0; i < 4; ++i)
+    {
+        p[i] = static_cast<uint8_t>(v >> (8 * i));
+    }
+}
+
+void put_le64(uint8_t * p, uint64_t v)
+{
+    for (size_t i = 0; i < 8; ++i)
+    {
+        p[i] = static_cast<uint8_t>(v >> (8 * i));
+    }
+}
+
+uint32_t get_le32(const uint8_t * p)
+{
+    uint32_t v = 0;
+    for (size_t i = 0; i < 4; ++i)
+    {
+        v |= static_cast<uint32_t>(p[i]) << (8 * i);
+    }
+    return v;
+}
+
+uint64_t get_le64(const uint8_t * p)
+{
+    uint64_t v = 0;
+    for (size_t i = 0; i < 8; ++i)
+    {
+        v |= static_cast<uint64_t>(p[i]) << (8 * i);
+    }
+    return v;
+}
+
+uint64_t to_ns(std::chrono::nanoseconds d)
+{
+    return static_cast<uint64_t>(d.count());
+}
+
+}  // namespace
+
+LinkCapture::LinkCapture()
+{
+}
+
+LinkCapture::~LinkCapture()
+{
+    close();
+}
+
+bool LinkCapture::open(const std::string & path, const std::string & protocol)
+{
+    close();
+
+    if (protocol.size() > CAPTURE_PROTOCOL_SIZE)
+    {
+        return false;
+    }
+
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    fd_ = fd;
+    if (!grow(CAPTURE_HEADER_SIZE))
+    {
+        ::close(fd_);
+        fd_ = -1;
+        return false;
+    }
+
+    ::memcpy(data_, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC));
+    put_le32(data_ + 4, CAPTURE_VERSION);
+    put_le64(data_ + 8, to_ns(std::chrono::steady_clock::now().time_since_epoch()));
+    put_le64(data_ + 16, to_ns(std::chrono::system_clock::now().time_since_epoch()));
+    ::memcpy(data_ + CAPTURE_PROTOCOL, protocol.data(), protocol.size());
+    length_ = CAPTURE_HEADER_SIZE;
+
+    return true;
+}
+
+bool LinkCapture::grow(size_t needed)
+{
+    // The blocks are allocated up front, since running out of disk while
+    // writing to the mapping would kill the process with SIGBUS.
+    size_t new_size = std::max(mapped_ + GROW_SIZE, mapped_ + needed);
+    int ret = ::posix_fallocate(fd_, 0, static_cast<off_t>(new_size));
+    if (ret != 0)
+    {
+        errno = ret;
+        return false;
+    }
+
+    void *map;
+    if (data_ == nullptr)
+    {
+        map = ::mmap(nullptr, new_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    }
+    else
+    {
+        map = ::mremap(data_, mapped_, new_size, MREMAP_MAYMOVE);
+    }
+    if (map == MAP_FAILED)
+    {
+        return false;
+    }
+    data_ = static_cast<uint8_t *>(map);
+    mapped_ = new_size;
+
+    return true;
+}
+
+void LinkCapture::append(Direction direction, const struct iovec *iov, int iovcnt)
+{
+    append(direction, iov, iovcnt, to_ns(std::chrono::steady_clock::now().time_since_epoch()));
+}
+
+void LinkCapture::append(Direction direction, const struct iovec *iov, int iovcnt, uint64_t timestamp_ns)
+{
+    size_t length = 0;
+    for (int i = 0; i < iovcnt; ++i)
+    {
+        length += iov[i].iov_len;
+    }
+    if (length == 0 || length > UINT32_MAX)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (data_ == nullptr)
+    {
+        return;
+    }
+
+    if (length_ + RECORD_HEADER_SIZE + length > mapped_ && !grow(RECORD_HEADER_SIZE + length))
+    {
+        ::fprintf(stderr, "Failed to grow the link capture; stopping the capture: %s\n", ::strerror(errno));
+        ::munmap(data_, mapped_);
+        data_ = nullptr;
+        return;
+    }
+
+    uint8_t *record = data_ + length_;
+    put_le64(record + RECORD_TIMESTAMP, timestamp_ns);
+    put_le32(record + RECORD_LENGTH, static_cast<uint32_t>(length));
+    size_t offset = RECORD_HEADER_SIZE;
+    for (int i = 0; i < iovcnt; ++i)
+    {
+        ::memcpy(record + offset, iov[i].iov_base, iov[i].iov_len);
+        offset += iov[i].iov_len;
+    }
+    record[RECORD_DIRECTION] = static_cast<uint8_t>(direction);
+    length_ += offset;
+}
+
+void LinkCapture::append(Direction direction, const void *data, size_t length)
+{
+    struct iovec iov{const_cast<void *>(data), length};
+    append(direction, &iov, 1);
+}
+
+void LinkCapture::close()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (data_ != nullptr)
+    {
+        ::munmap(data_, mapped_);
+        data_ = nullptr;
+    }
+    if (fd_ >= 0)
+    {
+        if (::ftruncate(fd_, static_cast<off_t>(length_)) < 0)
+        {
+            // The zeros at the end are harmless anyway.
+        }
+        ::close(fd_);
+        fd_ = -1;
+    }
+    mapped_ = 0;
+    length_ = 0;
+}
+
+FlightRecorder::FlightRecorder(size_t size)
+{
+    if (size == 0)
+    {
+        throw std::runtime_error("FlightRecorder size must be > 0");
+    }
+
+    long page_size = ::sysconf(_SC_PAGESIZE);
+    if (page_size <= 0)
+    {
+        throw std::runtime_error("Failed to get the page size for the flight recorder");
+    }
+    size_t page = static_cast<size_t>(page_size);
+    size = (size + page - 1) / page * page;
+
+    int fd = static_cast<int>(::syscall(SYS_memfd_create, "flight_recorder", MFD_CLOEXEC));
+    if (fd < 0)
+    {
+        throw std::runtime_error("Failed to create the memory of the flight recorder");
+    }
+    if (::ftruncate(fd, static_cast<off_t>(size)) != 0)
+    {
+        ::close(fd);
+        throw std::runtime_error("Failed to size the memory of the flight recorder");
+    }
+
+    // As for a mirrored RingBuffer: reserve address space for both copies
+    // first, then map the memfd over each half of it.
+    void *base = ::mmap(nullptr, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED)
+    {
+        ::close(fd);
+        throw std::runtime_error("Failed to map the memory of the flight recorder");
+    }
+    uint8_t *u8base = static_cast<uint8_t *>(base);
+    if (::mmap(u8base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+        ::mmap(u8base + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+    {
+        ::munmap(base, 2 * size);
+        ::close(fd);
+        throw std::runtime_error("Failed to map the memory of the flight recorder");
+    }
+    ::close(fd);
+
+    ring_ = u8base;
+    size_ = size;
+}
+
+FlightRecorder::~FlightRecorder()
+{
+    ::munmap(ring_, 2 * size_);
+}
+
+void FlightRecorder::append(LinkCapture::Direction direction, const struct iovec *iov, int iovcnt)
+{
+    uint64_t now = to_ns(std::chrono::steady_clock::now().time_since_epoch());
+
+    size_t length = 0;
+    for (int i = 0; i < iovcnt; ++i)
+    {
+        length += iov[i].iov_len;
+    }
+    uint64_t record_size = ring_record_size(length);
+    if (length == 0 || length > UINT32_MAX || record_size > size_)
+    {
+        return;
+    }
+
+    uint64_t position = claimed_.fetch_add(record_size, std::memory_order_relaxed);
+    uint8_t *record = ring_ + position % size_;
+    uint32_t length32 = static_cast<uint32_t>(length);
+    ::memcpy(record + RING_TIMESTAMP, &now, sizeof(now));
+    ::memcpy(record + RING_LENGTH, &length32, sizeof(length32));
+    record[RING_DIRECTION] = static_cast<uint8_t>(direction);
+    size_t offset = RING_HEADER_SIZE;
+    for (int i = 0; i < iovcnt; ++i)
+    {
+        ::memcpy(record + offset, iov[i].iov_base, iov[i].iov_len);
+        offset += iov[i].iov_len;
+    }
+    ::memcpy(record + record_size - RING_TRAILER_SIZE, &position, sizeof(position));
+    std::atomic_thread_fence(std::memory_order_release);
+    ::memcpy(record + RING_POSITION, &position, sizeof(position));
+
+    committed_.fetch_add(record_size, std::memory_order_release);
+}
+
+bool FlightRecorder::dump(const std::string & path, const std::string & protocol) const
+{
+    // Give the records being added a moment to be finished, so that the
+    // newest of them can be walked back from.
+    uint64_t end = claimed_.load(std::memory_order_acquire);
+    for (int i = 0; i < DUMP_SETTLE_TRIES && committed_.load(std::memory_order_acquire) != end; ++i)
+    {
+        std::this_thread::yield();
+        end = claimed_.load(std::memory_order_acquire);
+    }
+
+    // The ring is copied out twice in a row, like it is mapped, so that the
+    // records running over its end can be read in one piece.
+    std::unique_ptr<uint8_t[]> copy(new uint8_t[2 * size_]);
+    ::memcpy(copy.get(), ring_, size_);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    ::memcpy(copy.get() + size_, copy.get(), size_);
+
+    // Records added while the ring was being copied may have overwritten
+    // the oldest ones.
+    uint64_t claimed = claimed_.load(std::memory_order_relaxed);
+    uint64_t oldest = claimed > size_ ? claimed - size_ : 0;
+
+    std::vector<uint64_t> positions;
+    uint64_t next = end;
+    while (next >= oldest + RING_HEADER_SIZE + RING_TRAILER_SIZE)
+    {
+        uint64_t position;
+        ::memcpy(&position, copy.get() + (next - RING_TRAILER_SIZE) % size_, sizeof(position));
+        if (position < oldest || position >= next)
+        {
+            break;
+        }
+
+        const uint8_t *record = copy.get() + position % size_;
+        uint64_t start;
+        uint32_t length;
+        ::memcpy(&start, record + RING_POSITION, sizeof(start));
+        ::memcpy(&length, record + RING_LENGTH, sizeof(length));
+        if (start != position || ring_record_size(length) != next - position)
+        {
+            break;
+        }
+        positions.push_back(position);
+        next = position;
+    }
+
+    LinkCapture capture;
+    if (!capture.open(path, protocol))
+    {
+        return false;
+    }
+    for (auto it = positions.rbegin(); it != positions.rend(); ++it)
+    {
+        const uint8_t *record = copy.get() + *it % size_;
+        uint64_t timestamp_ns;
+        uint32_t length;
+        ::memcpy(&timestamp_ns, record + RING_TIMESTAMP, sizeof(timestamp_ns));
+        ::memcpy(&length, record + RING_LENGTH, sizeof(length));
+        struct iovec iov{const_cast<uint8_t *>(record + RING_HEADER_SIZE), length};
+        capture.append(static_cast<LinkCapture::Direction>(record[RING_DIRECTION]), &iov, 1, timestamp_ns);
+    }
+    capture.close();
+
+    return true;
+}
+
+LinkCaptureReader::LinkCaptureReader()
+{
+}
+
+LinkCaptureReader::~LinkCaptureReader()
+{
+    close();
+}
+
+bool LinkCaptureReader::open(const std::string & path)
+{
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct stat st{};
+    if (::fstat(fd, &st) < 0 || st.st_size < static_cast<off_t>(CAPTURE_HEADER_SIZE))
+    {
+        ::close(fd);
+        return false;
+    }
+
+    size_t length = static_cast<size_t>(st.st_size);
+    void * map = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+    {
+        return false;
+    }
+    data_ = static_cast<const uint8_t *>(map);
+    length_ = length;
+
+    if (::memcmp(data_, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) != 0 || get_le32(data_ + 4) != CAPTURE_VERSION)
+    {
+        close();
+        return false;
+    }
+    const char *protocol = reinterpret_cast<const char *>(data_ + CAPTURE_PROTOCOL);
+    protocol_.assign(protocol, ::strnlen(protocol, CAPTURE_PROTOCOL_SIZE));
+    offset_ = CAPTURE_HEADER_SIZE;
+
+    return true;
+}
+
+bool LinkCaptureReader::next(Record * record)
+{
+    if (data_ == nullptr || length_ - offset_ < RECORD_HEADER_SIZE)
+    {
+        return false;
+    }
+
+    const uint8_t *r = data_ + offset_;
+    uint8_t direction = r[RECORD_DIRECTION];
+    size_t length = get_le32(r + RECORD_LENGTH);
+    if ((direction != static_cast<uint8_t>(LinkCapture::Direction::RX) &&
+         direction != static_cast<uint8_t>(LinkCapture::Direction::TX)) ||
+        length > length_ - offset_ - RECORD_HEADER_SIZE)
+    {
+        return false;
+    }
+
+    record->timestamp_ns = get_le64(r + RECORD_TIMESTAMP);
+    record->direction = static_cast<LinkCapture::Direction>(direction);
+    record->data = r + RECORD_HEADER_SIZE;
+    record->length = length;
+    offset_ += RECORD_HEADER_SIZE + length;
+
+    return true;
+}
+
+void LinkCaptureReader::rewind()
+{
+    offset_ = CAPTURE_HEADER_SIZE;
+}
+
+void LinkCaptureReader::close()
+{
+    if (data_ != nullptr)
+    {
+        ::munmap(const_cast<uint8_t *>(data_), length_);
+        data_ = nullptr;
+    }
+    length_ = 0;
+    offset_ = 0;
+    protocol_.clear();
+}
+
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
@@ -0,0 +1,306 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ros2_serial_example/link_mux.hpp"
+#include "ros2_serial_example/transporter.hpp"
+#include "ros2_serial_example/tx_queue.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+constexpr unsigned LinkMux::CHANNEL_SHIFT;
+constexpr topic_id_size_t LinkMux::MAX_CHANNEL_TOPIC_ID;
+constexpr size_t LinkMux::MAX_CHANNELS;
+
+// The largest payload that is passed through, in either direction.
+static constexpr size_t BUFFER_SIZE = 65536;
+
+// The queued payloads have their topic ID in front of them.
+static constexpr size_t QUEUED_HEADER_LEN = sizeof(topic_id_size_t);
+
+// How long a reader waits before trying a transport that failed again, and
+// the longest the writer sleeps without looking at the queues.
+static constexpr std::chrono::milliseconds RETRY_INTERVAL{100};
+
+LinkMux::LinkMux(Transporter * link, const std::vector<Transporter *> & endpoints, size_t queue_depth,
+                 size_t quantum)
+    : link_(link), quantum_(quantum)
+{
+    if (link == nullptr)
+    {
+        throw std::runtime_error("LinkMux link must not be a nullptr");
+    }
+    if (endpoints.empty() || endpoints.size() > MAX_CHANNELS)
+    {
+        throw std::runtime_error("LinkMux must have between 1 and " + std::to_string(MAX_CHANNELS) + " channels");
+    }
+    if (link_topic_ID(endpoints.size() - 1, MAX_CHANNEL_TOPIC_ID) > link->get_max_topic_ID())
+    {
+        throw std::runtime_error("LinkMux link protocol '" + link->get_protocol() +
+                                 "' can't carry the topic IDs of more than one channel; use 'v2'");
+    }
+    if (queue_depth == 0)
+    {
+        throw std::runtime_error("LinkMux queue_depth must be > 0");
+    }
+    if (quantum == 0)
+    {
+        throw std::runtime_error("LinkMux quantum must be > 0");
+    }
+
+    for (Transporter *endpoint : endpoints)
+    {
+        if (endpoint == nullptr)
+        {
+            throw std::runtime_error("LinkMux endpoint must not be a nullptr");
+        }
+        channels_.push_back(std::make_unique<Channel>(endpoint, queue_depth));
+        channels_.back()->queue.reserve(QUEUED_HEADER_LEN + BUFFER_SIZE);
+    }
+}
+
+LinkMux::~LinkMux()
+{
+    stop();
+}
+
+void LinkMux::start()
+{
+    if (running_)
+    {
+        return;
+    }
+
+    running_ = true;
+    link_reader_ = std::thread(&LinkMux::link_reader_func, this);
+    for (auto & channel : channels_)
+    {
+        channel->reader = std::thread(&LinkMux::endpoint_reader_func, this, channel.get());
+    }
+    writer_ = std::thread(&LinkMux::writer_func, this);
+}
+
+void LinkMux::stop()
+{
+    if (!running_)
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = false;
+    }
+    cv_.notify_all();
+
+    // The readers notice within the read timeout of their transport.
+    writer_.join();
+    link_reader_.join();
+    for (auto & channel : channels_)
+    {
+        channel->reader.join();
+        while (channel->queue.try_pop(nullptr))
+        {
+        }
+        channel->have_head = false;
+        channel->deficit = 0;
+    }
+}
+
+LinkMux::Stats LinkMux::get_stats(size_t channel) const
+{
+    Stats stats;
+    if (channel >= channels_.size())
+    {
+        return stats;
+    }
+
+    const Channel & c = *channels_[channel];
+    stats.rx_messages = c.rx_messages;
+    stats.rx_drops = c.rx_drops;
+    stats.tx_messages = c.tx_messages;
+    stats.tx_bytes = c.tx_bytes;
+    stats.tx_drops = c.tx_drops;
+
+    return stats;
+}
+
+void LinkMux::link_reader_func()
+{
+    std::unique_ptr<uint8_t[]> buffer(new uint8_t[BUFFER_SIZE]);
+
+    while (running_)
+    {
+        ssize_t ret = link_->read_many(buffer.get(), BUFFER_SIZE,
+                                       [this](topic_id_size_t topic_ID, uint8_t *payload, size_t length)
+                                       {
+                                           size_t channel = topic_ID >> CHANNEL_SHIFT;
+                                           if (channel >= channels_.size())
+                                           {
+                                               unrouted_++;
+                                               return;
+                                           }
+
+                                           Channel *c = channels_[channel].get();
+                                           if (c->endpoint->write(topic_ID & MAX_CHANNEL_TOPIC_ID, payload, length) < 0)
+                                           {
+                                               c->rx_drops++;
+                                           }
+                                           else
+                                           {
+                                               c->rx_messages++;
+                                           }
+                                       });
+        if (ret < 0)
+        {
+            std::this_thread::sleep_for(RETRY_INTERVAL);
+        }
+    }
+}
+
+void LinkMux::endpoint_reader_func(Channel * channel)
+{
+    std::unique_ptr<uint8_t[]> buffer(new uint8_t[BUFFER_SIZE]);
+    // The payload is put together here and swapped into the queue, which
+    // hands back a buffer of the same size, so this doesn't allocate once
+    // the queue is warmed up.
+    std::vector<uint8_t> queued;
+    queued.reserve(QUEUED_HEADER_LEN + BUFFER_SIZE);
+
+    while (running_)
+    {
+        bool pushed = false;
+        ssize_t ret = channel->endpoint->read_many(buffer.get(), BUFFER_SIZE,
+                                                   [channel, &queued, &pushed](topic_id_size_t topic_ID,
+                                                                               uint8_t *payload, size_t length)
+                                                   {
+                                                       if (topic_ID > MAX_CHANNEL_TOPIC_ID)
+                                                       {
+                                                           channel->tx_drops++;
+                                                           return;
+                                                       }
+
+                                                       queued.resize(QUEUED_HEADER_LEN + length);
+                                                       ::memcpy(queued.data(), &topic_ID, QUEUED_HEADER_LEN);
+                                                       ::memcpy(queued.data() + QUEUED_HEADER_LEN, payload, length);
+                                                       if (!channel->queue.try_push(&queued))
+                                                       {
+                                                           channel->tx_drops++;
+                                                           return;
+                                                       }
+                                                       pushed = true;
+                                                   });
+        if (ret < 0)
+        {
+            std::this_thread::sleep_for(RETRY_INTERVAL);
+        }
+
+        // The writer is told once for everything that came in with one read.
+        if (pushed)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                queued_ = true;
+            }
+            cv_.notify_one();
+        }
+    }
+}
+
+bool LinkMux::write_round()
+{
+    // Deficit round robin: each channel with payloads waiting gets quantum_
+    // more bytes to spend each round, and sends payloads for as long as the
+    // next one fits in what it has.  A payload larger than that waits for
+    // the rounds it takes to save up for it, so a channel of large payloads
+    // gets no more of the link than one of small payloads.
+    bool busy = false;
+    for (size_t channel = 0; channel < channels_.size(); ++channel)
+    {
+        Channel *c = channels_[channel].get();
+        if (!c->have_head)
+        {
+            c->have_head = c->queue.try_pop(&c->head);
+            if (!c->have_head)
+            {
+                // A channel doesn't save up while it has nothing to send.
+                c->deficit = 0;
+                continue;
+            }
+        }
+
+        c->deficit += quantum_;
+        while (c->have_head && c->head.size() - QUEUED_HEADER_LEN <= c->deficit)
+        {
+            topic_id_size_t topic_ID;
+            ::memcpy(&topic_ID, c->head.data(), QUEUED_HEADER_LEN);
+            size_t length = c->head.size() - QUEUED_HEADER_LEN;
+            c->deficit -= length;
+
+            if (link_->write(link_topic_ID(channel, topic_ID), c->head.data() + QUEUED_HEADER_LEN, length) < 0)
+            {
+                c->tx_drops++;
+            }
+            else
+            {
+                c->tx_messages++;
+                c->tx_bytes += length;
+            }
+
+            c->have_head = c->queue.try_pop(&c->head);
+        }
+        if (!c->have_head)
+        {
+            c->deficit = 0;
+        }
+
+        busy = busy || c->have_head;
+    }
+
+    return busy;
+}
+
+void LinkMux::writer_func()
+{
+    while (running_)
+    {
+        if (write_round())
+        {
+            continue;
+        }
+
+        // Everything was sent; wait for a reader to queue more.  A payload
+        // queued since the round started has set queued_, so it isn't
+        // missed.
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait_for(lock, RETRY_INTERVAL, [this]() { return queued_ || !running_; });
+        queued_ = false;
+    }
+}
+
+}  // namespace transport
+
+}  // namespace ros2_to_serial_bridge
@@ -0,0 +1,75 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "ros2_serial_example/link_negotiation.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+bool negotiate_link(const LinkCapabilities & local, const LinkCapabilities & remote, LinkSettings * out)
+{
+    // In order of preference.
+    static const char * const protocols[] = {"v2", "cobs_zpe", "cobs", "px4"};
+
+    LinkSettings settings;
+    for (const char * protocol : protocols)
+    {
+        if (std::find(local.protocols.begin(), local.protocols.end(), protocol) != local.protocols.end() &&
+            std::find(remote.protocols.begin(), remote.protocols.end(), protocol) != remote.protocols.end())
+        {
+            settings.protocol = protocol;
+            break;
+        }
+    }
+    if (settings.protocol.empty())
+    {
+        return false;
+    }
+
+    for (uint32_t baudrate : local.baudrates)
+    {
+        if (baudrate > settings.baudrate &&
+            std::find(remote.baudrates.begin(), remote.baudrates.end(), baudrate) != remote.baudrates.end())
+        {
+            settings.baudrate = baudrate;
+        }
+    }
+
+    if (local.max_frame_size == 0 || remote.max_frame_size == 0)
+    {
+        settings.max_frame_size = std::max(local.max_frame_size, remote.max_frame_size);
+    }
+    else
+    {
+        settings.max_frame_size = std::min(local.max_frame_size, remote.max_frame_size);
+    }
+
+    settings.compression = settings.protocol == "v2" && local.compression && remote.compression;
+    settings.batching = local.batching && remote.batching;
+
+    *out = settings;
+
+    return true;
+}
+
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
@@ -0,0 +1,482 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "ros2_serial_example/load_generator.hpp"
+#include "ros2_serial_example/metrics.hpp"
+#include "ros2_serial_example/topic_id.hpp"
+#include "ros2_serial_example/transporter.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace loadgen
+{
+
+namespace
+{
+
+// The topic IDs of the generator start above the ones the dummy programs
+// use for their other topics; each topic takes an out and an in ID.
+constexpr topic_id_size_t FIRST_TOPIC_ID = 20;
+
+// The offsets of the fields in the serialized message.  The CDR of a
+// std_msgs/UInt8MultiArray is the length of layout.dim (always 0 here),
+// layout.data_offset, the length of data and then data itself, and the data
+// starts with the sequence number and the send time.
+constexpr size_t DIM_LENGTH_OFFSET = 0;
+constexpr size_t DATA_OFFSET_OFFSET = 4;
+constexpr size_t DATA_LENGTH_OFFSET = 8;
+constexpr size_t SEQ_OFFSET = 12;
+constexpr size_t SEND_TIME_OFFSET = 16;
+
+void set_ids(size_t index, TopicLoad * load)
+{
+    load->out_topic_ID = static_cast<topic_id_size_t>(FIRST_TOPIC_ID + 2 * index);
+    load->in_topic_ID = static_cast<topic_id_size_t>(FIRST_TOPIC_ID + 2 * index + 1);
+}
+
+bool parse_number(const std::string & str, double * out)
+{
+    if (str.empty())
+    {
+        return false;
+    }
+    char *endptr;
+    errno = 0;
+    *out = ::strtod(str.c_str(), &endptr);
+    return errno != ERANGE && *endptr == '\0';
+}
+
+}  // namespace
+
+constexpr size_t LoadGenerator::MIN_SIZE;
+
+LoadGenerator::LoadGenerator(transport::Transporter * transporter, const std::vector<TopicLoad> & topics)
+    : transporter_(transporter), topics_(topics)
+{
+    size_t max_size = 0;
+    for (const TopicLoad & t : topics_)
+    {
+        if (t.size < MIN_SIZE)
+        {
+            throw std::runtime_error("Topic '" + t.name + "' is smaller than the minimum size of " + std::to_string(MIN_SIZE));
+        }
+        if (!(t.rate_hz > 0.0) || t.burst == 0)
+        {
+            throw std::runtime_error("Topic '" + t.name + "' must have a positive rate and burst");
+        }
+        max_size = std::max(max_size, t.size);
+
+        std::unique_ptr<TopicState> state = std::make_unique<TopicState>();
+        state->load = t;
+        state->period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / t.rate_hz));
+        states_.push_back(std::move(state));
+    }
+    send_buffer_ = std::unique_ptr<uint8_t[]>(new uint8_t[max_size]{});
+}
+
+LoadGenerator::~LoadGenerator()
+{
+}
+
+bool LoadGenerator::parse_topic_load(const std::string & spec, size_t index, TopicLoad * out)
+{
+    std::vector<std::string> fields;
+    size_t start = 0;
+    size_t colon;
+    while ((colon = spec.find(':', start)) != std::string::npos)
+    {
+        fields.push_back(spec.substr(start, colon - start));
+        start = colon + 1;
+    }
+    fields.push_back(spec.substr(start));
+
+    if (fields.size() < 2 || fields.size() > 3)
+    {
+        return false;
+    }
+
+    double size;
+    double rate_hz;
+    double burst = 1.0;
+    if (!parse_number(fields[0], &size) || !parse_number(fields[1], &rate_hz) ||
+        (fields.size() == 3 && !parse_number(fields[2], &burst)))
+    {
+        return false;
+    }
+    if (size < MIN_SIZE || std::floor(size) != size || !(rate_hz > 0.0) ||
+        burst < 1.0 || burst > UINT32_MAX || std::floor(burst) != burst)
+    {
+        return false;
+    }
+
+    out->name = "load" + std::to_string(index);
+    set_ids(index, out);
+    out->size = static_cast<size_t>(size);
+    out->rate_hz = rate_hz;
+    out->burst = static_cast<uint32_t>(burst);
+
+    return true;
+}
+
+std::vector<TopicLoad> LoadGenerator::px4_mix(size_t first_index)
+{
+    // The sizes are roughly those of the CDR serialization of the px4_msgs
+    // types, and the rates those of a typical microRTPS client setup.
+    std::vector<TopicLoad> topics = {
+        {"sensor_combined", 0, 0, 72, 200.0, 1},
+        {"vehicle_attitude", 0, 0, 48, 100.0, 1},
+        {"vehicle_local_position", 0, 0, 160, 50.0, 1},
+        {"vehicle_gps_position", 0, 0, 112, 10.0, 1},
+        {"battery_status", 0, 0, 176, 10.0, 1},
+        {"vehicle_status", 0, 0, 96, 2.0, 1},
+        {"log_message", 0, 0, 136, 1.0, 5},
+    };
+    for (size_t i = 0; i < topics.size(); ++i)
+    {
+        set_ids(first_index + i, &topics[i]);
+    }
+
+    return topics;
+}
+
+void LoadGenerator::encode(uint32_t seq, Clock::time_point send_time, uint8_t * buffer, size_t size)
+{
+    uint32_t dim_length = 0;
+    uint32_t data_offset = 0;
+    uint32_t data_length = static_cast<uint32_t>(size - SEQ_OFFSET);
+    int64_t send_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(send_time.time_since_epoch()).count();
+
+    ::memcpy(buffer + DIM_LENGTH_OFFSET, &dim_length, sizeof(dim_length));
+    ::memcpy(buffer + DATA_OFFSET_OFFSET, &data_offset, sizeof(data_offset));
+    ::memcpy(buffer + DATA_LENGTH_OFFSET, &data_length, sizeof(data_length));
+    ::memcpy(buffer + SEQ_OFFSET, &seq, sizeof(seq));
+    ::memcpy(buffer + SEND_TIME_OFFSET, &send_ns, sizeof(send_ns));
+
+    // Fill the rest with bytes that change from message to message, so that
+    // compression and delta encoding see something like sensor data rather
+    // than a block of zeros.
+    uint32_t x = seq * 2654435761U + 1;
+    for (size_t i = MIN_SIZE; i < size; ++i)
+    {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        buffer[i] = static_cast<uint8_t>(x);
+    }
+}
+
+bool LoadGenerator::decode(const uint8_t * buffer, size_t length, uint32_t * seq, Clock::time_point * send_time)
+{
+    if (length < MIN_SIZE)
+    {
+        return false;
+    }
+
+    uint32_t dim_length;
+    uint32_t data_length;
+    ::memcpy(&dim_length, buffer + DIM_LENGTH_OFFSET, sizeof(dim_length));
+    ::memcpy(&data_length, buffer + DATA_LENGTH_OFFSET, sizeof(data_length));
+    if (dim_length != 0 || data_length != length - SEQ_OFFSET)
+    {
+        return false;
+    }
+
+    int64_t send_ns;
+    ::memcpy(seq, buffer + SEQ_OFFSET, sizeof(*seq));
+    ::memcpy(&send_ns, buffer + SEND_TIME_OFFSET, sizeof(send_ns));
+    *send_time = Clock::time_point(std::chrono::duration_cast<Clock::duration>(std::chrono::nanoseconds(send_ns)));
+
+    return true;
+}
+
+const std::vector<TopicLoad> & LoadGenerator::get_topics() const
+{
+    return topics_;
+}
+
+LoadGenerator::Clock::time_point LoadGenerator::send_due(Clock::time_point now)
+{
+    if (!started_)
+    {
+        for (std::unique_ptr<TopicState> & state : states_)
+        {
+            state->next_send = now;
+        }
+        started_ = true;
+    }
+
+    Clock::time_point next = Clock::time_point::max();
+    for (std::unique_ptr<TopicState> & state : states_)
+    {
+        while (state->next_send <= now)
+        {
+            for (uint32_t i = 0; i < state->load.burst; ++i)
+            {
+                uint32_t seq = static_cast<uint32_t>(state->sent.load(std::memory_order_relaxed));
+                encode(seq, Clock::now(), send_buffer_.get(), state->load.size);
+                if (transporter_->write(state->load.out_topic_ID, send_buffer_.get(), state->load.size) < 0)
+                {
+                    ::fprintf(stderr, "Failed to write topic %d: %s\n", state->load.out_topic_ID, ::strerror(errno));
+                }
+                // A message that failed to write is still counted, and will
+                // show up as lost.
+                state->sent.fetch_add(1, std::memory_order_relaxed);
+            }
+            state->next_send += state->period;
+        }
+        next = std::min(next, state->next_send);
+    }
+
+    return next;
+}
+
+bool LoadGenerator::receive(topic_id_size_t topic_ID, const uint8_t * buffer, size_t length, Clock::time_point now)
+{
+    std::vector<std::unique_ptr<TopicState>>::iterator it = std::find_if(states_.begin(), states_.end(),
+        [topic_ID](const std::unique_ptr<TopicState> & s) {
+            return s->load.in_topic_ID == topic_ID;
+        });
+    if (it == states_.end())
+    {
+        return false;
+    }
+    TopicState & state = **it;
+
+    uint32_t seq;
+    Clock::time_point send_time;
+    if (!decode(buffer, length, &seq, &send_time))
+    {
+        ::fprintf(stderr, "Topic ID %d: message of length %zu doesn't decode\n", topic_ID, length);
+        return true;
+    }
+
+    if (seq >= state.seen.size())
+    {
+        state.seen.resize(std::max(static_cast<size_t>(seq) + 1, state.seen.size() * 2));
+    }
+    if (state.seen[seq])
+    {
+        state.duplicates.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+    state.seen[seq] = true;
+
+    if (state.any_received && seq < state.highest_seq)
+    {
+        state.reordered.fetch_add(1, std::memory_order_relaxed);
+    }
+    else
+    {
+        state.highest_seq = seq;
+        state.any_received = true;
+    }
+
+    Clock::duration rtt = now - send_time;
+    state.rtt.record(rtt.count() > 0 ? static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(rtt).count()) : 0);
+    state.bytes.fetch_add(length, std::memory_order_relaxed);
+    state.received.fetch_add(1, std::memory_order_relaxed);
+
+    return true;
+}
+
+void LoadGenerator::report(std::vector<TopicReport> * out) const
+{
+    out->clear();
+    transport::impl::LatencyHistogram::Snapshot rtt;
+    for (const std::unique_ptr<TopicState> & state : states_)
+    {
+        TopicReport r;
+        r.name = state->load.name;
+        r.received = state->received.load(std::memory_order_relaxed);
+        r.sent = state->sent.load(std::memory_order_relaxed);
+        r.lost = r.sent > r.received ? r.sent - r.received : 0;
+        r.reordered = state->reordered.load(std::memory_order_relaxed);
+        r.duplicates = state->duplicates.load(std::memory_order_relaxed);
+        r.bytes = state->bytes.load(std::memory_order_relaxed);
+        state->rtt.snapshot(&rtt);
+        r.rtt_p50_ns = rtt.percentile(50.0);
+        r.rtt_p99_ns = rtt.percentile(99.0);
+        r.rtt_p999_ns = rtt.percentile(99.9);
+        r.rtt_max_ns = rtt.max;
+        out->push_back(r);
+    }
+}
+
+void LoadGenerator::print_report(FILE * out, const std::vector<TopicReport> & reports, double elapsed_s)
+{
+    ::fprintf(out, "%-24s %10s %10s %8s %8s %6s %10s %10s %10s %10s %10s %10s\n",
+              "topic", "sent", "received", "lost", "reorder", "dup", "msg/s", "kB/s",
+              "p50 us", "p99 us", "p99.9 us", "max us");
+    for (const TopicReport & r : reports)
+    {
+        double msgs_per_s = elapsed_s > 0.0 ? r.received / elapsed_s : 0.0;
+        double kbytes_per_s = elapsed_s > 0.0 ? r.bytes / elapsed_s / 1000.0 : 0.0;
+        ::fprintf(out, "%-24s %10lu %10lu %8lu %8lu %6lu %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+                  r.name.c_str(),
+                  static_cast<unsigned long>(r.sent),
+                  static_cast<unsigned long>(r.received),
+                  static_cast<unsigned long>(r.lost),
+                  static_cast<unsigned long>(r.reordered),
+                  static_cast<unsigned long>(r.duplicates),
+                  msgs_per_s, kbytes_per_s,
+                  r.rtt_p50_ns / 1000.0, r.rtt_p99_ns / 1000.0,
+                  r.rtt_p999_ns / 1000.0, r.rtt_max_ns / 1000.0);
+    }
+}
+
+void LoadGenerator::write_json_report(FILE * out, const std::string & link, const std::string & protocol,
+                                      const std::vector<TopicReport> & reports, double elapsed_s,
+                                      const ProcessUsage * start, const ProcessUsage * end)
+{
+    ::fprintf(out, "{\"link\": \"%s\", \"protocol\": \"%s\", \"elapsed_s\": %.3f", link.c_str(), protocol.c_str(), elapsed_s);
+    if (start != nullptr && end != nullptr && elapsed_s > 0.0)
+    {
+        ::fprintf(out, ", \"bridge_cpu_percent\": %.1f, \"bridge_max_rss_kb\": %lu",
+                  (end->cpu_s - start->cpu_s) / elapsed_s * 100.0, static_cast<unsigned long>(end->max_rss_kb));
+    }
+    ::fprintf(out, ", \"topics\": [");
+    for (size_t i = 0; i < reports.size(); ++i)
+    {
+        const TopicReport & r = reports[i];
+        ::fprintf(out, "%s{\"name\": \"%s\", \"sent\": %lu, \"received\": %lu, \"lost\": %lu, \"reordered\": %lu, "
+                  "\"duplicates\": %lu, \"bytes\": %lu, \"rtt_p50_us\": %.1f, \"rtt_p99_us\": %.1f, "
+                  "\"rtt_p999_us\": %.1f, \"rtt_max_us\": %.1f}",
+                  i == 0 ? "" : ", ", r.name.c_str(),
+                  static_cast<unsigned long>(r.sent),
+                  static_cast<unsigned long>(r.received),
+                  static_cast<unsigned long>(r.lost),
+                  static_cast<unsigned long>(r.reordered),
+                  static_cast<unsigned long>(r.duplicates),
+                  static_cast<unsigned long>(r.bytes),
+                  r.rtt_p50_ns / 1000.0, r.rtt_p99_ns / 1000.0,
+                  r.rtt_p999_ns / 1000.0, r.rtt_max_ns / 1000.0);
+    }
+    ::fprintf(out, "]}\n");
+}
+
+pid_t LoadGenerator::find_process(const std::string & name)
+{
+    DIR * proc = ::opendir("/proc");
+    if (proc == nullptr)
+    {
+        return -1;
+    }
+
+    pid_t found = -1;
+    struct dirent * entry;
+    while (found < 0 && (entry = ::readdir(proc)) != nullptr)
+    {
+        char *endptr;
+        long pid = ::strtol(entry->d_name, &endptr, 10);
+        if (*entry->d_name == '\0' || *endptr != '\0' || pid <= 0)
+        {
+            continue;
+        }
+
+        // The first string of the command line is the executable, as it was
+        // started.
+        std::string path = std::string("/proc/") + entry->d_name + "/cmdline";
+        FILE * f = ::fopen(path.c_str(), "r");
+        if (f == nullptr)
+        {
+            continue;
+        }
+        char cmdline[4096];
+        size_t n = ::fread(cmdline, 1, sizeof(cmdline) - 1, f);
+        ::fclose(f);
+        cmdline[n] = '\0';
+        const char * base = ::strrchr(cmdline, '/');
+        base = base == nullptr ? cmdline : base + 1;
+        if (n > 0 && name == base)
+        {
+            found = static_cast<pid_t>(pid);
+        }
+    }
+    ::closedir(proc);
+
+    return found;
+}
+
+bool LoadGenerator::read_process_usage(pid_t pid, ProcessUsage * out)
+{
+    std::string dir = "/proc/" + std::to_string(pid);
+
+    // The user and system times are the 14th and 15th fields of stat; the
+    // name in the 2nd can have spaces in it, so the fields are counted from
+    // the parenthesis that ends it.
+    FILE * f = ::fopen((dir + "/stat").c_str(), "r");
+    if (f == nullptr)
+    {
+        return false;
+    }
+    char stat[1024];
+    size_t n = ::fread(stat, 1, sizeof(stat) - 1, f);
+    ::fclose(f);
+    stat[n] = '\0';
+    const char * p = ::strrchr(stat, ')');
+    unsigned long utime;
+    unsigned long stime;
+    if (p == nullptr ||
+        ::sscanf(p + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2)
+    {
+        return false;
+    }
+    long ticks = ::sysconf(_SC_CLK_TCK);
+    if (ticks <= 0)
+    {
+        return false;
+    }
+    out->cpu_s = static_cast<double>(utime + stime) / ticks;
+
+    f = ::fopen((dir + "/status").c_str(), "r");
+    if (f == nullptr)
+    {
+        return false;
+    }
+    char line[256];
+    bool found = false;
+    while (!found && ::fgets(line, sizeof(line), f) != nullptr)
+    {
+        unsigned long kb;
+        if (::sscanf(line, "VmHWM: %lu kB", &kb) == 1)
+        {
+            out->max_rss_kb = kb;
+            found = true;
+        }
+    }
+    ::fclose(f);
+
+    return found;
+}
+
+}  // namespace loadgen
+}  // namespace ros2_to_serial_bridge
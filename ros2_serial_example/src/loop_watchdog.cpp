@@ -0,0 +1,179 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "ros2_serial_example/loop_watchdog.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+constexpr size_t LoopWatchdog::MAX_STALL_TOPICS;
+constexpr int32_t LoopWatchdog::NO_TOPIC;
+constexpr size_t LoopWatchdog::NO_ENTRY;
+
+static int64_t to_ns(LoopWatchdog::Clock::time_point t)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+}
+
+void LoopWatchdog::set_threshold(std::chrono::nanoseconds threshold)
+{
+    threshold_ns_.store(std::max(threshold.count(), static_cast<std::chrono::nanoseconds::rep>(0)),
+                        std::memory_order_relaxed);
+}
+
+void LoopWatchdog::begin(Clock::time_point now)
+{
+    if (now == Clock::time_point())
+    {
+        return;
+    }
+
+    topic_.store(NO_TOPIC, std::memory_order_relaxed);
+    // 0 means that no pass is in progress.
+    pass_start_ns_.store(std::max(to_ns(now), static_cast<int64_t>(1)), std::memory_order_relaxed);
+}
+
+bool LoopWatchdog::end(Clock::time_point now, uint64_t ring_overflows)
+{
+    int64_t start_ns = pass_start_ns_.exchange(0, std::memory_order_relaxed);
+    if (start_ns == 0 || now == Clock::time_point())
+    {
+        return false;
+    }
+
+    int64_t now_ns = to_ns(now);
+    uint64_t ns = now_ns > start_ns ? static_cast<uint64_t>(now_ns - start_ns) : 0;
+    passes_.record(ns);
+
+    uint64_t new_overflows = ring_overflows >= last_ring_overflows_ ? ring_overflows - last_ring_overflows_ : 0;
+    last_ring_overflows_ = ring_overflows;
+
+    int64_t threshold_ns = threshold_ns_.load(std::memory_order_relaxed);
+    bool stalled = threshold_ns > 0 && ns >= static_cast<uint64_t>(threshold_ns);
+    if (!stalled && !(last_stalled_ && new_overflows > 0))
+    {
+        last_stalled_ = false;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(stall_mutex_);
+
+    size_t entry = NO_ENTRY;
+    if (stalled)
+    {
+        int32_t topic = topic_.load(std::memory_order_relaxed);
+        stalls_++;
+        stall_ns_ += ns;
+        max_stall_ns_ = std::max(max_stall_ns_, ns);
+        last_stall_.duration_ns = ns;
+        last_stall_.has_topic = topic != NO_TOPIC;
+        last_stall_.topic_ID = last_stall_.has_topic ? static_cast<topic_id_size_t>(topic) : 0;
+
+        entry = stall_entry(topic);
+        if (entry != NO_ENTRY)
+        {
+            TopicStalls & t = topic_stalls_[entry];
+            t.stalls++;
+            t.total_ns += ns;
+            t.max_ns = std::max(t.max_ns, ns);
+        }
+    }
+
+    // The transport isn't drained while the pass stalls, so the overflows
+    // only show up in the next read; they go to the stall before if there
+    // was one, and otherwise to this one.
+    if (new_overflows > 0)
+    {
+        size_t overflow_entry = last_stalled_ ? last_stall_entry_ : entry;
+        stall_ring_overflows_ += new_overflows;
+        if (overflow_entry != NO_ENTRY)
+        {
+            topic_stalls_[overflow_entry].ring_overflows += new_overflows;
+        }
+    }
+
+    last_stalled_ = stalled;
+    last_stall_entry_ = entry;
+
+    return stalled;
+}
+
+bool LoopWatchdog::check(Clock::time_point now, Stall * stall) const
+{
+    int64_t threshold_ns = threshold_ns_.load(std::memory_order_relaxed);
+    int64_t start_ns = pass_start_ns_.load(std::memory_order_relaxed);
+    int64_t now_ns = to_ns(now);
+    if (threshold_ns <= 0 || start_ns == 0 || now_ns - start_ns < threshold_ns)
+    {
+        return false;
+    }
+
+    int32_t topic = topic_.load(std::memory_order_relaxed);
+    stall->duration_ns = static_cast<uint64_t>(now_ns - start_ns);
+    stall->has_topic = topic != NO_TOPIC;
+    stall->topic_ID = stall->has_topic ? static_cast<topic_id_size_t>(topic) : 0;
+
+    return true;
+}
+
+void LoopWatchdog::snapshot(Snapshot * out) const
+{
+    out->threshold_ns = static_cast<uint64_t>(threshold_ns_.load(std::memory_order_relaxed));
+    passes_.snapshot(&out->passes);
+
+    std::lock_guard<std::mutex> lock(stall_mutex_);
+    out->stalls = stalls_;
+    out->stall_ns = stall_ns_;
+    out->max_stall_ns = max_stall_ns_;
+    out->stall_ring_overflows = stall_ring_overflows_;
+    out->last_stall = last_stall_;
+    out->topics.assign(topic_stalls_.begin(), topic_stalls_.begin() + num_topic_stalls_);
+}
+
+size_t LoopWatchdog::stall_entry(int32_t topic)
+{
+    bool has_topic = topic != NO_TOPIC;
+    topic_id_size_t topic_ID = has_topic ? static_cast<topic_id_size_t>(topic) : 0;
+    for (size_t i = 0; i < num_topic_stalls_; ++i)
+    {
+        if (topic_stalls_[i].has_topic == has_topic && topic_stalls_[i].topic_ID == topic_ID)
+        {
+            return i;
+        }
+    }
+
+    if (num_topic_stalls_ == MAX_STALL_TOPICS)
+    {
+        return NO_ENTRY;
+    }
+    TopicStalls & t = topic_stalls_[num_topic_stalls_];
+    t.has_topic = has_topic;
+    t.topic_ID = topic_ID;
+
+    return num_topic_stalls_++;
+}
+
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
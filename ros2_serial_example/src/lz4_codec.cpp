@@ -0,0 +1,325 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "ros2_serial_example/lz4_codec.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+namespace impl
+{
+
+// The limits that the block format puts on matches: they are at least 4
+// bytes long, can refer at most 65535 bytes back, must start at least 12
+// bytes before the end of the block, and the last 5 bytes of the block are
+// always literals.
+constexpr size_t LZ4_MIN_MATCH = 4;
+constexpr size_t LZ4_MAX_OFFSET = 65535;
+constexpr size_t LZ4_MFLIMIT = 12;
+constexpr size_t LZ4_LAST_LITERALS = 5;
+
+constexpr unsigned int LZ4_HASH_LOG = 12;
+constexpr uint32_t LZ4_NO_POSITION = UINT32_MAX;
+
+static uint32_t lz4_read32(const uint8_t *p)
+{
+    uint32_t v;
+    ::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t lz4_hash(const uint8_t *p)
+{
+    return (lz4_read32(p) * 2654435761U) >> (32U - LZ4_HASH_LOG);
+}
+
+// Write the extra bytes of a literal or match length that didn't fit in the
+// 4 bits of the token.
+static uint8_t *lz4_write_length(uint8_t *op, size_t len)
+{
+    while (len >= 255)
+    {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = static_cast<uint8_t>(len);
+
+    return op;
+}
+
+// The number of bytes lz4_write_length() writes for a length that didn't
+// fit in the token (or 0 if it did).
+static size_t lz4_length_bytes(size_t len)
+{
+    return (len < 15) ? 0 : (len - 15) / 255 + 1;
+}
+
+LZ4Codec::LZ4Codec(const std::vector<uint8_t> & dictionary)
+    : seeded_table_(1U << LZ4_HASH_LOG, LZ4_NO_POSITION), table_(1U << LZ4_HASH_LOG)
+{
+    size_t dict_len = std::min(dictionary.size(), LZ4_MAX_OFFSET);
+    dict_.assign(dictionary.end() - dict_len, dictionary.end());
+    work_ = dict_;
+
+    for (size_t pos = 0; pos + LZ4_MIN_MATCH <= dict_len; ++pos)
+    {
+        seeded_table_[lz4_hash(&dict_[pos])] = static_cast<uint32_t>(pos);
+    }
+}
+
+size_t LZ4Codec::compress(const struct iovec *iov, int iovcnt, uint8_t *dst, size_t dst_len)
+{
+    size_t dict_len = dict_.size();
+    size_t len = 0;
+    for (int i = 0; i < iovcnt; ++i)
+    {
+        len += iov[i].iov_len;
+    }
+
+    work_.resize(dict_len + len);
+    size_t offset = dict_len;
+    for (int i = 0; i < iovcnt; ++i)
+    {
+        if (iov[i].iov_len > 0)
+        {
+            ::memcpy(&work_[offset], iov[i].iov_base, iov[i].iov_len);
+        }
+        offset += iov[i].iov_len;
+    }
+
+    table_ = seeded_table_;
+
+    const uint8_t *base = work_.data();
+    const uint8_t *src = base + dict_len;
+    const uint8_t *end = src + len;
+    const uint8_t *anchor = src;
+    uint8_t *op = dst;
+    uint8_t *oend = dst + dst_len;
+
+    if (len > LZ4_MFLIMIT)
+    {
+        const uint8_t *mflimit = end - LZ4_MFLIMIT;
+        const uint8_t *matchlimit = end - LZ4_LAST_LITERALS;
+        const uint8_t *ip = src;
+
+        while (ip <= mflimit)
+        {
+            uint32_t h = lz4_hash(ip);
+            uint32_t candidate = table_[h];
+            table_[h] = static_cast<uint32_t>(ip - base);
+
+            if (candidate == LZ4_NO_POSITION || static_cast<size_t>(ip - base) - candidate > LZ4_MAX_OFFSET ||
+                lz4_read32(base + candidate) != lz4_read32(ip))
+            {
+                // Skip ahead faster the longer we go without a match, so that
+                // incompressible data doesn't cost much.
+                ip += 1 + ((ip - anchor) >> 6U);
+                continue;
+            }
+
+            size_t match_offset = static_cast<size_t>(ip - base) - candidate;
+            const uint8_t *match_end = ip + LZ4_MIN_MATCH;
+            while (match_end < matchlimit && *match_end == *(match_end - match_offset))
+            {
+                ++match_end;
+            }
+
+            size_t literal_len = ip - anchor;
+            size_t match_len = (match_end - ip) - LZ4_MIN_MATCH;
+            size_t needed = 1 + lz4_length_bytes(literal_len) + literal_len + 2 + lz4_length_bytes(match_len);
+            if (static_cast<size_t>(oend - op) < needed)
+            {
+                return 0;
+            }
+
+            uint8_t *token = op++;
+            *token = static_cast<uint8_t>((std::min<size_t>(literal_len, 15) << 4U) | std::min<size_t>(match_len, 15));
+            if (literal_len >= 15)
+            {
+                op = lz4_write_length(op, literal_len - 15);
+            }
+            ::memcpy(op, anchor, literal_len);
+            op += literal_len;
+
+            *op++ = static_cast<uint8_t>(match_offset & 0xffU);
+            *op++ = static_cast<uint8_t>(match_offset >> 8U);
+            if (match_len >= 15)
+            {
+                op = lz4_write_length(op, match_len - 15);
+            }
+
+            ip = match_end;
+            anchor = ip;
+
+            // Remember a position inside the match too, which helps with
+            // data that repeats with a short period.
+            if (ip <= mflimit)
+            {
+                table_[lz4_hash(ip - 2)] = static_cast<uint32_t>(ip - 2 - base);
+            }
+        }
+    }
+
+    // The rest of the data goes into a final sequence of only literals.
+    size_t literal_len = end - anchor;
+    size_t needed = 1 + lz4_length_bytes(literal_len) + literal_len;
+    if (static_cast<size_t>(oend - op) < needed)
+    {
+        return 0;
+    }
+
+    *op++ = static_cast<uint8_t>(std::min<size_t>(literal_len, 15) << 4U);
+    if (literal_len >= 15)
+    {
+        op = lz4_write_length(op, literal_len - 15);
+    }
+    if (literal_len > 0)
+    {
+        ::memcpy(op, anchor, literal_len);
+        op += literal_len;
+    }
+
+    return op - dst;
+}
+
+ssize_t LZ4Codec::decompress(const uint8_t *src, size_t len, uint8_t *dst, size_t dst_len) const
+{
+    const uint8_t *ip = src;
+    const uint8_t *iend = src + len;
+    uint8_t *op = dst;
+    uint8_t *oend = dst + dst_len;
+
+    while (true)
+    {
+        if (ip == iend)
+        {
+            return -1;
+        }
+        uint8_t token = *ip++;
+
+        size_t literal_len = token >> 4U;
+        if (literal_len == 15)
+        {
+            uint8_t b;
+            do
+            {
+                if (ip == iend)
+                {
+                    return -1;
+                }
+                b = *ip++;
+                literal_len += b;
+            } while (b == 255);
+        }
+
+        if (static_cast<size_t>(iend - ip) < literal_len || static_cast<size_t>(oend - op) < literal_len)
+        {
+            return -1;
+        }
+        if (literal_len > 0)
+        {
+            ::memcpy(op, ip, literal_len);
+        }
+        op += literal_len;
+        ip += literal_len;
+
+        if (ip == iend)
+        {
+            // The last sequence has no match.
+            break;
+        }
+
+        if (iend - ip < 2)
+        {
+            return -1;
+        }
+        size_t match_offset = ip[0] | (static_cast<size_t>(ip[1]) << 8U);
+        ip += 2;
+
+        size_t match_len = token & 0xfU;
+        if (match_len == 15)
+        {
+            uint8_t b;
+            do
+            {
+                if (ip == iend)
+                {
+                    return -1;
+                }
+                b = *ip++;
+                match_len += b;
+            } while (b == 255);
+        }
+        match_len += LZ4_MIN_MATCH;
+
+        size_t out_pos = op - dst;
+        if (match_offset == 0 || match_offset > out_pos + dict_.size() ||
+            static_cast<size_t>(oend - op) < match_len)
+        {
+            return -1;
+        }
+
+        const uint8_t *match;
+        if (match_offset > out_pos)
+        {
+            // The match starts in the dictionary, and may run on into the
+            // output.
+            size_t back = match_offset - out_pos;
+            size_t from_dict = std::min(back, match_len);
+            ::memcpy(op, dict_.data() + dict_.size() - back, from_dict);
+            op += from_dict;
+            match_len -= from_dict;
+            match = dst;
+        }
+        else
+        {
+            match = op - match_offset;
+        }
+
+        if (static_cast<size_t>(op - match) >= match_len)
+        {
+            ::memcpy(op, match, match_len);
+            op += match_len;
+        }
+        else
+        {
+            // The match overlaps the bytes being written, which is how runs
+            // are encoded; copy a byte at a time.
+            for (size_t i = 0; i < match_len; ++i)
+            {
+                *op++ = *match++;
+            }
+        }
+    }
+
+    return op - dst;
+}
+
+}  // namespace impl
+
+}  // namespace transport
+
+}  // namespace ros2_to_serial_bridge
@@ -0,0 +1,144 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "ros2_serial_example/crc32c.hpp"
+#include "ros2_serial_example/mapping_cache.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+namespace
+{
+
+// The file is the magic, the length of the payload and its CRC-32C, all
+// little-endian, followed by the payload.
+constexpr uint8_t CACHE_MAGIC[4] = {'R', '2', 'S', 'M'};
+constexpr size_t CACHE_HEADER_SIZE = 12;
+// A SerialMapping is never anywhere near this big; anything larger is junk.
+constexpr uint32_t CACHE_MAX_PAYLOAD = 1024 * 1024;
+
+void put_le32(uint8_t * p, uint32_t v)
+{
+    p[0] = static_cast<uint8_t>(v);
+    p[1] = static_cast<uint8_t>(v >> 8);
+    p[2] = static_cast<uint8_t>(v >> 16);
+    p[3] = static_cast<uint8_t>(v >> 24);
+}
+
+uint32_t get_le32(const uint8_t * p)
+{
+    return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+           (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+}  // namespace
+
+MappingCache::MappingCache(const std::string & dir, const std::string & device)
+{
+    char name[64];
+    ::snprintf(name, sizeof(name), "serial_mapping_%016llx.bin", static_cast<unsigned long long>(hash_device(device)));
+    path_ = dir.empty() ? std::string(name) : dir + "/" + name;
+}
+
+uint64_t MappingCache::hash_device(const std::string & device)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (char c : device)
+    {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+const std::string & MappingCache::get_path() const
+{
+    return path_;
+}
+
+bool MappingCache::load(std::vector<uint8_t> * payload) const
+{
+    FILE * fp = ::fopen(path_.c_str(), "rb");
+    if (fp == nullptr)
+    {
+        return false;
+    }
+
+    uint8_t header[CACHE_HEADER_SIZE];
+    bool ok = ::fread(header, 1, sizeof(header), fp) == sizeof(header) &&
+              ::memcmp(header, CACHE_MAGIC, sizeof(CACHE_MAGIC)) == 0;
+    uint32_t length = ok ? get_le32(&header[4]) : 0;
+    if (ok && length > 0 && length <= CACHE_MAX_PAYLOAD)
+    {
+        payload->resize(length);
+        ok = ::fread(payload->data(), 1, length, fp) == length && ::fgetc(fp) == EOF;
+    }
+    else
+    {
+        ok = false;
+    }
+    ::fclose(fp);
+
+    static const impl::CRC32C crc32c;
+    if (!ok || crc32c.update(0, payload->data(), payload->size()) != get_le32(&header[8]))
+    {
+        payload->clear();
+        return false;
+    }
+
+    return true;
+}
+
+bool MappingCache::store(const uint8_t * payload, size_t length) const
+{
+    if (length == 0 || length > CACHE_MAX_PAYLOAD)
+    {
+        return false;
+    }
+
+    static const impl::CRC32C crc32c;
+    uint8_t header[CACHE_HEADER_SIZE];
+    ::memcpy(header, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    put_le32(&header[4], static_cast<uint32_t>(length));
+    put_le32(&header[8], crc32c.update(0, payload, length));
+
+    std::string tmp_path = path_ + ".tmp";
+    FILE * fp = ::fopen(tmp_path.c_str(), "wb");
+    if (fp == nullptr)
+    {
+        return false;
+    }
+    bool ok = ::fwrite(header, 1, sizeof(header), fp) == sizeof(header) &&
+              ::fwrite(payload, 1, length, fp) == length;
+    ok = (::fclose(fp) == 0) && ok;
+    if (!ok || ::rename(tmp_path.c_str(), path_.c_str()) != 0)
+    {
+        ::remove(tmp_path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
@@ -0,0 +1,370 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "ros2_serial_example/metrics.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+namespace impl
+{
+
+constexpr size_t LatencyHistogram::SUB_BUCKET_BITS;
+constexpr size_t LatencyHistogram::SUB_BUCKETS;
+constexpr size_t LatencyHistogram::NUM_BUCKETS;
+
+LatencyHistogram::LatencyHistogram()
+{
+    for (auto & bucket : buckets_)
+    {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+}
+
+size_t LatencyHistogram::bucket_index(uint64_t value)
+{
+    if (value < SUB_BUCKETS)
+    {
+        return value;
+    }
+
+    // The top SUB_BUCKET_BITS + 1 bits of the value pick the bucket; the
+    // position of the highest set bit picks the group of buckets.
+    size_t msb = 63 - __builtin_clzll(value);
+    size_t shift = msb - SUB_BUCKET_BITS;
+
+    return SUB_BUCKETS + shift * SUB_BUCKETS + (static_cast<size_t>(value >> shift) - SUB_BUCKETS);
+}
+
+uint64_t LatencyHistogram::bucket_max(size_t index)
+{
+    if (index < SUB_BUCKETS)
+    {
+        return index;
+    }
+
+    size_t shift = (index - SUB_BUCKETS) / SUB_BUCKETS;
+    uint64_t sub = (index - SUB_BUCKETS) % SUB_BUCKETS;
+    uint64_t lowest = (SUB_BUCKETS + sub) << shift;
+
+    return lowest + ((static_cast<uint64_t>(1) << shift) - 1);
+}
+
+void LatencyHistogram::record(uint64_t value)
+{
+    buckets_[bucket_index(value)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(value, std::memory_order_relaxed);
+
+    uint64_t max = max_.load(std::memory_order_relaxed);
+    while (value > max && !max_.compare_exchange_weak(max, value, std::memory_order_relaxed))
+    {
+    }
+}
+
+void LatencyHistogram::snapshot(Snapshot *out) const
+{
+    out->count = count_.load(std::memory_order_relaxed);
+    out->sum = sum_.load(std::memory_order_relaxed);
+    out->max = max_.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < NUM_BUCKETS; ++i)
+    {
+        out->buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+    }
+}
+
+uint64_t LatencyHistogram::Snapshot::percentile(double percentile) const
+{
+    // Go by the buckets rather than count, since the two may disagree a
+    // little if values were being recorded during the snapshot.
+    uint64_t total = 0;
+    for (uint64_t n : buckets)
+    {
+        total += n;
+    }
+    if (total == 0)
+    {
+        return 0;
+    }
+
+    double clamped = std::min(std::max(percentile, 0.0), 100.0);
+    uint64_t rank = static_cast<uint64_t>(std::ceil(clamped / 100.0 * static_cast<double>(total)));
+    rank = std::min(std::max(rank, static_cast<uint64_t>(1)), total);
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < NUM_BUCKETS; ++i)
+    {
+        seen += buckets[i];
+        if (seen >= rank)
+        {
+            return std::min(bucket_max(i), max);
+        }
+    }
+
+    return max;
+}
+
+}  // namespace impl
+
+constexpr size_t Metrics::NUM_STAGES;
+constexpr int Metrics::REORDER_WINDOW;
+constexpr uint32_t Metrics::SEQUENCE_VALID;
+constexpr size_t Metrics::BLOCK_BITS;
+constexpr size_t Metrics::BLOCK_SIZE;
+constexpr size_t Metrics::NUM_BLOCKS;
+
+Metrics::Metrics()
+{
+    for (auto & blocks : blocks_)
+    {
+        for (auto & block : blocks)
+        {
+            block.store(nullptr, std::memory_order_relaxed);
+        }
+    }
+}
+
+Metrics::~Metrics()
+{
+    for (auto & blocks : blocks_)
+    {
+        for (auto & block : blocks)
+        {
+            delete block.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+Metrics::Slot & Metrics::slot(Direction direction, topic_id_size_t topic_ID)
+{
+    std::atomic<Block *> & entry = blocks_[static_cast<size_t>(direction)][topic_ID >> BLOCK_BITS];
+
+    Block *block = entry.load(std::memory_order_acquire);
+    if (block == nullptr)
+    {
+        // This only happens the first time a topic in the block is seen.  If
+        // another thread gets there first, use its block instead.
+        Block *fresh = new Block();
+        if (entry.compare_exchange_strong(block, fresh, std::memory_order_acq_rel, std::memory_order_acquire))
+        {
+            block = fresh;
+        }
+        else
+        {
+            delete fresh;
+        }
+    }
+
+    return block->slots[topic_ID & (BLOCK_SIZE - 1)];
+}
+
+void Metrics::message(Direction direction, topic_id_size_t topic_ID, size_t bytes)
+{
+    Slot & s = slot(direction, topic_ID);
+    s.messages.fetch_add(1, std::memory_order_relaxed);
+    s.bytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void Metrics::drop(Direction direction, topic_id_size_t topic_ID, Drop reason)
+{
+    Slot & s = slot(direction, topic_ID);
+    switch (reason)
+    {
+    case Drop::CRC:
+        s.crc_failures.fetch_add(1, std::memory_order_relaxed);
+        break;
+    case Drop::OVERSIZE:
+        s.oversize_drops.fetch_add(1, std::memory_order_relaxed);
+        break;
+    case Drop::DECODE:
+        s.decode_failures.fetch_add(1, std::memory_order_relaxed);
+        break;
+    case Drop::WRITE:
+        s.write_failures.fetch_add(1, std::memory_order_relaxed);
+        break;
+    case Drop::DESERIALIZE:
+        s.deserialize_failures.fetch_add(1, std::memory_order_relaxed);
+        break;
+    case Drop::STALE:
+        s.stale_drops.fetch_add(1, std::memory_order_relaxed);
+        break;
+    case Drop::TIMEOUT:
+        s.timeouts.fetch_add(1, std::memory_order_relaxed);
+        break;
+    }
+}
+
+uint8_t Metrics::next_sequence(topic_id_size_t topic_ID)
+{
+    Slot & s = slot(Direction::TX, topic_ID);
+    // The counter is left to run past 255; only its low byte is sent.
+    return static_cast<uint8_t>(s.sequence.fetch_add(1, std::memory_order_relaxed) & 0xffU);
+}
+
+void Metrics::sequence(topic_id_size_t topic_ID, uint8_t sequence)
+{
+    Slot & s = slot(Direction::RX, topic_ID);
+    uint32_t last = s.sequence.load(std::memory_order_relaxed);
+    if ((last & SEQUENCE_VALID) == 0)
+    {
+        s.sequence.store(SEQUENCE_VALID | sequence, std::memory_order_relaxed);
+        return;
+    }
+
+    // How far the frame is from the one expected next, from -128 to 127.
+    int diff = static_cast<int8_t>(static_cast<uint8_t>(sequence - static_cast<uint8_t>(last) - 1));
+    if (diff == -1)
+    {
+        s.sequence_duplicates.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    if (diff < -1 && diff >= -1 - REORDER_WINDOW)
+    {
+        // A late frame doesn't move the expected number back.
+        s.sequence_reorders.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    if (diff > 0)
+    {
+        s.sequence_gaps.fetch_add(static_cast<uint64_t>(diff), std::memory_order_relaxed);
+    }
+    s.sequence.store(SEQUENCE_VALID | sequence, std::memory_order_relaxed);
+}
+
+void Metrics::retransmit(topic_id_size_t topic_ID)
+{
+    slot(Direction::TX, topic_ID).retransmits.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Metrics::corrected(topic_id_size_t topic_ID, size_t bytes)
+{
+    slot(Direction::RX, topic_ID).corrected_bytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void Metrics::garbage(size_t bytes)
+{
+    garbage_bytes_.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void Metrics::set_ring_overflow_bytes(uint64_t bytes)
+{
+    ring_overflow_bytes_.store(bytes, std::memory_order_relaxed);
+}
+
+void Metrics::set_ring_overflows(uint64_t overflows)
+{
+    ring_overflows_.store(overflows, std::memory_order_relaxed);
+}
+
+void Metrics::set_ring_buffer_usage(uint64_t capacity, uint64_t high_water)
+{
+    ring_buffer_capacity_.store(capacity, std::memory_order_relaxed);
+    ring_buffer_high_water_.store(high_water, std::memory_order_relaxed);
+}
+
+void Metrics::read_error()
+{
+    read_errors_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Metrics::set_timing(bool enable)
+{
+    timing_.store(enable, std::memory_order_relaxed);
+}
+
+void Metrics::record(Stage stage, Clock::time_point start, Clock::time_point end)
+{
+    if (start == Clock::time_point() || end == Clock::time_point() || end < start)
+    {
+        return;
+    }
+
+    uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    latency_[static_cast<size_t>(stage)].record(ns);
+}
+
+void Metrics::snapshot_topics(Direction direction, std::vector<TopicCounters> *out) const
+{
+    out->clear();
+
+    const auto & blocks = blocks_[static_cast<size_t>(direction)];
+    for (size_t b = 0; b < NUM_BLOCKS; ++b)
+    {
+        const Block *block = blocks[b].load(std::memory_order_acquire);
+        if (block == nullptr)
+        {
+            continue;
+        }
+
+        for (size_t i = 0; i < BLOCK_SIZE; ++i)
+        {
+            const Slot & s = block->slots[i];
+            TopicCounters counters;
+            counters.topic_ID = static_cast<topic_id_size_t>((b << BLOCK_BITS) | i);
+            counters.messages = s.messages.load(std::memory_order_relaxed);
+            counters.bytes = s.bytes.load(std::memory_order_relaxed);
+            counters.crc_failures = s.crc_failures.load(std::memory_order_relaxed);
+            counters.oversize_drops = s.oversize_drops.load(std::memory_order_relaxed);
+            counters.decode_failures = s.decode_failures.load(std::memory_order_relaxed);
+            counters.write_failures = s.write_failures.load(std::memory_order_relaxed);
+            counters.deserialize_failures = s.deserialize_failures.load(std::memory_order_relaxed);
+            counters.stale_drops = s.stale_drops.load(std::memory_order_relaxed);
+            counters.timeouts = s.timeouts.load(std::memory_order_relaxed);
+            counters.sequence_gaps = s.sequence_gaps.load(std::memory_order_relaxed);
+            counters.sequence_duplicates = s.sequence_duplicates.load(std::memory_order_relaxed);
+            counters.sequence_reorders = s.sequence_reorders.load(std::memory_order_relaxed);
+            counters.retransmits = s.retransmits.load(std::memory_order_relaxed);
+            counters.corrected_bytes = s.corrected_bytes.load(std::memory_order_relaxed);
+            if (counters.messages != 0 || counters.crc_failures != 0 || counters.oversize_drops != 0 ||
+                counters.decode_failures != 0 || counters.write_failures != 0 || counters.deserialize_failures != 0 ||
+                counters.stale_drops != 0 || counters.timeouts != 0 || counters.sequence_gaps != 0 || counters.sequence_duplicates != 0 ||
+                counters.sequence_reorders != 0 || counters.retransmits != 0 || counters.corrected_bytes != 0)
+            {
+                out->push_back(counters);
+            }
+        }
+    }
+}
+
+void Metrics::snapshot(Snapshot *out) const
+{
+    snapshot_topics(Direction::RX, &out->rx);
+    snapshot_topics(Direction::TX, &out->tx);
+    out->garbage_bytes = garbage_bytes_.load(std::memory_order_relaxed);
+    out->ring_overflow_bytes = ring_overflow_bytes_.load(std::memory_order_relaxed);
+    out->ring_overflows = ring_overflows_.load(std::memory_order_relaxed);
+    out->ring_buffer_capacity = ring_buffer_capacity_.load(std::memory_order_relaxed);
+    out->ring_buffer_high_water = ring_buffer_high_water_.load(std::memory_order_relaxed);
+    out->read_errors = read_errors_.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < NUM_STAGES; ++i)
+    {
+        latency_[i].snapshot(&out->latency[i]);
+    }
+}
+
+}  // namespace transport
+
+}  // namespace ros2_to_serial_bridge
@@ -0,0 +1,391 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ros2_serial_example/packed_encoding.hpp"
+#include "ros2_serial_example/string_interner.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace pubsub
+{
+
+// The most octets a 64-bit varint takes.
+constexpr size_t MAX_VARINT_SIZE = 10;
+
+// The largest count of each fixed point size; the count below minus this
+// one stands for NaN.
+constexpr double FIXED16_MAX = 32767.0;
+constexpr double FIXED8_MAX = 127.0;
+
+void put_packed_varint(uint64_t value, std::vector<uint8_t> * out)
+{
+    while (value >= 0x80)
+    {
+        out->push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    out->push_back(static_cast<uint8_t>(value));
+}
+
+static size_t quantized_size(Quantization kind, size_t elem_size)
+{
+    switch (kind)
+    {
+    case Quantization::FLOAT32:
+        return 4;
+    case Quantization::FIXED16:
+        return 2;
+    case Quantization::FIXED8:
+        return 1;
+    case Quantization::DROP:
+        return 0;
+    case Quantization::FULL:
+        break;
+    }
+    return elem_size;
+}
+
+// Get the count of a fixed point field, saturating at max; NaN is the count
+// below -max.
+static int32_t to_fixed(double value, double scale, double max)
+{
+    if (std::isnan(value))
+    {
+        return static_cast<int32_t>(-max) - 1;
+    }
+    double count = std::round(value / scale);
+    if (count > max)
+    {
+        count = max;
+    }
+    else if (count < -max)
+    {
+        count = -max;
+    }
+    return static_cast<int32_t>(count);
+}
+
+static double from_fixed(int32_t count, double scale, double max)
+{
+    if (count < -max)
+    {
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+    return count * scale;
+}
+
+bool QuantizationProfile::parse(const std::vector<std::string> & specs, const PackedField * fields, size_t count,
+                                std::string * error)
+{
+    if (specs.empty())
+    {
+        rules_.clear();
+        return true;
+    }
+
+    std::vector<FieldRule> rules(count);
+    std::vector<bool> seen(count, false);
+
+    for (const std::string & spec : specs)
+    {
+        size_t colon = spec.find(':');
+        if (colon == std::string::npos)
+        {
+            *error = "Bad quantize spec '" + spec + "'; expected <field>:<float32|fixed16:<scale>|fixed8:<scale>|drop>";
+            return false;
+        }
+        std::string path = spec.substr(0, colon);
+        std::string kind = spec.substr(colon + 1);
+        std::string scale;
+        size_t scale_colon = kind.find(':');
+        if (scale_colon != std::string::npos)
+        {
+            scale = kind.substr(scale_colon + 1);
+            kind.resize(scale_colon);
+        }
+
+        size_t index = 0;
+        while (index < count && path != fields[index].path)
+        {
+            index++;
+        }
+        if (index == count)
+        {
+            *error = "Quantize spec '" + spec + "' names a field '" + path + "' that the type doesn't have";
+            return false;
+        }
+        if (seen[index])
+        {
+            *error = "Quantize spec '" + spec + "' names a field that another spec already did";
+            return false;
+        }
+        seen[index] = true;
+
+        PackedField::Kind field_kind = fields[index].kind;
+        bool is_float = field_kind == PackedField::Kind::FLOAT32 || field_kind == PackedField::Kind::FLOAT64;
+        FieldRule & rule = rules[index];
+        if (kind == "float32" && scale_colon == std::string::npos)
+        {
+            if (field_kind != PackedField::Kind::FLOAT64)
+            {
+                *error = "Quantize spec '" + spec + "' needs a float64 field";
+                return false;
+            }
+            rule.kind = Quantization::FLOAT32;
+        }
+        else if ((kind == "fixed16" || kind == "fixed8") && scale_colon != std::string::npos)
+        {
+            if (!is_float)
+            {
+                *error = "Quantize spec '" + spec + "' needs a float32 or float64 field";
+                return false;
+            }
+            char * end = nullptr;
+            double value = std::strtod(scale.c_str(), &end);
+            if (scale.empty() || *end != '\0' || !std::isfinite(value) || value <= 0.0)
+            {
+                *error = "Quantize spec '" + spec + "' needs a scale above 0";
+                return false;
+            }
+            rule.kind = kind == "fixed16" ? Quantization::FIXED16 : Quantization::FIXED8;
+            rule.scale = value;
+        }
+        else if (kind == "drop" && scale_colon == std::string::npos)
+        {
+            if (field_kind == PackedField::Kind::STRING)
+            {
+                *error = "Quantize spec '" + spec + "' can't drop a string";
+                return false;
+            }
+            rule.kind = Quantization::DROP;
+        }
+        else
+        {
+            *error = "Bad quantize spec '" + spec + "'; expected <field>:<float32|fixed16:<scale>|fixed8:<scale>|drop>";
+            return false;
+        }
+    }
+
+    rules_ = std::move(rules);
+    return true;
+}
+
+void PackedWriter::put_quantized(double value, const FieldRule & rule)
+{
+    switch (rule.kind)
+    {
+    case Quantization::FLOAT32:
+    {
+        float f = static_cast<float>(value);
+        const uint8_t * p = reinterpret_cast<const uint8_t *>(&f);
+        out_->insert(out_->end(), p, p + sizeof(f));
+        break;
+    }
+    case Quantization::FIXED16:
+    {
+        int16_t count = static_cast<int16_t>(to_fixed(value, rule.scale, FIXED16_MAX));
+        const uint8_t * p = reinterpret_cast<const uint8_t *>(&count);
+        out_->insert(out_->end(), p, p + sizeof(count));
+        break;
+    }
+    case Quantization::FIXED8:
+        out_->push_back(static_cast<uint8_t>(static_cast<int8_t>(to_fixed(value, rule.scale, FIXED8_MAX))));
+        break;
+    case Quantization::FULL:
+    case Quantization::DROP:
+        // put() sends full fields itself, and dropped ones aren't sent.
+        break;
+    }
+}
+
+PackedReader::PackedReader(const uint8_t * data, size_t length, InternTable * table, const FieldRule * rules)
+    : data_(data), length_(length), table_(table), rules_(rules)
+{
+    if (table_ == nullptr)
+    {
+        return;
+    }
+    const uint8_t * session = take(1);
+    uint64_t definitions;
+    if (session == nullptr || !get_varint(&definitions))
+    {
+        return;
+    }
+    table_->begin(*session, static_cast<uint32_t>(definitions));
+}
+
+size_t PackedReader::get_length(size_t elem_size, size_t max_length)
+{
+    uint64_t length;
+    if (!get_varint(&length))
+    {
+        return 0;
+    }
+    if (length > max_length || (elem_size > 0 && length > (length_ - pos_) / elem_size))
+    {
+        fail();
+        return 0;
+    }
+    return static_cast<size_t>(length);
+}
+
+size_t PackedReader::get_field_length(size_t index, size_t elem_size, size_t max_length)
+{
+    if (rules_ == nullptr)
+    {
+        return get_length(elem_size, max_length);
+    }
+    if (rules_[index].kind == Quantization::DROP)
+    {
+        return 0;
+    }
+    return get_length(quantized_size(rules_[index].kind, elem_size), max_length);
+}
+
+void PackedReader::get_string(std::string & s)
+{
+    uint64_t token;
+    if (!get_varint(&token))
+    {
+        s.clear();
+        return;
+    }
+
+    if (token == StringInterner::TOKEN_LITERAL || token == StringInterner::TOKEN_DEFINITION)
+    {
+        bool definition = token == StringInterner::TOKEN_DEFINITION;
+        uint64_t slot = 0;
+        uint64_t length;
+        if ((definition && !get_varint(&slot)) || !get_varint(&length))
+        {
+            s.clear();
+            return;
+        }
+        if ((definition && (table_ == nullptr || slot >= StringInterner::TABLE_SIZE ||
+                            length > StringInterner::MAX_STRING_LENGTH)) ||
+            length > length_ - pos_)
+        {
+            fail();
+            s.clear();
+            return;
+        }
+        const char * p = reinterpret_cast<const char *>(take(static_cast<size_t>(length)));
+        if (definition)
+        {
+            table_->define(static_cast<size_t>(slot), p, static_cast<size_t>(length));
+        }
+        s.assign(p, static_cast<size_t>(length));
+        return;
+    }
+
+    // Without a table, the sender shouldn't have interned anything.
+    const std::string * value = nullptr;
+    if (table_ != nullptr)
+    {
+        value = table_->lookup(static_cast<size_t>(token - StringInterner::TOKEN_FIRST_SLOT));
+        unknown_slot_ = value == nullptr;
+    }
+    if (value == nullptr)
+    {
+        fail();
+        s.clear();
+        return;
+    }
+    s = *value;
+}
+
+double PackedReader::get_quantized(const FieldRule & rule)
+{
+    switch (rule.kind)
+    {
+    case Quantization::FLOAT32:
+    {
+        float f = 0.0f;
+        const uint8_t * p = take(sizeof(f));
+        if (p != nullptr)
+        {
+            ::memcpy(&f, p, sizeof(f));
+        }
+        return f;
+    }
+    case Quantization::FIXED16:
+    {
+        int16_t count = 0;
+        const uint8_t * p = take(sizeof(count));
+        if (p != nullptr)
+        {
+            ::memcpy(&count, p, sizeof(count));
+        }
+        return from_fixed(count, rule.scale, FIXED16_MAX);
+    }
+    case Quantization::FIXED8:
+    {
+        const uint8_t * p = take(1);
+        return p != nullptr ? from_fixed(static_cast<int8_t>(*p), rule.scale, FIXED8_MAX) : 0.0;
+    }
+    case Quantization::FULL:
+    case Quantization::DROP:
+        // get() reads full fields itself, and dropped ones aren't sent.
+        break;
+    }
+    return 0.0;
+}
+
+const uint8_t * PackedReader::take(size_t length)
+{
+    if (failed_ || length > length_ - pos_)
+    {
+        fail();
+        return nullptr;
+    }
+    const uint8_t * p = data_ + pos_;
+    pos_ += length;
+    return p;
+}
+
+bool PackedReader::get_varint(uint64_t * value)
+{
+    uint64_t v = 0;
+    for (size_t i = 0; i < MAX_VARINT_SIZE; ++i)
+    {
+        const uint8_t * p = take(1);
+        if (p == nullptr)
+        {
+            return false;
+        }
+        v |= static_cast<uint64_t>(*p & 0x7f) << (7 * i);
+        if ((*p & 0x80) == 0)
+        {
+            *value = v;
+            return true;
+        }
+    }
+
+    fail();
+    return false;
+}
+
+}  // namespace pubsub
+}  // namespace ros2_to_serial_bridge
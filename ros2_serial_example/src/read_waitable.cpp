@@ -0,0 +1,118 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <rclcpp/rclcpp.hpp>
+
+#include "ros2_serial_example/read_waitable.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+ReadWaitable::ReadWaitable(rclcpp::Context::SharedPtr context, std::function<void()> callback)
+    : guard_condition_(context), callback_(std::move(callback))
+{
+}
+
+void ReadWaitable::trigger()
+{
+    guard_condition_.trigger();
+}
+
+size_t ReadWaitable::get_number_of_ready_guard_conditions()
+{
+    return 1;
+}
+
+#if RCLCPP_VERSION_GTE(28, 0, 0)
+
+void ReadWaitable::add_to_wait_set(rcl_wait_set_t & wait_set)
+{
+    guard_condition_.add_to_wait_set(wait_set);
+}
+
+bool ReadWaitable::is_ready(const rcl_wait_set_t & wait_set)
+{
+    for (size_t i = 0; i < wait_set.size_of_guard_conditions; ++i)
+    {
+        if (wait_set.guard_conditions[i] == &guard_condition_.get_rcl_guard_condition())
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::shared_ptr<void> ReadWaitable::take_data()
+{
+    // The callback reads the transports itself.
+    return nullptr;
+}
+
+std::shared_ptr<void> ReadWaitable::take_data_by_entity_id(size_t id)
+{
+    (void)id;
+    return nullptr;
+}
+
+void ReadWaitable::execute(const std::shared_ptr<void> & data)
+{
+    (void)data;
+    callback_();
+}
+
+std::vector<std::shared_ptr<rclcpp::TimerBase>> ReadWaitable::get_timers() const
+{
+    return {};
+}
+
+#else
+
+void ReadWaitable::add_to_wait_set(rcl_wait_set_t * wait_set)
+{
+    guard_condition_.add_to_wait_set(wait_set);
+}
+
+bool ReadWaitable::is_ready(rcl_wait_set_t * wait_set)
+{
+    for (size_t i = 0; i < wait_set->size_of_guard_conditions; ++i)
+    {
+        if (wait_set->guard_conditions[i] == &guard_condition_.get_rcl_guard_condition())
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::shared_ptr<void> ReadWaitable::take_data()
+{
+    // The callback reads the transports itself.
+    return nullptr;
+}
+
+void ReadWaitable::execute(std::shared_ptr<void> & data)
+{
+    (void)data;
+    callback_();
+}
+
+#endif
+
+}  // namespace ros2_to_serial_bridge
@@ -0,0 +1,329 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "ros2_serial_example/reed_solomon.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+namespace impl
+{
+
+constexpr size_t ReedSolomon::DATA_LEN;
+constexpr size_t ReedSolomon::PARITY_LEN;
+constexpr size_t ReedSolomon::BLOCK_LEN;
+
+// x^8 + x^4 + x^3 + x^2 + 1, for which x (alpha) is primitive.
+constexpr unsigned int GF_POLY = 0x11D;
+
+struct GFTables final
+{
+    // exp[i] is alpha^i; it is doubled up so that the sum of two logs can
+    // index it without a modulo.
+    uint8_t exp[510];
+    // log[a] is i such that alpha^i == a; log[0] is unused.
+    uint8_t log[256];
+    // The logs of the coefficients of the generator polynomial, highest
+    // power first, without the leading 1.
+    uint8_t gen_log[ReedSolomon::PARITY_LEN];
+};
+
+constexpr GFTables make_gf_tables()
+{
+    GFTables tables{};
+
+    unsigned int x = 1;
+    for (int i = 0; i < 255; ++i)
+    {
+        tables.exp[i] = static_cast<uint8_t>(x);
+        tables.exp[i + 255] = static_cast<uint8_t>(x);
+        tables.log[x] = static_cast<uint8_t>(i);
+        x <<= 1U;
+        if ((x & 0x100U) != 0)
+        {
+            x ^= GF_POLY;
+        }
+    }
+
+    // g(x) is the product of (x - alpha^i) for i from 0 to PARITY_LEN - 1,
+    // built up one factor at a time; gen[0] is the highest power.
+    uint8_t gen[ReedSolomon::PARITY_LEN + 1]{};
+    gen[0] = 1;
+    for (size_t i = 0; i < ReedSolomon::PARITY_LEN; ++i)
+    {
+        for (size_t j = i + 1; j > 0; --j)
+        {
+            uint8_t product = gen[j - 1] == 0 ? 0 : tables.exp[tables.log[gen[j - 1]] + i];
+            gen[j] = static_cast<uint8_t>(gen[j] ^ product);
+        }
+    }
+    for (size_t i = 0; i < ReedSolomon::PARITY_LEN; ++i)
+    {
+        tables.gen_log[i] = tables.log[gen[i + 1]];
+    }
+
+    return tables;
+}
+
+static constexpr GFTables GF = make_gf_tables();
+
+static inline uint8_t gf_mul(uint8_t a, uint8_t b)
+{
+    if (a == 0 || b == 0)
+    {
+        return 0;
+    }
+
+    return GF.exp[GF.log[a] + GF.log[b]];
+}
+
+static inline uint8_t gf_div(uint8_t a, uint8_t b)
+{
+    if (a == 0)
+    {
+        return 0;
+    }
+
+    return GF.exp[GF.log[a] + 255 - GF.log[b]];
+}
+
+// This function evaluates the polynomial poly, of len coefficients with the
+// lowest power first, at x.
+static uint8_t poly_eval(const uint8_t *poly, size_t len, uint8_t x)
+{
+    uint8_t result = 0;
+    for (size_t i = len; i > 0; --i)
+    {
+        result = static_cast<uint8_t>(gf_mul(result, x) ^ poly[i - 1]);
+    }
+
+    return result;
+}
+
+// This function corrects the block of n bytes (data followed by parity) at
+// block in place.
+//
+// Returns the number of bytes corrected, or -1 if the block can't be
+// corrected.
+static int decode_block(uint8_t *block, size_t n)
+{
+    constexpr size_t nsyn = ReedSolomon::PARITY_LEN;
+
+    // The syndromes are the codeword evaluated at the roots of the
+    // generator; all of them are 0 for an undamaged block.
+    uint8_t syndromes[nsyn];
+    bool damaged = false;
+    for (size_t j = 0; j < nsyn; ++j)
+    {
+        uint8_t root = GF.exp[j];
+        uint8_t s = 0;
+        for (size_t i = 0; i < n; ++i)
+        {
+            s = static_cast<uint8_t>(gf_mul(s, root) ^ block[i]);
+        }
+        syndromes[j] = s;
+        damaged |= s != 0;
+    }
+    if (!damaged)
+    {
+        return 0;
+    }
+
+    // Berlekamp-Massey finds the error locator polynomial, lowest power
+    // first, whose roots are the inverses of the error locations.
+    uint8_t locator[nsyn + 1]{1};
+    uint8_t prev[nsyn + 1]{1};
+    size_t errors = 0;
+    size_t shift = 1;
+    uint8_t prev_discrepancy = 1;
+    for (size_t r = 0; r < nsyn; ++r)
+    {
+        uint8_t discrepancy = syndromes[r];
+        for (size_t i = 1; i <= errors; ++i)
+        {
+            discrepancy ^= gf_mul(locator[i], syndromes[r - i]);
+        }
+        if (discrepancy == 0)
+        {
+            ++shift;
+            continue;
+        }
+
+        uint8_t scale = gf_div(discrepancy, prev_discrepancy);
+        uint8_t saved[nsyn + 1];
+        ::memcpy(saved, locator, sizeof(saved));
+        for (size_t i = 0; i + shift <= nsyn; ++i)
+        {
+            locator[i + shift] ^= gf_mul(scale, prev[i]);
+        }
+        if (2 * errors <= r)
+        {
+            errors = r + 1 - errors;
+            ::memcpy(prev, saved, sizeof(prev));
+            prev_discrepancy = discrepancy;
+            shift = 1;
+        }
+        else
+        {
+            ++shift;
+        }
+    }
+    if (errors > nsyn / 2)
+    {
+        return -1;
+    }
+
+    // The error evaluator is the syndromes times the locator, mod x^nsyn.
+    uint8_t evaluator[nsyn]{};
+    for (size_t i = 0; i < nsyn; ++i)
+    {
+        for (size_t j = 0; j <= errors && j <= i; ++j)
+        {
+            evaluator[i] ^= gf_mul(syndromes[i - j], locator[j]);
+        }
+    }
+
+    // The Chien search tries every position in the block; byte i is the
+    // coefficient of x^(n - 1 - i).  The Forney algorithm then gives the
+    // value of the error at each root.
+    size_t found = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        size_t power = n - 1 - i;
+        uint8_t x_inv = GF.exp[(255 - power) % 255];
+        if (poly_eval(locator, errors + 1, x_inv) != 0)
+        {
+            continue;
+        }
+
+        // The formal derivative of the locator keeps only the odd powers.
+        uint8_t derivative = 0;
+        for (size_t j = 1; j <= errors; j += 2)
+        {
+            derivative ^= gf_mul(locator[j], GF.exp[(GF.log[x_inv] * (j - 1)) % 255]);
+        }
+        if (derivative == 0)
+        {
+            return -1;
+        }
+        uint8_t magnitude = gf_div(gf_mul(GF.exp[power], poly_eval(evaluator, nsyn, x_inv)), derivative);
+        block[i] ^= magnitude;
+        ++found;
+    }
+
+    // Any roots that weren't found are outside of the block (or don't
+    // exist), so there were more errors than can be corrected.
+    if (found != errors)
+    {
+        return -1;
+    }
+
+    return static_cast<int>(errors);
+}
+
+size_t ReedSolomon::encode(const struct iovec *iov, int iovcnt, uint8_t *dst)
+{
+    size_t out = 0;
+    size_t block_data = 0;
+    uint8_t parity[PARITY_LEN]{};
+
+    // The parity is the remainder of the data (times x^PARITY_LEN) divided
+    // by the generator, worked out a byte at a time as the data is copied.
+    auto finish_block = [&]()
+    {
+        ::memcpy(dst + out, parity, PARITY_LEN);
+        out += PARITY_LEN;
+        ::memset(parity, 0, PARITY_LEN);
+        block_data = 0;
+    };
+
+    for (int i = 0; i < iovcnt; ++i)
+    {
+        const uint8_t *data = static_cast<const uint8_t *>(iov[i].iov_base);
+        for (size_t j = 0; j < iov[i].iov_len; ++j)
+        {
+            dst[out++] = data[j];
+            uint8_t feedback = data[j] ^ parity[0];
+            ::memmove(parity, parity + 1, PARITY_LEN - 1);
+            parity[PARITY_LEN - 1] = 0;
+            if (feedback != 0)
+            {
+                unsigned int feedback_log = GF.log[feedback];
+                for (size_t k = 0; k < PARITY_LEN; ++k)
+                {
+                    parity[k] ^= GF.exp[feedback_log + GF.gen_log[k]];
+                }
+            }
+
+            if (++block_data == DATA_LEN)
+            {
+                finish_block();
+            }
+        }
+    }
+    if (block_data > 0)
+    {
+        finish_block();
+    }
+
+    return out;
+}
+
+ssize_t ReedSolomon::decode(uint8_t *buf, size_t len, size_t *corrected)
+{
+    ssize_t data_len = decoded_length(len);
+    if (data_len < 0)
+    {
+        return -1;
+    }
+
+    size_t total_corrected = 0;
+    size_t in = 0;
+    size_t out = 0;
+    while (in < len)
+    {
+        size_t n = len - in < BLOCK_LEN ? len - in : BLOCK_LEN;
+        int block_corrected = decode_block(buf + in, n);
+        if (block_corrected < 0)
+        {
+            return -1;
+        }
+        total_corrected += block_corrected;
+
+        ::memmove(buf + out, buf + in, n - PARITY_LEN);
+        out += n - PARITY_LEN;
+        in += n;
+    }
+
+    if (corrected != nullptr)
+    {
+        *corrected = total_corrected;
+    }
+
+    return data_len;
+}
+
+}  // namespace impl
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
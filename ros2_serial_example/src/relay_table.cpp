@@ -0,0 +1,81 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "ros2_serial_example/relay_table.hpp"
+#include "ros2_serial_example/transporter.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+void RelayTable::add(topic_id_size_t topic_ID, Transporter * to)
+{
+    if (to == nullptr)
+    {
+        throw std::runtime_error("RelayTable transport must not be a nullptr");
+    }
+    if (topic_ID > to->get_max_topic_ID())
+    {
+        throw std::runtime_error("Topic ID " + std::to_string(topic_ID) + " is too large for protocol '" +
+                                 to->get_protocol() + "'");
+    }
+
+    if (routes_.size() <= topic_ID)
+    {
+        routes_.resize(static_cast<size_t>(topic_ID) + 1);
+    }
+    std::vector<Transporter *> & route = routes_[topic_ID];
+    if (std::find(route.begin(), route.end(), to) != route.end())
+    {
+        throw std::runtime_error("Topic ID " + std::to_string(topic_ID) + " is relayed to the same transport twice");
+    }
+    route.push_back(to);
+}
+
+bool RelayTable::forward(topic_id_size_t topic_ID, const uint8_t * buffer, size_t length)
+{
+    if (!relays(topic_ID))
+    {
+        return false;
+    }
+
+    // A transport that can't take the payload (because it is backed up, for
+    // instance) doesn't hold it up for the others.
+    for (Transporter *to : routes_[topic_ID])
+    {
+        if (to->write(topic_ID, length > 0 ? buffer : nullptr, length) < 0)
+        {
+            drops_++;
+        }
+        else
+        {
+            relayed_++;
+        }
+    }
+
+    return true;
+}
+
+}  // namespace transport
+
+}  // namespace ros2_to_serial_bridge
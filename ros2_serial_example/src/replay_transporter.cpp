@@ -0,0 +1,178 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// C++ includes
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+
+// Local includes
+#include "ros2_serial_example/link_capture.hpp"
+#include "ros2_serial_example/replay_transporter.hpp"
+#include "ros2_serial_example/transporter.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+ReplayTransporter::ReplayTransporter(const std::string & protocol,
+                                     const std::string & path,
+                                     bool realtime,
+                                     uint32_t read_poll_ms,
+                                     size_t ring_buffer_size)
+    : Transporter(protocol, ring_buffer_size), path_(path), realtime_(realtime), read_poll_ms_(read_poll_ms)
+{
+}
+
+ReplayTransporter::~ReplayTransporter()
+{
+    close();
+}
+
+int ReplayTransporter::init()
+{
+    if (!reader_.open(path_))
+    {
+        ::fprintf(stderr, "Failed to open capture '%s'\n", path_.c_str());
+        return -1;
+    }
+    if (reader_.get_protocol() != get_protocol())
+    {
+        ::fprintf(stderr, "Capture '%s' was made with protocol '%s', not '%s'\n",
+                  path_.c_str(), reader_.get_protocol().c_str(), get_protocol().c_str());
+        return -1;
+    }
+    open_ = true;
+    rewind();
+
+    return 0;
+}
+
+int ReplayTransporter::close()
+{
+    open_ = false;
+
+    return 0;
+}
+
+void ReplayTransporter::rewind()
+{
+    reader_.rewind();
+    finished_ = false;
+    have_chunk_ = false;
+    started_ = false;
+    size_t used = ringbuf_.bytes_used();
+    if (used > 0)
+    {
+        ringbuf_.discard(used);
+    }
+}
+
+bool ReplayTransporter::next_chunk()
+{
+    while (reader_.next(&chunk_))
+    {
+        if (chunk_.direction == LinkCapture::Direction::RX)
+        {
+            chunk_offset_ = 0;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+ssize_t ReplayTransporter::node_read()
+{
+    if (!fds_OK())
+    {
+        return -1;
+    }
+
+    if (!have_chunk_ && !finished_)
+    {
+        have_chunk_ = next_chunk();
+        finished_ = !have_chunk_;
+    }
+    if (finished_)
+    {
+        // There is nothing more to come, so just wait like an idle link.
+        std::this_thread::sleep_for(std::chrono::milliseconds(read_poll_ms_));
+        return 0;
+    }
+
+    if (realtime_)
+    {
+        // The first chunk sets the pace for the rest.
+        if (!started_)
+        {
+            first_timestamp_ns_ = chunk_.timestamp_ns;
+            start_time_ = std::chrono::steady_clock::now();
+            started_ = true;
+        }
+        std::chrono::steady_clock::time_point due =
+            start_time_ + std::chrono::nanoseconds(chunk_.timestamp_ns - first_timestamp_ns_);
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (due > now)
+        {
+            std::chrono::steady_clock::time_point wake = std::min(due, now + std::chrono::milliseconds(read_poll_ms_));
+            std::this_thread::sleep_until(wake);
+            if (wake < due)
+            {
+                return 0;
+            }
+        }
+    }
+
+    // Only hand over what fits, so that nothing in the ring is overwritten
+    // before it is parsed.
+    size_t n = std::min(chunk_.length - chunk_offset_, ringbuf_.capacity() - ringbuf_.bytes_used());
+    size_t copied = 0;
+    while (copied < n)
+    {
+        ssize_t ret = ringbuf_.write(chunk_.data + chunk_offset_ + copied, n - copied);
+        if (ret <= 0)
+        {
+            break;
+        }
+        copied += static_cast<size_t>(ret);
+    }
+    chunk_offset_ += copied;
+    if (chunk_offset_ == chunk_.length)
+    {
+        have_chunk_ = false;
+    }
+
+    return copied;
+}
+
+ssize_t ReplayTransporter::node_write(void *buffer, size_t len)
+{
+    (void)buffer;
+
+    return len;
+}
+
+bool ReplayTransporter::fds_OK()
+{
+    return open_;
+}
+
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
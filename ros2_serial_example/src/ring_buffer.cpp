@@ -14,11 +14,15 @@
 
 #include <algorithm>
 #include <cstdint>
+#include <cstdlib>
 #include <cstring>
 #include <memory>
 
+#include <sys/mman.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 
+#include "ros2_serial_example/async_log.hpp"
 #include "ros2_serial_example/ring_buffer.hpp"
 
 namespace ros2_to_serial_bridge
@@ -30,13 +34,426 @@ namespace transport
 namespace impl
 {
 
-RingBuffer::RingBuffer(size_t capacity) : buf_(std::unique_ptr<uint8_t[]>(new uint8_t[capacity])), size_(capacity)
+constexpr size_t RingBuffer::GROW_QUARTERS;
+constexpr size_t RingBuffer::SHRINK_AFTER_ADDS;
+
+void RingBuffer::BufferDeleter::operator()(uint8_t *p) const
+{
+    if (mapped_len != 0)
+    {
+        ::munmap(p, mapped_len);
+    }
+    else
+    {
+        delete[] p;
+    }
+}
+
+RingBuffer::RingBuffer(size_t capacity) : buf_(new uint8_t[capacity], BufferDeleter()), size_(capacity)
 {
     head_ = tail_ = buf_.get();
 }
 
 RingBuffer::~RingBuffer()
 {
+    if (mirror_fd_ >= 0)
+    {
+        ::close(mirror_fd_);
+    }
+}
+
+int RingBuffer::map_memory(size_t size, size_t reserve, bool mirrored)
+{
+    size_t reserved = mirrored ? 2 * reserve : reserve;
+    int fd = -1;
+    void *base;
+    if (mirrored)
+    {
+#if defined(SYS_memfd_create) && defined(MFD_CLOEXEC)
+        fd = static_cast<int>(::syscall(SYS_memfd_create, "ring_buffer", MFD_CLOEXEC));
+#endif
+        if (fd < 0)
+        {
+            return -1;
+        }
+
+        if (::ftruncate(fd, size) != 0)
+        {
+            ::close(fd);
+            return -1;
+        }
+
+        // Reserve address space for both copies first, so that nothing else
+        // can end up in between, and then map the memfd over each half of
+        // it.
+        base = ::mmap(nullptr, reserved, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED)
+        {
+            ::close(fd);
+            return -1;
+        }
+
+        uint8_t *u8base = static_cast<uint8_t *>(base);
+        if (::mmap(u8base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+            ::mmap(u8base + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+        {
+            ::munmap(base, reserved);
+            ::close(fd);
+            return -1;
+        }
+    }
+    else
+    {
+        // Pages of anonymous memory are only backed once they are touched, so
+        // reserving the whole of it costs nothing until the ring grows.
+        base = ::mmap(nullptr, reserved, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (base == MAP_FAILED)
+        {
+            return -1;
+        }
+    }
+
+    if (mirror_fd_ >= 0)
+    {
+        ::close(mirror_fd_);
+    }
+    mirror_fd_ = fd;
+
+    BufferDeleter deleter;
+    deleter.mapped_len = reserved;
+    buf_ = std::unique_ptr<uint8_t[], BufferDeleter>(static_cast<uint8_t *>(base), deleter);
+    size_ = size;
+    mirrored_ = mirrored;
+    head_ = tail_ = buf_.get();
+    full_ = false;
+    scanned_ = 0;
+    tail_generation_++;
+
+    return 0;
+}
+
+int RingBuffer::set_mirrored()
+{
+    if (!is_empty())
+    {
+        return -1;
+    }
+
+    if (is_mirrored())
+    {
+        return 0;
+    }
+
+    long page_size = ::sysconf(_SC_PAGESIZE);
+    if (page_size <= 0)
+    {
+        return -1;
+    }
+    size_t page = static_cast<size_t>(page_size);
+    size_t size = (size_ + page - 1) / page * page;
+    size_t reserve = size;
+    if (is_adaptive())
+    {
+        reserve = std::max((max_capacity_ + page - 1) / page * page, size);
+    }
+
+    if (map_memory(size, reserve, true) < 0)
+    {
+        return -1;
+    }
+    if (is_adaptive())
+    {
+        max_capacity_ = reserve;
+        min_capacity_ = size;
+    }
+
+    return 0;
+}
+
+int RingBuffer::set_adaptive(size_t max_capacity)
+{
+    if (!is_empty() || max_capacity <= size_)
+    {
+        return -1;
+    }
+
+    size_t reserve = max_capacity;
+    if (is_mirrored())
+    {
+        long page_size = ::sysconf(_SC_PAGESIZE);
+        if (page_size <= 0)
+        {
+            return -1;
+        }
+        size_t page = static_cast<size_t>(page_size);
+        reserve = (max_capacity + page - 1) / page * page;
+    }
+
+    if (map_memory(size_, reserve, is_mirrored()) < 0)
+    {
+        return -1;
+    }
+    max_capacity_ = reserve;
+    min_capacity_ = size_;
+    window_adds_ = 0;
+    window_high_water_ = 0;
+    shrink_pending_ = false;
+
+    return 0;
+}
+
+int RingBuffer::resize(size_t capacity)
+{
+    size_t used = bytes_used();
+    if (capacity == 0 || capacity < used)
+    {
+        return -1;
+    }
+
+    // The data is copied out first, since mapping new memory throws the old
+    // memory away.
+    std::unique_ptr<uint8_t[]> data(new uint8_t[used]);
+    peek(data.get(), used);
+
+    if (is_mirrored() || is_adaptive())
+    {
+        size_t size = capacity;
+        if (is_mirrored())
+        {
+            long page_size = ::sysconf(_SC_PAGESIZE);
+            if (page_size <= 0)
+            {
+                return -1;
+            }
+            size_t page = static_cast<size_t>(page_size);
+            size = (capacity + page - 1) / page * page;
+        }
+        size_t reserve = std::max(max_capacity_, size);
+        if (map_memory(size, reserve, is_mirrored()) < 0)
+        {
+            return -1;
+        }
+        if (is_adaptive())
+        {
+            max_capacity_ = reserve;
+            min_capacity_ = size;
+            window_adds_ = 0;
+            window_high_water_ = 0;
+            shrink_pending_ = false;
+        }
+    }
+    else
+    {
+        buf_ = std::unique_ptr<uint8_t[], BufferDeleter>(new uint8_t[capacity], BufferDeleter());
+        size_ = capacity;
+        scanned_ = 0;
+        tail_generation_++;
+    }
+
+    ::memcpy(buf_.get(), data.get(), used);
+    tail_ = buf_.get();
+    head_ = tail_ + used;
+    if (head_ >= end())
+    {
+        head_ -= size_;
+    }
+    full_ = (used == size_);
+
+    return 0;
+}
+
+void RingBuffer::adapt()
+{
+    if (!is_adaptive())
+    {
+        return;
+    }
+
+    size_t used = bytes_used();
+    if (size_ < max_capacity_ && used >= size_ / 4 * GROW_QUARTERS)
+    {
+        // If the memory can't be had, the ring stays the size it is from
+        // now on, and overflows as a fixed one would.
+        if (!grow(std::min(size_ * 2, max_capacity_)))
+        {
+            max_capacity_ = size_;
+        }
+        window_adds_ = 0;
+        window_high_water_ = 0;
+        shrink_pending_ = false;
+        return;
+    }
+
+    if (++window_adds_ >= SHRINK_AFTER_ADDS)
+    {
+        shrink_pending_ = size_ > min_capacity_ && window_high_water_ <= size_ / 4;
+        window_adds_ = 0;
+        window_high_water_ = 0;
+    }
+
+    if (!shrink_pending_)
+    {
+        return;
+    }
+
+    // A mirrored ring has to stay a multiple of the page size.
+    size_t new_size = std::max(size_ / 2, min_capacity_);
+    if (is_mirrored())
+    {
+        size_t page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+        new_size = std::min((new_size + page - 1) / page * page, size_);
+    }
+
+    // Only data that doesn't wrap around the end can be moved down in one
+    // go, so the shrink waits for that.
+    if (new_size < size_ && !full_ && tail_ <= head_ && used <= new_size / 2)
+    {
+        shrink(new_size);
+        shrink_pending_ = false;
+    }
+}
+
+bool RingBuffer::map_mirror(size_t size, size_t old_size)
+{
+    uint8_t *base = buf_.get();
+
+    if (::ftruncate(mirror_fd_, size) != 0 ||
+        ::mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, mirror_fd_, 0) == MAP_FAILED ||
+        ::mmap(base + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, mirror_fd_, 0) == MAP_FAILED)
+    {
+        return false;
+    }
+    if (size < old_size &&
+        ::mmap(base + 2 * size, 2 * (old_size - size), PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) ==
+        MAP_FAILED)
+    {
+        return false;
+    }
+
+    return true;
+}
+
+void RingBuffer::restore_mirror(size_t size, size_t failed_size)
+{
+    if (map_mirror(size, failed_size))
+    {
+        return;
+    }
+
+    // The data can no longer be reached the way the ring expects, and some
+    // of it may not be mapped at all, so going on would hand out the wrong
+    // bytes or crash somewhere less obvious.
+    ROS2_SERIAL_LOG(ERROR, "Failed to map the mirrored ring buffer back at %zu bytes; aborting", size);
+    AsyncLog::instance().flush();
+    ::abort();
+}
+
+bool RingBuffer::grow(size_t new_size)
+{
+    uint8_t *base = buf_.get();
+    size_t old_size = size_;
+    size_t used = bytes_used();
+
+    // Extend the memfd and map both copies at their new size; the data
+    // already in it stays where it is.  If that fails part of the way, the
+    // old layout is put back, since the second copy may no longer mirror the
+    // first.
+    if (is_mirrored() && !map_mirror(new_size, old_size))
+    {
+        restore_mirror(old_size, new_size);
+        return false;
+    }
+
+    // Data that wraps around the old end has its part at the start of the
+    // ring moved up to just after the old end, where it now belongs, or as
+    // much of it as fits; the rest moves down to the start.
+    if (full_ || head_ < tail_)
+    {
+        size_t head_len = head_ - base;
+        size_t n = std::min(head_len, new_size - old_size);
+        ::memcpy(base + old_size, base, n);
+        if (head_len > n)
+        {
+            ::memmove(base, base + n, head_len - n);
+            head_ = base + (head_len - n);
+        }
+        else
+        {
+            head_ = base + old_size + n;
+        }
+    }
+    size_ = new_size;
+    if (head_ >= end())
+    {
+        head_ -= size_;
+    }
+    full_ = (used == size_);
+
+    return true;
+}
+
+void RingBuffer::shrink(size_t new_size)
+{
+    uint8_t *base = buf_.get();
+    size_t used = bytes_used();
+    size_t old_size = size_;
+
+    // The data is moved down to the start, which is as good a place for it
+    // in the ring at its old capacity as at the new one, so that it is all
+    // below the new end before anything above that is given back.  The
+    // findseq() scan state is an offset from the tail, so it stays valid.
+    if (tail_ != base)
+    {
+        ::memmove(base, tail_, used);
+    }
+    tail_ = base;
+    head_ = base + used;
+
+    if (is_mirrored())
+    {
+        // Truncating the memfd frees its pages; the mirror moves down, and
+        // the address space above it goes back to being reserved only.  The
+        // capacity only changes once all of that has worked; otherwise the
+        // memfd and both copies are put back at the old capacity.
+        if (!map_mirror(new_size, old_size))
+        {
+            restore_mirror(old_size, new_size);
+            return;
+        }
+        size_ = new_size;
+        return;
+    }
+
+    size_ = new_size;
+
+    // The pages wholly above the new end are given back, and read as zeros
+    // if they are touched again.
+    long page_size = ::sysconf(_SC_PAGESIZE);
+    if (page_size > 0)
+    {
+        size_t page = static_cast<size_t>(page_size);
+        size_t start = (new_size + page - 1) / page * page;
+        size_t stop = (old_size + page - 1) / page * page;
+        if (stop > start)
+        {
+            ::madvise(base + start, stop - start, MADV_DONTNEED);
+        }
+    }
+}
+
+const uint8_t *RingBuffer::contiguous(size_t count) const
+{
+    if (count > bytes_used())
+    {
+        return nullptr;
+    }
+
+    if (!is_mirrored() && count > static_cast<size_t>(end() - tail_))
+    {
+        return nullptr;
+    }
+
+    return tail_;
 }
 
 uint8_t *RingBuffer::end() const
@@ -71,32 +488,138 @@ bool RingBuffer::is_empty() const
 
 ssize_t RingBuffer::read(int fd)
 {
+    adapt();
+
     uint8_t *bufend = end();
     size_t nfree = bytes_free();
 
     size_t count = bufend - head_;
+    if (is_mirrored())
+    {
+        // The mirror lets a single read fill all of the free space, even if
+        // it wraps around the end.
+        count = std::max(count, nfree);
+    }
     ssize_t n = ::read(fd, head_, count);
     if (n > 0)
     {
         head_ += n;
 
         // wrap?
-        if (head_ == bufend)
+        if (head_ >= bufend)
         {
-            head_ = buf_.get();
+            head_ -= size_;
         }
 
         // fix up the tail pointer if an overflow occurred
         if (static_cast<size_t>(n) >= nfree)
         {
+            if (static_cast<size_t>(n) > nfree)
+            {
+                overflowed_bytes_ += n - nfree;
+                overflows_++;
+            }
             full_ = true;
             tail_ = head_;
+            scanned_ = 0;
+            tail_generation_++;
+        }
+        added();
+    }
+
+    return n;
+}
+
+ssize_t RingBuffer::write(const void *src, size_t count)
+{
+    if (src == nullptr)
+    {
+        return -1;
+    }
+
+    adapt();
+
+    uint8_t *bufend = end();
+    size_t nfree = bytes_free();
+
+    size_t contig = bufend - head_;
+    if (is_mirrored())
+    {
+        contig = std::max(contig, nfree);
+    }
+    size_t n = std::min(contig, count);
+    ::memcpy(head_, src, n);
+    head_ += n;
+
+    // wrap?
+    if (head_ >= bufend)
+    {
+        head_ -= size_;
+    }
+
+    // fix up the tail pointer if an overflow occurred
+    if (n > 0 && n >= nfree)
+    {
+        if (n > nfree)
+        {
+            overflowed_bytes_ += n - nfree;
+            overflows_++;
         }
+        full_ = true;
+        tail_ = head_;
+        scanned_ = 0;
+        tail_generation_++;
     }
+    added();
 
     return n;
 }
 
+uint8_t *RingBuffer::free_span(size_t *len)
+{
+    adapt();
+
+    if (full_)
+    {
+        // Drop the oldest data between the head and the end of the ring (or
+        // all of it, if mirrored), which is what read() would overwrite.
+        size_t n = is_mirrored() ? size_ : static_cast<size_t>(end() - head_);
+        overflowed_bytes_ += n;
+        overflows_++;
+        discard(n);
+    }
+
+    size_t nfree = bytes_free();
+    *len = is_mirrored() ? nfree : std::min(static_cast<size_t>(end() - head_), nfree);
+
+    return head_;
+}
+
+void RingBuffer::commit(size_t count)
+{
+    if (count == 0)
+    {
+        return;
+    }
+
+    head_ += count;
+
+    // wrap?
+    if (head_ >= end())
+    {
+        head_ -= size_;
+    }
+
+    full_ = (head_ == tail_);
+    added();
+}
+
+void RingBuffer::get_memory(uint8_t **base, size_t *length) const
+{
+    *base = buf_.get();
+    *length = is_mirrored() ? 2 * size_ : size_;
+}
+
 ssize_t RingBuffer::peek(void *dst, size_t count) const
 {
     if (count > bytes_used())
@@ -104,6 +627,12 @@ ssize_t RingBuffer::peek(void *dst, size_t count) const
         return -1;
     }
 
+    if (is_mirrored())
+    {
+        ::memcpy(dst, tail_, count);
+        return count;
+    }
+
     uint8_t *u8dst = static_cast<uint8_t *>(dst);
     uint8_t *bufend = end();
     size_t nwritten = 0;
@@ -135,6 +664,16 @@ ssize_t RingBuffer::memcpy_from(void *dst, size_t count)
     uint8_t *u8dst = static_cast<uint8_t *>(dst);
     uint8_t *bufend = end();
     size_t nwritten = 0;
+    if (is_mirrored())
+    {
+        ::memcpy(u8dst, tail_, count);
+        tail_ += count;
+        if (tail_ >= bufend)
+        {
+            tail_ -= size_;
+        }
+        nwritten = count;
+    }
     while (nwritten != count)
     {
         size_t n = std::min(static_cast<size_t>(bufend - tail_), count - nwritten);
@@ -151,9 +690,112 @@ ssize_t RingBuffer::memcpy_from(void *dst, size_t count)
 
     full_ = false;
 
+    consumed(count);
+
     return nwritten;
 }
 
+ssize_t RingBuffer::discard(size_t count)
+{
+    if (count == 0 || count > bytes_used())
+    {
+        return -1;
+    }
+
+    size_t n = std::min(static_cast<size_t>(end() - tail_), count);
+    if (n == count)
+    {
+        tail_ += n;
+    }
+    else
+    {
+        tail_ = buf_.get() + (count - n);
+    }
+
+    // wrap?
+    if (tail_ == end())
+    {
+        tail_ = buf_.get();
+    }
+
+    full_ = false;
+
+    consumed(count);
+
+    return count;
+}
+
+ssize_t RingBuffer::peek_spans(size_t count, const uint8_t **first, size_t *first_len,
+                               const uint8_t **second, size_t *second_len) const
+{
+    if (count > bytes_used())
+    {
+        return -1;
+    }
+
+    size_t n = std::min(static_cast<size_t>(end() - tail_), count);
+    if (is_mirrored())
+    {
+        n = count;
+    }
+    *first = tail_;
+    *first_len = n;
+    if (n == count)
+    {
+        *second = nullptr;
+        *second_len = 0;
+    }
+    else
+    {
+        *second = buf_.get();
+        *second_len = count - n;
+    }
+
+    return count;
+}
+
+void RingBuffer::consumed(size_t count)
+{
+    if (count > 0)
+    {
+        tail_generation_++;
+    }
+
+    // The bytes that were scanned are offsets from the tail, so they move
+    // back by the amount that was just removed.
+    if (count >= scanned_)
+    {
+        scanned_ = 0;
+    }
+    else
+    {
+        scanned_ -= count;
+    }
+}
+
+bool RingBuffer::matches_at(size_t offset, const uint8_t *seq, size_t seqlen) const
+{
+    const uint8_t *first;
+    size_t first_len;
+    const uint8_t *second;
+    size_t second_len;
+    peek_spans(offset + seqlen, &first, &first_len, &second, &second_len);
+
+    if (offset >= first_len)
+    {
+        // The whole candidate is in the second span.
+        return ::memcmp(second + (offset - first_len), seq, seqlen) == 0;
+    }
+
+    size_t n = std::min(first_len - offset, seqlen);
+    if (::memcmp(first + offset, seq, n) != 0)
+    {
+        return false;
+    }
+
+    return ::memcmp(second, seq + n, seqlen - n) == 0;
+}
+
 // This returns the number of bytes from tail to the found sequence, or -1 if the sequence can't be found
 ssize_t RingBuffer::findseq(const uint8_t *seq, size_t seqlen) const
 {
@@ -172,35 +814,72 @@ ssize_t RingBuffer::findseq(const uint8_t *seq, size_t seqlen) const
         return -1;
     }
 
-    uint8_t *ringp = tail_;
-    uint32_t tail_offset{0};
-    const uint8_t *seqp = seq;
-    uint8_t *bufend = end();
+    if (seqlen == 0)
+    {
+        return -1;
+    }
+
+    // If we are looking for the same sequence as last time, we can skip the
+    // bytes that we already know don't start a match.  Otherwise, remember
+    // this sequence (if it is small enough) and start from the tail.
+    bool cacheable = seqlen <= sizeof(scanned_seq_);
+    size_t start = 0;
+    if (cacheable && seqlen == scanned_seq_len_ && ::memcmp(seq, scanned_seq_, seqlen) == 0)
+    {
+        start = scanned_;
+    }
+    else if (cacheable)
+    {
+        ::memcpy(scanned_seq_, seq, seqlen);
+        scanned_seq_len_ = seqlen;
+        scanned_ = 0;
+    }
+
+    // The last offset at which the whole sequence can still fit.
+    size_t last = used - seqlen;
+
+    const uint8_t *spans[2];
+    size_t span_lens[2];
+    peek_spans(used, &spans[0], &span_lens[0], &spans[1], &span_lens[1]);
 
-    while (used > 0)
+    // Search each of the contiguous spans for the first byte of the
+    // sequence with memchr, and then check the rest of the sequence (which
+    // may cross the wrap) wherever it is found.
+    size_t span_start = 0;
+    for (int i = 0; i < 2; ++i)
     {
-        if (*ringp == *seqp)
+        size_t span_end = std::min(span_start + span_lens[i], last + 1);
+        size_t offset = std::max(start, span_start);
+        while (offset < span_end)
         {
-            if (seqp == (seq + seqlen - 1))
+            const void *found = ::memchr(spans[i] + (offset - span_start), seq[0], span_end - offset);
+            if (found == nullptr)
+            {
+                break;
+            }
+
+            offset = static_cast<const uint8_t *>(found) - spans[i] + span_start;
+            if (matches_at(offset, seq, seqlen))
             {
                 // Found it!  Return the offset from tail to the start of the sequence
-                return tail_offset - (seqlen - 1);
+                if (cacheable)
+                {
+                    scanned_ = offset;
+                }
+                return offset;
             }
 
-            seqp++;
-        }
-        else
-        {
-            seqp = seq;
+            offset++;
         }
 
-        ringp = ringp + 1;
-        if (ringp == bufend)
-        {
-            ringp = buf_.get();
-        }
-        used--;
-        tail_offset++;
+        span_start += span_lens[i];
+    }
+
+    // Nothing up to and including the last possible offset matched, so the
+    // next search only has to look at bytes that arrive after this.
+    if (cacheable)
+    {
+        scanned_ = last + 1;
     }
 
     return -1;
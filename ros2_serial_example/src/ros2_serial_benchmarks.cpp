@@ -0,0 +1,606 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Google Benchmark micro-benchmarks of the bridge's hot paths: the CRCs,
+// COBS stuffing and unstuffing, searching a wrapped ring buffer for a frame
+// marker, a whole frame round trip through a Transporter for each protocol,
+// the same over an emulated link with bit errors and burst losses,
+// ROS2Topics::dispatch(), looking up the publisher of a topic among many,
+// and setting up the topics of a port.  Run with
+// --benchmark_out=<file> --benchmark_out_format=json to keep the results
+// for comparing across commits.
+//
+// If ROS2_SERIAL_REPLAY_CAPTURE is set to the path of a link capture (see
+// the capture_file parameter of the bridge), BM_Replay also plays the
+// received data of that capture back through the framing code, as fast as
+// possible, so real traffic can be benchmarked as well, and BM_Reframe
+// frames the payloads of the capture with cobs and with cobs_zpe.
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include <fastcdr/Cdr.h>
+#include <fastcdr/FastCdr.h>
+
+#include <rclcpp/rclcpp.hpp>
+#include <std_msgs/msg/u_int8_multi_array.hpp>
+#include <std_msgs/msg/detail/u_int8_multi_array__rosidl_typesupport_fastrtps_cpp.hpp>
+
+#include "ros2_serial_example/cobs.hpp"
+#include "ros2_serial_example/crc16.hpp"
+#include "ros2_serial_example/crc32c.hpp"
+#include "ros2_serial_example/emulated_link_transporter.hpp"
+#include "ros2_serial_example/link_capture.hpp"
+#include "ros2_serial_example/publisher_table.hpp"
+#include "ros2_serial_example/replay_transporter.hpp"
+#include "ros2_serial_example/ring_buffer.hpp"
+#include "ros2_serial_example/transporter.hpp"
+#include "ros2_topics.hpp"
+
+namespace
+{
+
+using ros2_to_serial_bridge::transport::EmulatedLinkTransporter;
+using ros2_to_serial_bridge::transport::LinkCaptureReader;
+using ros2_to_serial_bridge::transport::LinkImpairments;
+using ros2_to_serial_bridge::transport::ReplayTransporter;
+using ros2_to_serial_bridge::transport::Transporter;
+using ros2_to_serial_bridge::transport::impl::COBSEncoder;
+using ros2_to_serial_bridge::transport::impl::CRC16;
+using ros2_to_serial_bridge::transport::impl::CRC32C;
+using ros2_to_serial_bridge::transport::impl::RingBuffer;
+
+constexpr size_t RING_BUFFER_SIZE = 8192;
+
+const char * const PROTOCOLS[] = {"px4", "cobs", "v2", "cobs_zpe"};
+
+// RingBuffer::write() stops at the end of the ring, so keep going until all
+// of the data is in.
+void write_all(RingBuffer * ring, const void *src, size_t count)
+{
+    const uint8_t *data = static_cast<const uint8_t *>(src);
+    while (count > 0)
+    {
+        ssize_t n = ring->write(data, count);
+        if (n <= 0)
+        {
+            throw std::runtime_error("Failed to write to the ring buffer");
+        }
+        data += n;
+        count -= n;
+    }
+}
+
+// A Transporter that doesn't touch any file descriptors.  In LOOPBACK mode
+// every frame that is written ends up in its own ring buffer, ready to be
+// read back; in CAPTURE mode the last frame written is kept; in SINK mode
+// frames are thrown away.  In every mode the bytes written are counted.
+class LoopbackTransporter final : public Transporter
+{
+public:
+    enum class Mode
+    {
+        LOOPBACK,
+        CAPTURE,
+        SINK,
+    };
+
+    LoopbackTransporter(const std::string & protocol, Mode mode)
+        : Transporter(protocol, RING_BUFFER_SIZE), mode_(mode)
+    {
+    }
+
+    ssize_t node_read() override
+    {
+        // Everything that was written is already in the ring.
+        return 0;
+    }
+
+    ssize_t node_write(void *buffer, size_t len) override
+    {
+        written_ += len;
+        if (mode_ == Mode::LOOPBACK)
+        {
+            write_all(&ringbuf_, buffer, len);
+        }
+        if (mode_ == Mode::CAPTURE)
+        {
+            const uint8_t *data = static_cast<const uint8_t *>(buffer);
+            frame_.assign(data, data + len);
+        }
+        return len;
+    }
+
+    bool fds_OK() override
+    {
+        return true;
+    }
+
+    using Transporter::copy_message_from_frame;
+
+    const std::vector<uint8_t> & frame() const
+    {
+        return frame_;
+    }
+
+    size_t written() const
+    {
+        return written_;
+    }
+
+private:
+    Mode mode_;
+    std::vector<uint8_t> frame_;
+    size_t written_{0};
+};
+
+// Make a payload that looks like CDR data: mostly small integers and floats,
+// with the zero padding and zero high bytes that CDR is full of.
+std::vector<uint8_t> make_payload(size_t len)
+{
+    std::mt19937 rng(len);
+    std::uniform_int_distribution<int> byte(0, 255);
+    std::vector<uint8_t> payload(len);
+    for (size_t i = 0; i < len; ++i)
+    {
+        payload[i] = (i % 4 == 3 || byte(rng) < 64) ? 0 : static_cast<uint8_t>(byte(rng));
+    }
+    return payload;
+}
+
+void BM_CRC16(benchmark::State & state)
+{
+    CRC16::Engine engine = static_cast<CRC16::Engine>(state.range(0));
+    if (!CRC16::engine_supported(engine))
+    {
+        state.SkipWithError("engine not supported on this CPU");
+        return;
+    }
+    CRC16 crc(engine);
+    std::vector<uint8_t> payload = make_payload(state.range(1));
+
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(crc.update(0, payload.data(), payload.size()));
+    }
+    state.SetBytesProcessed(state.iterations() * payload.size());
+}
+BENCHMARK(BM_CRC16)->ArgNames({"engine", "bytes"})->ArgsProduct({{0, 1, 2}, {16, 256, 4096}});
+
+void BM_CRC32C(benchmark::State & state)
+{
+    CRC32C::Engine engine = static_cast<CRC32C::Engine>(state.range(0));
+    if (!CRC32C::engine_supported(engine))
+    {
+        state.SkipWithError("engine not supported on this CPU");
+        return;
+    }
+    CRC32C crc(engine);
+    std::vector<uint8_t> payload = make_payload(state.range(1));
+
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(crc.update(0, payload.data(), payload.size()));
+    }
+    state.SetBytesProcessed(state.iterations() * payload.size());
+}
+BENCHMARK(BM_CRC32C)->ArgNames({"engine", "bytes"})->ArgsProduct({{0, 1, 2}, {16, 256, 4096}});
+
+// Just the COBS encoding of a payload, with each engine.
+void BM_COBSEncode(benchmark::State & state)
+{
+    COBSEncoder::Engine engine = static_cast<COBSEncoder::Engine>(state.range(0));
+    if (!COBSEncoder::engine_supported(engine))
+    {
+        state.SkipWithError("engine not supported on this CPU");
+        return;
+    }
+    COBSEncoder encoder(engine);
+    std::vector<uint8_t> payload = make_payload(state.range(1));
+    std::vector<uint8_t> out(payload.size() + payload.size() / 254 + 1);
+
+    for (auto _ : state)
+    {
+        COBSEncoder::State stuff_state{};
+        encoder.stuff(&stuff_state, payload.data(), payload.size(), out.data());
+        benchmark::DoNotOptimize(COBSEncoder::finish(&stuff_state, out.data()));
+    }
+    state.SetBytesProcessed(state.iterations() * payload.size());
+}
+BENCHMARK(BM_COBSEncode)->ArgNames({"engine", "bytes"})->ArgsProduct({{0, 1, 2}, {16, 256, 4096}});
+
+// Framing a payload with COBS; the CRC is part of the cost, as it is for
+// every write.
+void BM_COBSStuff(benchmark::State & state)
+{
+    LoopbackTransporter transporter("cobs", LoopbackTransporter::Mode::SINK);
+    std::vector<uint8_t> payload = make_payload(state.range(0));
+
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(transporter.write(0x2, payload.data(), payload.size()));
+    }
+    state.SetBytesProcessed(state.iterations() * payload.size());
+}
+BENCHMARK(BM_COBSStuff)->ArgName("bytes")->Arg(16)->Arg(256)->Arg(4096);
+
+// Unstuffing and checking a complete COBS frame.
+void BM_COBSUnstuff(benchmark::State & state)
+{
+    LoopbackTransporter transporter("cobs", LoopbackTransporter::Mode::CAPTURE);
+    std::vector<uint8_t> payload = make_payload(state.range(0));
+    transporter.write(0x2, payload.data(), payload.size());
+    std::vector<uint8_t> frame = transporter.frame();
+    std::vector<uint8_t> out(payload.size());
+    topic_id_size_t topic_ID;
+
+    for (auto _ : state)
+    {
+        ssize_t len = transporter.copy_message_from_frame(frame.data(), frame.size(), &topic_ID, out.data(), out.size());
+        if (len != static_cast<ssize_t>(payload.size()))
+        {
+            state.SkipWithError("failed to unstuff the frame");
+            return;
+        }
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetBytesProcessed(state.iterations() * payload.size());
+}
+BENCHMARK(BM_COBSUnstuff)->ArgName("bytes")->Arg(16)->Arg(256)->Arg(4096);
+
+// Searching a ring buffer whose data wraps around the end for a PX4 marker
+// that comes after range(0) bytes of garbage.  The garbage has a stray '>'
+// every so often, like CDR data does.  findseq() remembers how far it got for
+// the last sequence it was asked for, so the search alternates between two
+// sequences to make every call scan the whole ring.
+void BM_FindSeqWrapped(benchmark::State & state)
+{
+    size_t garbage_len = state.range(0);
+    RingBuffer ring(RING_BUFFER_SIZE);
+
+    // Move the tail close to the end, so that the data wraps.
+    std::vector<uint8_t> filler(RING_BUFFER_SIZE - garbage_len / 2, 0);
+    write_all(&ring, filler.data(), filler.size());
+    ring.discard(filler.size());
+
+    std::vector<uint8_t> data(garbage_len, 0x55);
+    for (size_t i = 61; i < garbage_len; i += 64)
+    {
+        data[i] = '>';
+    }
+    const uint8_t px4_marker[] = {'>', '>', '>'};
+    const uint8_t v2_marker[] = {'>', '>', 0x02};
+    data.insert(data.end(), px4_marker, px4_marker + sizeof(px4_marker));
+    data.insert(data.end(), v2_marker, v2_marker + sizeof(v2_marker));
+    write_all(&ring, data.data(), data.size());
+
+    bool px4 = true;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(ring.findseq(px4 ? px4_marker : v2_marker, 3));
+        px4 = !px4;
+    }
+    state.SetBytesProcessed(state.iterations() * garbage_len);
+}
+BENCHMARK(BM_FindSeqWrapped)->ArgName("garbage")->Arg(64)->Arg(1024)->Arg(4096);
+
+// Writing a payload and reading it back out through the ring buffer, which
+// is the whole framing and parsing cost of a message on one side of a link.
+void BM_RoundTrip(benchmark::State & state)
+{
+    const char *protocol = PROTOCOLS[state.range(0)];
+    LoopbackTransporter transporter(protocol, LoopbackTransporter::Mode::LOOPBACK);
+    std::vector<uint8_t> payload = make_payload(state.range(1));
+    std::vector<uint8_t> out(RING_BUFFER_SIZE);
+    size_t received = 0;
+    auto visitor = [&received](topic_id_size_t, uint8_t *, size_t length)
+    {
+        received += length;
+    };
+
+    for (auto _ : state)
+    {
+        transporter.write(0x2, payload.data(), payload.size());
+        transporter.read_many(out.data(), out.size(), visitor);
+    }
+    if (received != state.iterations() * payload.size())
+    {
+        state.SkipWithError("messages were lost in the round trip");
+    }
+    state.SetLabel(protocol);
+    state.SetBytesProcessed(state.iterations() * payload.size());
+    state.counters["wire_ratio"] = static_cast<double>(transporter.written()) / (state.iterations() * payload.size());
+}
+BENCHMARK(BM_RoundTrip)->ArgNames({"protocol", "bytes"})->ArgsProduct({{0, 1, 2, 3}, {16, 256, 4096}});
+
+// The same round trip over a link that flips 1 bit in 10000 and loses
+// bursts of about 20 bytes, to compare how much gets through with each
+// protocol (the delivered counter is the fraction of messages that did),
+// and what that costs.
+void BM_ImpairedLink(benchmark::State & state)
+{
+    const char *protocol = PROTOCOLS[state.range(0)];
+    LinkImpairments imp;
+    imp.bit_error_rate = 1e-4;
+    imp.burst_rate = 1e-5;
+    imp.burst_length = 20;
+    auto link = EmulatedLinkTransporter::create_pair(protocol, imp, LinkImpairments(), 0, RING_BUFFER_SIZE);
+    if (link.first->init() < 0 || link.second->init() < 0)
+    {
+        state.SkipWithError("failed to open the emulated link");
+        return;
+    }
+    if (state.range(1) != 0 && link.first->set_fec(true) < 0)
+    {
+        state.SkipWithError("failed to turn on FEC");
+        return;
+    }
+    std::vector<uint8_t> payload = make_payload(256);
+    std::vector<uint8_t> out(RING_BUFFER_SIZE);
+    size_t received = 0;
+    auto visitor = [&received](topic_id_size_t, uint8_t *, size_t)
+    {
+        received++;
+    };
+
+    for (auto _ : state)
+    {
+        link.first->write(0x2, payload.data(), payload.size());
+        link.second->read_many(out.data(), out.size(), visitor);
+    }
+    state.SetLabel(std::string(protocol) + (state.range(1) != 0 ? "+fec" : ""));
+    state.SetBytesProcessed(received * payload.size());
+    state.counters["delivered"] = static_cast<double>(received) / state.iterations();
+}
+BENCHMARK(BM_ImpairedLink)->ArgNames({"protocol", "fec"})->Args({0, 0})->Args({1, 0})->Args({2, 0})->Args({2, 1})
+    ->Args({3, 0});
+
+// Handing a payload to ROS2Topics::dispatch(), which deserializes it and
+// publishes it.  The payload sizes span the PX4 messages that are usually
+// bridged, from the small sensor messages (a few dozen bytes) to the larger
+// estimator states (a few hundred), with the CDR overhead of a
+// std_msgs/UInt8MultiArray on top.
+void BM_Dispatch(benchmark::State & state)
+{
+    auto node = std::make_shared<rclcpp::Node>("ros2_serial_benchmarks");
+    LoopbackTransporter transporter("px4", LoopbackTransporter::Mode::SINK);
+
+    std::map<std::string, ros2_to_serial_bridge::pubsub::TopicMapping> topics;
+    ros2_to_serial_bridge::pubsub::TopicMapping mapping;
+    mapping.type = "std_msgs/UInt8MultiArray";
+    mapping.serial_mapping = 0x2;
+    mapping.direction = ros2_to_serial_bridge::pubsub::TopicMapping::Direction::SERIAL_TO_ROS2;
+    mapping.passthrough = state.range(1) != 0;
+    mapping.qos.best_effort();
+    topics["benchmark_dispatch"] = mapping;
+    ros2_to_serial_bridge::pubsub::ROS2Topics ros2_topics(node.get(), topics, &transporter);
+
+    std_msgs::msg::UInt8MultiArray msg;
+    msg.data = make_payload(state.range(0));
+    std::vector<uint8_t> cdr(std_msgs::msg::typesupport_fastrtps_cpp::get_serialized_size(msg, 0));
+    eprosima::fastcdr::FastBuffer buffer(reinterpret_cast<char *>(cdr.data()), cdr.size());
+    eprosima::fastcdr::Cdr scdr(buffer);
+    std_msgs::msg::typesupport_fastrtps_cpp::cdr_serialize(msg, scdr);
+    cdr.resize(scdr.getSerializedDataLength());
+
+    for (auto _ : state)
+    {
+        ros2_topics.dispatch(0x2, cdr.data(), cdr.size());
+    }
+    state.SetLabel(mapping.passthrough ? "passthrough" : "deserialize");
+    state.SetBytesProcessed(state.iterations() * cdr.size());
+}
+BENCHMARK(BM_Dispatch)->ArgNames({"bytes", "passthrough"})->ArgsProduct({{48, 128, 256, 1024}, {0, 1}});
+
+// A Publisher that drops everything, for filling a PublisherTable.
+class NullPublisher final : public ros2_to_serial_bridge::pubsub::Publisher
+{
+public:
+    bool dispatch(uint8_t *, ssize_t, std::chrono::system_clock::time_point) override
+    {
+        return true;
+    }
+};
+
+// Looking up the publishers of range(0) topics in a PublisherTable, in a
+// random order; with range(1), half of the topic IDs are scattered over the
+// whole ID space instead of following on from each other, so they end up in
+// the overflow area.
+void BM_PublisherTableFind(benchmark::State & state)
+{
+    size_t count = static_cast<size_t>(state.range(0));
+    std::vector<NullPublisher> pubs(count);
+    ros2_to_serial_bridge::pubsub::PublisherTable<topic_id_size_t> table;
+    std::vector<topic_id_size_t> topic_IDs;
+    std::mt19937 rng(42);
+    for (size_t i = 0; i < count; ++i)
+    {
+        topic_id_size_t topic_ID = (state.range(1) != 0 && i % 2 == 1) ?
+            static_cast<topic_id_size_t>(rng()) : static_cast<topic_id_size_t>(2 + i);
+        table.insert(topic_ID, &pubs[i]);
+        topic_IDs.push_back(topic_ID);
+    }
+    std::shuffle(topic_IDs.begin(), topic_IDs.end(), rng);
+
+    size_t next = 0;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(table.find(topic_IDs[next]));
+        next = (next + 1 == topic_IDs.size()) ? 0 : next + 1;
+    }
+    state.counters["direct"] = static_cast<double>(table.get_direct_size());
+    state.counters["overflow"] = static_cast<double>(table.get_overflow_size());
+}
+BENCHMARK(BM_PublisherTableFind)->ArgNames({"topics", "sparse"})->ArgsProduct({{16, 1024, 8192}, {0, 1}});
+
+// Constructing a ROS2Topics with range(0) topics, half of them published and
+// half subscribed to, creating their publishers and subscriptions on
+// range(1) threads; this is most of what the bridge does at startup, so a
+// regression here is one in how long it takes to come up.  The entities
+// are created one at a time whatever range(1) is, unless the rmw is one
+// that allows otherwise.
+void BM_CreateTopics(benchmark::State & state)
+{
+    auto node = std::make_shared<rclcpp::Node>("ros2_serial_benchmarks");
+    LoopbackTransporter transporter("px4", LoopbackTransporter::Mode::SINK);
+
+    std::map<std::string, ros2_to_serial_bridge::pubsub::TopicMapping> topics;
+    for (int64_t i = 0; i < state.range(0); ++i)
+    {
+        ros2_to_serial_bridge::pubsub::TopicMapping mapping;
+        mapping.type = "std_msgs/UInt8MultiArray";
+        mapping.serial_mapping = 0x2 + i;
+        mapping.direction = i % 2 == 0 ? ros2_to_serial_bridge::pubsub::TopicMapping::Direction::SERIAL_TO_ROS2 :
+                                         ros2_to_serial_bridge::pubsub::TopicMapping::Direction::ROS2_TO_SERIAL;
+        topics["benchmark_create_" + std::to_string(i)] = mapping;
+    }
+
+    size_t threads = 1;
+    for (auto _ : state)
+    {
+        ros2_to_serial_bridge::pubsub::ROS2Topics ros2_topics(node.get(), topics, &transporter, nullptr, 1, false,
+                                                             nullptr, "", static_cast<size_t>(state.range(1)));
+        threads = ros2_topics.get_entity_creation_stats().threads;
+    }
+    state.counters["threads"] = static_cast<double>(threads);
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_CreateTopics)->ArgNames({"topics", "threads"})->ArgsProduct({{16, 128}, {1, 4}})->Unit(benchmark::kMillisecond);
+
+// Playing back all of the received data of a link capture and parsing it,
+// in the same chunks as it was read from the link.
+void BM_Replay(benchmark::State & state, const std::string & path)
+{
+    LinkCaptureReader reader;
+    if (!reader.open(path))
+    {
+        state.SkipWithError("failed to open the capture");
+        return;
+    }
+    ReplayTransporter transporter(reader.get_protocol(), path, false, 0, RING_BUFFER_SIZE);
+    if (transporter.init() < 0)
+    {
+        state.SkipWithError("failed to open the capture");
+        return;
+    }
+    std::vector<uint8_t> out(RING_BUFFER_SIZE);
+    size_t messages = 0;
+    size_t bytes = 0;
+    auto visitor = [&messages, &bytes](topic_id_size_t, uint8_t *, size_t length)
+    {
+        messages++;
+        bytes += length;
+    };
+
+    for (auto _ : state)
+    {
+        transporter.rewind();
+        while (!transporter.is_finished())
+        {
+            transporter.read_many(out.data(), out.size(), visitor);
+        }
+    }
+    state.SetItemsProcessed(messages);
+    state.SetBytesProcessed(bytes);
+}
+
+// Framing all of the payloads received in a link capture again with another
+// protocol, to compare what the framings cost, in time and in bytes on the
+// wire (the wire_ratio counter is the bytes written per payload byte).
+void BM_Reframe(benchmark::State & state, const std::string & path, const std::string & protocol)
+{
+    LinkCaptureReader reader;
+    if (!reader.open(path))
+    {
+        state.SkipWithError("failed to open the capture");
+        return;
+    }
+    ReplayTransporter replay(reader.get_protocol(), path, false, 0, RING_BUFFER_SIZE);
+    if (replay.init() < 0)
+    {
+        state.SkipWithError("failed to open the capture");
+        return;
+    }
+    std::vector<uint8_t> out(RING_BUFFER_SIZE);
+    std::vector<std::pair<topic_id_size_t, std::vector<uint8_t>>> payloads;
+    size_t bytes = 0;
+    auto visitor = [&payloads, &bytes](topic_id_size_t topic_ID, uint8_t *data, size_t length)
+    {
+        payloads.emplace_back(topic_ID, std::vector<uint8_t>(data, data + length));
+        bytes += length;
+    };
+    while (!replay.is_finished())
+    {
+        replay.read_many(out.data(), out.size(), visitor);
+    }
+    if (bytes == 0)
+    {
+        state.SkipWithError("no payloads in the capture");
+        return;
+    }
+
+    LoopbackTransporter transporter(protocol, LoopbackTransporter::Mode::SINK);
+    for (auto _ : state)
+    {
+        for (const auto & payload : payloads)
+        {
+            transporter.write(payload.first, payload.second.data(), payload.second.size());
+        }
+    }
+    state.SetLabel(protocol);
+    state.SetItemsProcessed(state.iterations() * payloads.size());
+    state.SetBytesProcessed(state.iterations() * bytes);
+    state.counters["wire_ratio"] = static_cast<double>(transporter.written()) / (state.iterations() * bytes);
+}
+
+}  // namespace
+
+int main(int argc, char **argv)
+{
+    rclcpp::init(argc, argv);
+
+    const char *capture = std::getenv("ROS2_SERIAL_REPLAY_CAPTURE");
+    if (capture != nullptr)
+    {
+        benchmark::RegisterBenchmark("BM_Replay", BM_Replay, std::string(capture));
+        for (const char *protocol : {"cobs", "cobs_zpe"})
+        {
+            benchmark::RegisterBenchmark("BM_Reframe", BM_Reframe, std::string(capture), std::string(protocol));
+        }
+    }
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+    {
+        rclcpp::shutdown();
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+
+    rclcpp::shutdown();
+    return 0;
+}
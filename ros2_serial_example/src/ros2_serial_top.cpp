@@ -0,0 +1,130 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include <diagnostic_msgs/msg/diagnostic_array.hpp>
+#include <rclcpp/rclcpp.hpp>
+
+#include "ros2_serial_example/bridge_monitor.hpp"
+
+static void usage(const char *name)
+{
+    ::printf("Usage: %s [options]\n\n"
+             "  -h            Print this help message\n"
+             "  -n <topics>   Most topics to show, busiest first, or 0 for\n"
+             "                all of them (default 20)\n"
+             "  -t <topic>    Diagnostics topic the bridge publishes on\n"
+             "                (default '/diagnostics')\n",
+             name);
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<std::string> args = rclcpp::init_and_remove_ros_arguments(argc, argv);
+    std::vector<char *> non_ros_argv;
+    for (std::string & arg : args)
+    {
+        non_ros_argv.push_back(&arg[0]);
+    }
+    non_ros_argv.push_back(nullptr);
+    int non_ros_argc = static_cast<int>(args.size());
+
+    std::string topic{"/diagnostics"};
+    unsigned long max_topics = 20;
+
+    int ch;
+    while ((ch = ::getopt(non_ros_argc, non_ros_argv.data(), "hn:t:")) != EOF)
+    {
+        switch (ch)
+        {
+        case 'h':
+            usage(argv[0]);
+            rclcpp::shutdown();
+            return 0;
+        case 'n':
+            if (optarg != nullptr)
+            {
+                char *endptr;
+                errno = 0;
+                max_topics = ::strtoul(optarg, &endptr, 10);
+                if (errno == ERANGE || *optarg == '\0' || *endptr != '\0')
+                {
+                    ::fprintf(stderr, "Invalid number of topics; must be a number >= 0\n");
+                    rclcpp::shutdown();
+                    return 1;
+                }
+            }
+            break;
+        case 't':
+            if (optarg != nullptr)
+            {
+                topic = optarg;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            rclcpp::shutdown();
+            return 1;
+        }
+    }
+
+    if (optind < non_ros_argc)
+    {
+        usage(argv[0]);
+        rclcpp::shutdown();
+        return 1;
+    }
+
+    auto node = std::make_shared<rclcpp::Node>("ros2_serial_top");
+    ros2_to_serial_bridge::monitor::BridgeMonitor monitor;
+
+    // The bridge publishes all of its ports at once, every
+    // diagnostics_period_ms, so the table is redrawn as each report comes in.
+    auto sub = node->create_subscription<diagnostic_msgs::msg::DiagnosticArray>(
+        topic, rclcpp::QoS(rclcpp::KeepLast(10)),
+        [&](const diagnostic_msgs::msg::DiagnosticArray::SharedPtr msg) {
+            int64_t stamp_ns = rclcpp::Time(msg->header.stamp).nanoseconds();
+            ros2_to_serial_bridge::monitor::BridgeMonitor::Values values;
+            for (const auto & status : msg->status)
+            {
+                values.clear();
+                for (const auto & kv : status.values)
+                {
+                    values.emplace_back(kv.key, kv.value);
+                }
+                monitor.update(status.name, stamp_ns, values);
+            }
+
+            // Home the cursor and clear the screen before each redraw.
+            ::printf("\033[H\033[2J%s", monitor.render(max_topics).c_str());
+            ::fflush(stdout);
+        });
+
+    ::printf("Waiting for the bridge to publish on %s (it needs diagnostics_period_ms set)\n", topic.c_str());
+    ::fflush(stdout);
+    rclcpp::spin(node);
+
+    rclcpp::shutdown();
+
+    return 0;
+}
@@ -12,326 +12,453 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
-#include <future>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iterator>
+#include <limits>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <stdexcept>
 #include <string>
+#include <vector>
+
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
 
 #include <fastcdr/Cdr.h>
 
+#include <diagnostic_msgs/msg/diagnostic_array.hpp>
 #include <rclcpp/rclcpp.hpp>
 #include <std_msgs/msg/detail/empty__rosidl_typesupport_fastrtps_cpp.hpp>
 
+#include "ros2_serial_msgs/msg/firmware_profile.hpp"
+#include "ros2_serial_msgs/msg/detail/firmware_profile__rosidl_typesupport_fastrtps_cpp.hpp"
+#include "ros2_serial_msgs/msg/flow_credits.hpp"
+#include "ros2_serial_msgs/msg/link_capabilities.hpp"
+#include "ros2_serial_msgs/msg/detail/link_capabilities__rosidl_typesupport_fastrtps_cpp.hpp"
 #include "ros2_serial_msgs/msg/serial_mapping.hpp"
 #include "ros2_serial_msgs/msg/detail/serial_mapping__rosidl_typesupport_fastrtps_cpp.hpp"
+#include "ros2_serial_msgs/msg/time_sync.hpp"
+#include "ros2_serial_msgs/msg/detail/time_sync__rosidl_typesupport_fastrtps_cpp.hpp"
+#include "ros2_serial_msgs/msg/topic_control.hpp"
+#include "ros2_serial_msgs/msg/detail/topic_control__rosidl_typesupport_fastrtps_cpp.hpp"
+#include "ros2_serial_msgs/srv/configure_topic.hpp"
+#include "ros2_serial_msgs/srv/dump_flight_recorder.hpp"
 
+#include "ros2_serial_example/alloc_guard.hpp"
+#include "ros2_serial_example/async_log.hpp"
+#ifdef ROS2_SERIAL_BAG_RECORDER
+#include "ros2_serial_example/bag_recorder.hpp"
+#endif
+#include "ros2_serial_example/link_negotiation.hpp"
+#include "ros2_serial_example/mapping_cache.hpp"
+#include "ros2_serial_example/metrics.hpp"
+#include "ros2_serial_example/relay_table.hpp"
 #include "ros2_serial_example/ros2_to_serial_bridge.hpp"
+#include "ros2_serial_example/startup_profile.hpp"
+#include "ros2_serial_example/thread_settings.hpp"
+#include "ros2_serial_example/time_sync.hpp"
+#include "ros2_serial_example/topic_manifest.hpp"
+#include "ros2_serial_example/topic_namespace.hpp"
 #include "ros2_serial_example/transporter.hpp"
-#include "ros2_serial_example/uart_transporter.hpp"
-#include "ros2_serial_example/udp_transporter.hpp"
+#include "ros2_serial_example/transporter_factory.hpp"
+#include "ros2_serial_example/tx_queue.hpp"
 
 // Generated file
 #include "ros2_topics.hpp"
 
 constexpr int BUFFER_SIZE = 1024;
+// The size of the queue of each dispatch thread.
+constexpr size_t DISPATCH_QUEUE_BYTES = 256 * 1024;
+// The room for the messages each port holds back while it reads a batch, so
+// that the ones with a higher rx_priority are dispatched first; a batch that
+// doesn't fit is dispatched in more than one go.
+constexpr size_t RX_LANES_BYTES = 64 * 1024;
+// The CDR size of a TimeSync: the kind, padding up to 8 bytes, and the three
+// times.
+constexpr size_t TIME_SYNC_SIZE = 32;
+// The CDR size of a FirmwareProfile: the kind, padding up to 4 bytes, the
+// clock, the three arrays of 32-bit counts, and the array of 64-bit totals.
+constexpr size_t FIRMWARE_PROFILE_SIZE = 104;
+// Firmware from before the sleep figures sends a FirmwareProfile without
+// them.
+constexpr size_t FIRMWARE_PROFILE_SIZE_NO_SLEEP = 88;
+
+// The write batch of a port on an RS-485 bus, unless tx_batch_bytes is given.
+constexpr int64_t RS485_TX_BATCH_BYTES = 1024;
+
+// How often the flight recorders are checked for a SIGUSR1, and how often
+// the errors of their ports are.
+constexpr int64_t FLIGHT_RECORDER_POLL_MS = 100;
+constexpr int64_t FLIGHT_RECORDER_ERROR_PERIOD_MS = 1000;
+
+// How long a pass of the read or writer thread of a port may take before it
+// counts as a stall, unless stall_threshold_ms is given.
+constexpr int64_t DEFAULT_STALL_THRESHOLD_MS = 100;
+
+// The transporter takes the FlowCredits apart itself.
+static_assert(ros2_to_serial_bridge::transport::Transporter::FLOW_CREDITS_KIND ==
+              ros2_serial_msgs::msg::FlowCredits::CREDITS, "FlowCredits kind doesn't match the message");
 
 namespace ros2_to_serial_bridge
 {
-ROS2ToSerialBridge::ROS2ToSerialBridge(const rclcpp::NodeOptions& node_options)
-: rclcpp::Node("ros2_to_serial_bridge", rclcpp::NodeOptions(node_options).automatically_declare_parameters_from_overrides(true))
+namespace
 {
-    std::string backend_comms{};
-    std::string device{};
-    std::string backend_protocol{};
-    uint32_t baudrate;
-    int64_t dynamic_serial_mapping_ms{-1};
-    uint32_t read_poll_ms;
-    size_t ring_buffer_size;
-    uint16_t udp_send_port{0};
-    uint16_t udp_recv_port{0};
 
-    if (!get_parameter("backend_comms", backend_comms))
-    {
-      throw std::runtime_error("No backend comms type specified, cannot continue");
-    }
+// Describe a port for error messages; the port of a single-port bridge has
+// no name.
+std::string port_description(const std::string & name)
+{
+    return name.empty() ? "" : " for port '" + name + "'";
+}
 
-    if (!get_parameter("backend_protocol", backend_protocol))
-    {
-        throw std::runtime_error("No backend_protocol specified, cannot continue");
-    }
+// Set by SIGUSR1, for the flight recorders to be dumped from the executor.
+std::atomic<bool> flight_recorder_signalled{false};
+
+void flight_recorder_signal_handler(int)
+{
+    flight_recorder_signalled = true;
+}
 
-    if (!get_parameter("dynamic_serial_mapping_ms", dynamic_serial_mapping_ms))
+// Count the errors in a snapshot of the metrics of a port, as the
+// diagnostics do.
+uint64_t count_errors(const ros2_to_serial_bridge::transport::Metrics::Snapshot & snapshot)
+{
+    uint64_t errors = snapshot.garbage_bytes + snapshot.ring_overflow_bytes + snapshot.read_errors;
+    for (const auto & counters : snapshot.rx)
     {
-        throw std::runtime_error("No dynamic_serial_mapping specified, cannot continue");
+        errors += counters.crc_failures + counters.oversize_drops + counters.decode_failures + counters.write_failures +
+                  counters.stale_drops + counters.deserialize_failures + counters.sequence_gaps +
+                  counters.sequence_duplicates + counters.sequence_reorders;
     }
-
-    if (!get_parameter("read_poll_ms", read_poll_ms))
+    for (const auto & counters : snapshot.tx)
     {
-        throw std::runtime_error("No read_poll_ms specified, cannot continue");
+        errors += counters.crc_failures + counters.oversize_drops + counters.decode_failures + counters.write_failures +
+                  counters.stale_drops + counters.timeouts;
     }
 
-    if (!get_parameter("ring_buffer_size", ring_buffer_size))
+    return errors;
+}
+
+// Send what the transports and topics log through the AsyncLog to the
+// logger of the node; this runs on the thread of the AsyncLog.
+void log_to_node(const rclcpp::Logger & logger, transport::AsyncLog::Level level, const char * text)
+{
+    switch (level)
     {
-        throw std::runtime_error("No ring_buffer_size specified, cannot continue");
+    case transport::AsyncLog::Level::INFO:
+        RCLCPP_INFO(logger, "%s", text);  // NOLINT(cppcoreguidelines-pro-bounds-array-to-pointer-decay,hicpp-no-array-decay)
+        break;
+    case transport::AsyncLog::Level::WARN:
+        RCLCPP_WARN(logger, "%s", text);  // NOLINT(cppcoreguidelines-pro-bounds-array-to-pointer-decay,hicpp-no-array-decay)
+        break;
+    case transport::AsyncLog::Level::ERROR:
+        RCLCPP_ERROR(logger, "%s", text);  // NOLINT(cppcoreguidelines-pro-bounds-array-to-pointer-decay,hicpp-no-array-decay)
+        break;
     }
+}
 
-    if (backend_comms == "uart")
+void add_diagnostic_value(diagnostic_msgs::msg::DiagnosticStatus * status, const std::string & key, const std::string & value)
+{
+    diagnostic_msgs::msg::KeyValue kv;
+    kv.key = key;
+    kv.value = value;
+    status->values.push_back(kv);
+}
+
+// Add the counters of the topics in one direction to a diagnostic status,
+// naming them after their ROS 2 topic where there is one, along with the
+// depth of the queue of each topic in tx_queue that has one.
+//
+// Returns the number of dropped messages among them.
+uint64_t add_topic_diagnostics(diagnostic_msgs::msg::DiagnosticStatus * status, const std::string & direction,
+                               const std::vector<ros2_to_serial_bridge::transport::Metrics::TopicCounters> & topics,
+                               const std::map<topic_id_size_t, std::string> & topic_names,
+                               const ros2_to_serial_bridge::transport::TxQueue * tx_queue)
+{
+    uint64_t drops = 0;
+    for (const auto & counters : topics)
     {
-        if (!get_parameter("device", device))
+        auto name_it = topic_names.find(counters.topic_ID);
+        std::string prefix = direction + "/" + (name_it != topic_names.end() ? name_it->second : std::to_string(counters.topic_ID)) + "/";
+        add_diagnostic_value(status, prefix + "messages", std::to_string(counters.messages));
+        add_diagnostic_value(status, prefix + "bytes", std::to_string(counters.bytes));
+        add_diagnostic_value(status, prefix + "crc_failures", std::to_string(counters.crc_failures));
+        add_diagnostic_value(status, prefix + "oversize_drops", std::to_string(counters.oversize_drops));
+        add_diagnostic_value(status, prefix + "decode_failures", std::to_string(counters.decode_failures));
+        add_diagnostic_value(status, prefix + "write_failures", std::to_string(counters.write_failures));
+        add_diagnostic_value(status, prefix + "stale_drops", std::to_string(counters.stale_drops));
+        drops += counters.crc_failures + counters.oversize_drops + counters.decode_failures + counters.write_failures +
+                 counters.stale_drops;
+        if (direction == "rx")
         {
-          throw std::runtime_error("No device parameter specified, cannot continue");
+            // Only received payloads are deserialized by the bridge.
+            add_diagnostic_value(status, prefix + "deserialize_failures", std::to_string(counters.deserialize_failures));
+            drops += counters.deserialize_failures;
         }
-
-        if (!get_parameter("baudrate", baudrate))
+        if (direction == "rx")
         {
-          throw std::runtime_error("No baudrate specified, cannot continue");
+            // Only received frames have their sequence numbers checked.
+            add_diagnostic_value(status, prefix + "sequence_gaps", std::to_string(counters.sequence_gaps));
+            add_diagnostic_value(status, prefix + "sequence_duplicates", std::to_string(counters.sequence_duplicates));
+            add_diagnostic_value(status, prefix + "sequence_reorders", std::to_string(counters.sequence_reorders));
+            drops += counters.sequence_gaps + counters.sequence_duplicates + counters.sequence_reorders;
+            // Corrected bytes were damaged, but nothing was lost.
+            add_diagnostic_value(status, prefix + "corrected_bytes", std::to_string(counters.corrected_bytes));
         }
-
-        transporter_ = std::make_unique<ros2_to_serial_bridge::transport::UARTTransporter>(device,
-                                                                                           backend_protocol,
-                                                                                           baudrate,
-                                                                                           read_poll_ms,
-                                                                                           ring_buffer_size);
-    }
-    else if (backend_comms == "udp")
-    {
-        if (!get_parameter("udp_recv_port", udp_recv_port))
+        else
         {
-          throw std::runtime_error("No udp_recv_port parameter specified, cannot continue");
+            // Retransmits are losses that were made up for, so they aren't
+            // drops.
+            add_diagnostic_value(status, prefix + "retransmits", std::to_string(counters.retransmits));
+            // Only service requests wait for an answer.
+            add_diagnostic_value(status, prefix + "timeouts", std::to_string(counters.timeouts));
+            drops += counters.timeouts;
         }
-
-        if (!get_parameter("udp_send_port", udp_send_port))
+        ssize_t queue_depth = tx_queue != nullptr ? tx_queue->get_queue_depth(counters.topic_ID) : -1;
+        if (queue_depth >= 0)
         {
-          throw std::runtime_error("No udp_send_port parameter specified, cannot continue");
+            add_diagnostic_value(status, prefix + "queue_depth", std::to_string(queue_depth));
         }
-
-        transporter_ = std::make_unique<ros2_to_serial_bridge::transport::UDPTransporter>(backend_protocol,
-                                                                                          udp_recv_port,
-                                                                                          udp_send_port,
-                                                                                          read_poll_ms,
-                                                                                          ring_buffer_size);
     }
-    else
+    return drops;
+}
+
+// Format a duration in nanoseconds as microseconds.
+std::string format_us(uint64_t ns)
+{
+    char buf[32];
+    ::snprintf(buf, sizeof(buf), "%.1f", static_cast<double>(ns) / 1000.0);
+    return buf;
+}
+
+// Name the topic a stall was put down to, after its ROS 2 topic where there
+// is one.
+std::string stall_topic_name(bool has_topic, topic_id_size_t topic_ID,
+                             const std::map<topic_id_size_t, std::string> & topic_names)
+{
+    if (!has_topic)
     {
-        throw std::runtime_error("Invalid backend_comms type specified; only 'uart' and 'udp' are supported");
+        return "(none)";
     }
+    auto name_it = topic_names.find(topic_ID);
+    return name_it != topic_names.end() ? name_it->second : std::to_string(topic_ID);
+}
 
-    if (transporter_->init() < 0)
+// Add what the watchdog of one of the threads of a port saw to a diagnostic
+// status, under "<thread>_loop/", and warn about the stalls since the last
+// report and about a pass that is stuck right now.
+//
+// Returns true if the thread stalled since the last report or is stuck.
+bool add_watchdog_diagnostics(diagnostic_msgs::msg::DiagnosticStatus * status, const rclcpp::Logger & logger,
+                              const std::string & thread, const std::string & desc,
+                              const ros2_to_serial_bridge::transport::LoopWatchdog & watchdog,
+                              const std::map<topic_id_size_t, std::string> & topic_names,
+                              ros2_to_serial_bridge::transport::LoopWatchdog::Snapshot * snapshot,
+                              uint64_t * reported_stalls)
+{
+    watchdog.snapshot(snapshot);
+    if (snapshot->threshold_ns == 0)
     {
-        throw std::runtime_error("Failed to initialize transport");
+        return false;
     }
 
-    std::map<std::string, ros2_to_serial_bridge::pubsub::TopicMapping> topic_names_and_serialization;
-    if (dynamic_serial_mapping_ms >= 0)
+    std::string prefix = thread + "_loop/";
+    add_diagnostic_value(status, prefix + "passes", std::to_string(snapshot->passes.count));
+    add_diagnostic_value(status, prefix + "p50_us", format_us(snapshot->passes.percentile(50.0)));
+    add_diagnostic_value(status, prefix + "p99_us", format_us(snapshot->passes.percentile(99.0)));
+    add_diagnostic_value(status, prefix + "max_us", format_us(snapshot->passes.max));
+    add_diagnostic_value(status, prefix + "stalls", std::to_string(snapshot->stalls));
+    add_diagnostic_value(status, prefix + "stall_total_us", format_us(snapshot->stall_ns));
+    add_diagnostic_value(status, prefix + "stall_max_us", format_us(snapshot->max_stall_ns));
+    add_diagnostic_value(status, prefix + "stall_ring_overflows", std::to_string(snapshot->stall_ring_overflows));
+    for (const auto & t : snapshot->topics)
     {
-        topic_names_and_serialization = dynamically_get_serial_mapping(dynamic_serial_mapping_ms);
+        std::string topic_prefix = prefix + "stalls/" + stall_topic_name(t.has_topic, t.topic_ID, topic_names) + "/";
+        add_diagnostic_value(status, topic_prefix + "count", std::to_string(t.stalls));
+        add_diagnostic_value(status, topic_prefix + "total_us", format_us(t.total_ns));
+        add_diagnostic_value(status, topic_prefix + "max_us", format_us(t.max_ns));
+        add_diagnostic_value(status, topic_prefix + "ring_overflows", std::to_string(t.ring_overflows));
     }
-    else
+
+    bool stalled = false;
+    if (snapshot->stalls > *reported_stalls)
     {
-        topic_names_and_serialization = parse_node_parameters_for_topics();
+        const ros2_to_serial_bridge::transport::LoopWatchdog::Stall & last = snapshot->last_stall;
+        RCLCPP_WARN(logger, "The %s thread%s stalled %llu time(s) since the last report; the latest took %.1f ms "
+                    "in topic '%s'", thread.c_str(), desc.c_str(),
+                    static_cast<unsigned long long>(snapshot->stalls - *reported_stalls),
+                    static_cast<double>(last.duration_ns) / 1000000.0,
+                    stall_topic_name(last.has_topic, last.topic_ID, topic_names).c_str());
+        stalled = true;
     }
+    *reported_stalls = snapshot->stalls;
 
-    ros2_topics_ = std::make_unique<ros2_to_serial_bridge::pubsub::ROS2Topics>(this,
-                                                                               topic_names_and_serialization,
-                                                                               transporter_.get());
-
-    future_ = exit_signal_.get_future();
+    ros2_to_serial_bridge::transport::LoopWatchdog::Stall stuck;
+    if (watchdog.check(ros2_to_serial_bridge::transport::LoopWatchdog::Clock::now(), &stuck))
+    {
+        RCLCPP_WARN(logger, "The %s thread%s has been stuck for %.1f ms in topic '%s'", thread.c_str(), desc.c_str(),
+                    static_cast<double>(stuck.duration_ns) / 1000000.0,
+                    stall_topic_name(stuck.has_topic, stuck.topic_ID, topic_names).c_str());
+        add_diagnostic_value(status, prefix + "stuck_us", format_us(stuck.duration_ns));
+        stalled = true;
+    }
 
-    read_thread_ = std::thread(&ROS2ToSerialBridge::read_thread_func, this, future_);
+    return stalled;
 }
 
-ROS2ToSerialBridge::~ROS2ToSerialBridge()
+// Serialize a LinkCapabilities message and send it on topic 0 straight away.
+void write_link_capabilities(ros2_to_serial_bridge::transport::Transporter * transporter,
+                             const ros2_serial_msgs::msg::LinkCapabilities & msg)
 {
-    exit_signal_.set_value();
-    read_thread_.join();
-
-    transporter_->close();
+    size_t serialized_size = ros2_serial_msgs::msg::typesupport_fastrtps_cpp::get_serialized_size(msg, 0);
+    std::unique_ptr<uint8_t[]> data_buffer(new uint8_t[serialized_size]{});
+    eprosima::fastcdr::FastBuffer cdrbuffer(reinterpret_cast<char *>(data_buffer.get()), serialized_size);
+    eprosima::fastcdr::Cdr scdr(cdrbuffer);
+    ros2_serial_msgs::msg::typesupport_fastrtps_cpp::cdr_serialize(msg, scdr);
+    if (transporter->write(0, data_buffer.get(), scdr.getSerializedDataLength()) < 0 || transporter->flush() < 0)
+    {
+        throw std::runtime_error("Failed to write link negotiation message");
+    }
 }
 
-void ROS2ToSerialBridge::read_thread_func(const std::shared_future<void> & local_future)
+// Serialize a TimeSync message and send it on topic 0 straight away.  The
+// time the message is sent at, t1 of a REQUEST or t3 of a RESPONSE, is taken
+// last.
+//
+// Returns 0 on success, or -1 if it couldn't be sent; the next REQUEST
+// makes up for it, so the callers don't complain.
+int write_time_sync(ros2_to_serial_bridge::transport::Transporter * transporter, ros2_serial_msgs::msg::TimeSync * msg)
 {
-    std::future_status status;
-
-    // We use a unique_ptr here both to make this a heap allocation and to quiet
-    // non-owning pointer warnings from clang-tidy
-    std::unique_ptr<uint8_t[]> data_buffer(new uint8_t[BUFFER_SIZE]);
-    ssize_t length = 0;
-    topic_id_size_t topic_ID;
-
-    do
+    char data_buffer[TIME_SYNC_SIZE];
+    eprosima::fastcdr::FastBuffer cdrbuffer(data_buffer, sizeof(data_buffer));
+    eprosima::fastcdr::Cdr scdr(cdrbuffer);
+    int64_t now_ns = ros2_to_serial_bridge::tracing::stamp_ns(std::chrono::system_clock::now());
+    if (msg->kind == ros2_serial_msgs::msg::TimeSync::REQUEST)
     {
-        // Process serial -> ROS 2 data
-        if ((length = transporter_->read(&topic_ID, data_buffer.get(), BUFFER_SIZE)) >= 0)
-        {
-            ros2_topics_->dispatch(topic_ID, data_buffer.get(), length);
-        }
-        status = local_future.wait_for(std::chrono::seconds(0));
-    } while (status == std::future_status::timeout);
+        msg->t1 = now_ns;
+    }
+    else
+    {
+        msg->t3 = now_ns;
+    }
+    ros2_serial_msgs::msg::typesupport_fastrtps_cpp::cdr_serialize(*msg, scdr);
+    if (transporter->write(0, reinterpret_cast<uint8_t *>(data_buffer), scdr.getSerializedDataLength()) < 0 ||
+        transporter->flush() < 0)
+    {
+        return -1;
+    }
+    return 0;
 }
 
-std::map<std::string, ros2_to_serial_bridge::pubsub::TopicMapping> ROS2ToSerialBridge::parse_node_parameters_for_topics()
+// Answer a TimeSync REQUEST from the other end, or hand the times of the
+// RESPONSE to one of ours to time_sync (if the port synchronizes its clock).
+void handle_time_sync(ros2_to_serial_bridge::transport::Transporter * transporter,
+                      ros2_to_serial_bridge::transport::TimeSync * time_sync, uint8_t * buffer, size_t length)
 {
-    // Now we go through the YAML file containing our parameters, looking for
-    // parameters of the form:
-    //     topics:
-    //         <topic_name>:
-    //             serial_mapping: <uint8_t>
-    //             type: <string>
-    //             direction: [SerialToROS2|ROS2ToSerial]
-
-    std::map<std::string, ros2_to_serial_bridge::pubsub::TopicMapping> topic_names_and_serialization;
+    int64_t receive_ns = ros2_to_serial_bridge::tracing::stamp_ns(transporter->get_receive_time());
 
-    rcl_interfaces::msg::ListParametersResult list_params_result = list_parameters({}, 0);
-    for (const auto & name : list_params_result.names)
+    // Checking the length up front means that deserializing can't throw.
+    if (length < TIME_SYNC_SIZE)
     {
-        if (std::count(name.begin(), name.end(), '.') != 2)
-        {
-          // This is not a parameter in a subsection, so it can't possibly be
-          // what we are looking for.  Just silently ignore and continue to
-          // allow other parameters.
-          continue;
-        }
-
-        std::size_t first_dot_pos = name.find_first_of('.');
-        if (first_dot_pos == std::string::npos)
-        {
-            throw std::runtime_error("Invalid parameter dot position");
-        }
-
-        std::string topics = name.substr(0, first_dot_pos);
-        if (topics != "topics")
-        {
-            // This is not a parameter in the subsection topics, so it can't
-            // possibly be what we are looking for.  Just silently ignore and
-            // continue to look for other parameters.
-            continue;
-        }
-
-        if (first_dot_pos == name.length())
-        {
-            // Strangely, the dot is the last character of the parameter.  ROS 2
-            // should really never allow this, but just ignore it and continue.
-            continue;
-        }
-
-        std::size_t second_dot_pos = name.find_first_of('.', first_dot_pos + 1);
-        if (second_dot_pos == std::string::npos)
-        {
-            throw std::runtime_error("Invalid parameter second dot position");
-        }
-
-        std::string topic_name = name.substr(first_dot_pos + 1, second_dot_pos - first_dot_pos - 1);
-
-        if (second_dot_pos == name.length())
-        {
-            // Strangely, the dot is the last character of the parameter.  ROS 2
-            // should really never allow this, but just ignore it and continue.
-            continue;
-        }
-
-        std::string param_name = name.substr(second_dot_pos + 1, name.length() - topic_name.length() - topics.length());
-
-        if (topic_names_and_serialization.count(topic_name) == 0)
-        {
-            topic_names_and_serialization[topic_name] = ros2_to_serial_bridge::pubsub::TopicMapping();
-        }
-
-        if (param_name == "serial_mapping")
-        {
-            int64_t serial_mapping = get_parameter(name).get_value<int64_t>();
-            topic_names_and_serialization[topic_name].serial_mapping = static_cast<topic_id_size_t>(serial_mapping);
-        }
-        else if (param_name == "type")
-        {
-            topic_names_and_serialization[topic_name].type = get_parameter(name).get_value<std::string>();
-        }
-        else if (param_name == "direction")
-        {
-            std::string dirstring = get_parameter(name).get_value<std::string>();
-            ros2_to_serial_bridge::pubsub::TopicMapping::Direction direction = ros2_to_serial_bridge::pubsub::TopicMapping::Direction::UNKNOWN;
-            if (dirstring == "SerialToROS2")
-            {
-                direction = ros2_to_serial_bridge::pubsub::TopicMapping::Direction::SERIAL_TO_ROS2;
-            }
-            else if (dirstring == "ROS2ToSerial")
-            {
-                direction = ros2_to_serial_bridge::pubsub::TopicMapping::Direction::ROS2_TO_SERIAL;
-            }
-            else
-            {
-                throw std::runtime_error("Invalid direction for topic; must be one of 'SerialToROS2' or 'ROS2ToSerial'");
-            }
-
-            topic_names_and_serialization[topic_name].direction = direction;
-        }
-        else
-        {
-            throw std::runtime_error("Invalid parameter name");
-        }
+        return;
     }
+    ros2_serial_msgs::msg::TimeSync msg;
+    eprosima::fastcdr::FastBuffer cdrbuffer(reinterpret_cast<char *>(buffer), length);
+    eprosima::fastcdr::Cdr cdrdes(cdrbuffer);
+    ros2_serial_msgs::msg::typesupport_fastrtps_cpp::cdr_deserialize(cdrdes, msg);
 
-    return topic_names_and_serialization;
+    if (msg.kind == ros2_serial_msgs::msg::TimeSync::REQUEST)
+    {
+        msg.kind = ros2_serial_msgs::msg::TimeSync::RESPONSE;
+        msg.t2 = receive_ns;
+        write_time_sync(transporter, &msg);
+    }
+    else if (time_sync != nullptr)
+    {
+        time_sync->sample(msg.t1, msg.t2, msg.t3, receive_ns);
+    }
 }
 
-std::map<std::string, ros2_to_serial_bridge::pubsub::TopicMapping> ROS2ToSerialBridge::dynamically_get_serial_mapping(uint64_t wait_ms)
+// Take apart a FirmwareProfile from the other end.
+//
+// Returns true on success, or false if it is too short.
+bool read_firmware_profile(uint8_t * buffer, size_t length, ros2_serial_msgs::msg::FirmwareProfile * msg)
 {
-    std::map<std::string, ros2_to_serial_bridge::pubsub::TopicMapping> topic_names_and_serialization;
-
+    // Checking the length up front means that deserializing can't throw.
+    if (length < FIRMWARE_PROFILE_SIZE_NO_SLEEP)
     {
-        // In Crystal and earlier, the std_msgs/Empty message has a zero size.
-        // However, that is not true in Dashing and later, so we always attempt
-        // to serialize
-        std_msgs::msg::Empty dynamic_request;
-        size_t serialized_size = std_msgs::msg::typesupport_fastrtps_cpp::get_serialized_size(dynamic_request, 0);
-        std::unique_ptr<uint8_t[]> data_buffer;
-        uint8_t *bufferp = nullptr;
-        size_t serialized_data_length = 0;
-        if (serialized_size != 0)
-        {
-            data_buffer = std::unique_ptr<uint8_t[]>(new uint8_t[serialized_size]{});
-            eprosima::fastcdr::FastBuffer cdrbuffer(reinterpret_cast<char *>(data_buffer.get()), serialized_size);
-            eprosima::fastcdr::Cdr scdr(cdrbuffer);
-            std_msgs::msg::typesupport_fastrtps_cpp::cdr_serialize(dynamic_request, scdr);
-            bufferp = data_buffer.get();
-            serialized_data_length = scdr.getSerializedDataLength();
-        }
-
-        if (transporter_->write(0, bufferp, serialized_data_length) < 0)
-        {
-            throw std::runtime_error("Failed to write dynamic message");
-        }
+        return false;
+    }
+    // The sleep figures of older firmware read as 0.
+    uint8_t padded[FIRMWARE_PROFILE_SIZE]{};
+    if (length < FIRMWARE_PROFILE_SIZE)
+    {
+        ::memcpy(padded, buffer, length);
+        buffer = padded;
+        length = FIRMWARE_PROFILE_SIZE;
     }
+    eprosima::fastcdr::FastBuffer cdrbuffer(reinterpret_cast<char *>(buffer), length);
+    eprosima::fastcdr::Cdr cdrdes(cdrbuffer);
+    ros2_serial_msgs::msg::typesupport_fastrtps_cpp::cdr_deserialize(cdrdes, *msg);
+    return true;
+}
 
-    // Wait for up to wait_ms for a response
+// Wait for up to wait_ms (forever if 0) for the other end to answer an
+// OFFER with one of its own.
+//
+// Returns true if it did, or false if it didn't answer or answered with a
+// SerialMapping, which means it doesn't support negotiation.
+bool read_link_offer(ros2_to_serial_bridge::transport::Transporter * transporter, uint64_t wait_ms,
+                     ros2_to_serial_bridge::transport::LinkCapabilities * remote)
+{
     std::unique_ptr<uint8_t[]> data_buffer(new uint8_t[BUFFER_SIZE]);
     std::chrono::duration<uint64_t, std::ratio<1, 1000>> diff_ms{0};
-    bool got_response{false};
-    ros2_serial_msgs::msg::SerialMapping serial_mapping_msg;
     std::chrono::time_point<std::chrono::system_clock> start = std::chrono::system_clock::now();
     do
     {
         ssize_t length = 0;
         topic_id_size_t topic_ID;
-        if ((length = transporter_->read(&topic_ID, data_buffer.get(), BUFFER_SIZE)) > 0)
+        if ((length = transporter->read(&topic_ID, data_buffer.get(), BUFFER_SIZE)) > 0)
         {
             if (topic_ID == 1)
             {
+                return false;
+            }
+            // The receive credits of an other end with flow control (see
+            // Transporter::set_flow_control()) come in on topic 0 too.
+            if (topic_ID == 0 && data_buffer[0] != ros2_to_serial_bridge::transport::Transporter::FLOW_CREDITS_KIND)
+            {
+                ros2_serial_msgs::msg::LinkCapabilities msg;
                 eprosima::fastcdr::FastBuffer cdrbuffer(reinterpret_cast<char *>(data_buffer.get()), length);
                 eprosima::fastcdr::Cdr cdrdes(cdrbuffer);
-                // Deserialization can fail if the message isn't actually
-                // a SerialMapping message, in which case Fast-CDR will
-                // throw eprosima::fastcdr::exception::NotEnoughMemoryException.
                 try
                 {
-                    ros2_serial_msgs::msg::typesupport_fastrtps_cpp::cdr_deserialize(cdrdes, serial_mapping_msg);
+                    ros2_serial_msgs::msg::typesupport_fastrtps_cpp::cdr_deserialize(cdrdes, msg);
                 }
                 catch(const eprosima::fastcdr::exception::NotEnoughMemoryException & err)
                 {
-                    throw std::runtime_error("Not enough memory for deserialization of SerialMapping message");
+                    continue;
+                }
+                if (msg.kind == ros2_serial_msgs::msg::LinkCapabilities::OFFER)
+                {
+                    remote->baudrates = msg.baudrates;
+                    remote->protocols = msg.protocols;
+                    remote->max_frame_size = msg.max_frame_size;
+                    remote->compression = msg.compression;
+                    remote->batching = msg.batching;
+                    return true;
                 }
-                got_response = true;
-                break;
             }
         }
 
@@ -342,9 +469,106 @@ std::map<std::string, ros2_to_serial_bridge::pubsub::TopicMapping> ROS2ToSerialB
         }
     } while (diff_ms.count() < wait_ms);
 
-    if (!got_response)
+    return false;
+}
+
+ros2_serial_msgs::msg::LinkCapabilities make_link_offer(const ros2_to_serial_bridge::transport::LinkCapabilities & local)
+{
+    ros2_serial_msgs::msg::LinkCapabilities offer;
+    offer.kind = ros2_serial_msgs::msg::LinkCapabilities::OFFER;
+    offer.baudrates = local.baudrates;
+    offer.protocols = local.protocols;
+    offer.max_frame_size = local.max_frame_size;
+    offer.compression = local.compression;
+    offer.batching = local.batching;
+    return offer;
+}
+
+// Ask the other end for its SerialMapping; it answers on topic 1.
+void write_mapping_request(ros2_to_serial_bridge::transport::Transporter * transporter)
+{
+    // In Crystal and earlier, the std_msgs/Empty message has a zero size.
+    // However, that is not true in Dashing and later, so we always attempt
+    // to serialize
+    std_msgs::msg::Empty dynamic_request;
+    size_t serialized_size = std_msgs::msg::typesupport_fastrtps_cpp::get_serialized_size(dynamic_request, 0);
+    std::unique_ptr<uint8_t[]> data_buffer;
+    uint8_t *bufferp = nullptr;
+    size_t serialized_data_length = 0;
+    if (serialized_size != 0)
     {
-        throw std::runtime_error("No response to dynamic serial request");
+        data_buffer = std::unique_ptr<uint8_t[]>(new uint8_t[serialized_size]{});
+        eprosima::fastcdr::FastBuffer cdrbuffer(reinterpret_cast<char *>(data_buffer.get()), serialized_size);
+        eprosima::fastcdr::Cdr scdr(cdrbuffer);
+        std_msgs::msg::typesupport_fastrtps_cpp::cdr_serialize(dynamic_request, scdr);
+        bufferp = data_buffer.get();
+        serialized_data_length = scdr.getSerializedDataLength();
+    }
+
+    if (transporter->write(0, bufferp, serialized_data_length) < 0 || transporter->flush() < 0)
+    {
+        throw std::runtime_error("Failed to write dynamic message");
+    }
+}
+
+// Ask the other end to stop or start sending a topic, how fast, and whether
+// to send it once now; see ros2_serial_msgs/TopicControl.  The other end may
+// not understand it, so a failure is only reported.
+void write_topic_control(ros2_to_serial_bridge::transport::Transporter * transporter, topic_id_size_t topic_ID, bool paused, double max_rate_hz = 0.0, bool refresh = false)
+{
+    ros2_serial_msgs::msg::TopicControl msg;
+    msg.serial_mapping = topic_ID;
+    msg.paused = paused;
+    msg.max_rate_hz = static_cast<float>(max_rate_hz);
+    msg.refresh = refresh;
+    size_t serialized_size = ros2_serial_msgs::msg::typesupport_fastrtps_cpp::get_serialized_size(msg, 0);
+    std::unique_ptr<uint8_t[]> data_buffer(new uint8_t[serialized_size]{});
+    eprosima::fastcdr::FastBuffer cdrbuffer(reinterpret_cast<char *>(data_buffer.get()), serialized_size);
+    eprosima::fastcdr::Cdr scdr(cdrbuffer);
+    ros2_serial_msgs::msg::typesupport_fastrtps_cpp::cdr_serialize(msg, scdr);
+    if (transporter->write(1, data_buffer.get(), scdr.getSerializedDataLength()) < 0 || transporter->flush() < 0)
+    {
+        ::fprintf(stderr, "Failed to write topic control message for topic %u\n", topic_ID);
+    }
+}
+
+// Make all of the SerialToROS2 topics lazy.
+void set_lazy(std::map<std::string, ros2_to_serial_bridge::pubsub::TopicMapping> * topics)
+{
+    for (auto & t : *topics)
+    {
+        if (t.second.direction == ros2_to_serial_bridge::pubsub::TopicMapping::Direction::SERIAL_TO_ROS2)
+        {
+            t.second.lazy = true;
+        }
+    }
+}
+
+// Turn the CDR payload of a SerialMapping message into the topics to set up.
+std::map<std::string, ros2_to_serial_bridge::pubsub::TopicMapping> parse_serial_mapping(const std::vector<uint8_t> & payload)
+{
+    std::map<std::string, ros2_to_serial_bridge::pubsub::TopicMapping> topic_names_and_serialization;
+
+    // Fast-CDR wants a non-const buffer, although it only reads from it.
+    // Devices from before type_hashes or fixed_sizes were added end the
+    // message before them, so enough zeros for their padding and empty
+    // sequences are put after the payload; a message that has them never
+    // gets to the zeros.
+    std::vector<uint8_t> buffer(payload);
+    buffer.resize(payload.size() + 12, 0);
+    ros2_serial_msgs::msg::SerialMapping serial_mapping_msg;
+    eprosima::fastcdr::FastBuffer cdrbuffer(reinterpret_cast<char *>(buffer.data()), buffer.size());
+    eprosima::fastcdr::Cdr cdrdes(cdrbuffer);
+    // Deserialization can fail if the message isn't actually a SerialMapping
+    // message, in which case Fast-CDR will throw
+    // eprosima::fastcdr::exception::NotEnoughMemoryException.
+    try
+    {
+        ros2_serial_msgs::msg::typesupport_fastrtps_cpp::cdr_deserialize(cdrdes, serial_mapping_msg);
+    }
+    catch(const eprosima::fastcdr::exception::NotEnoughMemoryException & err)
+    {
+        throw std::runtime_error("Not enough memory for deserialization of SerialMapping message");
     }
 
     if (serial_mapping_msg.topic_names.size() != serial_mapping_msg.serial_mappings.size() ||
@@ -353,6 +577,14 @@ std::map<std::string, ros2_to_serial_bridge::pubsub::TopicMapping> ROS2ToSerialB
     {
         throw std::runtime_error("Serial mapping message names, mappings, types, and directions must all be the same size");
     }
+    if (!serial_mapping_msg.type_hashes.empty() && serial_mapping_msg.type_hashes.size() != serial_mapping_msg.topic_names.size())
+    {
+        throw std::runtime_error("Serial mapping message type hashes must be empty or the same size as the names");
+    }
+    if (!serial_mapping_msg.fixed_sizes.empty() && serial_mapping_msg.fixed_sizes.size() != serial_mapping_msg.topic_names.size())
+    {
+        throw std::runtime_error("Serial mapping message fixed sizes must be empty or the same size as the names");
+    }
 
     for (size_t i = 0; i < serial_mapping_msg.topic_names.size(); ++i)
     {
@@ -361,6 +593,15 @@ std::map<std::string, ros2_to_serial_bridge::pubsub::TopicMapping> ROS2ToSerialB
         topic_names_and_serialization[topic_name] = ros2_to_serial_bridge::pubsub::TopicMapping();
         topic_names_and_serialization[topic_name].serial_mapping = serial_mapping_msg.serial_mappings[i];
         topic_names_and_serialization[topic_name].type = serial_mapping_msg.types[i];
+        if (!serial_mapping_msg.type_hashes.empty())
+        {
+            topic_names_and_serialization[topic_name].type_hash = serial_mapping_msg.type_hashes[i];
+        }
+        if (!serial_mapping_msg.fixed_sizes.empty() && serial_mapping_msg.fixed_sizes[i] != 0)
+        {
+            topic_names_and_serialization[topic_name].elide_length = true;
+            topic_names_and_serialization[topic_name].fixed_size = serial_mapping_msg.fixed_sizes[i];
+        }
 
         uint8_t direction = serial_mapping_msg.direction[i];
         if (direction == ros2_serial_msgs::msg::SerialMapping::SERIALTOROS2)
@@ -380,6 +621,3067 @@ std::map<std::string, ros2_to_serial_bridge::pubsub::TopicMapping> ROS2ToSerialB
     return topic_names_and_serialization;
 }
 
+// Write the topics to a topic manifest, for a later start to read instead of
+// the topic parameters.
+bool write_topic_manifest(const std::string & path, const std::map<std::string, ros2_to_serial_bridge::pubsub::TopicMapping> & topic_names_and_serialization)
+{
+    std::vector<ros2_to_serial_bridge::transport::ManifestTopic> topics;
+    topics.reserve(topic_names_and_serialization.size());
+    for (const auto & t : topic_names_and_serialization)
+    {
+        const rmw_qos_profile_t & qos = t.second.qos.get_rmw_qos_profile();
+        ros2_to_serial_bridge::transport::ManifestTopic topic;
+        topic.name = t.first;
+        topic.type = t.second.type;
+        topic.serial_mapping = t.second.serial_mapping;
+        topic.direction = static_cast<uint8_t>(t.second.direction);
+        topic.tx_queue_depth = t.second.tx_queue_depth;
+        topic.tx_overflow_policy = static_cast<uint8_t>(t.second.tx_overflow_policy);
+        // The manifest has one priority and one rate per topic, which are the
+        // ones that apply to its direction.
+        bool serial_to_ros2 = t.second.direction == ros2_to_serial_bridge::pubsub::TopicMapping::Direction::SERIAL_TO_ROS2;
+        topic.tx_priority = serial_to_ros2 ? t.second.rx_priority : t.second.tx_priority;
+        topic.tx_max_rate_hz = serial_to_ros2 ? t.second.max_rate_hz : t.second.tx_max_rate_hz;
+        topic.passthrough = t.second.passthrough;
+        topic.reliability = qos.reliability == RMW_QOS_POLICY_RELIABILITY_BEST_EFFORT ? 1 : 0;
+        topic.durability = qos.durability == RMW_QOS_POLICY_DURABILITY_TRANSIENT_LOCAL ? 1 : 0;
+        topic.history_depth = qos.depth;
+        topic.deadline_ms = static_cast<int64_t>(qos.deadline.sec) * 1000 + static_cast<int64_t>(qos.deadline.nsec / 1000000);
+        topic.compress_threshold = t.second.compress_threshold;
+        topic.compress_dictionary = t.second.compress_dictionary;
+        topic.delta_keyframe_interval = t.second.delta_keyframe_interval;
+        topic.stamp_header = t.second.stamp_header;
+        topic.device_stamp = t.second.device_stamp;
+        topic.lazy = t.second.lazy;
+        topic.last_value = t.second.last_value;
+        topic.on_change = t.second.on_change;
+        topic.on_change_keepalive_ms = t.second.on_change_keepalive_ms;
+        topic.reliable = t.second.reliable;
+        topic.elide_length = t.second.elide_length;
+        topic.intern_strings = t.second.intern_strings;
+        topic.quantize = t.second.quantize;
+        topic.batch_type = t.second.batch_type;
+        topic.batch_size = static_cast<uint32_t>(t.second.batch_size);
+        topic.batch_ms = t.second.batch_ms;
+        topic.max_message_size = static_cast<uint32_t>(t.second.max_message_size);
+        topic.max_age_ms = static_cast<uint16_t>(t.second.max_age_ms);
+        topics.push_back(std::move(topic));
+    }
+
+    return ros2_to_serial_bridge::transport::TopicManifest::write(path, topics);
+}
+
+// Read the topics from a topic manifest written by write_topic_manifest().
+std::map<std::string, ros2_to_serial_bridge::pubsub::TopicMapping> read_topic_manifest(const ros2_to_serial_bridge::transport::TopicManifest & manifest)
+{
+    // The manifest was written from a map, so the topics are in order.
+    std::map<std::string, ros2_to_serial_bridge::pubsub::TopicMapping> topic_names_and_serialization;
+    ros2_to_serial_bridge::transport::ManifestTopic topic;
+    for (size_t i = 0; i < manifest.size(); ++i)
+    {
+        manifest.get(i, &topic);
+        if (topic.direction > static_cast<uint8_t>(ros2_to_serial_bridge::pubsub::TopicMapping::Direction::ROS2_TO_SERIAL) ||
+            topic.tx_overflow_policy > static_cast<uint8_t>(ros2_to_serial_bridge::transport::TxQueue::OverflowPolicy::DROP_NEWEST) ||
+            topic.history_depth == 0)
+        {
+            throw std::runtime_error("Invalid topic '" + topic.name + "' in topic manifest");
+        }
+
+        ros2_to_serial_bridge::pubsub::TopicMapping mapping;
+        mapping.type = topic.type;
+        mapping.serial_mapping = topic.serial_mapping;
+        mapping.direction = static_cast<ros2_to_serial_bridge::pubsub::TopicMapping::Direction>(topic.direction);
+        mapping.tx_queue_depth = static_cast<size_t>(topic.tx_queue_depth);
+        mapping.tx_overflow_policy = static_cast<ros2_to_serial_bridge::transport::TxQueue::OverflowPolicy>(topic.tx_overflow_policy);
+        if (mapping.direction == ros2_to_serial_bridge::pubsub::TopicMapping::Direction::SERIAL_TO_ROS2)
+        {
+            mapping.rx_priority = topic.tx_priority;
+            mapping.max_rate_hz = topic.tx_max_rate_hz;
+        }
+        else
+        {
+            mapping.tx_priority = topic.tx_priority;
+            mapping.tx_max_rate_hz = topic.tx_max_rate_hz;
+        }
+        mapping.passthrough = topic.passthrough;
+        if (topic.reliability != 0)
+        {
+            mapping.qos.best_effort();
+        }
+        if (topic.durability != 0)
+        {
+            mapping.qos.transient_local();
+        }
+        mapping.qos.keep_last(static_cast<size_t>(topic.history_depth));
+        if (topic.deadline_ms > 0)
+        {
+            mapping.qos.deadline(rclcpp::Duration(std::chrono::milliseconds(topic.deadline_ms)));
+        }
+        mapping.compress_threshold = topic.compress_threshold;
+        mapping.compress_dictionary = std::move(topic.compress_dictionary);
+        mapping.delta_keyframe_interval = topic.delta_keyframe_interval;
+        mapping.stamp_header = topic.stamp_header;
+        mapping.device_stamp = topic.device_stamp;
+        mapping.lazy = topic.lazy;
+        mapping.last_value = topic.last_value;
+        mapping.on_change = topic.on_change;
+        if (topic.on_change)
+        {
+            mapping.on_change_keepalive_ms = topic.on_change_keepalive_ms;
+        }
+        mapping.reliable = topic.reliable;
+        mapping.elide_length = topic.elide_length;
+        mapping.intern_strings = topic.intern_strings;
+        mapping.quantize = std::move(topic.quantize);
+        mapping.batch_type = std::move(topic.batch_type);
+        mapping.batch_size = topic.batch_size;
+        mapping.batch_ms = topic.batch_ms;
+        mapping.max_message_size = topic.max_message_size;
+        mapping.max_age_ms = topic.max_age_ms;
+        topic_names_and_serialization.emplace_hint(topic_names_and_serialization.end(), topic.name, std::move(mapping));
+    }
+
+    return topic_names_and_serialization;
+}
+
+// The ROS 2 topic names by serial mapping, to label the metrics.
+std::map<topic_id_size_t, std::string> get_topic_names(const std::map<std::string, ros2_to_serial_bridge::pubsub::TopicMapping> & topic_names_and_serialization)
+{
+    std::map<topic_id_size_t, std::string> topic_names;
+    for (const auto & t : topic_names_and_serialization)
+    {
+        if (t.second.serial_mapping >= 0 && t.second.serial_mapping <= std::numeric_limits<topic_id_size_t>::max())
+        {
+            topic_names[static_cast<topic_id_size_t>(t.second.serial_mapping)] = t.first;
+        }
+    }
+    return topic_names;
+}
+
+}  // namespace
+
+ROS2ToSerialBridge::ROS2ToSerialBridge(const rclcpp::NodeOptions& node_options)
+: rclcpp::Node("ros2_to_serial_bridge", rclcpp::NodeOptions(node_options).automatically_declare_parameters_from_overrides(true))
+{
+    rclcpp::Logger logger = get_logger();
+    ros2_to_serial_bridge::transport::AsyncLog::instance().set_sink(
+        [logger](ros2_to_serial_bridge::transport::AsyncLog::Level level, const char * text)
+        {
+            log_to_node(logger, level, text);
+        });
+
+    // With dispatch threads, the read thread only frames the messages, and
+    // the dispatch threads deserialize and publish them.  The messages of a
+    // topic always go to the same dispatch thread, so they stay in order.
+    int64_t dispatch_threads{0};
+    get_parameter("dispatch_threads", dispatch_threads);
+    if (dispatch_threads < 0 || dispatch_threads > 64)
+    {
+        throw std::runtime_error("Invalid dispatch_threads; must be between 0 and 64");
+    }
+    dispatch_threads_ = static_cast<size_t>(dispatch_threads);
+
+    // The topics with an rx_priority above 0 can have dispatch threads of
+    // their own, so that they never wait behind the busier topics.
+    int64_t dispatch_priority_threads{0};
+    get_parameter("dispatch_priority_threads", dispatch_priority_threads);
+    if (dispatch_priority_threads < 0 || dispatch_priority_threads > 64)
+    {
+        throw std::runtime_error("Invalid dispatch_priority_threads; must be between 0 and 64");
+    }
+    if (dispatch_priority_threads > 0 && dispatch_threads_ == 0)
+    {
+        throw std::runtime_error("Invalid dispatch_priority_threads; needs dispatch_threads");
+    }
+    dispatch_priority_threads_ = static_cast<size_t>(dispatch_priority_threads);
+
+    // The publishers and subscriptions of the topics of a port can be
+    // created on several threads at once, which with hundreds of topics is
+    // most of the startup; 0 picks a number from the CPUs there are.
+    int64_t entity_creation_threads{0};
+    get_parameter("entity_creation_threads", entity_creation_threads);
+    if (entity_creation_threads < 0 || entity_creation_threads > 64)
+    {
+        throw std::runtime_error("Invalid entity_creation_threads; must be between 0 and 64");
+    }
+    if (entity_creation_threads == 0)
+    {
+        entity_creation_threads = std::min<int64_t>(std::max<unsigned int>(std::thread::hardware_concurrency(), 1), 8);
+    }
+    entity_creation_threads_ = static_cast<size_t>(entity_creation_threads);
+
+    // The reads can be done by the executor that runs the node's callbacks
+    // instead of by the read thread, which is then left only waiting for
+    // the transports to have data.
+    get_parameter("read_in_executor", read_in_executor_);
+
+    // A bridge can stand by to take over the links of another one: it sets
+    // up everything up front, but leaves the transports closed until it is
+    // activated through ~/activate, which then only has to open them and
+    // start reading.
+    get_parameter("standby", standby_);
+
+    // The bridge threads can be given real-time scheduling, and the memory
+    // of the process locked, so that a busy machine doesn't hold up the
+    // serial traffic.  These are all checked before anything starts.
+    read_thread_settings_ = get_thread_settings("", "read_thread");
+    ros2_to_serial_bridge::transport::ThreadSettings dispatch_thread_settings = get_thread_settings("", "dispatch_thread");
+    ros2_to_serial_bridge::transport::ThreadSettings dispatch_priority_thread_settings = get_thread_settings("", "dispatch_priority_thread");
+    bool lock_memory{false};
+    get_parameter("lock_memory", lock_memory);
+
+    // Once everything is set up, the read and dispatch threads can be
+    // checked for allocations; the buffers they use are sized from the
+    // max_message_size of the topics.
+    std::string hot_path_allocations{"off"};
+    get_parameter("hot_path_allocations", hot_path_allocations);
+    ros2_to_serial_bridge::transport::AllocGuardMode alloc_guard_mode;
+    if (!ros2_to_serial_bridge::transport::parse_alloc_guard_mode(hot_path_allocations, &alloc_guard_mode))
+    {
+        throw std::runtime_error("Invalid hot_path_allocations; must be one of 'off', 'log' or 'abort'");
+    }
+
+    // One bridge can serve several serial ports.  If the ports parameter is
+    // given, it lists the names of the ports, and the parameters for each
+    // port are in a subsection with that name; otherwise the parameters for
+    // the single port are at the top level.
+    std::vector<std::string> port_names;
+    if (get_parameter("ports", port_names) && !port_names.empty())
+    {
+        for (const auto & name : port_names)
+        {
+            if (name.empty() || name.find('.') != std::string::npos || name == "topics")
+            {
+                throw std::runtime_error("Invalid port name '" + name + "'; must not be empty, contain '.', or be 'topics'");
+            }
+            if (std::count(port_names.begin(), port_names.end(), name) != 1)
+            {
+                throw std::runtime_error("Duplicate port name '" + name + "'; this is not allowed");
+            }
+            ports_.push_back(setup_port(name));
+        }
+    }
+    else
+    {
+        ports_.push_back(setup_port(""));
+    }
+    for (size_t i = 0; i < ports_.size(); ++i)
+    {
+        ports_[i]->index = static_cast<uint16_t>(i);
+    }
+
+    // Topics can be passed from one port to another without going through
+    // ROS 2; this needs all of the ports, with their final protocols.
+    for (auto & port : ports_)
+    {
+        setup_relays(port.get());
+    }
+
+    // The read thread's buffer (and the dispatch threads' scratch buffers)
+    // only need to hold the largest message that can be received, so that no
+    // configured topic is ever dropped as oversize.  Topics of unbounded
+    // types without a max_message_size still get BUFFER_SIZE bytes.
+    rx_buffer_size_ = BUFFER_SIZE;
+    for (const auto & port : ports_)
+    {
+        for (const auto & t : port->ros2_topics->get_topics())
+        {
+            if (t.second.direction == ros2_to_serial_bridge::pubsub::TopicMapping::Direction::SERIAL_TO_ROS2)
+            {
+                rx_buffer_size_ = std::max(rx_buffer_size_, t.second.max_message_size);
+            }
+        }
+    }
+
+    // The received messages can be recorded straight into a bag as they
+    // arrive, without deserializing them or going through the middleware.
+    std::string record_bag;
+    get_parameter("record_bag", record_bag);
+    if (!record_bag.empty())
+    {
+#ifdef ROS2_SERIAL_BAG_RECORDER
+        std::string record_storage_id{"mcap"};
+        get_parameter("record_storage_id", record_storage_id);
+        bag_recorder_ = std::make_unique<ros2_to_serial_bridge::pubsub::BagRecorder>(record_bag, record_storage_id,
+                                                                                       DISPATCH_QUEUE_BYTES);
+        for (auto & port : ports_)
+        {
+            update_bag_topics(port.get());
+        }
+#else
+        throw std::runtime_error("record_bag needs the bridge to be built with ENABLE_BAG_RECORDER");
+#endif
+    }
+
+    // This only starts a writer thread for the ports where some topic asked
+    // for a tx queue or write batching is enabled.
+    for (auto & port : ports_)
+    {
+        port->tx_queue->start();
+
+        std::thread::native_handle_type handle;
+        std::string error;
+        if (port->tx_queue->native_handle(&handle) &&
+            !ros2_to_serial_bridge::transport::apply_thread_settings(handle, port->tx_thread_settings, &error))
+        {
+            throw std::runtime_error("Failed to set up tx thread" + port_description(port->name) + ": " + error);
+        }
+    }
+
+    for (const auto & port : ports_)
+    {
+        if (port->busy_poll_us == 0)
+        {
+            continue;
+        }
+        if (read_in_executor_)
+        {
+            ::fprintf(stderr, "busy_poll_us has no effect with read_in_executor\n");
+        }
+        else if (read_thread_settings_.cpus.empty())
+        {
+            ::fprintf(stderr, "busy_poll_us is set, but the read thread isn't pinned to CPUs; "
+                              "it will spin on whichever CPU it is scheduled on\n");
+        }
+        break;
+    }
+
+    // The read thread sleeps in epoll until either one of the transports has
+    // data or the wakeup eventfd is signalled (which is how it is told to
+    // exit).  Each event carries a pointer to its port, or a nullptr for the
+    // wakeup eventfd.
+    wakeup_fd_ = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (wakeup_fd_ < 0)
+    {
+        throw std::runtime_error("Failed to create wakeup eventfd");
+    }
+
+    epoll_fd_ = ::epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd_ < 0)
+    {
+        ::close(wakeup_fd_);
+        throw std::runtime_error("Failed to create epoll fd");
+    }
+
+    struct epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.ptr = nullptr;
+    if (::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wakeup_fd_, &ev) < 0)
+    {
+        ::close(epoll_fd_);
+        ::close(wakeup_fd_);
+        throw std::runtime_error("Failed to add wakeup eventfd to epoll");
+    }
+
+    for (auto & port : ports_)
+    {
+        if (port->reliable)
+        {
+            reliable_ports_.push_back(port.get());
+        }
+    }
+
+    // The metrics of every port are published together on /diagnostics, if
+    // asked for.  The latency histograms cost a few clock reads per message,
+    // so they are only kept when they are going to be published.
+    int64_t diagnostics_period_ms{0};
+    get_parameter("diagnostics_period_ms", diagnostics_period_ms);
+    if (diagnostics_period_ms < 0)
+    {
+        throw std::runtime_error("Invalid diagnostics_period_ms; must be >= 0");
+    }
+    if (diagnostics_period_ms > 0)
+    {
+        for (auto & port : ports_)
+        {
+            port->transporter->get_metrics().set_timing(true);
+        }
+        diagnostics_pub_ = create_publisher<diagnostic_msgs::msg::DiagnosticArray>("/diagnostics", rclcpp::QoS(rclcpp::KeepLast(10)));
+        diagnostics_timer_ = create_wall_timer(std::chrono::milliseconds(diagnostics_period_ms), [this]() { publish_diagnostics(); });
+    }
+
+    // Ports that started from a cached serial mapping are checked against
+    // the other end from the executor, so that replacing their topics never
+    // races with a subscription callback.
+    for (auto & port : ports_)
+    {
+        if (port->mapping_check.pending)
+        {
+            mapping_check_timer_ = create_wall_timer(std::chrono::milliseconds(100), [this]() { check_serial_mappings(); });
+            break;
+        }
+    }
+
+    // Topics can be added, remapped and removed while the bridge runs.  Like
+    // the subscriptions, the service is in the node's default callback group,
+    // so no subscription callback runs while topics are changed.
+    configure_topic_srv_ = create_service<ros2_serial_msgs::srv::ConfigureTopic>(
+        "~/configure_topic",
+        [this](const std::shared_ptr<ros2_serial_msgs::srv::ConfigureTopic::Request> request,
+               std::shared_ptr<ros2_serial_msgs::srv::ConfigureTopic::Response> response)
+        {
+            configure_topic(request, response);
+        });
+
+    // The baudrate, protocol, read_poll_ms and ring_buffer_size of the ports
+    // can be changed while the bridge runs, without restarting it; the read
+    // thread applies them between reads.
+    parameters_callback_ = add_on_set_parameters_callback(
+        [this](const std::vector<rclcpp::Parameter> & parameters)
+        {
+            return on_parameters_set(parameters);
+        });
+
+    // The flight recorders are dumped when asked to through the service or a
+    // SIGUSR1, or when the errors of their port come in too fast.  The
+    // signal only sets a flag, which is checked from the executor.
+    bool has_flight_recorder = std::any_of(ports_.begin(), ports_.end(),
+                                           [](const std::unique_ptr<Port> & port) { return port->flight_recorder; });
+    if (has_flight_recorder)
+    {
+        flight_recorder_dir_ = ".";
+        get_parameter("flight_recorder_dir", flight_recorder_dir_);
+        get_parameter("flight_recorder_error_rate", flight_recorder_error_rate_);
+        if (flight_recorder_error_rate_ < 0.0)
+        {
+            throw std::runtime_error("Invalid flight_recorder_error_rate; must be >= 0");
+        }
+        for (auto & port : ports_)
+        {
+            port->transporter->get_metrics().snapshot(&port->flight_recorder_snapshot);
+            port->flight_recorder_errors = count_errors(port->flight_recorder_snapshot);
+        }
+        flight_recorder_checked_ = std::chrono::steady_clock::now();
+
+        struct sigaction action{};
+        action.sa_handler = flight_recorder_signal_handler;
+        ::sigemptyset(&action.sa_mask);
+        action.sa_flags = SA_RESTART;
+        if (::sigaction(SIGUSR1, &action, nullptr) < 0)
+        {
+            throw std::runtime_error("Failed to set up SIGUSR1 for the flight recorders");
+        }
+        flight_recorder_timer_ = create_wall_timer(std::chrono::milliseconds(FLIGHT_RECORDER_POLL_MS),
+                                                   [this]() { check_flight_recorders(); });
+        dump_flight_recorder_srv_ = create_service<ros2_serial_msgs::srv::DumpFlightRecorder>(
+            "~/dump_flight_recorder",
+            [this](const std::shared_ptr<ros2_serial_msgs::srv::DumpFlightRecorder::Request> request,
+                   std::shared_ptr<ros2_serial_msgs::srv::DumpFlightRecorder::Response> response)
+            {
+                dump_flight_recorders(request, response);
+            });
+    }
+
+    if (dispatch_threads_ > 0)
+    {
+        dispatch_pool_ = std::make_unique<ros2_to_serial_bridge::transport::DispatchPool>(
+            dispatch_threads_, DISPATCH_QUEUE_BYTES,
+            [this](size_t thread, uint16_t port, topic_id_size_t topic_ID, uint8_t * buffer, size_t length,
+                   std::chrono::system_clock::time_point receive_time)
+            {
+                ports_[port]->ros2_topics->dispatch(thread, topic_ID, buffer, length, receive_time);
+            },
+            rx_buffer_size_, dispatch_priority_threads_);
+        for (size_t i = 0; i < dispatch_pool_->workers(); ++i)
+        {
+            std::string error;
+            if (!ros2_to_serial_bridge::transport::apply_thread_settings(dispatch_pool_->native_handle(i),
+                                                                         i < dispatch_threads_ ? dispatch_thread_settings : dispatch_priority_thread_settings,
+                                                                         &error))
+            {
+                throw std::runtime_error("Failed to set up dispatch thread: " + error);
+            }
+        }
+    }
+
+    // By now the ring buffers and queues have all been allocated, so locking
+    // the memory faults all of them in.
+    if (lock_memory)
+    {
+        std::string error;
+        if (!ros2_to_serial_bridge::transport::lock_memory(&error))
+        {
+            throw std::runtime_error(error);
+        }
+    }
+
+    if (!ros2_to_serial_bridge::transport::set_alloc_guard_mode(alloc_guard_mode))
+    {
+        throw std::runtime_error("Failed to check hot_path_allocations; another library replaces operator new");
+    }
+
+    rx_buffer_.reset(new uint8_t[rx_buffer_size_]);
+
+    if (standby_)
+    {
+        // Everything but opening the transports and reading from them is
+        // done by now, so that taking over the links is quick.
+        activate_srv_ = create_service<ros2_serial_msgs::srv::Activate>(
+            "~/activate",
+            [this](const std::shared_ptr<ros2_serial_msgs::srv::Activate::Request> request,
+                   std::shared_ptr<ros2_serial_msgs::srv::Activate::Response> response)
+            {
+                activate(request, response);
+            });
+        ::printf("Standing by; call ~/activate to take over the link\n");
+        return;
+    }
+
+    std::string error;
+    if (!start_io(&error))
+    {
+        ::close(epoll_fd_);
+        ::close(wakeup_fd_);
+        throw std::runtime_error(error);
+    }
+}
+
+ROS2ToSerialBridge::~ROS2ToSerialBridge()
+{
+    if (read_waitable_ != nullptr)
+    {
+        get_node_waitables_interface()->remove_waitable(read_waitable_, nullptr);
+    }
+    stop_read_thread();
+
+    if (dispatch_pool_ != nullptr)
+    {
+        dispatch_pool_->stop();
+    }
+
+#ifdef ROS2_SERIAL_BAG_RECORDER
+    if (bag_recorder_ != nullptr)
+    {
+        bag_recorder_->stop();
+    }
+#endif
+
+    for (auto & port : ports_)
+    {
+        port->tx_queue->stop();
+    }
+
+    ::close(epoll_fd_);
+    ::close(wakeup_fd_);
+
+    for (auto & port : ports_)
+    {
+        port->transporter->close();
+    }
+
+    // Nothing logs any more, so print what is still queued while the node
+    // is still around to log it.
+    ros2_to_serial_bridge::transport::AsyncLog::instance().flush();
+    ros2_to_serial_bridge::transport::AsyncLog::instance().set_sink(ros2_to_serial_bridge::transport::AsyncLog::Sink());
+}
+
+void ROS2ToSerialBridge::stop_read_thread()
+{
+    exiting_ = true;
+    {
+        // The read thread may be waiting for the executor to take its
+        // events, which it won't any more.
+        std::lock_guard<std::mutex> lock(read_handoff_mutex_);
+    }
+    read_handoff_cv_.notify_all();
+
+    uint64_t one = 1;
+    if (::write(wakeup_fd_, &one, sizeof(one)) != static_cast<ssize_t>(sizeof(one)))
+    {
+        ::fprintf(stderr, "Failed to wake up read thread (%d)\n", errno);
+    }
+    // A bridge that stood by and was never activated has no read thread.
+    if (read_thread_.joinable())
+    {
+        read_thread_.join();
+    }
+}
+
+bool ROS2ToSerialBridge::start_io(std::string * error)
+{
+    // The transports of a bridge in standby are only opened now.  A port
+    // that opened stays open if a later one fails, so activating again only
+    // tries the rest.
+    for (auto & port : ports_)
+    {
+        if (!port->transporter->get_standby())
+        {
+            continue;
+        }
+        if (port->transporter->init() < 0)
+        {
+            *error = "Failed to initialize transport" + port_description(port->name);
+            return false;
+        }
+        port->read_fd = port->transporter->get_read_fd();
+        port->transporter->set_standby(false);
+    }
+
+    // The ports that an activation which failed later on already added to
+    // epoll are left there.
+    waitable_ports_ = 0;
+    for (auto & port : ports_)
+    {
+        if (port->read_fd < 0)
+        {
+            if (read_in_executor_)
+            {
+                *error = "read_in_executor needs a transport with a file descriptor" + port_description(port->name);
+                return false;
+            }
+            continue;
+        }
+        struct epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.ptr = port.get();
+        if (::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, port->read_fd, &ev) < 0 && errno != EEXIST)
+        {
+            *error = "Failed to add transport fd" + port_description(port->name) + " to epoll";
+            return false;
+        }
+        ++waitable_ports_;
+    }
+
+    exiting_ = false;
+    if (read_in_executor_)
+    {
+        // The waitable is in the node's default callback group, so, like the
+        // service, it never runs at the same time as a subscription callback.
+        if (read_waitable_ == nullptr)
+        {
+            read_events_.reserve(waitable_ports_ + 1);
+            read_waitable_ = std::make_shared<ReadWaitable>(get_node_base_interface()->get_context(),
+                                                            [this]() { executor_read(); });
+            get_node_waitables_interface()->add_waitable(read_waitable_, nullptr);
+        }
+        read_thread_ = std::thread(&ROS2ToSerialBridge::watch_thread_func, this);
+    }
+    else
+    {
+        read_thread_ = std::thread(&ROS2ToSerialBridge::read_thread_func, this);
+    }
+
+    std::string thread_error;
+    if (!ros2_to_serial_bridge::transport::apply_thread_settings(read_thread_.native_handle(), read_thread_settings_,
+                                                                 &thread_error))
+    {
+        stop_read_thread();
+        *error = "Failed to set up read thread: " + thread_error;
+        return false;
+    }
+
+    return true;
+}
+
+void ROS2ToSerialBridge::activate(const std::shared_ptr<ros2_serial_msgs::srv::Activate::Request>,
+                                  std::shared_ptr<ros2_serial_msgs::srv::Activate::Response> response)
+{
+    if (read_thread_.joinable())
+    {
+        response->success = false;
+        response->message = "The bridge is already active";
+        return;
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::string error;
+    response->success = start_io(&error);
+    response->activate_ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count());
+    if (!response->success)
+    {
+        response->message = error;
+        RCLCPP_WARN(get_logger(), "Failed to activate: %s", error.c_str());
+        return;
+    }
+
+    RCLCPP_INFO(get_logger(), "Activated in %.3f ms", static_cast<double>(response->activate_ns) / 1e6);
+}
+
+template<typename T>
+bool ROS2ToSerialBridge::get_port_parameter(const std::string & prefix, const std::string & name, T & value)
+{
+    // The bridge parameters of a port fall back to the top-level ones, so
+    // that settings shared by all of the ports only need to be given once.
+    if (!prefix.empty() && get_parameter(prefix + name, value))
+    {
+        return true;
+    }
+    return get_parameter(name, value);
+}
+
+ros2_to_serial_bridge::transport::ThreadSettings ROS2ToSerialBridge::get_thread_settings(const std::string & prefix,
+                                                                                        const std::string & name)
+{
+    // Each parameter is optional; a thread without a policy keeps the one it
+    // was created with.
+    ros2_to_serial_bridge::transport::ThreadSettings settings;
+    get_port_parameter(prefix, name + ".policy", settings.policy);
+    get_port_parameter(prefix, name + ".priority", settings.priority);
+    get_port_parameter(prefix, name + ".cpus", settings.cpus);
+
+    std::string error;
+    if (!ros2_to_serial_bridge::transport::check_thread_settings(settings, &error))
+    {
+        throw std::runtime_error("Invalid " + name + " settings: " + error);
+    }
+
+    return settings;
+}
+
+std::unique_ptr<ROS2ToSerialBridge::Port> ROS2ToSerialBridge::setup_port(const std::string & name)
+{
+    std::string prefix = name.empty() ? "" : name + ".";
+    std::string desc = port_description(name);
+    std::string backend_comms{};
+    std::string backend_protocol{};
+    int64_t dynamic_serial_mapping_ms{-1};
+    uint32_t read_poll_ms;
+    size_t ring_buffer_size;
+    int64_t tx_batch_bytes{0};
+    int64_t tx_batch_delay_us{200};
+    int64_t bundle_topic_id{0};
+    int64_t tx_bundle_bytes{0};
+    int64_t congestion_target_ms{0};
+    int64_t congestion_interval_ms{100};
+    int64_t write_timeout_ms{100};
+    int64_t timesync_period_ms{0};
+    int64_t tx_slot_cycle_us{0};
+    int64_t tx_slot_offset_us{0};
+    int64_t tx_slot_length_us{0};
+    int64_t tx_slot_guard_us{0};
+
+    // How long each part of the setup takes is logged at the end.
+    ros2_to_serial_bridge::transport::StartupProfile profile;
+
+    std::unique_ptr<Port> port = std::make_unique<Port>();
+    port->name = name;
+
+    if (!get_port_parameter(prefix, "backend_comms", backend_comms))
+    {
+      throw std::runtime_error("No backend comms type specified" + desc + ", cannot continue");
+    }
+
+    if (!get_port_parameter(prefix, "backend_protocol", backend_protocol))
+    {
+        throw std::runtime_error("No backend_protocol specified" + desc + ", cannot continue");
+    }
+
+    if (!get_port_parameter(prefix, "dynamic_serial_mapping_ms", dynamic_serial_mapping_ms))
+    {
+        throw std::runtime_error("No dynamic_serial_mapping specified" + desc + ", cannot continue");
+    }
+
+    if (!get_port_parameter(prefix, "read_poll_ms", read_poll_ms))
+    {
+        throw std::runtime_error("No read_poll_ms specified" + desc + ", cannot continue");
+    }
+
+    if (!get_port_parameter(prefix, "ring_buffer_size", ring_buffer_size))
+    {
+        throw std::runtime_error("No ring_buffer_size specified" + desc + ", cannot continue");
+    }
+
+    // The backend specific parameters are looked up by the backend itself,
+    // in the subsection for the port only.
+    ros2_to_serial_bridge::transport::TransporterConfig config;
+    config.protocol = backend_protocol;
+    config.read_poll_ms = read_poll_ms;
+    config.ring_buffer_size = ring_buffer_size;
+    config.get_string = [this, prefix](const std::string & param, std::string * value) {
+        return get_parameter(prefix + param, *value);
+    };
+    config.get_int = [this, prefix](const std::string & param, int64_t * value) {
+        return get_parameter(prefix + param, *value);
+    };
+    config.get_bool = [this, prefix](const std::string & param, bool * value) {
+        return get_parameter(prefix + param, *value);
+    };
+    config.get_string_array = [this, prefix](const std::string & param, std::vector<std::string> * value) {
+        return get_parameter(prefix + param, *value);
+    };
+    config.get_int_array = [this, prefix](const std::string & param, std::vector<int64_t> * value) {
+        return get_parameter(prefix + param, *value);
+    };
+    profile.mark("parameters");
+    port->transporter = ros2_to_serial_bridge::transport::TransporterFactory::instance().create(backend_comms, config);
+
+    bool ring_buffer_mirrored{false};
+    get_port_parameter(prefix, "ring_buffer_mirrored", ring_buffer_mirrored);
+    if (ring_buffer_mirrored && port->transporter->set_ring_buffer_mirrored() < 0)
+    {
+        ::fprintf(stderr, "Mirrored ring buffer not available%s; using the ordinary ring buffer\n", desc.c_str());
+    }
+
+    // The ring buffer can grow with bursts instead of overflowing, and
+    // shrinks back to ring_buffer_size once they are over.
+    int64_t ring_buffer_max_size{0};
+    get_port_parameter(prefix, "ring_buffer_max_size", ring_buffer_max_size);
+    if (ring_buffer_max_size < 0 || (ring_buffer_max_size > 0 && static_cast<size_t>(ring_buffer_max_size) <= ring_buffer_size))
+    {
+        throw std::runtime_error("Invalid ring_buffer_max_size" + desc + "; must be 0 or larger than ring_buffer_size");
+    }
+    if (ring_buffer_max_size > 0 &&
+        port->transporter->set_ring_buffer_max_size(static_cast<size_t>(ring_buffer_max_size)) < 0)
+    {
+        throw std::runtime_error("Failed to reserve ring_buffer_max_size" + desc);
+    }
+
+    bool crc32c{false};
+    get_port_parameter(prefix, "crc32c", crc32c);
+    if (crc32c && port->transporter->set_crc32c(true) < 0)
+    {
+        throw std::runtime_error("crc32c" + desc + " requires backend_protocol 'v2'");
+    }
+
+    // Links that damage bytes often can have parity added to each payload,
+    // so that the receiver can put them right instead of dropping the frame.
+    bool fec{false};
+    get_port_parameter(prefix, "fec", fec);
+    if (fec && port->transporter->set_fec(true) < 0)
+    {
+        throw std::runtime_error("fec" + desc + " requires backend_protocol 'v2'");
+    }
+
+    // Links that others can listen in on or send to can have their frames
+    // encrypted and authenticated with a key that both ends share.
+    std::string aead_key_file;
+    get_port_parameter(prefix, "aead_key_file", aead_key_file);
+    if (!aead_key_file.empty())
+    {
+        std::ifstream file(aead_key_file, std::ios::binary);
+        if (!file)
+        {
+            throw std::runtime_error("Failed to open aead_key_file '" + aead_key_file + "'" + desc);
+        }
+        std::vector<uint8_t> key;
+        key.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+        int64_t aead_side{0};
+        get_port_parameter(prefix, "aead_side", aead_side);
+        if (aead_side < 0 || aead_side > 1)
+        {
+            throw std::runtime_error("Invalid aead_side" + desc + "; must be 0 or 1");
+        }
+        int ret = port->transporter->set_aead_key(key, static_cast<unsigned int>(aead_side));
+        std::fill(key.begin(), key.end(), 0);
+        if (ret < 0)
+        {
+            throw std::runtime_error("aead_key_file" + desc + " requires backend_protocol 'v2' and a 32 byte key");
+        }
+    }
+
+    // Long payloads can be sent in fragments, so that they fit the buffers
+    // at the other end and the frames of other topics can go in between.
+    int64_t fragment_size{0};
+    get_port_parameter(prefix, "fragment_size", fragment_size);
+    if (fragment_size < 0 || fragment_size > UINT32_MAX)
+    {
+        throw std::runtime_error("Invalid fragment_size" + desc + "; must be >= 0");
+    }
+    if (fragment_size > 0 && port->transporter->set_fragment_size(static_cast<size_t>(fragment_size)) < 0)
+    {
+        throw std::runtime_error("fragment_size" + desc + " requires backend_protocol 'v2' and must be > 15");
+    }
+
+    // A bridge in standby opens the transport when it is activated (see
+    // start_io()); until then, whatever its topics write goes nowhere.
+    if (standby_)
+    {
+        if (dynamic_serial_mapping_ms >= 0)
+        {
+            throw std::runtime_error("dynamic_serial_mapping_ms" + desc + " can't be used with standby; the mapping "
+                                     "has to be known before the link is up");
+        }
+        port->transporter->set_standby(true);
+    }
+    else if (port->transporter->init() < 0)
+    {
+        throw std::runtime_error("Failed to initialize transport" + desc);
+    }
+    profile.mark("transport");
+
+    get_port_parameter(prefix, "write_timeout_ms", write_timeout_ms);
+    if (write_timeout_ms < 0 || write_timeout_ms > UINT32_MAX)
+    {
+        throw std::runtime_error("Invalid write_timeout_ms" + desc + "; must be >= 0");
+    }
+    port->transporter->set_write_timeout(static_cast<uint32_t>(write_timeout_ms));
+
+    // If asked to, agree with the other end on the fastest settings both can
+    // do before anything else is sent; see ros2_serial_msgs/LinkCapabilities.
+    int64_t negotiate_link_ms{-1};
+    get_port_parameter(prefix, "negotiate_link_ms", negotiate_link_ms);
+    bool link_negotiated{false};
+    ros2_to_serial_bridge::transport::LinkSettings link_settings;
+    if (negotiate_link_ms >= 0 && standby_)
+    {
+        throw std::runtime_error("negotiate_link_ms" + desc + " can't be used with standby; the link settings have "
+                                 "to be known before the link is up");
+    }
+    if (negotiate_link_ms >= 0)
+    {
+        ros2_to_serial_bridge::transport::LinkCapabilities local;
+        if (port->transporter->get_baudrate() != 0)
+        {
+            local.baudrates.push_back(port->transporter->get_baudrate());
+            std::vector<int64_t> baudrates;
+            get_port_parameter(prefix, "negotiate_baudrates", baudrates);
+            for (int64_t baudrate : baudrates)
+            {
+                if (baudrate <= 0 || baudrate > UINT32_MAX)
+                {
+                    throw std::runtime_error("Invalid negotiate_baudrates" + desc + "; must be > 0");
+                }
+                local.baudrates.push_back(static_cast<uint32_t>(baudrate));
+            }
+        }
+        local.protocols = {"v2", "cobs_zpe", "cobs", "px4"};
+        get_port_parameter(prefix, "negotiate_protocols", local.protocols);
+        if (crc32c || fragment_size > 0 || fec || !aead_key_file.empty())
+        {
+            // The CRC-32C, fragments, FEC and keys only exist in the v2
+            // protocol.
+            local.protocols = {"v2"};
+        }
+        local.max_frame_size = static_cast<uint32_t>(std::min(static_cast<size_t>(BUFFER_SIZE), ring_buffer_size));
+        local.compression = true;
+        local.batching = true;
+
+        profile.mark("parameters");
+        link_negotiated = negotiate_link(port->transporter.get(), local, negotiate_link_ms, &link_settings);
+        profile.mark("negotiation");
+        port->link_local = local;
+        if (negotiate_link_ms > 0)
+        {
+            port->link_check_ms = negotiate_link_ms;
+        }
+        if (link_negotiated)
+        {
+            ::printf("Link%s negotiated: %u baud, protocol '%s', max frame size %u, compression %s, batching %s\n",
+                     desc.c_str(), port->transporter->get_baudrate(), link_settings.protocol.c_str(),
+                     link_settings.max_frame_size, link_settings.compression ? "on" : "off",
+                     link_settings.batching ? "on" : "off");
+            if (link_settings.max_frame_size != 0 && fragment_size > link_settings.max_frame_size)
+            {
+                port->transporter->set_fragment_size(link_settings.max_frame_size);
+            }
+        }
+    }
+
+    if (link_negotiated)
+    {
+        port->link_settings = link_settings;
+    }
+    else
+    {
+        port->link_settings.protocol = port->transporter->get_protocol();
+        port->link_local.protocols = {port->link_settings.protocol};
+    }
+
+    // Everything that goes over the link from here on can be recorded, for
+    // replaying it later with the replay backend.  This starts after the
+    // link negotiation, so that the whole capture is in one protocol.
+    std::string capture_file{};
+    get_parameter(prefix + "capture_file", capture_file);
+    if (!capture_file.empty() && port->transporter->set_capture(capture_file) < 0)
+    {
+        throw std::runtime_error("Failed to create capture_file '" + capture_file + "'" + desc);
+    }
+    port->capturing = !capture_file.empty();
+
+    // The flight recorder keeps only the latest traffic, in memory, for
+    // dumping to a capture when something goes wrong.
+    int64_t flight_recorder_kb{0};
+    get_port_parameter(prefix, "flight_recorder_kb", flight_recorder_kb);
+    if (flight_recorder_kb < 0)
+    {
+        throw std::runtime_error("Invalid flight_recorder_kb" + desc + "; must be >= 0");
+    }
+    if (flight_recorder_kb > 0)
+    {
+        if (port->transporter->set_flight_recorder(static_cast<size_t>(flight_recorder_kb) * 1024) < 0)
+        {
+            throw std::runtime_error("Failed to create flight recorder" + desc);
+        }
+        port->flight_recorder = true;
+    }
+
+    // With a cache directory, the last mapping from the other end is kept on
+    // disk, keyed by a hash of what identifies the device.  On the next start
+    // the topics are set up from the cache straight away, and the other end
+    // is asked for its mapping in the background; if it has changed, the
+    // topics are replaced (see check_serial_mappings()).
+    std::string serial_mapping_cache_dir{};
+    get_port_parameter(prefix, "serial_mapping_cache_dir", serial_mapping_cache_dir);
+    std::unique_ptr<ros2_to_serial_bridge::transport::MappingCache> mapping_cache;
+    if (dynamic_serial_mapping_ms >= 0 && !serial_mapping_cache_dir.empty())
+    {
+        std::string device = name + "|" + backend_comms;
+        std::string device_param;
+        int64_t port_param;
+        if (get_parameter(prefix + "device", device_param))
+        {
+            device += "|" + device_param;
+        }
+        if (get_parameter(prefix + "udp_recv_port", port_param))
+        {
+            device += "|" + std::to_string(port_param);
+        }
+        if (get_parameter(prefix + "udp_send_port", port_param))
+        {
+            device += "|" + std::to_string(port_param);
+        }
+        if (get_parameter(prefix + "shm_name", device_param))
+        {
+            device += "|" + device_param;
+        }
+        mapping_cache = std::make_unique<ros2_to_serial_bridge::transport::MappingCache>(serial_mapping_cache_dir, device);
+    }
+
+    profile.mark("parameters");
+    std::map<std::string, ros2_to_serial_bridge::pubsub::TopicMapping> topic_names_and_serialization;
+    std::vector<uint8_t> cached_mapping;
+    if (mapping_cache && mapping_cache->load(&cached_mapping))
+    {
+        try
+        {
+            topic_names_and_serialization = parse_serial_mapping(cached_mapping);
+        }
+        catch (const std::runtime_error & err)
+        {
+            ::fprintf(stderr, "Ignoring serial mapping cache '%s': %s\n", mapping_cache->get_path().c_str(), err.what());
+            cached_mapping.clear();
+        }
+    }
+    if (!cached_mapping.empty())
+    {
+        ::printf("Using cached serial mapping%s from '%s'\n", desc.c_str(), mapping_cache->get_path().c_str());
+        Port::MappingCheck & check = port->mapping_check;
+        check.cache = std::move(mapping_cache);
+        check.cached = std::move(cached_mapping);
+        check.wait_ms = dynamic_serial_mapping_ms;
+        check.start = std::chrono::steady_clock::now();
+        check.last_request = check.start;
+        check.pending = true;
+        write_mapping_request(port->transporter.get());
+    }
+    else if (dynamic_serial_mapping_ms >= 0)
+    {
+        std::vector<uint8_t> payload;
+        topic_names_and_serialization = dynamically_get_serial_mapping(port->transporter.get(), dynamic_serial_mapping_ms, &payload);
+        if (mapping_cache && !mapping_cache->store(payload.data(), payload.size()))
+        {
+            ::fprintf(stderr, "Failed to write serial mapping cache '%s'\n", mapping_cache->get_path().c_str());
+        }
+    }
+    else if (ros2_to_serial_bridge::pubsub::get_baked_topics(name, &topic_names_and_serialization))
+    {
+        // A bridge built with ROS2_SERIAL_BAKED_CONFIG has the topics of its
+        // ports built in, and ignores the topic parameters and manifests.
+        ::printf("Using the %zu topics built into the bridge%s\n", topic_names_and_serialization.size(), desc.c_str());
+    }
+    else
+    {
+        // A precompiled topic manifest saves declaring and parsing the topic
+        // parameters, which adds up with hundreds of topics.  It is written
+        // from the topic parameters by a start with topic_manifest_output.
+        std::string topic_manifest{};
+        get_parameter(prefix + "topic_manifest", topic_manifest);
+        if (!topic_manifest.empty())
+        {
+            ros2_to_serial_bridge::transport::TopicManifest manifest;
+            if (!manifest.open(topic_manifest))
+            {
+                throw std::runtime_error("Failed to read topic_manifest '" + topic_manifest + "'" + desc);
+            }
+            topic_names_and_serialization = read_topic_manifest(manifest);
+        }
+        else
+        {
+            topic_names_and_serialization = parse_node_parameters_for_topics(prefix);
+        }
+
+        std::string topic_manifest_output{};
+        get_parameter(prefix + "topic_manifest_output", topic_manifest_output);
+        if (!topic_manifest_output.empty())
+        {
+            if (!write_topic_manifest(topic_manifest_output, topic_names_and_serialization))
+            {
+                throw std::runtime_error("Failed to write topic_manifest_output '" + topic_manifest_output + "'" + desc);
+            }
+            ::printf("Wrote topic manifest%s to '%s'\n", desc.c_str(), topic_manifest_output.c_str());
+        }
+    }
+    profile.mark("mapping");
+
+    // Lazy publishers drop the data of topics that nothing subscribes to
+    // without deserializing it, and can ask the other end to stop sending it.
+    get_port_parameter(prefix, "lazy_publishers", port->lazy_publishers);
+    if (port->lazy_publishers)
+    {
+        set_lazy(&topic_names_and_serialization);
+    }
+    bool pause_lazy_topics{false};
+    get_port_parameter(prefix, "pause_lazy_topics", pause_lazy_topics);
+    // Topics with last_value set can also ask the other end for a message
+    // when a subscriber joins before there is one to give it.
+    bool refresh_last_values{false};
+    get_port_parameter(prefix, "refresh_last_values", refresh_last_values);
+
+    // Don't ask for what the other end said it can't take.
+    if (link_negotiated)
+    {
+        for (auto & t : topic_names_and_serialization)
+        {
+            if (!link_settings.compression && (t.second.compress_threshold >= 0 || !t.second.compress_dictionary.empty()))
+            {
+                ::fprintf(stderr, "Link%s has no compression; not compressing topic '%s'\n", desc.c_str(), t.first.c_str());
+                t.second.compress_threshold = -1;
+                t.second.compress_dictionary.clear();
+            }
+            if (link_settings.protocol != "v2" && t.second.delta_keyframe_interval > 0)
+            {
+                ::fprintf(stderr, "Link%s is not v2; not sending deltas for topic '%s'\n", desc.c_str(), t.first.c_str());
+                t.second.delta_keyframe_interval = 0;
+            }
+            if (link_settings.protocol != "v2" && t.second.reliable)
+            {
+                ::fprintf(stderr, "Link%s is not v2; not sending topic '%s' reliably\n", desc.c_str(), t.first.c_str());
+                t.second.reliable = false;
+            }
+        }
+    }
+
+    port->tx_queue = std::make_unique<ros2_to_serial_bridge::transport::TxQueue>(port->transporter.get());
+    port->tx_thread_settings = get_thread_settings(prefix, "tx_thread");
+
+    // Write batching is optional; when enabled, the tx queue writer thread
+    // makes sure nothing waits in the batch longer than the delay.  On a
+    // half-duplex RS-485 bus every write turns the bus around, so there it
+    // is on unless asked otherwise, to send frames in bursts.
+    bool rs485{false};
+    if (backend_comms == "uart")
+    {
+        get_port_parameter(prefix, "uart_rs485", rs485);
+    }
+    if (!get_port_parameter(prefix, "tx_batch_bytes", tx_batch_bytes) && rs485)
+    {
+        tx_batch_bytes = RS485_TX_BATCH_BYTES;
+    }
+    get_port_parameter(prefix, "tx_batch_delay_us", tx_batch_delay_us);
+    if (tx_batch_bytes < 0)
+    {
+        throw std::runtime_error("Invalid tx_batch_bytes" + desc + "; must be >= 0");
+    }
+    if (link_negotiated && tx_batch_bytes > 0)
+    {
+        if (!link_settings.batching)
+        {
+            ::fprintf(stderr, "Link%s has no batching; not batching writes\n", desc.c_str());
+            tx_batch_bytes = 0;
+        }
+        else if (link_settings.max_frame_size != 0 && tx_batch_bytes > link_settings.max_frame_size)
+        {
+            tx_batch_bytes = link_settings.max_frame_size;
+        }
+    }
+    if (tx_batch_bytes > 0)
+    {
+        if (tx_batch_delay_us <= 0 || tx_batch_delay_us > UINT32_MAX)
+        {
+            throw std::runtime_error("Invalid tx_batch_delay_us" + desc + "; must be > 0");
+        }
+        if (port->transporter->set_write_batching(static_cast<size_t>(tx_batch_bytes)) < 0)
+        {
+            throw std::runtime_error("Failed to enable write batching" + desc);
+        }
+        port->tx_queue->set_flush_delay(static_cast<uint32_t>(tx_batch_delay_us));
+    }
+
+    // Bundling small payloads into one frame is optional as well; the tx
+    // queue writer thread flushes the bundle like it does the batch.
+    get_port_parameter(prefix, "bundle_topic_id", bundle_topic_id);
+    get_port_parameter(prefix, "tx_bundle_bytes", tx_bundle_bytes);
+    if (bundle_topic_id < 0 || bundle_topic_id > port->transporter->get_max_topic_ID() || bundle_topic_id == 1)
+    {
+        throw std::runtime_error("Invalid bundle_topic_id" + desc + "; must be 0 or between 2 and " +
+                                 std::to_string(port->transporter->get_max_topic_ID()));
+    }
+    if (tx_bundle_bytes < 0)
+    {
+        throw std::runtime_error("Invalid tx_bundle_bytes" + desc + "; must be >= 0");
+    }
+    if (tx_bundle_bytes > 0 && bundle_topic_id == 0)
+    {
+        throw std::runtime_error("tx_bundle_bytes" + desc + " requires bundle_topic_id");
+    }
+    if (bundle_topic_id > 0)
+    {
+        for (const auto & t : topic_names_and_serialization)
+        {
+            if (t.second.serial_mapping == bundle_topic_id)
+            {
+                throw std::runtime_error("Topic '" + t.first + "' uses the bundle_topic_id" + desc);
+            }
+        }
+        if (link_negotiated && link_settings.max_frame_size != 0 && tx_bundle_bytes > link_settings.max_frame_size)
+        {
+            tx_bundle_bytes = link_settings.max_frame_size;
+        }
+        if (port->transporter->set_bundling(static_cast<topic_id_size_t>(bundle_topic_id),
+                                            static_cast<size_t>(tx_bundle_bytes)) < 0)
+        {
+            throw std::runtime_error("Invalid tx_bundle_bytes" + desc + "; too large for the protocol");
+        }
+        if (tx_bundle_bytes > 0)
+        {
+            if (tx_batch_delay_us <= 0 || tx_batch_delay_us > UINT32_MAX)
+            {
+                throw std::runtime_error("Invalid tx_batch_delay_us" + desc + "; must be > 0");
+            }
+            port->tx_queue->set_flush_delay(static_cast<uint32_t>(tx_batch_delay_us));
+        }
+    }
+
+    // Congestion control is optional; when enabled, the lowest tx priorities
+    // are held back while frames wait in the transport for too long.
+    get_port_parameter(prefix, "congestion_target_ms", congestion_target_ms);
+    get_port_parameter(prefix, "congestion_interval_ms", congestion_interval_ms);
+    if (congestion_target_ms < 0 || congestion_target_ms > UINT32_MAX / 1000)
+    {
+        throw std::runtime_error("Invalid congestion_target_ms" + desc + "; must be >= 0");
+    }
+    if (congestion_target_ms > 0)
+    {
+        if (congestion_interval_ms <= 0 || congestion_interval_ms > UINT32_MAX / 1000)
+        {
+            throw std::runtime_error("Invalid congestion_interval_ms" + desc + "; must be > 0");
+        }
+        if (!standby_ && port->transporter->get_write_queue_bytes() < 0)
+        {
+            ::fprintf(stderr, "Transport%s doesn't report its write queue; only reliable topics show congestion\n",
+                      desc.c_str());
+        }
+        port->tx_queue->set_congestion_control(static_cast<uint32_t>(congestion_target_ms * 1000),
+                                               static_cast<uint32_t>(congestion_interval_ms * 1000));
+    }
+
+    // With a multi-threaded executor, the subscriptions can be put in
+    // callback groups of their own, so that one topic's slow write doesn't
+    // hold up the others.
+    bool parallel_subscriptions{false};
+    get_port_parameter(prefix, "parallel_subscriptions", parallel_subscriptions);
+
+    // Ports to several vehicles that use the same topic names keep them
+    // apart with a namespace each, while sharing the node and its threads.
+    get_port_parameter(prefix, "topic_namespace", port->topic_namespace);
+    if (!ros2_to_serial_bridge::pubsub::valid_topic_namespace(port->topic_namespace))
+    {
+        throw std::runtime_error("Invalid topic_namespace '" + port->topic_namespace + "'" + desc +
+                                 "; must be names of letters, digits and underscores separated by slashes");
+    }
+
+    // With time sync, the clock of the other end is estimated from a
+    // TimeSync exchange every timesync_period_ms, so that the topics with
+    // device_stamp can be stamped in host time.
+    get_port_parameter(prefix, "timesync_period_ms", timesync_period_ms);
+    if (timesync_period_ms < 0 || timesync_period_ms > 3600000)
+    {
+        throw std::runtime_error("Invalid timesync_period_ms" + desc + "; must be between 0 and 3600000");
+    }
+    if (timesync_period_ms > 0)
+    {
+        port->time_sync = std::make_unique<ros2_to_serial_bridge::transport::TimeSync>();
+    }
+
+    // A simulator at the other end can run in lockstep with the bridge,
+    // waiting for each of its steps to be published before it takes the
+    // next, and the bridge publishes the simulated time on /clock.
+    bool sim_lockstep{false};
+    get_port_parameter(prefix, "sim_lockstep", sim_lockstep);
+    if (sim_lockstep)
+    {
+        port->sim_lockstep = std::make_unique<ros2_to_serial_bridge::transport::SimLockstep>();
+        if (clock_pub_ == nullptr)
+        {
+            clock_pub_ = create_publisher<rosgraph_msgs::msg::Clock>("/clock", rclcpp::QoS(rclcpp::KeepLast(1)));
+        }
+    }
+
+    // A time slot is optional too; when set, the tx queue writer thread only
+    // sends in its slot of the cycle, so that the two ends of a shared
+    // half-duplex link don't talk over each other.  The cycles are counted on
+    // the clock of the other end with time sync, and on the system clock
+    // otherwise.
+    get_port_parameter(prefix, "tx_slot_cycle_us", tx_slot_cycle_us);
+    get_port_parameter(prefix, "tx_slot_offset_us", tx_slot_offset_us);
+    get_port_parameter(prefix, "tx_slot_length_us", tx_slot_length_us);
+    get_port_parameter(prefix, "tx_slot_guard_us", tx_slot_guard_us);
+    for (int64_t value : {tx_slot_cycle_us, tx_slot_offset_us, tx_slot_length_us, tx_slot_guard_us})
+    {
+        if (value < 0 || value > UINT32_MAX)
+        {
+            throw std::runtime_error("Invalid tx_slot_cycle_us, tx_slot_offset_us, tx_slot_length_us or tx_slot_guard_us" +
+                                     desc + "; must be between 0 and " + std::to_string(UINT32_MAX));
+        }
+    }
+    if (tx_slot_cycle_us > 0)
+    {
+        if (port->tx_queue->set_tx_slot(static_cast<uint32_t>(tx_slot_cycle_us), static_cast<uint32_t>(tx_slot_offset_us),
+                                        static_cast<uint32_t>(tx_slot_length_us), static_cast<uint32_t>(tx_slot_guard_us),
+                                        port->time_sync.get()) < 0)
+        {
+            throw std::runtime_error("Invalid tx_slot" + desc + "; the slot must fit in tx_slot_cycle_us, and be longer "
+                                     "than twice tx_slot_guard_us");
+        }
+        for (const auto & t : topic_names_and_serialization)
+        {
+            if (t.second.direction == ros2_to_serial_bridge::pubsub::TopicMapping::Direction::ROS2_TO_SERIAL &&
+                t.second.tx_queue_depth == 0)
+            {
+                ::fprintf(stderr, "Topic '%s'%s has no tx_queue_depth, so it is sent outside of the tx slot\n",
+                          t.first.c_str(), desc.c_str());
+            }
+        }
+    }
+
+    port->ros2_topics = std::make_unique<ros2_to_serial_bridge::pubsub::ROS2Topics>(this,
+                                                                                    topic_names_and_serialization,
+                                                                                    port->transporter.get(),
+                                                                                    port->tx_queue.get(),
+                                                                                    std::max<size_t>(dispatch_threads_ + dispatch_priority_threads_, 1),
+                                                                                    parallel_subscriptions,
+                                                                                    port->time_sync.get(),
+                                                                                    port->topic_namespace,
+                                                                                    entity_creation_threads_);
+    port->ros2_topics->add_services(parse_node_parameters_for_services(prefix));
+    profile.mark("entities");
+    if (dispatch_threads_ == 0)
+    {
+        port->rx_lanes = std::make_unique<ros2_to_serial_bridge::transport::RxLanes>(RX_LANES_BYTES);
+    }
+    // The buffers of the transporter are sized up front for the largest
+    // message, so that they don't grow while messages flow.  The topics of
+    // bounded types have the largest size of their type by now.
+    size_t max_message_size = 0;
+    std::vector<topic_id_size_t> rx_topic_IDs;
+    for (const auto & t : port->ros2_topics->get_topics())
+    {
+        max_message_size = std::max(max_message_size, t.second.max_message_size);
+        if (t.second.direction == ros2_to_serial_bridge::pubsub::TopicMapping::Direction::SERIAL_TO_ROS2)
+        {
+            rx_topic_IDs.push_back(static_cast<topic_id_size_t>(t.second.serial_mapping));
+        }
+    }
+    if (max_message_size > 0)
+    {
+        port->transporter->reserve_buffers(std::max(max_message_size, static_cast<size_t>(BUFFER_SIZE)), rx_topic_IDs);
+    }
+
+    if (pause_lazy_topics)
+    {
+        ros2_to_serial_bridge::transport::Transporter * transporter = port->transporter.get();
+        port->ros2_topics->set_pause_callback([transporter](topic_id_size_t topic_ID, bool paused) {
+            write_topic_control(transporter, topic_ID, paused);
+        });
+        port->ros2_topics->set_rate_callback([transporter](topic_id_size_t topic_ID, double max_rate_hz) {
+            write_topic_control(transporter, topic_ID, false, max_rate_hz);
+        });
+    }
+    if (refresh_last_values)
+    {
+        // Every TopicControl sets the rate too, so it is the one the other
+        // end was asked for, or 0 if it was never asked for one.
+        ros2_to_serial_bridge::transport::Transporter * transporter = port->transporter.get();
+        port->ros2_topics->set_refresh_callback([transporter, pause_lazy_topics](topic_id_size_t topic_ID, double max_rate_hz) {
+            write_topic_control(transporter, topic_ID, false, pause_lazy_topics ? max_rate_hz : 0.0, true);
+        });
+    }
+
+    if (!standby_)
+    {
+        port->read_fd = port->transporter->get_read_fd();
+    }
+
+    // Busy polling trades a CPU for the latency of waking the read thread up
+    // for each message; transports without a file descriptor are polled
+    // all the time anyway.
+    int64_t busy_poll_us{0};
+    get_port_parameter(prefix, "busy_poll_us", busy_poll_us);
+    if (busy_poll_us < 0 || busy_poll_us > 1000000)
+    {
+        throw std::runtime_error("Invalid busy_poll_us" + desc + "; must be between 0 and 1000000");
+    }
+    port->busy_poll_us = static_cast<uint32_t>(busy_poll_us);
+
+    // A read thread that takes too long over a batch (most likely because
+    // publishing blocks) stops draining the transport, and a writer thread
+    // that takes too long over a frame holds up every topic; both are
+    // flagged in the diagnostics, with the topic at fault.
+    int64_t stall_threshold_ms{DEFAULT_STALL_THRESHOLD_MS};
+    get_port_parameter(prefix, "stall_threshold_ms", stall_threshold_ms);
+    if (stall_threshold_ms < 0)
+    {
+        throw std::runtime_error("Invalid stall_threshold_ms" + desc + "; must be >= 0");
+    }
+    port->read_watchdog.set_threshold(std::chrono::milliseconds(stall_threshold_ms));
+    port->tx_queue->get_watchdog().set_threshold(std::chrono::milliseconds(stall_threshold_ms));
+
+    // With flow control, the other end grants receive credits on topic 0,
+    // which read_port() hands to the transporter; it is only turned on now
+    // that the mapping and the negotiation are done, since nothing can be
+    // written until the first grant.
+    bool flow_control{false};
+    get_port_parameter(prefix, "flow_control", flow_control);
+    port->transporter->set_flow_control(flow_control);
+
+    // The read thread sends the retransmits and acknowledgements, and only
+    // waits as long as they allow; a reliable payload being sent means it
+    // has to work that out again.
+    if (port->transporter->get_protocol() == "v2")
+    {
+        port->reliable = true;
+        port->transporter->set_reliable_notify([this]() {
+            uint64_t one = 1;
+            if (::write(wakeup_fd_, &one, sizeof(one)) != static_cast<ssize_t>(sizeof(one)) && errno != EAGAIN)
+            {
+                ::fprintf(stderr, "Failed to wake up read thread (%d)\n", errno);
+            }
+        });
+    }
+
+    if (timesync_period_ms > 0)
+    {
+        ros2_to_serial_bridge::transport::Transporter * transporter = port->transporter.get();
+        port->time_sync_timer = create_wall_timer(std::chrono::milliseconds(timesync_period_ms), [transporter]() {
+            ros2_serial_msgs::msg::TimeSync request;
+            request.kind = ros2_serial_msgs::msg::TimeSync::REQUEST;
+            write_time_sync(transporter, &request);
+        });
+    }
+
+    topics_changed(port.get());
+
+    profile.mark("setup");
+    const ros2_to_serial_bridge::pubsub::ROS2Topics::EntityCreationStats & stats = port->ros2_topics->get_entity_creation_stats();
+    RCLCPP_INFO(get_logger(), "Setup%s took %s", desc.c_str(), profile.report().c_str());
+    if (stats.count > 0)
+    {
+        RCLCPP_INFO(get_logger(), "Created %zu publishers and subscriptions%s in %.3f ms on %zu threads (slowest '%s' %.3f ms)",
+                    stats.count, desc.c_str(), static_cast<double>(stats.wall.count()) / 1e6, stats.threads,
+                    stats.slowest.c_str(), static_cast<double>(stats.slowest_time.count()) / 1e6);
+    }
+
+    return port;
+}
+
+void ROS2ToSerialBridge::setup_relays(Port * port)
+{
+    // The relays of a port are in its subsection, as
+    //
+    //     relay:
+    //         <port_name>: [<serial_mapping>, ...]
+    //
+    // and each topic ID listed is written to the named port as it is
+    // received, without being deserialized.
+    std::string prefix = port->name.empty() ? "" : port->name + ".";
+    std::map<std::string, rclcpp::Parameter> params;
+    get_parameters_by_prefix(prefix + "relay", params);
+    for (const auto & name_and_param : params)
+    {
+        const std::string & to_name = name_and_param.first;
+        auto to = std::find_if(ports_.begin(), ports_.end(),
+                               [&to_name](const std::unique_ptr<Port> & p) { return p->name == to_name; });
+        if (to == ports_.end() || to->get() == port)
+        {
+            throw std::runtime_error("Invalid relay" + port_description(port->name) + ": '" + to_name +
+                                     "' is not another port");
+        }
+        if (name_and_param.second.get_type() != rclcpp::ParameterType::PARAMETER_INTEGER_ARRAY)
+        {
+            throw std::runtime_error("Invalid relay" + port_description(port->name) + " to '" + to_name +
+                                     "'; must be a list of serial mappings");
+        }
+
+        for (int64_t topic_ID : name_and_param.second.as_integer_array())
+        {
+            // Topics 0 and 1 are the link's own business on each port.
+            if (topic_ID < 2 || topic_ID > std::numeric_limits<topic_id_size_t>::max())
+            {
+                throw std::runtime_error("Invalid relay" + port_description(port->name) + " of topic " +
+                                         std::to_string(topic_ID) + "; must be between 2 and " +
+                                         std::to_string(std::numeric_limits<topic_id_size_t>::max()));
+            }
+            port->relays.add(static_cast<topic_id_size_t>(topic_ID), (*to)->transporter.get());
+        }
+    }
+
+    if (!port->relays.empty())
+    {
+        get_port_parameter(prefix, "relay_publish", port->relay_publish);
+    }
+}
+
+rcl_interfaces::msg::SetParametersResult ROS2ToSerialBridge::on_parameters_set(const std::vector<rclcpp::Parameter> & parameters)
+{
+    rcl_interfaces::msg::SetParametersResult result;
+    result.successful = true;
+
+    // Every parameter is checked before any of them is handed to the read
+    // thread, so that a set of changes is taken whole or not at all.
+    std::vector<Port::LinkChange> changes(ports_.size());
+    std::vector<bool> changed(ports_.size(), false);
+    for (const rclcpp::Parameter & parameter : parameters)
+    {
+        const std::string & full_name = parameter.get_name();
+        for (size_t i = 0; i < ports_.size(); ++i)
+        {
+            Port * port = ports_[i].get();
+            std::string prefix = port->name.empty() ? "" : port->name + ".";
+            std::string name = full_name;
+            if (!prefix.empty() && full_name.compare(0, prefix.size(), prefix) == 0)
+            {
+                name = full_name.substr(prefix.size());
+            }
+            else if (!prefix.empty() && (full_name == "baudrate" || has_parameter(prefix + full_name)))
+            {
+                // The baudrate is only ever set per port, and a port's own
+                // parameter overrides the top-level one.
+                continue;
+            }
+
+            if (name == "baudrate")
+            {
+                if (parameter.get_type() != rclcpp::ParameterType::PARAMETER_INTEGER ||
+                    parameter.as_int() <= 0 || parameter.as_int() > UINT32_MAX)
+                {
+                    result.successful = false;
+                    result.reason = "Invalid " + full_name + "; must be > 0";
+                    return result;
+                }
+                changes[i].baudrate = static_cast<uint32_t>(parameter.as_int());
+            }
+            else if (name == "backend_protocol")
+            {
+                static const std::vector<std::string> protocols{"px4", "cobs", "cobs_zpe", "v2"};
+                if (parameter.get_type() != rclcpp::ParameterType::PARAMETER_STRING ||
+                    std::find(protocols.begin(), protocols.end(), parameter.as_string()) == protocols.end())
+                {
+                    result.successful = false;
+                    result.reason = "Invalid " + full_name + "; must be one of 'px4', 'cobs', 'cobs_zpe' or 'v2'";
+                    return result;
+                }
+                if (port->capturing)
+                {
+                    result.successful = false;
+                    result.reason = "Cannot change " + full_name + " while capturing the traffic in one protocol";
+                    return result;
+                }
+                changes[i].protocol = parameter.as_string();
+            }
+            else if (name == "read_poll_ms")
+            {
+                if (parameter.get_type() != rclcpp::ParameterType::PARAMETER_INTEGER ||
+                    parameter.as_int() < 0 || parameter.as_int() > UINT32_MAX)
+                {
+                    result.successful = false;
+                    result.reason = "Invalid " + full_name + "; must be >= 0";
+                    return result;
+                }
+                changes[i].read_poll_ms = parameter.as_int();
+            }
+            else if (name == "ring_buffer_size")
+            {
+                if (parameter.get_type() != rclcpp::ParameterType::PARAMETER_INTEGER || parameter.as_int() <= 0)
+                {
+                    result.successful = false;
+                    result.reason = "Invalid " + full_name + "; must be > 0";
+                    return result;
+                }
+                changes[i].ring_buffer_size = static_cast<size_t>(parameter.as_int());
+            }
+            else
+            {
+                continue;
+            }
+            changed[i] = true;
+        }
+    }
+
+    bool any_changed = false;
+    for (size_t i = 0; i < ports_.size(); ++i)
+    {
+        if (!changed[i])
+        {
+            continue;
+        }
+        Port * port = ports_[i].get();
+        std::lock_guard<std::mutex> lock(port->link_change_mutex);
+        if (changes[i].baudrate != 0)
+        {
+            port->link_change.baudrate = changes[i].baudrate;
+        }
+        if (!changes[i].protocol.empty())
+        {
+            port->link_change.protocol = changes[i].protocol;
+        }
+        if (changes[i].read_poll_ms >= 0)
+        {
+            port->link_change.read_poll_ms = changes[i].read_poll_ms;
+        }
+        if (changes[i].ring_buffer_size > 0)
+        {
+            port->link_change.ring_buffer_size = changes[i].ring_buffer_size;
+        }
+        port->link_change_pending = true;
+        any_changed = true;
+    }
+
+    // The read thread picks the changes up when it is woken, so they are
+    // applied on the thread that reads, between two reads.
+    uint64_t one = 1;
+    if (any_changed && ::write(wakeup_fd_, &one, sizeof(one)) != static_cast<ssize_t>(sizeof(one)))
+    {
+        result.successful = false;
+        result.reason = "Failed to wake up the read thread";
+    }
+
+    return result;
+}
+
+void ROS2ToSerialBridge::apply_link_changes()
+{
+    for (auto & port : ports_)
+    {
+        if (!port->link_change_pending.exchange(false))
+        {
+            continue;
+        }
+        Port::LinkChange change;
+        {
+            std::lock_guard<std::mutex> lock(port->link_change_mutex);
+            change = port->link_change;
+            port->link_change = Port::LinkChange();
+        }
+        std::string desc = port_description(port->name);
+
+        if (change.read_poll_ms >= 0 && port->transporter->set_read_poll_ms(static_cast<uint32_t>(change.read_poll_ms)) < 0)
+        {
+            ROS2_SERIAL_LOG(WARN, "Failed to change read_poll_ms%s", desc.c_str());
+        }
+
+        // Whatever was received but not read yet moves into the new ring.
+        if (change.ring_buffer_size > 0 && port->transporter->set_ring_buffer_size(change.ring_buffer_size) < 0)
+        {
+            ROS2_SERIAL_LOG(WARN, "Failed to change ring_buffer_size%s to %zu", desc.c_str(), change.ring_buffer_size);
+        }
+
+        // The baudrate and protocol are switched together with the other
+        // end, as when the link is negotiated, and switched back if the link
+        // doesn't come up with them; what comes in while the link is checked
+        // is dropped.
+        if (change.baudrate == 0 && change.protocol.empty())
+        {
+            continue;
+        }
+        ros2_to_serial_bridge::transport::LinkSettings settings = port->link_settings;
+        settings.baudrate = change.baudrate;
+        if (!change.protocol.empty())
+        {
+            settings.protocol = change.protocol;
+        }
+        if (!switch_link(port->transporter.get(), port->link_local, static_cast<uint64_t>(port->link_check_ms), settings))
+        {
+            ROS2_SERIAL_LOG(WARN, "Link%s did not come up at %u baud with protocol '%s'; staying at %u baud with protocol '%s'",
+                            desc.c_str(), settings.baudrate, settings.protocol.c_str(),
+                            port->transporter->get_baudrate(), port->transporter->get_protocol().c_str());
+            continue;
+        }
+        port->link_settings = settings;
+        ROS2_SERIAL_LOG(INFO, "Link%s switched to %u baud, protocol '%s'", desc.c_str(),
+                        port->transporter->get_baudrate(), settings.protocol.c_str());
+    }
+}
+
+void ROS2ToSerialBridge::publish_diagnostics()
+{
+    using Metrics = ros2_to_serial_bridge::transport::Metrics;
+
+    diagnostic_msgs::msg::DiagnosticArray array;
+    array.header.stamp = now();
+
+    for (auto & port : ports_)
+    {
+        port->transporter->get_metrics().snapshot(&port->metrics_snapshot);
+        const Metrics::Snapshot & snapshot = port->metrics_snapshot;
+
+        diagnostic_msgs::msg::DiagnosticStatus status;
+        status.name = port->name.empty() ? get_name() : std::string(get_name()) + ": " + port->name;
+
+        uint64_t errors = snapshot.garbage_bytes + snapshot.ring_overflow_bytes + snapshot.read_errors;
+        errors += add_topic_diagnostics(&status, "rx", snapshot.rx, port->topic_names, nullptr);
+        errors += add_topic_diagnostics(&status, "tx", snapshot.tx, port->topic_names, port->tx_queue.get());
+        add_diagnostic_value(&status, "garbage_bytes", std::to_string(snapshot.garbage_bytes));
+        add_diagnostic_value(&status, "ring_overflow_bytes", std::to_string(snapshot.ring_overflow_bytes));
+        add_diagnostic_value(&status, "ring_overflows", std::to_string(snapshot.ring_overflows));
+        if (snapshot.ring_buffer_capacity > 0)
+        {
+            add_diagnostic_value(&status, "ring_buffer_capacity", std::to_string(snapshot.ring_buffer_capacity));
+            add_diagnostic_value(&status, "ring_buffer_high_water", std::to_string(snapshot.ring_buffer_high_water));
+        }
+        add_diagnostic_value(&status, "read_errors", std::to_string(snapshot.read_errors));
+        // With these, ros2_serial_top can tell how busy the link is.
+        uint32_t baudrate = port->transporter->get_baudrate();
+        if (baudrate > 0)
+        {
+            add_diagnostic_value(&status, "baudrate", std::to_string(baudrate));
+        }
+        ssize_t write_queue_bytes = port->transporter->get_write_queue_bytes();
+        if (write_queue_bytes >= 0)
+        {
+            add_diagnostic_value(&status, "write_queue_bytes", std::to_string(write_queue_bytes));
+        }
+        if (port->transporter->get_flow_control())
+        {
+            add_diagnostic_value(&status, "tx_credits", std::to_string(port->transporter->get_credits()));
+        }
+        if (port->tx_queue->get_congestion_target_us() > 0)
+        {
+            add_diagnostic_value(&status, "congestion_shed_priorities",
+                                 std::to_string(port->tx_queue->get_shed_priorities()));
+            add_diagnostic_value(&status, "congestion_delay_us", std::to_string(port->tx_queue->get_congestion_delay_us()));
+        }
+        if (port->time_sync != nullptr)
+        {
+            bool synced = port->time_sync->is_synced();
+            add_diagnostic_value(&status, "timesync_synced", synced ? "true" : "false");
+            if (synced)
+            {
+                char drift[32];
+                ::snprintf(drift, sizeof(drift), "%.3f", port->time_sync->get_drift_ppm());
+                add_diagnostic_value(&status, "timesync_offset_ns", std::to_string(port->time_sync->get_offset_ns()));
+                add_diagnostic_value(&status, "timesync_drift_ppm", drift);
+                add_diagnostic_value(&status, "timesync_rtt_us",
+                                     format_us(static_cast<uint64_t>(port->time_sync->get_rtt_ns())));
+            }
+        }
+        if (port->sim_lockstep != nullptr)
+        {
+            char factor[32];
+            ::snprintf(factor, sizeof(factor), "%.2f", port->sim_lockstep->get_real_time_factor());
+            add_diagnostic_value(&status, "sim_steps", std::to_string(port->sim_lockstep->get_steps()));
+            add_diagnostic_value(&status, "sim_step_repeats", std::to_string(port->sim_lockstep->get_repeats()));
+            add_diagnostic_value(&status, "sim_time_ns", std::to_string(port->sim_lockstep->get_sim_time_ns()));
+            add_diagnostic_value(&status, "sim_real_time_factor", factor);
+        }
+        if (!port->relays.empty())
+        {
+            errors += port->relays.get_drops();
+            add_diagnostic_value(&status, "relayed", std::to_string(port->relays.get_relayed()));
+            add_diagnostic_value(&status, "relay_drops", std::to_string(port->relays.get_drops()));
+        }
+        if (dispatch_pool_ != nullptr)
+        {
+            uint64_t dispatch_drops = port->dispatch_drops.load();
+            errors += dispatch_drops;
+            add_diagnostic_value(&status, "dispatch_queue_drops", std::to_string(dispatch_drops));
+        }
+
+        {
+            // The cycles the firmware spent on each frame, as of its latest
+            // profile.
+            static const char * const firmware_stage_names[ros2_serial_msgs::msg::FirmwareProfile::NUM_STAGES] = {
+                "rx_decode", "rx_handler", "tx_crc", "tx_encode"};
+            std::lock_guard<std::mutex> profile_lock(port->firmware_profile_mutex);
+            const ros2_serial_msgs::msg::FirmwareProfile & profile = port->firmware_profile;
+            for (size_t i = 0; port->has_firmware_profile && i < profile.count.size(); ++i)
+            {
+                std::string prefix = std::string("firmware/") + firmware_stage_names[i] + "/";
+                uint64_t mean = profile.count[i] > 0 ? profile.total_cycles[i] / profile.count[i] : 0;
+                add_diagnostic_value(&status, prefix + "count", std::to_string(profile.count[i]));
+                add_diagnostic_value(&status, prefix + "mean_cycles", std::to_string(mean));
+                add_diagnostic_value(&status, prefix + "min_cycles", std::to_string(profile.min_cycles[i]));
+                add_diagnostic_value(&status, prefix + "max_cycles", std::to_string(profile.max_cycles[i]));
+                if (profile.core_hz > 0)
+                {
+                    add_diagnostic_value(&status, prefix + "mean_us", format_us(mean * 1000000000ULL / profile.core_hz));
+                }
+            }
+            if (port->has_firmware_profile && profile.period_ms > 0 && profile.core_hz > 0)
+            {
+                // How long the core was awake is what its current draw mostly
+                // depends on; multiply by the run and sleep currents of the
+                // part to estimate it.
+                uint64_t messages = profile.count[ros2_serial_msgs::msg::FirmwareProfile::STAGE_RX_DECODE] +
+                                    profile.count[ros2_serial_msgs::msg::FirmwareProfile::STAGE_TX_ENCODE];
+                double awake_ms = static_cast<double>(profile.awake_cycles) * 1000.0 / profile.core_hz;
+                add_diagnostic_value(&status, "firmware/wakeups", std::to_string(profile.wakeups));
+                add_diagnostic_value(&status, "firmware/wakeups_per_message",
+                                     messages > 0 ? std::to_string(static_cast<double>(profile.wakeups) / messages) : "0");
+                add_diagnostic_value(&status, "firmware/awake_percent",
+                                     std::to_string(std::min(100.0, awake_ms * 100.0 / profile.period_ms)));
+            }
+        }
+
+        static const char * const stage_names[Metrics::NUM_STAGES] = {"serialize", "frame", "write", "dispatch"};
+        for (size_t i = 0; i < Metrics::NUM_STAGES; ++i)
+        {
+            const auto & latency = snapshot.latency[i];
+            std::string prefix = std::string("latency/") + stage_names[i] + "/";
+            add_diagnostic_value(&status, prefix + "count", std::to_string(latency.count));
+            add_diagnostic_value(&status, prefix + "p50_us", format_us(latency.percentile(50.0)));
+            add_diagnostic_value(&status, prefix + "p99_us", format_us(latency.percentile(99.0)));
+            add_diagnostic_value(&status, prefix + "max_us", format_us(latency.max));
+        }
+
+        std::string desc = port_description(port->name);
+        bool stalled = add_watchdog_diagnostics(&status, get_logger(), "read", desc, port->read_watchdog,
+                                                port->topic_names, &port->watchdog_snapshot,
+                                                &port->reported_read_stalls);
+        stalled = add_watchdog_diagnostics(&status, get_logger(), "tx", desc, port->tx_queue->get_watchdog(),
+                                           port->topic_names, &port->watchdog_snapshot,
+                                           &port->reported_tx_stalls) || stalled;
+
+        // The port is only flagged while errors are still being counted, or
+        // while its threads stall.
+        if (errors > port->reported_errors)
+        {
+            status.level = diagnostic_msgs::msg::DiagnosticStatus::WARN;
+            status.message = "Errors since the last report";
+        }
+        else if (stalled)
+        {
+            status.level = diagnostic_msgs::msg::DiagnosticStatus::WARN;
+            status.message = "Stalls since the last report";
+        }
+        else
+        {
+            status.level = diagnostic_msgs::msg::DiagnosticStatus::OK;
+            status.message = "OK";
+        }
+        port->reported_errors = errors;
+
+        array.status.push_back(status);
+    }
+
+    diagnostics_pub_->publish(array);
+}
+
+ssize_t ROS2ToSerialBridge::read_port(Port * port)
+{
+    ros2_to_serial_bridge::transport::HotPathScope hot_path;
+
+    // Process serial -> ROS 2 data; every complete message that arrived in
+    // one read from the transport is dispatched as a batch.  The watchdog
+    // times the batch from its first message, so that the wait for data
+    // isn't counted.
+    ssize_t ret = port->transporter->read_many(rx_buffer_.get(), rx_buffer_size_,
+                                 [this, port](topic_id_size_t topic_ID, uint8_t *buffer, size_t length)
+                                 {
+                                     if (!port->read_watchdog.in_pass())
+                                     {
+                                         port->read_watchdog.begin(port->read_watchdog.now());
+                                     }
+                                     port->read_watchdog.set_topic(topic_ID);
+                                     if (topic_ID == 1 && port->mapping_check.pending)
+                                     {
+                                         // The answer to the background
+                                         // mapping request.
+                                         ros2_to_serial_bridge::transport::ColdPathScope cold_path;
+                                         Port::MappingCheck & check = port->mapping_check;
+                                         std::lock_guard<std::mutex> check_lock(check.mutex);
+                                         check.received.assign(buffer, buffer + length);
+                                         check.has_received = true;
+                                         check.pending = false;
+                                         return;
+                                     }
+                                     if (topic_ID == 0)
+                                     {
+                                         // Receive credits (see
+                                         // Transporter::set_flow_control()),
+                                         // time sync exchanges and firmware
+                                         // profiles; nothing else comes in
+                                         // on topic 0 once the link is up.
+                                         if (length > 0 && (buffer[0] == ros2_serial_msgs::msg::TimeSync::REQUEST ||
+                                                            buffer[0] == ros2_serial_msgs::msg::TimeSync::RESPONSE))
+                                         {
+                                             handle_time_sync(port->transporter.get(), port->time_sync.get(),
+                                                              buffer, length);
+                                         }
+                                         else if (length > 0 && port->sim_lockstep != nullptr &&
+                                                  buffer[0] == ros2_to_serial_bridge::transport::SimLockstep::STEP)
+                                         {
+                                             handle_sim_step(port, buffer, length);
+                                         }
+                                         else if (length > 0 &&
+                                                  buffer[0] == ros2_serial_msgs::msg::FirmwareProfile::PROFILE)
+                                         {
+                                             ros2_serial_msgs::msg::FirmwareProfile profile;
+                                             if (read_firmware_profile(buffer, length, &profile))
+                                             {
+                                                 std::lock_guard<std::mutex> profile_lock(port->firmware_profile_mutex);
+                                                 port->firmware_profile = profile;
+                                                 port->has_firmware_profile = true;
+                                             }
+                                         }
+                                         else
+                                         {
+                                             port->transporter->handle_flow_credits(buffer, length);
+                                         }
+                                         return;
+                                     }
+                                     // This also goes before dispatching.
+                                     if (port->relays.forward(topic_ID, buffer, length) && !port->relay_publish)
+                                     {
+                                         return;
+                                     }
+#ifdef ROS2_SERIAL_BAG_RECORDER
+                                     // This goes first, since dispatching may
+                                     // change the buffer in place.
+                                     if (bag_recorder_ != nullptr)
+                                     {
+                                         bag_recorder_->push(port->index, topic_ID, buffer, length,
+                                                             port->transporter->get_receive_time());
+                                     }
+#endif
+                                     // Without dispatch threads, only the
+                                     // topics of the highest rx_priority
+                                     // go straight through; the others
+                                     // wait until the batch is read.
+                                     uint8_t priority = port->ros2_topics->get_rx_priority(topic_ID);
+                                     if (dispatch_pool_ == nullptr)
+                                     {
+                                         if (priority < port->ros2_topics->get_max_rx_priority())
+                                         {
+                                             if (port->rx_lanes->push(priority, topic_ID, buffer, length,
+                                                                      port->transporter->get_receive_time()))
+                                             {
+                                                 return;
+                                             }
+                                             // Out of room; what was held
+                                             // back goes first, to keep the
+                                             // topic in order.
+                                             drain_rx_lanes(port);
+                                         }
+                                         port->ros2_topics->dispatch(topic_ID, buffer, length);
+                                     }
+                                     else if (!dispatch_pool_->push(port->index, topic_ID, buffer, length,
+                                                                    port->transporter->get_receive_time(), priority))
+                                     {
+                                         port->dispatch_drops.fetch_add(1, std::memory_order_relaxed);
+                                     }
+                                 });
+    if (port->rx_lanes != nullptr && !port->rx_lanes->empty())
+    {
+        drain_rx_lanes(port);
+    }
+    if (port->read_watchdog.in_pass())
+    {
+        port->read_watchdog.end(port->read_watchdog.now(), port->transporter->get_ring_overflows());
+    }
+
+    return ret;
+}
+
+void ROS2ToSerialBridge::handle_sim_step(Port * port, const uint8_t * buffer, size_t length)
+{
+    uint8_t kind;
+    uint64_t step;
+    int64_t sim_time_ns;
+    if (!ros2_to_serial_bridge::transport::SimLockstep::decode(buffer, length, &kind, &step, &sim_time_ns))
+    {
+        return;
+    }
+
+    // Every frame of the step came before the STEP, so once they have all
+    // been published, the step is done.
+    if (port->rx_lanes != nullptr && !port->rx_lanes->empty())
+    {
+        drain_rx_lanes(port);
+    }
+    if (dispatch_pool_ != nullptr && !dispatch_pool_->wait_handled())
+    {
+        return;
+    }
+
+    int64_t wall_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    if (port->sim_lockstep->step(step, sim_time_ns, wall_ns))
+    {
+        // Publishing may allocate in the middleware, once a step.
+        ros2_to_serial_bridge::transport::ColdPathScope cold_path;
+        rosgraph_msgs::msg::Clock clock;
+        clock.clock.sec = static_cast<int32_t>(sim_time_ns / 1000000000);
+        clock.clock.nanosec = static_cast<uint32_t>(sim_time_ns % 1000000000);
+        clock_pub_->publish(clock);
+    }
+
+    // The simulator takes the next step as soon as it has the ACK, so it
+    // goes out straight away.
+    uint8_t ack[ros2_to_serial_bridge::transport::SimLockstep::MESSAGE_SIZE];
+    ros2_to_serial_bridge::transport::SimLockstep::encode(ros2_to_serial_bridge::transport::SimLockstep::ACK, step,
+                                                          sim_time_ns, ack, sizeof(ack));
+    if (port->transporter->write(0, ack, sizeof(ack)) < 0 || port->transporter->flush() < 0)
+    {
+        ROS2_SERIAL_LOG(WARN, "Failed to acknowledge simulator step %llu: %s",
+                        static_cast<unsigned long long>(step), ::strerror(errno));
+    }
+}
+
+void ROS2ToSerialBridge::drain_rx_lanes(Port * port)
+{
+    port->rx_lanes->drain([port](topic_id_size_t topic_ID, uint8_t *buffer, size_t length,
+                                 std::chrono::system_clock::time_point receive_time)
+                          {
+                              port->read_watchdog.set_topic(topic_ID);
+                              port->ros2_topics->dispatch(0, topic_ID, buffer, length, receive_time);
+                          });
+}
+
+ssize_t ROS2ToSerialBridge::handle_read_event(const struct epoll_event & event)
+{
+    Port *port = static_cast<Port *>(event.data.ptr);
+    if (port == nullptr)
+    {
+        uint64_t count;
+        if (::read(wakeup_fd_, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        {
+            ::fprintf(stderr, "Failed to read wakeup eventfd (%d)\n", errno);
+        }
+        if (!exiting_)
+        {
+            apply_link_changes();
+        }
+    }
+    else if ((event.events & EPOLLIN) != 0)
+    {
+        return read_port(port);
+    }
+    else if ((event.events & (EPOLLERR | EPOLLHUP)) != 0)
+    {
+        // The transport went away (for instance, a USB serial device was
+        // unplugged); waiting on it again would spin, so stop waiting on it
+        // but keep serving the other ports.
+        ::fprintf(stderr, "Transport file descriptor%s failed, no longer reading from it\n",
+                  port_description(port->name).c_str());
+        ::epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, port->read_fd, nullptr);
+        --waitable_ports_;
+    }
+
+    return 0;
+}
+
+int ROS2ToSerialBridge::service_reliable_ports(int timeout_ms)
+{
+    for (Port * port : reliable_ports_)
+    {
+        int due_ms = port->transporter->service_reliable();
+        if (due_ms >= 0 && (timeout_ms < 0 || due_ms < timeout_ms))
+        {
+            timeout_ms = due_ms;
+        }
+    }
+
+    return timeout_ms;
+}
+
+void ROS2ToSerialBridge::read_thread_func()
+{
+    // Transports that don't have a file descriptor we can wait on are polled
+    // on every pass instead, relying on them to wait in read_many().
+    std::vector<Port *> polled_ports;
+    for (auto & port : ports_)
+    {
+        if (port->read_fd < 0)
+        {
+            polled_ports.push_back(port.get());
+        }
+    }
+
+    // If every transport has a file descriptor we can wait on, we block in
+    // epoll until one of them has data, or until a retransmit or an
+    // acknowledgement is due.  Otherwise we don't wait in epoll at all.
+    std::vector<struct epoll_event> events(waitable_ports_ + 1);
+
+    // After a port with busy polling gets data, epoll is polled without
+    // sleeping until busy_until, so that the next message is picked up
+    // without waiting for the scheduler to wake the thread.
+    std::chrono::steady_clock::time_point busy_until;
+
+    while (!exiting_)
+    {
+        bool busy = busy_until > std::chrono::steady_clock::now();
+        int timeout_ms = service_reliable_ports((polled_ports.empty() && !busy) ? -1 : 0);
+
+        int nevents = ::epoll_wait(epoll_fd_, events.data(), static_cast<int>(events.size()), timeout_ms);
+        if (nevents < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            ::fprintf(stderr, "epoll_wait failed (%d)\n", errno);
+            break;
+        }
+
+        for (int i = 0; i < nevents && !exiting_; ++i)
+        {
+            Port *port = static_cast<Port *>(events[i].data.ptr);
+            if (handle_read_event(events[i]) > 0 && port->busy_poll_us > 0)
+            {
+                busy_until = std::max(busy_until, std::chrono::steady_clock::now() +
+                                                  std::chrono::microseconds(port->busy_poll_us));
+            }
+        }
+        if (nevents == 0 && busy)
+        {
+            ros2_to_serial_bridge::transport::cpu_relax();
+        }
+        if (waitable_ports_ == 0 && polled_ports.empty())
+        {
+            ::fprintf(stderr, "No transports left to read from, stopping read thread\n");
+            return;
+        }
+
+        for (Port * port : polled_ports)
+        {
+            if (exiting_)
+            {
+                break;
+            }
+            read_port(port);
+        }
+    }
+}
+
+void ROS2ToSerialBridge::watch_thread_func()
+{
+    std::vector<struct epoll_event> events(waitable_ports_ + 1);
+
+    while (!exiting_)
+    {
+        int timeout_ms = reliable_due_ms_;
+        int nevents = ::epoll_wait(epoll_fd_, events.data(), static_cast<int>(events.size()), timeout_ms);
+        if (nevents < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            ::fprintf(stderr, "epoll_wait failed (%d)\n", errno);
+            break;
+        }
+
+        std::unique_lock<std::mutex> lock(read_handoff_mutex_);
+        read_events_.clear();
+        for (int i = 0; i < nevents; ++i)
+        {
+            if (events[i].data.ptr == nullptr)
+            {
+                // Only the exit is signalled with the wakeup eventfd.
+                handle_read_event(events[i]);
+            }
+            else
+            {
+                read_events_.push_back(events[i]);
+            }
+        }
+
+        // A timeout means that a retransmit or an acknowledgement is due,
+        // which the executor sends as well.
+        if (exiting_ || (nevents > 0 && read_events_.empty()))
+        {
+            continue;
+        }
+
+        read_handoff_pending_ = true;
+        read_waitable_->trigger();
+        read_handoff_cv_.wait(lock, [this]() { return !read_handoff_pending_ || exiting_; });
+    }
+}
+
+void ROS2ToSerialBridge::executor_read()
+{
+    std::unique_lock<std::mutex> lock(read_handoff_mutex_);
+    if (!read_handoff_pending_)
+    {
+        return;
+    }
+
+    size_t waitable_ports = waitable_ports_;
+    for (const struct epoll_event & event : read_events_)
+    {
+        handle_read_event(event);
+    }
+    if (waitable_ports > 0 && waitable_ports_ == 0)
+    {
+        ::fprintf(stderr, "No transports left to read from\n");
+    }
+    reliable_due_ms_ = service_reliable_ports(-1);
+
+    read_handoff_pending_ = false;
+    lock.unlock();
+    read_handoff_cv_.notify_one();
+}
+
+std::map<std::string, ros2_to_serial_bridge::pubsub::TopicMapping> ROS2ToSerialBridge::parse_node_parameters_for_topics(const std::string & prefix)
+{
+    // Now we go through the YAML file containing our parameters, looking for
+    // parameters of the form:
+    //     topics:
+    //         <topic_name>:
+    //             serial_mapping: <int> (at most 255 unless the protocol is v2)
+    //             type: <string>
+    //             direction: [SerialToROS2|ROS2ToSerial]
+    //             tx_queue_depth: <int> (optional, ROS2ToSerial only)
+    //             tx_overflow_policy: [drop_oldest|drop_newest] (optional)
+    //             tx_priority: <int> (optional, 0-255)
+    //             tx_max_rate_hz: <float> (optional)
+    //             rx_priority: <int> (optional, SerialToROS2 only, 0-255)
+    //             passthrough: <bool> (optional)
+    //             reliability: [reliable|best_effort] (optional)
+    //             durability: [volatile|transient_local] (optional)
+    //             history_depth: <int> (optional)
+    //             deadline_ms: <int> (optional)
+    //             compress_threshold: <int> (optional, v2 only)
+    //             compress_dictionary: <string> (optional, v2 only)
+    //             delta_keyframe_interval: <int> (optional, ROS2ToSerial and v2 only)
+    //             stamp_header: <bool> (optional, SerialToROS2 only)
+    //             device_stamp: <bool> (optional, SerialToROS2 only, needs timesync_period_ms)
+    //             lazy: <bool> (optional, SerialToROS2 only)
+    //             max_rate_hz: <float> (optional, SerialToROS2 only)
+    //             last_value: <bool> (optional, SerialToROS2 only)
+    //             on_change: <bool> (optional, SerialToROS2 only)
+    //             on_change_keepalive_ms: <int> (optional, needs on_change)
+    //             reliable: <bool> (optional, ROS2ToSerial and v2 only)
+    //             bond_mode: [stripe|redundant] (optional, bond only)
+    //             max_age_ms: <int> (optional, 0-65535)
+    //             elide_length: <bool> (optional, needs bundle_topic_id)
+    //             intern_strings: <bool> (optional)
+    //             quantize: <string array> (optional, like ['altitude:float32', 'voltage:fixed16:0.001'])
+    //             batch_type: <string> (optional, SerialToROS2 only, like 'my_msgs/ImuBatch')
+    //             batch_size: <int> (optional, needs batch_type)
+    //             batch_ms: <int> (optional, needs batch_type)
+    //             max_message_size: <int> (optional)
+    //
+    // For a bridge with several ports, the topics section is in the
+    // subsection for the port, and prefix is the port name followed by a dot.
+
+    // All of the topic parameters are fetched at once.  They come sorted by
+    // name, so the parameters of a topic are next to each other and each
+    // topic is only looked up in the map once.
+    std::map<std::string, rclcpp::Parameter> params;
+    get_parameters_by_prefix(prefix + "topics", params);
+
+    std::map<std::string, ros2_to_serial_bridge::pubsub::TopicMapping> topic_names_and_serialization;
+    auto topic_it = topic_names_and_serialization.end();
+    for (const auto & name_and_param : params)
+    {
+        const std::string & name = name_and_param.first;
+        const rclcpp::Parameter & param = name_and_param.second;
+
+        // Only parameters of the form <topic_name>.<param_name> can be what
+        // we are looking for.  Just silently ignore anything else, to allow
+        // other parameters.
+        std::size_t dot_pos = name.find('.');
+        if (dot_pos == std::string::npos || dot_pos == 0 || dot_pos + 1 == name.length() ||
+            name.find('.', dot_pos + 1) != std::string::npos)
+        {
+            continue;
+        }
+
+        if (topic_it == topic_names_and_serialization.end() || topic_it->first.length() != dot_pos ||
+            name.compare(0, dot_pos, topic_it->first) != 0)
+        {
+            topic_it = topic_names_and_serialization.emplace_hint(topic_names_and_serialization.end(), name.substr(0, dot_pos),
+                                                                  ros2_to_serial_bridge::pubsub::TopicMapping());
+        }
+        ros2_to_serial_bridge::pubsub::TopicMapping & mapping = topic_it->second;
+        std::string param_name = name.substr(dot_pos + 1);
+
+        if (param_name == "serial_mapping")
+        {
+            // This is range checked against the protocol when the topics are
+            // set up.
+            mapping.serial_mapping = param.get_value<int64_t>();
+        }
+        else if (param_name == "type")
+        {
+            mapping.type = param.get_value<std::string>();
+        }
+        else if (param_name == "direction")
+        {
+            std::string dirstring = param.get_value<std::string>();
+            ros2_to_serial_bridge::pubsub::TopicMapping::Direction direction = ros2_to_serial_bridge::pubsub::TopicMapping::Direction::UNKNOWN;
+            if (dirstring == "SerialToROS2")
+            {
+                direction = ros2_to_serial_bridge::pubsub::TopicMapping::Direction::SERIAL_TO_ROS2;
+            }
+            else if (dirstring == "ROS2ToSerial")
+            {
+                direction = ros2_to_serial_bridge::pubsub::TopicMapping::Direction::ROS2_TO_SERIAL;
+            }
+            else
+            {
+                throw std::runtime_error("Invalid direction for topic; must be one of 'SerialToROS2' or 'ROS2ToSerial'");
+            }
+
+            mapping.direction = direction;
+        }
+        else if (param_name == "tx_queue_depth")
+        {
+            int64_t depth = param.get_value<int64_t>();
+            if (depth < 0)
+            {
+                throw std::runtime_error("Invalid tx_queue_depth for topic; must be >= 0");
+            }
+            mapping.tx_queue_depth = static_cast<size_t>(depth);
+        }
+        else if (param_name == "passthrough")
+        {
+            mapping.passthrough = param.get_value<bool>();
+        }
+        else if (param_name == "tx_overflow_policy")
+        {
+            std::string policystring = param.get_value<std::string>();
+            if (policystring == "drop_oldest")
+            {
+                mapping.tx_overflow_policy = ros2_to_serial_bridge::transport::TxQueue::OverflowPolicy::DROP_OLDEST;
+            }
+            else if (policystring == "drop_newest")
+            {
+                mapping.tx_overflow_policy = ros2_to_serial_bridge::transport::TxQueue::OverflowPolicy::DROP_NEWEST;
+            }
+            else
+            {
+                throw std::runtime_error("Invalid tx_overflow_policy for topic; must be one of 'drop_oldest' or 'drop_newest'");
+            }
+        }
+        else if (param_name == "tx_priority")
+        {
+            int64_t priority = param.get_value<int64_t>();
+            if (priority < 0 || priority > std::numeric_limits<uint8_t>::max())
+            {
+                throw std::runtime_error("Invalid tx_priority for topic; must be between 0 and 255");
+            }
+            mapping.tx_priority = static_cast<uint8_t>(priority);
+        }
+        else if (param_name == "rx_priority")
+        {
+            int64_t priority = param.get_value<int64_t>();
+            if (priority < 0 || priority > std::numeric_limits<uint8_t>::max())
+            {
+                throw std::runtime_error("Invalid rx_priority for topic; must be between 0 and 255");
+            }
+            mapping.rx_priority = static_cast<uint8_t>(priority);
+        }
+        else if (param_name == "tx_max_rate_hz")
+        {
+            // Allow a whole number of Hz to be given without a decimal point.
+            double rate = (param.get_type() == rclcpp::ParameterType::PARAMETER_INTEGER) ? static_cast<double>(param.as_int()) : param.as_double();
+            if (!(rate >= 0.0))
+            {
+                throw std::runtime_error("Invalid tx_max_rate_hz for topic; must be >= 0");
+            }
+            mapping.tx_max_rate_hz = rate;
+        }
+        else if (param_name == "reliability")
+        {
+            std::string reliability = param.get_value<std::string>();
+            if (reliability == "reliable")
+            {
+                mapping.qos.reliable();
+            }
+            else if (reliability == "best_effort")
+            {
+                mapping.qos.best_effort();
+            }
+            else
+            {
+                throw std::runtime_error("Invalid reliability for topic; must be one of 'reliable' or 'best_effort'");
+            }
+        }
+        else if (param_name == "durability")
+        {
+            std::string durability = param.get_value<std::string>();
+            if (durability == "volatile")
+            {
+                mapping.qos.durability_volatile();
+            }
+            else if (durability == "transient_local")
+            {
+                mapping.qos.transient_local();
+            }
+            else
+            {
+                throw std::runtime_error("Invalid durability for topic; must be one of 'volatile' or 'transient_local'");
+            }
+        }
+        else if (param_name == "history_depth")
+        {
+            int64_t depth = param.get_value<int64_t>();
+            if (depth <= 0)
+            {
+                throw std::runtime_error("Invalid history_depth for topic; must be > 0");
+            }
+            mapping.qos.keep_last(static_cast<size_t>(depth));
+        }
+        else if (param_name == "deadline_ms")
+        {
+            int64_t deadline_ms = param.get_value<int64_t>();
+            if (deadline_ms < 0)
+            {
+                throw std::runtime_error("Invalid deadline_ms for topic; must be >= 0");
+            }
+            mapping.qos.deadline(rclcpp::Duration(std::chrono::milliseconds(deadline_ms)));
+        }
+        else if (param_name == "compress_threshold")
+        {
+            int64_t threshold = param.get_value<int64_t>();
+            if (threshold < 0)
+            {
+                throw std::runtime_error("Invalid compress_threshold for topic; must be >= 0");
+            }
+            mapping.compress_threshold = threshold;
+        }
+        else if (param_name == "delta_keyframe_interval")
+        {
+            int64_t interval = param.get_value<int64_t>();
+            if (interval < 0 || interval > std::numeric_limits<uint32_t>::max())
+            {
+                throw std::runtime_error("Invalid delta_keyframe_interval for topic; must be >= 0");
+            }
+            mapping.delta_keyframe_interval = static_cast<uint32_t>(interval);
+        }
+        else if (param_name == "stamp_header")
+        {
+            mapping.stamp_header = param.get_value<bool>();
+        }
+        else if (param_name == "device_stamp")
+        {
+            mapping.device_stamp = param.get_value<bool>();
+        }
+        else if (param_name == "lazy")
+        {
+            mapping.lazy = param.get_value<bool>();
+        }
+        else if (param_name == "last_value")
+        {
+            mapping.last_value = param.get_value<bool>();
+        }
+        else if (param_name == "on_change")
+        {
+            mapping.on_change = param.get_value<bool>();
+        }
+        else if (param_name == "on_change_keepalive_ms")
+        {
+            int64_t keepalive = param.get_value<int64_t>();
+            if (keepalive < 0 || keepalive > std::numeric_limits<uint32_t>::max())
+            {
+                throw std::runtime_error("Invalid on_change_keepalive_ms for topic; must be >= 0");
+            }
+            mapping.on_change_keepalive_ms = static_cast<uint32_t>(keepalive);
+        }
+        else if (param_name == "max_rate_hz")
+        {
+            double rate = (param.get_type() == rclcpp::ParameterType::PARAMETER_INTEGER) ? static_cast<double>(param.as_int()) : param.as_double();
+            if (!(rate >= 0.0))
+            {
+                throw std::runtime_error("Invalid max_rate_hz for topic; must be >= 0");
+            }
+            mapping.max_rate_hz = rate;
+        }
+        else if (param_name == "reliable")
+        {
+            mapping.reliable = param.get_value<bool>();
+        }
+        else if (param_name == "bond_mode")
+        {
+            mapping.bond_mode = param.get_value<std::string>();
+            if (mapping.bond_mode != "stripe" && mapping.bond_mode != "redundant")
+            {
+                throw std::runtime_error("Invalid bond_mode for topic; must be one of 'stripe' or 'redundant'");
+            }
+        }
+        else if (param_name == "elide_length")
+        {
+            mapping.elide_length = param.get_value<bool>();
+        }
+        else if (param_name == "intern_strings")
+        {
+            mapping.intern_strings = param.get_value<bool>();
+        }
+        else if (param_name == "quantize")
+        {
+            // The specs are checked against the type when the topic is set
+            // up.
+            mapping.quantize = param.as_string_array();
+        }
+        else if (param_name == "batch_type")
+        {
+            // Whether it is a batch of the type is checked when the topic is
+            // set up.
+            mapping.batch_type = param.get_value<std::string>();
+        }
+        else if (param_name == "batch_size")
+        {
+            int64_t batch_size = param.get_value<int64_t>();
+            if (batch_size < 0 || batch_size > std::numeric_limits<uint32_t>::max())
+            {
+                throw std::runtime_error("Invalid batch_size for topic; must be >= 0");
+            }
+            mapping.batch_size = static_cast<size_t>(batch_size);
+        }
+        else if (param_name == "batch_ms")
+        {
+            int64_t batch_ms = param.get_value<int64_t>();
+            if (batch_ms < 0 || batch_ms > std::numeric_limits<uint32_t>::max())
+            {
+                throw std::runtime_error("Invalid batch_ms for topic; must be >= 0");
+            }
+            mapping.batch_ms = static_cast<uint32_t>(batch_ms);
+        }
+        else if (param_name == "max_age_ms")
+        {
+            int64_t max_age = param.get_value<int64_t>();
+            if (max_age < 0 || max_age > std::numeric_limits<uint16_t>::max())
+            {
+                throw std::runtime_error("Invalid max_age_ms for topic; must be between 0 and 65535");
+            }
+            mapping.max_age_ms = static_cast<uint32_t>(max_age);
+        }
+        else if (param_name == "max_message_size")
+        {
+            int64_t max_size = param.get_value<int64_t>();
+            if (max_size < 0 || max_size > std::numeric_limits<uint32_t>::max())
+            {
+                throw std::runtime_error("Invalid max_message_size for topic; must be >= 0");
+            }
+            mapping.max_message_size = static_cast<size_t>(max_size);
+        }
+        else if (param_name == "compress_dictionary")
+        {
+            std::string path = param.get_value<std::string>();
+            std::ifstream file(path, std::ios::binary);
+            if (!file)
+            {
+                throw std::runtime_error("Failed to open compress_dictionary '" + path + "' for topic");
+            }
+            mapping.compress_dictionary.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        }
+        else
+        {
+            throw std::runtime_error("Invalid parameter name");
+        }
+    }
+
+    return topic_names_and_serialization;
+}
+
+std::map<std::string, ros2_to_serial_bridge::pubsub::ServiceMapping> ROS2ToSerialBridge::parse_node_parameters_for_services(const std::string & prefix)
+{
+    // The services that the other end answers are in a section of their own,
+    // next to the topics:
+    //     services:
+    //         <service_name>:
+    //             serial_mapping: <int> (at most 255 unless the protocol is v2)
+    //             type: <string>
+    //             timeout_ms: <int> (optional, default 1000)
+    //             max_in_flight: <int> (optional, default 8)
+    //             reliable: <bool> (optional, v2 only)
+    std::map<std::string, rclcpp::Parameter> params;
+    get_parameters_by_prefix(prefix + "services", params);
+
+    std::map<std::string, ros2_to_serial_bridge::pubsub::ServiceMapping> services;
+    for (const auto & name_and_param : params)
+    {
+        const std::string & name = name_and_param.first;
+        const rclcpp::Parameter & param = name_and_param.second;
+
+        // Like the topics, anything that isn't <service_name>.<param_name> is
+        // silently ignored.
+        std::size_t dot_pos = name.find('.');
+        if (dot_pos == std::string::npos || dot_pos == 0 || dot_pos + 1 == name.length() ||
+            name.find('.', dot_pos + 1) != std::string::npos)
+        {
+            continue;
+        }
+
+        ros2_to_serial_bridge::pubsub::ServiceMapping & mapping = services[name.substr(0, dot_pos)];
+        std::string param_name = name.substr(dot_pos + 1);
+
+        if (param_name == "serial_mapping")
+        {
+            mapping.serial_mapping = param.get_value<int64_t>();
+        }
+        else if (param_name == "type")
+        {
+            mapping.type = param.get_value<std::string>();
+        }
+        else if (param_name == "timeout_ms")
+        {
+            int64_t timeout_ms = param.get_value<int64_t>();
+            if (timeout_ms <= 0 || timeout_ms > std::numeric_limits<uint32_t>::max())
+            {
+                throw std::runtime_error("Invalid timeout_ms for service; must be > 0");
+            }
+            mapping.timeout_ms = static_cast<uint32_t>(timeout_ms);
+        }
+        else if (param_name == "max_in_flight")
+        {
+            int64_t max_in_flight = param.get_value<int64_t>();
+            if (max_in_flight <= 0)
+            {
+                throw std::runtime_error("Invalid max_in_flight for service; must be > 0");
+            }
+            mapping.max_in_flight = static_cast<size_t>(max_in_flight);
+        }
+        else if (param_name == "reliable")
+        {
+            mapping.reliable = param.get_value<bool>();
+        }
+        else
+        {
+            throw std::runtime_error("Invalid parameter name");
+        }
+    }
+
+    return services;
+}
+
+void ROS2ToSerialBridge::check_serial_mappings()
+{
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    bool checking = false;
+
+    for (auto & port : ports_)
+    {
+        Port::MappingCheck & check = port->mapping_check;
+        std::string desc = port_description(port->name);
+        if (!check.cache)
+        {
+            continue;
+        }
+
+        std::vector<uint8_t> received;
+        bool has_received = false;
+        {
+            std::lock_guard<std::mutex> lock(check.mutex);
+            has_received = check.has_received;
+            received.swap(check.received);
+            check.has_received = false;
+        }
+
+        if (!has_received)
+        {
+            if (check.wait_ms > 0 && now - check.start >= std::chrono::milliseconds(check.wait_ms))
+            {
+                ::fprintf(stderr, "No response to dynamic serial request%s; keeping the cached serial mapping\n", desc.c_str());
+                check.pending = false;
+                check.cache.reset();
+                continue;
+            }
+            // The other end may have been resetting when it was first asked,
+            // so keep asking.
+            if (now - check.last_request >= std::chrono::seconds(1))
+            {
+                check.last_request = now;
+                try
+                {
+                    write_mapping_request(port->transporter.get());
+                }
+                catch (const std::runtime_error & err)
+                {
+                    ::fprintf(stderr, "%s%s\n", err.what(), desc.c_str());
+                }
+            }
+            checking = true;
+            continue;
+        }
+
+        if (received != check.cached)
+        {
+            try
+            {
+                replace_topics(port.get(), parse_serial_mapping(received));
+                ::printf("Serial mapping%s changed; replaced the topics\n", desc.c_str());
+                if (!check.cache->store(received.data(), received.size()))
+                {
+                    ::fprintf(stderr, "Failed to write serial mapping cache '%s'\n", check.cache->get_path().c_str());
+                }
+            }
+            catch (const std::runtime_error & err)
+            {
+                ::fprintf(stderr, "Invalid serial mapping%s (%s); keeping the cached serial mapping\n", desc.c_str(), err.what());
+            }
+        }
+        check.cache.reset();
+        check.cached.clear();
+    }
+
+    if (!checking)
+    {
+        mapping_check_timer_->cancel();
+    }
+}
+
+void ROS2ToSerialBridge::replace_topics(Port * port, std::map<std::string, ros2_to_serial_bridge::pubsub::TopicMapping> topic_names_and_serialization)
+{
+    if (port->lazy_publishers)
+    {
+        set_lazy(&topic_names_and_serialization);
+    }
+
+    // Only the topics that changed are replaced, so the others keep their
+    // publishers and subscriptions.  Everything that goes away or changes is
+    // removed first, so that a new topic can take over a serial mapping that
+    // another topic had.
+    std::map<std::string, ros2_to_serial_bridge::pubsub::TopicMapping> old_topics = port->ros2_topics->get_topics();
+    auto same = [](const ros2_to_serial_bridge::pubsub::TopicMapping & a, const ros2_to_serial_bridge::pubsub::TopicMapping & b)
+    {
+        return a.type == b.type && a.serial_mapping == b.serial_mapping && a.direction == b.direction;
+    };
+
+    for (const auto & t : old_topics)
+    {
+        auto it = topic_names_and_serialization.find(t.first);
+        if (it == topic_names_and_serialization.end() || !same(t.second, it->second))
+        {
+            port->ros2_topics->remove_topic(t.first);
+        }
+    }
+
+    for (const auto & t : topic_names_and_serialization)
+    {
+        auto it = old_topics.find(t.first);
+        std::string error;
+        if ((it == old_topics.end() || !same(it->second, t.second)) && !port->ros2_topics->add_topic(t.first, t.second, &error))
+        {
+            ::fprintf(stderr, "%s%s; skipping\n", error.c_str(), port_description(port->name).c_str());
+        }
+    }
+
+    topics_changed(port);
+}
+
+void ROS2ToSerialBridge::topics_changed(Port * port)
+{
+    std::map<std::string, ros2_to_serial_bridge::pubsub::TopicMapping> topics = port->ros2_topics->get_topics();
+    port->topic_names = get_topic_names(topics);
+    // The metrics of a service are under its name too.
+    for (const auto & s : port->ros2_topics->get_services())
+    {
+        port->topic_names[static_cast<topic_id_size_t>(s.second.serial_mapping)] = s.first;
+    }
+
+    // A received frame that claims to be longer than its topic can carry is
+    // garbage, so the parser doesn't wait for the rest of it.
+    std::map<topic_id_size_t, size_t> max_payloads;
+    for (const auto & t : topics)
+    {
+        if (t.second.direction == ros2_to_serial_bridge::pubsub::TopicMapping::Direction::SERIAL_TO_ROS2 &&
+            t.second.max_message_size > 0)
+        {
+            max_payloads[static_cast<topic_id_size_t>(t.second.serial_mapping)] = t.second.max_message_size;
+        }
+    }
+    port->transporter->set_rx_max_payloads(max_payloads);
+
+    update_bag_topics(port);
+}
+
+void ROS2ToSerialBridge::update_bag_topics(Port * port)
+{
+#ifdef ROS2_SERIAL_BAG_RECORDER
+    if (bag_recorder_ == nullptr)
+    {
+        return;
+    }
+
+    std::map<topic_id_size_t, ros2_to_serial_bridge::pubsub::BagRecorder::Topic> topics;
+    for (const auto & t : port->ros2_topics->get_topics())
+    {
+        if (t.second.direction == ros2_to_serial_bridge::pubsub::TopicMapping::Direction::SERIAL_TO_ROS2)
+        {
+            topics[static_cast<topic_id_size_t>(t.second.serial_mapping)] = {
+                ros2_to_serial_bridge::pubsub::apply_topic_namespace(port->topic_namespace, t.first), t.second.type};
+        }
+    }
+    bag_recorder_->set_topics(port->index, topics);
+#else
+    (void)port;
+#endif
+}
+
+void ROS2ToSerialBridge::configure_topic(const std::shared_ptr<ros2_serial_msgs::srv::ConfigureTopic::Request> request,
+                                         std::shared_ptr<ros2_serial_msgs::srv::ConfigureTopic::Response> response)
+{
+    using ConfigureTopic = ros2_serial_msgs::srv::ConfigureTopic;
+
+    auto port_it = std::find_if(ports_.begin(), ports_.end(),
+                                [&request](const std::unique_ptr<Port> & port) { return port->name == request->port; });
+    if (port_it == ports_.end())
+    {
+        response->success = false;
+        response->message = "No port '" + request->port + "'";
+        return;
+    }
+    Port * port = port_it->get();
+
+    if (request->action == ConfigureTopic::Request::REMOVE)
+    {
+        response->success = port->ros2_topics->remove_topic(request->topic_name);
+        if (!response->success)
+        {
+            response->message = "No topic '" + request->topic_name + "'";
+        }
+    }
+    else if (request->action == ConfigureTopic::Request::ADD)
+    {
+        ros2_to_serial_bridge::pubsub::TopicMapping mapping;
+        mapping.type = request->type;
+        mapping.serial_mapping = request->serial_mapping <= static_cast<uint64_t>(std::numeric_limits<int64_t>::max()) ? static_cast<int64_t>(request->serial_mapping) : -1;
+        if (request->direction == ros2_serial_msgs::msg::SerialMapping::SERIALTOROS2)
+        {
+            mapping.direction = ros2_to_serial_bridge::pubsub::TopicMapping::Direction::SERIAL_TO_ROS2;
+            mapping.lazy = port->lazy_publishers;
+        }
+        else if (request->direction == ros2_serial_msgs::msg::SerialMapping::ROS2TOSERIAL)
+        {
+            mapping.direction = ros2_to_serial_bridge::pubsub::TopicMapping::Direction::ROS2_TO_SERIAL;
+        }
+        response->success = port->ros2_topics->add_topic(request->topic_name, mapping, &response->message);
+    }
+    else
+    {
+        response->success = false;
+        response->message = "Invalid action " + std::to_string(request->action);
+    }
+
+    if (response->success)
+    {
+        topics_changed(port);
+    }
+}
+
+void ROS2ToSerialBridge::check_flight_recorders()
+{
+    std::string file;
+    if (flight_recorder_signalled.exchange(false))
+    {
+        for (auto & port : ports_)
+        {
+            if (port->flight_recorder)
+            {
+                dump_flight_recorder(port.get(), "signal", &file);
+            }
+        }
+    }
+
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (flight_recorder_error_rate_ <= 0.0 ||
+        now - flight_recorder_checked_ < std::chrono::milliseconds(FLIGHT_RECORDER_ERROR_PERIOD_MS))
+    {
+        return;
+    }
+    double elapsed_s = std::chrono::duration<double>(now - flight_recorder_checked_).count();
+    flight_recorder_checked_ = now;
+
+    for (auto & port : ports_)
+    {
+        if (!port->flight_recorder)
+        {
+            continue;
+        }
+        port->transporter->get_metrics().snapshot(&port->flight_recorder_snapshot);
+        uint64_t errors = count_errors(port->flight_recorder_snapshot);
+        double rate = static_cast<double>(errors - port->flight_recorder_errors) / elapsed_s;
+        port->flight_recorder_errors = errors;
+
+        // A burst of errors is dumped once, when it starts; the port has to
+        // go a whole period under the threshold before it is dumped again.
+        bool over = rate >= flight_recorder_error_rate_;
+        if (over && !port->flight_recorder_tripped)
+        {
+            dump_flight_recorder(port.get(), "errors", &file);
+        }
+        port->flight_recorder_tripped = over;
+    }
+}
+
+bool ROS2ToSerialBridge::dump_flight_recorder(Port * port, const std::string & reason, std::string * file)
+{
+    // The file is named after the port, the time and what triggered it, so
+    // that dumps never overwrite each other.
+    struct timespec ts;
+    ::clock_gettime(CLOCK_REALTIME, &ts);
+    struct tm tm;
+    ::localtime_r(&ts.tv_sec, &tm);
+    char stamp[64];
+    ::snprintf(stamp, sizeof(stamp), "%04d%02d%02d-%02d%02d%02d.%03ld", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+               tm.tm_hour, tm.tm_min, tm.tm_sec, ts.tv_nsec / 1000000);
+    std::string name = port->name.empty() ? std::string(get_name()) : port->name;
+    std::replace(name.begin(), name.end(), '/', '_');
+    *file = flight_recorder_dir_ + "/flight_recorder_" + name + "_" + stamp + "_" + reason + ".capture";
+
+    if (port->transporter->dump_flight_recorder(*file) < 0)
+    {
+        RCLCPP_ERROR(get_logger(), "Failed to dump the flight recorder%s to '%s'", port_description(port->name).c_str(),
+                     file->c_str());
+        return false;
+    }
+    RCLCPP_WARN(get_logger(), "Dumped the flight recorder%s to '%s' (%s)", port_description(port->name).c_str(),
+                file->c_str(), reason.c_str());
+
+    return true;
+}
+
+void ROS2ToSerialBridge::dump_flight_recorders(const std::shared_ptr<ros2_serial_msgs::srv::DumpFlightRecorder::Request> request,
+                                               std::shared_ptr<ros2_serial_msgs::srv::DumpFlightRecorder::Response> response)
+{
+    response->success = true;
+    bool found = false;
+    for (auto & port : ports_)
+    {
+        if (!port->flight_recorder || (!request->port.empty() && port->name != request->port))
+        {
+            continue;
+        }
+        found = true;
+        std::string file;
+        if (dump_flight_recorder(port.get(), "service", &file))
+        {
+            response->files.push_back(file);
+        }
+        else
+        {
+            response->success = false;
+            response->message = "Failed to write '" + file + "'";
+        }
+    }
+
+    if (!found)
+    {
+        response->success = false;
+        response->message = "No flight recorder on port '" + request->port + "'";
+    }
+}
+
+bool ROS2ToSerialBridge::negotiate_link(ros2_to_serial_bridge::transport::Transporter * transporter, const ros2_to_serial_bridge::transport::LinkCapabilities & local, uint64_t wait_ms, ros2_to_serial_bridge::transport::LinkSettings * settings)
+{
+    // Offer what we can do, and see what the other end can do.
+    write_link_capabilities(transporter, make_link_offer(local));
+
+    ros2_to_serial_bridge::transport::LinkCapabilities remote;
+    if (!read_link_offer(transporter, wait_ms, &remote))
+    {
+        return false;
+    }
+
+    if (!ros2_to_serial_bridge::transport::negotiate_link(local, remote, settings))
+    {
+        throw std::runtime_error("No serial protocol in common with the other end of the link");
+    }
+
+    if (!switch_link(transporter, local, wait_ms, *settings))
+    {
+        ::fprintf(stderr, "Link did not come up at %u baud with protocol '%s'; staying at the old settings\n",
+                  settings->baudrate, settings->protocol.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+bool ROS2ToSerialBridge::switch_link(ros2_to_serial_bridge::transport::Transporter * transporter, const ros2_to_serial_bridge::transport::LinkCapabilities & local, uint64_t wait_ms, const ros2_to_serial_bridge::transport::LinkSettings & settings)
+{
+    // Tell the other end what we picked; both ends switch once the SELECT
+    // has gone out, which set_baudrate() waits for.
+    ros2_serial_msgs::msg::LinkCapabilities select;
+    select.kind = ros2_serial_msgs::msg::LinkCapabilities::SELECT;
+    if (settings.baudrate != 0)
+    {
+        select.baudrates.push_back(settings.baudrate);
+    }
+    select.protocols.push_back(settings.protocol);
+    select.max_frame_size = settings.max_frame_size;
+    select.compression = settings.compression;
+    select.batching = settings.batching;
+    write_link_capabilities(transporter, select);
+
+    std::string old_protocol = transporter->get_protocol();
+    uint32_t old_baudrate = transporter->get_baudrate();
+    bool switched = true;
+    if (settings.baudrate != 0 && settings.baudrate != old_baudrate && transporter->set_baudrate(settings.baudrate) < 0)
+    {
+        switched = false;
+    }
+    if (switched && settings.protocol != old_protocol && transporter->set_protocol(settings.protocol) < 0)
+    {
+        switched = false;
+    }
+
+    // Make sure the link still works with the new settings.  If it doesn't,
+    // go back to the old ones; the other end does the same when it hears
+    // nothing valid for a while after switching.
+    if (switched)
+    {
+        write_link_capabilities(transporter, make_link_offer(local));
+        ros2_to_serial_bridge::transport::LinkCapabilities check;
+        switched = read_link_offer(transporter, wait_ms > 0 ? wait_ms : 1000, &check);
+    }
+    if (!switched)
+    {
+        if (old_baudrate != 0)
+        {
+            transporter->set_baudrate(old_baudrate);
+        }
+        transporter->set_protocol(old_protocol);
+        return false;
+    }
+
+    return true;
+}
+
+std::map<std::string, ros2_to_serial_bridge::pubsub::TopicMapping> ROS2ToSerialBridge::dynamically_get_serial_mapping(ros2_to_serial_bridge::transport::Transporter * transporter, uint64_t wait_ms, std::vector<uint8_t> * payload)
+{
+    write_mapping_request(transporter);
+
+    // Wait for up to wait_ms for a response
+    std::unique_ptr<uint8_t[]> data_buffer(new uint8_t[BUFFER_SIZE]);
+    std::chrono::duration<uint64_t, std::ratio<1, 1000>> diff_ms{0};
+    bool got_response{false};
+    std::chrono::time_point<std::chrono::system_clock> start = std::chrono::system_clock::now();
+    do
+    {
+        ssize_t length = 0;
+        topic_id_size_t topic_ID;
+        if ((length = transporter->read(&topic_ID, data_buffer.get(), BUFFER_SIZE)) > 0)
+        {
+            if (topic_ID == 1)
+            {
+                payload->assign(data_buffer.get(), data_buffer.get() + length);
+                got_response = true;
+                break;
+            }
+        }
+
+        if (wait_ms > 0)
+        {
+            std::chrono::time_point<std::chrono::system_clock> now = std::chrono::system_clock::now();
+            diff_ms = std::chrono::duration_cast<std::chrono::milliseconds>(now - start);
+        }
+    } while (diff_ms.count() < wait_ms);
+
+    if (!got_response)
+    {
+        throw std::runtime_error("No response to dynamic serial request");
+    }
+
+    return parse_serial_mapping(*payload);
+}
+
 }  // namespace ros2_to_serial_bridge
 
 #include "rclcpp_components/register_node_macro.hpp"
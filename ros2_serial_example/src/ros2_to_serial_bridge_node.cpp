@@ -0,0 +1,57 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+
+#include <rclcpp/rclcpp.hpp>
+
+#include "ros2_serial_example/ros2_to_serial_bridge.hpp"
+
+int main(int argc, char *argv[])
+{
+    rclcpp::init(argc, argv);
+
+    auto node = std::make_shared<ros2_to_serial_bridge::ROS2ToSerialBridge>(rclcpp::NodeOptions());
+
+    // The node's callbacks run in one thread unless asked otherwise; 0 means
+    // one thread per core.  More threads only help when the subscriptions
+    // are in callback groups of their own (parallel_subscriptions).
+    int64_t executor_threads{1};
+    node->get_parameter("executor_threads", executor_threads);
+    if (executor_threads < 0)
+    {
+        ::fprintf(stderr, "Invalid executor_threads; must be >= 0\n");
+        rclcpp::shutdown();
+        return 1;
+    }
+
+    std::unique_ptr<rclcpp::Executor> executor;
+    if (executor_threads == 1)
+    {
+        executor = std::make_unique<rclcpp::executors::SingleThreadedExecutor>();
+    }
+    else
+    {
+        executor = std::make_unique<rclcpp::executors::MultiThreadedExecutor>(rclcpp::ExecutorOptions(),
+                                                                              static_cast<size_t>(executor_threads));
+    }
+    executor->add_node(node);
+    executor->spin();
+
+    rclcpp::shutdown();
+
+    return 0;
+}
@@ -0,0 +1,96 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+
+#include "ros2_serial_example/rx_lanes.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+RxLanes::RxLanes(size_t capacity) : capacity_(capacity)
+{
+    if (capacity <= sizeof(Record))
+    {
+        throw std::runtime_error("RxLanes capacity is too small");
+    }
+
+    buf_ = std::make_unique<uint8_t[]>(capacity);
+}
+
+size_t RxLanes::record_size(size_t length)
+{
+    // Each record starts aligned, so that drain() can read it in place.
+    return (sizeof(Record) + length + alignof(Record) - 1) & ~(alignof(Record) - 1);
+}
+
+bool RxLanes::push(uint8_t priority, topic_id_size_t topic_ID, const uint8_t * buffer, size_t length,
+                   std::chrono::system_clock::time_point receive_time)
+{
+    if (length > UINT32_MAX || record_size(length) > capacity_ - used_)
+    {
+        return false;
+    }
+
+    Record * record = reinterpret_cast<Record *>(buf_.get() + used_);
+    record->length = static_cast<uint32_t>(length);
+    record->topic_ID = topic_ID;
+    record->priority = priority;
+    record->receive_time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(receive_time.time_since_epoch()).count();
+    ::memcpy(record + 1, buffer, length);
+
+    used_ += record_size(length);
+    counts_[priority]++;
+
+    return true;
+}
+
+size_t RxLanes::drain(const Visitor & visitor)
+{
+    size_t total = 0;
+    for (size_t priority = counts_.size(); priority-- > 0;)
+    {
+        uint32_t left = counts_[priority];
+        for (size_t offset = 0; left > 0; )
+        {
+            Record * record = reinterpret_cast<Record *>(buf_.get() + offset);
+            offset += record_size(record->length);
+            if (record->priority != priority)
+            {
+                continue;
+            }
+
+            std::chrono::system_clock::time_point receive_time{
+                std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::nanoseconds(record->receive_time_ns))};
+            visitor(record->topic_ID, reinterpret_cast<uint8_t *>(record + 1), record->length, receive_time);
+            left--;
+            total++;
+        }
+        counts_[priority] = 0;
+    }
+    used_ = 0;
+
+    return total;
+}
+
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
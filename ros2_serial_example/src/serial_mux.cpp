@@ -0,0 +1,233 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cerrno>
+#include <cstdint>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "ros2_serial_example/link_mux.hpp"
+#include "ros2_serial_example/shm_transporter.hpp"
+#include "ros2_serial_example/transporter.hpp"
+#include "ros2_serial_example/uart_transporter.hpp"
+
+// The bytes in each direction of the shared memory of an endpoint.
+constexpr size_t SHM_RING_SIZE = 65536;
+
+// How long a message for a client waits for it to make room.
+constexpr uint32_t ENDPOINT_WRITE_TIMEOUT_MS = 10;
+
+static void usage(const char *name)
+{
+    ::printf("Usage: %s [options]\n\n"
+             "  -b <baudrate> Baudrate to use for the device\n"
+             "  -c <channels> Number of channels (default 2)\n"
+             "  -d <device>   UART device; must be specified\n"
+             "  -h            Print this help message\n"
+             "  -n <prefix>   Shared memory name prefix of the endpoints; the\n"
+             "                channel number is appended (default\n"
+             "                '/ros2_serial_mux')\n"
+             "  -p <protocol> Protocol between the endpoints and their\n"
+             "                clients (default 'cobs')\n"
+             "  -q <depth>    Payloads that may wait for the link per channel\n"
+             "                (default 64)\n"
+             "  -Q <bytes>    Bytes each channel may write to the link per\n"
+             "                round (default 1024)\n"
+             "  -s <protocol> Serial protocol to use on the device; more than\n"
+             "                one channel needs 'v2' (default 'cobs')\n",
+             name);
+}
+
+volatile sig_atomic_t running = 1;
+
+static void signal_handler(int signum)
+{
+    (void)signum;
+    running = 0;
+}
+
+// Parse a positive number option, printing what was wrong with it if it
+// isn't one.
+static bool parse_count(const char *arg, const char *what, unsigned long *out)
+{
+    char *endptr;
+    errno = 0;
+    *out = ::strtoul(arg, &endptr, 10);
+    if (errno == ERANGE || *arg == '\0' || *endptr != '\0' || *out == 0)
+    {
+        ::fprintf(stderr, "Invalid %s; must be a number > 0\n", what);
+        return false;
+    }
+
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    std::string device{};
+    unsigned long baudrate = 0;
+    std::string serial_protocol{"cobs"};
+    unsigned long channels = 2;
+    std::string shm_prefix{"/ros2_serial_mux"};
+    std::string endpoint_protocol{"cobs"};
+    unsigned long queue_depth = 64;
+    unsigned long quantum = 1024;
+
+    int ch;
+    while ((ch = ::getopt(argc, argv, "b:c:d:hn:p:q:Q:s:")) != EOF)
+    {
+        switch (ch)
+        {
+        case 'b':
+            if (optarg != nullptr && !parse_count(optarg, "baudrate", &baudrate))
+            {
+                return 1;
+            }
+            break;
+        case 'c':
+            if (optarg != nullptr && !parse_count(optarg, "number of channels", &channels))
+            {
+                return 1;
+            }
+            break;
+        case 'd':
+            if (optarg != nullptr)
+            {
+                device = optarg;
+            }
+            break;
+        case 'h':
+            usage(argv[0]);
+            return 0;
+        case 'n':
+            if (optarg != nullptr)
+            {
+                shm_prefix = optarg;
+            }
+            break;
+        case 'p':
+            if (optarg != nullptr)
+            {
+                endpoint_protocol = optarg;
+            }
+            break;
+        case 'q':
+            if (optarg != nullptr && !parse_count(optarg, "queue depth", &queue_depth))
+            {
+                return 1;
+            }
+            break;
+        case 'Q':
+            if (optarg != nullptr && !parse_count(optarg, "quantum", &quantum))
+            {
+                return 1;
+            }
+            break;
+        case 's':
+            if (optarg != nullptr)
+            {
+                serial_protocol = optarg;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (optind < argc)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (device.empty())
+    {
+        fprintf(stderr, "No device specified\n");
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::unique_ptr<ros2_to_serial_bridge::transport::Transporter> link;
+    std::vector<std::unique_ptr<ros2_to_serial_bridge::transport::Transporter>> endpoints;
+    std::vector<ros2_to_serial_bridge::transport::Transporter *> endpoint_ptrs;
+    std::unique_ptr<ros2_to_serial_bridge::transport::LinkMux> mux;
+    try
+    {
+        link = std::make_unique<ros2_to_serial_bridge::transport::UARTTransporter>(device, serial_protocol, baudrate, 100, 8192);
+        for (unsigned long i = 0; i < channels; ++i)
+        {
+            endpoints.push_back(std::make_unique<ros2_to_serial_bridge::transport::ShmTransporter>(
+                endpoint_protocol, shm_prefix + std::to_string(i),
+                ros2_to_serial_bridge::transport::ShmTransporter::Role::CREATE, SHM_RING_SIZE, 100, 8192));
+            endpoint_ptrs.push_back(endpoints.back().get());
+        }
+        mux = std::make_unique<ros2_to_serial_bridge::transport::LinkMux>(link.get(), endpoint_ptrs, queue_depth, quantum);
+    }
+    catch (const std::runtime_error & err)
+    {
+        ::fprintf(stderr, "%s\n", err.what());
+        return 1;
+    }
+
+    if (link->init() < 0)
+    {
+        return 1;
+    }
+    for (unsigned long i = 0; i < channels; ++i)
+    {
+        if (endpoints[i]->init() < 0)
+        {
+            return 1;
+        }
+        // A client that stops reading only loses its own messages, rather
+        // than holding up the link reader for everybody.
+        endpoints[i]->set_write_timeout(ENDPOINT_WRITE_TIMEOUT_MS);
+        ::printf("Channel %lu: shm_name '%s%lu'\n", i, shm_prefix.c_str(), i);
+    }
+
+    ::signal(SIGINT, signal_handler);
+
+    mux->start();
+    while (running != 0)
+    {
+        ::usleep(100000);
+    }
+    mux->stop();
+
+    for (unsigned long i = 0; i < channels; ++i)
+    {
+        ros2_to_serial_bridge::transport::LinkMux::Stats stats = mux->get_stats(i);
+        ::printf("Channel %lu: %lu received (%lu dropped), %lu sent in %lu bytes (%lu dropped)\n", i,
+                 static_cast<unsigned long>(stats.rx_messages), static_cast<unsigned long>(stats.rx_drops),
+                 static_cast<unsigned long>(stats.tx_messages), static_cast<unsigned long>(stats.tx_bytes),
+                 static_cast<unsigned long>(stats.tx_drops));
+        endpoints[i]->close();
+    }
+    if (mux->get_unrouted() > 0)
+    {
+        ::printf("%lu received for channels that don't exist\n", static_cast<unsigned long>(mux->get_unrouted()));
+    }
+
+    link->close();
+
+    return 0;
+}
@@ -0,0 +1,391 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "ros2_serial_example/sharded_transporter.hpp"
+#include "ros2_serial_example/thread_settings.hpp"
+#include "ros2_serial_example/transporter.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+constexpr size_t ShardedTransporter::MAX_SHARDS;
+
+// What a shard thread queues in front of each message.
+struct QueuedHeader final
+{
+    int64_t receive_ns;
+    int32_t seq;
+    uint32_t length;
+    topic_id_size_t topic_ID;
+};
+
+ShardedTransporter::ShardedTransporter(const std::string & protocol,
+                                       std::vector<std::unique_ptr<Transporter>> shards,
+                                       uint32_t read_poll_ms,
+                                       size_t ring_buffer_size,
+                                       size_t queue_bytes):
+    Transporter(protocol, ring_buffer_size),
+    read_poll_ms_(read_poll_ms),
+    ring_buffer_size_(ring_buffer_size)
+{
+    if (shards.empty() || shards.size() > MAX_SHARDS)
+    {
+        throw std::runtime_error("Invalid number of shards; must be between 1 and " + std::to_string(MAX_SHARDS) +
+                                 " inclusive");
+    }
+
+    for (std::unique_ptr<Transporter> & transporter : shards)
+    {
+        if (transporter == nullptr)
+        {
+            throw std::runtime_error("Shard must not be a nullptr");
+        }
+        if (transporter->get_protocol() != get_protocol())
+        {
+            throw std::runtime_error("Shard uses protocol '" + transporter->get_protocol() + "' rather than '" +
+                                     get_protocol() + "'");
+        }
+        shards_.push_back(std::make_unique<Shard>(queue_bytes));
+        shards_.back()->transporter = std::move(transporter);
+    }
+
+    whole_messages_ = true;
+}
+
+ShardedTransporter::~ShardedTransporter()
+{
+    close();
+}
+
+int ShardedTransporter::set_shard_cpus(const std::vector<int64_t> & cpus)
+{
+    if (initialized_ || std::any_of(cpus.begin(), cpus.end(), [](int64_t cpu) { return cpu < 0; }))
+    {
+        return -1;
+    }
+
+    cpus_ = cpus;
+
+    return 0;
+}
+
+int ShardedTransporter::init()
+{
+    if (initialized_)
+    {
+        ::fprintf(stderr, "Cannot re-init; call close first\n");
+        return -1;
+    }
+
+    notify_fd_ = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (notify_fd_ < 0)
+    {
+        ::fprintf(stderr, "Failed to create shard eventfd: %s\n", ::strerror(errno));
+        return -1;
+    }
+
+    // The shards are initialized in order, which for UDP is the order the
+    // kernel numbers the sockets sharing the port in.
+    for (size_t i = 0; i < shards_.size(); ++i)
+    {
+        if (shards_[i]->transporter->init() < 0)
+        {
+            ::fprintf(stderr, "Failed to initialize shard %zu\n", i);
+            close();
+            return -1;
+        }
+    }
+
+    stopping_ = false;
+    for (size_t i = 0; i < shards_.size(); ++i)
+    {
+        Shard * shard = shards_[i].get();
+        shard->thread = std::thread(&ShardedTransporter::shard_thread_func, this, shard);
+        if (i < cpus_.size())
+        {
+            ThreadSettings settings;
+            settings.cpus = {cpus_[i]};
+            std::string error;
+            if (!apply_thread_settings(shard->thread.native_handle(), settings, &error))
+            {
+                ::fprintf(stderr, "Failed to pin shard %zu: %s\n", i, error.c_str());
+                close();
+                return -1;
+            }
+        }
+    }
+
+    initialized_ = true;
+
+    return 0;
+}
+
+int ShardedTransporter::close()
+{
+    int ret = 0;
+
+    // The shard threads notice within the read_poll_ms of their shards.
+    stopping_ = true;
+    for (std::unique_ptr<Shard> & shard : shards_)
+    {
+        if (shard->thread.joinable())
+        {
+            shard->thread.join();
+        }
+    }
+
+    for (std::unique_ptr<Shard> & shard : shards_)
+    {
+        if (shard->transporter->close() < 0)
+        {
+            ret = -1;
+        }
+        size_t len;
+        while (shard->queue.peek_contiguous(&len) != nullptr)
+        {
+            shard->queue.consume(len);
+        }
+    }
+
+    if (notify_fd_ != -1)
+    {
+        if (::close(notify_fd_) < 0)
+        {
+            ret = -1;
+        }
+        notify_fd_ = -1;
+    }
+
+    initialized_ = false;
+
+    return ret;
+}
+
+int ShardedTransporter::get_read_fd() const
+{
+    return notify_fd_;
+}
+
+ssize_t ShardedTransporter::get_write_queue_bytes() const
+{
+    return shards_[0]->transporter->get_write_queue_bytes();
+}
+
+ShardedTransporter::ShardStats ShardedTransporter::get_shard_stats(size_t shard) const
+{
+    ShardStats stats;
+    if (shard >= shards_.size())
+    {
+        return stats;
+    }
+
+    stats.rx_messages = shards_[shard]->rx_messages;
+    stats.overflows = shards_[shard]->queue.get_overflows();
+
+    return stats;
+}
+
+void ShardedTransporter::shard_thread_func(Shard * shard)
+{
+    std::unique_ptr<uint8_t[]> buffer(new uint8_t[ring_buffer_size_]);
+
+    while (!stopping_)
+    {
+        bool queued = false;
+        ssize_t ret = shard->transporter->read_many(buffer.get(), ring_buffer_size_,
+                                                    [&](topic_id_size_t topic_ID, uint8_t *payload, size_t payload_len) {
+            QueuedHeader header{};
+            header.receive_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                shard->transporter->get_receive_time().time_since_epoch()).count();
+            header.seq = shard->transporter->get_receive_sequence();
+            header.length = static_cast<uint32_t>(payload_len);
+            header.topic_ID = topic_ID;
+            struct iovec iov[2];
+            iov[0].iov_base = &header;
+            iov[0].iov_len = sizeof(header);
+            iov[1].iov_base = payload;
+            iov[1].iov_len = payload_len;
+            // A full queue counts the overflow itself.
+            if (shard->queue.writev(iov, 2) >= 0)
+            {
+                shard->rx_messages++;
+                queued = true;
+            }
+        });
+
+        if (queued)
+        {
+            uint64_t one = 1;
+            if (::write(notify_fd_, &one, sizeof(one)) < 0 && errno != EAGAIN)
+            {
+                ::fprintf(stderr, "Failed to signal shard eventfd (%d)\n", errno);
+            }
+        }
+        else if (ret < 0 && errno != 0 && errno != EAGAIN && errno != ETIMEDOUT && errno != EINTR)
+        {
+            // A shard that fails keeps failing straight away; don't spin on
+            // it.
+            std::this_thread::sleep_for(std::chrono::milliseconds(std::max<uint32_t>(read_poll_ms_, 1)));
+        }
+    }
+}
+
+ssize_t ShardedTransporter::take(Shard & shard, topic_id_size_t *topic_ID, uint8_t *out_buffer, size_t buffer_len,
+                                 size_t *taken)
+{
+    QueuedHeader header;
+    if (shard.queue.bytes_used() < sizeof(header))
+    {
+        return -ENODATA;
+    }
+    shard.queue.memcpy_from(&header, sizeof(header));
+    *taken = sizeof(header) + header.length;
+
+    if (header.length > buffer_len)
+    {
+        shard.queue.consume(header.length);
+        get_metrics().drop(Metrics::Direction::RX, header.topic_ID, Metrics::Drop::OVERSIZE);
+        return -ENOBUFS;
+    }
+    if (header.length > 0)
+    {
+        shard.queue.memcpy_from(out_buffer, header.length);
+    }
+
+    *topic_ID = header.topic_ID;
+    set_receive_info(std::chrono::system_clock::time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                         std::chrono::nanoseconds(header.receive_ns))),
+                     header.seq);
+
+    return header.length;
+}
+
+ssize_t ShardedTransporter::node_read()
+{
+    errno = ENOTSUP;
+
+    return -1;
+}
+
+ssize_t ShardedTransporter::node_write(void *buffer, size_t len)
+{
+    struct iovec iov;
+    iov.iov_base = buffer;
+    iov.iov_len = len;
+
+    return node_writev(&iov, 1);
+}
+
+ssize_t ShardedTransporter::node_writev(const struct iovec *iov, int iovcnt)
+{
+    ssize_t written = shards_[0]->transporter->write_framed(write_topic_ID_, iov, iovcnt);
+    if (written < 0)
+    {
+        return -1;
+    }
+
+    return written;
+}
+
+ssize_t ShardedTransporter::node_read_message(topic_id_size_t *topic_ID, uint8_t *out_buffer, size_t buffer_len)
+{
+    // Take the shards in turn, so a busy one doesn't starve the others.
+    for (size_t n = 0; n < shards_.size(); ++n)
+    {
+        Shard & shard = *shards_[next_shard_];
+        next_shard_ = (next_shard_ + 1) % shards_.size();
+
+        size_t taken;
+        ssize_t len = take(shard, topic_ID, out_buffer, buffer_len, &taken);
+        if (len >= 0)
+        {
+            return len;
+        }
+    }
+
+    return -ENODATA;
+}
+
+ssize_t ShardedTransporter::node_read_messages(uint8_t *out_buffer, size_t buffer_len, const MessageVisitor & visitor)
+{
+    // The eventfd is cleared before the queues are looked at, so a message
+    // queued after this wakes the next read up.
+    uint64_t count;
+    if (::read(notify_fd_, &count, sizeof(count)) < 0 && errno == EAGAIN)
+    {
+        struct pollfd pfd{};
+        pfd.fd = notify_fd_;
+        pfd.events = POLLIN;
+        if (::poll(&pfd, 1, static_cast<int>(read_poll_ms_)) > 0 &&
+            ::read(notify_fd_, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        {
+            return -1;
+        }
+    }
+
+    // Each shard is drained only as far as it was when the read started, so
+    // that a busy shard can't keep the read going forever.
+    ssize_t nmessages = 0;
+    for (std::unique_ptr<Shard> & shard : shards_)
+    {
+        size_t left = shard->queue.bytes_used();
+        while (left >= sizeof(QueuedHeader))
+        {
+            topic_id_size_t topic_ID;
+            size_t taken;
+            ssize_t len = take(*shard, &topic_ID, out_buffer, buffer_len, &taken);
+            if (len == -ENODATA)
+            {
+                break;
+            }
+            left -= std::min(left, taken);
+            if (len >= 0)
+            {
+                visitor(topic_ID, out_buffer, static_cast<size_t>(len));
+                nmessages++;
+            }
+        }
+    }
+
+    return nmessages;
+}
+
+bool ShardedTransporter::fds_OK()
+{
+    return initialized_;
+}
+
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
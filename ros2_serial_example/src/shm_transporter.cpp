@@ -0,0 +1,388 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ros2_serial_example/shm_transporter.hpp"
+#include "ros2_serial_example/transporter.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+namespace impl
+{
+
+// The control block for one direction of the shared memory segment.  head and
+// tail are running byte counts (they never wrap), so the ring holds
+// head - tail bytes.  The producer and consumer fields are on separate cache
+// lines so the two processes don't fight over them.
+struct ShmRing final
+{
+    alignas(64) std::atomic<uint64_t> head;
+    std::atomic<uint32_t> data_seq;
+    std::atomic<uint32_t> reader_waiting;
+    alignas(64) std::atomic<uint64_t> tail;
+    std::atomic<uint32_t> space_seq;
+    std::atomic<uint32_t> writer_waiting;
+};
+
+}  // namespace impl
+
+namespace
+{
+
+constexpr uint32_t SHM_MAGIC = 0x52325348;  // "R2SH"
+constexpr uint32_t SHM_VERSION = 1;
+
+// The layout of the start of the shared memory segment; the data for the two
+// rings follows it.  ring[0] carries data from the creating side to the
+// attaching side, and ring[1] the other way.
+struct ShmHeader final
+{
+    std::atomic<uint32_t> magic;
+    uint32_t version;
+    uint64_t ring_size;
+    impl::ShmRing ring[2];
+};
+
+int futex_wait(std::atomic<uint32_t> *addr, uint32_t expected, uint32_t timeout_ms)
+{
+    struct timespec ts{};
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+    // The segment is shared between processes, so this can't use the
+    // FUTEX_PRIVATE_FLAG variants.
+    return ::syscall(SYS_futex, reinterpret_cast<uint32_t *>(addr), FUTEX_WAIT, expected, &ts, nullptr, 0);
+}
+
+void futex_wake(std::atomic<uint32_t> *addr)
+{
+    ::syscall(SYS_futex, reinterpret_cast<uint32_t *>(addr), FUTEX_WAKE, 1, nullptr, nullptr, 0);
+}
+
+}  // namespace
+
+ShmTransporter::ShmTransporter(const std::string & protocol,
+                               const std::string & shm_name,
+                               Role role,
+                               size_t shm_ring_size,
+                               uint32_t read_poll_ms,
+                               size_t ring_buffer_size):
+    Transporter(protocol, ring_buffer_size),
+    shm_name_(shm_name),
+    role_(role),
+    shm_ring_size_(shm_ring_size),
+    read_poll_ms_(read_poll_ms)
+{
+    if (shm_name_.size() < 2 || shm_name_[0] != '/' || shm_name_.find('/', 1) != std::string::npos)
+    {
+        throw std::runtime_error("Invalid shared memory name; must be of the form '/name'");
+    }
+
+    if (role_ == Role::CREATE && shm_ring_size_ == 0)
+    {
+        throw std::runtime_error("Invalid shared memory ring size; must be > 0");
+    }
+}
+
+ShmTransporter::~ShmTransporter()
+{
+    close();
+}
+
+int ShmTransporter::init()
+{
+    if (fds_OK())
+    {
+        ::fprintf(stderr, "Cannot re-init; call close first\n");
+        return -1;
+    }
+
+    if (role_ == Role::CREATE)
+    {
+        // Remove any segment left behind by a previous run that didn't exit
+        // cleanly, so the other side can't attach to stale state.
+        ::shm_unlink(shm_name_.c_str());
+        shm_fd_ = ::shm_open(shm_name_.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    }
+    else
+    {
+        shm_fd_ = ::shm_open(shm_name_.c_str(), O_RDWR | O_CLOEXEC, 0);
+    }
+    if (shm_fd_ < 0)
+    {
+        ::fprintf(stderr, "Failed to open shared memory '%s': %s\n", shm_name_.c_str(), ::strerror(errno));
+        return -1;
+    }
+
+    if (role_ == Role::CREATE)
+    {
+        segment_size_ = sizeof(ShmHeader) + 2 * shm_ring_size_;
+        if (::ftruncate(shm_fd_, segment_size_) < 0)
+        {
+            ::fprintf(stderr, "Failed to size shared memory: %s\n", ::strerror(errno));
+            close();
+            return -1;
+        }
+    }
+    else
+    {
+        struct stat st{};
+        if (::fstat(shm_fd_, &st) < 0 || static_cast<size_t>(st.st_size) < sizeof(ShmHeader))
+        {
+            ::fprintf(stderr, "Shared memory '%s' is not set up yet\n", shm_name_.c_str());
+            close();
+            return -1;
+        }
+        segment_size_ = st.st_size;
+    }
+
+    segment_ = ::mmap(nullptr, segment_size_, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd_, 0);
+    if (segment_ == MAP_FAILED)
+    {
+        ::fprintf(stderr, "Failed to map shared memory: %s\n", ::strerror(errno));
+        segment_ = nullptr;
+        close();
+        return -1;
+    }
+
+    ShmHeader *header;
+    if (role_ == Role::CREATE)
+    {
+        // The freshly sized segment is all zeros; construct the control
+        // blocks, and only then publish the magic so the other side knows the
+        // segment is ready.
+        header = new (segment_) ShmHeader();
+        header->version = SHM_VERSION;
+        header->ring_size = shm_ring_size_;
+        header->magic.store(SHM_MAGIC, std::memory_order_release);
+    }
+    else
+    {
+        header = static_cast<ShmHeader *>(segment_);
+        if (header->magic.load(std::memory_order_acquire) != SHM_MAGIC || header->version != SHM_VERSION ||
+            sizeof(ShmHeader) + 2 * header->ring_size != segment_size_)
+        {
+            ::fprintf(stderr, "Shared memory '%s' is not set up yet or has an unknown layout\n", shm_name_.c_str());
+            close();
+            return -1;
+        }
+        shm_ring_size_ = header->ring_size;
+    }
+
+    uint8_t *data = static_cast<uint8_t *>(segment_) + sizeof(ShmHeader);
+    int tx_index = (role_ == Role::CREATE) ? 0 : 1;
+    tx_ring_ = &header->ring[tx_index];
+    rx_ring_ = &header->ring[1 - tx_index];
+    tx_data_ = data + tx_index * shm_ring_size_;
+    rx_data_ = data + (1 - tx_index) * shm_ring_size_;
+
+    return 0;
+}
+
+bool ShmTransporter::fds_OK()
+{
+    return segment_ != nullptr;
+}
+
+int ShmTransporter::close()
+{
+    if (segment_ != nullptr)
+    {
+        ::munmap(segment_, segment_size_);
+        segment_ = nullptr;
+    }
+
+    if (-1 != shm_fd_)
+    {
+        ::close(shm_fd_);
+        shm_fd_ = -1;
+        if (role_ == Role::CREATE)
+        {
+            ::shm_unlink(shm_name_.c_str());
+        }
+    }
+
+    tx_ring_ = nullptr;
+    rx_ring_ = nullptr;
+    tx_data_ = nullptr;
+    rx_data_ = nullptr;
+
+    return 0;
+}
+
+ssize_t ShmTransporter::node_read()
+{
+    if (!fds_OK())
+    {
+        return -1;
+    }
+
+    uint64_t tail = rx_ring_->tail.load(std::memory_order_relaxed);
+    uint64_t head = rx_ring_->head.load(std::memory_order_acquire);
+    if (head == tail)
+    {
+        // Announce that we are going to sleep, then check again, so that a
+        // write that happened in between isn't missed.  The futex wait
+        // itself returns immediately if data_seq moved on since we read it.
+        uint32_t seq = rx_ring_->data_seq.load(std::memory_order_seq_cst);
+        rx_ring_->reader_waiting.store(1, std::memory_order_seq_cst);
+        head = rx_ring_->head.load(std::memory_order_seq_cst);
+        if (head == tail)
+        {
+            futex_wait(&rx_ring_->data_seq, seq, read_poll_ms_);
+            head = rx_ring_->head.load(std::memory_order_acquire);
+        }
+        rx_ring_->reader_waiting.store(0, std::memory_order_relaxed);
+        if (head == tail)
+        {
+            return 0;
+        }
+    }
+
+    // Copy what is available, in at most two pieces on either side of the
+    // wrap in shared memory.  Like a short read() from a file descriptor,
+    // stop when the ring buffer wraps; whatever is left stays in shared
+    // memory for the next call.
+    size_t avail = head - tail;
+    size_t ncopied = 0;
+    while (ncopied < avail)
+    {
+        size_t offset = (tail + ncopied) % shm_ring_size_;
+        size_t n = std::min(avail - ncopied, shm_ring_size_ - offset);
+        ssize_t ret = ringbuf_.write(rx_data_ + offset, n);
+        if (ret <= 0)
+        {
+            break;
+        }
+        ncopied += ret;
+        if (static_cast<size_t>(ret) < n)
+        {
+            break;
+        }
+    }
+
+    rx_ring_->tail.store(tail + ncopied, std::memory_order_seq_cst);
+    rx_ring_->space_seq.fetch_add(1, std::memory_order_seq_cst);
+    if (rx_ring_->writer_waiting.load(std::memory_order_seq_cst) != 0)
+    {
+        futex_wake(&rx_ring_->space_seq);
+    }
+
+    return ncopied;
+}
+
+ssize_t ShmTransporter::node_write(void *buffer, size_t len)
+{
+    if (nullptr == buffer || !fds_OK())
+    {
+        return -1;
+    }
+
+    const uint8_t *b = static_cast<const uint8_t *>(buffer);
+    size_t n = len;
+    std::chrono::steady_clock::time_point deadline;
+    bool waited = false;
+    while (n > 0)
+    {
+        uint64_t head = tx_ring_->head.load(std::memory_order_relaxed);
+        uint64_t tail = tx_ring_->tail.load(std::memory_order_acquire);
+        size_t nfree = shm_ring_size_ - (head - tail);
+        if (nfree == 0)
+        {
+            // The other side isn't keeping up; wait for it to make room, but
+            // not forever.
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            if (!waited)
+            {
+                waited = true;
+                deadline = now + std::chrono::milliseconds(write_timeout_ms_);
+            }
+            else if (now >= deadline)
+            {
+                errno = EBUSY;
+                break;
+            }
+
+            uint32_t seq = tx_ring_->space_seq.load(std::memory_order_seq_cst);
+            tx_ring_->writer_waiting.store(1, std::memory_order_seq_cst);
+            tail = tx_ring_->tail.load(std::memory_order_seq_cst);
+            if (head - tail == shm_ring_size_)
+            {
+                uint32_t left_ms = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count() + 1;
+                futex_wait(&tx_ring_->space_seq, seq, left_ms);
+            }
+            tx_ring_->writer_waiting.store(0, std::memory_order_relaxed);
+            continue;
+        }
+        waited = false;
+
+        size_t count = std::min(n, nfree);
+        size_t offset = head % shm_ring_size_;
+        size_t first = std::min(count, shm_ring_size_ - offset);
+        ::memcpy(tx_data_ + offset, b, first);
+        ::memcpy(tx_data_, b + first, count - first);
+
+        tx_ring_->head.store(head + count, std::memory_order_seq_cst);
+        tx_ring_->data_seq.fetch_add(1, std::memory_order_seq_cst);
+        if (tx_ring_->reader_waiting.load(std::memory_order_seq_cst) != 0)
+        {
+            futex_wake(&tx_ring_->data_seq);
+        }
+
+        n -= count;
+        b += count;
+    }
+
+    if (n > 0 && n < len)
+    {
+        partial_writes_++;
+    }
+
+    return (n > 0) ? -1 : len;
+}
+
+ssize_t ShmTransporter::get_write_queue_bytes() const
+{
+    if (nullptr == tx_ring_)
+    {
+        return -1;
+    }
+
+    return tx_ring_->head.load(std::memory_order_relaxed) - tx_ring_->tail.load(std::memory_order_acquire);
+}
+
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
@@ -0,0 +1,126 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+
+#include "ros2_serial_example/sim_lockstep.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+constexpr uint8_t SimLockstep::STEP;
+constexpr uint8_t SimLockstep::ACK;
+constexpr size_t SimLockstep::MESSAGE_SIZE;
+
+// The offsets of the fields; the kind is padded out to the alignment of the
+// 64-bit step, as CDR does.
+constexpr size_t STEP_OFFSET = 8;
+constexpr size_t SIM_TIME_OFFSET = 16;
+
+size_t SimLockstep::encode(uint8_t kind, uint64_t step, int64_t sim_time_ns, uint8_t * buf, size_t len)
+{
+    if (len < MESSAGE_SIZE)
+    {
+        return 0;
+    }
+
+    ::memset(buf, 0, STEP_OFFSET);
+    buf[0] = kind;
+    ::memcpy(buf + STEP_OFFSET, &step, sizeof(step));
+    ::memcpy(buf + SIM_TIME_OFFSET, &sim_time_ns, sizeof(sim_time_ns));
+
+    return MESSAGE_SIZE;
+}
+
+bool SimLockstep::decode(const uint8_t * buf, size_t len, uint8_t * kind, uint64_t * step, int64_t * sim_time_ns)
+{
+    if (len < MESSAGE_SIZE || (buf[0] != STEP && buf[0] != ACK))
+    {
+        return false;
+    }
+
+    *kind = buf[0];
+    ::memcpy(step, buf + STEP_OFFSET, sizeof(*step));
+    ::memcpy(sim_time_ns, buf + SIM_TIME_OFFSET, sizeof(*sim_time_ns));
+
+    return true;
+}
+
+bool SimLockstep::step(uint64_t step, int64_t sim_time_ns, int64_t wall_ns)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (stepped_ && step == last_step_ && sim_time_ns == sim_time_ns_)
+    {
+        repeats_++;
+        return false;
+    }
+
+    // A simulator that was started again begins back at its start time, so
+    // the speed is measured again from there.
+    if (!stepped_ || sim_time_ns < sim_time_ns_)
+    {
+        start_sim_ns_ = sim_time_ns;
+        start_wall_ns_ = wall_ns;
+    }
+    stepped_ = true;
+    last_step_ = step;
+    sim_time_ns_ = sim_time_ns;
+    wall_ns_ = wall_ns;
+    steps_++;
+
+    return true;
+}
+
+uint64_t SimLockstep::get_steps() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    return steps_;
+}
+
+uint64_t SimLockstep::get_repeats() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    return repeats_;
+}
+
+int64_t SimLockstep::get_sim_time_ns() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    return sim_time_ns_;
+}
+
+double SimLockstep::get_real_time_factor() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (wall_ns_ <= start_wall_ns_)
+    {
+        return 0.0;
+    }
+
+    return static_cast<double>(sim_time_ns_ - start_sim_ns_) / static_cast<double>(wall_ns_ - start_wall_ns_);
+}
+
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
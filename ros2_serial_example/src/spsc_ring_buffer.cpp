@@ -0,0 +1,302 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "ros2_serial_example/spsc_ring_buffer.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+namespace impl
+{
+
+SPSCRingBuffer::SPSCRingBuffer(size_t capacity) : size_(capacity)
+{
+    if (capacity == 0)
+    {
+        throw std::runtime_error("SPSCRingBuffer capacity must be > 0");
+    }
+
+    buf_ = std::unique_ptr<uint8_t[]>(new uint8_t[capacity]);
+}
+
+size_t SPSCRingBuffer::producer_free(size_t count)
+{
+    size_t head = head_.load(std::memory_order_relaxed);
+    size_t nfree = size_ - (head - cached_tail_);
+    if (nfree < count)
+    {
+        // Only look at the consumer's cache line when our copy of the tail
+        // says there isn't enough room.  The acquire pairs with the release
+        // in consume(), so the consumer is done with the space it freed.
+        cached_tail_ = tail_.load(std::memory_order_acquire);
+        nfree = size_ - (head - cached_tail_);
+    }
+
+    return nfree;
+}
+
+size_t SPSCRingBuffer::consumer_used(size_t count)
+{
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    size_t used = cached_head_ - tail;
+    if (used < count)
+    {
+        // The acquire pairs with the release in commit_write(), so the data
+        // the producer committed is visible to us.
+        cached_head_ = head_.load(std::memory_order_acquire);
+        used = cached_head_ - tail;
+    }
+
+    return used;
+}
+
+uint8_t *SPSCRingBuffer::reserve_write(size_t *len)
+{
+    // Callers want all of the space there is, so always refresh the tail.
+    size_t nfree = producer_free(size_);
+    if (nfree == 0)
+    {
+        *len = 0;
+        return nullptr;
+    }
+
+    size_t offset = head_.load(std::memory_order_relaxed) % size_;
+    *len = std::min(nfree, size_ - offset);
+    return buf_.get() + offset;
+}
+
+ssize_t SPSCRingBuffer::commit_write(size_t count)
+{
+    if (count > producer_free(count))
+    {
+        return -1;
+    }
+
+    head_.store(head_.load(std::memory_order_relaxed) + count, std::memory_order_release);
+
+    return count;
+}
+
+ssize_t SPSCRingBuffer::write(const void *src, size_t count)
+{
+    if (src == nullptr)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (count > producer_free(count))
+    {
+        overflows_++;
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    const uint8_t *u8src = static_cast<const uint8_t *>(src);
+    size_t offset = head_.load(std::memory_order_relaxed) % size_;
+    size_t n = std::min(count, size_ - offset);
+    ::memcpy(buf_.get() + offset, u8src, n);
+    ::memcpy(buf_.get(), u8src + n, count - n);
+
+    return commit_write(count);
+}
+
+ssize_t SPSCRingBuffer::writev(const struct iovec *iov, int iovcnt)
+{
+    if (iov == nullptr || iovcnt < 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    size_t count = 0;
+    for (int i = 0; i < iovcnt; ++i)
+    {
+        if (iov[i].iov_base == nullptr && iov[i].iov_len > 0)
+        {
+            errno = EINVAL;
+            return -1;
+        }
+        count += iov[i].iov_len;
+    }
+
+    if (count > producer_free(count))
+    {
+        overflows_++;
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    size_t head = head_.load(std::memory_order_relaxed);
+    for (int i = 0; i < iovcnt; ++i)
+    {
+        if (iov[i].iov_len == 0)
+        {
+            continue;
+        }
+        const uint8_t *u8src = static_cast<const uint8_t *>(iov[i].iov_base);
+        size_t offset = head % size_;
+        size_t n = std::min(iov[i].iov_len, size_ - offset);
+        ::memcpy(buf_.get() + offset, u8src, n);
+        ::memcpy(buf_.get(), u8src + n, iov[i].iov_len - n);
+        head += iov[i].iov_len;
+    }
+
+    return commit_write(count);
+}
+
+ssize_t SPSCRingBuffer::read(int fd)
+{
+    size_t nfree = producer_free(size_);
+    if (nfree == 0)
+    {
+        overflows_++;
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    size_t offset = head_.load(std::memory_order_relaxed) % size_;
+    size_t n = std::min(nfree, size_ - offset);
+
+    struct iovec iov[2];
+    iov[0].iov_base = buf_.get() + offset;
+    iov[0].iov_len = n;
+    iov[1].iov_base = buf_.get();
+    iov[1].iov_len = nfree - n;
+
+    ssize_t ret = ::readv(fd, iov, iov[1].iov_len > 0 ? 2 : 1);
+    if (ret > 0)
+    {
+        commit_write(ret);
+    }
+
+    return ret;
+}
+
+const uint8_t *SPSCRingBuffer::peek_contiguous(size_t *len)
+{
+    // Callers want all of the data there is, so always refresh the head.
+    size_t used = consumer_used(size_);
+    if (used == 0)
+    {
+        *len = 0;
+        return nullptr;
+    }
+
+    size_t offset = tail_.load(std::memory_order_relaxed) % size_;
+    *len = std::min(used, size_ - offset);
+    return buf_.get() + offset;
+}
+
+ssize_t SPSCRingBuffer::peek_spans(size_t count, const uint8_t **first, size_t *first_len,
+                                   const uint8_t **second, size_t *second_len)
+{
+    if (count > consumer_used(count))
+    {
+        return -1;
+    }
+
+    size_t offset = tail_.load(std::memory_order_relaxed) % size_;
+    size_t n = std::min(count, size_ - offset);
+    *first = buf_.get() + offset;
+    *first_len = n;
+    if (n == count)
+    {
+        *second = nullptr;
+        *second_len = 0;
+    }
+    else
+    {
+        *second = buf_.get();
+        *second_len = count - n;
+    }
+
+    return count;
+}
+
+ssize_t SPSCRingBuffer::consume(size_t count)
+{
+    if (count > consumer_used(count))
+    {
+        return -1;
+    }
+
+    // The release makes sure we are done reading the data before the
+    // producer can see the space as free and overwrite it.
+    tail_.store(tail_.load(std::memory_order_relaxed) + count, std::memory_order_release);
+
+    return count;
+}
+
+ssize_t SPSCRingBuffer::memcpy_from(void *dst, size_t count)
+{
+    if (dst == nullptr || count == 0)
+    {
+        return -1;
+    }
+
+    const uint8_t *first;
+    size_t first_len;
+    const uint8_t *second;
+    size_t second_len;
+    if (peek_spans(count, &first, &first_len, &second, &second_len) < 0)
+    {
+        return -1;
+    }
+
+    uint8_t *u8dst = static_cast<uint8_t *>(dst);
+    ::memcpy(u8dst, first, first_len);
+    if (second_len > 0)
+    {
+        ::memcpy(u8dst + first_len, second, second_len);
+    }
+
+    return consume(count);
+}
+
+size_t SPSCRingBuffer::bytes_used() const
+{
+    // Load the tail first; the head can only move forward after that, so the
+    // difference never underflows.  It can come out larger than the ring if
+    // both sides moved in between, though, so clamp it.
+    size_t tail = tail_.load(std::memory_order_acquire);
+    return std::min(size_, head_.load(std::memory_order_acquire) - tail);
+}
+
+size_t SPSCRingBuffer::bytes_free() const
+{
+    return size_ - bytes_used();
+}
+
+}  // namespace impl
+
+}  // namespace transport
+
+}  // namespace ros2_to_serial_bridge
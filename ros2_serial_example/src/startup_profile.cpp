@@ -0,0 +1,166 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "ros2_serial_example/startup_profile.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+static std::string format_ms(std::chrono::nanoseconds duration)
+{
+    char buffer[32];
+    ::snprintf(buffer, sizeof(buffer), "%.1f ms", static_cast<double>(duration.count()) / 1e6);
+    return buffer;
+}
+
+StartupProfile::StartupProfile() : last_(Clock::now())
+{
+}
+
+void StartupProfile::mark(const std::string & phase)
+{
+    Clock::time_point now = Clock::now();
+    std::chrono::nanoseconds elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(now - last_);
+    last_ = now;
+
+    for (auto & p : phases_)
+    {
+        if (p.first == phase)
+        {
+            p.second += elapsed;
+            return;
+        }
+    }
+    phases_.emplace_back(phase, elapsed);
+}
+
+std::chrono::nanoseconds StartupProfile::get(const std::string & phase) const
+{
+    for (const auto & p : phases_)
+    {
+        if (p.first == phase)
+        {
+            return p.second;
+        }
+    }
+
+    return std::chrono::nanoseconds(0);
+}
+
+std::chrono::nanoseconds StartupProfile::total() const
+{
+    std::chrono::nanoseconds sum(0);
+    for (const auto & p : phases_)
+    {
+        sum += p.second;
+    }
+
+    return sum;
+}
+
+std::string StartupProfile::report() const
+{
+    std::string text;
+    for (const auto & p : phases_)
+    {
+        if (!text.empty())
+        {
+            text += ", ";
+        }
+        text += p.first + " " + format_ms(p.second);
+    }
+
+    return text + (text.empty() ? "" : " ") + "(total " + format_ms(total()) + ")";
+}
+
+void run_in_parallel(const std::vector<std::function<void()>> & jobs, size_t threads,
+                     std::vector<std::chrono::nanoseconds> * durations)
+{
+    std::vector<std::chrono::nanoseconds> times(jobs.size(), std::chrono::nanoseconds(0));
+    std::atomic<size_t> next{0};
+    std::atomic<bool> failed{false};
+    std::exception_ptr error;
+    std::mutex error_mutex;
+
+    auto worker = [&]() {
+        for (size_t i = next++; i < jobs.size() && !failed; i = next++)
+        {
+            StartupProfile::Clock::time_point start = StartupProfile::Clock::now();
+            try
+            {
+                jobs[i]();
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (!failed)
+                {
+                    error = std::current_exception();
+                    failed = true;
+                }
+            }
+            times[i] = std::chrono::duration_cast<std::chrono::nanoseconds>(StartupProfile::Clock::now() - start);
+        }
+    };
+
+    // The calling thread is one of the workers; if the others can't all be
+    // started, the jobs go to the ones that were.
+    std::vector<std::thread> helpers;
+    size_t count = std::min(std::max<size_t>(threads, 1), jobs.size());
+    for (size_t i = 1; i < count; ++i)
+    {
+        try
+        {
+            helpers.emplace_back(worker);
+        }
+        catch (const std::system_error &)
+        {
+            break;
+        }
+    }
+    worker();
+    for (std::thread & helper : helpers)
+    {
+        helper.join();
+    }
+
+    if (durations != nullptr)
+    {
+        *durations = std::move(times);
+    }
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+}
+
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
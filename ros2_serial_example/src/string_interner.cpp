@@ -0,0 +1,169 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "ros2_serial_example/packed_encoding.hpp"
+#include "ros2_serial_example/string_interner.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace pubsub
+{
+
+constexpr size_t StringInterner::TABLE_SIZE;
+constexpr size_t StringInterner::MAX_STRING_LENGTH;
+constexpr uint32_t StringInterner::REFRESH_INTERVAL;
+
+constexpr uint64_t StringInterner::TOKEN_LITERAL;
+constexpr uint64_t StringInterner::TOKEN_DEFINITION;
+constexpr uint64_t StringInterner::TOKEN_FIRST_SLOT;
+
+static uint32_t fnv1a(const char * data, size_t length)
+{
+    uint32_t h = 0x811c9dc5;
+    for (size_t i = 0; i < length; ++i)
+    {
+        h = (h ^ static_cast<uint8_t>(data[i])) * 0x01000193;
+    }
+    return h;
+}
+
+StringInterner::StringInterner(uint8_t session, uint32_t definitions)
+    : session_(session), definitions_(definitions)
+{
+    // The slots never allocate once they are in use.
+    for (Slot & slot : slots_)
+    {
+        slot.value.reserve(MAX_STRING_LENGTH);
+    }
+}
+
+void StringInterner::begin(std::vector<uint8_t> * out)
+{
+    // Bumping the refresh makes every slot due to be defined again the next
+    // time it is used.
+    if (++payloads_ == REFRESH_INTERVAL)
+    {
+        payloads_ = 0;
+        refresh_++;
+    }
+
+    out->push_back(session_);
+    put_packed_varint(definitions_, out);
+}
+
+void StringInterner::put(const char * data, size_t length, std::vector<uint8_t> * out)
+{
+    if (length > MAX_STRING_LENGTH)
+    {
+        put_literal(data, length, out);
+        literals_++;
+        return;
+    }
+
+    uint32_t hash = fnv1a(data, length);
+    bool found;
+    size_t index = find(data, length, hash, &found);
+    Slot & slot = slots_[index];
+    slot.last_used = ++uses_;
+
+    if (found && slot.refresh == refresh_)
+    {
+        put_packed_varint(TOKEN_FIRST_SLOT + index, out);
+        references_++;
+        return;
+    }
+
+    if (!found)
+    {
+        slot.value.assign(data, length);
+        slot.hash = hash;
+    }
+    slot.refresh = refresh_;
+
+    put_packed_varint(TOKEN_DEFINITION, out);
+    put_packed_varint(index, out);
+    put_packed_varint(length, out);
+    out->insert(out->end(), data, data + length);
+    definitions_++;
+    total_definitions_++;
+}
+
+void StringInterner::put_literal(const char * data, size_t length, std::vector<uint8_t> * out)
+{
+    put_packed_varint(TOKEN_LITERAL, out);
+    put_packed_varint(length, out);
+    out->insert(out->end(), data, data + length);
+}
+
+size_t StringInterner::find(const char * data, size_t length, uint32_t hash, bool * found) const
+{
+    // With few slots, a scan is about as quick as a hash table, and it
+    // finds the least recently used slot on the way.
+    size_t oldest = 0;
+    for (size_t i = 0; i < TABLE_SIZE; ++i)
+    {
+        const Slot & slot = slots_[i];
+        if (slot.last_used != 0 && slot.hash == hash && slot.value.size() == length &&
+            ::memcmp(slot.value.data(), data, length) == 0)
+        {
+            *found = true;
+            return i;
+        }
+        if (slot.last_used < slots_[oldest].last_used)
+        {
+            oldest = i;
+        }
+    }
+
+    *found = false;
+    return oldest;
+}
+
+void InternTable::begin(uint8_t session, uint32_t definitions)
+{
+    if (started_ && session == session_ && definitions == definitions_)
+    {
+        return;
+    }
+
+    if (started_)
+    {
+        resets_++;
+    }
+    valid_.fill(false);
+    started_ = true;
+    session_ = session;
+    definitions_ = definitions;
+}
+
+void InternTable::define(size_t slot, const char * data, size_t length)
+{
+    if (values_[slot].capacity() < StringInterner::MAX_STRING_LENGTH)
+    {
+        values_[slot].reserve(StringInterner::MAX_STRING_LENGTH);
+    }
+    values_[slot].assign(data, length);
+    valid_[slot] = true;
+    definitions_++;
+}
+
+}  // namespace pubsub
+}  // namespace ros2_to_serial_bridge
@@ -0,0 +1,583 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <linux/sockios.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "ros2_serial_example/async_log.hpp"
+#include "ros2_serial_example/tcp_transporter.hpp"
+#include "ros2_serial_example/transporter.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+constexpr uint32_t TCPTransporter::RECONNECT_MIN_MS;
+constexpr uint32_t TCPTransporter::RECONNECT_MAX_MS;
+
+// How long an idle connection waits before sending a keepalive probe, how
+// long between probes, and how many unanswered probes it takes to give up;
+// a peer that has gone away is noticed within about 3 seconds.
+static constexpr int KEEPALIVE_IDLE_S = 1;
+static constexpr int KEEPALIVE_INTERVAL_S = 1;
+static constexpr int KEEPALIVE_COUNT = 2;
+
+// Keepalives aren't sent while there is unacknowledged data, so this covers
+// a peer that goes away in the middle of a write.
+static constexpr unsigned int USER_TIMEOUT_MS = 3000;
+
+static int setup_socket_buffer(int fd, int optname, int size, const char *name)
+{
+    if (size == 0)
+    {
+        return 0;
+    }
+
+    if (::setsockopt(fd, SOL_SOCKET, optname, &size, sizeof(size)) < 0)
+    {
+        ::fprintf(stderr, "Failed to set TCP %s buffer size: %s\n", name, ::strerror(errno));
+        return -1;
+    }
+
+    // See UDPTransporter::setup_socket_buffer() for why this compares this way.
+    int actual = 0;
+    socklen_t actual_len = sizeof(actual);
+    if (::getsockopt(fd, SOL_SOCKET, optname, &actual, &actual_len) == 0 && actual < size)
+    {
+        ::fprintf(stderr, "TCP %s buffer size limited to %d bytes instead of %d; raise net.core.%s\n",
+                  name, actual, size, (optname == SO_RCVBUF) ? "rmem_max" : "wmem_max");
+    }
+
+    return 0;
+}
+
+TCPTransporter::TCPTransporter(const std::string & protocol,
+                               Mode mode,
+                               const std::string & address,
+                               uint16_t port,
+                               uint32_t read_poll_ms,
+                               size_t ring_buffer_size):
+    Transporter(protocol, ring_buffer_size),
+    mode_(mode),
+    address_(address),
+    port_(port),
+    read_poll_ms_(read_poll_ms)
+{
+    if (port_ == 0)
+    {
+        throw std::runtime_error("Invalid port, must be between 1 and 65535 inclusive");
+    }
+
+    if (mode_ == Mode::CLIENT && address_.empty())
+    {
+        throw std::runtime_error("No address to connect to");
+    }
+}
+
+TCPTransporter::~TCPTransporter()
+{
+    close();
+}
+
+int TCPTransporter::init()
+{
+    if (fds_OK())
+    {
+        ::fprintf(stderr, "Cannot re-init; call close first\n");
+        return -1;
+    }
+
+    struct addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICSERV | AI_ADDRCONFIG | ((mode_ == Mode::SERVER) ? AI_PASSIVE : 0);
+
+    struct addrinfo *results = nullptr;
+    int gai = ::getaddrinfo(address_.empty() ? nullptr : address_.c_str(), std::to_string(port_).c_str(),
+                            &hints, &results);
+    if (gai != 0)
+    {
+        ::fprintf(stderr, "Failed to look up TCP address '%s': %s\n", address_.c_str(), ::gai_strerror(gai));
+        return -1;
+    }
+
+    epoll_fd_ = ::epoll_create1(EPOLL_CLOEXEC);
+    timer_fd_ = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    struct epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = timer_fd_;
+    if (epoll_fd_ < 0 || timer_fd_ < 0 || ::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, timer_fd_, &ev) < 0)
+    {
+        ::fprintf(stderr, "Failed to set up TCP polling: %s\n", ::strerror(errno));
+        ::freeaddrinfo(results);
+        close();
+        return -1;
+    }
+
+    // A server listens on the first address that works; a client connects
+    // to the first address (and to it again after any failure).
+    int ret = -1;
+    for (struct addrinfo *ai = results; ai != nullptr; ai = ai->ai_next)
+    {
+        ::memcpy(&addr_, ai->ai_addr, ai->ai_addrlen);
+        addr_len_ = ai->ai_addrlen;
+
+        if (mode_ == Mode::CLIENT)
+        {
+            ret = 0;
+            break;
+        }
+
+        listen_fd_ = new_socket();
+        if (listen_fd_ < 0)
+        {
+            continue;
+        }
+
+        int reuse = 1;
+        if (::setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0 ||
+            ::bind(listen_fd_, ai->ai_addr, ai->ai_addrlen) < 0 ||
+            ::listen(listen_fd_, 1) < 0)
+        {
+            ::fprintf(stderr, "Failed to listen on TCP port %u: %s\n", port_, ::strerror(errno));
+            ::close(listen_fd_);
+            listen_fd_ = -1;
+            continue;
+        }
+
+        ev.data.fd = listen_fd_;
+        if (::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &ev) < 0)
+        {
+            ::fprintf(stderr, "Failed to poll TCP listen socket: %s\n", ::strerror(errno));
+            break;
+        }
+
+        ret = 0;
+        break;
+    }
+    ::freeaddrinfo(results);
+
+    // The connection's file descriptor exists from here on, unconnected
+    // until there is a connection to move onto it.
+    conn_fd_ = (ret == 0) ? new_socket() : -1;
+    if (conn_fd_ < 0)
+    {
+        close();
+        return -1;
+    }
+
+    if (mode_ == Mode::CLIENT)
+    {
+        start_connect();
+    }
+
+    return 0;
+}
+
+int TCPTransporter::new_socket()
+{
+    int fd = ::socket(addr_.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        ::fprintf(stderr, "create socket failed: %s\n", ::strerror(errno));
+        return -1;
+    }
+
+    // The receive buffer size decides the window scaling, which is agreed
+    // on when connecting, so the sizes have to be set before then; sockets
+    // accepted from a listening one take on its sizes.
+    if (setup_socket_buffer(fd, SO_RCVBUF, recv_buffer_size_, "receive") < 0 ||
+        setup_socket_buffer(fd, SO_SNDBUF, send_buffer_size_, "send") < 0)
+    {
+        ::close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int TCPTransporter::setup_connection(int fd)
+{
+    // Frames are written whole (and batches of them are written at once), so
+    // there is nothing for Nagle's algorithm to coalesce; it would only hold
+    // each frame back until the last one had been acknowledged.
+    int one = 1;
+    int idle = KEEPALIVE_IDLE_S;
+    int interval = KEEPALIVE_INTERVAL_S;
+    int count = KEEPALIVE_COUNT;
+    unsigned int user_timeout = USER_TIMEOUT_MS;
+    if (::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) < 0 ||
+        ::setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one)) < 0 ||
+        ::setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle)) < 0 ||
+        ::setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval)) < 0 ||
+        ::setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count)) < 0 ||
+        ::setsockopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &user_timeout, sizeof(user_timeout)) < 0)
+    {
+        ::fprintf(stderr, "Failed to set TCP socket options: %s\n", ::strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+void TCPTransporter::replace_connection(int fd)
+{
+    // Whatever was on conn_fd_ is closed by dup3(), which does so atomically,
+    // so a writer never sees it go away.
+    ::epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, conn_fd_, nullptr);
+    if (::dup3(fd, conn_fd_, O_CLOEXEC) < 0)
+    {
+        ::fprintf(stderr, "Failed to replace TCP connection: %s\n", ::strerror(errno));
+    }
+    ::close(fd);
+}
+
+void TCPTransporter::start_connect()
+{
+    int fd = new_socket();
+    if (fd < 0 || setup_connection(fd) < 0)
+    {
+        if (fd >= 0)
+        {
+            ::close(fd);
+        }
+        schedule_reconnect();
+        return;
+    }
+
+    replace_connection(fd);
+    if (::connect(conn_fd_, reinterpret_cast<struct sockaddr *>(&addr_), addr_len_) == 0)
+    {
+        connected();
+        return;
+    }
+
+    if (errno != EINPROGRESS)
+    {
+        // Only the first of a run of failures is worth mentioning.
+        if (reconnect_ms_ == RECONNECT_MIN_MS)
+        {
+            ::fprintf(stderr, "Failed to connect to TCP %s:%u: %s\n", address_.c_str(), port_, ::strerror(errno));
+        }
+        schedule_reconnect();
+        return;
+    }
+
+    // The socket becomes writable once the connection is made or has failed.
+    struct epoll_event ev{};
+    ev.events = EPOLLOUT;
+    ev.data.fd = conn_fd_;
+    ::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, conn_fd_, &ev);
+    connecting_ = true;
+}
+
+void TCPTransporter::connected()
+{
+    struct epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = conn_fd_;
+    ::epoll_ctl(epoll_fd_, connecting_ ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, conn_fd_, &ev);
+
+    connecting_ = false;
+    reconnect_ms_ = RECONNECT_MIN_MS;
+    connected_ = true;
+}
+
+void TCPTransporter::disconnected()
+{
+    if (connected_)
+    {
+        ROS2_SERIAL_LOG(WARN, "TCP connection lost");
+    }
+
+    connected_ = false;
+    connecting_ = false;
+
+    // An unconnected socket takes the place of the old connection, so that
+    // writes fail straight away instead of going to a dead peer, and anything
+    // left over from the old connection is thrown away; a frame cut short by
+    // it would otherwise be glued to the start of the next one.
+    int fd = new_socket();
+    if (fd >= 0)
+    {
+        replace_connection(fd);
+    }
+    else
+    {
+        ::epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, conn_fd_, nullptr);
+    }
+    ringbuf_.discard(ringbuf_.bytes_used());
+
+    if (mode_ == Mode::CLIENT)
+    {
+        schedule_reconnect();
+    }
+}
+
+void TCPTransporter::schedule_reconnect()
+{
+    struct itimerspec its{};
+    its.it_value.tv_sec = reconnect_ms_ / 1000;
+    its.it_value.tv_nsec = static_cast<long>(reconnect_ms_ % 1000) * 1000000L;
+    ::timerfd_settime(timer_fd_, 0, &its, nullptr);
+
+    reconnect_ms_ = std::min(reconnect_ms_ * 2, RECONNECT_MAX_MS);
+}
+
+int TCPTransporter::set_socket_buffer_sizes(int recv_bytes, int send_bytes)
+{
+    if (fds_OK() || recv_bytes < 0 || send_bytes < 0)
+    {
+        return -1;
+    }
+
+    recv_buffer_size_ = recv_bytes;
+    send_buffer_size_ = send_bytes;
+
+    return 0;
+}
+
+ssize_t TCPTransporter::get_write_queue_bytes() const
+{
+    int queued = 0;
+    if (!connected_ || ::ioctl(conn_fd_, SIOCOUTQ, &queued) < 0)
+    {
+        return -1;
+    }
+
+    return queued;
+}
+
+bool TCPTransporter::fds_OK()
+{
+    return (-1 != epoll_fd_ && -1 != conn_fd_);
+}
+
+int TCPTransporter::get_read_fd() const
+{
+    return epoll_fd_;
+}
+
+int TCPTransporter::get_write_fd() const
+{
+    return conn_fd_;
+}
+
+int TCPTransporter::close()
+{
+    connected_ = false;
+    connecting_ = false;
+    reconnect_ms_ = RECONNECT_MIN_MS;
+
+    for (int *fd : {&conn_fd_, &listen_fd_, &timer_fd_, &epoll_fd_})
+    {
+        if (-1 != *fd)
+        {
+            ::close(*fd);
+            *fd = -1;
+        }
+    }
+
+    return 0;
+}
+
+ssize_t TCPTransporter::node_read()
+{
+    if (!fds_OK())
+    {
+        return -1;
+    }
+
+    struct epoll_event events[3];
+    int n = ::epoll_wait(epoll_fd_, events, 3, read_poll_ms_);
+    if (n < 0)
+    {
+        return (errno == EINTR) ? 0 : -1;
+    }
+
+    ssize_t ret = 0;
+    for (int i = 0; i < n; ++i)
+    {
+        int fd = events[i].data.fd;
+        if (fd == timer_fd_)
+        {
+            uint64_t expirations;
+            if (::read(timer_fd_, &expirations, sizeof(expirations)) > 0 && !connected_ && !connecting_)
+            {
+                start_connect();
+            }
+        }
+        else if (fd == listen_fd_)
+        {
+            int conn = ::accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (conn < 0)
+            {
+                continue;
+            }
+            if (setup_connection(conn) < 0)
+            {
+                ::close(conn);
+                continue;
+            }
+
+            // The newest client wins; one that is reconnecting may not have
+            // been noticed to be gone yet.
+            if (connected_)
+            {
+                ROS2_SERIAL_LOG(WARN, "Replacing TCP connection with a new one");
+                connected_ = false;
+                ringbuf_.discard(ringbuf_.bytes_used());
+            }
+            replace_connection(conn);
+            connected();
+        }
+        else if (fd == conn_fd_ && connecting_)
+        {
+            int err = 0;
+            socklen_t err_len = sizeof(err);
+            if (::getsockopt(conn_fd_, SOL_SOCKET, SO_ERROR, &err, &err_len) == 0 && err == 0)
+            {
+                connected();
+            }
+            else
+            {
+                if (reconnect_ms_ == RECONNECT_MIN_MS)
+                {
+                    ROS2_SERIAL_LOG(WARN, "Failed to connect to TCP %s:%u: %s", address_.c_str(), port_,
+                                    ::strerror(err));
+                }
+                disconnected();
+            }
+        }
+        else if (fd == conn_fd_ && connected_)
+        {
+            ssize_t r = ringbuf_.read(conn_fd_);
+            if (r > 0)
+            {
+                ret += r;
+            }
+            else if (r == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+            {
+                disconnected();
+            }
+        }
+    }
+
+    return ret;
+}
+
+ssize_t TCPTransporter::node_write(void *buffer, size_t len)
+{
+    if (nullptr == buffer || !fds_OK())
+    {
+        return -1;
+    }
+
+    struct iovec iov{buffer, len};
+
+    return node_writev(&iov, 1);
+}
+
+ssize_t TCPTransporter::node_writev(const struct iovec *iov, int iovcnt)
+{
+    if (nullptr == iov || iovcnt > MAX_NODE_IOVECS || !fds_OK())
+    {
+        return -1;
+    }
+
+    if (!connected_)
+    {
+        errno = ENOTCONN;
+        return -1;
+    }
+
+    // The buffers are advanced past whatever a short write sent, so work on
+    // a copy of them.
+    struct iovec iovs[MAX_NODE_IOVECS];
+    size_t len = 0;
+    for (int i = 0; i < iovcnt; ++i)
+    {
+        iovs[i] = iov[i];
+        len += iov[i].iov_len;
+    }
+
+    struct msghdr msg{};
+    msg.msg_iov = iovs;
+    msg.msg_iovlen = iovcnt;
+
+    std::chrono::steady_clock::time_point deadline = write_deadline();
+    size_t sent = 0;
+    while (sent < len)
+    {
+        // MSG_NOSIGNAL turns a write to a connection the peer has closed into
+        // EPIPE instead of a SIGPIPE that would kill the bridge.
+        ssize_t ret = ::sendmsg(conn_fd_, &msg, MSG_NOSIGNAL);
+        if (ret == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            // The socket buffer is full; sleep until there is room, but give
+            // up if there isn't any for a while.
+            if (errno == EAGAIN && wait_writable(conn_fd_, deadline) == 0)
+            {
+                continue;
+            }
+
+            return -1;
+        }
+
+        sent += ret;
+        size_t skip = static_cast<size_t>(ret);
+        while (msg.msg_iovlen > 0 && skip >= msg.msg_iov->iov_len)
+        {
+            skip -= msg.msg_iov->iov_len;
+            ++msg.msg_iov;
+            --msg.msg_iovlen;
+        }
+        if (msg.msg_iovlen > 0)
+        {
+            msg.msg_iov->iov_base = static_cast<uint8_t *>(msg.msg_iov->iov_base) + skip;
+            msg.msg_iov->iov_len -= skip;
+        }
+    }
+
+    return len;
+}
+
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
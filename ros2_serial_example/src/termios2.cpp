@@ -0,0 +1,109 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <cerrno>
+#include <cstdint>
+
+// This must not include <termios.h>, directly or indirectly; see termios2.hpp.
+#include <asm/termbits.h>
+#include <linux/serial.h>
+#include <sys/ioctl.h>
+
+#include "ros2_serial_example/termios2.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+namespace impl
+{
+
+int set_custom_baudrate(int fd, uint32_t baudrate, uint32_t *actual)
+{
+    struct termios2 tio{};
+    if (::ioctl(fd, TCGETS2, &tio) < 0)
+    {
+        return -1;
+    }
+
+    tio.c_cflag &= ~(CBAUD | (CBAUD << IBSHIFT));
+    tio.c_cflag |= BOTHER | (BOTHER << IBSHIFT);
+    tio.c_ispeed = baudrate;
+    tio.c_ospeed = baudrate;
+    if (::ioctl(fd, TCSETS2, &tio) < 0)
+    {
+        return -1;
+    }
+
+    // Read it back, since the driver rounds to what the hardware can do.
+    if (::ioctl(fd, TCGETS2, &tio) < 0)
+    {
+        return -1;
+    }
+    *actual = tio.c_ospeed;
+
+    return 0;
+}
+
+int set_low_latency(int fd, bool enable)
+{
+    struct serial_struct serial{};
+    if (::ioctl(fd, TIOCGSERIAL, &serial) < 0)
+    {
+        return -1;
+    }
+
+    if (enable)
+    {
+        serial.flags |= ASYNC_LOW_LATENCY;
+    }
+    else
+    {
+        serial.flags &= ~ASYNC_LOW_LATENCY;
+    }
+
+    return ::ioctl(fd, TIOCSSERIAL, &serial);
+}
+
+int set_rs485(int fd, bool enable, uint32_t delay_before_ms, uint32_t delay_after_ms)
+{
+    struct serial_rs485 rs485{};
+    if (::ioctl(fd, TIOCGRS485, &rs485) < 0)
+    {
+        return -1;
+    }
+
+    if (enable)
+    {
+        // RTS is high while sending and low otherwise, which is how the
+        // driver enable of almost every transceiver is wired.
+        rs485.flags |= SER_RS485_ENABLED | SER_RS485_RTS_ON_SEND;
+        rs485.flags &= ~(SER_RS485_RTS_AFTER_SEND | SER_RS485_RX_DURING_TX);
+        rs485.delay_rts_before_send = delay_before_ms;
+        rs485.delay_rts_after_send = delay_after_ms;
+    }
+    else
+    {
+        rs485.flags &= ~SER_RS485_ENABLED;
+    }
+
+    return ::ioctl(fd, TIOCSRS485, &rs485);
+}
+
+}  // namespace impl
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
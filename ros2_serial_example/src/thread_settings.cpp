@@ -0,0 +1,172 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#include "ros2_serial_example/thread_settings.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+namespace
+{
+
+bool policy_from_name(const std::string & name, int * policy)
+{
+    if (name == "other")
+    {
+        *policy = SCHED_OTHER;
+    }
+    else if (name == "fifo")
+    {
+        *policy = SCHED_FIFO;
+    }
+    else if (name == "rr")
+    {
+        *policy = SCHED_RR;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+bool check_cpus(const ThreadSettings & settings, std::string * error)
+{
+    for (int64_t cpu : settings.cpus)
+    {
+        if (cpu < 0 || cpu >= CPU_SETSIZE)
+        {
+            *error = "Invalid CPU " + std::to_string(cpu) + "; must be between 0 and " + std::to_string(CPU_SETSIZE - 1);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+}  // namespace
+
+bool check_thread_settings(const ThreadSettings & settings, std::string * error)
+{
+    if (settings.policy.empty())
+    {
+        if (settings.priority != 0)
+        {
+            *error = "A priority needs a policy";
+            return false;
+        }
+        return check_cpus(settings, error);
+    }
+
+    int policy;
+    if (!policy_from_name(settings.policy, &policy))
+    {
+        *error = "Invalid policy '" + settings.policy + "'; must be one of 'other', 'fifo', or 'rr'";
+        return false;
+    }
+
+    int min_priority = ::sched_get_priority_min(policy);
+    int max_priority = ::sched_get_priority_max(policy);
+    if (settings.priority < min_priority || settings.priority > max_priority)
+    {
+        *error = "Invalid priority " + std::to_string(settings.priority) + " for policy '" + settings.policy +
+                 "'; must be between " + std::to_string(min_priority) + " and " + std::to_string(max_priority);
+        return false;
+    }
+
+    return check_cpus(settings, error);
+}
+
+bool apply_thread_settings(std::thread::native_handle_type thread, const ThreadSettings & settings, std::string * error)
+{
+    if (!check_thread_settings(settings, error))
+    {
+        return false;
+    }
+
+    // The affinity goes first, so that a real-time thread never runs on a
+    // CPU it wasn't meant to.
+    if (!settings.cpus.empty())
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int64_t cpu : settings.cpus)
+        {
+            CPU_SET(static_cast<int>(cpu), &set);
+        }
+        int ret = ::pthread_setaffinity_np(thread, sizeof(set), &set);
+        if (ret != 0)
+        {
+            *error = std::string("Failed to set CPU affinity: ") + ::strerror(ret);
+            return false;
+        }
+    }
+
+    int policy;
+    if (!policy_from_name(settings.policy, &policy))
+    {
+        return true;
+    }
+    struct sched_param param{};
+    param.sched_priority = static_cast<int>(settings.priority);
+    int ret = ::pthread_setschedparam(thread, policy, &param);
+    if (ret != 0)
+    {
+        *error = std::string("Failed to set scheduling policy '") + settings.policy + "': " + ::strerror(ret);
+        if (ret == EPERM)
+        {
+            *error += " (this needs CAP_SYS_NICE or a high enough RLIMIT_RTPRIO)";
+        }
+        return false;
+    }
+
+    return true;
+}
+
+bool lock_memory(std::string * error)
+{
+    if (::mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+    {
+        int err = errno;
+        *error = std::string("Failed to lock memory: ") + ::strerror(err);
+        if (err == ENOMEM || err == EPERM)
+        {
+            *error += " (this needs CAP_IPC_LOCK or a high enough RLIMIT_MEMLOCK)";
+        }
+        return false;
+    }
+
+    // Keep freed memory in the heap, where it stays locked, and serve large
+    // allocations from the heap too rather than from fresh mappings.
+    ::mallopt(M_TRIM_THRESHOLD, -1);
+    ::mallopt(M_MMAP_MAX, 0);
+
+    return true;
+}
+
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
@@ -0,0 +1,169 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+
+#include "ros2_serial_example/time_sync.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+TimeSync::TimeSync(size_t window, size_t history) : window_(window), history_(history)
+{
+    if (window == 0 || history == 0)
+    {
+        throw std::runtime_error("Time sync window and history must be > 0");
+    }
+    rtts_.reserve(window);
+    used_.reserve(history);
+}
+
+bool TimeSync::sample(int64_t t1, int64_t t2, int64_t t3, int64_t t4)
+{
+    int64_t rtt = (t4 - t1) - (t3 - t2);
+    if (t4 < t1 || t3 < t2 || rtt < 0)
+    {
+        return false;
+    }
+
+    if (rtts_.size() < window_)
+    {
+        rtts_.push_back(rtt);
+    }
+    else
+    {
+        rtts_[rtt_next_] = rtt;
+        rtt_next_ = (rtt_next_ + 1) % window_;
+    }
+    if (rtt > *std::min_element(rtts_.begin(), rtts_.end()))
+    {
+        return false;
+    }
+
+    // The exchange is taken to be symmetric, so the device clock read t2 and
+    // t3 halfway through each leg.
+    int64_t offset = ((t1 - t2) + (t4 - t3)) / 2;
+    int64_t device_ns = t2 + (t3 - t2) / 2;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (synced_ && device_ns < ref_device_ns_)
+    {
+        used_.clear();
+        used_next_ = 0;
+    }
+    if (used_.size() < history_)
+    {
+        used_.emplace_back(device_ns, offset);
+    }
+    else
+    {
+        used_[used_next_] = std::make_pair(device_ns, offset);
+        used_next_ = (used_next_ + 1) % history_;
+    }
+
+    // The sums are taken relative to this exchange, since a double doesn't
+    // have the precision for nanoseconds since the epoch.
+    double n = static_cast<double>(used_.size());
+    double sum_x = 0.0;
+    double sum_y = 0.0;
+    double sum_xx = 0.0;
+    double sum_xy = 0.0;
+    for (const auto & u : used_)
+    {
+        double x = static_cast<double>(u.first - device_ns);
+        double y = static_cast<double>(u.second - offset);
+        sum_x += x;
+        sum_y += y;
+        sum_xx += x * x;
+        sum_xy += x * y;
+    }
+    double variance = n * sum_xx - sum_x * sum_x;
+    double drift = 0.0;
+    if (variance > 0.0)
+    {
+        drift = (n * sum_xy - sum_x * sum_y) / variance;
+    }
+    offset_ns_ = offset + std::llround((sum_y - drift * sum_x) / n);
+    drift_ = drift;
+    ref_device_ns_ = device_ns;
+    synced_ = true;
+    rtt_ns_ = rtt;
+    samples_++;
+
+    return true;
+}
+
+bool TimeSync::to_host(int64_t device_ns, int64_t * host_ns) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!synced_)
+    {
+        return false;
+    }
+    *host_ns = device_ns + offset_ns_ + std::llround(drift_ * (device_ns - ref_device_ns_));
+    return true;
+}
+
+bool TimeSync::to_device(int64_t host_ns, int64_t * device_ns) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!synced_)
+    {
+        return false;
+    }
+    *device_ns = ref_device_ns_ + std::llround((host_ns - ref_device_ns_ - offset_ns_) / (1.0 + drift_));
+    return true;
+}
+
+bool TimeSync::is_synced() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return synced_;
+}
+
+int64_t TimeSync::get_offset_ns() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return offset_ns_;
+}
+
+double TimeSync::get_drift_ppm() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return drift_ * 1e6;
+}
+
+int64_t TimeSync::get_rtt_ns() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return rtt_ns_;
+}
+
+uint64_t TimeSync::get_samples() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return samples_;
+}
+
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
@@ -0,0 +1,382 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ros2_serial_example/crc32c.hpp"
+#include "ros2_serial_example/topic_manifest.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+namespace
+{
+
+// The file is the magic, the version, the number of topics and the CRC-32C
+// of everything after the header, all little-endian.  The records follow,
+// and after them the strings and dictionaries, which the records give the
+// offset (from the start of the file) and length of.  Version 1 manifests
+// have shorter records, without the quantize profile, version 2 ones
+// without the batch settings, and version 3 ones without on_change; all of
+// them are still read.
+constexpr uint8_t MANIFEST_MAGIC[4] = {'R', '2', 'T', 'M'};
+constexpr uint32_t MANIFEST_VERSION = 4;
+constexpr size_t MANIFEST_HEADER_SIZE = 16;
+
+// The layout of a record.
+constexpr size_t RECORD_NAME = 0;
+constexpr size_t RECORD_TYPE = 8;
+constexpr size_t RECORD_DICTIONARY = 16;
+constexpr size_t RECORD_SERIAL_MAPPING = 24;
+constexpr size_t RECORD_TX_QUEUE_DEPTH = 32;
+constexpr size_t RECORD_TX_MAX_RATE_HZ = 40;
+constexpr size_t RECORD_HISTORY_DEPTH = 48;
+constexpr size_t RECORD_DEADLINE_MS = 56;
+constexpr size_t RECORD_COMPRESS_THRESHOLD = 64;
+constexpr size_t RECORD_DELTA_KEYFRAME_INTERVAL = 72;
+constexpr size_t RECORD_DIRECTION = 76;
+constexpr size_t RECORD_TX_OVERFLOW_POLICY = 77;
+constexpr size_t RECORD_TX_PRIORITY = 78;
+constexpr size_t RECORD_RELIABILITY = 79;
+constexpr size_t RECORD_DURABILITY = 80;
+constexpr size_t RECORD_FLAGS = 81;
+// Manifests written before these were added have zeros here, which means no
+// maximum.
+constexpr size_t RECORD_MAX_AGE_MS = 82;
+constexpr size_t RECORD_MAX_MESSAGE_SIZE = 84;
+constexpr size_t RECORD_SIZE_V1 = 88;
+// The specs of the quantize profile, each followed by a newline.
+constexpr size_t RECORD_QUANTIZE = 88;
+constexpr size_t RECORD_SIZE_V2 = 96;
+constexpr size_t RECORD_BATCH_TYPE = 96;
+constexpr size_t RECORD_BATCH_SIZE = 104;
+constexpr size_t RECORD_BATCH_MS = 108;
+constexpr size_t RECORD_SIZE_V3 = 112;
+constexpr size_t RECORD_ON_CHANGE_KEEPALIVE_MS = 112;
+// The flags that didn't fit in the first byte of them.
+constexpr size_t RECORD_FLAGS_2 = 116;
+constexpr size_t RECORD_SIZE = 120;
+
+constexpr uint8_t FLAG_PASSTHROUGH = 0x1;
+constexpr uint8_t FLAG_STAMP_HEADER = 0x2;
+constexpr uint8_t FLAG_LAZY = 0x4;
+constexpr uint8_t FLAG_RELIABLE = 0x8;
+constexpr uint8_t FLAG_ELIDE_LENGTH = 0x10;
+constexpr uint8_t FLAG_DEVICE_STAMP = 0x20;
+constexpr uint8_t FLAG_INTERN_STRINGS = 0x40;
+constexpr uint8_t FLAG_LAST_VALUE = 0x80;
+constexpr uint8_t FLAG_2_ON_CHANGE = 0x1;
+
+void put_le16(uint8_t * p, uint16_t v)
+{
+    p[0] = static_cast<uint8_t>(v);
+    p[1] = static_cast<uint8_t>(v >> 8);
+}
+
+void put_le32(uint8_t * p, uint32_t v)
+{
+    for (size_t i = 0; i < 4; ++i)
+    {
+        p[i] = static_cast<uint8_t>(v >> (8 * i));
+    }
+}
+
+void put_le64(uint8_t * p, uint64_t v)
+{
+    for (size_t i = 0; i < 8; ++i)
+    {
+        p[i] = static_cast<uint8_t>(v >> (8 * i));
+    }
+}
+
+uint16_t get_le16(const uint8_t * p)
+{
+    return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+uint32_t get_le32(const uint8_t * p)
+{
+    uint32_t v = 0;
+    for (size_t i = 0; i < 4; ++i)
+    {
+        v |= static_cast<uint32_t>(p[i]) << (8 * i);
+    }
+    return v;
+}
+
+uint64_t get_le64(const uint8_t * p)
+{
+    uint64_t v = 0;
+    for (size_t i = 0; i < 8; ++i)
+    {
+        v |= static_cast<uint64_t>(p[i]) << (8 * i);
+    }
+    return v;
+}
+
+// Append a string or dictionary to the end of the file, and point the
+// record at it.
+void put_blob(std::vector<uint8_t> * file, size_t record, const uint8_t * data, size_t length)
+{
+    put_le32(file->data() + record, static_cast<uint32_t>(file->size()));
+    put_le32(file->data() + record + 4, static_cast<uint32_t>(length));
+    file->insert(file->end(), data, data + length);
+}
+
+}  // namespace
+
+TopicManifest::TopicManifest()
+{
+}
+
+TopicManifest::~TopicManifest()
+{
+    close();
+}
+
+bool TopicManifest::write(const std::string & path, const std::vector<ManifestTopic> & topics)
+{
+    std::vector<uint8_t> file(MANIFEST_HEADER_SIZE + topics.size() * RECORD_SIZE, 0);
+    ::memcpy(file.data(), MANIFEST_MAGIC, sizeof(MANIFEST_MAGIC));
+    put_le32(&file[4], MANIFEST_VERSION);
+    put_le32(&file[8], static_cast<uint32_t>(topics.size()));
+
+    for (size_t i = 0; i < topics.size(); ++i)
+    {
+        const ManifestTopic & t = topics[i];
+        size_t record = MANIFEST_HEADER_SIZE + i * RECORD_SIZE;
+        put_blob(&file, record + RECORD_NAME, reinterpret_cast<const uint8_t *>(t.name.data()), t.name.size());
+        put_blob(&file, record + RECORD_TYPE, reinterpret_cast<const uint8_t *>(t.type.data()), t.type.size());
+        put_blob(&file, record + RECORD_DICTIONARY, t.compress_dictionary.data(), t.compress_dictionary.size());
+        std::string quantize;
+        for (const std::string & spec : t.quantize)
+        {
+            quantize += spec + '\n';
+        }
+        put_blob(&file, record + RECORD_QUANTIZE, reinterpret_cast<const uint8_t *>(quantize.data()), quantize.size());
+        put_blob(&file, record + RECORD_BATCH_TYPE, reinterpret_cast<const uint8_t *>(t.batch_type.data()), t.batch_type.size());
+
+        uint8_t * r = file.data() + record;
+        uint64_t rate_bits;
+        ::memcpy(&rate_bits, &t.tx_max_rate_hz, sizeof(rate_bits));
+        put_le64(r + RECORD_SERIAL_MAPPING, static_cast<uint64_t>(t.serial_mapping));
+        put_le64(r + RECORD_TX_QUEUE_DEPTH, t.tx_queue_depth);
+        put_le64(r + RECORD_TX_MAX_RATE_HZ, rate_bits);
+        put_le64(r + RECORD_HISTORY_DEPTH, t.history_depth);
+        put_le64(r + RECORD_DEADLINE_MS, static_cast<uint64_t>(t.deadline_ms));
+        put_le64(r + RECORD_COMPRESS_THRESHOLD, static_cast<uint64_t>(t.compress_threshold));
+        put_le32(r + RECORD_DELTA_KEYFRAME_INTERVAL, t.delta_keyframe_interval);
+        put_le32(r + RECORD_MAX_MESSAGE_SIZE, t.max_message_size);
+        put_le32(r + RECORD_BATCH_SIZE, t.batch_size);
+        put_le32(r + RECORD_BATCH_MS, t.batch_ms);
+        put_le32(r + RECORD_ON_CHANGE_KEEPALIVE_MS, t.on_change_keepalive_ms);
+        put_le16(r + RECORD_MAX_AGE_MS, t.max_age_ms);
+        r[RECORD_DIRECTION] = t.direction;
+        r[RECORD_TX_OVERFLOW_POLICY] = t.tx_overflow_policy;
+        r[RECORD_TX_PRIORITY] = t.tx_priority;
+        r[RECORD_RELIABILITY] = t.reliability;
+        r[RECORD_DURABILITY] = t.durability;
+        r[RECORD_FLAGS] = static_cast<uint8_t>((t.passthrough ? FLAG_PASSTHROUGH : 0) |
+                                               (t.stamp_header ? FLAG_STAMP_HEADER : 0) |
+                                               (t.lazy ? FLAG_LAZY : 0) |
+                                               (t.reliable ? FLAG_RELIABLE : 0) |
+                                               (t.elide_length ? FLAG_ELIDE_LENGTH : 0) |
+                                               (t.device_stamp ? FLAG_DEVICE_STAMP : 0) |
+                                               (t.intern_strings ? FLAG_INTERN_STRINGS : 0) |
+                                               (t.last_value ? FLAG_LAST_VALUE : 0));
+        r[RECORD_FLAGS_2] = t.on_change ? FLAG_2_ON_CHANGE : 0;
+    }
+    if (file.size() > UINT32_MAX)
+    {
+        return false;
+    }
+
+    static const impl::CRC32C crc32c;
+    put_le32(&file[12], crc32c.update(0, file.data() + MANIFEST_HEADER_SIZE, file.size() - MANIFEST_HEADER_SIZE));
+
+    std::string tmp_path = path + ".tmp";
+    FILE * fp = ::fopen(tmp_path.c_str(), "wb");
+    if (fp == nullptr)
+    {
+        return false;
+    }
+    bool ok = ::fwrite(file.data(), 1, file.size(), fp) == file.size();
+    ok = (::fclose(fp) == 0) && ok;
+    if (!ok || ::rename(tmp_path.c_str(), path.c_str()) != 0)
+    {
+        ::remove(tmp_path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+bool TopicManifest::open(const std::string & path)
+{
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct stat st{};
+    if (::fstat(fd, &st) < 0 || st.st_size < static_cast<off_t>(MANIFEST_HEADER_SIZE) || st.st_size > static_cast<off_t>(UINT32_MAX))
+    {
+        ::close(fd);
+        return false;
+    }
+
+    size_t length = static_cast<size_t>(st.st_size);
+    void * map = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+    {
+        return false;
+    }
+    data_ = static_cast<const uint8_t *>(map);
+    length_ = length;
+
+    static const impl::CRC32C crc32c;
+    uint32_t version = get_le32(data_ + 4);
+    size_t record_size = version == 1 ? RECORD_SIZE_V1 : version == 2 ? RECORD_SIZE_V2 : version == 3 ? RECORD_SIZE_V3 : RECORD_SIZE;
+    uint64_t count = get_le32(data_ + 8);
+    bool ok = ::memcmp(data_, MANIFEST_MAGIC, sizeof(MANIFEST_MAGIC)) == 0 &&
+              version >= 1 && version <= MANIFEST_VERSION &&
+              count <= (length_ - MANIFEST_HEADER_SIZE) / record_size &&
+              crc32c.update(0, data_ + MANIFEST_HEADER_SIZE, length_ - MANIFEST_HEADER_SIZE) == get_le32(data_ + 12);
+
+    // Make sure that get() never has to check the blobs again.
+    for (uint64_t i = 0; ok && i < count; ++i)
+    {
+        const uint8_t * r = data_ + MANIFEST_HEADER_SIZE + i * record_size;
+        for (size_t blob : {RECORD_NAME, RECORD_TYPE, RECORD_DICTIONARY, RECORD_QUANTIZE, RECORD_BATCH_TYPE})
+        {
+            if (blob + 8 > record_size)
+            {
+                continue;
+            }
+            uint64_t offset = get_le32(r + blob);
+            uint64_t blob_length = get_le32(r + blob + 4);
+            ok = ok && offset >= MANIFEST_HEADER_SIZE + count * record_size && offset + blob_length <= length_;
+        }
+    }
+
+    if (!ok)
+    {
+        close();
+        return false;
+    }
+    count_ = static_cast<size_t>(count);
+    record_size_ = record_size;
+
+    return true;
+}
+
+size_t TopicManifest::size() const
+{
+    return count_;
+}
+
+void TopicManifest::get(size_t index, ManifestTopic * topic) const
+{
+    const uint8_t * r = data_ + MANIFEST_HEADER_SIZE + index * record_size_;
+
+    const char * chars = reinterpret_cast<const char *>(data_);
+    topic->name.assign(chars + get_le32(r + RECORD_NAME), get_le32(r + RECORD_NAME + 4));
+    topic->type.assign(chars + get_le32(r + RECORD_TYPE), get_le32(r + RECORD_TYPE + 4));
+    const uint8_t * dictionary = data_ + get_le32(r + RECORD_DICTIONARY);
+    topic->compress_dictionary.assign(dictionary, dictionary + get_le32(r + RECORD_DICTIONARY + 4));
+    topic->quantize.clear();
+    if (record_size_ > RECORD_QUANTIZE)
+    {
+        const char * quantize = chars + get_le32(r + RECORD_QUANTIZE);
+        const char * end = quantize + get_le32(r + RECORD_QUANTIZE + 4);
+        while (quantize < end)
+        {
+            const char * newline = std::find(quantize, end, '\n');
+            topic->quantize.emplace_back(quantize, newline);
+            quantize = newline + 1;
+        }
+    }
+    topic->batch_type.clear();
+    topic->batch_size = 0;
+    topic->batch_ms = 0;
+    if (record_size_ > RECORD_BATCH_TYPE)
+    {
+        topic->batch_type.assign(chars + get_le32(r + RECORD_BATCH_TYPE), get_le32(r + RECORD_BATCH_TYPE + 4));
+        topic->batch_size = get_le32(r + RECORD_BATCH_SIZE);
+        topic->batch_ms = get_le32(r + RECORD_BATCH_MS);
+    }
+
+    uint64_t rate_bits = get_le64(r + RECORD_TX_MAX_RATE_HZ);
+    ::memcpy(&topic->tx_max_rate_hz, &rate_bits, sizeof(rate_bits));
+    topic->serial_mapping = static_cast<int64_t>(get_le64(r + RECORD_SERIAL_MAPPING));
+    topic->tx_queue_depth = get_le64(r + RECORD_TX_QUEUE_DEPTH);
+    topic->history_depth = get_le64(r + RECORD_HISTORY_DEPTH);
+    topic->deadline_ms = static_cast<int64_t>(get_le64(r + RECORD_DEADLINE_MS));
+    topic->compress_threshold = static_cast<int64_t>(get_le64(r + RECORD_COMPRESS_THRESHOLD));
+    topic->delta_keyframe_interval = get_le32(r + RECORD_DELTA_KEYFRAME_INTERVAL);
+    topic->max_message_size = get_le32(r + RECORD_MAX_MESSAGE_SIZE);
+    topic->max_age_ms = get_le16(r + RECORD_MAX_AGE_MS);
+    topic->direction = r[RECORD_DIRECTION];
+    topic->tx_overflow_policy = r[RECORD_TX_OVERFLOW_POLICY];
+    topic->tx_priority = r[RECORD_TX_PRIORITY];
+    topic->reliability = r[RECORD_RELIABILITY];
+    topic->durability = r[RECORD_DURABILITY];
+    topic->passthrough = (r[RECORD_FLAGS] & FLAG_PASSTHROUGH) != 0;
+    topic->stamp_header = (r[RECORD_FLAGS] & FLAG_STAMP_HEADER) != 0;
+    topic->lazy = (r[RECORD_FLAGS] & FLAG_LAZY) != 0;
+    topic->reliable = (r[RECORD_FLAGS] & FLAG_RELIABLE) != 0;
+    topic->elide_length = (r[RECORD_FLAGS] & FLAG_ELIDE_LENGTH) != 0;
+    topic->device_stamp = (r[RECORD_FLAGS] & FLAG_DEVICE_STAMP) != 0;
+    topic->intern_strings = (r[RECORD_FLAGS] & FLAG_INTERN_STRINGS) != 0;
+    topic->last_value = (r[RECORD_FLAGS] & FLAG_LAST_VALUE) != 0;
+    topic->on_change = false;
+    topic->on_change_keepalive_ms = 0;
+    if (record_size_ > RECORD_FLAGS_2)
+    {
+        topic->on_change = (r[RECORD_FLAGS_2] & FLAG_2_ON_CHANGE) != 0;
+        topic->on_change_keepalive_ms = get_le32(r + RECORD_ON_CHANGE_KEEPALIVE_MS);
+    }
+}
+
+void TopicManifest::close()
+{
+    if (data_ != nullptr)
+    {
+        ::munmap(const_cast<uint8_t *>(data_), length_);
+    }
+    data_ = nullptr;
+    length_ = 0;
+    count_ = 0;
+    record_size_ = 0;
+}
+
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
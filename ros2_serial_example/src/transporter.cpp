@@ -35,21 +35,30 @@
 // but modified to use a ring buffer, fix a few bugs, and split the UART
 // implementation to a separate file.
 
+#include <algorithm>
 #include <array>
 #include <cerrno>
+#include <chrono>
 #include <cmath>
+#include <cstddef>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <limits>
 #include <memory>
+#include <mutex>
+#include <random>
 #include <stdexcept>
-#include <vector>
 
 #include <fcntl.h>
 #include <poll.h>
+#include <sys/uio.h>
 #include <termios.h>
 
+#include "ros2_serial_example/async_log.hpp"
+#include "ros2_serial_example/chacha20_poly1305.hpp"
+#include "ros2_serial_example/reed_solomon.hpp"
+#include "ros2_serial_example/tracing.hpp"
 #include "ros2_serial_example/transporter.hpp"
 
 namespace ros2_to_serial_bridge
@@ -58,514 +67,4238 @@ namespace ros2_to_serial_bridge
 namespace transport
 {
 
-/** CRC table for the CRC-16. The poly is 0x8005 (x^16 + x^15 + x^2 + 1) */
-uint16_t const crc16_table[256] = {
-    0x0000, 0xC0C1, 0xC181, 0x0140, 0xC301, 0x03C0, 0x0280, 0xC241,
-    0xC601, 0x06C0, 0x0780, 0xC741, 0x0500, 0xC5C1, 0xC481, 0x0440,
-    0xCC01, 0x0CC0, 0x0D80, 0xCD41, 0x0F00, 0xCFC1, 0xCE81, 0x0E40,
-    0x0A00, 0xCAC1, 0xCB81, 0x0B40, 0xC901, 0x09C0, 0x0880, 0xC841,
-    0xD801, 0x18C0, 0x1980, 0xD941, 0x1B00, 0xDBC1, 0xDA81, 0x1A40,
-    0x1E00, 0xDEC1, 0xDF81, 0x1F40, 0xDD01, 0x1DC0, 0x1C80, 0xDC41,
-    0x1400, 0xD4C1, 0xD581, 0x1540, 0xD701, 0x17C0, 0x1680, 0xD641,
-    0xD201, 0x12C0, 0x1380, 0xD341, 0x1100, 0xD1C1, 0xD081, 0x1040,
-    0xF001, 0x30C0, 0x3180, 0xF141, 0x3300, 0xF3C1, 0xF281, 0x3240,
-    0x3600, 0xF6C1, 0xF781, 0x3740, 0xF501, 0x35C0, 0x3480, 0xF441,
-    0x3C00, 0xFCC1, 0xFD81, 0x3D40, 0xFF01, 0x3FC0, 0x3E80, 0xFE41,
-    0xFA01, 0x3AC0, 0x3B80, 0xFB41, 0x3900, 0xF9C1, 0xF881, 0x3840,
-    0x2800, 0xE8C1, 0xE981, 0x2940, 0xEB01, 0x2BC0, 0x2A80, 0xEA41,
-    0xEE01, 0x2EC0, 0x2F80, 0xEF41, 0x2D00, 0xEDC1, 0xEC81, 0x2C40,
-    0xE401, 0x24C0, 0x2580, 0xE541, 0x2700, 0xE7C1, 0xE681, 0x2640,
-    0x2200, 0xE2C1, 0xE381, 0x2340, 0xE101, 0x21C0, 0x2080, 0xE041,
-    0xA001, 0x60C0, 0x6180, 0xA141, 0x6300, 0xA3C1, 0xA281, 0x6240,
-    0x6600, 0xA6C1, 0xA781, 0x6740, 0xA501, 0x65C0, 0x6480, 0xA441,
-    0x6C00, 0xACC1, 0xAD81, 0x6D40, 0xAF01, 0x6FC0, 0x6E80, 0xAE41,
-    0xAA01, 0x6AC0, 0x6B80, 0xAB41, 0x6900, 0xA9C1, 0xA881, 0x6840,
-    0x7800, 0xB8C1, 0xB981, 0x7940, 0xBB01, 0x7BC0, 0x7A80, 0xBA41,
-    0xBE01, 0x7EC0, 0x7F80, 0xBF41, 0x7D00, 0xBDC1, 0xBC81, 0x7C40,
-    0xB401, 0x74C0, 0x7580, 0xB541, 0x7700, 0xB7C1, 0xB681, 0x7640,
-    0x7200, 0xB2C1, 0xB381, 0x7340, 0xB101, 0x71C0, 0x7080, 0xB041,
-    0x5000, 0x90C1, 0x9181, 0x5140, 0x9301, 0x53C0, 0x5280, 0x9241,
-    0x9601, 0x56C0, 0x5780, 0x9741, 0x5500, 0x95C1, 0x9481, 0x5440,
-    0x9C01, 0x5CC0, 0x5D80, 0x9D41, 0x5F00, 0x9FC1, 0x9E81, 0x5E40,
-    0x5A00, 0x9AC1, 0x9B81, 0x5B40, 0x9901, 0x59C0, 0x5880, 0x9841,
-    0x8801, 0x48C0, 0x4980, 0x8941, 0x4B00, 0x8BC1, 0x8A81, 0x4A40,
-    0x4E00, 0x8EC1, 0x8F81, 0x4F40, 0x8D01, 0x4DC0, 0x4C80, 0x8C41,
-    0x4400, 0x84C1, 0x8581, 0x4540, 0x8701, 0x47C0, 0x4680, 0x8641,
-    0x8201, 0x42C0, 0x4380, 0x8341, 0x4100, 0x81C1, 0x8081, 0x4040
+constexpr int Transporter::MAX_NODE_IOVECS;
+constexpr size_t Transporter::MAX_REASSEMBLIES;
+constexpr size_t Transporter::RELIABLE_WINDOW;
+constexpr uint32_t Transporter::RELIABLE_MAX_RETRANSMITS;
+constexpr uint8_t Transporter::FLOW_CREDITS_KIND;
+
+// Every v2 frame starts with two markers followed by the version byte, which
+// together are what the receiver searches for.
+constexpr uint8_t V2_VERSION = 2;
+// The version byte of the frames of a keyed link (see
+// Transporter::set_aead_key()), which have a nonce and a tag in place of the
+// CRC.
+constexpr uint8_t V2_AEAD_VERSION = 3;
+// Set in the flags byte if the CRC in the header is a CRC-32C rather than a
+// CRC-16.
+constexpr uint8_t V2_FLAG_CRC32C = 0x1;
+// Set in the flags byte if the payload is LZ4-compressed.
+constexpr uint8_t V2_FLAG_COMPRESSED = 0x2;
+// Set in the flags byte if the payload is complete, and later delta frames of
+// the topic refer to it.
+constexpr uint8_t V2_FLAG_DELTA_BASE = 0x4;
+// Set in the flags byte if the payload is a delta against the previous
+// payload of the topic.
+constexpr uint8_t V2_FLAG_DELTA = 0x8;
+// Set in the flags byte if the payload is a fragment of a longer payload.
+constexpr uint8_t V2_FLAG_FRAGMENT = 0x10;
+// Set in the flags byte if the payload is sent reliably, in which case it
+// starts with the session and sequence number that the receiver
+// acknowledges it by.
+constexpr uint8_t V2_FLAG_RELIABLE = 0x20;
+// Set in the flags byte if the payload starts with an acknowledgement.
+constexpr uint8_t V2_FLAG_ACK = 0x40;
+// The payload is Reed-Solomon encoded (see impl::ReedSolomon); the length is
+// of the encoded payload, and the CRC of the data before it was encoded.
+constexpr uint8_t V2_FLAG_FEC = 0x80;
+constexpr uint8_t V2_KNOWN_FLAGS = V2_FLAG_CRC32C | V2_FLAG_COMPRESSED | V2_FLAG_DELTA_BASE | V2_FLAG_DELTA |
+                                   V2_FLAG_FRAGMENT | V2_FLAG_RELIABLE | V2_FLAG_ACK | V2_FLAG_FEC;
+// The markers, version, flags and sequence number.
+constexpr size_t V2_FIXED_HEADER_LEN = 5;
+// The varint topic ID carries 7 bits per byte.
+constexpr size_t V2_MAX_TOPIC_ID_LEN = (sizeof(topic_id_size_t) * 8 + 6) / 7;
+constexpr size_t V2_MIN_HEADER_LEN = V2_FIXED_HEADER_LEN + 1 + 4 + 2;
+// The nonce counter and the tag that end the header of a keyed frame.
+constexpr size_t V2_AEAD_NONCE_LEN = 8;
+constexpr size_t V2_AEAD_TRAILER_LEN = V2_AEAD_NONCE_LEN + impl::ChaCha20Poly1305::TAG_LEN;
+// The longest header is that of a keyed frame.
+constexpr size_t V2_MAX_HEADER_LEN = V2_FIXED_HEADER_LEN + V2_MAX_TOPIC_ID_LEN + 4 + V2_AEAD_TRAILER_LEN;
+// The top bit of a nonce is the side of the link that sent it, and the rest
+// counts up from the time the key was set.
+constexpr uint64_t AEAD_SIDE_BIT = 1ULL << 63U;
+// A frame is accepted if its nonce is higher than any yet, or one of the
+// AEAD_REPLAY_WINDOW below the highest that hasn't been seen yet, so that
+// frames a datagram link reorders aren't lost.
+constexpr uint64_t AEAD_REPLAY_WINDOW = 64;
+
+// A delta payload starts with the CRC-16 of the payload it is against, and
+// then has runs of the form [unchanged length,changed length,changed bytes],
+// where both lengths are varints.  Bytes after the last run are unchanged.
+constexpr size_t DELTA_HEADER_LEN = 2;
+constexpr size_t DELTA_MAX_RUN_HEADER_LEN = 2 * 5;
+// Runs of fewer unchanged bytes than this are sent as changed bytes, since
+// starting a new run would take at least as much space.
+constexpr size_t DELTA_MIN_UNCHANGED = 3;
+
+// A fragment payload starts with the message ID, the total length of the
+// payload it is part of, and the offset of its data in that payload, all as
+// varints, and then has the data.
+constexpr size_t FRAGMENT_MAX_HEADER_LEN = 3 * 5;
+// Reassembling longer payloads than this is refused, since the length is
+// most likely corrupt.
+constexpr size_t MAX_FRAGMENTED_PAYLOAD = 16 * 1024 * 1024;
+
+// A ros2_serial_msgs/FlowCredits in CDR is the kind, padding up to 4 bytes,
+// and then the received and window counts.
+constexpr size_t FLOW_CREDITS_LEN = 12;
+constexpr size_t FLOW_CREDITS_RECEIVED_OFFSET = 4;
+constexpr size_t FLOW_CREDITS_WINDOW_OFFSET = 8;
+
+// The session and sequence number in front of a reliable payload.
+constexpr size_t RELIABLE_HEADER_LEN = 2;
+// An acknowledgement is of the form [topic_ID(varint),session,base,bitmap],
+// where base is the first sequence number of the topic that the receiver is
+// still waiting for, and bit i of bitmap says that base + 1 + i was received.
+// Acknowledgements only go in front of payloads that aren't empty, so a frame
+// with nothing after its acknowledgement is only an acknowledgement.
+constexpr size_t RELIABLE_MAX_ACK_LEN = V2_MAX_TOPIC_ID_LEN + 3;
+// The receiver keeps track of this many sequence numbers from the first one
+// it is waiting for; a sender only gets further ahead than its window if it
+// gave up on a payload, and then the receiver gives up on it too.
+constexpr uint8_t RELIABLE_RX_SPAN = 16;
+// The retransmit timeout before there is a round trip time to go by, and the
+// limits of the timeout, as in RFC 6298 but scaled for a serial link.
+constexpr std::chrono::milliseconds RELIABLE_INITIAL_RTO{250};
+constexpr std::chrono::milliseconds RELIABLE_MIN_RTO{20};
+constexpr std::chrono::milliseconds RELIABLE_MAX_RTO{2000};
+// How long an acknowledgement waits for a payload going the other way to go
+// in front of before it is sent on its own.
+constexpr std::chrono::milliseconds RELIABLE_ACK_DELAY{5};
+
+// The fields of a v2 header that the receiver needs.
+struct V2FrameInfo final
+{
+    topic_id_size_t topic_ID;
+    uint32_t payload_len;
+    bool crc32c;
+    bool compressed;
+    bool delta_base;
+    bool delta;
+    bool fragment;
+    bool reliable;
+    bool ack;
+    bool fec;
+    uint8_t seq;
+    uint32_t crc;
+    uint64_t nonce;
+};
+
+// A buffer of the calling thread to encode a frame into before taking the
+// write lock, so that several threads can encode at once.  It only ever
+// grows, so once warm it doesn't allocate.  A write made while the buffer is
+// already in use further up the same thread (from a callback, say) gets
+// nullptr, and is encoded under the lock as before.
+class FrameScratch final
+{
+public:
+    FrameScratch() = default;
+    FrameScratch(const FrameScratch &) = delete;
+    FrameScratch & operator=(const FrameScratch &) = delete;
+
+    ~FrameScratch()
+    {
+        if (taken_)
+        {
+            in_use_ = false;
+        }
+    }
+
+    uint8_t *get(size_t len)
+    {
+        if (in_use_)
+        {
+            return nullptr;
+        }
+        in_use_ = true;
+        taken_ = true;
+        if (buf_.size() < len)
+        {
+            buf_.resize(len);
+        }
+        return buf_.data();
+    }
+
+private:
+    static thread_local std::vector<uint8_t> buf_;
+    static thread_local bool in_use_;
+    bool taken_{false};
+};
+
+thread_local std::vector<uint8_t> FrameScratch::buf_;
+thread_local bool FrameScratch::in_use_{false};
+
+static uint32_t get_be32(const uint8_t *buf)
+{
+    return (static_cast<uint32_t>(buf[0]) << 24U) | (static_cast<uint32_t>(buf[1]) << 16U) |
+           (static_cast<uint32_t>(buf[2]) << 8U) | buf[3];
+}
+
+static void put_be32(uint8_t *buf, uint32_t val)
+{
+    buf[0] = static_cast<uint8_t>(val >> 24U);
+    buf[1] = static_cast<uint8_t>(val >> 16U);
+    buf[2] = static_cast<uint8_t>(val >> 8U);
+    buf[3] = static_cast<uint8_t>(val);
+}
+
+static uint64_t get_be64(const uint8_t *buf)
+{
+    return (static_cast<uint64_t>(get_be32(buf)) << 32U) | get_be32(buf + 4);
+}
+
+static void put_be64(uint8_t *buf, uint64_t val)
+{
+    put_be32(buf, static_cast<uint32_t>(val >> 32U));
+    put_be32(buf + 4, static_cast<uint32_t>(val));
+}
+
+// This function writes val to buf as a varint (7 bits per byte, least
+// significant first, with the top bit set on every byte but the last); buf
+// must have room for 5 bytes.
+//
+// Returns the number of bytes written.
+static size_t put_varint(uint8_t *buf, uint32_t val)
+{
+    size_t pos = 0;
+    while (val >= 0x80U)
+    {
+        buf[pos++] = static_cast<uint8_t>(val | 0x80U);
+        val >>= 7U;
+    }
+    buf[pos++] = static_cast<uint8_t>(val);
+
+    return pos;
+}
+
+// This function reads a varint of at most max_bytes bytes from buf, which
+// holds len bytes of data.
+//
+// Returns the number of bytes read, 0 if len isn't enough to hold the whole
+// varint, or -1 if the varint is longer than max_bytes.
+static ssize_t get_varint(const uint8_t *buf, size_t len, size_t max_bytes, uint32_t *val)
+{
+    *val = 0;
+    for (size_t i = 0; ; ++i)
+    {
+        if (i == max_bytes)
+        {
+            return -1;
+        }
+        if (i == len)
+        {
+            return 0;
+        }
+        *val |= static_cast<uint32_t>(buf[i] & 0x7fU) << (7U * i);
+        if ((buf[i] & 0x80U) == 0)
+        {
+            return i + 1;
+        }
+    }
+}
+
+// A record in a bundle is of the form [topic_ID(varint),length(varint),payload],
+// or [topic_ID(varint),payload] for a topic with a fixed length.
+constexpr size_t BUNDLE_MAX_RECORD_HEADER_LEN = V2_MAX_TOPIC_ID_LEN + 5;
+
+// This function parses the header of the record at the start of buf, which
+// holds the len bytes left of a bundle; fixed_lengths are the topics whose
+// records have no length.
+//
+// Returns the length of the header, with the topic ID and payload length of
+// the record in topic_ID and payload_len, or -1 if the record is malformed
+// or runs past the end of the bundle.
+static ssize_t parse_bundle_record(const uint8_t *buf, size_t len,
+                                   const std::map<topic_id_size_t, uint32_t> & fixed_lengths,
+                                   topic_id_size_t *topic_ID, size_t *payload_len)
+{
+    uint32_t val;
+    ssize_t topic_ID_len = get_varint(buf, len, V2_MAX_TOPIC_ID_LEN, &val);
+    if (topic_ID_len <= 0 || val > std::numeric_limits<topic_id_size_t>::max())
+    {
+        return -1;
+    }
+    *topic_ID = static_cast<topic_id_size_t>(val);
+
+    if (!fixed_lengths.empty())
+    {
+        auto fixed_it = fixed_lengths.find(*topic_ID);
+        if (fixed_it != fixed_lengths.end())
+        {
+            if (fixed_it->second > len - topic_ID_len)
+            {
+                return -1;
+            }
+            *payload_len = fixed_it->second;
+            return topic_ID_len;
+        }
+    }
+
+    ssize_t length_len = get_varint(buf + topic_ID_len, len - topic_ID_len, 5, &val);
+    if (length_len <= 0 || val > len - topic_ID_len - length_len)
+    {
+        return -1;
+    }
+    *payload_len = val;
+
+    return topic_ID_len + length_len;
+}
+
+// This function parses the v2 header at the start of buf, which holds len
+// bytes of data; aead says whether the link is keyed, in which case only
+// keyed frames are valid.
+//
+// Returns the length of the header, 0 if len isn't enough to hold the whole
+// header, or -1 if buf doesn't start with a valid header.
+static ssize_t v2_parse_header(const uint8_t *buf, size_t len, bool aead, V2FrameInfo *info)
+{
+    if (len < V2_FIXED_HEADER_LEN)
+    {
+        return 0;
+    }
+
+    // A frame can't be both a delta base and a delta, and fragments,
+    // reliable payloads and acknowledgements are never encoded.
+    uint8_t flags = buf[3];
+    constexpr uint8_t encoded = V2_FLAG_COMPRESSED | V2_FLAG_DELTA_BASE | V2_FLAG_DELTA;
+    if (buf[0] != '>' || buf[1] != '>' || buf[2] != (aead ? V2_AEAD_VERSION : V2_VERSION) ||
+        (flags & ~V2_KNOWN_FLAGS) != 0 || (aead && (flags & V2_FLAG_CRC32C) != 0) ||
+        (flags & (V2_FLAG_DELTA_BASE | V2_FLAG_DELTA)) == (V2_FLAG_DELTA_BASE | V2_FLAG_DELTA) ||
+        ((flags & V2_FLAG_FRAGMENT) != 0 && (flags & encoded) != 0) ||
+        ((flags & (V2_FLAG_RELIABLE | V2_FLAG_ACK)) != 0 && (flags & (encoded | V2_FLAG_FRAGMENT)) != 0))
+    {
+        return -1;
+    }
+    info->crc32c = (flags & V2_FLAG_CRC32C) != 0;
+    info->compressed = (flags & V2_FLAG_COMPRESSED) != 0;
+    info->delta_base = (flags & V2_FLAG_DELTA_BASE) != 0;
+    info->delta = (flags & V2_FLAG_DELTA) != 0;
+    info->fragment = (flags & V2_FLAG_FRAGMENT) != 0;
+    info->reliable = (flags & V2_FLAG_RELIABLE) != 0;
+    info->ack = (flags & V2_FLAG_ACK) != 0;
+    info->fec = (flags & V2_FLAG_FEC) != 0;
+
+    info->seq = buf[4];
+    size_t pos = V2_FIXED_HEADER_LEN;
+    uint32_t topic_ID;
+    ssize_t topic_ID_len = get_varint(buf + pos, len - pos, V2_MAX_TOPIC_ID_LEN, &topic_ID);
+    if (topic_ID_len <= 0)
+    {
+        return topic_ID_len;
+    }
+    if (topic_ID > std::numeric_limits<topic_id_size_t>::max())
+    {
+        return -1;
+    }
+    info->topic_ID = static_cast<topic_id_size_t>(topic_ID);
+    pos += topic_ID_len;
+
+    size_t crc_len = aead ? V2_AEAD_TRAILER_LEN : info->crc32c ? 4 : 2;
+    if (len - pos < 4 + crc_len)
+    {
+        return 0;
+    }
+
+    info->payload_len = get_be32(buf + pos);
+    pos += 4;
+    if (info->fec && impl::ReedSolomon::decoded_length(info->payload_len) < 0)
+    {
+        return -1;
+    }
+
+    if (aead)
+    {
+        // The tag is checked against the rest of the header and the payload
+        // once they are all in.
+        info->nonce = get_be64(buf + pos);
+    }
+    else if (info->crc32c)
+    {
+        info->crc = get_be32(buf + pos);
+    }
+    else
+    {
+        info->crc = (static_cast<uint32_t>(buf[pos]) << 8U) | buf[pos + 1];
+    }
+    pos += crc_len;
+
+    return pos;
+}
+
+// This function builds a v2 header into buf, which must be at least
+// V2_MAX_HEADER_LEN bytes long.  If aead is true, the header of a keyed
+// frame is built with nonce in place of the CRC, and room left at the end
+// for the tag.
+//
+// Returns the length of the header.
+static size_t v2_build_header(uint8_t *buf, topic_id_size_t topic_ID, uint8_t seq, uint32_t payload_len,
+                              uint8_t flags, uint32_t crc, bool aead = false, uint64_t nonce = 0)
+{
+    buf[0] = '>';
+    buf[1] = '>';
+    buf[2] = aead ? V2_AEAD_VERSION : V2_VERSION;
+    buf[3] = flags;
+    buf[4] = seq;
+
+    size_t pos = V2_FIXED_HEADER_LEN;
+    pos += put_varint(buf + pos, topic_ID);
+
+    put_be32(buf + pos, payload_len);
+    pos += 4;
+
+    if (aead)
+    {
+        put_be64(buf + pos, nonce);
+        pos += V2_AEAD_TRAILER_LEN;
+    }
+    else if ((flags & V2_FLAG_CRC32C) != 0)
+    {
+        put_be32(buf + pos, crc);
+        pos += 4;
+    }
+    else
+    {
+        buf[pos++] = static_cast<uint8_t>(crc >> 8U);
+        buf[pos++] = static_cast<uint8_t>(crc);
+    }
+
+    return pos;
+}
+
+// This function encodes cur as a delta against base, both of which are len
+// bytes long, into out, which is out_len bytes long.
+//
+// Returns the length of the delta, or 0 if it doesn't fit in out_len bytes.
+static size_t delta_encode(const uint8_t *base, uint16_t base_crc, const uint8_t *cur, size_t len,
+                           uint8_t *out, size_t out_len)
+{
+    if (out_len < DELTA_HEADER_LEN)
+    {
+        return 0;
+    }
+    out[0] = static_cast<uint8_t>(base_crc >> 8U);
+    out[1] = static_cast<uint8_t>(base_crc);
+    size_t pos = DELTA_HEADER_LEN;
+
+    size_t i = 0;
+    while (true)
+    {
+        size_t unchanged_start = i;
+        while (i < len && base[i] == cur[i])
+        {
+            ++i;
+        }
+        if (i == len)
+        {
+            break;
+        }
+
+        // Extend the changed run over any short stretches of unchanged
+        // bytes.
+        size_t changed_start = i;
+        while (i < len)
+        {
+            if (base[i] != cur[i])
+            {
+                ++i;
+                continue;
+            }
+            size_t same = i;
+            while (same < len && base[same] == cur[same] && same - i < DELTA_MIN_UNCHANGED)
+            {
+                ++same;
+            }
+            if (same == len || same - i == DELTA_MIN_UNCHANGED)
+            {
+                break;
+            }
+            i = same;
+        }
+
+        size_t changed_len = i - changed_start;
+        if (out_len - pos < DELTA_MAX_RUN_HEADER_LEN + changed_len)
+        {
+            return 0;
+        }
+        pos += put_varint(out + pos, static_cast<uint32_t>(changed_start - unchanged_start));
+        pos += put_varint(out + pos, static_cast<uint32_t>(changed_len));
+        ::memcpy(out + pos, cur + changed_start, changed_len);
+        pos += changed_len;
+    }
+
+    return pos;
+}
+
+// This function applies the runs of a delta (everything after the base CRC)
+// to base, which is base_len bytes long, in place.
+//
+// Returns 0 on success, or -1 if the delta isn't valid for base.
+static int delta_apply(const uint8_t *delta, size_t len, uint8_t *base, size_t base_len)
+{
+    size_t pos = 0;
+    size_t out = 0;
+    while (pos < len)
+    {
+        uint32_t unchanged_len;
+        uint32_t changed_len;
+        ssize_t n = get_varint(delta + pos, len - pos, 5, &unchanged_len);
+        if (n <= 0)
+        {
+            return -1;
+        }
+        pos += n;
+        n = get_varint(delta + pos, len - pos, 5, &changed_len);
+        if (n <= 0)
+        {
+            return -1;
+        }
+        pos += n;
+
+        if (unchanged_len > base_len - out)
+        {
+            return -1;
+        }
+        out += unchanged_len;
+        if (changed_len > base_len - out || changed_len > len - pos)
+        {
+            return -1;
+        }
+        ::memcpy(base + out, delta + pos, changed_len);
+        out += changed_len;
+        pos += changed_len;
+    }
+
+    return 0;
+}
+
+bool Transporter::parse_protocol(const std::string & protocol, SerialProtocol * out)
+{
+    if (protocol == "px4")
+    {
+        *out = SerialProtocol::PX4;
+    }
+    else if (protocol == "cobs")
+    {
+        *out = SerialProtocol::COBS;
+    }
+    else if (protocol == "cobs_zpe")
+    {
+        *out = SerialProtocol::COBS_ZPE;
+    }
+    else if (protocol == "v2")
+    {
+        *out = SerialProtocol::V2;
+    }
+    else
+    {
+        return false;
+    }
+
+    return true;
+}
+
+Transporter::Transporter(const std::string & protocol, size_t ring_buffer_size) : ringbuf_(ring_buffer_size)
+{
+    if (!parse_protocol(protocol, &backend_protocol_))
+    {
+        throw std::runtime_error("Invalid protocol; must be one of 'px4', 'cobs', 'cobs_zpe' or 'v2'");
+    }
+
+    // Size the frame buffer for the largest frame we can ever send, which is
+    // a header plus a payload of the maximum length that fits in the 16-bit
+    // wire length, plus the worst case COBS (or COBS/ZPE) overhead and
+    // end-of-packet byte.
+    // The v2 protocol can send larger payloads than that, but it only needs
+    // the frame buffer in the rare cases it can't pass the payload straight
+    // down to the transport, so the frame buffer grows on demand instead.
+    size_t max_data_plus_header = get_header_length() + std::numeric_limits<uint16_t>::max();
+    frame_buf_size_ = impl::COBSEncoder::max_encoded_length(max_data_plus_header) + 1;
+    frame_buf_ = std::unique_ptr<uint8_t[]>(new uint8_t[frame_buf_size_]);
+}
+
+Transporter::~Transporter()
+{
+}
+
+uint16_t Transporter::crc16_byte(uint16_t crc, uint8_t data)
+{
+    return impl::CRC16::update_byte(crc, data);
+}
+
+uint16_t Transporter::crc16(uint8_t const *buffer, size_t len)
+{
+    return crc_engine_.update(0, buffer, len);
+}
+
+// The destination for COBS unstuffing.  The first hdr_len bytes of decoded
+// data go into hdr, and the rest go into dst.  At most dst_len bytes are
+// written into dst; anything past that is only counted in total, so that the
+// caller can tell the frame was too large.
+//
+// With a crc_engine, the CRC-16 of the payload is worked out as it is
+// written, rather than in a pass of its own afterwards: once hdr is full,
+// the payload length is taken from the big-endian length at len_offset in
+// it, and crc ends up as the CRC of that many bytes of dst (if that many
+// were written).
+struct COBSUnstuffOutput final
+{
+    uint8_t *hdr;
+    size_t hdr_len;
+    uint8_t *dst;
+    size_t dst_len;
+    size_t total;
+    const impl::CRC16 *crc_engine{nullptr};
+    size_t len_offset{0};
+    size_t crc_len{0};
+    uint16_t crc{0};
 };
 
-Transporter::Transporter(const std::string & protocol, size_t ring_buffer_size) : ringbuf_(ring_buffer_size)
+static void cobs_unstuff_write(COBSUnstuffOutput *out, const uint8_t *src, size_t n)
+{
+    if (out->total < out->hdr_len)
+    {
+        size_t nhdr = std::min(n, out->hdr_len - out->total);
+        ::memcpy(out->hdr + out->total, src, nhdr);
+        out->total += nhdr;
+        src += nhdr;
+        n -= nhdr;
+
+        if (out->total == out->hdr_len && out->crc_engine != nullptr)
+        {
+            out->crc_len = static_cast<size_t>(out->hdr[out->len_offset] << 8U) | out->hdr[out->len_offset + 1];
+        }
+    }
+
+    if (n > 0)
+    {
+        size_t dst_offset = out->total - out->hdr_len;
+        if (dst_offset < out->dst_len)
+        {
+            size_t ndst = std::min(n, out->dst_len - dst_offset);
+            ::memcpy(out->dst + dst_offset, src, ndst);
+            if (out->crc_engine != nullptr && dst_offset < out->crc_len)
+            {
+                out->crc = out->crc_engine->update(out->crc, src, std::min(ndst, out->crc_len - dst_offset));
+            }
+        }
+        out->total += n;
+    }
+}
+
+// This function works out what the code byte of a COBS block says: how
+// many data bytes follow it (in *data_len), and how many 0s come after those
+// (the return value).  With zpe, the code is one of COBS/ZPE instead.
+static inline size_t cobs_block(uint8_t code, bool zpe, size_t *data_len)
+{
+    if (zpe && code >= impl::COBSEncoder::ZPE_PAIR_CODE)
+    {
+        *data_len = code - impl::COBSEncoder::ZPE_PAIR_CODE;
+        return 2;
+    }
+    if (zpe && code == impl::COBSEncoder::ZPE_RUN_CODE)
+    {
+        *data_len = impl::COBSEncoder::ZPE_MAX_RUN;
+        return 0;
+    }
+
+    *data_len = code - 1;
+    return (!zpe && code == 0xff) ? 0 : 1;
+}
+
+// This function decodes the COBS (or with zpe, COBS/ZPE) data held in nspans
+// spans of memory (as handed out by RingBuffer::peek_spans), writing the
+// output to out.  Runs of non-zero bytes are copied as a block, and the data
+// is decoded straight out of the spans, so no intermediate buffer is needed.
+//
+// Returns the total length of the decoded data.
+size_t cobs_unstuff_spans(const uint8_t * const *spans, const size_t *span_lens, size_t nspans, COBSUnstuffOutput *out,
+                          bool zpe)
+{
+    static const uint8_t zeros[2]{0, 0};
+    // The 0s that follow the data of the current block; they are only
+    // written once the next block starts, since the last 0 of the last block
+    // isn't part of the data.
+    size_t pending_zeros = 0;
+    size_t copy = 0;
+
+    for (size_t i = 0; i < nspans; ++i)
+    {
+        const uint8_t *ptr = spans[i];
+        const uint8_t *end = ptr + span_lens[i];
+
+        while (ptr < end)
+        {
+            if (copy != 0)
+            {
+                size_t n = std::min(copy, static_cast<size_t>(end - ptr));
+                cobs_unstuff_write(out, ptr, n);
+                ptr += n;
+                copy -= n;
+            }
+            else
+            {
+                if (pending_zeros != 0)
+                {
+                    cobs_unstuff_write(out, zeros, pending_zeros);
+                }
+                uint8_t code = *ptr++;
+                if (code == 0)
+                {
+                    return out->total;  // source length too long
+                }
+                pending_zeros = cobs_block(code, zpe, &copy);
+            }
+        }
+    }
+
+    if (pending_zeros > 1)
+    {
+        cobs_unstuff_write(out, zeros, pending_zeros - 1);
+    }
+
+    return out->total;
+}
+
+// This function walks the COBS (or with zpe, COBS/ZPE) blocks held in nspans
+// spans of memory to find where the encoding of the first decoded_len bytes
+// ends.  It only finds an end that falls at the end of a block, since that
+// is where the 0 that ends a frame goes.
+//
+// Returns the encoded length, or 0 if the blocks don't end there.
+static size_t cobs_encoded_length(const uint8_t * const *spans, const size_t *span_lens, size_t nspans,
+                                  size_t decoded_len, bool zpe)
+{
+    size_t total = 0;
+    for (size_t i = 0; i < nspans; ++i)
+    {
+        total += span_lens[i];
+    }
+
+    size_t pos = 0;
+    size_t decoded = 0;
+    while (pos < total)
+    {
+        size_t span = 0;
+        size_t span_pos = pos;
+        while (span_pos >= span_lens[span])
+        {
+            span_pos -= span_lens[span];
+            span++;
+        }
+        uint8_t code = spans[span][span_pos];
+        if (code == 0)
+        {
+            return 0;
+        }
+
+        size_t data_len;
+        size_t block_zeros = cobs_block(code, zpe, &data_len);
+        pos += 1 + data_len;
+        decoded += data_len;
+        // The last 0 of the block that ends the frame is the frame's own.
+        if (decoded == decoded_len || (block_zeros == 2 && decoded + 1 == decoded_len))
+        {
+            return pos <= total ? pos : 0;
+        }
+        decoded += block_zeros;
+        if (decoded > decoded_len)
+        {
+            return 0;
+        }
+    }
+
+    return 0;
+}
+
+uint8_t *Transporter::take_payload(size_t payload_len, uint8_t *out_buffer, bool in_place)
+{
+    // If the caller can take the payload in place and it is contiguous, we
+    // just consume it; the bytes stay where they are in the ring until more
+    // data is added.
+    const uint8_t *in_ring = (in_place && payload_len > 0) ? ringbuf_.contiguous(payload_len) : nullptr;
+    if (in_ring != nullptr)
+    {
+        if (ringbuf_.discard(payload_len) < 0)
+        {
+            ring_failure();
+            return nullptr;
+        }
+        return const_cast<uint8_t *>(in_ring);
+    }
+
+    if (payload_len > 0 && ringbuf_.memcpy_from(out_buffer, payload_len) < 0)
+    {
+        ring_failure();
+        return nullptr;
+    }
+
+    return out_buffer;
+}
+
+ssize_t Transporter::ring_failure()
+{
+    // The parsers only take what they have already found in the ring, so
+    // this means the ring itself is inconsistent.  Nothing in it can be
+    // trusted, so it is all thrown away and parsing starts over with the
+    // next data that arrives, rather than taking the read thread down.
+    ROS2_SERIAL_LOG(ERROR, "Unexpected ring buffer failure; dropping %zu bytes", ringbuf_.bytes_used());
+    metrics_.garbage(ringbuf_.bytes_used());
+    metrics_.read_error();
+    (void)ringbuf_.discard(ringbuf_.bytes_used());
+
+    return -EIO;
+}
+
+bool Transporter::rx_payload_plausible(topic_id_size_t topic_ID, size_t payload_len) const
+{
+    if (topic_ID >= rx_max_payload_.size())
+    {
+        return true;
+    }
+    uint32_t max_payload = rx_max_payload_[topic_ID].load(std::memory_order_relaxed);
+
+    return max_payload == 0 || payload_len <= max_payload;
+}
+
+bool Transporter::ring_payload_crc(size_t header_len, size_t payload_len, bool use_crc32c, uint32_t *crc)
+{
+    // Carry on from what was worked out while the frame was coming in.
+    size_t done = 0;
+    *crc = 0;
+    if (rx_frame_pending(rx_frame_.aead) && rx_frame_.header_len == header_len && rx_frame_.crc_len <= payload_len)
+    {
+        done = rx_frame_.crc_len;
+        *crc = rx_frame_.crc;
+    }
+
+    const uint8_t *spans[2];
+    size_t span_lens[2];
+    if (ringbuf_.peek_spans(header_len + payload_len, &spans[0], &span_lens[0], &spans[1], &span_lens[1]) < 0)
+    {
+        return false;
+    }
+
+    size_t offset = header_len + done;
+    for (size_t i = 0; i < 2; ++i)
+    {
+        size_t skip = std::min(offset, span_lens[i]);
+        offset -= skip;
+        if (use_crc32c)
+        {
+            *crc = crc32c_engine_.update(*crc, spans[i] + skip, span_lens[i] - skip);
+        }
+        else
+        {
+            *crc = crc_engine_.update(static_cast<uint16_t>(*crc), spans[i] + skip, span_lens[i] - skip);
+        }
+    }
+
+    return true;
+}
+
+bool Transporter::rx_frame_pending(bool aead) const
+{
+    return rx_frame_.valid && rx_frame_.tail_generation == ringbuf_.get_tail_generation() && rx_frame_.aead == aead;
+}
+
+void Transporter::rx_frame_wait(const uint8_t *header, size_t header_len, bool aead)
+{
+    if (rx_frame_pending(aead) && rx_frame_.header_len == header_len)
+    {
+        return;
+    }
+
+    static_assert(sizeof(rx_frame_.header) >= V2_MAX_HEADER_LEN, "RxFrameState header too small");
+    rx_frame_.valid = true;
+    rx_frame_.tail_generation = ringbuf_.get_tail_generation();
+    rx_frame_.aead = aead;
+    ::memcpy(rx_frame_.header.data(), header, header_len);
+    rx_frame_.header_len = header_len;
+    rx_frame_.crc_len = 0;
+    rx_frame_.crc = 0;
+}
+
+// The framing policies that drain_ring_framed() is instantiated with, one
+// per protocol.  Each has the shortest header of the protocol as a constant
+// and parses the next message in the ring with the protocol's parser.
+struct Transporter::PX4Framing final
+{
+    static constexpr size_t HEADER_LEN = sizeof(PX4Header);
+
+    static ssize_t find(Transporter *transporter, topic_id_size_t *topic_ID, uint8_t *out_buffer,
+                        size_t buffer_len, uint8_t **payload)
+    {
+        return transporter->find_px4_message(topic_ID, out_buffer, buffer_len, payload);
+    }
+};
+
+struct Transporter::V2Framing final
+{
+    static constexpr size_t HEADER_LEN = V2_MIN_HEADER_LEN;
+
+    static ssize_t find(Transporter *transporter, topic_id_size_t *topic_ID, uint8_t *out_buffer,
+                        size_t buffer_len, uint8_t **payload)
+    {
+        return transporter->find_v2_message(topic_ID, out_buffer, buffer_len, payload);
+    }
+};
+
+struct Transporter::COBSFraming final
+{
+    static constexpr size_t HEADER_LEN = sizeof(COBSHeader);
+
+    static ssize_t find(Transporter *transporter, topic_id_size_t *topic_ID, uint8_t *out_buffer,
+                        size_t buffer_len, uint8_t **payload)
+    {
+        return transporter->find_cobs_message(topic_ID, out_buffer, buffer_len, payload, false);
+    }
+};
+
+struct Transporter::COBSZPEFraming final
+{
+    static constexpr size_t HEADER_LEN = sizeof(COBSHeader);
+
+    static ssize_t find(Transporter *transporter, topic_id_size_t *topic_ID, uint8_t *out_buffer,
+                        size_t buffer_len, uint8_t **payload)
+    {
+        return transporter->find_cobs_message(topic_ID, out_buffer, buffer_len, payload, true);
+    }
+};
+
+constexpr size_t Transporter::PX4Framing::HEADER_LEN;
+constexpr size_t Transporter::V2Framing::HEADER_LEN;
+constexpr size_t Transporter::COBSFraming::HEADER_LEN;
+constexpr size_t Transporter::COBSZPEFraming::HEADER_LEN;
+
+ssize_t Transporter::find_and_copy_message(topic_id_size_t *topic_ID, uint8_t *out_buffer, size_t buffer_len,
+                                           uint8_t **payload)
+{
+    if (ringbuf_.bytes_used() < get_header_length())
+    {
+        return -ENODATA;
+    }
+
+    switch (backend_protocol_)
+    {
+    case SerialProtocol::PX4:
+        return PX4Framing::find(this, topic_ID, out_buffer, buffer_len, payload);
+    case SerialProtocol::V2:
+        return V2Framing::find(this, topic_ID, out_buffer, buffer_len, payload);
+    case SerialProtocol::COBS:
+        return COBSFraming::find(this, topic_ID, out_buffer, buffer_len, payload);
+    case SerialProtocol::COBS_ZPE:
+        return COBSZPEFraming::find(this, topic_ID, out_buffer, buffer_len, payload);
+    }
+
+    throw std::runtime_error("Bad protocol");
+}
+
+ssize_t Transporter::find_px4_message(topic_id_size_t *topic_ID, uint8_t *out_buffer, size_t buffer_len,
+                                      uint8_t **payload)
+{
+    constexpr size_t header_len = PX4Framing::HEADER_LEN;
+
+    // Looking for a header of the form:
+    // [>,>,>,topic_ID,seq,payload_length_H,payload_length_L,CRCHigh,CRCLow,payloadStart, ... ,payloadEnd]
+
+    PX4Header header{};
+
+    if (rx_frame_pending(false))
+    {
+        // The rest of the frame whose header was read last time may have
+        // come in since; its header is still the one at the front.
+        ::memcpy(&header, rx_frame_.header.data(), header_len);
+    }
+    else
+    {
+        std::array<uint8_t, 3> headerseq{'>', '>', '>'};
+        ssize_t offset = ringbuf_.findseq(&headerseq[0], headerseq.size());
+
+        if (offset < 0)
+        {
+            // We didn't find the sequence, so just return
+            return -ENODATA;
+        }
+
+        if (offset > 0)
+        {
+            // There is some garbage at the front, so just throw it away.
+            if (ringbuf_.discard(offset) < 0)
+            {
+                return ring_failure();
+            }
+            metrics_.garbage(offset);
+            if (ringbuf_.bytes_used() < header_len)
+            {
+                // Not enough bytes now.
+                return -ENODATA;
+            }
+        }
+
+        // Peek at the header out of the buffer.  Note that we need to do
+        // a peek/copy (rather than just mapping to the array) because the
+        // header might be non-contiguous in memory in the ring.
+
+        if (ringbuf_.peek(&header, header_len) < 0)
+        {
+            // ringbuf_.peek returns nullptr if there isn't enough data in the
+            // ring buffer for the requested length
+            return -EMSGSIZE;
+        }
+    }
+
+    uint16_t payload_len = static_cast<uint16_t>(static_cast<uint16_t>(header.payload_len_h) << 8U) | header.payload_len_l;
+
+    // A marker inside of a payload, or a corrupt length, makes for a
+    // bogus header.  If the length is more than the topic can carry or
+    // than could be received, skip the marker straight away rather than
+    // waiting for that much data, and search again one byte past it.
+    bool plausible = rx_payload_plausible(header.topic_ID, payload_len);
+    if (!plausible || buffer_len < payload_len || header_len + payload_len > ringbuf_.max_capacity())
+    {
+        if (ringbuf_.discard(1) < 0)
+        {
+            return ring_failure();
+        }
+        if (plausible)
+        {
+            // The message won't fit the buffer.
+            metrics_.drop(Metrics::Direction::RX, header.topic_ID, Metrics::Drop::OVERSIZE);
+            return -EMSGSIZE;
+        }
+        metrics_.garbage(1);
+        return -EBADMSG;
+    }
+
+    if (ringbuf_.bytes_used() < (header_len + payload_len))
+    {
+        // We do not have a complete message yet; remember the header, and
+        // add what there is of the payload to the CRC while it is at hand.
+        rx_frame_wait(reinterpret_cast<const uint8_t *>(&header), header_len, false);
+        uint32_t crc;
+        size_t arrived = ringbuf_.bytes_used() - header_len;
+        if (!ring_payload_crc(header_len, arrived, false, &crc))
+        {
+            return ring_failure();
+        }
+        rx_frame_.crc = crc;
+        rx_frame_.crc_len = arrived;
+        return -ENODATA;
+    }
+    ROS2_SERIAL_TRACEPOINT(frame_complete, this, header_len + payload_len);
+
+    // The CRC is checked before anything is consumed, so that if the
+    // header was bogus (or the frame corrupt) only the marker is thrown
+    // away, and a frame that starts inside of the claimed payload is
+    // still found.
+    uint16_t read_crc = static_cast<uint16_t>(static_cast<uint16_t>(header.crc_h) << 8U) | header.crc_l;
+    uint32_t calc_crc;
+    bool crc_ok = ring_payload_crc(header_len, payload_len, false, &calc_crc);
+    rx_frame_.valid = false;
+    if (!crc_ok)
+    {
+        return ring_failure();
+    }
+    if (read_crc != calc_crc)
+    {
+        ROS2_SERIAL_LOG(WARN, "BAD CRC %u != %u", read_crc, calc_crc);
+        metrics_.drop(Metrics::Direction::RX, header.topic_ID, Metrics::Drop::CRC);
+        if (ringbuf_.discard(1) < 0)
+        {
+            return ring_failure();
+        }
+        return -EBADMSG;
+    }
+    ROS2_SERIAL_TRACEPOINT(crc_verified, this, header.topic_ID, payload_len);
+    metrics_.sequence(header.topic_ID, header.seq);
+    rx_seq_ = header.seq;
+
+    // At this point, we know that we have a complete, valid message.
+    // Header; we already have a copy of it from the peek above.
+    if (ringbuf_.discard(header_len) < 0)
+    {
+        // We already checked above, so this should never happen.
+        return ring_failure();
+    }
+
+    uint8_t *data = take_payload(payload_len, out_buffer, payload != nullptr);
+    if (data == nullptr)
+    {
+        return -EIO;
+    }
+
+    *topic_ID = header.topic_ID;
+    if (payload != nullptr)
+    {
+        *payload = data;
+    }
+
+    return payload_len;
+}
+
+ssize_t Transporter::find_v2_message(topic_id_size_t *topic_ID, uint8_t *out_buffer, size_t buffer_len,
+                                     uint8_t **payload)
+{
+    constexpr size_t header_len = V2Framing::HEADER_LEN;
+
+    bool aead = aead_ != nullptr;
+    std::array<uint8_t, V2_MAX_HEADER_LEN> header_buf;
+    size_t peek_len;
+
+    if (rx_frame_pending(aead))
+    {
+        // The rest of the frame whose header was read last time may have
+        // come in since; its header is still the one at the front.
+        peek_len = rx_frame_.header_len;
+        ::memcpy(&header_buf[0], rx_frame_.header.data(), peek_len);
+    }
+    else
+    {
+        std::array<uint8_t, 3> headerseq{'>', '>', aead ? V2_AEAD_VERSION : V2_VERSION};
+        ssize_t offset = ringbuf_.findseq(&headerseq[0], headerseq.size());
+
+        if (offset < 0)
+        {
+            // We didn't find the sequence, so just return
+            return -ENODATA;
+        }
+
+        if (offset > 0)
+        {
+            // There is some garbage at the front, so just throw it away.
+            if (ringbuf_.discard(offset) < 0)
+            {
+                return ring_failure();
+            }
+            metrics_.garbage(offset);
+            if (ringbuf_.bytes_used() < header_len)
+            {
+                // Not enough bytes now.
+                return -ENODATA;
+            }
+        }
+
+        // The header is variable length, so peek at as much of it as there
+        // could be.
+        peek_len = std::min(ringbuf_.bytes_used(), header_buf.size());
+        if (ringbuf_.peek(&header_buf[0], peek_len) < 0)
+        {
+            // We already checked above, so this should never happen.
+            return ring_failure();
+        }
+    }
+
+    V2FrameInfo info{};
+    ssize_t v2_header_len = v2_parse_header(&header_buf[0], peek_len, aead, &info);
+    if (v2_header_len == 0)
+    {
+        // We do not have a complete header yet
+        return -ENODATA;
+    }
+
+    uint64_t frame_len = static_cast<uint64_t>(v2_header_len) + info.payload_len;
+    if (v2_header_len < 0 || frame_len > ringbuf_.max_capacity())
+    {
+        // This isn't a valid header, or it is for a frame that could
+        // never fit in the ring buffer (most likely because the length is
+        // corrupt).  Throw away the first marker so that the next search
+        // starts after it.
+        if (ringbuf_.discard(1) < 0)
+        {
+            return ring_failure();
+        }
+        metrics_.garbage(1);
+        return -EBADMSG;
+    }
+
+    // An FEC payload is longer on the wire than the data it carries.
+    size_t data_len = info.payload_len;
+    if (info.fec)
+    {
+        data_len = impl::ReedSolomon::decoded_length(info.payload_len);
+    }
+
+    if (data_len > buffer_len)
+    {
+        // The message won't fit the buffer, or the header is bogus; as for
+        // PX4 frames, only the marker is thrown away, so that a frame that
+        // starts inside of the claimed payload is still found.
+        if (ringbuf_.discard(1) < 0)
+        {
+            return ring_failure();
+        }
+        metrics_.drop(Metrics::Direction::RX, info.topic_ID, Metrics::Drop::OVERSIZE);
+        return -EMSGSIZE;
+    }
+
+    // A plain payload (one that isn't keyed or FEC encoded) is covered by
+    // the CRC as it is on the wire, so the CRC can be worked out in the ring
+    // as the payload comes in.
+    bool ring_crc = !aead && !info.fec;
+
+    if (ringbuf_.bytes_used() < frame_len)
+    {
+        // We do not have a complete message yet; remember the header, and
+        // add what there is of the payload to the CRC while it is at hand.
+        rx_frame_wait(&header_buf[0], v2_header_len, aead);
+        if (ring_crc)
+        {
+            uint32_t crc;
+            size_t arrived = ringbuf_.bytes_used() - v2_header_len;
+            if (!ring_payload_crc(v2_header_len, arrived, info.crc32c, &crc))
+            {
+                return ring_failure();
+            }
+            rx_frame_.crc = crc;
+            rx_frame_.crc_len = arrived;
+        }
+        return -ENODATA;
+    }
+    ROS2_SERIAL_TRACEPOINT(frame_complete, this, frame_len);
+
+    // A CRC worked out in the ring is checked before anything is consumed,
+    // as for PX4 frames, so that if the header was bogus (or the frame
+    // corrupt) only the marker is thrown away, and a frame that starts
+    // inside of the claimed payload is still found.  The CRC of the other
+    // payloads can only be checked once they have been taken.
+    uint32_t ring_calc_crc = 0;
+    bool crc_ok = !ring_crc || ring_payload_crc(v2_header_len, info.payload_len, info.crc32c, &ring_calc_crc);
+    rx_frame_.valid = false;
+    if (!crc_ok)
+    {
+        return ring_failure();
+    }
+    if (ring_crc && info.crc != ring_calc_crc)
+    {
+        ROS2_SERIAL_LOG(WARN, "BAD CRC %u != %u", info.crc, ring_calc_crc);
+        metrics_.drop(Metrics::Direction::RX, info.topic_ID, Metrics::Drop::CRC);
+        if (ringbuf_.discard(1) < 0)
+        {
+            return ring_failure();
+        }
+        return -EBADMSG;
+    }
+
+    if (ringbuf_.discard(v2_header_len) < 0)
+    {
+        // We already checked above, so this should never happen.
+        return ring_failure();
+    }
+
+    // A compressed payload is decompressed into out_buffer, so it can
+    // only be copied out of the ring (if it isn't contiguous there) into
+    // a separate buffer.
+    // An FEC payload is corrected in a buffer of its own, and only then
+    // decoded any further.
+    uint8_t *data;
+    if (info.fec)
+    {
+        if (rx_fec_buf_.size() < info.payload_len)
+        {
+            rx_fec_buf_.resize(info.payload_len);
+        }
+        data = take_payload(info.payload_len, rx_fec_buf_.data(), false);
+        if (data == nullptr)
+        {
+            return -EIO;
+        }
+        if (correct_fec(info.topic_ID, data, info.payload_len) < 0)
+        {
+            return -EBADMSG;
+        }
+    }
+    else if (info.compressed)
+    {
+        if (rx_compressed_buf_.size() < info.payload_len)
+        {
+            rx_compressed_buf_.resize(info.payload_len);
+        }
+        data = take_payload(info.payload_len, rx_compressed_buf_.data(), true);
+    }
+    else
+    {
+        data = take_payload(info.payload_len, out_buffer, payload != nullptr);
+    }
+    if (data == nullptr)
+    {
+        return -EIO;
+    }
+
+    // A keyed payload is decrypted where it is; it has already been taken
+    // out of the ring.
+    if (aead)
+    {
+        if (open_aead(info.topic_ID, &header_buf[0], v2_header_len, data, data, data_len) < 0)
+        {
+            return -EBADMSG;
+        }
+    }
+    else if (!ring_crc)
+    {
+        uint32_t calc_crc = info.crc32c ? crc32c_engine_.update(0, data, data_len) : crc16(data, data_len);
+        if (info.crc != calc_crc)
+        {
+            ROS2_SERIAL_LOG(WARN, "BAD CRC %u != %u", info.crc, calc_crc);
+            metrics_.drop(Metrics::Direction::RX, info.topic_ID, Metrics::Drop::CRC);
+            return -EBADMSG;
+        }
+    }
+    ROS2_SERIAL_TRACEPOINT(crc_verified, this, info.topic_ID, data_len);
+    metrics_.sequence(info.topic_ID, info.seq);
+    rx_seq_ = info.seq;
+
+    if (info.fragment)
+    {
+        ssize_t len = reassemble_fragment(info.topic_ID, data, data_len, out_buffer, buffer_len, payload);
+        if (len >= 0)
+        {
+            *topic_ID = info.topic_ID;
+        }
+        return len;
+    }
+
+    if (info.ack || info.reliable)
+    {
+        ssize_t prefix_len = receive_reliable(info.topic_ID, info.ack, info.reliable, data, data_len);
+        if (prefix_len < 0)
+        {
+            if (prefix_len == -EBADMSG)
+            {
+                metrics_.drop(Metrics::Direction::RX, info.topic_ID, Metrics::Drop::DECODE);
+            }
+            return prefix_len;
+        }
+        data += prefix_len;
+        data_len -= prefix_len;
+    }
+
+    const uint8_t *decoded;
+    ssize_t len = decode_v2_payload(info.topic_ID, info.compressed, info.delta_base, info.delta, data,
+                                    data_len, out_buffer, buffer_len, &decoded);
+    if (len < 0)
+    {
+        metrics_.drop(Metrics::Direction::RX, info.topic_ID,
+                      len == -EMSGSIZE ? Metrics::Drop::OVERSIZE : Metrics::Drop::DECODE);
+        return len;
+    }
+
+    *topic_ID = info.topic_ID;
+    if (payload != nullptr)
+    {
+        *payload = const_cast<uint8_t *>(decoded);
+    }
+    else if (decoded != out_buffer && len > 0)
+    {
+        // The message follows the acknowledgement and sequence number
+        // in out_buffer, but must start at the front of it.
+        ::memmove(out_buffer, decoded, len);
+    }
+
+    return len;
+}
+
+ssize_t Transporter::find_cobs_message(topic_id_size_t *topic_ID, uint8_t *out_buffer, size_t buffer_len,
+                                       uint8_t **payload, bool zpe)
+{
+    constexpr size_t header_len = COBSFraming::HEADER_LEN;
+
+    // For COBS, we search for a tail sequence consisting just of 0x0.  If
+    // we find it, we find out how many bytes there are from the start of
+    // the ring until that sequence; if there are enough bytes, we can try
+    // to unstuff.
+    std::array<uint8_t, 1> tailseq{0x0};
+    ssize_t offset = ringbuf_.findseq(&tailseq[0], tailseq.size());
+
+    if (offset < 0)
+    {
+        // We didn't find the sequence, so just return
+        return -ENODATA;
+    }
+
+    // Since findseq returns the number of bytes *up to* the sequence, we
+    // need to add one so we actually consume the 0 as well.  This should
+    // always succeed since we found it above.
+    size_t needed = offset + 1;
+    ROS2_SERIAL_TRACEPOINT(frame_complete, this, needed);
+
+    // Unstuff the data straight out of the ring buffer.  The header is
+    // decoded into a local COBSHeader and the payload directly into the
+    // caller's out_buffer, so there is no intermediate copy.  If the
+    // payload turns out to be larger than out_buffer, the unstuffing only
+    // counts the remaining bytes and we reject the message below.
+    const uint8_t *spans[2];
+    size_t span_lens[2];
+    if (ringbuf_.peek_spans(offset, &spans[0], &span_lens[0], &spans[1], &span_lens[1]) < 0)
+    {
+        return ring_failure();
+    }
+
+    COBSHeader header{};
+    COBSUnstuffOutput unstuff_out{reinterpret_cast<uint8_t *>(&header), header_len, out_buffer, buffer_len, 0};
+    unstuff_out.crc_engine = &crc_engine_;
+    unstuff_out.len_offset = offsetof(COBSHeader, payload_len_h);
+    size_t unstuffed_size = cobs_unstuff_spans(spans, span_lens, 2, &unstuff_out, zpe);
+    uint16_t payload_len = 0;
+    if (unstuffed_size >= header_len)
+    {
+        payload_len = static_cast<uint16_t>(static_cast<uint16_t>(header.payload_len_h) << 8U) | header.payload_len_l;
+    }
+
+    // If the data decodes to more than the header says and the payload
+    // is still good, the 0 at the end of the frame was most likely
+    // corrupted, running the next frame into it.  In that case only this
+    // frame, and the byte that should have been its 0, are consumed, so
+    // that the next frame is still found.  (An empty payload is too easy
+    // to come by in garbage to go on.)
+    uint16_t read_crc = static_cast<uint16_t>(static_cast<uint16_t>(header.crc_h) << 8U) | header.crc_l;
+    if (unstuffed_size > header_len + payload_len && payload_len > 0 && payload_len <= buffer_len &&
+        rx_payload_plausible(header.topic_ID, payload_len) && unstuff_out.crc == read_crc)
+    {
+        size_t encoded_len = cobs_encoded_length(spans, span_lens, 2, header_len + payload_len, zpe);
+        if (encoded_len > 0 && encoded_len < static_cast<size_t>(offset))
+        {
+            needed = encoded_len + 1;
+            unstuffed_size = header_len + payload_len;
+        }
+    }
+
+    // Note that we *always* consume the data up to and including the 0,
+    // even if it isn't valid.  This is so we get the data out of the ring
+    // buffer; if it is bogus, we'll throw it away below.
+    if (ringbuf_.discard(needed) < 0)
+    {
+        return ring_failure();
+    }
+
+    if (unstuffed_size < header_len)
+    {
+        // We found a 0x0 in the data, but there wasn't enough for a full
+        // header.  Drop all of the data.
+        metrics_.garbage(needed);
+        return -ENODATA;
+    }
+
+    if ((unstuffed_size - header_len) < payload_len || !rx_payload_plausible(header.topic_ID, payload_len))
+    {
+        // The data we copied out and unstuffed was smaller than what the
+        // payload was, or the payload is longer than the topic can
+        // carry, so this definitely isn't a valid message.
+        metrics_.garbage(needed);
+        return -ENODATA;
+    }
+
+    if ((unstuffed_size - header_len) > buffer_len)
+    {
+        // The message won't fit the buffer.
+        metrics_.drop(Metrics::Direction::RX, header.topic_ID, Metrics::Drop::OVERSIZE);
+        return -EMSGSIZE;
+    }
+
+    // The CRC was worked out while unstuffing.
+    uint16_t calc_crc = unstuff_out.crc;
+    if (read_crc != calc_crc)
+    {
+        ROS2_SERIAL_LOG(WARN, "BAD CRC %u != %u", read_crc, calc_crc);
+        metrics_.drop(Metrics::Direction::RX, header.topic_ID, Metrics::Drop::CRC);
+        return -EBADMSG;
+    }
+    ROS2_SERIAL_TRACEPOINT(crc_verified, this, header.topic_ID, payload_len);
+
+    *topic_ID = header.topic_ID;
+    if (payload != nullptr)
+    {
+        *payload = out_buffer;
+    }
+
+    return payload_len;
+}
+
+ssize_t Transporter::copy_message_from_frame(const uint8_t *frame, size_t frame_len, topic_id_size_t *topic_ID,
+                                             uint8_t *out_buffer, size_t buffer_len, uint8_t **payload)
+{
+    size_t header_len = get_header_length();
+    size_t payload_len;
+    uint16_t read_crc;
+    topic_id_size_t frame_topic_ID;
+    // COBS frames have no sequence number.
+    int frame_seq = -1;
+
+    ROS2_SERIAL_TRACEPOINT(frame_complete, this, frame_len);
+
+    if (backend_protocol_ == SerialProtocol::PX4)
+    {
+        if (frame_len < header_len || frame[0] != '>' || frame[1] != '>' || frame[2] != '>')
+        {
+            metrics_.garbage(frame_len);
+            return -EBADMSG;
+        }
+
+        PX4Header header{};
+        ::memcpy(&header, frame, header_len);
+
+        payload_len = static_cast<uint16_t>(static_cast<uint16_t>(header.payload_len_h) << 8U) | header.payload_len_l;
+        if (frame_len != header_len + payload_len)
+        {
+            metrics_.garbage(frame_len);
+            return -EBADMSG;
+        }
+
+        if (buffer_len < payload_len)
+        {
+            metrics_.drop(Metrics::Direction::RX, header.topic_ID, Metrics::Drop::OVERSIZE);
+            return -EMSGSIZE;
+        }
+
+        if (payload_len > 0)
+        {
+            ::memcpy(out_buffer, frame + header_len, payload_len);
+        }
+
+        read_crc = static_cast<uint16_t>(static_cast<uint16_t>(header.crc_h) << 8U) | header.crc_l;
+        frame_topic_ID = header.topic_ID;
+        frame_seq = header.seq;
+    }
+    else if (backend_protocol_ == SerialProtocol::V2)
+    {
+        V2FrameInfo info{};
+        ssize_t v2_header_len = v2_parse_header(frame, frame_len, aead_ != nullptr, &info);
+        if (v2_header_len <= 0 || frame_len != static_cast<uint64_t>(v2_header_len) + info.payload_len)
+        {
+            metrics_.garbage(frame_len);
+            return -EBADMSG;
+        }
+
+        payload_len = info.fec ? impl::ReedSolomon::decoded_length(info.payload_len) : info.payload_len;
+        if (buffer_len < payload_len)
+        {
+            metrics_.drop(Metrics::Direction::RX, info.topic_ID, Metrics::Drop::OVERSIZE);
+            return -EMSGSIZE;
+        }
+
+        // The CRC is of the payload as sent (once any FEC is corrected), so
+        // check it before decoding the payload.
+        const uint8_t *data = frame + v2_header_len;
+        if (info.fec)
+        {
+            if (rx_fec_buf_.size() < info.payload_len)
+            {
+                rx_fec_buf_.resize(info.payload_len);
+            }
+            ::memcpy(rx_fec_buf_.data(), data, info.payload_len);
+            if (correct_fec(info.topic_ID, rx_fec_buf_.data(), info.payload_len) < 0)
+            {
+                return -EBADMSG;
+            }
+            data = rx_fec_buf_.data();
+        }
+        if (aead_ != nullptr)
+        {
+            // The frame can't be written to, so a keyed payload is decrypted
+            // into a buffer of its own (unless it was corrected into one).
+            uint8_t *decrypted = rx_fec_buf_.data();
+            if (!info.fec)
+            {
+                if (rx_aead_buf_.size() < payload_len)
+                {
+                    rx_aead_buf_.resize(payload_len);
+                }
+                decrypted = rx_aead_buf_.data();
+            }
+            if (open_aead(info.topic_ID, frame, v2_header_len, data, decrypted, payload_len) < 0)
+            {
+                return -EBADMSG;
+            }
+            data = decrypted;
+        }
+        else
+        {
+            uint32_t calc_crc = info.crc32c ? crc32c_engine_.update(0, data, payload_len) : crc16(data, payload_len);
+            if (info.crc != calc_crc)
+            {
+                ROS2_SERIAL_LOG(WARN, "BAD CRC %u != %u", info.crc, calc_crc);
+                metrics_.drop(Metrics::Direction::RX, info.topic_ID, Metrics::Drop::CRC);
+                return -EBADMSG;
+            }
+        }
+        ROS2_SERIAL_TRACEPOINT(crc_verified, this, info.topic_ID, payload_len);
+        metrics_.sequence(info.topic_ID, info.seq);
+        rx_seq_ = info.seq;
+
+        if (info.fragment)
+        {
+            ssize_t len = reassemble_fragment(info.topic_ID, data, payload_len, out_buffer, buffer_len, payload);
+            if (len >= 0)
+            {
+                *topic_ID = info.topic_ID;
+            }
+            return len;
+        }
+
+        if (info.ack || info.reliable)
+        {
+            ssize_t prefix_len = receive_reliable(info.topic_ID, info.ack, info.reliable, data, payload_len);
+            if (prefix_len < 0)
+            {
+                if (prefix_len == -EBADMSG)
+                {
+                    metrics_.drop(Metrics::Direction::RX, info.topic_ID, Metrics::Drop::DECODE);
+                }
+                return prefix_len;
+            }
+            data += prefix_len;
+            payload_len -= prefix_len;
+        }
+
+        const uint8_t *decoded;
+        ssize_t len = decode_v2_payload(info.topic_ID, info.compressed, info.delta_base, info.delta, data,
+                                        payload_len, out_buffer, buffer_len, &decoded);
+        if (len < 0)
+        {
+            metrics_.drop(Metrics::Direction::RX, info.topic_ID,
+                          len == -EMSGSIZE ? Metrics::Drop::OVERSIZE : Metrics::Drop::DECODE);
+            return len;
+        }
+        if (decoded != out_buffer && len > 0)
+        {
+            ::memcpy(out_buffer, decoded, len);
+        }
+
+        *topic_ID = info.topic_ID;
+        if (payload != nullptr)
+        {
+            *payload = out_buffer;
+        }
+
+        return len;
+    }
+    else if (backend_protocol_ == SerialProtocol::COBS || backend_protocol_ == SerialProtocol::COBS_ZPE)
+    {
+        // The frame must end with the 0 end-of-packet marker, and must not
+        // have any other 0 in it.
+        if (frame_len == 0 || frame[frame_len - 1] != 0 || ::memchr(frame, 0, frame_len - 1) != nullptr)
+        {
+            metrics_.garbage(frame_len);
+            return -EBADMSG;
+        }
+
+        const uint8_t *spans[1] = {frame};
+        size_t span_lens[1] = {frame_len - 1};
+
+        COBSHeader header{};
+        COBSUnstuffOutput unstuff_out{reinterpret_cast<uint8_t *>(&header), header_len, out_buffer, buffer_len, 0};
+        size_t unstuffed_size = cobs_unstuff_spans(spans, span_lens, 1, &unstuff_out,
+                                                   backend_protocol_ == SerialProtocol::COBS_ZPE);
+
+        if (unstuffed_size < header_len)
+        {
+            metrics_.garbage(frame_len);
+            return -EBADMSG;
+        }
+
+        payload_len = static_cast<uint16_t>(static_cast<uint16_t>(header.payload_len_h) << 8U) | header.payload_len_l;
+        if ((unstuffed_size - header_len) != payload_len)
+        {
+            metrics_.garbage(frame_len);
+            return -EBADMSG;
+        }
+
+        if (buffer_len < payload_len)
+        {
+            metrics_.drop(Metrics::Direction::RX, header.topic_ID, Metrics::Drop::OVERSIZE);
+            return -EMSGSIZE;
+        }
+
+        read_crc = static_cast<uint16_t>(static_cast<uint16_t>(header.crc_h) << 8U) | header.crc_l;
+        frame_topic_ID = header.topic_ID;
+    }
+    else
+    {
+        throw std::runtime_error("Bad protocol");
+    }
+
+    uint16_t calc_crc = crc16(out_buffer, payload_len);
+    if (read_crc != calc_crc)
+    {
+        ROS2_SERIAL_LOG(WARN, "BAD CRC %u != %u", read_crc, calc_crc);
+        metrics_.drop(Metrics::Direction::RX, frame_topic_ID, Metrics::Drop::CRC);
+        return -EBADMSG;
+    }
+    ROS2_SERIAL_TRACEPOINT(crc_verified, this, frame_topic_ID, payload_len);
+    if (frame_seq >= 0)
+    {
+        metrics_.sequence(frame_topic_ID, static_cast<uint8_t>(frame_seq));
+        rx_seq_ = frame_seq;
+    }
+
+    *topic_ID = frame_topic_ID;
+    if (payload != nullptr)
+    {
+        *payload = out_buffer;
+    }
+
+    return payload_len;
+}
+
+ssize_t Transporter::read(topic_id_size_t *topic_ID, uint8_t *out_buffer, size_t buffer_len)
+{
+    if (nullptr == out_buffer || nullptr == topic_ID || !fds_OK())
+    {
+        return -1;
+    }
+
+    size_t header_len = get_header_length();
+
+    *topic_ID = std::numeric_limits<topic_id_size_t>::max();
+
+    // The rest of a bundle goes out before anything new is read.
+    if (rx_bundle_pos_ < rx_bundle_.size())
+    {
+        return read_bundled(topic_ID, out_buffer, buffer_len);
+    }
+
+    if (whole_messages_)
+    {
+        ssize_t len = node_read_message(topic_ID, out_buffer, buffer_len);
+        if (len >= 0)
+        {
+            metrics_.message(Metrics::Direction::RX, *topic_ID, len);
+        }
+        else if (len != -ENODATA)
+        {
+            metrics_.read_error();
+        }
+        return unbundle_read(topic_ID, out_buffer, buffer_len, len);
+    }
+
+    if (ringbuf_.bytes_used() >= header_len)
+    {
+        ssize_t len = find_and_copy_message(topic_ID, out_buffer, buffer_len);
+        if (len >= 0)
+        {
+            estimate_rx_time();
+            metrics_.message(Metrics::Direction::RX, *topic_ID, len);
+            return unbundle_read(topic_ID, out_buffer, buffer_len, len);
+        }
+    }
+
+    rx_arrival_time_ = std::chrono::system_clock::time_point();
+    ssize_t len = node_read();
+    if (len > 0)
+    {
+        stamp_rx_read();
+        capture_rx(static_cast<size_t>(len));
+    }
+    ROS2_SERIAL_TRACEPOINT(node_read, this, len, tracing::stamp_ns(rx_time_));
+    if (len < 0)
+    {
+        if (errno != 0 && errno != EAGAIN && errno != ETIMEDOUT)
+        {
+            ROS2_SERIAL_LOG(WARN, "Read fail %d", errno);
+            metrics_.read_error();
+        }
+
+        return len;
+    }
+    if (len == 0)
+    {
+        // No data returned, just return -ENODATA
+        return -ENODATA;
+    }
+    metrics_.set_ring_overflow_bytes(ringbuf_.get_overflowed_bytes());
+    metrics_.set_ring_overflows(ringbuf_.get_overflows());
+    metrics_.set_ring_buffer_usage(ringbuf_.capacity(), ringbuf_.get_high_water());
+
+    if (ringbuf_.bytes_used() >= header_len)
+    {
+        ssize_t len = find_and_copy_message(topic_ID, out_buffer, buffer_len);
+        if (len >= 0)
+        {
+            metrics_.message(Metrics::Direction::RX, *topic_ID, len);
+            return unbundle_read(topic_ID, out_buffer, buffer_len, len);
+        }
+    }
+
+    return -ENODATA;
+}
+
+ssize_t Transporter::unbundle_read(topic_id_size_t *topic_ID, uint8_t *out_buffer, size_t buffer_len, ssize_t len)
+{
+    if (len < 0 || bundle_topic_ID_ == 0 || *topic_ID != bundle_topic_ID_)
+    {
+        return len;
+    }
+
+    // The payloads are handed out of a copy of the bundle, since out_buffer
+    // is where each of them is copied to.
+    rx_bundle_.assign(out_buffer, out_buffer + len);
+    rx_bundle_pos_ = 0;
+
+    return read_bundled(topic_ID, out_buffer, buffer_len);
+}
+
+ssize_t Transporter::read_bundled(topic_id_size_t *topic_ID, uint8_t *out_buffer, size_t buffer_len)
+{
+    size_t record_len = 0;
+    ssize_t header_len = -1;
+    if (rx_bundle_pos_ < rx_bundle_.size())
+    {
+        header_len = parse_bundle_record(rx_bundle_.data() + rx_bundle_pos_, rx_bundle_.size() - rx_bundle_pos_,
+                                         fixed_lengths_, topic_ID, &record_len);
+        if (header_len < 0)
+        {
+            metrics_.drop(Metrics::Direction::RX, bundle_topic_ID_, Metrics::Drop::DECODE);
+        }
+    }
+    if (header_len < 0)
+    {
+        rx_bundle_.clear();
+        rx_bundle_pos_ = 0;
+        *topic_ID = std::numeric_limits<topic_id_size_t>::max();
+        return -ENODATA;
+    }
+
+    const uint8_t *record = rx_bundle_.data() + rx_bundle_pos_ + header_len;
+    rx_bundle_pos_ += header_len + record_len;
+    if (record_len > buffer_len)
+    {
+        return -1;
+    }
+    ::memcpy(out_buffer, record, record_len);
+    metrics_.message(Metrics::Direction::RX, *topic_ID, record_len);
+
+    return record_len;
+}
+
+size_t Transporter::visit_message(topic_id_size_t topic_ID, uint8_t *payload, size_t len,
+                                  const MessageVisitor & visitor)
+{
+    metrics_.message(Metrics::Direction::RX, topic_ID, len);
+    if (bundle_topic_ID_ == 0 || topic_ID != bundle_topic_ID_)
+    {
+        visitor(topic_ID, payload, len);
+        return 1;
+    }
+
+    // The payloads of a bundle are handed to the visitor in place.
+    size_t nmessages = 0;
+    size_t pos = 0;
+    while (pos < len)
+    {
+        topic_id_size_t record_topic_ID;
+        size_t record_len;
+        ssize_t header_len = parse_bundle_record(payload + pos, len - pos, fixed_lengths_, &record_topic_ID,
+                                                 &record_len);
+        if (header_len < 0)
+        {
+            // The frame passed its CRC, so the sender bundles differently;
+            // nothing after this can be trusted.
+            metrics_.drop(Metrics::Direction::RX, topic_ID, Metrics::Drop::DECODE);
+            break;
+        }
+        pos += header_len;
+        metrics_.message(Metrics::Direction::RX, record_topic_ID, record_len);
+        visitor(record_topic_ID, payload + pos, record_len);
+        pos += record_len;
+        nmessages++;
+    }
+
+    return nmessages;
+}
+
+template<typename Framing>
+size_t Transporter::drain_ring_framed(uint8_t *out_buffer, size_t buffer_len, const MessageVisitor & visitor)
+{
+    constexpr size_t header_len = Framing::HEADER_LEN;
+    size_t nmessages = 0;
+
+    while (ringbuf_.bytes_used() >= header_len)
+    {
+        size_t used_before = ringbuf_.bytes_used();
+        topic_id_size_t topic_ID = std::numeric_limits<topic_id_size_t>::max();
+
+        // The visitor runs before anything else is added to the ring, so the
+        // payload can be handed to it straight out of the ring.
+        uint8_t *payload = out_buffer;
+        ssize_t len = Framing::find(this, &topic_ID, out_buffer, buffer_len, &payload);
+        if (len >= 0)
+        {
+            estimate_rx_time();
+            nmessages += visit_message(topic_ID, payload, len, visitor);
+        }
+        else if (ringbuf_.bytes_used() == used_before)
+        {
+            // Nothing was consumed, so there are no more complete messages.
+            break;
+        }
+
+        // Otherwise a bad message was dropped from the ring; keep going since
+        // there may be good ones behind it.
+    }
+
+    return nmessages;
+}
+
+size_t Transporter::drain_ring(uint8_t *out_buffer, size_t buffer_len, const MessageVisitor & visitor)
+{
+    // The protocol is looked at once per call rather than once per message,
+    // and the loop for each protocol calls its parser directly.
+    switch (backend_protocol_)
+    {
+    case SerialProtocol::PX4:
+        return drain_ring_framed<PX4Framing>(out_buffer, buffer_len, visitor);
+    case SerialProtocol::V2:
+        return drain_ring_framed<V2Framing>(out_buffer, buffer_len, visitor);
+    case SerialProtocol::COBS:
+        return drain_ring_framed<COBSFraming>(out_buffer, buffer_len, visitor);
+    case SerialProtocol::COBS_ZPE:
+        return drain_ring_framed<COBSZPEFraming>(out_buffer, buffer_len, visitor);
+    }
+
+    throw std::runtime_error("Bad protocol");
+}
+
+ssize_t Transporter::read_many(uint8_t *out_buffer, size_t buffer_len, const MessageVisitor & visitor)
+{
+    if (nullptr == out_buffer || !visitor || !fds_OK())
+    {
+        return -1;
+    }
+
+    if (whole_messages_)
+    {
+        size_t delivered = 0;
+        ssize_t nmessages = node_read_messages(out_buffer, buffer_len,
+                                               [&](topic_id_size_t topic_ID, uint8_t *payload, size_t payload_len) {
+            delivered += visit_message(topic_ID, payload, payload_len, visitor);
+        });
+        if (nmessages < 0)
+        {
+            if (errno != 0 && errno != EAGAIN && errno != ETIMEDOUT)
+            {
+                ROS2_SERIAL_LOG(WARN, "Read fail %d", errno);
+                metrics_.read_error();
+            }
+
+            return nmessages;
+        }
+
+        return delivered;
+    }
+
+    size_t nmessages = drain_ring(out_buffer, buffer_len, visitor);
+    if (nmessages > 0)
+    {
+        return nmessages;
+    }
+
+    ssize_t len;
+    if (datagram_frames_)
+    {
+        // All of the frames handed over by one call were received together,
+        // so they all get the time the first one was handed over, unless the
+        // transport says when each of them arrived.
+        bool stamped = false;
+        rx_arrival_time_ = std::chrono::system_clock::time_point();
+        len = node_read_frames([&](const uint8_t *frame, size_t frame_len) {
+            if (!stamped)
+            {
+                rx_read_time_ = std::chrono::system_clock::now();
+            }
+            rx_time_ = rx_arrival_time_ != std::chrono::system_clock::time_point() ? rx_arrival_time_ : rx_read_time_;
+            if (!stamped)
+            {
+                ROS2_SERIAL_TRACEPOINT(node_read, this, frame_len, tracing::stamp_ns(rx_time_));
+                stamped = true;
+            }
+            capture(LinkCapture::Direction::RX, frame, frame_len);
+            topic_id_size_t topic_ID = std::numeric_limits<topic_id_size_t>::max();
+            uint8_t *payload = out_buffer;
+            ssize_t payload_len = copy_message_from_frame(frame, frame_len, &topic_ID, out_buffer, buffer_len,
+                                                          &payload);
+            if (payload_len >= 0)
+            {
+                nmessages += visit_message(topic_ID, payload, payload_len, visitor);
+            }
+        });
+    }
+    else
+    {
+        rx_arrival_time_ = std::chrono::system_clock::time_point();
+        len = node_read();
+        if (len > 0)
+        {
+            stamp_rx_read();
+            capture_rx(static_cast<size_t>(len));
+        }
+        ROS2_SERIAL_TRACEPOINT(node_read, this, len, tracing::stamp_ns(rx_time_));
+    }
+
+    if (len < 0)
+    {
+        if (errno != 0 && errno != EAGAIN && errno != ETIMEDOUT)
+        {
+            ROS2_SERIAL_LOG(WARN, "Read fail %d", errno);
+            metrics_.read_error();
+        }
+
+        return len;
+    }
+
+    if (datagram_frames_ || len == 0)
+    {
+        return nmessages;
+    }
+    metrics_.set_ring_overflow_bytes(ringbuf_.get_overflowed_bytes());
+    metrics_.set_ring_overflows(ringbuf_.get_overflows());
+    metrics_.set_ring_buffer_usage(ringbuf_.capacity(), ringbuf_.get_high_water());
+
+    return drain_ring(out_buffer, buffer_len, visitor);
+}
+
+int Transporter::wait_writable(int fd, std::chrono::steady_clock::time_point deadline)
+{
+    while (true)
+    {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (now >= deadline)
+        {
+            errno = EBUSY;
+            return -1;
+        }
+
+        // Round up, so this doesn't turn into a busy loop for the last
+        // fraction of a millisecond.
+        int left_ms = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count()) + 1;
+
+        struct pollfd pfd{};
+        pfd.fd = fd;
+        pfd.events = POLLOUT;
+        int r = ::poll(&pfd, 1, left_ms);
+        if (r < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        if (r > 0)
+        {
+            if ((pfd.revents & (POLLERR | POLLNVAL)) != 0)
+            {
+                errno = EIO;
+                return -1;
+            }
+            return 0;
+        }
+    }
+}
+
+ssize_t Transporter::node_read_frames(const FrameVisitor & visitor)
+{
+    (void)visitor;
+
+    errno = ENOTSUP;
+
+    return -1;
+}
+
+ssize_t Transporter::node_read_message(topic_id_size_t *topic_ID, uint8_t *out_buffer, size_t buffer_len)
+{
+    (void)topic_ID;
+    (void)out_buffer;
+    (void)buffer_len;
+
+    errno = ENOTSUP;
+
+    return -1;
+}
+
+ssize_t Transporter::node_read_messages(uint8_t *out_buffer, size_t buffer_len, const MessageVisitor & visitor)
+{
+    (void)out_buffer;
+    (void)buffer_len;
+    (void)visitor;
+
+    errno = ENOTSUP;
+
+    return -1;
+}
+
+ssize_t Transporter::node_write_frames(const struct iovec *frames, const topic_id_size_t *topic_IDs, size_t count)
+{
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    if (!datagram_frames_)
+    {
+        // The frames are contiguous, so they can all go out in one go.
+        size_t len = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            len += frames[i].iov_len;
+        }
+
+        return node_write(frames[0].iov_base, len);
+    }
+
+    size_t total = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        write_topic_ID_ = topic_IDs[i];
+        ssize_t ret = node_write(frames[i].iov_base, frames[i].iov_len);
+        if (ret < 0)
+        {
+            return -1;
+        }
+        total += ret;
+    }
+
+    return total;
+}
+
+size_t Transporter::get_header_length()
+{
+    switch (backend_protocol_)
+    {
+    case SerialProtocol::PX4:
+        return PX4Framing::HEADER_LEN;
+    case SerialProtocol::COBS:
+        return COBSFraming::HEADER_LEN;
+    case SerialProtocol::COBS_ZPE:
+        return COBSZPEFraming::HEADER_LEN;
+    case SerialProtocol::V2:
+        return V2Framing::HEADER_LEN;
+    }
+
+    throw std::runtime_error("Unknown protocol");
+}
+
+topic_id_size_t Transporter::get_max_topic_ID() const
+{
+    if (backend_protocol_ == SerialProtocol::V2)
+    {
+        return std::numeric_limits<topic_id_size_t>::max();
+    }
+
+    // The PX4 and COBS headers only have a single byte for the topic ID.
+    return std::numeric_limits<uint8_t>::max();
+}
+
+int Transporter::set_protocol(const std::string & protocol)
+{
+    SerialProtocol new_protocol;
+    if (!parse_protocol(protocol, &new_protocol))
+    {
+        return -1;
+    }
+
+    std::lock_guard<std::mutex> lock(write_mutex_);
+
+    if (new_protocol != SerialProtocol::V2 &&
+        (crc32c_ || !compression_.empty() || !delta_tx_.empty() || fragment_size_ > 0 || !reliable_tx_.empty() ||
+         fec_ || aead_ != nullptr))
+    {
+        return -1;
+    }
+
+    if (flush_locked() < 0)
+    {
+        return -1;
+    }
+
+    backend_protocol_ = new_protocol;
+
+    // The new protocol may have a shorter header, so there may be room for
+    // more frames in a batch, and a larger worst case for a whole frame.
+    if (batch_size_ > 0)
+    {
+        batch_frames_.reserve(batch_size_ / get_header_length() + 1);
+        batch_topic_IDs_.reserve(batch_frames_.capacity());
+    }
+    size_t max_data_plus_header = get_header_length() + std::numeric_limits<uint16_t>::max();
+    reserve_frame_buf(impl::COBSEncoder::max_encoded_length(max_data_plus_header) + 1);
+
+    // Whatever is left in the ring was framed with the old protocol, and
+    // the delta bases and fragments were sent with it.
+    ringbuf_.discard(ringbuf_.bytes_used());
+    delta_rx_.clear();
+    for (Reassembly & r : reassemblies_)
+    {
+        r.active = false;
+    }
+    std::lock_guard<std::mutex> reliable_lock(reliable_mutex_);
+    for (auto & rx : reliable_rx_)
+    {
+        rx.second = ReliableRx();
+    }
+    acks_pending_ = false;
+
+    return 0;
+}
+
+std::string Transporter::get_protocol() const
+{
+    if (backend_protocol_ == SerialProtocol::COBS)
+    {
+        return "cobs";
+    }
+    else if (backend_protocol_ == SerialProtocol::COBS_ZPE)
+    {
+        return "cobs_zpe";
+    }
+    else if (backend_protocol_ == SerialProtocol::V2)
+    {
+        return "v2";
+    }
+
+    return "px4";
+}
+
+int Transporter::set_crc32c(bool enable)
+{
+    if (backend_protocol_ != SerialProtocol::V2)
+    {
+        return -1;
+    }
+
+    crc32c_ = enable;
+
+    return 0;
+}
+
+int Transporter::set_fec(bool enable)
+{
+    if (backend_protocol_ != SerialProtocol::V2)
+    {
+        return -1;
+    }
+
+    fec_ = enable;
+
+    return 0;
+}
+
+int Transporter::set_aead_key(const std::vector<uint8_t> & key, unsigned int side)
+{
+    if (backend_protocol_ != SerialProtocol::V2 || key.size() != impl::ChaCha20Poly1305::KEY_LEN || side > 1)
+    {
+        return -1;
+    }
+
+    aead_ = std::make_unique<impl::ChaCha20Poly1305>(key.data());
+    aead_side_ = side == 0 ? 0 : AEAD_SIDE_BIT;
+
+    // Counting the nonces up from the wall clock time in nanoseconds means
+    // that they never repeat when the bridge is restarted with the same
+    // key, since no link sends a frame every nanosecond.
+    uint64_t now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    aead_tx_nonce_ = aead_side_ | (now_ns & ~AEAD_SIDE_BIT);
+    aead_rx_highest_ = 0;
+    aead_rx_seen_ = 0;
+
+    return 0;
+}
+
+int Transporter::open_aead(topic_id_size_t topic_ID, const uint8_t *header, size_t header_len, const uint8_t *in,
+                           uint8_t *out, size_t len)
+{
+    constexpr size_t tag_len = impl::ChaCha20Poly1305::TAG_LEN;
+    uint64_t nonce = get_be64(header + header_len - V2_AEAD_TRAILER_LEN);
+
+    // Frames from this side of the link are ones an attacker sent back, and
+    // frames whose nonce was already seen are replays.
+    uint64_t behind = aead_rx_highest_ - nonce;
+    if ((nonce & AEAD_SIDE_BIT) == aead_side_ ||
+        (nonce <= aead_rx_highest_ &&
+         (behind >= AEAD_REPLAY_WINDOW || (aead_rx_seen_ & (1ULL << behind)) != 0)))
+    {
+        ROS2_SERIAL_LOG(WARN, "REPLAYED FRAME for topic %u", topic_ID);
+        metrics_.drop(Metrics::Direction::RX, topic_ID, Metrics::Drop::CRC);
+        return -EBADMSG;
+    }
+
+    std::array<uint8_t, impl::ChaCha20Poly1305::NONCE_LEN> full_nonce{};
+    put_be64(&full_nonce[full_nonce.size() - V2_AEAD_NONCE_LEN], nonce);
+    if (!aead_->open(&full_nonce[0], header, header_len - tag_len, in, len, out, header + header_len - tag_len))
+    {
+        ROS2_SERIAL_LOG(WARN, "BAD TAG for topic %u", topic_ID);
+        metrics_.drop(Metrics::Direction::RX, topic_ID, Metrics::Drop::CRC);
+        return -EBADMSG;
+    }
+
+    // Only a frame that is genuine moves the window on.
+    if (nonce > aead_rx_highest_)
+    {
+        uint64_t ahead = nonce - aead_rx_highest_;
+        aead_rx_seen_ = ahead >= AEAD_REPLAY_WINDOW ? 0 : aead_rx_seen_ << ahead;
+        aead_rx_seen_ |= 1;
+        aead_rx_highest_ = nonce;
+    }
+    else
+    {
+        aead_rx_seen_ |= 1ULL << behind;
+    }
+
+    return 0;
+}
+
+int Transporter::set_compression(topic_id_size_t topic_ID, size_t threshold, const std::vector<uint8_t> & dictionary)
+{
+    if (backend_protocol_ != SerialProtocol::V2)
+    {
+        return -1;
+    }
+
+    TopicCompression & compression = compression_[topic_ID];
+    compression.threshold = threshold;
+    compression.codec = std::make_unique<impl::LZ4Codec>(dictionary);
+
+    return 0;
+}
+
+ssize_t Transporter::decompress_payload(topic_id_size_t topic_ID, const uint8_t *data, size_t len,
+                                        uint8_t *out_buffer, size_t buffer_len) const
+{
+    auto it = compression_.find(topic_ID);
+    const impl::LZ4Codec & codec = (it != compression_.end()) ? *it->second.codec : default_codec_;
+
+    ssize_t out_len = codec.decompress(data, len, out_buffer, buffer_len);
+    if (out_len < 0)
+    {
+        ROS2_SERIAL_LOG(WARN, "BAD COMPRESSED PAYLOAD for topic %u", topic_ID);
+        return -EBADMSG;
+    }
+
+    return out_len;
+}
+
+int Transporter::set_delta_encoding(topic_id_size_t topic_ID, uint32_t keyframe_interval)
+{
+    if (backend_protocol_ != SerialProtocol::V2 || keyframe_interval == 0)
+    {
+        return -1;
+    }
+
+    TopicDelta & delta = delta_tx_[topic_ID];
+    delta.keyframe_interval = keyframe_interval;
+    delta.since_keyframe = 0;
+    delta.have_last = false;
+
+    return 0;
+}
+
+int Transporter::set_fragment_size(size_t fragment_size)
+{
+    if (backend_protocol_ != SerialProtocol::V2 || (fragment_size > 0 && fragment_size <= FRAGMENT_MAX_HEADER_LEN))
+    {
+        return -1;
+    }
+
+    fragment_size_ = fragment_size;
+
+    return 0;
+}
+
+int Transporter::set_reliable(topic_id_size_t topic_ID)
+{
+    if (backend_protocol_ != SerialProtocol::V2)
+    {
+        return -1;
+    }
+
+    std::lock_guard<std::mutex> lock(reliable_mutex_);
+
+    if (reliable_tx_.count(topic_ID) != 0)
+    {
+        return 0;
+    }
+
+    // The receiver takes a new session to mean that the numbering started
+    // over, so that the first payloads after a restart aren't taken for
+    // ones it already has; starting the numbering anywhere makes that even
+    // less likely when the session happens to be the same as last time.
+    std::random_device random;
+    ReliableTx & tx = reliable_tx_[topic_ID];
+    tx.session = static_cast<uint8_t>(random());
+    tx.next_seq = static_cast<uint8_t>(random());
+    tx.rto = RELIABLE_INITIAL_RTO;
+
+    return 0;
+}
+
+void Transporter::reserve_buffers(size_t max_payload, const std::vector<topic_id_size_t> & rx_topic_IDs)
+{
+    // The write side only grows its buffers to one byte less than the
+    // payload, since anything that doesn't shrink is sent as it was.
+    compress_buf_.reserve(max_payload);
+    delta_buf_.reserve(max_payload);
+    for (auto & delta : delta_tx_)
+    {
+        delta.second.last.reserve(max_payload);
+        delta.second.pending.reserve(max_payload);
+    }
+
+    rx_compressed_buf_.reserve(max_payload);
+    rx_delta_buf_.reserve(max_payload);
+    if (backend_protocol_ == SerialProtocol::V2)
+    {
+        // A frame can carry a fragment or reliable header as well as the
+        // payload, and parity on top of that.
+        size_t max_frame_payload = max_payload + std::max(FRAGMENT_MAX_HEADER_LEN,
+                                                          RELIABLE_MAX_ACK_LEN + RELIABLE_HEADER_LEN);
+        if (fec_)
+        {
+            fec_buf_.reserve(impl::ReedSolomon::encoded_length(max_frame_payload));
+        }
+        rx_fec_buf_.reserve(impl::ReedSolomon::encoded_length(max_frame_payload));
+
+        for (topic_id_size_t topic_ID : rx_topic_IDs)
+        {
+            delta_rx_[topic_ID].data.reserve(max_payload);
+        }
+
+        // Each topic reassembles at most one payload at a time, and the
+        // reassemblies that are free are always taken in order.
+        for (size_t i = 0; i < std::min(rx_topic_IDs.size(), reassemblies_.size()); ++i)
+        {
+            reassemblies_[i].data.reserve(max_payload);
+        }
+
+        std::lock_guard<std::mutex> lock(reliable_mutex_);
+        for (topic_id_size_t topic_ID : rx_topic_IDs)
+        {
+            reliable_rx_[topic_ID];
+        }
+        for (auto & tx : reliable_tx_)
+        {
+            for (ReliableFrame & frame : tx.second.window)
+            {
+                frame.payload.reserve(RELIABLE_HEADER_LEN + max_payload);
+            }
+        }
+    }
+}
+
+void Transporter::set_rx_max_payloads(const std::map<topic_id_size_t, size_t> & max_payloads)
+{
+    for (size_t i = 0; i < rx_max_payload_.size(); ++i)
+    {
+        auto it = max_payloads.find(static_cast<topic_id_size_t>(i));
+        size_t max_payload = it == max_payloads.end() ? 0 : std::min<size_t>(it->second, UINT32_MAX);
+        rx_max_payload_[i].store(static_cast<uint32_t>(max_payload), std::memory_order_relaxed);
+    }
+}
+
+int Transporter::set_capture(const std::string & path)
+{
+    if (path.empty())
+    {
+        capture_.reset();
+        return 0;
+    }
+
+    auto capture = std::make_unique<LinkCapture>();
+    if (!capture->open(path, get_protocol()))
+    {
+        return -1;
+    }
+    capture_ = std::move(capture);
+
+    return 0;
+}
+
+int Transporter::set_flight_recorder(size_t size)
+{
+    if (size == 0)
+    {
+        flight_recorder_.reset();
+        return 0;
+    }
+
+    try
+    {
+        flight_recorder_ = std::make_unique<FlightRecorder>(size);
+    }
+    catch (const std::runtime_error & err)
+    {
+        ::fprintf(stderr, "%s\n", err.what());
+        return -1;
+    }
+
+    return 0;
+}
+
+int Transporter::dump_flight_recorder(const std::string & path)
+{
+    if (flight_recorder_ == nullptr || !flight_recorder_->dump(path, get_protocol()))
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+void Transporter::stamp_rx_read()
+{
+    rx_read_time_ = rx_arrival_time_ != std::chrono::system_clock::time_point() ? rx_arrival_time_ :
+                                                                                 std::chrono::system_clock::now();
+    rx_time_ = rx_read_time_;
+}
+
+void Transporter::capture_rx(size_t len)
+{
+    if (capture_ == nullptr && flight_recorder_ == nullptr)
+    {
+        return;
+    }
+
+    // The new data is at the head of the ring, after whatever was already
+    // there; if the ring overflowed, only what is left of it is captured.
+    size_t used = ringbuf_.bytes_used();
+    len = std::min(len, used);
+    const uint8_t *first;
+    const uint8_t *second;
+    size_t first_len;
+    size_t second_len;
+    if (len == 0 || ringbuf_.peek_spans(used, &first, &first_len, &second, &second_len) < 0)
+    {
+        return;
+    }
+
+    size_t skip = used - len;
+    struct iovec iov[2];
+    int iovcnt = 0;
+    if (skip < first_len)
+    {
+        iov[iovcnt++] = {const_cast<uint8_t *>(first + skip), first_len - skip};
+        skip = 0;
+    }
+    else
+    {
+        skip -= first_len;
+    }
+    if (second_len > skip)
+    {
+        iov[iovcnt++] = {const_cast<uint8_t *>(second + skip), second_len - skip};
+    }
+    capture(LinkCapture::Direction::RX, iov, iovcnt);
+}
+
+void Transporter::capture(LinkCapture::Direction direction, const struct iovec *iov, int iovcnt)
+{
+    if (capture_ != nullptr)
+    {
+        capture_->append(direction, iov, iovcnt);
+    }
+    if (flight_recorder_ != nullptr)
+    {
+        flight_recorder_->append(direction, iov, iovcnt);
+    }
+}
+
+void Transporter::capture(LinkCapture::Direction direction, const void *data, size_t length)
+{
+    struct iovec iov{const_cast<void *>(data), length};
+    capture(direction, &iov, 1);
+}
+
+ssize_t Transporter::correct_fec(topic_id_size_t topic_ID, uint8_t *data, size_t len)
+{
+    size_t corrected = 0;
+    ssize_t data_len = impl::ReedSolomon::decode(data, len, &corrected);
+    if (data_len < 0)
+    {
+        ROS2_SERIAL_LOG(WARN, "UNCORRECTABLE FEC PAYLOAD for topic %u", topic_ID);
+        metrics_.drop(Metrics::Direction::RX, topic_ID, Metrics::Drop::CRC);
+        return -EBADMSG;
+    }
+    if (corrected > 0)
+    {
+        metrics_.corrected(topic_ID, corrected);
+    }
+
+    return data_len;
+}
+
+ssize_t Transporter::decode_v2_payload(topic_id_size_t topic_ID, bool compressed, bool delta_base, bool delta,
+                                       const uint8_t *data, size_t len, uint8_t *out_buffer, size_t buffer_len,
+                                       const uint8_t **payload)
+{
+    if (compressed)
+    {
+        // A delta is only an intermediate result, so it is decompressed
+        // somewhere other than out_buffer.
+        uint8_t *dst = out_buffer;
+        if (delta)
+        {
+            if (rx_delta_buf_.size() < buffer_len)
+            {
+                rx_delta_buf_.resize(buffer_len);
+            }
+            dst = rx_delta_buf_.data();
+        }
+        ssize_t decompressed_len = decompress_payload(topic_ID, data, len, dst, buffer_len);
+        if (decompressed_len < 0)
+        {
+            return decompressed_len;
+        }
+        data = dst;
+        len = decompressed_len;
+    }
+
+    if (delta)
+    {
+        // The delta must be against the last payload of the topic that we
+        // have; if it isn't, a frame was lost and the topic can't be decoded
+        // until the next delta base comes along.
+        auto it = delta_rx_.find(topic_ID);
+        if (it == delta_rx_.end() || !it->second.valid)
+        {
+            ROS2_SERIAL_LOG(WARN, "DELTA WITHOUT BASE for topic %u", topic_ID);
+            return -EBADMSG;
+        }
+        DeltaBase & base = it->second;
+        uint16_t base_crc = (len < DELTA_HEADER_LEN) ? 0 : static_cast<uint16_t>(static_cast<uint16_t>(data[0]) << 8U) | data[1];
+        if (len < DELTA_HEADER_LEN || base_crc != base.crc)
+        {
+            ROS2_SERIAL_LOG(WARN, "DELTA BASE MISMATCH for topic %u", topic_ID);
+            base.valid = false;
+            return -EBADMSG;
+        }
+        if (base.data.size() > buffer_len)
+        {
+            return -EMSGSIZE;
+        }
+        if (delta_apply(data + DELTA_HEADER_LEN, len - DELTA_HEADER_LEN, base.data.data(), base.data.size()) < 0)
+        {
+            ROS2_SERIAL_LOG(WARN, "BAD DELTA for topic %u", topic_ID);
+            base.valid = false;
+            return -EBADMSG;
+        }
+        base.crc = crc16(base.data.data(), base.data.size());
+
+        if (!base.data.empty())
+        {
+            ::memcpy(out_buffer, base.data.data(), base.data.size());
+        }
+        *payload = out_buffer;
+
+        return base.data.size();
+    }
+
+    if (delta_base)
+    {
+        DeltaBase & base = delta_rx_[topic_ID];
+        base.data.assign(data, data + len);
+        base.crc = crc16(data, len);
+        base.valid = true;
+    }
+
+    *payload = (compressed) ? out_buffer : data;
+
+    return len;
+}
+
+ssize_t Transporter::reassemble_fragment(topic_id_size_t topic_ID, const uint8_t *data, size_t len,
+                                         uint8_t *out_buffer, size_t buffer_len, uint8_t **payload)
+{
+    uint32_t message_ID;
+    uint32_t total_len;
+    uint32_t offset;
+    size_t pos = 0;
+    ssize_t varint_len = get_varint(data, len, 5, &message_ID);
+    if (varint_len > 0)
+    {
+        pos += varint_len;
+        varint_len = get_varint(data + pos, len - pos, 5, &total_len);
+    }
+    if (varint_len > 0)
+    {
+        pos += varint_len;
+        varint_len = get_varint(data + pos, len - pos, 5, &offset);
+    }
+    if (varint_len <= 0 || offset > total_len || len - pos - varint_len > total_len - offset)
+    {
+        ROS2_SERIAL_LOG(WARN, "BAD FRAGMENT for topic %u", topic_ID);
+        metrics_.drop(Metrics::Direction::RX, topic_ID, Metrics::Drop::DECODE);
+        return -EBADMSG;
+    }
+    pos += varint_len;
+    size_t chunk_len = len - pos;
+
+    Reassembly *r = nullptr;
+    for (Reassembly & candidate : reassemblies_)
+    {
+        if (candidate.active && candidate.topic_ID == topic_ID)
+        {
+            r = &candidate;
+            break;
+        }
+    }
+
+    if (r != nullptr && (r->message_ID != message_ID || r->received != offset || r->data.size() != total_len))
+    {
+        // A fragment went missing, so the partial payload can never be
+        // completed.
+        metrics_.drop(Metrics::Direction::RX, topic_ID, Metrics::Drop::DECODE);
+        r->active = false;
+        if (offset != 0)
+        {
+            return -EBADMSG;
+        }
+    }
+    else if (r == nullptr && offset != 0)
+    {
+        // We missed the start of this payload.
+        metrics_.drop(Metrics::Direction::RX, topic_ID, Metrics::Drop::DECODE);
+        return -EBADMSG;
+    }
+
+    if (r == nullptr || !r->active)
+    {
+        if (total_len > MAX_FRAGMENTED_PAYLOAD || !rx_payload_plausible(topic_ID, total_len))
+        {
+            metrics_.drop(Metrics::Direction::RX, topic_ID, Metrics::Drop::OVERSIZE);
+            return -EMSGSIZE;
+        }
+
+        if (r == nullptr)
+        {
+            // Take the first free reassembly, or else the one that has gone
+            // the longest without a fragment.
+            r = &reassemblies_[0];
+            for (Reassembly & candidate : reassemblies_)
+            {
+                if (!candidate.active)
+                {
+                    r = &candidate;
+                    break;
+                }
+                if (candidate.last_used < r->last_used)
+                {
+                    r = &candidate;
+                }
+            }
+            if (r->active)
+            {
+                metrics_.drop(Metrics::Direction::RX, r->topic_ID, Metrics::Drop::DECODE);
+            }
+        }
+
+        r->active = true;
+        r->topic_ID = topic_ID;
+        r->message_ID = message_ID;
+        r->received = 0;
+        r->data.resize(total_len);
+    }
+
+    if (chunk_len > 0)
+    {
+        ::memcpy(r->data.data() + r->received, data + pos, chunk_len);
+    }
+    r->received += chunk_len;
+    r->last_used = ++reassembly_clock_;
+
+    if (r->received < r->data.size())
+    {
+        return -EINPROGRESS;
+    }
+
+    // The data stays where it is until the reassembly is taken again, which
+    // is no sooner than the next fragment.
+    r->active = false;
+    if (payload != nullptr)
+    {
+        *payload = r->data.data();
+        return r->data.size();
+    }
+
+    if (r->data.size() > buffer_len)
+    {
+        metrics_.drop(Metrics::Direction::RX, topic_ID, Metrics::Drop::OVERSIZE);
+        return -EMSGSIZE;
+    }
+    if (!r->data.empty())
+    {
+        ::memcpy(out_buffer, r->data.data(), r->data.size());
+    }
+
+    return r->data.size();
+}
+
+uint32_t Transporter::payload_crc(const struct iovec *iov, int iovcnt, bool use_crc32c) const
+{
+    // The tag of a keyed frame checks the payload, so it has no CRC.
+    uint32_t crc = 0;
+    if (aead_ != nullptr)
+    {
+        return crc;
+    }
+
+    for (int i = 0; i < iovcnt; ++i)
+    {
+        const uint8_t *data = static_cast<const uint8_t *>(iov[i].iov_base);
+        if (use_crc32c)
+        {
+            crc = crc32c_engine_.update(crc, data, iov[i].iov_len);
+        }
+        else
+        {
+            crc = crc_engine_.update(static_cast<uint16_t>(crc), data, iov[i].iov_len);
+        }
+    }
+
+    return crc;
+}
+
+void Transporter::reserve_frame_buf(size_t len)
+{
+    if (len <= frame_buf_size_)
+    {
+        return;
+    }
+
+    frame_buf_ = std::unique_ptr<uint8_t[]>(new uint8_t[len]);
+    frame_buf_size_ = len;
+}
+
+ssize_t Transporter::node_writev(const struct iovec *iov, int iovcnt)
+{
+    // Transports that can't do scatter-gather I/O get the buffers gathered
+    // into the frame buffer and written in one go.
+    size_t len = 0;
+    for (int i = 0; i < iovcnt; ++i)
+    {
+        len += iov[i].iov_len;
+    }
+    reserve_frame_buf(len);
+
+    size_t offset = 0;
+    for (int i = 0; i < iovcnt; ++i)
+    {
+        ::memcpy(frame_buf_.get() + offset, iov[i].iov_base, iov[i].iov_len);
+        offset += iov[i].iov_len;
+    }
+
+    return node_write(frame_buf_.get(), offset);
+}
+
+ssize_t Transporter::write(topic_id_size_t topic_ID, uint8_t const *buffer, size_t data_length)
+{
+    // We allow nullptr buffer and 0 length, or non-nullptr buffer and > 0 length,
+    // but not nullptr buffer and > 0 length or non-nullptr buffer and 0 length.
+    if ((buffer == nullptr && data_length > 0) ||
+        (buffer != nullptr && data_length == 0))
+    {
+        return -1;
+    }
+
+    struct iovec iov{const_cast<uint8_t *>(buffer), data_length};
+
+    return writev(topic_ID, &iov, (data_length > 0) ? 1 : 0);
+}
+
+size_t Transporter::encode_cobs_frame(topic_id_size_t topic_ID, const struct iovec *iov, int iovcnt,
+                                      size_t data_length, uint32_t crc, uint8_t *out) const
+{
+    COBSHeader header{};
+
+    // We'll use COBS (https://en.wikipedia.org/wiki/Consistent_Overhead_Byte_Stuffing)
+    // along with a well-known header.  The header and all of the payload
+    // buffers are stuffed in a single pass.
+
+    header.topic_ID = static_cast<uint8_t>(topic_ID);
+    // This is the payload length without the header and before stuffing
+    header.payload_len_h = (data_length >> 8U) & 0xffU;
+    header.payload_len_l = data_length & 0xffU;
+    header.crc_h = static_cast<uint8_t>(crc >> 8U);
+    header.crc_l = crc & 0xffU;
+
+    impl::COBSEncoder::State state{};
+    size_t stuffed_length;
+    if (backend_protocol_ == SerialProtocol::COBS_ZPE)
+    {
+        cobs_encoder_.stuff_zpe(&state, reinterpret_cast<const uint8_t *>(&header), sizeof(header), out);
+        for (int i = 0; i < iovcnt; ++i)
+        {
+            cobs_encoder_.stuff_zpe(&state, static_cast<const uint8_t *>(iov[i].iov_base), iov[i].iov_len, out);
+        }
+        stuffed_length = impl::COBSEncoder::finish_zpe(&state, out);
+    }
+    else
+    {
+        cobs_encoder_.stuff(&state, reinterpret_cast<const uint8_t *>(&header), sizeof(header), out);
+        for (int i = 0; i < iovcnt; ++i)
+        {
+            cobs_encoder_.stuff(&state, static_cast<const uint8_t *>(iov[i].iov_base), iov[i].iov_len, out);
+        }
+        stuffed_length = impl::COBSEncoder::finish(&state, out);
+    }
+
+    // Force the last byte to be 0 to mark the end-of-packet
+    out[stuffed_length] = '\0';
+
+    return stuffed_length + 1;
+}
+
+ssize_t Transporter::write_frame_locked(topic_id_size_t topic_ID, const struct iovec *iov, int iovcnt,
+                                        size_t data_length, uint8_t v2_flags, uint32_t crc,
+                                        Metrics::Clock::time_point frame_start, const uint8_t *cobs_frame,
+                                        size_t cobs_frame_len)
+{
+    // A payload mustn't overtake one of the same topic that is waiting in
+    // the bundle.
+    if (bundle_len_ > 0 && topic_ID != bundle_topic_ID_ && bundle_holds_locked(topic_ID) &&
+        flush_bundle_locked() < 0)
+    {
+        return -1;
+    }
+
+    // With FEC, the payload is encoded into a buffer of its own and sent
+    // from there; the CRC stays that of the payload before it was encoded.
+    // From here on data_length is the length on the wire, which is known
+    // before the payload is encoded.
+    bool fec = backend_protocol_ == SerialProtocol::V2 && fec_ && data_length > 0;
+    size_t payload_len = data_length;
+    if (fec)
+    {
+        data_length = impl::ReedSolomon::encoded_length(payload_len);
+        v2_flags |= V2_FLAG_FEC;
+    }
+
+    // A frame that might not fit in the credits is held back before anything
+    // (like the sequence number) is used up on it.  The COBS size is the
+    // worst case for stuffing.
+    bool cobs = backend_protocol_ == SerialProtocol::COBS || backend_protocol_ == SerialProtocol::COBS_ZPE;
+    if (flow_control_)
+    {
+        size_t max_len = (backend_protocol_ == SerialProtocol::V2 ? V2_MAX_HEADER_LEN : get_header_length()) + data_length;
+        if (cobs)
+        {
+            max_len = cobs_frame != nullptr ? cobs_frame_len : impl::COBSEncoder::max_encoded_length(max_len) + 1;
+        }
+        if (get_credits() < max_len)
+        {
+            credit_stalled_ = true;
+            errno = EBUSY;
+            return -1;
+        }
+    }
+
+    // The PX4 and v2 frames are a header followed by the unchanged payload,
+    // so once the header is built they are written out the same way.
+    PX4Header px4_header{};
+    std::array<uint8_t, V2_MAX_HEADER_LEN> v2_header;
+    struct iovec aead_iov;
+    struct iovec fec_iov;
+    const uint8_t *frame_header = nullptr;
+    size_t header_len = get_header_length();
+
+    if (backend_protocol_ == SerialProtocol::PX4)
+    {
+        px4_header.marker[0] = '>';
+        px4_header.marker[1] = '>';
+        px4_header.marker[2] = '>';
+
+        // [>,>,>,topic_ID,seq,payload_length,CRCHigh,CRCLow,payload_start, ... ,payload_end]
+
+        px4_header.topic_ID = static_cast<uint8_t>(topic_ID);
+        px4_header.seq = metrics_.next_sequence(topic_ID);
+        px4_header.payload_len_h = (data_length >> 8U) & 0xffU;
+        px4_header.payload_len_l = data_length & 0xffU;
+        px4_header.crc_h = static_cast<uint8_t>(crc >> 8U);
+        px4_header.crc_l = crc & 0xffU;
+
+        frame_header = reinterpret_cast<const uint8_t *>(&px4_header);
+    }
+    else if (backend_protocol_ == SerialProtocol::V2)
+    {
+        bool aead = aead_ != nullptr;
+        if (aead)
+        {
+            v2_flags &= ~V2_FLAG_CRC32C;
+        }
+        header_len = v2_build_header(&v2_header[0], topic_ID, metrics_.next_sequence(topic_ID), static_cast<uint32_t>(data_length), v2_flags, crc,
+                                     aead, aead_tx_nonce_);
+        frame_header = &v2_header[0];
+
+        // A keyed payload is encrypted into a buffer of its own, and its tag
+        // over the header and the ciphertext finishes off the header.  FEC
+        // goes on top of the ciphertext, so it is corrected before the tag is
+        // checked.
+        if (aead)
+        {
+            std::array<uint8_t, impl::ChaCha20Poly1305::NONCE_LEN> nonce{};
+            put_be64(&nonce[nonce.size() - V2_AEAD_NONCE_LEN], aead_tx_nonce_++);
+            if (aead_buf_.size() < payload_len)
+            {
+                aead_buf_.resize(payload_len);
+            }
+            constexpr size_t tag_len = impl::ChaCha20Poly1305::TAG_LEN;
+            aead_->seal(&nonce[0], &v2_header[0], header_len - tag_len, iov, iovcnt, aead_buf_.data(),
+                        &v2_header[header_len - tag_len]);
+            aead_iov.iov_base = aead_buf_.data();
+            aead_iov.iov_len = payload_len;
+            iov = &aead_iov;
+            iovcnt = payload_len > 0 ? 1 : 0;
+        }
+
+        if (fec)
+        {
+            if (fec_buf_.size() < data_length)
+            {
+                fec_buf_.resize(data_length);
+            }
+            fec_iov.iov_base = fec_buf_.data();
+            fec_iov.iov_len = impl::ReedSolomon::encode(iov, iovcnt, fec_buf_.data());
+            iov = &fec_iov;
+            iovcnt = 1;
+        }
+    }
+
+    // Work out whether this frame goes into the batch buffer, making room in
+    // it first if necessary.
+    size_t max_frame_len = header_len + data_length;
+    if (cobs)
+    {
+        max_frame_len = cobs_frame != nullptr ? cobs_frame_len : impl::COBSEncoder::max_encoded_length(max_frame_len) + 1;
+    }
+    bool batched = false;
+    if (batch_size_ > 0)
+    {
+        if (batch_len_ + max_frame_len > batch_size_ && flush_locked() < 0)
+        {
+            return -1;
+        }
+        batched = max_frame_len <= batch_size_;
+    }
+
+    ssize_t written;
+    Metrics::Clock::time_point framed;
+
+    write_topic_ID_ = topic_ID;
+
+    if (frame_header != nullptr)
+    {
+        if (batched)
+        {
+            uint8_t *out = batch_buf_.get() + batch_len_;
+            size_t offset = header_len;
+            ::memcpy(out, frame_header, header_len);
+            for (int i = 0; i < iovcnt; ++i)
+            {
+                ::memcpy(out + offset, iov[i].iov_base, iov[i].iov_len);
+                offset += iov[i].iov_len;
+            }
+
+            batch_frames_.push_back({out, offset});
+            batch_topic_IDs_.push_back(topic_ID);
+            batch_len_ += offset;
+            framed = metrics_.now();
+            written = offset;
+        }
+        else if (iovcnt < MAX_NODE_IOVECS)
+        {
+            // Hand the header and the payload buffers down to the transport
+            // as-is, so the payload is never copied.
+            std::array<struct iovec, MAX_NODE_IOVECS> frame_iov;
+            frame_iov[0].iov_base = const_cast<uint8_t *>(frame_header);
+            frame_iov[0].iov_len = header_len;
+            for (int i = 0; i < iovcnt; ++i)
+            {
+                frame_iov[i + 1] = iov[i];
+            }
+
+            framed = metrics_.now();
+            written = node_writev(&frame_iov[0], iovcnt + 1);
+            if (written >= 0)
+            {
+                capture(LinkCapture::Direction::TX, &frame_iov[0], iovcnt + 1);
+            }
+        }
+        else
+        {
+            // Too many buffers to pass down; assemble the packet in the frame
+            // buffer instead.
+            reserve_frame_buf(header_len + data_length);
+            size_t offset = header_len;
+            ::memcpy(frame_buf_.get(), frame_header, header_len);
+            for (int i = 0; i < iovcnt; ++i)
+            {
+                ::memcpy(frame_buf_.get() + offset, iov[i].iov_base, iov[i].iov_len);
+                offset += iov[i].iov_len;
+            }
+
+            framed = metrics_.now();
+            written = node_write(frame_buf_.get(), offset);
+            if (written >= 0)
+            {
+                capture(LinkCapture::Direction::TX, frame_buf_.get(), offset);
+            }
+        }
+    }
+    else if (cobs)
+    {
+        // Batched frames are stuffed straight into the batch buffer, and the
+        // others into the frame buffer, which was sized in the constructor
+        // for the largest possible frame, unless they were encoded already.
+        uint8_t *out = batched ? batch_buf_.get() + batch_len_ : frame_buf_.get();
+        size_t frame_len;
+        if (cobs_frame == nullptr)
+        {
+            frame_len = encode_cobs_frame(topic_ID, iov, iovcnt, data_length, crc, out);
+        }
+        else
+        {
+            frame_len = cobs_frame_len;
+            if (batched)
+            {
+                ::memcpy(out, cobs_frame, frame_len);
+            }
+            else
+            {
+                out = const_cast<uint8_t *>(cobs_frame);
+            }
+        }
+        framed = metrics_.now();
+
+        if (batched)
+        {
+            batch_frames_.push_back({out, frame_len});
+            batch_topic_IDs_.push_back(topic_ID);
+            batch_len_ += frame_len;
+            written = frame_len;
+        }
+        else
+        {
+            written = node_write(out, frame_len);
+            if (written >= 0)
+            {
+                capture(LinkCapture::Direction::TX, out, frame_len);
+            }
+        }
+    }
+    else
+    {
+        throw std::runtime_error("Unknown protocol");
+    }
+
+    if (!batched && written >= 0)
+    {
+        written_bytes_.fetch_add(static_cast<uint64_t>(written), std::memory_order_relaxed);
+    }
+
+    // A batched frame uses up its credits as soon as it is in the batch.
+    if (flow_control_ && written >= 0)
+    {
+        credits_sent_.store(credits_sent_.load(std::memory_order_relaxed) + static_cast<uint32_t>(written),
+                            std::memory_order_relaxed);
+        credit_stalled_ = false;
+    }
+
+    // A batched frame is timed as a write when the batch is flushed.
+    metrics_.record(Metrics::Stage::FRAME, frame_start, framed);
+    if (!batched)
+    {
+        metrics_.record(Metrics::Stage::WRITE, framed, metrics_.now());
+    }
+
+    return written;
+}
+
+ssize_t Transporter::writev(topic_id_size_t topic_ID, const struct iovec *iov, int iovcnt)
+{
+    if (iovcnt < 0 || (iov == nullptr && iovcnt > 0))
+    {
+        return -1;
+    }
+
+    size_t data_length = 0;
+    for (int i = 0; i < iovcnt; ++i)
+    {
+        if (iov[i].iov_base == nullptr && iov[i].iov_len > 0)
+        {
+            return -1;
+        }
+        data_length += iov[i].iov_len;
+    }
+
+    // A transporter in standby hasn't been opened yet; what its topics send
+    // until it takes over the link goes nowhere.
+    if (standby_.load(std::memory_order_relaxed))
+    {
+        return static_cast<ssize_t>(data_length);
+    }
+
+    if (!fds_OK())
+    {
+        return -1;
+    }
+
+    if (topic_ID > get_max_topic_ID())
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // The payload length is sent on the wire as 16 bits (32 bits for v2), so
+    // anything larger than that can't be represented.
+    bool v2 = backend_protocol_ == SerialProtocol::V2;
+    if (data_length > (v2 ? std::numeric_limits<uint32_t>::max() : std::numeric_limits<uint16_t>::max()))
+    {
+        metrics_.drop(Metrics::Direction::TX, topic_ID, Metrics::Drop::OVERSIZE);
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    Metrics::Clock::time_point frame_start = metrics_.now();
+
+    if (v2 && !reliable_tx_.empty() && reliable_tx_.count(topic_ID) != 0)
+    {
+        Metrics::Clock::time_point lock_start = metrics_.now();
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        frame_start += metrics_.now() - lock_start;
+
+        if (write_reliable_locked(topic_ID, iov, iovcnt, data_length, frame_start) < 0)
+        {
+            metrics_.drop(Metrics::Direction::TX, topic_ID, Metrics::Drop::WRITE);
+            return -1;
+        }
+        metrics_.message(Metrics::Direction::TX, topic_ID, data_length);
+
+        return data_length;
+    }
+
+    if (v2 && fragment_size_ > 0 && data_length > fragment_size_)
+    {
+        // The fragments are cut from a single buffer, so a payload in several
+        // has to be gathered up first.
+        const uint8_t *buffer = static_cast<const uint8_t *>(iov[0].iov_base);
+        std::vector<uint8_t> gathered;
+        if (iovcnt > 1)
+        {
+            gathered.resize(data_length);
+            size_t offset = 0;
+            for (int i = 0; i < iovcnt; ++i)
+            {
+                ::memcpy(gathered.data() + offset, iov[i].iov_base, iov[i].iov_len);
+                offset += iov[i].iov_len;
+            }
+            buffer = gathered.data();
+        }
+
+        // The lock is held for all of the fragments, since they mustn't be
+        // mixed with another payload of the same topic; TxQueue is what
+        // sends other frames in between them.
+        Metrics::Clock::time_point lock_start = metrics_.now();
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        frame_start += metrics_.now() - lock_start;
+
+        FragmentCursor cursor;
+        while (cursor.offset < data_length)
+        {
+            if (write_fragment_locked(topic_ID, buffer, data_length, &cursor, frame_start) < 0)
+            {
+                return -1;
+            }
+            frame_start = metrics_.now();
+        }
+
+        return data_length;
+    }
+
+    // The higher layers only ever see the length of the payload they passed
+    // in, even if what goes on the wire is compressed.
+    size_t message_length = data_length;
+
+    TopicCompression *compression = nullptr;
+    TopicDelta *delta = nullptr;
+    if (v2)
+    {
+        auto compression_it = compression_.find(topic_ID);
+        if (compression_it != compression_.end())
+        {
+            compression = &compression_it->second;
+        }
+        auto delta_it = delta_tx_.find(topic_ID);
+        if (delta_it != delta_tx_.end())
+        {
+            delta = &delta_it->second;
+        }
+    }
+
+    // A small payload goes into the bundle rather than a frame of its own,
+    // unless its topic has a fixed length that it doesn't have.
+    auto fixed_it = fixed_lengths_.empty() ? fixed_lengths_.end() : fixed_lengths_.find(topic_ID);
+    bool fixed = fixed_it != fixed_lengths_.end();
+    if (bundle_size_ > 0 && compression == nullptr && delta == nullptr && topic_ID != bundle_topic_ID_ &&
+        data_length <= bundle_size_ && (!fixed || fixed_it->second == data_length))
+    {
+        std::array<uint8_t, BUNDLE_MAX_RECORD_HEADER_LEN> record_header;
+        size_t record_header_len = put_varint(&record_header[0], topic_ID);
+        if (!fixed)
+        {
+            record_header_len += put_varint(&record_header[record_header_len], static_cast<uint32_t>(data_length));
+        }
+        if (record_header_len + data_length <= bundle_size_)
+        {
+            Metrics::Clock::time_point lock_start = metrics_.now();
+            std::lock_guard<std::mutex> lock(write_mutex_);
+            frame_start += metrics_.now() - lock_start;
+
+            if (bundle_locked(topic_ID, &record_header[0], record_header_len, iov, iovcnt, data_length) < 0)
+            {
+                metrics_.drop(Metrics::Direction::TX, topic_ID, Metrics::Drop::WRITE);
+                return -1;
+            }
+            metrics_.record(Metrics::Stage::FRAME, frame_start, metrics_.now());
+            metrics_.message(Metrics::Direction::TX, topic_ID, data_length);
+
+            return data_length;
+        }
+    }
+
+    // The CRC is computed outside of the lock where possible; a payload
+    // that may be encoded has its CRC computed once it is known what is
+    // going to be sent.
+    bool crc32c = v2 && crc32c_;
+    uint32_t crc = (compression == nullptr && delta == nullptr) ? payload_crc(iov, iovcnt, crc32c) : 0;
+
+    // A cobs frame has nothing in it that depends on the frames before it,
+    // so it is stuffed before taking the lock too, in a buffer of the
+    // calling thread; only handing it on is serialized.
+    FrameScratch scratch;
+    const uint8_t *cobs_frame = nullptr;
+    size_t cobs_frame_len = 0;
+    if (backend_protocol_ == SerialProtocol::COBS || backend_protocol_ == SerialProtocol::COBS_ZPE)
+    {
+        uint8_t *out = scratch.get(impl::COBSEncoder::max_encoded_length(get_header_length() + data_length) + 1);
+        if (out != nullptr)
+        {
+            cobs_frame_len = encode_cobs_frame(topic_ID, iov, iovcnt, data_length, crc, out);
+            cobs_frame = out;
+        }
+    }
+
+    Metrics::Clock::time_point lock_start = metrics_.now();
+    std::lock_guard<std::mutex> lock(write_mutex_);
+
+    // Waiting for the lock doesn't count as framing.
+    frame_start += metrics_.now() - lock_start;
+
+    uint8_t v2_flags = crc32c ? V2_FLAG_CRC32C : 0;
+
+    // An acknowledgement that is waiting to be sent goes in front of a plain
+    // payload, rather than in a frame of its own.
+    std::array<uint8_t, RELIABLE_MAX_ACK_LEN> ack_buf;
+    std::array<struct iovec, MAX_NODE_IOVECS> ack_iov;
+    if (v2 && acks_pending_ && compression == nullptr && delta == nullptr && data_length > 0 &&
+        iovcnt < MAX_NODE_IOVECS - 1)
+    {
+        topic_id_size_t ack_topic_ID;
+        size_t ack_len;
+        {
+            std::lock_guard<std::mutex> reliable_lock(reliable_mutex_);
+            ack_len = take_ack_locked(std::chrono::steady_clock::time_point::max(), &ack_buf[0], &ack_topic_ID);
+        }
+        if (ack_len > 0)
+        {
+            ack_iov[0].iov_base = &ack_buf[0];
+            ack_iov[0].iov_len = ack_len;
+            std::copy(iov, iov + iovcnt, &ack_iov[1]);
+            iov = &ack_iov[0];
+            iovcnt++;
+            data_length += ack_len;
+            v2_flags |= V2_FLAG_ACK;
+            crc = payload_crc(iov, iovcnt, crc32c);
+        }
+    }
+
+    struct iovec delta_iov;
+    if (delta != nullptr)
+    {
+        // The payload is kept to compare the next one against, so gather it
+        // up.  A delta is only sent if it is smaller than the payload; when
+        // it isn't, when the length changed, or when it is time for a
+        // keyframe, the whole payload is sent as a new delta base.
+        delta->pending.resize(data_length);
+        size_t offset = 0;
+        for (int i = 0; i < iovcnt; ++i)
+        {
+            ::memcpy(delta->pending.data() + offset, iov[i].iov_base, iov[i].iov_len);
+            offset += iov[i].iov_len;
+        }
+
+        size_t delta_len = 0;
+        if (delta->have_last && delta->last.size() == data_length && data_length > DELTA_HEADER_LEN &&
+            delta->since_keyframe + 1 < delta->keyframe_interval)
+        {
+            if (delta_buf_.size() < data_length - 1)
+            {
+                delta_buf_.resize(data_length - 1);
+            }
+            delta_len = delta_encode(delta->last.data(), delta->last_crc, delta->pending.data(), data_length,
+                                     delta_buf_.data(), data_length - 1);
+        }
+
+        if (delta_len > 0)
+        {
+            delta_iov.iov_base = delta_buf_.data();
+            delta_iov.iov_len = delta_len;
+            v2_flags |= V2_FLAG_DELTA;
+            delta->since_keyframe++;
+        }
+        else
+        {
+            delta_iov.iov_base = delta->pending.data();
+            delta_iov.iov_len = data_length;
+            v2_flags |= V2_FLAG_DELTA_BASE;
+            delta->since_keyframe = 0;
+        }
+        iov = &delta_iov;
+        iovcnt = 1;
+        data_length = delta_iov.iov_len;
+    }
+
+    struct iovec compressed_iov;
+    impl::LZ4Codec *codec = nullptr;
+    if (compression != nullptr && data_length > 0 && data_length >= compression->threshold)
+    {
+        codec = compression->codec.get();
+    }
+    if (codec != nullptr)
+    {
+        // The codec and the compression buffer are shared by all writers,
+        // hence this is done under the lock.  Anything that doesn't shrink
+        // is sent as it was.
+        if (compress_buf_.size() < data_length - 1)
+        {
+            compress_buf_.resize(data_length - 1);
+        }
+        size_t compressed_len = codec->compress(iov, iovcnt, compress_buf_.data(), data_length - 1);
+        if (compressed_len > 0)
+        {
+            compressed_iov.iov_base = compress_buf_.data();
+            compressed_iov.iov_len = compressed_len;
+            iov = &compressed_iov;
+            iovcnt = 1;
+            data_length = compressed_len;
+            v2_flags |= V2_FLAG_COMPRESSED;
+        }
+    }
+    if (compression != nullptr || delta != nullptr)
+    {
+        crc = payload_crc(iov, iovcnt, crc32c);
+    }
+
+    ssize_t written = write_frame_locked(topic_ID, iov, iovcnt, data_length, v2_flags, crc, frame_start, cobs_frame,
+                                         cobs_frame_len);
+
+    // To hide the details of the serialization protocol from the higher layers,
+    // we return the payload length if we were successful here.
+    if (delta != nullptr)
+    {
+        if (written < 0)
+        {
+            // The other side may not have the payload, so the next one must
+            // not be a delta against it.
+            delta->have_last = false;
+        }
+        else
+        {
+            delta->last.swap(delta->pending);
+            delta->last_crc = crc16(delta->last.data(), delta->last.size());
+            delta->have_last = true;
+        }
+    }
+
+    if (written < 0)
+    {
+        metrics_.drop(Metrics::Direction::TX, topic_ID, Metrics::Drop::WRITE);
+        return written;
+    }
+
+    metrics_.message(Metrics::Direction::TX, topic_ID, message_length);
+
+    return message_length;
+}
+
+ssize_t Transporter::write_fragment(topic_id_size_t topic_ID, uint8_t const *buffer, size_t length,
+                                    FragmentCursor *cursor)
+{
+    if (!fds_OK())
+    {
+        return -1;
+    }
+
+    if (buffer == nullptr || cursor == nullptr || cursor->offset >= length || topic_ID > get_max_topic_ID() ||
+        length > std::numeric_limits<uint32_t>::max() || fragment_size_ == 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (!reliable_tx_.empty() && reliable_tx_.count(topic_ID) != 0 && cursor->offset == 0)
+    {
+        // Reliable payloads are never fragmented, so the whole payload is
+        // the one fragment.
+        struct iovec iov{const_cast<uint8_t *>(buffer), length};
+        if (writev(topic_ID, &iov, 1) < 0)
+        {
+            return -1;
+        }
+        cursor->offset = length;
+
+        return length;
+    }
+
+    Metrics::Clock::time_point frame_start = metrics_.now();
+    Metrics::Clock::time_point lock_start = frame_start;
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    frame_start += metrics_.now() - lock_start;
+
+    return write_fragment_locked(topic_ID, buffer, length, cursor, frame_start);
+}
+
+ssize_t Transporter::write_fragment_locked(topic_id_size_t topic_ID, uint8_t const *buffer, size_t length,
+                                           FragmentCursor *cursor, Metrics::Clock::time_point frame_start)
+{
+    if (cursor->offset == 0)
+    {
+        cursor->message_ID = next_message_ID_++;
+    }
+
+    std::array<uint8_t, FRAGMENT_MAX_HEADER_LEN> fragment_header;
+    size_t fragment_header_len = put_varint(&fragment_header[0], cursor->message_ID);
+    fragment_header_len += put_varint(&fragment_header[fragment_header_len], static_cast<uint32_t>(length));
+    fragment_header_len += put_varint(&fragment_header[fragment_header_len], static_cast<uint32_t>(cursor->offset));
+
+    size_t chunk_len = std::min(fragment_size_ - fragment_header_len, length - cursor->offset);
+    std::array<struct iovec, 2> iov{{
+        {&fragment_header[0], fragment_header_len},
+        {const_cast<uint8_t *>(buffer + cursor->offset), chunk_len},
+    }};
+
+    uint8_t v2_flags = V2_FLAG_FRAGMENT | (crc32c_ ? V2_FLAG_CRC32C : 0);
+    uint32_t crc = payload_crc(&iov[0], iov.size(), crc32c_);
+    if (write_frame_locked(topic_ID, &iov[0], iov.size(), fragment_header_len + chunk_len, v2_flags, crc,
+                           frame_start) < 0)
+    {
+        metrics_.drop(Metrics::Direction::TX, topic_ID, Metrics::Drop::WRITE);
+        return -1;
+    }
+
+    // The payload only counts as sent once all of it is.
+    cursor->offset += chunk_len;
+    if (cursor->offset == length)
+    {
+        metrics_.message(Metrics::Direction::TX, topic_ID, length);
+    }
+
+    return chunk_len;
+}
+
+ssize_t Transporter::receive_reliable(topic_id_size_t topic_ID, bool ack, bool reliable, const uint8_t *data,
+                                      size_t len)
+{
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    size_t pos = 0;
+
+    std::lock_guard<std::mutex> lock(reliable_mutex_);
+
+    if (ack)
+    {
+        uint32_t acked_topic_ID;
+        ssize_t topic_ID_len = get_varint(data, len, V2_MAX_TOPIC_ID_LEN, &acked_topic_ID);
+        if (topic_ID_len <= 0 || len - topic_ID_len < RELIABLE_MAX_ACK_LEN - V2_MAX_TOPIC_ID_LEN)
+        {
+            return -EBADMSG;
+        }
+        pos = topic_ID_len;
+        uint8_t session = data[pos];
+        uint8_t base = data[pos + 1];
+        uint8_t bitmap = data[pos + 2];
+        pos += 3;
+
+        auto tx_it = acked_topic_ID <= std::numeric_limits<topic_id_size_t>::max() ?
+                     reliable_tx_.find(static_cast<topic_id_size_t>(acked_topic_ID)) : reliable_tx_.end();
+        if (tx_it != reliable_tx_.end() && tx_it->second.session == session)
+        {
+            ReliableTx & tx = tx_it->second;
+            for (ReliableFrame & frame : tx.window)
+            {
+                // Everything before base was received, and the bitmap says
+                // which of the ones after it were.
+                uint8_t offset = static_cast<uint8_t>(frame.seq - base);
+                if (!frame.in_flight ||
+                    (offset < 0x80 && (offset == 0 || offset > 8 || (bitmap & (1U << (offset - 1))) == 0)))
+                {
+                    continue;
+                }
+
+                // Only frames that were sent once give a round trip time, since
+                // there is no telling which send a retransmitted one was
+                // acknowledged for (Karn's algorithm).
+                if (frame.retransmits == 0)
+                {
+                    std::chrono::microseconds rtt = std::chrono::duration_cast<std::chrono::microseconds>(now - frame.sent);
+                    last_rtt_us_.store(rtt.count(), std::memory_order_relaxed);
+                    if (!tx.have_rtt)
+                    {
+                        tx.srtt = rtt;
+                        tx.rttvar = rtt / 2;
+                        tx.have_rtt = true;
+                    }
+                    else
+                    {
+                        std::chrono::microseconds err = tx.srtt > rtt ? tx.srtt - rtt : rtt - tx.srtt;
+                        tx.rttvar = (3 * tx.rttvar + err) / 4;
+                        tx.srtt = (7 * tx.srtt + rtt) / 8;
+                    }
+                    std::chrono::microseconds rto = tx.srtt + std::max<std::chrono::microseconds>(
+                        std::chrono::milliseconds(1), 4 * tx.rttvar);
+                    tx.rto = std::min<std::chrono::microseconds>(std::max<std::chrono::microseconds>(rto, RELIABLE_MIN_RTO),
+                                                                 RELIABLE_MAX_RTO);
+                }
+
+                frame.in_flight = false;
+                tx.in_flight--;
+            }
+        }
+
+        if (pos == len && !reliable)
+        {
+            // There is nothing but the acknowledgement.
+            return -EINPROGRESS;
+        }
+    }
+
+    if (!reliable)
+    {
+        return pos;
+    }
+
+    if (len - pos < RELIABLE_HEADER_LEN)
+    {
+        return -EBADMSG;
+    }
+    uint8_t session = data[pos];
+    uint8_t seq = data[pos + 1];
+    pos += RELIABLE_HEADER_LEN;
+
+    ReliableRx & rx = reliable_rx_[topic_ID];
+    if (!rx.started || rx.session != session)
+    {
+        rx.started = true;
+        rx.session = session;
+        rx.base = seq;
+        rx.received = 0;
+    }
+
+    // Every reliable frame is acknowledged, even if it was already received,
+    // since it means the acknowledgement of it was lost.
+    if (!rx.ack_pending)
+    {
+        rx.ack_pending = true;
+        rx.ack_due = now + RELIABLE_ACK_DELAY;
+        acks_pending_ = true;
+    }
+
+    uint8_t offset = static_cast<uint8_t>(seq - rx.base);
+    if (offset >= 0x80)
+    {
+        // This is before base, so it was already delivered.
+        return -EINPROGRESS;
+    }
+    if (offset >= RELIABLE_RX_SPAN)
+    {
+        // The sender gave up on the frames this skips over.
+        uint8_t skip = offset - (RELIABLE_RX_SPAN - 1);
+        rx.base += skip;
+        rx.received = skip >= RELIABLE_RX_SPAN ? 0 : static_cast<uint16_t>(rx.received >> skip);
+        offset = RELIABLE_RX_SPAN - 1;
+    }
+    uint16_t bit = static_cast<uint16_t>(1U << offset);
+    if ((rx.received & bit) != 0)
+    {
+        return -EINPROGRESS;
+    }
+    rx.received |= bit;
+    while ((rx.received & 1U) != 0)
+    {
+        rx.received >>= 1U;
+        rx.base++;
+    }
+
+    return pos;
+}
+
+size_t Transporter::take_ack_locked(std::chrono::steady_clock::time_point due_by, uint8_t *buf,
+                                    topic_id_size_t *topic_ID)
+{
+    if (!acks_pending_)
+    {
+        return 0;
+    }
+
+    ReliableRx *found = nullptr;
+    bool more = false;
+    for (auto & rx : reliable_rx_)
+    {
+        if (!rx.second.ack_pending)
+        {
+            continue;
+        }
+        if (found == nullptr && rx.second.ack_due <= due_by)
+        {
+            found = &rx.second;
+            *topic_ID = rx.first;
+        }
+        else
+        {
+            more = true;
+        }
+    }
+    acks_pending_ = more;
+
+    if (found == nullptr)
+    {
+        return 0;
+    }
+    found->ack_pending = false;
+
+    // The receiver only keeps track of base and the 8 frames after it that
+    // can be in flight, since the sender's window is no larger.
+    size_t len = put_varint(buf, *topic_ID);
+    buf[len++] = found->session;
+    buf[len++] = found->base;
+    buf[len++] = static_cast<uint8_t>(found->received >> 1U);
+
+    return len;
+}
+
+ssize_t Transporter::write_reliable_locked(topic_id_size_t topic_ID, const struct iovec *iov, int iovcnt,
+                                           size_t data_length, Metrics::Clock::time_point frame_start)
 {
-    if (protocol == "px4")
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    std::array<uint8_t, RELIABLE_MAX_ACK_LEN> ack_buf;
+    topic_id_size_t ack_topic_ID;
+    size_t ack_len;
+    ReliableFrame *frame;
+    uint8_t session;
+    bool was_idle;
     {
-        backend_protocol_ = SerialProtocol::PX4;
+        std::lock_guard<std::mutex> lock(reliable_mutex_);
+
+        ReliableTx & tx = reliable_tx_[topic_ID];
+        frame = &tx.window[tx.next_seq % RELIABLE_WINDOW];
+        if (frame->in_flight)
+        {
+            // The frame RELIABLE_WINDOW back is still waiting.
+            errno = ENOBUFS;
+            return -1;
+        }
+        frame->in_flight = true;
+        frame->seq = tx.next_seq++;
+        frame->retransmits = 0;
+        frame->sent = now;
+        frame->due = now + tx.rto;
+        session = tx.session;
+        was_idle = tx.in_flight++ == 0;
+
+        ack_len = take_ack_locked(std::chrono::steady_clock::time_point::max(), &ack_buf[0], &ack_topic_ID);
     }
-    else if (protocol == "cobs")
+
+    // The payload is kept for retransmits, and is only ever touched with
+    // write_mutex_ held.
+    frame->payload.resize(RELIABLE_HEADER_LEN + data_length);
+    frame->payload[0] = session;
+    frame->payload[1] = frame->seq;
+    size_t offset = RELIABLE_HEADER_LEN;
+    for (int i = 0; i < iovcnt; ++i)
     {
-        backend_protocol_ = SerialProtocol::COBS;
+        ::memcpy(frame->payload.data() + offset, iov[i].iov_base, iov[i].iov_len);
+        offset += iov[i].iov_len;
     }
-    else
+
+    std::array<struct iovec, 2> frame_iov{{
+        {&ack_buf[0], ack_len},
+        {frame->payload.data(), frame->payload.size()},
+    }};
+    const struct iovec *payload_iov = ack_len > 0 ? &frame_iov[0] : &frame_iov[1];
+    int payload_iovcnt = ack_len > 0 ? 2 : 1;
+    uint8_t v2_flags = V2_FLAG_RELIABLE | (ack_len > 0 ? V2_FLAG_ACK : 0) | (crc32c_ ? V2_FLAG_CRC32C : 0);
+    uint32_t crc = payload_crc(payload_iov, payload_iovcnt, crc32c_);
+    ssize_t written = write_frame_locked(topic_ID, payload_iov, payload_iovcnt, ack_len + frame->payload.size(),
+                                         v2_flags, crc, frame_start);
+    if (written < 0)
     {
-        throw std::runtime_error("Invalid protocol; must be one of 'px4' or 'cobs'");
+        // It is sent again like a frame that was lost.
+        std::lock_guard<std::mutex> lock(reliable_mutex_);
+        frame->due = now;
+        written = 0;
     }
-}
 
-Transporter::~Transporter()
-{
+    if (was_idle && reliable_notify_)
+    {
+        reliable_notify_();
+    }
+
+    return written;
 }
 
-uint16_t Transporter::crc16_byte(uint16_t crc, uint8_t data)
+void Transporter::set_flow_control(bool enable)
 {
-    return static_cast<uint8_t>(crc >> 8U) ^ crc16_table[static_cast<uint8_t>(crc ^ data)];
+    flow_control_ = enable;
+    credits_sent_ = 0;
+    credit_limit_ = 0;
+    credit_stalled_ = false;
+    credits_granted_ = false;
 }
 
-uint16_t Transporter::crc16(uint8_t const *buffer, size_t len)
+int Transporter::handle_flow_credits(const uint8_t *buffer, size_t length)
 {
-    uint16_t crc = 0;
-
-    while ((len--) != 0)
+    if (!flow_control_ || buffer == nullptr || length < FLOW_CREDITS_LEN || buffer[0] != FLOW_CREDITS_KIND)
     {
-        crc = crc16_byte(crc, *buffer++);
+        return -1;
     }
 
-    return crc;
-}
+    uint32_t received;
+    uint32_t window;
+    ::memcpy(&received, buffer + FLOW_CREDITS_RECEIVED_OFFSET, sizeof(received));
+    ::memcpy(&window, buffer + FLOW_CREDITS_WINDOW_OFFSET, sizeof(window));
 
-// This function decodes length bytes of data at the location pointed to by
-// ptr, writing the output to the location pointed to by dst.  The amount of
-// memory needed by dst is guaranteed to be <= length.
-//
-// Returns the length of the decoded data.
-size_t cobs_unstuff_data(const uint8_t *ptr, size_t length, uint8_t *dst)
-{
-    const uint8_t *start = dst;
-    const uint8_t *end = ptr + length;
-    uint8_t code = 0xff;
-    uint8_t copy = 0;
+    // The other end counts from when it started, and the bridge from when
+    // flow control was enabled, so the counts are lined up on the first
+    // grant.  A count that went back, or that is ahead of what was sent,
+    // means the other end started again (taking whatever was on the way
+    // with it), so they are lined up again.
+    uint32_t sent = credits_sent_.load(std::memory_order_relaxed);
+    if (!credits_granted_ || static_cast<int32_t>(received - last_received_) < 0 ||
+        static_cast<int32_t>(received + credit_offset_ - sent) > 0)
+    {
+        credit_offset_ = sent - received;
+        credits_granted_ = true;
+    }
+    last_received_ = received;
+    credit_limit_.store(received + credit_offset_ + window, std::memory_order_relaxed);
 
-    for (; ptr < end; copy--)
+    if (credit_notify_)
     {
-        if (copy != 0)
-        {
-            *dst++ = *ptr++;
-        }
-        else
-        {
-            if (code != 0xff)
-            {
-                *dst++ = 0;
-            }
-            copy = code = *ptr++;
-            if (code == 0)
-            {
-                break;  // source length too long
-            }
-        }
+        credit_notify_();
     }
 
-    return dst - start;
+    return 0;
 }
 
-ssize_t Transporter::find_and_copy_message(topic_id_size_t *topic_ID, uint8_t *out_buffer, size_t buffer_len)
+size_t Transporter::get_credits() const
 {
-    size_t header_len = get_header_length();
-    if (ringbuf_.bytes_used() < header_len)
-    {
-        throw std::runtime_error("Bad size");
-    }
+    int32_t credits = static_cast<int32_t>(credit_limit_.load(std::memory_order_relaxed) -
+                                           credits_sent_.load(std::memory_order_relaxed));
 
-    if (backend_protocol_ == SerialProtocol::PX4)
+    return credits > 0 ? static_cast<size_t>(credits) : 0;
+}
+
+int Transporter::service_reliable(std::chrono::steady_clock::time_point now)
+{
+    if (backend_protocol_ != SerialProtocol::V2 || !fds_OK())
     {
-        std::array<uint8_t, 3> headerseq{'>', '>', '>'};
-        ssize_t offset = ringbuf_.findseq(&headerseq[0], headerseq.size());
+        return -1;
+    }
 
-        if (offset < 0)
-        {
-            // We didn't find the sequence, so just return
-            return -ENODATA;
-        }
+    // Work out when the next thing is due, and only take the write lock if
+    // something already is.
+    auto wait_ms = [this, now]() {
+        std::lock_guard<std::mutex> reliable_lock(reliable_mutex_);
 
-        if (offset > 0)
+        bool waiting = false;
+        std::chrono::steady_clock::time_point next = std::chrono::steady_clock::time_point::max();
+        if (acks_pending_)
         {
-            // There is some garbage at the front, so just throw it away.
-            std::vector<uint8_t> garbage(offset);
-            if (ringbuf_.memcpy_from(&garbage[0], offset) < 0)
+            for (const auto & rx : reliable_rx_)
             {
-                throw std::runtime_error("Failed getting garbage data from ring buffer");
+                if (rx.second.ack_pending)
+                {
+                    next = std::min(next, rx.second.ack_due);
+                    waiting = true;
+                }
             }
-            if (ringbuf_.bytes_used() < header_len)
+        }
+        for (const auto & tx : reliable_tx_)
+        {
+            for (size_t i = 0; tx.second.in_flight > 0 && i < tx.second.window.size(); ++i)
             {
-                // Not enough bytes now.
-                return -ENODATA;
+                if (tx.second.window[i].in_flight)
+                {
+                    next = std::min(next, tx.second.window[i].due);
+                    waiting = true;
+                }
             }
         }
 
-        // Looking for a header of the form:
-        // [>,>,>,topic_ID,seq,payload_length_H,payload_length_L,CRCHigh,CRCLow,payloadStart, ... ,payloadEnd]
-
-        std::unique_ptr<uint8_t[]> headerbuf = std::unique_ptr<uint8_t[]>(new uint8_t[sizeof(PX4Header)]);
-
-        // Peek at the header out of the buffer.  Note that we need to do
-        // a peek/copy (rather than just mapping to the array) because the
-        // header might be non-contiguous in memory in the ring.
-
-        if (ringbuf_.peek(headerbuf.get(), header_len) < 0)
+        if (!waiting)
         {
-            // ringbuf_.peek returns nullptr if there isn't enough data in the
-            // ring buffer for the requested length
-            return -EMSGSIZE;
+            return -1;
+        }
+        if (next <= now)
+        {
+            return 0;
         }
 
-        PX4Header *header = reinterpret_cast<PX4Header *>(headerbuf.get());
+        // Round up, so the caller doesn't wake up just before it is due.
+        int64_t wait_us = std::chrono::duration_cast<std::chrono::microseconds>(next - now).count();
+        return static_cast<int>(std::min<int64_t>((wait_us + 999) / 1000, std::numeric_limits<int>::max()));
+    };
 
-        uint16_t payload_len = static_cast<uint16_t>(static_cast<uint16_t>(header->payload_len_h) << 8U) | header->payload_len_l;
+    int wait = wait_ms();
+    if (wait != 0)
+    {
+        return wait;
+    }
 
-        if (buffer_len < payload_len)
-        {
-            // The message won't fit the buffer.
-            return -EMSGSIZE;
-        }
+    std::lock_guard<std::mutex> lock(write_mutex_);
 
-        if (ringbuf_.bytes_used() < (header_len + payload_len))
+    // Each round sends one thing that is due, taking reliable_mutex_ only to
+    // find it, so that acknowledgements can be taken in while writing.
+    bool wrote = false;
+    for (;;)
+    {
+        std::array<uint8_t, RELIABLE_MAX_ACK_LEN> ack_buf;
+        topic_id_size_t topic_ID = 0;
+        size_t ack_len;
+        ReliableFrame *frame = nullptr;
         {
-            // We do not have a complete message yet
-            return -ENODATA;
-        }
+            std::lock_guard<std::mutex> reliable_lock(reliable_mutex_);
 
-        // At this point, we know that we have a complete header and the payload.
-        // Consume both; whether we keep the data or not, we want it out of the
-        // ring.
+            ack_len = take_ack_locked(now, &ack_buf[0], &topic_ID);
+            for (auto tx_it = reliable_tx_.begin(); ack_len == 0 && frame == nullptr && tx_it != reliable_tx_.end();
+                 ++tx_it)
+            {
+                ReliableTx & tx = tx_it->second;
+                for (size_t i = 0; tx.in_flight > 0 && frame == nullptr && i < tx.window.size(); ++i)
+                {
+                    ReliableFrame & f = tx.window[i];
+                    if (!f.in_flight || f.due > now)
+                    {
+                        continue;
+                    }
+                    if (f.retransmits >= RELIABLE_MAX_RETRANSMITS)
+                    {
+                        ROS2_SERIAL_LOG(WARN, "RELIABLE FRAME NOT ACKNOWLEDGED for topic %u", tx_it->first);
+                        metrics_.drop(Metrics::Direction::TX, tx_it->first, Metrics::Drop::WRITE);
+                        f.in_flight = false;
+                        tx.in_flight--;
+                        continue;
+                    }
 
-        // Header
-        if (ringbuf_.memcpy_from(headerbuf.get(), header_len) < 0)
-        {
-            // We already checked above, so this should never happen.
-            throw std::runtime_error("Unexpected ring buffer failure");
+                    // Back off exponentially, since the timeout may simply
+                    // be too short for the link.
+                    f.retransmits++;
+                    f.due = now + std::min<std::chrono::microseconds>(tx.rto * (1U << f.retransmits), RELIABLE_MAX_RTO);
+                    frame = &f;
+                    topic_ID = tx_it->first;
+                }
+            }
         }
 
-        if (payload_len > 0)
+        struct iovec iov;
+        uint8_t v2_flags = crc32c_ ? V2_FLAG_CRC32C : 0;
+        if (ack_len > 0)
         {
-          if (ringbuf_.memcpy_from(out_buffer, payload_len) < 0)
-          {
-              // We already checked above, so this should never happen.
-              throw std::runtime_error("Unexpected ring buffer failure");
-          }
+            iov.iov_base = &ack_buf[0];
+            iov.iov_len = ack_len;
+            v2_flags |= V2_FLAG_ACK;
         }
-
-        uint16_t read_crc = static_cast<uint16_t>(static_cast<uint16_t>(header->crc_h) << 8U) | header->crc_l;
-        uint16_t calc_crc = crc16(out_buffer, payload_len);
-
-        ssize_t len;
-        if (read_crc != calc_crc)
+        else if (frame != nullptr)
         {
-            ::printf("BAD CRC %u != %u\n", read_crc, calc_crc);
-            len = -EBADMSG;
+            iov.iov_base = frame->payload.data();
+            iov.iov_len = frame->payload.size();
+            v2_flags |= V2_FLAG_RELIABLE;
+            metrics_.retransmit(topic_ID);
         }
         else
         {
-            *topic_ID = header->topic_ID;
-            len = payload_len;
+            break;
         }
 
-        return len;
+        // A failed write is sent again later like a lost frame, or
+        // acknowledged again when the frame is.
+        write_frame_locked(topic_ID, &iov, 1, iov.iov_len, v2_flags, payload_crc(&iov, 1, crc32c_), metrics_.now());
+        wrote = true;
     }
 
-    if (backend_protocol_ == SerialProtocol::COBS)
+    if (wrote)
     {
-        // For COBS, we search for a tail sequence consisting just of 0x0.  If
-        // we find it, we find out how many bytes there are from the start of
-        // the ring until that sequence; if there are enough bytes, we can try
-        // to unstuff.
-        std::array<uint8_t, 1> tailseq{0x0};
-        ssize_t offset = ringbuf_.findseq(&tailseq[0], tailseq.size());
+        flush_locked();
+    }
 
-        if (offset < 0)
-        {
-            // We didn't find the sequence, so just return
-            return -ENODATA;
-        }
+    return wait_ms();
+}
 
-        // Since findseq returns the number of bytes *up to* the sequence, we
-        // need to add one so we actually copy the 0 out as well.  This should
-        // always succeed since we found it above.
-        size_t needed = offset + 1;
-        std::unique_ptr<uint8_t[]> stuffed_buffer = std::unique_ptr<uint8_t[]>(new uint8_t[needed]);
+int Transporter::set_write_batching(size_t batch_size)
+{
+    std::lock_guard<std::mutex> lock(write_mutex_);
 
-        // Since we saw a 0 in the stream, copy all bytes out of the ring buffer
-        // up until the 0.  Note that we *always* copy the data out, even if it
-        // isn't large enough for our needs.  This is so we get the data out of
-        // the ring buffer; if it is bogus, we'll throw it away below.
-        // Otherwise we'll COBS unstuff it, do a CRC and see if it is valid.
-        if (ringbuf_.memcpy_from(stuffed_buffer.get(), needed) < 0)
-        {
-            throw std::runtime_error("Unexpected ring buffer failure");
-        }
+    if (flush_locked() < 0)
+    {
+        return -1;
+    }
 
-        // Unstuff the buffer before doing anything else.  Since COBS unstuffing
-        // is guaranteed to need less memory than the input buffer, just
-        // allocate enough for the input buffer here.
+    batch_size_ = batch_size;
+    if (batch_size > 0)
+    {
+        batch_buf_ = std::unique_ptr<uint8_t[]>(new uint8_t[batch_size]);
+        // Every frame has at least a header, so this bounds the number of
+        // frames in a batch and the vector never grows.
+        batch_frames_.reserve(batch_size / get_header_length() + 1);
+        batch_topic_IDs_.reserve(batch_frames_.capacity());
+    }
+    else
+    {
+        batch_buf_.reset();
+    }
+
+    return 0;
+}
 
-        // Note that there is a tradeoff between being nice to the caller and
-        // performance here.  If we unstuffed directly into the out_buffer, we
-        // could save an allocation and a memcpy below.  But the tradeoff is
-        // that we would have to check that the out_buffer contains at least
-        // "needed" bytes, which is more than the unstuffed version will really
-        // require.  Thus we might fail unnecessarily.  For now we take the
-        // performance hit, but we might want to re-examine this decision.
+ssize_t Transporter::write_framed(topic_id_size_t topic_ID, const struct iovec *iov, int iovcnt)
+{
+    if (!fds_OK() || iov == nullptr || iovcnt <= 0)
+    {
+        return -1;
+    }
 
-        std::unique_ptr<uint8_t[]> unstuffed_buffer = std::unique_ptr<uint8_t[]>(new uint8_t[needed]);
-        size_t unstuffed_size = cobs_unstuff_data(stuffed_buffer.get(), offset, unstuffed_buffer.get());
+    std::lock_guard<std::mutex> lock(write_mutex_);
 
-        if (unstuffed_size < header_len)
-        {
-            // We found a 0x0 in the data, but there wasn't enough for a full
-            // header.  Drop all of the data.
-            return -ENODATA;
-        }
+    // Anything batched was framed first, so it goes first.
+    if (flush_locked() < 0)
+    {
+        return -1;
+    }
 
-        COBSHeader *header = reinterpret_cast<COBSHeader *>(unstuffed_buffer.get());
-        uint16_t payload_len = static_cast<uint16_t>(static_cast<uint16_t>(header->payload_len_h) << 8U) | header->payload_len_l;
+    write_topic_ID_ = topic_ID;
 
-        if ((unstuffed_size - header_len) < payload_len)
+    ssize_t written;
+    if (iovcnt <= MAX_NODE_IOVECS)
+    {
+        written = node_writev(iov, iovcnt);
+        if (written >= 0)
         {
-            // The data we copied out and unstuffed was smaller than what the
-            // payload was, so this definitely isn't a valid message.
-            return -ENODATA;
+            capture(LinkCapture::Direction::TX, iov, iovcnt);
         }
-
-        if ((unstuffed_size - header_len) > buffer_len)
+    }
+    else
+    {
+        size_t len = 0;
+        for (int i = 0; i < iovcnt; ++i)
         {
-            // The message won't fit the buffer.
-            return -EMSGSIZE;
+            len += iov[i].iov_len;
         }
-
-        uint16_t read_crc = static_cast<uint16_t>(static_cast<uint16_t>(header->crc_h) << 8U) | header->crc_l;
-        uint16_t calc_crc = crc16(unstuffed_buffer.get() + header_len, payload_len);
-
-        ssize_t len;
-        if (read_crc != calc_crc)
+        reserve_frame_buf(len);
+        size_t offset = 0;
+        for (int i = 0; i < iovcnt; ++i)
         {
-            ::printf("BAD CRC %u != %u\n", read_crc, calc_crc);
-            return -EBADMSG;
+            ::memcpy(frame_buf_.get() + offset, iov[i].iov_base, iov[i].iov_len);
+            offset += iov[i].iov_len;
+        }
+        written = node_write(frame_buf_.get(), len);
+        if (written >= 0)
+        {
+            capture(LinkCapture::Direction::TX, frame_buf_.get(), len);
         }
+    }
 
-        *topic_ID = header->topic_ID;
-        len = payload_len;
+    if (written >= 0)
+    {
+        written_bytes_.fetch_add(static_cast<uint64_t>(written), std::memory_order_relaxed);
+    }
 
-        // OK, everything checks out.  Copy the unstuffed data into the output
-        // buffer.
-        ::memcpy(out_buffer, unstuffed_buffer.get() + header_len, len);
+    return written;
+}
 
-        return len;
-    }
+ssize_t Transporter::flush()
+{
+    std::lock_guard<std::mutex> lock(write_mutex_);
 
-    throw std::runtime_error("Bad protocol");
+    return flush_locked();
 }
 
-ssize_t Transporter::read(topic_id_size_t *topic_ID, uint8_t *out_buffer, size_t buffer_len)
+size_t Transporter::get_pending_write_bytes()
 {
-    if (nullptr == out_buffer || nullptr == topic_ID || !fds_OK())
+    std::lock_guard<std::mutex> lock(write_mutex_);
+
+    return batch_len_ + bundle_len_;
+}
+
+ssize_t Transporter::flush_locked()
+{
+    // The bundle goes at the end of the batch, after the frames that were
+    // written while it was filling up, unless it was written on its own.
+    ssize_t bundled = flush_bundle_locked();
+    if (bundled < 0)
     {
         return -1;
     }
 
-    size_t header_len = get_header_length();
+    if (batch_len_ == 0)
+    {
+        return bundled;
+    }
 
-    *topic_ID = std::numeric_limits<topic_id_size_t>::max();
+    // Whether or not this succeeds, the batch is gone; retrying a partial
+    // write could put a corrupted frame on the wire.
+    batch_len_ = 0;
 
-    if (ringbuf_.bytes_used() >= header_len)
+    Metrics::Clock::time_point write_start = metrics_.now();
+    ssize_t ret = -1;
+    if (fds_OK())
     {
-        ssize_t len = find_and_copy_message(topic_ID, out_buffer, buffer_len);
-        if (len >= 0)
-        {
-            return len;
-        }
+        ret = node_write_frames(batch_frames_.data(), batch_topic_IDs_.data(), batch_frames_.size());
     }
-
-    ssize_t len = node_read();
-    if (len < 0)
+    if (ret >= 0)
     {
-        if (errno != 0 && errno != EAGAIN && errno != ETIMEDOUT)
-        {
-            ::printf("Read fail %d\n", errno);
-        }
-
-        return len;
+        written_bytes_.fetch_add(static_cast<uint64_t>(ret), std::memory_order_relaxed);
     }
-    if (len == 0)
+    if (ret >= 0)
     {
-        // No data returned, just return -ENODATA
-        return -ENODATA;
+        capture(LinkCapture::Direction::TX, batch_frames_.data(), static_cast<int>(batch_frames_.size()));
     }
-
-    if (ringbuf_.bytes_used() >= header_len)
+    metrics_.record(Metrics::Stage::WRITE, write_start, metrics_.now());
+    if (ret < 0)
     {
-        ssize_t len = find_and_copy_message(topic_ID, out_buffer, buffer_len);
-        if (len >= 0)
+        // The frames were counted as sent when they went into the batch, so
+        // this only adds to their write failures.
+        for (topic_id_size_t batch_topic_ID : batch_topic_IDs_)
         {
-            return len;
+            metrics_.drop(Metrics::Direction::TX, batch_topic_ID, Metrics::Drop::WRITE);
         }
     }
+    batch_frames_.clear();
+    batch_topic_IDs_.clear();
 
-    return -ENODATA;
+    return ret;
 }
 
-size_t Transporter::get_header_length()
+int Transporter::set_bundling(topic_id_size_t bundle_topic_ID, size_t bundle_size)
 {
-    if (backend_protocol_ == SerialProtocol::PX4)
+    // Topics 0 and 1 carry the mappings and the topic control messages.
+    size_t max_payload = backend_protocol_ == SerialProtocol::V2 ? std::numeric_limits<uint32_t>::max()
+                                                                 : std::numeric_limits<uint16_t>::max();
+    if (bundle_topic_ID == 1 || bundle_topic_ID > get_max_topic_ID() || bundle_size > max_payload)
     {
-        return sizeof(PX4Header);
+        return -1;
     }
-    if (backend_protocol_ == SerialProtocol::COBS)
+
+    std::lock_guard<std::mutex> lock(write_mutex_);
+
+    if (flush_bundle_locked() < 0)
     {
-        return sizeof(COBSHeader);
+        return -1;
     }
 
-    throw std::runtime_error("Unknown protocol");
+    bundle_topic_ID_ = bundle_topic_ID;
+    bundle_size_ = bundle_topic_ID != 0 ? bundle_size : 0;
+    if (bundle_topic_ID == 0)
+    {
+        fixed_lengths_.clear();
+    }
+    if (bundle_size_ > 0)
+    {
+        bundle_buf_ = std::unique_ptr<uint8_t[]>(new uint8_t[bundle_size_]);
+        // Every record is at least two bytes long, so this bounds the number
+        // of payloads in a bundle and the vector never grows.
+        bundle_topic_IDs_.reserve(bundle_size_ / 2 + 1);
+    }
+    else
+    {
+        bundle_buf_.reset();
+    }
+
+    return 0;
 }
 
-// This function stuffs length bytes of data at the location pointed to by
-// input, writing the output to the location pointed to by output.  In the worst
-// case (long sequences of data with no 0 in them), this can expand the
-// destination buffer requirements by 1 byte for the header plus one byte for
-// every 254 bytes.
-//
-// Returns the length of the encoded data.
-size_t cobs_stuff_data(const uint8_t *input, size_t length, uint8_t *output)
+int Transporter::set_fixed_length(topic_id_size_t topic_ID, uint32_t length)
 {
-    size_t read_index = 0;
-    size_t write_index = 1;
-    size_t code_index = 0;
-    uint8_t code = 1;
-
-    while (read_index < length)
+    if (bundle_topic_ID_ == 0 || topic_ID == bundle_topic_ID_ || length == 0)
     {
-        if (input[read_index] == 0)
-        {
-            output[code_index] = code;
-            code = 1;
-            code_index = write_index++;
-            read_index++;
-        }
-        else
-        {
-            output[write_index++] = input[read_index++];
-            code++;
-            if (code == 0xFF)
-            {
-                output[code_index] = code;
-                code = 1;
-                code_index = write_index++;
-            }
-        }
+        return -1;
     }
 
-    output[code_index] = code;
+    fixed_lengths_[topic_ID] = length;
 
-    return write_index;
+    return 0;
 }
 
-ssize_t Transporter::write(topic_id_size_t topic_ID, uint8_t const *buffer, size_t data_length)
+int Transporter::bundle_locked(topic_id_size_t topic_ID, const uint8_t *record_header, size_t record_header_len,
+                               const struct iovec *iov, int iovcnt, size_t data_length)
 {
-    if (!fds_OK())
+    if (bundle_len_ + record_header_len + data_length > bundle_size_ && flush_bundle_locked() < 0)
     {
         return -1;
     }
 
-    // We allow nullptr buffer and 0 length, or non-nullptr buffer and > 0 length,
-    // but not nullptr buffer and > 0 length or non-nullptr buffer and 0 length.
-    if ((buffer == nullptr && data_length > 0) ||
-        (buffer != nullptr && data_length == 0))
+    uint8_t *out = bundle_buf_.get() + bundle_len_;
+    size_t offset = record_header_len;
+    ::memcpy(out, record_header, record_header_len);
+    for (int i = 0; i < iovcnt; ++i)
     {
-        return -1;
+        ::memcpy(out + offset, iov[i].iov_base, iov[i].iov_len);
+        offset += iov[i].iov_len;
     }
+    bundle_len_ += offset;
+    bundle_topic_IDs_.push_back(topic_ID);
 
-    std::lock_guard<std::mutex> lock(write_mutex_);
-
-    size_t header_len = get_header_length();
-
-    std::unique_ptr<uint8_t[]> write_buf;
-
-    uint16_t crc = crc16(buffer, data_length);
-
-    size_t write_length;
+    return 0;
+}
 
-    if (backend_protocol_ == SerialProtocol::PX4)
+ssize_t Transporter::flush_bundle_locked()
+{
+    if (bundle_len_ == 0)
     {
-        PX4Header header{};
-        header.marker[0] = '>';
-        header.marker[1] = '>';
-        header.marker[2] = '>';
-
-        // [>,>,>,topic_ID,seq,payload_length,CRCHigh,CRCLow,payload_start, ... ,payload_end]
-
-        header.topic_ID = topic_ID;
-        header.seq = seq_++;
-        header.payload_len_h = (data_length >> 8U) & 0xffU;
-        header.payload_len_l = data_length & 0xffU;
-        header.crc_h = static_cast<uint8_t>(crc >> 8U);
-        header.crc_l = crc & 0xffU;
-
-        write_length = header_len + data_length;
-        write_buf = std::unique_ptr<uint8_t[]>(new uint8_t[write_length]);
-
-        // Assemble the packet
-        ::memcpy(write_buf.get(), &header, header_len);
-        if (buffer != nullptr)
-        {
-            ::memcpy(write_buf.get() + header_len, buffer, data_length);
-        }
+        return 0;
     }
-    else if (backend_protocol_ == SerialProtocol::COBS)
-    {
-        COBSHeader header{};
 
-        // We'll use COBS (https://en.wikipedia.org/wiki/Consistent_Overhead_Byte_Stuffing)
-        // along with a well-known header.  Make sure the passed-in buffer has
-        // enough space for the header plus the stuffed payload.
-        size_t data_plus_header = header_len + data_length;
-        // COBS guarantees that the maximum length is the length of the data,
-        // plus one overhead byte per run of 254 or larger non-zero bytes,
-        // plus 1 byte for the header.  There is also one byte for the 00 added
-        // to the end to denote end-of-packet.
-        size_t needed_length = data_plus_header + data_plus_header / 254 + 1 + 1;
+    // The bundle counts as empty while it is being framed, so that flushing
+    // the batch to make room for it doesn't send it again.
+    size_t len = bundle_len_;
+    bundle_len_ = 0;
 
-        header.topic_ID = topic_ID;
-        // This is the payload length without the header and before stuffing
-        header.payload_len_h = (data_length >> 8U) & 0xffU;
-        header.payload_len_l = data_length & 0xffU;
-        header.crc_h = static_cast<uint8_t>(crc >> 8U);
-        header.crc_l = crc & 0xffU;
+    struct iovec iov{bundle_buf_.get(), len};
+    bool crc32c = backend_protocol_ == SerialProtocol::V2 && crc32c_;
+    ssize_t written = write_frame_locked(bundle_topic_ID_, &iov, 1, len, crc32c ? V2_FLAG_CRC32C : 0,
+                                         payload_crc(&iov, 1, crc32c), metrics_.now());
+    if (written < 0 && errno == EBUSY)
+    {
+        // Flow control held it back; it goes out once there are credits.
+        bundle_len_ = len;
+        return -1;
+    }
 
-        std::unique_ptr<uint8_t[]> intermediate_buf = std::unique_ptr<uint8_t[]>(new uint8_t[data_plus_header]);
-        ::memcpy(intermediate_buf.get(), &header, header_len);
-        if (buffer != nullptr)
+    if (written < 0)
+    {
+        // The payloads were counted as sent when they went into the bundle,
+        // so this only adds to their write failures.
+        for (topic_id_size_t bundle_topic_ID : bundle_topic_IDs_)
         {
-            ::memcpy(intermediate_buf.get() + header_len, buffer, data_length);
+            metrics_.drop(Metrics::Direction::TX, bundle_topic_ID, Metrics::Drop::WRITE);
         }
-
-        write_buf = std::unique_ptr<uint8_t[]>(new uint8_t[needed_length]);
-        // OK, now stuff it
-        size_t stuffed_length = cobs_stuff_data(intermediate_buf.get(), data_plus_header, write_buf.get());
-        // Force the last byte to be 0 to mark the end-of-packet
-        *(write_buf.get() + stuffed_length) = '\0';
-
-        write_length = stuffed_length + 1;
     }
     else
     {
-        throw std::runtime_error("Unknown protocol");
+        metrics_.message(Metrics::Direction::TX, bundle_topic_ID_, len);
     }
+    bundle_topic_IDs_.clear();
 
-    // To hide the details of the serialization protocol from the higher layers,
-    // we return the payload length if we were successful here.
-    ssize_t written = node_write(write_buf.get(), write_length);
-    if (written < 0)
-    {
-        return written;
-    }
+    return written;
+}
 
-    return data_length;
+bool Transporter::bundle_holds_locked(topic_id_size_t topic_ID) const
+{
+    return std::find(bundle_topic_IDs_.begin(), bundle_topic_IDs_.end(), topic_ID) != bundle_topic_IDs_.end();
 }
 
 }  // namespace transport
@@ -0,0 +1,664 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ros2_serial_example/bonded_transporter.hpp"
+#include "ros2_serial_example/can_transporter.hpp"
+#include "ros2_serial_example/replay_transporter.hpp"
+#include "ros2_serial_example/sharded_transporter.hpp"
+#include "ros2_serial_example/shm_transporter.hpp"
+#include "ros2_serial_example/tcp_transporter.hpp"
+#include "ros2_serial_example/transporter.hpp"
+#include "ros2_serial_example/transporter_factory.hpp"
+#include "ros2_serial_example/uart_transporter.hpp"
+#include "ros2_serial_example/udp_transporter.hpp"
+#include "ros2_serial_example/usb_transporter.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+namespace
+{
+
+// The size of the queue each UDP receive shard hands its messages over in.
+constexpr size_t UDP_SHARD_QUEUE_BYTES = 1024 * 1024;
+
+std::string require_string(const TransporterConfig & config, const std::string & name)
+{
+    std::string value;
+    if (!config.get_string || !config.get_string(name, &value))
+    {
+        throw std::runtime_error("No " + name + " parameter specified, cannot continue");
+    }
+    return value;
+}
+
+int64_t require_int(const TransporterConfig & config, const std::string & name, int64_t min, int64_t max)
+{
+    int64_t value;
+    if (!config.get_int || !config.get_int(name, &value))
+    {
+        throw std::runtime_error("No " + name + " parameter specified, cannot continue");
+    }
+    if (value < min || value > max)
+    {
+        throw std::runtime_error("Invalid " + name + " parameter; must be between " + std::to_string(min) +
+                                 " and " + std::to_string(max) + " inclusive");
+    }
+    return value;
+}
+
+std::unique_ptr<Transporter> create_uart(const TransporterConfig & config)
+{
+    std::string device = require_string(config, "device");
+    int64_t baudrate = require_int(config, "baudrate", 0, std::numeric_limits<uint32_t>::max());
+
+    auto uart = std::make_unique<UARTTransporter>(device,
+                                                  config.protocol,
+                                                  static_cast<uint32_t>(baudrate),
+                                                  config.read_poll_ms,
+                                                  config.ring_buffer_size);
+
+    bool low_latency = false;
+    bool flow_control = false;
+    bool io_uring = false;
+    bool reconnect = false;
+    bool estimate_arrival = false;
+    if (config.get_bool)
+    {
+        config.get_bool("uart_low_latency", &low_latency);
+        config.get_bool("uart_flow_control", &flow_control);
+        config.get_bool("io_uring", &io_uring);
+        config.get_bool("uart_reconnect", &reconnect);
+        config.get_bool("uart_estimate_arrival", &estimate_arrival);
+    }
+    uart->set_low_latency(low_latency);
+    uart->set_flow_control(flow_control);
+    uart->set_io_uring(io_uring);
+    uart->set_reconnect(reconnect);
+    uart->set_arrival_estimate(estimate_arrival);
+
+    bool rs485 = false;
+    int64_t rs485_delay_before_ms = 0;
+    int64_t rs485_delay_after_ms = 0;
+    if (config.get_bool)
+    {
+        config.get_bool("uart_rs485", &rs485);
+    }
+    if (config.get_int)
+    {
+        config.get_int("uart_rs485_delay_before_ms", &rs485_delay_before_ms);
+        config.get_int("uart_rs485_delay_after_ms", &rs485_delay_after_ms);
+    }
+    int64_t max_delay_ms = UARTTransporter::RS485_MAX_DELAY_MS;
+    if (rs485_delay_before_ms < 0 || rs485_delay_before_ms > max_delay_ms ||
+        rs485_delay_after_ms < 0 || rs485_delay_after_ms > max_delay_ms ||
+        uart->set_rs485(rs485, static_cast<uint32_t>(rs485_delay_before_ms),
+                        static_cast<uint32_t>(rs485_delay_after_ms)) < 0)
+    {
+        throw std::runtime_error("Invalid uart_rs485_delay_before_ms or uart_rs485_delay_after_ms; must be between 0 and " +
+                                 std::to_string(UARTTransporter::RS485_MAX_DELAY_MS) + " inclusive");
+    }
+
+    return uart;
+}
+
+// Parse a peer of the form "address:port" or "address:port:ID,ID,...", where
+// the IDs can be at most max_topic_ID.
+UDPTransporter::Peer parse_udp_peer(const std::string & spec, topic_id_size_t max_topic_ID)
+{
+    UDPTransporter::Peer peer;
+    std::string error = "Invalid udp_peers entry '" + spec + "'; must be of the form address:port[:topic_ID,...]";
+
+    size_t port_pos = spec.find(':');
+    if (port_pos == std::string::npos || port_pos == 0)
+    {
+        throw std::runtime_error(error);
+    }
+    peer.address = spec.substr(0, port_pos);
+
+    size_t topics_pos = spec.find(':', port_pos + 1);
+    std::string port = spec.substr(port_pos + 1, topics_pos - port_pos - 1);
+    char *end = nullptr;
+    unsigned long value = std::strtoul(port.c_str(), &end, 10);
+    if (port.empty() || *end != '\0' || value == 0 || value > 65535)
+    {
+        throw std::runtime_error(error);
+    }
+    peer.port = static_cast<uint16_t>(value);
+
+    if (topics_pos == std::string::npos)
+    {
+        return peer;
+    }
+
+    std::string topics = spec.substr(topics_pos + 1);
+    size_t pos = 0;
+    while (pos <= topics.size())
+    {
+        size_t comma = topics.find(',', pos);
+        std::string id = topics.substr(pos, comma - pos);
+        value = std::strtoul(id.c_str(), &end, 10);
+        if (id.empty() || *end != '\0' || value > max_topic_ID)
+        {
+            throw std::runtime_error(error);
+        }
+        peer.topic_IDs.push_back(static_cast<topic_id_size_t>(value));
+        if (comma == std::string::npos)
+        {
+            break;
+        }
+        pos = comma + 1;
+    }
+
+    return peer;
+}
+
+std::unique_ptr<UDPTransporter> create_udp_socket(const TransporterConfig & config)
+{
+    int64_t udp_recv_port = require_int(config, "udp_recv_port", 1, 65535);
+    int64_t udp_send_port = require_int(config, "udp_send_port", 1, 65535);
+
+    // Datagram mode is optional, since the other side has to send exactly one
+    // frame per datagram.
+    int64_t udp_datagram_batch = 0;
+    if (config.get_int && config.get_int("udp_datagram_batch", &udp_datagram_batch) &&
+        (udp_datagram_batch < 0 || static_cast<uint64_t>(udp_datagram_batch) > UDPTransporter::MAX_DATAGRAM_BATCH))
+    {
+        throw std::runtime_error("Invalid udp_datagram_batch; must be between 0 and " +
+                                 std::to_string(UDPTransporter::MAX_DATAGRAM_BATCH) + " inclusive");
+    }
+
+    auto udp = std::make_unique<UDPTransporter>(config.protocol,
+                                                static_cast<uint16_t>(udp_recv_port),
+                                                static_cast<uint16_t>(udp_send_port),
+                                                config.read_poll_ms,
+                                                config.ring_buffer_size,
+                                                static_cast<size_t>(udp_datagram_batch));
+
+    std::string address;
+    if (config.get_string && config.get_string("udp_remote_address", &address) &&
+        udp->set_remote_address(address) < 0)
+    {
+        throw std::runtime_error("Invalid udp_remote_address '" + address + "'");
+    }
+
+    std::vector<std::string> peer_specs;
+    if (config.get_string_array && config.get_string_array("udp_peers", &peer_specs) && !peer_specs.empty())
+    {
+        std::vector<UDPTransporter::Peer> peers;
+        for (const std::string & spec : peer_specs)
+        {
+            peers.push_back(parse_udp_peer(spec, udp->get_max_topic_ID()));
+        }
+        if (udp->set_peers(peers) < 0)
+        {
+            throw std::runtime_error("Invalid udp_peers address");
+        }
+    }
+
+    std::string group;
+    if (config.get_string && config.get_string("udp_multicast_group", &group) && !group.empty() &&
+        udp->set_multicast_group(group) < 0)
+    {
+        throw std::runtime_error("Invalid udp_multicast_group '" + group + "'; must be an IPv4 multicast address");
+    }
+
+    int64_t recv_buffer_size = 0;
+    int64_t send_buffer_size = 0;
+    if (config.get_int)
+    {
+        config.get_int("udp_recv_buffer_size", &recv_buffer_size);
+        config.get_int("udp_send_buffer_size", &send_buffer_size);
+    }
+    if (recv_buffer_size < 0 || recv_buffer_size > std::numeric_limits<int>::max() ||
+        send_buffer_size < 0 || send_buffer_size > std::numeric_limits<int>::max() ||
+        udp->set_socket_buffer_sizes(static_cast<int>(recv_buffer_size), static_cast<int>(send_buffer_size)) < 0)
+    {
+        throw std::runtime_error("Invalid udp_recv_buffer_size or udp_send_buffer_size; must be >= 0");
+    }
+
+    bool io_uring = false;
+    if (config.get_bool)
+    {
+        config.get_bool("io_uring", &io_uring);
+    }
+    udp->set_io_uring(io_uring);
+
+    bool offload = false;
+    if (config.get_bool)
+    {
+        config.get_bool("udp_offload", &offload);
+    }
+    udp->set_offload(offload);
+
+    bool kernel_timestamps = false;
+    if (config.get_bool)
+    {
+        config.get_bool("udp_kernel_timestamps", &kernel_timestamps);
+    }
+    udp->set_kernel_timestamps(kernel_timestamps);
+
+    return udp;
+}
+
+std::unique_ptr<Transporter> create_udp(const TransporterConfig & config)
+{
+    int64_t shards = 1;
+    if (config.get_int && config.get_int("udp_recv_shards", &shards) &&
+        (shards < 1 || static_cast<uint64_t>(shards) > ShardedTransporter::MAX_SHARDS))
+    {
+        throw std::runtime_error("Invalid udp_recv_shards; must be between 1 and " +
+                                 std::to_string(ShardedTransporter::MAX_SHARDS) + " inclusive");
+    }
+    if (shards == 1)
+    {
+        return create_udp_socket(config);
+    }
+
+    bool steer_by_source = false;
+    if (config.get_bool)
+    {
+        config.get_bool("udp_steer_by_source", &steer_by_source);
+    }
+
+    // Every shard is a socket of its own on udp_recv_port, set up the same
+    // way; the kernel spreads the senders over them.
+    std::vector<std::unique_ptr<Transporter>> sockets;
+    for (int64_t i = 0; i < shards; ++i)
+    {
+        std::unique_ptr<UDPTransporter> udp = create_udp_socket(config);
+        udp->set_reuse_port(true);
+        if (steer_by_source && i == 0)
+        {
+            udp->set_source_steering(static_cast<uint32_t>(shards));
+        }
+        sockets.push_back(std::move(udp));
+    }
+
+    auto sharded = std::make_unique<ShardedTransporter>(config.protocol,
+                                                        std::move(sockets),
+                                                        config.read_poll_ms,
+                                                        config.ring_buffer_size,
+                                                        UDP_SHARD_QUEUE_BYTES);
+
+    std::vector<int64_t> cpus;
+    if (config.get_int_array && config.get_int_array("udp_recv_shard_cpus", &cpus) &&
+        sharded->set_shard_cpus(cpus) < 0)
+    {
+        throw std::runtime_error("Invalid udp_recv_shard_cpus; must be >= 0");
+    }
+
+    return sharded;
+}
+
+std::unique_ptr<Transporter> create_tcp(const TransporterConfig & config)
+{
+    TCPTransporter::Mode mode = TCPTransporter::Mode::CLIENT;
+    std::string modestring;
+    if (config.get_string && config.get_string("tcp_mode", &modestring))
+    {
+        if (modestring == "client")
+        {
+            mode = TCPTransporter::Mode::CLIENT;
+        }
+        else if (modestring == "server")
+        {
+            mode = TCPTransporter::Mode::SERVER;
+        }
+        else
+        {
+            throw std::runtime_error("Invalid tcp_mode; must be one of 'client' or 'server'");
+        }
+    }
+
+    // A server listens on every address unless told otherwise, but a client
+    // has to be told where to connect.
+    std::string address;
+    if (mode == TCPTransporter::Mode::CLIENT)
+    {
+        address = require_string(config, "tcp_address");
+    }
+    else if (config.get_string)
+    {
+        config.get_string("tcp_address", &address);
+    }
+    int64_t tcp_port = require_int(config, "tcp_port", 1, 65535);
+
+    auto tcp = std::make_unique<TCPTransporter>(config.protocol,
+                                                mode,
+                                                address,
+                                                static_cast<uint16_t>(tcp_port),
+                                                config.read_poll_ms,
+                                                config.ring_buffer_size);
+
+    int64_t recv_buffer_size = 0;
+    int64_t send_buffer_size = 0;
+    if (config.get_int)
+    {
+        config.get_int("tcp_recv_buffer_size", &recv_buffer_size);
+        config.get_int("tcp_send_buffer_size", &send_buffer_size);
+    }
+    if (recv_buffer_size < 0 || recv_buffer_size > std::numeric_limits<int>::max() ||
+        send_buffer_size < 0 || send_buffer_size > std::numeric_limits<int>::max() ||
+        tcp->set_socket_buffer_sizes(static_cast<int>(recv_buffer_size), static_cast<int>(send_buffer_size)) < 0)
+    {
+        throw std::runtime_error("Invalid tcp_recv_buffer_size or tcp_send_buffer_size; must be >= 0");
+    }
+
+    return tcp;
+}
+
+std::unique_ptr<Transporter> create_can(const TransporterConfig & config)
+{
+    std::string interface = require_string(config, "can_interface");
+
+    bool extended_ids = false;
+    if (config.get_bool)
+    {
+        config.get_bool("can_extended_ids", &extended_ids);
+    }
+    int64_t max_id = extended_ids ? CAN_EFF_MASK : CAN_SFF_MASK;
+
+    // The defaults leave room for 256 topic IDs each way with 11-bit IDs;
+    // the other side of the link has them the other way around.
+    int64_t tx_base_id = 0x100;
+    int64_t rx_base_id = 0x200;
+    int64_t frame_batch = 32;
+    if (config.get_int)
+    {
+        config.get_int("can_tx_base_id", &tx_base_id);
+        config.get_int("can_rx_base_id", &rx_base_id);
+        config.get_int("can_frame_batch", &frame_batch);
+    }
+    if (tx_base_id < 0 || tx_base_id > max_id || rx_base_id < 0 || rx_base_id > max_id)
+    {
+        throw std::runtime_error("Invalid can_tx_base_id or can_rx_base_id; must be between 0 and " +
+                                 std::to_string(max_id) + " inclusive");
+    }
+    if (frame_batch < 1 || static_cast<uint64_t>(frame_batch) > CANTransporter::MAX_FRAME_BATCH)
+    {
+        throw std::runtime_error("Invalid can_frame_batch; must be between 1 and " +
+                                 std::to_string(CANTransporter::MAX_FRAME_BATCH) + " inclusive");
+    }
+
+    return std::make_unique<CANTransporter>(config.protocol,
+                                            interface,
+                                            static_cast<uint32_t>(tx_base_id),
+                                            static_cast<uint32_t>(rx_base_id),
+                                            extended_ids,
+                                            config.read_poll_ms,
+                                            config.ring_buffer_size,
+                                            static_cast<size_t>(frame_batch));
+}
+
+std::unique_ptr<Transporter> create_usb(const TransporterConfig & config)
+{
+    int64_t vendor_id = require_int(config, "usb_vendor_id", 0, std::numeric_limits<uint16_t>::max());
+    int64_t product_id = require_int(config, "usb_product_id", 0, std::numeric_limits<uint16_t>::max());
+
+    std::string serial;
+    if (config.get_string)
+    {
+        config.get_string("usb_serial", &serial);
+    }
+
+    // The defaults suit the data interface of a CDC-ACM device.
+    int64_t interface = 1;
+    int64_t transfers = 4;
+    int64_t transfer_size = 4096;
+    if (config.get_int)
+    {
+        config.get_int("usb_interface", &interface);
+        config.get_int("usb_transfers", &transfers);
+        config.get_int("usb_transfer_size", &transfer_size);
+    }
+    if (interface < 0 || interface > std::numeric_limits<uint8_t>::max())
+    {
+        throw std::runtime_error("Invalid usb_interface; must be between 0 and 255 inclusive");
+    }
+    if (transfers < 1 || static_cast<uint64_t>(transfers) > USBTransporter::MAX_TRANSFERS)
+    {
+        throw std::runtime_error("Invalid usb_transfers; must be between 1 and " +
+                                 std::to_string(USBTransporter::MAX_TRANSFERS) + " inclusive");
+    }
+    if (transfer_size < 1 || transfer_size > std::numeric_limits<int32_t>::max())
+    {
+        throw std::runtime_error("Invalid usb_transfer_size; must be > 0");
+    }
+
+    return std::make_unique<USBTransporter>(config.protocol,
+                                            static_cast<uint16_t>(vendor_id),
+                                            static_cast<uint16_t>(product_id),
+                                            serial,
+                                            static_cast<uint8_t>(interface),
+                                            config.read_poll_ms,
+                                            config.ring_buffer_size,
+                                            static_cast<size_t>(transfers),
+                                            static_cast<size_t>(transfer_size));
+}
+
+std::unique_ptr<Transporter> create_shm(const TransporterConfig & config)
+{
+    // Everything is optional here; the defaults are suitable for a bridge
+    // talking to a single simulator on the same machine.
+    std::string shm_name{"/ros2_serial_bridge"};
+    if (config.get_string)
+    {
+        config.get_string("shm_name", &shm_name);
+    }
+
+    ShmTransporter::Role role = ShmTransporter::Role::CREATE;
+    std::string rolestring;
+    if (config.get_string && config.get_string("shm_role", &rolestring))
+    {
+        if (rolestring == "create")
+        {
+            role = ShmTransporter::Role::CREATE;
+        }
+        else if (rolestring == "attach")
+        {
+            role = ShmTransporter::Role::ATTACH;
+        }
+        else
+        {
+            throw std::runtime_error("Invalid shm_role; must be one of 'create' or 'attach'");
+        }
+    }
+
+    int64_t shm_ring_size = 65536;
+    if (config.get_int && config.get_int("shm_ring_size", &shm_ring_size) && shm_ring_size <= 0)
+    {
+        throw std::runtime_error("Invalid shm_ring_size; must be > 0");
+    }
+
+    return std::make_unique<ShmTransporter>(config.protocol,
+                                            shm_name,
+                                            role,
+                                            static_cast<size_t>(shm_ring_size),
+                                            config.read_poll_ms,
+                                            config.ring_buffer_size);
+}
+
+std::unique_ptr<Transporter> create_replay(const TransporterConfig & config)
+{
+    std::string replay_file = require_string(config, "replay_file");
+
+    bool realtime = true;
+    if (config.get_bool)
+    {
+        config.get_bool("replay_realtime", &realtime);
+    }
+
+    return std::make_unique<ReplayTransporter>(config.protocol,
+                                               replay_file,
+                                               realtime,
+                                               config.read_poll_ms,
+                                               config.ring_buffer_size);
+}
+
+std::unique_ptr<Transporter> create_bond(const TransporterConfig & config)
+{
+    std::vector<std::string> names;
+    if (!config.get_string_array || !config.get_string_array("bond_links", &names) || names.empty())
+    {
+        throw std::runtime_error("No bond_links parameter specified, cannot continue");
+    }
+
+    BondedTransporter::Mode mode = BondedTransporter::Mode::REDUNDANT;
+    std::string modestring;
+    if (config.get_string && config.get_string("bond_mode", &modestring) &&
+        !BondedTransporter::parse_mode(modestring, &mode))
+    {
+        throw std::runtime_error("Invalid bond_mode; must be one of 'stripe' or 'redundant'");
+    }
+
+    // Each link is set up like a transport of its own, from the parameters
+    // in its subsection, but with the protocol and buffers of the bond.
+    std::vector<std::unique_ptr<Transporter>> links;
+    for (const std::string & name : names)
+    {
+        std::string prefix = name + ".";
+        std::string backend = require_string(config, prefix + "backend_comms");
+
+        TransporterConfig link_config;
+        link_config.protocol = config.protocol;
+        link_config.read_poll_ms = config.read_poll_ms;
+        link_config.ring_buffer_size = config.ring_buffer_size;
+        if (config.get_string)
+        {
+            link_config.get_string = [config, prefix](const std::string & param, std::string * value) {
+                return config.get_string(prefix + param, value);
+            };
+        }
+        if (config.get_int)
+        {
+            link_config.get_int = [config, prefix](const std::string & param, int64_t * value) {
+                return config.get_int(prefix + param, value);
+            };
+        }
+        if (config.get_bool)
+        {
+            link_config.get_bool = [config, prefix](const std::string & param, bool * value) {
+                return config.get_bool(prefix + param, value);
+            };
+        }
+        if (config.get_string_array)
+        {
+            link_config.get_string_array = [config, prefix](const std::string & param, std::vector<std::string> * value) {
+                return config.get_string_array(prefix + param, value);
+            };
+        }
+        if (config.get_int_array)
+        {
+            link_config.get_int_array = [config, prefix](const std::string & param, std::vector<int64_t> * value) {
+                return config.get_int_array(prefix + param, value);
+            };
+        }
+
+        links.push_back(TransporterFactory::instance().create(backend, link_config));
+    }
+
+    return std::make_unique<BondedTransporter>(config.protocol,
+                                               std::move(links),
+                                               mode,
+                                               config.read_poll_ms,
+                                               config.ring_buffer_size);
+}
+
+}  // namespace
+
+TransporterFactory & TransporterFactory::instance()
+{
+    static TransporterFactory factory;
+    return factory;
+}
+
+TransporterFactory::TransporterFactory()
+{
+    creators_["uart"] = create_uart;
+    creators_["udp"] = create_udp;
+    creators_["tcp"] = create_tcp;
+    creators_["can"] = create_can;
+    creators_["usb"] = create_usb;
+    creators_["shm"] = create_shm;
+    creators_["replay"] = create_replay;
+    creators_["bond"] = create_bond;
+}
+
+bool TransporterFactory::register_backend(const std::string & name, Creator creator)
+{
+    if (name.empty() || !creator)
+    {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    return creators_.emplace(name, creator).second;
+}
+
+std::unique_ptr<Transporter> TransporterFactory::create(const std::string & name, const TransporterConfig & config) const
+{
+    Creator creator;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = creators_.find(name);
+        if (it != creators_.end())
+        {
+            creator = it->second;
+        }
+    }
+
+    if (!creator)
+    {
+        std::string supported;
+        for (const std::string & backend : backends())
+        {
+            supported += (supported.empty() ? "'" : ", '") + backend + "'";
+        }
+        throw std::runtime_error("Invalid backend_comms type '" + name + "' specified; supported types are " + supported);
+    }
+
+    return creator(config);
+}
+
+std::vector<std::string> TransporterFactory::backends() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    std::vector<std::string> names;
+    for (const auto & c : creators_)
+    {
+        names.push_back(c.first);
+    }
+
+    return names;
+}
+
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
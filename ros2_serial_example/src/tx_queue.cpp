@@ -0,0 +1,955 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "ros2_serial_example/alloc_guard.hpp"
+#include "ros2_serial_example/async_log.hpp"
+#include "ros2_serial_example/congestion_control.hpp"
+#include "ros2_serial_example/metrics.hpp"
+#include "ros2_serial_example/time_sync.hpp"
+#include "ros2_serial_example/transporter.hpp"
+#include "ros2_serial_example/tx_queue.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+namespace impl
+{
+
+FrameQueue::FrameQueue(size_t capacity) : capacity_(capacity)
+{
+    if (capacity == 0)
+    {
+        throw std::runtime_error("FrameQueue capacity must be > 0");
+    }
+
+    // The sequence numbers can't tell a full slot from a free one with only
+    // one slot (both would be pos + 1), so always have at least two, and
+    // enforce the capacity separately in claim_push_slot().
+    num_slots_ = std::max<size_t>(capacity, 2);
+    slots_ = std::unique_ptr<Slot[]>(new Slot[num_slots_]);
+    for (size_t i = 0; i < num_slots_; ++i)
+    {
+        slots_[i].seq.store(i, std::memory_order_relaxed);
+    }
+}
+
+FrameQueue::Slot *FrameQueue::claim_push_slot(size_t *claimed_pos)
+{
+    Slot *slot;
+    size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        slot = &slots_[pos % num_slots_];
+        size_t seq = slot->seq.load(std::memory_order_acquire);
+        intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+        if (diff == 0)
+        {
+            // The slot is free, so consumers can't be past it; if there are
+            // already capacity payloads ahead of it, the queue is full.
+            if (num_slots_ != capacity_ && pos - dequeue_pos_.load(std::memory_order_acquire) >= capacity_)
+            {
+                return nullptr;
+            }
+
+            // Try to claim the slot.
+            if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            // The slot still holds the payload from one lap ago, so the
+            // queue is full.
+            return nullptr;
+        }
+        else
+        {
+            // Another producer claimed this position first.
+            pos = enqueue_pos_.load(std::memory_order_relaxed);
+        }
+    }
+
+    *claimed_pos = pos;
+
+    return slot;
+}
+
+bool FrameQueue::try_push(uint8_t const *buffer, size_t length, std::chrono::steady_clock::time_point stamp)
+{
+    size_t pos;
+    Slot *slot = claim_push_slot(&pos);
+    if (slot == nullptr)
+    {
+        return false;
+    }
+
+    slot->data.assign(buffer, buffer + length);
+    slot->stamp = stamp;
+    slot->seq.store(pos + 1, std::memory_order_release);
+
+    return true;
+}
+
+bool FrameQueue::try_push(std::vector<uint8_t> *in, std::chrono::steady_clock::time_point stamp)
+{
+    size_t pos;
+    Slot *slot = claim_push_slot(&pos);
+    if (slot == nullptr)
+    {
+        return false;
+    }
+
+    in->swap(slot->data);
+    slot->stamp = stamp;
+    slot->seq.store(pos + 1, std::memory_order_release);
+
+    return true;
+}
+
+bool FrameQueue::try_pop(std::vector<uint8_t> *out, std::chrono::steady_clock::time_point *stamp)
+{
+    Slot *slot;
+    size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        slot = &slots_[pos % num_slots_];
+        size_t seq = slot->seq.load(std::memory_order_acquire);
+        intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+        if (diff == 0)
+        {
+            // The slot holds a payload; try to claim it.
+            if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            // The queue is empty.
+            return false;
+        }
+        else
+        {
+            // Another consumer claimed this position first.
+            pos = dequeue_pos_.load(std::memory_order_relaxed);
+        }
+    }
+
+    if (out != nullptr)
+    {
+        out->swap(slot->data);
+    }
+    if (stamp != nullptr)
+    {
+        *stamp = slot->stamp;
+    }
+
+    // Hand the slot back to producers for the next lap.
+    slot->seq.store(pos + num_slots_, std::memory_order_release);
+
+    return true;
+}
+
+bool FrameQueue::empty() const
+{
+    // The slot at the dequeue position only has its sequence number bumped
+    // once a producer has finished filling it.
+    size_t pos = dequeue_pos_.load(std::memory_order_acquire);
+    return slots_[pos % num_slots_].seq.load(std::memory_order_acquire) != pos + 1;
+}
+
+size_t FrameQueue::size() const
+{
+    // The dequeue position is read first, so it can't be ahead of the
+    // enqueue position read after it.
+    size_t dequeued = dequeue_pos_.load(std::memory_order_acquire);
+    size_t enqueued = enqueue_pos_.load(std::memory_order_acquire);
+    return std::min(enqueued - dequeued, capacity_);
+}
+
+void FrameQueue::reserve(size_t max_payload)
+{
+    for (size_t i = 0; i < num_slots_; ++i)
+    {
+        slots_[i].data.reserve(max_payload);
+    }
+}
+
+}  // namespace impl
+
+TxQueue::TxQueue(Transporter * transporter) : transporter_(transporter)
+{
+    if (transporter == nullptr)
+    {
+        throw std::runtime_error("Invalid transporter pointer passed");
+    }
+
+    wakeup_fd_ = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (wakeup_fd_ < 0)
+    {
+        throw std::runtime_error("Failed to create TxQueue wakeup eventfd");
+    }
+}
+
+TxQueue::~TxQueue()
+{
+    stop();
+    ::close(wakeup_fd_);
+}
+
+int TxQueue::add_topic(topic_id_size_t topic_ID, size_t depth, OverflowPolicy policy)
+{
+    if (depth == 0 || running_ || queues_.count(topic_ID) != 0)
+    {
+        return -1;
+    }
+
+    std::unique_ptr<TopicQueue> q = std::make_unique<TopicQueue>(topic_ID, depth, policy);
+    queue_list_.push_back(q.get());
+    queues_[topic_ID] = std::move(q);
+
+    return 0;
+}
+
+int TxQueue::set_priority(topic_id_size_t topic_ID, uint8_t priority)
+{
+    auto it = queues_.find(topic_ID);
+    if (running_ || it == queues_.end())
+    {
+        return -1;
+    }
+
+    it->second->priority = priority;
+
+    return 0;
+}
+
+int TxQueue::set_max_rate(topic_id_size_t topic_ID, double max_rate_hz)
+{
+    auto it = queues_.find(topic_ID);
+    if (running_ || it == queues_.end() || !(max_rate_hz >= 0.0))
+    {
+        return -1;
+    }
+
+    if (max_rate_hz == 0.0)
+    {
+        it->second->min_interval = std::chrono::steady_clock::duration::zero();
+    }
+    else
+    {
+        it->second->min_interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / max_rate_hz));
+    }
+
+    return 0;
+}
+
+int TxQueue::set_max_age(topic_id_size_t topic_ID, uint32_t max_age_ms)
+{
+    auto it = queues_.find(topic_ID);
+    if (running_ || it == queues_.end())
+    {
+        return -1;
+    }
+
+    it->second->max_age = std::chrono::milliseconds(max_age_ms);
+
+    return 0;
+}
+
+bool TxQueue::has_topic(topic_id_size_t topic_ID) const
+{
+    return queues_.count(topic_ID) != 0;
+}
+
+ssize_t TxQueue::get_queue_depth(topic_id_size_t topic_ID) const
+{
+    auto it = queues_.find(topic_ID);
+    if (it == queues_.end())
+    {
+        return -1;
+    }
+
+    return static_cast<ssize_t>(it->second->queue.size());
+}
+
+int TxQueue::set_flush_delay(uint32_t delay_us)
+{
+    if (running_)
+    {
+        return -1;
+    }
+
+    flush_delay_us_ = delay_us;
+
+    return 0;
+}
+
+int TxQueue::set_congestion_control(uint32_t target_us, uint32_t interval_us)
+{
+    if (running_ || (target_us > 0 && interval_us == 0))
+    {
+        return -1;
+    }
+
+    congestion_target_us_ = target_us;
+    congestion_interval_us_ = interval_us;
+
+    return 0;
+}
+
+int TxQueue::set_tx_slot(uint32_t cycle_us, uint32_t offset_us, uint32_t length_us, uint32_t guard_us,
+                         const TimeSync * clock)
+{
+    if (running_ ||
+        (cycle_us > 0 && (offset_us >= cycle_us || length_us == 0 || length_us > cycle_us ||
+                          2 * static_cast<uint64_t>(guard_us) >= length_us)))
+    {
+        return -1;
+    }
+
+    slot_cycle_ns_ = static_cast<int64_t>(cycle_us) * 1000;
+    slot_offset_ns_ = static_cast<int64_t>(offset_us) * 1000;
+    slot_length_ns_ = static_cast<int64_t>(length_us) * 1000;
+    slot_guard_ns_ = static_cast<int64_t>(guard_us) * 1000;
+    slot_clock_ = clock;
+
+    return 0;
+}
+
+int TxQueue::reserve_payloads(size_t max_payload)
+{
+    if (running_)
+    {
+        return -1;
+    }
+
+    for (TopicQueue *q : queue_list_)
+    {
+        q->queue.reserve(max_payload);
+        q->partial.reserve(max_payload);
+    }
+    reserved_payload_ = max_payload;
+
+    return 0;
+}
+
+void TxQueue::start()
+{
+    if (running_ || (queue_list_.empty() && flush_delay_us_ == 0))
+    {
+        return;
+    }
+
+    // Group the queues by priority, keeping the order they were added in
+    // within each priority.
+    classes_.clear();
+    for (TopicQueue *q : queue_list_)
+    {
+        auto it = std::find_if(classes_.begin(), classes_.end(),
+                               [q](const PriorityClass & c) {return c.priority == q->priority;});
+        if (it == classes_.end())
+        {
+            classes_.emplace_back();
+            it = classes_.end() - 1;
+            it->priority = q->priority;
+        }
+        it->queues.push_back(q);
+    }
+    std::sort(classes_.begin(), classes_.end(),
+              [](const PriorityClass & a, const PriorityClass & b) {return a.priority > b.priority;});
+
+    congestion_.reset();
+    if (congestion_target_us_ > 0 && !classes_.empty())
+    {
+        congestion_ = std::make_unique<CongestionControl>(std::chrono::microseconds(congestion_target_us_),
+                                                          std::chrono::microseconds(congestion_interval_us_),
+                                                          classes_.size());
+    }
+
+    // A writer waiting for receive credits sleeps until more are granted.
+    if (transporter_->get_flow_control())
+    {
+        transporter_->set_credit_notify([this]() {
+            uint64_t one = 1;
+            if (::write(wakeup_fd_, &one, sizeof(one)) != static_cast<ssize_t>(sizeof(one)) && errno != EAGAIN)
+            {
+                ROS2_SERIAL_LOG(WARN, "Failed to wake up TxQueue writer thread (%d)", errno);
+            }
+        });
+    }
+
+    running_ = true;
+    writer_thread_ = std::thread(&TxQueue::writer_thread_func, this);
+}
+
+void TxQueue::stop()
+{
+    if (!running_)
+    {
+        return;
+    }
+
+    running_ = false;
+    // Unconditionally poke the writer; it may be waiting for the transport
+    // to become writable rather than for new payloads.
+    uint64_t one = 1;
+    if (::write(wakeup_fd_, &one, sizeof(one)) != static_cast<ssize_t>(sizeof(one)))
+    {
+        ::fprintf(stderr, "Failed to wake up TxQueue writer thread (%d)\n", errno);
+    }
+    writer_thread_.join();
+
+    if (transporter_->get_flow_control())
+    {
+        transporter_->set_credit_notify(std::function<void()>());
+    }
+}
+
+bool TxQueue::native_handle(std::thread::native_handle_type * handle)
+{
+    if (!running_)
+    {
+        return false;
+    }
+    *handle = writer_thread_.native_handle();
+    return true;
+}
+
+ssize_t TxQueue::write(topic_id_size_t topic_ID, uint8_t const *buffer, size_t length)
+{
+    auto it = queues_.find(topic_ID);
+    if (it == queues_.end())
+    {
+        ssize_t ret = transporter_->write(topic_ID, buffer, length);
+        if (flush_delay_us_ > 0 && running_)
+        {
+            // The frame may be sitting in the transporter's batch buffer, so
+            // make sure the writer knows to flush it.
+            wake_writer();
+        }
+        return ret;
+    }
+
+    if (nullptr == buffer && length != 0)
+    {
+        return -1;
+    }
+
+    if (!running_)
+    {
+        errno = ESHUTDOWN;
+        return -1;
+    }
+
+    // Only topics with a max age need to know when their payloads were
+    // queued.
+    TopicQueue *q = it->second.get();
+    std::chrono::steady_clock::time_point queued_at;
+    if (q->max_age.count() > 0)
+    {
+        queued_at = std::chrono::steady_clock::now();
+    }
+    while (!q->queue.try_push(buffer, length, queued_at))
+    {
+        if (!make_room(q))
+        {
+            return -1;
+        }
+    }
+
+    wake_writer();
+
+    return length;
+}
+
+ssize_t TxQueue::write(topic_id_size_t topic_ID, std::vector<uint8_t> *payload)
+{
+    if (nullptr == payload)
+    {
+        return -1;
+    }
+
+    auto it = queues_.find(topic_ID);
+    if (it == queues_.end())
+    {
+        return write(topic_ID, payload->data(), payload->size());
+    }
+
+    if (!running_)
+    {
+        errno = ESHUTDOWN;
+        return -1;
+    }
+
+    size_t length = payload->size();
+    TopicQueue *q = it->second.get();
+    std::chrono::steady_clock::time_point queued_at;
+    if (q->max_age.count() > 0)
+    {
+        queued_at = std::chrono::steady_clock::now();
+    }
+    while (!q->queue.try_push(payload, queued_at))
+    {
+        if (!make_room(q))
+        {
+            return -1;
+        }
+    }
+
+    wake_writer();
+
+    return length;
+}
+
+bool TxQueue::make_room(TopicQueue *q)
+{
+    if (q->policy == OverflowPolicy::DROP_NEWEST)
+    {
+        dropped_++;
+        errno = ENOBUFS;
+        return false;
+    }
+
+    // Make room by throwing away the oldest payload.  The writer may get to
+    // it first, in which case there is room now anyway.
+    if (q->queue.try_pop(nullptr))
+    {
+        dropped_++;
+    }
+
+    return true;
+}
+
+bool TxQueue::pop_fresh(TopicQueue *q, std::vector<uint8_t> *payload, std::chrono::steady_clock::time_point now)
+{
+    if (q->max_age.count() == 0)
+    {
+        return q->queue.try_pop(payload);
+    }
+
+    // Sending a payload that is already too old would only hold up the
+    // fresher ones behind it.
+    std::chrono::steady_clock::time_point queued_at;
+    while (q->queue.try_pop(payload, &queued_at))
+    {
+        if (now - queued_at <= q->max_age)
+        {
+            return true;
+        }
+        transporter_->get_metrics().drop(Metrics::Direction::TX, q->topic_ID, Metrics::Drop::STALE);
+    }
+
+    return false;
+}
+
+void TxQueue::wake_writer()
+{
+    // Only pay for the eventfd write if the writer is actually asleep.
+    if (writer_sleeping_.exchange(false))
+    {
+        uint64_t one = 1;
+        if (::write(wakeup_fd_, &one, sizeof(one)) != static_cast<ssize_t>(sizeof(one)))
+        {
+            ROS2_SERIAL_LOG(WARN, "Failed to wake up TxQueue writer thread (%d)", errno);
+        }
+    }
+}
+
+void TxQueue::write_frame(topic_id_size_t topic_ID, uint8_t const *buffer, size_t length)
+{
+    int write_fd = transporter_->get_write_fd();
+
+    while (running_)
+    {
+        if (transporter_->write(topic_ID, buffer, length) >= 0)
+        {
+            return;
+        }
+
+        if (errno != EBUSY || (write_fd < 0 && !transporter_->waiting_for_credits()))
+        {
+            ROS2_SERIAL_LOG(WARN, "TxQueue failed to write topic %d (%d)", topic_ID, errno);
+            return;
+        }
+
+        // The transport is backed up, or the other end has no room; sleep
+        // until it can take more data (or we are told to stop) and then try
+        // this frame again.
+        if (!wait_writable(write_fd))
+        {
+            return;
+        }
+    }
+}
+
+void TxQueue::write_fragment(TopicQueue *q)
+{
+    int write_fd = transporter_->get_write_fd();
+
+    while (running_)
+    {
+        if (transporter_->write_fragment(q->topic_ID, q->partial.data(), q->partial.size(), &q->cursor) >= 0)
+        {
+            q->sending = q->cursor.offset < q->partial.size();
+            return;
+        }
+
+        if (errno != EBUSY || (write_fd < 0 && !transporter_->waiting_for_credits()))
+        {
+            // The rest of the payload is no use to the other end without
+            // this fragment.
+            ROS2_SERIAL_LOG(WARN, "TxQueue failed to write fragment of topic %d (%d)", q->topic_ID, errno);
+            q->sending = false;
+            return;
+        }
+
+        if (!wait_writable(write_fd))
+        {
+            q->sending = false;
+            return;
+        }
+    }
+}
+
+bool TxQueue::wait_writable(int write_fd)
+{
+    if (transporter_->waiting_for_credits())
+    {
+        // The transport being writable is no help, so only wait to be woken
+        // up by a grant (or by stop()).  Nothing else wakes the writer while
+        // it is busy, so the wakeup can be taken here.
+        struct pollfd fd{};
+        fd.fd = wakeup_fd_;
+        fd.events = POLLIN;
+        if (::poll(&fd, 1, -1) < 0 && errno != EINTR)
+        {
+            ROS2_SERIAL_LOG(WARN, "TxQueue poll failed (%d)", errno);
+            return false;
+        }
+
+        uint64_t count;
+        if (::read(wakeup_fd_, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        {
+            ROS2_SERIAL_LOG(WARN, "Failed to read TxQueue wakeup eventfd (%d)", errno);
+        }
+
+        return true;
+    }
+
+    std::array<struct pollfd, 2> fds{};
+    fds[0].fd = write_fd;
+    fds[0].events = POLLOUT;
+    fds[1].fd = wakeup_fd_;
+    fds[1].events = POLLIN;
+    if (::poll(fds.data(), fds.size(), -1) < 0 && errno != EINTR)
+    {
+        ROS2_SERIAL_LOG(WARN, "TxQueue poll failed (%d)", errno);
+        return false;
+    }
+
+    return true;
+}
+
+bool TxQueue::write_queued_frame(std::vector<uint8_t> *payload, bool *rate_limited,
+                                 std::chrono::steady_clock::time_point *next_due)
+{
+    // Send one payload from the highest priority that has one ready.  Within
+    // a priority the queues take turns, so that a busy topic can't starve
+    // the others.  Queues that are waiting out their rate limit are skipped,
+    // but if they have a payload waiting the caller needs to know when to
+    // come back for it.  A payload that is sent in fragments only sends one
+    // at a time, so the higher priorities get to go in between.  The
+    // priorities that congestion control holds back are treated the same way
+    // as a rate limited queue, coming back at the next sample.
+    HotPathScope hot_path;
+    *rate_limited = false;
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    size_t allowed = classes_.size();
+    if (congestion_ != nullptr)
+    {
+        if (now >= next_congestion_sample_)
+        {
+            congestion_->sample(now, transporter_->get_write_queue_bytes(), transporter_->get_written_bytes(),
+                                transporter_->get_last_rtt_us());
+            next_congestion_sample_ = now + std::chrono::milliseconds(1);
+        }
+        allowed -= congestion_->get_shed_levels();
+    }
+    for (size_t level = 0; level < classes_.size(); ++level)
+    {
+        PriorityClass & c = classes_[level];
+        if (level >= allowed)
+        {
+            for (TopicQueue *q : c.queues)
+            {
+                if ((q->sending || !q->queue.empty()) && (!*rate_limited || next_congestion_sample_ < *next_due))
+                {
+                    *rate_limited = true;
+                    *next_due = next_congestion_sample_;
+                }
+            }
+            continue;
+        }
+
+        for (size_t i = 0; i < c.queues.size(); ++i)
+        {
+            size_t idx = (c.next + i) % c.queues.size();
+            TopicQueue *q = c.queues[idx];
+            if (q->sending)
+            {
+                // The rate limit was already applied to the first fragment.
+                c.next = (idx + 1) % c.queues.size();
+                writer_sleeping_ = false;
+                watchdog_.set_topic(q->topic_ID);
+                write_fragment(q);
+                return true;
+            }
+
+            if (now < q->next_send)
+            {
+                if (!q->queue.empty() && (!*rate_limited || q->next_send < *next_due))
+                {
+                    *rate_limited = true;
+                    *next_due = q->next_send;
+                }
+                continue;
+            }
+
+            if (pop_fresh(q, payload, now))
+            {
+                c.next = (idx + 1) % c.queues.size();
+                q->next_send = now + q->min_interval;
+                writer_sleeping_ = false;
+                watchdog_.set_topic(q->topic_ID);
+                size_t fragment_size = transporter_->get_fragment_size();
+                if (fragment_size > 0 && payload->size() > fragment_size)
+                {
+                    q->partial.swap(*payload);
+                    q->cursor = Transporter::FragmentCursor();
+                    q->sending = true;
+                    write_fragment(q);
+                }
+                else
+                {
+                    write_frame(q->topic_ID, payload->data(), payload->size());
+                }
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+void TxQueue::check_flush(bool *flush_pending, std::chrono::steady_clock::time_point *flush_at)
+{
+    if (flush_delay_us_ == 0)
+    {
+        return;
+    }
+
+    HotPathScope hot_path;
+    if (transporter_->get_pending_write_bytes() == 0)
+    {
+        *flush_pending = false;
+        return;
+    }
+
+    // The deadline starts from when we first notice the pending batch, and
+    // with a time slot, the batch has to be out before the slot closes.
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (!*flush_pending)
+    {
+        *flush_pending = true;
+        *flush_at = now + std::chrono::microseconds(flush_delay_us_);
+        if (slot_cycle_ns_ > 0)
+        {
+            *flush_at = std::min(*flush_at, std::max(now, slot_end_ - std::chrono::microseconds(flush_delay_us_)));
+        }
+    }
+    else if (now >= *flush_at)
+    {
+        if (transporter_->flush() < 0)
+        {
+            ROS2_SERIAL_LOG(WARN, "TxQueue failed to flush batch (%d)", errno);
+        }
+        *flush_pending = false;
+    }
+}
+
+bool TxQueue::in_slot(std::chrono::steady_clock::time_point now, std::chrono::steady_clock::time_point *until)
+{
+    // Work out where in the cycle we are on the agreed clock, and from that
+    // how long until the usable part of the slot ends (if we are in it) or
+    // starts (if we aren't).  Neither clock moves much against the steady
+    // clock over a cycle.
+    int64_t host_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    int64_t link_ns = host_ns;
+    if (slot_clock_ != nullptr && !slot_clock_->to_device(host_ns, &link_ns))
+    {
+        // There is no telling when the slot is yet; check again a cycle on.
+        *until = now + std::chrono::nanoseconds(slot_cycle_ns_);
+        return false;
+    }
+
+    int64_t pos = (link_ns - slot_offset_ns_) % slot_cycle_ns_;
+    if (pos < 0)
+    {
+        pos += slot_cycle_ns_;
+    }
+
+    if (pos >= slot_guard_ns_ && pos < slot_length_ns_ - slot_guard_ns_)
+    {
+        *until = now + std::chrono::nanoseconds(slot_length_ns_ - slot_guard_ns_ - pos);
+        return true;
+    }
+
+    int64_t wait_ns = (pos < slot_guard_ns_) ? slot_guard_ns_ - pos : slot_cycle_ns_ - pos + slot_guard_ns_;
+    *until = now + std::chrono::nanoseconds(wait_ns);
+    return false;
+}
+
+bool TxQueue::sleep_until(std::chrono::steady_clock::time_point const *wake_at)
+{
+    // Sleep until woken up, or until wake_at if it isn't a nullptr.
+    struct timespec timeout{};
+    struct timespec *timeoutp = nullptr;
+    if (wake_at != nullptr)
+    {
+        std::chrono::steady_clock::duration remaining = *wake_at - std::chrono::steady_clock::now();
+        if (remaining.count() < 0)
+        {
+            remaining = std::chrono::steady_clock::duration::zero();
+        }
+        std::chrono::seconds secs = std::chrono::duration_cast<std::chrono::seconds>(remaining);
+        timeout.tv_sec = secs.count();
+        timeout.tv_nsec = std::chrono::duration_cast<std::chrono::nanoseconds>(remaining - secs).count();
+        timeoutp = &timeout;
+    }
+
+    struct pollfd fd{};
+    fd.fd = wakeup_fd_;
+    fd.events = POLLIN;
+    if (::ppoll(&fd, 1, timeoutp, nullptr) < 0 && errno != EINTR)
+    {
+        ROS2_SERIAL_LOG(WARN, "TxQueue poll failed (%d)", errno);
+        return false;
+    }
+
+    uint64_t count;
+    if (::read(wakeup_fd_, &count, sizeof(count)) < 0 && errno != EAGAIN)
+    {
+        ROS2_SERIAL_LOG(WARN, "Failed to read TxQueue wakeup eventfd (%d)", errno);
+    }
+
+    return true;
+}
+
+void TxQueue::writer_thread_func()
+{
+    // The buffer swapped out of the queues each time goes back into them, so
+    // it has to be as big as theirs.
+    std::vector<uint8_t> payload;
+    payload.reserve(reserved_payload_);
+    bool flush_pending = false;
+    std::chrono::steady_clock::time_point flush_at;
+    bool rate_limited = false;
+    std::chrono::steady_clock::time_point next_due;
+
+    while (running_)
+    {
+        // Outside of the time slot, the payloads queue up until it opens;
+        // nobody needs to wake the writer up for them meanwhile, since
+        // writer_sleeping_ stays false.
+        if (slot_cycle_ns_ > 0 && !in_slot(std::chrono::steady_clock::now(), &slot_end_))
+        {
+            if (!sleep_until(&slot_end_))
+            {
+                break;
+            }
+            continue;
+        }
+
+        watchdog_.begin(watchdog_.now());
+        bool wrote = write_queued_frame(&payload, &rate_limited, &next_due);
+        check_flush(&flush_pending, &flush_at);
+        watchdog_.end(watchdog_.now(), 0);
+        if (wrote)
+        {
+            continue;
+        }
+
+        // Everything looked empty.  Announce that we are going to sleep and
+        // then check one more time, so that a producer that pushed just
+        // before the announcement isn't missed.
+        writer_sleeping_ = true;
+        watchdog_.begin(watchdog_.now());
+        wrote = write_queued_frame(&payload, &rate_limited, &next_due);
+        check_flush(&flush_pending, &flush_at);
+        watchdog_.end(watchdog_.now(), 0);
+        if (wrote)
+        {
+            continue;
+        }
+
+        // Sleep until woken up, until the pending batch is due, or until a
+        // rate limited topic with a payload waiting may send again.
+        std::chrono::steady_clock::time_point wake_at;
+        if (flush_pending || rate_limited)
+        {
+            wake_at = flush_pending ? flush_at : next_due;
+            if (flush_pending && rate_limited)
+            {
+                wake_at = std::min(flush_at, next_due);
+            }
+        }
+        if (!sleep_until((flush_pending || rate_limited) ? &wake_at : nullptr))
+        {
+            break;
+        }
+        writer_sleeping_ = false;
+    }
+
+    // Don't leave anything sitting in the batch.
+    if (flush_delay_us_ > 0 && transporter_->flush() < 0)
+    {
+        ::fprintf(stderr, "TxQueue failed to flush batch (%d)\n", errno);
+    }
+}
+
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
@@ -0,0 +1,67 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <map>
+#include <mutex>
+#include <string>
+
+#include <dlfcn.h>
+
+#include "ros2_serial_example/type_plugin.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace pubsub
+{
+
+const TypePlugin * load_type_plugin(const std::string & library, std::string * error)
+{
+    static std::mutex mutex;
+    static std::map<std::string, const TypePlugin *> loaded;
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto it = loaded.find(library);
+    if (it != loaded.end())
+    {
+        return it->second;
+    }
+
+    // Each plugin exports the same symbol, so keep them out of the global
+    // namespace and look the symbol up in the plugin itself.
+    void * handle = ::dlopen(library.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (handle == nullptr)
+    {
+        const char * reason = ::dlerror();
+        *error = reason != nullptr ? reason : "Failed to load '" + library + "'";
+        return nullptr;
+    }
+
+    void * symbol = ::dlsym(handle, ROS2_SERIAL_TYPE_PLUGIN_SYMBOL);
+    if (symbol == nullptr)
+    {
+        *error = "'" + library + "' is not a type plugin";
+        ::dlclose(handle);
+        return nullptr;
+    }
+
+    const TypePlugin * plugin = static_cast<const TypePlugin *>(symbol);
+    loaded[library] = plugin;
+
+    return plugin;
+}
+
+}  // namespace pubsub
+}  // namespace ros2_to_serial_bridge
@@ -34,22 +34,34 @@
 // https://github.com/PX4/px4_ros_com/blob/69bdf6e70f3832ff00f2e9e7f17d9394532787d6/templates/microRTPS_transport.cpp
 // but modified to split UART code out of the original transporter.
 
+#include <array>
 #include <cerrno>
+#include <chrono>
 #include <cmath>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <map>
+#include <memory>
 #include <stdexcept>
 #include <string>
 
 #include <fcntl.h>
 #include <poll.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
 #include <termios.h>
 #include <unistd.h>
 
+#include "ros2_serial_example/async_log.hpp"
+#include "ros2_serial_example/termios2.hpp"
 #include "ros2_serial_example/transporter.hpp"
 #include "ros2_serial_example/uart_transporter.hpp"
+#include "ros2_serial_example/uring_io.hpp"
 
 namespace ros2_to_serial_bridge
 {
@@ -57,11 +69,14 @@ namespace ros2_to_serial_bridge
 namespace transport
 {
 
-uint32_t baud_number_to_rate(uint32_t baud)
+constexpr uint32_t UARTTransporter::RECONNECT_RETRY_MS;
+constexpr uint32_t UARTTransporter::RS485_MAX_DELAY_MS;
+
+// This is a table of the standard baudrates as defined in
+// /usr/include/asm-generic/termbits.h
+static const std::map<uint32_t, uint32_t> & standard_baudrates()
 {
-    // This is a table of the standard baudrates as defined in
-    // /usr/include/asm-generic/termbits.h
-    static std::map<uint32_t, uint32_t> BaudNumberToRate{
+    static const std::map<uint32_t, uint32_t> BaudNumberToRate{
         {0,       B0},
         {50,      B50},
         {75,      B75},
@@ -94,11 +109,17 @@ uint32_t baud_number_to_rate(uint32_t baud)
         {4000000, B4000000},
     };
 
-    if (BaudNumberToRate.count(baud) == 0)
+    return BaudNumberToRate;
+}
+
+uint32_t baud_number_to_rate(uint32_t baud)
+{
+    auto it = standard_baudrates().find(baud);
+    if (it == standard_baudrates().end())
     {
         throw std::runtime_error("Invalid baudrate");
     }
-    return BaudNumberToRate[baud];
+    return it->second;
 }
 
 UARTTransporter::UARTTransporter(const std::string & uart_name,
@@ -108,9 +129,20 @@ UARTTransporter::UARTTransporter(const std::string & uart_name,
                                  size_t ring_buffer_size):
     Transporter(protocol, ring_buffer_size),
     uart_name_(uart_name),
+    baudrate_bps_(baudrate),
     read_poll_ms_(read_poll_ms)
 {
-    baudrate_ = baud_number_to_rate(baudrate);
+    // Rates without a B* constant are set with termios2 in init(), after the
+    // rest of the termios setup has been done with a placeholder rate.
+    if (standard_baudrates().count(baudrate) != 0)
+    {
+        baudrate_ = baud_number_to_rate(baudrate);
+    }
+    else
+    {
+        baudrate_ = B38400;
+        custom_baudrate_ = baudrate;
+    }
 }
 
 UARTTransporter::~UARTTransporter()
@@ -126,13 +158,71 @@ int UARTTransporter::init()
         return -1;
     }
 
+    if (rs485_ && flow_control_)
+    {
+        ::fprintf(stderr, "Cannot use hardware flow control on %s in RS-485 mode\n", uart_name_.c_str());
+        return -EINVAL;
+    }
+
+    int fd = open_uart(true);
+    if (fd < 0)
+    {
+        return fd;
+    }
+    uart_fd_ = fd;
+
+    poll_fd_[0].fd = uart_fd_;
+    poll_fd_[0].events = POLLIN;
+
+    if (reconnect_)
+    {
+        if (io_uring_)
+        {
+            ::fprintf(stderr, "Not using io_uring on %s, since it reconnects\n", uart_name_.c_str());
+        }
+        if (setup_reconnect() < 0)
+        {
+            close();
+            return -1;
+        }
+    }
+    else if (io_uring_)
+    {
+        try
+        {
+            uring_ = std::make_unique<impl::UringIo>(uart_fd_, uart_fd_, &ringbuf_, 0);
+        }
+        catch (const std::runtime_error & e)
+        {
+            ::fprintf(stderr, "Not using io_uring on %s: %s\n", uart_name_.c_str(), e.what());
+        }
+    }
+
+    connected_ = true;
+
+    return 0;
+}
+
+int UARTTransporter::open_uart(bool verbose)
+{
     // Open a serial port
-    uart_fd_ = ::open(uart_name_.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    int fd = ::open(uart_name_.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
 
-    if (uart_fd_ < 0)
+    if (fd < 0)
     {
-        ::fprintf(stderr, "failed to open device: %s (%d)\n", uart_name_.c_str(), errno);
-        return -errno;
+        int errno_bkp = errno;
+        if (verbose)
+        {
+            ::fprintf(stderr, "failed to open device: %s (%d)\n", uart_name_.c_str(), errno);
+        }
+        return -errno_bkp;
+    }
+
+    if (low_latency_ && impl::set_low_latency(fd, true) < 0)
+    {
+        // Not every driver supports this (pseudo-terminals don't, for
+        // instance), and the port still works without it.
+        ::fprintf(stderr, "Failed to set low latency mode on %s: %s\n", uart_name_.c_str(), ::strerror(errno));
     }
 
     // If a baudrate > 0 is specified, we setup the UART with that rate.
@@ -143,72 +233,417 @@ int UARTTransporter::init()
         int termios_state;
 
         // Back up the original uart configuration to restore it after exit
-        if ((termios_state = ::tcgetattr(uart_fd_, &uart_config)) < 0)
+        if ((termios_state = ::tcgetattr(fd, &uart_config)) < 0)
         {
             int errno_bkp = errno;
             ::fprintf(stderr, "ERR GET CONF %s: %d (%d)\n", uart_name_.c_str(), termios_state, errno);
-            close();
+            ::close(fd);
             return -errno_bkp;
         }
 
         // Set up the UART for non-canonical binary communication: 8 bits, 1 stop bit, no parity,
-        // no flow control, no modem control
+        // no software flow control, no modem control, and hardware flow
+        // control only if it was asked for
         uart_config.c_iflag &= ~(INPCK | ISTRIP | INLCR | IGNCR | ICRNL | IXON | IXANY | IXOFF);
         uart_config.c_iflag |= IGNBRK | IGNPAR;
 
         uart_config.c_oflag &= ~(OPOST | ONLCR | OCRNL | ONOCR | ONLRET | OFILL | NLDLY | VTDLY);
         uart_config.c_oflag |= NL0 | VT0;
 
-        uart_config.c_cflag &= ~(CSIZE | CSTOPB | PARENB);
+        uart_config.c_cflag &= ~(CSIZE | CSTOPB | PARENB | CRTSCTS);
         uart_config.c_cflag |= CS8 | CREAD | CLOCAL;
+        if (flow_control_)
+        {
+            uart_config.c_cflag |= CRTSCTS;
+        }
 
         uart_config.c_lflag &= ~(ISIG | ICANON | ECHO | TOSTOP | IEXTEN);
 
+        // The port is non-blocking and read only after poll() says there is
+        // data, so have read() return whatever has arrived straight away.
+        uart_config.c_cc[VMIN] = 0;
+        uart_config.c_cc[VTIME] = 0;
+
         // Set baud rate
         if (::cfsetispeed(&uart_config, baudrate_) < 0 || ::cfsetospeed(&uart_config, baudrate_) < 0)
         {
             int errno_bkp = errno;
             ::fprintf(stderr, "ERR SET BAUD %s: %d (%d)\n", uart_name_.c_str(), termios_state, errno);
-            close();
+            ::close(fd);
             return -errno_bkp;
         }
 
-        if ((termios_state = ::tcsetattr(uart_fd_, TCSANOW, &uart_config)) < 0)
+        if ((termios_state = ::tcsetattr(fd, TCSANOW, &uart_config)) < 0)
         {
             int errno_bkp = errno;
             ::fprintf(stderr, "ERR SET CONF %s (%d)\n", uart_name_.c_str(), errno);
-            close();
+            ::close(fd);
             return -errno_bkp;
         }
+
+        if (custom_baudrate_ != 0)
+        {
+            uint32_t actual = 0;
+            if (impl::set_custom_baudrate(fd, custom_baudrate_, &actual) < 0)
+            {
+                int errno_bkp = errno;
+                ::fprintf(stderr, "ERR SET CUSTOM BAUD %s: %u (%d)\n", uart_name_.c_str(), custom_baudrate_, errno);
+                ::close(fd);
+                return -errno_bkp;
+            }
+            if (actual != custom_baudrate_)
+            {
+                ::fprintf(stderr, "Baudrate on %s is %u instead of %u\n", uart_name_.c_str(), actual, custom_baudrate_);
+            }
+        }
+    }
+
+    if (rs485_ && impl::set_rs485(fd, true, rs485_delay_before_ms_, rs485_delay_after_ms_) < 0)
+    {
+        // Unlike low latency mode, nothing gets onto the bus without this.
+        int errno_bkp = errno;
+        ::fprintf(stderr, "Failed to set RS-485 mode on %s: %s\n", uart_name_.c_str(), ::strerror(errno));
+        ::close(fd);
+        return -errno_bkp;
     }
 
     // Flush out any pending data in the file descriptor.
     uint8_t aux[64];
-    while (0 < ::read(uart_fd_, &aux, 64))
+    while (0 < ::read(fd, &aux, 64))
     {
         ::usleep(1000);
     }
 
-    poll_fd_[0].fd = uart_fd_;
-    poll_fd_[0].events = POLLIN;
+    return fd;
+}
+
+int UARTTransporter::setup_reconnect()
+{
+    epoll_fd_ = ::epoll_create1(EPOLL_CLOEXEC);
+    inotify_fd_ = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    timer_fd_ = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (epoll_fd_ < 0 || inotify_fd_ < 0 || timer_fd_ < 0)
+    {
+        ::fprintf(stderr, "Failed to set up reconnecting on %s: %s\n", uart_name_.c_str(), ::strerror(errno));
+        return -1;
+    }
+
+    for (int fd : {uart_fd_, inotify_fd_, timer_fd_})
+    {
+        struct epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        if (::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) < 0)
+        {
+            ::fprintf(stderr, "Failed to set up reconnecting on %s: %s\n", uart_name_.c_str(), ::strerror(errno));
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+void UARTTransporter::disconnected()
+{
+    ROS2_SERIAL_LOG(WARN, "UART %s went away; waiting for it to come back", uart_name_.c_str());
+
+    connected_ = false;
+
+    // The dead file descriptor stays open until the device comes back, so
+    // that its number isn't handed out to something else in the meantime;
+    // it hangs up for good, so it is taken out of the epoll set.
+    ::epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, uart_fd_, nullptr);
+
+    // A frame cut short by the device going away would otherwise be glued to
+    // the start of the first one after it comes back.
+    ringbuf_.discard(ringbuf_.bytes_used());
+
+    watch_device();
+
+    struct itimerspec its{};
+    its.it_value.tv_sec = RECONNECT_RETRY_MS / 1000;
+    its.it_value.tv_nsec = static_cast<long>(RECONNECT_RETRY_MS % 1000) * 1000000L;
+    its.it_interval = its.it_value;
+    ::timerfd_settime(timer_fd_, 0, &its, nullptr);
+}
+
+void UARTTransporter::reopen()
+{
+    // The device node can show up before udev has given it its permissions
+    // or made its links, so failing to open it is nothing to report.
+    int fd = open_uart(false);
+    if (fd < 0)
+    {
+        // A directory on the way to the device may have just been made, in
+        // which case the watch can move down to it.
+        watch_device();
+        return;
+    }
+
+    // dup3() closes the dead file descriptor and puts the new one in its
+    // place atomically, so a writer never sees it go away.
+    if (::dup3(fd, uart_fd_, O_CLOEXEC) < 0)
+    {
+        ROS2_SERIAL_LOG(WARN, "Failed to replace UART %s: %s", uart_name_.c_str(), ::strerror(errno));
+        ::close(fd);
+        return;
+    }
+    ::close(fd);
+
+    struct epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = uart_fd_;
+    ::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, uart_fd_, &ev);
+
+    struct itimerspec its{};
+    ::timerfd_settime(timer_fd_, 0, &its, nullptr);
+    if (watch_fd_ != -1)
+    {
+        ::inotify_rm_watch(inotify_fd_, watch_fd_);
+        watch_fd_ = -1;
+    }
+
+    connected_ = true;
+
+    ROS2_SERIAL_LOG(INFO, "UART %s is back", uart_name_.c_str());
+}
+
+void UARTTransporter::watch_device()
+{
+    // Watch the directory the device shows up in or, if it doesn't exist,
+    // the nearest one above it that does; /dev/serial/by-id goes away along
+    // with the last USB serial device.  Anything happening in there is
+    // reason enough to try to open the device again.
+    std::string dir = uart_name_;
+    while (true)
+    {
+        size_t slash = dir.find_last_of('/');
+        if (slash == std::string::npos)
+        {
+            dir = ".";
+        }
+        else
+        {
+            dir = (slash == 0) ? "/" : dir.substr(0, slash);
+        }
+
+        int wd = ::inotify_add_watch(inotify_fd_, dir.c_str(), IN_CREATE | IN_ATTRIB | IN_MOVED_TO);
+        if (wd >= 0)
+        {
+            if (watch_fd_ != -1 && watch_fd_ != wd)
+            {
+                ::inotify_rm_watch(inotify_fd_, watch_fd_);
+            }
+            watch_fd_ = wd;
+            return;
+        }
+
+        if (dir == "/" || dir == ".")
+        {
+            // Only the retries are left.
+            return;
+        }
+    }
+}
+
+int UARTTransporter::set_low_latency(bool enable)
+{
+    if (fds_OK())
+    {
+        return -1;
+    }
+
+    low_latency_ = enable;
 
     return 0;
 }
 
+int UARTTransporter::set_arrival_estimate(bool enable)
+{
+    if (fds_OK())
+    {
+        return -1;
+    }
+
+    arrival_estimate_ = enable;
+    update_byte_time();
+
+    return 0;
+}
+
+void UARTTransporter::update_byte_time()
+{
+    // A byte on the wire is a start bit, 8 data bits and a stop bit.
+    std::chrono::nanoseconds byte_time(0);
+    if (arrival_estimate_ && baudrate_bps_ > 0)
+    {
+        byte_time = std::chrono::nanoseconds(10 * UINT64_C(1000000000) / baudrate_bps_);
+    }
+    set_rx_byte_time(byte_time);
+}
+
+int UARTTransporter::set_flow_control(bool enable)
+{
+    if (fds_OK())
+    {
+        return -1;
+    }
+
+    flow_control_ = enable;
+
+    return 0;
+}
+
+int UARTTransporter::set_io_uring(bool enable)
+{
+    if (fds_OK())
+    {
+        return -1;
+    }
+
+    io_uring_ = enable;
+
+    return 0;
+}
+
+int UARTTransporter::set_reconnect(bool enable)
+{
+    if (fds_OK())
+    {
+        return -1;
+    }
+
+    reconnect_ = enable;
+
+    return 0;
+}
+
+int UARTTransporter::set_rs485(bool enable, uint32_t delay_before_ms, uint32_t delay_after_ms)
+{
+    if (fds_OK() || delay_before_ms > RS485_MAX_DELAY_MS || delay_after_ms > RS485_MAX_DELAY_MS)
+    {
+        return -1;
+    }
+
+    rs485_ = enable;
+    rs485_delay_before_ms_ = delay_before_ms;
+    rs485_delay_after_ms_ = delay_after_ms;
+
+    return 0;
+}
+
+int UARTTransporter::set_baudrate(uint32_t baudrate)
+{
+    if (!fds_OK() || baudrate == 0)
+    {
+        return -1;
+    }
+
+    // Let everything already written go out at the old rate.
+    if (::tcdrain(uart_fd_) < 0)
+    {
+        ::fprintf(stderr, "ERR DRAIN %s (%d)\n", uart_name_.c_str(), errno);
+        return -1;
+    }
+
+    struct termios uart_config{};
+    if (::tcgetattr(uart_fd_, &uart_config) < 0)
+    {
+        ::fprintf(stderr, "ERR GET CONF %s (%d)\n", uart_name_.c_str(), errno);
+        return -1;
+    }
+
+    uint32_t rate = standard_baudrates().count(baudrate) != 0 ? baud_number_to_rate(baudrate) : B38400;
+    if (::cfsetispeed(&uart_config, rate) < 0 || ::cfsetospeed(&uart_config, rate) < 0 ||
+        ::tcsetattr(uart_fd_, TCSANOW, &uart_config) < 0)
+    {
+        ::fprintf(stderr, "ERR SET BAUD %s: %u (%d)\n", uart_name_.c_str(), baudrate, errno);
+        return -1;
+    }
+
+    if (rate == B38400 && baudrate != 38400)
+    {
+        uint32_t actual = 0;
+        if (impl::set_custom_baudrate(uart_fd_, baudrate, &actual) < 0)
+        {
+            ::fprintf(stderr, "ERR SET CUSTOM BAUD %s: %u (%d)\n", uart_name_.c_str(), baudrate, errno);
+            return -1;
+        }
+        if (actual != baudrate)
+        {
+            ::fprintf(stderr, "Baudrate on %s is %u instead of %u\n", uart_name_.c_str(), actual, baudrate);
+        }
+        custom_baudrate_ = baudrate;
+    }
+    else
+    {
+        custom_baudrate_ = 0;
+    }
+
+    baudrate_ = rate;
+    baudrate_bps_ = baudrate;
+    update_byte_time();
+
+    // Anything that came in while the rates didn't match is garbage.
+    ::tcflush(uart_fd_, TCIFLUSH);
+    ringbuf_.discard(ringbuf_.bytes_used());
+
+    return 0;
+}
+
+uint32_t UARTTransporter::get_baudrate() const
+{
+    return baudrate_bps_;
+}
+
 bool UARTTransporter::fds_OK()
 {
     return (-1 != uart_fd_);
 }
 
+int UARTTransporter::get_read_fd() const
+{
+    if (epoll_fd_ != -1)
+    {
+        return epoll_fd_;
+    }
+
+    if (uring_ != nullptr)
+    {
+        return uring_->get_fd();
+    }
+
+    return uart_fd_;
+}
+
+int UARTTransporter::get_write_fd() const
+{
+    return uart_fd_;
+}
+
 int UARTTransporter::close()
 {
     if (-1 != uart_fd_)
     {
+        // The read in flight has to be cancelled before the file descriptor
+        // goes away.
+        uring_.reset();
         ::close(uart_fd_);
         uart_fd_ = -1;
         ::memset(&poll_fd_, 0, sizeof(poll_fd_));
     }
 
+    for (int *fd : {&timer_fd_, &inotify_fd_, &epoll_fd_})
+    {
+        if (-1 != *fd)
+        {
+            ::close(*fd);
+            *fd = -1;
+        }
+    }
+    watch_fd_ = -1;
+    connected_ = false;
+
     return 0;
 }
 
@@ -219,6 +654,63 @@ ssize_t UARTTransporter::node_read()
         return -1;
     }
 
+    if (uring_ != nullptr)
+    {
+        return uring_->read(read_poll_ms_);
+    }
+
+    if (epoll_fd_ != -1)
+    {
+        struct epoll_event events[3];
+        int n = ::epoll_wait(epoll_fd_, events, 3, read_poll_ms_);
+        if (n < 0)
+        {
+            return (errno == EINTR) ? 0 : -1;
+        }
+
+        ssize_t ret = 0;
+        for (int i = 0; i < n; ++i)
+        {
+            int fd = events[i].data.fd;
+            if (fd == uart_fd_ && connected_)
+            {
+                // Whatever came in before a hang up is read first; the next
+                // read then fails or finds nothing.
+                ssize_t r = (events[i].events & EPOLLIN) != 0 ? ringbuf_.read(uart_fd_) : 0;
+                if (r > 0)
+                {
+                    ret += r;
+                }
+                else if ((events[i].events & (EPOLLHUP | EPOLLERR)) != 0 ||
+                         (r < 0 && errno != EAGAIN && errno != EINTR))
+                {
+                    disconnected();
+                }
+            }
+            else if (fd == inotify_fd_)
+            {
+                alignas(struct inotify_event) char buf[4096];
+                while (::read(inotify_fd_, buf, sizeof(buf)) > 0)
+                {
+                }
+                if (!connected_)
+                {
+                    reopen();
+                }
+            }
+            else if (fd == timer_fd_)
+            {
+                uint64_t expirations;
+                if (::read(timer_fd_, &expirations, sizeof(expirations)) > 0 && !connected_)
+                {
+                    reopen();
+                }
+            }
+        }
+
+        return ret;
+    }
+
     ssize_t ret = 0;
     int r = ::poll(reinterpret_cast<struct pollfd *>(poll_fd_), 1, read_poll_ms_);
 
@@ -237,49 +729,150 @@ ssize_t UARTTransporter::node_write(void *buffer, size_t len)
         return -1;
     }
 
-    uint32_t intr_times = 0;
+    if (!connected_)
+    {
+        errno = ENOTCONN;
+        return -1;
+    }
+
+    if (uring_ != nullptr)
+    {
+        struct iovec iov{buffer, len};
+        return node_writev(&iov, 1);
+    }
 
     // Ensure that the entire buffer gets out to the file descriptor (unless a
     // fatal error occurs)
     uint8_t *b = static_cast<uint8_t *>(buffer);
     size_t n = len;
+    std::chrono::steady_clock::time_point deadline = write_deadline();
     while (n > 0)
     {
         ssize_t ret = ::write(uart_fd_, b, n);
         if (ret == -1)
         {
-            if (errno == EINTR || errno == EAGAIN)
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            // The UART output queue is full; sleep until the driver has
+            // drained some of it.  If it doesn't for a while (for instance,
+            // because the other end is holding off hardware flow control),
+            // give up rather than blocking the caller forever.
+            if (errno == EAGAIN && wait_writable(uart_fd_, deadline) == 0)
             {
-                // We can get an EINTR/EAGAIN for a temporary failure (for
-                // instance, the remote end of a pipe is temporarily busy and not
-                // draining the data fast enough), or for a more permanent one
-                // (for instance, nothing is draining the remote end of a pipe).
-                // Just doing "continue" here in the latter case means that we'll
-                // be stuck in this loop forever, burning CPU.  Thus, we add a
-                // small delay and a counter in here.  If we get into here
-                // `write_timeout_us` times in a row (with no data being
-                // transferred in between), we presume this is a permanent failure
-                // and return an error to the application.
-                intr_times++;
-                if (intr_times > write_timeout_us_)
-                {
-                    // Too many failures, set an errno and get out.
-                    errno = EBUSY;
-                    break;
-                }
-                ::usleep(1);
                 continue;
             }
 
             break;
         }
-        intr_times = 0;
         n -= ret;
         b += ret;
     }
 
+    if (n > 0 && n < len)
+    {
+        partial_writes_++;
+    }
+
+    return (n > 0) ? -1 : len;
+}
+
+ssize_t UARTTransporter::node_writev(const struct iovec *iov, int iovcnt)
+{
+    if (nullptr == iov || iovcnt > MAX_NODE_IOVECS || !fds_OK())
+    {
+        return -1;
+    }
+
+    if (!connected_)
+    {
+        errno = ENOTCONN;
+        return -1;
+    }
+
+    if (uring_ != nullptr)
+    {
+        size_t written = 0;
+        ssize_t ret = uring_->writev(iov, iovcnt, write_timeout_ms_, &written);
+        if (ret < 0 && written > 0)
+        {
+            partial_writes_++;
+        }
+        return ret;
+    }
+
+    // writev() can return short, so keep a local copy of the buffer
+    // descriptions that we can advance past the data already written.
+    std::array<struct iovec, MAX_NODE_IOVECS> local_iov;
+    size_t len = 0;
+    for (int i = 0; i < iovcnt; ++i)
+    {
+        local_iov[i] = iov[i];
+        len += iov[i].iov_len;
+    }
+
+    // Ensure that all of the buffers get out to the file descriptor (unless a
+    // fatal error occurs)
+    struct iovec *v = &local_iov[0];
+    int nv = iovcnt;
+    size_t n = len;
+    std::chrono::steady_clock::time_point deadline = write_deadline();
+    while (n > 0)
+    {
+        ssize_t ret = ::writev(uart_fd_, v, nv);
+        if (ret == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            // See node_write() for how this waits.
+            if (errno == EAGAIN && wait_writable(uart_fd_, deadline) == 0)
+            {
+                continue;
+            }
+
+            break;
+        }
+        n -= ret;
+
+        // Skip past the buffers that were completely written, and adjust the
+        // one that was partially written (if any).
+        size_t done = ret;
+        while (nv > 0 && done >= v->iov_len)
+        {
+            done -= v->iov_len;
+            v++;
+            nv--;
+        }
+        if (nv > 0)
+        {
+            v->iov_base = static_cast<uint8_t *>(v->iov_base) + done;
+            v->iov_len -= done;
+        }
+    }
+
+    if (n > 0 && n < len)
+    {
+        partial_writes_++;
+    }
+
     return (n > 0) ? -1 : len;
 }
 
+ssize_t UARTTransporter::get_write_queue_bytes() const
+{
+    int queued = 0;
+    if (-1 == uart_fd_ || ::ioctl(uart_fd_, TIOCOUTQ, &queued) < 0)
+    {
+        return -1;
+    }
+
+    return queued;
+}
+
 }  // namespace transport
 }  // namespace ros2_to_serial_bridge
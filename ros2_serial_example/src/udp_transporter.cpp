@@ -34,22 +34,45 @@
 // https://github.com/PX4/px4_ros_com/blob/69bdf6e70f3832ff00f2e9e7f17d9394532787d6/templates/microRTPS_transport.cpp
 // but modified to split UDP code out of the original transporter.
 
+#include <algorithm>
 #include <cerrno>
+#include <chrono>
 #include <cmath>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <memory>
 #include <stdexcept>
 #include <string>
+#include <vector>
 
 #include <arpa/inet.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <linux/filter.h>
+#include <linux/net_tstamp.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
+#include <linux/sockios.h>
 #include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#include "ros2_serial_example/async_log.hpp"
 #include "ros2_serial_example/transporter.hpp"
 #include "ros2_serial_example/udp_transporter.hpp"
+#include "ros2_serial_example/uring_io.hpp"
+
+// Older C libraries don't have these yet, but the kernel may still support
+// them; if it doesn't, setting them fails and init() does without.
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
 
 namespace ros2_to_serial_bridge
 {
@@ -57,20 +80,61 @@ namespace ros2_to_serial_bridge
 namespace transport
 {
 
+constexpr size_t UDPTransporter::MAX_DATAGRAM_BATCH;
+constexpr size_t UDPTransporter::MAX_GSO_SEGMENTS;
+constexpr size_t UDPTransporter::MAX_GSO_SEGMENT_SIZE;
+constexpr size_t UDPTransporter::MAX_GRO_SIZE;
+
+// The most UDP payload an IPv4 datagram can carry, which a UDP_SEGMENT
+// message can't go over in total.
+static constexpr size_t MAX_UDP_PAYLOAD = 65507;
+
+// Each message gets room for one control message with an int in it, which
+// is enough for both UDP_SEGMENT (a uint16_t) and UDP_GRO (an int).
+static constexpr size_t CONTROL_WORDS = (CMSG_SPACE(sizeof(int)) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+// Received messages may also get an SCM_TIMESTAMPING control message, which
+// holds three timespecs: software, (deprecated) and hardware.
+static constexpr size_t RECV_CONTROL_WORDS =
+    (CMSG_SPACE(sizeof(int)) + CMSG_SPACE(3 * sizeof(struct timespec)) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
 UDPTransporter::UDPTransporter(const std::string & protocol,
                                uint16_t recv_port,
                                uint16_t send_port,
                                uint32_t read_poll_ms,
-                               size_t ring_buffer_size):
+                               size_t ring_buffer_size,
+                               size_t datagram_batch):
     Transporter(protocol, ring_buffer_size),
     recv_port_(recv_port),
     send_port_(send_port),
-    read_poll_ms_(read_poll_ms)
+    read_poll_ms_(read_poll_ms),
+    ring_buffer_size_(ring_buffer_size)
 {
     if (recv_port_ == 0 || send_port_ == 0)
     {
         throw std::runtime_error("Invalid send or receive port, must be between 1 and 65535 inclusive");
     }
+
+    if (datagram_batch > 0)
+    {
+        if (datagram_batch > MAX_DATAGRAM_BATCH)
+        {
+            throw std::runtime_error("Invalid datagram batch, must be at most " + std::to_string(MAX_DATAGRAM_BATCH));
+        }
+
+        datagram_frames_ = true;
+
+        recv_iovs_.resize(datagram_batch);
+        recv_msgs_.resize(datagram_batch);
+        setup_recv_slots(ring_buffer_size);
+
+        send_msgs_.resize(datagram_batch);
+    }
+    else
+    {
+        // Room for one datagram, for node_read().
+        recv_bufs_.resize(ring_buffer_size);
+    }
 }
 
 UDPTransporter::~UDPTransporter()
@@ -78,6 +142,23 @@ UDPTransporter::~UDPTransporter()
     close();
 }
 
+void UDPTransporter::setup_recv_slots(size_t datagram_size)
+{
+    // Each datagram gets its own slot in one big receive buffer; the message
+    // headers point at those slots once and are reused for every recvmmsg()
+    // call.
+    datagram_size_ = datagram_size;
+    recv_bufs_.assign(recv_msgs_.size() * datagram_size_, 0);
+    recv_bufs_.shrink_to_fit();
+    for (size_t i = 0; i < recv_msgs_.size(); ++i)
+    {
+        recv_iovs_[i].iov_base = &recv_bufs_[i * datagram_size_];
+        recv_iovs_[i].iov_len = datagram_size_;
+        recv_msgs_[i].msg_hdr.msg_iov = &recv_iovs_[i];
+        recv_msgs_[i].msg_hdr.msg_iovlen = 1;
+    }
+}
+
 int UDPTransporter::init()
 {
     if (fds_OK())
@@ -100,6 +181,27 @@ int UDPTransporter::init()
         return -errno;
     }
 
+    if (!multicast_group_.empty())
+    {
+        // Let other processes on this machine join the group on the same port.
+        int reuse = 1;
+        if (::setsockopt(recv_fd_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0)
+        {
+            ::fprintf(stderr, "Failed to set SO_REUSEADDR: %s\n", ::strerror(errno));
+            return -1;
+        }
+    }
+
+    if (reuse_port_)
+    {
+        int reuse = 1;
+        if (::setsockopt(recv_fd_, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) < 0)
+        {
+            ::fprintf(stderr, "Failed to set SO_REUSEPORT: %s\n", ::strerror(errno));
+            return -1;
+        }
+    }
+
     if (::bind(recv_fd_, reinterpret_cast<struct sockaddr *>(&receiver_inaddr),
                sizeof(receiver_inaddr)) < 0)
     {
@@ -107,6 +209,43 @@ int UDPTransporter::init()
         return -1;
     }
 
+    if (reuse_port_ && steering_shards_ > 0)
+    {
+        // The program runs with the packet at the UDP payload, so the source
+        // address is found from the start of the IP header.
+        struct sock_filter code[] = {
+            BPF_STMT(BPF_LD | BPF_W | BPF_ABS, static_cast<uint32_t>(SKF_NET_OFF) + 12),
+            BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, steering_shards_),
+            BPF_STMT(BPF_RET | BPF_A, 0),
+        };
+        struct sock_fprog program{};
+        program.len = sizeof(code) / sizeof(code[0]);
+        program.filter = code;
+        if (::setsockopt(recv_fd_, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof(program)) < 0)
+        {
+            ::fprintf(stderr, "Failed to attach the source steering program: %s\n", ::strerror(errno));
+            return -1;
+        }
+    }
+
+    if (!multicast_group_.empty())
+    {
+        struct ip_mreq mreq{};
+        ::inet_aton(multicast_group_.c_str(), &mreq.imr_multiaddr);
+        mreq.imr_interface.s_addr = ::htonl(INADDR_ANY);
+        if (::setsockopt(recv_fd_, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0)
+        {
+            ::fprintf(stderr, "Failed to join multicast group %s: %s\n", multicast_group_.c_str(),
+                      ::strerror(errno));
+            return -1;
+        }
+    }
+
+    if (setup_socket_buffer(recv_fd_, SO_RCVBUF, recv_buffer_size_, "receive") < 0)
+    {
+        return -1;
+    }
+
     // Now make the incoming socket non-blocking.
     int flags = ::fcntl(recv_fd_, F_GETFL, 0);
     if (flags < 0)
@@ -123,6 +262,41 @@ int UDPTransporter::init()
         return -1;
     }
 
+    gro_ = false;
+    if (offload_ && datagram_frames_)
+    {
+        int on = 1;
+        if (::setsockopt(recv_fd_, IPPROTO_UDP, UDP_GRO, &on, sizeof(on)) == 0)
+        {
+            gro_ = true;
+        }
+        else
+        {
+            ::fprintf(stderr, "Not using UDP_GRO: %s\n", ::strerror(errno));
+        }
+    }
+
+    // Only the software timestamps are asked for; the hardware ones are in
+    // the clock of the network device, not the system clock.
+    rx_timestamps_ = false;
+    if (kernel_timestamps_)
+    {
+        int stamp_flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+        if (::setsockopt(recv_fd_, SOL_SOCKET, SO_TIMESTAMPING, &stamp_flags, sizeof(stamp_flags)) == 0)
+        {
+            rx_timestamps_ = true;
+        }
+        else
+        {
+            ::fprintf(stderr, "Not using kernel timestamps: %s\n", ::strerror(errno));
+        }
+    }
+
+    if (gro_ || rx_timestamps_)
+    {
+        recv_control_.resize(recv_msgs_.size() * RECV_CONTROL_WORDS);
+    }
+
     poll_fd_[0].fd = recv_fd_;
     poll_fd_[0].events = POLLIN;
 
@@ -133,25 +307,292 @@ int UDPTransporter::init()
         return -1;
     }
 
-    send_outaddr.sin_family = AF_INET;
-    send_outaddr.sin_port = ::htons(send_port_);
+    if (setup_socket_buffer(send_fd_, SO_SNDBUF, send_buffer_size_, "send") < 0)
+    {
+        return -1;
+    }
 
-    if (::inet_aton("127.0.0.1", &send_outaddr.sin_addr) == 0)
+    // The sender is non-blocking too, so that a full socket buffer makes the
+    // writes wait with a timeout instead of blocking forever.
+    flags = ::fcntl(send_fd_, F_GETFL, 0);
+    if (flags < 0 || ::fcntl(send_fd_, F_SETFL, flags | O_NONBLOCK) < 0)
     {
-        ::fprintf(stderr, "inet_aton() failed: %s\n", ::strerror(errno));
+        ::fprintf(stderr, "Failed to set flags for UDP send: %s\n",
+                  ::strerror(errno));
         return -1;
     }
 
+    // Without an explicit list of peers, everything goes to the one peer on
+    // send_port.
+    std::vector<Peer> peers = peer_config_;
+    if (peers.empty())
+    {
+        peers.push_back(Peer{remote_address_, send_port_, {}});
+    }
+
+    peers_.clear();
+    for (const Peer & peer : peers)
+    {
+        PeerAddr peer_addr{};
+        peer_addr.addr.sin_family = AF_INET;
+        peer_addr.addr.sin_port = ::htons(peer.port);
+        if (::inet_aton(peer.address.c_str(), &peer_addr.addr.sin_addr) == 0)
+        {
+            ::fprintf(stderr, "inet_aton() failed: %s\n", ::strerror(errno));
+            return -1;
+        }
+        peer_addr.topic_IDs = peer.topic_IDs;
+        std::sort(peer_addr.topic_IDs.begin(), peer_addr.topic_IDs.end());
+        peers_.push_back(peer_addr);
+    }
+
+    // With only one peer, connecting saves the kernel from looking up the
+    // route (and checking the address) for every datagram.  Several peers
+    // share the socket, so they still give their address each time.
+    connected_ = false;
+    if (peers_.size() == 1)
+    {
+        if (::connect(send_fd_, reinterpret_cast<struct sockaddr *>(&peers_[0].addr), sizeof(peers_[0].addr)) < 0)
+        {
+            ::fprintf(stderr, "connect failed: %s\n", ::strerror(errno));
+            return -1;
+        }
+        connected_ = true;
+    }
+
+    // Only probe for UDP_SEGMENT here; it is asked for per message, with the
+    // size of the frames in each run.
+    gso_ = false;
+    if (offload_ && datagram_frames_)
+    {
+        int segment_size = 0;
+        socklen_t segment_size_len = sizeof(segment_size);
+        if (::getsockopt(send_fd_, IPPROTO_UDP, UDP_SEGMENT, &segment_size, &segment_size_len) == 0)
+        {
+            gso_ = true;
+            send_control_.resize(send_msgs_.size() * CONTROL_WORDS);
+        }
+        else
+        {
+            ::fprintf(stderr, "Not using UDP_SEGMENT: %s\n", ::strerror(errno));
+        }
+    }
+
+    if (io_uring_)
+    {
+        // Datagrams that would wrap around the end of the ring buffer have to
+        // be received whole, the same as in node_read().  The timestamps come
+        // in control messages, which a plain read can't take, so with them
+        // the receive side stays in node_read().
+        int read_fd = (datagram_frames_ || rx_timestamps_) ? -1 : recv_fd_;
+        size_t bounce_size = ringbuf_.is_mirrored() ? 0 : recv_bufs_.size();
+        try
+        {
+            uring_ = std::make_unique<impl::UringIo>(read_fd, send_fd_, &ringbuf_, bounce_size);
+        }
+        catch (const std::runtime_error & e)
+        {
+            ::fprintf(stderr, "Not using io_uring for UDP: %s\n", e.what());
+        }
+    }
+
+    return 0;
+}
+
+int UDPTransporter::setup_socket_buffer(int fd, int optname, int size, const char *name)
+{
+    if (size == 0)
+    {
+        return 0;
+    }
+
+    if (::setsockopt(fd, SOL_SOCKET, optname, &size, sizeof(size)) < 0)
+    {
+        ::fprintf(stderr, "Failed to set UDP %s buffer size: %s\n", name, ::strerror(errno));
+        return -1;
+    }
+
+    // The kernel silently caps the size, and then doubles it to account for
+    // its own overhead, so it is only too small if it is less than asked for.
+    int actual = 0;
+    socklen_t actual_len = sizeof(actual);
+    if (::getsockopt(fd, SOL_SOCKET, optname, &actual, &actual_len) == 0 && actual < size)
+    {
+        ::fprintf(stderr, "UDP %s buffer size limited to %d bytes instead of %d; raise net.core.%s\n",
+                  name, actual, size, (optname == SO_RCVBUF) ? "rmem_max" : "wmem_max");
+    }
+
     return 0;
 }
 
+int UDPTransporter::set_remote_address(const std::string & address)
+{
+    struct in_addr addr{};
+    if (fds_OK() || ::inet_aton(address.c_str(), &addr) == 0)
+    {
+        return -1;
+    }
+
+    remote_address_ = address;
+
+    return 0;
+}
+
+int UDPTransporter::set_peers(const std::vector<Peer> & peers)
+{
+    if (fds_OK() || peers.empty())
+    {
+        return -1;
+    }
+
+    for (const Peer & peer : peers)
+    {
+        struct in_addr addr{};
+        if (peer.port == 0 || ::inet_aton(peer.address.c_str(), &addr) == 0)
+        {
+            return -1;
+        }
+    }
+
+    peer_config_ = peers;
+
+    return 0;
+}
+
+int UDPTransporter::set_multicast_group(const std::string & group)
+{
+    struct in_addr addr{};
+    if (fds_OK() || ::inet_aton(group.c_str(), &addr) == 0 || !IN_MULTICAST(::ntohl(addr.s_addr)))
+    {
+        return -1;
+    }
+
+    multicast_group_ = group;
+
+    return 0;
+}
+
+int UDPTransporter::set_io_uring(bool enable)
+{
+    if (fds_OK())
+    {
+        return -1;
+    }
+
+    io_uring_ = enable;
+
+    return 0;
+}
+
+int UDPTransporter::set_reuse_port(bool enable)
+{
+    if (fds_OK())
+    {
+        return -1;
+    }
+
+    reuse_port_ = enable;
+
+    return 0;
+}
+
+int UDPTransporter::set_source_steering(uint32_t shards)
+{
+    if (fds_OK())
+    {
+        return -1;
+    }
+
+    steering_shards_ = shards;
+
+    return 0;
+}
+
+int UDPTransporter::set_offload(bool enable)
+{
+    if (fds_OK())
+    {
+        return -1;
+    }
+
+    // A buffer merged by UDP_GRO has to fit in a slot whole, or it is
+    // dropped along with all of the frames in it.
+    if (datagram_frames_ && enable != offload_)
+    {
+        setup_recv_slots(enable ? std::max(ring_buffer_size_, MAX_GRO_SIZE) : ring_buffer_size_);
+    }
+
+    offload_ = enable;
+
+    return 0;
+}
+
+int UDPTransporter::set_kernel_timestamps(bool enable)
+{
+    if (fds_OK())
+    {
+        return -1;
+    }
+
+    kernel_timestamps_ = enable;
+
+    return 0;
+}
+
+int UDPTransporter::set_socket_buffer_sizes(int recv_bytes, int send_bytes)
+{
+    if (fds_OK() || recv_bytes < 0 || send_bytes < 0)
+    {
+        return -1;
+    }
+
+    recv_buffer_size_ = recv_bytes;
+    send_buffer_size_ = send_bytes;
+
+    return 0;
+}
+
+ssize_t UDPTransporter::get_write_queue_bytes() const
+{
+    int queued = 0;
+    if (-1 == send_fd_ || ::ioctl(send_fd_, SIOCOUTQ, &queued) < 0)
+    {
+        return -1;
+    }
+
+    return queued;
+}
+
+bool UDPTransporter::PeerAddr::wants(topic_id_size_t topic_ID) const
+{
+    return topic_IDs.empty() || std::binary_search(topic_IDs.begin(), topic_IDs.end(), topic_ID);
+}
+
 bool UDPTransporter::fds_OK()
 {
     return (-1 != recv_fd_ && -1 != send_fd_);
 }
 
+int UDPTransporter::get_read_fd() const
+{
+    if (uring_ != nullptr && uring_->get_fd() != -1)
+    {
+        return uring_->get_fd();
+    }
+
+    return recv_fd_;
+}
+
+int UDPTransporter::get_write_fd() const
+{
+    return send_fd_;
+}
+
 int UDPTransporter::close()
 {
+    // The receive in flight has to be cancelled before the socket goes away.
+    uring_.reset();
+
     if (-1 != recv_fd_)
     {
         ::shutdown(recv_fd_, SHUT_RDWR);
@@ -178,17 +619,163 @@ ssize_t UDPTransporter::node_read()
         return -1;
     }
 
+    if (uring_ != nullptr && !rx_timestamps_)
+    {
+        return uring_->read(read_poll_ms_);
+    }
+
     ssize_t ret = 0;
     int r = ::poll(reinterpret_cast<struct pollfd *>(poll_fd_), 1, read_poll_ms_);
 
     if (r == 1 && (poll_fd_[0].revents & POLLIN) != 0)
     {
-        ret = ringbuf_.read(recv_fd_);
+        if (ringbuf_.is_mirrored() && !rx_timestamps_)
+        {
+            ret = ringbuf_.read(recv_fd_);
+        }
+        else
+        {
+            // The ring buffer reads no further than its end, and the rest of
+            // a datagram is thrown away once it has been read from, so a
+            // datagram that straddles the end has to be received whole and
+            // then copied in; so does one that comes with a timestamp.
+            ret = rx_timestamps_ ? recv_stamped(recv_bufs_.data(), recv_bufs_.size()) :
+                                   ::recv(recv_fd_, recv_bufs_.data(), recv_bufs_.size(), 0);
+            for (ssize_t copied = 0; copied < ret; )
+            {
+                copied += ringbuf_.write(recv_bufs_.data() + copied, ret - copied);
+            }
+        }
+    }
+
+    return ret;
+}
+
+ssize_t UDPTransporter::node_read_frames(const FrameVisitor & visitor)
+{
+    if (!fds_OK())
+    {
+        return -1;
+    }
+
+    if (gro_ || rx_timestamps_)
+    {
+        // The kernel shrinks msg_controllen to what it filled in.
+        for (size_t i = 0; i < recv_msgs_.size(); ++i)
+        {
+            recv_msgs_[i].msg_hdr.msg_control = &recv_control_[i * RECV_CONTROL_WORDS];
+            recv_msgs_[i].msg_hdr.msg_controllen = RECV_CONTROL_WORDS * sizeof(uint64_t);
+        }
+    }
+
+    // Try to receive first, and only wait if nothing was there; when data is
+    // streaming in, this saves the poll() call.
+    int n = ::recvmmsg(recv_fd_, recv_msgs_.data(), recv_msgs_.size(), MSG_DONTWAIT, nullptr);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+        int r = ::poll(reinterpret_cast<struct pollfd *>(poll_fd_), 1, read_poll_ms_);
+        if (r != 1 || (poll_fd_[0].revents & POLLIN) == 0)
+        {
+            return (r < 0) ? -1 : 0;
+        }
+
+        n = ::recvmmsg(recv_fd_, recv_msgs_.data(), recv_msgs_.size(), MSG_DONTWAIT, nullptr);
+    }
+
+    if (n < 0)
+    {
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+
+    size_t nframes = 0;
+    for (int i = 0; i < n; ++i)
+    {
+        if ((recv_msgs_[i].msg_hdr.msg_flags & MSG_TRUNC) != 0)
+        {
+            ROS2_SERIAL_LOG(WARN, "Dropping UDP datagram larger than %zu bytes", datagram_size_);
+            continue;
+        }
+
+        const uint8_t *data = static_cast<const uint8_t *>(recv_iovs_[i].iov_base);
+        size_t len = recv_msgs_[i].msg_len;
+
+        // A buffer merged by UDP_GRO holds datagrams of the segment size,
+        // except that the last one may be shorter.  It has the timestamp of
+        // the first of them.
+        size_t segment_size = len;
+        if (gro_)
+        {
+            struct msghdr & msg = recv_msgs_[i].msg_hdr;
+            for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg))
+            {
+                if (cmsg->cmsg_level == IPPROTO_UDP && cmsg->cmsg_type == UDP_GRO)
+                {
+                    int gro_size;
+                    ::memcpy(&gro_size, CMSG_DATA(cmsg), sizeof(gro_size));
+                    if (gro_size > 0)
+                    {
+                        segment_size = static_cast<size_t>(gro_size);
+                    }
+                }
+            }
+        }
+        if (rx_timestamps_)
+        {
+            take_timestamp(recv_msgs_[i].msg_hdr);
+        }
+
+        size_t offset = 0;
+        do
+        {
+            size_t segment_len = std::min(segment_size, len - offset);
+            visitor(data + offset, segment_len);
+            nframes++;
+            offset += segment_len;
+        } while (offset < len);
+    }
+
+    return nframes;
+}
+
+ssize_t UDPTransporter::recv_stamped(void *buffer, size_t len)
+{
+    uint64_t control[RECV_CONTROL_WORDS];
+    struct iovec iov{buffer, len};
+    struct msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t ret = ::recvmsg(recv_fd_, &msg, 0);
+    if (ret > 0)
+    {
+        take_timestamp(msg);
     }
 
     return ret;
 }
 
+void UDPTransporter::take_timestamp(struct msghdr & msg)
+{
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING)
+        {
+            // The software timestamp is the first; it is zero if the kernel
+            // didn't take one.
+            struct timespec stamp;
+            ::memcpy(&stamp, CMSG_DATA(cmsg), sizeof(stamp));
+            if (stamp.tv_sec != 0 || stamp.tv_nsec != 0)
+            {
+                set_rx_arrival_time(std::chrono::system_clock::time_point(
+                    std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                        std::chrono::seconds(stamp.tv_sec) + std::chrono::nanoseconds(stamp.tv_nsec))));
+            }
+        }
+    }
+}
+
 ssize_t UDPTransporter::node_write(void *buffer, size_t len)
 {
     if (nullptr == buffer || !fds_OK())
@@ -196,48 +783,328 @@ ssize_t UDPTransporter::node_write(void *buffer, size_t len)
         return -1;
     }
 
-    uint32_t intr_times = 0;
+    struct iovec iov{buffer, len};
 
-    // Ensure that the entire buffer gets out to the file descriptor (unless a
-    // fatal error occurs)
-    uint8_t *b = static_cast<uint8_t *>(buffer);
-    size_t n = len;
-    while (n > 0)
+    return send_frame(&iov, 1);
+}
+
+ssize_t UDPTransporter::node_writev(const struct iovec *iov, int iovcnt)
+{
+    if (nullptr == iov || iovcnt > MAX_NODE_IOVECS || !fds_OK())
     {
-        ssize_t ret = ::sendto(send_fd_, b, n, 0, reinterpret_cast<struct sockaddr *>(&send_outaddr), sizeof(send_outaddr));
+        return -1;
+    }
+
+    return send_frame(iov, iovcnt);
+}
+
+ssize_t UDPTransporter::send_frame(const struct iovec *iov, int iovcnt)
+{
+    size_t len = 0;
+    for (int i = 0; i < iovcnt; ++i)
+    {
+        len += iov[i].iov_len;
+    }
+
+    // Keep going if one peer fails, so the others still get the frame.  The
+    // write only fails if none of them did; otherwise each peer that missed
+    // it counts as a failed write of the topic.
+    size_t sent = 0;
+    size_t failed = 0;
+    for (PeerAddr & peer : peers_)
+    {
+        if (!peer.wants(write_topic_ID_))
+        {
+            continue;
+        }
+        if (send_msg(&peer.addr, iov, iovcnt, len) < 0)
+        {
+            failed++;
+        }
+        else
+        {
+            sent++;
+        }
+    }
+
+    if (failed > 0 && sent == 0)
+    {
+        return -1;
+    }
+    for (size_t i = 0; i < failed; ++i)
+    {
+        get_metrics().drop(Metrics::Direction::TX, write_topic_ID_, Metrics::Drop::WRITE);
+    }
+
+    return len;
+}
+
+ssize_t UDPTransporter::send_msg(struct sockaddr_in *addr, const struct iovec *iov, size_t iovcnt, size_t len)
+{
+    struct msghdr msg{};
+    if (!connected_)
+    {
+        msg.msg_name = addr;
+        msg.msg_namelen = sizeof(*addr);
+    }
+    msg.msg_iov = const_cast<struct iovec *>(iov);
+    msg.msg_iovlen = iovcnt;
+
+    // A connected socket reports an ICMP port unreachable for an earlier
+    // datagram by failing the next send, which hasn't gone out; the peer may
+    // simply not have been up yet, so try once more.
+    bool refused = false;
+
+    if (uring_ != nullptr)
+    {
+        ssize_t ret = uring_->sendmsg(&msg, write_timeout_ms_);
+        if (ret < 0 && errno == ECONNREFUSED && connected_)
+        {
+            ret = uring_->sendmsg(&msg, write_timeout_ms_);
+        }
+        return (ret < 0 || static_cast<size_t>(ret) != len) ? -1 : len;
+    }
+
+    // A datagram is sent in its entirety or not at all, so there is no need
+    // to deal with short writes here.
+    std::chrono::steady_clock::time_point deadline = write_deadline();
+    while (true)
+    {
+        ssize_t ret = ::sendmsg(send_fd_, &msg, 0);
         if (ret == -1)
         {
-            if (errno == EINTR || errno == EAGAIN)
+            if (errno == EINTR)
             {
-                // We can get an EINTR/EAGAIN for a temporary failure (for
-                // instance, the remote end of a pipe is temporarily busy and not
-                // draining the data fast enough), or for a more permanent one
-                // (for instance, nothing is draining the remote end of a pipe).
-                // Just doing "continue" here in the latter case means that we'll
-                // be stuck in this loop forever, burning CPU.  Thus, we add a
-                // small delay and a counter in here.  If we get into here
-                // `write_timeout_us` times in a row (with no data being
-                // transferred in between), we presume this is a permanent failure
-                // and return an error to the application.
-                intr_times++;
-                if (intr_times > write_timeout_us_)
+                continue;
+            }
+
+            if (errno == ECONNREFUSED && connected_ && !refused)
+            {
+                refused = true;
+                continue;
+            }
+
+            // The socket buffer is full; sleep until there is room, but give
+            // up if there isn't any for a while.
+            if (errno == EAGAIN && wait_writable(send_fd_, deadline) == 0)
+            {
+                continue;
+            }
+
+            return -1;
+        }
+
+        return (static_cast<size_t>(ret) != len) ? -1 : len;
+    }
+}
+
+ssize_t UDPTransporter::node_write_frames(const struct iovec *frames, const topic_id_size_t *topic_IDs, size_t count)
+{
+    if (nullptr == frames || nullptr == topic_IDs || !fds_OK())
+    {
+        return -1;
+    }
+
+    size_t len = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        len += frames[i].iov_len;
+    }
+
+    bool failed = false;
+    for (PeerAddr & peer : peers_)
+    {
+        if (datagram_frames_)
+        {
+            // One datagram per frame, datagram_batch messages at a time.
+            if (gso_ && gso_iovs_.size() < count)
+            {
+                gso_iovs_.resize(count);
+            }
+            size_t next = 0;
+            while (next < count)
+            {
+                size_t nmsgs = build_datagrams(peer, frames, topic_IDs, count, &next);
+                if (nmsgs > 0)
                 {
-                    // Too many failures, set an errno and get out.
-                    errno = EBUSY;
-                    break;
+                    failed |= send_datagrams(nmsgs) < 0;
                 }
-                ::usleep(1);
-                continue;
             }
+        }
+        else
+        {
+            // All of the frames the peer wants go out in one datagram,
+            // merging the ones that are next to each other in memory.
+            send_iovs_.clear();
+            size_t peer_len = 0;
+            for (size_t i = 0; i < count; ++i)
+            {
+                if (!peer.wants(topic_IDs[i]))
+                {
+                    continue;
+                }
+
+                if (!send_iovs_.empty() &&
+                    static_cast<uint8_t *>(send_iovs_.back().iov_base) + send_iovs_.back().iov_len == frames[i].iov_base)
+                {
+                    send_iovs_.back().iov_len += frames[i].iov_len;
+                }
+                else
+                {
+                    if (send_iovs_.size() == IOV_MAX)
+                    {
+                        // Frame boundaries don't matter in this mode, so
+                        // it is fine to split the batch here.
+                        failed |= send_msg(&peer.addr, send_iovs_.data(), send_iovs_.size(), peer_len) < 0;
+                        send_iovs_.clear();
+                        peer_len = 0;
+                    }
+                    send_iovs_.push_back(frames[i]);
+                }
+                peer_len += frames[i].iov_len;
+            }
+            if (!send_iovs_.empty())
+            {
+                failed |= send_msg(&peer.addr, send_iovs_.data(), send_iovs_.size(), peer_len) < 0;
+            }
+        }
+    }
 
+    return failed ? -1 : len;
+}
+
+size_t UDPTransporter::build_datagrams(PeerAddr & peer, const struct iovec *frames, const topic_id_size_t *topic_IDs,
+                                       size_t count, size_t *next)
+{
+    size_t nmsgs = 0;
+    size_t niovs = 0;
+    struct msghdr *msg = nullptr;
+    size_t segment_size = 0;
+    size_t run_len = 0;
+    bool run_open = false;
+    size_t i = *next;
+    for (; i < count; ++i)
+    {
+        if (!peer.wants(topic_IDs[i]))
+        {
+            continue;
+        }
+
+        // With UDP_SEGMENT, a frame joins the run before it if it is no
+        // larger than the frames in the run; one that is smaller becomes the
+        // last segment and ends the run.
+        size_t len = frames[i].iov_len;
+        if (run_open && msg->msg_iovlen < MAX_GSO_SEGMENTS && len <= segment_size &&
+            run_len + len <= MAX_UDP_PAYLOAD)
+        {
+            gso_iovs_[niovs++] = frames[i];
+            msg->msg_iovlen++;
+            run_len += len;
+            run_open = (len == segment_size);
+            continue;
+        }
+
+        if (nmsgs == send_msgs_.size())
+        {
             break;
         }
-        intr_times = 0;
-        n -= ret;
-        b += ret;
+
+        msg = &send_msgs_[nmsgs++].msg_hdr;
+        *msg = {};
+        if (!connected_)
+        {
+            msg->msg_name = &peer.addr;
+            msg->msg_namelen = sizeof(peer.addr);
+        }
+        if (gso_)
+        {
+            gso_iovs_[niovs] = frames[i];
+            msg->msg_iov = &gso_iovs_[niovs];
+            niovs++;
+        }
+        else
+        {
+            msg->msg_iov = const_cast<struct iovec *>(&frames[i]);
+        }
+        msg->msg_iovlen = 1;
+        segment_size = len;
+        run_len = len;
+        run_open = gso_ && len <= MAX_GSO_SEGMENT_SIZE;
+    }
+    *next = i;
+
+    // Only the messages with more than one frame need splitting.
+    for (size_t m = 0; m < nmsgs; ++m)
+    {
+        struct msghdr & run = send_msgs_[m].msg_hdr;
+        if (run.msg_iovlen < 2)
+        {
+            continue;
+        }
+
+        run.msg_control = &send_control_[m * CONTROL_WORDS];
+        run.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&run);
+        cmsg->cmsg_level = IPPROTO_UDP;
+        cmsg->cmsg_type = UDP_SEGMENT;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        uint16_t gso_size = static_cast<uint16_t>(run.msg_iov[0].iov_len);
+        ::memcpy(CMSG_DATA(cmsg), &gso_size, sizeof(gso_size));
+    }
+
+    return nmsgs;
+}
+
+ssize_t UDPTransporter::send_datagrams(size_t nmsgs)
+{
+    struct mmsghdr *msgs = send_msgs_.data();
+
+    // See send_msg() for why a refused send is tried again.
+    bool refused = false;
+
+    std::chrono::steady_clock::time_point deadline = write_deadline();
+    while (nmsgs > 0)
+    {
+        int ret = ::sendmmsg(send_fd_, msgs, nmsgs, 0);
+        if (ret == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            if (errno == ECONNREFUSED && connected_ && !refused)
+            {
+                refused = true;
+                continue;
+            }
+
+            // The kernel supports UDP_SEGMENT, but the network device can't
+            // do it (it needs checksum offload); the runs left in this batch
+            // are lost, but the next ones go out as plain datagrams.
+            if (gso_ && msgs->msg_hdr.msg_controllen != 0 && (errno == EIO || errno == EINVAL))
+            {
+                ROS2_SERIAL_LOG(WARN, "UDP segmentation offload failed, turning it off: %s", ::strerror(errno));
+                gso_ = false;
+                return -1;
+            }
+
+            // See send_msg() for how this waits.
+            if (errno == EAGAIN && wait_writable(send_fd_, deadline) == 0)
+            {
+                continue;
+            }
+
+            return -1;
+        }
+
+        // Each datagram is sent in its entirety or not at all, but sendmmsg()
+        // may stop early; carry on from the first one that wasn't sent.
+        msgs += ret;
+        nmsgs -= ret;
     }
 
-    return (n > 0) ? -1 : len;
+    return 0;
 }
 
 }  // namespace transport
@@ -0,0 +1,690 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "ros2_serial_example/uring_io.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+namespace impl
+{
+
+namespace
+{
+
+// The user_data of each kind of request.
+enum : uint64_t
+{
+    READ_POLL = 1,
+    READ_DATA,
+    WRITE_DATA,
+    WRITE_POLL,
+    WRITE_TIMEOUT,
+    CANCEL,
+};
+
+// Every ring has at most a few requests in flight.
+constexpr unsigned RING_ENTRIES = 4;
+
+}  // namespace
+
+/**
+ * A minimal io_uring, set up with the raw system calls so that there is no
+ * need for liburing.
+ */
+class IoUring final
+{
+public:
+    explicit IoUring(unsigned entries)
+    {
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) && defined(__NR_io_uring_register)
+        struct io_uring_params params{};
+        fd_ = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+        if (fd_ < 0)
+        {
+            throw std::runtime_error(std::string("io_uring_setup failed: ") + ::strerror(errno));
+        }
+
+        sq_ring_len_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_ring_len_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single_mmap)
+        {
+            sq_ring_len_ = cq_ring_len_ = std::max(sq_ring_len_, cq_ring_len_);
+        }
+
+        sq_ring_ = ::mmap(nullptr, sq_ring_len_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+        if (sq_ring_ == MAP_FAILED)
+        {
+            sq_ring_ = nullptr;
+            fail("Failed to map the io_uring submission queue");
+        }
+        if (single_mmap)
+        {
+            cq_ring_ = sq_ring_;
+        }
+        else
+        {
+            cq_ring_ = ::mmap(nullptr, cq_ring_len_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+            if (cq_ring_ == MAP_FAILED)
+            {
+                cq_ring_ = nullptr;
+                fail("Failed to map the io_uring completion queue");
+            }
+        }
+        sqes_len_ = params.sq_entries * sizeof(struct io_uring_sqe);
+        void *sqes = ::mmap(nullptr, sqes_len_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED)
+        {
+            fail("Failed to map the io_uring submission entries");
+        }
+        sqes_ = static_cast<struct io_uring_sqe *>(sqes);
+
+        uint8_t *sq = static_cast<uint8_t *>(sq_ring_);
+        sq_head_ = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+        sq_tail_ = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+        sq_mask_ = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+        sq_entries_ = params.sq_entries;
+        sq_array_ = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+        sqe_tail_ = *sq_tail_;
+
+        uint8_t *cq = static_cast<uint8_t *>(cq_ring_);
+        cq_head_ = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+        cq_mask_ = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+
+        // Make sure that the kernel has all of the operations we use; the
+        // probe itself only exists from Linux 5.6, which is also when the
+        // last of them arrived.
+        size_t probe_len = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+        std::unique_ptr<uint8_t[]> probe_buf(new uint8_t[probe_len]());
+        struct io_uring_probe *probe = reinterpret_cast<struct io_uring_probe *>(probe_buf.get());
+        if (::syscall(__NR_io_uring_register, fd_, IORING_REGISTER_PROBE, probe, 256) < 0)
+        {
+            fail("io_uring is too old");
+        }
+        for (int op : {IORING_OP_POLL_ADD, IORING_OP_READ, IORING_OP_READ_FIXED, IORING_OP_WRITEV,
+                       IORING_OP_SENDMSG, IORING_OP_LINK_TIMEOUT, IORING_OP_ASYNC_CANCEL})
+        {
+            if (op > probe->last_op || (probe->ops[op].flags & IO_URING_OP_SUPPORTED) == 0)
+            {
+                errno = ENOTSUP;
+                fail("io_uring is missing operation " + std::to_string(op));
+            }
+        }
+#else
+        (void)entries;
+        throw std::runtime_error("io_uring is not supported on this platform");
+#endif
+    }
+
+    ~IoUring()
+    {
+        release();
+    }
+
+    IoUring(IoUring const &) = delete;
+    IoUring& operator=(IoUring const &) = delete;
+    IoUring(IoUring &&) = delete;
+    IoUring& operator=(IoUring &&) = delete;
+
+    int fd() const
+    {
+        return fd_;
+    }
+
+    int register_buffer(void *base, size_t length)
+    {
+        struct iovec iov{base, length};
+        return static_cast<int>(::syscall(__NR_io_uring_register, fd_, IORING_REGISTER_BUFFERS, &iov, 1));
+    }
+
+    // Get a cleared submission entry, or a nullptr if the queue is full.
+    struct io_uring_sqe *get_sqe()
+    {
+        // The kernel moves the head as it consumes entries, and the shared
+        // ring indices have to be accessed atomically.
+        unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+        if (sqe_tail_ - head >= sq_entries_)
+        {
+            return nullptr;
+        }
+
+        unsigned index = sqe_tail_ & sq_mask_;
+        struct io_uring_sqe *sqe = &sqes_[index];
+        ::memset(sqe, 0, sizeof(*sqe));
+        sq_array_[index] = index;
+        sqe_tail_++;
+
+        return sqe;
+    }
+
+    // Submit the entries got since the last call, and wait for wait_nr
+    // completions.  This may return before they are all there (for
+    // instance, when interrupted), so callers check for them with pop().
+    int submit(unsigned wait_nr)
+    {
+        __atomic_store_n(sq_tail_, sqe_tail_, __ATOMIC_RELEASE);
+
+        while (true)
+        {
+            unsigned to_submit = sqe_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+            long ret = ::syscall(__NR_io_uring_enter, fd_, to_submit, wait_nr,
+                                 wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+            if (ret < 0 && errno == EINTR)
+            {
+                // Only the wait was interrupted once everything has been
+                // submitted; the callers wait again if they need to.
+                if (sqe_tail_ == __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE))
+                {
+                    return 0;
+                }
+                continue;
+            }
+            return (ret < 0) ? -1 : 0;
+        }
+    }
+
+    // Take the next completion, if there is one.
+    bool pop(struct io_uring_cqe *cqe)
+    {
+        unsigned head = *cq_head_;
+        if (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE))
+        {
+            return false;
+        }
+
+        *cqe = cqes_[head & cq_mask_];
+        __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+
+        return true;
+    }
+
+private:
+    [[noreturn]] void fail(const std::string & what)
+    {
+        std::string message = what + ": " + ::strerror(errno);
+        release();
+        throw std::runtime_error(message);
+    }
+
+    void release()
+    {
+        if (sqes_ != nullptr)
+        {
+            ::munmap(sqes_, sqes_len_);
+            sqes_ = nullptr;
+        }
+        if (cq_ring_ != nullptr && cq_ring_ != sq_ring_)
+        {
+            ::munmap(cq_ring_, cq_ring_len_);
+        }
+        cq_ring_ = nullptr;
+        if (sq_ring_ != nullptr)
+        {
+            ::munmap(sq_ring_, sq_ring_len_);
+            sq_ring_ = nullptr;
+        }
+        if (fd_ >= 0)
+        {
+            ::close(fd_);
+            fd_ = -1;
+        }
+    }
+
+    int fd_{-1};
+    void *sq_ring_{nullptr};
+    size_t sq_ring_len_{0};
+    void *cq_ring_{nullptr};
+    size_t cq_ring_len_{0};
+    struct io_uring_sqe *sqes_{nullptr};
+    size_t sqes_len_{0};
+
+    unsigned *sq_head_{nullptr};
+    unsigned *sq_tail_{nullptr};
+    unsigned sq_mask_{0};
+    unsigned sq_entries_{0};
+    unsigned *sq_array_{nullptr};
+    // The tail including the entries that haven't been submitted yet.
+    unsigned sqe_tail_{0};
+
+    unsigned *cq_head_{nullptr};
+    unsigned *cq_tail_{nullptr};
+    unsigned cq_mask_{0};
+    struct io_uring_cqe *cqes_{nullptr};
+};
+
+namespace
+{
+
+// Wait until both requests of a linked pair have completed, keeping the
+// result of the first.
+int wait_for_pair(IoUring * ring, uint64_t first, uint64_t second, int32_t *first_res)
+{
+    bool have_first = false;
+    bool have_second = false;
+    while (!have_first || !have_second)
+    {
+        struct io_uring_cqe cqe;
+        while (ring->pop(&cqe))
+        {
+            if (cqe.user_data == first)
+            {
+                *first_res = cqe.res;
+                have_first = true;
+            }
+            else if (cqe.user_data == second)
+            {
+                have_second = true;
+            }
+        }
+        if ((!have_first || !have_second) && ring->submit(1) < 0)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+void set_timeout(struct io_uring_sqe *sqe, struct __kernel_timespec *ts, int timeout_ms)
+{
+    ts->tv_sec = timeout_ms / 1000;
+    ts->tv_nsec = static_cast<long long>(timeout_ms % 1000) * 1000000;
+    sqe->opcode = IORING_OP_LINK_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = reinterpret_cast<uint64_t>(ts);
+    sqe->len = 1;
+    sqe->user_data = WRITE_TIMEOUT;
+}
+
+}  // namespace
+
+UringIo::UringIo(int read_fd, int write_fd, RingBuffer * ringbuf, size_t bounce_size)
+    : read_fd_(read_fd), write_fd_(write_fd), ringbuf_(ringbuf)
+{
+    if (read_fd_ >= 0)
+    {
+        if (ringbuf_ == nullptr)
+        {
+            throw std::runtime_error("UringIo needs a ring buffer to read into");
+        }
+
+        read_ring_ = std::make_unique<IoUring>(RING_ENTRIES);
+        if (bounce_size > 0)
+        {
+            bounce_.resize(bounce_size);
+        }
+        else if (!ringbuf_->is_adaptive())
+        {
+            // An adaptive ring buffer gives its pages back when it shrinks,
+            // which pinned pages would keep the kernel reading into, so its
+            // reads go through the ordinary path instead.
+            uint8_t *base;
+            size_t length;
+            ringbuf_->get_memory(&base, &length);
+            if (read_ring_->register_buffer(base, length) == 0)
+            {
+                registered_ = true;
+            }
+        }
+
+        post_read();
+        if (read_ring_->submit(0) < 0)
+        {
+            throw std::runtime_error(std::string("Failed to post io_uring read: ") + ::strerror(errno));
+        }
+    }
+
+    if (write_fd_ >= 0)
+    {
+        write_ring_ = std::make_unique<IoUring>(RING_ENTRIES);
+    }
+}
+
+UringIo::~UringIo()
+{
+    if (!read_posted_)
+    {
+        return;
+    }
+
+    // Cancel both the poll and the read linked behind it, since the poll
+    // may already have finished.
+    for (uint64_t target : {READ_POLL, READ_DATA})
+    {
+        struct io_uring_sqe *sqe = read_ring_->get_sqe();
+        if (sqe == nullptr)
+        {
+            break;
+        }
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = target;
+        sqe->user_data = CANCEL;
+    }
+    read_ring_->submit(0);
+
+    // The read can't be running for long, since it only starts once there
+    // is data, but don't hang forever if the kernel doesn't let go.
+    for (int i = 0; i < 100 && read_posted_; ++i)
+    {
+        struct io_uring_cqe cqe;
+        while (read_ring_->pop(&cqe))
+        {
+            if (cqe.user_data == READ_DATA)
+            {
+                read_posted_ = false;
+            }
+        }
+        if (read_posted_)
+        {
+            struct pollfd pfd{read_ring_->fd(), POLLIN, 0};
+            ::poll(&pfd, 1, 10);
+        }
+    }
+}
+
+int UringIo::get_fd() const
+{
+    return (read_ring_ != nullptr) ? read_ring_->fd() : -1;
+}
+
+void UringIo::post_read()
+{
+    size_t len;
+    if (!bounce_.empty())
+    {
+        read_span_ = bounce_.data();
+        len = bounce_.size();
+    }
+    else
+    {
+        read_span_ = ringbuf_->free_span(&len);
+    }
+
+    // The read is linked behind a poll, so that it only starts once there is
+    // data; otherwise the kernel would hand back EAGAIN straight away for a
+    // non-blocking file descriptor that it can't wait on by itself.
+    struct io_uring_sqe *poll = read_ring_->get_sqe();
+    struct io_uring_sqe *read = read_ring_->get_sqe();
+    poll->opcode = IORING_OP_POLL_ADD;
+    poll->fd = read_fd_;
+    poll->poll_events = POLLIN;
+    poll->flags = IOSQE_IO_LINK;
+    poll->user_data = READ_POLL;
+
+    read->fd = read_fd_;
+    read->addr = reinterpret_cast<uint64_t>(read_span_);
+    read->len = static_cast<uint32_t>(std::min<size_t>(len, UINT32_MAX));
+    read->off = static_cast<uint64_t>(-1);
+    read->user_data = READ_DATA;
+    if (registered_)
+    {
+        read->opcode = IORING_OP_READ_FIXED;
+        read->buf_index = 0;
+    }
+    else
+    {
+        read->opcode = IORING_OP_READ;
+    }
+
+    read_posted_ = true;
+}
+
+ssize_t UringIo::read(int timeout_ms)
+{
+    if (read_ring_ == nullptr)
+    {
+        errno = EBADF;
+        return -1;
+    }
+
+    bool waited = false;
+    while (true)
+    {
+        ssize_t added = 0;
+        int error = 0;
+        struct io_uring_cqe cqe;
+        while (read_ring_->pop(&cqe))
+        {
+            if (cqe.user_data == READ_POLL)
+            {
+                if (cqe.res > 0 && (cqe.res & (POLLHUP | POLLERR | POLLNVAL)) != 0)
+                {
+                    // Whatever the read linked behind it gets is the last of
+                    // the data.
+                    hung_up_ = true;
+                }
+            }
+            else if (cqe.user_data == READ_DATA)
+            {
+                read_posted_ = false;
+                if (cqe.res > 0)
+                {
+                    if (!bounce_.empty())
+                    {
+                        for (ssize_t copied = 0; copied < cqe.res; )
+                        {
+                            copied += ringbuf_->write(bounce_.data() + copied, cqe.res - copied);
+                        }
+                    }
+                    else
+                    {
+                        ringbuf_->commit(cqe.res);
+                    }
+                    added += cqe.res;
+                }
+                else if (cqe.res < 0 && cqe.res != -EAGAIN && cqe.res != -EINTR && cqe.res != -ECANCELED)
+                {
+                    error = -cqe.res;
+                    hung_up_ = true;
+                }
+            }
+        }
+
+        if (!read_posted_ && !hung_up_)
+        {
+            post_read();
+            if (read_ring_->submit(0) < 0)
+            {
+                read_posted_ = false;
+                return -1;
+            }
+        }
+
+        if (added > 0)
+        {
+            return added;
+        }
+        if (hung_up_ && !read_posted_)
+        {
+            errno = (error != 0) ? error : EIO;
+            return -1;
+        }
+        if (waited || timeout_ms == 0)
+        {
+            return 0;
+        }
+
+        struct pollfd pfd{read_ring_->fd(), POLLIN, 0};
+        if (::poll(&pfd, 1, timeout_ms) < 0 && errno != EINTR)
+        {
+            return -1;
+        }
+        waited = true;
+    }
+}
+
+ssize_t UringIo::writev(const struct iovec *iov, int iovcnt, uint32_t timeout_ms, size_t *written)
+{
+    *written = 0;
+    if (write_ring_ == nullptr || iovcnt < 0)
+    {
+        errno = EBADF;
+        return -1;
+    }
+
+    write_iov_.assign(iov, iov + iovcnt);
+    size_t len = 0;
+    for (const struct iovec & v : write_iov_)
+    {
+        len += v.iov_len;
+    }
+
+    // The kernel can write short, so carry on from where it stopped until
+    // everything is out.
+    size_t first = 0;
+    while (*written < len)
+    {
+        ssize_t ret = submit_write(false, &write_iov_[first], static_cast<unsigned>(write_iov_.size() - first), timeout_ms);
+        if (ret < 0)
+        {
+            return -1;
+        }
+        *written += ret;
+
+        size_t done = ret;
+        while (first < write_iov_.size() && done >= write_iov_[first].iov_len)
+        {
+            done -= write_iov_[first].iov_len;
+            first++;
+        }
+        if (first < write_iov_.size())
+        {
+            write_iov_[first].iov_base = static_cast<uint8_t *>(write_iov_[first].iov_base) + done;
+            write_iov_[first].iov_len -= done;
+        }
+    }
+
+    return len;
+}
+
+ssize_t UringIo::sendmsg(const struct msghdr *msg, uint32_t timeout_ms)
+{
+    if (write_ring_ == nullptr)
+    {
+        errno = EBADF;
+        return -1;
+    }
+
+    return submit_write(true, msg, 1, timeout_ms);
+}
+
+ssize_t UringIo::submit_write(bool is_sendmsg, const void *arg, unsigned count, uint32_t timeout_ms)
+{
+    std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+
+    while (true)
+    {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (now >= deadline)
+        {
+            errno = EBUSY;
+            return -1;
+        }
+        // Round up, like Transporter::wait_writable().
+        int left_ms = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count()) + 1;
+
+        // The write and its timeout go in together; if the kernel has to wait
+        // for room in the transport, the timeout cancels the write.
+        struct __kernel_timespec ts;
+        struct io_uring_sqe *write = write_ring_->get_sqe();
+        struct io_uring_sqe *timeout = write_ring_->get_sqe();
+        write->opcode = is_sendmsg ? IORING_OP_SENDMSG : IORING_OP_WRITEV;
+        write->fd = write_fd_;
+        write->addr = reinterpret_cast<uint64_t>(arg);
+        write->len = count;
+        write->off = is_sendmsg ? 0 : static_cast<uint64_t>(-1);
+        write->flags = IOSQE_IO_LINK;
+        write->user_data = WRITE_DATA;
+        set_timeout(timeout, &ts, left_ms);
+
+        int32_t res = 0;
+        if (write_ring_->submit(2) < 0 || wait_for_pair(write_ring_.get(), WRITE_DATA, WRITE_TIMEOUT, &res) < 0)
+        {
+            return -1;
+        }
+
+        if (res >= 0)
+        {
+            return res;
+        }
+        if (res == -ECANCELED)
+        {
+            errno = EBUSY;
+            return -1;
+        }
+        if (res == -EINTR)
+        {
+            continue;
+        }
+        if (res != -EAGAIN)
+        {
+            errno = -res;
+            return -1;
+        }
+
+        // The kernel can't wait for room in this file descriptor by itself,
+        // so wait for it to become writable first, and then try again.
+        struct io_uring_sqe *poll = write_ring_->get_sqe();
+        timeout = write_ring_->get_sqe();
+        poll->opcode = IORING_OP_POLL_ADD;
+        poll->fd = write_fd_;
+        poll->poll_events = POLLOUT;
+        poll->flags = IOSQE_IO_LINK;
+        poll->user_data = WRITE_POLL;
+        set_timeout(timeout, &ts, left_ms);
+
+        if (write_ring_->submit(2) < 0 || wait_for_pair(write_ring_.get(), WRITE_POLL, WRITE_TIMEOUT, &res) < 0)
+        {
+            return -1;
+        }
+        if (res == -ECANCELED)
+        {
+            errno = EBUSY;
+            return -1;
+        }
+        if (res < 0 || (res & (POLLERR | POLLNVAL)) != 0)
+        {
+            errno = (res < 0) ? -res : EIO;
+            return -1;
+        }
+    }
+}
+
+}  // namespace impl
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
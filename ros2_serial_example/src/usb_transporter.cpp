@@ -0,0 +1,438 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/usbdevice_fs.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include "ros2_serial_example/transporter.hpp"
+#include "ros2_serial_example/usb_transporter.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace transport
+{
+
+constexpr size_t USBTransporter::MAX_TRANSFERS;
+constexpr size_t USBTransporter::MAX_OUT_TRANSFER;
+
+// The CDC class request that sets DTR and RTS, which many CDC-ACM devices
+// wait for before sending anything, since opening the tty raises them.
+static constexpr uint8_t CDC_REQUEST_TYPE = 0x21;
+static constexpr uint8_t CDC_SET_CONTROL_LINE_STATE = 0x22;
+static constexpr uint16_t CDC_DTR_RTS = 0x3;
+static constexpr uint32_t CONTROL_TIMEOUT_MS = 1000;
+
+// This function reads the first line of a sysfs attribute.
+//
+// Returns the line, or an empty string if the attribute can't be read.
+static std::string read_attribute(const std::string & path)
+{
+    std::ifstream file(path);
+    std::string line;
+    std::getline(file, line);
+    return line;
+}
+
+static std::vector<std::string> list_directory(const std::string & path)
+{
+    std::vector<std::string> names;
+    DIR *dir = ::opendir(path.c_str());
+    if (dir == nullptr)
+    {
+        return names;
+    }
+    while (struct dirent *entry = ::readdir(dir))
+    {
+        if (entry->d_name[0] != '.')
+        {
+            names.emplace_back(entry->d_name);
+        }
+    }
+    ::closedir(dir);
+
+    return names;
+}
+
+USBTransporter::USBTransporter(const std::string & protocol,
+                               uint16_t vendor_id,
+                               uint16_t product_id,
+                               const std::string & serial,
+                               uint8_t interface,
+                               uint32_t read_poll_ms,
+                               size_t ring_buffer_size,
+                               size_t transfers,
+                               size_t transfer_size):
+    Transporter(protocol, ring_buffer_size),
+    vendor_id_(vendor_id),
+    product_id_(product_id),
+    serial_(serial),
+    interface_(interface),
+    read_poll_ms_(read_poll_ms),
+    transfer_size_(transfer_size)
+{
+    if (transfers == 0 || transfers > MAX_TRANSFERS)
+    {
+        throw std::runtime_error("Invalid number of USB transfers, must be between 1 and " +
+                                 std::to_string(MAX_TRANSFERS) + " inclusive");
+    }
+
+    if (transfer_size_ == 0 || transfer_size_ > static_cast<size_t>(INT32_MAX))
+    {
+        throw std::runtime_error("Invalid USB transfer size");
+    }
+
+    urbs_.resize(transfers);
+    in_buffers_.resize(transfers * transfer_size_);
+}
+
+USBTransporter::~USBTransporter()
+{
+    close();
+}
+
+int USBTransporter::find_device(const std::string & sysfs_root,
+                                uint16_t vendor_id,
+                                uint16_t product_id,
+                                const std::string & serial,
+                                uint8_t interface,
+                                Device *device)
+{
+    for (const std::string & name : list_directory(sysfs_root))
+    {
+        // Interfaces have a colon in their names; devices don't.
+        if (name.find(':') != std::string::npos)
+        {
+            continue;
+        }
+
+        std::string dev_dir = sysfs_root + "/" + name;
+        if (std::strtoul(read_attribute(dev_dir + "/idVendor").c_str(), nullptr, 16) != vendor_id ||
+            std::strtoul(read_attribute(dev_dir + "/idProduct").c_str(), nullptr, 16) != product_id ||
+            (!serial.empty() && read_attribute(dev_dir + "/serial") != serial))
+        {
+            continue;
+        }
+
+        std::string intf_dir = sysfs_root + "/" + name + ":" + read_attribute(dev_dir + "/bConfigurationValue") +
+                               "." + std::to_string(interface);
+        Device found;
+        for (const std::string & ep : list_directory(intf_dir))
+        {
+            if (ep.compare(0, 3, "ep_") != 0 || read_attribute(intf_dir + "/" + ep + "/type") != "Bulk")
+            {
+                continue;
+            }
+
+            uint8_t address = static_cast<uint8_t>(std::strtoul(ep.c_str() + 3, nullptr, 16));
+            std::string direction = read_attribute(intf_dir + "/" + ep + "/direction");
+            if (direction == "in" && found.in_endpoint == 0)
+            {
+                found.in_endpoint = address;
+            }
+            else if (direction == "out" && found.out_endpoint == 0)
+            {
+                found.out_endpoint = address;
+                found.out_packet_size = std::strtoul(read_attribute(intf_dir + "/" + ep + "/wMaxPacketSize").c_str(),
+                                                     nullptr, 16);
+            }
+        }
+        if (found.in_endpoint == 0 || found.out_endpoint == 0 || found.out_packet_size == 0)
+        {
+            continue;
+        }
+
+        char path[64];
+        ::snprintf(path, sizeof(path), "/dev/bus/usb/%03lu/%03lu",
+                   std::strtoul(read_attribute(dev_dir + "/busnum").c_str(), nullptr, 10),
+                   std::strtoul(read_attribute(dev_dir + "/devnum").c_str(), nullptr, 10));
+        found.path = path;
+        *device = found;
+        return 0;
+    }
+
+    return -1;
+}
+
+int USBTransporter::init()
+{
+    if (fds_OK())
+    {
+        ::fprintf(stderr, "Cannot re-init; call close first\n");
+        return -1;
+    }
+
+    if (find_device("/sys/bus/usb/devices", vendor_id_, product_id_, serial_, interface_, &device_) < 0)
+    {
+        ::fprintf(stderr, "No USB device %04x:%04x%s%s with bulk endpoints on interface %u\n", vendor_id_,
+                  product_id_, serial_.empty() ? "" : " serial ", serial_.c_str(), interface_);
+        return -1;
+    }
+
+    fd_ = ::open(device_.path.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd_ < 0)
+    {
+        ::fprintf(stderr, "Failed to open %s: %s\n", device_.path.c_str(), ::strerror(errno));
+        return -1;
+    }
+
+    // Take the interface from whichever kernel driver has it (cdc_acm, for
+    // instance) and claim it in one go, so no other process can get in
+    // between.
+    struct usbdevfs_disconnect_claim claim{};
+    claim.interface = interface_;
+    claim.flags = USBDEVFS_DISCONNECT_CLAIM_EXCEPT_DRIVER;
+    ::strncpy(claim.driver, "usbfs", sizeof(claim.driver) - 1);
+    if (::ioctl(fd_, USBDEVFS_DISCONNECT_CLAIM, &claim) < 0)
+    {
+        ::fprintf(stderr, "Failed to claim USB interface %u: %s\n", interface_, ::strerror(errno));
+        close();
+        return -1;
+    }
+    claimed_ = true;
+
+    // For a CDC-ACM device, the data interface follows the communications
+    // interface that the request goes to; other devices just refuse it.
+    if (interface_ > 0)
+    {
+        struct usbdevfs_ctrltransfer ctrl{};
+        ctrl.bRequestType = CDC_REQUEST_TYPE;
+        ctrl.bRequest = CDC_SET_CONTROL_LINE_STATE;
+        ctrl.wValue = CDC_DTR_RTS;
+        ctrl.wIndex = static_cast<uint16_t>(interface_ - 1);
+        ctrl.timeout = CONTROL_TIMEOUT_MS;
+        ::ioctl(fd_, USBDEVFS_CONTROL, &ctrl);
+    }
+
+    // usbfs reports completed transfers as the device being writable; the
+    // epoll file descriptor turns that into it being readable, which is
+    // what the bridge waits for.
+    epoll_fd_ = ::epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev{};
+    ev.events = EPOLLOUT;
+    ev.data.fd = fd_;
+    if (epoll_fd_ < 0 || ::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd_, &ev) < 0)
+    {
+        ::fprintf(stderr, "Failed to set up USB polling: %s\n", ::strerror(errno));
+        close();
+        return -1;
+    }
+
+    for (size_t i = 0; i < urbs_.size(); ++i)
+    {
+        if (submit_in(i) < 0)
+        {
+            ::fprintf(stderr, "Failed to queue USB transfer: %s\n", ::strerror(errno));
+            close();
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int USBTransporter::submit_in(size_t index)
+{
+    struct usbdevfs_urb & urb = urbs_[index];
+    urb = {};
+    urb.type = USBDEVFS_URB_TYPE_BULK;
+    urb.endpoint = device_.in_endpoint;
+    urb.buffer = &in_buffers_[index * transfer_size_];
+    urb.buffer_length = static_cast<int>(transfer_size_);
+
+    return ::ioctl(fd_, USBDEVFS_SUBMITURB, &urb);
+}
+
+int USBTransporter::close()
+{
+    if (-1 != fd_)
+    {
+        // Closing the device cancels the transfers that are still queued.
+        if (claimed_)
+        {
+            unsigned int intf = interface_;
+            ::ioctl(fd_, USBDEVFS_RELEASEINTERFACE, &intf);
+
+            // Hand the interface back to its kernel driver.
+            struct usbdevfs_ioctl command{};
+            command.ifno = interface_;
+            command.ioctl_code = USBDEVFS_CONNECT;
+            ::ioctl(fd_, USBDEVFS_IOCTL, &command);
+            claimed_ = false;
+        }
+
+        ::close(fd_);
+        fd_ = -1;
+    }
+
+    if (-1 != epoll_fd_)
+    {
+        ::close(epoll_fd_);
+        epoll_fd_ = -1;
+    }
+
+    return 0;
+}
+
+bool USBTransporter::fds_OK()
+{
+    return -1 != fd_ && -1 != epoll_fd_;
+}
+
+int USBTransporter::get_read_fd() const
+{
+    return epoll_fd_;
+}
+
+ssize_t USBTransporter::node_read()
+{
+    if (!fds_OK())
+    {
+        return -1;
+    }
+
+    struct epoll_event ev;
+    int r = ::epoll_wait(epoll_fd_, &ev, 1, read_poll_ms_);
+    if (r <= 0)
+    {
+        return (r < 0 && errno != EINTR) ? -1 : 0;
+    }
+
+    ssize_t ret = 0;
+    while (true)
+    {
+        struct usbdevfs_urb *urb = nullptr;
+        if (::ioctl(fd_, USBDEVFS_REAPURBNDELAY, &urb) < 0)
+        {
+            if (errno == EAGAIN)
+            {
+                break;
+            }
+
+            return -1;
+        }
+
+        if (urb->status == -ENODEV || urb->status == -ESHUTDOWN)
+        {
+            errno = ENODEV;
+            return -1;
+        }
+
+        if (urb->status == 0)
+        {
+            // A zero-length packet completes a transfer with no data, and
+            // just means the device had nothing more to send.
+            const uint8_t *data = static_cast<const uint8_t *>(urb->buffer);
+            for (ssize_t copied = 0; copied < urb->actual_length; )
+            {
+                copied += ringbuf_.write(data + copied, urb->actual_length - copied);
+            }
+            ret += urb->actual_length;
+        }
+        else if (urb->status == -EPIPE)
+        {
+            unsigned int endpoint = device_.in_endpoint;
+            ::ioctl(fd_, USBDEVFS_CLEAR_HALT, &endpoint);
+        }
+
+        // Anything else (a babble or a CRC error, say) loses that transfer's
+        // data, which the framing copes with.
+        if (submit_in(urb - urbs_.data()) < 0)
+        {
+            return -1;
+        }
+    }
+
+    return ret;
+}
+
+int USBTransporter::bulk_out(void *buffer, size_t len)
+{
+    struct usbdevfs_bulktransfer bulk{};
+    bulk.ep = device_.out_endpoint;
+    bulk.len = static_cast<unsigned int>(len);
+    // A timeout of 0 would wait forever.
+    bulk.timeout = (write_timeout_ms_ > 0) ? write_timeout_ms_ : 1;
+    bulk.data = buffer;
+
+    int ret = ::ioctl(fd_, USBDEVFS_BULK, &bulk);
+    if (ret < 0 && errno == EPIPE)
+    {
+        unsigned int endpoint = device_.out_endpoint;
+        ::ioctl(fd_, USBDEVFS_CLEAR_HALT, &endpoint);
+    }
+
+    return ret;
+}
+
+ssize_t USBTransporter::node_write(void *buffer, size_t len)
+{
+    if (nullptr == buffer || !fds_OK())
+    {
+        return -1;
+    }
+
+    uint8_t *data = static_cast<uint8_t *>(buffer);
+    size_t sent = 0;
+    while (sent < len)
+    {
+        size_t chunk = (len - sent < MAX_OUT_TRANSFER) ? len - sent : MAX_OUT_TRANSFER;
+        int ret = bulk_out(data + sent, chunk);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            if (errno == ETIMEDOUT)
+            {
+                // Some of the chunk may have gone out, so it can't simply be
+                // sent again.
+                partial_writes_++;
+                errno = EBUSY;
+            }
+            return -1;
+        }
+
+        sent += ret;
+    }
+
+    // The device only sees the end of a transfer at a short packet, so one
+    // that ends on a packet boundary needs a zero-length packet after it.
+    if (len > 0 && len % device_.out_packet_size == 0 && bulk_out(data, 0) < 0)
+    {
+        return -1;
+    }
+
+    return len;
+}
+
+}  // namespace transport
+}  // namespace ros2_to_serial_bridge
@@ -12,8 +12,13 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <memory>
 #include <string>
+#include <utility>
 
 #include <rclcpp/rclcpp.hpp>
 
@@ -22,13 +27,20 @@
 
 #include <@(ros2_type.ns)/msg/@(ros2_type.lower_type).hpp>
 #include <@(ros2_type.ns)/msg/detail/@(ros2_type.lower_type)__rosidl_typesupport_fastrtps_cpp.hpp>
+@[for b in batches]@
+#include <@(b.ns)/msg/@(b.lower_type).hpp>
+@[end for]@
 
 #include "@(ros2_type.ns)_@(ros2_type.lower_type)_pub_sub_type.hpp"
 
+#include "ros2_serial_example/batch_publisher.hpp"
+#include "ros2_serial_example/cdr_fixed_layout.hpp"
+#include "ros2_serial_example/packed_encoding.hpp"
 #include "ros2_serial_example/publisher.hpp"
 #include "ros2_serial_example/publisher_impl.hpp"
 #include "ros2_serial_example/subscription.hpp"
 #include "ros2_serial_example/subscription_impl.hpp"
+#include "ros2_serial_example/typesupport_size.hpp"
 
 namespace ros2_to_serial_bridge
 {
@@ -36,22 +48,160 @@ namespace ros2_to_serial_bridge
 namespace pubsub
 {
 
-std::unique_ptr<Publisher> @(ros2_type.ns)_@(ros2_type.lower_type)_pub_factory(rclcpp::Node * node, const std::string & topic)
+@[if fixed_layout is not None]@
+// @(ros2_type.ns)/@(ros2_type.ros_type) has no strings or sequences, so its CDR has the
+// same layout in every message, and each field is copied straight to or from
+// its offset.
+struct @(ros2_type.ns)_@(ros2_type.lower_type)_layout final
 {
-    typedef bool (*des_t)(eprosima::fastcdr::Cdr &, @(ros2_type.ns)::msg::@(ros2_type.ros_type) &);
-    des_t des = @(ros2_type.ns)::msg::typesupport_fastrtps_cpp::cdr_deserialize;
-    return std::make_unique<PublisherImpl<@(ros2_type.ns)::msg::@(ros2_type.ros_type)>>(node, topic, des);
+    static constexpr bool FIXED = true;
+    static constexpr size_t SIZE = @(fixed_layout.size);
+    static constexpr size_t MIN_SIZE = SIZE;
+
+    static bool decode(const uint8_t *data, size_t length, @(ros2_type.ns)::msg::@(ros2_type.ros_type) & msg)
+    {
+        if (length < SIZE)
+        {
+            return false;
+        }
+@[for f in fixed_layout.fields]@
+        cdr::fixed_load<@(f.size)>(data, @(f.offset), msg.@(f.accessor));
+@[end for]@
+        return true;
+    }
+
+    static size_t encode(const @(ros2_type.ns)::msg::@(ros2_type.ros_type) & msg, uint8_t *data, size_t length)
+    {
+        if (length < SIZE)
+        {
+            return 0;
+        }
+@[for g in fixed_layout.gaps]@
+        ::memset(data + @(g[0]), 0, @(g[1]));
+@[end for]@
+@[for f in fixed_layout.fields]@
+        cdr::fixed_store<@(f.size)>(data, @(f.offset), msg.@(f.accessor));
+@[end for]@
+        return SIZE;
+    }
+};
+
+constexpr bool @(ros2_type.ns)_@(ros2_type.lower_type)_layout::FIXED;
+constexpr size_t @(ros2_type.ns)_@(ros2_type.lower_type)_layout::SIZE;
+constexpr size_t @(ros2_type.ns)_@(ros2_type.lower_type)_layout::MIN_SIZE;
+
+@[else]@
+// @(ros2_type.ns)/@(ros2_type.ros_type) goes through Fast-CDR, but data shorter than the
+// shortest message of the type is turned away without being decoded.
+using @(ros2_type.ns)_@(ros2_type.lower_type)_layout = cdr::VariableLayout<@(ros2_type.ns)::msg::@(ros2_type.ros_type), @(min_size)>;
+
+@[end if]@
+@[if packing is not None]@
+// Topics of @(ros2_type.ns)/@(ros2_type.ros_type) can send their messages packed, with their
+// strings interned or their fields quantized (see packed_encoding.hpp).
+struct @(ros2_type.ns)_@(ros2_type.lower_type)_packing final
+{
+    static constexpr bool PACKABLE = true;
+    static constexpr bool HAS_STRINGS = @('true' if packing.has_strings else 'false');
+
+    static const PackedField * fields(size_t * count)
+    {
+        static const PackedField FIELDS[] = {
+@[for field in packing.fields]@
+            {"@(field[0])", PackedField::Kind::@(field[1])},
+@[end for]@
+        };
+        *count = sizeof(FIELDS) / sizeof(FIELDS[0]);
+        return FIELDS;
+    }
+
+    static void encode(const @(ros2_type.ns)::msg::@(ros2_type.ros_type) & msg, PackedWriter & writer)
+    {
+@[for line in packing.encode]@
+        @(line)
+@[end for]@
+    }
+
+    static bool decode(PackedReader & reader, @(ros2_type.ns)::msg::@(ros2_type.ros_type) & msg)
+    {
+@[for line in packing.decode]@
+        @(line)
+@[end for]@
+        return reader.finish();
+    }
+};
+
+constexpr bool @(ros2_type.ns)_@(ros2_type.lower_type)_packing::PACKABLE;
+constexpr bool @(ros2_type.ns)_@(ros2_type.lower_type)_packing::HAS_STRINGS;
+
+@[else]@
+using @(ros2_type.ns)_@(ros2_type.lower_type)_packing = NoPacking<@(ros2_type.ns)::msg::@(ros2_type.ros_type)>;
+
+@[end if]@
+size_t @(ros2_type.ns)_@(ros2_type.lower_type)_max_serialized_size(bool * bounded)
+{
+    return max_serialized_size(@(ros2_type.ns)::msg::typesupport_fastrtps_cpp::max_serialized_size_@(ros2_type.ros_type), bounded);
+}
+
+size_t @(ros2_type.ns)_@(ros2_type.lower_type)_fixed_size()
+{
+    return @(ros2_type.ns)_@(ros2_type.lower_type)_layout::SIZE;
 }
 
-std::unique_ptr<Subscription> @(ros2_type.ns)_@(ros2_type.lower_type)_sub_factory(rclcpp::Node * node, topic_id_size_t serial_mapping, const std::string & topic, ros2_to_serial_bridge::transport::Transporter * transporter)
+std::unique_ptr<Publisher> @(ros2_type.ns)_@(ros2_type.lower_type)_pub_factory(rclcpp::Node * node, const std::string & topic, bool passthrough, const rclcpp::QoS & qos)
 {
-    typedef size_t (*getsize_t)(const @(ros2_type.ns)::msg::@(ros2_type.ros_type) &, size_t);
-    getsize_t getsize = @(ros2_type.ns)::msg::typesupport_fastrtps_cpp::get_serialized_size;
-    typedef bool (*ser_t)(const @(ros2_type.ns)::msg::@(ros2_type.ros_type) &, eprosima::fastcdr::Cdr &);
-    ser_t ser = @(ros2_type.ns)::msg::typesupport_fastrtps_cpp::cdr_serialize;
+    return std::make_unique<PublisherImpl<@(ros2_type.ns)::msg::@(ros2_type.ros_type),
+                                          @(ros2_type.ns)::msg::typesupport_fastrtps_cpp::cdr_deserialize,
+                                          @(ros2_type.ns)_@(ros2_type.lower_type)_layout,
+                                          @(ros2_type.ns)_@(ros2_type.lower_type)_packing>>(node, topic, passthrough, qos);
+}
 
-    return std::make_unique<SubscriptionImpl<@(ros2_type.ns)::msg::@(ros2_type.ros_type)>>(node, serial_mapping, topic, transporter, getsize, ser);
+// The batch types are the message types the bridge was built with whose
+// samples field is a sequence of @(ros2_type.ns)/@(ros2_type.ros_type).
+std::unique_ptr<Publisher> @(ros2_type.ns)_@(ros2_type.lower_type)_batch_pub_factory(const std::string & batch_type, rclcpp::Node * node, const std::string & topic, const rclcpp::QoS & qos, size_t batch_size, uint32_t batch_ms)
+{
+@[for b in batches]@
+    if (batch_type == "@(b.ns)/@(b.ros_type)")
+    {
+        auto batch = std::make_unique<BatchSinkImpl<@(ros2_type.ns)::msg::@(ros2_type.ros_type), @(b.ns)::msg::@(b.ros_type)>>(
+            node, topic, qos, batch_size, std::chrono::milliseconds(batch_ms), @(b.max_samples));
+        return std::make_unique<PublisherImpl<@(ros2_type.ns)::msg::@(ros2_type.ros_type),
+                                              @(ros2_type.ns)::msg::typesupport_fastrtps_cpp::cdr_deserialize,
+                                              @(ros2_type.ns)_@(ros2_type.lower_type)_layout,
+                                              @(ros2_type.ns)_@(ros2_type.lower_type)_packing>>(node, topic, false, qos, std::move(batch));
+    }
+@[end for]@
+    (void)batch_type;
+    (void)node;
+    (void)topic;
+    (void)qos;
+    (void)batch_size;
+    (void)batch_ms;
+    return nullptr;
+}
+
+std::unique_ptr<Subscription> @(ros2_type.ns)_@(ros2_type.lower_type)_sub_factory(rclcpp::Node * node, topic_id_size_t serial_mapping, const std::string & topic, ros2_to_serial_bridge::transport::Transporter * transporter, ros2_to_serial_bridge::transport::TxQueue * tx_queue, bool passthrough, const rclcpp::QoS & qos, const std::shared_ptr<rclcpp::CallbackGroup> & callback_group)
+{
+    return std::make_unique<SubscriptionImpl<@(ros2_type.ns)::msg::@(ros2_type.ros_type),
+                                             @(ros2_type.ns)::msg::typesupport_fastrtps_cpp::get_serialized_size,
+                                             @(ros2_type.ns)::msg::typesupport_fastrtps_cpp::cdr_serialize,
+                                             @(ros2_type.ns)_@(ros2_type.lower_type)_max_serialized_size,
+                                             @(ros2_type.ns)_@(ros2_type.lower_type)_layout,
+                                             @(ros2_type.ns)_@(ros2_type.lower_type)_packing>>(node, serial_mapping, topic, transporter, tx_queue, passthrough, qos, callback_group);
 }
 
 }  // namespace pubsub
 }  // namespace ros2_to_serial_bridge
+
+#ifdef ROS2_SERIAL_TYPE_PLUGIN
+#include "ros2_serial_example/type_plugin.hpp"
+
+// The symbol that ROS2Topics looks up after loading this type's plugin.
+extern "C" const ros2_to_serial_bridge::pubsub::TypePlugin ros2_serial_type_plugin = {
+    ros2_to_serial_bridge::pubsub::@(ros2_type.ns)_@(ros2_type.lower_type)_pub_factory,
+    ros2_to_serial_bridge::pubsub::@(ros2_type.ns)_@(ros2_type.lower_type)_sub_factory,
+    ros2_to_serial_bridge::pubsub::@(ros2_type.ns)_@(ros2_type.lower_type)_max_serialized_size,
+    ros2_to_serial_bridge::pubsub::@(ros2_type.ns)_@(ros2_type.lower_type)_fixed_size,
+    ros2_to_serial_bridge::pubsub::@(ros2_type.ns)_@(ros2_type.lower_type)_batch_pub_factory,
+};
+#endif
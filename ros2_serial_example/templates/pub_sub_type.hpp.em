@@ -15,6 +15,8 @@
 #ifndef ROS2_SERIAL_EXAMPLE__@(ros2_type.ns.upper())_@(ros2_type.lower_type.upper())_HPP_
 #define ROS2_SERIAL_EXAMPLE__@(ros2_type.ns.upper())_@(ros2_type.lower_type.upper())_HPP_
 
+#include <cstddef>
+#include <cstdint>
 #include <memory>
 #include <string>
 
@@ -23,6 +25,7 @@
 #include "ros2_serial_example/publisher.hpp"
 #include "ros2_serial_example/subscription.hpp"
 #include "ros2_serial_example/transporter.hpp"
+#include "ros2_serial_example/tx_queue.hpp"
 
 namespace ros2_to_serial_bridge
 {
@@ -30,8 +33,11 @@ namespace ros2_to_serial_bridge
 namespace pubsub
 {
 
-std::unique_ptr<Publisher> @(ros2_type.ns)_@(ros2_type.lower_type)_pub_factory(rclcpp::Node * node, const std::string & topic);
-std::unique_ptr<Subscription> @(ros2_type.ns)_@(ros2_type.lower_type)_sub_factory(rclcpp::Node * node, topic_id_size_t serial_mapping, const std::string & topic, ros2_to_serial_bridge::transport::Transporter * transporter);
+std::unique_ptr<Publisher> @(ros2_type.ns)_@(ros2_type.lower_type)_pub_factory(rclcpp::Node * node, const std::string & topic, bool passthrough, const rclcpp::QoS & qos);
+std::unique_ptr<Subscription> @(ros2_type.ns)_@(ros2_type.lower_type)_sub_factory(rclcpp::Node * node, topic_id_size_t serial_mapping, const std::string & topic, ros2_to_serial_bridge::transport::Transporter * transporter, ros2_to_serial_bridge::transport::TxQueue * tx_queue, bool passthrough, const rclcpp::QoS & qos, const std::shared_ptr<rclcpp::CallbackGroup> & callback_group);
+size_t @(ros2_type.ns)_@(ros2_type.lower_type)_max_serialized_size(bool * bounded);
+size_t @(ros2_type.ns)_@(ros2_type.lower_type)_fixed_size();
+std::unique_ptr<Publisher> @(ros2_type.ns)_@(ros2_type.lower_type)_batch_pub_factory(const std::string & batch_type, rclcpp::Node * node, const std::string & topic, const rclcpp::QoS & qos, size_t batch_size, uint32_t batch_ms);
 
 }  // namespace pubsub
 }  // namespace ros2_to_serial_bridge
@@ -0,0 +1,205 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// C++ includes
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+#include <map>
+#include <string>
+
+#include "ros2_topics.hpp"
+
+@[if not type_plugins]@
+@[for t in ros2_types]@
+#include "@(t.ns)_@(t.lower_type)_pub_sub_type.hpp"
+@[end for]@
+@[end if]@
+@[for t in ros2_services]@
+#include "@(t.ns)_@(t.lower_type)_service_type.hpp"
+@[end for]@
+
+namespace ros2_to_serial_bridge
+{
+
+namespace pubsub
+{
+
+@[if ros2_types]@
+namespace
+{
+
+// Every type the bridge was generated with, sorted by name so that
+// find_registered_type() can binary search it.
+constexpr RegisteredType REGISTERED_TYPES[] = {
+@[for t in ros2_types]@
+@[if type_plugins]@
+    {"@(t.ns)/@(t.ros_type)", "libros2_serial_type_@(t.ns)_@(t.lower_type).so", {nullptr, nullptr, nullptr, nullptr, nullptr}, @('0x%08xU' % t.type_hash)},
+@[else]@
+    {"@(t.ns)/@(t.ros_type)", nullptr, {@(t.ns)_@(t.lower_type)_pub_factory, @(t.ns)_@(t.lower_type)_sub_factory, @(t.ns)_@(t.lower_type)_max_serialized_size, @(t.ns)_@(t.lower_type)_fixed_size, @(t.ns)_@(t.lower_type)_batch_pub_factory}, @('0x%08xU' % t.type_hash)},
+@[end if]@
+@[end for]@
+};
+
+}  // namespace
+
+const RegisteredType * find_registered_type(const std::string & name)
+{
+    const RegisteredType * it = std::lower_bound(std::begin(REGISTERED_TYPES), std::end(REGISTERED_TYPES), name,
+                                                 [](const RegisteredType & t, const std::string & n) {
+                                                     return n.compare(t.name) > 0;
+                                                 });
+    if (it == std::end(REGISTERED_TYPES) || name != it->name)
+    {
+        return nullptr;
+    }
+
+    return it;
+}
+@[else]@
+const RegisteredType * find_registered_type(const std::string & name)
+{
+    (void)name;
+    return nullptr;
+}
+@[end if]@
+
+@[if ros2_services]@
+namespace
+{
+
+// Every service the bridge was generated with, sorted by name so that
+// find_registered_service() can binary search it.
+constexpr RegisteredService REGISTERED_SERVICES[] = {
+@[for t in ros2_services]@
+    {"@(t.ns)/@(t.ros_type)", @(t.ns)_@(t.lower_type)_service_factory},
+@[end for]@
+};
+
+}  // namespace
+
+const RegisteredService * find_registered_service(const std::string & name)
+{
+    const RegisteredService * it = std::lower_bound(std::begin(REGISTERED_SERVICES), std::end(REGISTERED_SERVICES), name,
+                                                    [](const RegisteredService & t, const std::string & n) {
+                                                        return n.compare(t.name) > 0;
+                                                    });
+    if (it == std::end(REGISTERED_SERVICES) || name != it->name)
+    {
+        return nullptr;
+    }
+
+    return it;
+}
+@[else]@
+const RegisteredService * find_registered_service(const std::string & name)
+{
+    (void)name;
+    return nullptr;
+}
+@[end if]@
+
+@[if baked_topics]@
+namespace
+{
+
+@[for t in baked_topics]@
+@[if t.dictionary is not None]@
+constexpr uint8_t BAKED_DICTIONARY_@(t.index)[] = {@(', '.join('0x%02x' % b for b in t.dictionary))};
+@[end if]@
+@[if t.quantize is not None]@
+constexpr const char * BAKED_QUANTIZE_@(t.index)[] = {@(', '.join(t.quantize))};
+@[end if]@
+@[end for]@
+
+// The topics of the baked config, in the order of its ports.
+constexpr BakedTopic BAKED_TOPICS[] = {
+@[for t in baked_topics]@
+    {@(t.initializer())},
+@[end for]@
+};
+
+}  // namespace
+
+bool get_baked_topics(const std::string & port, std::map<std::string, TopicMapping> * topics)
+{
+    bool found = false;
+    for (const BakedTopic & baked : BAKED_TOPICS)
+    {
+        if (port != baked.port)
+        {
+            continue;
+        }
+        found = true;
+
+        TopicMapping & mapping = (*topics)[baked.name];
+        mapping.type = baked.type;
+        mapping.serial_mapping = baked.serial_mapping;
+        mapping.direction = baked.direction;
+        mapping.tx_queue_depth = baked.tx_queue_depth;
+        mapping.tx_overflow_policy = baked.drop_newest ? ros2_to_serial_bridge::transport::TxQueue::OverflowPolicy::DROP_NEWEST :
+                                                         ros2_to_serial_bridge::transport::TxQueue::OverflowPolicy::DROP_OLDEST;
+        mapping.tx_priority = baked.tx_priority;
+        mapping.tx_max_rate_hz = baked.tx_max_rate_hz;
+        mapping.passthrough = baked.passthrough;
+        mapping.qos = rclcpp::QoS(rclcpp::KeepLast(baked.history_depth));
+        if (baked.best_effort)
+        {
+            mapping.qos.best_effort();
+        }
+        if (baked.transient_local)
+        {
+            mapping.qos.transient_local();
+        }
+        if (baked.deadline_ms >= 0)
+        {
+            mapping.qos.deadline(rclcpp::Duration(std::chrono::milliseconds(baked.deadline_ms)));
+        }
+        mapping.compress_threshold = baked.compress_threshold;
+        mapping.compress_dictionary.assign(baked.compress_dictionary,
+                                           baked.compress_dictionary + baked.compress_dictionary_size);
+        mapping.delta_keyframe_interval = baked.delta_keyframe_interval;
+        mapping.reliable = baked.reliable;
+        mapping.bond_mode = baked.bond_mode;
+        mapping.stamp_header = baked.stamp_header;
+        mapping.device_stamp = baked.device_stamp;
+        mapping.lazy = baked.lazy;
+        mapping.max_rate_hz = baked.max_rate_hz;
+        mapping.last_value = baked.last_value;
+        mapping.on_change = baked.on_change;
+        mapping.on_change_keepalive_ms = baked.on_change_keepalive_ms;
+        mapping.max_age_ms = baked.max_age_ms;
+        mapping.rx_priority = baked.rx_priority;
+        mapping.elide_length = baked.elide_length;
+        mapping.intern_strings = baked.intern_strings;
+        mapping.quantize.assign(baked.quantize, baked.quantize + baked.quantize_count);
+        mapping.batch_type = baked.batch_type;
+        mapping.batch_size = baked.batch_size;
+        mapping.batch_ms = baked.batch_ms;
+        mapping.max_message_size = baked.max_message_size;
+    }
+
+    return found;
+}
+@[else]@
+bool get_baked_topics(const std::string & port, std::map<std::string, TopicMapping> * topics)
+{
+    (void)port;
+    (void)topics;
+    return false;
+}
+@[end if]@
+
+}  // namespace pubsub
+}  // namespace ros2_to_serial_bridge
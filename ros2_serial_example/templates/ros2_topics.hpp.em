@@ -17,25 +17,37 @@
 
 // C++ includes
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
 #include <cstdint>
+#include <cstdio>
 #include <functional>
 #include <limits>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <set>
 #include <stdexcept>
 #include <string>
+#include <utility>
 #include <vector>
 
 // ROS 2 includes
 #include <rclcpp/rclcpp.hpp>
+#include <rmw/rmw.h>
 
 #include "ros2_serial_example/publisher.hpp"
+#include "ros2_serial_example/publisher_table.hpp"
+#include "ros2_serial_example/rcu_pointer.hpp"
+#include "ros2_serial_example/service_bridge.hpp"
+#include "ros2_serial_example/startup_profile.hpp"
 #include "ros2_serial_example/subscription.hpp"
+#include "ros2_serial_example/time_sync.hpp"
+#include "ros2_serial_example/topic_namespace.hpp"
 #include "ros2_serial_example/transporter.hpp"
-
-@[for t in ros2_types]@
-#include "@(t.ns)_@(t.lower_type)_pub_sub_type.hpp"
-@[end for]@
+#include "ros2_serial_example/tx_queue.hpp"
+#include "ros2_serial_example/type_plugin.hpp"
 
 namespace ros2_to_serial_bridge
 {
@@ -43,6 +55,55 @@ namespace ros2_to_serial_bridge
 namespace pubsub
 {
 
+/**
+ * A message type that the bridge was generated with.  Either its factories
+ * are built in, or plugin_library names the type plugin that has them.
+ * type_hash is the hash of the definition of the type that the bridge was
+ * generated with (see generate_ros2_topics.py --print-type-hashes), or 0 if
+ * it couldn't be worked out.
+ */
+struct RegisteredType final
+{
+    const char * name;
+    const char * plugin_library;
+    TypePlugin factories;
+    uint32_t type_hash;
+};
+
+/**
+ * Look up a message type that the bridge was generated with; the table is
+ * generated (sorted by name) into ros2_topics.cpp.
+ *
+ * @param[in] name The type, as "<package>/<name>".
+ * @returns The type, or nullptr if the bridge doesn't have it.
+ */
+const RegisteredType * find_registered_type(const std::string & name);
+
+/**
+ * A service type that the bridge was generated with (see ROS2_SERIAL_SRVS
+ * in CMakeLists.txt).  Services are always built in.
+ */
+struct RegisteredService final
+{
+    const char * name;
+    std::unique_ptr<ServiceBridge> (*factory)(rclcpp::Node * node,
+                                              topic_id_size_t serial_mapping,
+                                              const std::string & name,
+                                              ros2_to_serial_bridge::transport::Transporter * transporter,
+                                              size_t max_in_flight,
+                                              std::chrono::milliseconds timeout,
+                                              const std::shared_ptr<rclcpp::CallbackGroup> & callback_group);
+};
+
+/**
+ * Look up a service type that the bridge was generated with; the table is
+ * generated (sorted by name) into ros2_topics.cpp.
+ *
+ * @param[in] name The type, as "<package>/<name>".
+ * @returns The service type, or nullptr if the bridge doesn't have it.
+ */
+const RegisteredService * find_registered_service(const std::string & name);
+
 struct TopicMapping final
 {
     std::string type{""};
@@ -54,14 +115,277 @@ struct TopicMapping final
         ROS2_TO_SERIAL,
     };
     Direction direction{Direction::UNKNOWN};
+    // ROS2_TO_SERIAL topics with a tx_queue_depth > 0 are sent through a
+    // TxQueue rather than written from the subscription callback.
+    size_t tx_queue_depth{0};
+    ros2_to_serial_bridge::transport::TxQueue::OverflowPolicy tx_overflow_policy{ros2_to_serial_bridge::transport::TxQueue::OverflowPolicy::DROP_OLDEST};
+    // The priority and rate limit of the topic's TxQueue; like the overflow
+    // policy, these only apply if tx_queue_depth > 0.
+    uint8_t tx_priority{0};
+    double tx_max_rate_hz{0.0};
+    // Passthrough topics forward the CDR data between the serial port and
+    // ROS 2 serialized messages without deserializing it.
+    bool passthrough{false};
+    // The QoS settings for the ROS 2 publisher or subscription; the default is
+    // reliable, volatile, keep last 10.
+    rclcpp::QoS qos{rclcpp::KeepLast(10)};
+    // Payloads of at least compress_threshold bytes are sent compressed; -1
+    // means never.  The dictionary is used in both directions, and requires
+    // the v2 protocol like compression does.
+    int64_t compress_threshold{-1};
+    std::vector<uint8_t> compress_dictionary;
+    // ROS2_TO_SERIAL topics with a delta_keyframe_interval > 0 are sent as
+    // deltas against the previous message, with a full message every
+    // delta_keyframe_interval messages.
+    uint32_t delta_keyframe_interval{0};
+    // ROS2_TO_SERIAL topics with reliable set are acknowledged by the other
+    // end of the serial link and sent again if they are lost (see
+    // Transporter::set_reliable()).  This has nothing to do with the
+    // reliability of the QoS, which only applies on the ROS 2 side.
+    bool reliable{false};
+    // On a bond (backend_comms 'bond'), "redundant" sends the topic on every
+    // link and "stripe" on one of them; empty leaves it to the bond_mode of
+    // the port.
+    std::string bond_mode;
+    // SERIAL_TO_ROS2 topics with stamp_header set have the header.stamp of
+    // each message overwritten with the time it was received.
+    bool stamp_header{false};
+    // SERIAL_TO_ROS2 topics with device_stamp set have the header.stamp that
+    // the other end put in each message translated from its clock into host
+    // time, which needs the time sync of the port.
+    bool device_stamp{false};
+    // SERIAL_TO_ROS2 topics with lazy set drop the data from the serial port
+    // without deserializing it while nothing subscribes to them.
+    bool lazy{false};
+    // If not 0, the most messages a second that the other end is asked to
+    // send a SERIAL_TO_ROS2 topic at.  Lazy topics and topics with a
+    // max_rate_hz are also asked for no more than their subscribers need
+    // (see ROS2Topics::set_rate_callback()).
+    double max_rate_hz{0.0};
+    // SERIAL_TO_ROS2 topics with last_value set keep the data of their last
+    // message, and publish it again when a subscriber joins (see
+    // ROS2Topics::set_refresh_callback()).
+    bool last_value{false};
+    // SERIAL_TO_ROS2 topics with on_change set drop the messages whose data
+    // is the same as that of the last one published, without deserializing
+    // them, and publish the same data again at most every
+    // on_change_keepalive_ms (never if 0).
+    bool on_change{false};
+    uint32_t on_change_keepalive_ms{1000};
+    // If not 0, the longest time in milliseconds a message may wait before it
+    // is dropped as stale: SERIAL_TO_ROS2 messages from when they were
+    // received, and ROS2_TO_SERIAL messages (with a tx_queue_depth > 0) from
+    // when they were queued.
+    uint32_t max_age_ms{0};
+    // SERIAL_TO_ROS2 topics with a higher rx_priority are dispatched ahead of
+    // the topics with a lower one that were read at the same time, or on the
+    // priority dispatch threads if there are any (see get_rx_priority()).
+    uint8_t rx_priority{0};
+    // Topics with elide_length set leave the length of their payloads out of
+    // the bundles they are sent and received in (see
+    // Transporter::set_fixed_length()), which needs a type with a fixed
+    // layout and the other end to do the same.  If not 0, fixed_size is the
+    // length the other end declared in the fixed_sizes of its SerialMapping,
+    // which has to be that of the bridge's type.
+    bool elide_length{false};
+    uint32_t fixed_size{0};
+    // Topics with intern_strings set send (or take) their messages packed,
+    // with each string that was sent before as a single octet, rather than
+    // as CDR (see string_interner.hpp), which needs a type with strings and
+    // the other end to do the same.
+    bool intern_strings{false};
+    // Topics with a quantize profile send (or take) their messages packed,
+    // with the fields it names sent with less precision or not at all (see
+    // packed_encoding.hpp), which needs the other end to use the same
+    // profile.  Each spec is like "altitude:float32".
+    std::vector<std::string> quantize;
+    // SERIAL_TO_ROS2 topics with a batch_type are published as messages of
+    // that type, each holding up to batch_size of the messages received in
+    // its samples sequence, and published at least every batch_ms if not 0
+    // (see BatchSinkImpl).  The batch type has to be built into the bridge.
+    std::string batch_type;
+    size_t batch_size{0};
+    uint32_t batch_ms{0};
+    // If not 0, the largest CDR data of a message on the topic; the buffers
+    // for the topic are then allocated up front rather than as they grow.
+    // Topics of bounded types (no unbounded strings or sequences) default to
+    // the largest size of their type.
+    size_t max_message_size{0};
+    // If not 0, the hash of the definition of the type that the other end
+    // was built with, from the type_hashes of its SerialMapping.  A topic
+    // whose hash isn't the bridge's is refused when it is set up, rather
+    // than failing to deserialize every message.
+    uint32_t type_hash{0};
 };
 
+struct ServiceMapping final
+{
+    std::string type{""};
+    // The serial mapping that both the requests and the responses of the
+    // service are sent on; it can't be used by a topic too.
+    int64_t serial_mapping{-1};
+    // How long a request waits for its response before it is given up on.
+    uint32_t timeout_ms{1000};
+    // The most requests that may wait for their responses at once; any more
+    // are dropped.
+    size_t max_in_flight{8};
+    // Requests with reliable set are acknowledged by the other end of the
+    // serial link and sent again if they are lost, like topics.
+    bool reliable{false};
+};
+
+/**
+ * A topic that was built into the bridge from ROS2_SERIAL_BAKED_CONFIG (see
+ * CMakeLists.txt), so that it needs no parameters to be parsed.  The
+ * members are those of TopicMapping, with the QoS settings and the overflow
+ * policy as flags, and are generated in the order of BAKED_MEMBERS in
+ * generate_ros2_topics.py.
+ */
+struct BakedTopic final
+{
+    // The port the topic is on, or "" for a bridge without ports.
+    const char * port;
+    const char * name;
+    const char * type;
+    int64_t serial_mapping;
+    TopicMapping::Direction direction;
+    size_t tx_queue_depth;
+    bool drop_newest;
+    uint8_t tx_priority;
+    double tx_max_rate_hz;
+    bool passthrough;
+    bool best_effort;
+    bool transient_local;
+    size_t history_depth;
+    // -1 for no deadline.
+    int64_t deadline_ms;
+    int64_t compress_threshold;
+    uint32_t delta_keyframe_interval;
+    bool reliable;
+    const char * bond_mode;
+    bool stamp_header;
+    bool device_stamp;
+    bool lazy;
+    double max_rate_hz;
+    bool last_value;
+    bool on_change;
+    uint32_t on_change_keepalive_ms;
+    uint32_t max_age_ms;
+    uint8_t rx_priority;
+    bool elide_length;
+    bool intern_strings;
+    const char * batch_type;
+    size_t batch_size;
+    uint32_t batch_ms;
+    size_t max_message_size;
+    const uint8_t * compress_dictionary;
+    size_t compress_dictionary_size;
+    const char * const * quantize;
+    size_t quantize_count;
+};
+
+/**
+ * Get the topics of a port that were built into the bridge (see BakedTopic);
+ * the table is generated into ros2_topics.cpp.
+ *
+ * @param[in] port The name of the port, or "" for a bridge without ports.
+ * @param[out] topics The map to add the topics to, by name.
+ * @returns true if topics were built in for the port, false otherwise.
+ */
+bool get_baked_topics(const std::string & port, std::map<std::string, TopicMapping> * topics);
+
+/**
+ * The ROS2Topics class sets up the ROS 2 publishers and subscriptions for the
+ * topics of one transport, and dispatches the messages from the transport to
+ * the publishers.
+ *
+ * Topics can be added and removed while messages are being dispatched.  The
+ * table that dispatch() looks publishers up in is replaced read-copy-update
+ * style, so dispatch() never waits for a change; add_topic() and
+ * remove_topic() wait for dispatch() to let go of the old table instead.
+ *
+ * Messages can be dispatched from several threads at once, as long as all of
+ * the messages of a topic are dispatched from the same thread.  The thread
+ * that reads the messages can look up the rx_priority of each topic with
+ * get_rx_priority() at the same time.
+ *
+ * Lazy topics have their subscribers counted again whenever the ROS 2 graph
+ * changes, from a timer on the node.  If a pause callback is set, it is
+ * called whenever a lazy topic loses its last subscriber or gets its first
+ * one, so the other end can stop sending the topic in the meantime.  If a
+ * rate callback is set, it is called whenever the rate that the subscribers
+ * of a lazy topic or a topic with a max_rate_hz need changes, so the other
+ * end doesn't send the topic faster than anything takes it.
+ *
+ * Topics with last_value set have their subscriptions counted every time
+ * the timer fires, since a subscription is matched some time after it shows
+ * up in the graph, and the last message is published again whenever the
+ * count goes up.  If there is no message to publish yet, or it is too old,
+ * the refresh callback is called instead, if it is set, so the other end can
+ * send the topic now rather than when it next would.
+ *
+ * The subscriptions are in the node's default callback group, so only one
+ * of them runs at a time.  With parallel_subscriptions, the subscriptions
+ * that write to the transport from their callbacks share a mutually
+ * exclusive callback group instead, and each subscription with a tx queue
+ * gets a mutually exclusive callback group of its own, so that with a
+ * multi-threaded executor the messages of different topics are serialized
+ * at the same time.  A subscription is never in a reentrant callback group,
+ * since its messages have to go out in order, through its one buffer.
+ *
+ * Creating the publishers and subscriptions, each of which is a DDS entity
+ * that has to be announced to the rest of the graph, is most of the time it
+ * takes to set up the topics.  With entity_threads above 1, they are created
+ * on that many threads at once, if the rmw is known to allow it, and then
+ * set up one after another as usual.  Either way, how long that took is
+ * kept for get_entity_creation_stats().
+ *
+ * With a topic_namespace (see apply_topic_namespace()), the topics and
+ * services are published, subscribed to and served in that namespace, so
+ * that ports to several vehicles can use the same names.  Everything else
+ * knows them by their names as configured.
+ *
+ * If the port synchronizes its clock with the other end, the topics with
+ * device_stamp set are published with their header.stamp translated through
+ * time_sync, which must outlive the ROS2Topics.
+ *
+ * Services answered by the other end (see ServiceBridge) are set up with
+ * add_services(); their responses are dispatched like the messages of a
+ * topic, and the requests that got no response in time are given up on from
+ * a timer on the node.
+ */
 class ROS2Topics
 {
 public:
+    /**
+     * How long creating the publishers and subscriptions of the topics took
+     * when the ROS2Topics was constructed.
+     */
+    struct EntityCreationStats final
+    {
+        /// The number of publishers and subscriptions created.
+        size_t count{0};
+        /// The number of threads they were created on.
+        size_t threads{1};
+        /// The time it took to create all of them.
+        std::chrono::nanoseconds wall{0};
+        /// The topic that took the longest, and how long.
+        std::string slowest;
+        std::chrono::nanoseconds slowest_time{0};
+    };
+
     explicit ROS2Topics(rclcpp::Node * node,
                         const std::map<std::string, TopicMapping> & topic_names_and_serialization,
-                        ros2_to_serial_bridge::transport::Transporter * transporter)
+                        ros2_to_serial_bridge::transport::Transporter * transporter,
+                        ros2_to_serial_bridge::transport::TxQueue * tx_queue = nullptr,
+                        size_t dispatch_threads = 1,
+                        bool parallel_subscriptions = false,
+                        const ros2_to_serial_bridge::transport::TimeSync * time_sync = nullptr,
+                        const std::string & topic_namespace = "",
+                        size_t entity_threads = 1)
+    : pub_table_(std::make_unique<PublisherTable<topic_id_size_t>>(), dispatch_threads + 1),
+      priority_reader_(dispatch_threads), parallel_subscriptions_(parallel_subscriptions), time_sync_(time_sync),
+      topic_namespace_(topic_namespace)
     {
         if (node == nullptr)
         {
@@ -73,23 +397,47 @@ public:
             throw std::runtime_error("Invalid transporter pointer passed");
         }
 
-        // Setup the pub_type_to_factory map for all types
-@[for t in ros2_types]@
-        pub_type_to_factory_["@(t.ns)/@(t.ros_type)"] = @(t.ns)_@(t.lower_type)_pub_factory;
-@[end for]@
-
-        // Setup the sub_type_to_factory map for all types
-@[for t in ros2_types]@
-        sub_type_to_factory_["@(t.ns)/@(t.ros_type)"] = @(t.ns)_@(t.lower_type)_sub_factory;
-@[end for]@
+        if (!valid_topic_namespace(topic_namespace))
+        {
+            throw std::runtime_error("Invalid topic namespace '" + topic_namespace + "'");
+        }
+        node_ = node;
+        transporter_ = transporter;
+        tx_queue_ = tx_queue;
+        metrics_ = &transporter->get_metrics();
 
         serial_to_pub_ = std::make_unique<std::map<topic_id_size_t, std::unique_ptr<Publisher>>>();
         serial_subs_ = std::make_unique<std::vector<std::unique_ptr<Subscription>>>();
+        std::unique_ptr<PublisherTable<topic_id_size_t>> pub_table = std::make_unique<PublisherTable<topic_id_size_t>>();
+        bool any_lazy = false;
+
+        std::map<std::string, TopicMapping> topics = topic_names_and_serialization;
+        for (auto & t : topics)
+        {
+            size_from_type(&t.second);
+        }
+
+        // Buffers move between all of the queued topics (see
+        // TxQueue::reserve_payloads()), so they all get the largest size.
+        size_t queued_max_size = 0;
+        for (const auto & t : topics)
+        {
+            if (t.second.direction == TopicMapping::Direction::ROS2_TO_SERIAL && t.second.tx_queue_depth > 0)
+            {
+                queued_max_size = std::max(queued_max_size, t.second.max_message_size);
+            }
+        }
+
+        // The plain publishers and the subscriptions are created up front,
+        // possibly in parallel, and taken from here by the loop below.
+        std::map<std::string, std::unique_ptr<Publisher>> created_pubs;
+        std::map<std::string, std::unique_ptr<Subscription>> created_subs;
+        create_entities(topics, tx_queue, entity_threads, &created_pubs, &created_subs);
 
         // Now go through every topic and ensure that it has a valid type
         // (not ""), a valid serial mapping (not 0), and a valid direction
         // (not UNKNOWN).
-        for (const auto & t : topic_names_and_serialization)
+        for (const auto & t : topics)
         {
             if (t.second.type.empty() || t.second.serial_mapping < 0 || t.second.direction == TopicMapping::Direction::UNKNOWN)
             {
@@ -103,9 +451,9 @@ public:
                 continue;
             }
 
-            if (t.second.serial_mapping > std::numeric_limits<topic_id_size_t>::max())
+            if (t.second.serial_mapping > transporter->get_max_topic_ID())
             {
-                fprintf(stderr, "Topic '%s' uses serial mapping number > %d; skipping\n", t.first.c_str(), std::numeric_limits<topic_id_size_t>::max());
+                fprintf(stderr, "Topic '%s' uses serial mapping number > %d; skipping\n", t.first.c_str(), transporter->get_max_topic_ID());
                 continue;
             }
 
@@ -132,32 +480,687 @@ public:
                 continue;
             }
 
+            std::string hash_error;
+            if (!type_hash_matches(t.first, t.second, &hash_error))
+            {
+                fprintf(stderr, "%s; skipping\n", hash_error.c_str());
+                continue;
+            }
+
+            if (t.second.elide_length)
+            {
+                const TypePlugin * factories = load_type(t.second.type);
+                size_t fixed_size = factories != nullptr && factories->fixed_size != nullptr ? factories->fixed_size() : 0;
+                if (t.second.fixed_size != 0 && t.second.fixed_size != fixed_size)
+                {
+                    fprintf(stderr, "Topic '%s' is %u bytes long at the other end but %zu here; skipping\n", t.first.c_str(), t.second.fixed_size, fixed_size);
+                    continue;
+                }
+                if (fixed_size == 0)
+                {
+                    fprintf(stderr, "Topic '%s' asked for elide_length, but its type has no fixed size; sending its length\n", t.first.c_str());
+                }
+                else if (transporter->set_fixed_length(t.second.serial_mapping, static_cast<uint32_t>(fixed_size)) < 0)
+                {
+                    throw std::runtime_error("Topic '" + t.first + "' asked for elide_length, which requires bundle_topic_id");
+                }
+            }
+
+            if (t.second.compress_threshold >= 0 || !t.second.compress_dictionary.empty())
+            {
+                size_t threshold = t.second.compress_threshold >= 0 ? static_cast<size_t>(t.second.compress_threshold) : std::numeric_limits<size_t>::max();
+                if (transporter->set_compression(t.second.serial_mapping, threshold, t.second.compress_dictionary) < 0)
+                {
+                    throw std::runtime_error("Topic '" + t.first + "' asked for compression, which requires backend_protocol 'v2'");
+                }
+            }
+
+            if (t.second.delta_keyframe_interval > 0 && t.second.direction == TopicMapping::Direction::ROS2_TO_SERIAL)
+            {
+                if (transporter->set_delta_encoding(t.second.serial_mapping, t.second.delta_keyframe_interval) < 0)
+                {
+                    throw std::runtime_error("Topic '" + t.first + "' asked for delta encoding, which requires backend_protocol 'v2'");
+                }
+            }
+
+            if (t.second.reliable && t.second.direction == TopicMapping::Direction::ROS2_TO_SERIAL)
+            {
+                if (transporter->set_reliable(t.second.serial_mapping) < 0)
+                {
+                    throw std::runtime_error("Topic '" + t.first + "' asked for reliable delivery, which requires backend_protocol 'v2'");
+                }
+            }
+
+            if (!t.second.bond_mode.empty())
+            {
+                if (transporter->set_redundant(t.second.serial_mapping, t.second.bond_mode == "redundant") < 0)
+                {
+                    throw std::runtime_error("Topic '" + t.first + "' asked for bond_mode, which requires backend_comms 'bond'");
+                }
+            }
+
             if (t.second.direction == TopicMapping::Direction::SERIAL_TO_ROS2)
             {
-                if (pub_type_to_factory_.count(t.second.type) == 0)
+                const TypePlugin * factories = load_type(t.second.type);
+                if (factories == nullptr)
                 {
                     fprintf(stderr, "Topic '%s' has unsupported pub type '%s'; skipping\n", t.first.c_str(), t.second.type.c_str());
                     continue;
                 }
-                (*serial_to_pub_)[t.second.serial_mapping] = pub_type_to_factory_[t.second.type](node, t.first);
+                std::unique_ptr<Publisher> & pub = (*serial_to_pub_)[t.second.serial_mapping];
+                if (t.second.batch_type.empty())
+                {
+                    pub = std::move(created_pubs[t.first]);
+                }
+                else
+                {
+                    if (t.second.passthrough)
+                    {
+                        throw std::runtime_error("Topic '" + t.first + "' can't be both passthrough and batched");
+                    }
+                    if (factories->batch_pub_factory != nullptr)
+                    {
+                        pub = factories->batch_pub_factory(t.second.batch_type, node, ros_name(t.first), t.second.qos,
+                                                           t.second.batch_size, t.second.batch_ms);
+                    }
+                    if (pub == nullptr)
+                    {
+                        throw std::runtime_error("Topic '" + t.first + "' has batch_type '" + t.second.batch_type +
+                                                 "', which isn't a batch of '" + t.second.type + "' that the bridge was built with");
+                    }
+                }
+                if (t.second.intern_strings && !pub->set_string_interning(true))
+                {
+                    throw std::runtime_error("Topic '" + t.first + "' asked for intern_strings, but its type has no strings or it is passthrough");
+                }
+                std::string quantize_error;
+                if (!pub->set_quantization(t.second.quantize, &quantize_error))
+                {
+                    throw std::runtime_error("Topic '" + t.first + "' has a bad quantize profile: " + quantize_error);
+                }
+                if (t.second.stamp_header && !pub->set_stamp_header(true))
+                {
+                    fprintf(stderr, "Topic '%s' asked for stamp_header, but its type has no header or it is passthrough; not stamping it\n", t.first.c_str());
+                }
+                if (t.second.device_stamp && (time_sync_ == nullptr || !pub->set_device_clock(time_sync_)))
+                {
+                    fprintf(stderr, "Topic '%s' asked for device_stamp, but the port has no time sync, its type has no header or it is passthrough; not translating it\n", t.first.c_str());
+                }
+                if (t.second.lazy)
+                {
+                    pub->set_lazy(true);
+                }
+                if (t.second.last_value && !pub->set_last_value(true))
+                {
+                    throw std::runtime_error("Topic '" + t.first + "' asked for last_value, but it is batched or its strings are interned");
+                }
+                if (t.second.on_change && !pub->set_on_change(true, std::chrono::milliseconds(t.second.on_change_keepalive_ms)))
+                {
+                    fprintf(stderr, "Topic '%s' asked for on_change, but its publisher can't compare the data; publishing every message\n", t.first.c_str());
+                }
+                any_lazy = any_lazy || t.second.lazy || t.second.max_rate_hz > 0.0 || t.second.last_value;
+                pub->set_max_age(std::chrono::milliseconds(t.second.max_age_ms));
+                pub->set_rx_priority(t.second.rx_priority);
+                update_max_rx_priority(t.second.rx_priority);
+                if (t.second.max_message_size > 0 && !pub->reserve(t.second.max_message_size))
+                {
+                    fprintf(stderr, "Topic '%s' goes to subscriptions in the same process, which allocates every message\n", t.first.c_str());
+                }
+                pub_table->insert(t.second.serial_mapping, pub.get());
             }
             else
             {
-                if (sub_type_to_factory_.count(t.second.type) == 0)
+                const TypePlugin * factories = load_type(t.second.type);
+                if (factories == nullptr)
                 {
                     fprintf(stderr, "Topic '%s' has unsupported sub type '%s'; skipping\n", t.first.c_str(), t.second.type.c_str());
                     continue;
                 }
-                serial_subs_->push_back(sub_type_to_factory_[t.second.type](node, t.second.serial_mapping, t.first, transporter));
+                if (t.second.tx_queue_depth > 0)
+                {
+                    if (tx_queue == nullptr)
+                    {
+                        fprintf(stderr, "Topic '%s' asked for a tx queue, but none is available; writing synchronously\n", t.first.c_str());
+                    }
+                    else if (tx_queue->add_topic(t.second.serial_mapping, t.second.tx_queue_depth, t.second.tx_overflow_policy) < 0 ||
+                             tx_queue->set_priority(t.second.serial_mapping, t.second.tx_priority) < 0 ||
+                             tx_queue->set_max_rate(t.second.serial_mapping, t.second.tx_max_rate_hz) < 0 ||
+                             tx_queue->set_max_age(t.second.serial_mapping, t.second.max_age_ms) < 0)
+                    {
+                        throw std::runtime_error("Topic '" + t.first + "' failed to add tx queue");
+                    }
+                }
+                else if (t.second.tx_priority != 0 || t.second.tx_max_rate_hz > 0.0 || t.second.max_age_ms > 0)
+                {
+                    fprintf(stderr, "Topic '%s' has a tx_priority, tx_max_rate_hz or max_age_ms but no tx_queue_depth; ignoring them\n", t.first.c_str());
+                }
+                bool queued = tx_queue != nullptr && tx_queue->has_topic(t.second.serial_mapping);
+                serial_subs_->push_back(std::move(created_subs[t.first]));
+                if (t.second.intern_strings && !serial_subs_->back()->set_string_interning(true))
+                {
+                    throw std::runtime_error("Topic '" + t.first + "' asked for intern_strings, but its type has no strings or it is passthrough");
+                }
+                std::string quantize_error;
+                if (!serial_subs_->back()->set_quantization(t.second.quantize, &quantize_error))
+                {
+                    throw std::runtime_error("Topic '" + t.first + "' has a bad quantize profile: " + quantize_error);
+                }
+                if (t.second.max_message_size > 0)
+                {
+                    serial_subs_->back()->reserve(queued ? queued_max_size : t.second.max_message_size);
+                }
             }
+            topics_[t.first] = t.second;
+        }
+
+        if (tx_queue != nullptr && queued_max_size > 0)
+        {
+            tx_queue->reserve_payloads(queued_max_size);
+        }
+
+        pub_table_.exchange(std::move(pub_table));
+
+        if (any_lazy)
+        {
+            watch_subscribers();
         }
     }
 
+    /**
+     * Dispatch a message from the transport to the publisher for its topic,
+     * if there is one, straight from the thread that read it.  This is the
+     * first of the dispatch threads.
+     *
+     * @param[in] topic_ID The topic ID the message was received on.
+     * @param[in] data_buffer The payload of the message.
+     * @param[in] length The length of the payload.
+     */
     void dispatch(topic_id_size_t topic_ID, uint8_t *data_buffer, ssize_t length)
     {
-        if (serial_to_pub_->count(topic_ID) > 0)
+        dispatch(0, topic_ID, data_buffer, length, transporter_->get_receive_time());
+    }
+
+    /**
+     * Dispatch a message to the publisher for its topic, if there is one.
+     *
+     * @param[in] thread The index of the calling dispatch thread, less than
+     *                   the dispatch_threads given to the constructor.  Only
+     *                   one thread at a time may use each index.
+     * @param[in] topic_ID The topic ID the message was received on.
+     * @param[in] data_buffer The payload of the message.
+     * @param[in] length The length of the payload.
+     * @param[in] receive_time The time the message was received.
+     */
+    void dispatch(size_t thread, topic_id_size_t topic_ID, uint8_t *data_buffer, ssize_t length,
+                  std::chrono::system_clock::time_point receive_time)
+    {
+        // This is called for every message from the serial port, so look the
+        // publisher up in the flat table rather than the map.  The publisher
+        // isn't destroyed before the guard lets go of the table.
+        RcuPointer<PublisherTable<topic_id_size_t>>::ReadGuard pub_table = pub_table_.read(thread);
+        Publisher * pub = pub_table->find(topic_ID);
+        if (pub != nullptr)
+        {
+            // Data that waited too long is worse than none, so drop it before
+            // spending any time on it.
+            std::chrono::milliseconds max_age = pub->get_max_age();
+            if (max_age.count() > 0 && std::chrono::system_clock::now() - receive_time > max_age)
+            {
+                metrics_->drop(ros2_to_serial_bridge::transport::Metrics::Direction::RX, topic_ID,
+                               ros2_to_serial_bridge::transport::Metrics::Drop::STALE);
+                return;
+            }
+
+            ros2_to_serial_bridge::transport::Metrics::Clock::time_point start = metrics_->now();
+            if (!pub->dispatch(data_buffer, length, receive_time))
+            {
+                metrics_->drop(ros2_to_serial_bridge::transport::Metrics::Direction::RX, topic_ID,
+                               ros2_to_serial_bridge::transport::Metrics::Drop::DESERIALIZE);
+            }
+            metrics_->record(ros2_to_serial_bridge::transport::Metrics::Stage::DISPATCH, start, metrics_->now());
+        }
+    }
+
+    /**
+     * Get the rx_priority of the topic that a message was received on.  This
+     * is meant to be called from the thread that reads the messages, to pick
+     * the lane it dispatches the message in; only one thread may call it.
+     *
+     * @param[in] topic_ID The topic ID the message was received on.
+     * @returns The rx_priority of the topic, or 0 if it has none or there is
+     *          no such topic.
+     */
+    uint8_t get_rx_priority(topic_id_size_t topic_ID)
+    {
+        if (max_rx_priority_.load(std::memory_order_relaxed) == 0)
+        {
+            return 0;
+        }
+        RcuPointer<PublisherTable<topic_id_size_t>>::ReadGuard pub_table = pub_table_.read(priority_reader_);
+        Publisher * pub = pub_table->find(topic_ID);
+        return pub != nullptr ? pub->get_rx_priority() : 0;
+    }
+
+    /**
+     * Get the highest rx_priority of any topic set up so far, including the
+     * ones since removed.  If it is 0, every message can be dispatched as it
+     * is read.
+     *
+     * @returns The highest rx_priority.
+     */
+    uint8_t get_max_rx_priority() const
+    {
+        return max_rx_priority_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Add a topic, replacing any topic of the same name (which is how a topic
+     * is moved to another serial mapping).
+     *
+     * This must be called from the node's default callback group, such as
+     * from a service callback, so that no subscription callback of a topic
+     * being replaced is running (with parallel_subscriptions, removing a
+     * subscription waits for its callback instead).  The topic is written straight to the
+     * transport rather than through a tx queue of its own, and can't be
+     * compressed or delta encoded.
+     *
+     * @param[in] name The name of the ROS 2 topic.
+     * @param[in] mapping The type, serial mapping, direction and QoS of the
+     *                    topic.
+     * @param[out] error Why the topic couldn't be added.
+     * @returns true if the topic was added, false otherwise.
+     */
+    bool add_topic(const std::string & name, const TopicMapping & mapping, std::string * error)
+    {
+        std::lock_guard<std::mutex> lock(update_mutex_);
+
+        if (mapping.type.empty() || mapping.direction == TopicMapping::Direction::UNKNOWN)
+        {
+            *error = "Topic '" + name + "' missing type or direction";
+            return false;
+        }
+        if (mapping.serial_mapping < 2 || mapping.serial_mapping > transporter_->get_max_topic_ID())
+        {
+            *error = "Topic '" + name + "' serial mapping must be between 2 and " + std::to_string(transporter_->get_max_topic_ID());
+            return false;
+        }
+        if (mapping.tx_queue_depth > 0 || mapping.compress_threshold >= 0 || !mapping.compress_dictionary.empty() || mapping.delta_keyframe_interval > 0 || mapping.reliable)
+        {
+            *error = "Topic '" + name + "' can't have a tx queue, compression, delta encoding or reliable delivery when added at runtime";
+            return false;
+        }
+
+        bool pub = mapping.direction == TopicMapping::Direction::SERIAL_TO_ROS2;
+        if (!pub && mapping.max_age_ms > 0)
+        {
+            *error = "Topic '" + name + "' can't have a max age when added at runtime, since it has no tx queue";
+            return false;
+        }
+        if (mapping.elide_length)
+        {
+            *error = "Topic '" + name + "' can't leave out its length when added at runtime, since the other end may already be sending it";
+            return false;
+        }
+        if (mapping.intern_strings)
+        {
+            *error = "Topic '" + name + "' can't intern its strings when added at runtime, since the other end may already be sending CDR";
+            return false;
+        }
+        if (!mapping.quantize.empty())
+        {
+            *error = "Topic '" + name + "' can't have a quantize profile when added at runtime, since the other end may already be sending CDR";
+            return false;
+        }
+        if (!mapping.batch_type.empty())
+        {
+            *error = "Topic '" + name + "' can't be batched when added at runtime";
+            return false;
+        }
+        const TypePlugin * factories = load_type(mapping.type);
+        if (factories == nullptr)
+        {
+            *error = "Topic '" + name + "' has unsupported type '" + mapping.type + "'";
+            return false;
+        }
+        if (!type_hash_matches(name, mapping, error))
+        {
+            return false;
+        }
+
+        // The serial mapping may only be in use by the topic being replaced.
+        for (const auto & t : topics_)
+        {
+            if (t.first != name && t.second.serial_mapping == mapping.serial_mapping)
+            {
+                *error = "Topic '" + name + "' serial mapping is already used by topic '" + t.first + "'";
+                return false;
+            }
+        }
+        for (const auto & s : services_)
+        {
+            if (s.second.serial_mapping == mapping.serial_mapping)
+            {
+                *error = "Topic '" + name + "' serial mapping is already used by service '" + s.first + "'";
+                return false;
+            }
+        }
+
+        if (topics_.count(name) != 0)
+        {
+            remove_topic_locked(name);
+        }
+
+        topic_id_size_t topic_ID = static_cast<topic_id_size_t>(mapping.serial_mapping);
+        if (pub)
+        {
+            std::unique_ptr<Publisher> & publisher = (*serial_to_pub_)[topic_ID];
+            publisher = factories->pub_factory(node_, ros_name(name), mapping.passthrough, mapping.qos);
+            publisher->set_max_age(std::chrono::milliseconds(mapping.max_age_ms));
+            publisher->set_rx_priority(mapping.rx_priority);
+            update_max_rx_priority(mapping.rx_priority);
+            if (mapping.stamp_header && !publisher->set_stamp_header(true))
+            {
+                fprintf(stderr, "Topic '%s' asked for stamp_header, but its type has no header or it is passthrough; not stamping it\n", name.c_str());
+            }
+            if (mapping.device_stamp && (time_sync_ == nullptr || !publisher->set_device_clock(time_sync_)))
+            {
+                fprintf(stderr, "Topic '%s' asked for device_stamp, but the port has no time sync, its type has no header or it is passthrough; not translating it\n", name.c_str());
+            }
+            if (mapping.lazy)
+            {
+                publisher->set_lazy(true);
+            }
+            if (mapping.last_value && !publisher->set_last_value(true))
+            {
+                fprintf(stderr, "Topic '%s' asked for last_value, but it is batched or its strings are interned; not keeping it\n", name.c_str());
+            }
+            if (mapping.on_change && !publisher->set_on_change(true, std::chrono::milliseconds(mapping.on_change_keepalive_ms)))
+            {
+                fprintf(stderr, "Topic '%s' asked for on_change, but its publisher can't compare the data; publishing every message\n", name.c_str());
+            }
+            if (mapping.lazy || mapping.max_rate_hz > 0.0 || mapping.last_value)
+            {
+                watch_subscribers();
+            }
+            std::unique_ptr<PublisherTable<topic_id_size_t>> pub_table = std::make_unique<PublisherTable<topic_id_size_t>>(pub_table_.current());
+            pub_table->insert(topic_ID, publisher.get());
+            pub_table_.exchange(std::move(pub_table));
+        }
+        else
+        {
+            serial_subs_->push_back(factories->sub_factory(node_, topic_ID, ros_name(name), transporter_, tx_queue_, mapping.passthrough, mapping.qos, subscription_group(false)));
+        }
+        topics_[name] = mapping;
+        size_from_type(&topics_[name]);
+
+        return true;
+    }
+
+    /**
+     * Remove a topic.  Like add_topic(), this must be called from the node's
+     * default callback group.
+     *
+     * @param[in] name The name of the ROS 2 topic.
+     * @returns true if the topic was removed, false if there is no such topic.
+     */
+    bool remove_topic(const std::string & name)
+    {
+        std::lock_guard<std::mutex> lock(update_mutex_);
+
+        if (topics_.count(name) == 0)
+        {
+            return false;
+        }
+        remove_topic_locked(name);
+
+        return true;
+    }
+
+    /**
+     * Get the topics that are set up.
+     *
+     * @returns The topics, by name.
+     */
+    std::map<std::string, TopicMapping> get_topics() const
+    {
+        std::lock_guard<std::mutex> lock(update_mutex_);
+
+        return topics_;
+    }
+
+    /**
+     * Set up the services that the other end of the serial link answers.
+     * This should be called once, before the node starts spinning.  A
+     * service that is missing its type or serial mapping, or whose type the
+     * bridge doesn't have, is skipped.
+     *
+     * @param[in] services The type, serial mapping and timeout of each
+     *                     service, by name.
+     * @throws std::runtime_error If a service uses the serial mapping of a
+     *                            topic or another service, or asks for
+     *                            reliable delivery without the v2 protocol.
+     */
+    void add_services(const std::map<std::string, ServiceMapping> & services)
+    {
+        std::lock_guard<std::mutex> lock(update_mutex_);
+
+        std::unique_ptr<PublisherTable<topic_id_size_t>> pub_table = std::make_unique<PublisherTable<topic_id_size_t>>(pub_table_.current());
+        for (const auto & s : services)
+        {
+            if (s.second.type.empty() || s.second.serial_mapping < 0)
+            {
+                fprintf(stderr, "Service '%s' missing type or serial_mapping; skipping\n", s.first.c_str());
+                continue;
+            }
+            if (s.second.serial_mapping < 2 || s.second.serial_mapping > transporter_->get_max_topic_ID())
+            {
+                fprintf(stderr, "Service '%s' serial mapping must be between 2 and %d; skipping\n", s.first.c_str(), transporter_->get_max_topic_ID());
+                continue;
+            }
+            for (const auto & t : topics_)
+            {
+                if (t.second.serial_mapping == s.second.serial_mapping)
+                {
+                    throw std::runtime_error("Service '" + s.first + "' has the serial_mapping of topic '" + t.first + "'; this is not allowed");
+                }
+            }
+            for (const auto & other : services_)
+            {
+                if (other.second.serial_mapping == s.second.serial_mapping)
+                {
+                    throw std::runtime_error("Service '" + s.first + "' has duplicate serial_mapping; this is not allowed");
+                }
+            }
+            const RegisteredService * registered = find_registered_service(s.second.type);
+            if (registered == nullptr)
+            {
+                fprintf(stderr, "Service '%s' has unsupported type '%s'; skipping\n", s.first.c_str(), s.second.type.c_str());
+                continue;
+            }
+
+            topic_id_size_t topic_ID = static_cast<topic_id_size_t>(s.second.serial_mapping);
+            if (s.second.reliable && transporter_->set_reliable(topic_ID) < 0)
+            {
+                throw std::runtime_error("Service '" + s.first + "' asked for reliable delivery, which requires backend_protocol 'v2'");
+            }
+
+            // The requests are written to the transport from the service
+            // callback, so with parallel_subscriptions the service shares the
+            // callback group of the subscriptions that do the same.
+            service_bridges_.push_back(registered->factory(node_, topic_ID, ros_name(s.first), transporter_,
+                                                           s.second.max_in_flight,
+                                                           std::chrono::milliseconds(s.second.timeout_ms),
+                                                           subscription_group(false)));
+            pub_table->insert(topic_ID, service_bridges_.back().get());
+            services_[s.first] = s.second;
+        }
+        pub_table_.exchange(std::move(pub_table));
+
+        if (!service_bridges_.empty() && service_timer_ == nullptr)
+        {
+            service_timer_ = node_->create_wall_timer(std::chrono::milliseconds(SERVICE_EXPIRE_PERIOD_MS), [this]() {
+                std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+                for (const auto & service : service_bridges_)
+                {
+                    service->expire(now);
+                }
+            });
+        }
+    }
+
+    /**
+     * Get the services that are set up.
+     *
+     * @returns The services, by name.
+     */
+    std::map<std::string, ServiceMapping> get_services() const
+    {
+        std::lock_guard<std::mutex> lock(update_mutex_);
+
+        return services_;
+    }
+
+    /**
+     * Get how long creating the publishers and subscriptions of the topics
+     * took when the ROS2Topics was constructed.  Batched topics, whose
+     * publishers are created along with a timer, aren't counted.
+     *
+     * @returns The stats.
+     */
+    const EntityCreationStats & get_entity_creation_stats() const
+    {
+        return entity_creation_stats_;
+    }
+
+    /**
+     * Set the function to call when a lazy topic loses its last subscriber
+     * or gets its first one.  This should be called before the node starts
+     * spinning.
+     *
+     * @param[in] callback Called with the topic ID and true if the topic lost
+     *                     its last subscriber, or false if it got its first
+     *                     one.  It is also called again with true for a topic
+     *                     that keeps sending data while it has no subscribers,
+     *                     for instance because the other end was reset, and
+     *                     with false for a topic that is removed while it has
+     *                     none.
+     */
+    void set_pause_callback(std::function<void(topic_id_size_t, bool)> callback)
+    {
+        std::lock_guard<std::mutex> lock(update_mutex_);
+
+        pause_callback_ = std::move(callback);
+    }
+
+    /**
+     * Set the function to call when the rate that the other end should send
+     * a lazy topic or a topic with a max_rate_hz at changes.  This should be
+     * called before the node starts spinning.
+     *
+     * The rate is the max_rate_hz of the topic, or the rate that the
+     * subscriber with the shortest deadline QoS needs (one message per
+     * deadline) if that is lower.  A subscriber without a deadline takes
+     * every message, so then only the max_rate_hz applies.  Calling the
+     * pause callback for a topic is taken to reset its rate at the other end
+     * to 0, so the rate callback is called again once the topic has
+     * subscribers again.
+     *
+     * @param[in] callback Called with the topic ID and the rate in messages
+     *                     a second, or 0 for as many as there are.  A rate
+     *                     other than 0 is also sent again about once a second,
+     *                     in case the other end was reset.
+     */
+    void set_rate_callback(std::function<void(topic_id_size_t, double)> callback)
+    {
+        std::lock_guard<std::mutex> lock(update_mutex_);
+
+        rate_callback_ = std::move(callback);
+    }
+
+    /**
+     * Set the function to call when a subscriber joins a topic with
+     * last_value set, but there is no last message to publish to it.  This
+     * should be called before the node starts spinning.
+     *
+     * @param[in] callback Called with the topic ID and the rate the other
+     *                     end was last asked to send it at (see
+     *                     set_rate_callback()), or 0 if none.
+     */
+    void set_refresh_callback(std::function<void(topic_id_size_t, double)> callback)
+    {
+        std::lock_guard<std::mutex> lock(update_mutex_);
+
+        refresh_callback_ = std::move(callback);
+    }
+
+    /**
+     * Count the subscribers of the lazy topics again if the ROS 2 graph
+     * changed, and call the pause callback for the topics that lost their
+     * last subscriber or got their first one, and the rate callback for the
+     * topics whose subscribers need another rate.  Then publish the last
+     * message of the topics with last_value set that got a subscriber, or
+     * call the refresh callback for them.  This is called from a timer on
+     * the node, but may also be called directly.
+     */
+    void update_subscribers()
+    {
+        std::lock_guard<std::mutex> lock(update_mutex_);
+
+        if (graph_event_ == nullptr)
+        {
+            return;
+        }
+
+        bool graph_changed = graph_event_->check_and_clear() || subscribers_stale_;
+        subscribers_stale_ = false;
+        // A topic that keeps sending while paused is told again, but only
+        // about once a second in case the other end doesn't understand.
+        bool repause = ++repause_ticks_ >= REPAUSE_TICKS;
+        if (repause)
         {
-            (*serial_to_pub_)[topic_ID]->dispatch(data_buffer, length);
+            repause_ticks_ = 0;
+        }
+
+        for (const auto & t : topics_)
+        {
+            if (t.second.direction != TopicMapping::Direction::SERIAL_TO_ROS2 ||
+                (!t.second.lazy && t.second.max_rate_hz <= 0.0 && !t.second.last_value))
+            {
+                continue;
+            }
+
+            topic_id_size_t topic_ID = static_cast<topic_id_size_t>(t.second.serial_mapping);
+            Publisher * pub = (*serial_to_pub_)[topic_ID].get();
+            bool paused = paused_.count(topic_ID) != 0;
+            if (t.second.lazy && graph_changed && pub->update_subscribed() == paused)
+            {
+                paused = !paused;
+                if (paused)
+                {
+                    paused_.insert(topic_ID);
+                }
+                else
+                {
+                    paused_.erase(topic_ID);
+                }
+                call_pause_callback(topic_ID, paused);
+                // Whatever was skipped so far was before the change.
+                pub->take_skipped();
+            }
+            else if (paused && repause && pub->take_skipped())
+            {
+                call_pause_callback(topic_ID, true);
+            }
+
+            if (!paused && (t.second.lazy || t.second.max_rate_hz > 0.0))
+            {
+                update_rate(t.first, t.second, graph_changed, repause);
+            }
+
+            if (t.second.last_value)
+            {
+                update_last_value(topic_ID, pub, paused);
+            }
         }
     }
 
@@ -166,8 +1169,369 @@ protected:
     std::unique_ptr<std::vector<std::unique_ptr<Subscription>>> serial_subs_;
 
 private:
-    std::map<std::string, std::function<std::unique_ptr<Publisher>(rclcpp::Node *, const std::string &)>> pub_type_to_factory_;
-    std::map<std::string, std::function<std::unique_ptr<Subscription>(rclcpp::Node *, topic_id_size_t, const std::string &, ros2_to_serial_bridge::transport::Transporter *)>> sub_type_to_factory_;
+    void update_max_rx_priority(uint8_t priority)
+    {
+        if (priority > max_rx_priority_.load(std::memory_order_relaxed))
+        {
+            max_rx_priority_.store(priority, std::memory_order_relaxed);
+        }
+    }
+
+    void remove_topic_locked(const std::string & name)
+    {
+        auto it = topics_.find(name);
+        topic_id_size_t topic_ID = static_cast<topic_id_size_t>(it->second.serial_mapping);
+        if (it->second.direction == TopicMapping::Direction::SERIAL_TO_ROS2)
+        {
+            // Take the publisher out of the dispatch table first; once that
+            // has been swapped in, dispatch() can't be using it anymore.
+            std::unique_ptr<PublisherTable<topic_id_size_t>> pub_table = std::make_unique<PublisherTable<topic_id_size_t>>(pub_table_.current());
+            pub_table->erase(topic_ID);
+            pub_table_.exchange(std::move(pub_table));
+            serial_to_pub_->erase(topic_ID);
+            // Let the other end send the topic again, as fast as it likes,
+            // since whatever takes over the topic ID may want it.
+            if (paused_.erase(topic_ID) != 0)
+            {
+                call_pause_callback(topic_ID, false);
+            }
+            else if (rates_.erase(topic_ID) != 0 && rate_callback_)
+            {
+                rate_callback_(topic_ID, 0.0);
+            }
+            subscription_counts_.erase(topic_ID);
+        }
+        else
+        {
+            serial_subs_->erase(std::remove_if(serial_subs_->begin(), serial_subs_->end(),
+                                               [topic_ID](const std::unique_ptr<Subscription> & e) {
+                                                   return e->get_serial_mapping() == topic_ID;
+                                               }),
+                                serial_subs_->end());
+        }
+        topics_.erase(it);
+    }
+
+    // Check the hash of the type that the other end sent for a topic, if it
+    // sent one, against the type the bridge was generated with.
+    bool type_hash_matches(const std::string & name, const TopicMapping & mapping, std::string * error)
+    {
+        const RegisteredType * registered = find_registered_type(mapping.type);
+        if (mapping.type_hash == 0 || registered == nullptr || registered->type_hash == 0 ||
+            mapping.type_hash == registered->type_hash)
+        {
+            return true;
+        }
+
+        char hashes[64];
+        ::snprintf(hashes, sizeof(hashes), "0x%08x, but the bridge has 0x%08x",
+                   static_cast<unsigned int>(mapping.type_hash), static_cast<unsigned int>(registered->type_hash));
+        *error = "Topic '" + name + "' has a type '" + mapping.type + "' with hash " + hashes +
+                 "; the two ends were built with different definitions of it";
+        return false;
+    }
+
+    // Create the plain publishers and the subscriptions of the topics, on up
+    // to threads threads, keyed by topic name.  The topics that the
+    // constructor skips are left out, and so are the batched ones, whose
+    // factory also creates a timer, which the constructor creates itself.
+    // The factories are looked up and the callback groups are created
+    // beforehand, so the threads only call the factories.
+    void create_entities(const std::map<std::string, TopicMapping> & topics,
+                         ros2_to_serial_bridge::transport::TxQueue * tx_queue, size_t threads,
+                         std::map<std::string, std::unique_ptr<Publisher>> * pubs,
+                         std::map<std::string, std::unique_ptr<Subscription>> * subs)
+    {
+        std::vector<std::string> names;
+        std::vector<std::function<void()>> jobs;
+        for (const auto & t : topics)
+        {
+            const TopicMapping & mapping = t.second;
+            std::string hash_error;
+            if (mapping.type.empty() || mapping.serial_mapping < 2 || mapping.serial_mapping > transporter_->get_max_topic_ID() ||
+                !mapping.batch_type.empty() || !type_hash_matches(t.first, mapping, &hash_error))
+            {
+                continue;
+            }
+            const TypePlugin * factories = load_type(mapping.type);
+            if (factories == nullptr)
+            {
+                continue;
+            }
+
+            std::string name = ros_name(t.first);
+            if (mapping.direction == TopicMapping::Direction::SERIAL_TO_ROS2)
+            {
+                // The map doesn't move its entries as it grows.
+                std::unique_ptr<Publisher> * pub = &(*pubs)[t.first];
+                jobs.push_back([this, factories, name, &mapping, pub]() {
+                    *pub = factories->pub_factory(node_, name, mapping.passthrough, mapping.qos);
+                });
+            }
+            else if (mapping.direction == TopicMapping::Direction::ROS2_TO_SERIAL)
+            {
+                bool queued = tx_queue != nullptr && mapping.tx_queue_depth > 0;
+                std::shared_ptr<rclcpp::CallbackGroup> group = subscription_group(queued);
+                std::unique_ptr<Subscription> * sub = &(*subs)[t.first];
+                jobs.push_back([this, factories, name, &mapping, tx_queue, group, sub]() {
+                    *sub = factories->sub_factory(node_, mapping.serial_mapping, name, transporter_, tx_queue,
+                                                  mapping.passthrough, mapping.qos, group);
+                });
+            }
+            else
+            {
+                continue;
+            }
+            names.push_back(t.first);
+        }
+
+        EntityCreationStats & stats = entity_creation_stats_;
+        stats.count = jobs.size();
+        stats.threads = threads > 1 && rmw_creates_in_parallel() ? std::min(threads, std::max<size_t>(jobs.size(), 1)) : 1;
+        std::vector<std::chrono::nanoseconds> durations;
+        ros2_to_serial_bridge::transport::StartupProfile::Clock::time_point start = ros2_to_serial_bridge::transport::StartupProfile::Clock::now();
+        ros2_to_serial_bridge::transport::run_in_parallel(jobs, stats.threads, &durations);
+        stats.wall = std::chrono::duration_cast<std::chrono::nanoseconds>(ros2_to_serial_bridge::transport::StartupProfile::Clock::now() - start);
+        for (size_t i = 0; i < durations.size(); ++i)
+        {
+            if (durations[i] > stats.slowest_time)
+            {
+                stats.slowest = names[i];
+                stats.slowest_time = durations[i];
+            }
+        }
+    }
+
+    // Whether the rmw is known to create the entities of a node from several
+    // threads at once safely; the others get them one at a time.
+    static bool rmw_creates_in_parallel()
+    {
+        const std::string rmw = rmw_get_implementation_identifier();
+        return rmw == "rmw_fastrtps_cpp" || rmw == "rmw_fastrtps_dynamic_cpp" || rmw == "rmw_cyclonedds_cpp";
+    }
+
+    // Get the factories of a type, loading its plugin if it is built as one.
+    const TypePlugin * load_type(const std::string & type)
+    {
+        const RegisteredType * registered = find_registered_type(type);
+        if (registered == nullptr)
+        {
+            return nullptr;
+        }
+        if (registered->plugin_library == nullptr)
+        {
+            return &registered->factories;
+        }
+
+        std::string error;
+        const TypePlugin * plugin = load_type_plugin(registered->plugin_library, &error);
+        if (plugin == nullptr)
+        {
+            fprintf(stderr, "Failed to load the plugin for type '%s': %s\n", type.c_str(), error.c_str());
+        }
+
+        return plugin;
+    }
+
+    // Give a topic of a bounded type the largest size of its type as its
+    // max_message_size, unless it was given one.
+    void size_from_type(TopicMapping * mapping)
+    {
+        if (mapping->max_message_size > 0)
+        {
+            return;
+        }
+        const TypePlugin * factories = load_type(mapping->type);
+        if (factories == nullptr || factories->max_serialized_size == nullptr)
+        {
+            return;
+        }
+
+        bool bounded = false;
+        size_t max_size = factories->max_serialized_size(&bounded);
+        if (bounded)
+        {
+            mapping->max_message_size = max_size;
+        }
+    }
+
+    // Get the callback group for a new subscription, which is nullptr for
+    // the node's default one.
+    std::shared_ptr<rclcpp::CallbackGroup> subscription_group(bool queued)
+    {
+        if (!parallel_subscriptions_)
+        {
+            return nullptr;
+        }
+        if (queued)
+        {
+            queued_groups_.push_back(node_->create_callback_group(rclcpp::CallbackGroupType::MutuallyExclusive));
+            return queued_groups_.back();
+        }
+        if (write_group_ == nullptr)
+        {
+            write_group_ = node_->create_callback_group(rclcpp::CallbackGroupType::MutuallyExclusive);
+        }
+        return write_group_;
+    }
+
+    void call_pause_callback(topic_id_size_t topic_ID, bool paused)
+    {
+        // The other end forgets the rate of a topic when it is paused or
+        // resumed.
+        rates_.erase(topic_ID);
+        if (pause_callback_)
+        {
+            pause_callback_(topic_ID, paused);
+        }
+    }
+
+    // Work out the rate that the subscribers of a topic need again if the
+    // graph changed, and tell the other end if it changed, or again if it is
+    // time to repeat it.
+    void update_rate(const std::string & name, const TopicMapping & mapping, bool graph_changed, bool repeat)
+    {
+        topic_id_size_t topic_ID = static_cast<topic_id_size_t>(mapping.serial_mapping);
+        auto it = rates_.find(topic_ID);
+        double rate = it != rates_.end() ? it->second : 0.0;
+        double wanted = graph_changed ? wanted_rate(name, mapping.max_rate_hz) : rate;
+        if (wanted != rate)
+        {
+            if (wanted > 0.0)
+            {
+                rates_[topic_ID] = wanted;
+            }
+            else
+            {
+                rates_.erase(topic_ID);
+            }
+        }
+        else if (!repeat || rate <= 0.0)
+        {
+            return;
+        }
+        if (rate_callback_)
+        {
+            rate_callback_(topic_ID, wanted);
+        }
+    }
+
+    // Publish the last message of a topic with last_value set again if it
+    // got a subscriber since the last time, or ask the other end for one.
+    void update_last_value(topic_id_size_t topic_ID, Publisher * pub, bool paused)
+    {
+        size_t count = pub->get_subscription_count();
+        size_t & last_count = subscription_counts_[topic_ID];
+        bool joined = count > last_count;
+        last_count = count;
+        if (!joined || pub->republish_last_value())
+        {
+            return;
+        }
+
+        // A paused topic is resumed once the lazy check sees the subscriber,
+        // which sends it anyway.
+        if (refresh_callback_ && !paused)
+        {
+            auto it = rates_.find(topic_ID);
+            refresh_callback_(topic_ID, it != rates_.end() ? it->second : 0.0);
+        }
+    }
+
+    // The name that a topic or service has in ROS 2.
+    std::string ros_name(const std::string & name) const
+    {
+        return apply_topic_namespace(topic_namespace_, name);
+    }
+
+    // The rate that the subscribers of a topic need, up to max_rate_hz: one
+    // message per deadline of the subscriber with the shortest one, or all
+    // of them if any subscriber has no deadline.
+    double wanted_rate(const std::string & name, double max_rate_hz)
+    {
+        double rate = 0.0;
+        for (const rclcpp::TopicEndpointInfo & info : node_->get_subscriptions_info_by_topic(ros_name(name)))
+        {
+            int64_t deadline_ns = info.qos_profile().deadline().nanoseconds();
+            if (deadline_ns <= 0 || deadline_ns >= NO_DEADLINE_NS)
+            {
+                return max_rate_hz;
+            }
+            rate = std::max(rate, 1e9 / static_cast<double>(deadline_ns));
+        }
+        if (rate <= 0.0 || (max_rate_hz > 0.0 && max_rate_hz < rate))
+        {
+            return max_rate_hz;
+        }
+
+        return rate;
+    }
+
+    void watch_subscribers()
+    {
+        subscribers_stale_ = true;
+        if (graph_event_ != nullptr)
+        {
+            return;
+        }
+
+        graph_event_ = node_->get_graph_event();
+        subscriber_timer_ = node_->create_wall_timer(std::chrono::milliseconds(100), [this]() {
+            update_subscribers();
+        });
+    }
+
+    static constexpr uint32_t REPAUSE_TICKS = 10;
+    // A deadline this long (a year) is as good as none; the default deadline
+    // of an rmw is infinite, which doesn't fit in nanoseconds.
+    static constexpr int64_t NO_DEADLINE_NS = 365LL * 24 * 3600 * 1000000000LL;
+    // How often the requests of the services are checked for timeouts, which
+    // is how late a request may be given up on.
+    static constexpr uint32_t SERVICE_EXPIRE_PERIOD_MS = 10;
+
+    // The services outlive the dispatch table that points to them, like the
+    // publishers.
+    std::vector<std::unique_ptr<ServiceBridge>> service_bridges_;
+    // The dispatch threads each have a reader of the table, and the thread
+    // that looks up the rx_priority of the topics has the last one.
+    RcuPointer<PublisherTable<topic_id_size_t>> pub_table_;
+    size_t priority_reader_;
+    std::atomic<uint8_t> max_rx_priority_{0};
+    // The topics that were set up, and the lock that add_topic() and
+    // remove_topic() take while changing them.
+    std::map<std::string, TopicMapping> topics_;
+    std::map<std::string, ServiceMapping> services_;
+    mutable std::mutex update_mutex_;
+    // The lazy topics and the topics with a max_rate_hz are checked for
+    // subscribers when graph_event_ is set (or when such a topic is added),
+    // and paused_ has the lazy ones that had none.
+    rclcpp::Event::SharedPtr graph_event_;
+    rclcpp::TimerBase::SharedPtr subscriber_timer_;
+    rclcpp::TimerBase::SharedPtr service_timer_;
+    bool subscribers_stale_{false};
+    uint32_t repause_ticks_{0};
+    std::set<topic_id_size_t> paused_;
+    std::function<void(topic_id_size_t, bool)> pause_callback_;
+    // The rate that the other end was last asked to send each topic at,
+    // for the topics that have one other than 0.
+    std::map<topic_id_size_t, double> rates_;
+    std::function<void(topic_id_size_t, double)> rate_callback_;
+    // The number of subscriptions each topic with last_value set had the
+    // last time they were counted.
+    std::map<topic_id_size_t, size_t> subscription_counts_;
+    std::function<void(topic_id_size_t, double)> refresh_callback_;
+    // With parallel_subscriptions, the callback group of the subscriptions
+    // that write to the transport, and those of the ones with tx queues.
+    bool parallel_subscriptions_{false};
+    rclcpp::CallbackGroup::SharedPtr write_group_;
+    std::vector<rclcpp::CallbackGroup::SharedPtr> queued_groups_;
+    const ros2_to_serial_bridge::transport::TimeSync * time_sync_{nullptr};
+    std::string topic_namespace_;
+    EntityCreationStats entity_creation_stats_;
+    rclcpp::Node * node_;
+    ros2_to_serial_bridge::transport::Transporter * transporter_;
+    ros2_to_serial_bridge::transport::TxQueue * tx_queue_;
+    ros2_to_serial_bridge::transport::Metrics * metrics_;
 };
 
 }  // namespace pubsub
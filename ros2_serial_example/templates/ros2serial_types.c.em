@@ -0,0 +1,128 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Generated by generate_ros2_topics.py --firmware-dir; do not edit.
+
+#include <string.h>
+
+#include "ros2serial/ros2serial_types.h"
+
+// A type with no strings or sequences has each field at the same offset in
+// every message, so when the buffer is in this machine's byte order and at
+// an offset with the same padding, the fields are copied straight to or from
+// there, rather than one microCDR call at a time.  Anything else (or not
+// enough room) goes the slow way, which also sets the error.
+@[for t in firmware_types]@
+
+@[if t.fixed_layout is not None]@
+@[for f in t.fixed_layout.fields]@
+_Static_assert(sizeof(((@(t.c_name) *)0)->@(f.accessor)) == @(f.size), "@(t.c_name).@(f.accessor) is not the size it is serialized as");
+@[end for]@
+
+static bool fixed_@(t.c_name)(const ucdrBuffer *mb)
+{
+  return !mb->error && mb->endianness == UCDR_MACHINE_ENDIANNESS && ucdr_buffer_length(mb) % @(t.fixed_layout.align) == 0 &&
+         ucdr_buffer_remaining(mb) >= @(t.fixed_layout.size);
+}
+
+@[end if]@
+bool ucdr_serialize_@(t.c_name)(ucdrBuffer *mb, const @(t.c_name) *msg)
+{
+@[if t.fixed_layout is not None]@
+  if (fixed_@(t.c_name)(mb)) {
+@[for g in t.fixed_layout.gaps]@
+    memset(mb->iterator + @(g[0]), 0, @(g[1]));
+@[end for]@
+@[for f in t.fixed_layout.fields]@
+    memcpy(mb->iterator + @(f.offset), &msg->@(f.accessor), @(f.size));
+@[end for]@
+    mb->iterator += @(t.fixed_layout.size);
+    mb->last_data_size = @(t.fixed_layout.last_size);
+    return true;
+  }
+
+@[end if]@
+@[for m in t.members]@
+@[if m.sequence_capacity is not None]@
+  if (msg->@(m.name)_size > @(m.sequence_capacity)) {
+    mb->error = true;
+    return false;
+  }
+@[if m.kind == 'basic']@
+  ucdr_serialize_sequence_@(m.c_type)(mb, msg->@(m.name), msg->@(m.name)_size);
+@[else]@
+  ucdr_serialize_uint32_t(mb, msg->@(m.name)_size);
+  for (uint32_t i = 0; i < msg->@(m.name)_size; ++i) {
+    @(m.serialize('msg->%s[i]' % m.name))
+  }
+@[end if]@
+@[elif m.array_size is not None]@
+@[if m.kind == 'basic']@
+  ucdr_serialize_array_@(m.c_type)(mb, msg->@(m.name), @(m.array_size));
+@[else]@
+  for (uint32_t i = 0; i < @(m.array_size); ++i) {
+    @(m.serialize('msg->%s[i]' % m.name))
+  }
+@[end if]@
+@[else]@
+  @(m.serialize('msg->' + m.name))
+@[end if]@
+@[end for]@
+
+  return !mb->error;
+}
+
+bool ucdr_deserialize_@(t.c_name)(ucdrBuffer *mb, @(t.c_name) *msg)
+{
+@[if t.fixed_layout is not None]@
+  if (fixed_@(t.c_name)(mb)) {
+@[for f in t.fixed_layout.fields]@
+    memcpy(&msg->@(f.accessor), mb->iterator + @(f.offset), @(f.size));
+@[end for]@
+    mb->iterator += @(t.fixed_layout.size);
+    mb->last_data_size = @(t.fixed_layout.last_size);
+    return true;
+  }
+
+@[end if]@
+@[for m in t.members]@
+@[if m.sequence_capacity is not None]@
+@[if m.kind == 'basic']@
+  ucdr_deserialize_sequence_@(m.c_type)(mb, msg->@(m.name), @(m.sequence_capacity), &msg->@(m.name)_size);
+@[else]@
+  if (!ucdr_deserialize_uint32_t(mb, &msg->@(m.name)_size) || msg->@(m.name)_size > @(m.sequence_capacity)) {
+    msg->@(m.name)_size = 0;
+    mb->error = true;
+    return false;
+  }
+  for (uint32_t i = 0; i < msg->@(m.name)_size; ++i) {
+    @(m.deserialize('msg->%s[i]' % m.name))
+  }
+@[end if]@
+@[elif m.array_size is not None]@
+@[if m.kind == 'basic']@
+  ucdr_deserialize_array_@(m.c_type)(mb, msg->@(m.name), @(m.array_size));
+@[else]@
+  for (uint32_t i = 0; i < @(m.array_size); ++i) {
+    @(m.deserialize('msg->%s[i]' % m.name))
+  }
+@[end if]@
+@[else]@
+  @(m.deserialize('msg->' + m.name))
+@[end if]@
+@[end for]@
+
+  return !mb->error;
+}
+@[end for]@
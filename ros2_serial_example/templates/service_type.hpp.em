@@ -0,0 +1,40 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef ROS2_SERIAL_EXAMPLE__@(ros2_service.ns.upper())_@(ros2_service.lower_type.upper())_SERVICE_HPP_
+#define ROS2_SERIAL_EXAMPLE__@(ros2_service.ns.upper())_@(ros2_service.lower_type.upper())_SERVICE_HPP_
+
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <string>
+
+#include <rclcpp/rclcpp.hpp>
+
+#include "ros2_serial_example/service_bridge.hpp"
+#include "ros2_serial_example/transporter.hpp"
+
+namespace ros2_to_serial_bridge
+{
+
+namespace pubsub
+{
+
+std::unique_ptr<ServiceBridge> @(ros2_service.ns)_@(ros2_service.lower_type)_service_factory(rclcpp::Node * node, topic_id_size_t serial_mapping, const std::string & name, ros2_to_serial_bridge::transport::Transporter * transporter, size_t max_in_flight, std::chrono::milliseconds timeout, const std::shared_ptr<rclcpp::CallbackGroup> & callback_group);
+
+}  // namespace pubsub
+}  // namespace ros2_to_serial_bridge
+
+#endif
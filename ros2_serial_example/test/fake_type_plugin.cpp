@@ -0,0 +1,59 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <memory>
+#include <string>
+
+#include "ros2_serial_example/type_plugin.hpp"
+
+// A type plugin for test_type_plugin, whose factories don't make anything.
+
+namespace
+{
+
+std::unique_ptr<ros2_to_serial_bridge::pubsub::Publisher> fake_pub_factory(rclcpp::Node *, const std::string &, bool, const rclcpp::QoS &)
+{
+    return nullptr;
+}
+
+std::unique_ptr<ros2_to_serial_bridge::pubsub::Subscription> fake_sub_factory(rclcpp::Node *, topic_id_size_t, const std::string &, ros2_to_serial_bridge::transport::Transporter *, ros2_to_serial_bridge::transport::TxQueue *, bool, const rclcpp::QoS &, const std::shared_ptr<rclcpp::CallbackGroup> &)
+{
+    return nullptr;
+}
+
+size_t fake_max_serialized_size(bool * bounded)
+{
+    *bounded = true;
+    return 24;
+}
+
+size_t fake_fixed_size()
+{
+    return 0;
+}
+
+std::unique_ptr<ros2_to_serial_bridge::pubsub::Publisher> fake_batch_pub_factory(const std::string &, rclcpp::Node *, const std::string &, const rclcpp::QoS &, size_t, uint32_t)
+{
+    return nullptr;
+}
+
+}  // namespace
+
+extern "C" const ros2_to_serial_bridge::pubsub::TypePlugin ros2_serial_type_plugin = {
+    fake_pub_factory,
+    fake_sub_factory,
+    fake_max_serialized_size,
+    fake_fixed_size,
+    fake_batch_pub_factory,
+};
@@ -0,0 +1,138 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "ros2_serial_example/alloc_guard.hpp"
+
+using ros2_to_serial_bridge::transport::AllocGuardMode;
+using ros2_to_serial_bridge::transport::ColdPathScope;
+using ros2_to_serial_bridge::transport::HotPathScope;
+using ros2_to_serial_bridge::transport::get_hot_path_allocations;
+using ros2_to_serial_bridge::transport::parse_alloc_guard_mode;
+using ros2_to_serial_bridge::transport::set_alloc_guard_mode;
+
+/// HELPERS
+
+namespace
+{
+
+// Allocate in a way the compiler can't optimize away.
+void allocate()
+{
+    std::vector<uint8_t> v;
+    v.reserve(64);
+    static volatile uint8_t *sink;
+    sink = v.data();
+    (void)sink;
+}
+
+class AllocGuardFixture : public testing::Test
+{
+public:
+    void SetUp() override
+    {
+        ASSERT_TRUE(set_alloc_guard_mode(AllocGuardMode::LOG));
+    }
+
+    void TearDown() override
+    {
+        set_alloc_guard_mode(AllocGuardMode::OFF);
+    }
+};
+
+}  // namespace
+
+/// TESTS
+
+TEST(AllocGuard, parse)
+{
+    AllocGuardMode mode = AllocGuardMode::OFF;
+    ASSERT_TRUE(parse_alloc_guard_mode("log", &mode));
+    ASSERT_EQ(mode, AllocGuardMode::LOG);
+    ASSERT_TRUE(parse_alloc_guard_mode("abort", &mode));
+    ASSERT_EQ(mode, AllocGuardMode::ABORT);
+    ASSERT_TRUE(parse_alloc_guard_mode("off", &mode));
+    ASSERT_EQ(mode, AllocGuardMode::OFF);
+    ASSERT_FALSE(parse_alloc_guard_mode("warn", &mode));
+}
+
+TEST_F(AllocGuardFixture, hot_path)
+{
+    uint64_t before = get_hot_path_allocations();
+    allocate();
+    ASSERT_EQ(get_hot_path_allocations(), before);
+
+    {
+        HotPathScope hot_path;
+        allocate();
+        ASSERT_EQ(get_hot_path_allocations(), before + 1);
+
+        {
+            HotPathScope nested;
+        }
+        allocate();
+        ASSERT_EQ(get_hot_path_allocations(), before + 2);
+    }
+
+    allocate();
+    ASSERT_EQ(get_hot_path_allocations(), before + 2);
+}
+
+TEST_F(AllocGuardFixture, cold_path)
+{
+    uint64_t before = get_hot_path_allocations();
+    HotPathScope hot_path;
+    {
+        ColdPathScope cold_path;
+        allocate();
+    }
+    ASSERT_EQ(get_hot_path_allocations(), before);
+}
+
+TEST_F(AllocGuardFixture, other_threads)
+{
+    uint64_t before = get_hot_path_allocations();
+    HotPathScope hot_path;
+    std::thread thread;
+    {
+        // Starting the thread allocates.
+        ColdPathScope cold_path;
+        thread = std::thread([]() {allocate();});
+    }
+    thread.join();
+    ASSERT_EQ(get_hot_path_allocations(), before);
+}
+
+TEST(AllocGuard, off)
+{
+    ASSERT_TRUE(set_alloc_guard_mode(AllocGuardMode::OFF));
+    uint64_t before = get_hot_path_allocations();
+    HotPathScope hot_path;
+    allocate();
+    ASSERT_EQ(get_hot_path_allocations(), before);
+}
+
+TEST(AllocGuard, abort)
+{
+    ASSERT_DEATH({
+        set_alloc_guard_mode(AllocGuardMode::ABORT);
+        HotPathScope hot_path;
+        allocate();
+    }, "allocation of 64 bytes on the hot path");
+}
@@ -0,0 +1,230 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "ros2_serial_example/async_log.hpp"
+
+using ros2_to_serial_bridge::transport::AsyncLog;
+
+/// HELPERS
+
+// A sink that records every line, and that can be made to block until it is
+// released, to hold the background thread up while the queue fills.
+class SinkRecorder final
+{
+public:
+    AsyncLog::Sink sink()
+    {
+        return [this](AsyncLog::Level level, const char * text)
+               {
+                   std::unique_lock<std::mutex> lock(mutex_);
+                   lines_.push_back(std::string(level == AsyncLog::Level::WARN ? "W " : "- ") + text);
+                   in_sink_ = true;
+                   cv_.notify_all();
+                   cv_.wait(lock, [this] {return !blocked_;});
+               };
+    }
+
+    void block()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        blocked_ = true;
+    }
+
+    void unblock()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        blocked_ = false;
+        cv_.notify_all();
+    }
+
+    bool wait_for_sink()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return cv_.wait_for(lock, std::chrono::seconds(5), [this] {return in_sink_;});
+    }
+
+    std::vector<std::string> lines()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return lines_;
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::vector<std::string> lines_;
+    bool blocked_{false};
+    bool in_sink_{false};
+};
+
+/// TESTS
+
+TEST(AsyncLog, invalid_construction)
+{
+    ASSERT_THROW(AsyncLog(0, 10, AsyncLog::Sink()), std::runtime_error);
+    ASSERT_THROW(AsyncLog(16, 0, AsyncLog::Sink()), std::runtime_error);
+}
+
+TEST(AsyncLog, messages_reach_sink_in_order)
+{
+    SinkRecorder recorder;
+    AsyncLog log(16, 100, recorder.sink());
+    AsyncLog::Site site;
+
+    log.log(&site, AsyncLog::Level::WARN, "BAD CRC %u != %u", 1U, 2U);
+    log.log(&site, AsyncLog::Level::INFO, "Read fail %d", 5);
+    log.flush();
+
+    std::vector<std::string> lines = recorder.lines();
+    ASSERT_EQ(lines.size(), 2U);
+    ASSERT_EQ(lines[0], "W BAD CRC 1 != 2");
+    ASSERT_EQ(lines[1], "- Read fail 5");
+    ASSERT_EQ(log.get_dropped(), 0U);
+}
+
+TEST(AsyncLog, long_message_truncated)
+{
+    SinkRecorder recorder;
+    AsyncLog log(16, 100, recorder.sink());
+    AsyncLog::Site site;
+
+    std::string long_text(AsyncLog::MESSAGE_SIZE * 2, 'x');
+    log.log(&site, AsyncLog::Level::WARN, "%s", long_text.c_str());
+    log.flush();
+
+    std::vector<std::string> lines = recorder.lines();
+    ASSERT_EQ(lines.size(), 1U);
+    ASSERT_EQ(lines[0], "W " + std::string(AsyncLog::MESSAGE_SIZE - 1, 'x'));
+}
+
+TEST(AsyncLog, repeats_coalesced)
+{
+    SinkRecorder recorder;
+    AsyncLog log(16, 100, recorder.sink());
+    AsyncLog::Site site;
+
+    for (int i = 0; i < 5; ++i)
+    {
+        log.log(&site, AsyncLog::Level::WARN, "BAD CRC %u != %u", 1U, 2U);
+    }
+    log.log(&site, AsyncLog::Level::WARN, "BAD CRC %u != %u", 3U, 4U);
+    log.flush();
+
+    std::vector<std::string> lines = recorder.lines();
+    ASSERT_EQ(lines.size(), 3U);
+    ASSERT_EQ(lines[0], "W BAD CRC 1 != 2");
+    ASSERT_EQ(lines[1], "W last message repeated 4 times");
+    ASSERT_EQ(lines[2], "W BAD CRC 3 != 4");
+}
+
+TEST(AsyncLog, flush_reports_open_repeats)
+{
+    SinkRecorder recorder;
+    AsyncLog log(16, 100, recorder.sink());
+    AsyncLog::Site site;
+
+    log.log(&site, AsyncLog::Level::WARN, "TCP connection lost");
+    log.log(&site, AsyncLog::Level::WARN, "TCP connection lost");
+    log.flush();
+
+    std::vector<std::string> lines = recorder.lines();
+    ASSERT_EQ(lines.size(), 2U);
+    ASSERT_EQ(lines[0], "W TCP connection lost");
+    ASSERT_EQ(lines[1], "W last message repeated 1 times");
+}
+
+TEST(AsyncLog, rate_limited_per_site)
+{
+    SinkRecorder recorder;
+    AsyncLog log(64, 3, recorder.sink());
+    AsyncLog::Site site_a;
+    AsyncLog::Site site_b;
+
+    for (int i = 0; i < 10; ++i)
+    {
+        log.log(&site_a, AsyncLog::Level::WARN, "a %d", i);
+    }
+    // Another site has a rate of its own.
+    log.log(&site_b, AsyncLog::Level::WARN, "b");
+    log.flush();
+
+    std::vector<std::string> lines = recorder.lines();
+    ASSERT_EQ(lines.size(), 4U);
+    ASSERT_EQ(lines[0], "W a 0");
+    ASSERT_EQ(lines[1], "W a 1");
+    ASSERT_EQ(lines[2], "W a 2");
+    ASSERT_EQ(lines[3], "W b");
+    ASSERT_EQ(log.get_suppressed(), 7U);
+
+    // The next message let through from the site carries the count of the
+    // ones that weren't.
+    site_a.window_start_ns = 0;
+    log.log(&site_a, AsyncLog::Level::WARN, "a again");
+    log.flush();
+
+    lines = recorder.lines();
+    ASSERT_EQ(lines.size(), 5U);
+    ASSERT_EQ(lines[4], "W a again (7 similar messages suppressed)");
+}
+
+TEST(AsyncLog, full_queue_drops)
+{
+    SinkRecorder recorder;
+    AsyncLog log(4, 100, recorder.sink());
+    AsyncLog::Site site;
+
+    // Hold the background thread up in the sink with the first message, so
+    // that the rest stay queued.
+    recorder.block();
+    log.log(&site, AsyncLog::Level::WARN, "first");
+    ASSERT_TRUE(recorder.wait_for_sink());
+
+    for (int i = 0; i < 7; ++i)
+    {
+        log.log(&site, AsyncLog::Level::WARN, "queued %d", i);
+    }
+    uint64_t dropped = log.get_dropped();
+    recorder.unblock();
+    ASSERT_EQ(dropped, 3U);
+
+    log.flush();
+
+    std::vector<std::string> lines = recorder.lines();
+    ASSERT_EQ(lines.size(), 5U);
+    ASSERT_EQ(lines[0], "W first");
+    ASSERT_EQ(lines[1], "W queued 0");
+    ASSERT_EQ(lines[4], "W queued 3");
+}
+
+TEST(AsyncLog, destruction_prints_queued)
+{
+    SinkRecorder recorder;
+    {
+        AsyncLog log(16, 100, recorder.sink());
+        AsyncLog::Site site;
+        log.log(&site, AsyncLog::Level::WARN, "last words");
+    }
+
+    std::vector<std::string> lines = recorder.lines();
+    ASSERT_EQ(lines.size(), 1U);
+    ASSERT_EQ(lines[0], "W last words");
+}
+
+TEST(AsyncLog, macro_uses_instance)
+{
+    SinkRecorder recorder;
+    AsyncLog::instance().set_sink(recorder.sink());
+    ROS2_SERIAL_LOG(WARN, "Dropping UDP datagram larger than %zu bytes", static_cast<size_t>(1500));
+    AsyncLog::instance().flush();
+    AsyncLog::instance().set_sink(AsyncLog::Sink());
+
+    std::vector<std::string> lines = recorder.lines();
+    ASSERT_EQ(lines.size(), 1U);
+    ASSERT_EQ(lines[0], "W Dropping UDP datagram larger than 1500 bytes");
+}
@@ -0,0 +1,271 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+#include "ros2_serial_example/bonded_transporter.hpp"
+#include "ros2_serial_example/shm_transporter.hpp"
+#include "ros2_serial_example/transporter.hpp"
+#include "ros2_serial_example/transporter_factory.hpp"
+
+using ros2_to_serial_bridge::transport::BondedTransporter;
+using ros2_to_serial_bridge::transport::ShmTransporter;
+using ros2_to_serial_bridge::transport::Transporter;
+using ros2_to_serial_bridge::transport::TransporterConfig;
+using ros2_to_serial_bridge::transport::TransporterFactory;
+
+/// HELPERS
+
+static std::string shm_name(const std::string & test)
+{
+    return "/ros2_serial_test_" + test + "_" + std::to_string(::getpid());
+}
+
+// The links of one side of a bond through shared memory; the side that
+// creates the segments has to be initialized first.
+static std::vector<std::unique_ptr<Transporter>> make_links(const std::string & test, const std::string & protocol,
+                                                            ShmTransporter::Role role, size_t count)
+{
+    std::vector<std::unique_ptr<Transporter>> links;
+    for (size_t i = 0; i < count; ++i)
+    {
+        links.push_back(std::make_unique<ShmTransporter>(protocol, shm_name(test) + "_" + std::to_string(i), role,
+                                                         4096, 10, 4096));
+    }
+    return links;
+}
+
+// Both sides of a bond.
+class BondPair final
+{
+public:
+    BondPair(const std::string & test, BondedTransporter::Mode mode, size_t links)
+        : local("v2", make_links(test, "v2", ShmTransporter::Role::CREATE, links), mode, 10, 4096),
+          remote("v2", make_links(test, "v2", ShmTransporter::Role::ATTACH, links), mode, 10, 4096)
+    {
+        EXPECT_EQ(local.init(), 0);
+        EXPECT_EQ(remote.init(), 0);
+    }
+
+    BondedTransporter local;
+    BondedTransporter remote;
+};
+
+/// TESTS
+
+TEST(BondedTransporter, invalid_construction)
+{
+    // COBS has no sequence numbers to tell copies apart by.
+    ASSERT_THROW(BondedTransporter("cobs", make_links("bond_invalid_cobs", "cobs", ShmTransporter::Role::CREATE, 2),
+                                   BondedTransporter::Mode::REDUNDANT, 10, 4096), std::runtime_error);
+    ASSERT_THROW(BondedTransporter("v2", {}, BondedTransporter::Mode::REDUNDANT, 10, 4096), std::runtime_error);
+
+    std::vector<std::unique_ptr<Transporter>> links = make_links("bond_invalid_null", "v2", ShmTransporter::Role::CREATE, 1);
+    links.push_back(nullptr);
+    ASSERT_THROW(BondedTransporter("v2", std::move(links), BondedTransporter::Mode::REDUNDANT, 10, 4096),
+                 std::runtime_error);
+
+    links = make_links("bond_invalid_protocol", "px4", ShmTransporter::Role::CREATE, 1);
+    ASSERT_THROW(BondedTransporter("v2", std::move(links), BondedTransporter::Mode::REDUNDANT, 10, 4096),
+                 std::runtime_error);
+}
+
+TEST(BondedTransporter, parse_mode)
+{
+    BondedTransporter::Mode mode = BondedTransporter::Mode::STRIPE;
+    ASSERT_TRUE(BondedTransporter::parse_mode("redundant", &mode));
+    ASSERT_EQ(mode, BondedTransporter::Mode::REDUNDANT);
+    ASSERT_TRUE(BondedTransporter::parse_mode("stripe", &mode));
+    ASSERT_EQ(mode, BondedTransporter::Mode::STRIPE);
+    ASSERT_FALSE(BondedTransporter::parse_mode("both", &mode));
+}
+
+TEST(BondedTransporter, redundant_drops_duplicates)
+{
+    BondPair bond("bond_redundant", BondedTransporter::Mode::REDUNDANT, 2);
+
+    // More than 256 messages, so the sequence numbers wrap around.
+    for (int i = 0; i < 300; ++i)
+    {
+        uint8_t payload[] = {static_cast<uint8_t>(i), static_cast<uint8_t>(i >> 8)};
+        ASSERT_EQ(bond.local.write(9, payload, sizeof(payload)), static_cast<ssize_t>(sizeof(payload)));
+
+        int received = 0;
+        uint8_t buffer[64];
+        for (int tries = 0; tries < 10 && received == 0; ++tries)
+        {
+            ASSERT_GE(bond.remote.read_many(buffer, sizeof(buffer),
+                                            [&](topic_id_size_t topic_ID, uint8_t *data, size_t len) {
+                ASSERT_EQ(topic_ID, 9U);
+                ASSERT_EQ(len, sizeof(payload));
+                ASSERT_EQ(data[0], payload[0]);
+                ASSERT_EQ(data[1], payload[1]);
+                received++;
+            }), 0);
+        }
+        ASSERT_EQ(received, 1);
+    }
+
+    // The copies that were left behind are dropped.
+    uint8_t buffer[64];
+    ASSERT_EQ(bond.remote.read_many(buffer, sizeof(buffer), [](topic_id_size_t, uint8_t *, size_t) {
+        FAIL();
+    }), 0);
+
+    BondedTransporter::LinkStats a = bond.local.get_link_stats(0);
+    BondedTransporter::LinkStats b = bond.local.get_link_stats(1);
+    ASSERT_EQ(a.tx_frames, 300U);
+    ASSERT_EQ(b.tx_frames, 300U);
+    ASSERT_TRUE(a.up);
+
+    a = bond.remote.get_link_stats(0);
+    b = bond.remote.get_link_stats(1);
+    ASSERT_EQ(a.rx_messages + b.rx_messages, 600U);
+    ASSERT_EQ(a.duplicates + b.duplicates, 300U);
+
+    // The bond counts each message once.
+    ros2_to_serial_bridge::transport::Metrics::Snapshot snapshot;
+    bond.remote.get_metrics().snapshot(&snapshot);
+    ASSERT_EQ(snapshot.rx.size(), 1U);
+    ASSERT_EQ(snapshot.rx[0].topic_ID, 9U);
+    ASSERT_EQ(snapshot.rx[0].messages, 300U);
+}
+
+TEST(BondedTransporter, stripe_spreads_frames)
+{
+    BondPair bond("bond_stripe", BondedTransporter::Mode::STRIPE, 2);
+
+    // Nobody reads while these go out, so the first link backs up and the
+    // second one is quicker.
+    uint8_t payload[256]{};
+    for (int i = 0; i < 10; ++i)
+    {
+        payload[0] = static_cast<uint8_t>(i);
+        ASSERT_EQ(bond.local.write(9, payload, sizeof(payload)), static_cast<ssize_t>(sizeof(payload)));
+    }
+
+    BondedTransporter::LinkStats a = bond.local.get_link_stats(0);
+    BondedTransporter::LinkStats b = bond.local.get_link_stats(1);
+    ASSERT_GT(a.tx_frames, 0U);
+    ASSERT_GT(b.tx_frames, 0U);
+    ASSERT_EQ(a.tx_frames + b.tx_frames, 10U);
+
+    // Every frame arrives once, though not necessarily in order.
+    std::vector<int> seen(10, 0);
+    uint8_t buffer[512];
+    for (int tries = 0; tries < 10; ++tries)
+    {
+        ASSERT_GE(bond.remote.read_many(buffer, sizeof(buffer), [&](topic_id_size_t topic_ID, uint8_t *data, size_t len) {
+            ASSERT_EQ(topic_ID, 9U);
+            ASSERT_EQ(len, sizeof(payload));
+            ASSERT_LT(data[0], 10);
+            seen[data[0]]++;
+        }), 0);
+    }
+    for (int count : seen)
+    {
+        ASSERT_EQ(count, 1);
+    }
+    ASSERT_EQ(bond.remote.get_link_stats(0).duplicates + bond.remote.get_link_stats(1).duplicates, 0U);
+}
+
+TEST(BondedTransporter, mode_per_topic)
+{
+    BondPair bond("bond_per_topic", BondedTransporter::Mode::STRIPE, 2);
+    ASSERT_EQ(bond.local.set_redundant(9, true), 0);
+    ASSERT_EQ(bond.local.set_redundant(0xffff, true), 0);
+
+    uint8_t payload[] = {0x1};
+    ASSERT_EQ(bond.local.write(9, payload, sizeof(payload)), static_cast<ssize_t>(sizeof(payload)));
+    ASSERT_EQ(bond.local.write(10, payload, sizeof(payload)), static_cast<ssize_t>(sizeof(payload)));
+
+    ASSERT_EQ(bond.local.get_link_stats(0).tx_frames + bond.local.get_link_stats(1).tx_frames, 3U);
+
+    // Transports with only one link don't have a choice.
+    ShmTransporter single("v2", shm_name("bond_per_topic_single"), ShmTransporter::Role::CREATE, 4096, 10, 4096);
+    ASSERT_EQ(single.set_redundant(9, true), -1);
+}
+
+TEST(BondedTransporter, read_one_at_a_time)
+{
+    BondPair bond("bond_read", BondedTransporter::Mode::REDUNDANT, 3);
+
+    uint8_t payload[] = {0x1, 0x2, 0x3};
+    ASSERT_EQ(bond.local.write(12, payload, sizeof(payload)), static_cast<ssize_t>(sizeof(payload)));
+    ASSERT_EQ(bond.local.write(12, payload, sizeof(payload)), static_cast<ssize_t>(sizeof(payload)));
+
+    int received = 0;
+    for (int i = 0; i < 20; ++i)
+    {
+        topic_id_size_t topic_ID = 0;
+        uint8_t buffer[64];
+        ssize_t len = bond.remote.read(&topic_ID, buffer, sizeof(buffer));
+        if (len >= 0)
+        {
+            ASSERT_EQ(len, static_cast<ssize_t>(sizeof(payload)));
+            ASSERT_EQ(topic_ID, 12U);
+            ASSERT_GE(bond.remote.get_receive_sequence(), 0);
+            received++;
+        }
+    }
+    ASSERT_EQ(received, 2);
+}
+
+TEST(BondedTransporter, factory)
+{
+    std::string name = shm_name("bond_factory");
+    TransporterConfig config;
+    config.protocol = "px4";
+    config.read_poll_ms = 10;
+    config.ring_buffer_size = 4096;
+    config.get_string = [name](const std::string & param, std::string * value) {
+        if (param == "radio.backend_comms" || param == "cable.backend_comms")
+        {
+            *value = "shm";
+            return true;
+        }
+        if (param == "radio.shm_name" || param == "cable.shm_name")
+        {
+            *value = name + "_" + param.substr(0, param.find('.'));
+            return true;
+        }
+        if (param == "bond_mode")
+        {
+            *value = "stripe";
+            return true;
+        }
+        return false;
+    };
+    config.get_string_array = [](const std::string & param, std::vector<std::string> * value) {
+        if (param == "bond_links")
+        {
+            *value = {"radio", "cable"};
+            return true;
+        }
+        return false;
+    };
+
+    std::unique_ptr<Transporter> trans = TransporterFactory::instance().create("bond", config);
+    ASSERT_NE(trans, nullptr);
+    ASSERT_EQ(trans->get_protocol(), "px4");
+    ASSERT_EQ(trans->init(), 0);
+    ASSERT_EQ(static_cast<BondedTransporter *>(trans.get())->get_link_count(), 2U);
+    ASSERT_EQ(trans->close(), 0);
+
+    // Every link needs a backend of its own.
+    config.get_string_array = [](const std::string & param, std::vector<std::string> * value) {
+        if (param == "bond_links")
+        {
+            *value = {"radio", "satellite"};
+            return true;
+        }
+        return false;
+    };
+    ASSERT_THROW(TransporterFactory::instance().create("bond", config), std::runtime_error);
+}
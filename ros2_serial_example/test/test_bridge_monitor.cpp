@@ -0,0 +1,115 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "ros2_serial_example/bridge_monitor.hpp"
+
+using ros2_to_serial_bridge::monitor::BridgeMonitor;
+
+/// HELPERS
+
+constexpr int64_t SECOND_NS = 1000000000;
+
+// A report of a port with two topics, as the bridge sends it.
+static BridgeMonitor::Values port_values(uint64_t chatter_bytes, uint64_t imu_bytes, uint64_t crc_failures)
+{
+    return BridgeMonitor::Values{
+        {"rx//chatter/messages", std::to_string(chatter_bytes / 10)},
+        {"rx//chatter/bytes", std::to_string(chatter_bytes)},
+        {"rx//chatter/crc_failures", std::to_string(crc_failures)},
+        {"tx//imu/data/messages", std::to_string(imu_bytes / 100)},
+        {"tx//imu/data/bytes", std::to_string(imu_bytes)},
+        {"tx//imu/data/stale_drops", "0"},
+        {"tx//imu/data/queue_depth", "3"},
+        {"garbage_bytes", "0"},
+        {"baudrate", "115200"},
+        {"write_queue_bytes", "12"},
+        {"latency/write/count", "10"},
+        {"latency/write/p99_us", "250.5"},
+    };
+}
+
+/// TESTS
+
+TEST(BridgeMonitor, not_a_port)
+{
+    BridgeMonitor monitor;
+    ASSERT_FALSE(monitor.update("something else", 0, BridgeMonitor::Values{{"temperature", "40"}}));
+    ASSERT_TRUE(monitor.ports().empty());
+}
+
+TEST(BridgeMonitor, rates)
+{
+    BridgeMonitor monitor;
+    ASSERT_TRUE(monitor.update("bridge", 0, port_values(1000, 1000, 0)));
+
+    // One report has no rates yet.
+    std::vector<BridgeMonitor::TopicRow> topics = monitor.topics();
+    ASSERT_EQ(topics.size(), 2U);
+    ASSERT_EQ(topics[0].bytes_per_s, 0.0);
+
+    // Over two seconds, chatter got 1000 bytes in 100 messages, with 25
+    // more frames failing their CRC, and imu sent 4000 bytes.
+    ASSERT_TRUE(monitor.update("bridge", 2 * SECOND_NS, port_values(2000, 5000, 25)));
+    topics = monitor.topics();
+    ASSERT_EQ(topics.size(), 2U);
+    ASSERT_EQ(topics[0].topic, "/imu/data");
+    ASSERT_EQ(topics[0].direction, "tx");
+    ASSERT_DOUBLE_EQ(topics[0].bytes_per_s, 2000.0);
+    ASSERT_DOUBLE_EQ(topics[0].messages_per_s, 20.0);
+    ASSERT_DOUBLE_EQ(topics[0].link_percent, 2000.0 * 10 * 100 / 115200);
+    ASSERT_EQ(topics[0].queue_depth, 3);
+
+    ASSERT_EQ(topics[1].topic, "/chatter");
+    ASSERT_DOUBLE_EQ(topics[1].bytes_per_s, 500.0);
+    ASSERT_DOUBLE_EQ(topics[1].crc_error_percent, 20.0);
+    ASSERT_DOUBLE_EQ(topics[1].drops_per_s, 12.5);
+    ASSERT_EQ(topics[1].queue_depth, -1);
+
+    std::vector<BridgeMonitor::PortRow> ports = monitor.ports();
+    ASSERT_EQ(ports.size(), 1U);
+    ASSERT_DOUBLE_EQ(ports[0].rx_bytes_per_s, 500.0);
+    ASSERT_DOUBLE_EQ(ports[0].tx_bytes_per_s, 2000.0);
+    ASSERT_EQ(ports[0].baudrate, 115200U);
+    ASSERT_EQ(ports[0].write_queue_bytes, 12);
+    ASSERT_DOUBLE_EQ(ports[0].write_p99_us, 250.5);
+}
+
+TEST(BridgeMonitor, restart)
+{
+    BridgeMonitor monitor;
+    ASSERT_TRUE(monitor.update("bridge", 0, port_values(1000, 1000, 0)));
+    ASSERT_TRUE(monitor.update("bridge", SECOND_NS, port_values(2000, 2000, 0)));
+    ASSERT_DOUBLE_EQ(monitor.topics()[0].bytes_per_s, 1000.0);
+
+    // The counters starting over doesn't show up as a huge rate.
+    ASSERT_TRUE(monitor.update("bridge", 2 * SECOND_NS, port_values(100, 100, 0)));
+    ASSERT_EQ(monitor.topics()[0].bytes_per_s, 0.0);
+    ASSERT_TRUE(monitor.update("bridge", 3 * SECOND_NS, port_values(600, 100, 0)));
+    ASSERT_DOUBLE_EQ(monitor.topics()[0].bytes_per_s, 500.0);
+
+    // An older report is ignored.
+    ASSERT_TRUE(monitor.update("bridge", SECOND_NS, port_values(0, 0, 0)));
+    ASSERT_DOUBLE_EQ(monitor.topics()[0].bytes_per_s, 500.0);
+}
+
+TEST(BridgeMonitor, render)
+{
+    BridgeMonitor monitor;
+    ASSERT_TRUE(monitor.update("bridge: uart", 0, port_values(1000, 1000, 0)));
+    ASSERT_TRUE(monitor.update("bridge: uart", SECOND_NS, port_values(2000, 5000, 0)));
+    ASSERT_TRUE(monitor.update("bridge: udp", 0, BridgeMonitor::Values{{"rx/7/messages", "1"}, {"rx/7/bytes", "8"}}));
+
+    std::string table = monitor.render(0);
+    ASSERT_NE(table.find("bridge: uart"), std::string::npos);
+    ASSERT_NE(table.find("bridge: udp"), std::string::npos);
+    // The busiest topic comes first.
+    ASSERT_LT(table.find("/imu/data"), table.find("/chatter"));
+
+    // Only the busiest topic is shown.
+    table = monitor.render(1);
+    ASSERT_NE(table.find("/imu/data"), std::string::npos);
+    ASSERT_EQ(table.find("/chatter"), std::string::npos);
+}
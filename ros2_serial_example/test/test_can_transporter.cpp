@@ -0,0 +1,127 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include <linux/can.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "ros2_serial_example/can_transporter.hpp"
+
+#include "transporter_test_helpers.hpp"
+
+using ros2_to_serial_bridge::transport::CANTransporter;
+
+/// HELPERS
+
+// The round trip tests need a virtual CAN-FD interface, which can be made with
+//   ip link add dev vcan0 type vcan && ip link set vcan0 mtu 72 up
+static bool vcan_available()
+{
+    int fd = ::socket(PF_CAN, SOCK_RAW, CAN_RAW);
+    struct ifreq ifr{};
+    ::strncpy(ifr.ifr_name, "vcan0", IFNAMSIZ - 1);
+    bool available = fd >= 0 && ::ioctl(fd, SIOCGIFMTU, &ifr) == 0 && ifr.ifr_mtu >= static_cast<int>(CANFD_MTU);
+    if (fd >= 0)
+    {
+        ::close(fd);
+    }
+    if (!available)
+    {
+        ::fprintf(stderr, "Skipping, there is no CAN-FD interface vcan0\n");
+    }
+
+    return available;
+}
+
+/// TESTS
+
+TEST(CANTransporter, invalid_args)
+{
+    ASSERT_THROW(CANTransporter("px4", "", 0x100, 0x200, false, 10, 1024, 32), std::runtime_error);
+    ASSERT_THROW(CANTransporter("px4", "a_very_long_interface_name", 0x100, 0x200, false, 10, 1024, 32),
+                 std::runtime_error);
+    ASSERT_THROW(CANTransporter("px4", "can0", 0x800, 0x200, false, 10, 1024, 32), std::runtime_error);
+    ASSERT_THROW(CANTransporter("px4", "can0", 0x100, 0x800, false, 10, 1024, 32), std::runtime_error);
+    ASSERT_THROW(CANTransporter("px4", "can0", 0x100, 0x200, false, 10, 1024, 0), std::runtime_error);
+    ASSERT_THROW(CANTransporter("px4", "can0", 0x100, 0x200, false, 10, 1024, CANTransporter::MAX_FRAME_BATCH + 1),
+                 std::runtime_error);
+
+    // 29-bit IDs allow much larger base IDs.
+    ASSERT_NO_THROW(CANTransporter("px4", "can0", 0x100000, 0x200000, true, 10, 1024, 32));
+}
+
+TEST(CANTransporter, no_interface)
+{
+    CANTransporter trans("px4", "nosuchcan9", 0x100, 0x200, false, 10, 1024, 32);
+    ASSERT_EQ(trans.init(), -1);
+    ASSERT_EQ(trans.get_read_fd(), -1);
+}
+
+TEST(CANTransporter, round_trip)
+{
+    if (!vcan_available())
+    {
+        return;
+    }
+
+    CANTransporter a("px4", "vcan0", 0x100, 0x200, false, 10, 1024, 32);
+    ASSERT_EQ(a.init(), 0);
+    CANTransporter b("px4", "vcan0", 0x200, 0x100, false, 10, 1024, 32);
+    ASSERT_EQ(b.init(), 0);
+
+    // A short message goes in a single CAN frame, and a long one is
+    // segmented.
+    std::vector<uint8_t> small{0x1, 0x2, 0x3};
+    std::vector<uint8_t> large(500);
+    for (size_t i = 0; i < large.size(); ++i)
+    {
+        large[i] = static_cast<uint8_t>(i);
+    }
+    ASSERT_EQ(a.write(0x3, small.data(), small.size()), 3);
+    ASSERT_EQ(a.write(0x4, large.data(), large.size()), 500);
+
+    std::vector<std::vector<uint8_t>> messages = read_messages(b, 2);
+    ASSERT_EQ(messages.size(), 2U);
+    small.push_back(0x3);
+    large.push_back(0x4);
+    ASSERT_EQ(messages[0], small);
+    ASSERT_EQ(messages[1], large);
+}
+
+TEST(CANTransporter, batched_round_trip)
+{
+    if (!vcan_available())
+    {
+        return;
+    }
+
+    CANTransporter a("cobs", "vcan0", 0x300, 0x400, false, 10, 1024, 4);
+    ASSERT_EQ(a.init(), 0);
+    CANTransporter b("cobs", "vcan0", 0x400, 0x300, false, 10, 1024, 4);
+    ASSERT_EQ(b.init(), 0);
+
+    uint8_t payload[100]{};
+    ASSERT_EQ(a.set_write_batching(1024), 0);
+    for (uint8_t i = 0; i < 3; ++i)
+    {
+        payload[0] = i;
+        ASSERT_EQ(a.write(i, payload, sizeof(payload)), 100);
+    }
+    ASSERT_GT(a.flush(), 0);
+
+    std::vector<std::vector<uint8_t>> messages = read_messages(b, 3);
+    ASSERT_EQ(messages.size(), 3U);
+    for (uint8_t i = 0; i < 3; ++i)
+    {
+        ASSERT_EQ(messages[i].size(), 101U);
+        ASSERT_EQ(messages[i][0], i);
+        ASSERT_EQ(messages[i].back(), i);
+    }
+}
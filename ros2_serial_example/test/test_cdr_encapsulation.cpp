@@ -0,0 +1,49 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+
+#include "ros2_serial_example/cdr_encapsulation.hpp"
+
+namespace cdr = ros2_to_serial_bridge::pubsub::cdr;
+
+TEST(CdrEncapsulation, round_trip)
+{
+    uint8_t buffer[8]{0xff, 0xff, 0xff, 0xff, 0x1, 0x2, 0x3, 0x4};
+    cdr::write_encapsulation(buffer);
+    ASSERT_EQ(buffer[0], 0x00);
+    ASSERT_EQ(buffer[1], cdr::NATIVE_REPRESENTATION);
+    ASSERT_EQ(buffer[2], 0x00);
+    ASSERT_EQ(buffer[3], 0x00);
+
+    size_t data_length = 0;
+    ASSERT_TRUE(cdr::unwrap_encapsulation(buffer, sizeof(buffer), &data_length));
+    ASSERT_EQ(data_length, 4U);
+}
+
+TEST(CdrEncapsulation, padding)
+{
+    uint8_t buffer[8]{0x00, cdr::NATIVE_REPRESENTATION, 0x00, 0x03, 0x1, 0x0, 0x0, 0x0};
+
+    size_t data_length = 0;
+    ASSERT_TRUE(cdr::unwrap_encapsulation(buffer, sizeof(buffer), &data_length));
+    ASSERT_EQ(data_length, 1U);
+
+    // More padding than there is data.
+    ASSERT_FALSE(cdr::unwrap_encapsulation(buffer, 6, &data_length));
+}
+
+TEST(CdrEncapsulation, invalid)
+{
+    size_t data_length = 0;
+
+    uint8_t too_short[3]{0x00, cdr::NATIVE_REPRESENTATION, 0x00};
+    ASSERT_FALSE(cdr::unwrap_encapsulation(too_short, sizeof(too_short), &data_length));
+
+    uint8_t wrong_endian[4]{0x00, static_cast<uint8_t>(cdr::NATIVE_REPRESENTATION ^ 0x1), 0x00, 0x00};
+    ASSERT_FALSE(cdr::unwrap_encapsulation(wrong_endian, sizeof(wrong_endian), &data_length));
+
+    // Anything other than plain CDR (like parameter lists) can't be passed
+    // through either.
+    uint8_t pl_cdr[4]{0x00, static_cast<uint8_t>(cdr::NATIVE_REPRESENTATION | 0x2), 0x00, 0x00};
+    ASSERT_FALSE(cdr::unwrap_encapsulation(pl_cdr, sizeof(pl_cdr), &data_length));
+}
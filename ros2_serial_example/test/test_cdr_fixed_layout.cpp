@@ -0,0 +1,184 @@
+#include <gtest/gtest.h>
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "ros2_serial_example/cdr_fixed_layout.hpp"
+
+namespace cdr = ros2_to_serial_bridge::pubsub::cdr;
+
+/// HELPERS
+
+// Stand-ins for generated message types.
+struct Time
+{
+    int32_t sec{0};
+    uint32_t nanosec{0};
+};
+
+struct Sample
+{
+    bool valid{false};
+    std::array<Time, 2> stamps;
+    uint16_t count{0};
+    std::array<float, 3> values{};
+    std::array<bool, 2> flags{};
+    double total{0.0};
+};
+
+// The layout generate_ros2_topics.py makes for Sample.
+struct SampleLayout final
+{
+    static constexpr bool FIXED = true;
+    static constexpr size_t SIZE = 48;
+    static constexpr size_t MIN_SIZE = SIZE;
+
+    static bool decode(const uint8_t *data, size_t length, Sample & msg)
+    {
+        if (length < SIZE)
+        {
+            return false;
+        }
+        cdr::fixed_load<1>(data, 0, msg.valid);
+        cdr::fixed_load<4>(data, 4, msg.stamps[0].sec);
+        cdr::fixed_load<4>(data, 8, msg.stamps[0].nanosec);
+        cdr::fixed_load<4>(data, 12, msg.stamps[1].sec);
+        cdr::fixed_load<4>(data, 16, msg.stamps[1].nanosec);
+        cdr::fixed_load<2>(data, 20, msg.count);
+        cdr::fixed_load<12>(data, 24, msg.values);
+        cdr::fixed_load<2>(data, 36, msg.flags);
+        cdr::fixed_load<8>(data, 40, msg.total);
+        return true;
+    }
+
+    static size_t encode(const Sample & msg, uint8_t *data, size_t length)
+    {
+        if (length < SIZE)
+        {
+            return 0;
+        }
+        ::memset(data + 1, 0, 3);
+        ::memset(data + 22, 0, 2);
+        ::memset(data + 38, 0, 2);
+        cdr::fixed_store<1>(data, 0, msg.valid);
+        cdr::fixed_store<4>(data, 4, msg.stamps[0].sec);
+        cdr::fixed_store<4>(data, 8, msg.stamps[0].nanosec);
+        cdr::fixed_store<4>(data, 12, msg.stamps[1].sec);
+        cdr::fixed_store<4>(data, 16, msg.stamps[1].nanosec);
+        cdr::fixed_store<2>(data, 20, msg.count);
+        cdr::fixed_store<12>(data, 24, msg.values);
+        cdr::fixed_store<2>(data, 36, msg.flags);
+        cdr::fixed_store<8>(data, 40, msg.total);
+        return SIZE;
+    }
+};
+
+constexpr size_t SampleLayout::SIZE;
+constexpr size_t SampleLayout::MIN_SIZE;
+
+template<typename V>
+void put(std::vector<uint8_t> * data, size_t offset, V value)
+{
+    ::memcpy(&(*data)[offset], &value, sizeof(value));
+}
+
+// CDR data for a Sample, laid out by hand.
+std::vector<uint8_t> sample_cdr()
+{
+    std::vector<uint8_t> data(48, 0xee);
+    data[0] = 1;
+    put<int32_t>(&data, 4, -5);
+    put<uint32_t>(&data, 8, 123456789);
+    put<int32_t>(&data, 12, 7);
+    put<uint32_t>(&data, 16, 8);
+    put<uint16_t>(&data, 20, 0x1234);
+    put<float>(&data, 24, 1.5f);
+    put<float>(&data, 28, -2.25f);
+    put<float>(&data, 32, 1e6f);
+    data[36] = 0;
+    data[37] = 1;
+    put<double>(&data, 40, 3.0e-3);
+
+    return data;
+}
+
+/// TESTS
+
+TEST(CdrFixedLayout, no_fixed_layout)
+{
+    Sample msg;
+    uint8_t data[48]{};
+    ASSERT_FALSE(cdr::NoFixedLayout<Sample>::FIXED);
+    ASSERT_EQ(cdr::NoFixedLayout<Sample>::MIN_SIZE, 0U);
+    ASSERT_FALSE(cdr::NoFixedLayout<Sample>::decode(data, sizeof(data), msg));
+    ASSERT_EQ(cdr::NoFixedLayout<Sample>::encode(msg, data, sizeof(data)), 0U);
+}
+
+TEST(CdrFixedLayout, variable_layout)
+{
+    Sample msg;
+    uint8_t data[48]{};
+    using Layout = cdr::VariableLayout<Sample, 12>;
+    ASSERT_FALSE(Layout::FIXED);
+    ASSERT_EQ(Layout::MIN_SIZE, 12U);
+    ASSERT_FALSE(Layout::decode(data, sizeof(data), msg));
+    ASSERT_EQ(Layout::encode(msg, data, sizeof(data)), 0U);
+}
+
+TEST(CdrFixedLayout, decode)
+{
+    std::vector<uint8_t> data = sample_cdr();
+    Sample msg;
+    ASSERT_TRUE(SampleLayout::decode(data.data(), data.size(), msg));
+    ASSERT_TRUE(msg.valid);
+    ASSERT_EQ(msg.stamps[0].sec, -5);
+    ASSERT_EQ(msg.stamps[0].nanosec, 123456789U);
+    ASSERT_EQ(msg.stamps[1].sec, 7);
+    ASSERT_EQ(msg.stamps[1].nanosec, 8U);
+    ASSERT_EQ(msg.count, 0x1234);
+    ASSERT_EQ(msg.values[0], 1.5f);
+    ASSERT_EQ(msg.values[1], -2.25f);
+    ASSERT_EQ(msg.values[2], 1e6f);
+    ASSERT_FALSE(msg.flags[0]);
+    ASSERT_TRUE(msg.flags[1]);
+    ASSERT_EQ(msg.total, 3.0e-3);
+
+    // Extra data is ignored, as Fast-CDR does; too little is an error.
+    data.push_back(0x55);
+    ASSERT_TRUE(SampleLayout::decode(data.data(), data.size(), msg));
+    ASSERT_FALSE(SampleLayout::decode(data.data(), 47, msg));
+}
+
+TEST(CdrFixedLayout, decode_bool)
+{
+    // A boolean byte that isn't 0 or 1 still makes a valid bool.
+    std::vector<uint8_t> data = sample_cdr();
+    data[0] = 0x80;
+    data[36] = 0x02;
+    Sample msg;
+    ASSERT_TRUE(SampleLayout::decode(data.data(), data.size(), msg));
+    ASSERT_TRUE(msg.valid);
+    ASSERT_TRUE(msg.flags[0]);
+}
+
+TEST(CdrFixedLayout, encode)
+{
+    std::vector<uint8_t> expected = sample_cdr();
+    // The padding is written as 0s.
+    for (size_t i : {1, 2, 3, 22, 23, 38, 39})
+    {
+        expected[i] = 0;
+    }
+
+    Sample msg;
+    ASSERT_TRUE(SampleLayout::decode(expected.data(), expected.size(), msg));
+
+    std::vector<uint8_t> data(64, 0xee);
+    ASSERT_EQ(SampleLayout::encode(msg, data.data(), data.size()), SampleLayout::SIZE);
+    data.resize(SampleLayout::SIZE);
+    ASSERT_EQ(data, expected);
+
+    ASSERT_EQ(SampleLayout::encode(msg, data.data(), 47), 0U);
+}
@@ -0,0 +1,193 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gtest/gtest.h>
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <sys/uio.h>
+
+#include "ros2_serial_example/chacha20_poly1305.hpp"
+
+using ros2_to_serial_bridge::transport::impl::ChaCha20Poly1305;
+
+/// HELPERS
+
+// The AEAD test vector of RFC 8439 section 2.8.2.
+static const char RFC_PLAINTEXT[] =
+    "Ladies and Gentlemen of the class of '99: If I could offer you only one tip for the future, "
+    "sunscreen would be it.";
+
+static const std::array<uint8_t, 12> RFC_AAD{
+    0x50, 0x51, 0x52, 0x53, 0xc0, 0xc1, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7,
+};
+
+static const std::array<uint8_t, 12> RFC_NONCE{
+    0x07, 0x00, 0x00, 0x00, 0x40, 0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47,
+};
+
+static const std::array<uint8_t, 114> RFC_CIPHERTEXT{
+    0xd3, 0x1a, 0x8d, 0x34, 0x64, 0x8e, 0x60, 0xdb, 0x7b, 0x86, 0xaf, 0xbc, 0x53, 0xef, 0x7e, 0xc2,
+    0xa4, 0xad, 0xed, 0x51, 0x29, 0x6e, 0x08, 0xfe, 0xa9, 0xe2, 0xb5, 0xa7, 0x36, 0xee, 0x62, 0xd6,
+    0x3d, 0xbe, 0xa4, 0x5e, 0x8c, 0xa9, 0x67, 0x12, 0x82, 0xfa, 0xfb, 0x69, 0xda, 0x92, 0x72, 0x8b,
+    0x1a, 0x71, 0xde, 0x0a, 0x9e, 0x06, 0x0b, 0x29, 0x05, 0xd6, 0xa5, 0xb6, 0x7e, 0xcd, 0x3b, 0x36,
+    0x92, 0xdd, 0xbd, 0x7f, 0x2d, 0x77, 0x8b, 0x8c, 0x98, 0x03, 0xae, 0xe3, 0x28, 0x09, 0x1b, 0x58,
+    0xfa, 0xb3, 0x24, 0xe4, 0xfa, 0xd6, 0x75, 0x94, 0x55, 0x85, 0x80, 0x8b, 0x48, 0x31, 0xd7, 0xbc,
+    0x3f, 0xf4, 0xde, 0xf0, 0x8e, 0x4b, 0x7a, 0x9d, 0xe5, 0x76, 0xd2, 0x65, 0x86, 0xce, 0xc6, 0x4b,
+    0x61, 0x16,
+};
+
+static const std::array<uint8_t, 16> RFC_TAG{
+    0x1a, 0xe1, 0x0b, 0x59, 0x4f, 0x09, 0xe2, 0x6a, 0x7e, 0x90, 0x2e, 0xcb, 0xd0, 0x60, 0x06, 0x91,
+};
+
+static std::array<uint8_t, 32> rfc_key()
+{
+    std::array<uint8_t, 32> key;
+    for (size_t i = 0; i < key.size(); ++i)
+    {
+        key[i] = static_cast<uint8_t>(0x80 + i);
+    }
+
+    return key;
+}
+
+static std::vector<uint8_t> make_test_data(size_t len)
+{
+    std::vector<uint8_t> data(len);
+    uint32_t x = 0x12345678;
+    for (size_t i = 0; i < len; ++i)
+    {
+        x = x * 1103515245U + 12345U;
+        data[i] = static_cast<uint8_t>(x >> 16U);
+    }
+
+    return data;
+}
+
+/// TESTS
+
+TEST(ChaCha20Poly1305, rfc8439_seal)
+{
+    ChaCha20Poly1305 aead(rfc_key().data());
+
+    size_t len = sizeof(RFC_PLAINTEXT) - 1;
+    ASSERT_EQ(len, RFC_CIPHERTEXT.size());
+    struct iovec iov{const_cast<char *>(RFC_PLAINTEXT), len};
+    std::vector<uint8_t> out(len);
+    std::array<uint8_t, ChaCha20Poly1305::TAG_LEN> tag;
+    aead.seal(RFC_NONCE.data(), RFC_AAD.data(), RFC_AAD.size(), &iov, 1, out.data(), tag.data());
+
+    ASSERT_EQ(::memcmp(out.data(), RFC_CIPHERTEXT.data(), len), 0);
+    ASSERT_EQ(tag, RFC_TAG);
+}
+
+TEST(ChaCha20Poly1305, rfc8439_open)
+{
+    ChaCha20Poly1305 aead(rfc_key().data());
+
+    std::vector<uint8_t> out(RFC_CIPHERTEXT.size());
+    ASSERT_TRUE(aead.open(RFC_NONCE.data(), RFC_AAD.data(), RFC_AAD.size(), RFC_CIPHERTEXT.data(),
+                          RFC_CIPHERTEXT.size(), out.data(), RFC_TAG.data()));
+    ASSERT_EQ(::memcmp(out.data(), RFC_PLAINTEXT, out.size()), 0);
+}
+
+TEST(ChaCha20Poly1305, split_buffers)
+{
+    // However the data is split up, it comes out the same as in one buffer.
+    ChaCha20Poly1305 aead(rfc_key().data());
+    std::vector<uint8_t> data = make_test_data(1000);
+
+    struct iovec whole{data.data(), data.size()};
+    std::vector<uint8_t> expected(data.size());
+    std::array<uint8_t, ChaCha20Poly1305::TAG_LEN> expected_tag;
+    aead.seal(RFC_NONCE.data(), nullptr, 0, &whole, 1, expected.data(), expected_tag.data());
+
+    for (size_t first : {0, 1, 15, 63, 64, 65, 500})
+    {
+        for (size_t second : {0, 7, 64, 129})
+        {
+            std::array<struct iovec, 3> iov{{
+                {data.data(), first},
+                {data.data() + first, second},
+                {data.data() + first + second, data.size() - first - second},
+            }};
+            std::vector<uint8_t> out(data.size());
+            std::array<uint8_t, ChaCha20Poly1305::TAG_LEN> tag;
+            aead.seal(RFC_NONCE.data(), nullptr, 0, iov.data(), iov.size(), out.data(), tag.data());
+            ASSERT_EQ(out, expected) << first << " " << second;
+            ASSERT_EQ(tag, expected_tag) << first << " " << second;
+        }
+    }
+}
+
+TEST(ChaCha20Poly1305, round_trip_in_place)
+{
+    ChaCha20Poly1305 aead(rfc_key().data());
+
+    for (size_t len : {0, 1, 16, 17, 64, 100, 1500})
+    {
+        std::vector<uint8_t> data = make_test_data(len);
+        struct iovec iov{data.data(), data.size()};
+        std::vector<uint8_t> buf(len);
+        std::array<uint8_t, ChaCha20Poly1305::TAG_LEN> tag;
+        aead.seal(RFC_NONCE.data(), RFC_AAD.data(), RFC_AAD.size(), &iov, len > 0 ? 1 : 0, buf.data(),
+                  tag.data());
+
+        ASSERT_TRUE(aead.open(RFC_NONCE.data(), RFC_AAD.data(), RFC_AAD.size(), buf.data(), len, buf.data(),
+                              tag.data())) << len;
+        ASSERT_EQ(buf, data) << len;
+    }
+}
+
+TEST(ChaCha20Poly1305, rejects_forgeries)
+{
+    ChaCha20Poly1305 aead(rfc_key().data());
+    std::vector<uint8_t> out(RFC_CIPHERTEXT.size(), 0xaa);
+    std::vector<uint8_t> untouched = out;
+
+    // A flipped bit anywhere in the ciphertext, associated data, nonce or tag
+    // is caught, and nothing is decrypted.
+    std::vector<uint8_t> ciphertext(RFC_CIPHERTEXT.begin(), RFC_CIPHERTEXT.end());
+    ciphertext[50] ^= 0x04;
+    ASSERT_FALSE(aead.open(RFC_NONCE.data(), RFC_AAD.data(), RFC_AAD.size(), ciphertext.data(),
+                           ciphertext.size(), out.data(), RFC_TAG.data()));
+
+    std::array<uint8_t, 12> aad = RFC_AAD;
+    aad[0] ^= 0x01;
+    ASSERT_FALSE(aead.open(RFC_NONCE.data(), aad.data(), aad.size(), RFC_CIPHERTEXT.data(),
+                           RFC_CIPHERTEXT.size(), out.data(), RFC_TAG.data()));
+
+    std::array<uint8_t, 12> nonce = RFC_NONCE;
+    nonce[11] ^= 0x80;
+    ASSERT_FALSE(aead.open(nonce.data(), RFC_AAD.data(), RFC_AAD.size(), RFC_CIPHERTEXT.data(),
+                           RFC_CIPHERTEXT.size(), out.data(), RFC_TAG.data()));
+
+    std::array<uint8_t, 16> tag = RFC_TAG;
+    tag[15] ^= 0x01;
+    ASSERT_FALSE(aead.open(RFC_NONCE.data(), RFC_AAD.data(), RFC_AAD.size(), RFC_CIPHERTEXT.data(),
+                           RFC_CIPHERTEXT.size(), out.data(), tag.data()));
+
+    // A different key doesn't open it either.
+    std::array<uint8_t, 32> key = rfc_key();
+    key[0] ^= 0x01;
+    ChaCha20Poly1305 other(key.data());
+    ASSERT_FALSE(other.open(RFC_NONCE.data(), RFC_AAD.data(), RFC_AAD.size(), RFC_CIPHERTEXT.data(),
+                            RFC_CIPHERTEXT.size(), out.data(), RFC_TAG.data()));
+
+    ASSERT_EQ(out, untouched);
+}
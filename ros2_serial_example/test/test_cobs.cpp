@@ -0,0 +1,346 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "ros2_serial_example/cobs.hpp"
+
+using ros2_to_serial_bridge::transport::impl::COBSEncoder;
+
+/// HELPERS
+
+// A straightforward encoder to check the engines against.
+static std::vector<uint8_t> cobs_reference(const uint8_t *data, size_t len)
+{
+    std::vector<uint8_t> out(1);
+    size_t code_index = 0;
+    uint8_t code = 1;
+    for (size_t i = 0; i < len; ++i)
+    {
+        if (data[i] != 0)
+        {
+            out.push_back(data[i]);
+            code++;
+        }
+        if (data[i] == 0 || code == 0xFF)
+        {
+            out[code_index] = code;
+            code = 1;
+            code_index = out.size();
+            out.push_back(0);
+        }
+    }
+    out[code_index] = code;
+
+    return out;
+}
+
+// A straightforward COBS/ZPE encoder to check the engines against.
+static std::vector<uint8_t> cobs_zpe_reference(const uint8_t *data, size_t len)
+{
+    std::vector<uint8_t> out(1);
+    size_t code_index = 0;
+    uint8_t code = 1;
+    size_t i = 0;
+    while (i < len)
+    {
+        if (data[i] != 0)
+        {
+            out.push_back(data[i++]);
+            code++;
+            if (code != COBSEncoder::ZPE_RUN_CODE)
+            {
+                continue;
+            }
+        }
+        else if (code - 1U <= COBSEncoder::ZPE_MAX_PAIR_RUN && i + 1 == len)
+        {
+            // The last 0 pairs up with the one that ends the frame.
+            out[code_index] = static_cast<uint8_t>(COBSEncoder::ZPE_PAIR_CODE + code - 1);
+            return out;
+        }
+        else if (code - 1U <= COBSEncoder::ZPE_MAX_PAIR_RUN && data[i + 1] == 0)
+        {
+            code = static_cast<uint8_t>(COBSEncoder::ZPE_PAIR_CODE + code - 1);
+            i += 2;
+        }
+        else
+        {
+            i++;
+        }
+        out[code_index] = code;
+        code = 1;
+        code_index = out.size();
+        out.push_back(0);
+    }
+    out[code_index] = code;
+
+    return out;
+}
+
+// Data with a 0 every so often; zero_every of 0 means no zeros at all.
+static std::vector<uint8_t> make_test_data(size_t len, uint32_t zero_every)
+{
+    std::vector<uint8_t> data(len);
+    uint32_t x = 0x12345678;
+    for (size_t i = 0; i < len; ++i)
+    {
+        x = x * 1103515245U + 12345U;
+        uint8_t byte = static_cast<uint8_t>(x >> 16U);
+        if (zero_every == 0)
+        {
+            data[i] = byte == 0 ? 1 : byte;
+        }
+        else
+        {
+            data[i] = (x >> 8U) % zero_every == 0 ? 0 : (byte == 0 ? 1 : byte);
+        }
+    }
+
+    return data;
+}
+
+static std::vector<uint8_t> encode(const COBSEncoder & encoder, const uint8_t *data, size_t len)
+{
+    std::vector<uint8_t> out(len + len / 254 + 1);
+    COBSEncoder::State state{};
+    encoder.stuff(&state, data, len, out.data());
+    out.resize(COBSEncoder::finish(&state, out.data()));
+
+    return out;
+}
+
+static std::vector<uint8_t> encode_zpe(const COBSEncoder & encoder, const uint8_t *data, size_t len)
+{
+    std::vector<uint8_t> out(COBSEncoder::max_encoded_length(len));
+    COBSEncoder::State state{};
+    encoder.stuff_zpe(&state, data, len, out.data());
+    out.resize(COBSEncoder::finish_zpe(&state, out.data()));
+
+    return out;
+}
+
+static std::vector<COBSEncoder::Engine> supported_engines()
+{
+    std::vector<COBSEncoder::Engine> engines;
+    for (COBSEncoder::Engine e : {COBSEncoder::Engine::BYTEWISE, COBSEncoder::Engine::WORD, COBSEncoder::Engine::SIMD})
+    {
+        if (COBSEncoder::engine_supported(e))
+        {
+            engines.push_back(e);
+        }
+    }
+
+    return engines;
+}
+
+TEST(COBSEncoder, bytewise_and_word_always_supported)
+{
+    ASSERT_TRUE(COBSEncoder::engine_supported(COBSEncoder::Engine::BYTEWISE));
+    ASSERT_TRUE(COBSEncoder::engine_supported(COBSEncoder::Engine::WORD));
+}
+
+TEST(COBSEncoder, default_engine)
+{
+    COBSEncoder encoder;
+    if (COBSEncoder::engine_supported(COBSEncoder::Engine::SIMD))
+    {
+        ASSERT_EQ(encoder.engine(), COBSEncoder::Engine::SIMD);
+    }
+    else
+    {
+        ASSERT_EQ(encoder.engine(), COBSEncoder::Engine::WORD);
+    }
+}
+
+TEST(COBSEncoder, known_values)
+{
+    const uint8_t zero[]{0x00};
+    const uint8_t zeros[]{0x00, 0x00};
+    const uint8_t mixed[]{0x11, 0x22, 0x00, 0x33};
+    for (COBSEncoder::Engine e : supported_engines())
+    {
+        COBSEncoder encoder(e);
+        ASSERT_EQ(encode(encoder, nullptr, 0), std::vector<uint8_t>({0x01}));
+        ASSERT_EQ(encode(encoder, zero, sizeof(zero)), std::vector<uint8_t>({0x01, 0x01}));
+        ASSERT_EQ(encode(encoder, zeros, sizeof(zeros)), std::vector<uint8_t>({0x01, 0x01, 0x01}));
+        ASSERT_EQ(encode(encoder, mixed, sizeof(mixed)), std::vector<uint8_t>({0x03, 0x11, 0x22, 0x02, 0x33}));
+    }
+}
+
+TEST(COBSEncoder, all_lengths)
+{
+    for (uint32_t zero_every : {0U, 2U, 7U, 40U, 300U})
+    {
+        std::vector<uint8_t> data = make_test_data(1100, zero_every);
+        for (COBSEncoder::Engine e : supported_engines())
+        {
+            COBSEncoder encoder(e);
+            for (size_t len = 0; len <= data.size(); ++len)
+            {
+                ASSERT_EQ(encode(encoder, &data[0], len), cobs_reference(&data[0], len))
+                    << "length " << len << " zero every " << zero_every;
+            }
+        }
+    }
+}
+
+TEST(COBSEncoder, block_boundaries)
+{
+    // Runs of non-zero bytes on either side of the 254 byte block length,
+    // with and without a 0 straight after them.
+    for (size_t run = 250; run <= 260; ++run)
+    {
+        for (bool trailing_zero : {false, true})
+        {
+            std::vector<uint8_t> data(run, 0x55);
+            if (trailing_zero)
+            {
+                data.push_back(0);
+            }
+            for (COBSEncoder::Engine e : supported_engines())
+            {
+                COBSEncoder encoder(e);
+                ASSERT_EQ(encode(encoder, &data[0], data.size()), cobs_reference(&data[0], data.size()))
+                    << "run " << run;
+            }
+        }
+    }
+}
+
+TEST(COBSEncoder, unaligned)
+{
+    std::vector<uint8_t> data = make_test_data(600, 90);
+    for (COBSEncoder::Engine e : supported_engines())
+    {
+        COBSEncoder encoder(e);
+        for (size_t offset = 0; offset < 32; ++offset)
+        {
+            ASSERT_EQ(encode(encoder, &data[offset], 512), cobs_reference(&data[offset], 512));
+        }
+    }
+}
+
+TEST(COBSEncoder, incremental)
+{
+    std::vector<uint8_t> data = make_test_data(1000, 300);
+    std::vector<uint8_t> expected = cobs_reference(&data[0], data.size());
+    for (COBSEncoder::Engine e : supported_engines())
+    {
+        COBSEncoder encoder(e);
+        for (size_t split = 0; split <= data.size(); split += 37)
+        {
+            std::vector<uint8_t> out(expected.size());
+            COBSEncoder::State state{};
+            encoder.stuff(&state, &data[0], split, out.data());
+            encoder.stuff(&state, &data[split], data.size() - split, out.data());
+            ASSERT_EQ(COBSEncoder::finish(&state, out.data()), expected.size());
+            ASSERT_EQ(out, expected) << "split " << split;
+        }
+    }
+}
+
+TEST(COBSEncoder, zpe_known_values)
+{
+    const uint8_t zero[]{0x00};
+    const uint8_t zeros[]{0x00, 0x00};
+    const uint8_t three_zeros[]{0x00, 0x00, 0x00};
+    const uint8_t mixed[]{0x11, 0x22, 0x00, 0x00, 0x33};
+    const uint8_t trailing[]{0x11, 0x00};
+    for (COBSEncoder::Engine e : supported_engines())
+    {
+        COBSEncoder encoder(e);
+        ASSERT_EQ(encode_zpe(encoder, nullptr, 0), std::vector<uint8_t>({0x01}));
+        ASSERT_EQ(encode_zpe(encoder, zero, sizeof(zero)), std::vector<uint8_t>({0xE1}));
+        ASSERT_EQ(encode_zpe(encoder, zeros, sizeof(zeros)), std::vector<uint8_t>({0xE1, 0x01}));
+        ASSERT_EQ(encode_zpe(encoder, three_zeros, sizeof(three_zeros)), std::vector<uint8_t>({0xE1, 0xE1}));
+        ASSERT_EQ(encode_zpe(encoder, mixed, sizeof(mixed)), std::vector<uint8_t>({0xE3, 0x11, 0x22, 0x02, 0x33}));
+        ASSERT_EQ(encode_zpe(encoder, trailing, sizeof(trailing)), std::vector<uint8_t>({0xE2, 0x11}));
+    }
+}
+
+TEST(COBSEncoder, zpe_all_lengths)
+{
+    for (uint32_t zero_every : {0U, 2U, 3U, 7U, 40U, 300U})
+    {
+        std::vector<uint8_t> data = make_test_data(1100, zero_every);
+        for (COBSEncoder::Engine e : supported_engines())
+        {
+            COBSEncoder encoder(e);
+            for (size_t len = 0; len <= data.size(); ++len)
+            {
+                std::vector<uint8_t> encoded = encode_zpe(encoder, &data[0], len);
+                ASSERT_EQ(encoded, cobs_zpe_reference(&data[0], len))
+                    << "length " << len << " zero every " << zero_every;
+                ASSERT_LE(encoded.size(), COBSEncoder::max_encoded_length(len));
+            }
+        }
+    }
+}
+
+TEST(COBSEncoder, zpe_block_boundaries)
+{
+    // Runs of non-zero bytes either side of the longest block that can end
+    // in a pair of 0s and of the longest block, followed by no, one, two or
+    // three 0s.
+    for (size_t base : {COBSEncoder::ZPE_MAX_PAIR_RUN, COBSEncoder::ZPE_MAX_RUN})
+    {
+        for (size_t run = base - 3; run <= base + 3; ++run)
+        {
+            for (size_t zeros = 0; zeros <= 3; ++zeros)
+            {
+                for (bool more : {false, true})
+                {
+                    std::vector<uint8_t> data(run, 0x55);
+                    data.resize(run + zeros, 0);
+                    if (more)
+                    {
+                        data.push_back(0x66);
+                    }
+                    for (COBSEncoder::Engine e : supported_engines())
+                    {
+                        COBSEncoder encoder(e);
+                        ASSERT_EQ(encode_zpe(encoder, &data[0], data.size()),
+                                  cobs_zpe_reference(&data[0], data.size()))
+                            << "run " << run << " zeros " << zeros;
+                    }
+                }
+            }
+        }
+    }
+}
+
+TEST(COBSEncoder, zpe_incremental)
+{
+    // Zeros are common enough that many splits fall between the two 0s of a
+    // pair.
+    std::vector<uint8_t> data = make_test_data(1000, 3);
+    std::vector<uint8_t> expected = cobs_zpe_reference(&data[0], data.size());
+    for (COBSEncoder::Engine e : supported_engines())
+    {
+        COBSEncoder encoder(e);
+        for (size_t split = 0; split <= data.size(); ++split)
+        {
+            std::vector<uint8_t> out(COBSEncoder::max_encoded_length(data.size()));
+            COBSEncoder::State state{};
+            encoder.stuff_zpe(&state, &data[0], split, out.data());
+            encoder.stuff_zpe(&state, &data[split], data.size() - split, out.data());
+            out.resize(COBSEncoder::finish_zpe(&state, out.data()));
+            ASSERT_EQ(out, expected) << "split " << split;
+        }
+    }
+}
@@ -0,0 +1,112 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+
+#include "ros2_serial_example/congestion_control.hpp"
+
+using ros2_to_serial_bridge::transport::CongestionControl;
+
+using std::chrono::microseconds;
+using std::chrono::milliseconds;
+
+/// HELPERS
+
+// Feeds a CongestionControl samples of a link that sends 1000 bytes a second,
+// one every millisecond of made up time.
+class Link final
+{
+public:
+    explicit Link(CongestionControl * cc) : cc_(cc)
+    {
+    }
+
+    // Run the link for a while with the given number of bytes waiting to go
+    // out, topping the queue up as it drains.
+    void run(milliseconds duration, ssize_t queued, int64_t rtt_us = -1)
+    {
+        for (milliseconds t(0); t < duration; t += milliseconds(1))
+        {
+            now_ += milliseconds(1);
+            written_ += 1;
+            cc_->sample(now_, queued, written_, rtt_us);
+        }
+    }
+
+private:
+    CongestionControl * cc_;
+    std::chrono::steady_clock::time_point now_{};
+    uint64_t written_{0};
+};
+
+/// TESTS
+
+TEST(CongestionControl, invalid_construction)
+{
+    ASSERT_THROW(CongestionControl(microseconds(0), milliseconds(100), 2), std::runtime_error);
+    ASSERT_THROW(CongestionControl(milliseconds(5), microseconds(0), 2), std::runtime_error);
+    ASSERT_THROW(CongestionControl(milliseconds(5), milliseconds(100), 0), std::runtime_error);
+}
+
+TEST(CongestionControl, measures_rate)
+{
+    CongestionControl cc(milliseconds(50), milliseconds(100), 3);
+    Link link(&cc);
+    ASSERT_EQ(cc.get_rate_Bps(), 0U);
+
+    // 20 bytes waiting at 1000 bytes a second is 20 ms.
+    link.run(milliseconds(100), 20);
+    ASSERT_NEAR(static_cast<double>(cc.get_rate_Bps()), 1000.0, 10.0);
+    ASSERT_NEAR(static_cast<double>(cc.get_delay_us()), 20000.0, 500.0);
+    ASSERT_EQ(cc.get_shed_levels(), 0U);
+
+    // An idle link says nothing about the rate.
+    link.run(milliseconds(100), 0);
+    ASSERT_NEAR(static_cast<double>(cc.get_rate_Bps()), 1000.0, 10.0);
+    ASSERT_EQ(cc.get_delay_us(), 0);
+}
+
+TEST(CongestionControl, sheds_and_restores)
+{
+    CongestionControl cc(milliseconds(5), milliseconds(100), 3);
+    Link link(&cc);
+
+    // 50 ms of delay; nothing happens until it has lasted an interval.
+    link.run(milliseconds(50), 50);
+    ASSERT_EQ(cc.get_shed_levels(), 0U);
+    link.run(milliseconds(100), 50);
+    ASSERT_EQ(cc.get_shed_levels(), 1U);
+
+    // The next one goes sooner, and the highest priority is never shed.
+    link.run(milliseconds(75), 50);
+    ASSERT_EQ(cc.get_shed_levels(), 2U);
+    link.run(milliseconds(500), 50);
+    ASSERT_EQ(cc.get_shed_levels(), 2U);
+
+    // Under the target, one comes back each interval.
+    link.run(milliseconds(50), 1);
+    ASSERT_EQ(cc.get_shed_levels(), 2U);
+    link.run(milliseconds(100), 1);
+    ASSERT_EQ(cc.get_shed_levels(), 1U);
+    link.run(milliseconds(100), 1);
+    ASSERT_EQ(cc.get_shed_levels(), 0U);
+}
+
+TEST(CongestionControl, round_trip_time)
+{
+    CongestionControl cc(milliseconds(5), milliseconds(100), 2);
+    Link link(&cc);
+
+    // Without a write queue to go by, the growth of the round trip time is
+    // the delay.
+    link.run(milliseconds(10), -1, 20000);
+    ASSERT_EQ(cc.get_delay_us(), 0);
+    link.run(milliseconds(10), -1, 30000);
+    ASSERT_EQ(cc.get_delay_us(), 10000);
+
+    // A sample only counts for an interval.
+    link.run(milliseconds(150), -1, 30000);
+    ASSERT_EQ(cc.get_delay_us(), 0);
+    ASSERT_EQ(cc.get_shed_levels(), 0U);
+}
@@ -0,0 +1,154 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "ros2_serial_example/crc16.hpp"
+
+using ros2_to_serial_bridge::transport::impl::CRC16;
+
+/// HELPERS
+
+// A straightforward bit-at-a-time implementation to check the engines against.
+static uint16_t crc16_bitwise(const uint8_t *data, size_t len)
+{
+    uint16_t crc = 0;
+    for (size_t i = 0; i < len; ++i)
+    {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; ++bit)
+        {
+            crc = ((crc & 1U) != 0) ? static_cast<uint16_t>((crc >> 1U) ^ 0xA001) : static_cast<uint16_t>(crc >> 1U);
+        }
+    }
+
+    return crc;
+}
+
+static std::vector<uint8_t> make_test_data(size_t len)
+{
+    std::vector<uint8_t> data(len);
+    uint32_t x = 0x12345678;
+    for (size_t i = 0; i < len; ++i)
+    {
+        x = x * 1103515245U + 12345U;
+        data[i] = static_cast<uint8_t>(x >> 16U);
+    }
+
+    return data;
+}
+
+static std::vector<CRC16::Engine> supported_engines()
+{
+    std::vector<CRC16::Engine> engines;
+    for (CRC16::Engine e : {CRC16::Engine::TABLE, CRC16::Engine::SLICING_BY_8, CRC16::Engine::CLMUL})
+    {
+        if (CRC16::engine_supported(e))
+        {
+            engines.push_back(e);
+        }
+    }
+
+    return engines;
+}
+
+TEST(CRC16, table_and_slicing_always_supported)
+{
+    ASSERT_TRUE(CRC16::engine_supported(CRC16::Engine::TABLE));
+    ASSERT_TRUE(CRC16::engine_supported(CRC16::Engine::SLICING_BY_8));
+}
+
+TEST(CRC16, default_engine)
+{
+    CRC16 crc;
+    if (CRC16::engine_supported(CRC16::Engine::CLMUL))
+    {
+        ASSERT_EQ(crc.engine(), CRC16::Engine::CLMUL);
+    }
+    else
+    {
+        ASSERT_EQ(crc.engine(), CRC16::Engine::SLICING_BY_8);
+    }
+}
+
+TEST(CRC16, update_byte)
+{
+    ASSERT_EQ(CRC16::update_byte(0, 0), 0);
+    ASSERT_EQ(CRC16::update_byte(0, 1), 0xc0c1);
+}
+
+TEST(CRC16, check_value)
+{
+    // The standard check value for CRC-16/ARC is the CRC of "123456789".
+    const uint8_t check[]{'1', '2', '3', '4', '5', '6', '7', '8', '9'};
+    for (CRC16::Engine e : supported_engines())
+    {
+        CRC16 crc(e);
+        ASSERT_EQ(crc.update(0, check, sizeof(check)), 0xBB3D);
+    }
+}
+
+TEST(CRC16, zero_length)
+{
+    for (CRC16::Engine e : supported_engines())
+    {
+        CRC16 crc(e);
+        ASSERT_EQ(crc.update(0x1234, nullptr, 0), 0x1234);
+    }
+}
+
+TEST(CRC16, all_lengths)
+{
+    std::vector<uint8_t> data = make_test_data(1100);
+    for (CRC16::Engine e : supported_engines())
+    {
+        CRC16 crc(e);
+        for (size_t len = 0; len <= data.size(); ++len)
+        {
+            ASSERT_EQ(crc.update(0, &data[0], len), crc16_bitwise(&data[0], len)) << "length " << len;
+        }
+    }
+}
+
+TEST(CRC16, unaligned)
+{
+    std::vector<uint8_t> data = make_test_data(300);
+    for (CRC16::Engine e : supported_engines())
+    {
+        CRC16 crc(e);
+        for (size_t offset = 0; offset < 16; ++offset)
+        {
+            ASSERT_EQ(crc.update(0, &data[offset], 256), crc16_bitwise(&data[offset], 256));
+        }
+    }
+}
+
+TEST(CRC16, incremental)
+{
+    std::vector<uint8_t> data = make_test_data(1000);
+    uint16_t expected = crc16_bitwise(&data[0], data.size());
+    for (CRC16::Engine e : supported_engines())
+    {
+        CRC16 crc(e);
+        for (size_t split = 0; split <= data.size(); split += 37)
+        {
+            uint16_t c = crc.update(0, &data[0], split);
+            c = crc.update(c, &data[split], data.size() - split);
+            ASSERT_EQ(c, expected) << "split " << split;
+        }
+    }
+}
@@ -0,0 +1,149 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "ros2_serial_example/crc32c.hpp"
+
+using ros2_to_serial_bridge::transport::impl::CRC32C;
+
+/// HELPERS
+
+// A straightforward bit-at-a-time implementation to check the engines against.
+static uint32_t crc32c_bitwise(const uint8_t *data, size_t len)
+{
+    uint32_t crc = 0xffffffffU;
+    for (size_t i = 0; i < len; ++i)
+    {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; ++bit)
+        {
+            crc = ((crc & 1U) != 0) ? ((crc >> 1U) ^ 0x82F63B78U) : (crc >> 1U);
+        }
+    }
+
+    return ~crc;
+}
+
+static std::vector<uint8_t> make_test_data(size_t len)
+{
+    std::vector<uint8_t> data(len);
+    uint32_t x = 0x12345678;
+    for (size_t i = 0; i < len; ++i)
+    {
+        x = x * 1103515245U + 12345U;
+        data[i] = static_cast<uint8_t>(x >> 16U);
+    }
+
+    return data;
+}
+
+static std::vector<CRC32C::Engine> supported_engines()
+{
+    std::vector<CRC32C::Engine> engines;
+    for (CRC32C::Engine e : {CRC32C::Engine::TABLE, CRC32C::Engine::SLICING_BY_8, CRC32C::Engine::HARDWARE})
+    {
+        if (CRC32C::engine_supported(e))
+        {
+            engines.push_back(e);
+        }
+    }
+
+    return engines;
+}
+
+TEST(CRC32C, table_and_slicing_always_supported)
+{
+    ASSERT_TRUE(CRC32C::engine_supported(CRC32C::Engine::TABLE));
+    ASSERT_TRUE(CRC32C::engine_supported(CRC32C::Engine::SLICING_BY_8));
+}
+
+TEST(CRC32C, default_engine)
+{
+    CRC32C crc;
+    if (CRC32C::engine_supported(CRC32C::Engine::HARDWARE))
+    {
+        ASSERT_EQ(crc.engine(), CRC32C::Engine::HARDWARE);
+    }
+    else
+    {
+        ASSERT_EQ(crc.engine(), CRC32C::Engine::SLICING_BY_8);
+    }
+}
+
+TEST(CRC32C, check_value)
+{
+    // The standard check value for CRC-32C is the CRC of "123456789".
+    const uint8_t check[]{'1', '2', '3', '4', '5', '6', '7', '8', '9'};
+    for (CRC32C::Engine e : supported_engines())
+    {
+        CRC32C crc(e);
+        ASSERT_EQ(crc.update(0, check, sizeof(check)), 0xE3069283U);
+    }
+}
+
+TEST(CRC32C, zero_length)
+{
+    for (CRC32C::Engine e : supported_engines())
+    {
+        CRC32C crc(e);
+        ASSERT_EQ(crc.update(0x12345678, nullptr, 0), 0x12345678U);
+    }
+}
+
+TEST(CRC32C, all_lengths)
+{
+    std::vector<uint8_t> data = make_test_data(1100);
+    for (CRC32C::Engine e : supported_engines())
+    {
+        CRC32C crc(e);
+        for (size_t len = 0; len <= data.size(); ++len)
+        {
+            ASSERT_EQ(crc.update(0, &data[0], len), crc32c_bitwise(&data[0], len)) << "length " << len;
+        }
+    }
+}
+
+TEST(CRC32C, unaligned)
+{
+    std::vector<uint8_t> data = make_test_data(300);
+    for (CRC32C::Engine e : supported_engines())
+    {
+        CRC32C crc(e);
+        for (size_t offset = 0; offset < 16; ++offset)
+        {
+            ASSERT_EQ(crc.update(0, &data[offset], 256), crc32c_bitwise(&data[offset], 256));
+        }
+    }
+}
+
+TEST(CRC32C, incremental)
+{
+    std::vector<uint8_t> data = make_test_data(1000);
+    uint32_t expected = crc32c_bitwise(&data[0], data.size());
+    for (CRC32C::Engine e : supported_engines())
+    {
+        CRC32C crc(e);
+        for (size_t split = 0; split <= data.size(); split += 37)
+        {
+            uint32_t c = crc.update(0, &data[0], split);
+            c = crc.update(c, &data[split], data.size() - split);
+            ASSERT_EQ(c, expected) << "split " << split;
+        }
+    }
+}
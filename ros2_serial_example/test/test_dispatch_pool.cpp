@@ -0,0 +1,230 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gtest/gtest.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "ros2_serial_example/dispatch_pool.hpp"
+
+using ros2_to_serial_bridge::transport::DispatchPool;
+
+/// HELPERS
+
+namespace
+{
+
+constexpr size_t NUM_TOPICS = 8;
+constexpr uint32_t MESSAGES_PER_TOPIC = 5000;
+
+// Each payload is its sequence number, followed by a pattern that depends on
+// it, so that a payload that was torn or wrapped wrongly doesn't check out.
+std::vector<uint8_t> make_payload(uint32_t seq)
+{
+    std::vector<uint8_t> payload(sizeof(seq) + seq % 61);
+    ::memcpy(payload.data(), &seq, sizeof(seq));
+    for (size_t i = sizeof(seq); i < payload.size(); ++i)
+    {
+        payload[i] = static_cast<uint8_t>(seq + i);
+    }
+    return payload;
+}
+
+bool check_payload(const uint8_t * buffer, size_t length, uint32_t * seq)
+{
+    if (length < sizeof(*seq))
+    {
+        return false;
+    }
+    ::memcpy(seq, buffer, sizeof(*seq));
+    std::vector<uint8_t> expected = make_payload(*seq);
+    return expected.size() == length && ::memcmp(expected.data(), buffer, length) == 0;
+}
+
+bool wait_for(const std::function<bool()> & done)
+{
+    for (int i = 0; i < 5000 && !done(); ++i)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return done();
+}
+
+}  // namespace
+
+/// TESTS
+
+TEST(DispatchPool, invalid)
+{
+    auto handler = [](size_t, uint16_t, topic_id_size_t, uint8_t *, size_t, std::chrono::system_clock::time_point) {};
+    ASSERT_THROW(DispatchPool(0, 1024, handler), std::runtime_error);
+    ASSERT_THROW(DispatchPool(1, 8, handler), std::runtime_error);
+}
+
+TEST(DispatchPool, per_topic_order)
+{
+    // Only the worker of a topic touches its slot, so no locking is needed.
+    struct TopicState
+    {
+        uint32_t next{0};
+        size_t worker{SIZE_MAX};
+        uint64_t errors{0};
+    };
+    std::array<TopicState, NUM_TOPICS> topics;
+    std::atomic<uint64_t> handled{0};
+    auto start = std::chrono::system_clock::now();
+
+    DispatchPool pool(3, 1024, [&](size_t worker, uint16_t source, topic_id_size_t topic_ID, uint8_t * buffer, size_t length,
+                                   std::chrono::system_clock::time_point receive_time) {
+        TopicState & state = topics[topic_ID];
+        uint32_t seq = 0;
+        if (source != 7 || !check_payload(buffer, length, &seq) || seq != state.next ||
+            (state.worker != SIZE_MAX && state.worker != worker) || receive_time != start + std::chrono::microseconds(seq))
+        {
+            ++state.errors;
+        }
+        state.next = seq + 1;
+        state.worker = worker;
+        ++handled;
+    });
+    ASSERT_EQ(pool.workers(), 3U);
+
+    // The queues are small, so they wrap all the time and sometimes fill up;
+    // a full queue just means trying again.
+    for (uint32_t seq = 0; seq < MESSAGES_PER_TOPIC; ++seq)
+    {
+        std::vector<uint8_t> payload = make_payload(seq);
+        for (topic_id_size_t topic_ID = 0; topic_ID < NUM_TOPICS; ++topic_ID)
+        {
+            while (!pool.push(7, topic_ID, payload.data(), payload.size(), start + std::chrono::microseconds(seq)))
+            {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    ASSERT_TRUE(wait_for([&handled]() {return handled == NUM_TOPICS * MESSAGES_PER_TOPIC;}));
+    pool.stop();
+    for (const auto & state : topics)
+    {
+        ASSERT_EQ(state.errors, 0U);
+        ASSERT_EQ(state.next, MESSAGES_PER_TOPIC);
+    }
+}
+
+TEST(DispatchPool, full_queue_drops)
+{
+    std::mutex mutex;
+    std::unique_lock<std::mutex> hold(mutex);
+    std::atomic<uint64_t> handled{0};
+
+    DispatchPool pool(1, 256, [&](size_t, uint16_t, topic_id_size_t, uint8_t *, size_t, std::chrono::system_clock::time_point) {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++handled;
+    });
+
+    // The worker is stuck in the handler on the first payload, so the queue
+    // fills up behind it.
+    uint8_t payload[48]{};
+    size_t pushed = 0;
+    while (pool.push(0, 2, payload, sizeof(payload), std::chrono::system_clock::time_point()))
+    {
+        ++pushed;
+        ASSERT_LT(pushed, 100U);
+    }
+    ASSERT_GT(pushed, 1U);
+
+    // A payload that could never fit is refused straight away.
+    std::vector<uint8_t> big(1024);
+    ASSERT_FALSE(pool.push(0, 3, big.data(), big.size(), std::chrono::system_clock::time_point()));
+
+    hold.unlock();
+    ASSERT_TRUE(wait_for([&handled, pushed]() {return handled == pushed;}));
+
+    // Once the worker has caught up, there is room again.
+    ASSERT_TRUE(pool.push(0, 2, payload, sizeof(payload), std::chrono::system_clock::time_point()));
+    ASSERT_TRUE(wait_for([&handled, pushed]() {return handled == pushed + 1;}));
+}
+
+TEST(DispatchPool, priority_workers)
+{
+    std::mutex mutex;
+    std::unique_lock<std::mutex> hold(mutex);
+    std::atomic<uint64_t> handled{0};
+    std::atomic<uint64_t> priority_handled{0};
+
+    DispatchPool pool(1, 1024, [&](size_t worker, uint16_t, topic_id_size_t topic_ID, uint8_t *, size_t,
+                                   std::chrono::system_clock::time_point) {
+        if (topic_ID == 9)
+        {
+            ASSERT_EQ(worker, 1U);
+            ++priority_handled;
+            return;
+        }
+        ASSERT_EQ(worker, 0U);
+        std::lock_guard<std::mutex> lock(mutex);
+        ++handled;
+    }, 0, 1);
+    ASSERT_EQ(pool.workers(), 2U);
+    ASSERT_EQ(pool.priority_workers(), 1U);
+
+    // The worker for the other topics is stuck behind a backlog, but the
+    // priority topic has a worker of its own.
+    uint8_t payload[16]{};
+    for (size_t i = 0; i < 4; ++i)
+    {
+        ASSERT_TRUE(pool.push(0, 2, payload, sizeof(payload), std::chrono::system_clock::time_point()));
+    }
+    ASSERT_TRUE(pool.push(0, 9, payload, sizeof(payload), std::chrono::system_clock::time_point(), 1));
+    ASSERT_TRUE(wait_for([&priority_handled]() {return priority_handled == 1;}));
+    ASSERT_EQ(handled, 0U);
+
+    hold.unlock();
+    ASSERT_TRUE(wait_for([&handled]() {return handled == 4;}));
+}
+
+TEST(DispatchPool, wait_handled)
+{
+    std::atomic<uint64_t> handled{0};
+    DispatchPool pool(2, 4096, [&](size_t, uint16_t, topic_id_size_t, uint8_t *, size_t, std::chrono::system_clock::time_point) {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+        ++handled;
+    });
+
+    ASSERT_TRUE(pool.wait_handled());
+
+    // Once it returns, everything pushed before it has been handled.
+    uint8_t payload[8]{};
+    for (uint64_t round = 1; round <= 3; ++round)
+    {
+        for (topic_id_size_t topic_ID = 0; topic_ID < 10; ++topic_ID)
+        {
+            ASSERT_TRUE(pool.push(0, topic_ID, payload, sizeof(payload), std::chrono::system_clock::time_point()));
+        }
+        ASSERT_TRUE(pool.wait_handled());
+        ASSERT_EQ(handled, round * 10);
+    }
+
+    pool.stop();
+    ASSERT_TRUE(pool.wait_handled());
+}
@@ -0,0 +1,245 @@
+#include <gtest/gtest.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "ros2_serial_example/emulated_link_transporter.hpp"
+
+#include "transporter_test_helpers.hpp"
+
+using ros2_to_serial_bridge::transport::EmulatedLinkTransporter;
+using ros2_to_serial_bridge::transport::LinkImpairments;
+
+/// HELPERS
+
+using Pair = std::pair<std::unique_ptr<EmulatedLinkTransporter>, std::unique_ptr<EmulatedLinkTransporter>>;
+
+static Pair make_pair(const std::string & protocol, const LinkImpairments & imp, uint32_t read_poll_ms = 10)
+{
+    Pair link = EmulatedLinkTransporter::create_pair(protocol, imp, LinkImpairments(), read_poll_ms, 65536);
+    EXPECT_EQ(link.first->init(), 0);
+    EXPECT_EQ(link.second->init(), 0);
+    return link;
+}
+
+// Write count messages of len bytes each from a over a damaged link, and
+// count how many of them come out whole at b.
+static size_t count_delivered(Pair & link, size_t count, size_t len)
+{
+    std::vector<uint8_t> data(len);
+    for (size_t i = 0; i < count; ++i)
+    {
+        data[0] = static_cast<uint8_t>(i);
+        EXPECT_EQ(link.first->write(0x5, data.data(), data.size()), static_cast<ssize_t>(len));
+    }
+
+    size_t delivered = 0;
+    topic_id_size_t topic_ID;
+    std::vector<uint8_t> buffer(len + 64);
+    // A damaged frame reads as no data too, so only give up once nothing
+    // has come in for a while.
+    std::chrono::steady_clock::time_point idle_since = std::chrono::steady_clock::now();
+    while (std::chrono::steady_clock::now() - idle_since < std::chrono::milliseconds(50))
+    {
+        ssize_t ret = link.second->read(&topic_ID, buffer.data(), buffer.size());
+        if (ret == static_cast<ssize_t>(len) && topic_ID == 0x5)
+        {
+            delivered++;
+            idle_since = std::chrono::steady_clock::now();
+        }
+    }
+
+    return delivered;
+}
+
+/// TESTS
+
+TEST(EmulatedLinkTransporter, invalid_args)
+{
+    LinkImpairments imp;
+    imp.bit_error_rate = 1.5;
+    ASSERT_THROW(EmulatedLinkTransporter::create_pair("px4", imp, LinkImpairments(), 10, 1024), std::runtime_error);
+
+    imp = LinkImpairments();
+    imp.byte_error_rate = -0.1;
+    ASSERT_THROW(EmulatedLinkTransporter::create_pair("px4", LinkImpairments(), imp, 10, 1024), std::runtime_error);
+
+    imp = LinkImpairments();
+    imp.burst_length = 0.5;
+    ASSERT_THROW(EmulatedLinkTransporter::create_pair("px4", imp, LinkImpairments(), 10, 1024), std::runtime_error);
+
+    imp = LinkImpairments();
+    imp.jitter = std::chrono::microseconds(-1);
+    ASSERT_THROW(EmulatedLinkTransporter::create_pair("px4", imp, LinkImpairments(), 10, 1024), std::runtime_error);
+}
+
+TEST(EmulatedLinkTransporter, round_trip)
+{
+    Pair link = make_pair("px4", LinkImpairments());
+
+    topic_id_size_t topic_ID;
+    uint8_t buffer[64]{};
+
+    // Nothing has been written yet, so reads time out.
+    ASSERT_EQ(link.second->read(&topic_ID, buffer, sizeof(buffer)), -ENODATA);
+
+    uint8_t data[3]{0x1, 0x2, 0x3};
+    ASSERT_EQ(link.first->write(0x5, data, sizeof(data)), static_cast<ssize_t>(sizeof(data)));
+    ASSERT_EQ(read_message(*link.second, &topic_ID, buffer, sizeof(buffer)), static_cast<ssize_t>(sizeof(data)));
+    ASSERT_EQ(topic_ID, 0x5);
+    ASSERT_EQ(buffer[0], 0x1);
+    ASSERT_EQ(buffer[2], 0x3);
+
+    uint8_t data2[2]{0x4, 0x5};
+    ASSERT_EQ(link.second->write(0x6, data2, sizeof(data2)), static_cast<ssize_t>(sizeof(data2)));
+    ASSERT_EQ(read_message(*link.first, &topic_ID, buffer, sizeof(buffer)), static_cast<ssize_t>(sizeof(data2)));
+    ASSERT_EQ(topic_ID, 0x6);
+    ASSERT_EQ(buffer[1], 0x5);
+
+    ASSERT_EQ(link.first->get_link_stats().bytes_lost, 0U);
+    ASSERT_EQ(link.first->get_link_stats().bits_flipped, 0U);
+}
+
+TEST(EmulatedLinkTransporter, delay)
+{
+    LinkImpairments imp;
+    imp.delay = std::chrono::milliseconds(50);
+    Pair link = make_pair("cobs", imp);
+
+    uint8_t data[3]{0x1, 0x2, 0x3};
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    ASSERT_EQ(link.first->write(0x5, data, sizeof(data)), static_cast<ssize_t>(sizeof(data)));
+
+    topic_id_size_t topic_ID;
+    uint8_t buffer[64]{};
+    ASSERT_EQ(read_message(*link.second, &topic_ID, buffer, sizeof(buffer)), static_cast<ssize_t>(sizeof(data)));
+    ASSERT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(50));
+}
+
+TEST(EmulatedLinkTransporter, baudrate)
+{
+    // 20 kB at 1 Mbaud takes 200 ms to send, and the writer can only get
+    // TX_BUFFER_BYTES ahead of the line.
+    LinkImpairments imp;
+    imp.baudrate = 1000000;
+    Pair link = make_pair("px4", imp);
+    ASSERT_EQ(link.first->get_baudrate(), 1000000U);
+
+    std::vector<uint8_t> data(1000);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 20; ++i)
+    {
+        ASSERT_EQ(link.first->write(0x5, data.data(), data.size()), static_cast<ssize_t>(data.size()));
+        ASSERT_LE(link.first->get_write_queue_bytes(),
+                  static_cast<ssize_t>(EmulatedLinkTransporter::TX_BUFFER_BYTES + 2 * data.size()));
+    }
+    ASSERT_GT(link.first->get_write_queue_bytes(), 0);
+
+    topic_id_size_t topic_ID;
+    std::vector<uint8_t> buffer(2000);
+    for (int i = 0; i < 20; ++i)
+    {
+        ASSERT_EQ(read_message(*link.second, &topic_ID, buffer.data(), buffer.size()),
+                  static_cast<ssize_t>(data.size()));
+    }
+    ASSERT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(200));
+}
+
+TEST(EmulatedLinkTransporter, mtu)
+{
+    LinkImpairments imp;
+    imp.mtu = 64;
+    Pair link = EmulatedLinkTransporter::create_pair("v2", imp, imp, 10, 65536);
+    ASSERT_EQ(link.first->init(), 0);
+    ASSERT_EQ(link.second->init(), 0);
+
+    // A frame that doesn't fit in a packet fails.
+    uint8_t big[100]{};
+    ASSERT_EQ(link.first->write(0x5, big, sizeof(big)), -1);
+    ASSERT_EQ(link.first->get_link_stats().oversize_packets, 1U);
+
+    uint8_t data[3]{0x1, 0x2, 0x3};
+    ASSERT_EQ(link.first->write(0x5, data, sizeof(data)), static_cast<ssize_t>(sizeof(data)));
+    topic_id_size_t topic_ID;
+    uint8_t buffer[64]{};
+    ASSERT_EQ(read_message(*link.second, &topic_ID, buffer, sizeof(buffer)), static_cast<ssize_t>(sizeof(data)));
+    ASSERT_EQ(topic_ID, 0x5);
+    ASSERT_EQ(buffer[1], 0x2);
+}
+
+TEST(EmulatedLinkTransporter, same_seed_same_errors)
+{
+    LinkImpairments imp;
+    imp.bit_error_rate = 1e-4;
+    imp.byte_error_rate = 1e-4;
+    imp.burst_rate = 1e-4;
+    imp.burst_length = 20;
+    imp.seed = 42;
+
+    Pair one = make_pair("v2", imp);
+    Pair two = make_pair("v2", imp);
+    size_t delivered_one = count_delivered(one, 200, 200);
+    size_t delivered_two = count_delivered(two, 200, 200);
+
+    // Some messages are damaged, and exactly the same ones each time.
+    ASSERT_LT(delivered_one, 200U);
+    ASSERT_GT(delivered_one, 100U);
+    ASSERT_EQ(delivered_one, delivered_two);
+
+    EmulatedLinkTransporter::Stats stats_one = one.first->get_link_stats();
+    EmulatedLinkTransporter::Stats stats_two = two.first->get_link_stats();
+    ASSERT_EQ(stats_one.bytes_written, stats_two.bytes_written);
+    ASSERT_EQ(stats_one.bytes_lost, stats_two.bytes_lost);
+    ASSERT_EQ(stats_one.bits_flipped, stats_two.bits_flipped);
+    ASSERT_EQ(stats_one.bytes_replaced, stats_two.bytes_replaced);
+    ASSERT_GT(stats_one.bits_flipped, 0U);
+}
+
+TEST(EmulatedLinkTransporter, error_rates)
+{
+    // Over a megabyte the counts come out close to what the rates say.  With
+    // bursts starting at 1 in 1000 bytes and lasting for 50 on average, 1 in
+    // 21 bytes is lost.
+    LinkImpairments imp;
+    imp.bit_error_rate = 1e-3;
+    imp.byte_error_rate = 1e-3;
+    imp.burst_rate = 1e-3;
+    imp.burst_length = 50;
+    Pair link = make_pair("px4", imp);
+
+    std::vector<uint8_t> data(1000);
+    for (int i = 0; i < 1000; ++i)
+    {
+        ASSERT_EQ(link.first->write(0x5, data.data(), data.size()), static_cast<ssize_t>(data.size()));
+    }
+
+    EmulatedLinkTransporter::Stats stats = link.first->get_link_stats();
+    double bytes = static_cast<double>(stats.bytes_written);
+    double kept = bytes - stats.bytes_lost;
+    ASSERT_NEAR(stats.bytes_lost / bytes, 1.0 / 21.0, 0.01);
+    ASSERT_NEAR(stats.bits_flipped / (kept * 8), 1e-3, 1e-4);
+    ASSERT_NEAR(stats.bytes_replaced / kept, 1e-3, 2e-4);
+}
+
+TEST(EmulatedLinkTransporter, packet_loss)
+{
+    // With an MTU, losses take whole packets.
+    LinkImpairments imp;
+    imp.mtu = 1500;
+    imp.burst_rate = 0.1;
+    Pair link = EmulatedLinkTransporter::create_pair("v2", imp, imp, 10, 65536);
+    ASSERT_EQ(link.first->init(), 0);
+    ASSERT_EQ(link.second->init(), 0);
+
+    size_t delivered = count_delivered(link, 200, 100);
+    EmulatedLinkTransporter::Stats stats = link.first->get_link_stats();
+    ASSERT_EQ(stats.bytes_lost % (stats.bytes_written / 200), 0U);
+    ASSERT_EQ(delivered, 200 - stats.bytes_lost / (stats.bytes_written / 200));
+    ASSERT_GT(delivered, 150U);
+    ASSERT_LT(delivered, 200U);
+}
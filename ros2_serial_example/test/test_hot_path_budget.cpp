@@ -0,0 +1,325 @@
+#include <gtest/gtest.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ros2_serial_example/alloc_guard.hpp"
+#include "ros2_serial_example/uart_transporter.hpp"
+
+using ros2_to_serial_bridge::transport::AllocGuardMode;
+using ros2_to_serial_bridge::transport::HotPathScope;
+using ros2_to_serial_bridge::transport::UARTTransporter;
+using ros2_to_serial_bridge::transport::get_hot_path_allocations;
+using ros2_to_serial_bridge::transport::set_alloc_guard_mode;
+
+/// HELPERS
+
+namespace
+{
+
+// The system calls made by the calling thread while counting is on.
+struct SyscallCounts
+{
+    uint64_t reads{0};
+    uint64_t writes{0};
+    uint64_t waits{0};
+};
+
+thread_local bool counting = false;
+thread_local SyscallCounts counts;
+
+}  // namespace
+
+// These stand in for the C library's wrappers for everything linked into
+// this test, so the calls the transporter makes can be counted.  They go
+// straight to the kernel, as the wrappers do.
+extern "C" ssize_t read(int fd, void *buf, size_t count)
+{
+    if (counting)
+    {
+        counts.reads++;
+    }
+    return ::syscall(SYS_read, fd, buf, count);
+}
+
+extern "C" ssize_t write(int fd, const void *buf, size_t count)
+{
+    if (counting)
+    {
+        counts.writes++;
+    }
+    return ::syscall(SYS_write, fd, buf, count);
+}
+
+extern "C" ssize_t writev(int fd, const struct iovec *iov, int iovcnt)
+{
+    if (counting)
+    {
+        counts.writes++;
+    }
+    return ::syscall(SYS_writev, fd, iov, iovcnt);
+}
+
+extern "C" int poll(struct pollfd *fds, nfds_t nfds, int timeout)
+{
+    if (counting)
+    {
+        counts.waits++;
+    }
+    struct timespec ts{timeout / 1000, (timeout % 1000) * 1000000L};
+    return ::syscall(SYS_ppoll, fds, nfds, (timeout < 0) ? nullptr : &ts, nullptr, _NSIG / 8);
+}
+
+extern "C" int epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout)
+{
+    if (counting)
+    {
+        counts.waits++;
+    }
+    return ::syscall(SYS_epoll_pwait, epfd, events, maxevents, timeout, nullptr, _NSIG / 8);
+}
+
+namespace
+{
+
+// Everything that happens on the calling thread while this object lives is
+// counted against the budget: allocations, through the allocation guard,
+// and system calls, through the wrappers above.
+class Budget final
+{
+public:
+    Budget() : allocations_(get_hot_path_allocations())
+    {
+        counts = SyscallCounts();
+        counting = true;
+    }
+
+    ~Budget()
+    {
+        counting = false;
+    }
+
+    uint64_t allocations() const
+    {
+        return get_hot_path_allocations() - allocations_;
+    }
+
+    const SyscallCounts & syscalls() const
+    {
+        return counts;
+    }
+
+private:
+    HotPathScope hot_path_;
+    uint64_t allocations_;
+};
+
+// How many frames each pass sends and receives.
+constexpr size_t FRAMES = 64;
+
+// Once warm, the receive side may make at most one read (and one wait) per
+// this many frames that come in together.
+constexpr size_t FRAMES_PER_READ = 8;
+
+// A pseudo-terminal stands in for the serial port, as in
+// test_uart_transporter.cpp.  The frames the transporter sends are recorded
+// from the master side and played back to it, so both directions run through
+// the real transporter code and system calls.
+class HotPathBudgetFixture : public testing::Test
+{
+public:
+    void SetUp() override
+    {
+        master_fd_ = ::posix_openpt(O_RDWR | O_NOCTTY);
+        ASSERT_GE(master_fd_, 0);
+        ASSERT_EQ(::grantpt(master_fd_), 0);
+        ASSERT_EQ(::unlockpt(master_fd_), 0);
+        slave_name_ = ::ptsname(master_fd_);
+
+        struct termios tio{};
+        ASSERT_EQ(::tcgetattr(master_fd_, &tio), 0);
+        ::cfmakeraw(&tio);
+        ASSERT_EQ(::tcsetattr(master_fd_, TCSANOW, &tio), 0);
+
+        ASSERT_TRUE(set_alloc_guard_mode(AllocGuardMode::LOG));
+    }
+
+    void TearDown() override
+    {
+        set_alloc_guard_mode(AllocGuardMode::OFF);
+        ::close(master_fd_);
+    }
+
+protected:
+    // Send FRAMES messages, and return the bytes that came out on the wire.
+    std::vector<uint8_t> send(UARTTransporter & trans)
+    {
+        uint8_t payload[24]{};
+        for (size_t i = 0; i < FRAMES; ++i)
+        {
+            payload[0] = static_cast<uint8_t>(i);
+            EXPECT_EQ(trans.write(0x5, payload, sizeof(payload)), static_cast<ssize_t>(sizeof(payload)));
+        }
+        EXPECT_GE(trans.flush(), 0);
+
+        return record();
+    }
+
+    // Take out everything the transporter has sent so far.
+    std::vector<uint8_t> record()
+    {
+        std::vector<uint8_t> recording;
+        uint8_t buf[4096];
+        struct pollfd pfd{master_fd_, POLLIN, 0};
+        while (::poll(&pfd, 1, 100) == 1)
+        {
+            ssize_t n = ::read(master_fd_, buf, sizeof(buf));
+            if (n <= 0)
+            {
+                break;
+            }
+            recording.insert(recording.end(), buf, buf + n);
+        }
+
+        return recording;
+    }
+
+    void play(const std::vector<uint8_t> & recording)
+    {
+        ASSERT_EQ(::write(master_fd_, recording.data(), recording.size()),
+                  static_cast<ssize_t>(recording.size()));
+    }
+
+    int master_fd_{-1};
+    std::string slave_name_;
+};
+
+// Read FRAMES messages with read(), checking each is in order.
+void receive(UARTTransporter & trans)
+{
+    topic_id_size_t topic_ID;
+    uint8_t buf[64];
+    size_t received = 0;
+    for (int i = 0; i < 1000 && received < FRAMES; ++i)
+    {
+        ssize_t ret = trans.read(&topic_ID, buf, sizeof(buf));
+        if (ret == -ENODATA)
+        {
+            continue;
+        }
+        ASSERT_EQ(ret, 24);
+        ASSERT_EQ(topic_ID, 0x5);
+        ASSERT_EQ(buf[0], static_cast<uint8_t>(received));
+        received++;
+    }
+    ASSERT_EQ(received, FRAMES);
+}
+
+// Read FRAMES messages with read_many().
+void receive_many(UARTTransporter & trans)
+{
+    uint8_t buf[64];
+    size_t received = 0;
+    for (int i = 0; i < 1000 && received < FRAMES; ++i)
+    {
+        ASSERT_GE(trans.read_many(buf, sizeof(buf), [&](topic_id_size_t topic_ID, uint8_t *payload, size_t len) {
+            EXPECT_EQ(topic_ID, 0x5);
+            EXPECT_EQ(len, 24U);
+            EXPECT_EQ(payload[0], static_cast<uint8_t>(received));
+            received++;
+        }), 0);
+    }
+    ASSERT_EQ(received, FRAMES);
+}
+
+}  // namespace
+
+/// TESTS
+
+TEST_F(HotPathBudgetFixture, read_px4)
+{
+    UARTTransporter trans(slave_name_, "px4", 115200, 100, 4096);
+    ASSERT_EQ(trans.init(), 0);
+
+    // The first pass warms up the metrics and anything else that is set up
+    // on first use.
+    std::vector<uint8_t> recording = send(trans);
+    play(recording);
+    receive(trans);
+
+    play(recording);
+    Budget budget;
+    receive(trans);
+    ASSERT_EQ(budget.allocations(), 0U);
+    ASSERT_LE(budget.syscalls().reads, FRAMES / FRAMES_PER_READ);
+    ASSERT_LE(budget.syscalls().waits, FRAMES / FRAMES_PER_READ);
+    ASSERT_EQ(budget.syscalls().writes, 0U);
+}
+
+TEST_F(HotPathBudgetFixture, read_many_cobs)
+{
+    UARTTransporter trans(slave_name_, "cobs", 115200, 100, 4096);
+    ASSERT_EQ(trans.init(), 0);
+
+    std::vector<uint8_t> recording = send(trans);
+    play(recording);
+    receive_many(trans);
+
+    play(recording);
+    Budget budget;
+    receive_many(trans);
+    ASSERT_EQ(budget.allocations(), 0U);
+    ASSERT_LE(budget.syscalls().reads, FRAMES / FRAMES_PER_READ);
+    ASSERT_LE(budget.syscalls().waits, FRAMES / FRAMES_PER_READ);
+    ASSERT_EQ(budget.syscalls().writes, 0U);
+}
+
+TEST_F(HotPathBudgetFixture, write)
+{
+    UARTTransporter trans(slave_name_, "px4", 115200, 100, 4096);
+    ASSERT_EQ(trans.init(), 0);
+    send(trans);
+
+    // Without batching, each frame takes exactly one write.
+    {
+        Budget budget;
+        uint8_t payload[24]{};
+        for (size_t i = 0; i < FRAMES; ++i)
+        {
+            ASSERT_EQ(trans.write(0x5, payload, sizeof(payload)), static_cast<ssize_t>(sizeof(payload)));
+        }
+        ASSERT_EQ(budget.allocations(), 0U);
+        ASSERT_EQ(budget.syscalls().writes, FRAMES);
+        ASSERT_EQ(budget.syscalls().reads, 0U);
+    }
+    record();
+
+    // With batching, the 15 frames that fit in a batch share a write.
+    ASSERT_EQ(trans.set_write_batching(512), 0);
+    send(trans);
+    {
+        Budget budget;
+        uint8_t payload[24]{};
+        for (size_t i = 0; i < FRAMES; ++i)
+        {
+            ASSERT_EQ(trans.write(0x5, payload, sizeof(payload)), static_cast<ssize_t>(sizeof(payload)));
+        }
+        ASSERT_GE(trans.flush(), 0);
+        ASSERT_EQ(budget.allocations(), 0U);
+        ASSERT_LE(budget.syscalls().writes, FRAMES / FRAMES_PER_READ);
+    }
+    record();
+}
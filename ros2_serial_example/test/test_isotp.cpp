@@ -0,0 +1,190 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <vector>
+
+#include <linux/can.h>
+
+#include "ros2_serial_example/isotp.hpp"
+
+using ros2_to_serial_bridge::transport::impl::IsoTp;
+
+/// HELPERS
+
+static std::vector<uint8_t> make_data(size_t len)
+{
+    std::vector<uint8_t> data(len);
+    for (size_t i = 0; i < len; ++i)
+    {
+        data[i] = static_cast<uint8_t>(i * 7 + 3);
+    }
+
+    return data;
+}
+
+static std::vector<struct canfd_frame> segment(const std::vector<uint8_t> & data)
+{
+    std::vector<struct canfd_frame> frames(IsoTp::frame_count(data.size()));
+    EXPECT_EQ(IsoTp::segment(data.data(), data.size(), 0x123, frames.data()), frames.size());
+
+    return frames;
+}
+
+/// TESTS
+
+TEST(IsoTp, frame_counts)
+{
+    ASSERT_EQ(IsoTp::frame_count(1), 1U);
+    ASSERT_EQ(IsoTp::frame_count(62), 1U);
+    ASSERT_EQ(IsoTp::frame_count(63), 2U);
+    ASSERT_EQ(IsoTp::frame_count(62 + 63), 2U);
+    ASSERT_EQ(IsoTp::frame_count(62 + 64), 3U);
+    ASSERT_EQ(IsoTp::frame_count(4095), 66U);
+    ASSERT_EQ(IsoTp::frame_count(4096), 66U);
+}
+
+TEST(IsoTp, padded_lengths)
+{
+    ASSERT_EQ(IsoTp::padded_length(0), 0);
+    ASSERT_EQ(IsoTp::padded_length(8), 8);
+    ASSERT_EQ(IsoTp::padded_length(9), 12);
+    ASSERT_EQ(IsoTp::padded_length(21), 24);
+    ASSERT_EQ(IsoTp::padded_length(25), 32);
+    ASSERT_EQ(IsoTp::padded_length(33), 48);
+    ASSERT_EQ(IsoTp::padded_length(49), 64);
+}
+
+TEST(IsoTp, single_frames)
+{
+    // Up to 7 bytes go in a classic single frame, padded to 8 bytes.
+    std::vector<struct canfd_frame> frames = segment(make_data(3));
+    ASSERT_EQ(frames.size(), 1U);
+    ASSERT_EQ(frames[0].can_id, 0x123U);
+    ASSERT_EQ(frames[0].len, 8);
+    ASSERT_EQ(frames[0].data[0], 0x03);
+    ASSERT_EQ(frames[0].data[4], IsoTp::PADDING);
+
+    // Longer ones have the length in the second byte.
+    frames = segment(make_data(40));
+    ASSERT_EQ(frames.size(), 1U);
+    ASSERT_EQ(frames[0].len, 48);
+    ASSERT_EQ(frames[0].data[0], 0x00);
+    ASSERT_EQ(frames[0].data[1], 40);
+}
+
+TEST(IsoTp, segmented_frames)
+{
+    std::vector<struct canfd_frame> frames = segment(make_data(200));
+    ASSERT_EQ(frames.size(), 4U);
+    ASSERT_EQ(frames[0].len, 64);
+    ASSERT_EQ(frames[0].data[0], 0x10);
+    ASSERT_EQ(frames[0].data[1], 200);
+    ASSERT_EQ(frames[1].len, 64);
+    ASSERT_EQ(frames[1].data[0], 0x21);
+    ASSERT_EQ(frames[2].data[0], 0x22);
+    // 200 - 62 - 63 - 63 = 12 bytes, plus the header, padded to 16.
+    ASSERT_EQ(frames[3].len, 16);
+    ASSERT_EQ(frames[3].data[0], 0x23);
+
+    // Over 4095 bytes, the length takes 32 bits.
+    frames = segment(make_data(5000));
+    ASSERT_EQ(frames[0].data[0], 0x10);
+    ASSERT_EQ(frames[0].data[1], 0x00);
+    ASSERT_EQ(frames[0].data[4], 5000 >> 8);
+    ASSERT_EQ(frames[0].data[5], 5000 & 0xFF);
+    // The sequence number wraps from 15 to 0.
+    ASSERT_EQ(frames[15].data[0], 0x2F);
+    ASSERT_EQ(frames[16].data[0], 0x20);
+}
+
+TEST(IsoTp, round_trip)
+{
+    IsoTp::Reassembler reassembler(10000);
+
+    for (size_t len : {1, 7, 8, 62, 63, 200, 4095, 4096, 5000})
+    {
+        std::vector<uint8_t> data = make_data(len);
+        std::vector<struct canfd_frame> frames = segment(data);
+
+        for (size_t i = 0; i < frames.size(); ++i)
+        {
+            IsoTp::Reassembler::Result result = reassembler.push(frames[i].data, frames[i].len);
+            if (i + 1 < frames.size())
+            {
+                ASSERT_EQ(result, (i == 0) ? IsoTp::Reassembler::Result::FIRST_FRAME :
+                                             IsoTp::Reassembler::Result::PENDING);
+            }
+            else
+            {
+                ASSERT_EQ(result, IsoTp::Reassembler::Result::COMPLETE);
+            }
+        }
+        ASSERT_EQ(std::vector<uint8_t>(reassembler.message(), reassembler.message() + reassembler.message_length()),
+                  data);
+    }
+}
+
+TEST(IsoTp, lost_frame)
+{
+    IsoTp::Reassembler reassembler(10000);
+    std::vector<struct canfd_frame> frames = segment(make_data(300));
+
+    // Missing a consecutive frame drops the message, and the ones after it.
+    ASSERT_EQ(reassembler.push(frames[0].data, frames[0].len), IsoTp::Reassembler::Result::FIRST_FRAME);
+    ASSERT_EQ(reassembler.push(frames[2].data, frames[2].len), IsoTp::Reassembler::Result::ERROR);
+    ASSERT_EQ(reassembler.push(frames[3].data, frames[3].len), IsoTp::Reassembler::Result::ERROR);
+
+    // The next message starts afresh.
+    std::vector<uint8_t> data = make_data(20);
+    frames = segment(data);
+    ASSERT_EQ(reassembler.push(frames[0].data, frames[0].len), IsoTp::Reassembler::Result::COMPLETE);
+    ASSERT_EQ(reassembler.message_length(), 20U);
+}
+
+TEST(IsoTp, overflow_and_flow_control)
+{
+    IsoTp::Reassembler reassembler(100);
+    std::vector<struct canfd_frame> frames = segment(make_data(300));
+    ASSERT_EQ(reassembler.push(frames[0].data, frames[0].len), IsoTp::Reassembler::Result::OVERFLOW);
+    ASSERT_EQ(reassembler.push(frames[1].data, frames[1].len), IsoTp::Reassembler::Result::ERROR);
+
+    struct canfd_frame fc;
+    IsoTp::flow_control(IsoTp::FlowStatus::CONTINUE, 0x456, &fc);
+    ASSERT_EQ(fc.can_id, 0x456U);
+    ASSERT_EQ(fc.len, 8);
+    ASSERT_EQ(fc.data[0], 0x30);
+    ASSERT_EQ(fc.data[1], 0);
+    ASSERT_EQ(fc.data[2], 0);
+    ASSERT_EQ(reassembler.push(fc.data, fc.len), IsoTp::Reassembler::Result::IGNORED);
+}
+
+TEST(IsoTp, malformed)
+{
+    IsoTp::Reassembler reassembler(100);
+
+    uint8_t empty_sf[8]{0x00, 0x00};
+    ASSERT_EQ(reassembler.push(empty_sf, 0), IsoTp::Reassembler::Result::ERROR);
+    ASSERT_EQ(reassembler.push(empty_sf, sizeof(empty_sf)), IsoTp::Reassembler::Result::ERROR);
+
+    // A single frame that says it is longer than the frame.
+    uint8_t long_sf[4]{0x07, 1, 2, 3};
+    ASSERT_EQ(reassembler.push(long_sf, sizeof(long_sf)), IsoTp::Reassembler::Result::ERROR);
+
+    // A first frame for a message that would have fit in it.
+    uint8_t short_ff[12]{0x10, 5};
+    ASSERT_EQ(reassembler.push(short_ff, sizeof(short_ff)), IsoTp::Reassembler::Result::ERROR);
+}
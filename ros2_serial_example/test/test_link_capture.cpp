@@ -0,0 +1,436 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "ros2_serial_example/link_capture.hpp"
+#include "ros2_serial_example/replay_transporter.hpp"
+#include "ros2_serial_example/transporter.hpp"
+
+using ros2_to_serial_bridge::transport::FlightRecorder;
+using ros2_to_serial_bridge::transport::LinkCapture;
+using ros2_to_serial_bridge::transport::LinkCaptureReader;
+using ros2_to_serial_bridge::transport::ReplayTransporter;
+using ros2_to_serial_bridge::transport::Transporter;
+
+/// HELPERS
+
+namespace
+{
+
+// A Transporter whose writes come back to it, one node_read() per write.
+class TransporterLoopback : public Transporter
+{
+public:
+    explicit TransporterLoopback(const std::string & protocol) : Transporter(protocol, 1024)
+    {
+    }
+
+    ssize_t node_read() override
+    {
+        if (pending_.empty())
+        {
+            return 0;
+        }
+        std::vector<uint8_t> chunk = pending_.front();
+        pending_.erase(pending_.begin());
+        return ringbuf_.write(chunk.data(), chunk.size());
+    }
+
+    ssize_t node_write(void *buffer, size_t len) override
+    {
+        const uint8_t *data = static_cast<const uint8_t *>(buffer);
+        pending_.emplace_back(data, data + len);
+        return len;
+    }
+
+    bool fds_OK() override
+    {
+        return true;
+    }
+
+private:
+    std::vector<std::vector<uint8_t>> pending_;
+};
+
+std::vector<uint8_t> record_data(const LinkCaptureReader::Record & record)
+{
+    return std::vector<uint8_t>(record.data, record.data + record.length);
+}
+
+}  // namespace
+
+/// FIXTURES
+
+class LinkCaptureFixture : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        char dir[] = "/tmp/test_link_capture_XXXXXX";
+        ASSERT_NE(::mkdtemp(dir), nullptr);
+        dir_ = dir;
+        path_ = dir_ + "/link.cap";
+    }
+
+    void TearDown() override
+    {
+        ::unlink(path_.c_str());
+        ::rmdir(dir_.c_str());
+    }
+
+    std::string dir_;
+    std::string path_;
+};
+
+/// TESTS
+
+TEST_F(LinkCaptureFixture, write_read)
+{
+    LinkCaptureReader reader;
+    ASSERT_FALSE(reader.open(path_));
+
+    LinkCapture capture;
+    ASSERT_FALSE(capture.open(path_, "toolongprotocol"));
+    ASSERT_TRUE(capture.open(path_, "cobs"));
+    uint8_t a[]{0x1, 0x2, 0x3};
+    uint8_t b[]{0x4, 0x5};
+    capture.append(LinkCapture::Direction::RX, a, sizeof(a));
+    struct iovec iov[2]{{a, sizeof(a)}, {b, sizeof(b)}};
+    capture.append(LinkCapture::Direction::TX, iov, 2);
+    // Empty records aren't kept.
+    capture.append(LinkCapture::Direction::RX, b, 0);
+    capture.close();
+
+    ASSERT_TRUE(reader.open(path_));
+    ASSERT_EQ(reader.get_protocol(), "cobs");
+
+    LinkCaptureReader::Record record;
+    ASSERT_TRUE(reader.next(&record));
+    ASSERT_EQ(record.direction, LinkCapture::Direction::RX);
+    ASSERT_EQ(record_data(record), std::vector<uint8_t>({0x1, 0x2, 0x3}));
+    uint64_t first_timestamp = record.timestamp_ns;
+    ASSERT_GT(first_timestamp, 0U);
+
+    ASSERT_TRUE(reader.next(&record));
+    ASSERT_EQ(record.direction, LinkCapture::Direction::TX);
+    ASSERT_EQ(record_data(record), std::vector<uint8_t>({0x1, 0x2, 0x3, 0x4, 0x5}));
+    ASSERT_GE(record.timestamp_ns, first_timestamp);
+
+    ASSERT_FALSE(reader.next(&record));
+
+    reader.rewind();
+    ASSERT_TRUE(reader.next(&record));
+    ASSERT_EQ(record.timestamp_ns, first_timestamp);
+}
+
+TEST_F(LinkCaptureFixture, grow)
+{
+    // Enough data to grow the file a few times.
+    LinkCapture capture;
+    ASSERT_TRUE(capture.open(path_, "v2"));
+    std::vector<uint8_t> chunk(100000);
+    for (size_t i = 0; i < 40; ++i)
+    {
+        chunk[0] = static_cast<uint8_t>(i);
+        capture.append(LinkCapture::Direction::RX, chunk.data(), chunk.size());
+    }
+    capture.close();
+
+    LinkCaptureReader reader;
+    ASSERT_TRUE(reader.open(path_));
+    LinkCaptureReader::Record record;
+    for (size_t i = 0; i < 40; ++i)
+    {
+        ASSERT_TRUE(reader.next(&record));
+        ASSERT_EQ(record.length, chunk.size());
+        ASSERT_EQ(record.data[0], i);
+    }
+    ASSERT_FALSE(reader.next(&record));
+}
+
+TEST_F(LinkCaptureFixture, not_closed)
+{
+    // A capture that was never closed, as if the process crashed, can be
+    // read up to the last record.
+    LinkCapture capture;
+    ASSERT_TRUE(capture.open(path_, "px4"));
+    uint8_t a[]{0x1, 0x2, 0x3};
+    capture.append(LinkCapture::Direction::RX, a, sizeof(a));
+    capture.append(LinkCapture::Direction::RX, a, sizeof(a));
+
+    LinkCaptureReader reader;
+    ASSERT_TRUE(reader.open(path_));
+    LinkCaptureReader::Record record;
+    ASSERT_TRUE(reader.next(&record));
+    ASSERT_TRUE(reader.next(&record));
+    ASSERT_FALSE(reader.next(&record));
+}
+
+TEST_F(LinkCaptureFixture, capture_and_replay)
+{
+    std::vector<std::pair<topic_id_size_t, std::vector<uint8_t>>> sent;
+    {
+        TransporterLoopback loopback("px4");
+        ASSERT_EQ(loopback.set_capture(path_), 0);
+
+        for (uint8_t i = 0; i < 10; ++i)
+        {
+            std::vector<uint8_t> payload(i + 1U, i);
+            ASSERT_EQ(loopback.write(0x2 + (i % 2), payload.data(), payload.size()), static_cast<ssize_t>(payload.size()));
+            sent.emplace_back(0x2 + (i % 2), payload);
+        }
+
+        uint8_t buffer[256];
+        size_t received = 0;
+        for (int i = 0; i < 10; ++i)
+        {
+            loopback.read_many(buffer, sizeof(buffer), [&received](topic_id_size_t, uint8_t *, size_t) {received++;});
+        }
+        ASSERT_EQ(received, sent.size());
+    }
+
+    // The capture has every frame twice, once going out and once coming
+    // back in.
+    LinkCaptureReader reader;
+    ASSERT_TRUE(reader.open(path_));
+    ASSERT_EQ(reader.get_protocol(), "px4");
+    LinkCaptureReader::Record record;
+    size_t rx = 0;
+    size_t tx = 0;
+    while (reader.next(&record))
+    {
+        (record.direction == LinkCapture::Direction::RX ? rx : tx)++;
+    }
+    ASSERT_EQ(rx, sent.size());
+    ASSERT_EQ(tx, sent.size());
+
+    ReplayTransporter replay("px4", path_, false, 10, 1024);
+    ASSERT_EQ(replay.init(), 0);
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        std::vector<std::pair<topic_id_size_t, std::vector<uint8_t>>> replayed;
+        uint8_t buffer[256];
+        while (!replay.is_finished())
+        {
+            replay.read_many(buffer, sizeof(buffer), [&replayed](topic_id_size_t topic_ID, uint8_t *data, size_t length) {
+                replayed.emplace_back(topic_ID, std::vector<uint8_t>(data, data + length));
+            });
+        }
+        ASSERT_EQ(replayed, sent);
+        replay.rewind();
+    }
+
+    // Writes go nowhere.
+    uint8_t a[]{0x1};
+    ASSERT_EQ(replay.write(0x2, a, sizeof(a)), 1);
+}
+
+TEST_F(LinkCaptureFixture, replay_realtime)
+{
+    {
+        LinkCapture capture;
+        ASSERT_TRUE(capture.open(path_, "px4"));
+        uint8_t a[]{0x1};
+        capture.append(LinkCapture::Direction::RX, a, sizeof(a));
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        capture.append(LinkCapture::Direction::RX, a, sizeof(a));
+    }
+
+    ReplayTransporter replay("px4", path_, true, 10, 1024);
+    ASSERT_EQ(replay.init(), 0);
+
+    // The first chunk comes straight away, and the second only once the
+    // 50 milliseconds between them have passed.
+    auto start = std::chrono::steady_clock::now();
+    uint8_t buffer[16];
+    topic_id_size_t topic_ID;
+    replay.read(&topic_ID, buffer, sizeof(buffer));
+    ASSERT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(40));
+    int reads = 0;
+    while (!replay.is_finished())
+    {
+        replay.read(&topic_ID, buffer, sizeof(buffer));
+        reads++;
+    }
+    ASSERT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(50));
+    // Each read waits at most read_poll_ms.
+    ASSERT_GT(reads, 2);
+}
+
+TEST_F(LinkCaptureFixture, replay_wrong_protocol)
+{
+    {
+        LinkCapture capture;
+        ASSERT_TRUE(capture.open(path_, "cobs"));
+    }
+
+    ReplayTransporter replay("px4", path_, false, 10, 1024);
+    ASSERT_EQ(replay.init(), -1);
+
+    ReplayTransporter missing("px4", path_ + ".missing", false, 10, 1024);
+    ASSERT_EQ(missing.init(), -1);
+}
+
+TEST(FlightRecorder, invalid_size)
+{
+    ASSERT_THROW(FlightRecorder recorder(0), std::runtime_error);
+}
+
+TEST_F(LinkCaptureFixture, flight_recorder_keeps_latest)
+{
+    FlightRecorder recorder(4096);
+    ASSERT_EQ(recorder.get_size() % 4096, 0U);
+
+    // Nothing recorded yet makes an empty capture.
+    ASSERT_TRUE(recorder.dump(path_, "cobs"));
+    LinkCaptureReader reader;
+    ASSERT_TRUE(reader.open(path_));
+    ASSERT_EQ(reader.get_protocol(), "cobs");
+    LinkCaptureReader::Record record;
+    ASSERT_FALSE(reader.next(&record));
+
+    // 500 records of 100 bytes go round the ring many times, so only the
+    // latest ones are left; records run over the end of the ring too.
+    std::vector<uint8_t> chunk(100);
+    uint8_t b[]{0x7};
+    for (size_t i = 0; i < 500; ++i)
+    {
+        chunk.assign(chunk.size(), static_cast<uint8_t>(i));
+        struct iovec iov[2]{{chunk.data(), chunk.size()}, {b, sizeof(b)}};
+        recorder.append(i % 2 == 0 ? LinkCapture::Direction::RX : LinkCapture::Direction::TX, iov, 2);
+    }
+    // A record bigger than the ring is left out.
+    std::vector<uint8_t> big(recorder.get_size());
+    struct iovec big_iov{big.data(), big.size()};
+    recorder.append(LinkCapture::Direction::RX, &big_iov, 1);
+
+    ASSERT_TRUE(recorder.dump(path_, "cobs"));
+    ASSERT_TRUE(reader.open(path_));
+    std::vector<LinkCaptureReader::Record> records;
+    while (reader.next(&record))
+    {
+        records.push_back(record);
+    }
+    ASSERT_GT(records.size(), recorder.get_size() / 200);
+    ASSERT_LE(records.size(), recorder.get_size() / 101);
+    uint64_t timestamp = 0;
+    size_t first = 500 - records.size();
+    for (size_t i = 0; i < records.size(); ++i)
+    {
+        ASSERT_EQ(records[i].length, 101U);
+        ASSERT_EQ(records[i].data[0], static_cast<uint8_t>(first + i));
+        ASSERT_EQ(records[i].data[99], static_cast<uint8_t>(first + i));
+        ASSERT_EQ(records[i].data[100], 0x7);
+        ASSERT_EQ(records[i].direction, (first + i) % 2 == 0 ? LinkCapture::Direction::RX : LinkCapture::Direction::TX);
+        ASSERT_GE(records[i].timestamp_ns, timestamp);
+        timestamp = records[i].timestamp_ns;
+    }
+}
+
+TEST_F(LinkCaptureFixture, flight_recorder_concurrent)
+{
+    // Two threads add records while the recorder is dumped over and over;
+    // every record that comes out is whole.
+    FlightRecorder recorder(8192);
+    std::atomic<bool> stop{false};
+    auto writer = [&recorder, &stop](LinkCapture::Direction direction, uint8_t fill) {
+        std::vector<uint8_t> chunk;
+        for (size_t i = 0; !stop; ++i)
+        {
+            chunk.assign(1 + i % 300, fill);
+            struct iovec iov{chunk.data(), chunk.size()};
+            recorder.append(direction, &iov, 1);
+        }
+    };
+    std::thread rx(writer, LinkCapture::Direction::RX, 0x11);
+    std::thread tx(writer, LinkCapture::Direction::TX, 0x22);
+
+    size_t dumped = 0;
+    for (int pass = 0; pass < 50; ++pass)
+    {
+        ASSERT_TRUE(recorder.dump(path_, "v2"));
+        LinkCaptureReader reader;
+        ASSERT_TRUE(reader.open(path_));
+        LinkCaptureReader::Record record;
+        while (reader.next(&record))
+        {
+            uint8_t fill = record.direction == LinkCapture::Direction::RX ? 0x11 : 0x22;
+            for (size_t i = 0; i < record.length; ++i)
+            {
+                ASSERT_EQ(record.data[i], fill);
+            }
+            dumped++;
+        }
+    }
+    stop = true;
+    rx.join();
+    tx.join();
+    ASSERT_GT(dumped, 0U);
+}
+
+TEST_F(LinkCaptureFixture, transporter_flight_recorder)
+{
+    TransporterLoopback loopback("px4");
+    ASSERT_EQ(loopback.dump_flight_recorder(path_), -1);
+    ASSERT_EQ(loopback.set_flight_recorder(65536), 0);
+
+    uint8_t payload[]{0x1, 0x2, 0x3};
+    ASSERT_EQ(loopback.write(0x2, payload, sizeof(payload)), static_cast<ssize_t>(sizeof(payload)));
+    uint8_t buffer[256];
+    size_t received = 0;
+    loopback.read_many(buffer, sizeof(buffer), [&received](topic_id_size_t, uint8_t *, size_t) {received++;});
+    ASSERT_EQ(received, 1U);
+
+    // The frame going out and coming back in, in a capture that replays.
+    ASSERT_EQ(loopback.dump_flight_recorder(path_), 0);
+    LinkCaptureReader reader;
+    ASSERT_TRUE(reader.open(path_));
+    ASSERT_EQ(reader.get_protocol(), "px4");
+    LinkCaptureReader::Record tx_record;
+    LinkCaptureReader::Record rx_record;
+    ASSERT_TRUE(reader.next(&tx_record));
+    ASSERT_TRUE(reader.next(&rx_record));
+    ASSERT_EQ(tx_record.direction, LinkCapture::Direction::TX);
+    ASSERT_EQ(rx_record.direction, LinkCapture::Direction::RX);
+    ASSERT_EQ(record_data(tx_record), record_data(rx_record));
+    ASSERT_FALSE(reader.next(&rx_record));
+
+    ReplayTransporter replay("px4", path_, false, 10, 1024);
+    ASSERT_EQ(replay.init(), 0);
+    topic_id_size_t topic_ID;
+    ssize_t len = -ENODATA;
+    for (int i = 0; i < 10 && len == -ENODATA; ++i)
+    {
+        len = replay.read(&topic_ID, buffer, sizeof(buffer));
+    }
+    ASSERT_EQ(len, static_cast<ssize_t>(sizeof(payload)));
+    ASSERT_EQ(topic_ID, 0x2);
+
+    ASSERT_EQ(loopback.set_flight_recorder(0), 0);
+    ASSERT_EQ(loopback.dump_flight_recorder(path_), -1);
+}
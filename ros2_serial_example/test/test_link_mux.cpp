@@ -0,0 +1,177 @@
+#include <gtest/gtest.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "ros2_serial_example/link_mux.hpp"
+#include "ros2_serial_example/shm_transporter.hpp"
+
+#include "transporter_test_helpers.hpp"
+
+using ros2_to_serial_bridge::transport::LinkMux;
+using ros2_to_serial_bridge::transport::ShmTransporter;
+using ros2_to_serial_bridge::transport::Transporter;
+
+/// HELPERS
+
+static std::string shm_name(const std::string & test)
+{
+    return "/ros2_serial_test_" + test + "_" + std::to_string(::getpid());
+}
+
+// A link shared by a device and a LinkMux, and the endpoints of the channels
+// with the clients attached to them, all through shared memory.
+class MuxFixture final
+{
+public:
+    MuxFixture(const std::string & test, const std::string & link_protocol, size_t channels)
+    {
+        std::string name = shm_name(test);
+        link = std::make_unique<ShmTransporter>(link_protocol, name, ShmTransporter::Role::CREATE, 65536, 10, 65536);
+        EXPECT_EQ(link->init(), 0);
+        device = std::make_unique<ShmTransporter>(link_protocol, name, ShmTransporter::Role::ATTACH, 0, 10, 65536);
+        EXPECT_EQ(device->init(), 0);
+
+        for (size_t i = 0; i < channels; ++i)
+        {
+            std::string channel_name = name + "_" + std::to_string(i);
+            endpoints.push_back(std::make_unique<ShmTransporter>("cobs", channel_name, ShmTransporter::Role::CREATE, 65536, 10, 65536));
+            EXPECT_EQ(endpoints.back()->init(), 0);
+            endpoint_ptrs.push_back(endpoints.back().get());
+            clients.push_back(std::make_unique<ShmTransporter>("cobs", channel_name, ShmTransporter::Role::ATTACH, 0, 10, 65536));
+            EXPECT_EQ(clients.back()->init(), 0);
+        }
+    }
+
+    std::unique_ptr<ShmTransporter> link;
+    std::unique_ptr<ShmTransporter> device;
+    std::vector<std::unique_ptr<ShmTransporter>> endpoints;
+    std::vector<Transporter *> endpoint_ptrs;
+    std::vector<std::unique_ptr<ShmTransporter>> clients;
+};
+
+/// TESTS
+
+TEST(LinkMux, invalid_construction)
+{
+    MuxFixture f("mux_invalid_construction", "cobs", 2);
+
+    ASSERT_THROW(LinkMux(nullptr, f.endpoint_ptrs, 16, 1024), std::runtime_error);
+    ASSERT_THROW(LinkMux(f.link.get(), {}, 16, 1024), std::runtime_error);
+    ASSERT_THROW(LinkMux(f.link.get(), {f.endpoint_ptrs[0], nullptr}, 16, 1024), std::runtime_error);
+    ASSERT_THROW(LinkMux(f.link.get(), {f.endpoint_ptrs[0]}, 0, 1024), std::runtime_error);
+    ASSERT_THROW(LinkMux(f.link.get(), {f.endpoint_ptrs[0]}, 16, 0), std::runtime_error);
+    ASSERT_THROW(LinkMux(f.link.get(), std::vector<Transporter *>(LinkMux::MAX_CHANNELS + 1, f.endpoint_ptrs[0]), 16, 1024), std::runtime_error);
+
+    // A cobs link only has room for the topic IDs of channel 0.
+    ASSERT_THROW(LinkMux(f.link.get(), f.endpoint_ptrs, 16, 1024), std::runtime_error);
+    ASSERT_NO_THROW(LinkMux(f.link.get(), {f.endpoint_ptrs[0]}, 16, 1024));
+}
+
+TEST(LinkMux, link_topic_ID)
+{
+    ASSERT_EQ(LinkMux::link_topic_ID(0, 9), 9U);
+    ASSERT_EQ(LinkMux::link_topic_ID(1, 0), 0x100U);
+    ASSERT_EQ(LinkMux::link_topic_ID(2, 255), 0x2ffU);
+    ASSERT_EQ(LinkMux::link_topic_ID(LinkMux::MAX_CHANNELS - 1, LinkMux::MAX_CHANNEL_TOPIC_ID), 0xffffU);
+}
+
+TEST(LinkMux, device_to_clients)
+{
+    MuxFixture f("mux_device_to_clients", "v2", 2);
+    LinkMux mux(f.link.get(), f.endpoint_ptrs, 16, 1024);
+    mux.start();
+
+    uint8_t a[] = {0x1, 0x2, 0x3};
+    uint8_t b[] = {0x4, 0x5};
+    ASSERT_EQ(f.device->write(LinkMux::link_topic_ID(0, 9), a, sizeof(a)), static_cast<ssize_t>(sizeof(a)));
+    ASSERT_EQ(f.device->write(LinkMux::link_topic_ID(1, 9), b, sizeof(b)), static_cast<ssize_t>(sizeof(b)));
+    // There is no channel 2.
+    ASSERT_EQ(f.device->write(LinkMux::link_topic_ID(2, 9), a, sizeof(a)), static_cast<ssize_t>(sizeof(a)));
+
+    topic_id_size_t topic_ID = 0;
+    uint8_t buffer[64];
+    ASSERT_EQ(read_message(*f.clients[0], &topic_ID, buffer, sizeof(buffer)), static_cast<ssize_t>(sizeof(a)));
+    ASSERT_EQ(topic_ID, 9U);
+    ASSERT_EQ(buffer[2], 0x3);
+
+    topic_ID = 0;
+    ASSERT_EQ(read_message(*f.clients[1], &topic_ID, buffer, sizeof(buffer)), static_cast<ssize_t>(sizeof(b)));
+    ASSERT_EQ(topic_ID, 9U);
+    ASSERT_EQ(buffer[1], 0x5);
+
+    mux.stop();
+
+    ASSERT_EQ(mux.get_stats(0).rx_messages, 1U);
+    ASSERT_EQ(mux.get_stats(1).rx_messages, 1U);
+    ASSERT_EQ(mux.get_unrouted(), 1U);
+}
+
+TEST(LinkMux, clients_to_device)
+{
+    MuxFixture f("mux_clients_to_device", "v2", 2);
+    LinkMux mux(f.link.get(), f.endpoint_ptrs, 16, 1024);
+    mux.start();
+
+    uint8_t a[] = {0x1, 0x2, 0x3};
+    uint8_t b[] = {0x4, 0x5};
+    ASSERT_EQ(f.clients[0]->write(0, a, sizeof(a)), static_cast<ssize_t>(sizeof(a)));
+    ASSERT_EQ(f.clients[1]->write(0, b, sizeof(b)), static_cast<ssize_t>(sizeof(b)));
+
+    // The channels are written in whatever order their readers got to them,
+    // so collect both before looking at them.
+    bool got_a = false;
+    bool got_b = false;
+    for (int i = 0; i < 2; ++i)
+    {
+        topic_id_size_t topic_ID = 0;
+        uint8_t buffer[64];
+        ssize_t len = read_message(*f.device, &topic_ID, buffer, sizeof(buffer));
+        if (topic_ID == LinkMux::link_topic_ID(0, 0))
+        {
+            ASSERT_EQ(len, static_cast<ssize_t>(sizeof(a)));
+            ASSERT_EQ(buffer[0], 0x1);
+            got_a = true;
+        }
+        else
+        {
+            ASSERT_EQ(topic_ID, LinkMux::link_topic_ID(1, 0));
+            ASSERT_EQ(len, static_cast<ssize_t>(sizeof(b)));
+            ASSERT_EQ(buffer[0], 0x4);
+            got_b = true;
+        }
+    }
+    ASSERT_TRUE(got_a);
+    ASSERT_TRUE(got_b);
+
+    mux.stop();
+
+    ASSERT_EQ(mux.get_stats(0).tx_messages, 1U);
+    ASSERT_EQ(mux.get_stats(0).tx_bytes, sizeof(a));
+    ASSERT_EQ(mux.get_stats(1).tx_messages, 1U);
+    ASSERT_EQ(mux.get_stats(1).tx_drops, 0U);
+}
+
+TEST(LinkMux, stop_and_restart)
+{
+    MuxFixture f("mux_stop_and_restart", "v2", 1);
+    LinkMux mux(f.link.get(), f.endpoint_ptrs, 16, 1024);
+    mux.start();
+    mux.stop();
+    mux.start();
+
+    uint8_t a[] = {0x7};
+    ASSERT_EQ(f.clients[0]->write(12, a, sizeof(a)), static_cast<ssize_t>(sizeof(a)));
+
+    topic_id_size_t topic_ID = 0;
+    uint8_t buffer[64];
+    ASSERT_EQ(read_message(*f.device, &topic_ID, buffer, sizeof(buffer)), static_cast<ssize_t>(sizeof(a)));
+    ASSERT_EQ(topic_ID, 12U);
+    ASSERT_EQ(buffer[0], 0x7);
+}
@@ -0,0 +1,109 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gtest/gtest.h>
+
+#include "ros2_serial_example/link_negotiation.hpp"
+
+using ros2_to_serial_bridge::transport::LinkCapabilities;
+using ros2_to_serial_bridge::transport::LinkSettings;
+using ros2_to_serial_bridge::transport::negotiate_link;
+
+/// HELPERS
+
+static LinkCapabilities make_capabilities(const std::vector<uint32_t> & baudrates, const std::vector<std::string> & protocols,
+                                          uint32_t max_frame_size, bool compression, bool batching)
+{
+    LinkCapabilities caps;
+    caps.baudrates = baudrates;
+    caps.protocols = protocols;
+    caps.max_frame_size = max_frame_size;
+    caps.compression = compression;
+    caps.batching = batching;
+    return caps;
+}
+
+/// TESTS
+
+TEST(LinkNegotiation, best_common)
+{
+    LinkCapabilities bridge = make_capabilities({115200, 921600, 2000000, 3000000}, {"v2", "cobs", "px4"}, 1024, true, true);
+    LinkCapabilities mcu = make_capabilities({115200, 460800, 2000000}, {"cobs", "px4"}, 512, true, true);
+
+    LinkSettings settings;
+    ASSERT_TRUE(negotiate_link(bridge, mcu, &settings));
+    ASSERT_EQ(settings.baudrate, 2000000U);
+    ASSERT_EQ(settings.protocol, "cobs");
+    ASSERT_EQ(settings.max_frame_size, 512U);
+    // Compression needs v2.
+    ASSERT_FALSE(settings.compression);
+    ASSERT_TRUE(settings.batching);
+
+    // Both ends come to the same answer.
+    LinkSettings other;
+    ASSERT_TRUE(negotiate_link(mcu, bridge, &other));
+    ASSERT_EQ(other.baudrate, settings.baudrate);
+    ASSERT_EQ(other.protocol, settings.protocol);
+    ASSERT_EQ(other.max_frame_size, settings.max_frame_size);
+}
+
+TEST(LinkNegotiation, v2_features)
+{
+    LinkCapabilities bridge = make_capabilities({}, {"v2", "cobs", "px4"}, 1024, true, true);
+    LinkCapabilities mcu = make_capabilities({}, {"px4", "v2"}, 0, true, false);
+
+    LinkSettings settings;
+    ASSERT_TRUE(negotiate_link(bridge, mcu, &settings));
+    ASSERT_EQ(settings.protocol, "v2");
+    ASSERT_TRUE(settings.compression);
+    ASSERT_FALSE(settings.batching);
+    // A limit of 0 means no limit, so the other end's limit applies.
+    ASSERT_EQ(settings.max_frame_size, 1024U);
+}
+
+TEST(LinkNegotiation, cobs_zpe)
+{
+    LinkCapabilities bridge = make_capabilities({}, {"v2", "cobs_zpe", "cobs", "px4"}, 1024, true, true);
+    LinkCapabilities mcu = make_capabilities({}, {"cobs", "cobs_zpe"}, 512, true, true);
+
+    // COBS/ZPE is preferred over plain COBS when both ends have it.
+    LinkSettings settings;
+    ASSERT_TRUE(negotiate_link(bridge, mcu, &settings));
+    ASSERT_EQ(settings.protocol, "cobs_zpe");
+
+    mcu = make_capabilities({}, {"cobs"}, 512, true, true);
+    ASSERT_TRUE(negotiate_link(bridge, mcu, &settings));
+    ASSERT_EQ(settings.protocol, "cobs");
+}
+
+TEST(LinkNegotiation, no_common_baudrate)
+{
+    LinkCapabilities bridge = make_capabilities({115200, 921600}, {"px4"}, 0, false, false);
+    LinkCapabilities mcu = make_capabilities({}, {"px4"}, 0, false, false);
+
+    LinkSettings settings;
+    ASSERT_TRUE(negotiate_link(bridge, mcu, &settings));
+    ASSERT_EQ(settings.baudrate, 0U);
+    ASSERT_EQ(settings.protocol, "px4");
+    ASSERT_EQ(settings.max_frame_size, 0U);
+}
+
+TEST(LinkNegotiation, no_common_protocol)
+{
+    LinkCapabilities bridge = make_capabilities({115200}, {"v2"}, 0, true, true);
+    LinkCapabilities mcu = make_capabilities({115200}, {"cobs", "foo"}, 0, true, true);
+
+    LinkSettings settings;
+    ASSERT_FALSE(negotiate_link(bridge, mcu, &settings));
+}
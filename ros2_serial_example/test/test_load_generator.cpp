@@ -0,0 +1,293 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include "ros2_serial_example/load_generator.hpp"
+#include "ros2_serial_example/transporter.hpp"
+
+using ros2_to_serial_bridge::loadgen::LoadGenerator;
+using ros2_to_serial_bridge::loadgen::TopicLoad;
+using ros2_to_serial_bridge::loadgen::TopicReport;
+
+/// HELPERS
+
+// A transporter that keeps every frame written.  With the px4 protocol the
+// payload is at the end of the frame.
+class FrameRecorder : public ros2_to_serial_bridge::transport::Transporter
+{
+public:
+    FrameRecorder() : Transporter("px4", 1024)
+    {
+    }
+
+    ~FrameRecorder() override
+    {
+    }
+
+    ssize_t node_read() override
+    {
+        return 0;
+    }
+
+    ssize_t node_write(void *buffer, size_t len) override
+    {
+        uint8_t *bytes = static_cast<uint8_t *>(buffer);
+        frames.emplace_back(bytes, bytes + len);
+        return len;
+    }
+
+    bool fds_OK() override
+    {
+        return true;
+    }
+
+    std::vector<std::vector<uint8_t>> frames;
+};
+
+static TopicLoad make_topic(size_t size, double rate_hz, uint32_t burst)
+{
+    TopicLoad load;
+    EXPECT_TRUE(LoadGenerator::parse_topic_load(std::to_string(size) + ":" + std::to_string(rate_hz) + ":" + std::to_string(burst), 0, &load));
+    return load;
+}
+
+static std::vector<uint8_t> make_message(uint32_t seq, LoadGenerator::Clock::time_point send_time, size_t size)
+{
+    std::vector<uint8_t> buffer(size);
+    LoadGenerator::encode(seq, send_time, buffer.data(), size);
+    return buffer;
+}
+
+/// TESTS
+
+TEST(LoadGenerator, parse_topic_load)
+{
+    TopicLoad load;
+
+    ASSERT_TRUE(LoadGenerator::parse_topic_load("64:250", 2, &load));
+    ASSERT_EQ(load.name, "load2");
+    ASSERT_EQ(load.size, 64U);
+    ASSERT_EQ(load.rate_hz, 250.0);
+    ASSERT_EQ(load.burst, 1U);
+    ASSERT_NE(load.out_topic_ID, load.in_topic_ID);
+
+    ASSERT_TRUE(LoadGenerator::parse_topic_load("320:0.5:10", 3, &load));
+    ASSERT_EQ(load.size, 320U);
+    ASSERT_EQ(load.rate_hz, 0.5);
+    ASSERT_EQ(load.burst, 10U);
+
+    ASSERT_FALSE(LoadGenerator::parse_topic_load("", 0, &load));
+    ASSERT_FALSE(LoadGenerator::parse_topic_load("64", 0, &load));
+    ASSERT_FALSE(LoadGenerator::parse_topic_load("64:", 0, &load));
+    ASSERT_FALSE(LoadGenerator::parse_topic_load("64:10:1:1", 0, &load));
+    ASSERT_FALSE(LoadGenerator::parse_topic_load("8:10", 0, &load));
+    ASSERT_FALSE(LoadGenerator::parse_topic_load("64.5:10", 0, &load));
+    ASSERT_FALSE(LoadGenerator::parse_topic_load("64:0", 0, &load));
+    ASSERT_FALSE(LoadGenerator::parse_topic_load("64:10:0", 0, &load));
+    ASSERT_FALSE(LoadGenerator::parse_topic_load("64:abc", 0, &load));
+}
+
+TEST(LoadGenerator, px4_mix_ids)
+{
+    TopicLoad first;
+    ASSERT_TRUE(LoadGenerator::parse_topic_load("64:10", 0, &first));
+    std::vector<TopicLoad> mix = LoadGenerator::px4_mix(1);
+    ASSERT_FALSE(mix.empty());
+
+    std::vector<topic_id_size_t> ids{first.out_topic_ID, first.in_topic_ID};
+    for (const TopicLoad & t : mix)
+    {
+        ASSERT_GE(t.size, LoadGenerator::MIN_SIZE);
+        ids.push_back(t.out_topic_ID);
+        ids.push_back(t.in_topic_ID);
+    }
+    std::sort(ids.begin(), ids.end());
+    ASSERT_EQ(std::unique(ids.begin(), ids.end()), ids.end());
+}
+
+TEST(LoadGenerator, encode_decode)
+{
+    LoadGenerator::Clock::time_point send_time = LoadGenerator::Clock::now();
+    std::vector<uint8_t> buffer = make_message(1234, send_time, 100);
+
+    uint32_t seq = 0;
+    LoadGenerator::Clock::time_point decoded_time;
+    ASSERT_TRUE(LoadGenerator::decode(buffer.data(), buffer.size(), &seq, &decoded_time));
+    ASSERT_EQ(seq, 1234U);
+    ASSERT_EQ(decoded_time, send_time);
+
+    // A truncated message no longer matches its length.
+    ASSERT_FALSE(LoadGenerator::decode(buffer.data(), buffer.size() - 1, &seq, &decoded_time));
+    ASSERT_FALSE(LoadGenerator::decode(buffer.data(), LoadGenerator::MIN_SIZE - 1, &seq, &decoded_time));
+}
+
+TEST(LoadGenerator, invalid_topics)
+{
+    FrameRecorder transporter;
+    TopicLoad load = make_topic(64, 10.0, 1);
+
+    load.size = LoadGenerator::MIN_SIZE - 1;
+    ASSERT_THROW(LoadGenerator(&transporter, {load}), std::runtime_error);
+
+    load.size = 64;
+    load.rate_hz = 0.0;
+    ASSERT_THROW(LoadGenerator(&transporter, {load}), std::runtime_error);
+}
+
+TEST(LoadGenerator, send_due)
+{
+    FrameRecorder transporter;
+    TopicLoad load = make_topic(64, 10.0, 3);
+    LoadGenerator generator(&transporter, {load});
+
+    LoadGenerator::Clock::time_point start = LoadGenerator::Clock::now();
+    LoadGenerator::Clock::time_point next = generator.send_due(start);
+    ASSERT_EQ(transporter.frames.size(), 3U);
+    ASSERT_EQ(next, start + std::chrono::milliseconds(100));
+
+    // Nothing is due yet.
+    ASSERT_EQ(generator.send_due(start + std::chrono::milliseconds(50)), next);
+    ASSERT_EQ(transporter.frames.size(), 3U);
+
+    // Two periods have gone by, so two bursts are sent.
+    generator.send_due(start + std::chrono::milliseconds(200));
+    ASSERT_EQ(transporter.frames.size(), 9U);
+
+    for (size_t i = 0; i < transporter.frames.size(); ++i)
+    {
+        const std::vector<uint8_t> & frame = transporter.frames[i];
+        ASSERT_GE(frame.size(), load.size);
+        uint32_t seq;
+        LoadGenerator::Clock::time_point send_time;
+        ASSERT_TRUE(LoadGenerator::decode(frame.data() + frame.size() - load.size, load.size, &seq, &send_time));
+        ASSERT_EQ(seq, i);
+    }
+
+    std::vector<TopicReport> reports;
+    generator.report(&reports);
+    ASSERT_EQ(reports.size(), 1U);
+    ASSERT_EQ(reports[0].sent, 9U);
+    ASSERT_EQ(reports[0].received, 0U);
+    ASSERT_EQ(reports[0].lost, 9U);
+}
+
+TEST(LoadGenerator, receive)
+{
+    FrameRecorder transporter;
+    TopicLoad load = make_topic(64, 10.0, 5);
+    LoadGenerator generator(&transporter, {load});
+
+    LoadGenerator::Clock::time_point start = LoadGenerator::Clock::now();
+    generator.send_due(start);
+
+    // Messages 0, 2, 1 (reordered), 2 again (duplicated) and 4 come back;
+    // 3 is lost.
+    std::vector<uint32_t> seqs{0, 2, 1, 2, 4};
+    for (uint32_t seq : seqs)
+    {
+        std::vector<uint8_t> message = make_message(seq, start, load.size);
+        ASSERT_TRUE(generator.receive(load.in_topic_ID, message.data(), message.size(), start + std::chrono::microseconds(500)));
+    }
+
+    // Messages on other topics aren't for the generator.
+    std::vector<uint8_t> message = make_message(0, start, load.size);
+    ASSERT_FALSE(generator.receive(load.out_topic_ID, message.data(), message.size(), start));
+
+    std::vector<TopicReport> reports;
+    generator.report(&reports);
+    ASSERT_EQ(reports.size(), 1U);
+    ASSERT_EQ(reports[0].sent, 5U);
+    ASSERT_EQ(reports[0].received, 4U);
+    ASSERT_EQ(reports[0].lost, 1U);
+    ASSERT_EQ(reports[0].reordered, 1U);
+    ASSERT_EQ(reports[0].duplicates, 1U);
+    ASSERT_EQ(reports[0].bytes, 4 * load.size);
+
+    // The histogram buckets are within 1/8 of the value.
+    ASSERT_GE(reports[0].rtt_p50_ns, 500000U);
+    ASSERT_LE(reports[0].rtt_p50_ns, 500000U + 500000U / 8);
+    ASSERT_EQ(reports[0].rtt_max_ns, 500000U);
+}
+
+TEST(LoadGenerator, json_report)
+{
+    TopicReport report;
+    report.name = "sensor_combined";
+    report.sent = 10;
+    report.received = 9;
+    report.lost = 1;
+    report.bytes = 900;
+    report.rtt_p50_ns = 1500;
+    std::vector<TopicReport> reports{report, report};
+
+    ros2_to_serial_bridge::loadgen::ProcessUsage start;
+    start.cpu_s = 1.0;
+    ros2_to_serial_bridge::loadgen::ProcessUsage end;
+    end.cpu_s = 1.5;
+    end.max_rss_kb = 2048;
+
+    char *text = nullptr;
+    size_t size = 0;
+    FILE * out = ::open_memstream(&text, &size);
+    ASSERT_NE(out, nullptr);
+    LoadGenerator::write_json_report(out, "udp", "cobs", reports, 2.0, &start, &end);
+    LoadGenerator::write_json_report(out, "uart", "px4", {}, 2.0, nullptr, nullptr);
+    ::fclose(out);
+    std::string json(text, size);
+    ::free(text);
+
+    ASSERT_EQ(json,
+              "{\"link\": \"udp\", \"protocol\": \"cobs\", \"elapsed_s\": 2.000, "
+              "\"bridge_cpu_percent\": 25.0, \"bridge_max_rss_kb\": 2048, \"topics\": ["
+              "{\"name\": \"sensor_combined\", \"sent\": 10, \"received\": 9, \"lost\": 1, \"reordered\": 0, "
+              "\"duplicates\": 0, \"bytes\": 900, \"rtt_p50_us\": 1.5, \"rtt_p99_us\": 0.0, "
+              "\"rtt_p999_us\": 0.0, \"rtt_max_us\": 0.0}, "
+              "{\"name\": \"sensor_combined\", \"sent\": 10, \"received\": 9, \"lost\": 1, \"reordered\": 0, "
+              "\"duplicates\": 0, \"bytes\": 900, \"rtt_p50_us\": 1.5, \"rtt_p99_us\": 0.0, "
+              "\"rtt_p999_us\": 0.0, \"rtt_max_us\": 0.0}]}\n"
+              "{\"link\": \"uart\", \"protocol\": \"px4\", \"elapsed_s\": 2.000, \"topics\": []}\n");
+}
+
+TEST(LoadGenerator, process_usage)
+{
+    // The test itself is a process to find and measure.
+    char exe[4096];
+    ssize_t n = ::readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+    ASSERT_GT(n, 0);
+    exe[n] = '\0';
+    std::string name(exe);
+    name = name.substr(name.rfind('/') + 1);
+    pid_t pid = LoadGenerator::find_process(name);
+    ASSERT_GT(pid, 0);
+
+    ros2_to_serial_bridge::loadgen::ProcessUsage usage;
+    ASSERT_TRUE(LoadGenerator::read_process_usage(::getpid(), &usage));
+    ASSERT_GE(usage.cpu_s, 0.0);
+    ASSERT_GT(usage.max_rss_kb, 0U);
+
+    ASSERT_EQ(LoadGenerator::find_process("no_such_process_here"), -1);
+}
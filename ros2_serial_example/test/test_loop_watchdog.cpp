@@ -0,0 +1,165 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#include "ros2_serial_example/loop_watchdog.hpp"
+
+using ros2_to_serial_bridge::transport::LoopWatchdog;
+
+/// HELPERS
+
+// Run one pass that takes ms milliseconds, working on topic (or none if
+// topic is negative).
+static bool pass(LoopWatchdog * watchdog, LoopWatchdog::Clock::time_point * now, int ms, int topic,
+                 uint64_t ring_overflows = 0)
+{
+    watchdog->begin(*now);
+    if (topic >= 0)
+    {
+        watchdog->set_topic(static_cast<topic_id_size_t>(topic));
+    }
+    *now += std::chrono::milliseconds(ms);
+
+    return watchdog->end(*now, ring_overflows);
+}
+
+/// TESTS
+
+TEST(LoopWatchdog, disabled)
+{
+    LoopWatchdog watchdog;
+    ASSERT_EQ(watchdog.now(), LoopWatchdog::Clock::time_point());
+
+    // Passes aren't timed without a threshold.
+    watchdog.begin(watchdog.now());
+    ASSERT_FALSE(watchdog.end(watchdog.now(), 0));
+    LoopWatchdog::Snapshot snapshot;
+    watchdog.snapshot(&snapshot);
+    ASSERT_EQ(snapshot.passes.count, 0U);
+    ASSERT_EQ(snapshot.stalls, 0U);
+
+    watchdog.set_threshold(std::chrono::milliseconds(10));
+    ASSERT_NE(watchdog.now(), LoopWatchdog::Clock::time_point());
+}
+
+TEST(LoopWatchdog, stalls)
+{
+    LoopWatchdog watchdog;
+    watchdog.set_threshold(std::chrono::milliseconds(10));
+    LoopWatchdog::Clock::time_point now = LoopWatchdog::Clock::now();
+
+    ASSERT_FALSE(pass(&watchdog, &now, 1, 5));
+    ASSERT_TRUE(pass(&watchdog, &now, 30, 5));
+    ASSERT_TRUE(pass(&watchdog, &now, 20, 5));
+    ASSERT_TRUE(pass(&watchdog, &now, 50, 7));
+    ASSERT_TRUE(pass(&watchdog, &now, 10, -1));
+    ASSERT_FALSE(pass(&watchdog, &now, 9, 7));
+
+    LoopWatchdog::Snapshot snapshot;
+    watchdog.snapshot(&snapshot);
+    ASSERT_EQ(snapshot.threshold_ns, 10000000U);
+    ASSERT_EQ(snapshot.passes.count, 6U);
+    ASSERT_EQ(snapshot.passes.max, 50000000U);
+    ASSERT_EQ(snapshot.stalls, 4U);
+    ASSERT_EQ(snapshot.stall_ns, 110000000U);
+    ASSERT_EQ(snapshot.max_stall_ns, 50000000U);
+    ASSERT_EQ(snapshot.last_stall.duration_ns, 10000000U);
+    ASSERT_FALSE(snapshot.last_stall.has_topic);
+
+    // In the order they first stalled.
+    ASSERT_EQ(snapshot.topics.size(), 3U);
+    ASSERT_TRUE(snapshot.topics[0].has_topic);
+    ASSERT_EQ(snapshot.topics[0].topic_ID, 5U);
+    ASSERT_EQ(snapshot.topics[0].stalls, 2U);
+    ASSERT_EQ(snapshot.topics[0].total_ns, 50000000U);
+    ASSERT_EQ(snapshot.topics[0].max_ns, 30000000U);
+    ASSERT_EQ(snapshot.topics[1].topic_ID, 7U);
+    ASSERT_EQ(snapshot.topics[1].stalls, 1U);
+    ASSERT_FALSE(snapshot.topics[2].has_topic);
+    ASSERT_EQ(snapshot.topics[2].stalls, 1U);
+}
+
+TEST(LoopWatchdog, ring_overflows)
+{
+    LoopWatchdog watchdog;
+    watchdog.set_threshold(std::chrono::milliseconds(10));
+    LoopWatchdog::Clock::time_point now = LoopWatchdog::Clock::now();
+
+    // Overflows without a stall aren't put down to one.
+    ASSERT_FALSE(pass(&watchdog, &now, 1, 3, 2));
+    // Those that show up right after a stall are put down to it...
+    ASSERT_TRUE(pass(&watchdog, &now, 100, 3, 2));
+    ASSERT_FALSE(pass(&watchdog, &now, 1, 4, 5));
+    // ...but not those after that.
+    ASSERT_FALSE(pass(&watchdog, &now, 1, 4, 6));
+    // Those in the pass that stalls are put down to it too.
+    ASSERT_TRUE(pass(&watchdog, &now, 100, 4, 7));
+
+    LoopWatchdog::Snapshot snapshot;
+    watchdog.snapshot(&snapshot);
+    ASSERT_EQ(snapshot.stall_ring_overflows, 4U);
+    ASSERT_EQ(snapshot.topics.size(), 2U);
+    ASSERT_EQ(snapshot.topics[0].topic_ID, 3U);
+    ASSERT_EQ(snapshot.topics[0].ring_overflows, 3U);
+    ASSERT_EQ(snapshot.topics[1].topic_ID, 4U);
+    ASSERT_EQ(snapshot.topics[1].ring_overflows, 1U);
+}
+
+TEST(LoopWatchdog, max_topics)
+{
+    LoopWatchdog watchdog;
+    watchdog.set_threshold(std::chrono::milliseconds(10));
+    LoopWatchdog::Clock::time_point now = LoopWatchdog::Clock::now();
+
+    for (size_t i = 0; i < LoopWatchdog::MAX_STALL_TOPICS + 4; ++i)
+    {
+        ASSERT_TRUE(pass(&watchdog, &now, 20, static_cast<int>(i)));
+    }
+
+    LoopWatchdog::Snapshot snapshot;
+    watchdog.snapshot(&snapshot);
+    ASSERT_EQ(snapshot.stalls, LoopWatchdog::MAX_STALL_TOPICS + 4);
+    ASSERT_EQ(snapshot.topics.size(), LoopWatchdog::MAX_STALL_TOPICS);
+}
+
+TEST(LoopWatchdog, check)
+{
+    LoopWatchdog watchdog;
+    watchdog.set_threshold(std::chrono::milliseconds(10));
+    LoopWatchdog::Clock::time_point start = LoopWatchdog::Clock::now();
+    LoopWatchdog::Stall stall;
+
+    // No pass in progress.
+    ASSERT_FALSE(watchdog.check(start + std::chrono::seconds(1), &stall));
+
+    ASSERT_FALSE(watchdog.in_pass());
+    watchdog.begin(start);
+    ASSERT_TRUE(watchdog.in_pass());
+    ASSERT_FALSE(watchdog.check(start + std::chrono::milliseconds(9), &stall));
+    watchdog.set_topic(12);
+    ASSERT_TRUE(watchdog.check(start + std::chrono::milliseconds(250), &stall));
+    ASSERT_EQ(stall.duration_ns, 250000000U);
+    ASSERT_TRUE(stall.has_topic);
+    ASSERT_EQ(stall.topic_ID, 12U);
+
+    // Once the pass is over, it is a stall like any other.
+    ASSERT_TRUE(watchdog.end(start + std::chrono::milliseconds(300), 0));
+    ASSERT_FALSE(watchdog.in_pass());
+    ASSERT_FALSE(watchdog.check(start + std::chrono::seconds(1), &stall));
+}
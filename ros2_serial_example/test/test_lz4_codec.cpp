@@ -0,0 +1,205 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <sys/uio.h>
+
+#include "ros2_serial_example/lz4_codec.hpp"
+
+using ros2_to_serial_bridge::transport::impl::LZ4Codec;
+
+/// HELPERS
+
+static std::vector<uint8_t> make_random_data(size_t len)
+{
+    std::vector<uint8_t> data(len);
+    uint32_t x = 0x12345678;
+    for (size_t i = 0; i < len; ++i)
+    {
+        x = x * 1103515245U + 12345U;
+        data[i] = static_cast<uint8_t>(x >> 16U);
+    }
+
+    return data;
+}
+
+// Data that looks a bit like a serialized message: mostly small, repeating
+// fields with the occasional changing byte.
+static std::vector<uint8_t> make_message_data(size_t len, uint8_t salt)
+{
+    std::vector<uint8_t> data(len);
+    for (size_t i = 0; i < len; ++i)
+    {
+        data[i] = static_cast<uint8_t>((i % 16) < 4 ? i / 16 : (i % 16) * 3);
+    }
+    if (len > 0)
+    {
+        data[len / 2] = salt;
+    }
+
+    return data;
+}
+
+static std::vector<uint8_t> compress(LZ4Codec * codec, const std::vector<uint8_t> & data)
+{
+    std::vector<uint8_t> out(LZ4Codec::compress_bound(data.size()));
+    struct iovec iov;
+    iov.iov_base = const_cast<uint8_t *>(data.data());
+    iov.iov_len = data.size();
+    size_t len = codec->compress(&iov, 1, out.data(), out.size());
+    EXPECT_GT(len, 0U);
+    out.resize(len);
+
+    return out;
+}
+
+static std::vector<uint8_t> decompress(const LZ4Codec & codec, const std::vector<uint8_t> & data, size_t max_len)
+{
+    std::vector<uint8_t> out(max_len);
+    ssize_t len = codec.decompress(data.data(), data.size(), out.data(), out.size());
+    EXPECT_GE(len, 0);
+    out.resize(len < 0 ? 0 : static_cast<size_t>(len));
+
+    return out;
+}
+
+/// TESTS
+
+TEST(LZ4Codec, roundtrip_all_lengths)
+{
+    LZ4Codec codec;
+    for (size_t len = 0; len < 300; ++len)
+    {
+        std::vector<uint8_t> data = make_message_data(len, 0xaa);
+        std::vector<uint8_t> c = compress(&codec, data);
+        ASSERT_EQ(decompress(codec, c, len), data) << "length " << len;
+    }
+}
+
+TEST(LZ4Codec, roundtrip_large)
+{
+    LZ4Codec codec;
+    std::vector<uint8_t> data = make_message_data(200000, 0x55);
+    std::vector<uint8_t> c = compress(&codec, data);
+    ASSERT_LT(c.size(), data.size() / 4);
+    ASSERT_EQ(decompress(codec, c, data.size()), data);
+}
+
+TEST(LZ4Codec, incompressible)
+{
+    LZ4Codec codec;
+    std::vector<uint8_t> data = make_random_data(1000);
+    std::vector<uint8_t> c = compress(&codec, data);
+    ASSERT_LE(c.size(), LZ4Codec::compress_bound(data.size()));
+    ASSERT_EQ(decompress(codec, c, data.size()), data);
+
+    // If the output buffer is too small to hold the result, compress fails.
+    std::vector<uint8_t> out(data.size());
+    struct iovec iov{data.data(), data.size()};
+    ASSERT_EQ(codec.compress(&iov, 1, out.data(), out.size()), 0U);
+}
+
+TEST(LZ4Codec, scattered_input)
+{
+    LZ4Codec codec;
+    std::vector<uint8_t> data = make_message_data(500, 0x12);
+    struct iovec iov[3];
+    iov[0].iov_base = &data[0];
+    iov[0].iov_len = 7;
+    iov[1].iov_base = &data[7];
+    iov[1].iov_len = 0;
+    iov[2].iov_base = &data[7];
+    iov[2].iov_len = data.size() - 7;
+    std::vector<uint8_t> out(LZ4Codec::compress_bound(data.size()));
+    size_t len = codec.compress(iov, 3, out.data(), out.size());
+    ASSERT_GT(len, 0U);
+    out.resize(len);
+    ASSERT_EQ(out, compress(&codec, data));
+    ASSERT_EQ(decompress(codec, out, data.size()), data);
+}
+
+TEST(LZ4Codec, dictionary)
+{
+    std::vector<uint8_t> dictionary = make_message_data(64, 0x00);
+    LZ4Codec plain;
+    LZ4Codec with_dict(dictionary);
+    std::vector<uint8_t> data = make_message_data(64, 0x01);
+
+    std::vector<uint8_t> c_plain = compress(&plain, data);
+    std::vector<uint8_t> c_dict = compress(&with_dict, data);
+    ASSERT_LT(c_dict.size(), c_plain.size());
+    ASSERT_EQ(decompress(with_dict, c_dict, data.size()), data);
+
+    // The same codec can be used again; the dictionary isn't changed by the
+    // previous message.
+    ASSERT_EQ(compress(&with_dict, data), c_dict);
+
+    // A codec without the dictionary cannot decode the data.
+    std::vector<uint8_t> out(data.size());
+    ssize_t len = plain.decompress(c_dict.data(), c_dict.size(), out.data(), out.size());
+    ASSERT_TRUE(len < 0 || out != data);
+}
+
+TEST(LZ4Codec, reference_block)
+{
+    // A block built by hand from the format description: 4 literals, a
+    // 4-byte match at offset 4, then 5 final literals.
+    const std::vector<uint8_t> block{0x40, 'a', 'b', 'c', 'd', 0x04, 0x00, 0x50, 'a', 'b', 'c', 'd', 'e'};
+    const char expected[] = "abcdabcdabcde";
+
+    LZ4Codec codec;
+    std::vector<uint8_t> out = decompress(codec, block, 100);
+    ASSERT_EQ(out.size(), ::strlen(expected));
+    ASSERT_EQ(::memcmp(out.data(), expected, out.size()), 0);
+}
+
+TEST(LZ4Codec, corrupt_input)
+{
+    LZ4Codec codec;
+    std::vector<uint8_t> data = make_message_data(300, 0x34);
+    std::vector<uint8_t> c = compress(&codec, data);
+    std::vector<uint8_t> out(data.size());
+
+    // Output buffer too small.
+    ASSERT_EQ(codec.decompress(c.data(), c.size(), out.data(), out.size() - 1), -1);
+
+    // Truncated input either fails or decodes to something shorter (a block
+    // can be cut right after a run of literals and still be valid).
+    for (size_t len = 0; len < c.size(); ++len)
+    {
+        ASSERT_LT(codec.decompress(c.data(), len, out.data(), out.size()), static_cast<ssize_t>(data.size()))
+            << "length " << len;
+    }
+
+    // A match offset that points before the start of the output.
+    const std::vector<uint8_t> bad_offset{0x40, 'a', 'b', 'c', 'd', 0x10, 0x00, 0x50, 'a', 'b', 'c', 'd', 'e'};
+    ASSERT_EQ(codec.decompress(bad_offset.data(), bad_offset.size(), out.data(), out.size()), -1);
+
+    // A zero match offset.
+    const std::vector<uint8_t> zero_offset{0x40, 'a', 'b', 'c', 'd', 0x00, 0x00, 0x50, 'a', 'b', 'c', 'd', 'e'};
+    ASSERT_EQ(codec.decompress(zero_offset.data(), zero_offset.size(), out.data(), out.size()), -1);
+
+    // Random garbage must never crash.
+    for (size_t i = 0; i < 200; ++i)
+    {
+        std::vector<uint8_t> garbage = make_random_data(i + 1);
+        garbage[0] = static_cast<uint8_t>(i);
+        codec.decompress(garbage.data(), garbage.size(), out.data(), out.size());
+    }
+}
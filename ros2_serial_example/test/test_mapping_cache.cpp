@@ -0,0 +1,117 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "ros2_serial_example/mapping_cache.hpp"
+
+using ros2_to_serial_bridge::transport::MappingCache;
+
+/// FIXTURES
+
+class MappingCacheFixture : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        char dir[] = "/tmp/test_mapping_cache_XXXXXX";
+        ASSERT_NE(::mkdtemp(dir), nullptr);
+        dir_ = dir;
+    }
+
+    void TearDown() override
+    {
+        for (const std::string & path : paths_)
+        {
+            ::unlink(path.c_str());
+        }
+        ::rmdir(dir_.c_str());
+    }
+
+    MappingCache make_cache(const std::string & device)
+    {
+        MappingCache cache(dir_, device);
+        paths_.push_back(cache.get_path());
+        return cache;
+    }
+
+    std::string dir_;
+    std::vector<std::string> paths_;
+};
+
+/// TESTS
+
+TEST(MappingCache, hash_device)
+{
+    // The FNV-1a reference values.
+    ASSERT_EQ(MappingCache::hash_device(""), 0xcbf29ce484222325ULL);
+    ASSERT_EQ(MappingCache::hash_device("a"), 0xaf63dc4c8601ec8cULL);
+    ASSERT_NE(MappingCache::hash_device("uart:/dev/ttyACM0"), MappingCache::hash_device("uart:/dev/ttyACM1"));
+}
+
+TEST_F(MappingCacheFixture, store_load)
+{
+    MappingCache cache = make_cache("uart:/dev/ttyACM0");
+    std::vector<uint8_t> payload;
+    ASSERT_FALSE(cache.load(&payload));
+
+    std::vector<uint8_t> mapping{0x01, 0x00, 0x00, 0x00, 0x05, 0x00, 0x00, 0x00, 'h', 'e', 'l', 'l', 'o'};
+    ASSERT_TRUE(cache.store(mapping.data(), mapping.size()));
+    ASSERT_TRUE(cache.load(&payload));
+    ASSERT_EQ(payload, mapping);
+
+    // Another device has its own file.
+    MappingCache other = make_cache("uart:/dev/ttyACM1");
+    ASSERT_NE(other.get_path(), cache.get_path());
+    ASSERT_FALSE(other.load(&payload));
+
+    // A new mapping replaces the old one.
+    mapping.push_back('!');
+    ASSERT_TRUE(cache.store(mapping.data(), mapping.size()));
+    ASSERT_TRUE(cache.load(&payload));
+    ASSERT_EQ(payload, mapping);
+
+    ASSERT_FALSE(cache.store(mapping.data(), 0));
+}
+
+TEST_F(MappingCacheFixture, damaged)
+{
+    MappingCache cache = make_cache("udp:5000");
+    std::vector<uint8_t> mapping{0x01, 0x02, 0x03, 0x04, 0x05, 0x06};
+    ASSERT_TRUE(cache.store(mapping.data(), mapping.size()));
+
+    // Flip a payload byte.
+    FILE * fp = ::fopen(cache.get_path().c_str(), "r+b");
+    ASSERT_NE(fp, nullptr);
+    ASSERT_EQ(::fseek(fp, 14, SEEK_SET), 0);
+    ASSERT_NE(::fputc(0xff, fp), EOF);
+    ASSERT_EQ(::fclose(fp), 0);
+
+    std::vector<uint8_t> payload;
+    ASSERT_FALSE(cache.load(&payload));
+    ASSERT_TRUE(payload.empty());
+
+    // Truncate it.
+    ASSERT_TRUE(cache.store(mapping.data(), mapping.size()));
+    ASSERT_EQ(::truncate(cache.get_path().c_str(), 15), 0);
+    ASSERT_FALSE(cache.load(&payload));
+}
@@ -0,0 +1,279 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <thread>
+#include <vector>
+
+#include "ros2_serial_example/metrics.hpp"
+
+using ros2_to_serial_bridge::transport::Metrics;
+using ros2_to_serial_bridge::transport::impl::LatencyHistogram;
+
+/// TESTS
+
+TEST(LatencyHistogram, buckets)
+{
+    // Small values have a bucket each.
+    for (uint64_t value = 0; value < 2 * LatencyHistogram::SUB_BUCKETS; ++value)
+    {
+        ASSERT_EQ(LatencyHistogram::bucket_index(value), value);
+        ASSERT_EQ(LatencyHistogram::bucket_max(value), value);
+    }
+
+    // Every value is in a bucket no wider than 1/SUB_BUCKETS of it, and the
+    // buckets cover the whole range without gaps.
+    ASSERT_EQ(LatencyHistogram::bucket_index(std::numeric_limits<uint64_t>::max()), LatencyHistogram::NUM_BUCKETS - 1);
+    ASSERT_EQ(LatencyHistogram::bucket_max(LatencyHistogram::NUM_BUCKETS - 1), std::numeric_limits<uint64_t>::max());
+    for (size_t i = 1; i < LatencyHistogram::NUM_BUCKETS; ++i)
+    {
+        uint64_t lowest = LatencyHistogram::bucket_max(i - 1) + 1;
+        uint64_t highest = LatencyHistogram::bucket_max(i);
+        ASSERT_EQ(LatencyHistogram::bucket_index(lowest), i);
+        ASSERT_EQ(LatencyHistogram::bucket_index(highest), i);
+        ASSERT_LE(highest - lowest, lowest / LatencyHistogram::SUB_BUCKETS);
+    }
+}
+
+TEST(LatencyHistogram, percentile)
+{
+    LatencyHistogram histogram;
+    LatencyHistogram::Snapshot snapshot;
+
+    histogram.snapshot(&snapshot);
+    ASSERT_EQ(snapshot.count, 0U);
+    ASSERT_EQ(snapshot.percentile(50.0), 0U);
+
+    for (uint64_t value = 1; value <= 1000; ++value)
+    {
+        histogram.record(value);
+    }
+    histogram.snapshot(&snapshot);
+    ASSERT_EQ(snapshot.count, 1000U);
+    ASSERT_EQ(snapshot.sum, 500500U);
+    ASSERT_EQ(snapshot.max, 1000U);
+
+    // The estimates are the top of the bucket the percentile is in.
+    uint64_t p50 = snapshot.percentile(50.0);
+    ASSERT_GE(p50, 500U);
+    ASSERT_LE(p50, 500U + 500U / LatencyHistogram::SUB_BUCKETS);
+    uint64_t p99 = snapshot.percentile(99.0);
+    ASSERT_GE(p99, 990U);
+    ASSERT_LE(p99, 1000U);
+    ASSERT_EQ(snapshot.percentile(100.0), 1000U);
+    ASSERT_EQ(snapshot.percentile(0.0), 1U);
+}
+
+TEST(Metrics, counters)
+{
+    Metrics metrics;
+    Metrics::Snapshot snapshot;
+
+    metrics.snapshot(&snapshot);
+    ASSERT_TRUE(snapshot.rx.empty());
+    ASSERT_TRUE(snapshot.tx.empty());
+
+    // Topics are reported in order of their IDs, whichever block they are
+    // in, and separately for each direction.
+    metrics.message(Metrics::Direction::RX, 0x1234, 10);
+    metrics.message(Metrics::Direction::RX, 0x5, 3);
+    metrics.message(Metrics::Direction::RX, 0x5, 4);
+    metrics.drop(Metrics::Direction::RX, 0x5, Metrics::Drop::CRC);
+    metrics.drop(Metrics::Direction::RX, 0x5, Metrics::Drop::DESERIALIZE);
+    metrics.drop(Metrics::Direction::RX, 0xffff, Metrics::Drop::DECODE);
+    metrics.drop(Metrics::Direction::TX, 0x5, Metrics::Drop::OVERSIZE);
+    metrics.drop(Metrics::Direction::TX, 0x5, Metrics::Drop::WRITE);
+    metrics.drop(Metrics::Direction::TX, 0x5, Metrics::Drop::STALE);
+    metrics.drop(Metrics::Direction::TX, 0x5, Metrics::Drop::TIMEOUT);
+    metrics.garbage(7);
+    metrics.garbage(2);
+    metrics.set_ring_overflow_bytes(100);
+    metrics.set_ring_buffer_usage(16384, 12000);
+    metrics.read_error();
+
+    metrics.snapshot(&snapshot);
+    ASSERT_EQ(snapshot.rx.size(), 3U);
+    ASSERT_EQ(snapshot.rx[0].topic_ID, 0x5);
+    ASSERT_EQ(snapshot.rx[0].messages, 2U);
+    ASSERT_EQ(snapshot.rx[0].bytes, 7U);
+    ASSERT_EQ(snapshot.rx[0].crc_failures, 1U);
+    ASSERT_EQ(snapshot.rx[0].deserialize_failures, 1U);
+    ASSERT_EQ(snapshot.rx[1].topic_ID, 0x1234);
+    ASSERT_EQ(snapshot.rx[1].messages, 1U);
+    ASSERT_EQ(snapshot.rx[1].bytes, 10U);
+    ASSERT_EQ(snapshot.rx[2].topic_ID, 0xffff);
+    ASSERT_EQ(snapshot.rx[2].messages, 0U);
+    ASSERT_EQ(snapshot.rx[2].decode_failures, 1U);
+
+    ASSERT_EQ(snapshot.tx.size(), 1U);
+    ASSERT_EQ(snapshot.tx[0].topic_ID, 0x5);
+    ASSERT_EQ(snapshot.tx[0].messages, 0U);
+    ASSERT_EQ(snapshot.tx[0].oversize_drops, 1U);
+    ASSERT_EQ(snapshot.tx[0].write_failures, 1U);
+    ASSERT_EQ(snapshot.tx[0].stale_drops, 1U);
+    ASSERT_EQ(snapshot.tx[0].timeouts, 1U);
+
+    ASSERT_EQ(snapshot.garbage_bytes, 9U);
+    ASSERT_EQ(snapshot.ring_overflow_bytes, 100U);
+    ASSERT_EQ(snapshot.ring_buffer_capacity, 16384U);
+    ASSERT_EQ(snapshot.ring_buffer_high_water, 12000U);
+    ASSERT_EQ(snapshot.read_errors, 1U);
+}
+
+TEST(Metrics, sequence)
+{
+    Metrics metrics;
+    Metrics::Snapshot snapshot;
+
+    // Each topic counts its own frames, wrapping around after 255.
+    ASSERT_EQ(metrics.next_sequence(0x5), 0U);
+    ASSERT_EQ(metrics.next_sequence(0x5), 1U);
+    ASSERT_EQ(metrics.next_sequence(0x1234), 0U);
+    for (size_t i = 2; i < 256; ++i)
+    {
+        ASSERT_EQ(metrics.next_sequence(0x5), i);
+    }
+    ASSERT_EQ(metrics.next_sequence(0x5), 0U);
+
+    // The first frame of a topic can have any number.
+    metrics.sequence(0x5, 254);
+    metrics.sequence(0x5, 255);
+    metrics.sequence(0x5, 2);  // 0 and 1 lost
+    metrics.sequence(0x5, 2);  // duplicate
+    metrics.sequence(0x5, 1);  // late
+    metrics.sequence(0x5, 3);
+    metrics.sequence(0x5, 200);  // the other end started over
+    metrics.sequence(0x5, 201);
+    metrics.sequence(0x1234, 7);
+    metrics.sequence(0x1234, 8);
+
+    metrics.snapshot(&snapshot);
+    ASSERT_EQ(snapshot.rx.size(), 1U);
+    ASSERT_EQ(snapshot.rx[0].topic_ID, 0x5);
+    ASSERT_EQ(snapshot.rx[0].messages, 0U);
+    ASSERT_EQ(snapshot.rx[0].sequence_gaps, 2U);
+    ASSERT_EQ(snapshot.rx[0].sequence_duplicates, 1U);
+    ASSERT_EQ(snapshot.rx[0].sequence_reorders, 1U);
+    ASSERT_TRUE(snapshot.tx.empty());
+}
+
+TEST(Metrics, timing)
+{
+    Metrics metrics;
+    Metrics::Snapshot snapshot;
+
+    // Times taken while timing is off are never recorded.
+    Metrics::Clock::time_point start = metrics.now();
+    ASSERT_EQ(start, Metrics::Clock::time_point());
+    metrics.record(Metrics::Stage::DISPATCH, start, metrics.now());
+
+    metrics.set_timing(true);
+    start = metrics.now();
+    metrics.record(Metrics::Stage::DISPATCH, start, start + std::chrono::microseconds(5));
+    metrics.record(Metrics::Stage::SERIALIZE, Metrics::Clock::time_point(), metrics.now());
+
+    metrics.snapshot(&snapshot);
+    const LatencyHistogram::Snapshot & dispatch = snapshot.latency[static_cast<size_t>(Metrics::Stage::DISPATCH)];
+    ASSERT_EQ(dispatch.count, 1U);
+    ASSERT_EQ(dispatch.max, 5000U);
+    ASSERT_EQ(snapshot.latency[static_cast<size_t>(Metrics::Stage::SERIALIZE)].count, 0U);
+}
+
+TEST(Metrics, concurrent)
+{
+    Metrics metrics;
+    metrics.set_timing(true);
+
+    // Several threads counting on the same and on different topics, while
+    // snapshots are taken; nothing may be lost.
+    constexpr size_t NUM_THREADS = 4;
+    constexpr uint64_t COUNT = 10000;
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < NUM_THREADS; ++t)
+    {
+        threads.emplace_back([&metrics, t]() {
+            for (uint64_t i = 0; i < COUNT; ++i)
+            {
+                metrics.message(Metrics::Direction::TX, 0x100, 1);
+                metrics.message(Metrics::Direction::TX, static_cast<topic_id_size_t>(0x200 * (t + 1)), 2);
+                Metrics::Clock::time_point start = metrics.now();
+                metrics.record(Metrics::Stage::FRAME, start, start + std::chrono::nanoseconds(i));
+            }
+        });
+    }
+
+    Metrics::Snapshot snapshot;
+    for (int i = 0; i < 100; ++i)
+    {
+        metrics.snapshot(&snapshot);
+    }
+
+    for (auto & thread : threads)
+    {
+        thread.join();
+    }
+
+    metrics.snapshot(&snapshot);
+    ASSERT_EQ(snapshot.tx.size(), NUM_THREADS + 1);
+    ASSERT_EQ(snapshot.tx[0].topic_ID, 0x100);
+    ASSERT_EQ(snapshot.tx[0].messages, NUM_THREADS * COUNT);
+    for (size_t t = 0; t < NUM_THREADS; ++t)
+    {
+        ASSERT_EQ(snapshot.tx[t + 1].messages, COUNT);
+        ASSERT_EQ(snapshot.tx[t + 1].bytes, 2 * COUNT);
+    }
+    ASSERT_EQ(snapshot.latency[static_cast<size_t>(Metrics::Stage::FRAME)].count, NUM_THREADS * COUNT);
+    ASSERT_EQ(snapshot.latency[static_cast<size_t>(Metrics::Stage::FRAME)].max, COUNT - 1);
+}
+
+TEST(Metrics, concurrent_sequence)
+{
+    Metrics metrics;
+
+    // Several threads taking sequence numbers for the same topic; each
+    // number must be handed out exactly as often as the others.
+    constexpr size_t NUM_THREADS = 4;
+    constexpr size_t COUNT = 256 * 100;
+    std::vector<std::vector<size_t>> seen(NUM_THREADS, std::vector<size_t>(256));
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < NUM_THREADS; ++t)
+    {
+        threads.emplace_back([&metrics, &seen, t]() {
+            for (size_t i = 0; i < COUNT; ++i)
+            {
+                seen[t][metrics.next_sequence(0x5)]++;
+            }
+        });
+    }
+    for (auto & thread : threads)
+    {
+        thread.join();
+    }
+
+    for (size_t seq = 0; seq < 256; ++seq)
+    {
+        size_t total = 0;
+        for (size_t t = 0; t < NUM_THREADS; ++t)
+        {
+            total += seen[t][seq];
+        }
+        ASSERT_EQ(total, NUM_THREADS * COUNT / 256) << seq;
+    }
+    ASSERT_EQ(metrics.next_sequence(0x5), 0U);
+}
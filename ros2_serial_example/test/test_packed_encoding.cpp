@@ -0,0 +1,288 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gtest/gtest.h>
+
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "ros2_serial_example/packed_encoding.hpp"
+#include "ros2_serial_example/string_interner.hpp"
+
+using ros2_to_serial_bridge::pubsub::FieldRule;
+using ros2_to_serial_bridge::pubsub::InternTable;
+using ros2_to_serial_bridge::pubsub::PackedField;
+using ros2_to_serial_bridge::pubsub::PackedReader;
+using ros2_to_serial_bridge::pubsub::PackedWriter;
+using ros2_to_serial_bridge::pubsub::QuantizationProfile;
+using ros2_to_serial_bridge::pubsub::StringInterner;
+
+/// HELPERS
+
+struct Cell
+{
+    float voltage{0.0f};
+    uint8_t status{0};
+};
+
+struct Battery
+{
+    std::string frame_id;
+    double altitude{0.0};
+    std::array<float, 3> currents{};
+    std::vector<double> history;
+    bool charging{false};
+    std::vector<Cell> cells;
+};
+
+// The packing struct generate_ros2_topics.py makes for Battery.
+struct BatteryPacking final
+{
+    static const PackedField * fields(size_t * count)
+    {
+        static const PackedField FIELDS[] = {
+            {"frame_id", PackedField::Kind::STRING},
+            {"altitude", PackedField::Kind::FLOAT64},
+            {"currents", PackedField::Kind::FLOAT32},
+            {"history", PackedField::Kind::FLOAT64},
+            {"charging", PackedField::Kind::BOOLEAN},
+            {"cells.voltage", PackedField::Kind::FLOAT32},
+            {"cells.status", PackedField::Kind::INTEGER},
+        };
+        *count = sizeof(FIELDS) / sizeof(FIELDS[0]);
+        return FIELDS;
+    }
+
+    static void encode(const Battery & msg, PackedWriter & writer)
+    {
+        writer.put_string(msg.frame_id);
+        writer.put<8>(msg.altitude, 1);
+        writer.put_array<4>(msg.currents.data(), 3, 2);
+        writer.put_field_length(msg.history.size(), 3);
+        writer.put_array<8>(msg.history.data(), msg.history.size(), 3);
+        writer.put<1>(msg.charging, 4);
+        writer.put_length(msg.cells.size());
+        for (size_t i0 = 0; i0 < msg.cells.size(); ++i0)
+        {
+            writer.put<4>(msg.cells[i0].voltage, 5);
+            writer.put<1>(msg.cells[i0].status, 6);
+        }
+    }
+
+    static bool decode(PackedReader & reader, Battery & msg)
+    {
+        reader.get_string(msg.frame_id);
+        reader.get<8>(msg.altitude, 1);
+        reader.get_array<4>(msg.currents.data(), 3, 2);
+        msg.history.resize(reader.get_field_length(3, 8));
+        reader.get_array<8>(msg.history.data(), msg.history.size(), 3);
+        reader.get<1>(msg.charging, 4);
+        msg.cells.resize(reader.get_length(1));
+        for (size_t i0 = 0; i0 < msg.cells.size(); ++i0)
+        {
+            reader.get<4>(msg.cells[i0].voltage, 5);
+            reader.get<1>(msg.cells[i0].status, 6);
+        }
+        return reader.finish();
+    }
+};
+
+static Battery make_battery()
+{
+    Battery msg;
+    msg.frame_id = "battery";
+    msg.altitude = 1234.56789012345;
+    msg.currents = {1.25f, -0.5f, 3.0f};
+    msg.history = {12.1, 12.05, 11.9};
+    msg.charging = true;
+    msg.cells = {{4.101f, 1}, {4.087f, 2}};
+    return msg;
+}
+
+static QuantizationProfile parse(const std::vector<std::string> & specs)
+{
+    QuantizationProfile profile;
+    size_t count;
+    const PackedField * fields = BatteryPacking::fields(&count);
+    std::string error;
+    EXPECT_TRUE(profile.parse(specs, fields, count, &error)) << error;
+    return profile;
+}
+
+static std::vector<uint8_t> encode(const Battery & msg, const FieldRule * rules, StringInterner * interner = nullptr)
+{
+    std::vector<uint8_t> payload;
+    PackedWriter writer(&payload, interner, rules);
+    BatteryPacking::encode(msg, writer);
+    return payload;
+}
+
+static bool decode(const std::vector<uint8_t> & payload, const FieldRule * rules, Battery * msg,
+                   InternTable * table = nullptr)
+{
+    PackedReader reader(payload.data(), payload.size(), table, rules);
+    return BatteryPacking::decode(reader, *msg);
+}
+
+/// TESTS
+
+TEST(PackedEncoding, full)
+{
+    Battery in = make_battery();
+    Battery out;
+
+    // Without interning, the string is a literal and there is no header.
+    std::vector<uint8_t> payload = encode(in, nullptr);
+    ASSERT_EQ(payload.size(), (2U + 7U) + 8U + 12U + (1U + 24U) + 1U + (1U + 2U * 5U));
+    ASSERT_TRUE(decode(payload, nullptr, &out));
+    ASSERT_EQ(out.frame_id, in.frame_id);
+    ASSERT_EQ(out.altitude, in.altitude);
+    ASSERT_EQ(out.currents, in.currents);
+    ASSERT_EQ(out.history, in.history);
+    ASSERT_TRUE(out.charging);
+    ASSERT_EQ(out.cells.size(), 2U);
+    ASSERT_EQ(out.cells[1].voltage, in.cells[1].voltage);
+    ASSERT_EQ(out.cells[1].status, 2U);
+
+    // A string interned by the sender can't be decoded without a table.
+    StringInterner interner(1);
+    std::vector<uint8_t> interned = encode(in, nullptr, &interner);
+    InternTable table;
+    ASSERT_TRUE(decode(interned, nullptr, &out, &table));
+    ASSERT_FALSE(decode(std::vector<uint8_t>(interned.begin() + 2, interned.end()), nullptr, &out));
+}
+
+TEST(PackedEncoding, quantized)
+{
+    QuantizationProfile profile = parse({"altitude:float32", "currents:fixed16:0.01", "history:fixed8:0.1",
+                                         "cells.voltage:fixed16:0.001"});
+    Battery in = make_battery();
+    Battery out;
+
+    std::vector<uint8_t> payload = encode(in, profile.rules());
+    ASSERT_EQ(payload.size(), (2U + 7U) + 4U + 6U + (1U + 3U) + 1U + (1U + 2U * 3U));
+    ASSERT_LT(payload.size() * 2, encode(in, nullptr).size());
+    ASSERT_TRUE(decode(payload, profile.rules(), &out));
+
+    ASSERT_EQ(out.altitude, static_cast<double>(static_cast<float>(in.altitude)));
+    ASSERT_NEAR(out.currents[0], 1.25f, 0.005f);
+    ASSERT_NEAR(out.currents[1], -0.5f, 0.005f);
+    ASSERT_EQ(out.history.size(), 3U);
+    ASSERT_NEAR(out.history[1], 12.1, 0.05);
+    ASSERT_NEAR(out.cells[0].voltage, 4.101f, 0.0005f);
+    ASSERT_NEAR(out.cells[1].voltage, 4.087f, 0.0005f);
+    ASSERT_EQ(out.cells[1].status, 2U);
+}
+
+TEST(PackedEncoding, saturate)
+{
+    QuantizationProfile profile = parse({"altitude:fixed16:1", "history:fixed8:1"});
+    Battery in = make_battery();
+    in.altitude = 100000.0;
+    in.history = {-1000.0, std::numeric_limits<double>::quiet_NaN(), std::numeric_limits<double>::infinity()};
+    Battery out;
+
+    ASSERT_TRUE(decode(encode(in, profile.rules()), profile.rules(), &out));
+    ASSERT_EQ(out.altitude, 32767.0);
+    ASSERT_EQ(out.history[0], -127.0);
+    ASSERT_TRUE(std::isnan(out.history[1]));
+    ASSERT_EQ(out.history[2], 127.0);
+
+    in.altitude = std::numeric_limits<double>::quiet_NaN();
+    ASSERT_TRUE(decode(encode(in, profile.rules()), profile.rules(), &out));
+    ASSERT_TRUE(std::isnan(out.altitude));
+}
+
+TEST(PackedEncoding, drop)
+{
+    QuantizationProfile profile = parse({"altitude:drop", "currents:drop", "history:drop", "charging:drop",
+                                         "cells.status:drop"});
+    Battery in = make_battery();
+    Battery out = make_battery();
+
+    std::vector<uint8_t> payload = encode(in, profile.rules());
+    ASSERT_EQ(payload.size(), (2U + 7U) + (1U + 2U * 4U));
+    ASSERT_TRUE(decode(payload, profile.rules(), &out));
+    ASSERT_EQ(out.frame_id, in.frame_id);
+    ASSERT_EQ(out.altitude, 0.0);
+    ASSERT_EQ(out.currents[0], 0.0f);
+    ASSERT_TRUE(out.history.empty());
+    ASSERT_FALSE(out.charging);
+    ASSERT_EQ(out.cells.size(), 2U);
+    ASSERT_EQ(out.cells[0].voltage, in.cells[0].voltage);
+    ASSERT_EQ(out.cells[0].status, 0U);
+
+    // Truncated anywhere, the payload fails to decode.
+    for (size_t length = 0; length < payload.size(); ++length)
+    {
+        ASSERT_FALSE(decode(std::vector<uint8_t>(payload.begin(), payload.begin() + length), profile.rules(), &out));
+    }
+}
+
+TEST(PackedEncoding, interned)
+{
+    QuantizationProfile profile = parse({"altitude:float32"});
+    StringInterner interner(9);
+    InternTable table;
+    Battery out;
+
+    ASSERT_TRUE(decode(encode(make_battery(), profile.rules(), &interner), profile.rules(), &out, &table));
+    std::vector<uint8_t> payload = encode(make_battery(), profile.rules(), &interner);
+    ASSERT_TRUE(decode(payload, profile.rules(), &out, &table));
+    ASSERT_EQ(out.frame_id, "battery");
+    // The header, a reference to the string and the float32 altitude.
+    ASSERT_EQ(payload.size(), 2U + 1U + 4U + 12U + (1U + 24U) + 1U + (1U + 2U * 5U));
+}
+
+TEST(PackedEncoding, profile)
+{
+    size_t count;
+    const PackedField * fields = BatteryPacking::fields(&count);
+    QuantizationProfile profile;
+    std::string error;
+
+    ASSERT_TRUE(profile.parse({}, fields, count, &error));
+    ASSERT_EQ(profile.rules(), nullptr);
+
+    ASSERT_TRUE(profile.parse({"cells.voltage:fixed8:0.05"}, fields, count, &error));
+    ASSERT_NE(profile.rules(), nullptr);
+    ASSERT_EQ(profile.rules()[5].scale, 0.05);
+
+    const std::vector<std::string> bad[] = {
+        {"altitude"},
+        {"altitude:float16"},
+        {"missing:drop"},
+        {"cells:drop"},
+        {"currents:float32"},
+        {"charging:fixed16:1"},
+        {"altitude:fixed16"},
+        {"altitude:fixed16:0"},
+        {"altitude:fixed16:-1"},
+        {"altitude:fixed16:1x"},
+        {"altitude:drop:1"},
+        {"frame_id:drop"},
+        {"altitude:drop", "altitude:float32"},
+    };
+    for (const std::vector<std::string> & specs : bad)
+    {
+        error.clear();
+        ASSERT_FALSE(profile.parse(specs, fields, count, &error)) << specs[0];
+        ASSERT_FALSE(error.empty());
+    }
+}
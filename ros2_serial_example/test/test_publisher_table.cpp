@@ -0,0 +1,156 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <random>
+#include <vector>
+
+#include "ros2_serial_example/publisher.hpp"
+#include "ros2_serial_example/publisher_table.hpp"
+
+using ros2_to_serial_bridge::pubsub::PublisherTable;
+
+/// HELPERS
+
+class PublisherCounter : public ros2_to_serial_bridge::pubsub::Publisher
+{
+public:
+    bool dispatch(uint8_t *data_buffer, ssize_t length, std::chrono::system_clock::time_point receive_time) override
+    {
+        (void)data_buffer;
+        (void)length;
+        (void)receive_time;
+        count_++;
+        return true;
+    }
+
+    size_t count_{0};
+};
+
+/// TESTS
+
+TEST(PublisherTable, flat)
+{
+    PublisherTable<uint8_t> table;
+    PublisherCounter a;
+    PublisherCounter b;
+
+    for (size_t i = 0; i < 256; ++i)
+    {
+        ASSERT_EQ(table.find(static_cast<uint8_t>(i)), nullptr);
+    }
+
+    table.insert(0x2, &a);
+    table.insert(0xff, &b);
+    ASSERT_EQ(table.find(0x2), &a);
+    ASSERT_EQ(table.find(0xff), &b);
+    ASSERT_EQ(table.find(0x3), nullptr);
+
+    table.insert(0x2, &b);
+    ASSERT_EQ(table.find(0x2), &b);
+
+    table.find(0xff)->dispatch(nullptr, 0, std::chrono::system_clock::time_point());
+    ASSERT_EQ(b.count_, 1U);
+
+    table.erase(0x2);
+    table.erase(0x3);
+    ASSERT_EQ(table.find(0x2), nullptr);
+    ASSERT_EQ(table.find(0xff), &b);
+}
+
+TEST(PublisherTable, sorted)
+{
+    PublisherTable<uint16_t> table;
+    PublisherCounter a;
+    PublisherCounter b;
+    PublisherCounter c;
+
+    ASSERT_EQ(table.find(0x2), nullptr);
+
+    // Insert out of order to make sure the table keeps itself sorted.
+    table.insert(0x1234, &a);
+    table.insert(0x2, &b);
+    table.insert(0xffff, &c);
+    ASSERT_EQ(table.find(0x1234), &a);
+    ASSERT_EQ(table.find(0x2), &b);
+    ASSERT_EQ(table.find(0xffff), &c);
+    ASSERT_EQ(table.find(0x3), nullptr);
+    ASSERT_EQ(table.find(0x0), nullptr);
+
+    table.insert(0x2, &c);
+    ASSERT_EQ(table.find(0x2), &c);
+    ASSERT_EQ(table.find(0x1234), &a);
+
+    table.erase(0x1234);
+    table.erase(0x3);
+    ASSERT_EQ(table.find(0x1234), nullptr);
+    ASSERT_EQ(table.find(0x2), &c);
+    ASSERT_EQ(table.find(0xffff), &c);
+}
+
+TEST(PublisherTable, direct)
+{
+    PublisherTable<uint16_t> table;
+    PublisherCounter a;
+    PublisherCounter b;
+
+    // Low IDs go in the direct table however few of them there are.
+    table.insert(0x2, &a);
+    table.insert(0x3f, &b);
+    ASSERT_EQ(table.get_direct_size(), 0x40U);
+    ASSERT_EQ(table.get_overflow_size(), 0U);
+
+    // A run of IDs past that grows the direct table as long as it stays at
+    // least half full, and a sparse one stays in the overflow area.
+    std::vector<PublisherCounter> pubs(200);
+    for (uint16_t i = 0; i < 200; ++i)
+    {
+        table.insert(0x40 + i, &pubs[i]);
+    }
+    table.insert(0x4000, &a);
+    ASSERT_EQ(table.get_direct_size(), 0x40U + 200U);
+    ASSERT_EQ(table.get_overflow_size(), 1U);
+    ASSERT_EQ(table.find(0x2), &a);
+    ASSERT_EQ(table.find(0x3f), &b);
+    ASSERT_EQ(table.find(0x40 + 199), &pubs[199]);
+    ASSERT_EQ(table.find(0x40 + 200), nullptr);
+    ASSERT_EQ(table.find(0x4000), &a);
+
+    // Erasing leaves the direct table as it is.
+    table.erase(0x40);
+    table.erase(0x4000);
+    ASSERT_EQ(table.find(0x40), nullptr);
+    ASSERT_EQ(table.find(0x4000), nullptr);
+    ASSERT_EQ(table.get_direct_size(), 0x40U + 200U);
+    ASSERT_EQ(table.get_overflow_size(), 0U);
+}
+
+TEST(PublisherTable, many)
+{
+    // Thousands of topics, some dense and some scattered over the whole
+    // range, looked up against a std::map.
+    PublisherTable<uint16_t> table;
+    std::vector<PublisherCounter> pubs(4096);
+    std::map<uint16_t, PublisherCounter *> expected;
+    std::mt19937 rng(42);
+    for (size_t i = 0; i < pubs.size(); ++i)
+    {
+        uint16_t topic_ID = (i % 2 == 0) ? static_cast<uint16_t>(i / 2) : static_cast<uint16_t>(rng());
+        table.insert(topic_ID, &pubs[i]);
+        expected[topic_ID] = &pubs[i];
+    }
+    for (size_t i = 0; i < pubs.size(); i += 3)
+    {
+        uint16_t topic_ID = static_cast<uint16_t>(rng());
+        table.erase(topic_ID);
+        expected.erase(topic_ID);
+    }
+
+    ASSERT_GE(table.get_direct_size(), 2048U);
+    for (uint32_t topic_ID = 0; topic_ID <= 0xffff; ++topic_ID)
+    {
+        auto it = expected.find(static_cast<uint16_t>(topic_ID));
+        ASSERT_EQ(table.find(static_cast<uint16_t>(topic_ID)), it == expected.end() ? nullptr : it->second);
+    }
+}
@@ -0,0 +1,181 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "ros2_serial_example/rcu_pointer.hpp"
+
+using ros2_to_serial_bridge::pubsub::RcuPointer;
+
+/// HELPERS
+
+// Poisoned on destruction, so a reader that is still using it notices.
+struct Value final
+{
+    explicit Value(uint64_t v) : value(v), check(~v)
+    {
+    }
+
+    ~Value()
+    {
+        value = 0;
+        check = 0;
+    }
+
+    bool valid() const
+    {
+        return value == ~check;
+    }
+
+    uint64_t value;
+    uint64_t check;
+};
+
+/// TESTS
+
+TEST(RcuPointer, exchange)
+{
+    RcuPointer<Value> rcu(std::make_unique<Value>(1));
+    ASSERT_EQ(rcu.read()->value, 1U);
+    ASSERT_EQ(rcu.current().value, 1U);
+
+    std::unique_ptr<Value> old = rcu.exchange(std::make_unique<Value>(2));
+    ASSERT_EQ(old->value, 1U);
+    ASSERT_EQ(rcu.read()->value, 2U);
+    ASSERT_EQ(rcu.current().value, 2U);
+}
+
+TEST(RcuPointer, guard_keeps_old)
+{
+    RcuPointer<Value> rcu(std::make_unique<Value>(1));
+    std::atomic<bool> exchanged{false};
+    std::unique_ptr<Value> old;
+
+    std::thread writer;
+    {
+        RcuPointer<Value>::ReadGuard guard = rcu.read();
+        writer = std::thread([&rcu, &exchanged, &old]() {
+            old = rcu.exchange(std::make_unique<Value>(2));
+            exchanged = true;
+        });
+
+        // The writer can't hand the old value back while it is being read.
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        ASSERT_FALSE(exchanged);
+        ASSERT_EQ(guard->value, 1U);
+    }
+    writer.join();
+    ASSERT_TRUE(exchanged);
+    ASSERT_EQ(old->value, 1U);
+    ASSERT_EQ(rcu.read()->value, 2U);
+}
+
+TEST(RcuPointer, concurrent)
+{
+    RcuPointer<Value> rcu(std::make_unique<Value>(0));
+    std::atomic<bool> done{false};
+    uint64_t bad = 0;
+    uint64_t last = 0;
+    uint64_t backwards = 0;
+
+    std::thread reader([&]() {
+        while (!done)
+        {
+            RcuPointer<Value>::ReadGuard guard = rcu.read();
+            if (!guard->valid())
+            {
+                ++bad;
+            }
+            if (guard->value < last)
+            {
+                ++backwards;
+            }
+            last = guard->value;
+        }
+    });
+
+    for (uint64_t i = 1; i <= 20000; ++i)
+    {
+        // Destroying the old value poisons it straight away.
+        rcu.exchange(std::make_unique<Value>(i));
+    }
+    done = true;
+    reader.join();
+
+    ASSERT_EQ(bad, 0U);
+    ASSERT_EQ(backwards, 0U);
+    ASSERT_EQ(rcu.read()->value, 20000U);
+}
+
+TEST(RcuPointer, zero_readers)
+{
+    ASSERT_THROW(RcuPointer<Value>(std::make_unique<Value>(1), 0), std::runtime_error);
+}
+
+TEST(RcuPointer, guard_of_any_reader_keeps_old)
+{
+    RcuPointer<Value> rcu(std::make_unique<Value>(1), 3);
+    std::atomic<bool> exchanged{false};
+    std::unique_ptr<Value> old;
+
+    std::thread writer;
+    {
+        // Only the last reader holds on to the old value.
+        RcuPointer<Value>::ReadGuard guard = rcu.read(2);
+        ASSERT_EQ(rcu.read(0)->value, 1U);
+        writer = std::thread([&rcu, &exchanged, &old]() {
+            old = rcu.exchange(std::make_unique<Value>(2));
+            exchanged = true;
+        });
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        ASSERT_FALSE(exchanged);
+        ASSERT_EQ(guard->value, 1U);
+        ASSERT_EQ(rcu.read(1)->value, 2U);
+    }
+    writer.join();
+    ASSERT_TRUE(exchanged);
+    ASSERT_EQ(old->value, 1U);
+}
+
+TEST(RcuPointer, concurrent_readers)
+{
+    RcuPointer<Value> rcu(std::make_unique<Value>(0), 4);
+    std::atomic<bool> done{false};
+    std::atomic<uint64_t> bad{0};
+
+    std::vector<std::thread> readers;
+    for (size_t r = 0; r < 4; ++r)
+    {
+        readers.emplace_back([&rcu, &done, &bad, r]() {
+            uint64_t last = 0;
+            while (!done)
+            {
+                RcuPointer<Value>::ReadGuard guard = rcu.read(r);
+                if (!guard->valid() || guard->value < last)
+                {
+                    ++bad;
+                }
+                last = guard->value;
+            }
+        });
+    }
+
+    for (uint64_t i = 1; i <= 20000; ++i)
+    {
+        rcu.exchange(std::make_unique<Value>(i));
+    }
+    done = true;
+    for (auto & reader : readers)
+    {
+        reader.join();
+    }
+
+    ASSERT_EQ(bad, 0U);
+    ASSERT_EQ(rcu.read(3)->value, 20000U);
+}
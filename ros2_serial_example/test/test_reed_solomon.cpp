@@ -0,0 +1,169 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include <sys/uio.h>
+
+#include "ros2_serial_example/reed_solomon.hpp"
+
+using ros2_to_serial_bridge::transport::impl::ReedSolomon;
+
+/// HELPERS
+
+static std::vector<uint8_t> make_data(size_t len, uint32_t seed)
+{
+    std::mt19937 rng(seed);
+    std::vector<uint8_t> data(len);
+    for (uint8_t & b : data)
+    {
+        b = static_cast<uint8_t>(rng());
+    }
+
+    return data;
+}
+
+static std::vector<uint8_t> encode(const std::vector<uint8_t> & data)
+{
+    std::vector<uint8_t> encoded(ReedSolomon::encoded_length(data.size()));
+    struct iovec iov{const_cast<uint8_t *>(data.data()), data.size()};
+    EXPECT_EQ(ReedSolomon::encode(&iov, 1, encoded.data()), encoded.size());
+
+    return encoded;
+}
+
+/// TESTS
+
+TEST(ReedSolomon, lengths)
+{
+    ASSERT_EQ(ReedSolomon::encoded_length(0), 0U);
+    ASSERT_EQ(ReedSolomon::encoded_length(1), 33U);
+    ASSERT_EQ(ReedSolomon::encoded_length(223), 255U);
+    ASSERT_EQ(ReedSolomon::encoded_length(224), 288U);
+
+    for (size_t len = 0; len < 1000; ++len)
+    {
+        ASSERT_EQ(ReedSolomon::decoded_length(ReedSolomon::encoded_length(len)), static_cast<ssize_t>(len));
+    }
+
+    // A last block with no room for data can't have come from encode().
+    ASSERT_EQ(ReedSolomon::decoded_length(1), -1);
+    ASSERT_EQ(ReedSolomon::decoded_length(32), -1);
+    ASSERT_EQ(ReedSolomon::decoded_length(255 + 32), -1);
+}
+
+TEST(ReedSolomon, round_trip)
+{
+    for (size_t len : {1, 2, 100, 222, 223, 224, 446, 1000})
+    {
+        std::vector<uint8_t> data = make_data(len, len);
+        std::vector<uint8_t> encoded = encode(data);
+
+        // The code is systematic, so the data is there as it was.
+        ASSERT_TRUE(std::equal(data.begin(), data.begin() + std::min<size_t>(len, 223), encoded.begin()));
+
+        size_t corrected = 99;
+        ASSERT_EQ(ReedSolomon::decode(encoded.data(), encoded.size(), &corrected), static_cast<ssize_t>(len));
+        ASSERT_EQ(corrected, 0U);
+        ASSERT_EQ(std::vector<uint8_t>(encoded.begin(), encoded.begin() + len), data);
+    }
+}
+
+TEST(ReedSolomon, encode_iovecs)
+{
+    std::vector<uint8_t> data = make_data(500, 1);
+    std::vector<uint8_t> encoded = encode(data);
+
+    // Splitting the data across buffers makes no difference.
+    std::vector<uint8_t> split(encoded.size());
+    struct iovec iov[3] = {{data.data(), 10}, {data.data() + 10, 300}, {data.data() + 310, 190}};
+    ASSERT_EQ(ReedSolomon::encode(iov, 3, split.data()), encoded.size());
+    ASSERT_EQ(split, encoded);
+}
+
+TEST(ReedSolomon, correct_errors)
+{
+    std::mt19937 rng(42);
+
+    for (size_t len : {1, 50, 223, 400, 1000})
+    {
+        std::vector<uint8_t> data = make_data(len, len);
+        std::vector<uint8_t> encoded = encode(data);
+
+        // Damage 16 bytes of every block, anywhere in the data or parity.
+        size_t damaged = 0;
+        for (size_t start = 0; start < encoded.size(); start += ReedSolomon::BLOCK_LEN)
+        {
+            size_t n = std::min(encoded.size() - start, ReedSolomon::BLOCK_LEN);
+            std::vector<size_t> positions(n);
+            for (size_t i = 0; i < n; ++i)
+            {
+                positions[i] = i;
+            }
+            std::shuffle(positions.begin(), positions.end(), rng);
+            for (size_t i = 0; i < 16; ++i)
+            {
+                encoded[start + positions[i]] ^= static_cast<uint8_t>(rng() % 255 + 1);
+                ++damaged;
+            }
+        }
+
+        size_t corrected = 0;
+        ASSERT_EQ(ReedSolomon::decode(encoded.data(), encoded.size(), &corrected), static_cast<ssize_t>(len));
+        ASSERT_EQ(corrected, damaged);
+        ASSERT_EQ(std::vector<uint8_t>(encoded.begin(), encoded.begin() + len), data);
+    }
+}
+
+TEST(ReedSolomon, correct_burst)
+{
+    std::vector<uint8_t> data = make_data(223, 7);
+    std::vector<uint8_t> encoded = encode(data);
+
+    // A burst of 16 bytes (128 bits) is 16 errors like any other.
+    for (size_t i = 100; i < 116; ++i)
+    {
+        encoded[i] = 0;
+    }
+
+    ASSERT_EQ(ReedSolomon::decode(encoded.data(), encoded.size(), nullptr), 223);
+    ASSERT_EQ(std::vector<uint8_t>(encoded.begin(), encoded.begin() + 223), data);
+}
+
+TEST(ReedSolomon, too_many_errors)
+{
+    std::vector<uint8_t> data = make_data(300, 3);
+    std::vector<uint8_t> encoded = encode(data);
+
+    // 17 errors in the second, shortened, block is one too many.
+    for (size_t i = 0; i < 17; ++i)
+    {
+        encoded[255 + i * 3] ^= 0x5a;
+    }
+
+    ASSERT_EQ(ReedSolomon::decode(encoded.data(), encoded.size(), nullptr), -1);
+}
+
+TEST(ReedSolomon, decode_bad_length)
+{
+    std::vector<uint8_t> buf(40);
+
+    ASSERT_EQ(ReedSolomon::decode(buf.data(), 20, nullptr), -1);
+    ASSERT_EQ(ReedSolomon::decode(buf.data(), 0, nullptr), 0);
+}
@@ -0,0 +1,127 @@
+#include <gtest/gtest.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include <unistd.h>
+
+#include "ros2_serial_example/relay_table.hpp"
+#include "ros2_serial_example/shm_transporter.hpp"
+
+#include "transporter_test_helpers.hpp"
+
+using ros2_to_serial_bridge::transport::RelayTable;
+using ros2_to_serial_bridge::transport::ShmTransporter;
+
+/// HELPERS
+
+static std::string shm_name(const std::string & test)
+{
+    return "/ros2_serial_test_" + test + "_" + std::to_string(::getpid());
+}
+
+// The two ends of a link through shared memory.
+class LinkPair final
+{
+public:
+    LinkPair(const std::string & name, const std::string & protocol)
+        : local(protocol, name, ShmTransporter::Role::CREATE, 4096, 10, 4096),
+          remote(protocol, name, ShmTransporter::Role::ATTACH, 0, 10, 4096)
+    {
+        EXPECT_EQ(local.init(), 0);
+        EXPECT_EQ(remote.init(), 0);
+    }
+
+    ShmTransporter local;
+    ShmTransporter remote;
+};
+
+/// TESTS
+
+TEST(RelayTable, invalid_add)
+{
+    LinkPair cobs(shm_name("relay_invalid_add"), "cobs");
+    RelayTable table;
+
+    ASSERT_THROW(table.add(9, nullptr), std::runtime_error);
+    // A cobs header only has room for 8-bit topic IDs.
+    ASSERT_THROW(table.add(300, &cobs.local), std::runtime_error);
+    ASSERT_TRUE(table.empty());
+
+    table.add(9, &cobs.local);
+    ASSERT_THROW(table.add(9, &cobs.local), std::runtime_error);
+}
+
+TEST(RelayTable, routes)
+{
+    LinkPair a(shm_name("relay_routes_a"), "v2");
+    RelayTable table;
+
+    ASSERT_TRUE(table.empty());
+    table.add(300, &a.local);
+    ASSERT_FALSE(table.empty());
+    ASSERT_TRUE(table.relays(300));
+    ASSERT_FALSE(table.relays(9));
+    ASSERT_FALSE(table.relays(301));
+
+    uint8_t payload[] = {0x1, 0x2};
+    ASSERT_FALSE(table.forward(9, payload, sizeof(payload)));
+    ASSERT_EQ(table.get_relayed(), 0U);
+}
+
+TEST(RelayTable, forward_between_protocols)
+{
+    // The same payload goes out on a cobs link and a px4 one, each framed
+    // its own way.
+    LinkPair cobs(shm_name("relay_forward_cobs"), "cobs");
+    LinkPair px4(shm_name("relay_forward_px4"), "px4");
+    RelayTable table;
+    table.add(12, &cobs.local);
+    table.add(12, &px4.local);
+
+    uint8_t payload[] = {0x0, 0x1, 0x2, 0x0, 0x3};
+    ASSERT_TRUE(table.forward(12, payload, sizeof(payload)));
+    ASSERT_EQ(table.get_relayed(), 2U);
+    ASSERT_EQ(table.get_drops(), 0U);
+
+    topic_id_size_t topic_ID = 0;
+    uint8_t buffer[64];
+    ASSERT_EQ(read_message(cobs.remote, &topic_ID, buffer, sizeof(buffer)), static_cast<ssize_t>(sizeof(payload)));
+    ASSERT_EQ(topic_ID, 12U);
+    ASSERT_EQ(buffer[3], 0x0);
+    ASSERT_EQ(buffer[4], 0x3);
+
+    topic_ID = 0;
+    ASSERT_EQ(read_message(px4.remote, &topic_ID, buffer, sizeof(buffer)), static_cast<ssize_t>(sizeof(payload)));
+    ASSERT_EQ(topic_ID, 12U);
+    ASSERT_EQ(buffer[4], 0x3);
+}
+
+TEST(RelayTable, full_transport_drops)
+{
+    LinkPair full(shm_name("relay_full"), "px4");
+    LinkPair other(shm_name("relay_other"), "px4");
+    full.local.set_write_timeout(0);
+    RelayTable table;
+    table.add(20, &full.local);
+    table.add(20, &other.local);
+
+    // Nobody reads the first link, so it fills up; the second one still gets
+    // every payload.
+    uint8_t payload[512]{};
+    int sent = 0;
+    while (table.get_drops() == 0 && sent < 100)
+    {
+        ASSERT_TRUE(table.forward(20, payload, sizeof(payload)));
+        ++sent;
+
+        topic_id_size_t topic_ID = 0;
+        uint8_t buffer[1024];
+        ASSERT_EQ(read_message(other.remote, &topic_ID, buffer, sizeof(buffer)), static_cast<ssize_t>(sizeof(payload)));
+    }
+    ASSERT_GT(table.get_drops(), 0U);
+    ASSERT_EQ(table.get_relayed() + table.get_drops(), 2U * sent);
+}
@@ -1,5 +1,7 @@
 #include <gtest/gtest.h>
 
+#include <cstring>
+#include <memory>
 #include <string>
 
 #include <linux/memfd.h>
@@ -176,6 +178,8 @@ TEST_F(RingBufferFixture, read_wrap)
     ASSERT_EQ(head_, buf_.get());
     ASSERT_EQ(tail_, buf_.get());
     ASSERT_TRUE(full_);
+    ASSERT_EQ(get_overflowed_bytes(), 0U);
+    ASSERT_EQ(get_overflows(), 0U);
 
     uint8_t *bufp = buf_.get();
     for (uint8_t i = 0; i < size_; ++i)
@@ -197,6 +201,8 @@ TEST_F(RingBufferFixture, read_wrap)
     ASSERT_EQ(head_, buf_.get() + sizeof(smallbuf));
     ASSERT_EQ(tail_, buf_.get() + sizeof(smallbuf));
     ASSERT_TRUE(full_);
+    ASSERT_EQ(get_overflowed_bytes(), sizeof(smallbuf));
+    ASSERT_EQ(get_overflows(), 1U);
 
     bufp = buf_.get();
     ASSERT_EQ(*bufp++, 240);
@@ -208,6 +214,66 @@ TEST_F(RingBufferFixture, read_wrap)
     }
 }
 
+TEST_F(RingBufferFixture, write_nullptr)
+{
+    ASSERT_EQ(write(nullptr, 1), -1);
+}
+
+TEST_F(RingBufferFixture, write)
+{
+    uint8_t data[3]{0x0, 0x1, 0x2};
+    ASSERT_EQ(write(data, sizeof(data)), static_cast<ssize_t>(sizeof(data)));
+
+    ASSERT_EQ(bytes_used(), sizeof(data));
+    ASSERT_EQ(bytes_free(), size_ - sizeof(data));
+    ASSERT_EQ(head_, buf_.get() + sizeof(data));
+    ASSERT_EQ(tail_, buf_.get());
+    ASSERT_FALSE(full_);
+    uint8_t *bufp = buf_.get();
+    ASSERT_EQ(*bufp++, 0x0);
+    ASSERT_EQ(*bufp++, 0x1);
+    ASSERT_EQ(*bufp++, 0x2);
+}
+
+TEST_F(RingBufferFixture, write_wrap)
+{
+    // Fill up all but 2 bytes of the buffer
+    uint8_t initialbuf[238];
+    for (uint8_t i = 0; i < sizeof(initialbuf); ++i)
+    {
+        initialbuf[i] = i;
+    }
+    ASSERT_EQ(write(initialbuf, sizeof(initialbuf)), static_cast<ssize_t>(sizeof(initialbuf)));
+
+    // Only the 2 bytes up to the end of the buffer are copied the first time.
+    uint8_t smallbuf[4]{238, 239, 240, 241};
+    ASSERT_EQ(write(smallbuf, sizeof(smallbuf)), 2);
+    ASSERT_EQ(head_, buf_.get());
+    ASSERT_EQ(tail_, buf_.get());
+    ASSERT_TRUE(full_);
+    ASSERT_EQ(bytes_used(), size_);
+    ASSERT_EQ(get_overflowed_bytes(), 0U);
+    ASSERT_EQ(get_overflows(), 0U);
+
+    // The rest overflows, overwriting the oldest data.
+    ASSERT_EQ(write(smallbuf + 2, 2), 2);
+    ASSERT_EQ(bytes_used(), size_);
+    ASSERT_EQ(head_, buf_.get() + 2);
+    ASSERT_EQ(tail_, buf_.get() + 2);
+    ASSERT_TRUE(full_);
+    ASSERT_EQ(get_overflowed_bytes(), 2U);
+    ASSERT_EQ(get_overflows(), 1U);
+
+    uint8_t *bufp = buf_.get();
+    ASSERT_EQ(*bufp++, 240);
+    ASSERT_EQ(*bufp++, 241);
+    for (uint8_t i = 2; i < size_; ++i)
+    {
+        ASSERT_EQ(*bufp, i);
+        bufp++;
+    }
+}
+
 TEST_F(RingBufferFixture, memcpy_from_nullptr)
 {
     ASSERT_EQ(memcpy_from(nullptr, 10), -1);
@@ -553,6 +619,76 @@ TEST_F(RingBufferFixture, findseq_partial_wrap)
     ASSERT_EQ(findseq(seq, sizeof(seq)), 237);
 }
 
+TEST_F(RingBufferFixture, findseq_overlapping_prefix)
+{
+    // The start of the sequence appears one byte before the real match, so
+    // a search that simply restarts on a mismatch would skip over it.
+    uint8_t initialbuf[]{'a', 'a', 'a', 'b'};
+    ASSERT_EQ(add_to_memfd(initialbuf, sizeof(initialbuf)), static_cast<int>(sizeof(initialbuf)));
+
+    ASSERT_EQ(read(memfd_), static_cast<ssize_t>(sizeof(initialbuf)));
+
+    uint8_t seq[]{'a', 'a', 'b'};
+    ASSERT_EQ(findseq(seq, sizeof(seq)), 1);
+}
+
+TEST_F(RingBufferFixture, findseq_incremental)
+{
+    // Find nothing in the first batch of data, except for a partial sequence
+    // at the very end.
+    uint8_t initialbuf[20]{};
+    initialbuf[18] = '>';
+    initialbuf[19] = '>';
+    ASSERT_EQ(add_to_memfd(initialbuf, sizeof(initialbuf)), static_cast<int>(sizeof(initialbuf)));
+
+    ASSERT_EQ(read(memfd_), static_cast<ssize_t>(sizeof(initialbuf)));
+
+    uint8_t seq[]{'>', '>', '>'};
+    ASSERT_EQ(findseq(seq, sizeof(seq)), -1);
+    ASSERT_EQ(scanned_, 18U);
+
+    // Searching again without new data doesn't change anything.
+    ASSERT_EQ(findseq(seq, sizeof(seq)), -1);
+    ASSERT_EQ(scanned_, 18U);
+
+    // Completing the sequence makes it findable.
+    uint8_t buf2[]{'>', 0x0};
+    ASSERT_EQ(add_to_memfd(buf2, sizeof(buf2)), static_cast<int>(sizeof(buf2)));
+
+    ASSERT_EQ(read(memfd_), static_cast<ssize_t>(sizeof(buf2)));
+
+    ASSERT_EQ(findseq(seq, sizeof(seq)), 18);
+    ASSERT_EQ(scanned_, 18U);
+
+    // Removing data from the tail moves the scan position with it.
+    ASSERT_EQ(discard(10), 10);
+    ASSERT_EQ(scanned_, 8U);
+    ASSERT_EQ(findseq(seq, sizeof(seq)), 8);
+
+    uint8_t out[9]{};
+    ASSERT_EQ(memcpy_from(out, sizeof(out)), static_cast<ssize_t>(sizeof(out)));
+    ASSERT_EQ(scanned_, 0U);
+    ASSERT_EQ(findseq(seq, sizeof(seq)), -1);
+}
+
+TEST_F(RingBufferFixture, findseq_different_sequence)
+{
+    uint8_t initialbuf[]{0x1, '>', '>', '>', 0x0};
+    ASSERT_EQ(add_to_memfd(initialbuf, sizeof(initialbuf)), static_cast<int>(sizeof(initialbuf)));
+
+    ASSERT_EQ(read(memfd_), static_cast<ssize_t>(sizeof(initialbuf)));
+
+    // Searching for a different sequence must not reuse the scan position
+    // from the previous one.
+    uint8_t seq1[]{0x0};
+    ASSERT_EQ(findseq(seq1, sizeof(seq1)), 4);
+
+    uint8_t seq2[]{'>', '>', '>'};
+    ASSERT_EQ(findseq(seq2, sizeof(seq2)), 1);
+
+    ASSERT_EQ(findseq(seq1, sizeof(seq1)), 4);
+}
+
 TEST_F(RingBufferFixture, peek_not_enough_bytes)
 {
     uint8_t out[5]{};
@@ -599,3 +735,594 @@ TEST_F(RingBufferFixture, peek_wrap)
     ASSERT_EQ(buf2[2], 0x3);
     ASSERT_EQ(buf2[3], 0x4);
 }
+
+TEST_F(RingBufferFixture, discard_0_count)
+{
+    ASSERT_EQ(discard(0), -1);
+}
+
+TEST_F(RingBufferFixture, discard_not_enough_bytes)
+{
+    ASSERT_EQ(discard(5), -1);
+}
+
+TEST_F(RingBufferFixture, discard)
+{
+    uint8_t initialbuf[]{0x0, 0x1, 0x2, 0x3};
+    ASSERT_EQ(add_to_memfd(initialbuf, sizeof(initialbuf)), static_cast<int>(sizeof(initialbuf)));
+    ASSERT_EQ(read(memfd_), static_cast<ssize_t>(sizeof(initialbuf)));
+
+    ASSERT_EQ(discard(2), 2);
+    ASSERT_EQ(bytes_used(), 2U);
+    ASSERT_EQ(tail_, buf_.get() + 2);
+
+    uint8_t buf2[2]{};
+    ASSERT_EQ(memcpy_from(buf2, sizeof(buf2)), static_cast<ssize_t>(sizeof(buf2)));
+    ASSERT_EQ(buf2[0], 0x2);
+    ASSERT_EQ(buf2[1], 0x3);
+    ASSERT_TRUE(is_empty());
+}
+
+TEST_F(RingBufferFixture, discard_full_buffer)
+{
+    uint8_t initialbuf[240]{};
+    ASSERT_EQ(add_to_memfd(initialbuf, sizeof(initialbuf)), static_cast<int>(sizeof(initialbuf)));
+    ASSERT_EQ(read(memfd_), static_cast<ssize_t>(sizeof(initialbuf)));
+    ASSERT_TRUE(full_);
+
+    ASSERT_EQ(discard(240), 240);
+    ASSERT_FALSE(full_);
+    ASSERT_TRUE(is_empty());
+    ASSERT_EQ(tail_, buf_.get());
+}
+
+TEST_F(RingBufferFixture, discard_wrap)
+{
+    uint8_t initialbuf[238]{};
+    ASSERT_EQ(add_to_memfd(initialbuf, sizeof(initialbuf)), static_cast<int>(sizeof(initialbuf)));
+    ASSERT_EQ(read(memfd_), static_cast<ssize_t>(sizeof(initialbuf)));
+    ASSERT_EQ(discard(236), 236);
+
+    uint8_t smallbuf[4]{0x1, 0x2, 0x3, 0x4};
+    ASSERT_EQ(add_to_memfd(smallbuf, sizeof(smallbuf)), static_cast<int>(sizeof(smallbuf)));
+    ASSERT_EQ(read(memfd_), 2);
+    ASSERT_EQ(read(memfd_), 2);
+
+    // Discard the two remaining zeros and the two bytes at the end of the ring
+    ASSERT_EQ(discard(5), 5);
+    ASSERT_EQ(tail_, buf_.get() + 1);
+
+    uint8_t buf2[1]{};
+    ASSERT_EQ(memcpy_from(buf2, sizeof(buf2)), static_cast<ssize_t>(sizeof(buf2)));
+    ASSERT_EQ(buf2[0], 0x4);
+}
+
+TEST_F(RingBufferFixture, tail_generation)
+{
+    uint64_t generation = get_tail_generation();
+
+    // Data coming in at the head leaves the tail alone.
+    uint8_t initialbuf[8]{0x0, 0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7};
+    ASSERT_EQ(add_to_memfd(initialbuf, sizeof(initialbuf)), static_cast<int>(sizeof(initialbuf)));
+    ASSERT_EQ(read(memfd_), static_cast<ssize_t>(sizeof(initialbuf)));
+    ASSERT_EQ(get_tail_generation(), generation);
+
+    ASSERT_EQ(discard(2), 2);
+    ASSERT_NE(get_tail_generation(), generation);
+    generation = get_tail_generation();
+
+    uint8_t buf2[2]{};
+    ASSERT_EQ(memcpy_from(buf2, sizeof(buf2)), static_cast<ssize_t>(sizeof(buf2)));
+    ASSERT_NE(get_tail_generation(), generation);
+    generation = get_tail_generation();
+
+    // Overflowing the ring throws away data at the tail.
+    uint8_t bigbuf[240]{};
+    ASSERT_EQ(add_to_memfd(bigbuf, sizeof(bigbuf)), static_cast<int>(sizeof(bigbuf)));
+    while (read(memfd_) > 0)
+    {
+    }
+    ASSERT_NE(get_tail_generation(), generation);
+}
+
+TEST_F(RingBufferFixture, peek_spans_not_enough_bytes)
+{
+    const uint8_t *first;
+    const uint8_t *second;
+    size_t first_len;
+    size_t second_len;
+    ASSERT_EQ(peek_spans(5, &first, &first_len, &second, &second_len), -1);
+}
+
+TEST_F(RingBufferFixture, peek_spans)
+{
+    uint8_t initialbuf[]{0x0, 0x1, 0x2, 0x3};
+    ASSERT_EQ(add_to_memfd(initialbuf, sizeof(initialbuf)), static_cast<int>(sizeof(initialbuf)));
+    ASSERT_EQ(read(memfd_), static_cast<ssize_t>(sizeof(initialbuf)));
+
+    const uint8_t *first;
+    const uint8_t *second;
+    size_t first_len;
+    size_t second_len;
+    ASSERT_EQ(peek_spans(3, &first, &first_len, &second, &second_len), 3);
+    ASSERT_EQ(first, buf_.get());
+    ASSERT_EQ(first_len, 3U);
+    ASSERT_EQ(second, nullptr);
+    ASSERT_EQ(second_len, 0U);
+    ASSERT_EQ(bytes_used(), 4U);
+}
+
+TEST_F(RingBufferFixture, peek_spans_wrap)
+{
+    uint8_t initialbuf[239]{};
+    ASSERT_EQ(add_to_memfd(initialbuf, sizeof(initialbuf)), static_cast<int>(sizeof(initialbuf)));
+    ASSERT_EQ(read(memfd_), static_cast<ssize_t>(sizeof(initialbuf)));
+    ASSERT_EQ(discard(sizeof(initialbuf)), static_cast<ssize_t>(sizeof(initialbuf)));
+
+    uint8_t smallbuf[4]{0x1, 0x2, 0x3, 0x4};
+    ASSERT_EQ(add_to_memfd(smallbuf, sizeof(smallbuf)), static_cast<int>(sizeof(smallbuf)));
+    ASSERT_EQ(read(memfd_), 1);
+    ASSERT_EQ(read(memfd_), 3);
+
+    const uint8_t *first;
+    const uint8_t *second;
+    size_t first_len;
+    size_t second_len;
+    ASSERT_EQ(peek_spans(4, &first, &first_len, &second, &second_len), 4);
+    ASSERT_EQ(first_len, 1U);
+    ASSERT_EQ(first[0], 0x1);
+    ASSERT_EQ(second, buf_.get());
+    ASSERT_EQ(second_len, 3U);
+    ASSERT_EQ(second[0], 0x2);
+    ASSERT_EQ(second[1], 0x3);
+    ASSERT_EQ(second[2], 0x4);
+}
+
+TEST_F(RingBufferFixture, mirrored_not_empty)
+{
+    uint8_t data[3]{0x0, 0x1, 0x2};
+    ASSERT_EQ(write(data, sizeof(data)), 3);
+    ASSERT_EQ(set_mirrored(), -1);
+    ASSERT_FALSE(is_mirrored());
+    ASSERT_EQ(size_, 240U);
+}
+
+TEST_F(RingBufferFixture, mirrored_wrap)
+{
+    ASSERT_EQ(set_mirrored(), 0);
+    ASSERT_TRUE(is_mirrored());
+
+    // The size is rounded up to the page size.
+    size_t page_size = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+    ASSERT_EQ(size_, page_size);
+    ASSERT_EQ(bytes_free(), page_size);
+
+    // Move the head and tail close to the end of the ring.
+    std::unique_ptr<uint8_t[]> filler(new uint8_t[page_size - 2]{});
+    ASSERT_EQ(write(filler.get(), page_size - 2), static_cast<ssize_t>(page_size - 2));
+    ASSERT_EQ(discard(page_size - 2), static_cast<ssize_t>(page_size - 2));
+
+    // A single read fills the free space across the end of the ring.
+    uint8_t data[6]{0x0, 0x1, 0x2, 0x3, 0x4, 0x5};
+    ASSERT_EQ(add_to_memfd(data, sizeof(data)), static_cast<int>(sizeof(data)));
+    ASSERT_EQ(read(memfd_), static_cast<ssize_t>(sizeof(data)));
+    ASSERT_EQ(bytes_used(), sizeof(data));
+    ASSERT_EQ(head_, buf_.get() + 4);
+
+    // The data is contiguous even though it wraps.
+    const uint8_t *p = contiguous(sizeof(data));
+    ASSERT_EQ(p, tail_);
+    ASSERT_EQ(::memcmp(p, data, sizeof(data)), 0);
+    ASSERT_EQ(contiguous(sizeof(data) + 1), nullptr);
+
+    const uint8_t *first;
+    size_t first_len;
+    const uint8_t *second;
+    size_t second_len;
+    ASSERT_EQ(peek_spans(sizeof(data), &first, &first_len, &second, &second_len), static_cast<ssize_t>(sizeof(data)));
+    ASSERT_EQ(first_len, sizeof(data));
+    ASSERT_EQ(second_len, 0U);
+
+    uint8_t seq[2]{0x1, 0x2};
+    ASSERT_EQ(findseq(seq, sizeof(seq)), 1);
+
+    uint8_t out[6]{};
+    ASSERT_EQ(memcpy_from(out, sizeof(out)), static_cast<ssize_t>(sizeof(out)));
+    ASSERT_EQ(::memcmp(out, data, sizeof(data)), 0);
+    ASSERT_EQ(tail_, buf_.get() + 4);
+    ASSERT_TRUE(is_empty());
+}
+
+TEST_F(RingBufferFixture, contiguous_not_mirrored)
+{
+    std::unique_ptr<uint8_t[]> filler(new uint8_t[238]{});
+    ASSERT_EQ(write(filler.get(), 238), 238);
+    ASSERT_EQ(discard(238), 238);
+
+    uint8_t data[4]{0x0, 0x1, 0x2, 0x3};
+    ASSERT_EQ(write(data, sizeof(data)), 2);
+    ASSERT_EQ(write(data + 2, 2), 2);
+
+    // Without the mirror, only the part up to the end is contiguous.
+    ASSERT_EQ(contiguous(2), tail_);
+    ASSERT_EQ(contiguous(3), nullptr);
+}
+
+TEST_F(RingBufferFixture, free_span_commit)
+{
+    size_t len;
+    uint8_t *span = free_span(&len);
+    ASSERT_EQ(span, head_);
+    ASSERT_EQ(len, 240U);
+
+    uint8_t data[4]{0x0, 0x1, 0x2, 0x3};
+    ::memcpy(span, data, sizeof(data));
+    commit(sizeof(data));
+    ASSERT_EQ(bytes_used(), sizeof(data));
+
+    // Data may be removed while a span is filled.
+    span = free_span(&len);
+    ASSERT_EQ(len, 236U);
+    ASSERT_EQ(discard(2), 2);
+    commit(len);
+    ASSERT_EQ(bytes_used(), 238U);
+    ASSERT_EQ(head_, buf_.get());
+
+    // The span stops at the tail.
+    span = free_span(&len);
+    ASSERT_EQ(span, buf_.get());
+    ASSERT_EQ(len, 2U);
+    commit(len);
+    ASSERT_TRUE(full_);
+    ASSERT_EQ(get_overflowed_bytes(), 0U);
+}
+
+TEST_F(RingBufferFixture, free_span_full)
+{
+    std::unique_ptr<uint8_t[]> filler(new uint8_t[240]{});
+    ASSERT_EQ(write(filler.get(), 100), 100);
+    ASSERT_EQ(discard(100), 100);
+    ASSERT_EQ(write(filler.get(), 140), 140);
+    ASSERT_EQ(write(filler.get(), 100), 100);
+    ASSERT_TRUE(full_);
+
+    // A full ring drops the data from the head to the end to make room.
+    size_t len;
+    uint8_t *span = free_span(&len);
+    ASSERT_EQ(span, buf_.get() + 100);
+    ASSERT_EQ(len, 140U);
+    ASSERT_EQ(bytes_used(), 100U);
+    ASSERT_EQ(get_overflowed_bytes(), 140U);
+}
+
+TEST_F(RingBufferFixture, free_span_mirrored)
+{
+    ASSERT_EQ(set_mirrored(), 0);
+    size_t page_size = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+
+    uint8_t *base;
+    size_t length;
+    get_memory(&base, &length);
+    ASSERT_EQ(base, buf_.get());
+    ASSERT_EQ(length, 2 * page_size);
+
+    std::unique_ptr<uint8_t[]> filler(new uint8_t[page_size - 2]{});
+    ASSERT_EQ(write(filler.get(), page_size - 2), static_cast<ssize_t>(page_size - 2));
+    ASSERT_EQ(discard(page_size - 2), static_cast<ssize_t>(page_size - 2));
+
+    // With the mirror, the span covers all of the free space, across the end.
+    size_t len;
+    uint8_t *span = free_span(&len);
+    ASSERT_EQ(len, page_size);
+    uint8_t data[6]{0x0, 0x1, 0x2, 0x3, 0x4, 0x5};
+    ::memcpy(span, data, sizeof(data));
+    commit(sizeof(data));
+    ASSERT_EQ(head_, buf_.get() + 4);
+    ASSERT_EQ(::memcmp(contiguous(sizeof(data)), data, sizeof(data)), 0);
+}
+
+TEST_F(RingBufferFixture, resize)
+{
+    ASSERT_EQ(resize(0), -1);
+
+    // Wrap the data around the end, so that it has to be put back together.
+    uint8_t filler[200]{};
+    ASSERT_EQ(write(filler, sizeof(filler)), 200);
+    ASSERT_EQ(discard(200), 200);
+    uint8_t data[100];
+    for (size_t i = 0; i < sizeof(data); ++i)
+    {
+        data[i] = static_cast<uint8_t>(i);
+    }
+    ASSERT_EQ(write(data, 40), 40);
+    ASSERT_EQ(write(data + 40, 60), 60);
+    uint64_t generation = get_tail_generation();
+
+    // Too small for the data.
+    ASSERT_EQ(resize(99), -1);
+    ASSERT_EQ(capacity(), 240U);
+
+    ASSERT_EQ(resize(500), 0);
+    ASSERT_EQ(capacity(), 500U);
+    ASSERT_EQ(bytes_used(), 100U);
+    ASSERT_NE(get_tail_generation(), generation);
+    ASSERT_NE(contiguous(100), nullptr);
+    ASSERT_EQ(::memcmp(contiguous(100), data, sizeof(data)), 0);
+
+    // And down to exactly the data, which leaves it full.
+    ASSERT_EQ(resize(100), 0);
+    ASSERT_EQ(capacity(), 100U);
+    ASSERT_EQ(bytes_free(), 0U);
+    uint8_t out[100];
+    ASSERT_EQ(memcpy_from(out, sizeof(out)), 100);
+    ASSERT_EQ(::memcmp(out, data, sizeof(data)), 0);
+    ASSERT_TRUE(is_empty());
+}
+
+TEST_F(RingBufferFixture, resize_mirrored)
+{
+    size_t page_size = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+    ASSERT_EQ(set_mirrored(), 0);
+
+    uint8_t data[100];
+    for (size_t i = 0; i < sizeof(data); ++i)
+    {
+        data[i] = static_cast<uint8_t>(i * 3);
+    }
+    ASSERT_EQ(write(data, sizeof(data)), 100);
+
+    ASSERT_EQ(resize(page_size + 1), 0);
+    ASSERT_TRUE(is_mirrored());
+    ASSERT_EQ(capacity(), 2 * page_size);
+    ASSERT_EQ(::memcmp(contiguous(100), data, sizeof(data)), 0);
+}
+
+TEST_F(RingBufferFixture, adaptive_invalid)
+{
+    ASSERT_EQ(set_adaptive(240), -1);
+    ASSERT_FALSE(is_adaptive());
+
+    uint8_t data[1]{0x1};
+    ASSERT_EQ(write(data, sizeof(data)), 1);
+    ASSERT_EQ(set_adaptive(1000), -1);
+    ASSERT_FALSE(is_adaptive());
+}
+
+TEST_F(RingBufferFixture, adaptive_grow)
+{
+    ASSERT_EQ(set_adaptive(1000), 0);
+    ASSERT_TRUE(is_adaptive());
+    ASSERT_EQ(capacity(), 240U);
+
+    // Up to three quarters full, the ring stays as it is.
+    std::unique_ptr<uint8_t[]> data(new uint8_t[1000]);
+    for (size_t i = 0; i < 1000; ++i)
+    {
+        data[i] = static_cast<uint8_t>(i);
+    }
+    ASSERT_EQ(write(data.get(), 180), 180);
+    ASSERT_EQ(capacity(), 240U);
+
+    // Past that, each addition doubles it, up to the maximum.
+    ASSERT_EQ(write(data.get() + 180, 200), 200);
+    ASSERT_EQ(capacity(), 480U);
+    ASSERT_EQ(write(data.get() + 380, 100), 100);
+    ASSERT_EQ(capacity(), 960U);
+    ASSERT_EQ(write(data.get() + 480, 400), 400);
+    ASSERT_EQ(capacity(), 960U);
+    ASSERT_EQ(write(data.get() + 880, 100), 100);
+    ASSERT_EQ(capacity(), 1000U);
+    ASSERT_EQ(get_overflowed_bytes(), 0U);
+    ASSERT_EQ(get_high_water(), 980U);
+
+    std::unique_ptr<uint8_t[]> out(new uint8_t[980]);
+    ASSERT_EQ(memcpy_from(out.get(), 980), 980);
+    ASSERT_EQ(::memcmp(out.get(), data.get(), 980), 0);
+}
+
+TEST_F(RingBufferFixture, adaptive_grow_wrap)
+{
+    ASSERT_EQ(set_adaptive(1000), 0);
+
+    uint8_t filler[100]{};
+    ASSERT_EQ(write(filler, sizeof(filler)), 100);
+    ASSERT_EQ(discard(100), 100);
+
+    // 140 bytes up to the end, and 60 after the wrap.
+    uint8_t data[210];
+    for (size_t i = 0; i < sizeof(data); ++i)
+    {
+        data[i] = static_cast<uint8_t>(i);
+    }
+    ASSERT_EQ(write(data, 140), 140);
+    ASSERT_EQ(write(data + 140, 60), 60);
+    ASSERT_EQ(head_, buf_.get() + 60);
+
+    // Growing moves the part after the wrap up to after the old end.
+    ASSERT_EQ(write(data + 200, 10), 10);
+    ASSERT_EQ(capacity(), 480U);
+    ASSERT_EQ(tail_, buf_.get() + 100);
+    ASSERT_EQ(head_, buf_.get() + 310);
+    uint8_t out[210];
+    ASSERT_EQ(memcpy_from(out, sizeof(out)), static_cast<ssize_t>(sizeof(out)));
+    ASSERT_EQ(::memcmp(out, data, sizeof(data)), 0);
+}
+
+TEST_F(RingBufferFixture, adaptive_grow_full_capped)
+{
+    ASSERT_EQ(set_adaptive(300), 0);
+
+    uint8_t filler[100]{};
+    ASSERT_EQ(write(filler, sizeof(filler)), 100);
+    ASSERT_EQ(discard(100), 100);
+
+    // A full ring, wrapped 100 bytes in, can only grow by 60 bytes, so the
+    // part after the wrap doesn't all fit after the old end.
+    uint8_t data[250];
+    for (size_t i = 0; i < sizeof(data); ++i)
+    {
+        data[i] = static_cast<uint8_t>(i);
+    }
+    ASSERT_EQ(write(data, 140), 140);
+    ASSERT_EQ(write(data + 140, 100), 100);
+    ASSERT_TRUE(full_);
+
+    ASSERT_EQ(write(data + 240, 10), 10);
+    ASSERT_EQ(capacity(), 300U);
+    ASSERT_EQ(bytes_used(), 250U);
+    ASSERT_EQ(get_overflowed_bytes(), 0U);
+    uint8_t out[250];
+    ASSERT_EQ(memcpy_from(out, sizeof(out)), static_cast<ssize_t>(sizeof(out)));
+    ASSERT_EQ(::memcmp(out, data, sizeof(data)), 0);
+}
+
+TEST_F(RingBufferFixture, adaptive_shrink)
+{
+    ASSERT_EQ(set_adaptive(1000), 0);
+
+    uint8_t data[200]{};
+    ASSERT_EQ(write(data, sizeof(data)), 200);
+    ASSERT_EQ(write(data, sizeof(data)), 200);
+    ASSERT_EQ(capacity(), 480U);
+    ASSERT_EQ(discard(400), 400);
+
+    // With a byte or two in it for long enough, the ring shrinks back,
+    // keeping the byte that is in it when it does.
+    uint8_t value = 0;
+    ASSERT_EQ(write(&value, 1), 1);
+    size_t adds = 0;
+    while (capacity() == 480U && adds < 2 * RingBuffer::SHRINK_AFTER_ADDS)
+    {
+        uint8_t next = static_cast<uint8_t>(value + 1);
+        ASSERT_EQ(write(&next, 1), 1);
+        uint8_t out;
+        ASSERT_EQ(memcpy_from(&out, 1), 1);
+        ASSERT_EQ(out, value);
+        value = next;
+        adds++;
+    }
+    ASSERT_EQ(capacity(), 240U);
+    ASSERT_GE(adds, RingBuffer::SHRINK_AFTER_ADDS - 1);
+    uint8_t out;
+    ASSERT_EQ(memcpy_from(&out, 1), 1);
+    ASSERT_EQ(out, value);
+    ASSERT_EQ(get_high_water(), 400U);
+
+    // Never below the size it started with.
+    for (size_t i = 0; i < 2 * RingBuffer::SHRINK_AFTER_ADDS; ++i)
+    {
+        ASSERT_EQ(write(data, 1), 1);
+        ASSERT_EQ(discard(1), 1);
+    }
+    ASSERT_EQ(capacity(), 240U);
+}
+
+TEST_F(RingBufferFixture, adaptive_no_shrink_busy)
+{
+    ASSERT_EQ(set_adaptive(1000), 0);
+
+    uint8_t data[200]{};
+    ASSERT_EQ(write(data, sizeof(data)), 200);
+    ASSERT_EQ(write(data, sizeof(data)), 200);
+    ASSERT_EQ(capacity(), 480U);
+    ASSERT_EQ(discard(400), 400);
+
+    // Being busy once in every while is enough to keep the capacity.
+    for (size_t i = 0; i < 3 * RingBuffer::SHRINK_AFTER_ADDS; ++i)
+    {
+        size_t len = (i % (RingBuffer::SHRINK_AFTER_ADDS / 2) == 0) ? 200 : 10;
+        size_t written = 0;
+        while (written < len)
+        {
+            ssize_t n = write(data, len - written);
+            ASSERT_GT(n, 0);
+            written += n;
+        }
+        ASSERT_EQ(discard(len), static_cast<ssize_t>(len));
+    }
+    ASSERT_EQ(capacity(), 480U);
+}
+
+TEST_F(RingBufferFixture, adaptive_read)
+{
+    ASSERT_EQ(set_adaptive(1000), 0);
+
+    uint8_t data[500];
+    for (size_t i = 0; i < sizeof(data); ++i)
+    {
+        data[i] = static_cast<uint8_t>(i);
+    }
+    ASSERT_EQ(::write(memfd_, data, sizeof(data)), static_cast<ssize_t>(sizeof(data)));
+    ASSERT_EQ(::lseek(memfd_, 0, SEEK_SET), 0);
+
+    // The ring grows as the reads fill it.
+    size_t total = 0;
+    while (total < sizeof(data))
+    {
+        ssize_t n = read(memfd_);
+        ASSERT_GT(n, 0);
+        total += n;
+    }
+    ASSERT_EQ(capacity(), 960U);
+    ASSERT_EQ(get_overflowed_bytes(), 0U);
+    uint8_t out[500];
+    ASSERT_EQ(memcpy_from(out, sizeof(out)), static_cast<ssize_t>(sizeof(out)));
+    ASSERT_EQ(::memcmp(out, data, sizeof(data)), 0);
+}
+
+TEST_F(RingBufferFixture, adaptive_mirrored)
+{
+    size_t page_size = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+    ASSERT_EQ(set_adaptive(3 * page_size - 1), 0);
+    ASSERT_EQ(set_mirrored(), 0);
+    ASSERT_EQ(capacity(), page_size);
+    uint8_t *base = buf_.get();
+
+    // Fill the ring so that it wraps, and then grow it.
+    std::unique_ptr<uint8_t[]> data(new uint8_t[page_size]);
+    for (size_t i = 0; i < page_size; ++i)
+    {
+        data[i] = static_cast<uint8_t>(i * 7);
+    }
+    ASSERT_EQ(write(data.get(), page_size / 2), static_cast<ssize_t>(page_size / 2));
+    ASSERT_EQ(discard(page_size / 2), static_cast<ssize_t>(page_size / 2));
+    ASSERT_EQ(write(data.get(), page_size - 1), static_cast<ssize_t>(page_size - 1));
+    ASSERT_EQ(write(data.get(), 1), 1);
+    ASSERT_EQ(capacity(), 2 * page_size);
+    ASSERT_EQ(buf_.get(), base);
+
+    uint8_t *mem;
+    size_t length;
+    get_memory(&mem, &length);
+    ASSERT_EQ(length, 4 * page_size);
+
+    // The data is still in one piece, through the mirror.
+    const uint8_t *in_place = contiguous(page_size);
+    ASSERT_NE(in_place, nullptr);
+    ASSERT_EQ(::memcmp(in_place, data.get(), page_size - 1), 0);
+    ASSERT_EQ(in_place[page_size - 1], data[0]);
+
+    // And to the maximum, rounded up to a page.
+    std::unique_ptr<uint8_t[]> more(new uint8_t[page_size]{});
+    ASSERT_EQ(write(more.get(), page_size / 2), static_cast<ssize_t>(page_size / 2));
+    ASSERT_EQ(write(more.get(), 1), 1);
+    ASSERT_EQ(capacity(), 3 * page_size);
+    ASSERT_EQ(::memcmp(contiguous(page_size - 1), data.get(), page_size - 1), 0);
+    ASSERT_EQ(discard(bytes_used()), static_cast<ssize_t>(page_size + page_size / 2 + 1));
+
+    // Shrinking remaps the mirror right after the smaller ring.
+    for (size_t i = 0; i < 2 * RingBuffer::SHRINK_AFTER_ADDS && capacity() == 3 * page_size; ++i)
+    {
+        ASSERT_EQ(write(more.get(), 1), 1);
+        ASSERT_EQ(discard(1), 1);
+    }
+    ASSERT_EQ(capacity(), 2 * page_size);
+    get_memory(&mem, &length);
+    ASSERT_EQ(length, 4 * page_size);
+
+    ASSERT_EQ(write(data.get(), page_size), static_cast<ssize_t>(page_size));
+    ASSERT_EQ(discard(page_size), static_cast<ssize_t>(page_size));
+    ASSERT_EQ(write(data.get(), page_size), static_cast<ssize_t>(page_size));
+    ASSERT_NE(contiguous(page_size), nullptr);
+    ASSERT_EQ(::memcmp(contiguous(page_size), data.get(), page_size), 0);
+}
@@ -1,12 +1,16 @@
 #include <gtest/gtest.h>
 
+#include <chrono>
 #include <limits>
 #include <map>
 #include <memory>
 #include <stdexcept>
+#include <thread>
+#include <utility>
 #include <vector>
 
 #include <rclcpp/rclcpp.hpp>
+#include <std_msgs/msg/string.hpp>
 
 #include "ros2_serial_example/transporter.hpp"
 #include "ros2_topics.hpp"
@@ -299,6 +303,28 @@ TEST(ROS2Topics, serial_mapping_too_large)
     ASSERT_EQ(serial_subs->size(), 0U);
 }
 
+TEST(ROS2Topics, serial_mapping_too_large_for_protocol)
+{
+    std::shared_ptr<rclcpp::Node> node = rclcpp::Node::make_shared("node");
+    std::map<std::string, ros2_to_serial_bridge::pubsub::TopicMapping> topic_names_and_serialization;
+
+    topic_names_and_serialization["foo"] = ros2_to_serial_bridge::pubsub::TopicMapping();
+    topic_names_and_serialization["foo"].serial_mapping = 256;
+    topic_names_and_serialization["foo"].type = "std_msgs/String";
+    topic_names_and_serialization["foo"].direction = ros2_to_serial_bridge::pubsub::TopicMapping::Direction::SERIAL_TO_ROS2;
+
+    // PX4 only has a single byte for the topic ID on the wire ...
+    std::unique_ptr<TransporterPassThrough> px4 = std::make_unique<TransporterPassThrough>("px4", 8192);
+    ROS2TopicsPassThrough px4_r2(node.get(), topic_names_and_serialization, px4.get());
+    ASSERT_EQ(px4_r2.get_serial_to_pub_map()->size(), 0U);
+
+    // ... but v2 can carry wider IDs.
+    std::unique_ptr<TransporterPassThrough> v2 = std::make_unique<TransporterPassThrough>("v2", 8192);
+    ROS2TopicsPassThrough v2_r2(node.get(), topic_names_and_serialization, v2.get());
+    ASSERT_EQ(v2_r2.get_serial_to_pub_map()->size(), 1U);
+    ASSERT_EQ(v2_r2.get_serial_to_pub_map()->count(256), 1U);
+}
+
 TEST(ROS2Topics, unsupported_pub_type)
 {
     std::shared_ptr<rclcpp::Node> node = rclcpp::Node::make_shared("node");
@@ -379,6 +405,288 @@ TEST(ROS2Topics, one_sub_mapping)
     ASSERT_EQ(serial_subs->size(), 1U);
 }
 
+TEST(ROS2Topics, pub_mapping_qos)
+{
+    std::shared_ptr<rclcpp::Node> node = rclcpp::Node::make_shared("node");
+    std::unique_ptr<TransporterPassThrough> transporter = std::make_unique<TransporterPassThrough>("px4", 8192);
+    std::map<std::string, ros2_to_serial_bridge::pubsub::TopicMapping> topic_names_and_serialization;
+
+    topic_names_and_serialization["qos_foo"] = ros2_to_serial_bridge::pubsub::TopicMapping();
+    topic_names_and_serialization["qos_foo"].serial_mapping = 9;
+    topic_names_and_serialization["qos_foo"].type = "std_msgs/String";
+    topic_names_and_serialization["qos_foo"].direction = ros2_to_serial_bridge::pubsub::TopicMapping::Direction::SERIAL_TO_ROS2;
+    topic_names_and_serialization["qos_foo"].qos.best_effort().keep_last(3).transient_local();
+
+    ROS2TopicsPassThrough r2(node.get(), topic_names_and_serialization, transporter.get());
+
+    std::vector<rclcpp::TopicEndpointInfo> infos = node->get_publishers_info_by_topic("/qos_foo");
+    ASSERT_EQ(infos.size(), 1U);
+    const rmw_qos_profile_t & profile = infos[0].qos_profile().get_rmw_qos_profile();
+    ASSERT_EQ(profile.reliability, RMW_QOS_POLICY_RELIABILITY_BEST_EFFORT);
+    ASSERT_EQ(profile.durability, RMW_QOS_POLICY_DURABILITY_TRANSIENT_LOCAL);
+}
+
+TEST(ROS2Topics, intra_process_pub_sub_mapping)
+{
+    // Intra-process comms can't be used with transient local durability,
+    // which must not stop the topic from being created.
+    std::shared_ptr<rclcpp::Node> node = rclcpp::Node::make_shared("node", rclcpp::NodeOptions().use_intra_process_comms(true));
+    std::unique_ptr<TransporterPassThrough> transporter = std::make_unique<TransporterPassThrough>("px4", 8192);
+    std::map<std::string, ros2_to_serial_bridge::pubsub::TopicMapping> topic_names_and_serialization;
+
+    topic_names_and_serialization["foo"] = ros2_to_serial_bridge::pubsub::TopicMapping();
+    topic_names_and_serialization["foo"].serial_mapping = 9;
+    topic_names_and_serialization["foo"].type = "std_msgs/String";
+    topic_names_and_serialization["foo"].direction = ros2_to_serial_bridge::pubsub::TopicMapping::Direction::SERIAL_TO_ROS2;
+
+    topic_names_and_serialization["bar"] = ros2_to_serial_bridge::pubsub::TopicMapping();
+    topic_names_and_serialization["bar"].serial_mapping = 10;
+    topic_names_and_serialization["bar"].type = "std_msgs/String";
+    topic_names_and_serialization["bar"].direction = ros2_to_serial_bridge::pubsub::TopicMapping::Direction::ROS2_TO_SERIAL;
+    topic_names_and_serialization["bar"].qos.transient_local();
+
+    ROS2TopicsPassThrough r2(node.get(), topic_names_and_serialization, transporter.get());
+
+    ASSERT_EQ(r2.get_serial_to_pub_map()->size(), 1U);
+    ASSERT_EQ(r2.get_serial_subs_vector()->size(), 1U);
+}
+
+TEST(ROS2Topics, add_remove_topic)
+{
+    std::shared_ptr<rclcpp::Node> node = rclcpp::Node::make_shared("node");
+    std::unique_ptr<TransporterPassThrough> transporter = std::make_unique<TransporterPassThrough>("px4", 8192);
+    std::map<std::string, ros2_to_serial_bridge::pubsub::TopicMapping> topic_names_and_serialization;
+
+    topic_names_and_serialization["foo"] = ros2_to_serial_bridge::pubsub::TopicMapping();
+    topic_names_and_serialization["foo"].serial_mapping = 9;
+    topic_names_and_serialization["foo"].type = "std_msgs/String";
+    topic_names_and_serialization["foo"].direction = ros2_to_serial_bridge::pubsub::TopicMapping::Direction::SERIAL_TO_ROS2;
+
+    ROS2TopicsPassThrough r2(node.get(), topic_names_and_serialization, transporter.get());
+    ASSERT_EQ(r2.get_topics().size(), 1U);
+
+    std::string error;
+    ros2_to_serial_bridge::pubsub::TopicMapping bar;
+    bar.serial_mapping = 10;
+    bar.type = "std_msgs/String";
+    bar.direction = ros2_to_serial_bridge::pubsub::TopicMapping::Direction::ROS2_TO_SERIAL;
+    ASSERT_TRUE(r2.add_topic("bar", bar, &error));
+    ASSERT_EQ(r2.get_serial_subs_vector()->size(), 1U);
+    ASSERT_EQ(r2.get_topics().size(), 2U);
+
+    // Moving a topic to another serial mapping replaces it.
+    ros2_to_serial_bridge::pubsub::TopicMapping foo = topic_names_and_serialization["foo"];
+    foo.serial_mapping = 11;
+    ASSERT_TRUE(r2.add_topic("foo", foo, &error));
+    ASSERT_EQ(r2.get_serial_to_pub_map()->size(), 1U);
+    ASSERT_EQ(r2.get_serial_to_pub_map()->count(11), 1U);
+    ASSERT_EQ(r2.get_topics()["foo"].serial_mapping, 11);
+
+    ASSERT_TRUE(r2.remove_topic("foo"));
+    ASSERT_FALSE(r2.remove_topic("foo"));
+    ASSERT_EQ(r2.get_serial_to_pub_map()->size(), 0U);
+    ASSERT_TRUE(r2.remove_topic("bar"));
+    ASSERT_EQ(r2.get_serial_subs_vector()->size(), 0U);
+    ASSERT_TRUE(r2.get_topics().empty());
+
+    // Dispatching to a removed topic does nothing.
+    uint8_t data[8]{};
+    r2.dispatch(11, data, sizeof(data));
+}
+
+TEST(ROS2Topics, add_topic_invalid)
+{
+    std::shared_ptr<rclcpp::Node> node = rclcpp::Node::make_shared("node");
+    std::unique_ptr<TransporterPassThrough> transporter = std::make_unique<TransporterPassThrough>("px4", 8192);
+    std::map<std::string, ros2_to_serial_bridge::pubsub::TopicMapping> topic_names_and_serialization;
+
+    topic_names_and_serialization["foo"] = ros2_to_serial_bridge::pubsub::TopicMapping();
+    topic_names_and_serialization["foo"].serial_mapping = 9;
+    topic_names_and_serialization["foo"].type = "std_msgs/String";
+    topic_names_and_serialization["foo"].direction = ros2_to_serial_bridge::pubsub::TopicMapping::Direction::SERIAL_TO_ROS2;
+
+    ROS2TopicsPassThrough r2(node.get(), topic_names_and_serialization, transporter.get());
+
+    std::string error;
+    ros2_to_serial_bridge::pubsub::TopicMapping bar;
+    bar.serial_mapping = 9;
+    bar.type = "std_msgs/String";
+    bar.direction = ros2_to_serial_bridge::pubsub::TopicMapping::Direction::ROS2_TO_SERIAL;
+    ASSERT_FALSE(r2.add_topic("bar", bar, &error));
+    ASSERT_NE(error.find("already used"), std::string::npos);
+
+    bar.serial_mapping = 1;
+    ASSERT_FALSE(r2.add_topic("bar", bar, &error));
+    bar.serial_mapping = 256;
+    ASSERT_FALSE(r2.add_topic("bar", bar, &error));
+
+    bar.serial_mapping = 10;
+    bar.type = "invalid_test_msgs/String";
+    ASSERT_FALSE(r2.add_topic("bar", bar, &error));
+
+    bar.type = "std_msgs/String";
+    bar.tx_queue_depth = 4;
+    ASSERT_FALSE(r2.add_topic("bar", bar, &error));
+
+    bar.tx_queue_depth = 0;
+    bar.max_age_ms = 100;
+    ASSERT_FALSE(r2.add_topic("bar", bar, &error));
+
+    bar.max_age_ms = 0;
+    bar.elide_length = true;
+    ASSERT_FALSE(r2.add_topic("bar", bar, &error));
+
+    ASSERT_EQ(r2.get_topics().size(), 1U);
+    ASSERT_EQ(r2.get_serial_subs_vector()->size(), 0U);
+}
+
+TEST(ROS2Topics, lazy_pub_mapping)
+{
+    std::shared_ptr<rclcpp::Node> node = rclcpp::Node::make_shared("node");
+    std::unique_ptr<TransporterPassThrough> transporter = std::make_unique<TransporterPassThrough>("px4", 8192);
+    std::map<std::string, ros2_to_serial_bridge::pubsub::TopicMapping> topic_names_and_serialization;
+
+    topic_names_and_serialization["lazy_foo"] = ros2_to_serial_bridge::pubsub::TopicMapping();
+    topic_names_and_serialization["lazy_foo"].serial_mapping = 9;
+    topic_names_and_serialization["lazy_foo"].type = "std_msgs/String";
+    topic_names_and_serialization["lazy_foo"].direction = ros2_to_serial_bridge::pubsub::TopicMapping::Direction::SERIAL_TO_ROS2;
+    topic_names_and_serialization["lazy_foo"].lazy = true;
+
+    ROS2TopicsPassThrough r2(node.get(), topic_names_and_serialization, transporter.get());
+
+    std::vector<std::pair<topic_id_size_t, bool>> pauses;
+    r2.set_pause_callback([&pauses](topic_id_size_t topic_ID, bool paused) {
+        pauses.emplace_back(topic_ID, paused);
+    });
+
+    // Nothing subscribes yet, so the topic is paused and its data dropped.
+    r2.update_subscribers();
+    ASSERT_EQ(pauses.size(), 1U);
+    ASSERT_EQ(pauses[0].first, 9);
+    ASSERT_TRUE(pauses[0].second);
+    uint8_t data[8]{};
+    r2.dispatch(9, data, sizeof(data));
+
+    // The first subscriber resumes it, once the graph change is seen.
+    auto sub = node->create_subscription<std_msgs::msg::String>("lazy_foo", 10, [](std_msgs::msg::String::SharedPtr) {});
+    for (int i = 0; i < 100 && pauses.size() < 2; ++i)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        r2.update_subscribers();
+    }
+    ASSERT_EQ(pauses.size(), 2U);
+    ASSERT_FALSE(pauses[1].second);
+}
+
+TEST(ROS2Topics, rate_pub_mapping)
+{
+    std::shared_ptr<rclcpp::Node> node = rclcpp::Node::make_shared("node");
+    std::unique_ptr<TransporterPassThrough> transporter = std::make_unique<TransporterPassThrough>("px4", 8192);
+    std::map<std::string, ros2_to_serial_bridge::pubsub::TopicMapping> topic_names_and_serialization;
+
+    topic_names_and_serialization["rate_foo"] = ros2_to_serial_bridge::pubsub::TopicMapping();
+    topic_names_and_serialization["rate_foo"].serial_mapping = 9;
+    topic_names_and_serialization["rate_foo"].type = "std_msgs/String";
+    topic_names_and_serialization["rate_foo"].direction = ros2_to_serial_bridge::pubsub::TopicMapping::Direction::SERIAL_TO_ROS2;
+    topic_names_and_serialization["rate_foo"].max_rate_hz = 50.0;
+
+    ROS2TopicsPassThrough r2(node.get(), topic_names_and_serialization, transporter.get());
+
+    std::vector<std::pair<topic_id_size_t, double>> rates;
+    r2.set_rate_callback([&rates](topic_id_size_t topic_ID, double max_rate_hz) {
+        rates.emplace_back(topic_ID, max_rate_hz);
+    });
+
+    // Without subscribers, the topic isn't lazy, so it is sent at its
+    // max_rate_hz.
+    r2.update_subscribers();
+    ASSERT_EQ(rates.size(), 1U);
+    ASSERT_EQ(rates[0].first, 9);
+    ASSERT_EQ(rates[0].second, 50.0);
+
+    // A subscriber with a deadline of 100 ms only needs 10 messages a second.
+    rclcpp::QoS qos(10);
+    qos.deadline(rclcpp::Duration(std::chrono::milliseconds(100)));
+    auto sub = node->create_subscription<std_msgs::msg::String>("rate_foo", qos, [](std_msgs::msg::String::SharedPtr) {});
+    // The rate is also sent again every so often, so wait for the change.
+    for (int i = 0; i < 100 && rates.back().second == 50.0; ++i)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        r2.update_subscribers();
+    }
+    ASSERT_DOUBLE_EQ(rates.back().second, 10.0);
+
+    // One without a deadline takes everything up to the max_rate_hz.
+    auto greedy = node->create_subscription<std_msgs::msg::String>("rate_foo", 10, [](std_msgs::msg::String::SharedPtr) {});
+    for (int i = 0; i < 100 && rates.back().second != 50.0; ++i)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        r2.update_subscribers();
+    }
+    ASSERT_EQ(rates.back().second, 50.0);
+}
+
+TEST(ROS2Topics, stale_pub_mapping)
+{
+    std::shared_ptr<rclcpp::Node> node = rclcpp::Node::make_shared("node");
+    std::unique_ptr<TransporterPassThrough> transporter = std::make_unique<TransporterPassThrough>("px4", 8192);
+    std::map<std::string, ros2_to_serial_bridge::pubsub::TopicMapping> topic_names_and_serialization;
+
+    topic_names_and_serialization["stale_foo"] = ros2_to_serial_bridge::pubsub::TopicMapping();
+    topic_names_and_serialization["stale_foo"].serial_mapping = 9;
+    topic_names_and_serialization["stale_foo"].type = "std_msgs/String";
+    topic_names_and_serialization["stale_foo"].direction = ros2_to_serial_bridge::pubsub::TopicMapping::Direction::SERIAL_TO_ROS2;
+    topic_names_and_serialization["stale_foo"].max_age_ms = 100;
+
+    ROS2TopicsPassThrough r2(node.get(), topic_names_and_serialization, transporter.get());
+
+    // Data received a second ago is dropped without being deserialized, and
+    // data received just now isn't.
+    uint8_t data[8]{};
+    std::chrono::system_clock::time_point now = std::chrono::system_clock::now();
+    r2.dispatch(0, 9, data, sizeof(data), now - std::chrono::seconds(1));
+    r2.dispatch(0, 9, data, sizeof(data), now);
+
+    ros2_to_serial_bridge::transport::Metrics::Snapshot snapshot;
+    transporter->get_metrics().snapshot(&snapshot);
+    ASSERT_EQ(snapshot.rx.size(), 1U);
+    ASSERT_EQ(snapshot.rx[0].stale_drops, 1U);
+}
+
+TEST(ROS2Topics, elide_length_mapping)
+{
+    std::shared_ptr<rclcpp::Node> node = rclcpp::Node::make_shared("node");
+    std::unique_ptr<TransporterPassThrough> transporter = std::make_unique<TransporterPassThrough>("px4", 8192);
+    ASSERT_EQ(transporter->set_bundling(200, 64), 0);
+    std::map<std::string, ros2_to_serial_bridge::pubsub::TopicMapping> topic_names_and_serialization;
+
+    // A string has no fixed size, so its length is still sent...
+    topic_names_and_serialization["foo"] = ros2_to_serial_bridge::pubsub::TopicMapping();
+    topic_names_and_serialization["foo"].serial_mapping = 9;
+    topic_names_and_serialization["foo"].type = "std_msgs/String";
+    topic_names_and_serialization["foo"].direction = ros2_to_serial_bridge::pubsub::TopicMapping::Direction::SERIAL_TO_ROS2;
+    topic_names_and_serialization["foo"].elide_length = true;
+
+    // ...and a topic that the other end thinks has one isn't bridged.
+    topic_names_and_serialization["bar"] = topic_names_and_serialization["foo"];
+    topic_names_and_serialization["bar"].serial_mapping = 10;
+    topic_names_and_serialization["bar"].fixed_size = 8;
+
+    ROS2TopicsPassThrough r2(node.get(), topic_names_and_serialization, transporter.get());
+    std::map<std::string, ros2_to_serial_bridge::pubsub::TopicMapping> topics = r2.get_topics();
+    ASSERT_EQ(topics.size(), 1U);
+    ASSERT_EQ(topics.count("foo"), 1U);
+}
+
+TEST(ROS2Topics, no_baked_topics)
+{
+    // The tests aren't built with ROS2_SERIAL_BAKED_CONFIG, so the topics
+    // come from the parameters.
+    std::map<std::string, ros2_to_serial_bridge::pubsub::TopicMapping> topics;
+    ASSERT_FALSE(ros2_to_serial_bridge::pubsub::get_baked_topics("", &topics));
+    ASSERT_TRUE(topics.empty());
+}
+
 int main(int argc, char **argv)
 {
     ::testing::InitGoogleTest(&argc, argv);
@@ -0,0 +1,114 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "ros2_serial_example/rx_lanes.hpp"
+
+using ros2_to_serial_bridge::transport::RxLanes;
+
+/// HELPERS
+
+namespace
+{
+
+struct Drained final
+{
+    topic_id_size_t topic_ID;
+    std::vector<uint8_t> payload;
+    std::chrono::system_clock::time_point receive_time;
+};
+
+std::vector<Drained> drain_all(RxLanes * lanes)
+{
+    std::vector<Drained> drained;
+    size_t count = lanes->drain([&drained](topic_id_size_t topic_ID, uint8_t * buffer, size_t length,
+                                           std::chrono::system_clock::time_point receive_time) {
+        drained.push_back(Drained{topic_ID, std::vector<uint8_t>(buffer, buffer + length), receive_time});
+    });
+    EXPECT_EQ(count, drained.size());
+    return drained;
+}
+
+}  // namespace
+
+/// TESTS
+
+TEST(RxLanes, invalid_construction)
+{
+    ASSERT_THROW(RxLanes(0), std::runtime_error);
+    ASSERT_THROW(RxLanes(8), std::runtime_error);
+}
+
+TEST(RxLanes, priority_order)
+{
+    RxLanes lanes(1024);
+    ASSERT_TRUE(lanes.empty());
+    std::chrono::system_clock::time_point start = std::chrono::system_clock::now();
+
+    // A burst of telemetry on two topics, with a control topic and a
+    // heartbeat in the middle of it.
+    const std::vector<std::pair<uint8_t, topic_id_size_t>> pushed = {
+        {0, 10}, {0, 11}, {0, 10}, {5, 20}, {0, 11}, {9, 30}, {5, 20}, {0, 10},
+    };
+    for (size_t i = 0; i < pushed.size(); ++i)
+    {
+        std::vector<uint8_t> payload(1 + i, static_cast<uint8_t>(i));
+        ASSERT_TRUE(lanes.push(pushed[i].first, pushed[i].second, payload.data(), payload.size(),
+                               start + std::chrono::microseconds(i)));
+    }
+    ASSERT_FALSE(lanes.empty());
+
+    // Highest priority first, and in the order they were pushed within a
+    // lane, so each topic stays in order.
+    std::vector<Drained> drained = drain_all(&lanes);
+    const std::vector<size_t> order = {5, 3, 6, 0, 1, 2, 4, 7};
+    ASSERT_EQ(drained.size(), order.size());
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        size_t index = order[i];
+        ASSERT_EQ(drained[i].topic_ID, pushed[index].second);
+        ASSERT_EQ(drained[i].payload, std::vector<uint8_t>(1 + index, static_cast<uint8_t>(index)));
+        ASSERT_EQ(drained[i].receive_time, start + std::chrono::microseconds(index));
+    }
+    ASSERT_TRUE(lanes.empty());
+    ASSERT_TRUE(drain_all(&lanes).empty());
+}
+
+TEST(RxLanes, full)
+{
+    RxLanes lanes(256);
+
+    // A payload that doesn't fit is refused, and there is room again once
+    // the lanes are drained.
+    uint8_t payload[100]{};
+    ASSERT_TRUE(lanes.push(0, 2, payload, sizeof(payload), std::chrono::system_clock::time_point()));
+    ASSERT_TRUE(lanes.push(1, 3, payload, sizeof(payload), std::chrono::system_clock::time_point()));
+    ASSERT_FALSE(lanes.push(0, 2, payload, sizeof(payload), std::chrono::system_clock::time_point()));
+    ASSERT_TRUE(lanes.push(0, 2, payload, 0, std::chrono::system_clock::time_point()));
+
+    std::vector<Drained> drained = drain_all(&lanes);
+    ASSERT_EQ(drained.size(), 3U);
+    ASSERT_EQ(drained[0].topic_ID, 3);
+    ASSERT_TRUE(drained[2].payload.empty());
+
+    ASSERT_TRUE(lanes.push(0, 2, payload, sizeof(payload), std::chrono::system_clock::time_point()));
+    ASSERT_TRUE(lanes.push(0, 2, payload, sizeof(payload), std::chrono::system_clock::time_point()));
+}
@@ -0,0 +1,137 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdint>
+#include <set>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "ros2_serial_example/service_correlator.hpp"
+
+using ros2_to_serial_bridge::transport::ServiceCorrelator;
+
+/// HELPERS
+
+using Correlator = ServiceCorrelator<int>;
+
+/// TESTS
+
+TEST(ServiceCorrelator, invalid_construction)
+{
+    ASSERT_THROW(Correlator(0, std::chrono::milliseconds(100)), std::runtime_error);
+    ASSERT_THROW(Correlator(4, std::chrono::milliseconds(0)), std::runtime_error);
+}
+
+TEST(ServiceCorrelator, pipelined)
+{
+    Correlator correlator(3, std::chrono::milliseconds(100));
+    Correlator::Clock::time_point now = Correlator::Clock::now();
+
+    // Up to max_in_flight requests wait at once, each with an ID of its own.
+    uint32_t ids[3];
+    ASSERT_TRUE(correlator.begin(10, now, &ids[0]));
+    ASSERT_TRUE(correlator.begin(11, now, &ids[1]));
+    ASSERT_TRUE(correlator.begin(12, now, &ids[2]));
+    ASSERT_NE(ids[0], 0U);
+    ASSERT_NE(ids[0], ids[1]);
+    ASSERT_NE(ids[1], ids[2]);
+    ASSERT_EQ(correlator.in_flight(), 3U);
+    uint32_t id;
+    ASSERT_FALSE(correlator.begin(13, now, &id));
+
+    // The responses may come back in any order, and each only once.
+    int context = 0;
+    ASSERT_TRUE(correlator.complete(ids[1], &context));
+    ASSERT_EQ(context, 11);
+    ASSERT_FALSE(correlator.complete(ids[1], &context));
+    ASSERT_TRUE(correlator.begin(13, now, &id));
+    ASSERT_TRUE(correlator.complete(ids[2], &context));
+    ASSERT_EQ(context, 12);
+    ASSERT_TRUE(correlator.complete(ids[0], &context));
+    ASSERT_EQ(context, 10);
+    ASSERT_TRUE(correlator.complete(id, &context));
+    ASSERT_EQ(context, 13);
+    ASSERT_EQ(correlator.in_flight(), 0U);
+
+    // A bogus ID matches nothing.
+    ASSERT_FALSE(correlator.complete(0, &context));
+}
+
+TEST(ServiceCorrelator, expire)
+{
+    Correlator correlator(4, std::chrono::milliseconds(100));
+    Correlator::Clock::time_point now = Correlator::Clock::now();
+    ASSERT_EQ(correlator.next_deadline(), Correlator::Clock::time_point::max());
+
+    uint32_t first;
+    uint32_t second;
+    ASSERT_TRUE(correlator.begin(1, now, &first));
+    ASSERT_TRUE(correlator.begin(2, now + std::chrono::milliseconds(50), &second));
+    ASSERT_EQ(correlator.next_deadline(), now + std::chrono::milliseconds(100));
+
+    std::vector<int> expired;
+    ASSERT_EQ(correlator.expire(now + std::chrono::milliseconds(99), &expired), 0U);
+    ASSERT_EQ(correlator.expire(now + std::chrono::milliseconds(100), &expired), 1U);
+    ASSERT_EQ(expired, std::vector<int>({1}));
+    ASSERT_EQ(correlator.next_deadline(), now + std::chrono::milliseconds(150));
+
+    // A response after the timeout is too late.
+    int context = 0;
+    ASSERT_FALSE(correlator.complete(first, &context));
+    ASSERT_TRUE(correlator.complete(second, &context));
+    ASSERT_EQ(context, 2);
+}
+
+TEST(ServiceCorrelator, ids)
+{
+    uint8_t buf[ServiceCorrelator<int>::ID_LEN];
+    Correlator::put_id(buf, 0x12345678);
+    ASSERT_EQ(buf[0], 0x12);
+    ASSERT_EQ(buf[3], 0x78);
+
+    uint32_t id = 0;
+    ASSERT_TRUE(Correlator::get_id(buf, sizeof(buf), &id));
+    ASSERT_EQ(id, 0x12345678U);
+    ASSERT_FALSE(Correlator::get_id(buf, sizeof(buf) - 1, &id));
+}
+
+TEST(ServiceCorrelator, concurrent)
+{
+    // Requests started from several threads while another completes them;
+    // every ID in flight is unique, and every request completes once.
+    constexpr size_t NUM_THREADS = 4;
+    constexpr int COUNT = 5000;
+    Correlator correlator(NUM_THREADS, std::chrono::milliseconds(10000));
+
+    std::vector<std::thread> threads;
+    std::vector<std::vector<uint32_t>> ids(NUM_THREADS);
+    for (size_t t = 0; t < NUM_THREADS; ++t)
+    {
+        threads.emplace_back([&correlator, &ids, t]() {
+            for (int i = 0; i < COUNT; ++i)
+            {
+                uint32_t id;
+                // Each thread has at most one request waiting, so there is
+                // always room for it.
+                ASSERT_TRUE(correlator.begin(static_cast<int>(t), Correlator::Clock::now(), &id));
+                int context = -1;
+                ASSERT_TRUE(correlator.complete(id, &context));
+                ASSERT_EQ(context, static_cast<int>(t));
+                ids[t].push_back(id);
+            }
+        });
+    }
+    for (auto & thread : threads)
+    {
+        thread.join();
+    }
+
+    std::set<uint32_t> all;
+    for (const auto & v : ids)
+    {
+        all.insert(v.begin(), v.end());
+    }
+    ASSERT_EQ(all.size(), NUM_THREADS * COUNT);
+    ASSERT_EQ(correlator.in_flight(), 0U);
+}
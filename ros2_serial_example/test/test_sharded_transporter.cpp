@@ -0,0 +1,176 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+#include "ros2_serial_example/sharded_transporter.hpp"
+#include "ros2_serial_example/transporter.hpp"
+#include "ros2_serial_example/udp_transporter.hpp"
+
+#include "transporter_test_helpers.hpp"
+
+using ros2_to_serial_bridge::transport::ShardedTransporter;
+using ros2_to_serial_bridge::transport::Transporter;
+using ros2_to_serial_bridge::transport::UDPTransporter;
+
+/// HELPERS
+
+// Pick a range of ports that is unlikely to clash with other test runs, or
+// with the ones test_udp_transporter picks.
+static uint16_t base_port()
+{
+    return static_cast<uint16_t>(45000 + (::getpid() % 1000) * 16);
+}
+
+// The shards of a ShardedTransporter receiving on recv_port.
+static std::vector<std::unique_ptr<Transporter>> make_shards(uint16_t recv_port, uint16_t send_port, size_t count,
+                                                             bool steer_by_source)
+{
+    std::vector<std::unique_ptr<Transporter>> shards;
+    for (size_t i = 0; i < count; ++i)
+    {
+        auto udp = std::make_unique<UDPTransporter>("cobs", recv_port, send_port, 10, 1024);
+        EXPECT_EQ(udp->set_reuse_port(true), 0);
+        if (steer_by_source && i == 0)
+        {
+            EXPECT_EQ(udp->set_source_steering(static_cast<uint32_t>(count)), 0);
+        }
+        shards.push_back(std::move(udp));
+    }
+    return shards;
+}
+
+/// TESTS
+
+TEST(ShardedTransporter, invalid_construction)
+{
+    ASSERT_THROW(ShardedTransporter("cobs", {}, 10, 1024, 4096), std::runtime_error);
+
+    std::vector<std::unique_ptr<Transporter>> shards = make_shards(1, 2, 1, false);
+    shards.push_back(nullptr);
+    ASSERT_THROW(ShardedTransporter("cobs", std::move(shards), 10, 1024, 4096), std::runtime_error);
+
+    shards = make_shards(1, 2, 1, false);
+    ASSERT_THROW(ShardedTransporter("px4", std::move(shards), 10, 1024, 4096), std::runtime_error);
+
+    shards = make_shards(1, 2, ShardedTransporter::MAX_SHARDS + 1, false);
+    ASSERT_THROW(ShardedTransporter("cobs", std::move(shards), 10, 1024, 4096), std::runtime_error);
+}
+
+TEST(ShardedTransporter, invalid_settings)
+{
+    ShardedTransporter sharded("cobs", make_shards(1, 2, 2, false), 10, 1024, 4096);
+    ASSERT_EQ(sharded.get_shard_count(), 2U);
+    ASSERT_EQ(sharded.set_shard_cpus({0, -1}), -1);
+    ASSERT_EQ(sharded.set_shard_cpus({0}), 0);
+    ASSERT_EQ(sharded.get_read_fd(), -1);
+    ASSERT_EQ(sharded.get_shard_stats(2).rx_messages, 0U);
+
+    UDPTransporter udp("cobs", 1, 2, 10, 1024);
+    ASSERT_EQ(udp.set_reuse_port(true), 0);
+    ASSERT_EQ(udp.set_source_steering(4), 0);
+}
+
+TEST(ShardedTransporter, round_trip)
+{
+    uint16_t port = base_port();
+    ShardedTransporter sharded("cobs", make_shards(port, port + 1, 4, false), 10, 1024, 4096);
+    ASSERT_EQ(sharded.init(), 0);
+    ASSERT_GE(sharded.get_read_fd(), 0);
+
+    // Several senders, each from a port of its own, so the kernel has
+    // something to spread over the shards.
+    std::vector<std::unique_ptr<UDPTransporter>> senders;
+    for (uint16_t i = 0; i < 4; ++i)
+    {
+        senders.push_back(std::make_unique<UDPTransporter>("cobs", port + 2 + i, port, 10, 1024));
+        ASSERT_EQ(senders.back()->init(), 0);
+    }
+
+    for (uint8_t n = 0; n < 10; ++n)
+    {
+        for (size_t i = 0; i < senders.size(); ++i)
+        {
+            uint8_t payload[]{n, static_cast<uint8_t>(i)};
+            ASSERT_EQ(senders[i]->write(0x7, payload, sizeof(payload)), 2);
+        }
+    }
+
+    std::vector<std::vector<uint8_t>> messages = read_messages(sharded, 40);
+    ASSERT_EQ(messages.size(), 40U);
+    uint64_t rx_messages = 0;
+    for (size_t i = 0; i < sharded.get_shard_count(); ++i)
+    {
+        rx_messages += sharded.get_shard_stats(i).rx_messages;
+        ASSERT_EQ(sharded.get_shard_stats(i).overflows, 0U);
+    }
+    ASSERT_EQ(rx_messages, 40U);
+
+    // The messages of each sender come out in the order they were sent.
+    std::vector<uint8_t> next(senders.size(), 0);
+    for (const std::vector<uint8_t> & message : messages)
+    {
+        ASSERT_EQ(message.size(), 3U);
+        ASSERT_EQ(message[2], 0x7);
+        ASSERT_EQ(message[0], next[message[1]]++);
+    }
+
+    // Writing goes through the first shard.
+    UDPTransporter receiver("cobs", port + 1, port + 6, 10, 1024);
+    ASSERT_EQ(receiver.init(), 0);
+    uint8_t payload[]{0x1, 0x0, 0x2};
+    ASSERT_EQ(sharded.write(0x3, payload, sizeof(payload)), 3);
+    uint8_t buf[64];
+    size_t received = 0;
+    for (int i = 0; i < 100 && received == 0; ++i)
+    {
+        receiver.read_many(buf, sizeof(buf), [&received](topic_id_size_t topic_ID, uint8_t *, size_t length)
+        {
+            ASSERT_EQ(topic_ID, 0x3);
+            ASSERT_EQ(length, 3U);
+            received++;
+        });
+    }
+    ASSERT_EQ(received, 1U);
+
+    ASSERT_EQ(sharded.close(), 0);
+    ASSERT_EQ(sharded.get_read_fd(), -1);
+}
+
+TEST(ShardedTransporter, steer_by_source)
+{
+    uint16_t port = base_port() + 7;
+    ShardedTransporter sharded("cobs", make_shards(port, port + 1, 2, true), 10, 1024, 4096);
+    ASSERT_EQ(sharded.init(), 0);
+
+    // Everything from 127.0.0.1 goes to the same shard, whatever port it is
+    // sent from: 0x7f000001 modulo 2 is 1.
+    std::vector<std::unique_ptr<UDPTransporter>> senders;
+    for (uint16_t i = 0; i < 3; ++i)
+    {
+        senders.push_back(std::make_unique<UDPTransporter>("cobs", port - 3 + i, port, 10, 1024));
+        ASSERT_EQ(senders.back()->init(), 0);
+        uint8_t payload[]{static_cast<uint8_t>(i)};
+        ASSERT_EQ(senders.back()->write(0x5, payload, sizeof(payload)), 1);
+    }
+
+    ASSERT_EQ(read_messages(sharded, 3).size(), 3U);
+    ASSERT_EQ(sharded.get_shard_stats(0).rx_messages, 0U);
+    ASSERT_EQ(sharded.get_shard_stats(1).rx_messages, 3U);
+}
+
+TEST(ShardedTransporter, reinit)
+{
+    uint16_t port = base_port() + 4;
+    ShardedTransporter sharded("cobs", make_shards(port, port + 1, 2, false), 10, 1024, 4096);
+    ASSERT_EQ(sharded.init(), 0);
+    ASSERT_EQ(sharded.init(), -1);
+    ASSERT_EQ(sharded.close(), 0);
+    ASSERT_EQ(sharded.init(), 0);
+}
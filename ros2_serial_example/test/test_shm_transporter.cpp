@@ -0,0 +1,151 @@
+#include <gtest/gtest.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "ros2_serial_example/shm_transporter.hpp"
+
+using ros2_to_serial_bridge::transport::ShmTransporter;
+
+/// HELPERS
+
+static std::string shm_name(const std::string & test)
+{
+    return "/ros2_serial_test_" + test + "_" + std::to_string(::getpid());
+}
+
+// Read until a complete message arrives, giving up after a while.
+static ssize_t read_message(ShmTransporter & trans, topic_id_size_t *topic_ID, uint8_t *buffer, size_t len)
+{
+    for (int i = 0; i < 100; ++i)
+    {
+        ssize_t ret = trans.read(topic_ID, buffer, len);
+        if (ret != 0 && ret != -ENODATA)
+        {
+            return ret;
+        }
+    }
+    return 0;
+}
+
+/// TESTS
+
+TEST(ShmTransporter, invalid_args)
+{
+    ASSERT_THROW(ShmTransporter("px4", "noslash", ShmTransporter::Role::CREATE, 1024, 10, 1024), std::runtime_error);
+    ASSERT_THROW(ShmTransporter("px4", "/", ShmTransporter::Role::CREATE, 1024, 10, 1024), std::runtime_error);
+    ASSERT_THROW(ShmTransporter("px4", "/a/b", ShmTransporter::Role::CREATE, 1024, 10, 1024), std::runtime_error);
+    ASSERT_THROW(ShmTransporter("px4", "/a", ShmTransporter::Role::CREATE, 0, 10, 1024), std::runtime_error);
+}
+
+TEST(ShmTransporter, attach_before_create)
+{
+    ShmTransporter attach("px4", shm_name("attach_before_create"), ShmTransporter::Role::ATTACH, 0, 10, 1024);
+    ASSERT_EQ(attach.init(), -1);
+}
+
+TEST(ShmTransporter, round_trip)
+{
+    std::string name = shm_name("round_trip");
+    ShmTransporter create("px4", name, ShmTransporter::Role::CREATE, 1024, 10, 1024);
+    ASSERT_EQ(create.init(), 0);
+    ShmTransporter attach("px4", name, ShmTransporter::Role::ATTACH, 0, 10, 1024);
+    ASSERT_EQ(attach.init(), 0);
+
+    topic_id_size_t topic_ID;
+    uint8_t buffer[64]{};
+
+    // Nothing has been written yet, so reads time out.
+    ASSERT_EQ(attach.read(&topic_ID, buffer, sizeof(buffer)), -ENODATA);
+
+    uint8_t data[3]{0x1, 0x2, 0x3};
+    ASSERT_EQ(create.write(0x5, data, sizeof(data)), static_cast<ssize_t>(sizeof(data)));
+    ASSERT_EQ(read_message(attach, &topic_ID, buffer, sizeof(buffer)), static_cast<ssize_t>(sizeof(data)));
+    ASSERT_EQ(topic_ID, 0x5);
+    ASSERT_EQ(buffer[0], 0x1);
+    ASSERT_EQ(buffer[1], 0x2);
+    ASSERT_EQ(buffer[2], 0x3);
+
+    // And the other direction.
+    uint8_t data2[2]{0x4, 0x5};
+    ASSERT_EQ(attach.write(0x6, data2, sizeof(data2)), static_cast<ssize_t>(sizeof(data2)));
+    ASSERT_EQ(read_message(create, &topic_ID, buffer, sizeof(buffer)), static_cast<ssize_t>(sizeof(data2)));
+    ASSERT_EQ(topic_ID, 0x6);
+    ASSERT_EQ(buffer[0], 0x4);
+    ASSERT_EQ(buffer[1], 0x5);
+}
+
+TEST(ShmTransporter, full_ring)
+{
+    std::string name = shm_name("full_ring");
+    ShmTransporter create("px4", name, ShmTransporter::Role::CREATE, 32, 10, 1024);
+    ASSERT_EQ(create.init(), 0);
+
+    // Nobody is reading, so once the ring fills up the write gives up.
+    uint8_t data[64]{};
+    ASSERT_EQ(create.write(0x5, data, sizeof(data)), -1);
+    ASSERT_EQ(errno, EBUSY);
+}
+
+TEST(ShmTransporter, wrap)
+{
+    std::string name = shm_name("wrap");
+    ShmTransporter create("cobs", name, ShmTransporter::Role::CREATE, 64, 100, 1024);
+    ASSERT_EQ(create.init(), 0);
+    ShmTransporter attach("cobs", name, ShmTransporter::Role::ATTACH, 0, 100, 1024);
+    ASSERT_EQ(attach.init(), 0);
+
+    // Messages much bigger than the shared ring have to go through it in
+    // pieces while the reader drains it.
+    std::vector<uint8_t> received;
+    std::thread reader([&attach, &received]() {
+        topic_id_size_t topic_ID;
+        uint8_t buffer[512]{};
+        for (int i = 0; i < 10; ++i)
+        {
+            ssize_t ret = read_message(attach, &topic_ID, buffer, sizeof(buffer));
+            if (ret <= 0)
+            {
+                return;
+            }
+            received.push_back(buffer[0]);
+            received.push_back(buffer[ret - 1]);
+        }
+    });
+
+    for (uint8_t i = 0; i < 10; ++i)
+    {
+        uint8_t data[200];
+        for (size_t j = 0; j < sizeof(data); ++j)
+        {
+            data[j] = static_cast<uint8_t>(i + j);
+        }
+        ASSERT_EQ(create.write(0x5, data, sizeof(data)), static_cast<ssize_t>(sizeof(data)));
+    }
+
+    reader.join();
+    ASSERT_EQ(received.size(), 20U);
+    for (uint8_t i = 0; i < 10; ++i)
+    {
+        ASSERT_EQ(received[2 * i], i);
+        ASSERT_EQ(received[2 * i + 1], static_cast<uint8_t>(i + 199));
+    }
+}
+
+TEST(ShmTransporter, close_removes_segment)
+{
+    std::string name = shm_name("close_removes_segment");
+    {
+        ShmTransporter create("px4", name, ShmTransporter::Role::CREATE, 1024, 10, 1024);
+        ASSERT_EQ(create.init(), 0);
+    }
+
+    ShmTransporter attach("px4", name, ShmTransporter::Role::ATTACH, 0, 10, 1024);
+    ASSERT_EQ(attach.init(), -1);
+}
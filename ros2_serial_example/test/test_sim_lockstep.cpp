@@ -0,0 +1,74 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+
+#include "ros2_serial_example/sim_lockstep.hpp"
+
+using ros2_to_serial_bridge::transport::SimLockstep;
+
+/// HELPERS
+
+// A simulator with 4 ms steps that the bridge gets through every 1 ms.
+constexpr int64_t STEP_NS = 4000000;
+constexpr int64_t WALL_NS = 1000000;
+
+/// TESTS
+
+TEST(SimLockstep, encode_decode)
+{
+    uint8_t buf[SimLockstep::MESSAGE_SIZE + 4];
+    ASSERT_EQ(SimLockstep::encode(SimLockstep::STEP, 0x0102030405060708ULL, -5, buf, SimLockstep::MESSAGE_SIZE - 1), 0U);
+    ASSERT_EQ(SimLockstep::encode(SimLockstep::STEP, 0x0102030405060708ULL, -5, buf, sizeof(buf)), SimLockstep::MESSAGE_SIZE);
+    ASSERT_EQ(buf[0], SimLockstep::STEP);
+    ASSERT_EQ(buf[1], 0);
+
+    uint8_t kind = 0;
+    uint64_t step = 0;
+    int64_t sim_time_ns = 0;
+    ASSERT_TRUE(SimLockstep::decode(buf, SimLockstep::MESSAGE_SIZE, &kind, &step, &sim_time_ns));
+    ASSERT_EQ(kind, SimLockstep::STEP);
+    ASSERT_EQ(step, 0x0102030405060708ULL);
+    ASSERT_EQ(sim_time_ns, -5);
+
+    // Too short, or another message on topic 0.
+    ASSERT_FALSE(SimLockstep::decode(buf, SimLockstep::MESSAGE_SIZE - 1, &kind, &step, &sim_time_ns));
+    buf[0] = 3;
+    ASSERT_FALSE(SimLockstep::decode(buf, SimLockstep::MESSAGE_SIZE, &kind, &step, &sim_time_ns));
+}
+
+TEST(SimLockstep, steps)
+{
+    SimLockstep lockstep;
+    ASSERT_EQ(lockstep.get_real_time_factor(), 0.0);
+
+    for (uint64_t i = 0; i < 100; ++i)
+    {
+        ASSERT_TRUE(lockstep.step(1000 + i, static_cast<int64_t>(i + 1) * STEP_NS, static_cast<int64_t>(i) * WALL_NS));
+    }
+    ASSERT_EQ(lockstep.get_steps(), 100U);
+    ASSERT_EQ(lockstep.get_sim_time_ns(), 100 * STEP_NS);
+    ASSERT_DOUBLE_EQ(lockstep.get_real_time_factor(), 4.0);
+
+    // A STEP whose ACK was lost comes again, and is only acknowledged.
+    ASSERT_FALSE(lockstep.step(1099, 100 * STEP_NS, 100 * WALL_NS));
+    ASSERT_EQ(lockstep.get_steps(), 100U);
+    ASSERT_EQ(lockstep.get_repeats(), 1U);
+    ASSERT_DOUBLE_EQ(lockstep.get_real_time_factor(), 4.0);
+}
+
+TEST(SimLockstep, restart)
+{
+    SimLockstep lockstep;
+    ASSERT_TRUE(lockstep.step(7, 10 * STEP_NS, 0));
+    ASSERT_TRUE(lockstep.step(8, 11 * STEP_NS, 10 * WALL_NS));
+    ASSERT_DOUBLE_EQ(lockstep.get_real_time_factor(), 0.4);
+
+    // A simulator started again goes back in time, even with the same step
+    // number, and its speed is measured from there.
+    ASSERT_TRUE(lockstep.step(8, STEP_NS, 20 * WALL_NS));
+    ASSERT_EQ(lockstep.get_sim_time_ns(), STEP_NS);
+    ASSERT_EQ(lockstep.get_real_time_factor(), 0.0);
+    ASSERT_TRUE(lockstep.step(9, 2 * STEP_NS, 21 * WALL_NS));
+    ASSERT_DOUBLE_EQ(lockstep.get_real_time_factor(), 4.0);
+    ASSERT_EQ(lockstep.get_steps(), 4U);
+}
@@ -0,0 +1,253 @@
+#include <gtest/gtest.h>
+
+#include <cerrno>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "ros2_serial_example/spsc_ring_buffer.hpp"
+
+/// HELPERS
+
+class SPSCRingBufferFixture : public testing::Test
+{
+public:
+    SPSCRingBufferFixture() : ring_(16)
+    {
+        if (::pipe2(pipe_fds_, O_NONBLOCK | O_CLOEXEC) != 0)
+        {
+            throw std::runtime_error("Failed to create pipe");
+        }
+    }
+
+    ~SPSCRingBufferFixture() override
+    {
+        ::close(pipe_fds_[0]);
+        ::close(pipe_fds_[1]);
+    }
+
+    ros2_to_serial_bridge::transport::impl::SPSCRingBuffer ring_;
+    int pipe_fds_[2];
+};
+
+/// TESTS
+
+TEST(SPSCRingBuffer, zero_capacity)
+{
+    ASSERT_THROW(ros2_to_serial_bridge::transport::impl::SPSCRingBuffer(0), std::runtime_error);
+}
+
+TEST_F(SPSCRingBufferFixture, write_and_memcpy_from)
+{
+    uint8_t in[10] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9};
+    uint8_t out[10]{};
+
+    ASSERT_EQ(ring_.write(in, sizeof(in)), 10);
+    ASSERT_EQ(ring_.bytes_used(), 10U);
+    ASSERT_EQ(ring_.bytes_free(), 6U);
+    ASSERT_EQ(ring_.memcpy_from(out, 11), -1);
+    ASSERT_EQ(ring_.memcpy_from(out, 10), 10);
+    ASSERT_EQ(::memcmp(in, out, sizeof(in)), 0);
+    ASSERT_EQ(ring_.bytes_used(), 0U);
+    ASSERT_EQ(ring_.memcpy_from(out, 1), -1);
+}
+
+TEST_F(SPSCRingBufferFixture, write_overflow_keeps_data)
+{
+    uint8_t in[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+    uint8_t out[12]{};
+
+    ASSERT_EQ(ring_.write(in, sizeof(in)), 12);
+    errno = 0;
+    ASSERT_EQ(ring_.write(in, 5), -1);
+    ASSERT_EQ(errno, ENOBUFS);
+    ASSERT_EQ(ring_.get_overflows(), 1U);
+
+    // The data that was already in the ring is untouched.
+    ASSERT_EQ(ring_.bytes_used(), 12U);
+    ASSERT_EQ(ring_.memcpy_from(out, 12), 12);
+    ASSERT_EQ(::memcmp(in, out, sizeof(in)), 0);
+}
+
+TEST_F(SPSCRingBufferFixture, wrapped_spans)
+{
+    uint8_t in[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+    uint8_t out[12]{};
+
+    ASSERT_EQ(ring_.write(in, sizeof(in)), 12);
+    ASSERT_EQ(ring_.consume(10), 10);
+
+    // This wraps around the end of the ring.
+    ASSERT_EQ(ring_.write(in, sizeof(in)), 12);
+    ASSERT_EQ(ring_.bytes_used(), 14U);
+
+    size_t len;
+    const uint8_t *p = ring_.peek_contiguous(&len);
+    ASSERT_NE(p, nullptr);
+    ASSERT_EQ(len, 6U);
+    ASSERT_EQ(p[0], 10);
+    ASSERT_EQ(p[2], 0);
+
+    const uint8_t *first;
+    size_t first_len;
+    const uint8_t *second;
+    size_t second_len;
+    ASSERT_EQ(ring_.peek_spans(14, &first, &first_len, &second, &second_len), 14);
+    ASSERT_EQ(first, p);
+    ASSERT_EQ(first_len, 6U);
+    ASSERT_EQ(second_len, 8U);
+    ASSERT_EQ(second[0], 4);
+    ASSERT_EQ(ring_.peek_spans(15, &first, &first_len, &second, &second_len), -1);
+
+    ASSERT_EQ(ring_.consume(2), 2);
+    ASSERT_EQ(ring_.memcpy_from(out, 12), 12);
+    ASSERT_EQ(::memcmp(in, out, sizeof(in)), 0);
+}
+
+TEST_F(SPSCRingBufferFixture, writev_wraps)
+{
+    uint8_t header[4] = {0, 1, 2, 3};
+    uint8_t payload[6] = {4, 5, 6, 7, 8, 9};
+    uint8_t out[10]{};
+
+    ASSERT_EQ(ring_.write(payload, sizeof(payload)), 6);
+    ASSERT_EQ(ring_.write(payload, 4), 4);
+    ASSERT_EQ(ring_.consume(10), 10);
+
+    // Both buffers go in together, wrapping around the end of the ring in
+    // the middle of the payload.
+    struct iovec iov[2] = {{header, sizeof(header)}, {payload, sizeof(payload)}};
+    ASSERT_EQ(ring_.writev(iov, 2), 10);
+    ASSERT_EQ(ring_.bytes_used(), 10U);
+    ASSERT_EQ(ring_.memcpy_from(out, 10), 10);
+    for (uint8_t i = 0; i < 10; ++i)
+    {
+        ASSERT_EQ(out[i], i);
+    }
+
+    // If they don't both fit, neither goes in.
+    ASSERT_EQ(ring_.write(payload, sizeof(payload)), 6);
+    ASSERT_EQ(ring_.write(header, 1), 1);
+    errno = 0;
+    ASSERT_EQ(ring_.writev(iov, 2), -1);
+    ASSERT_EQ(errno, ENOBUFS);
+    ASSERT_EQ(ring_.get_overflows(), 1U);
+    ASSERT_EQ(ring_.bytes_used(), 7U);
+}
+
+TEST_F(SPSCRingBufferFixture, reserve_and_commit)
+{
+    size_t len;
+    uint8_t *p = ring_.reserve_write(&len);
+    ASSERT_NE(p, nullptr);
+    ASSERT_EQ(len, 16U);
+    p[0] = 42;
+    ASSERT_EQ(ring_.commit_write(17), -1);
+    ASSERT_EQ(ring_.commit_write(16), 16);
+    ASSERT_EQ(ring_.reserve_write(&len), nullptr);
+    ASSERT_EQ(len, 0U);
+
+    ASSERT_EQ(ring_.consume(4), 4);
+    p = ring_.reserve_write(&len);
+    ASSERT_NE(p, nullptr);
+    ASSERT_EQ(len, 4U);
+    ASSERT_EQ(ring_.commit_write(4), 4);
+
+    const uint8_t *c = ring_.peek_contiguous(&len);
+    ASSERT_EQ(len, 12U);
+    ASSERT_EQ(ring_.consume(12), 12);
+    c = ring_.peek_contiguous(&len);
+    ASSERT_EQ(c, p);
+    ASSERT_EQ(len, 4U);
+}
+
+TEST_F(SPSCRingBufferFixture, read_wraps_in_one_call)
+{
+    uint8_t in[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+    uint8_t out[12]{};
+
+    ASSERT_EQ(ring_.write(in, 10), 10);
+    ASSERT_EQ(ring_.consume(10), 10);
+
+    // The free space is 6 bytes at the end of the ring and 10 at the start,
+    // and a single read fills both.
+    ASSERT_EQ(::write(pipe_fds_[1], in, sizeof(in)), 12);
+    ASSERT_EQ(ring_.read(pipe_fds_[0]), 12);
+    ASSERT_EQ(ring_.memcpy_from(out, 12), 12);
+    ASSERT_EQ(::memcmp(in, out, sizeof(in)), 0);
+
+    ASSERT_EQ(ring_.read(pipe_fds_[0]), -1);
+    ASSERT_EQ(errno, EAGAIN);
+}
+
+TEST_F(SPSCRingBufferFixture, read_full)
+{
+    uint8_t in[16]{};
+    ASSERT_EQ(ring_.write(in, sizeof(in)), 16);
+    ASSERT_EQ(::write(pipe_fds_[1], in, 1), 1);
+    errno = 0;
+    ASSERT_EQ(ring_.read(pipe_fds_[0]), -1);
+    ASSERT_EQ(errno, ENOBUFS);
+    ASSERT_EQ(ring_.get_overflows(), 1U);
+}
+
+TEST(SPSCRingBuffer, producer_consumer_threads)
+{
+    // A producer thread writes an incrementing byte pattern in chunks of
+    // varying size, and the consumer checks that it comes out in order.
+    ros2_to_serial_bridge::transport::impl::SPSCRingBuffer ring(97);
+    constexpr size_t TOTAL = 200000;
+
+    std::thread producer([&ring]()
+    {
+        size_t sent = 0;
+        uint8_t chunk[13];
+        while (sent < TOTAL)
+        {
+            size_t n = std::min(sizeof(chunk), TOTAL - sent);
+            n = 1 + (sent % n);
+            for (size_t i = 0; i < n; ++i)
+            {
+                chunk[i] = static_cast<uint8_t>(sent + i);
+            }
+            if (ring.write(chunk, n) == static_cast<ssize_t>(n))
+            {
+                sent += n;
+            }
+            else
+            {
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    size_t received = 0;
+    bool in_order = true;
+    while (received < TOTAL)
+    {
+        size_t len;
+        const uint8_t *p = ring.peek_contiguous(&len);
+        if (p == nullptr)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+        for (size_t i = 0; i < len; ++i)
+        {
+            in_order = in_order && p[i] == static_cast<uint8_t>(received + i);
+        }
+        ring.consume(len);
+        received += len;
+    }
+
+    producer.join();
+
+    ASSERT_TRUE(in_order);
+    ASSERT_EQ(received, TOTAL);
+    ASSERT_EQ(ring.bytes_used(), 0U);
+}
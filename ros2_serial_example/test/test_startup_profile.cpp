@@ -0,0 +1,109 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ros2_serial_example/startup_profile.hpp"
+
+using ros2_to_serial_bridge::transport::StartupProfile;
+using ros2_to_serial_bridge::transport::run_in_parallel;
+
+/// TESTS
+
+TEST(StartupProfile, phases)
+{
+    StartupProfile profile;
+    ASSERT_EQ(profile.total().count(), 0);
+    ASSERT_EQ(profile.report(), "(total 0.0 ms)");
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    profile.mark("parameters");
+    profile.mark("transport");
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    profile.mark("parameters");
+
+    ASSERT_GE(profile.get("parameters"), std::chrono::milliseconds(4));
+    ASSERT_LT(profile.get("transport"), std::chrono::milliseconds(2));
+    ASSERT_EQ(profile.get("entities").count(), 0);
+    ASSERT_EQ(profile.total(), profile.get("parameters") + profile.get("transport"));
+
+    // In the order the phases first came up.
+    std::string report = profile.report();
+    ASSERT_EQ(report.find("parameters "), 0U);
+    ASSERT_NE(report.find(", transport "), std::string::npos);
+    ASSERT_NE(report.find(" (total "), std::string::npos);
+}
+
+TEST(StartupProfile, run_in_parallel)
+{
+    std::vector<std::function<void()>> jobs;
+    std::atomic<int> running{0};
+    std::atomic<int> most_running{0};
+    std::vector<int> done(8, 0);
+    for (size_t i = 0; i < done.size(); ++i)
+    {
+        jobs.push_back([&, i]() {
+            int now = ++running;
+            int most = most_running;
+            while (now > most && !most_running.compare_exchange_weak(most, now))
+            {
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            --running;
+            done[i]++;
+        });
+    }
+
+    std::vector<std::chrono::nanoseconds> durations;
+    run_in_parallel(jobs, 4, &durations);
+    ASSERT_EQ(done, std::vector<int>(8, 1));
+    ASSERT_EQ(durations.size(), 8U);
+    for (std::chrono::nanoseconds duration : durations)
+    {
+        ASSERT_GE(duration, std::chrono::milliseconds(5));
+    }
+    ASSERT_GT(most_running, 1);
+    ASSERT_LE(most_running, 4);
+
+    // One thread runs them all on the calling thread, one after another.
+    std::set<std::thread::id> ids;
+    std::vector<std::function<void()>> serial(3, [&ids]() { ids.insert(std::this_thread::get_id()); });
+    run_in_parallel(serial, 1, nullptr);
+    ASSERT_EQ(ids, std::set<std::thread::id>{std::this_thread::get_id()});
+
+    run_in_parallel({}, 4, &durations);
+    ASSERT_TRUE(durations.empty());
+}
+
+TEST(StartupProfile, run_in_parallel_throws)
+{
+    std::atomic<int> ran{0};
+    std::vector<std::function<void()>> jobs;
+    jobs.push_back([&ran]() { ran++; throw std::runtime_error("first"); });
+    for (int i = 0; i < 16; ++i)
+    {
+        jobs.push_back([&ran]() { ran++; });
+    }
+
+    // With one thread, nothing runs after the job that threw.
+    try
+    {
+        run_in_parallel(jobs, 1, nullptr);
+        FAIL() << "Expected std::runtime_error";
+    }
+    catch (const std::runtime_error & err)
+    {
+        ASSERT_EQ(std::string(err.what()), "first");
+    }
+    ASSERT_EQ(ran, 1);
+
+    ran = 0;
+    ASSERT_THROW(run_in_parallel(jobs, 4, nullptr), std::runtime_error);
+    ASSERT_GE(ran, 1);
+}
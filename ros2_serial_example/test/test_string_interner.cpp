@@ -0,0 +1,285 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gtest/gtest.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "ros2_serial_example/packed_encoding.hpp"
+#include "ros2_serial_example/string_interner.hpp"
+
+using ros2_to_serial_bridge::pubsub::InternTable;
+using ros2_to_serial_bridge::pubsub::PackedReader;
+using ros2_to_serial_bridge::pubsub::PackedWriter;
+using ros2_to_serial_bridge::pubsub::StringInterner;
+
+/// HELPERS
+
+struct Header
+{
+    int32_t sec{0};
+    uint32_t nanosec{0};
+    std::string frame_id;
+};
+
+struct Sample
+{
+    Header header;
+    std::string child_frame_id;
+    std::array<bool, 2> flags{};
+    std::vector<double> values;
+    std::vector<std::string> names;
+};
+
+// The encode() and decode() of the packing struct generate_ros2_topics.py
+// makes for Sample.
+struct SamplePacking final
+{
+    static void encode(const Sample & msg, PackedWriter & writer)
+    {
+        writer.put<4>(msg.header.sec, 0);
+        writer.put<4>(msg.header.nanosec, 1);
+        writer.put_string(msg.header.frame_id);
+        writer.put_string(msg.child_frame_id);
+        writer.put_array<1>(msg.flags.data(), 2, 4);
+        writer.put_field_length(msg.values.size(), 5);
+        writer.put_array<8>(msg.values.data(), msg.values.size(), 5);
+        writer.put_length(msg.names.size());
+        for (size_t i0 = 0; i0 < msg.names.size(); ++i0)
+        {
+            writer.put_string(msg.names[i0]);
+        }
+    }
+
+    static bool decode(PackedReader & reader, Sample & msg)
+    {
+        reader.get<4>(msg.header.sec, 0);
+        reader.get<4>(msg.header.nanosec, 1);
+        reader.get_string(msg.header.frame_id);
+        reader.get_string(msg.child_frame_id);
+        reader.get_array<1>(msg.flags.data(), 2, 4);
+        msg.values.resize(reader.get_field_length(5, 8));
+        reader.get_array<8>(msg.values.data(), msg.values.size(), 5);
+        msg.names.resize(reader.get_length(1, 4));
+        for (size_t i0 = 0; i0 < msg.names.size(); ++i0)
+        {
+            reader.get_string(msg.names[i0]);
+        }
+        return reader.finish();
+    }
+};
+
+static Sample make_sample(int32_t sec)
+{
+    Sample msg;
+    msg.header.sec = sec;
+    msg.header.nanosec = 500;
+    msg.header.frame_id = "base_link";
+    msg.child_frame_id = "imu_link";
+    msg.flags[1] = true;
+    msg.values = {1.5, -2.0};
+    msg.names = {"left", "right", "left"};
+    return msg;
+}
+
+static std::vector<uint8_t> encode(StringInterner * interner, const Sample & msg)
+{
+    std::vector<uint8_t> payload;
+    PackedWriter writer(&payload, interner);
+    SamplePacking::encode(msg, writer);
+    return payload;
+}
+
+static bool decode(InternTable * table, const std::vector<uint8_t> & payload, Sample * msg, bool * unknown = nullptr)
+{
+    PackedReader reader(payload.data(), payload.size(), table);
+    bool ok = SamplePacking::decode(reader, *msg);
+    if (unknown != nullptr)
+    {
+        *unknown = reader.unknown_slot();
+    }
+    return ok;
+}
+
+static void expect_equal(const Sample & a, const Sample & b)
+{
+    EXPECT_EQ(a.header.sec, b.header.sec);
+    EXPECT_EQ(a.header.nanosec, b.header.nanosec);
+    EXPECT_EQ(a.header.frame_id, b.header.frame_id);
+    EXPECT_EQ(a.child_frame_id, b.child_frame_id);
+    EXPECT_EQ(a.flags, b.flags);
+    EXPECT_EQ(a.values, b.values);
+    EXPECT_EQ(a.names, b.names);
+}
+
+/// TESTS
+
+TEST(StringInterner, roundtrip)
+{
+    StringInterner interner(0x5a);
+    InternTable table;
+    Sample out;
+
+    std::vector<uint8_t> first = encode(&interner, make_sample(1));
+    ASSERT_TRUE(decode(&table, first, &out));
+    expect_equal(out, make_sample(1));
+    // base_link, imu_link, left and right are defined; the second left refers
+    // to the first.
+    ASSERT_EQ(interner.get_definitions(), 4U);
+    ASSERT_EQ(interner.get_references(), 1U);
+
+    // After that, each string is a single octet.
+    std::vector<uint8_t> second = encode(&interner, make_sample(2));
+    ASSERT_TRUE(decode(&table, second, &out));
+    expect_equal(out, make_sample(2));
+    ASSERT_EQ(interner.get_definitions(), 4U);
+    ASSERT_EQ(interner.get_references(), 6U);
+    // The session, the number of definitions, 8 octets of stamp, 2 flags,
+    // 1 + 16 of values, 1 for the number of names and a token per string.
+    ASSERT_EQ(second.size(), 1U + 1U + 8U + 2U + 17U + 1U + 5U);
+    ASSERT_LT(second.size(), first.size());
+}
+
+TEST(StringInterner, literal)
+{
+    StringInterner interner(1);
+    InternTable table;
+    Sample in = make_sample(1);
+    in.child_frame_id = std::string(StringInterner::MAX_STRING_LENGTH + 1, 'x');
+    Sample out;
+
+    ASSERT_TRUE(decode(&table, encode(&interner, in), &out));
+    ASSERT_TRUE(decode(&table, encode(&interner, in), &out));
+    expect_equal(out, in);
+    // Too long to intern, so it is sent in full each time.
+    ASSERT_EQ(interner.get_definitions(), 5U);
+}
+
+TEST(StringInterner, eviction)
+{
+    StringInterner interner(2);
+    InternTable table;
+    Sample in = make_sample(1);
+    Sample out;
+
+    // More strings than there are slots; the oldest are evicted and defined
+    // again when they come back.
+    for (size_t i = 0; i < StringInterner::TABLE_SIZE + 10; ++i)
+    {
+        in.child_frame_id = "frame_" + std::to_string(i);
+        ASSERT_TRUE(decode(&table, encode(&interner, in), &out));
+        ASSERT_EQ(out.child_frame_id, in.child_frame_id);
+    }
+    uint64_t definitions = interner.get_definitions();
+
+    // The strings used in every message are never the oldest.
+    in.child_frame_id = "frame_0";
+    ASSERT_TRUE(decode(&table, encode(&interner, in), &out));
+    expect_equal(out, in);
+    ASSERT_EQ(interner.get_definitions(), definitions + 1);
+}
+
+TEST(StringInterner, lost_definition)
+{
+    StringInterner interner(3);
+    InternTable table;
+    Sample in = make_sample(1);
+    Sample out;
+    bool unknown;
+
+    ASSERT_TRUE(decode(&table, encode(&interner, in), &out));
+
+    // The message that defines a new string is lost...
+    in.child_frame_id = "camera_link";
+    encode(&interner, in);
+
+    // ...so the next one doesn't decode, and the table is forgotten.
+    ASSERT_FALSE(decode(&table, encode(&interner, in), &out, &unknown));
+    ASSERT_TRUE(unknown);
+    ASSERT_EQ(table.get_resets(), 1U);
+
+    // Every slot is defined again within REFRESH_INTERVAL messages.
+    size_t failed = 2;
+    while (!decode(&table, encode(&interner, in), &out))
+    {
+        failed++;
+        ASSERT_LE(failed, StringInterner::REFRESH_INTERVAL);
+    }
+    expect_equal(out, in);
+    ASSERT_TRUE(decode(&table, encode(&interner, in), &out));
+}
+
+TEST(StringInterner, new_session)
+{
+    InternTable table;
+    Sample out;
+
+    StringInterner first(4);
+    ASSERT_TRUE(decode(&table, encode(&first, make_sample(1)), &out));
+    ASSERT_TRUE(decode(&table, encode(&first, make_sample(2)), &out));
+
+    // A sender that started over uses the slots for other strings.
+    StringInterner second(5);
+    Sample in = make_sample(3);
+    in.header.frame_id = "map";
+    ASSERT_TRUE(decode(&table, encode(&second, in), &out));
+    expect_equal(out, in);
+    ASSERT_TRUE(decode(&table, encode(&second, in), &out));
+    expect_equal(out, in);
+    ASSERT_EQ(table.get_resets(), 1U);
+}
+
+TEST(StringInterner, bad_data)
+{
+    StringInterner interner(6);
+    InternTable table;
+    Sample out;
+    std::vector<uint8_t> payload = encode(&interner, make_sample(1));
+
+    // Truncated anywhere, the payload fails to decode rather than reading
+    // past its end.
+    for (size_t length = 0; length < payload.size(); ++length)
+    {
+        InternTable fresh;
+        PackedReader reader(payload.data(), length, &fresh);
+        ASSERT_FALSE(SamplePacking::decode(reader, out));
+    }
+
+    // Extra data at the end is bad too.
+    std::vector<uint8_t> longer = payload;
+    longer.push_back(0);
+    ASSERT_FALSE(decode(&table, longer, &out));
+
+    // So is a sequence longer than the payload could hold.
+    std::vector<uint8_t> huge;
+    StringInterner other(7);
+    PackedWriter writer(&huge, &other);
+    writer.put<4>(out.header.sec, 0);
+    writer.put<4>(out.header.nanosec, 1);
+    writer.put_string("");
+    writer.put_string("");
+    writer.put_array<1>(out.flags.data(), 2, 4);
+    writer.put_field_length(1000000, 5);
+    InternTable fresh;
+    ASSERT_FALSE(decode(&fresh, huge, &out));
+
+    // And more names than the sequence is bounded to.
+    Sample in = make_sample(1);
+    in.names.resize(5);
+    ASSERT_FALSE(decode(&table, encode(&interner, in), &out));
+}
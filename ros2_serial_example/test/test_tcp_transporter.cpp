@@ -0,0 +1,152 @@
+#include <gtest/gtest.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include <unistd.h>
+
+#include "ros2_serial_example/tcp_transporter.hpp"
+
+#include "transporter_test_helpers.hpp"
+
+using ros2_to_serial_bridge::transport::TCPTransporter;
+
+/// HELPERS
+
+// Pick a port that is unlikely to clash with other test runs.
+static uint16_t base_port()
+{
+    return static_cast<uint16_t>(20000 + (::getpid() % 5000) * 8);
+}
+
+// Read from both sides until the client and server are connected to each
+// other, giving up after a while.
+static bool wait_connected(TCPTransporter & server, TCPTransporter & client)
+{
+    uint8_t buf[64];
+    topic_id_size_t topic_ID;
+    for (int i = 0; i < 200 && !(server.is_connected() && client.is_connected()); ++i)
+    {
+        server.read(&topic_ID, buf, sizeof(buf));
+        client.read(&topic_ID, buf, sizeof(buf));
+    }
+    return server.is_connected() && client.is_connected();
+}
+
+/// TESTS
+
+TEST(TCPTransporter, invalid_args)
+{
+    ASSERT_THROW(TCPTransporter("px4", TCPTransporter::Mode::CLIENT, "127.0.0.1", 0, 10, 1024), std::runtime_error);
+    ASSERT_THROW(TCPTransporter("px4", TCPTransporter::Mode::CLIENT, "", 1, 10, 1024), std::runtime_error);
+
+    TCPTransporter trans("px4", TCPTransporter::Mode::SERVER, "", 1, 10, 1024);
+    ASSERT_EQ(trans.set_socket_buffer_sizes(-1, 0), -1);
+    ASSERT_EQ(trans.set_socket_buffer_sizes(65536, 65536), 0);
+}
+
+TEST(TCPTransporter, not_connected)
+{
+    uint16_t port = base_port();
+    TCPTransporter client("cobs", TCPTransporter::Mode::CLIENT, "127.0.0.1", port, 10, 1024);
+    ASSERT_EQ(client.init(), 0);
+    ASSERT_NE(client.get_read_fd(), -1);
+    ASSERT_NE(client.get_write_fd(), -1);
+
+    // Nobody is listening, so the client keeps trying in the background and
+    // writes fail in the meantime.
+    uint8_t payload[]{0x1, 0x2};
+    ASSERT_EQ(client.write(0x3, payload, sizeof(payload)), -1);
+    ASSERT_FALSE(client.is_connected());
+    ASSERT_EQ(client.get_write_queue_bytes(), -1);
+}
+
+TEST(TCPTransporter, round_trip)
+{
+    uint16_t port = base_port();
+    TCPTransporter server("cobs", TCPTransporter::Mode::SERVER, "127.0.0.1", port, 10, 1024);
+    ASSERT_EQ(server.init(), 0);
+    TCPTransporter client("cobs", TCPTransporter::Mode::CLIENT, "127.0.0.1", port, 10, 1024);
+    ASSERT_EQ(client.set_socket_buffer_sizes(65536, 65536), 0);
+    ASSERT_EQ(client.init(), 0);
+    ASSERT_TRUE(wait_connected(server, client));
+
+    // With batching, both frames go out in one write.
+    uint8_t payload[]{0x1, 0x0, 0x2};
+    ASSERT_EQ(client.set_write_batching(256), 0);
+    ASSERT_EQ(client.write(0x3, payload, sizeof(payload)), 3);
+    ASSERT_EQ(client.write(0x4, payload, sizeof(payload)), 3);
+    ASSERT_GT(client.flush(), 0);
+
+    std::vector<std::vector<uint8_t>> messages = read_messages(server, 2);
+    ASSERT_EQ(messages.size(), 2U);
+    ASSERT_EQ(messages[0], std::vector<uint8_t>({0x1, 0x0, 0x2, 0x3}));
+    ASSERT_EQ(messages[1], std::vector<uint8_t>({0x1, 0x0, 0x2, 0x4}));
+
+    ASSERT_EQ(server.write(0x5, payload, sizeof(payload)), 3);
+    messages = read_messages(client, 1);
+    ASSERT_EQ(messages.size(), 1U);
+    ASSERT_EQ(messages[0], std::vector<uint8_t>({0x1, 0x0, 0x2, 0x5}));
+    ASSERT_GE(client.get_write_queue_bytes(), 0);
+}
+
+TEST(TCPTransporter, reconnect)
+{
+    uint16_t port = base_port();
+    TCPTransporter server("px4", TCPTransporter::Mode::SERVER, "127.0.0.1", port, 10, 1024);
+    ASSERT_EQ(server.init(), 0);
+    TCPTransporter client("px4", TCPTransporter::Mode::CLIENT, "127.0.0.1", port, 10, 1024);
+    ASSERT_EQ(client.init(), 0);
+    ASSERT_TRUE(wait_connected(server, client));
+    int write_fd = client.get_write_fd();
+
+    // Restarting the server drops the connection, and the client connects
+    // again by itself, on the same file descriptor.
+    ASSERT_EQ(server.close(), 0);
+    uint8_t buf[64];
+    topic_id_size_t topic_ID;
+    for (int i = 0; i < 100 && client.is_connected(); ++i)
+    {
+        client.read(&topic_ID, buf, sizeof(buf));
+    }
+    ASSERT_FALSE(client.is_connected());
+
+    ASSERT_EQ(server.init(), 0);
+    ASSERT_TRUE(wait_connected(server, client));
+    ASSERT_EQ(client.get_write_fd(), write_fd);
+
+    uint8_t payload[]{0x7, 0x8};
+    ASSERT_EQ(client.write(0x3, payload, sizeof(payload)), 2);
+    std::vector<std::vector<uint8_t>> messages = read_messages(server, 1);
+    ASSERT_EQ(messages.size(), 1U);
+    ASSERT_EQ(messages[0], std::vector<uint8_t>({0x7, 0x8, 0x3}));
+}
+
+TEST(TCPTransporter, newest_client_wins)
+{
+    uint16_t port = base_port();
+    TCPTransporter server("cobs", TCPTransporter::Mode::SERVER, "127.0.0.1", port, 10, 1024);
+    ASSERT_EQ(server.init(), 0);
+    TCPTransporter first("cobs", TCPTransporter::Mode::CLIENT, "127.0.0.1", port, 10, 1024);
+    ASSERT_EQ(first.init(), 0);
+    ASSERT_TRUE(wait_connected(server, first));
+
+    TCPTransporter second("cobs", TCPTransporter::Mode::CLIENT, "127.0.0.1", port, 10, 1024);
+    ASSERT_EQ(second.init(), 0);
+    ASSERT_TRUE(wait_connected(server, second));
+
+    // The server takes the second connection over from the first, so what it
+    // writes goes to the second client.
+    uint8_t payload[]{0x9};
+    ASSERT_EQ(second.write(0x3, payload, sizeof(payload)), 1);
+    std::vector<std::vector<uint8_t>> messages = read_messages(server, 1);
+    ASSERT_EQ(messages.size(), 1U);
+    ASSERT_EQ(messages[0], std::vector<uint8_t>({0x9, 0x3}));
+
+    ASSERT_EQ(server.write(0x4, payload, sizeof(payload)), 1);
+    messages = read_messages(second, 1);
+    ASSERT_EQ(messages.size(), 1U);
+    ASSERT_EQ(messages[0], std::vector<uint8_t>({0x9, 0x4}));
+}
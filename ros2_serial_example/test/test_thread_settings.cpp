@@ -0,0 +1,107 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "ros2_serial_example/thread_settings.hpp"
+
+using ros2_to_serial_bridge::transport::ThreadSettings;
+using ros2_to_serial_bridge::transport::apply_thread_settings;
+using ros2_to_serial_bridge::transport::check_thread_settings;
+
+/// TESTS
+
+TEST(ThreadSettings, check)
+{
+    std::string error;
+    ThreadSettings settings;
+    ASSERT_TRUE(check_thread_settings(settings, &error));
+
+    settings.priority = 10;
+    ASSERT_FALSE(check_thread_settings(settings, &error));
+
+    settings.policy = "fifo";
+    ASSERT_TRUE(check_thread_settings(settings, &error));
+
+    settings.priority = 0;
+    ASSERT_FALSE(check_thread_settings(settings, &error));
+
+    settings.policy = "other";
+    ASSERT_TRUE(check_thread_settings(settings, &error));
+
+    settings.policy = "deadline";
+    ASSERT_FALSE(check_thread_settings(settings, &error));
+    ASSERT_NE(error.find("deadline"), std::string::npos);
+
+    settings.policy = "rr";
+    settings.priority = 1;
+    settings.cpus = {0, -1};
+    ASSERT_FALSE(check_thread_settings(settings, &error));
+    settings.cpus = {0, CPU_SETSIZE};
+    ASSERT_FALSE(check_thread_settings(settings, &error));
+}
+
+TEST(ThreadSettings, apply_affinity)
+{
+    // Any user may narrow the affinity of their own threads and keep the
+    // normal policy, so this works without privileges.
+    cpu_set_t allowed;
+    ASSERT_EQ(::sched_getaffinity(0, sizeof(allowed), &allowed), 0);
+    int cpu = 0;
+    while (!CPU_ISSET(cpu, &allowed))
+    {
+        ++cpu;
+    }
+
+    // The thread has to stay alive until it has been checked.
+    std::atomic<bool> done{false};
+    std::thread thread([&done]() {
+        while (!done)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+    ThreadSettings settings;
+    settings.policy = "other";
+    settings.cpus = {cpu};
+    std::string error;
+    bool applied = apply_thread_settings(thread.native_handle(), settings, &error);
+    cpu_set_t set;
+    int ret = ::pthread_getaffinity_np(thread.native_handle(), sizeof(set), &set);
+    done = true;
+    thread.join();
+
+    ASSERT_TRUE(applied) << error;
+    ASSERT_EQ(ret, 0);
+    ASSERT_EQ(CPU_COUNT(&set), 1);
+    ASSERT_TRUE(CPU_ISSET(cpu, &set));
+}
+
+TEST(ThreadSettings, apply_invalid)
+{
+    ThreadSettings settings;
+    settings.policy = "fifo";
+    settings.priority = 1000;
+    std::string error;
+    ASSERT_FALSE(apply_thread_settings(::pthread_self(), settings, &error));
+    ASSERT_FALSE(error.empty());
+}
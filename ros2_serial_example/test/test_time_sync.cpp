@@ -0,0 +1,143 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <random>
+#include <stdexcept>
+
+#include "ros2_serial_example/time_sync.hpp"
+
+using ros2_to_serial_bridge::transport::TimeSync;
+
+/// HELPERS
+
+// A device whose clock started at a made up time, runs 50 ppm slow and is
+// reached over a link with up to 200 us of jitter on each leg.
+class Device final
+{
+public:
+    static constexpr int64_t HOST_START = 1700000000000000000;
+
+    explicit Device(TimeSync * sync) : sync_(sync), rng_(42)
+    {
+    }
+
+    int64_t device_time(int64_t host_ns) const
+    {
+        return 1000 + static_cast<int64_t>((host_ns - HOST_START) * (1.0 - 50e-6));
+    }
+
+    // Do one exchange every 100 ms of made up time.
+    bool exchange()
+    {
+        std::uniform_int_distribution<int64_t> jitter(0, 200000);
+        host_ns_ += 100000000;
+        int64_t there = 1000000 + jitter(rng_);
+        int64_t back = 1000000 + jitter(rng_);
+        int64_t t1 = host_ns_;
+        int64_t t2 = device_time(t1 + there);
+        int64_t t3 = device_time(t1 + there + 50000);
+        int64_t t4 = t1 + there + 50000 + back;
+        return sync_->sample(t1, t2, t3, t4);
+    }
+
+    int64_t host_ns() const
+    {
+        return host_ns_;
+    }
+
+private:
+    TimeSync * sync_;
+    std::mt19937 rng_;
+    int64_t host_ns_{HOST_START};
+};
+
+/// TESTS
+
+TEST(TimeSync, invalid_construction)
+{
+    ASSERT_THROW(TimeSync(0), std::runtime_error);
+}
+
+TEST(TimeSync, single_exchange)
+{
+    TimeSync sync;
+    int64_t host_ns = 0;
+    ASSERT_FALSE(sync.is_synced());
+    ASSERT_FALSE(sync.to_host(0, &host_ns));
+    ASSERT_FALSE(sync.to_device(0, &host_ns));
+    ASSERT_EQ(sync.get_rtt_ns(), -1);
+
+    // Times that go backwards are turned away.
+    ASSERT_FALSE(sync.sample(1000, 500, 400, 2000));
+    ASSERT_FALSE(sync.sample(1000, 500, 600, 900));
+    ASSERT_FALSE(sync.is_synced());
+
+    // 100 us each way, with the device 1 s behind and 20 us to answer.
+    ASSERT_TRUE(sync.sample(1000000000, 100000, 120000, 1000220000));
+    ASSERT_TRUE(sync.is_synced());
+    ASSERT_EQ(sync.get_rtt_ns(), 200000);
+    ASSERT_EQ(sync.get_offset_ns(), 1000000000);
+    ASSERT_TRUE(sync.to_host(5000000, &host_ns));
+    ASSERT_EQ(host_ns, 1005000000);
+    int64_t device_ns = 0;
+    ASSERT_TRUE(sync.to_device(host_ns, &device_ns));
+    ASSERT_EQ(device_ns, 5000000);
+    ASSERT_EQ(sync.get_samples(), 1U);
+}
+
+TEST(TimeSync, slow_exchanges_are_ignored)
+{
+    TimeSync sync(4);
+    ASSERT_TRUE(sync.sample(0, 100, 100, 200));
+
+    // Held up on the way back; taken as symmetric, this would put the offset
+    // off by 5 ms.
+    ASSERT_FALSE(sync.sample(1000000, 1000100, 1000100, 11000200));
+    ASSERT_EQ(sync.get_offset_ns(), 0);
+    ASSERT_EQ(sync.get_samples(), 1U);
+
+    // Once the quick one is out of the window, the quickest of the others
+    // counts.
+    ASSERT_FALSE(sync.sample(2000000, 2000100, 2000100, 2000400));
+    ASSERT_FALSE(sync.sample(3000000, 3000100, 3000100, 3000400));
+    ASSERT_TRUE(sync.sample(4000000, 4000100, 4000100, 4000400));
+    ASSERT_EQ(sync.get_rtt_ns(), 400);
+}
+
+TEST(TimeSync, tracks_offset_and_drift)
+{
+    TimeSync sync;
+    Device device(&sync);
+    for (int i = 0; i < 600; ++i)
+    {
+        device.exchange();
+    }
+    ASSERT_GT(sync.get_samples(), 50U);
+    ASSERT_NEAR(sync.get_drift_ppm(), 50.0, 2.0);
+
+    // A time taken on the device now, and one from a minute ago.
+    int64_t host_ns = 0;
+    ASSERT_TRUE(sync.to_host(device.device_time(device.host_ns()), &host_ns));
+    ASSERT_NEAR(static_cast<double>(host_ns - device.host_ns()), 0.0, 50000.0);
+    ASSERT_TRUE(sync.to_host(device.device_time(device.host_ns() - 60000000000), &host_ns));
+    ASSERT_NEAR(static_cast<double>(host_ns - (device.host_ns() - 60000000000)), 0.0, 200000.0);
+
+    // And back again.
+    int64_t device_ns = 0;
+    ASSERT_TRUE(sync.to_device(host_ns, &device_ns));
+    ASSERT_NEAR(static_cast<double>(device_ns - device.device_time(device.host_ns() - 60000000000)), 0.0, 200000.0);
+}
+
+TEST(TimeSync, device_reset)
+{
+    TimeSync sync(1);
+    ASSERT_TRUE(sync.sample(0, 100, 100, 200));
+    ASSERT_TRUE(sync.sample(1000000000, 1000000100, 1000000100, 1000000200));
+    ASSERT_EQ(sync.get_offset_ns(), 0);
+
+    // The device started again from 0 at host time 2.5 s; the exchanges
+    // from before don't count.
+    ASSERT_TRUE(sync.sample(3000000000, 500000100, 500000100, 3000000200));
+    ASSERT_EQ(sync.get_offset_ns(), 2500000000);
+    ASSERT_EQ(sync.get_drift_ppm(), 0.0);
+}
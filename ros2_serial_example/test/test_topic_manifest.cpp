@@ -0,0 +1,238 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "ros2_serial_example/crc32c.hpp"
+#include "ros2_serial_example/topic_manifest.hpp"
+
+using ros2_to_serial_bridge::transport::ManifestTopic;
+using ros2_to_serial_bridge::transport::TopicManifest;
+
+/// FIXTURES
+
+class TopicManifestFixture : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        char dir[] = "/tmp/test_topic_manifest_XXXXXX";
+        ASSERT_NE(::mkdtemp(dir), nullptr);
+        dir_ = dir;
+        path_ = dir_ + "/topics.bin";
+    }
+
+    void TearDown() override
+    {
+        ::unlink(path_.c_str());
+        ::rmdir(dir_.c_str());
+    }
+
+    std::string dir_;
+    std::string path_;
+};
+
+/// TESTS
+
+TEST_F(TopicManifestFixture, write_open)
+{
+    TopicManifest manifest;
+    ASSERT_FALSE(manifest.open(path_));
+    ASSERT_EQ(manifest.size(), 0U);
+
+    std::vector<ManifestTopic> topics(2);
+    topics[0].name = "chatter";
+    topics[0].type = "std_msgs/String";
+    topics[0].serial_mapping = 9;
+    topics[0].direction = 1;
+    topics[0].reliability = 1;
+    topics[0].history_depth = 3;
+    topics[0].deadline_ms = 250;
+    topics[0].stamp_header = true;
+    topics[0].device_stamp = true;
+    topics[0].lazy = true;
+    topics[0].last_value = true;
+    topics[0].on_change = true;
+    topics[0].on_change_keepalive_ms = 2500;
+    topics[0].reliable = true;
+    topics[0].elide_length = true;
+    topics[0].intern_strings = true;
+    topics[0].quantize = {"data:drop", "other:fixed16:0.5"};
+    topics[0].batch_type = "my_msgs/StringBatch";
+    topics[0].batch_size = 50;
+    topics[0].batch_ms = 20;
+    topics[1].name = "cmd";
+    topics[1].type = "std_msgs/UInt16";
+    topics[1].serial_mapping = 300;
+    topics[1].direction = 2;
+    topics[1].tx_queue_depth = 4;
+    topics[1].tx_overflow_policy = 1;
+    topics[1].tx_priority = 7;
+    topics[1].tx_max_rate_hz = 2.5;
+    topics[1].passthrough = true;
+    topics[1].durability = 1;
+    topics[1].compress_threshold = 64;
+    topics[1].compress_dictionary = {0x00, 0x01, 0xff};
+    topics[1].delta_keyframe_interval = 20;
+    topics[1].max_message_size = 512;
+    topics[1].max_age_ms = 300;
+    ASSERT_TRUE(TopicManifest::write(path_, topics));
+
+    ASSERT_TRUE(manifest.open(path_));
+    ASSERT_EQ(manifest.size(), 2U);
+
+    ManifestTopic t;
+    manifest.get(0, &t);
+    ASSERT_EQ(t.name, "chatter");
+    ASSERT_EQ(t.type, "std_msgs/String");
+    ASSERT_EQ(t.serial_mapping, 9);
+    ASSERT_EQ(t.direction, 1);
+    ASSERT_EQ(t.reliability, 1);
+    ASSERT_EQ(t.durability, 0);
+    ASSERT_EQ(t.history_depth, 3U);
+    ASSERT_EQ(t.deadline_ms, 250);
+    ASSERT_EQ(t.compress_threshold, -1);
+    ASSERT_TRUE(t.compress_dictionary.empty());
+    ASSERT_FALSE(t.passthrough);
+    ASSERT_TRUE(t.stamp_header);
+    ASSERT_TRUE(t.device_stamp);
+    ASSERT_TRUE(t.lazy);
+    ASSERT_TRUE(t.last_value);
+    ASSERT_TRUE(t.on_change);
+    ASSERT_EQ(t.on_change_keepalive_ms, 2500U);
+    ASSERT_TRUE(t.reliable);
+    ASSERT_TRUE(t.elide_length);
+    ASSERT_TRUE(t.intern_strings);
+    ASSERT_EQ(t.quantize, topics[0].quantize);
+    ASSERT_EQ(t.batch_type, "my_msgs/StringBatch");
+    ASSERT_EQ(t.batch_size, 50U);
+    ASSERT_EQ(t.batch_ms, 20U);
+    ASSERT_EQ(t.max_message_size, 0U);
+    ASSERT_EQ(t.max_age_ms, 0U);
+
+    manifest.get(1, &t);
+    ASSERT_EQ(t.name, "cmd");
+    ASSERT_EQ(t.type, "std_msgs/UInt16");
+    ASSERT_EQ(t.serial_mapping, 300);
+    ASSERT_EQ(t.direction, 2);
+    ASSERT_EQ(t.tx_queue_depth, 4U);
+    ASSERT_EQ(t.tx_overflow_policy, 1);
+    ASSERT_EQ(t.tx_priority, 7);
+    ASSERT_EQ(t.tx_max_rate_hz, 2.5);
+    ASSERT_TRUE(t.passthrough);
+    ASSERT_EQ(t.durability, 1);
+    ASSERT_EQ(t.compress_threshold, 64);
+    ASSERT_EQ(t.compress_dictionary, topics[1].compress_dictionary);
+    ASSERT_EQ(t.delta_keyframe_interval, 20U);
+    ASSERT_EQ(t.max_message_size, 512U);
+    ASSERT_EQ(t.max_age_ms, 300U);
+    ASSERT_FALSE(t.stamp_header);
+    ASSERT_FALSE(t.device_stamp);
+    ASSERT_FALSE(t.lazy);
+    ASSERT_FALSE(t.last_value);
+    ASSERT_FALSE(t.on_change);
+    ASSERT_FALSE(t.reliable);
+    ASSERT_FALSE(t.elide_length);
+    ASSERT_FALSE(t.intern_strings);
+    ASSERT_TRUE(t.quantize.empty());
+    ASSERT_TRUE(t.batch_type.empty());
+    ASSERT_EQ(t.batch_size, 0U);
+
+    // An empty manifest is valid.
+    ASSERT_TRUE(TopicManifest::write(path_, {}));
+    ASSERT_TRUE(manifest.open(path_));
+    ASSERT_EQ(manifest.size(), 0U);
+}
+
+TEST_F(TopicManifestFixture, damaged)
+{
+    std::vector<ManifestTopic> topics(1);
+    topics[0].name = "chatter";
+    topics[0].type = "std_msgs/String";
+    ASSERT_TRUE(TopicManifest::write(path_, topics));
+
+    // Flip a byte of the type.
+    FILE * fp = ::fopen(path_.c_str(), "r+b");
+    ASSERT_NE(fp, nullptr);
+    ASSERT_EQ(::fseek(fp, -1, SEEK_END), 0);
+    ASSERT_NE(::fputc('x', fp), EOF);
+    ASSERT_EQ(::fclose(fp), 0);
+
+    TopicManifest manifest;
+    ASSERT_FALSE(manifest.open(path_));
+    ASSERT_EQ(manifest.size(), 0U);
+
+    // Truncate it.
+    ASSERT_TRUE(TopicManifest::write(path_, topics));
+    ASSERT_EQ(::truncate(path_.c_str(), 20), 0);
+    ASSERT_FALSE(manifest.open(path_));
+    ASSERT_EQ(::truncate(path_.c_str(), 4), 0);
+    ASSERT_FALSE(manifest.open(path_));
+}
+
+TEST_F(TopicManifestFixture, version_1)
+{
+    // A version 1 manifest, with an 88 octet record and no quantize profile,
+    // batch settings or on_change.
+    std::vector<uint8_t> file(16 + 88, 0);
+    const char header[] = {'R', '2', 'T', 'M', 1, 0, 0, 0, 1, 0, 0, 0};
+    ::memcpy(file.data(), header, sizeof(header));
+    const std::string name = "chatter";
+    file[16] = static_cast<uint8_t>(file.size());
+    file[20] = static_cast<uint8_t>(name.size());
+    file.insert(file.end(), name.begin(), name.end());
+    file[16 + 8] = static_cast<uint8_t>(file.size());
+    file[16 + 16] = static_cast<uint8_t>(file.size());
+    file[16 + 48] = 5;
+    file[16 + 76] = 1;
+    file[16 + 81] = 0x40;
+    static const ros2_to_serial_bridge::transport::impl::CRC32C crc32c;
+    uint32_t crc = crc32c.update(0, file.data() + 16, file.size() - 16);
+    for (size_t i = 0; i < 4; ++i)
+    {
+        file[12 + i] = static_cast<uint8_t>(crc >> (8 * i));
+    }
+    FILE * fp = ::fopen(path_.c_str(), "wb");
+    ASSERT_NE(fp, nullptr);
+    ASSERT_EQ(::fwrite(file.data(), 1, file.size(), fp), file.size());
+    ASSERT_EQ(::fclose(fp), 0);
+
+    TopicManifest manifest;
+    ASSERT_TRUE(manifest.open(path_));
+    ASSERT_EQ(manifest.size(), 1U);
+    ManifestTopic t;
+    t.quantize = {"stale:drop"};
+    t.batch_type = "stale_msgs/Batch";
+    t.batch_ms = 5;
+    t.on_change = true;
+    manifest.get(0, &t);
+    ASSERT_EQ(t.name, "chatter");
+    ASSERT_TRUE(t.type.empty());
+    ASSERT_EQ(t.history_depth, 5U);
+    ASSERT_EQ(t.direction, 1);
+    ASSERT_TRUE(t.intern_strings);
+    ASSERT_TRUE(t.quantize.empty());
+    ASSERT_TRUE(t.batch_type.empty());
+    ASSERT_EQ(t.batch_ms, 0U);
+    ASSERT_FALSE(t.on_change);
+}
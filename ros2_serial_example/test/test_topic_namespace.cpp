@@ -0,0 +1,39 @@
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include "ros2_serial_example/topic_namespace.hpp"
+
+using ros2_to_serial_bridge::pubsub::apply_topic_namespace;
+using ros2_to_serial_bridge::pubsub::valid_topic_namespace;
+
+/// TESTS
+
+TEST(TopicNamespace, valid)
+{
+    ASSERT_TRUE(valid_topic_namespace(""));
+    ASSERT_TRUE(valid_topic_namespace("/"));
+    ASSERT_TRUE(valid_topic_namespace("uav7"));
+    ASSERT_TRUE(valid_topic_namespace("/uav7"));
+    ASSERT_TRUE(valid_topic_namespace("uav7/"));
+    ASSERT_TRUE(valid_topic_namespace("/fleet/_uav_7/"));
+
+    ASSERT_FALSE(valid_topic_namespace("//"));
+    ASSERT_FALSE(valid_topic_namespace("7uav"));
+    ASSERT_FALSE(valid_topic_namespace("fleet/7"));
+    ASSERT_FALSE(valid_topic_namespace("fleet//uav7"));
+    ASSERT_FALSE(valid_topic_namespace("uav-7"));
+    ASSERT_FALSE(valid_topic_namespace("~/uav7"));
+    ASSERT_FALSE(valid_topic_namespace("uav 7"));
+}
+
+TEST(TopicNamespace, apply)
+{
+    ASSERT_EQ(apply_topic_namespace("", "/fmu/out/status"), "/fmu/out/status");
+    ASSERT_EQ(apply_topic_namespace("/", "status"), "status");
+
+    ASSERT_EQ(apply_topic_namespace("uav7", "/fmu/out/status"), "/uav7/fmu/out/status");
+    ASSERT_EQ(apply_topic_namespace("/uav7/", "/fmu/out/status"), "/uav7/fmu/out/status");
+    ASSERT_EQ(apply_topic_namespace("fleet/uav7", "status"), "fleet/uav7/status");
+    ASSERT_EQ(apply_topic_namespace("uav7", "~/status"), "~/uav7/status");
+}
@@ -1,13 +1,20 @@
 #include <gtest/gtest.h>
 
+#include <cerrno>
+#include <chrono>
 #include <cstring>
+#include <limits>
+#include <map>
 #include <memory>
 #include <stdexcept>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <linux/memfd.h>
 
 #include <fcntl.h>
+#include <sys/stat.h>
 #include <sys/syscall.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -109,6 +116,19 @@ public:
         return bufsize;
     }
 
+    // Get the number of bytes added to the memfd that haven't been read yet.
+    off_t memfd_unread()
+    {
+        struct stat st{};
+        off_t offset = ::lseek(memfd_, 0, SEEK_CUR);
+        if (offset < 0 || ::fstat(memfd_, &st) != 0)
+        {
+            return -1;
+        }
+
+        return st.st_size - offset;
+    }
+
     ssize_t node_read() override
     {
         return ringbuf_.read(memfd_);
@@ -118,6 +138,12 @@ public:
     {
         written_data_ = std::unique_ptr<uint8_t[]>(new uint8_t[len]);
         ::memcpy(written_data_.get(), buffer, len);
+        written_len_ = len;
+        write_count_++;
+        if (keep_wire_)
+        {
+            wire_.insert(wire_.end(), written_data_.get(), written_data_.get() + len);
+        }
         return len;
     }
 
@@ -126,10 +152,172 @@ public:
         return test_fds_ok_;
     }
 
+    // Write from several threads at once, each on a topic of its own, and
+    // check that every frame that came out decodes, and that each thread's
+    // frames are in the order it wrote them.
+    void concurrent_writes()
+    {
+        constexpr size_t NUM_THREADS = 4;
+        constexpr size_t COUNT = 500;
+
+        keep_wire_ = true;
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < NUM_THREADS; ++t)
+        {
+            threads.emplace_back([this, t]() {
+                // Lengths from 4 to 203, with runs of 0s for the stuffing to
+                // deal with.
+                uint8_t buf[203]{};
+                for (size_t i = 0; i < COUNT; ++i)
+                {
+                    size_t len = 4 + (i * 7) % 200;
+                    buf[0] = static_cast<uint8_t>(t);
+                    buf[1] = static_cast<uint8_t>(i >> 8U);
+                    buf[2] = static_cast<uint8_t>(i);
+                    for (size_t j = 3; j < len; ++j)
+                    {
+                        buf[j] = (j % 3 == 0) ? static_cast<uint8_t>(i + j) : 0;
+                    }
+                    ASSERT_EQ(write(static_cast<topic_id_size_t>(0x10 + t), buf, len), static_cast<ssize_t>(len));
+                }
+            });
+        }
+        for (auto & thread : threads)
+        {
+            thread.join();
+        }
+        // Anything left in the batch.
+        ASSERT_GE(flush(), 0);
+
+        std::vector<size_t> received(NUM_THREADS);
+        size_t start = 0;
+        uint8_t buf[203];
+        for (size_t end = 0; end < wire_.size(); ++end)
+        {
+            if (wire_[end] != 0)
+            {
+                continue;
+            }
+            topic_id_size_t topic_ID = 0;
+            ssize_t len = copy_message_from_frame(&wire_[start], end + 1 - start, &topic_ID, buf, sizeof(buf));
+            start = end + 1;
+            ASSERT_GE(len, 4);
+            size_t t = buf[0];
+            ASSERT_LT(t, NUM_THREADS);
+            ASSERT_EQ(topic_ID, 0x10 + t);
+            size_t i = (static_cast<size_t>(buf[1]) << 8U) | buf[2];
+            ASSERT_EQ(i, received[t]);
+            ASSERT_EQ(static_cast<size_t>(len), 4 + (i * 7) % 200);
+            received[t]++;
+        }
+        ASSERT_EQ(start, wire_.size());
+        for (size_t t = 0; t < NUM_THREADS; ++t)
+        {
+            ASSERT_EQ(received[t], COUNT);
+        }
+    }
+
+    // Write some frames, damage one, and put some garbage in front, then
+    // check that the same messages come out (and the same garbage and CRC
+    // failures are counted) whether the data arrives in large chunks (as
+    // large as the ring buffer has room for) or in small ones, down to a
+    // byte at a time.
+    void split_reads()
+    {
+        keep_wire_ = true;
+        std::vector<std::vector<uint8_t>> written;
+        std::vector<size_t> frame_ends;
+        for (size_t i = 0; i < 12; ++i)
+        {
+            size_t len = 1 + (i * 13) % 40;
+            std::vector<uint8_t> buf(len);
+            for (size_t j = 0; j < len; ++j)
+            {
+                buf[j] = (j % 4 == 3) ? 0 : static_cast<uint8_t>(i * 3 + j);
+            }
+            ASSERT_EQ(write(static_cast<topic_id_size_t>(0x10 + i), &buf[0], len), static_cast<ssize_t>(len));
+            buf.push_back(static_cast<uint8_t>(0x10 + i));
+            written.push_back(buf);
+            frame_ends.push_back(wire_.size());
+        }
+
+        // The next to last byte of the third frame is in its payload (or
+        // for COBS, its stuffed payload) whatever the protocol; it is
+        // changed without making it 0.
+        uint8_t & damaged = wire_[frame_ends[2] - 2];
+        damaged = (damaged == 0x40) ? 0x20 : damaged ^ 0x40;
+        written.erase(written.begin() + 2);
+
+        // A false marker with a length that can't fit, and then a 0 so that
+        // COBS finds its way back too.
+        std::vector<uint8_t> data{'>', '>', '>', 0x7, 0x3, 0x9, 0x0};
+        data.insert(data.end(), wire_.begin(), wire_.end());
+
+        // What the first pass counted, and the totals so far.
+        uint64_t pass_garbage = 0;
+        uint64_t pass_crc_failures = 0;
+        uint64_t garbage = 0;
+        uint64_t crc_failures = 0;
+        for (size_t chunk : {128, 1, 5})
+        {
+            SCOPED_TRACE("chunk " + std::to_string(chunk));
+            std::vector<std::vector<uint8_t>> messages;
+            auto visitor = [&messages](topic_id_size_t topic_ID, uint8_t *buffer, size_t length)
+            {
+                messages.emplace_back(buffer, buffer + length);
+                messages.back().push_back(static_cast<uint8_t>(topic_ID));
+            };
+            std::vector<uint8_t> buf(256);
+            for (size_t pos = 0; pos < data.size(); pos += chunk)
+            {
+                size_t n = std::min(chunk, data.size() - pos);
+                ASSERT_EQ(add_to_memfd(&data[pos], n), static_cast<int>(n));
+                // A read stops at the end of the ring, and add_to_memfd()
+                // overwrites what wasn't read, so read until it all was.
+                ssize_t ret;
+                do
+                {
+                    ret = read_many(&buf[0], buf.size(), visitor);
+                } while (ret > 0 || (ret == 0 && memfd_unread() > 0));
+                ASSERT_EQ(ret, 0);
+            }
+            ASSERT_EQ(messages.size(), written.size());
+            ASSERT_EQ(messages, written);
+            ASSERT_EQ(ringbuf_.bytes_used(), 0U);
+
+            ros2_to_serial_bridge::transport::Metrics::Snapshot snapshot;
+            get_metrics().snapshot(&snapshot);
+            uint64_t crc_total = 0;
+            for (const auto & counters : snapshot.rx)
+            {
+                crc_total += counters.crc_failures;
+            }
+            if (chunk == 128)
+            {
+                pass_garbage = snapshot.garbage_bytes;
+                pass_crc_failures = crc_total;
+                ASSERT_GT(pass_garbage, 0U);
+                ASSERT_EQ(pass_crc_failures, 1U);
+            }
+            else
+            {
+                ASSERT_EQ(snapshot.garbage_bytes - garbage, pass_garbage);
+                ASSERT_EQ(crc_total - crc_failures, pass_crc_failures);
+            }
+            garbage = snapshot.garbage_bytes;
+            crc_failures = crc_total;
+        }
+    }
+
 protected:
     // This variable is used to hang on to data written by tests so it can be
     // examined.
     std::unique_ptr<uint8_t[]> written_data_;
+    size_t written_len_{0};
+    size_t write_count_{0};
+    // Everything written, if keep_wire_ is set.
+    bool keep_wire_{false};
+    std::vector<uint8_t> wire_;
 
     // This file descriptor connects to a memory fd which tests can fill with
     // data of their choosing.  That data will be returned when a test
@@ -159,20 +347,36 @@ public:
     }
 };
 
+// This fixture allows us access to the protected methods of Transporter
+class COBSZPETransporterFixture : public TransporterFixture
+{
+public:
+    COBSZPETransporterFixture() : TransporterFixture("cobs_zpe")
+    {
+    }
+};
+
+// This fixture allows us access to the protected methods of Transporter
+class V2TransporterFixture : public TransporterFixture
+{
+public:
+    V2TransporterFixture() : TransporterFixture("v2")
+    {
+    }
+};
+
 std::vector<uint8_t> setup_px4_test_data()
 {
-    // The amount of data we need is 3 bytes for the marker, plus the size of
+    // The amount of data we need is 3 bytes for the marker, plus 1 byte for
     // the topic id, plus 5 bytes for the sequence, payload, and CRC, plus 4
     // bytes for the payload.
-    std::vector<uint8_t> test_data(3 + sizeof(topic_id_size_t) + 5 + 4);
+    std::vector<uint8_t> test_data(3 + 1 + 5 + 4);
 
-    topic_id_size_t topic_ID = 0xa;
     size_t i = 0;
     test_data[i++] = '>';  // marker 1
     test_data[i++] = '>';  // marker 2
     test_data[i++] = '>';  // marker 3
-    ::memcpy(&test_data[i], &topic_ID, sizeof(topic_id_size_t));  // topic id
-    i += sizeof(topic_id_size_t);
+    test_data[i++] = 0x0a;  // topic id
     test_data[i++] = 0x00;  // sequence number
     test_data[i++] = 0x00;  // payload length high
     test_data[i++] = 0x04;  // payload length low
@@ -188,26 +392,35 @@ std::vector<uint8_t> setup_px4_test_data()
 
 std::vector<uint8_t> setup_cobs_test_data()
 {
-    // // The amount of data we need is 4 bytes for the header, plus the size of
-    // // the topic id, plus one byte for the final 0, plus 4 bytes for the payload.
-    // std::vector<uint8_t> test_data(4 + sizeof(topic_id_size_t) + 1 + 4);
-    // topic_id_size_t topic_ID = 0xa;
-    // size_t i = 0;
+    // The COBS header carries a single byte of topic ID, whatever the size
+    // of topic_id_size_t.
+    return std::vector<uint8_t>{
+        0x2, 0xa, 0x8, 0x4, 0x6d, 0x10, 0x5, 0x1, 0x2, 0x3, 0x0,
+    };
+}
 
-    if (sizeof(topic_id_size_t) == 1)
-    {
-        return std::vector<uint8_t>{
-            0x2, 0xa, 0x8, 0x4, 0x6d, 0x10, 0x5, 0x1, 0x2, 0x3, 0x0,
-        };
-    }
-    else if (sizeof(topic_id_size_t) == 2)
-    {
-        return std::vector<uint8_t>{
-            0x2, 0xa, 0x1, 0x8, 0x4, 0x6d, 0x10, 0x5, 0x1, 0x2, 0x3, 0x0,
-        };
-    }
+std::vector<uint8_t> setup_v2_test_data()
+{
+    return std::vector<uint8_t>{
+        '>', '>', 0x02,  // markers and version
+        0x00,  // flags
+        0x00,  // sequence number
+        0x0a,  // topic id
+        0x00, 0x00, 0x00, 0x04,  // payload length
+        0x6d, 0x10,  // crc
+        0x05, 0x01, 0x02, 0x03,  // payload
+    };
+}
 
-    throw std::runtime_error("Invalid topic ID size");
+// A ros2_serial_msgs/FlowCredits in CDR.
+std::vector<uint8_t> setup_flow_credits(uint32_t received, uint32_t window)
+{
+    std::vector<uint8_t> msg(12, 0);
+    msg[0] = ros2_to_serial_bridge::transport::Transporter::FLOW_CREDITS_KIND;
+    ::memcpy(&msg[4], &received, sizeof(received));
+    ::memcpy(&msg[8], &window, sizeof(window));
+
+    return msg;
 }
 
 TEST(TransporterPassThrough, px4_protocol)
@@ -252,7 +465,7 @@ TEST(TransporterPassThrough, invalid_protocol)
 
 TEST_F(PX4TransporterFixture, get_header_length)
 {
-    ASSERT_EQ(get_header_length(), sizeof(topic_id_size_t) + 8U);
+    ASSERT_EQ(get_header_length(), 9U);
 }
 
 TEST_F(PX4TransporterFixture, crc16_byte)
@@ -276,6 +489,24 @@ TEST_F(PX4TransporterFixture, write_fds_not_ok)
     ASSERT_EQ(write(0, buf.get(), 4), -1);
 }
 
+TEST_F(PX4TransporterFixture, write_standby)
+{
+    std::unique_ptr<uint8_t[]> buf = std::unique_ptr<uint8_t[]>(new uint8_t[4]{});
+
+    // In standby, writes succeed without the transport being touched.
+    test_fds_ok_ = false;
+    set_standby(true);
+    ASSERT_TRUE(get_standby());
+    ASSERT_EQ(write(0xa, buf.get(), 4), 4);
+    ASSERT_EQ(written_len_, 0U);
+    ASSERT_EQ(write(0xa, nullptr, 4), -1);
+
+    test_fds_ok_ = true;
+    set_standby(false);
+    ASSERT_EQ(write(0xa, buf.get(), 4), 4);
+    ASSERT_GT(written_len_, 4U);
+}
+
 TEST_F(PX4TransporterFixture, write_nullptr)
 {
     ASSERT_EQ(write(0, nullptr, 0), 0);
@@ -368,7 +599,7 @@ TEST_F(PX4TransporterFixture, read_message_already_available)
 
 TEST_F(COBSTransporterFixture, get_header_length)
 {
-    ASSERT_EQ(get_header_length(), sizeof(topic_id_size_t) + 4U);
+    ASSERT_EQ(get_header_length(), 5U);
 }
 
 TEST_F(COBSTransporterFixture, write)
@@ -391,48 +622,23 @@ TEST_F(COBSTransporterFixture, write)
 
 std::vector<uint8_t> setup_cobs_long_data()
 {
-    if (sizeof(topic_id_size_t) == 1)
-    {
-        std::vector<uint8_t> test_data{
-            0xff, 0xa, 0x1, 0x2c, 0xb6, 0x4a
-        };
+    std::vector<uint8_t> test_data{
+        0xff, 0xa, 0x1, 0x2c, 0xb6, 0x4a
+    };
 
-        size_t header_size = test_data.size();
+    size_t header_size = test_data.size();
 
-        test_data.resize(header_size + 300 + 1 + 1);
-        test_data[test_data.size() - 1] = 0x0;
+    test_data.resize(header_size + 300 + 1 + 1);
+    test_data[test_data.size() - 1] = 0x0;
 
-        for (size_t i = header_size; i < test_data.size() - 1; ++i)
-        {
-            test_data[i] = 0x1;
-        }
-
-        test_data[255] = 0x34;
-
-        return test_data;
-    }
-    else if (sizeof(topic_id_size_t) == 2)
+    for (size_t i = header_size; i < test_data.size() - 1; ++i)
     {
-        std::vector<uint8_t> test_data{
-            0x2, 0xa, 0xff, 0x1, 0x2c, 0xb6, 0x4a
-        };
-
-        size_t header_size = test_data.size();
-
-        test_data.resize(header_size + 300 + 1 + 1);
-        test_data[test_data.size() - 1] = 0x0;
-
-        for (size_t i = header_size; i < test_data.size() - 1; ++i)
-        {
-            test_data[i] = 0x1;
-        }
-
-        test_data[257] = 0x33;
-
-        return test_data;
+        test_data[i] = 0x1;
     }
 
-    throw std::runtime_error("Unsupported topic_id_size_t size");
+    test_data[255] = 0x34;
+
+    return test_data;
 }
 
 TEST_F(COBSTransporterFixture, write_long_sequence)
@@ -486,3 +692,1954 @@ TEST_F(COBSTransporterFixture, read_message_already_available)
     ASSERT_EQ(buf.get()[2], 0x02);
     ASSERT_EQ(buf.get()[3], 0x03);
 }
+
+TEST_F(PX4TransporterFixture, read_message_leading_garbage)
+{
+    std::unique_ptr<uint8_t[]> buf = std::unique_ptr<uint8_t[]>(new uint8_t[4]{});
+
+    std::vector<uint8_t> read_data{0x1, 0x2, '>', 0x3};
+    std::vector<uint8_t> msg_data = setup_px4_test_data();
+    read_data.insert(read_data.end(), msg_data.begin(), msg_data.end());
+
+    add_to_memfd(&read_data[0], read_data.size());
+
+    topic_id_size_t topic_id;
+    ASSERT_EQ(read(&topic_id, buf.get(), 4), 4);
+    ASSERT_EQ(topic_id, 0xa);
+    ASSERT_EQ(buf.get()[0], 0x05);
+    ASSERT_EQ(buf.get()[1], 0x01);
+    ASSERT_EQ(buf.get()[2], 0x02);
+    ASSERT_EQ(buf.get()[3], 0x03);
+    ASSERT_EQ(ringbuf_.bytes_used(), 0U);
+}
+
+TEST_F(COBSTransporterFixture, read_message_wrap)
+{
+    std::unique_ptr<uint8_t[]> buf = std::unique_ptr<uint8_t[]>(new uint8_t[4]{});
+
+    // Fill most of the ring with a run of non-zero garbage plus a delimiter,
+    // so that the real message wraps around the end of the ring.
+    std::vector<uint8_t> read_data(235, 0x1);
+    read_data.push_back(0x0);
+    std::vector<uint8_t> msg_data = setup_cobs_test_data();
+    read_data.insert(read_data.end(), msg_data.begin(), msg_data.end());
+
+    add_to_memfd(&read_data[0], read_data.size());
+    ASSERT_EQ(node_read(), 240);
+
+    topic_id_size_t topic_id;
+    ASSERT_LT(find_and_copy_message(&topic_id, buf.get(), 4), 0);
+    ASSERT_EQ(node_read(), static_cast<ssize_t>(read_data.size() - 240));
+
+    ASSERT_EQ(find_and_copy_message(&topic_id, buf.get(), 4), 4);
+    ASSERT_EQ(topic_id, 0xa);
+    ASSERT_EQ(buf.get()[0], 0x05);
+    ASSERT_EQ(buf.get()[1], 0x01);
+    ASSERT_EQ(buf.get()[2], 0x02);
+    ASSERT_EQ(buf.get()[3], 0x03);
+    ASSERT_EQ(ringbuf_.bytes_used(), 0U);
+}
+
+TEST_F(COBSTransporterFixture, read_message_too_large)
+{
+    std::unique_ptr<uint8_t[]> buf = std::unique_ptr<uint8_t[]>(new uint8_t[3]{});
+
+    std::vector<uint8_t> read_data = setup_cobs_test_data();
+    add_to_memfd(&read_data[0], read_data.size());
+    ASSERT_EQ(node_read(), static_cast<ssize_t>(read_data.size()));
+
+    topic_id_size_t topic_id;
+    ASSERT_EQ(find_and_copy_message(&topic_id, buf.get(), 3), -EMSGSIZE);
+    ASSERT_EQ(ringbuf_.bytes_used(), 0U);
+}
+
+TEST_F(COBSTransporterFixture, read_message_short)
+{
+    std::unique_ptr<uint8_t[]> buf = std::unique_ptr<uint8_t[]>(new uint8_t[4]{});
+
+    // Less than a header is waited on, not an error.
+    std::vector<uint8_t> read_data{0x03};
+    add_to_memfd(&read_data[0], read_data.size());
+    ASSERT_EQ(node_read(), 1);
+
+    topic_id_size_t topic_id;
+    ASSERT_EQ(find_and_copy_message(&topic_id, buf.get(), 4), -ENODATA);
+    ASSERT_EQ(ringbuf_.bytes_used(), 1U);
+}
+
+TEST_F(PX4TransporterFixture, read_message_false_marker_too_large)
+{
+    std::unique_ptr<uint8_t[]> buf = std::unique_ptr<uint8_t[]>(new uint8_t[4]{});
+
+    // A marker in the garbage whose length couldn't fit the buffer is
+    // skipped straight away, rather than holding up the message behind it.
+    std::vector<uint8_t> read_data{'>', '>', '>', 0x0b, 0x00, 0xff, 0xff, 0x00, 0x00};
+    std::vector<uint8_t> msg_data = setup_px4_test_data();
+    read_data.insert(read_data.end(), msg_data.begin(), msg_data.end());
+    add_to_memfd(&read_data[0], read_data.size());
+
+    std::vector<std::vector<uint8_t>> messages;
+    auto visitor = [&messages](topic_id_size_t topic_ID, uint8_t *buffer, size_t length)
+    {
+        ASSERT_EQ(topic_ID, 0xa);
+        messages.emplace_back(buffer, buffer + length);
+    };
+    ASSERT_EQ(read_many(buf.get(), 4, visitor), 1);
+    ASSERT_EQ(messages.size(), 1U);
+    ASSERT_EQ(messages[0], std::vector<uint8_t>({0x05, 0x01, 0x02, 0x03}));
+    ASSERT_EQ(ringbuf_.bytes_used(), 0U);
+}
+
+TEST_F(PX4TransporterFixture, read_message_false_marker_bad_crc)
+{
+    std::unique_ptr<uint8_t[]> buf = std::unique_ptr<uint8_t[]>(new uint8_t[16]{});
+
+    // A marker whose length covers the whole of the next message fails its
+    // CRC, and the search starts again just past it.
+    std::vector<uint8_t> msg_data = setup_px4_test_data();
+    std::vector<uint8_t> read_data{'>', '>', '>', 0x0a, 0x00, 0x00, static_cast<uint8_t>(msg_data.size()), 0x00, 0x00};
+    read_data.insert(read_data.end(), msg_data.begin(), msg_data.end());
+    add_to_memfd(&read_data[0], read_data.size());
+
+    topic_id_size_t topic_id;
+    ASSERT_EQ(read(&topic_id, buf.get(), 16), -ENODATA);
+    ASSERT_EQ(ringbuf_.bytes_used(), read_data.size() - 1);
+    ASSERT_EQ(read(&topic_id, buf.get(), 16), 4);
+    ASSERT_EQ(topic_id, 0xa);
+    ASSERT_EQ(ringbuf_.bytes_used(), 0U);
+}
+
+TEST_F(PX4TransporterFixture, read_message_max_payload)
+{
+    std::unique_ptr<uint8_t[]> buf = std::unique_ptr<uint8_t[]>(new uint8_t[256]{});
+
+    std::vector<uint8_t> read_data{'>', '>', '>', 0x0a, 0x00, 0x00, 200, 0x00, 0x00};
+    std::vector<uint8_t> msg_data = setup_px4_test_data();
+    read_data.insert(read_data.end(), msg_data.begin(), msg_data.end());
+    add_to_memfd(&read_data[0], read_data.size());
+
+    size_t nmessages = 0;
+    auto visitor = [&nmessages](topic_id_size_t, uint8_t *, size_t) { nmessages++; };
+
+    // Without a limit, the marker could be for a 200 byte message that
+    // hasn't all arrived yet.
+    ASSERT_EQ(read_many(buf.get(), 256, visitor), 0);
+    ASSERT_EQ(ringbuf_.bytes_used(), read_data.size());
+
+    // The topic never carries more than 4 bytes, so it can't be.
+    set_rx_max_payloads({{0xa, 4}});
+    ASSERT_EQ(read_many(buf.get(), 256, visitor), 1);
+    ASSERT_EQ(nmessages, 1U);
+    ASSERT_EQ(ringbuf_.bytes_used(), 0U);
+    ros2_to_serial_bridge::transport::Metrics::Snapshot snapshot;
+    get_metrics().snapshot(&snapshot);
+    ASSERT_EQ(snapshot.garbage_bytes, read_data.size() - msg_data.size());
+}
+
+TEST_F(COBSTransporterFixture, read_message_lost_delimiter)
+{
+    std::unique_ptr<uint8_t[]> buf = std::unique_ptr<uint8_t[]>(new uint8_t[16]{});
+
+    // The 0 at the end of the first message is corrupted, running it into
+    // the second; both are still found.
+    std::vector<uint8_t> msg_data = setup_cobs_test_data();
+    std::vector<uint8_t> read_data = msg_data;
+    read_data.back() = 0x1;
+    read_data.insert(read_data.end(), msg_data.begin(), msg_data.end());
+    add_to_memfd(&read_data[0], read_data.size());
+
+    size_t nmessages = 0;
+    auto visitor = [&nmessages](topic_id_size_t topic_ID, uint8_t *buffer, size_t length)
+    {
+        ASSERT_EQ(topic_ID, 0xa);
+        ASSERT_EQ(std::vector<uint8_t>(buffer, buffer + length), std::vector<uint8_t>({0x05, 0x01, 0x02, 0x03}));
+        nmessages++;
+    };
+    ASSERT_EQ(read_many(buf.get(), 16, visitor), 2);
+    ASSERT_EQ(nmessages, 2U);
+    ASSERT_EQ(ringbuf_.bytes_used(), 0U);
+}
+
+TEST_F(PX4TransporterFixture, split_reads)
+{
+    split_reads();
+}
+
+TEST_F(COBSTransporterFixture, split_reads)
+{
+    split_reads();
+}
+
+TEST_F(COBSZPETransporterFixture, split_reads)
+{
+    split_reads();
+}
+
+TEST_F(V2TransporterFixture, split_reads)
+{
+    split_reads();
+}
+
+TEST_F(PX4TransporterFixture, writev)
+{
+    uint8_t buf1[]{0x5, 0x1};
+    uint8_t buf2[]{0x2, 0x3};
+    struct iovec iov[2]{{buf1, sizeof(buf1)}, {buf2, sizeof(buf2)}};
+
+    ASSERT_EQ(writev(0xa, iov, 2), 4);
+
+    std::vector<uint8_t> expected = setup_px4_test_data();
+
+    for (size_t i = 0; i < expected.size(); ++i)
+    {
+        ASSERT_EQ(written_data_.get()[i], expected[i]);
+    }
+}
+
+TEST_F(PX4TransporterFixture, writev_nullptr_with_length)
+{
+    struct iovec iov[1]{{nullptr, 4}};
+
+    ASSERT_EQ(writev(0xa, iov, 1), -1);
+}
+
+TEST_F(PX4TransporterFixture, write_too_large)
+{
+    std::unique_ptr<uint8_t[]> buf = std::unique_ptr<uint8_t[]>(new uint8_t[65536]{});
+
+    ASSERT_EQ(write(0xa, buf.get(), 65536), -1);
+    ASSERT_EQ(errno, EMSGSIZE);
+}
+
+TEST_F(COBSTransporterFixture, writev)
+{
+    uint8_t buf1[]{0x5};
+    uint8_t buf2[]{0x1, 0x2, 0x3};
+    struct iovec iov[2]{{buf1, sizeof(buf1)}, {buf2, sizeof(buf2)}};
+
+    ASSERT_EQ(writev(0xa, iov, 2), 4);
+
+    std::vector<uint8_t> expected = setup_cobs_test_data();
+
+    for (size_t i = 0; i < expected.size(); ++i)
+    {
+        ASSERT_EQ(written_data_.get()[i], expected[i]);
+    }
+}
+
+TEST_F(PX4TransporterFixture, read_many_invalid)
+{
+    std::unique_ptr<uint8_t[]> buf = std::unique_ptr<uint8_t[]>(new uint8_t[4]{});
+    auto visitor = [](topic_id_size_t, uint8_t *, size_t) {};
+
+    ASSERT_EQ(read_many(nullptr, 4, visitor), -1);
+    ASSERT_EQ(read_many(buf.get(), 4, nullptr), -1);
+
+    test_fds_ok_ = false;
+    ASSERT_EQ(read_many(buf.get(), 4, visitor), -1);
+}
+
+TEST_F(PX4TransporterFixture, read_many)
+{
+    std::unique_ptr<uint8_t[]> buf = std::unique_ptr<uint8_t[]>(new uint8_t[4]{});
+
+    // Three messages with a bad one in the middle, all in one read.
+    std::vector<uint8_t> msg_data = setup_px4_test_data();
+    std::vector<uint8_t> bad_data = msg_data;
+    bad_data[bad_data.size() - 1] ^= 0xff;
+    std::vector<uint8_t> read_data = msg_data;
+    read_data.insert(read_data.end(), bad_data.begin(), bad_data.end());
+    read_data.insert(read_data.end(), msg_data.begin(), msg_data.end());
+    add_to_memfd(&read_data[0], read_data.size());
+
+    std::vector<std::vector<uint8_t>> messages;
+    auto visitor = [&messages](topic_id_size_t topic_ID, uint8_t *buffer, size_t length)
+    {
+        ASSERT_EQ(topic_ID, 0xa);
+        messages.emplace_back(buffer, buffer + length);
+    };
+
+    ASSERT_EQ(read_many(buf.get(), 4, visitor), 2);
+    ASSERT_EQ(messages.size(), 2U);
+    for (const std::vector<uint8_t> & msg : messages)
+    {
+        ASSERT_EQ(msg, std::vector<uint8_t>({0x05, 0x01, 0x02, 0x03}));
+    }
+    ASSERT_EQ(ringbuf_.bytes_used(), 0U);
+
+    // Nothing left in the ring or the transport.
+    ASSERT_EQ(read_many(buf.get(), 4, visitor), 0);
+    ASSERT_EQ(messages.size(), 2U);
+}
+
+TEST_F(PX4TransporterFixture, read_many_in_place)
+{
+    std::unique_ptr<uint8_t[]> buf = std::unique_ptr<uint8_t[]>(new uint8_t[4]{});
+    std::vector<uint8_t> msg_data = setup_px4_test_data();
+
+    ASSERT_EQ(set_ring_buffer_mirrored(), 0);
+
+    // The ring is the 240 bytes rounded up to one page; put the frame across
+    // the end of it.
+    size_t ring_size = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+    size_t filler_len = ring_size - msg_data.size() + 2;
+    std::vector<uint8_t> filler(filler_len, 0);
+    ASSERT_EQ(ringbuf_.write(&filler[0], filler.size()), static_cast<ssize_t>(filler.size()));
+    ASSERT_EQ(ringbuf_.discard(filler.size()), static_cast<ssize_t>(filler.size()));
+    add_to_memfd(&msg_data[0], msg_data.size());
+
+    std::vector<std::vector<uint8_t>> messages;
+    auto visitor = [&messages, &buf](topic_id_size_t topic_ID, uint8_t *buffer, size_t length)
+    {
+        ASSERT_EQ(topic_ID, 0xa);
+        // The payload is handed over straight out of the ring.
+        ASSERT_NE(buffer, buf.get());
+        messages.emplace_back(buffer, buffer + length);
+    };
+
+    ASSERT_EQ(read_many(buf.get(), 4, visitor), 1);
+    ASSERT_EQ(messages.size(), 1U);
+    ASSERT_EQ(messages[0], std::vector<uint8_t>({0x05, 0x01, 0x02, 0x03}));
+    ASSERT_EQ(ringbuf_.bytes_used(), 0U);
+}
+
+TEST_F(PX4TransporterFixture, read_adaptive_ring)
+{
+    ASSERT_EQ(set_ring_buffer_max_size(240), -1);
+    ASSERT_EQ(set_ring_buffer_max_size(4096), 0);
+
+    // A frame too long for the ring as it started out, which grows to take
+    // it in.
+    std::vector<uint8_t> payload(1000);
+    for (size_t i = 0; i < payload.size(); ++i)
+    {
+        payload[i] = static_cast<uint8_t>(i);
+    }
+    ASSERT_EQ(write(0xa, &payload[0], payload.size()), static_cast<ssize_t>(payload.size()));
+    std::vector<uint8_t> frame(written_data_.get(), written_data_.get() + written_len_);
+    add_to_memfd(&frame[0], frame.size());
+
+    topic_id_size_t topic_ID;
+    std::vector<uint8_t> buf(payload.size());
+    ssize_t len = -ENODATA;
+    for (int i = 0; i < 20 && len == -ENODATA; ++i)
+    {
+        len = read(&topic_ID, &buf[0], buf.size());
+    }
+    ASSERT_EQ(len, static_cast<ssize_t>(payload.size()));
+    ASSERT_EQ(topic_ID, 0xa);
+    ASSERT_EQ(buf, payload);
+
+    ros2_to_serial_bridge::transport::Metrics::Snapshot snapshot;
+    get_metrics().snapshot(&snapshot);
+    ASSERT_EQ(snapshot.ring_overflow_bytes, 0U);
+    ASSERT_EQ(snapshot.ring_buffer_capacity, 1920U);
+    ASSERT_EQ(snapshot.ring_buffer_high_water, frame.size());
+}
+
+TEST_F(COBSTransporterFixture, read_many)
+{
+    std::unique_ptr<uint8_t[]> buf = std::unique_ptr<uint8_t[]>(new uint8_t[4]{});
+
+    // Three messages with a bad one in the middle and a partial one at the
+    // end, all in one read.
+    std::vector<uint8_t> msg_data = setup_cobs_test_data();
+    std::vector<uint8_t> bad_data = msg_data;
+    bad_data[bad_data.size() - 2] ^= 0xff;
+    std::vector<uint8_t> read_data = msg_data;
+    read_data.insert(read_data.end(), bad_data.begin(), bad_data.end());
+    read_data.insert(read_data.end(), msg_data.begin(), msg_data.end());
+    read_data.insert(read_data.end(), msg_data.begin(), msg_data.end() - 1);
+    add_to_memfd(&read_data[0], read_data.size());
+
+    size_t nmessages = 0;
+    auto visitor = [&nmessages](topic_id_size_t topic_ID, uint8_t *buffer, size_t length)
+    {
+        ASSERT_EQ(topic_ID, 0xa);
+        ASSERT_EQ(std::vector<uint8_t>(buffer, buffer + length), std::vector<uint8_t>({0x05, 0x01, 0x02, 0x03}));
+        nmessages++;
+    };
+
+    ASSERT_EQ(read_many(buf.get(), 4, visitor), 2);
+    ASSERT_EQ(nmessages, 2U);
+    ASSERT_EQ(ringbuf_.bytes_used(), msg_data.size() - 1);
+
+    // Finish off the partial message.
+    uint8_t end[]{0x0};
+    add_to_memfd(end, sizeof(end));
+    ASSERT_EQ(read_many(buf.get(), 4, visitor), 1);
+    ASSERT_EQ(nmessages, 3U);
+    ASSERT_EQ(ringbuf_.bytes_used(), 0U);
+}
+
+TEST_F(PX4TransporterFixture, write_batching)
+{
+    uint8_t buf[]{0x5, 0x1, 0x2, 0x3};
+    std::vector<uint8_t> frame = setup_px4_test_data();
+
+    // Room for two frames, but not three.
+    ASSERT_EQ(set_write_batching(frame.size() * 2 + 1), 0);
+
+    ASSERT_EQ(write(0xa, buf, sizeof(buf)), 4);
+    ASSERT_EQ(write(0xa, buf, sizeof(buf)), 4);
+    ASSERT_EQ(write_count_, 0U);
+    ASSERT_EQ(get_pending_write_bytes(), frame.size() * 2);
+
+    // The third frame doesn't fit, so the first two go out together.
+    ASSERT_EQ(write(0xa, buf, sizeof(buf)), 4);
+    ASSERT_EQ(write_count_, 1U);
+    ASSERT_EQ(written_len_, frame.size() * 2);
+    for (size_t i = 0; i < frame.size(); ++i)
+    {
+        // Only the sequence number differs between the two frames.
+        ASSERT_EQ(written_data_.get()[i], frame[i]) << i;
+        if (i != 4)
+        {
+            ASSERT_EQ(written_data_.get()[frame.size() + i], frame[i]) << i;
+        }
+    }
+    ASSERT_EQ(written_data_.get()[frame.size() + 4], 0x01);
+    ASSERT_EQ(get_pending_write_bytes(), frame.size());
+
+    ASSERT_EQ(flush(), static_cast<ssize_t>(frame.size()));
+    ASSERT_EQ(write_count_, 2U);
+    ASSERT_EQ(get_pending_write_bytes(), 0U);
+    ASSERT_EQ(flush(), 0);
+    ASSERT_EQ(write_count_, 2U);
+}
+
+TEST_F(PX4TransporterFixture, write_batching_large_frame)
+{
+    uint8_t buf[]{0x5, 0x1, 0x2, 0x3};
+    std::vector<uint8_t> frame = setup_px4_test_data();
+    std::vector<uint8_t> large(64, 0x1);
+
+    ASSERT_EQ(set_write_batching(32), 0);
+
+    ASSERT_EQ(write(0xa, buf, sizeof(buf)), 4);
+    ASSERT_EQ(write_count_, 0U);
+
+    // A frame that is larger than the batch flushes what is pending and
+    // then goes out on its own.
+    ASSERT_EQ(write(0xa, &large[0], large.size()), static_cast<ssize_t>(large.size()));
+    ASSERT_EQ(write_count_, 2U);
+    ASSERT_EQ(written_len_, large.size() + frame.size() - sizeof(buf));
+    ASSERT_EQ(get_pending_write_bytes(), 0U);
+}
+
+TEST_F(PX4TransporterFixture, write_batching_disable)
+{
+    uint8_t buf[]{0x5, 0x1, 0x2, 0x3};
+    std::vector<uint8_t> frame = setup_px4_test_data();
+
+    ASSERT_EQ(set_write_batching(1024), 0);
+    ASSERT_EQ(write(0xa, buf, sizeof(buf)), 4);
+    ASSERT_EQ(write_count_, 0U);
+
+    // Turning batching off flushes what is pending.
+    ASSERT_EQ(set_write_batching(0), 0);
+    ASSERT_EQ(write_count_, 1U);
+    ASSERT_EQ(written_len_, frame.size());
+
+    ASSERT_EQ(write(0xa, buf, sizeof(buf)), 4);
+    ASSERT_EQ(write_count_, 2U);
+}
+
+TEST_F(COBSTransporterFixture, write_batching)
+{
+    uint8_t buf[]{0x5, 0x1, 0x2, 0x3};
+    std::vector<uint8_t> frame = setup_cobs_test_data();
+
+    ASSERT_EQ(set_write_batching(1024), 0);
+
+    ASSERT_EQ(write(0xa, buf, sizeof(buf)), 4);
+    ASSERT_EQ(write(0xa, buf, sizeof(buf)), 4);
+    ASSERT_EQ(write_count_, 0U);
+
+    ASSERT_EQ(flush(), static_cast<ssize_t>(frame.size() * 2));
+    ASSERT_EQ(write_count_, 1U);
+    for (size_t i = 0; i < frame.size() * 2; ++i)
+    {
+        ASSERT_EQ(written_data_.get()[i], frame[i % frame.size()]) << i;
+    }
+}
+
+TEST_F(COBSTransporterFixture, concurrent_writes)
+{
+    concurrent_writes();
+}
+
+TEST_F(COBSTransporterFixture, concurrent_writes_batching)
+{
+    ASSERT_EQ(set_write_batching(1024), 0);
+    concurrent_writes();
+}
+
+TEST_F(PX4TransporterFixture, copy_message_from_frame)
+{
+    uint8_t buf[4]{};
+    topic_id_size_t topic_ID = 0;
+    std::vector<uint8_t> frame = setup_px4_test_data();
+
+    ASSERT_EQ(copy_message_from_frame(&frame[0], frame.size(), &topic_ID, buf, sizeof(buf)), 4);
+    ASSERT_EQ(topic_ID, 0xa);
+    ASSERT_EQ(std::vector<uint8_t>(buf, buf + sizeof(buf)), std::vector<uint8_t>({0x05, 0x01, 0x02, 0x03}));
+
+    // Too small a buffer, a truncated frame, trailing garbage, and a bad CRC.
+    ASSERT_EQ(copy_message_from_frame(&frame[0], frame.size(), &topic_ID, buf, 3), -EMSGSIZE);
+    ASSERT_EQ(copy_message_from_frame(&frame[0], frame.size() - 1, &topic_ID, buf, sizeof(buf)), -EBADMSG);
+    std::vector<uint8_t> long_frame = frame;
+    long_frame.push_back(0x0);
+    ASSERT_EQ(copy_message_from_frame(&long_frame[0], long_frame.size(), &topic_ID, buf, sizeof(buf)), -EBADMSG);
+    frame[frame.size() - 1] ^= 0xff;
+    ASSERT_EQ(copy_message_from_frame(&frame[0], frame.size(), &topic_ID, buf, sizeof(buf)), -EBADMSG);
+}
+
+TEST_F(COBSTransporterFixture, copy_message_from_frame)
+{
+    uint8_t buf[4]{};
+    topic_id_size_t topic_ID = 0;
+    std::vector<uint8_t> frame = setup_cobs_test_data();
+
+    ASSERT_EQ(copy_message_from_frame(&frame[0], frame.size(), &topic_ID, buf, sizeof(buf)), 4);
+    ASSERT_EQ(topic_ID, 0xa);
+    ASSERT_EQ(std::vector<uint8_t>(buf, buf + sizeof(buf)), std::vector<uint8_t>({0x05, 0x01, 0x02, 0x03}));
+
+    // Too small a buffer, a missing end-of-packet, and two frames at once.
+    ASSERT_EQ(copy_message_from_frame(&frame[0], frame.size(), &topic_ID, buf, 3), -EMSGSIZE);
+    ASSERT_EQ(copy_message_from_frame(&frame[0], frame.size() - 1, &topic_ID, buf, sizeof(buf)), -EBADMSG);
+    std::vector<uint8_t> two_frames = frame;
+    two_frames.insert(two_frames.end(), frame.begin(), frame.end());
+    ASSERT_EQ(copy_message_from_frame(&two_frames[0], two_frames.size(), &topic_ID, buf, sizeof(buf)), -EBADMSG);
+}
+
+TEST_F(COBSZPETransporterFixture, get_header_length)
+{
+    ASSERT_EQ(get_header_length(), 5U);
+    ASSERT_EQ(get_protocol(), "cobs_zpe");
+}
+
+TEST_F(COBSZPETransporterFixture, write)
+{
+    uint8_t buf[]{0x5, 0x1, 0x2, 0x3};
+
+    // With no pair of 0s in the frame, the encoding is the same as COBS.
+    ASSERT_EQ(write(0xa, buf, sizeof(buf)), 4);
+
+    std::vector<uint8_t> expected = setup_cobs_test_data();
+    ASSERT_EQ(written_len_, expected.size());
+    ASSERT_EQ(std::vector<uint8_t>(written_data_.get(), written_data_.get() + written_len_), expected);
+}
+
+TEST_F(COBSZPETransporterFixture, read_message)
+{
+    uint8_t buf[4]{};
+
+    std::vector<uint8_t> read_data = setup_cobs_test_data();
+    add_to_memfd(&read_data[0], read_data.size());
+
+    topic_id_size_t topic_id;
+    ASSERT_EQ(read(&topic_id, buf, sizeof(buf)), 4);
+    ASSERT_EQ(topic_id, 0xa);
+    ASSERT_EQ(std::vector<uint8_t>(buf, buf + sizeof(buf)), std::vector<uint8_t>({0x05, 0x01, 0x02, 0x03}));
+}
+
+TEST_F(COBSZPETransporterFixture, round_trip_zero_pairs)
+{
+    // Payloads padded with 0s, the way CDR pads, including runs of 0s that
+    // end the frame and runs too long to end in a pair.
+    std::vector<std::vector<uint8_t>> payloads{
+        {0x1, 0x0, 0x0, 0x0, 0x2, 0x0, 0x0, 0x0},
+        std::vector<uint8_t>(64, 0x0),
+        {0x7, 0x0, 0x0},
+        {0x7, 0x0},
+        std::vector<uint8_t>(200, 0x3),
+    };
+    payloads[4][40] = 0x0;
+    payloads[4][41] = 0x0;
+    payloads[4][199] = 0x0;
+
+    for (const std::vector<uint8_t> & payload : payloads)
+    {
+        ASSERT_EQ(write(0xa, &payload[0], payload.size()), static_cast<ssize_t>(payload.size()));
+        std::vector<uint8_t> frame(written_data_.get(), written_data_.get() + written_len_);
+        add_to_memfd(&frame[0], frame.size());
+        // A frame that wraps around the end of the ring takes two reads.
+        while (node_read() > 0)
+        {
+        }
+
+        std::vector<uint8_t> buf(payload.size());
+        topic_id_size_t topic_id;
+        ASSERT_EQ(find_and_copy_message(&topic_id, &buf[0], buf.size()), static_cast<ssize_t>(payload.size()));
+        ASSERT_EQ(topic_id, 0xa);
+        ASSERT_EQ(buf, payload);
+        ASSERT_EQ(ringbuf_.bytes_used(), 0U);
+    }
+
+    // The pairs of 0s make the frame shorter than with COBS.
+    ASSERT_EQ(write(0xa, &payloads[1][0], payloads[1].size()), 64);
+    size_t zpe_len = written_len_;
+    ASSERT_EQ(set_protocol("cobs"), 0);
+    ASSERT_EQ(write(0xa, &payloads[1][0], payloads[1].size()), 64);
+    ASSERT_LT(zpe_len, written_len_);
+}
+
+TEST_F(COBSZPETransporterFixture, concurrent_writes)
+{
+    concurrent_writes();
+}
+
+TEST_F(COBSZPETransporterFixture, copy_message_from_frame)
+{
+    uint8_t payload[]{0x5, 0x0, 0x0, 0x3};
+    ASSERT_EQ(write(0xa, payload, sizeof(payload)), 4);
+    std::vector<uint8_t> frame(written_data_.get(), written_data_.get() + written_len_);
+
+    uint8_t buf[4]{};
+    topic_id_size_t topic_ID = 0;
+    ASSERT_EQ(copy_message_from_frame(&frame[0], frame.size(), &topic_ID, buf, sizeof(buf)), 4);
+    ASSERT_EQ(topic_ID, 0xa);
+    ASSERT_EQ(std::vector<uint8_t>(buf, buf + sizeof(buf)), std::vector<uint8_t>({0x05, 0x00, 0x00, 0x03}));
+
+    // Too small a buffer, and a missing end-of-packet.
+    ASSERT_EQ(copy_message_from_frame(&frame[0], frame.size(), &topic_ID, buf, 3), -EMSGSIZE);
+    ASSERT_EQ(copy_message_from_frame(&frame[0], frame.size() - 1, &topic_ID, buf, sizeof(buf)), -EBADMSG);
+}
+
+TEST_F(PX4TransporterFixture, write_batching_datagram_frames)
+{
+    uint8_t buf[]{0x5, 0x1, 0x2, 0x3};
+    std::vector<uint8_t> frame = setup_px4_test_data();
+
+    datagram_frames_ = true;
+    ASSERT_EQ(set_write_batching(1024), 0);
+
+    ASSERT_EQ(write(0xa, buf, sizeof(buf)), 4);
+    ASSERT_EQ(write(0xa, buf, sizeof(buf)), 4);
+    ASSERT_EQ(write_count_, 0U);
+
+    // The batch goes out as one write per frame.
+    ASSERT_EQ(flush(), static_cast<ssize_t>(frame.size() * 2));
+    ASSERT_EQ(write_count_, 2U);
+    ASSERT_EQ(written_len_, frame.size());
+}
+
+TEST_F(PX4TransporterFixture, bundling)
+{
+    uint8_t buf[]{0x5, 0x1, 0x2, 0x3};
+    uint8_t short_buf[]{0x7, 0x8};
+
+    ASSERT_EQ(set_bundling(1, 64), -1);
+    ASSERT_EQ(set_bundling(256, 64), -1);
+    ASSERT_EQ(set_bundling(200, 65536), -1);
+    ASSERT_EQ(set_bundling(200, 64), 0);
+    ASSERT_EQ(get_bundle_topic_ID(), 200);
+
+    ASSERT_EQ(write(0xa, buf, sizeof(buf)), 4);
+    ASSERT_EQ(write(0xb, short_buf, sizeof(short_buf)), 2);
+    ASSERT_EQ(write_count_, 0U);
+    ASSERT_EQ(get_pending_write_bytes(), 2 + sizeof(buf) + 2 + sizeof(short_buf));
+
+    // Both payloads go out in one frame, each with a two byte record header.
+    ASSERT_EQ(flush(), static_cast<ssize_t>(get_header_length() + 10));
+    ASSERT_EQ(write_count_, 1U);
+    ASSERT_EQ(written_data_.get()[3], 200);
+    std::vector<uint8_t> bundle(written_data_.get(), written_data_.get() + written_len_);
+    ASSERT_EQ(std::vector<uint8_t>(bundle.begin() + get_header_length(), bundle.end()),
+              std::vector<uint8_t>({0xa, 0x4, 0x5, 0x1, 0x2, 0x3, 0xb, 0x2, 0x7, 0x8}));
+
+    // The receiver hands out the payloads as if they came on their own.
+    add_to_memfd(&bundle[0], bundle.size());
+    std::vector<std::pair<topic_id_size_t, std::vector<uint8_t>>> messages;
+    std::unique_ptr<uint8_t[]> out = std::unique_ptr<uint8_t[]>(new uint8_t[64]{});
+    ASSERT_EQ(read_many(out.get(), 64, [&messages](topic_id_size_t topic_ID, uint8_t *data, size_t len) {
+        messages.emplace_back(topic_ID, std::vector<uint8_t>(data, data + len));
+    }), 2);
+    ASSERT_EQ(messages.size(), 2U);
+    ASSERT_EQ(messages[0].first, 0xa);
+    ASSERT_EQ(messages[0].second, std::vector<uint8_t>(buf, buf + sizeof(buf)));
+    ASSERT_EQ(messages[1].first, 0xb);
+    ASSERT_EQ(messages[1].second, std::vector<uint8_t>(short_buf, short_buf + sizeof(short_buf)));
+
+    ros2_to_serial_bridge::transport::Metrics::Snapshot snapshot;
+    get_metrics().snapshot(&snapshot);
+    ASSERT_EQ(snapshot.rx.size(), 3U);
+    ASSERT_EQ(snapshot.tx.size(), 3U);
+    for (const auto & counters : snapshot.rx)
+    {
+        ASSERT_EQ(counters.messages, 1U) << counters.topic_ID;
+    }
+
+    // read() hands them out one at a time.
+    add_to_memfd(&bundle[0], bundle.size());
+    topic_id_size_t topic_ID = 0;
+    ASSERT_EQ(read(&topic_ID, out.get(), 64), 4);
+    ASSERT_EQ(topic_ID, 0xa);
+    ASSERT_EQ(read(&topic_ID, out.get(), 1), -1);
+    ASSERT_EQ(read(&topic_ID, out.get(), 64), -ENODATA);
+}
+
+TEST_F(PX4TransporterFixture, bundling_order)
+{
+    uint8_t buf[]{0x5, 0x1, 0x2, 0x3};
+    std::vector<uint8_t> large(64, 0x1);
+
+    ASSERT_EQ(set_bundling(200, 32), 0);
+    ASSERT_EQ(write(0xa, buf, sizeof(buf)), 4);
+
+    // A payload of another topic that doesn't fit goes out on its own...
+    ASSERT_EQ(write(0xb, &large[0], large.size()), static_cast<ssize_t>(large.size()));
+    ASSERT_EQ(write_count_, 1U);
+    ASSERT_EQ(get_pending_write_bytes(), 2 + sizeof(buf));
+
+    // ...but one of the same topic has to wait for the bundle.
+    ASSERT_EQ(write(0xa, &large[0], large.size()), static_cast<ssize_t>(large.size()));
+    ASSERT_EQ(write_count_, 3U);
+    ASSERT_EQ(written_len_, get_header_length() + large.size());
+    ASSERT_EQ(get_pending_write_bytes(), 0U);
+
+    // Disabling bundling sends what is pending.
+    ASSERT_EQ(write(0xa, buf, sizeof(buf)), 4);
+    ASSERT_EQ(set_bundling(0, 0), 0);
+    ASSERT_EQ(write_count_, 4U);
+    ASSERT_EQ(write(0xa, buf, sizeof(buf)), 4);
+    ASSERT_EQ(write_count_, 5U);
+}
+
+TEST_F(PX4TransporterFixture, bundling_fixed_length)
+{
+    uint8_t buf[]{0x5, 0x1, 0x2, 0x3};
+
+    // The length can only be left out of bundles.
+    ASSERT_EQ(set_fixed_length(0xa, sizeof(buf)), -1);
+    ASSERT_EQ(set_bundling(200, 64), 0);
+    ASSERT_EQ(set_fixed_length(200, sizeof(buf)), -1);
+    ASSERT_EQ(set_fixed_length(0xa, 0), -1);
+    ASSERT_EQ(set_fixed_length(0xa, sizeof(buf)), 0);
+
+    ASSERT_EQ(write(0xa, buf, sizeof(buf)), 4);
+    ASSERT_EQ(write(0xb, buf, sizeof(buf)), 4);
+    ASSERT_EQ(write(0xa, buf, sizeof(buf)), 4);
+    ASSERT_EQ(get_pending_write_bytes(), (1 + sizeof(buf)) * 2 + 2 + sizeof(buf));
+    ASSERT_EQ(write_count_, 0U);
+    ASSERT_GT(flush(), 0);
+    std::vector<uint8_t> bundle(written_data_.get(), written_data_.get() + written_len_);
+    ASSERT_EQ(std::vector<uint8_t>(bundle.begin() + get_header_length(), bundle.end()),
+              std::vector<uint8_t>({0xa, 0x5, 0x1, 0x2, 0x3, 0xb, 0x4, 0x5, 0x1, 0x2, 0x3, 0xa, 0x5, 0x1, 0x2, 0x3}));
+
+    // A payload of another length goes in a frame of its own.
+    ASSERT_EQ(write(0xa, buf, 2), 2);
+    ASSERT_EQ(write_count_, 2U);
+    ASSERT_EQ(written_len_, get_header_length() + 2);
+    ASSERT_EQ(get_pending_write_bytes(), 0U);
+
+    add_to_memfd(&bundle[0], bundle.size());
+    std::vector<topic_id_size_t> topic_IDs;
+    uint8_t out[64];
+    ASSERT_EQ(read_many(out, sizeof(out), [&](topic_id_size_t topic_ID, uint8_t *data, size_t len) {
+        ASSERT_EQ(std::vector<uint8_t>(data, data + len), std::vector<uint8_t>(buf, buf + sizeof(buf)));
+        topic_IDs.push_back(topic_ID);
+    }), 3);
+    ASSERT_EQ(topic_IDs, std::vector<topic_id_size_t>({0xa, 0xb, 0xa}));
+}
+
+TEST_F(V2TransporterFixture, bundling_malformed)
+{
+    // A record that runs past the end of the bundle ends it.  The bundle is
+    // written before bundling is enabled, so it goes out as it is.
+    uint8_t bad[]{0xa, 0x1, 0x5, 0xb, 0x4, 0x1};
+    ASSERT_EQ(write(300, bad, sizeof(bad)), static_cast<ssize_t>(sizeof(bad)));
+    std::vector<uint8_t> frame(written_data_.get(), written_data_.get() + written_len_);
+
+    // Only unpacking received bundles.
+    ASSERT_EQ(set_bundling(300, 0), 0);
+    ASSERT_EQ(write(0xa, bad, sizeof(bad)), static_cast<ssize_t>(sizeof(bad)));
+    ASSERT_EQ(get_pending_write_bytes(), 0U);
+    add_to_memfd(&frame[0], frame.size());
+
+    int received = 0;
+    uint8_t out[64];
+    ASSERT_EQ(read_many(out, sizeof(out), [&received](topic_id_size_t topic_ID, uint8_t *data, size_t len) {
+        ASSERT_EQ(topic_ID, 0xa);
+        ASSERT_EQ(len, 1U);
+        ASSERT_EQ(data[0], 0x5);
+        received++;
+    }), 1);
+    ASSERT_EQ(received, 1);
+
+    ros2_to_serial_bridge::transport::Metrics::Snapshot snapshot;
+    get_metrics().snapshot(&snapshot);
+    bool found = false;
+    for (const auto & counters : snapshot.rx)
+    {
+        if (counters.topic_ID == 300)
+        {
+            ASSERT_EQ(counters.decode_failures, 1U);
+            found = true;
+        }
+    }
+    ASSERT_TRUE(found);
+}
+
+TEST_F(PX4TransporterFixture, max_topic_ID)
+{
+    uint8_t buf[]{0x5, 0x1, 0x2, 0x3};
+
+    ASSERT_EQ(get_max_topic_ID(), 255);
+    ASSERT_EQ(write(256, buf, sizeof(buf)), -1);
+    ASSERT_EQ(errno, EINVAL);
+    ASSERT_EQ(set_crc32c(true), -1);
+}
+
+TEST_F(V2TransporterFixture, get_header_length)
+{
+    ASSERT_EQ(get_header_length(), 12U);
+    ASSERT_EQ(get_max_topic_ID(), std::numeric_limits<topic_id_size_t>::max());
+}
+
+TEST_F(V2TransporterFixture, write)
+{
+    uint8_t buf[]{0x5, 0x1, 0x2, 0x3};
+
+    ASSERT_EQ(write(0xa, buf, sizeof(buf)), 4);
+
+    std::vector<uint8_t> expected = setup_v2_test_data();
+    ASSERT_EQ(std::vector<uint8_t>(written_data_.get(), written_data_.get() + written_len_), expected);
+}
+
+TEST_F(V2TransporterFixture, read_message)
+{
+    std::unique_ptr<uint8_t[]> buf = std::unique_ptr<uint8_t[]>(new uint8_t[4]{});
+    topic_id_size_t topic_id;
+    std::vector<uint8_t> msg_data = setup_v2_test_data();
+
+    ASSERT_EQ(add_to_memfd(&msg_data[0], msg_data.size()), static_cast<ssize_t>(msg_data.size()));
+
+    ASSERT_EQ(read(&topic_id, buf.get(), 4), 4);
+    ASSERT_EQ(topic_id, 0xa);
+    ASSERT_EQ(std::vector<uint8_t>(buf.get(), buf.get() + 4), std::vector<uint8_t>({0x05, 0x01, 0x02, 0x03}));
+}
+
+TEST_F(V2TransporterFixture, wide_topic_ID_and_crc32c)
+{
+    uint8_t buf[]{0x5, 0x1, 0x2, 0x3};
+    uint8_t out[4]{};
+    topic_id_size_t topic_id;
+
+    ASSERT_EQ(set_crc32c(true), 0);
+    ASSERT_EQ(write(0x1234, buf, sizeof(buf)), 4);
+
+    // Two bytes of varint topic ID and four of CRC.
+    ASSERT_EQ(written_len_, 5U + 2U + 4U + 4U + sizeof(buf));
+    ASSERT_EQ(written_data_.get()[3], 0x01);
+    ASSERT_EQ(written_data_.get()[5], 0xb4);
+    ASSERT_EQ(written_data_.get()[6], 0x24);
+
+    ASSERT_EQ(add_to_memfd(written_data_.get(), written_len_), static_cast<ssize_t>(written_len_));
+    ASSERT_EQ(read(&topic_id, out, sizeof(out)), 4);
+    ASSERT_EQ(topic_id, 0x1234);
+    ASSERT_EQ(std::vector<uint8_t>(out, out + sizeof(out)), std::vector<uint8_t>(buf, buf + sizeof(buf)));
+}
+
+TEST_F(V2TransporterFixture, read_message_bad_length)
+{
+    std::unique_ptr<uint8_t[]> buf = std::unique_ptr<uint8_t[]>(new uint8_t[4]{});
+    topic_id_size_t topic_id;
+
+    // A header claiming a payload that could never fit in the ring buffer is
+    // skipped, and the good frame behind it is still found.
+    std::vector<uint8_t> msg_data = setup_v2_test_data();
+    msg_data[7] = 0x10;
+    std::vector<uint8_t> good = setup_v2_test_data();
+    msg_data.insert(msg_data.end(), good.begin(), good.end());
+    ASSERT_EQ(add_to_memfd(&msg_data[0], msg_data.size()), static_cast<ssize_t>(msg_data.size()));
+
+    std::vector<std::vector<uint8_t>> messages;
+    auto visitor = [&messages](topic_id_size_t topic_ID, uint8_t *buffer, size_t length)
+    {
+        ASSERT_EQ(topic_ID, 0xa);
+        messages.emplace_back(buffer, buffer + length);
+    };
+
+    ASSERT_EQ(read_many(buf.get(), 4, visitor), 1);
+    ASSERT_EQ(messages.size(), 1U);
+    ASSERT_EQ(messages[0], std::vector<uint8_t>({0x05, 0x01, 0x02, 0x03}));
+    ASSERT_EQ(read(&topic_id, buf.get(), 4), -ENODATA);
+}
+
+TEST_F(V2TransporterFixture, read_message_false_marker_bad_crc)
+{
+    std::unique_ptr<uint8_t[]> buf = std::unique_ptr<uint8_t[]>(new uint8_t[32]{});
+    topic_id_size_t topic_id;
+
+    // A marker whose length covers the whole of the next frame fails its
+    // CRC, and the search starts again just past it rather than past the
+    // frame it claimed.
+    std::vector<uint8_t> good = setup_v2_test_data();
+    std::vector<uint8_t> msg_data = setup_v2_test_data();
+    msg_data[9] = static_cast<uint8_t>(4 + good.size());
+    msg_data.insert(msg_data.end(), good.begin(), good.end());
+    ASSERT_EQ(add_to_memfd(&msg_data[0], msg_data.size()), static_cast<ssize_t>(msg_data.size()));
+
+    std::vector<std::vector<uint8_t>> messages;
+    auto visitor = [&messages](topic_id_size_t topic_ID, uint8_t *buffer, size_t length)
+    {
+        ASSERT_EQ(topic_ID, 0xa);
+        messages.emplace_back(buffer, buffer + length);
+    };
+
+    ASSERT_EQ(read_many(buf.get(), 32, visitor), 1);
+    ASSERT_EQ(messages.size(), 1U);
+    ASSERT_EQ(messages[0], std::vector<uint8_t>({0x05, 0x01, 0x02, 0x03}));
+    ASSERT_EQ(read(&topic_id, buf.get(), 32), -ENODATA);
+}
+
+TEST_F(V2TransporterFixture, read_message_false_marker_oversize)
+{
+    std::unique_ptr<uint8_t[]> buf = std::unique_ptr<uint8_t[]>(new uint8_t[8]{});
+    topic_id_size_t topic_id;
+
+    // A marker whose length covers the whole of the next frame is more than
+    // the buffer holds, and the search starts again just past it rather than
+    // past the frame it claimed.
+    std::vector<uint8_t> good = setup_v2_test_data();
+    std::vector<uint8_t> msg_data = setup_v2_test_data();
+    msg_data[9] = static_cast<uint8_t>(4 + good.size());
+    msg_data.insert(msg_data.end(), good.begin(), good.end());
+    ASSERT_EQ(add_to_memfd(&msg_data[0], msg_data.size()), static_cast<ssize_t>(msg_data.size()));
+
+    std::vector<std::vector<uint8_t>> messages;
+    auto visitor = [&messages](topic_id_size_t topic_ID, uint8_t *buffer, size_t length)
+    {
+        ASSERT_EQ(topic_ID, 0xa);
+        messages.emplace_back(buffer, buffer + length);
+    };
+
+    ASSERT_EQ(read_many(buf.get(), 8, visitor), 1);
+    ASSERT_EQ(messages.size(), 1U);
+    ASSERT_EQ(messages[0], std::vector<uint8_t>({0x05, 0x01, 0x02, 0x03}));
+    ASSERT_EQ(read(&topic_id, buf.get(), 8), -ENODATA);
+}
+
+TEST_F(V2TransporterFixture, large_payload)
+{
+    // Larger than the 16-bit length of the other protocols allows.
+    std::vector<uint8_t> payload(70000);
+    for (size_t i = 0; i < payload.size(); ++i)
+    {
+        payload[i] = static_cast<uint8_t>(i);
+    }
+    std::vector<uint8_t> out(payload.size());
+    topic_id_size_t topic_ID = 0;
+
+    ASSERT_EQ(set_crc32c(true), 0);
+    ASSERT_EQ(write(0x300, &payload[0], payload.size()), static_cast<ssize_t>(payload.size()));
+    ASSERT_EQ(copy_message_from_frame(written_data_.get(), written_len_, &topic_ID, &out[0], out.size()),
+              static_cast<ssize_t>(payload.size()));
+    ASSERT_EQ(topic_ID, 0x300);
+    ASSERT_EQ(out, payload);
+}
+
+TEST_F(V2TransporterFixture, copy_message_from_frame)
+{
+    uint8_t buf[4]{};
+    topic_id_size_t topic_ID = 0;
+    std::vector<uint8_t> frame = setup_v2_test_data();
+
+    ASSERT_EQ(copy_message_from_frame(&frame[0], frame.size(), &topic_ID, buf, sizeof(buf)), 4);
+    ASSERT_EQ(topic_ID, 0xa);
+    ASSERT_EQ(std::vector<uint8_t>(buf, buf + sizeof(buf)), std::vector<uint8_t>({0x05, 0x01, 0x02, 0x03}));
+
+    // Too small a buffer, a truncated frame, an unknown version, unknown
+    // flags, and a bad CRC.
+    ASSERT_EQ(copy_message_from_frame(&frame[0], frame.size(), &topic_ID, buf, 3), -EMSGSIZE);
+    ASSERT_EQ(copy_message_from_frame(&frame[0], frame.size() - 1, &topic_ID, buf, sizeof(buf)), -EBADMSG);
+    std::vector<uint8_t> bad = frame;
+    bad[2] = 0x03;
+    ASSERT_EQ(copy_message_from_frame(&bad[0], bad.size(), &topic_ID, buf, sizeof(buf)), -EBADMSG);
+    bad = frame;
+    bad[3] = 0x80;
+    ASSERT_EQ(copy_message_from_frame(&bad[0], bad.size(), &topic_ID, buf, sizeof(buf)), -EBADMSG);
+    frame[frame.size() - 1] ^= 0xff;
+    ASSERT_EQ(copy_message_from_frame(&frame[0], frame.size(), &topic_ID, buf, sizeof(buf)), -EBADMSG);
+}
+
+TEST_F(V2TransporterFixture, compression)
+{
+    std::vector<uint8_t> payload(200);
+    for (size_t i = 0; i < payload.size(); ++i)
+    {
+        payload[i] = static_cast<uint8_t>(i % 8);
+    }
+    std::vector<uint8_t> out(payload.size());
+    topic_id_size_t topic_ID = 0;
+
+    // Payloads below the threshold are sent as they are.
+    ASSERT_EQ(set_compression(0xa, 201, {}), 0);
+    ASSERT_EQ(write(0xa, &payload[0], payload.size()), static_cast<ssize_t>(payload.size()));
+    ASSERT_EQ(written_len_, 12U + payload.size());
+    ASSERT_EQ(written_data_.get()[3], 0x00);
+
+    ASSERT_EQ(set_compression(0xa, 16, {}), 0);
+    ASSERT_EQ(write(0xa, &payload[0], payload.size()), static_cast<ssize_t>(payload.size()));
+    ASSERT_LT(written_len_, 12U + payload.size() / 4);
+    ASSERT_EQ(written_data_.get()[3], 0x02);
+
+    // Both ways of receiving a frame decompress it.
+    ASSERT_EQ(copy_message_from_frame(written_data_.get(), written_len_, &topic_ID, &out[0], out.size()),
+              static_cast<ssize_t>(payload.size()));
+    ASSERT_EQ(topic_ID, 0xa);
+    ASSERT_EQ(out, payload);
+
+    std::fill(out.begin(), out.end(), 0);
+    ASSERT_EQ(add_to_memfd(written_data_.get(), written_len_), static_cast<ssize_t>(written_len_));
+    ASSERT_EQ(read(&topic_ID, &out[0], out.size()), static_cast<ssize_t>(payload.size()));
+    ASSERT_EQ(topic_ID, 0xa);
+    ASSERT_EQ(out, payload);
+
+    // A buffer too small for the decompressed payload.
+    ASSERT_EQ(copy_message_from_frame(written_data_.get(), written_len_, &topic_ID, &out[0], out.size() - 1),
+              -EBADMSG);
+
+    // Payloads that don't compress are sent uncompressed.
+    uint8_t buf[]{0x5, 0x1, 0x2, 0x3};
+    ASSERT_EQ(set_compression(0xa, 0, {}), 0);
+    ASSERT_EQ(write(0xa, buf, sizeof(buf)), 4);
+    ASSERT_EQ(written_len_, 12U + sizeof(buf));
+    ASSERT_EQ(written_data_.get()[3], 0x00);
+    ASSERT_EQ(std::vector<uint8_t>(written_data_.get() + 12, written_data_.get() + written_len_),
+              std::vector<uint8_t>(buf, buf + sizeof(buf)));
+}
+
+TEST_F(V2TransporterFixture, compression_dictionary)
+{
+    std::vector<uint8_t> dictionary(64);
+    for (size_t i = 0; i < dictionary.size(); ++i)
+    {
+        dictionary[i] = static_cast<uint8_t>(i * 7);
+    }
+    std::vector<uint8_t> payload = dictionary;
+    payload[10] = 0xff;
+    std::vector<uint8_t> out(payload.size());
+    topic_id_size_t topic_ID = 0;
+
+    // Without the dictionary this payload has nothing to refer back to.
+    ASSERT_EQ(set_crc32c(true), 0);
+    ASSERT_EQ(set_compression(0x200, 0, {}), 0);
+    ASSERT_EQ(write(0x200, &payload[0], payload.size()), static_cast<ssize_t>(payload.size()));
+    ASSERT_EQ(written_data_.get()[3], 0x01);
+
+    ASSERT_EQ(set_compression(0x200, 0, dictionary), 0);
+    ASSERT_EQ(write(0x200, &payload[0], payload.size()), static_cast<ssize_t>(payload.size()));
+    ASSERT_EQ(written_data_.get()[3], 0x03);
+    ASSERT_LT(written_len_, 16U + payload.size() / 2);
+
+    ASSERT_EQ(copy_message_from_frame(written_data_.get(), written_len_, &topic_ID, &out[0], out.size()),
+              static_cast<ssize_t>(payload.size()));
+    ASSERT_EQ(topic_ID, 0x200);
+    ASSERT_EQ(out, payload);
+}
+
+TEST_F(PX4TransporterFixture, compression_requires_v2)
+{
+    ASSERT_EQ(set_compression(0xa, 0, {}), -1);
+}
+
+TEST_F(PX4TransporterFixture, set_protocol)
+{
+    ASSERT_EQ(get_protocol(), "px4");
+    ASSERT_EQ(set_protocol("foo"), -1);
+    ASSERT_EQ(get_protocol(), "px4");
+
+    // Whatever is in the ring from before the switch is thrown away.
+    std::vector<uint8_t> px4_data = setup_px4_test_data();
+    add_to_memfd(&px4_data[0], px4_data.size());
+    ASSERT_GT(node_read(), 0);
+
+    ASSERT_EQ(set_protocol("cobs"), 0);
+    ASSERT_EQ(get_protocol(), "cobs");
+    ASSERT_EQ(get_header_length(), 5U);
+
+    std::vector<uint8_t> cobs_data = setup_cobs_test_data();
+    add_to_memfd(&cobs_data[0], cobs_data.size());
+
+    std::unique_ptr<uint8_t[]> buf = std::unique_ptr<uint8_t[]>(new uint8_t[4]{});
+    topic_id_size_t topic_id;
+    ASSERT_EQ(read(&topic_id, buf.get(), 4), 4);
+    ASSERT_EQ(topic_id, 0xa);
+    ASSERT_EQ(buf.get()[0], 0x05);
+
+    // Writes use the new framing too.
+    ASSERT_EQ(write(0xa, buf.get(), 4), 4);
+    ASSERT_EQ(written_len_, cobs_data.size());
+    for (size_t i = 0; i < written_len_; ++i)
+    {
+        ASSERT_EQ(written_data_.get()[i], cobs_data[i]);
+    }
+}
+
+TEST_F(V2TransporterFixture, set_protocol_v2_features)
+{
+    ASSERT_EQ(set_crc32c(true), 0);
+    ASSERT_EQ(set_protocol("cobs"), -1);
+    ASSERT_EQ(get_protocol(), "v2");
+
+    ASSERT_EQ(set_crc32c(false), 0);
+    ASSERT_EQ(set_fragment_size(64), 0);
+    ASSERT_EQ(set_protocol("cobs"), -1);
+    ASSERT_EQ(set_fragment_size(0), 0);
+    ASSERT_EQ(set_protocol("cobs"), 0);
+    ASSERT_EQ(get_protocol(), "cobs");
+}
+
+TEST_F(V2TransporterFixture, delta_encoding)
+{
+    std::vector<uint8_t> payload(100);
+    for (size_t i = 0; i < payload.size(); ++i)
+    {
+        payload[i] = static_cast<uint8_t>(i);
+    }
+    std::vector<uint8_t> out(payload.size());
+    topic_id_size_t topic_ID = 0;
+
+    ASSERT_EQ(set_delta_encoding(0xa, 0), -1);
+    ASSERT_EQ(set_delta_encoding(0xa, 4), 0);
+
+    // The first payload is sent in full, as a delta base.
+    ASSERT_EQ(write(0xa, &payload[0], payload.size()), static_cast<ssize_t>(payload.size()));
+    ASSERT_EQ(written_data_.get()[3], 0x04);
+    ASSERT_EQ(written_len_, 12U + payload.size());
+    ASSERT_EQ(copy_message_from_frame(written_data_.get(), written_len_, &topic_ID, &out[0], out.size()),
+              static_cast<ssize_t>(payload.size()));
+    ASSERT_EQ(out, payload);
+
+    // A payload with two changed bytes is sent as a small delta.
+    payload[10] = 0xff;
+    payload[50] = 0xee;
+    ASSERT_EQ(write(0xa, &payload[0], payload.size()), static_cast<ssize_t>(payload.size()));
+    ASSERT_EQ(written_data_.get()[3], 0x08);
+    ASSERT_LT(written_len_, 12U + 10U);
+    ASSERT_EQ(copy_message_from_frame(written_data_.get(), written_len_, &topic_ID, &out[0], out.size()),
+              static_cast<ssize_t>(payload.size()));
+    ASSERT_EQ(topic_ID, 0xa);
+    ASSERT_EQ(out, payload);
+
+    // An unchanged payload is just the base CRC, and read() decodes it too.
+    ASSERT_EQ(write(0xa, &payload[0], payload.size()), static_cast<ssize_t>(payload.size()));
+    ASSERT_EQ(written_data_.get()[3], 0x08);
+    ASSERT_EQ(written_len_, 12U + 2U);
+    std::fill(out.begin(), out.end(), 0);
+    ASSERT_EQ(add_to_memfd(written_data_.get(), written_len_), static_cast<ssize_t>(written_len_));
+    ASSERT_EQ(read(&topic_ID, &out[0], out.size()), static_cast<ssize_t>(payload.size()));
+    ASSERT_EQ(out, payload);
+
+    // After a delta base and three deltas, the next payload is a keyframe.
+    ASSERT_EQ(write(0xa, &payload[0], payload.size()), static_cast<ssize_t>(payload.size()));
+    ASSERT_EQ(written_data_.get()[3], 0x08);
+    ASSERT_EQ(write(0xa, &payload[0], payload.size()), static_cast<ssize_t>(payload.size()));
+    ASSERT_EQ(written_data_.get()[3], 0x04);
+    ASSERT_EQ(copy_message_from_frame(written_data_.get(), written_len_, &topic_ID, &out[0], out.size()),
+              static_cast<ssize_t>(payload.size()));
+
+    // A change of length also sends the whole payload.
+    payload.push_back(0x1);
+    out.resize(payload.size());
+    ASSERT_EQ(write(0xa, &payload[0], payload.size()), static_cast<ssize_t>(payload.size()));
+    ASSERT_EQ(written_data_.get()[3], 0x04);
+    ASSERT_EQ(copy_message_from_frame(written_data_.get(), written_len_, &topic_ID, &out[0], out.size()),
+              static_cast<ssize_t>(payload.size()));
+    ASSERT_EQ(out, payload);
+}
+
+TEST_F(V2TransporterFixture, delta_encoding_lost_frame)
+{
+    std::vector<uint8_t> payload(64, 0x55);
+    std::vector<uint8_t> out(payload.size());
+    topic_id_size_t topic_ID = 0;
+
+    ASSERT_EQ(set_delta_encoding(0xa, 100), 0);
+
+    // A delta without a base is dropped.
+    ASSERT_EQ(write(0xa, &payload[0], payload.size()), static_cast<ssize_t>(payload.size()));
+    std::vector<uint8_t> base(written_data_.get(), written_data_.get() + written_len_);
+    payload[0] = 0x1;
+    ASSERT_EQ(write(0xa, &payload[0], payload.size()), static_cast<ssize_t>(payload.size()));
+    std::vector<uint8_t> delta1(written_data_.get(), written_data_.get() + written_len_);
+    payload[1] = 0x2;
+    ASSERT_EQ(write(0xa, &payload[0], payload.size()), static_cast<ssize_t>(payload.size()));
+    std::vector<uint8_t> delta2(written_data_.get(), written_data_.get() + written_len_);
+    ASSERT_EQ(copy_message_from_frame(&delta1[0], delta1.size(), &topic_ID, &out[0], out.size()), -EBADMSG);
+
+    // A delta against a base other than the one we have (because delta1 was
+    // lost) is dropped too.
+    ASSERT_EQ(copy_message_from_frame(&base[0], base.size(), &topic_ID, &out[0], out.size()),
+              static_cast<ssize_t>(payload.size()));
+    ASSERT_EQ(copy_message_from_frame(&delta2[0], delta2.size(), &topic_ID, &out[0], out.size()), -EBADMSG);
+
+    // A frame can't be both a delta and a delta base.
+    delta2[3] |= 0x04;
+    ASSERT_EQ(copy_message_from_frame(&delta2[0], delta2.size(), &topic_ID, &out[0], out.size()), -EBADMSG);
+}
+
+TEST_F(V2TransporterFixture, delta_encoding_and_compression)
+{
+    std::vector<uint8_t> payload(300);
+    for (size_t i = 0; i < payload.size(); ++i)
+    {
+        payload[i] = static_cast<uint8_t>(i * 13);
+    }
+    std::vector<uint8_t> out(payload.size());
+    topic_id_size_t topic_ID = 0;
+
+    ASSERT_EQ(set_delta_encoding(0x300, 10), 0);
+    ASSERT_EQ(set_compression(0x300, 0, {}), 0);
+
+    ASSERT_EQ(write(0x300, &payload[0], payload.size()), static_cast<ssize_t>(payload.size()));
+    ASSERT_EQ(copy_message_from_frame(written_data_.get(), written_len_, &topic_ID, &out[0], out.size()),
+              static_cast<ssize_t>(payload.size()));
+
+    // Change a long stretch, so that the delta is worth compressing.
+    std::fill(payload.begin() + 100, payload.begin() + 200, 0);
+    ASSERT_EQ(write(0x300, &payload[0], payload.size()), static_cast<ssize_t>(payload.size()));
+    ASSERT_EQ(written_data_.get()[3], 0x0a);
+    ASSERT_EQ(copy_message_from_frame(written_data_.get(), written_len_, &topic_ID, &out[0], out.size()),
+              static_cast<ssize_t>(payload.size()));
+    ASSERT_EQ(topic_ID, 0x300);
+    ASSERT_EQ(out, payload);
+}
+
+TEST_F(PX4TransporterFixture, delta_encoding_requires_v2)
+{
+    ASSERT_EQ(set_delta_encoding(0xa, 10), -1);
+}
+
+TEST_F(V2TransporterFixture, fragments)
+{
+    std::vector<uint8_t> payload(300);
+    for (size_t i = 0; i < payload.size(); ++i)
+    {
+        payload[i] = static_cast<uint8_t>(i);
+    }
+    topic_id_size_t topic_ID = 0;
+
+    ASSERT_EQ(set_fragment_size(15), -1);
+    ASSERT_EQ(set_fragment_size(64), 0);
+    ASSERT_EQ(get_fragment_size(), 64U);
+
+    // Each fragment is a frame with no more than 64 bytes of payload.
+    std::vector<std::vector<uint8_t>> frames;
+    FragmentCursor cursor;
+    while (cursor.offset < payload.size())
+    {
+        ssize_t ret = write_fragment(0x3, &payload[0], payload.size(), &cursor);
+        ASSERT_GT(ret, 0);
+        ASSERT_EQ(written_data_.get()[3], 0x10);
+        ASSERT_LE(written_len_, 12U + 64U);
+        frames.emplace_back(written_data_.get(), written_data_.get() + written_len_);
+    }
+    ASSERT_GT(frames.size(), 4U);
+    ASSERT_EQ(write_fragment(0x3, &payload[0], payload.size(), &cursor), -1);
+
+    // The payload is only handed over with the last fragment, and can be
+    // longer than the buffer it is read with.
+    uint8_t buf[64];
+    uint8_t *out = nullptr;
+    for (size_t i = 0; i < frames.size() - 1; ++i)
+    {
+        ASSERT_EQ(copy_message_from_frame(&frames[i][0], frames[i].size(), &topic_ID, buf, sizeof(buf), &out),
+                  -EINPROGRESS);
+    }
+    ASSERT_EQ(copy_message_from_frame(&frames.back()[0], frames.back().size(), &topic_ID, buf, sizeof(buf), &out),
+              static_cast<ssize_t>(payload.size()));
+    ASSERT_EQ(topic_ID, 0x3);
+    ASSERT_EQ(std::vector<uint8_t>(out, out + payload.size()), payload);
+
+    // Without somewhere to leave it, it has to fit the buffer.
+    for (size_t i = 0; i < frames.size() - 1; ++i)
+    {
+        ASSERT_EQ(copy_message_from_frame(&frames[i][0], frames[i].size(), &topic_ID, buf, sizeof(buf)), -EINPROGRESS);
+    }
+    ASSERT_EQ(copy_message_from_frame(&frames.back()[0], frames.back().size(), &topic_ID, buf, sizeof(buf)),
+              -EMSGSIZE);
+
+    // A missing fragment loses the payload, but the next one still gets
+    // through.
+    for (size_t i = 0; i < frames.size(); ++i)
+    {
+        if (i == 1)
+        {
+            continue;
+        }
+        ASSERT_LT(copy_message_from_frame(&frames[i][0], frames[i].size(), &topic_ID, buf, sizeof(buf), &out), 0);
+    }
+
+    // write() sends all of the fragments, and read_many() reassembles them
+    // out of the ring buffer, which is smaller than the payload.
+    size_t write_count = write_count_;
+    std::vector<uint8_t> stream;
+    for (size_t i = 0; i < frames.size(); ++i)
+    {
+        stream.insert(stream.end(), frames[i].begin(), frames[i].end());
+    }
+    ASSERT_EQ(write(0x3, &payload[0], payload.size()), static_cast<ssize_t>(payload.size()));
+    ASSERT_EQ(write_count_ - write_count, frames.size());
+    ASSERT_EQ(add_to_memfd(&stream[0], stream.size()), static_cast<ssize_t>(stream.size()));
+    std::vector<std::vector<uint8_t>> received;
+    for (int i = 0; i < 10 && received.empty(); ++i)
+    {
+        ASSERT_GE(read_many(buf, sizeof(buf), [&received](topic_id_size_t, uint8_t *data, size_t length) {
+            received.emplace_back(data, data + length);
+        }), 0);
+    }
+    ASSERT_EQ(received.size(), 1U);
+    ASSERT_EQ(received[0], payload);
+
+    ros2_to_serial_bridge::transport::Metrics::Snapshot snapshot;
+    get_metrics().snapshot(&snapshot);
+    ASSERT_EQ(snapshot.tx.size(), 1U);
+    ASSERT_EQ(snapshot.tx[0].messages, 2U);
+    ASSERT_EQ(snapshot.rx.size(), 1U);
+    ASSERT_EQ(snapshot.rx[0].messages, 1U);
+    ASSERT_EQ(snapshot.rx[0].oversize_drops, 1U);
+    // Every fragment after the missing one is dropped.
+    ASSERT_EQ(snapshot.rx[0].decode_failures, frames.size() - 2);
+}
+
+TEST_F(V2TransporterFixture, fragments_interleaved)
+{
+    std::vector<uint8_t> a(100, 0xa);
+    std::vector<uint8_t> b(100, 0xb);
+    ASSERT_EQ(set_fragment_size(32), 0);
+
+    // The fragments of two topics and a whole frame of a third can be mixed
+    // on the wire.
+    std::vector<uint8_t> stream;
+    FragmentCursor cursor_a;
+    FragmentCursor cursor_b;
+    while (cursor_a.offset < a.size() || cursor_b.offset < b.size())
+    {
+        if (cursor_a.offset < a.size())
+        {
+            ASSERT_GT(write_fragment(0x1, &a[0], a.size(), &cursor_a), 0);
+            stream.insert(stream.end(), written_data_.get(), written_data_.get() + written_len_);
+        }
+        if (cursor_b.offset < b.size())
+        {
+            ASSERT_GT(write_fragment(0x2, &b[0], b.size(), &cursor_b), 0);
+            stream.insert(stream.end(), written_data_.get(), written_data_.get() + written_len_);
+        }
+        uint8_t small[]{0x5};
+        ASSERT_EQ(write(0x4, small, sizeof(small)), 1);
+        stream.insert(stream.end(), written_data_.get(), written_data_.get() + written_len_);
+    }
+
+    ASSERT_EQ(add_to_memfd(&stream[0], stream.size()), static_cast<ssize_t>(stream.size()));
+    std::map<topic_id_size_t, std::vector<std::vector<uint8_t>>> received;
+    uint8_t buf[64];
+    for (int i = 0; i < 20; ++i)
+    {
+        read_many(buf, sizeof(buf), [&received](topic_id_size_t topic_ID, uint8_t *data, size_t length) {
+            received[topic_ID].emplace_back(data, data + length);
+        });
+    }
+    ASSERT_EQ(received[0x1], std::vector<std::vector<uint8_t>>({a}));
+    ASSERT_EQ(received[0x2], std::vector<std::vector<uint8_t>>({b}));
+    ASSERT_GT(received[0x4].size(), 2U);
+}
+
+TEST_F(PX4TransporterFixture, fragments_require_v2)
+{
+    ASSERT_EQ(set_fragment_size(64), -1);
+}
+
+TEST_F(PX4TransporterFixture, metrics)
+{
+    using Metrics = ros2_to_serial_bridge::transport::Metrics;
+
+    std::unique_ptr<uint8_t[]> buf = std::unique_ptr<uint8_t[]>(new uint8_t[4]{});
+
+    // Garbage, a good message, and a message with a bad CRC.
+    std::vector<uint8_t> read_data{0x1, 0x2, '>', 0x3};
+    std::vector<uint8_t> msg_data = setup_px4_test_data();
+    read_data.insert(read_data.end(), msg_data.begin(), msg_data.end());
+    msg_data[msg_data.size() - 1] ^= 0xff;
+    read_data.insert(read_data.end(), msg_data.begin(), msg_data.end());
+    add_to_memfd(&read_data[0], read_data.size());
+
+    ASSERT_EQ(read_many(buf.get(), 4, [](topic_id_size_t, uint8_t *, size_t) {}), 1);
+
+    uint8_t payload[]{0x5, 0x1, 0x2, 0x3};
+    get_metrics().set_timing(true);
+    ASSERT_EQ(write(0x7, payload, sizeof(payload)), 4);
+    test_fds_ok_ = false;
+    ASSERT_EQ(write(0x7, payload, sizeof(payload)), -1);
+    test_fds_ok_ = true;
+
+    Metrics::Snapshot snapshot;
+    get_metrics().snapshot(&snapshot);
+
+    ASSERT_EQ(snapshot.garbage_bytes, 4U);
+    ASSERT_EQ(snapshot.ring_overflow_bytes, 0U);
+    ASSERT_EQ(snapshot.rx.size(), 1U);
+    ASSERT_EQ(snapshot.rx[0].topic_ID, 0xa);
+    ASSERT_EQ(snapshot.rx[0].messages, 1U);
+    ASSERT_EQ(snapshot.rx[0].bytes, 4U);
+    ASSERT_EQ(snapshot.rx[0].crc_failures, 1U);
+
+    // A write with the transport down never gets as far as being counted.
+    ASSERT_EQ(snapshot.tx.size(), 1U);
+    ASSERT_EQ(snapshot.tx[0].topic_ID, 0x7);
+    ASSERT_EQ(snapshot.tx[0].messages, 1U);
+    ASSERT_EQ(snapshot.tx[0].bytes, 4U);
+    ASSERT_EQ(snapshot.tx[0].write_failures, 0U);
+
+    ASSERT_EQ(snapshot.latency[static_cast<size_t>(Metrics::Stage::FRAME)].count, 1U);
+    ASSERT_EQ(snapshot.latency[static_cast<size_t>(Metrics::Stage::WRITE)].count, 1U);
+    ASSERT_EQ(snapshot.latency[static_cast<size_t>(Metrics::Stage::DISPATCH)].count, 0U);
+}
+
+TEST_F(PX4TransporterFixture, sequence)
+{
+    uint8_t payload[]{0x5, 0x1, 0x2, 0x3};
+    ASSERT_EQ(write(0x7, payload, sizeof(payload)), 4);
+    ASSERT_EQ(write(0x7, payload, sizeof(payload)), 4);
+    ASSERT_EQ(written_data_[4], 1U);
+    ASSERT_EQ(write(0x8, payload, sizeof(payload)), 4);
+    ASSERT_EQ(written_data_[4], 0U);
+
+    // The sequence number isn't covered by the CRC.
+    uint8_t buf[4]{};
+    topic_id_size_t topic_ID = 0;
+    std::vector<uint8_t> frame = setup_px4_test_data();
+    for (uint8_t seq : {0, 1, 4, 4, 3})
+    {
+        frame[4] = seq;
+        ASSERT_EQ(copy_message_from_frame(&frame[0], frame.size(), &topic_ID, buf, sizeof(buf)), 4);
+    }
+
+    ros2_to_serial_bridge::transport::Metrics::Snapshot snapshot;
+    get_metrics().snapshot(&snapshot);
+    ASSERT_EQ(snapshot.rx.size(), 1U);
+    ASSERT_EQ(snapshot.rx[0].sequence_gaps, 2U);
+    ASSERT_EQ(snapshot.rx[0].sequence_duplicates, 1U);
+    ASSERT_EQ(snapshot.rx[0].sequence_reorders, 1U);
+}
+
+TEST_F(V2TransporterFixture, metrics_drops)
+{
+    using Metrics = ros2_to_serial_bridge::transport::Metrics;
+
+    uint8_t buf[4]{};
+    topic_id_size_t topic_ID = 0;
+    std::vector<uint8_t> frame = setup_v2_test_data();
+
+    ASSERT_EQ(copy_message_from_frame(&frame[0], frame.size(), &topic_ID, buf, 3), -EMSGSIZE);
+    ASSERT_EQ(copy_message_from_frame(&frame[0], frame.size() - 1, &topic_ID, buf, sizeof(buf)), -EBADMSG);
+
+    std::unique_ptr<uint8_t[]> too_large = std::unique_ptr<uint8_t[]>(new uint8_t[65536]{});
+    ASSERT_EQ(set_write_batching(64), 0);
+    ASSERT_EQ(write(0x3, too_large.get(), 65536), 65536);
+    ASSERT_EQ(write(0x3, too_large.get(), 16), 16);
+    test_fds_ok_ = false;
+    ASSERT_EQ(flush(), -1);
+    test_fds_ok_ = true;
+
+    Metrics::Snapshot snapshot;
+    get_metrics().snapshot(&snapshot);
+
+    ASSERT_EQ(snapshot.garbage_bytes, frame.size() - 1);
+    ASSERT_EQ(snapshot.rx.size(), 1U);
+    ASSERT_EQ(snapshot.rx[0].topic_ID, 0xa);
+    ASSERT_EQ(snapshot.rx[0].messages, 0U);
+    ASSERT_EQ(snapshot.rx[0].oversize_drops, 1U);
+
+    // The batched frame was counted when it was written, and then as a
+    // failed write when the batch couldn't be flushed.
+    ASSERT_EQ(snapshot.tx.size(), 1U);
+    ASSERT_EQ(snapshot.tx[0].messages, 2U);
+    ASSERT_EQ(snapshot.tx[0].bytes, 65536U + 16U);
+    ASSERT_EQ(snapshot.tx[0].write_failures, 1U);
+
+    // Timing is off by default.
+    ASSERT_EQ(snapshot.latency[static_cast<size_t>(Metrics::Stage::WRITE)].count, 0U);
+}
+
+TEST_F(V2TransporterFixture, reliable)
+{
+    using Metrics = ros2_to_serial_bridge::transport::Metrics;
+
+    // The transporter reads back what it writes, so it acknowledges its own
+    // frames.
+    ASSERT_EQ(set_reliable(0x1), 0);
+    std::vector<std::vector<uint8_t>> frames;
+    for (uint8_t i = 0; i < 3; ++i)
+    {
+        uint8_t msg[3]{i, 0x2, 0x3};
+        ASSERT_EQ(write(0x1, msg, sizeof(msg)), 3);
+        frames.emplace_back(written_data_.get(), written_data_.get() + written_len_);
+    }
+
+    // The second frame is lost, and the third arrives twice.
+    topic_id_size_t topic_ID = 0;
+    uint8_t buf[16];
+    ASSERT_EQ(copy_message_from_frame(&frames[0][0], frames[0].size(), &topic_ID, buf, sizeof(buf)), 3);
+    ASSERT_EQ(topic_ID, 0x1);
+    ASSERT_EQ(buf[0], 0);
+    ASSERT_EQ(copy_message_from_frame(&frames[2][0], frames[2].size(), &topic_ID, buf, sizeof(buf)), 3);
+    ASSERT_EQ(buf[0], 2);
+    ASSERT_EQ(copy_message_from_frame(&frames[2][0], frames[2].size(), &topic_ID, buf, sizeof(buf)), -EINPROGRESS);
+
+    // Once the timers run out, the acknowledgement and all three frames are
+    // sent, and only the lost frame is delivered again.
+    ASSERT_EQ(set_write_batching(200), 0);
+    std::chrono::steady_clock::time_point later = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+    ASSERT_GT(service_reliable(later), 0);
+    ASSERT_EQ(get_pending_write_bytes(), 0U);
+    ASSERT_EQ(add_to_memfd(written_data_.get(), written_len_), static_cast<ssize_t>(written_len_));
+    std::vector<std::vector<uint8_t>> received;
+    ASSERT_EQ(read_many(buf, sizeof(buf), [&received](topic_id_size_t, uint8_t *data, size_t length) {
+        received.emplace_back(data, data + length);
+    }), 1);
+    ASSERT_EQ(received, std::vector<std::vector<uint8_t>>({{1, 2, 3}}));
+
+    // The first and third frames were acknowledged, and the acknowledgement
+    // of the second goes out on its own while the second waits for it.
+    size_t write_count = write_count_;
+    ASSERT_GT(service_reliable(later), 0);
+    ASSERT_EQ(write_count_, write_count + 1);
+    ASSERT_EQ(add_to_memfd(written_data_.get(), written_len_), static_cast<ssize_t>(written_len_));
+    ASSERT_EQ(read_many(buf, sizeof(buf), [](topic_id_size_t, uint8_t *, size_t) {}), 0);
+    ASSERT_EQ(service_reliable(later), -1);
+
+    Metrics::Snapshot snapshot;
+    get_metrics().snapshot(&snapshot);
+    ASSERT_EQ(snapshot.tx[0].topic_ID, 0x1);
+    ASSERT_EQ(snapshot.tx[0].messages, 3U);
+    ASSERT_EQ(snapshot.tx[0].retransmits, 3U);
+    ASSERT_EQ(snapshot.tx[0].write_failures, 0U);
+}
+
+TEST_F(V2TransporterFixture, reliable_piggyback)
+{
+    ASSERT_EQ(set_reliable(0x1), 0);
+    uint8_t msg[2]{0x1, 0x2};
+    ASSERT_EQ(write(0x1, msg, sizeof(msg)), 2);
+    ASSERT_EQ(add_to_memfd(written_data_.get(), written_len_), static_cast<ssize_t>(written_len_));
+    uint8_t buf[16];
+    ASSERT_EQ(read_many(buf, sizeof(buf), [](topic_id_size_t, uint8_t *, size_t) {}), 1);
+
+    // The acknowledgement goes in front of the next payload of any topic,
+    // which still arrives as it was sent.
+    uint8_t other[3]{0x7, 0x8, 0x9};
+    ASSERT_EQ(write(0x4, other, sizeof(other)), 3);
+    ASSERT_EQ(add_to_memfd(written_data_.get(), written_len_), static_cast<ssize_t>(written_len_));
+    std::vector<uint8_t> received;
+    ASSERT_EQ(read_many(buf, sizeof(buf), [&received](topic_id_size_t topic_ID, uint8_t *data, size_t length) {
+        ASSERT_EQ(topic_ID, 0x4);
+        received.assign(data, data + length);
+    }), 1);
+    ASSERT_EQ(received, std::vector<uint8_t>({0x7, 0x8, 0x9}));
+
+    // Nothing is left to send.
+    size_t write_count = write_count_;
+    ASSERT_EQ(service_reliable(std::chrono::steady_clock::now() + std::chrono::seconds(1)), -1);
+    ASSERT_EQ(write_count_, write_count);
+}
+
+TEST_F(V2TransporterFixture, reliable_window)
+{
+    int notified = 0;
+    set_reliable_notify([&notified]() {notified++;});
+    ASSERT_EQ(set_reliable(0x1), 0);
+
+    uint8_t msg[1]{0x1};
+    for (size_t i = 0; i < RELIABLE_WINDOW; ++i)
+    {
+        ASSERT_EQ(write(0x1, msg, sizeof(msg)), 1);
+    }
+    ASSERT_EQ(notified, 1);
+    errno = 0;
+    ASSERT_EQ(write(0x1, msg, sizeof(msg)), -1);
+    ASSERT_EQ(errno, ENOBUFS);
+
+    // Without acknowledgements, each frame is given up on after the last
+    // retransmit.
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < RELIABLE_MAX_RETRANSMITS; ++i)
+    {
+        now += std::chrono::seconds(10);
+        ASSERT_GT(service_reliable(now), 0);
+    }
+    now += std::chrono::seconds(10);
+    ASSERT_EQ(service_reliable(now), -1);
+    ASSERT_EQ(write(0x1, msg, sizeof(msg)), 1);
+    ASSERT_EQ(notified, 2);
+
+    ros2_to_serial_bridge::transport::Metrics::Snapshot snapshot;
+    get_metrics().snapshot(&snapshot);
+    ASSERT_EQ(snapshot.tx[0].retransmits, RELIABLE_WINDOW * RELIABLE_MAX_RETRANSMITS);
+    ASSERT_EQ(snapshot.tx[0].write_failures, RELIABLE_WINDOW + 1);
+}
+
+TEST_F(V2TransporterFixture, reliable_requires_v2)
+{
+    ASSERT_EQ(set_reliable(0x1), 0);
+    ASSERT_EQ(set_protocol("px4"), -1);
+    ASSERT_EQ(get_protocol(), "v2");
+}
+
+TEST_F(PX4TransporterFixture, reliable_requires_v2)
+{
+    ASSERT_EQ(set_reliable(0x1), -1);
+    ASSERT_EQ(service_reliable(), -1);
+}
+
+TEST_F(V2TransporterFixture, fec)
+{
+    using Metrics = ros2_to_serial_bridge::transport::Metrics;
+
+    std::vector<uint8_t> payload(150);
+    for (size_t i = 0; i < payload.size(); ++i)
+    {
+        payload[i] = static_cast<uint8_t>(i * 7);
+    }
+    std::vector<uint8_t> out(payload.size());
+    topic_id_size_t topic_ID = 0;
+
+    // One shortened block, with 32 bytes of parity.
+    ASSERT_EQ(set_fec(true), 0);
+    ASSERT_EQ(write(0xa, &payload[0], payload.size()), static_cast<ssize_t>(payload.size()));
+    ASSERT_EQ(written_len_, 5U + 1U + 4U + 2U + payload.size() + 32U);
+    ASSERT_EQ(written_data_.get()[3], 0x80);
+    std::vector<uint8_t> frame(written_data_.get(), written_data_.get() + written_len_);
+
+    // Damaged bytes, in the payload or the parity, are put right before the
+    // CRC is checked.
+    std::vector<uint8_t> damaged = frame;
+    for (size_t i = 0; i < 10; ++i)
+    {
+        damaged[12 + i * 18] ^= 0xff;
+    }
+    ASSERT_EQ(add_to_memfd(&damaged[0], damaged.size()), static_cast<ssize_t>(damaged.size()));
+    ASSERT_EQ(read(&topic_ID, &out[0], out.size()), static_cast<ssize_t>(payload.size()));
+    ASSERT_EQ(topic_ID, 0xa);
+    ASSERT_EQ(out, payload);
+
+    ASSERT_EQ(copy_message_from_frame(&damaged[0], damaged.size(), &topic_ID, &out[0], out.size()),
+              static_cast<ssize_t>(payload.size()));
+    ASSERT_EQ(out, payload);
+
+    // Too much damage loses the frame.
+    for (size_t i = 0; i < 20; ++i)
+    {
+        damaged[12 + i] ^= 0x55;
+    }
+    ASSERT_EQ(copy_message_from_frame(&damaged[0], damaged.size(), &topic_ID, &out[0], out.size()), -EBADMSG);
+
+    // The buffer only has to be big enough for the payload, not the parity.
+    ASSERT_EQ(copy_message_from_frame(&frame[0], frame.size(), &topic_ID, &out[0], payload.size() - 1), -EMSGSIZE);
+
+    Metrics::Snapshot snapshot;
+    get_metrics().snapshot(&snapshot);
+    ASSERT_EQ(snapshot.rx.size(), 1U);
+    ASSERT_EQ(snapshot.rx[0].messages, 1U);
+    ASSERT_EQ(snapshot.rx[0].corrected_bytes, 20U);
+    ASSERT_EQ(snapshot.rx[0].crc_failures, 1U);
+    ASSERT_EQ(snapshot.rx[0].oversize_drops, 1U);
+
+    // The receiver takes the parity from the frame, whatever it sends.
+    ASSERT_EQ(set_fec(false), 0);
+    ASSERT_EQ(copy_message_from_frame(&frame[0], frame.size(), &topic_ID, &out[0], out.size()),
+              static_cast<ssize_t>(payload.size()));
+    ASSERT_EQ(out, payload);
+    ASSERT_EQ(write(0xa, &payload[0], payload.size()), static_cast<ssize_t>(payload.size()));
+    ASSERT_EQ(written_len_, 5U + 1U + 4U + 2U + payload.size());
+}
+
+TEST_F(V2TransporterFixture, fec_with_compression_and_fragments)
+{
+    std::vector<uint8_t> payload(1000, 0x42);
+    std::vector<uint8_t> out(payload.size());
+    topic_id_size_t topic_ID = 0;
+
+    ASSERT_EQ(set_fec(true), 0);
+    ASSERT_EQ(set_crc32c(true), 0);
+    ASSERT_EQ(set_compression(0x3, 16, {}), 0);
+    ASSERT_EQ(write(0x3, &payload[0], payload.size()), static_cast<ssize_t>(payload.size()));
+    ASSERT_EQ(written_data_.get()[3], 0x80 | 0x2 | 0x1);
+    std::vector<uint8_t> frame(written_data_.get(), written_data_.get() + written_len_);
+    frame[frame.size() - 40] ^= 0x1;
+    ASSERT_EQ(copy_message_from_frame(&frame[0], frame.size(), &topic_ID, &out[0], out.size()),
+              static_cast<ssize_t>(payload.size()));
+    ASSERT_EQ(out, payload);
+
+    // Each fragment is a frame with parity of its own, two blocks of it.
+    ASSERT_EQ(set_fragment_size(400), 0);
+    std::vector<std::vector<uint8_t>> frames;
+    FragmentCursor cursor;
+    while (cursor.offset < payload.size())
+    {
+        ASSERT_GT(write_fragment(0x4, &payload[0], payload.size(), &cursor), 0);
+        frames.emplace_back(written_data_.get(), written_data_.get() + written_len_);
+    }
+    ASSERT_EQ(frames.size(), 3U);
+    for (size_t i = 0; i < frames.size(); ++i)
+    {
+        frames[i][20] ^= 0x80;
+        ssize_t len = copy_message_from_frame(&frames[i][0], frames[i].size(), &topic_ID, &out[0], out.size());
+        ASSERT_EQ(len, i + 1 < frames.size() ? -EINPROGRESS : static_cast<ssize_t>(payload.size()));
+    }
+    ASSERT_EQ(topic_ID, 0x4);
+    ASSERT_EQ(out, payload);
+}
+
+TEST_F(PX4TransporterFixture, fec_requires_v2)
+{
+    ASSERT_EQ(set_fec(true), -1);
+}
+
+TEST_F(V2TransporterFixture, aead)
+{
+    using Metrics = ros2_to_serial_bridge::transport::Metrics;
+
+    std::vector<uint8_t> key(32);
+    for (size_t i = 0; i < key.size(); ++i)
+    {
+        key[i] = static_cast<uint8_t>(i * 13 + 1);
+    }
+    std::vector<uint8_t> payload(100);
+    for (size_t i = 0; i < payload.size(); ++i)
+    {
+        payload[i] = static_cast<uint8_t>(i);
+    }
+    std::vector<uint8_t> out(payload.size());
+    topic_id_size_t topic_ID = 0;
+
+    ASSERT_EQ(set_aead_key(std::vector<uint8_t>(16), 0), -1);
+    ASSERT_EQ(set_aead_key(key, 2), -1);
+
+    // The nonce and tag take the place of the CRC, and the payload is
+    // encrypted.
+    ASSERT_EQ(set_aead_key(key, 0), 0);
+    ASSERT_EQ(set_crc32c(true), 0);
+    std::vector<std::vector<uint8_t>> frames;
+    for (int i = 0; i < 3; ++i)
+    {
+        ASSERT_EQ(write(0xa, &payload[0], payload.size()), static_cast<ssize_t>(payload.size()));
+        frames.emplace_back(written_data_.get(), written_data_.get() + written_len_);
+    }
+    constexpr size_t header_len = 5 + 1 + 4 + 8 + 16;
+    ASSERT_EQ(frames[0].size(), header_len + payload.size());
+    ASSERT_EQ(frames[0][2], 0x03);
+    ASSERT_EQ(frames[0][3], 0x00);
+    ASSERT_NE(std::vector<uint8_t>(frames[0].begin() + header_len, frames[0].end()), payload);
+    ASSERT_NE(frames[0], frames[1]);
+
+    // Frames from this side of the link are refused.
+    ASSERT_EQ(copy_message_from_frame(&frames[0][0], frames[0].size(), &topic_ID, &out[0], out.size()), -EBADMSG);
+
+    // The other side takes them in any order, but only once each.
+    ASSERT_EQ(set_aead_key(key, 1), 0);
+    ASSERT_EQ(copy_message_from_frame(&frames[1][0], frames[1].size(), &topic_ID, &out[0], out.size()),
+              static_cast<ssize_t>(payload.size()));
+    ASSERT_EQ(topic_ID, 0xa);
+    ASSERT_EQ(out, payload);
+    ASSERT_EQ(copy_message_from_frame(&frames[0][0], frames[0].size(), &topic_ID, &out[0], out.size()),
+              static_cast<ssize_t>(payload.size()));
+    ASSERT_EQ(copy_message_from_frame(&frames[1][0], frames[1].size(), &topic_ID, &out[0], out.size()), -EBADMSG);
+
+    // A change to the header or the payload is caught by the tag.
+    std::vector<uint8_t> bad = frames[2];
+    bad[4] ^= 0x01;
+    ASSERT_EQ(copy_message_from_frame(&bad[0], bad.size(), &topic_ID, &out[0], out.size()), -EBADMSG);
+    bad = frames[2];
+    bad[header_len + 50] ^= 0x01;
+    ASSERT_EQ(copy_message_from_frame(&bad[0], bad.size(), &topic_ID, &out[0], out.size()), -EBADMSG);
+
+    // Nor does a frame that isn't keyed get in.
+    std::vector<uint8_t> plain = setup_v2_test_data();
+    ASSERT_EQ(copy_message_from_frame(&plain[0], plain.size(), &topic_ID, &out[0], out.size()), -EBADMSG);
+
+    // The stream parser checks them the same way.
+    ASSERT_EQ(add_to_memfd(&plain[0], plain.size()), static_cast<ssize_t>(plain.size()));
+    ASSERT_EQ(add_to_memfd(&frames[2][0], frames[2].size()), static_cast<ssize_t>(frames[2].size()));
+    ASSERT_EQ(read(&topic_ID, &out[0], out.size()), static_cast<ssize_t>(payload.size()));
+    ASSERT_EQ(out, payload);
+
+    Metrics::Snapshot snapshot;
+    get_metrics().snapshot(&snapshot);
+    ASSERT_EQ(snapshot.rx.size(), 1U);
+    ASSERT_EQ(snapshot.rx[0].messages, 1U);
+    ASSERT_EQ(snapshot.rx[0].crc_failures, 4U);
+
+    ASSERT_EQ(set_protocol("cobs"), -1);
+}
+
+TEST_F(V2TransporterFixture, aead_with_fec)
+{
+    std::vector<uint8_t> key(32, 0x5a);
+    std::vector<uint8_t> payload(300, 0x42);
+    std::vector<uint8_t> out(payload.size());
+    topic_id_size_t topic_ID = 0;
+
+    // The parity is of the encrypted payload, so damage is corrected before
+    // the tag is checked.
+    ASSERT_EQ(set_aead_key(key, 1), 0);
+    ASSERT_EQ(set_fec(true), 0);
+    ASSERT_EQ(write(0x3, &payload[0], payload.size()), static_cast<ssize_t>(payload.size()));
+    std::vector<uint8_t> frame(written_data_.get(), written_data_.get() + written_len_);
+    ASSERT_EQ(frame[3], 0x80);
+    for (size_t i = 0; i < 10; ++i)
+    {
+        frame[40 + i * 25] ^= 0xff;
+    }
+
+    ASSERT_EQ(set_aead_key(key, 0), 0);
+    ASSERT_EQ(copy_message_from_frame(&frame[0], frame.size(), &topic_ID, &out[0], out.size()),
+              static_cast<ssize_t>(payload.size()));
+    ASSERT_EQ(topic_ID, 0x3);
+    ASSERT_EQ(out, payload);
+}
+
+TEST_F(PX4TransporterFixture, aead_requires_v2)
+{
+    ASSERT_EQ(set_aead_key(std::vector<uint8_t>(32), 0), -1);
+}
+
+TEST_F(PX4TransporterFixture, receive_time)
+{
+    std::unique_ptr<uint8_t[]> buf = std::unique_ptr<uint8_t[]>(new uint8_t[4]{});
+    ASSERT_EQ(get_receive_time(), std::chrono::system_clock::time_point());
+
+    std::vector<uint8_t> msg_data = setup_px4_test_data();
+    std::vector<uint8_t> read_data = msg_data;
+    read_data.insert(read_data.end(), msg_data.begin(), msg_data.end());
+    add_to_memfd(&read_data[0], read_data.size());
+
+    // Both messages came in with the same read, so they have the same time.
+    std::chrono::system_clock::time_point before = std::chrono::system_clock::now();
+    std::vector<std::chrono::system_clock::time_point> times;
+    ASSERT_EQ(read_many(buf.get(), 4, [this, &times](topic_id_size_t, uint8_t *, size_t) {
+        times.push_back(get_receive_time());
+    }), 2);
+    std::chrono::system_clock::time_point after = std::chrono::system_clock::now();
+
+    ASSERT_EQ(times.size(), 2U);
+    ASSERT_GE(times[0], before);
+    ASSERT_LE(times[0], after);
+    ASSERT_EQ(times[1], times[0]);
+
+    // A read that returns nothing leaves it alone.
+    ASSERT_EQ(read_many(buf.get(), 4, [](topic_id_size_t, uint8_t *, size_t) {}), 0);
+    ASSERT_EQ(get_receive_time(), times[0]);
+}
+
+TEST_F(PX4TransporterFixture, flow_control)
+{
+    uint8_t buf[]{0x5, 0x1, 0x2, 0x3};
+    size_t frame_len = setup_px4_test_data().size();
+
+    // Credits are ignored until flow control is enabled.
+    std::vector<uint8_t> credits = setup_flow_credits(100, frame_len * 2);
+    ASSERT_EQ(handle_flow_credits(credits.data(), credits.size()), -1);
+
+    int notified = 0;
+    set_credit_notify([&notified]() {notified++;});
+    set_flow_control(true);
+    ASSERT_TRUE(get_flow_control());
+
+    // Nothing can be written before the first grant.
+    ASSERT_EQ(get_credits(), 0U);
+    errno = 0;
+    ASSERT_EQ(write(0xa, buf, sizeof(buf)), -1);
+    ASSERT_EQ(errno, EBUSY);
+    ASSERT_TRUE(waiting_for_credits());
+    ASSERT_EQ(write_count_, 0U);
+
+    // The first grant says nothing is on the way, whatever the other end
+    // has received before.
+    ASSERT_EQ(handle_flow_credits(credits.data(), credits.size()), 0);
+    ASSERT_EQ(notified, 1);
+    ASSERT_EQ(get_credits(), frame_len * 2);
+    ASSERT_EQ(write(0xa, buf, sizeof(buf)), 4);
+    ASSERT_FALSE(waiting_for_credits());
+    ASSERT_EQ(write(0xa, buf, sizeof(buf)), 4);
+    ASSERT_EQ(get_credits(), 0U);
+    ASSERT_EQ(write(0xa, buf, sizeof(buf)), -1);
+    ASSERT_EQ(errno, EBUSY);
+    ASSERT_EQ(write_count_, 2U);
+
+    // The other end took one frame off the wire.
+    credits = setup_flow_credits(100 + frame_len, frame_len * 2);
+    ASSERT_EQ(handle_flow_credits(credits.data(), credits.size()), 0);
+    ASSERT_EQ(get_credits(), frame_len);
+    ASSERT_EQ(write(0xa, buf, sizeof(buf)), 4);
+    ASSERT_EQ(get_credits(), 0U);
+
+    // A count that went back means the other end was reset, and whatever was
+    // on the way is gone.
+    credits = setup_flow_credits(0, frame_len);
+    ASSERT_EQ(handle_flow_credits(credits.data(), credits.size()), 0);
+    ASSERT_EQ(get_credits(), frame_len);
+    ASSERT_EQ(write(0xa, buf, sizeof(buf)), 4);
+    ASSERT_EQ(write_count_, 4U);
+    ASSERT_EQ(notified, 3);
+
+    // Disabling it lets everything through again.
+    set_flow_control(false);
+    ASSERT_EQ(write(0xa, buf, sizeof(buf)), 4);
+    ASSERT_EQ(write_count_, 5U);
+}
+
+TEST_F(PX4TransporterFixture, flow_credits_invalid)
+{
+    set_flow_control(true);
+
+    std::vector<uint8_t> credits = setup_flow_credits(0, 100);
+    ASSERT_EQ(handle_flow_credits(nullptr, credits.size()), -1);
+    ASSERT_EQ(handle_flow_credits(credits.data(), credits.size() - 1), -1);
+
+    // A LinkCapabilities OFFER isn't a grant.
+    credits[0] = 0;
+    ASSERT_EQ(handle_flow_credits(credits.data(), credits.size()), -1);
+    ASSERT_EQ(get_credits(), 0U);
+}
+
+TEST_F(COBSTransporterFixture, flow_control_worst_case)
+{
+    uint8_t buf[]{0x5, 0x1, 0x2, 0x3};
+    std::vector<uint8_t> frame = setup_cobs_test_data();
+
+    // A frame needs the credits for the worst case of stuffing, and uses up
+    // the ones for what was actually written.
+    set_flow_control(true);
+    std::vector<uint8_t> credits = setup_flow_credits(0, frame.size() - 1);
+    ASSERT_EQ(handle_flow_credits(credits.data(), credits.size()), 0);
+    ASSERT_EQ(write(0xa, buf, sizeof(buf)), -1);
+    ASSERT_EQ(errno, EBUSY);
+
+    credits = setup_flow_credits(0, frame.size() + 2);
+    ASSERT_EQ(handle_flow_credits(credits.data(), credits.size()), 0);
+    ASSERT_EQ(write(0xa, buf, sizeof(buf)), 4);
+    ASSERT_EQ(written_len_, frame.size());
+    ASSERT_EQ(get_credits(), 2U);
+}
+
+TEST_F(PX4TransporterFixture, flow_control_batching)
+{
+    uint8_t buf[]{0x5, 0x1, 0x2, 0x3};
+    size_t frame_len = setup_px4_test_data().size();
+
+    // Frames use up their credits as they go into the batch.
+    ASSERT_EQ(set_write_batching(frame_len * 4), 0);
+    set_flow_control(true);
+    std::vector<uint8_t> credits = setup_flow_credits(0, frame_len * 2);
+    ASSERT_EQ(handle_flow_credits(credits.data(), credits.size()), 0);
+    ASSERT_EQ(write(0xa, buf, sizeof(buf)), 4);
+    ASSERT_EQ(write(0xa, buf, sizeof(buf)), 4);
+    ASSERT_EQ(write(0xa, buf, sizeof(buf)), -1);
+    ASSERT_EQ(errno, EBUSY);
+    ASSERT_EQ(write_count_, 0U);
+    ASSERT_EQ(flush(), static_cast<ssize_t>(frame_len * 2));
+}
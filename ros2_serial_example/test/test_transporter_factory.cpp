@@ -0,0 +1,197 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "ros2_serial_example/transporter.hpp"
+#include "ros2_serial_example/transporter_factory.hpp"
+
+using ros2_to_serial_bridge::transport::Transporter;
+using ros2_to_serial_bridge::transport::TransporterConfig;
+using ros2_to_serial_bridge::transport::TransporterFactory;
+
+/// HELPERS
+
+class TransporterNull : public Transporter
+{
+public:
+    explicit TransporterNull(const std::string & protocol) : Transporter(protocol, 1024)
+    {
+    }
+
+    ssize_t node_read() override
+    {
+        return 0;
+    }
+
+    ssize_t node_write(void *buffer, size_t len) override
+    {
+        (void)buffer;
+        return len;
+    }
+
+    bool fds_OK() override
+    {
+        return true;
+    }
+};
+
+static TransporterConfig make_config()
+{
+    TransporterConfig config;
+    config.protocol = "px4";
+    config.read_poll_ms = 10;
+    config.ring_buffer_size = 1024;
+    config.get_string = [](const std::string & name, std::string * value) {
+        if (name == "shm_name")
+        {
+            *value = "/ros2_serial_test_factory_" + std::to_string(::getpid());
+            return true;
+        }
+        return false;
+    };
+    config.get_int = [](const std::string & name, int64_t * value) {
+        if (name == "udp_recv_port")
+        {
+            *value = 0;
+            return true;
+        }
+        return false;
+    };
+    return config;
+}
+
+/// TESTS
+
+TEST(TransporterFactory, builtin_backends)
+{
+    std::vector<std::string> backends = TransporterFactory::instance().backends();
+    ASSERT_NE(std::find(backends.begin(), backends.end(), "bond"), backends.end());
+    ASSERT_NE(std::find(backends.begin(), backends.end(), "can"), backends.end());
+    ASSERT_NE(std::find(backends.begin(), backends.end(), "usb"), backends.end());
+    ASSERT_NE(std::find(backends.begin(), backends.end(), "replay"), backends.end());
+    ASSERT_NE(std::find(backends.begin(), backends.end(), "shm"), backends.end());
+    ASSERT_NE(std::find(backends.begin(), backends.end(), "tcp"), backends.end());
+    ASSERT_NE(std::find(backends.begin(), backends.end(), "uart"), backends.end());
+    ASSERT_NE(std::find(backends.begin(), backends.end(), "udp"), backends.end());
+}
+
+TEST(TransporterFactory, unknown_backend)
+{
+    ASSERT_THROW(TransporterFactory::instance().create("carrier_pigeon", make_config()), std::runtime_error);
+}
+
+TEST(TransporterFactory, missing_parameters)
+{
+    // No device for the UART, and an out of range port for UDP.
+    ASSERT_THROW(TransporterFactory::instance().create("uart", make_config()), std::runtime_error);
+    ASSERT_THROW(TransporterFactory::instance().create("udp", make_config()), std::runtime_error);
+}
+
+TEST(TransporterFactory, shm)
+{
+    std::unique_ptr<Transporter> trans = TransporterFactory::instance().create("shm", make_config());
+    ASSERT_NE(trans, nullptr);
+    ASSERT_EQ(trans->init(), 0);
+    ASSERT_EQ(trans->close(), 0);
+}
+
+TEST(TransporterFactory, udp_peers)
+{
+    std::vector<std::string> peers;
+    TransporterConfig config = make_config();
+    config.get_int = [](const std::string & name, int64_t * value) {
+        if (name == "udp_recv_port" || name == "udp_send_port")
+        {
+            *value = 2019;
+            return true;
+        }
+        return false;
+    };
+    config.get_string_array = [&peers](const std::string & name, std::vector<std::string> * value) {
+        if (name == "udp_peers")
+        {
+            *value = peers;
+            return true;
+        }
+        return false;
+    };
+
+    peers = {"127.0.0.1:2020", "127.0.0.1:2021:1,2,3"};
+    ASSERT_NE(TransporterFactory::instance().create("udp", config), nullptr);
+
+    for (const char *bad : {"127.0.0.1", ":2020", "127.0.0.1:0", "127.0.0.1:x", "127.0.0.1:2020:",
+                            "127.0.0.1:2020:1,,2", "127.0.0.1:2020:256", "not.an.address:2020"})
+    {
+        peers = {bad};
+        ASSERT_THROW(TransporterFactory::instance().create("udp", config), std::runtime_error) << bad;
+    }
+}
+
+TEST(TransporterFactory, udp_recv_shards)
+{
+    int64_t shards = 0;
+    std::vector<int64_t> cpus;
+    TransporterConfig config = make_config();
+    config.get_int = [&shards](const std::string & name, int64_t * value) {
+        if (name == "udp_recv_port" || name == "udp_send_port")
+        {
+            *value = 2019;
+            return true;
+        }
+        if (name == "udp_recv_shards")
+        {
+            *value = shards;
+            return true;
+        }
+        return false;
+    };
+    config.get_int_array = [&cpus](const std::string & name, std::vector<int64_t> * value) {
+        if (name == "udp_recv_shard_cpus")
+        {
+            *value = cpus;
+            return true;
+        }
+        return false;
+    };
+
+    shards = 1;
+    ASSERT_NE(TransporterFactory::instance().create("udp", config), nullptr);
+    shards = 4;
+    cpus = {0, 1};
+    ASSERT_NE(TransporterFactory::instance().create("udp", config), nullptr);
+
+    cpus = {-1};
+    ASSERT_THROW(TransporterFactory::instance().create("udp", config), std::runtime_error);
+    cpus.clear();
+    for (int64_t bad : {static_cast<int64_t>(0), static_cast<int64_t>(65)})
+    {
+        shards = bad;
+        ASSERT_THROW(TransporterFactory::instance().create("udp", config), std::runtime_error) << bad;
+    }
+}
+
+TEST(TransporterFactory, register_backend)
+{
+    TransporterFactory & factory = TransporterFactory::instance();
+
+    auto creator = [](const TransporterConfig & config) {
+        return std::make_unique<TransporterNull>(config.protocol);
+    };
+    ASSERT_FALSE(factory.register_backend("", creator));
+    ASSERT_FALSE(factory.register_backend("null", nullptr));
+    ASSERT_TRUE(factory.register_backend("null", creator));
+    ASSERT_FALSE(factory.register_backend("null", creator));
+    ASSERT_FALSE(factory.register_backend("udp", creator));
+
+    std::unique_ptr<Transporter> trans = factory.create("null", make_config());
+    ASSERT_NE(trans, nullptr);
+    uint8_t data[1]{0x1};
+    ASSERT_EQ(trans->write(0x5, data, sizeof(data)), 1);
+}
@@ -0,0 +1,719 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ros2_serial_example/time_sync.hpp"
+#include "ros2_serial_example/transporter.hpp"
+#include "ros2_serial_example/tx_queue.hpp"
+
+using ros2_to_serial_bridge::transport::TimeSync;
+using ros2_to_serial_bridge::transport::TxQueue;
+using ros2_to_serial_bridge::transport::impl::FrameQueue;
+
+/// HELPERS
+
+// A transporter that records the last byte of every frame written (which is
+// the payload for the 1 byte payloads used here), and that can be made to
+// block in node_write() to simulate a backed up transport, or claim to have
+// any number of bytes waiting to go out.
+class TransporterRecorder : public ros2_to_serial_bridge::transport::Transporter
+{
+public:
+    explicit TransporterRecorder(const std::string & protocol = "px4") : Transporter(protocol, 1024)
+    {
+    }
+
+    ~TransporterRecorder() override
+    {
+    }
+
+    ssize_t node_read() override
+    {
+        return 0;
+    }
+
+    ssize_t node_write(void *buffer, size_t len) override
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        in_write_ = true;
+        cv_.notify_all();
+        cv_.wait(lock, [this] {return !blocked_;});
+        written_.push_back(static_cast<uint8_t *>(buffer)[len - 1]);
+        written_at_.push_back(now_ns());
+        in_write_ = false;
+        cv_.notify_all();
+        return len;
+    }
+
+    ssize_t node_writev(const struct iovec *iov, int iovcnt) override
+    {
+        // Use the gathering default, which ends up in node_write() above.
+        return Transporter::node_writev(iov, iovcnt);
+    }
+
+    bool fds_OK() override
+    {
+        return true;
+    }
+
+    ssize_t get_write_queue_bytes() const override
+    {
+        return queue_bytes_;
+    }
+
+    void set_write_queue_bytes(ssize_t bytes)
+    {
+        queue_bytes_ = bytes;
+    }
+
+    void block()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        blocked_ = true;
+    }
+
+    void unblock()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        blocked_ = false;
+        cv_.notify_all();
+    }
+
+    bool wait_for_write_started()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return cv_.wait_for(lock, std::chrono::seconds(5), [this] {return in_write_;});
+    }
+
+    bool wait_for_written(size_t count)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return cv_.wait_for(lock, std::chrono::seconds(5), [this, count] {return written_.size() >= count;});
+    }
+
+    std::vector<uint8_t> written()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return written_;
+    }
+
+    // When each frame was written, in system clock nanoseconds.
+    std::vector<int64_t> written_at()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return written_at_;
+    }
+
+    static int64_t now_ns()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool blocked_{false};
+    bool in_write_{false};
+    std::vector<uint8_t> written_;
+    std::vector<int64_t> written_at_;
+    std::atomic<ssize_t> queue_bytes_{-1};
+};
+
+/// FRAMEQUEUE TESTS
+
+TEST(FrameQueue, zero_capacity)
+{
+    ASSERT_THROW(FrameQueue q(0), std::runtime_error);
+}
+
+TEST(FrameQueue, push_pop)
+{
+    FrameQueue q(2);
+    ASSERT_EQ(q.capacity(), 2U);
+
+    std::vector<uint8_t> out;
+    ASSERT_FALSE(q.try_pop(&out));
+
+    uint8_t a[]{0x1, 0x2, 0x3};
+    uint8_t b[]{0x4};
+    uint8_t c[]{0x5, 0x6};
+    ASSERT_TRUE(q.try_push(a, sizeof(a)));
+    ASSERT_TRUE(q.try_push(b, sizeof(b)));
+    ASSERT_FALSE(q.try_push(c, sizeof(c)));
+
+    ASSERT_TRUE(q.try_pop(&out));
+    ASSERT_EQ(out, std::vector<uint8_t>({0x1, 0x2, 0x3}));
+
+    // Now that there is room, wrap around the end of the slots.
+    ASSERT_TRUE(q.try_push(c, sizeof(c)));
+
+    ASSERT_TRUE(q.try_pop(&out));
+    ASSERT_EQ(out, std::vector<uint8_t>({0x4}));
+    ASSERT_TRUE(q.try_pop(&out));
+    ASSERT_EQ(out, std::vector<uint8_t>({0x5, 0x6}));
+    ASSERT_FALSE(q.try_pop(&out));
+}
+
+TEST(FrameQueue, empty)
+{
+    FrameQueue q(2);
+    ASSERT_TRUE(q.empty());
+
+    uint8_t a[]{0x1};
+    ASSERT_TRUE(q.try_push(a, sizeof(a)));
+    ASSERT_FALSE(q.empty());
+    ASSERT_TRUE(q.try_pop(nullptr));
+    ASSERT_TRUE(q.empty());
+}
+
+TEST(FrameQueue, size)
+{
+    FrameQueue q(2);
+    ASSERT_EQ(q.size(), 0U);
+
+    uint8_t a[]{0x1};
+    ASSERT_TRUE(q.try_push(a, sizeof(a)));
+    ASSERT_TRUE(q.try_push(a, sizeof(a)));
+    ASSERT_EQ(q.size(), 2U);
+    ASSERT_TRUE(q.try_pop(nullptr));
+    ASSERT_EQ(q.size(), 1U);
+}
+
+TEST(FrameQueue, pop_without_output)
+{
+    FrameQueue q(1);
+
+    uint8_t a[]{0x1};
+    ASSERT_TRUE(q.try_push(a, sizeof(a)));
+    ASSERT_TRUE(q.try_pop(nullptr));
+    ASSERT_FALSE(q.try_pop(nullptr));
+}
+
+TEST(FrameQueue, push_swap)
+{
+    FrameQueue q(1);
+
+    std::vector<uint8_t> in{0x1, 0x2};
+    const uint8_t *in_data = in.data();
+    ASSERT_TRUE(q.try_push(&in));
+
+    // The queue is full, so a second payload is left untouched.
+    std::vector<uint8_t> in2{0x3};
+    ASSERT_FALSE(q.try_push(&in2));
+    ASSERT_EQ(in2, std::vector<uint8_t>({0x3}));
+
+    // The payload buffer itself went through the queue, not a copy of it.
+    std::vector<uint8_t> out;
+    ASSERT_TRUE(q.try_pop(&out));
+    ASSERT_EQ(out, std::vector<uint8_t>({0x1, 0x2}));
+    ASSERT_EQ(out.data(), in_data);
+}
+
+TEST(FrameQueue, stamps)
+{
+    FrameQueue q(2);
+    std::chrono::steady_clock::time_point a = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point b = a + std::chrono::milliseconds(5);
+
+    uint8_t data[]{0x1};
+    std::vector<uint8_t> in{0x2};
+    ASSERT_TRUE(q.try_push(data, sizeof(data), a));
+    ASSERT_TRUE(q.try_push(&in, b));
+
+    std::vector<uint8_t> out;
+    std::chrono::steady_clock::time_point stamp;
+    ASSERT_TRUE(q.try_pop(&out, &stamp));
+    ASSERT_EQ(stamp, a);
+    ASSERT_TRUE(q.try_pop(&out, &stamp));
+    ASSERT_EQ(stamp, b);
+}
+
+/// TXQUEUE TESTS
+
+TEST(TxQueue, nullptr_transporter)
+{
+    ASSERT_THROW(TxQueue q(nullptr), std::runtime_error);
+}
+
+TEST(TxQueue, add_topic)
+{
+    TransporterRecorder trans;
+    TxQueue q(&trans);
+
+    ASSERT_EQ(q.add_topic(0x2, 0, TxQueue::OverflowPolicy::DROP_OLDEST), -1);
+    ASSERT_EQ(q.add_topic(0x2, 4, TxQueue::OverflowPolicy::DROP_OLDEST), 0);
+    ASSERT_EQ(q.add_topic(0x2, 4, TxQueue::OverflowPolicy::DROP_OLDEST), -1);
+    ASSERT_TRUE(q.has_topic(0x2));
+    ASSERT_FALSE(q.has_topic(0x3));
+    ASSERT_EQ(q.get_queue_depth(0x2), 0);
+    ASSERT_EQ(q.get_queue_depth(0x3), -1);
+
+    q.start();
+    ASSERT_EQ(q.add_topic(0x3, 4, TxQueue::OverflowPolicy::DROP_OLDEST), -1);
+}
+
+TEST(TxQueue, reserve_payloads)
+{
+    TransporterRecorder trans;
+    TxQueue q(&trans);
+    ASSERT_EQ(q.add_topic(0x2, 4, TxQueue::OverflowPolicy::DROP_OLDEST), 0);
+    ASSERT_EQ(q.reserve_payloads(256), 0);
+    q.start();
+    ASSERT_EQ(q.reserve_payloads(256), -1);
+
+    std::vector<uint8_t> payload(200, 0x5);
+    payload.back() = 0x7;
+    ASSERT_EQ(q.write(0x2, payload.data(), payload.size()), 200);
+    ASSERT_TRUE(trans.wait_for_written(1));
+    ASSERT_EQ(trans.written(), std::vector<uint8_t>({0x7}));
+}
+
+TEST(TxQueue, not_started)
+{
+    TransporterRecorder trans;
+    TxQueue q(&trans);
+    ASSERT_EQ(q.add_topic(0x2, 4, TxQueue::OverflowPolicy::DROP_OLDEST), 0);
+
+    uint8_t a[]{0x1};
+    ASSERT_EQ(q.write(0x2, a, sizeof(a)), -1);
+    ASSERT_EQ(errno, ESHUTDOWN);
+}
+
+TEST(TxQueue, unqueued_topic_is_synchronous)
+{
+    TransporterRecorder trans;
+    TxQueue q(&trans);
+
+    uint8_t a[]{0x1};
+    ASSERT_EQ(q.write(0x2, a, sizeof(a)), 1);
+    ASSERT_EQ(trans.written(), std::vector<uint8_t>({0x1}));
+}
+
+TEST(TxQueue, queued_topic)
+{
+    TransporterRecorder trans;
+    TxQueue q(&trans);
+    ASSERT_EQ(q.add_topic(0x2, 16, TxQueue::OverflowPolicy::DROP_NEWEST), 0);
+    q.start();
+
+    for (uint8_t i = 0; i < 10; ++i)
+    {
+        ASSERT_EQ(q.write(0x2, &i, 1), 1);
+    }
+
+    ASSERT_TRUE(trans.wait_for_written(10));
+    ASSERT_EQ(trans.written(), std::vector<uint8_t>({0, 1, 2, 3, 4, 5, 6, 7, 8, 9}));
+    ASSERT_EQ(q.get_dropped(), 0U);
+}
+
+TEST(TxQueue, drop_newest)
+{
+    TransporterRecorder trans;
+    TxQueue q(&trans);
+    ASSERT_EQ(q.add_topic(0x2, 2, TxQueue::OverflowPolicy::DROP_NEWEST), 0);
+    q.start();
+
+    // Get the writer thread stuck writing the first payload.
+    trans.block();
+    uint8_t data[]{0x0, 0x1, 0x2, 0x3, 0x4};
+    ASSERT_EQ(q.write(0x2, &data[0], 1), 1);
+    ASSERT_TRUE(trans.wait_for_write_started());
+
+    // That leaves room for two more, and the rest are dropped.
+    ASSERT_EQ(q.write(0x2, &data[1], 1), 1);
+    ASSERT_EQ(q.write(0x2, &data[2], 1), 1);
+    ASSERT_EQ(q.write(0x2, &data[3], 1), -1);
+    ASSERT_EQ(errno, ENOBUFS);
+    ASSERT_EQ(q.write(0x2, &data[4], 1), -1);
+    ASSERT_EQ(q.get_dropped(), 2U);
+
+    trans.unblock();
+    ASSERT_TRUE(trans.wait_for_written(3));
+    ASSERT_EQ(trans.written(), std::vector<uint8_t>({0x0, 0x1, 0x2}));
+}
+
+TEST(TxQueue, drop_oldest)
+{
+    TransporterRecorder trans;
+    TxQueue q(&trans);
+    ASSERT_EQ(q.add_topic(0x2, 2, TxQueue::OverflowPolicy::DROP_OLDEST), 0);
+    q.start();
+
+    // Get the writer thread stuck writing the first payload.
+    trans.block();
+    uint8_t data[]{0x0, 0x1, 0x2, 0x3, 0x4};
+    ASSERT_EQ(q.write(0x2, &data[0], 1), 1);
+    ASSERT_TRUE(trans.wait_for_write_started());
+
+    // Everything is accepted, but only the newest two are kept.
+    for (size_t i = 1; i < sizeof(data); ++i)
+    {
+        ASSERT_EQ(q.write(0x2, &data[i], 1), 1);
+    }
+    ASSERT_EQ(q.get_dropped(), 2U);
+
+    trans.unblock();
+    ASSERT_TRUE(trans.wait_for_written(3));
+    ASSERT_EQ(trans.written(), std::vector<uint8_t>({0x0, 0x3, 0x4}));
+}
+
+TEST(TxQueue, round_robin)
+{
+    TransporterRecorder trans;
+    TxQueue q(&trans);
+    ASSERT_EQ(q.add_topic(0x2, 8, TxQueue::OverflowPolicy::DROP_NEWEST), 0);
+    ASSERT_EQ(q.add_topic(0x3, 8, TxQueue::OverflowPolicy::DROP_NEWEST), 0);
+    q.start();
+
+    // Get the writer thread stuck writing the first payload, then fill up
+    // one topic before the other.
+    trans.block();
+    uint8_t first{0xff};
+    ASSERT_EQ(q.write(0x2, &first, 1), 1);
+    ASSERT_TRUE(trans.wait_for_write_started());
+
+    uint8_t data2[]{0x20, 0x21, 0x22};
+    uint8_t data3[]{0x30, 0x31, 0x32};
+    for (uint8_t & d : data2)
+    {
+        ASSERT_EQ(q.write(0x2, &d, 1), 1);
+    }
+    for (uint8_t & d : data3)
+    {
+        ASSERT_EQ(q.write(0x3, &d, 1), 1);
+    }
+
+    // The writer was in the middle of a pass when it got stuck on topic 0x2,
+    // so it carries on with topic 0x3 before coming back around.
+    trans.unblock();
+    ASSERT_TRUE(trans.wait_for_written(7));
+    ASSERT_EQ(trans.written(), std::vector<uint8_t>({0xff, 0x30, 0x20, 0x31, 0x21, 0x32, 0x22}));
+}
+
+TEST(TxQueue, priority)
+{
+    TransporterRecorder trans;
+    TxQueue q(&trans);
+    ASSERT_EQ(q.add_topic(0x2, 8, TxQueue::OverflowPolicy::DROP_NEWEST), 0);
+    ASSERT_EQ(q.add_topic(0x3, 8, TxQueue::OverflowPolicy::DROP_NEWEST), 0);
+    ASSERT_EQ(q.set_priority(0x4, 1), -1);
+    ASSERT_EQ(q.set_priority(0x3, 1), 0);
+    q.start();
+    ASSERT_EQ(q.set_priority(0x3, 2), -1);
+
+    // Get the writer thread stuck writing a low priority payload, then queue
+    // up more low priority payloads before the high priority ones.
+    trans.block();
+    uint8_t first{0xff};
+    ASSERT_EQ(q.write(0x2, &first, 1), 1);
+    ASSERT_TRUE(trans.wait_for_write_started());
+
+    uint8_t data2[]{0x20, 0x21, 0x22};
+    uint8_t data3[]{0x30, 0x31, 0x32};
+    for (uint8_t & d : data2)
+    {
+        ASSERT_EQ(q.write(0x2, &d, 1), 1);
+    }
+    for (uint8_t & d : data3)
+    {
+        ASSERT_EQ(q.write(0x3, &d, 1), 1);
+    }
+
+    // All of the high priority payloads go first.
+    trans.unblock();
+    ASSERT_TRUE(trans.wait_for_written(7));
+    ASSERT_EQ(trans.written(), std::vector<uint8_t>({0xff, 0x30, 0x31, 0x32, 0x20, 0x21, 0x22}));
+}
+
+TEST(TxQueue, fragments_interleaved)
+{
+    TransporterRecorder trans("v2");
+    ASSERT_EQ(trans.set_fragment_size(32), 0);
+    TxQueue q(&trans);
+    ASSERT_EQ(q.add_topic(0x2, 8, TxQueue::OverflowPolicy::DROP_NEWEST), 0);
+    ASSERT_EQ(q.add_topic(0x3, 8, TxQueue::OverflowPolicy::DROP_NEWEST), 0);
+    ASSERT_EQ(q.set_priority(0x3, 1), 0);
+    q.start();
+
+    // Get the writer thread stuck writing the first fragment of a long low
+    // priority payload, which goes out as four fragments.
+    trans.block();
+    std::vector<uint8_t> large(100, 0xaa);
+    ASSERT_EQ(q.write(0x2, large.data(), large.size()), static_cast<ssize_t>(large.size()));
+    ASSERT_TRUE(trans.wait_for_write_started());
+
+    uint8_t data3[]{0x30, 0x31};
+    for (uint8_t & d : data3)
+    {
+        ASSERT_EQ(q.write(0x3, &d, 1), 1);
+    }
+
+    // The high priority payloads go before the rest of the fragments.
+    trans.unblock();
+    ASSERT_TRUE(trans.wait_for_written(6));
+    ASSERT_EQ(trans.written(), std::vector<uint8_t>({0xaa, 0x30, 0x31, 0xaa, 0xaa, 0xaa}));
+}
+
+TEST(TxQueue, max_rate)
+{
+    TransporterRecorder trans;
+    TxQueue q(&trans);
+    ASSERT_EQ(q.add_topic(0x2, 1, TxQueue::OverflowPolicy::DROP_OLDEST), 0);
+    ASSERT_EQ(q.set_max_rate(0x3, 10.0), -1);
+    ASSERT_EQ(q.set_max_rate(0x2, -1.0), -1);
+    ASSERT_EQ(q.set_max_rate(0x2, 20.0), 0);
+    q.start();
+    ASSERT_EQ(q.set_max_rate(0x2, 10.0), -1);
+
+    uint8_t data[]{0x1, 0x2, 0x3};
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    ASSERT_EQ(q.write(0x2, &data[0], 1), 1);
+    ASSERT_TRUE(trans.wait_for_written(1));
+
+    // The next payloads are held back until 50ms after the first, and only
+    // the latest of them is sent.
+    ASSERT_EQ(q.write(0x2, &data[1], 1), 1);
+    ASSERT_EQ(q.write(0x2, &data[2], 1), 1);
+    ASSERT_TRUE(trans.wait_for_written(2));
+    ASSERT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(45));
+    ASSERT_EQ(trans.written(), std::vector<uint8_t>({0x1, 0x3}));
+    ASSERT_EQ(q.get_dropped(), 1U);
+}
+
+TEST(TxQueue, max_age)
+{
+    TransporterRecorder trans;
+    TxQueue q(&trans);
+    ASSERT_EQ(q.add_topic(0x2, 8, TxQueue::OverflowPolicy::DROP_NEWEST), 0);
+    ASSERT_EQ(q.set_max_age(0x3, 20), -1);
+    ASSERT_EQ(q.set_max_age(0x2, 20), 0);
+    q.start();
+    ASSERT_EQ(q.set_max_age(0x2, 10), -1);
+
+    // Get the writer thread stuck long enough for the payloads queued behind
+    // the first one to go stale.
+    trans.block();
+    uint8_t first{0xff};
+    ASSERT_EQ(q.write(0x2, &first, 1), 1);
+    ASSERT_TRUE(trans.wait_for_write_started());
+
+    uint8_t data[]{0x20, 0x21, 0x22};
+    for (uint8_t & d : data)
+    {
+        ASSERT_EQ(q.write(0x2, &d, 1), 1);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    uint8_t fresh{0x23};
+    ASSERT_EQ(q.write(0x2, &fresh, 1), 1);
+
+    // Only the payload that was still fresh goes out after the first.
+    trans.unblock();
+    ASSERT_TRUE(trans.wait_for_written(2));
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    ASSERT_EQ(trans.written(), std::vector<uint8_t>({0xff, 0x23}));
+
+    ros2_to_serial_bridge::transport::Metrics::Snapshot snapshot;
+    trans.get_metrics().snapshot(&snapshot);
+    ASSERT_EQ(snapshot.tx.size(), 1U);
+    ASSERT_EQ(snapshot.tx[0].stale_drops, 3U);
+    ASSERT_EQ(q.get_dropped(), 0U);
+}
+
+TEST(TxQueue, flush_delay)
+{
+    TransporterRecorder trans;
+    ASSERT_EQ(trans.set_write_batching(256), 0);
+    TxQueue q(&trans);
+    ASSERT_EQ(q.set_flush_delay(1000), 0);
+    q.start();
+    ASSERT_EQ(q.set_flush_delay(1000), -1);
+
+    // Both frames fit in the batch, so nothing is written until the writer
+    // thread flushes it after the delay, in a single write.
+    uint8_t a[]{0x1};
+    uint8_t b[]{0x2};
+    ASSERT_EQ(q.write(0x2, a, sizeof(a)), 1);
+    ASSERT_EQ(q.write(0x2, b, sizeof(b)), 1);
+
+    ASSERT_TRUE(trans.wait_for_written(1));
+    ASSERT_EQ(trans.written(), std::vector<uint8_t>({0x2}));
+    ASSERT_EQ(trans.get_pending_write_bytes(), 0U);
+}
+
+TEST(TxQueue, write_vector)
+{
+    TransporterRecorder trans;
+    TxQueue q(&trans);
+    ASSERT_EQ(q.add_topic(0x2, 4, TxQueue::OverflowPolicy::DROP_NEWEST), 0);
+
+    std::vector<uint8_t> payload{0x5};
+    ASSERT_EQ(q.write(0x2, &payload), -1);
+    ASSERT_EQ(errno, ESHUTDOWN);
+    ASSERT_EQ(payload, std::vector<uint8_t>({0x5}));
+
+    // Topics without a queue are written synchronously and keep the payload.
+    ASSERT_EQ(q.write(0x3, &payload), 1);
+    ASSERT_EQ(payload, std::vector<uint8_t>({0x5}));
+    ASSERT_EQ(trans.written(), std::vector<uint8_t>({0x5}));
+
+    q.start();
+    ASSERT_EQ(q.write(0x2, &payload), 1);
+    ASSERT_TRUE(trans.wait_for_written(2));
+    ASSERT_EQ(trans.written(), std::vector<uint8_t>({0x5, 0x5}));
+}
+
+TEST(TxQueue, flow_control)
+{
+    TransporterRecorder trans;
+    trans.set_flow_control(true);
+    TxQueue q(&trans);
+    ASSERT_EQ(q.add_topic(0x2, 4, TxQueue::OverflowPolicy::DROP_NEWEST), 0);
+    q.start();
+
+    // A 1 byte payload is a 10 byte PX4 frame.  Nothing goes out until the
+    // other end grants credits.
+    uint8_t data[]{0x0, 0x1, 0x2};
+    for (size_t i = 0; i < sizeof(data); ++i)
+    {
+        ASSERT_EQ(q.write(0x2, &data[i], 1), 1);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    ASSERT_TRUE(trans.written().empty());
+
+    std::vector<uint8_t> credits(12, 0);
+    credits[0] = ros2_to_serial_bridge::transport::Transporter::FLOW_CREDITS_KIND;
+    credits[8] = 20;
+    ASSERT_EQ(trans.handle_flow_credits(credits.data(), credits.size()), 0);
+    ASSERT_TRUE(trans.wait_for_written(2));
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    ASSERT_EQ(trans.written(), std::vector<uint8_t>({0x0, 0x1}));
+
+    // The other end took the two frames off the wire.
+    credits[4] = 20;
+    ASSERT_EQ(trans.handle_flow_credits(credits.data(), credits.size()), 0);
+    ASSERT_TRUE(trans.wait_for_written(3));
+    ASSERT_EQ(trans.written(), std::vector<uint8_t>({0x0, 0x1, 0x2}));
+    ASSERT_EQ(q.get_dropped(), 0U);
+
+    q.stop();
+}
+
+TEST(TxQueue, congestion_control)
+{
+    TransporterRecorder trans;
+    TxQueue q(&trans);
+    ASSERT_EQ(q.add_topic(0x2, 8, TxQueue::OverflowPolicy::DROP_NEWEST), 0);
+    ASSERT_EQ(q.add_topic(0x3, 8, TxQueue::OverflowPolicy::DROP_NEWEST), 0);
+    ASSERT_EQ(q.set_priority(0x3, 1), 0);
+    ASSERT_EQ(q.set_congestion_control(5000, 0), -1);
+    ASSERT_EQ(q.set_congestion_control(5000, 20000), 0);
+    ASSERT_EQ(q.get_shed_priorities(), 0U);
+
+    // The transport has far more waiting than it sends in the target delay,
+    // so the low priority is held back once the high priority payloads have
+    // shown how fast it sends.
+    trans.set_write_queue_bytes(1000000);
+    q.start();
+    ASSERT_EQ(q.set_congestion_control(0, 0), -1);
+    uint8_t high{0x30};
+    for (int i = 0; i < 2000 && q.get_shed_priorities() == 0; ++i)
+    {
+        ASSERT_EQ(q.write(0x3, &high, 1), 1);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    ASSERT_EQ(q.get_shed_priorities(), 1U);
+    ASSERT_GT(q.get_congestion_delay_us(), 5000);
+
+    uint8_t low{0x20};
+    ASSERT_EQ(q.write(0x2, &low, 1), 1);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    std::vector<uint8_t> written = trans.written();
+    ASSERT_EQ(std::count(written.begin(), written.end(), low), 0);
+
+    // Once the transport has caught up, the low priority goes out again.
+    trans.set_write_queue_bytes(0);
+    ASSERT_TRUE(trans.wait_for_written(written.size() + 1));
+    ASSERT_EQ(trans.written().back(), low);
+    ASSERT_EQ(q.get_shed_priorities(), 0U);
+
+    q.stop();
+}
+
+TEST(TxQueue, tx_slot)
+{
+    TransporterRecorder trans;
+    TxQueue q(&trans);
+    ASSERT_EQ(q.add_topic(0x2, 16, TxQueue::OverflowPolicy::DROP_NEWEST), 0);
+    ASSERT_EQ(q.set_tx_slot(20000, 20000, 5000, 0), -1);
+    ASSERT_EQ(q.set_tx_slot(20000, 0, 0, 0), -1);
+    ASSERT_EQ(q.set_tx_slot(20000, 0, 20001, 0), -1);
+    ASSERT_EQ(q.set_tx_slot(20000, 0, 5000, 2500), -1);
+    ASSERT_EQ(q.set_tx_slot(20000, 5000, 5000, 500), 0);
+    q.start();
+    ASSERT_EQ(q.set_tx_slot(0, 0, 0, 0), -1);
+
+    // Payloads queued all through the cycle only go out between 5.5 ms and
+    // 9.5 ms into it, give or take the time to wake the writer thread up.
+    uint8_t data[]{0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7, 0x8, 0x9, 0xa};
+    for (uint8_t & d : data)
+    {
+        ASSERT_EQ(q.write(0x2, &d, 1), 1);
+        std::this_thread::sleep_for(std::chrono::milliseconds(3));
+    }
+    ASSERT_TRUE(trans.wait_for_written(sizeof(data)));
+    ASSERT_EQ(trans.written(), std::vector<uint8_t>(data, data + sizeof(data)));
+    for (int64_t at : trans.written_at())
+    {
+        int64_t pos = at % 20000000;
+        ASSERT_GE(pos, 5500000);
+        ASSERT_LT(pos, 10500000);
+    }
+
+    q.stop();
+}
+
+TEST(TxQueue, tx_slot_device_clock)
+{
+    TransporterRecorder trans;
+    TimeSync sync;
+    TxQueue q(&trans);
+    ASSERT_EQ(q.add_topic(0x2, 16, TxQueue::OverflowPolicy::DROP_NEWEST), 0);
+    ASSERT_EQ(q.set_tx_slot(20000, 0, 5000, 500, &sync), 0);
+    q.start();
+
+    // Nothing goes out until the clocks are synchronized.
+    uint8_t first{0x1};
+    ASSERT_EQ(q.write(0x2, &first, 1), 1);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    ASSERT_TRUE(trans.written().empty());
+
+    // The device clock is 7 ms behind, so the slot is 7 to 12 ms into the
+    // cycle of the system clock.
+    int64_t now = TransporterRecorder::now_ns();
+    ASSERT_TRUE(sync.sample(now, now - 7000000, now - 7000000, now));
+    uint8_t data[]{0x2, 0x3, 0x4, 0x5, 0x6};
+    for (uint8_t & d : data)
+    {
+        ASSERT_EQ(q.write(0x2, &d, 1), 1);
+        std::this_thread::sleep_for(std::chrono::milliseconds(7));
+    }
+    ASSERT_TRUE(trans.wait_for_written(1 + sizeof(data)));
+    for (int64_t at : trans.written_at())
+    {
+        int64_t pos = at % 20000000;
+        ASSERT_GE(pos, 7500000);
+        ASSERT_LT(pos, 12500000);
+    }
+
+    q.stop();
+}
@@ -0,0 +1,54 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include "ros2_serial_example/type_plugin.hpp"
+
+using ros2_to_serial_bridge::pubsub::TypePlugin;
+using ros2_to_serial_bridge::pubsub::load_type_plugin;
+
+/// TESTS
+
+TEST(TypePlugin, load)
+{
+    std::string error;
+    const TypePlugin * plugin = load_type_plugin(FAKE_TYPE_PLUGIN, &error);
+    ASSERT_NE(plugin, nullptr) << error;
+    ASSERT_NE(plugin->pub_factory, nullptr);
+    ASSERT_NE(plugin->sub_factory, nullptr);
+    bool bounded = false;
+    ASSERT_EQ(plugin->max_serialized_size(&bounded), 24U);
+    ASSERT_TRUE(bounded);
+    ASSERT_EQ(plugin->fixed_size(), 0U);
+
+    // Loading it again gives back the same plugin.
+    ASSERT_EQ(load_type_plugin(FAKE_TYPE_PLUGIN, &error), plugin);
+}
+
+TEST(TypePlugin, missing_library)
+{
+    std::string error;
+    ASSERT_EQ(load_type_plugin("libros2_serial_type_no_such_type.so", &error), nullptr);
+    ASSERT_FALSE(error.empty());
+}
+
+TEST(TypePlugin, not_a_plugin)
+{
+    std::string error;
+    ASSERT_EQ(load_type_plugin("libc.so.6", &error), nullptr);
+    ASSERT_NE(error.find("not a type plugin"), std::string::npos);
+}
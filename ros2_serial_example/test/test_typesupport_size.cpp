@@ -0,0 +1,40 @@
+#include <gtest/gtest.h>
+
+#include <cstddef>
+
+#include "ros2_serial_example/typesupport_size.hpp"
+
+using ros2_to_serial_bridge::pubsub::max_serialized_size;
+
+/// HELPERS
+
+// The two signatures that rosidl_typesupport_fastrtps_cpp generates, for a
+// bounded and an unbounded type.
+size_t bounded_max_size(bool & full_bounded, size_t current_alignment)
+{
+    (void)full_bounded;
+    return current_alignment + 16;
+}
+
+size_t unbounded_max_size(bool & full_bounded, bool & is_plain, size_t current_alignment)
+{
+    full_bounded = false;
+    is_plain = false;
+    return current_alignment + 4;
+}
+
+/// TESTS
+
+TEST(TypesupportSize, bounded)
+{
+    bool bounded = false;
+    ASSERT_EQ(max_serialized_size(bounded_max_size, &bounded), 16U);
+    ASSERT_TRUE(bounded);
+}
+
+TEST(TypesupportSize, unbounded)
+{
+    bool bounded = true;
+    ASSERT_EQ(max_serialized_size(unbounded_max_size, &bounded), 4U);
+    ASSERT_FALSE(bounded);
+}
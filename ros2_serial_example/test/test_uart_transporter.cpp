@@ -0,0 +1,288 @@
+#include <gtest/gtest.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "ros2_serial_example/uart_transporter.hpp"
+
+using ros2_to_serial_bridge::transport::UARTTransporter;
+
+/// HELPERS
+
+// A pseudo-terminal to stand in for a serial port; the transporter opens the
+// slave side, and the test talks to it through the master side.
+class UARTTransporterFixture : public testing::Test
+{
+public:
+    void SetUp() override
+    {
+        open_master();
+    }
+
+    void TearDown() override
+    {
+        ::close(master_fd_);
+    }
+
+protected:
+    void open_master()
+    {
+        master_fd_ = ::posix_openpt(O_RDWR | O_NOCTTY);
+        ASSERT_GE(master_fd_, 0);
+        ASSERT_EQ(::grantpt(master_fd_), 0);
+        ASSERT_EQ(::unlockpt(master_fd_), 0);
+        slave_name_ = ::ptsname(master_fd_);
+
+        // Keep the master side from echoing or translating anything.
+        struct termios tio{};
+        ASSERT_EQ(::tcgetattr(master_fd_, &tio), 0);
+        ::cfmakeraw(&tio);
+        ASSERT_EQ(::tcsetattr(master_fd_, TCSANOW, &tio), 0);
+    }
+
+    int master_fd_{-1};
+    std::string slave_name_;
+};
+
+/// TESTS
+
+TEST_F(UARTTransporterFixture, round_trip)
+{
+    UARTTransporter trans(slave_name_, "px4", 115200, 10, 1024);
+    ASSERT_EQ(trans.set_flow_control(false), 0);
+    ASSERT_EQ(trans.init(), 0);
+    ASSERT_EQ(trans.set_flow_control(true), -1);
+
+    uint8_t payload[]{0x1, 0x2, 0x3};
+    ASSERT_EQ(trans.write(0x4, payload, sizeof(payload)), 3);
+
+    // Loop the frame straight back to the transporter.
+    uint8_t frame[64];
+    ssize_t len = ::read(master_fd_, frame, sizeof(frame));
+    ASSERT_GT(len, static_cast<ssize_t>(sizeof(payload)));
+    ASSERT_EQ(::write(master_fd_, frame, len), len);
+
+    topic_id_size_t topic_ID = 0;
+    uint8_t buf[16];
+    ssize_t ret = -ENODATA;
+    for (int i = 0; i < 100 && ret == -ENODATA; ++i)
+    {
+        ret = trans.read(&topic_ID, buf, sizeof(buf));
+    }
+    ASSERT_EQ(ret, 3);
+    ASSERT_EQ(topic_ID, 0x4);
+    ASSERT_EQ(std::vector<uint8_t>(buf, buf + 3), std::vector<uint8_t>(payload, payload + 3));
+}
+
+TEST_F(UARTTransporterFixture, custom_baudrate)
+{
+    // Not a standard rate, so this goes through termios2.
+    UARTTransporter trans(slave_name_, "px4", 3000007, 10, 1024);
+    ASSERT_EQ(trans.init(), 0);
+
+    int fd = ::open(slave_name_.c_str(), O_RDWR | O_NOCTTY);
+    ASSERT_GE(fd, 0);
+    struct termios tio{};
+    ASSERT_EQ(::tcgetattr(fd, &tio), 0);
+    ::close(fd);
+    // This is BOTHER from <asm/termbits.h>, which can't be included here.
+    ASSERT_EQ(tio.c_cflag & CBAUD, static_cast<tcflag_t>(0010000));
+}
+
+TEST_F(UARTTransporterFixture, low_latency)
+{
+    // Pseudo-terminals don't support TIOCSSERIAL, which is only a warning.
+    UARTTransporter trans(slave_name_, "cobs", 115200, 10, 1024);
+    ASSERT_EQ(trans.set_low_latency(true), 0);
+    ASSERT_EQ(trans.init(), 0);
+    ASSERT_EQ(trans.set_low_latency(false), -1);
+}
+
+TEST_F(UARTTransporterFixture, arrival_estimate)
+{
+    // At 9600 baud, a byte takes 10 / 9600 seconds.
+    UARTTransporter trans(slave_name_, "px4", 9600, 10, 1024);
+    ASSERT_EQ(trans.set_arrival_estimate(true), 0);
+    ASSERT_EQ(trans.init(), 0);
+    ASSERT_EQ(trans.set_arrival_estimate(false), -1);
+
+    uint8_t payload[]{0x1, 0x2, 0x3};
+    ASSERT_EQ(trans.write(0x4, payload, sizeof(payload)), 3);
+    uint8_t frame[64];
+    ssize_t len = ::read(master_fd_, frame, sizeof(frame));
+    ASSERT_GT(len, static_cast<ssize_t>(sizeof(payload)));
+
+    // Both frames come back in one read, so the first is stamped as having
+    // arrived a frame's worth of bytes before the second.
+    uint8_t frames[128];
+    ::memcpy(frames, frame, len);
+    ::memcpy(frames + len, frame, len);
+    ASSERT_EQ(::write(master_fd_, frames, 2 * len), 2 * len);
+
+    std::vector<std::chrono::system_clock::time_point> times;
+    uint8_t buf[16];
+    for (int i = 0; i < 100 && times.size() < 2; ++i)
+    {
+        trans.read_many(buf, sizeof(buf), [&](topic_id_size_t, uint8_t *, size_t)
+        {
+            times.push_back(trans.get_receive_time());
+        });
+    }
+    ASSERT_EQ(times.size(), 2U);
+    ASSERT_EQ(times[1] - times[0], len * std::chrono::nanoseconds(1041666));
+}
+
+TEST_F(UARTTransporterFixture, write_timeout)
+{
+    UARTTransporter trans(slave_name_, "px4", 115200, 10, 1024);
+    ASSERT_EQ(trans.init(), 0);
+    trans.set_write_timeout(10);
+
+    // Nothing reads the master side, so the output queue eventually fills.
+    std::vector<uint8_t> payload(1000, 0x5);
+    ssize_t ret = 0;
+    for (int i = 0; i < 1000 && ret >= 0; ++i)
+    {
+        ret = trans.write(0x1, payload.data(), payload.size());
+    }
+    ASSERT_EQ(ret, -1);
+    ASSERT_EQ(errno, EBUSY);
+    // At most the frame that was being written when the queue filled up.
+    ASSERT_LE(trans.get_partial_writes(), 1U);
+    ASSERT_GE(trans.get_write_queue_bytes(), 0);
+}
+
+TEST_F(UARTTransporterFixture, io_uring)
+{
+    // Falls back to poll() if io_uring isn't available, which works the same.
+    UARTTransporter trans(slave_name_, "px4", 115200, 10, 1024);
+    ASSERT_EQ(trans.set_io_uring(true), 0);
+    ASSERT_EQ(trans.init(), 0);
+    ASSERT_EQ(trans.set_io_uring(false), -1);
+    ASSERT_GE(trans.get_read_fd(), 0);
+
+    uint8_t payload[]{0x1, 0x2, 0x3};
+    ASSERT_EQ(trans.write(0x4, payload, sizeof(payload)), 3);
+
+    uint8_t frame[64];
+    ssize_t len = ::read(master_fd_, frame, sizeof(frame));
+    ASSERT_GT(len, static_cast<ssize_t>(sizeof(payload)));
+    ASSERT_EQ(::write(master_fd_, frame, len), len);
+
+    topic_id_size_t topic_ID = 0;
+    uint8_t buf[16];
+    ssize_t ret = -ENODATA;
+    for (int i = 0; i < 100 && ret == -ENODATA; ++i)
+    {
+        ret = trans.read(&topic_ID, buf, sizeof(buf));
+    }
+    ASSERT_EQ(ret, 3);
+    ASSERT_EQ(topic_ID, 0x4);
+    ASSERT_EQ(std::vector<uint8_t>(buf, buf + 3), std::vector<uint8_t>(payload, payload + 3));
+
+    ASSERT_EQ(trans.close(), 0);
+}
+
+TEST_F(UARTTransporterFixture, rs485)
+{
+    UARTTransporter trans(slave_name_, "px4", 115200, 10, 1024);
+    ASSERT_EQ(trans.set_rs485(true, UARTTransporter::RS485_MAX_DELAY_MS + 1, 0), -1);
+    ASSERT_EQ(trans.set_rs485(true, 0, UARTTransporter::RS485_MAX_DELAY_MS + 1), -1);
+
+    // RTS is the driver enable, so it can't do flow control as well.
+    ASSERT_EQ(trans.set_rs485(true, 1, 1), 0);
+    ASSERT_EQ(trans.set_flow_control(true), 0);
+    ASSERT_EQ(trans.init(), -EINVAL);
+
+    // Pseudo-terminals don't support RS-485, and without it nothing would
+    // get onto the bus, so that is an error.
+    ASSERT_EQ(trans.set_flow_control(false), 0);
+    ASSERT_LT(trans.init(), 0);
+
+    ASSERT_EQ(trans.set_rs485(false, 0, 0), 0);
+    ASSERT_EQ(trans.init(), 0);
+    ASSERT_EQ(trans.set_rs485(true, 0, 0), -1);
+}
+
+TEST_F(UARTTransporterFixture, reconnect)
+{
+    // A link in a directory of its own stands in for /dev/serial/by-id, which
+    // comes and goes along with the device.
+    char dir_template[] = "/tmp/test_uart_transporter_XXXXXX";
+    ASSERT_NE(::mkdtemp(dir_template), nullptr);
+    std::string by_id = std::string(dir_template) + "/by-id";
+    std::string device = by_id + "/usb-Test_Adapter_1234-if00";
+    ASSERT_EQ(::mkdir(by_id.c_str(), 0700), 0);
+    ASSERT_EQ(::symlink(slave_name_.c_str(), device.c_str()), 0);
+
+    UARTTransporter trans(device, "px4", 115200, 10, 1024);
+    ASSERT_EQ(trans.set_reconnect(true), 0);
+    ASSERT_EQ(trans.init(), 0);
+    ASSERT_EQ(trans.set_reconnect(false), -1);
+    ASSERT_TRUE(trans.is_connected());
+    int read_fd = trans.get_read_fd();
+    int write_fd = trans.get_write_fd();
+
+    // Unplug it: the other end hangs up, and the link goes away.
+    ::close(master_fd_);
+    master_fd_ = -1;
+    ASSERT_EQ(::unlink(device.c_str()), 0);
+    ASSERT_EQ(::rmdir(by_id.c_str()), 0);
+
+    topic_id_size_t topic_ID = 0;
+    uint8_t buf[16];
+    for (int i = 0; i < 100 && trans.is_connected(); ++i)
+    {
+        trans.read(&topic_ID, buf, sizeof(buf));
+    }
+    ASSERT_FALSE(trans.is_connected());
+
+    uint8_t payload[]{0x1, 0x2, 0x3};
+    ASSERT_LT(trans.write(0x4, payload, sizeof(payload)), 0);
+
+    // Plug it back in; it comes back as a different terminal.
+    open_master();
+    ASSERT_EQ(::mkdir(by_id.c_str(), 0700), 0);
+    ASSERT_EQ(::symlink(slave_name_.c_str(), device.c_str()), 0);
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 100 && !trans.is_connected(); ++i)
+    {
+        trans.read(&topic_ID, buf, sizeof(buf));
+    }
+    ASSERT_TRUE(trans.is_connected());
+    ASSERT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(1));
+    ASSERT_EQ(trans.get_read_fd(), read_fd);
+    ASSERT_EQ(trans.get_write_fd(), write_fd);
+
+    // And it works as before.
+    ASSERT_EQ(trans.write(0x4, payload, sizeof(payload)), 3);
+    uint8_t frame[64];
+    ssize_t len = ::read(master_fd_, frame, sizeof(frame));
+    ASSERT_GT(len, static_cast<ssize_t>(sizeof(payload)));
+    ASSERT_EQ(::write(master_fd_, frame, len), len);
+
+    ssize_t ret = -ENODATA;
+    for (int i = 0; i < 100 && ret == -ENODATA; ++i)
+    {
+        ret = trans.read(&topic_ID, buf, sizeof(buf));
+    }
+    ASSERT_EQ(ret, 3);
+    ASSERT_EQ(topic_ID, 0x4);
+
+    ASSERT_EQ(trans.close(), 0);
+    ::unlink(device.c_str());
+    ::rmdir(by_id.c_str());
+    ::rmdir(dir_template);
+}
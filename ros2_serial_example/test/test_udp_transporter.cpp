@@ -0,0 +1,317 @@
+#include <gtest/gtest.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "ros2_serial_example/udp_transporter.hpp"
+
+#include "transporter_test_helpers.hpp"
+
+using ros2_to_serial_bridge::transport::Metrics;
+using ros2_to_serial_bridge::transport::UDPTransporter;
+
+/// HELPERS
+
+// Pick a pair of ports that is unlikely to clash with other test runs.
+static uint16_t base_port()
+{
+    return static_cast<uint16_t>(20000 + (::getpid() % 5000) * 8);
+}
+
+/// TESTS
+
+TEST(UDPTransporter, invalid_args)
+{
+    ASSERT_THROW(UDPTransporter("px4", 0, 1, 10, 1024), std::runtime_error);
+    ASSERT_THROW(UDPTransporter("px4", 1, 0, 10, 1024), std::runtime_error);
+    ASSERT_THROW(UDPTransporter("px4", 1, 2, 10, 1024, UDPTransporter::MAX_DATAGRAM_BATCH + 1), std::runtime_error);
+}
+
+TEST(UDPTransporter, invalid_settings)
+{
+    UDPTransporter trans("px4", 1, 2, 10, 1024);
+    ASSERT_EQ(trans.set_remote_address("localhost"), -1);
+    ASSERT_EQ(trans.set_peers({}), -1);
+    ASSERT_EQ(trans.set_peers({UDPTransporter::Peer{"127.0.0.1", 0, {}}}), -1);
+    ASSERT_EQ(trans.set_multicast_group("127.0.0.1"), -1);
+    ASSERT_EQ(trans.set_socket_buffer_sizes(-1, 0), -1);
+
+    ASSERT_EQ(trans.set_remote_address("127.0.0.1"), 0);
+    ASSERT_EQ(trans.set_multicast_group("239.255.0.1"), 0);
+    ASSERT_EQ(trans.set_socket_buffer_sizes(65536, 65536), 0);
+    ASSERT_EQ(trans.set_offload(true), 0);
+}
+
+TEST(UDPTransporter, stream_round_trip)
+{
+    uint16_t port = base_port();
+    UDPTransporter a("cobs", port, port + 1, 10, 1024);
+    ASSERT_EQ(a.init(), 0);
+    UDPTransporter b("cobs", port + 1, port, 10, 1024);
+    ASSERT_EQ(b.init(), 0);
+
+    // With batching, both frames share a datagram.
+    uint8_t payload[]{0x1, 0x0, 0x2};
+    ASSERT_EQ(a.set_write_batching(256), 0);
+    ASSERT_EQ(a.write(0x3, payload, sizeof(payload)), 3);
+    ASSERT_EQ(a.write(0x4, payload, sizeof(payload)), 3);
+    ASSERT_GT(a.flush(), 0);
+
+    std::vector<std::vector<uint8_t>> messages = read_messages(b, 2);
+    ASSERT_EQ(messages.size(), 2U);
+    ASSERT_EQ(messages[0], std::vector<uint8_t>({0x1, 0x0, 0x2, 0x3}));
+    ASSERT_EQ(messages[1], std::vector<uint8_t>({0x1, 0x0, 0x2, 0x4}));
+}
+
+TEST(UDPTransporter, stream_wrap)
+{
+    uint16_t port = base_port() + 6;
+    UDPTransporter a("px4", port, port + 1, 10, 1024);
+    ASSERT_EQ(a.init(), 0);
+    UDPTransporter b("px4", port + 1, port, 10, 64);
+    ASSERT_EQ(b.init(), 0);
+
+    // Each frame is 29 bytes, so in a 64 byte ring buffer the third one
+    // straddles the end and must still arrive whole.
+    uint8_t payload[20]{};
+    for (uint8_t i = 0; i < 5; ++i)
+    {
+        payload[0] = i;
+        ASSERT_EQ(a.write(0x3, payload, sizeof(payload)), 20);
+
+        topic_id_size_t topic_ID = 0;
+        uint8_t buf[32];
+        ssize_t ret = -ENODATA;
+        for (int j = 0; j < 100 && ret == -ENODATA; ++j)
+        {
+            ret = b.read(&topic_ID, buf, sizeof(buf));
+        }
+        ASSERT_EQ(ret, 20);
+        ASSERT_EQ(topic_ID, 0x3);
+        ASSERT_EQ(buf[0], i);
+    }
+}
+
+TEST(UDPTransporter, datagram_round_trip)
+{
+    uint16_t port = base_port() + 2;
+    UDPTransporter a("px4", port, port + 1, 10, 1024, 4);
+    ASSERT_EQ(a.init(), 0);
+    UDPTransporter b("px4", port + 1, port, 10, 1024, 4);
+    ASSERT_EQ(b.init(), 0);
+
+    // More frames than fit in one recvmmsg()/sendmmsg() batch, some of them
+    // written directly and some through the write batch.
+    uint8_t payload[]{0x5, 0x6};
+    for (topic_id_size_t i = 0; i < 3; ++i)
+    {
+        ASSERT_EQ(a.write(i, payload, sizeof(payload)), 2);
+    }
+    ASSERT_EQ(a.set_write_batching(256), 0);
+    for (topic_id_size_t i = 3; i < 10; ++i)
+    {
+        ASSERT_EQ(a.write(i, payload, sizeof(payload)), 2);
+    }
+    ASSERT_GT(a.flush(), 0);
+
+    std::vector<std::vector<uint8_t>> messages = read_messages(b, 10);
+    ASSERT_EQ(messages.size(), 10U);
+    for (topic_id_size_t i = 0; i < 10; ++i)
+    {
+        ASSERT_EQ(messages[i], std::vector<uint8_t>({0x5, 0x6, static_cast<uint8_t>(i)}));
+    }
+
+    // The plain read() still works in datagram mode.
+    topic_id_size_t topic_ID = 0;
+    uint8_t buf[16];
+    ASSERT_EQ(b.write(0x7, payload, sizeof(payload)), 2);
+    ssize_t ret = -ENODATA;
+    for (int i = 0; i < 100 && ret == -ENODATA; ++i)
+    {
+        ret = a.read(&topic_ID, buf, sizeof(buf));
+    }
+    ASSERT_EQ(ret, 2);
+    ASSERT_EQ(topic_ID, 0x7);
+}
+
+TEST(UDPTransporter, peers)
+{
+    for (size_t datagram_batch : {0, 2})
+    {
+        uint16_t port = base_port() + (datagram_batch == 0 ? 0 : 3);
+        UDPTransporter sender("px4", port, port + 1, 10, 1024, datagram_batch);
+        ASSERT_EQ(sender.set_peers({UDPTransporter::Peer{"127.0.0.1", static_cast<uint16_t>(port + 1), {}},
+                                    UDPTransporter::Peer{"127.0.0.1", static_cast<uint16_t>(port + 2), {2, 4}}}), 0);
+        ASSERT_EQ(sender.set_socket_buffer_sizes(65536, 65536), 0);
+        ASSERT_EQ(sender.init(), 0);
+        UDPTransporter all("px4", port + 1, port, 10, 1024, datagram_batch);
+        ASSERT_EQ(all.init(), 0);
+        UDPTransporter some("px4", port + 2, port, 10, 1024, datagram_batch);
+        ASSERT_EQ(some.init(), 0);
+
+        // Topics 0 and 1 are written directly, and 2 to 5 through the batch.
+        uint8_t payload[]{0x9};
+        ASSERT_EQ(sender.write(0, payload, sizeof(payload)), 1);
+        ASSERT_EQ(sender.write(1, payload, sizeof(payload)), 1);
+        ASSERT_EQ(sender.set_write_batching(256), 0);
+        for (topic_id_size_t i = 2; i < 6; ++i)
+        {
+            ASSERT_EQ(sender.write(i, payload, sizeof(payload)), 1);
+        }
+        ASSERT_GT(sender.flush(), 0);
+
+        std::vector<std::vector<uint8_t>> messages = read_messages(all, 6);
+        ASSERT_EQ(messages.size(), 6U);
+        for (topic_id_size_t i = 0; i < 6; ++i)
+        {
+            ASSERT_EQ(messages[i], std::vector<uint8_t>({0x9, static_cast<uint8_t>(i)}));
+        }
+
+        messages = read_messages(some, 2);
+        ASSERT_EQ(messages.size(), 2U);
+        ASSERT_EQ(messages[0], std::vector<uint8_t>({0x9, 0x2}));
+        ASSERT_EQ(messages[1], std::vector<uint8_t>({0x9, 0x4}));
+    }
+}
+
+TEST(UDPTransporter, peer_failure)
+{
+    // Sending to the broadcast address fails without SO_BROADCAST, but the
+    // other peer still gets the frame, so the write succeeds and the missed
+    // peer is counted.
+    uint16_t port = base_port() + 6;
+    UDPTransporter sender("px4", port, port + 1, 10, 1024);
+    ASSERT_EQ(sender.set_peers({UDPTransporter::Peer{"255.255.255.255", static_cast<uint16_t>(port + 1), {}},
+                                UDPTransporter::Peer{"127.0.0.1", static_cast<uint16_t>(port + 1), {}}}), 0);
+    ASSERT_EQ(sender.init(), 0);
+    UDPTransporter receiver("px4", port + 1, port, 10, 1024);
+    ASSERT_EQ(receiver.init(), 0);
+
+    uint8_t payload[]{0x9};
+    ASSERT_EQ(sender.write(0x3, payload, sizeof(payload)), 1);
+    std::vector<std::vector<uint8_t>> messages = read_messages(receiver, 1);
+    ASSERT_EQ(messages.size(), 1U);
+    ASSERT_EQ(messages[0], std::vector<uint8_t>({0x9, 0x3}));
+
+    Metrics::Snapshot snapshot;
+    sender.get_metrics().snapshot(&snapshot);
+    ASSERT_EQ(snapshot.tx.size(), 1U);
+    ASSERT_EQ(snapshot.tx[0].topic_ID, 0x3);
+    ASSERT_EQ(snapshot.tx[0].write_failures, 1U);
+
+    // With only the failing peer, the write fails.
+    UDPTransporter lonely("px4", port + 2, port + 1, 10, 1024);
+    ASSERT_EQ(lonely.set_peers({UDPTransporter::Peer{"255.255.255.255", static_cast<uint16_t>(port + 1), {}},
+                                UDPTransporter::Peer{"255.255.255.255", static_cast<uint16_t>(port + 2), {}}}), 0);
+    ASSERT_EQ(lonely.init(), 0);
+    ASSERT_EQ(lonely.write(0x3, payload, sizeof(payload)), -1);
+}
+
+TEST(UDPTransporter, offload_round_trip)
+{
+    for (bool receiver_offload : {false, true})
+    {
+        uint16_t port = base_port() + (receiver_offload ? 4 : 6);
+        UDPTransporter a("px4", port, port + 1, 10, 1024, 8);
+        ASSERT_EQ(a.set_offload(true), 0);
+        ASSERT_EQ(a.set_socket_buffer_sizes(262144, 262144), 0);
+        ASSERT_EQ(a.init(), 0);
+        ASSERT_EQ(a.set_offload(false), -1);
+        UDPTransporter b("px4", port + 1, port, 10, 1024, 8);
+        ASSERT_EQ(b.set_offload(receiver_offload), 0);
+        ASSERT_EQ(b.set_socket_buffer_sizes(262144, 262144), 0);
+        ASSERT_EQ(b.init(), 0);
+
+        // Runs of equal sized frames, broken up by larger and smaller ones,
+        // and more of them than fit in one sendmmsg() batch; every frame
+        // must still arrive in its own datagram, in order.
+        ASSERT_EQ(a.set_write_batching(8192), 0);
+        uint8_t payload[40]{};
+        std::vector<size_t> lengths;
+        for (size_t i = 0; i < 100; ++i)
+        {
+            size_t len = (i % 30 == 29) ? 40 : (i % 17 == 16) ? 3 : 10;
+            lengths.push_back(len);
+            payload[0] = static_cast<uint8_t>(i);
+            ASSERT_EQ(a.write(static_cast<topic_id_size_t>(i % 7), payload, len), static_cast<ssize_t>(len));
+        }
+        ASSERT_GT(a.flush(), 0);
+
+        std::vector<std::vector<uint8_t>> messages = read_messages(b, lengths.size());
+        ASSERT_EQ(messages.size(), lengths.size());
+        for (size_t i = 0; i < lengths.size(); ++i)
+        {
+            ASSERT_EQ(messages[i].size(), lengths[i] + 1);
+            ASSERT_EQ(messages[i][0], static_cast<uint8_t>(i));
+            ASSERT_EQ(messages[i].back(), static_cast<uint8_t>(i % 7));
+        }
+    }
+}
+
+TEST(UDPTransporter, kernel_timestamps)
+{
+    for (size_t datagram_batch : {0, 8})
+    {
+        uint16_t port = base_port();
+        UDPTransporter a("cobs", port, port + 1, 10, 1024, datagram_batch);
+        ASSERT_EQ(a.init(), 0);
+        UDPTransporter b("cobs", port + 1, port, 10, 1024, datagram_batch);
+        ASSERT_EQ(b.set_kernel_timestamps(true), 0);
+        ASSERT_EQ(b.init(), 0);
+        ASSERT_EQ(b.set_kernel_timestamps(false), -1);
+
+        // The messages sit in the socket for a while before they are read,
+        // which the receive times must not include.
+        std::chrono::system_clock::time_point sent = std::chrono::system_clock::now();
+        uint8_t payload[]{0x1, 0x0, 0x2};
+        ASSERT_EQ(a.write(0x3, payload, sizeof(payload)), 3);
+        ASSERT_EQ(a.write(0x4, payload, sizeof(payload)), 3);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        std::chrono::system_clock::time_point reading = std::chrono::system_clock::now();
+
+        std::vector<std::chrono::system_clock::time_point> times;
+        uint8_t buf[64];
+        for (int i = 0; i < 100 && times.size() < 2; ++i)
+        {
+            b.read_many(buf, sizeof(buf), [&](topic_id_size_t, uint8_t *, size_t)
+            {
+                times.push_back(b.get_receive_time());
+            });
+        }
+        ASSERT_EQ(times.size(), 2U);
+        for (const std::chrono::system_clock::time_point & time : times)
+        {
+            ASSERT_GE(time, sent);
+            ASSERT_LT(time, reading);
+        }
+    }
+}
+
+TEST(UDPTransporter, connected_refused)
+{
+    // Nothing listens on the peer's port, so the single peer's connected
+    // socket gets an ICMP port unreachable back; that must not fail the
+    // writes that come after it.
+    uint16_t port = base_port() + 5;
+    for (size_t datagram_batch : {0, 2})
+    {
+        UDPTransporter a("px4", port, port + 1, 10, 1024, datagram_batch);
+        ASSERT_EQ(a.init(), 0);
+
+        uint8_t payload[]{0x1};
+        ASSERT_EQ(a.write(0x1, payload, sizeof(payload)), 1);
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        ASSERT_EQ(a.write(0x1, payload, sizeof(payload)), 1);
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        ASSERT_EQ(a.set_write_batching(256), 0);
+        ASSERT_EQ(a.write(0x1, payload, sizeof(payload)), 1);
+        ASSERT_EQ(a.write(0x2, payload, sizeof(payload)), 1);
+        ASSERT_GT(a.flush(), 0);
+    }
+}
@@ -0,0 +1,288 @@
+// Copyright 2019 Open Source Robotics Foundation, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gtest/gtest.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "ros2_serial_example/ring_buffer.hpp"
+#include "ros2_serial_example/uring_io.hpp"
+
+using ros2_to_serial_bridge::transport::impl::RingBuffer;
+using ros2_to_serial_bridge::transport::impl::UringIo;
+
+/// HELPERS
+
+namespace
+{
+
+// io_uring may be missing or disabled where the tests run, in which case
+// there is nothing to test.
+bool uring_available()
+{
+    RingBuffer ringbuf(16);
+    try
+    {
+        UringIo io(-1, STDOUT_FILENO, &ringbuf, 0);
+    }
+    catch (const std::runtime_error & e)
+    {
+        ::fprintf(stderr, "Skipping, io_uring isn't available: %s\n", e.what());
+        return false;
+    }
+    return true;
+}
+
+class PipeFixture : public testing::Test
+{
+public:
+    void SetUp() override
+    {
+        ASSERT_EQ(::pipe2(fds_, O_NONBLOCK | O_CLOEXEC), 0);
+    }
+
+    void TearDown() override
+    {
+        for (int fd : fds_)
+        {
+            if (fd >= 0)
+            {
+                ::close(fd);
+            }
+        }
+    }
+
+protected:
+    int fds_[2]{-1, -1};
+};
+
+}  // namespace
+
+/// TESTS
+
+TEST_F(PipeFixture, read)
+{
+    if (!uring_available())
+    {
+        return;
+    }
+
+    RingBuffer ringbuf(64);
+    UringIo io(fds_[0], -1, &ringbuf, 0);
+    ASSERT_GE(io.get_fd(), 0);
+    ASSERT_EQ(io.read(0), 0);
+
+    uint8_t data[5]{0x1, 0x2, 0x3, 0x4, 0x5};
+    ASSERT_EQ(::write(fds_[1], data, sizeof(data)), static_cast<ssize_t>(sizeof(data)));
+    ASSERT_EQ(io.read(1000), static_cast<ssize_t>(sizeof(data)));
+
+    uint8_t out[5]{};
+    ASSERT_EQ(ringbuf.memcpy_from(out, sizeof(out)), static_cast<ssize_t>(sizeof(out)));
+    ASSERT_EQ(::memcmp(out, data, sizeof(data)), 0);
+
+    // Nothing more arrives before the timeout.
+    ASSERT_EQ(io.read(10), 0);
+}
+
+TEST_F(PipeFixture, read_wraps)
+{
+    if (!uring_available())
+    {
+        return;
+    }
+
+    RingBuffer ringbuf(16);
+    UringIo io(fds_[0], -1, &ringbuf, 0);
+
+    uint8_t data[10];
+    for (size_t i = 0; i < sizeof(data); ++i)
+    {
+        data[i] = static_cast<uint8_t>(i);
+    }
+    ASSERT_EQ(::write(fds_[1], data, sizeof(data)), static_cast<ssize_t>(sizeof(data)));
+    ASSERT_EQ(io.read(1000), 10);
+    ASSERT_EQ(ringbuf.discard(10), 10);
+
+    // The next read was posted for the 6 bytes up to the end of the ring, so
+    // the rest comes in with the read after that.
+    ASSERT_EQ(::write(fds_[1], data, sizeof(data)), static_cast<ssize_t>(sizeof(data)));
+    ASSERT_EQ(io.read(1000), 6);
+    ASSERT_EQ(io.read(1000), 4);
+
+    uint8_t out[10]{};
+    ASSERT_EQ(ringbuf.memcpy_from(out, sizeof(out)), static_cast<ssize_t>(sizeof(out)));
+    ASSERT_EQ(::memcmp(out, data, sizeof(data)), 0);
+}
+
+TEST_F(PipeFixture, hang_up)
+{
+    if (!uring_available())
+    {
+        return;
+    }
+
+    RingBuffer ringbuf(64);
+    UringIo io(fds_[0], -1, &ringbuf, 0);
+
+    uint8_t data[3]{0x1, 0x2, 0x3};
+    ASSERT_EQ(::write(fds_[1], data, sizeof(data)), static_cast<ssize_t>(sizeof(data)));
+    ASSERT_EQ(io.read(1000), 3);
+
+    ::close(fds_[1]);
+    fds_[1] = -1;
+    ssize_t ret = 0;
+    for (int i = 0; i < 10 && ret == 0; ++i)
+    {
+        ret = io.read(100);
+    }
+    ASSERT_EQ(ret, -1);
+    ASSERT_EQ(errno, EIO);
+    ASSERT_EQ(io.read(0), -1);
+}
+
+TEST_F(PipeFixture, cancel)
+{
+    if (!uring_available())
+    {
+        return;
+    }
+
+    RingBuffer ringbuf(64);
+    {
+        UringIo io(fds_[0], -1, &ringbuf, 0);
+    }
+
+    // The read posted by the UringIo is gone, so the data stays in the pipe.
+    uint8_t data[3]{0x1, 0x2, 0x3};
+    ASSERT_EQ(::write(fds_[1], data, sizeof(data)), static_cast<ssize_t>(sizeof(data)));
+    uint8_t out[3]{};
+    ASSERT_EQ(::read(fds_[0], out, sizeof(out)), static_cast<ssize_t>(sizeof(out)));
+    ASSERT_EQ(ringbuf.bytes_used(), 0U);
+}
+
+TEST(UringIo, writev)
+{
+    if (!uring_available())
+    {
+        return;
+    }
+
+    int fds[2];
+    ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds), 0);
+    UringIo io(-1, fds[0], nullptr, 0);
+    ASSERT_EQ(io.get_fd(), -1);
+
+    uint8_t a[3]{0x1, 0x2, 0x3};
+    uint8_t b[2]{0x4, 0x5};
+    struct iovec iov[2]{{a, sizeof(a)}, {b, sizeof(b)}};
+    size_t written = 0;
+    ASSERT_EQ(io.writev(iov, 2, 100, &written), 5);
+    ASSERT_EQ(written, 5U);
+
+    uint8_t out[5]{};
+    ASSERT_EQ(::read(fds[1], out, sizeof(out)), 5);
+    uint8_t expected[5]{0x1, 0x2, 0x3, 0x4, 0x5};
+    ASSERT_EQ(::memcmp(out, expected, sizeof(out)), 0);
+
+    ::close(fds[0]);
+    ::close(fds[1]);
+}
+
+TEST(UringIo, write_timeout)
+{
+    if (!uring_available())
+    {
+        return;
+    }
+
+    int fds[2];
+    ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds), 0);
+    UringIo io(-1, fds[0], nullptr, 0);
+
+    // Nothing reads the other end, so the socket eventually fills up.
+    std::vector<uint8_t> payload(4096, 0x5);
+    struct iovec iov{payload.data(), payload.size()};
+    size_t written = 0;
+    ssize_t ret = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 10000 && ret >= 0; ++i)
+    {
+        start = std::chrono::steady_clock::now();
+        ret = io.writev(&iov, 1, 20, &written);
+    }
+    ASSERT_EQ(ret, -1);
+    ASSERT_EQ(errno, EBUSY);
+    ASSERT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(15));
+
+    ::close(fds[0]);
+    ::close(fds[1]);
+}
+
+TEST(UringIo, datagrams)
+{
+    if (!uring_available())
+    {
+        return;
+    }
+
+    int recv_fd = ::socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    int send_fd = ::socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    ASSERT_GE(recv_fd, 0);
+    ASSERT_GE(send_fd, 0);
+    struct sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_EQ(::bind(recv_fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)), 0);
+    socklen_t addr_len = sizeof(addr);
+    ASSERT_EQ(::getsockname(recv_fd, reinterpret_cast<struct sockaddr *>(&addr), &addr_len), 0);
+
+    // Move the head of the ring close to its end, so that the datagram has
+    // to wrap; it is still received whole through the bounce buffer.
+    RingBuffer ringbuf(16);
+    uint8_t filler[12]{};
+    ASSERT_EQ(ringbuf.write(filler, sizeof(filler)), 12);
+    ASSERT_EQ(ringbuf.discard(12), 12);
+    UringIo io(recv_fd, send_fd, &ringbuf, 16);
+
+    uint8_t data[8]{0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7, 0x8};
+    struct iovec iov{data, sizeof(data)};
+    struct msghdr msg{};
+    msg.msg_name = &addr;
+    msg.msg_namelen = sizeof(addr);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    ASSERT_EQ(io.sendmsg(&msg, 100), static_cast<ssize_t>(sizeof(data)));
+
+    ASSERT_EQ(io.read(1000), static_cast<ssize_t>(sizeof(data)));
+    uint8_t out[8]{};
+    ASSERT_EQ(ringbuf.memcpy_from(out, sizeof(out)), static_cast<ssize_t>(sizeof(out)));
+    ASSERT_EQ(::memcmp(out, data, sizeof(data)), 0);
+
+    ::close(recv_fd);
+    ::close(send_fd);
+}
@@ -0,0 +1,129 @@
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ros2_serial_example/usb_transporter.hpp"
+
+using ros2_to_serial_bridge::transport::USBTransporter;
+
+/// FIXTURES
+
+// Builds a fake /sys/bus/usb/devices in a temporary directory.
+class FakeSysfsFixture : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        char dir[] = "/tmp/test_usb_transporter_XXXXXX";
+        ASSERT_NE(::mkdtemp(dir), nullptr);
+        root_ = dir;
+    }
+
+    void TearDown() override
+    {
+        for (auto it = paths_.rbegin(); it != paths_.rend(); ++it)
+        {
+            ::remove(it->c_str());
+        }
+        ::rmdir(root_.c_str());
+    }
+
+    void make_dir(const std::string & path)
+    {
+        ::mkdir((root_ + "/" + path).c_str(), 0755);
+        paths_.push_back(root_ + "/" + path);
+    }
+
+    void make_file(const std::string & path, const std::string & contents)
+    {
+        std::ofstream(root_ + "/" + path) << contents << "\n";
+        paths_.push_back(root_ + "/" + path);
+    }
+
+    void make_endpoint(const std::string & intf, const std::string & ep, const std::string & type,
+                       const std::string & direction, const std::string & packet_size)
+    {
+        make_dir(intf + "/" + ep);
+        make_file(intf + "/" + ep + "/type", type);
+        make_file(intf + "/" + ep + "/direction", direction);
+        make_file(intf + "/" + ep + "/wMaxPacketSize", packet_size);
+    }
+
+    // A CDC-ACM device, with the notification endpoint on interface 0 and
+    // the bulk endpoints on interface 1.
+    void make_cdc_device(const std::string & name, const std::string & product, const std::string & serial,
+                         const std::string & devnum)
+    {
+        make_dir(name);
+        make_file(name + "/idVendor", "0483");
+        make_file(name + "/idProduct", product);
+        make_file(name + "/serial", serial);
+        make_file(name + "/busnum", "1");
+        make_file(name + "/devnum", devnum);
+        make_file(name + "/bConfigurationValue", "1");
+        make_dir(name + ":1.0");
+        make_endpoint(name + ":1.0", "ep_82", "Interrupt", "in", "0008");
+        make_dir(name + ":1.1");
+        make_endpoint(name + ":1.1", "ep_01", "Bulk", "out", "0200");
+        make_endpoint(name + ":1.1", "ep_81", "Bulk", "in", "0200");
+    }
+
+    std::string root_;
+    std::vector<std::string> paths_;
+};
+
+/// TESTS
+
+TEST(USBTransporter, invalid_args)
+{
+    ASSERT_THROW(USBTransporter("px4", 0x0483, 0x5740, "", 1, 10, 1024, 0, 4096), std::runtime_error);
+    ASSERT_THROW(USBTransporter("px4", 0x0483, 0x5740, "", 1, 10, 1024, USBTransporter::MAX_TRANSFERS + 1, 4096),
+                 std::runtime_error);
+    ASSERT_THROW(USBTransporter("px4", 0x0483, 0x5740, "", 1, 10, 1024, 4, 0), std::runtime_error);
+
+    ASSERT_NO_THROW(USBTransporter("px4", 0x0483, 0x5740, "", 1, 10, 1024, 4, 4096));
+}
+
+TEST(USBTransporter, no_device)
+{
+    // Nothing should have these IDs.
+    USBTransporter trans("px4", 0xffff, 0xfffe, "", 1, 10, 1024, 4, 4096);
+    ASSERT_EQ(trans.init(), -1);
+    ASSERT_EQ(trans.get_read_fd(), -1);
+    uint8_t buf[8]{};
+    ASSERT_EQ(trans.write(1, buf, sizeof(buf)), -1);
+}
+
+TEST_F(FakeSysfsFixture, find_device)
+{
+    make_dir("usb1");
+    make_file("usb1/idVendor", "1d6b");
+    make_file("usb1/idProduct", "0002");
+    make_cdc_device("1-2", "5740", "ABC", "4");
+    make_cdc_device("1-3", "5740", "DEF", "12");
+
+    USBTransporter::Device device;
+    ASSERT_EQ(USBTransporter::find_device(root_, 0x0483, 0x5740, "DEF", 1, &device), 0);
+    ASSERT_EQ(device.path, "/dev/bus/usb/001/012");
+    ASSERT_EQ(device.in_endpoint, 0x81);
+    ASSERT_EQ(device.out_endpoint, 0x01);
+    ASSERT_EQ(device.out_packet_size, 512U);
+
+    // Without a serial number, either device will do.
+    ASSERT_EQ(USBTransporter::find_device(root_, 0x0483, 0x5740, "", 1, &device), 0);
+    ASSERT_EQ(device.in_endpoint, 0x81);
+
+    // The communications interface has no bulk endpoints.
+    ASSERT_EQ(USBTransporter::find_device(root_, 0x0483, 0x5740, "ABC", 0, &device), -1);
+
+    ASSERT_EQ(USBTransporter::find_device(root_, 0x0483, 0x5740, "GHI", 1, &device), -1);
+    ASSERT_EQ(USBTransporter::find_device(root_, 0x0483, 0x5741, "", 1, &device), -1);
+    ASSERT_EQ(USBTransporter::find_device(root_ + "/missing", 0x0483, 0x5740, "", 1, &device), -1);
+}
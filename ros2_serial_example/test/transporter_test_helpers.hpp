@@ -0,0 +1,91 @@
+#ifndef ROS2_SERIAL_EXAMPLE__TEST__TRANSPORTER_TEST_HELPERS_HPP_
+#define ROS2_SERIAL_EXAMPLE__TEST__TRANSPORTER_TEST_HELPERS_HPP_
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+
+#include "ros2_serial_example/transporter.hpp"
+
+// How long the helpers below wait for what they read before giving up.
+constexpr std::chrono::milliseconds READ_TIMEOUT{1000};
+
+// Wait until the transporter may have something new to read, for at most
+// timeout: on its read fd if it has one, or else for a moment, since it then
+// waits inside of read() itself if it waits at all.
+inline void wait_readable(ros2_to_serial_bridge::transport::Transporter & trans, std::chrono::milliseconds timeout)
+{
+    int fd = trans.get_read_fd();
+    if (fd < 0)
+    {
+        std::this_thread::sleep_for(std::min(timeout, std::chrono::milliseconds(1)));
+        return;
+    }
+
+    struct pollfd pfd{};
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    ::poll(&pfd, 1, static_cast<int>(timeout.count()));
+}
+
+// The time left until deadline, but no more than 10 ms, so that a
+// transporter whose fd doesn't show everything it has is still read again
+// soon.
+inline std::chrono::milliseconds time_left(std::chrono::steady_clock::time_point deadline)
+{
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+    return std::max(std::chrono::milliseconds(0), std::min(left, std::chrono::milliseconds(10)));
+}
+
+// Read until a complete message arrives, giving up after READ_TIMEOUT.
+// Returns what read() returned for it (a message may be empty), or -ENODATA
+// if none came.
+inline ssize_t read_message(ros2_to_serial_bridge::transport::Transporter & trans, topic_id_size_t *topic_ID,
+                            uint8_t *buffer, size_t len)
+{
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + READ_TIMEOUT;
+    while (true)
+    {
+        ssize_t ret = trans.read(topic_ID, buffer, len);
+        if (ret != -ENODATA || std::chrono::steady_clock::now() >= deadline)
+        {
+            return ret;
+        }
+        wait_readable(trans, time_left(deadline));
+    }
+}
+
+// Read until the expected number of messages arrive, giving up after
+// READ_TIMEOUT or at the first error.  Each message has the low byte of its
+// topic ID appended.
+inline std::vector<std::vector<uint8_t>> read_messages(ros2_to_serial_bridge::transport::Transporter & trans,
+                                                       size_t expected)
+{
+    std::vector<std::vector<uint8_t>> messages;
+    std::vector<uint8_t> buf(1024);
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + READ_TIMEOUT;
+    while (messages.size() < expected)
+    {
+        ssize_t ret = trans.read_many(buf.data(), buf.size(), [&messages](topic_id_size_t topic_ID, uint8_t *buffer, size_t length)
+        {
+            messages.emplace_back(buffer, buffer + length);
+            messages.back().push_back(static_cast<uint8_t>(topic_ID));
+        });
+        if (ret < 0 || std::chrono::steady_clock::now() >= deadline)
+        {
+            break;
+        }
+        if (ret == 0)
+        {
+            wait_readable(trans, time_left(deadline));
+        }
+    }
+    return messages;
+}
+
+#endif